@@ -80,7 +80,7 @@ closure_func_basic(value_handler, void, azure_instance_md_vh,
     tuple md = 0;
     parser p = json_parser(azure.h, stack_closure(azure_instance_md_parsed, &md),
                            stack_closure_func(parse_error, azure_instance_md_err));
-    p = parser_feed(p, content);
+    p = json_parser_feed(p, content);
     p = apply(p, CHARACTER_INVALID);
     json_parser_free(p);
     if (md) {
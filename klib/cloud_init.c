@@ -36,6 +36,7 @@ typedef struct cloud_download_cfg {
     struct buffer server_path;
     boolean tls;
     boolean optional;   /* if true, a download error is not fatal */
+    boolean background; /* if true, application startup does not wait for the download */
     boolean done;
     buffer auth_header;
     closure_struct(cloud_download_task, task);
@@ -61,12 +62,15 @@ declare_closure_struct(2, 2, boolean, cloud_download_env_recv,
 typedef struct cloud_download_env_cfg {
     struct cloud_download_cfg download;
     vector attribute_path;
+    buffer cache_path;  /* file where the server response is saved for subsequent boots */
+    closure_struct(cloud_init_task, task);
     closure_struct(cloud_download_setenv, setenv);
     closure_struct(cloud_download_env_recv, recv);
     closure_struct(thunk, cleanup);
 } *cloud_download_env;
 
 static heap cloud_heap;
+static closure_struct(status_handler, cloud_background_complete);
 
 static enum cloud cloud_detect(void)
 {
@@ -148,7 +152,7 @@ static int cloud_download_parse(tuple config, cloud_download_cfg parsed_cfg)
         parsed_cfg->server_host.end = parsed_cfg->server_host.start + host_end;
     }
     parsed_cfg->server_host.wrapped = true;
-    parsed_cfg->optional = parsed_cfg->done = false;
+    parsed_cfg->optional = parsed_cfg->background = parsed_cfg->done = false;
     parsed_cfg->auth_header = get(config, sym(auth));
     return KLIB_INIT_OK;
 }
@@ -478,7 +482,17 @@ define_closure_function(2, 2, void, cloud_download_task,
     cloud_download_cfg cfg = struct_from_field(closure_self(), cloud_download_cfg, task);
     switch (op) {
     case CLOUD_INIT_TASK_OP_START:
-        cloud_download_start(cfg, bound(recv), arg);
+        if (cfg->done) {
+            /* the download has been done in a previous boot */
+            apply((status_handler)arg, STATUS_OK);
+            apply(bound(cleanup));
+        } else if (cfg->background) {
+            apply((status_handler)arg, STATUS_OK);
+            cloud_download_start(cfg, bound(recv),
+                                 (status_handler)&cloud_background_complete);
+        } else {
+            cloud_download_start(cfg, bound(recv), arg);
+        }
         break;
     case CLOUD_INIT_TASK_OP_DELETE:
         apply(bound(cleanup));
@@ -521,9 +535,19 @@ static int cloud_download_file_parse(tuple config, vector tasks)
             parsed_cfg->download.done = true;
     }
     fsfile_release(f);
+    parsed_cfg->download.background = (get(config, sym(background)) != 0);
     return KLIB_INIT_OK;
 }
 
+closure_func_basic(status_handler, void, cloud_download_background_done,
+                   status s)
+{
+    if (!is_ok(s)) {
+        msg_err("background download failed: %v\n", s);
+        timm_dealloc(s);
+    }
+}
+
 closure_function(1, 2, boolean, cloud_download_env_each,
                  tuple, env,
                  value k, value v)
@@ -569,6 +593,48 @@ closure_function(1, 1, void, cloud_download_env_err,
         *bound(result) = timm("result", "failed to parse JSON: %b", data);
 }
 
+static void cloud_download_env_apply(cloud_download_env cfg, buffer content, status *s)
+{
+    parser p = json_parser(cloud_heap, stack_closure(cloud_download_env_set, cfg, s),
+                           stack_closure(cloud_download_env_err, s));
+    p = json_parser_feed(p, content);
+    p = apply(p, CHARACTER_INVALID);
+    json_parser_free(p);
+}
+
+closure_function(2, 2, void, cloud_download_env_cache_saved,
+                 fsfile, f, buffer, content,
+                 status s, bytes len)
+{
+    if (!is_ok(s)) {
+        msg_err("failed to save download_env cache: %v\n", s);
+        timm_dealloc(s);
+    }
+    deallocate_buffer(bound(content));
+    fsfile_release(bound(f));
+    closure_finish();
+}
+
+static void cloud_download_env_cache_save(cloud_download_env cfg, buffer content)
+{
+    buffer b = clone_buffer(cloud_heap, content);
+    if (b == INVALID_ADDRESS)
+        return;
+    fsfile f = fsfile_open_or_create(buffer_to_sstring(cfg->cache_path), true);
+    if (!f)
+        goto err_open;
+    io_status_handler io_sh = closure(cloud_heap, cloud_download_env_cache_saved, f, b);
+    if (io_sh == INVALID_ADDRESS)
+        goto err_closure;
+    filesystem_write_linear(f, buffer_ref(b, 0), irangel(0, buffer_length(b)), io_sh);
+    return;
+  err_closure:
+    fsfile_release(f);
+  err_open:
+    deallocate_buffer(b);
+    msg_err("failed to save download_env cache '%b'\n", cfg->cache_path);
+}
+
 define_closure_function(1, 1, void, cloud_download_setenv,
                         status *, s,
                         value v)
@@ -582,12 +648,10 @@ define_closure_function(1, 1, void, cloud_download_setenv,
                          start_line);
         goto done;
     }
-    status *s = bound(s);
-    parser p = json_parser(cloud_heap, stack_closure(cloud_download_env_set, cfg, s),
-                           stack_closure(cloud_download_env_err, s));
-    p = parser_feed(p, get_string(v, sym(content)));
-    p = apply(p, CHARACTER_INVALID);
-    json_parser_free(p);
+    buffer content = get_string(v, sym(content));
+    cloud_download_env_apply(cfg, content, bound(s));
+    if (cfg->cache_path && (*bound(s) == STATUS_OK) && content)
+        cloud_download_env_cache_save(cfg, content);
   done:
     cfg->download.done = true;
 }
@@ -632,6 +696,67 @@ closure_func_basic(thunk, void, cloud_download_env_cleanup)
     deallocate(cloud_heap, cfg, sizeof(*cfg));
 }
 
+closure_function(4, 2, void, cloud_download_env_cache_read,
+                 cloud_download_env, cfg, fsfile, f, buffer, content, status_handler, sh,
+                 status s, bytes len)
+{
+    cloud_download_env cfg = bound(cfg);
+    buffer content = bound(content);
+    cloud_init_task task = (cloud_init_task)&cfg->download.task;
+    fsfile_release(bound(f));
+    if (is_ok(s)) {
+        buffer_produce(content, len);
+        cloud_download_env_apply(cfg, content, &s);
+    }
+    deallocate_buffer(content);
+    if (is_ok(s)) {
+        apply(bound(sh), s);
+        apply(task, CLOUD_INIT_TASK_OP_DELETE, 0);
+    } else {
+        /* invalid cache contents: retrieve the environment from the server */
+        msg_err("failed to load download_env cache '%b': %v\n", cfg->cache_path, s);
+        timm_dealloc(s);
+        apply(task, CLOUD_INIT_TASK_OP_START, bound(sh));
+    }
+    closure_finish();
+}
+
+/* Loads the environment from the cache file (if present), so that it is not retrieved again from
+ * the server on subsequent boots. */
+static boolean cloud_download_env_cache_load(cloud_download_env cfg, status_handler sh)
+{
+    fsfile f = fsfile_open(buffer_to_sstring(cfg->cache_path));
+    if (!f)
+        return false;
+    u64 len = fsfile_get_length(f);
+    if (len == 0)
+        goto err_buf;
+    buffer content = allocate_buffer(cloud_heap, len);
+    if (content == INVALID_ADDRESS)
+        goto err_buf;
+    io_status_handler io_sh = closure(cloud_heap, cloud_download_env_cache_read, cfg, f, content,
+                                      sh);
+    if (io_sh == INVALID_ADDRESS)
+        goto err_closure;
+    filesystem_read_linear(f, buffer_ref(content, 0), irangel(0, len), io_sh);
+    return true;
+  err_closure:
+    deallocate_buffer(content);
+  err_buf:
+    fsfile_release(f);
+    return false;
+}
+
+closure_func_basic(cloud_init_task, void, cloud_download_env_task,
+                   enum cloud_init_task_op op, void *arg)
+{
+    cloud_download_env cfg = struct_from_field(closure_self(), cloud_download_env, task);
+    if ((op == CLOUD_INIT_TASK_OP_START) && cfg->cache_path &&
+        cloud_download_env_cache_load(cfg, arg))
+        return;
+    apply((cloud_init_task)&cfg->download.task, op, arg);
+}
+
 static int cloud_download_env_parse(tuple config, vector tasks)
 {
     cloud_download_env cfg = allocate(cloud_heap, sizeof(*cfg));
@@ -639,7 +764,9 @@ static int cloud_download_env_parse(tuple config, vector tasks)
     download_recv recv = init_closure(&cfg->recv, cloud_download_env_recv,
                                       INVALID_ADDRESS, STATUS_OK);
     thunk cleanup = init_closure_func(&cfg->cleanup, thunk, cloud_download_env_cleanup);
-    vector_push(tasks, init_closure(&cfg->download.task, cloud_download_task, recv, cleanup));
+    init_closure(&cfg->download.task, cloud_download_task, recv, cleanup);
+    vector_push(tasks, init_closure_func(&cfg->task, cloud_init_task, cloud_download_env_task));
+    cfg->cache_path = 0;
     int ret = cloud_download_parse(config, &cfg->download);
     if (ret != KLIB_INIT_OK)
         return ret;
@@ -653,12 +780,21 @@ static int cloud_download_env_parse(tuple config, vector tasks)
     } else {
         cfg->attribute_path = 0;
     }
+    value cache = get(config, sym(cache));
+    if (cache) {
+        if (!is_string(cache)) {
+            rprintf("download_env: invalid cache %v\n", cache);
+            return KLIB_INIT_FAILED;
+        }
+        cfg->cache_path = cache;
+    }
     return KLIB_INIT_OK;
 }
 
 int init(status_handler complete)
 {
     cloud_heap = heap_locked(get_kernel_heaps());
+    init_closure_func(&cloud_background_complete, status_handler, cloud_download_background_done);
     enum cloud c = cloud_detect();
     switch (c) {
     case CLOUD_ERROR:
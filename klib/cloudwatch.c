@@ -16,6 +16,10 @@
 
 #define CW_LOG_MAX_ENTRIES  8192
 
+/* Console writes are queued in a ring, which is drained into the log entry vector when log events
+ * are posted, so that writers do not contend with the (possibly slow) posting of log events. */
+#define CW_LOG_RING_SIZE    (256 * KB)
+
 declare_closure_struct(1, 1, void, cw_aws_cred_handler,
                        status_handler, complete,
                        aws_cred cred);
@@ -43,6 +47,8 @@ static struct cw {
     char log_servername[64];
     bytes log_servername_len;
     buffer log_group, log_stream, log_seq_token;
+    ringbuf log_ring;
+    boolean log_timer_armed;
     vector log_entries;
     int log_pending;
     closure_struct(connection_handler, log_conn_handler);
@@ -178,14 +184,20 @@ static void cw_connect(sstring server, void (*handler)(const ip_addr_t *server))
     }
 }
 
-static void cw_log_send_async(void)
+static void cw_log_timer_arm(void)
 {
-    if ((cw.log_pending == 0) && (vector_length(cw.log_entries) > 0) &&
-        !timer_is_active(&cw.log_timer))
+    if (!cw.log_timer_armed && compare_and_swap_boolean(&cw.log_timer_armed, false, true))
         register_timer(kernel_timers, &cw.log_timer, CLOCK_ID_MONOTONIC, seconds(10), false, 0,
                        (timer_handler)&cw.log_timer_handler);
 }
 
+static void cw_log_send_async(void)
+{
+    if ((cw.log_pending == 0) &&
+        ((vector_length(cw.log_entries) > 0) || (ringbuf_length_sync(cw.log_ring) > 0)))
+        cw_log_timer_arm();
+}
+
 closure_function(1, 1, void, cw_logstream_vh,
                  boolean, parsed,
                  value v)
@@ -599,22 +611,40 @@ closure_func_basic(timer_handler, void, cw_metrics_timer_handler,
     cw_connect(isstring(cw.servername, cw.servername_len), cw_metrics_send);
 }
 
+/* Console writes are serialized by the console layer, so this is the only producer of the ring. */
 static void cw_log_write(void *d, const char *s, bytes count)
 {
-    if (count == 0)
+    ringbuf r = cw.log_ring;
+    struct cw_log_entry e;
+    if ((count == 0) || (ringbuf_space_sync(r) < sizeof(e) + count))
         return;
-    spin_lock(&cw.lock);
-    if (vector_length(cw.log_entries) < CW_LOG_MAX_ENTRIES) {
-        cw_log_entry e = allocate(cw.h, sizeof(*e) + count);
-        if (e != INVALID_ADDRESS) {
-            e->t = kern_now(CLOCK_ID_REALTIME);
-            e->msg_len = count;
-            runtime_memcpy(e->msg, s, count);
-            vector_push(cw.log_entries, e);
-        }
+    e.t = kern_now(CLOCK_ID_REALTIME);
+    e.msg_len = count;
+    ringbuf_stage(r, 0, &e, sizeof(e));
+    ringbuf_stage(r, sizeof(e), s, count);
+    ringbuf_publish(r, sizeof(e) + count);
+    cw_log_timer_arm();
+}
+
+/* Moves the entries queued in the ring to the log entry vector; entries that do not fit in the
+ * vector stay in the ring until the next post. */
+static void cw_log_drain(void)
+{
+    ringbuf r = cw.log_ring;
+    bytes avail = ringbuf_length_sync(r);
+    while ((avail > 0) && (vector_length(cw.log_entries) < CW_LOG_MAX_ENTRIES)) {
+        struct cw_log_entry hdr;
+        ringbuf_peek(r, &hdr, sizeof(hdr));
+        cw_log_entry e = allocate(cw.h, sizeof(*e) + hdr.msg_len);
+        if (e == INVALID_ADDRESS)
+            break;
+        ringbuf_release(r, sizeof(hdr));
+        *e = hdr;
+        ringbuf_peek(r, e->msg, e->msg_len);
+        ringbuf_release(r, e->msg_len);
+        vector_push(cw.log_entries, e);
+        avail -= sizeof(hdr) + hdr.msg_len;
     }
-    cw_log_send_async();
-    spin_unlock(&cw.lock);
 }
 
 static void cw_log_connect(const ip_addr_t *server)
@@ -649,8 +679,10 @@ static void cw_log_pending_delete(void)
 {
     spin_lock(&cw.lock);
     int log_entries = cw.log_pending;
-    for (int i = 0; i < log_entries; i++)
-        deallocate(cw.h, vector_get(cw.log_entries, i), sizeof(struct cw_log_entry));
+    for (int i = 0; i < log_entries; i++) {
+        cw_log_entry e = vector_get(cw.log_entries, i);
+        deallocate(cw.h, e, sizeof(*e) + e->msg_len);
+    }
     vector_delete_range(cw.log_entries, 0, log_entries);
     spin_unlock(&cw.lock);
 }
@@ -788,10 +820,15 @@ static void cw_log_post(void)
 
 static void cw_log_send(void)
 {
-    if (!cw.log_out)
+    if (!cw.log_out) {
         cw_connect(isstring(cw.log_servername, cw.log_servername_len), cw_log_connect);
-    else
-        cw_log_post();
+    } else {
+        cw_log_drain();
+        if (vector_length(cw.log_entries) > 0)
+            cw_log_post();
+        else
+            cw_log_send_async();
+    }
 }
 
 closure_func_basic(connection_handler, input_buffer_handler, cw_log_conn_handler,
@@ -801,6 +838,7 @@ closure_func_basic(connection_handler, input_buffer_handler, cw_log_conn_handler
     spin_lock(&cw.lock);
     if (out && !cw.log_out) {
         cw.log_out = out;
+        cw_log_drain();
         cw_log_post();
         ibh = (input_buffer_handler)&cw.log_in_handler;
     } else {
@@ -816,8 +854,10 @@ closure_func_basic(timer_handler, void, cw_log_timer_handler,
 {
     if (overruns == timer_disabled)
         return;
+    cw.log_timer_armed = false;
+    memory_barrier();
     spin_lock(&cw.lock);
-    if (cw.log_inited)
+    if (cw.log_inited && (cw.log_pending == 0))
         cw_log_send();
     spin_unlock(&cw.lock);
 }
@@ -862,6 +902,8 @@ int init(status_handler complete)
         assert(cw.log_seq_token != INVALID_ADDRESS);
         cw.log_entries = allocate_vector(cw.h, CW_LOG_MAX_ENTRIES);
         assert(cw.log_entries != INVALID_ADDRESS);
+        cw.log_ring = allocate_ringbuf(cw.h, CW_LOG_RING_SIZE);
+        assert(cw.log_ring != INVALID_ADDRESS);
         init_closure_func(&cw.log_conn_handler, connection_handler, cw_log_conn_handler);
         init_closure_func(&cw.log_in_handler, input_buffer_handler, cw_log_in_handler);
         cw.log_resp_parser = allocate_http_parser(cw.h, init_closure_func(&cw.log_vh, value_handler,
@@ -0,0 +1,603 @@
+#include <kernel.h>
+#include <lwip.h>
+
+/* Caching stub DNS resolver: queries sent by applications to the listen address (e.g. by pointing
+ * the nameserver of /etc/resolv.conf to it) are forwarded to the upstream server, and responses are
+ * cached for the lifetime given by their TTLs. Negative responses (NXDOMAIN and NODATA) are cached
+ * for the lifetime given by the SOA record of the zone (RFC 2308), and entries that are hit close
+ * to their expiration are refreshed in the background, so that names resolved continuously never
+ * miss the cache. Identical queries that are in flight are merged into a single upstream query. */
+
+//#define DNS_CACHE_DEBUG
+#ifdef DNS_CACHE_DEBUG
+#define dns_cache_debug(x, ...) do {tprintf(sym(dns_cache), 0, ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define dns_cache_debug(x, ...)
+#endif
+
+#define DNS_PORT            53
+#define DNS_HDR_LEN         12
+#define DNS_MAX_NAME_LEN    255
+#define DNS_MAX_MSG_LEN     4096
+
+#define DNS_FLAG_QR         0x8000
+#define DNS_FLAG_TC         0x0200
+#define DNS_FLAG_RD         0x0100
+#define DNS_FLAG_RA         0x0080
+#define DNS_FLAG_CD         0x0010
+#define DNS_OPCODE(flags)   (((flags) >> 11) & 0xf)
+#define DNS_RCODE(flags)    ((flags) & 0xf)
+
+#define DNS_RCODE_NOERROR   0
+#define DNS_RCODE_SERVFAIL  2
+#define DNS_RCODE_NXDOMAIN  3
+
+#define DNS_TYPE_SOA        6
+#define DNS_TYPE_OPT        41
+#define DNS_EDNS_DO         0x8000
+
+#define DNS_CACHE_LISTEN_DEFAULT    "127.0.0.1"
+#define DNS_CACHE_ENTRIES_DEFAULT   1024
+#define DNS_CACHE_MAX_TTL_DEFAULT   86400   /* seconds */
+#define DNS_CACHE_NEG_TTL_DEFAULT   300     /* seconds */
+#define DNS_CACHE_BUCKETS           1024
+#define DNS_CACHE_UPSTREAM_PCBS     8
+#define DNS_CACHE_QUERIES_MAX       256
+#define DNS_CACHE_QUERY_CLIENTS     8
+#define DNS_CACHE_QUERY_TIMEOUT     seconds(5)
+#define DNS_CACHE_PREFETCH_DIVISOR  10      /* refresh in the last tenth of the TTL */
+
+/* Cache key: lowercased question (name, type and class), followed by a byte of query flags that
+ * affect the response. */
+#define DNS_KEY_EDNS    0x01
+#define DNS_KEY_DO      0x02
+#define DNS_KEY_CD      0x04
+#define DNS_KEY_RD      0x08
+#define DNS_MAX_KEY_LEN (DNS_MAX_NAME_LEN + 5)
+
+typedef struct dns_cache_entry {
+    struct list l;              /* hash bucket */
+    struct list lru;
+    u64 hash;
+    timestamp stored;
+    timestamp expiry;
+    boolean prefetching;
+    u16 keylen;
+    u16 len;                    /* response length */
+    u16 qlen;                   /* length of the query that obtained the response */
+    u8 data[0];                 /* key, response, query */
+} *dns_cache_entry;
+
+typedef struct dns_cache_client {
+    ip_addr_t addr;
+    u16 port;
+    u16 id;
+} *dns_cache_client;
+
+typedef struct dns_cache_query {
+    struct list l;
+    u16 id;                     /* ID of the upstream query */
+    boolean cacheable;
+    struct udp_pcb *pcb;
+    ip_addr_t server;
+    u64 hash;
+    timestamp expiry;
+    int nclients;
+    struct dns_cache_client clients[DNS_CACHE_QUERY_CLIENTS];
+    u16 keylen;
+    u16 qlen;
+    u8 data[0];                 /* key, query */
+} *dns_cache_query;
+
+typedef struct dns_msg_info {
+    u16 id;
+    u16 flags;
+    u16 qdcount, ancount, nscount, arcount;
+    u16 question_end;           /* offset of the end of the question section */
+    u8 key[DNS_MAX_KEY_LEN];
+    u16 keylen;
+} *dns_msg_info;
+
+static struct {
+    heap h;
+    struct spinlock lock;
+    ip_addr_t listen_addr;
+    struct udp_pcb *listen_pcb;
+    struct udp_pcb *upstream_pcbs[DNS_CACHE_UPSTREAM_PCBS];
+    ip_addr_t server;
+    boolean server_set;
+    u64 max_entries;
+    u64 max_ttl, neg_ttl;       /* in seconds */
+    u64 entry_count;
+    struct list lru;
+    struct list buckets[DNS_CACHE_BUCKETS];
+    struct list queries;
+    u64 query_count;
+} dns_cache;
+
+static inline u16 dns_get16(const u8 *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline u32 dns_get32(const u8 *p)
+{
+    return ((u32)dns_get16(p) << 16) | dns_get16(p + 2);
+}
+
+static inline void dns_put16(u8 *p, u16 v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void dns_put32(u8 *p, u32 v)
+{
+    dns_put16(p, v >> 16);
+    dns_put16(p + 2, v);
+}
+
+static u64 dns_cache_hash(const u8 *key, u16 len)
+{
+    u64 h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < len; i++)
+        h = (h ^ key[i]) * 0x100000001b3ull;
+    return h;
+}
+
+/* Returns the offset following the (possibly compressed) name at offset, or 0 if malformed. */
+static u16 dns_skip_name(const u8 *msg, u16 len, u16 offset)
+{
+    while (offset < len) {
+        u8 l = msg[offset];
+        if (l == 0)
+            return offset + 1;
+        if ((l & 0xc0) == 0xc0)
+            return (offset + 2 <= len) ? offset + 2 : 0;
+        if (l & 0xc0)
+            return 0;
+        offset += l + 1;
+    }
+    return 0;
+}
+
+/* Parses the header and the (single, uncompressed) question of a message, and builds its key. */
+static boolean dns_parse(const u8 *msg, u16 len, dns_msg_info info)
+{
+    if (len < DNS_HDR_LEN)
+        return false;
+    info->id = dns_get16(msg);
+    info->flags = dns_get16(msg + 2);
+    info->qdcount = dns_get16(msg + 4);
+    info->ancount = dns_get16(msg + 6);
+    info->nscount = dns_get16(msg + 8);
+    info->arcount = dns_get16(msg + 10);
+    if ((info->qdcount != 1) || (DNS_OPCODE(info->flags) != 0))
+        return false;
+    u16 offset = DNS_HDR_LEN;
+    u16 k = 0;
+    for (;;) {
+        if (offset >= len)
+            return false;
+        u8 l = msg[offset];
+        if (l & 0xc0)
+            return false;
+        if ((offset + l + 1 > len) || (k + l + 1 > DNS_MAX_NAME_LEN))
+            return false;
+        info->key[k++] = l;
+        for (int i = 1; i <= l; i++) {
+            u8 c = msg[offset + i];
+            info->key[k++] = ((c >= 'A') && (c <= 'Z')) ? c + ('a' - 'A') : c;
+        }
+        offset += l + 1;
+        if (l == 0)
+            break;
+    }
+    if (offset + 4 > len)
+        return false;
+    runtime_memcpy(&info->key[k], msg + offset, 4);     /* type and class */
+    k += 4;
+    offset += 4;
+    info->question_end = offset;
+    u8 kflags = 0;
+    if (info->flags & DNS_FLAG_RD)
+        kflags |= DNS_KEY_RD;
+    if (info->flags & DNS_FLAG_CD)
+        kflags |= DNS_KEY_CD;
+    info->key[k++] = kflags;
+    info->keylen = k;
+    return true;
+}
+
+/* Looks for an EDNS OPT record in the additional section of a query, and adds its flags to the key;
+ * returns false if the query cannot be cached. */
+static boolean dns_parse_query_edns(const u8 *msg, u16 len, dns_msg_info info)
+{
+    if (info->ancount || info->nscount || (info->arcount > 1))
+        return false;
+    if (!info->arcount)
+        return true;
+    u16 offset = dns_skip_name(msg, len, info->question_end);
+    if (!offset || (offset + 10 > len) || (dns_get16(msg + offset) != DNS_TYPE_OPT))
+        return false;
+    u8 *kflags = &info->key[info->keylen - 1];
+    *kflags |= DNS_KEY_EDNS;
+    if (dns_get16(msg + offset + 6) & DNS_EDNS_DO)
+        *kflags |= DNS_KEY_DO;
+    return true;
+}
+
+/* Walks the resource records of a response: returns false if the message is malformed, and sets
+ * *min_ttl to the minimum TTL of the answer and authority records and *soa_ttl to the negative
+ * caching TTL given by an SOA record of the authority section (-1 if there is none). With a non-zero elapsed time, decrements the TTLs of the records. */
+static boolean dns_walk_rrs(u8 *msg, u16 len, dns_msg_info info, u32 elapsed, s64 *min_ttl,
+                            s64 *soa_ttl)
+{
+    u16 offset = info->question_end;
+    u32 count = info->ancount + info->nscount + info->arcount;
+    *min_ttl = -1;
+    *soa_ttl = -1;
+    for (u32 i = 0; i < count; i++) {
+        offset = dns_skip_name(msg, len, offset);
+        if (!offset || (offset + 10 > len))
+            return false;
+        u16 type = dns_get16(msg + offset);
+        u32 ttl = dns_get32(msg + offset + 4);
+        u16 rdlen = dns_get16(msg + offset + 8);
+        u16 rdata = offset + 10;
+        if (rdata + rdlen > len)
+            return false;
+        if (type != DNS_TYPE_OPT) {
+            if (i < info->ancount + info->nscount) {
+                if ((*min_ttl < 0) || (ttl < *min_ttl))
+                    *min_ttl = ttl;
+                if ((type == DNS_TYPE_SOA) && (i >= info->ancount)) {
+                    /* the SOA MINIMUM field is the last of the record data */
+                    u32 minimum = (rdlen >= 20) ? dns_get32(msg + rdata + rdlen - 4) : 0;
+                    *soa_ttl = MIN(ttl, minimum);
+                }
+            }
+            if (elapsed)
+                dns_put32(msg + offset + 4, (ttl > elapsed) ? ttl - elapsed : 0);
+        }
+        offset = rdata + rdlen;
+    }
+    return true;
+}
+
+static void dns_cache_send(struct udp_pcb *pcb, const void *msg, u16 len, const ip_addr_t *addr,
+                           u16 port)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+    if (!p)
+        return;
+    pbuf_take(p, msg, len);
+    udp_sendto(pcb, p, addr, port);
+    pbuf_free(p);
+}
+
+/* replies to a query with an error and no records */
+static void dns_cache_reply_error(const u8 *query, dns_msg_info info, u8 rcode,
+                                  const ip_addr_t *addr, u16 port)
+{
+    u8 msg[DNS_HDR_LEN + DNS_MAX_KEY_LEN];
+    runtime_memcpy(msg, query, info->question_end);
+    dns_put16(msg + 2, DNS_FLAG_QR | DNS_FLAG_RA | (info->flags & (DNS_FLAG_RD | DNS_FLAG_CD)) |
+              rcode);
+    zero(msg + 6, 6);
+    dns_cache_send(dns_cache.listen_pcb, msg, info->question_end, addr, port);
+}
+
+static dns_cache_entry dns_cache_lookup(const u8 *key, u16 keylen, u64 hash)
+{
+    list_foreach(&dns_cache.buckets[hash & (DNS_CACHE_BUCKETS - 1)], l) {
+        dns_cache_entry e = struct_from_list(l, dns_cache_entry, l);
+        if ((e->hash == hash) && (e->keylen == keylen) && !runtime_memcmp(e->data, key, keylen))
+            return e;
+    }
+    return 0;
+}
+
+static void dns_cache_remove(dns_cache_entry e)
+{
+    list_delete(&e->l);
+    list_delete(&e->lru);
+    dns_cache.entry_count--;
+    deallocate(dns_cache.h, e, sizeof(*e) + e->keylen + e->len + e->qlen);
+}
+
+static void dns_cache_insert(dns_cache_query q, const u8 *msg, u16 len, timestamp ttl)
+{
+    dns_cache_entry e = dns_cache_lookup(q->data, q->keylen, q->hash);
+    if (e)
+        dns_cache_remove(e);
+    else if (dns_cache.entry_count >= dns_cache.max_entries)
+        dns_cache_remove(struct_from_list(list_end(&dns_cache.lru)->prev, dns_cache_entry, lru));
+    e = allocate(dns_cache.h, sizeof(*e) + q->keylen + len + q->qlen);
+    if (e == INVALID_ADDRESS)
+        return;
+    e->hash = q->hash;
+    e->stored = kern_now(CLOCK_ID_MONOTONIC_RAW);
+    e->expiry = e->stored + ttl;
+    e->prefetching = false;
+    e->keylen = q->keylen;
+    e->len = len;
+    e->qlen = q->qlen;
+    runtime_memcpy(e->data, q->data, q->keylen);
+    runtime_memcpy(e->data + e->keylen, msg, len);
+    runtime_memcpy(e->data + e->keylen + len, q->data + q->keylen, q->qlen);
+    list_insert_after(&dns_cache.lru, &e->lru);
+    list_push_back(&dns_cache.buckets[e->hash & (DNS_CACHE_BUCKETS - 1)], &e->l);
+    dns_cache.entry_count++;
+}
+
+static void dns_cache_query_free(dns_cache_query q)
+{
+    list_delete(&q->l);
+    dns_cache.query_count--;
+    deallocate(dns_cache.h, q, sizeof(*q) + q->keylen + q->qlen);
+}
+
+/* Sends a query upstream, or joins an identical query in flight; called with the cache locked.
+ * Returns false if the query cannot be sent. */
+static boolean dns_cache_forward(const u8 *query, u16 len, dns_msg_info info, boolean cacheable,
+                                 dns_cache_client client)
+{
+    timestamp t = kern_now(CLOCK_ID_MONOTONIC_RAW);
+    dns_cache_query q;
+    u64 hash = dns_cache_hash(info->key, info->keylen);
+    list_foreach(&dns_cache.queries, l) {
+        q = struct_from_list(l, dns_cache_query, l);
+        if (q->expiry <= t)
+            continue;
+        if (cacheable && q->cacheable && (q->hash == hash) && (q->keylen == info->keylen) &&
+            !runtime_memcmp(q->data, info->key, info->keylen)) {
+            if (!client)
+                return true;
+            if (q->nclients == DNS_CACHE_QUERY_CLIENTS)
+                break;
+            q->clients[q->nclients++] = *client;
+            return true;
+        }
+    }
+
+    /* queries are in order of expiration */
+    while (!list_empty(&dns_cache.queries)) {
+        q = struct_from_list(list_begin(&dns_cache.queries), dns_cache_query, l);
+        if ((q->expiry > t) && (dns_cache.query_count < DNS_CACHE_QUERIES_MAX))
+            break;
+        dns_cache_query_free(q);
+    }
+    const ip_addr_t *server = dns_cache.server_set ? &dns_cache.server : dns_getserver(0);
+    if (!server || ip_addr_isany(server))
+        return false;
+    q = allocate(dns_cache.h, sizeof(*q) + info->keylen + len);
+    if (q == INVALID_ADDRESS)
+        return false;
+    u64 r = random_u64();
+    q->id = r;
+    q->cacheable = cacheable;
+    q->pcb = dns_cache.upstream_pcbs[(r >> 16) % DNS_CACHE_UPSTREAM_PCBS];
+    ip_addr_copy(q->server, *server);
+    q->hash = hash;
+    q->expiry = t + DNS_CACHE_QUERY_TIMEOUT;
+    q->nclients = 0;
+    if (client)
+        q->clients[q->nclients++] = *client;
+    q->keylen = info->keylen;
+    q->qlen = len;
+    runtime_memcpy(q->data, info->key, info->keylen);
+    u8 *msg = q->data + q->keylen;
+    runtime_memcpy(msg, query, len);
+    dns_put16(msg, q->id);
+    list_push_back(&dns_cache.queries, &q->l);
+    dns_cache.query_count++;
+    dns_cache_debug("query %d to upstream\n", q->id);
+    dns_cache_send(q->pcb, msg, len, &q->server, DNS_PORT);
+    return true;
+}
+
+closure_func_basic(io_status_handler, void, dns_cache_noop, status s, bytes len)
+{
+}
+
+/* called for queries from applications */
+static void dns_cache_input(void *z, struct udp_pcb *pcb, struct pbuf *p,
+                            struct ip_globals *ip_data, u16 port)
+{
+    u8 buf[DNS_MAX_MSG_LEN];
+    u16 len = p->tot_len;
+    struct dns_msg_info info;
+    if ((len > sizeof(buf)) || (pbuf_copy_partial(p, buf, len, 0) != len) ||
+        !dns_parse(buf, len, &info) || (info.flags & DNS_FLAG_QR))
+        goto out;
+    struct dns_cache_client client;
+    ip_addr_copy(client.addr, ip_data->current_iphdr_src);
+    client.port = port;
+    client.id = info.id;
+    boolean cacheable = dns_parse_query_edns(buf, len, &info);
+    u64 hash = dns_cache_hash(info.key, info.keylen);
+    spin_lock(&dns_cache.lock);
+    dns_cache_entry e = cacheable ? dns_cache_lookup(info.key, info.keylen, hash) : 0;
+    timestamp t = kern_now(CLOCK_ID_MONOTONIC_RAW);
+    if (e && (e->expiry <= t)) {
+        dns_cache_remove(e);
+        e = 0;
+    }
+    if (e) {
+        u8 *resp = buf;
+        u16 resp_len = e->len;
+        runtime_memcpy(resp, e->data + e->keylen, resp_len);
+        dns_put16(resp, client.id);
+        list_delete(&e->lru);
+        list_insert_after(&dns_cache.lru, &e->lru);
+        if (!e->prefetching &&
+            (e->expiry - t < (e->expiry - e->stored) / DNS_CACHE_PREFETCH_DIVISOR)) {
+            /* refresh the entry before it expires */
+            struct dns_msg_info qinfo;
+            u8 *query = e->data + e->keylen + e->len;
+            if (dns_parse(query, e->qlen, &qinfo)) {
+                dns_parse_query_edns(query, e->qlen, &qinfo);
+                e->prefetching = dns_cache_forward(query, e->qlen, &qinfo, true, 0);
+            }
+        }
+        u32 elapsed = sec_from_timestamp(t - e->stored);
+        spin_unlock(&dns_cache.lock);
+        if (elapsed) {
+            struct dns_msg_info rinfo;
+            s64 min_ttl, soa_ttl;
+            if (dns_parse(resp, resp_len, &rinfo))
+                dns_walk_rrs(resp, resp_len, &rinfo, elapsed, &min_ttl, &soa_ttl);
+        }
+        dns_cache_debug("cache hit, %d bytes\n", resp_len);
+        dns_cache_send(pcb, resp, resp_len, &client.addr, client.port);
+        goto out;
+    }
+    boolean sent = dns_cache_forward(buf, len, &info, cacheable, &client);
+    spin_unlock(&dns_cache.lock);
+    if (!sent)
+        dns_cache_reply_error(buf, &info, DNS_RCODE_SERVFAIL, &client.addr, client.port);
+  out:
+    pbuf_free(p);
+}
+
+/* called for responses from the upstream server */
+static void dns_cache_upstream_input(void *z, struct udp_pcb *pcb, struct pbuf *p,
+                                     struct ip_globals *ip_data, u16 port)
+{
+    u8 buf[DNS_MAX_MSG_LEN];
+    u16 len = p->tot_len;
+    struct dns_msg_info info;
+    if ((port != DNS_PORT) || (len > sizeof(buf)) || (pbuf_copy_partial(p, buf, len, 0) != len) ||
+        !dns_parse(buf, len, &info) || !(info.flags & DNS_FLAG_QR))
+        goto out;
+    spin_lock(&dns_cache.lock);
+    dns_cache_query q = 0;
+    list_foreach(&dns_cache.queries, l) {
+        dns_cache_query pq = struct_from_list(l, dns_cache_query, l);
+        /* the question must match (ignoring the query flags, at the end of the key) */
+        if ((pq->id == info.id) && (pq->pcb == pcb) &&
+            ip_addr_cmp(&pq->server, &ip_data->current_iphdr_src) &&
+            (pq->keylen == info.keylen) && !runtime_memcmp(pq->data, info.key, info.keylen - 1)) {
+            q = pq;
+            break;
+        }
+    }
+    if (!q) {
+        spin_unlock(&dns_cache.lock);
+        goto out;
+    }
+    s64 min_ttl, soa_ttl;
+    if (q->cacheable && !(info.flags & DNS_FLAG_TC) &&
+        dns_walk_rrs(buf, len, &info, 0, &min_ttl, &soa_ttl)) {
+        u8 rcode = DNS_RCODE(info.flags);
+        s64 ttl = -1;
+        if ((rcode == DNS_RCODE_NOERROR) && info.ancount)
+            ttl = MIN(min_ttl, (s64)dns_cache.max_ttl);
+        else if ((rcode == DNS_RCODE_NXDOMAIN) || (rcode == DNS_RCODE_NOERROR))
+            ttl = MIN(soa_ttl, (s64)dns_cache.neg_ttl);
+        if (ttl > 0) {
+            dns_cache_insert(q, buf, len, seconds(ttl));
+            goto reply;
+        }
+    }
+    if (q->cacheable) {
+        /* an uncacheable response to a refresh: let the next hit retry */
+        dns_cache_entry e = dns_cache_lookup(q->data, q->keylen, q->hash);
+        if (e)
+            e->prefetching = false;
+    }
+  reply:
+    ;
+    int nclients = q->nclients;
+    struct dns_cache_client clients[DNS_CACHE_QUERY_CLIENTS];
+    runtime_memcpy(clients, q->clients, nclients * sizeof(clients[0]));
+    dns_cache_query_free(q);
+    spin_unlock(&dns_cache.lock);
+    for (int i = 0; i < nclients; i++) {
+        dns_put16(buf, clients[i].id);
+        dns_cache_send(dns_cache.listen_pcb, buf, len, &clients[i].addr, clients[i].port);
+    }
+  out:
+    pbuf_free(p);
+}
+
+closure_func_basic(binding_handler, boolean, dns_cache_cfg,
+                   value s, value v)
+{
+    if (s == sym(listen) || s == sym(server)) {
+        ip_addr_t addr;
+        if (!is_string(v) || !ipaddr_aton(buffer_to_sstring(v), &addr)) {
+            rprintf("dns_cache: invalid %v address %v\n", s, v);
+            return false;
+        }
+        if (s == sym(server)) {
+            ip_addr_copy(dns_cache.server, addr);
+            dns_cache.server_set = true;
+        } else {
+            ip_addr_copy(dns_cache.listen_addr, addr);
+        }
+    } else if (s == sym(max_entries) || s == sym(max_ttl) || s == sym(negative_ttl)) {
+        u64 val;
+        if (!u64_from_value(v, &val) || ((s == sym(max_entries)) && !val)) {
+            rprintf("dns_cache: invalid %v\n", s);
+            return false;
+        }
+        if (s == sym(max_entries))
+            dns_cache.max_entries = val;
+        else if (s == sym(max_ttl))
+            dns_cache.max_ttl = val;
+        else
+            dns_cache.neg_ttl = val;
+    } else {
+        rprintf("dns_cache: invalid option %v\n", s);
+        return false;
+    }
+    return true;
+}
+
+int init(status_handler complete)
+{
+    dns_cache.h = heap_locked(get_kernel_heaps());
+    tuple root = get_root_tuple();
+    if (!root)
+        return KLIB_INIT_FAILED;
+    value cfg = get(root, sym(dns_cache));
+    dns_cache.max_entries = DNS_CACHE_ENTRIES_DEFAULT;
+    dns_cache.max_ttl = DNS_CACHE_MAX_TTL_DEFAULT;
+    dns_cache.neg_ttl = DNS_CACHE_NEG_TTL_DEFAULT;
+    ipaddr_aton(ss(DNS_CACHE_LISTEN_DEFAULT), &dns_cache.listen_addr);
+    if (cfg && (!is_tuple(cfg) ||
+                !iterate(cfg, stack_closure_func(binding_handler, dns_cache_cfg)))) {
+        rprintf("invalid dns_cache configuration\n");
+        return KLIB_INIT_FAILED;
+    }
+    dns_cache.listen_pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!dns_cache.listen_pcb || (udp_bind(dns_cache.listen_pcb, &dns_cache.listen_addr,
+                                                   DNS_PORT) != ERR_OK)) {
+        rprintf("dns_cache: cannot listen on port %d\n", DNS_PORT);
+        return KLIB_INIT_FAILED;
+    }
+    udp_recv(dns_cache.listen_pcb, dns_cache_input, 0);
+
+    /* upstream queries go out from a few randomly chosen ports */
+    for (int i = 0; i < DNS_CACHE_UPSTREAM_PCBS; i++) {
+        struct udp_pcb *pcb = udp_new_ip_type(IPADDR_TYPE_ANY);
+        if (!pcb)
+            return KLIB_INIT_FAILED;
+        err_t err;
+        do {
+            err = udp_bind(pcb, IP_ANY_TYPE, 49152 + random_u64() % 16384);
+        } while (err == ERR_USE);
+        if (err != ERR_OK)
+            return KLIB_INIT_FAILED;
+        udp_recv(pcb, dns_cache_upstream_input, 0);
+        dns_cache.upstream_pcbs[i] = pcb;
+    }
+    spin_lock_init(&dns_cache.lock);
+    list_init(&dns_cache.lru);
+    for (int i = 0; i < DNS_CACHE_BUCKETS; i++)
+        list_init(&dns_cache.buckets[i]);
+    list_init(&dns_cache.queries);
+    return KLIB_INIT_OK;
+}
@@ -4,6 +4,7 @@
 
 typedef struct firewall_rule {
     struct list l;
+    int index;
     u8 ip_version;
     u8 l4_proto;
     vector l3_match;
@@ -36,8 +37,29 @@ typedef struct firewall_constraint_buf {
     u8 buf[0];
 } *firewall_constraint_buf;
 
+/* Verdict cache entry for the packets that share the fields checked by rule constraints (IP version,
+ * source address, transport protocol and destination port): since the rules do not change at
+ * runtime, the first matching rule is the same for all the packets of a given flow. Entries are
+ * updated without locking: the sequence number is odd while an entry is being written, and is
+ * re-checked by readers after reading the entry. */
+#define FIREWALL_FLOW_ORDER 12
+
+typedef struct firewall_flow {
+    u64 seq;    /* 0 for an unused entry */
+    u8 ip_version;
+    u8 l4_proto;
+    u16 dest;   /* network byte order */
+    boolean drop;
+    u8 src[16];
+} *firewall_flow;
+
 static struct firewall {
     struct list rules;
+    int rule_count;
+    table port_rules;       /* (transport protocol, destination port) -> vector of rules */
+    table proto_rules;      /* transport protocol -> vector of rules not indexed by port */
+    vector generic_rules;   /* rules not indexed by destination port or transport protocol */
+    firewall_flow flows;
 } firewall;
 
 static boolean firewall_match_val(u64 val, firewall_constraint c)
@@ -63,107 +85,120 @@ static boolean firewall_match_buf(void *buf, firewall_constraint c)
     return ((b == (c_buf->buf[byte_count] & bit_mask)) == c->equals);
 }
 
-static boolean firewall_ip4_match(vector constraints, void *buf, unsigned int len, void **l4_hdr)
+/* Fields of a packet checked by rule constraints, extracted once per packet */
+typedef struct firewall_pkt {
+    u8 ip_version;
+    boolean l3_valid;
+    int l4_proto;   /* -1 if the IPv6 extension headers are truncated */
+    boolean l4_valid;
+    void *src;
+    u16 dest;       /* network byte order */
+} *firewall_pkt;
+
+static void firewall_parse_pkt(struct pbuf *p, firewall_pkt pkt)
 {
-    struct ip_hdr *hdr = buf;
-    int hdr_len = IPH_HL_BYTES(hdr);
-    if (len < hdr_len)
-        return false;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L3_SRC:
-            if (!firewall_match_buf(&hdr->src, c))
-                return false;
-            break;
-        case FW_L3_PROTO:
-            if (!firewall_match_val(IPH_PROTO(hdr), c))
-                return false;
-            break;
+    void *buf = p->payload;
+    unsigned int len = p->len;
+    pkt->ip_version = IP_HDR_GET_VERSION(buf);
+    pkt->l3_valid = pkt->l4_valid = false;
+    pkt->l4_proto = -1;
+    if (pkt->ip_version == 4) {
+        struct ip_hdr *hdr = buf;
+        int hdr_len = IPH_HL_BYTES(hdr);
+        if (len < hdr_len)
+            return;
+        pkt->l3_valid = true;
+        pkt->src = &hdr->src;
+        pkt->l4_proto = IPH_PROTO(hdr);
+        buf += hdr_len;
+        len -= hdr_len;
+    } else {
+        if (len < IP6_HLEN)
+            return;
+        struct ip6_hdr *hdr = buf;
+        pkt->l3_valid = true;
+        pkt->src = &hdr->src;
+        boolean options_done = false;
+        u8 *nexth = &IP6H_NEXTH(hdr);
+        buf += IP6_HLEN;
+        len -= IP6_HLEN;
+        while (*nexth != IP6_NEXTH_NONE) {
+            u16 hlen;
+            switch (*nexth) {
+            case IP6_NEXTH_HOPBYHOP: {
+                struct ip6_hbh_hdr *hbh_hdr = (struct ip6_hbh_hdr *)buf;
+                if (len < sizeof(*hbh_hdr))
+                    return;
+                hlen = 8 * (1 + hbh_hdr->_hlen);
+                nexth = &IP6_HBH_NEXTH(hbh_hdr);
+                break;
+            }
+            case IP6_NEXTH_DESTOPTS: {
+                struct ip6_dest_hdr *dest_hdr = (struct ip6_dest_hdr *)buf;
+                if (len < sizeof(*dest_hdr))
+                    return;
+                hlen = 8 * (1 + dest_hdr->_hlen);
+                nexth = &IP6_DEST_NEXTH(dest_hdr);
+                break;
+            }
+            case IP6_NEXTH_ROUTING: {
+                struct ip6_rout_hdr *rout_hdr = (struct ip6_rout_hdr *)buf;
+                if (len < sizeof(*rout_hdr))
+                    return;
+                hlen = 8 * (1 + rout_hdr->_hlen);
+                nexth = &IP6_ROUT_NEXTH(rout_hdr);
+                break;
+            }
+            case IP6_NEXTH_FRAGMENT:
+                hlen = 8;
+                nexth = &IP6_FRAG_NEXTH((struct ip6_frag_hdr *)buf);
+                break;
+            default:
+                options_done = true;
+            }
+            if (options_done)
+                break;
+            if (len < hlen)
+                return;
+            buf += hlen;
+            len -= hlen;
         }
+        pkt->l4_proto = *nexth;
+    }
+    switch (pkt->l4_proto) {
+    case IP_PROTO_TCP: {
+        struct tcp_hdr *hdr = buf;
+        if (len < sizeof(*hdr))
+            return;
+        pkt->dest = hdr->dest;
+        break;
     }
-    *l4_hdr = buf + hdr_len;
-    return true;
+    case IP_PROTO_UDP: {
+        struct udp_hdr *hdr = buf;
+        if (len < sizeof(*hdr))
+            return;
+        pkt->dest = hdr->dest;
+        break;
+    }
+    default:
+        return;
+    }
+    pkt->l4_valid = true;
 }
 
-static boolean firewall_ip6_match(vector constraints, void *buf, unsigned int len, void **l4_hdr)
+static boolean firewall_l3_match(vector constraints, firewall_pkt pkt)
 {
-    if (len < IP6_HLEN)
+    if (!pkt->l3_valid)
         return false;
-    struct ip6_hdr *hdr = buf;
     firewall_constraint c;
     vector_foreach(constraints, c) {
         switch (c->type) {
         case FW_L3_SRC:
-            if (!firewall_match_buf(&hdr->src, c))
+            if (!firewall_match_buf(pkt->src, c))
                 return false;
             break;
-        case FW_L3_PROTO: {
-            boolean options_done = false;
-            u8 *nexth = &IP6H_NEXTH(hdr);
-            buf += IP6_HLEN;
-            len -= IP6_HLEN;
-            while (*nexth != IP6_NEXTH_NONE) {
-                u16 hlen;
-                switch (*nexth) {
-                case IP6_NEXTH_HOPBYHOP: {
-                    struct ip6_hbh_hdr *hbh_hdr = (struct ip6_hbh_hdr *)buf;
-                    if (len < sizeof(*hbh_hdr))
-                        return false;
-                    hlen = 8 * (1 + hbh_hdr->_hlen);
-                    nexth = &IP6_HBH_NEXTH(hbh_hdr);
-                    break;
-                }
-                case IP6_NEXTH_DESTOPTS: {
-                    struct ip6_dest_hdr *dest_hdr = (struct ip6_dest_hdr *)buf;
-                    if (len < sizeof(*dest_hdr))
-                        return false;
-                    hlen = 8 * (1 + dest_hdr->_hlen);
-                    nexth = &IP6_DEST_NEXTH(dest_hdr);
-                    break;
-                }
-                case IP6_NEXTH_ROUTING: {
-                    struct ip6_rout_hdr *rout_hdr = (struct ip6_rout_hdr *)buf;
-                    if (len < sizeof(*rout_hdr))
-                        return false;
-                    hlen = 8 * (1 + rout_hdr->_hlen);
-                    nexth = &IP6_ROUT_NEXTH(rout_hdr);
-                    break;
-                }
-                case IP6_NEXTH_FRAGMENT:
-                    hlen = 8;
-                    nexth = &IP6_FRAG_NEXTH((struct ip6_frag_hdr *)buf);
-                    break;
-                default:
-                    options_done = true;
-                }
-                if (options_done)
-                    break;
-                if (len < hlen)
-                    return false;
-                buf += hlen;
-                len -= hlen;
-            }
-            if (!firewall_match_val(*nexth, c))
-                return false;
-            break;
-        }
-        }
-    }
-    *l4_hdr = buf;
-    return true;
-}
-
-static boolean firewall_tcp_match(vector constraints, void *buf, unsigned int len)
-{
-    struct tcp_hdr *hdr = buf;
-    if (len < sizeof(*hdr))
-        return false;
-    firewall_constraint c;
-    vector_foreach(constraints, c) {
-        switch (c->type) {
-        case FW_L4_DEST:
-            if (!firewall_match_val(hdr->dest, c))
+        case FW_L3_PROTO:
+            if ((pkt->l4_proto < 0) || !firewall_match_val(pkt->l4_proto, c))
                 return false;
             break;
         }
@@ -171,16 +206,16 @@ static boolean firewall_tcp_match(vector constraints, void *buf, unsigned int le
     return true;
 }
 
-static boolean firewall_udp_match(vector constraints, void *buf, unsigned int len)
+/* The transport protocol of the packet has already been matched by the Layer 3 constraints. */
+static boolean firewall_l4_match(vector constraints, firewall_pkt pkt)
 {
-    struct udp_hdr *hdr = buf;
-    if (len < sizeof(*hdr))
+    if (!pkt->l4_valid)
         return false;
     firewall_constraint c;
     vector_foreach(constraints, c) {
         switch (c->type) {
         case FW_L4_DEST:
-            if (!firewall_match_val(hdr->dest, c))
+            if (!firewall_match_val(pkt->dest, c))
                 return false;
             break;
         }
@@ -188,45 +223,120 @@ static boolean firewall_udp_match(vector constraints, void *buf, unsigned int le
     return true;
 }
 
-static boolean firewall_match(struct pbuf *p, firewall_rule rule)
+static boolean firewall_match(firewall_pkt pkt, firewall_rule rule)
 {
-    u8 ip_version = IP_HDR_GET_VERSION(p->payload);
-    if (rule->ip_version && (rule->ip_version != ip_version))
+    if (rule->ip_version && (rule->ip_version != pkt->ip_version))
         return false;
     if (!rule->l3_match)
         return true;
-    void *l4_hdr;
-    boolean (*l3_match_func)(vector, void *, unsigned int, void **);
-    l3_match_func = (ip_version == 4) ? firewall_ip4_match : firewall_ip6_match;
-    if (!l3_match_func(rule->l3_match, p->payload, p->len, &l4_hdr))
+    if (!firewall_l3_match(rule->l3_match, pkt))
         return false;
     if (!rule->l4_match)
         return true;
-    boolean (*l4_match_func)(vector, void *, unsigned int);
-    switch (rule->l4_proto) {
-    case IP_PROTO_TCP:
-        l4_match_func = firewall_tcp_match;
-        break;
-    case IP_PROTO_UDP:
-        l4_match_func = firewall_udp_match;
-        break;
-    default:
-        return false;   /* should never happen */
-    }
-    return l4_match_func(rule->l4_match, l4_hdr, p->len - (l4_hdr - p->payload));
+    return firewall_l4_match(rule->l4_match, pkt);
+}
+
+static void *firewall_port_key(int l4_proto, u16 dest)
+{
+    return pointer_from_u64(((u64)l4_proto << 16) | dest);
+}
+
+static firewall_flow firewall_flow_get(firewall_pkt pkt, u8 *src)
+{
+    int src_len = (pkt->ip_version == 4) ? sizeof(ip4_addr_p_t) : sizeof(ip6_addr_p_t);
+    runtime_memcpy(src, pkt->src, src_len);
+    zero(src + src_len, 16 - src_len);
+    u64 hash = 0xcbf29ce484222325;
+    for (int i = 0; i < src_len; i++) {
+        hash ^= src[i];
+        hash *= 1099511628211;
+    }
+    hash ^= (pkt->l4_proto << 16) | pkt->dest;
+    hash *= 1099511628211;
+    return firewall.flows + ((hash ^ (hash >> 32)) & MASK(FIREWALL_FLOW_ORDER));
 }
 
+/* Returns the cached verdict (true to drop) for the flow of a packet, or -1 if not cached. */
+static int firewall_flow_lookup(firewall_flow f, firewall_pkt pkt, u8 *src)
+{
+    u64 seq = f->seq;
+    if (!seq || (seq & 1))
+        return -1;
+    read_barrier();
+    boolean match = (f->ip_version == pkt->ip_version) && (f->l4_proto == pkt->l4_proto) &&
+                    (f->dest == pkt->dest) && !runtime_memcmp(f->src, src, sizeof(f->src));
+    boolean drop = f->drop;
+    read_barrier();
+    if (!match || (f->seq != seq))
+        return -1;
+    return drop;
+}
+
+static void firewall_flow_insert(firewall_flow f, firewall_pkt pkt, u8 *src, boolean drop)
+{
+    u64 seq = f->seq;
+    if ((seq & 1) || !compare_and_swap_64(&f->seq, seq, seq + 1))
+        return; /* another CPU is writing this entry */
+    write_barrier();
+    f->ip_version = pkt->ip_version;
+    f->l4_proto = pkt->l4_proto;
+    f->dest = pkt->dest;
+    f->drop = drop;
+    runtime_memcpy(f->src, src, sizeof(f->src));
+    write_barrier();
+    f->seq = seq + 2;
+}
+
+/* Rules are evaluated in order, and the first matching rule determines the action. Only the rules
+ * that can match the transport protocol and destination port of the packet are evaluated: rules with
+ * a destination port constraint are looked up in a hash table, and are merged (by rule index) with
+ * the rules for the transport protocol of the packet that are not indexed by port. Verdicts for TCP
+ * and UDP packets are cached in the flow table, so that only the first packet of a flow walks the
+ * rules. */
 static int firewall_filter(struct pbuf *pbuf, struct netif *input_netif)
 {
-    list_foreach(&firewall.rules, elem) {
-        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
-        if (firewall_match(pbuf, rule)) {
-            if (rule->drop)
-                goto drop_pkt;
+    struct firewall_pkt pkt;
+    firewall_parse_pkt(pbuf, &pkt);
+    firewall_flow flow = 0;
+    u8 src[16];
+    if (pkt.l4_valid && firewall.flows) {
+        flow = firewall_flow_get(&pkt, src);
+        int drop = firewall_flow_lookup(flow, &pkt, src);
+        if (drop == 0)
+            return 1;
+        else if (drop > 0)
+            goto drop_pkt;
+    }
+    vector generic_rules = (pkt.l4_proto >= 0) ?
+                           table_find(firewall.proto_rules, firewall_port_key(pkt.l4_proto, 0)) :
+                           0;
+    if (!generic_rules)
+        generic_rules = firewall.generic_rules;
+    vector port_rules = pkt.l4_valid ?
+                        table_find(firewall.port_rules, firewall_port_key(pkt.l4_proto, pkt.dest)) :
+                        0;
+    boolean drop = false;
+    int generic_count = vector_length(generic_rules);
+    int port_count = port_rules ? vector_length(port_rules) : 0;
+    int i = 0, j = 0;
+    while ((i < generic_count) || (j < port_count)) {
+        firewall_rule rule = (i < generic_count) ? vector_get(generic_rules, i) : 0;
+        firewall_rule port_rule = (j < port_count) ? vector_get(port_rules, j) : 0;
+        if (rule && (!port_rule || (rule->index < port_rule->index))) {
+            i++;
+        } else {
+            rule = port_rule;
+            j++;
+        }
+        if (firewall_match(&pkt, rule)) {
+            drop = rule->drop;
             break;
         }
     }
-    return 1;
+    if (flow)
+        firewall_flow_insert(flow, &pkt, src, drop);
+    if (!drop)
+        return 1;
   drop_pkt:
     pbuf_free(pbuf);
     return 0;
@@ -460,6 +570,7 @@ static boolean firewall_create_rule(heap h, value spec)
     rule->ip_version = 0;
     rule->l4_proto = 0;
     rule->l3_match = rule->l4_match = 0;
+    rule->index = firewall.rule_count++;
     list_push_back(&firewall.rules, &rule->l);
     value ip4 = get(spec, sym(ip));
     if (ip4) {
@@ -546,6 +657,66 @@ static void firewall_destroy_rule(heap h, firewall_rule rule)
     deallocate(h, rule, sizeof(*rule));
 }
 
+/* Returns the destination port of a rule that only matches packets sent to that port, or -1. */
+static int firewall_rule_port(firewall_rule rule)
+{
+    if (!rule->l4_match)
+        return -1;
+    firewall_constraint c;
+    vector_foreach(rule->l4_match, c) {
+        if ((c->type == FW_L4_DEST) && c->equals)
+            return ((firewall_constraint_val)c)->val;
+    }
+    return -1;
+}
+
+static void firewall_index_rules(heap h)
+{
+    firewall.port_rules = allocate_table(h, identity_key, pointer_equal);
+    assert(firewall.port_rules != INVALID_ADDRESS);
+    firewall.proto_rules = allocate_table(h, identity_key, pointer_equal);
+    assert(firewall.proto_rules != INVALID_ADDRESS);
+    firewall.generic_rules = allocate_vector(h, 8);
+    assert(firewall.generic_rules != INVALID_ADDRESS);
+
+    /* Rules that are not indexed by port and match a single transport protocol are grouped by
+     * protocol; each group includes (in rule order) the rules that match any protocol. */
+    list_foreach(&firewall.rules, elem) {
+        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+        if (!rule->l4_proto || (firewall_rule_port(rule) >= 0))
+            continue;
+        void *key = firewall_port_key(rule->l4_proto, 0);
+        if (table_find(firewall.proto_rules, key))
+            continue;
+        vector rules = allocate_vector(h, 8);
+        assert(rules != INVALID_ADDRESS);
+        list_foreach(&firewall.rules, e) {
+            firewall_rule r = struct_from_list(e, firewall_rule, l);
+            if (((r->l4_proto == 0) || (r->l4_proto == rule->l4_proto)) &&
+                (firewall_rule_port(r) < 0))
+                vector_push(rules, r);
+        }
+        table_set(firewall.proto_rules, key, rules);
+    }
+    list_foreach(&firewall.rules, elem) {
+        firewall_rule rule = struct_from_list(elem, firewall_rule, l);
+        int port = firewall_rule_port(rule);
+        if (port < 0) {
+            if (!rule->l4_proto)
+                vector_push(firewall.generic_rules, rule);
+            continue;
+        }
+        void *key = firewall_port_key(rule->l4_proto, port);
+        vector rules = table_find(firewall.port_rules, key);
+        if (!rules) {
+            rules = allocate_vector(h, 1);
+            assert(rules != INVALID_ADDRESS);
+            table_set(firewall.port_rules, key, rules);
+        }
+        vector_push(rules, rule);
+    }
+}
+
 int init(status_handler complete)
 {
     tuple config = get(get_root_tuple(), sym(firewall));
@@ -569,8 +740,13 @@ int init(status_handler complete)
         if (!firewall_create_rule(h, rule_spec))
             goto err_dealloc_rules;
     }
-    if (!list_empty(&firewall.rules))
+    if (!list_empty(&firewall.rules)) {
+        firewall_index_rules(h);
+        firewall.flows = allocate_zero(h, sizeof(struct firewall_flow) << FIREWALL_FLOW_ORDER);
+        if (firewall.flows == INVALID_ADDRESS)
+            firewall.flows = 0;
         net_ip_input_filter = firewall_filter;
+    }
     return KLIB_INIT_OK;
   err_dealloc_rules:
     list_foreach(&firewall.rules, elem) {
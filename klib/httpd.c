@@ -0,0 +1,352 @@
+#include <unix_internal.h>
+#include <filesystem.h>
+#include <http.h>
+
+/* Static file server: serves the files under a directory of the root filesystem over HTTP/1.1 with
+ * keep-alive and pipelining. File data is sent straight from the page cache: each page read is
+ * wrapped in a buffer that the connection references until the peer acknowledges it, and the page
+ * is released when the buffer is deallocated. Reads are paced by the acknowledgements, so that a
+ * slow client holds at most two reads worth of pages. */
+
+//#define HTTPD_DEBUG
+#ifdef HTTPD_DEBUG
+#define httpd_debug(x, ...) do {tprintf(sym(httpd), 0, ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define httpd_debug(x, ...)
+#endif
+
+#define HTTPD_PORT_DEFAULT  8080
+#define HTTPD_READ_SIZE     (256 * KB)
+#define HTTPD_MAX_PATH      1024
+#define HTTPD_INDEX         "index.html"
+
+static struct {
+    heap h;
+    buffer root;
+    u64 port;
+    http_listener hl;
+} httpd;
+
+typedef struct httpd_stream {
+    struct heap h;              /* allocates the buffers wrapping page cache data */
+    http_responder out;
+    fsfile f;
+    u64 offset, end;
+    sg_list sg;
+    u64 inflight;               /* bytes sent and not yet released by the connection */
+    boolean reading;
+    boolean failed;
+    boolean kick_scheduled;
+    struct spinlock lock;
+    closure_struct(thunk, kick);
+    closure_struct(status_handler, read_complete);
+} *httpd_stream;
+
+/* a buffer wrapping (part of) a page cache page */
+typedef struct httpd_frag {
+    struct buffer b;            /* must be first: the buffer is deallocated as a frag */
+    struct sg_buf sgb;
+    u32 len;
+} *httpd_frag;
+
+static const struct {
+    sstring ext;
+    sstring type;
+} httpd_types[] = {
+    {ss_static_init("html"), ss_static_init("text/html")},
+    {ss_static_init("htm"), ss_static_init("text/html")},
+    {ss_static_init("css"), ss_static_init("text/css")},
+    {ss_static_init("js"), ss_static_init("text/javascript")},
+    {ss_static_init("json"), ss_static_init("application/json")},
+    {ss_static_init("txt"), ss_static_init("text/plain")},
+    {ss_static_init("svg"), ss_static_init("image/svg+xml")},
+    {ss_static_init("png"), ss_static_init("image/png")},
+    {ss_static_init("jpg"), ss_static_init("image/jpeg")},
+    {ss_static_init("jpeg"), ss_static_init("image/jpeg")},
+    {ss_static_init("gif"), ss_static_init("image/gif")},
+    {ss_static_init("ico"), ss_static_init("image/x-icon")},
+    {ss_static_init("wasm"), ss_static_init("application/wasm")},
+};
+
+static sstring httpd_content_type(buffer path)
+{
+    char *p = buffer_ref(path, 0);
+    int len = buffer_length(path);
+    int dot;
+    for (dot = len - 1; (dot >= 0) && (p[dot] != '.') && (p[dot] != '/'); dot--);
+    if ((dot >= 0) && (p[dot] == '.')) {
+        sstring ext = isstring(p + dot + 1, len - dot - 1);
+        for (int i = 0; i < _countof(httpd_types); i++)
+            if (!runtime_strcmp(ext, httpd_types[i].ext))
+                return httpd_types[i].type;
+    }
+    return ss("application/octet-stream");
+}
+
+static void httpd_stream_kick(httpd_stream st)
+{
+    if (compare_and_swap_32((u32 *)&st->kick_scheduled, false, true))
+        async_apply((thunk)&st->kick);
+}
+
+static u64 httpd_frag_alloc(heap h, bytes b)
+{
+    assert(b == sizeof(struct buffer));
+    return u64_from_pointer(allocate(httpd.h, sizeof(struct httpd_frag)));
+}
+
+/* called when the connection is done with a buffer */
+static void httpd_frag_dealloc(heap h, u64 a, bytes b)
+{
+    httpd_stream st = struct_from_field(h, httpd_stream, h);
+    httpd_frag frag = pointer_from_u64(a);
+    u32 len = frag->len;
+    sg_buf_release(&frag->sgb);
+    deallocate(httpd.h, frag, sizeof(*frag));
+    spin_lock(&st->lock);
+    st->inflight -= len;
+    spin_unlock(&st->lock);
+
+    /* the connection may be sending with locks held: continue from the runqueue */
+    httpd_stream_kick(st);
+}
+
+static void httpd_stream_free(httpd_stream st)
+{
+    httpd_debug("stream %p done\n", st);
+    fsfile_release(st->f);
+    deallocate_sg_list(st->sg);
+    http_responder_release(st->out);
+    deallocate(httpd.h, st, sizeof(*st));
+}
+
+closure_func_basic(thunk, void, httpd_stream_kick_func)
+{
+    httpd_stream st = struct_from_field(closure_self(), httpd_stream, kick);
+    spin_lock(&st->lock);
+    st->kick_scheduled = false;
+    if (st->reading) {
+        /* the read completion kicks the stream again */
+        spin_unlock(&st->lock);
+        return;
+    }
+    if (!st->failed && (st->offset < st->end) && (st->inflight < HTTPD_READ_SIZE)) {
+        range r = irange(st->offset, MIN(st->end, st->offset + HTTPD_READ_SIZE));
+        st->reading = true;
+        spin_unlock(&st->lock);
+        filesystem_read_sg(st->f, st->sg, r, (status_handler)&st->read_complete);
+        return;
+    }
+    boolean done = (st->failed || (st->offset == st->end)) && !st->inflight;
+    spin_unlock(&st->lock);
+    if (done)
+        httpd_stream_free(st);
+}
+
+closure_func_basic(status_handler, void, httpd_read_complete,
+                   status s)
+{
+    httpd_stream st = struct_from_field(closure_self(), httpd_stream, read_complete);
+    u64 remaining = MIN(st->end - st->offset, HTTPD_READ_SIZE);
+    httpd_debug("stream %p, offset %ld, len %ld, status %v\n", st, st->offset, remaining, s);
+    if (!is_ok(s)) {
+        msg_err("failed to read file: %v\n", s);
+        timm_dealloc(s);
+        st->failed = true;
+    }
+    sg_buf sgb;
+    while (!st->failed && remaining && ((sgb = sg_list_head_remove(st->sg)) != INVALID_ADDRESS)) {
+        u32 len = MIN(sg_buf_len(sgb), remaining);
+        buffer b = wrap_buffer(&st->h, sgb->buf + sgb->offset, len);
+        if (b == INVALID_ADDRESS) {
+            sg_buf_release(sgb);
+            st->failed = true;
+            break;
+        }
+        httpd_frag frag = (httpd_frag)b;
+        runtime_memcpy(&frag->sgb, sgb, sizeof(*sgb));
+        frag->len = len;
+        spin_lock(&st->lock);
+        st->inflight += len;
+        spin_unlock(&st->lock);
+        st->offset += len;
+        remaining -= len;
+        s = send_http_body(st->out, b);
+        if (!is_ok(s)) {
+            timm_dealloc(s);
+            st->failed = true;
+        }
+    }
+    sg_list_release(st->sg);
+    if (!st->failed && remaining)
+        st->failed = true;  /* short read */
+    if (st->failed) {
+        /* the response cannot be completed */
+        http_responder_close(st->out);
+    } else if (st->offset == st->end) {
+        s = send_http_body(st->out, 0);
+        if (!is_ok(s))
+            timm_dealloc(s);
+    }
+    spin_lock(&st->lock);
+    st->reading = false;
+    spin_unlock(&st->lock);
+    httpd_stream_kick(st);
+}
+
+static void httpd_send_error(http_responder out, sstring code)
+{
+    status s = send_http_response(out, timm("status", "%s", code),
+                                  aprintf(httpd.h, "<html><head><title>%s</title></head>"
+                                          "<body><h1>%s</h1></body></html>\r\n", code, code));
+    if (!is_ok(s))
+        timm_dealloc(s);
+}
+
+/* Builds the path of the file for a request URI; returns false if the URI is not acceptable. */
+static boolean httpd_path(buffer uri, buffer path)
+{
+    buffer_write(path, buffer_ref(httpd.root, 0), buffer_length(httpd.root));
+    char *p = buffer_ref(uri, 0);
+    int len = buffer_length(uri);
+    char prev = 0;
+    for (int i = 0; i < len; i++) {
+        char c = p[i];
+        if ((c == '?') || (c == '#'))
+            break;
+        if (c == '\0')
+            return false;
+
+        /* no way out of the root directory */
+        if ((c == '.') && (prev == '/') && (i + 1 < len) && (p[i + 1] == '.') &&
+            ((i + 2 == len) || (p[i + 2] == '/') || (p[i + 2] == '?') || (p[i + 2] == '#')))
+            return false;
+        if (!((c == '/') && (prev == '/')))
+            push_u8(path, c);
+        prev = c;
+    }
+    if (prev == '/')
+        buffer_write_cstring(path, HTTPD_INDEX);
+    return (buffer_length(path) < HTTPD_MAX_PATH);
+}
+
+closure_func_basic(http_request_handler, void, httpd_request,
+                   http_method method, http_responder out, value v)
+{
+    if ((method != HTTP_REQUEST_METHOD_GET) && (method != HTTP_REQUEST_METHOD_HEAD)) {
+        httpd_send_error(out, ss("405 Method Not Allowed"));
+        return;
+    }
+    buffer uri = vector_get(get_vector(v, sym(start_line)), 1);
+    buffer path = little_stack_buffer(HTTPD_MAX_PATH);
+    if (!httpd_path(uri, path)) {
+        httpd_send_error(out, ss("400 Bad Request"));
+        return;
+    }
+    httpd_debug("%s %b\n", http_request_methods[method], path);
+    fsfile f = fsfile_open(buffer_to_sstring(path));
+    if (!f) {
+        httpd_send_error(out, ss("404 Not Found"));
+        return;
+    }
+    u64 len = fsfile_get_length(f);
+    status s = send_http_response_header(out, timm("Content-Type", "%s", httpd_content_type(path)),
+                                         len);
+    if (!is_ok(s))
+        goto error;
+    if ((method == HTTP_REQUEST_METHOD_HEAD) || (len == 0)) {
+        fsfile_release(f);
+        s = send_http_body(out, 0);
+        if (!is_ok(s))
+            timm_dealloc(s);
+        return;
+    }
+    httpd_stream st = allocate(httpd.h, sizeof(*st));
+    if (st == INVALID_ADDRESS)
+        goto error_close;
+    st->sg = allocate_sg_list();
+    if (st->sg == INVALID_ADDRESS) {
+        deallocate(httpd.h, st, sizeof(*st));
+        goto error_close;
+    }
+    zero(&st->h, sizeof(st->h));
+    st->h.alloc = httpd_frag_alloc;
+    st->h.dealloc = httpd_frag_dealloc;
+    st->out = out;
+    http_responder_hold(out);
+    st->f = f;
+    st->offset = 0;
+    st->end = len;
+    st->inflight = 0;
+    st->reading = st->failed = st->kick_scheduled = false;
+    spin_lock_init(&st->lock);
+    init_closure_func(&st->kick, thunk, httpd_stream_kick_func);
+    init_closure_func(&st->read_complete, status_handler, httpd_read_complete);
+    httpd_stream_kick(st);
+    return;
+  error:
+    timm_dealloc(s);
+    fsfile_release(f);
+    return;
+  error_close:
+    fsfile_release(f);
+    http_responder_close(out);
+}
+
+closure_func_basic(binding_handler, boolean, httpd_cfg,
+                   value s, value v)
+{
+    if (s == sym(port)) {
+        if (!u64_from_value(v, &httpd.port) || !httpd.port || (httpd.port > U16_MAX)) {
+            rprintf("httpd: invalid port\n");
+            return false;
+        }
+    } else if (s == sym(root)) {
+        if (!is_string(v) || !buffer_length(v) || (*(u8 *)buffer_ref(v, 0) != '/')) {
+            rprintf("httpd: invalid root directory\n");
+            return false;
+        }
+        httpd.root = v;
+    } else {
+        rprintf("httpd: invalid option %v\n", s);
+        return false;
+    }
+    return true;
+}
+
+int init(status_handler complete)
+{
+    httpd.h = heap_locked(get_kernel_heaps());
+    tuple root = get_root_tuple();
+    tuple cfg = get(root, sym(httpd));
+    if (!cfg) {
+        rprintf("httpd configuration not specified\n");
+        return KLIB_INIT_FAILED;
+    }
+    httpd.port = HTTPD_PORT_DEFAULT;
+    if (!is_tuple(cfg) || !iterate(cfg, stack_closure_func(binding_handler, httpd_cfg))) {
+        rprintf("invalid httpd configuration\n");
+        return KLIB_INIT_FAILED;
+    }
+    if (!httpd.root) {
+        httpd.root = allocate_buffer(httpd.h, 1);
+        if (httpd.root == INVALID_ADDRESS)
+            return KLIB_INIT_FAILED;
+    }
+    /* URIs start with a slash */
+    if (*(u8 *)buffer_ref(httpd.root, buffer_length(httpd.root) - 1) == '/')
+        httpd.root->end--;
+    httpd.hl = allocate_http_listener(httpd.h, httpd.port);
+    if (httpd.hl == INVALID_ADDRESS)
+        return KLIB_INIT_FAILED;
+    http_register_default_handler(httpd.hl,
+                                  closure_func(httpd.h, http_request_handler, httpd_request));
+    status s = listen_port(httpd.h, httpd.port, connection_handler_from_http_listener(httpd.hl));
+    if (!is_ok(s)) {
+        rprintf("httpd: cannot listen on port %ld: %v\n", httpd.port, s);
+        timm_dealloc(s);
+        deallocate_http_listener(httpd.h, httpd.hl);
+        return KLIB_INIT_FAILED;
+    }
+    return KLIB_INIT_OK;
+}
@@ -1,9 +1,10 @@
-#include <kernel.h>
+#include <unix_internal.h>
 #include <lwip.h>
 
 #define _RUNTIME_H_ /* guard against double inclusion of runtime.h */
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/entropy.h>
+#include <mbedtls/gcm.h>
 #include <mbedtls/ssl.h>
 
 typedef struct tls_conn {
@@ -258,6 +259,203 @@ int tls_connect(ip_addr_t *addr, u16 port, connection_handler ch)
     return ret;
 }
 
+/* kTLS record protection with AES-GCM ciphers (as negotiated in TLS 1.2 and TLS 1.3) */
+
+#define TLS_1_2_VERSION         0x0303
+#define TLS_1_3_VERSION         0x0304
+
+#define TLS_CIPHER_AES_GCM_128  51
+#define TLS_CIPHER_AES_GCM_256  52
+
+#define KTLS_SALT_SIZE      4
+#define KTLS_IV_SIZE        8
+#define KTLS_NONCE_SIZE     (KTLS_SALT_SIZE + KTLS_IV_SIZE)
+#define KTLS_REC_SEQ_SIZE   8
+#define KTLS_TAG_SIZE       16
+#define KTLS_AAD_SIZE       13  /* TLS 1.2: sequence number, record type, version and length */
+
+typedef struct ktls_ctx {
+    heap h;
+    mbedtls_gcm_context gcm;
+    u16 version;
+    u8 iv[KTLS_NONCE_SIZE];     /* salt followed by the IV */
+    u64 seq;
+} *ktls_ctx;
+
+static int ktls_init(heap h, void *crypto_info, u64 len, void **ctx)
+{
+    struct {
+        u16 version;
+        u16 cipher_type;
+    } *info = crypto_info;
+    u64 key_len;
+    switch (info->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+        key_len = 16;
+        break;
+    case TLS_CIPHER_AES_GCM_256:
+        key_len = 32;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (((info->version != TLS_1_2_VERSION) && (info->version != TLS_1_3_VERSION)) ||
+        (len != sizeof(*info) + KTLS_IV_SIZE + key_len + KTLS_SALT_SIZE + KTLS_REC_SEQ_SIZE))
+        return -EINVAL;
+    u8 *iv = crypto_info + sizeof(*info);
+    u8 *key = iv + KTLS_IV_SIZE;
+    u8 *salt = key + key_len;
+    u8 *rec_seq = salt + KTLS_SALT_SIZE;
+    ktls_ctx c = allocate(h, sizeof(*c));
+    if (c == INVALID_ADDRESS)
+        return -ENOMEM;
+    mbedtls_gcm_init(&c->gcm);
+    if (mbedtls_gcm_setkey(&c->gcm, MBEDTLS_CIPHER_ID_AES, key, key_len * 8)) {
+        mbedtls_gcm_free(&c->gcm);
+        deallocate(h, c, sizeof(*c));
+        return -EINVAL;
+    }
+    c->h = h;
+    c->version = info->version;
+    runtime_memcpy(c->iv, salt, KTLS_SALT_SIZE);
+    runtime_memcpy(c->iv + KTLS_SALT_SIZE, iv, KTLS_IV_SIZE);
+    runtime_memcpy(&c->seq, rec_seq, KTLS_REC_SEQ_SIZE);
+    c->seq = be64toh(c->seq);
+    *ctx = c;
+    return 0;
+}
+
+static void ktls_deinit(void *ctx)
+{
+    ktls_ctx c = ctx;
+    mbedtls_gcm_free(&c->gcm);
+    zero(c->iv, sizeof(c->iv));
+    deallocate(c->h, c, sizeof(*c));
+}
+
+/* TLS 1.3 per-record nonce: the IV combined with the record sequence number */
+static void ktls_nonce_tls13(ktls_ctx c, u8 *nonce)
+{
+    u64 seq = htobe64(c->seq);
+    runtime_memcpy(nonce, c->iv, KTLS_NONCE_SIZE);
+    for (int i = 0; i < sizeof(seq); i++)
+        nonce[KTLS_SALT_SIZE + i] ^= ((u8 *)&seq)[i];
+}
+
+static void ktls_aad_tls12(ktls_ctx c, u8 *aad, u8 type, u64 len)
+{
+    u64 seq = htobe64(c->seq);
+    runtime_memcpy(aad, &seq, sizeof(seq));
+    aad[8] = type;
+    aad[9] = TLS_1_2_VERSION >> 8;
+    aad[10] = TLS_1_2_VERSION & 0xff;
+    aad[11] = len >> 8;
+    aad[12] = len;
+}
+
+static u64 ktls_encrypt(void *ctx, u8 type, void *in, u64 len, void *out)
+{
+    ktls_ctx c = ctx;
+    u8 *rec = out;
+    u8 nonce[KTLS_NONCE_SIZE];
+    u8 aad[KTLS_AAD_SIZE];
+    const u8 *add;
+    u64 add_len;
+    u8 *payload;
+    u64 payload_len;
+    void *src;
+    if (c->version == TLS_1_2_VERSION) {
+        /* the explicit part of the nonce is sent in the record, and incremented for each record */
+        runtime_memcpy(nonce, c->iv, KTLS_NONCE_SIZE);
+        runtime_memcpy(rec + TLS_RECORD_HDR_LEN, c->iv + KTLS_SALT_SIZE, KTLS_IV_SIZE);
+        u64 explicit;
+        runtime_memcpy(&explicit, c->iv + KTLS_SALT_SIZE, KTLS_IV_SIZE);
+        explicit = htobe64(be64toh(explicit) + 1);
+        runtime_memcpy(c->iv + KTLS_SALT_SIZE, &explicit, KTLS_IV_SIZE);
+        payload = rec + TLS_RECORD_HDR_LEN + KTLS_IV_SIZE;
+        payload_len = len;
+        src = in;
+        ktls_aad_tls12(c, aad, type, len);
+        add = aad;
+        add_len = KTLS_AAD_SIZE;
+        rec[0] = type;
+    } else {
+        /* the actual record type follows the content */
+        ktls_nonce_tls13(c, nonce);
+        payload = rec + TLS_RECORD_HDR_LEN;
+        runtime_memcpy(payload, in, len);
+        payload[len] = type;
+        payload_len = len + 1;
+        src = payload;
+        add = rec;
+        add_len = TLS_RECORD_HDR_LEN;
+        rec[0] = TLS_RECORD_TYPE_DATA;
+    }
+    u64 rec_len = (payload - rec) + payload_len + KTLS_TAG_SIZE;
+    rec[1] = TLS_1_2_VERSION >> 8;  /* legacy record version, also used by TLS 1.3 */
+    rec[2] = TLS_1_2_VERSION & 0xff;
+    rec[3] = (rec_len - TLS_RECORD_HDR_LEN) >> 8;
+    rec[4] = rec_len - TLS_RECORD_HDR_LEN;
+    mbedtls_gcm_crypt_and_tag(&c->gcm, MBEDTLS_GCM_ENCRYPT, payload_len, nonce, sizeof(nonce),
+                              add, add_len, src, payload, KTLS_TAG_SIZE, payload + payload_len);
+    c->seq++;
+    return rec_len;
+}
+
+static s64 ktls_decrypt(void *ctx, void *rec, u64 len, u64 *offset, u8 *type)
+{
+    ktls_ctx c = ctx;
+    u8 *r = rec;
+    u8 nonce[KTLS_NONCE_SIZE];
+    u8 aad[KTLS_AAD_SIZE];
+    const u8 *add;
+    u64 add_len;
+    u8 *payload;
+    s64 payload_len;
+    if (c->version == TLS_1_2_VERSION) {
+        if (len < TLS_RECORD_HDR_LEN + KTLS_IV_SIZE + KTLS_TAG_SIZE)
+            return -EBADMSG;
+        runtime_memcpy(nonce, c->iv, KTLS_SALT_SIZE);
+        runtime_memcpy(nonce + KTLS_SALT_SIZE, r + TLS_RECORD_HDR_LEN, KTLS_IV_SIZE);
+        payload = r + TLS_RECORD_HDR_LEN + KTLS_IV_SIZE;
+        payload_len = len - (payload - r) - KTLS_TAG_SIZE;
+        ktls_aad_tls12(c, aad, r[0], payload_len);
+        add = aad;
+        add_len = KTLS_AAD_SIZE;
+    } else {
+        if ((r[0] != TLS_RECORD_TYPE_DATA) || (len < TLS_RECORD_HDR_LEN + 1 + KTLS_TAG_SIZE))
+            return -EBADMSG;
+        ktls_nonce_tls13(c, nonce);
+        payload = r + TLS_RECORD_HDR_LEN;
+        payload_len = len - TLS_RECORD_HDR_LEN - KTLS_TAG_SIZE;
+        add = r;
+        add_len = TLS_RECORD_HDR_LEN;
+    }
+    if (mbedtls_gcm_auth_decrypt(&c->gcm, payload_len, nonce, sizeof(nonce), add, add_len,
+                                 payload + payload_len, KTLS_TAG_SIZE, payload, payload))
+        return -EBADMSG;
+    c->seq++;
+    if (c->version == TLS_1_2_VERSION) {
+        *type = r[0];
+    } else {
+        /* strip the padding and retrieve the actual record type */
+        while ((payload_len > 0) && !payload[payload_len - 1])
+            payload_len--;
+        if (payload_len == 0)
+            return -EBADMSG;
+        *type = payload[--payload_len];
+    }
+    *offset = payload - r;
+    return payload_len;
+}
+
+static struct ktls_ops ktls_aes_gcm = {
+    .init = ktls_init,
+    .deinit = ktls_deinit,
+    .encrypt = ktls_encrypt,
+    .decrypt = ktls_decrypt,
+};
+
 int init(status_handler complete)
 {
     tls.h = heap_malloc();
@@ -272,6 +470,8 @@ int init(status_handler complete)
         MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
     mbedtls_ssl_conf_authmode(&tls.conf, MBEDTLS_SSL_VERIFY_NONE);
     mbedtls_ssl_conf_rng(&tls.conf, mbedtls_ctr_drbg_random, &tls.ctr_drbg);
+    if (!ktls_register(&ktls_aes_gcm))
+        msg_warn("kTLS operations already registered\n");
     return KLIB_INIT_OK;
 }
 
@@ -43,6 +43,7 @@
 
 static struct {
     u64 sc_abilities[SYS_MAX];
+    u64 sc_allowed[pad(SYS_MAX, 64) / 64];  /* bitmap of syscalls allowed by current abilities */
     u64 abilities;
     struct spinlock lock;
 } pldg;
@@ -68,9 +69,23 @@ static sysreturn pledge_fail(thread t)
     return 0;
 }
 
+/* Must be called with the pledge lock held (or during initialization). */
+static void pledge_set_abilities(u64 abilities)
+{
+    pldg.abilities = abilities;
+    for (int i = 0; i < _countof(pldg.sc_allowed); i++) {
+        u64 allowed = 0;
+        for (int j = 0; (j < 64) && (i * 64 + j < SYS_MAX); j++) {
+            if (abilities & pldg.sc_abilities[i * 64 + j])
+                allowed |= U64_FROM_BIT(j);
+        }
+        pldg.sc_allowed[i] = allowed;
+    }
+}
+
 static boolean pledge_syscall_check(syscall_context sc, sysreturn *rv)
 {
-    if (pldg.abilities & pldg.sc_abilities[sc->call])
+    if (pldg.sc_allowed[sc->call / 64] & U64_FROM_BIT(sc->call & 63))
         return false;
     *rv = pledge_fail(sc->t);
     return true;
@@ -150,7 +165,7 @@ static sysreturn pledge(const char *promises, const char *execpromises)
     if (new_abilities & ~pldg.abilities) {
         rv = -EPERM;
     } else {
-        pldg.abilities = new_abilities;
+        pledge_set_abilities(new_abilities);
         rv = 0;
     }
     spin_unlock(&pldg.lock);
@@ -655,7 +670,6 @@ static boolean pledge_sendmmsg(u64 arg0, u64 arg1, u64 arg2, u64 arg3, u64 arg4,
 
 boolean pledge_init(sb_syscall syscalls, tuple cfg)
 {
-    pldg.abilities = PLEDGE_ALL;
     register_syscall(linux_syscalls, pledge, pledge, 0);
     pledge_syscall_register_default(syscalls, read, PLEDGE_STDIO);
     pledge_syscall_register_default(syscalls, write, PLEDGE_STDIO);
@@ -934,5 +948,6 @@ boolean pledge_init(sb_syscall syscalls, tuple cfg)
     pledge_syscall_register_default(syscalls, io_uring_register, PLEDGE_STDIO);
     pledge_syscall_register_default(syscalls, clone3, PLEDGE_STDIO);
     pledge_syscall_register_default(syscalls, unveil, PLEDGE_UNVEIL);
+    pledge_set_abilities(PLEDGE_ALL);
     return true;
 }
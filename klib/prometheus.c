@@ -0,0 +1,311 @@
+#include <kernel.h>
+#include <net.h>
+#include <http.h>
+
+/* Prometheus exporter: serves the kernel statistics at /metrics in the Prometheus text format.
+ * Most samples are rendered directly from the management tree (scheduler, syscall, page cache, heap,
+ * memory and reclaim statistics), walking the existing management tuples rather than building a
+ * tree per scrape: nested tuples become the components of the metric names, and the keys of
+ * collections (CPUs, syscalls, heaps, histogram buckets, ...) become labels. The network and
+ * storage counters are read from the per-CPU statistics. */
+
+#define PROMETHEUS_PORT_DEFAULT 9100
+#define PROMETHEUS_URI          "metrics"
+#define PROMETHEUS_PREFIX       "nanos_"
+#define PROMETHEUS_NAME_MAX     128
+#define PROMETHEUS_LABELS_MAX   256
+#define PROMETHEUS_BUF_SIZE     (16 * KB)
+
+static struct {
+    heap h;
+    tuple root;
+    u64 port;
+    http_listener hl;
+} prometheus;
+
+/* management tuples rendered as metrics, with the label of their top-level keys */
+static const struct {
+    sstring attr;
+    sstring label;
+} prometheus_sources[] = {
+    {ss_static_init("sched"), ss_static_init("cpu")},
+    {ss_static_init("syscall_stats"), ss_static_init("syscall")},
+    {ss_static_init("pagecache")},
+    {ss_static_init("heaps"), ss_static_init("heap")},
+    {ss_static_init("memory"), ss_static_init("account")},
+    {ss_static_init("reclaim")},
+};
+
+/* nested collections, whose keys become labels */
+static const struct {
+    sstring name;
+    sstring label;
+} prometheus_collections[] = {
+    {ss_static_init("wait_latency"), ss_static_init("bucket")},
+    {ss_static_init("latency"), ss_static_init("bucket")},
+    {ss_static_init("cleaners"), ss_static_init("cleaner")},
+    {ss_static_init("caches"), ss_static_init("size")},
+    {ss_static_init("cpus"), ss_static_init("cpu")},
+};
+
+/* per-CPU counters */
+static const struct {
+    sstring name;
+    sstring help;
+    u64 offset;
+} prometheus_cpu_counters[] = {
+    {ss_static_init("net_rx_packets_total"), ss_static_init("IP packets received"),
+     offsetof(cpuinfo, net_rx_packets)},
+    {ss_static_init("net_rx_bytes_total"), ss_static_init("IP bytes received"),
+     offsetof(cpuinfo, net_rx_bytes)},
+    {ss_static_init("storage_requests_total"), ss_static_init("Requests submitted to storage devices"),
+     offsetof(cpuinfo, storage_reqs)},
+    {ss_static_init("storage_completions_total"), ss_static_init("Storage requests completed"),
+     offsetof(cpuinfo, storage_completions)},
+};
+
+typedef struct prometheus_walk {
+    buffer out;             /* samples output, or 0 while collecting the metric families */
+    vector families;
+    symbol family;          /* family being rendered */
+    sstring label;          /* label of the keys of the tuple being walked */
+    int name_len;
+    int labels_len;
+    char name[PROMETHEUS_NAME_MAX];
+    char labels[PROMETHEUS_LABELS_MAX];
+} *prometheus_walk;
+
+static void prometheus_walk_value(prometheus_walk w, value v);
+
+static boolean prometheus_append_name(prometheus_walk w, string key)
+{
+    int len = buffer_length(key);
+    if (w->name_len + 1 + len > PROMETHEUS_NAME_MAX)
+        return false;
+    w->name[w->name_len++] = '_';
+    for (int i = 0; i < len; i++) {
+        char c = byte(key, i);
+        if (!((c >= 'a') && (c <= 'z')) && !((c >= 'A') && (c <= 'Z')) &&
+            !((c >= '0') && (c <= '9')))
+            c = '_';
+        w->name[w->name_len++] = c;
+    }
+    return true;
+}
+
+static boolean prometheus_append_label(prometheus_walk w, sstring label, string key)
+{
+    int len = buffer_length(key);
+    if (w->labels_len + label.len + len + 4 > PROMETHEUS_LABELS_MAX)
+        return false;
+    if (w->labels_len)
+        w->labels[w->labels_len++] = ',';
+    runtime_memcpy(w->labels + w->labels_len, label.ptr, label.len);
+    w->labels_len += label.len;
+    w->labels[w->labels_len++] = '=';
+    w->labels[w->labels_len++] = '"';
+    for (int i = 0; i < len; i++) {
+        char c = byte(key, i);
+        w->labels[w->labels_len++] = ((c == '"') || (c == '\\') || (c == '\n')) ? '_' : c;
+    }
+    w->labels[w->labels_len++] = '"';
+    return true;
+}
+
+static sstring prometheus_collection_label(string key)
+{
+    for (int i = 0; i < _countof(prometheus_collections); i++)
+        if (!buffer_compare_with_sstring(key, prometheus_collections[i].name))
+            return prometheus_collections[i].label;
+    return sstring_null();
+}
+
+static void prometheus_sample(prometheus_walk w, u64 n)
+{
+    if (!w->out) {
+        symbol family = intern(alloca_wrap_buffer(w->name, w->name_len));
+        symbol f;
+        vector_foreach(w->families, f) {
+            if (f == family)
+                return;
+        }
+        vector_push(w->families, family);
+        return;
+    }
+    string family = symbol_string(w->family);
+    if ((buffer_length(family) != w->name_len) ||
+        runtime_memcmp(buffer_ref(family, 0), w->name, w->name_len))
+        return;
+    buffer_write(w->out, w->name, w->name_len);
+    if (w->labels_len) {
+        push_u8(w->out, '{');
+        buffer_write(w->out, w->labels, w->labels_len);
+        push_u8(w->out, '}');
+    }
+    bprintf(w->out, " %ld\n", n);
+}
+
+closure_function(1, 2, boolean, prometheus_walk_each,
+                 prometheus_walk, w,
+                 value a, value v)
+{
+    prometheus_walk w = bound(w);
+    symbol s = sym_from_attribute(a);
+    if (!s || !v)
+        return true;
+    string key = symbol_string(s);
+    sstring tuple_label = w->label;
+    sstring label = tuple_label;
+    int name_len = w->name_len;
+    int labels_len = w->labels_len;
+    u64 n;
+    boolean ok;
+    if (sstring_is_null(label) && u64_from_attribute(a, &n))
+        label = ss("index");
+    if (!sstring_is_null(label)) {
+        ok = prometheus_append_label(w, label, key);
+        w->label = sstring_null();
+    } else {
+        ok = prometheus_append_name(w, key);
+        w->label = prometheus_collection_label(key);
+    }
+    if (ok)
+        prometheus_walk_value(w, v);
+    w->label = tuple_label;
+    w->name_len = name_len;
+    w->labels_len = labels_len;
+    return true;
+}
+
+static void prometheus_walk_value(prometheus_walk w, value v)
+{
+    u64 n;
+    if (is_tuple(v)) {
+        sstring label = w->label;
+        iterate(v, stack_closure(prometheus_walk_each, w));
+        w->label = label;
+    } else if (u64_from_value(v, &n)) {
+        prometheus_sample(w, n);
+    }
+}
+
+static void prometheus_render_source(prometheus_walk w, buffer b, int i)
+{
+    value v = get(prometheus.root, sym_sstring(prometheus_sources[i].attr));
+    if (!v)
+        return;
+    sstring attr = prometheus_sources[i].attr;
+    runtime_memcpy(w->name, PROMETHEUS_PREFIX, sizeof(PROMETHEUS_PREFIX) - 1);
+    runtime_memcpy(w->name + sizeof(PROMETHEUS_PREFIX) - 1, attr.ptr, attr.len);
+
+    /* samples of a metric family must be contiguous: walk the tuple once to collect the families,
+     * then once per family */
+    w->out = 0;
+    vector_clear(w->families);
+    for (int pass = 0; pass <= vector_length(w->families); pass++) {
+        if (pass > 0) {
+            w->out = b;
+            w->family = vector_get(w->families, pass - 1);
+            bprintf(b, "# TYPE %b untyped\n", symbol_string(w->family));
+        }
+        w->name_len = sizeof(PROMETHEUS_PREFIX) - 1 + attr.len;
+        w->labels_len = 0;
+        w->label = prometheus_sources[i].label;
+        prometheus_walk_value(w, v);
+    }
+}
+
+static void prometheus_render_cpu_counters(buffer b)
+{
+    for (int i = 0; i < _countof(prometheus_cpu_counters); i++) {
+        sstring name = prometheus_cpu_counters[i].name;
+        bprintf(b, "# HELP " PROMETHEUS_PREFIX "%s %s\n", name, prometheus_cpu_counters[i].help);
+        bprintf(b, "# TYPE " PROMETHEUS_PREFIX "%s counter\n", name);
+        for (u64 cpu = 0; cpu < total_processors; cpu++) {
+            u64 *counter = (u64 *)((u8 *)cpuinfo_from_id(cpu) + prometheus_cpu_counters[i].offset);
+            bprintf(b, PROMETHEUS_PREFIX "%s{cpu=\"%ld\"} %ld\n", name, cpu, *counter);
+        }
+    }
+
+    /* a request may complete on a different CPU than the one that submitted it */
+    s64 inflight = 0;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        cpuinfo ci = cpuinfo_from_id(cpu);
+        inflight += ci->storage_reqs - ci->storage_completions;
+    }
+    bprintf(b, "# HELP " PROMETHEUS_PREFIX "storage_inflight Storage requests in flight\n"
+            "# TYPE " PROMETHEUS_PREFIX "storage_inflight gauge\n"
+            PROMETHEUS_PREFIX "storage_inflight %ld\n", MAX(inflight, 0));
+}
+
+closure_func_basic(http_request_handler, void, prometheus_request,
+                   http_method method, http_responder out, value v)
+{
+    status s;
+    if ((method != HTTP_REQUEST_METHOD_GET) || get(v, sym(relative_uri))) {
+        s = send_http_response(out, timm("status", "404 Not Found"),
+                               aprintf(prometheus.h, "Not Found\n"));
+        goto out;
+    }
+    buffer b = allocate_buffer(prometheus.h, PROMETHEUS_BUF_SIZE);
+    vector families = allocate_vector(prometheus.h, 32);
+    if ((b == INVALID_ADDRESS) || (families == INVALID_ADDRESS)) {
+        if (b != INVALID_ADDRESS)
+            deallocate_buffer(b);
+        s = send_http_response(out, timm("status", "503 Service Unavailable"), 0);
+        goto out;
+    }
+    struct prometheus_walk w;
+    w.families = families;
+    for (int i = 0; i < _countof(prometheus_sources); i++)
+        prometheus_render_source(&w, b, i);
+    deallocate_vector(families);
+    prometheus_render_cpu_counters(b);
+    s = send_http_response(out, timm("Content-Type", "text/plain; version=0.0.4"), b);
+  out:
+    if (!is_ok(s))
+        timm_dealloc(s);
+}
+
+closure_func_basic(binding_handler, boolean, prometheus_cfg,
+                   value s, value v)
+{
+    if (s == sym(port)) {
+        if (!u64_from_value(v, &prometheus.port) || !prometheus.port ||
+            (prometheus.port > U16_MAX)) {
+            rprintf("prometheus: invalid port\n");
+            return false;
+        }
+    } else {
+        rprintf("prometheus: invalid option %v\n", s);
+        return false;
+    }
+    return true;
+}
+
+int init(status_handler complete)
+{
+    prometheus.h = heap_locked(get_kernel_heaps());
+    prometheus.root = get_root_tuple();
+    prometheus.port = PROMETHEUS_PORT_DEFAULT;
+    value cfg = get(prometheus.root, sym(prometheus));
+    if (cfg && (!is_tuple(cfg) ||
+                !iterate(cfg, stack_closure_func(binding_handler, prometheus_cfg)))) {
+        rprintf("invalid prometheus configuration\n");
+        return KLIB_INIT_FAILED;
+    }
+    prometheus.hl = allocate_http_listener(prometheus.h, prometheus.port);
+    if (prometheus.hl == INVALID_ADDRESS)
+        return KLIB_INIT_FAILED;
+    http_register_uri_handler(prometheus.hl, ss(PROMETHEUS_URI),
+                              closure_func(prometheus.h, http_request_handler, prometheus_request));
+    status s = listen_port(prometheus.h, prometheus.port,
+                           connection_handler_from_http_listener(prometheus.hl));
+    if (!is_ok(s)) {
+        rprintf("prometheus: cannot listen on port %ld: %v\n", prometheus.port, s);
+        timm_dealloc(s);
+        deallocate_http_listener(prometheus.h, prometheus.hl);
+        return KLIB_INIT_FAILED;
+    }
+    return KLIB_INIT_OK;
+}
@@ -9,6 +9,10 @@
 
 #define SYSLOG_BUF_LEN  (8 * KB)
 
+/* Console writes are queued in a ring and shipped in batches from the flush timer, or from a
+ * bottom half when the ring is half full, so that writers never wait for log file or network I/O. */
+#define SYSLOG_RING_SIZE    (256 * KB)
+
 #define SYSLOG_FLUSH_INTERVAL   seconds(1)
 
 #define SYSLOG_FILE_MAXSIZE_DEFAULT (8 * MB)
@@ -28,6 +32,11 @@
 
 #define SYSLOG_UDP_MSG_MAX  8192
 
+typedef struct syslog_entry {
+    timestamp t;
+    bytes len;
+} *syslog_entry;
+
 typedef struct syslog_udp_msg {
     struct list l;
     bytes len;
@@ -42,6 +51,9 @@ typedef struct syslog_udp_msg {
 static struct {
     struct console_driver driver;
     heap h;
+    ringbuf ring;
+    boolean ship_armed, ship_kicked;
+    closure_struct(thunk, ship_kick);
     buffer file_path;
     u64 file_max_size;
     u64 file_rotate;
@@ -143,9 +155,8 @@ closure_function(4, 1, void, syslog_file_write_complete,
     }
 }
 
-static void syslog_file_flush(status_handler complete)
+static void syslog_file_flush_locked(status_handler complete)
 {
-    syslog_lock();
     sg_list sg = syslog.file_sg;
     if (sg) {
         syslog.file_sg = 0;
@@ -166,11 +177,11 @@ static void syslog_file_flush(status_handler complete)
     } else if (complete) {
         apply(complete, STATUS_OK);
     }
-    syslog_unlock();
 }
 
-static void syslog_file_write(const char *s, bytes count)
+static void syslog_file_write(syslog_entry e)
 {
+    bytes count = e->len;
     if (!syslog.fs_write || (count > SYSLOG_BUF_LEN))
         return;
     if (!syslog.file_sg) {
@@ -194,16 +205,11 @@ static void syslog_file_write(const char *s, bytes count)
         syslog.file_sgb->refcount = 0;
     }
     if (syslog.file_sgb->offset + count <= SYSLOG_BUF_LEN) {
-        runtime_memcpy(syslog.file_sgb->buf + syslog.file_sgb->offset, s, count);
+        ringbuf_peek(syslog.ring, syslog.file_sgb->buf + syslog.file_sgb->offset, count);
         syslog.file_sgb->offset += count;
-        if (!timer_is_active(&syslog.flush_timer)) {
-            register_timer(kernel_timers, &syslog.flush_timer, CLOCK_ID_MONOTONIC,
-                                  SYSLOG_FLUSH_INTERVAL, false, 0,
-                                  (timer_handler)&syslog.flush);
-        }
     } else {
-        syslog_file_flush(0);
-        syslog_file_write(s, count);
+        syslog_file_flush_locked(0);
+        syslog_file_write(e);
     }
 }
 
@@ -227,6 +233,13 @@ static void syslog_set_hdr_len(void)
                      syslog.local_ip_len + 1;
 }
 
+static void syslog_ship_schedule(void)
+{
+    if (!syslog.ship_armed && compare_and_swap_boolean(&syslog.ship_armed, false, true))
+        register_timer(kernel_timers, &syslog.flush_timer, CLOCK_ID_MONOTONIC,
+                       SYSLOG_FLUSH_INTERVAL, false, 0, (timer_handler)&syslog.flush);
+}
+
 static void syslog_udp_send(void)
 {
     u64 msg_count = 0;
@@ -257,9 +270,8 @@ static void syslog_udp_send(void)
             /* Limit the number of packets sent in the initial batch, when an ARP query is likely
              * needed to resolve the destination MAC address in the LAN (outgoing packets need to be
              * queued until an ARP response is received). */
-            if (!list_empty(&syslog.udp_msgs) && !timer_is_active(&syslog.flush_timer))
-                register_timer(kernel_timers, &syslog.flush_timer, CLOCK_ID_MONOTONIC,
-                               SYSLOG_FLUSH_INTERVAL, false, 0, (timer_handler)&syslog.flush);
+            if (!list_empty(&syslog.udp_msgs))
+                syslog_ship_schedule();
             break;
         }
     }
@@ -309,51 +321,97 @@ static void syslog_udp_free(struct pbuf *p)
     deallocate(syslog.h, msg, sizeof(*msg) + msg->len);
 }
 
-static void syslog_udp_write(const char *s, bytes count)
+static void syslog_udp_write(syslog_entry e)
 {
+    bytes count = e->len;
     if (syslog.udp_msg_count >= SYSLOG_UDP_MSG_MAX) /* too many buffered messages */
         return;
     syslog_udp_msg msg = allocate(syslog.h, sizeof(*msg) + syslog.max_hdr_len + count);
     if (msg == INVALID_ADDRESS)
         return;
     msg->len = syslog.max_hdr_len + count;
-    msg->t = kern_now(CLOCK_ID_REALTIME);
+    msg->t = e->t;
     msg->p.custom_free_function = syslog_udp_free;
     pbuf_alloced_custom(PBUF_TRANSPORT, msg->len, PBUF_RAM, &msg->p, msg->buf,
                                PBUF_TRANSPORT + msg->len);
-    runtime_memcpy(msg->buf + PBUF_TRANSPORT + syslog.max_hdr_len, s, count);
-    syslog_lock();
+    ringbuf_peek(syslog.ring, msg->buf + PBUF_TRANSPORT + syslog.max_hdr_len, count);
     list_push_back(&syslog.udp_msgs, &msg->l);
     syslog.udp_msg_count++;
-    if (!timer_is_active(&syslog.flush_timer)) {
-        register_timer(kernel_timers, &syslog.flush_timer, CLOCK_ID_MONOTONIC,
-                       SYSLOG_FLUSH_INTERVAL, false, 0, (timer_handler)&syslog.flush);
+}
+
+/* Moves the entries queued in the ring to the file buffer and the UDP message list. */
+static void syslog_drain_locked(void)
+{
+    ringbuf r = syslog.ring;
+    bytes avail = ringbuf_length_sync(r);
+    while (avail > 0) {
+        struct syslog_entry e;
+        ringbuf_peek(r, &e, sizeof(e));
+        ringbuf_release(r, sizeof(e));
+        if (syslog.file_path)
+            syslog_file_write(&e);
+        if (!sstring_is_null(syslog.server))
+            syslog_udp_write(&e);
+        ringbuf_release(r, e.len);
+        avail -= sizeof(e) + e.len;
     }
+}
+
+static void syslog_ship(boolean flush_file)
+{
+    syslog_lock();
+    syslog_drain_locked();
+    if (flush_file)
+        syslog_file_flush_locked(0);
     syslog_unlock();
+    if (!sstring_is_null(syslog.server))
+        syslog_udp_flush();
 }
 
+/* Console writes are serialized by the console layer, so this is the only producer of the ring. */
 static void syslog_write(void *d, const char *s, bytes count)
 {
-    if (syslog.file_path)
-        syslog_file_write(s, count);
-    if (!sstring_is_null(syslog.server))
-        syslog_udp_write(s, count);
+    ringbuf r = syslog.ring;
+    struct syslog_entry e;
+    if ((count == 0) || (ringbuf_space_sync(r) < sizeof(e) + count))
+        return;     /* shipping cannot keep up: drop the message */
+    e.t = kern_now(CLOCK_ID_REALTIME);
+    e.len = count;
+    ringbuf_stage(r, 0, &e, sizeof(e));
+    ringbuf_stage(r, sizeof(e), s, count);
+    ringbuf_publish(r, sizeof(e) + count);
+    syslog_ship_schedule();
+    if ((ringbuf_space_sync(r) < r->length / 2) && !syslog.ship_kicked &&
+        compare_and_swap_boolean(&syslog.ship_kicked, false, true))
+        async_apply_bh((thunk)&syslog.ship_kick);
+}
+
+closure_func_basic(thunk, void, syslog_ship_kick_func)
+{
+    syslog.ship_kicked = false;
+    syslog_ship(false);
 }
 
 closure_func_basic(timer_handler, void, syslog_timer_func,
                    u64 expiry, u64 overruns)
 {
     if (overruns != timer_disabled) {
-        syslog_file_flush(0);
-        syslog_udp_flush();
+        syslog.ship_armed = false;
+        memory_barrier();
+        syslog_ship(true);
     }
 }
 
 closure_func_basic(shutdown_handler, void, syslog_shutdown_completion,
                    int status, merge m)
 {
-    syslog_file_flush(apply_merge(m));
-    syslog_udp_flush();
+    status_handler complete = apply_merge(m);
+    syslog_lock();
+    syslog_drain_locked();
+    syslog_file_flush_locked(complete);
+    syslog_unlock();
+    if (!sstring_is_null(syslog.server))
+        syslog_udp_flush();
 }
 
 closure_func_basic(binding_handler, boolean, syslog_cfg,
@@ -480,6 +538,12 @@ int init(status_handler complete)
         list_init(&syslog.udp_msgs);
         syslog.arp_init = true;
     }
+    syslog.ring = allocate_ringbuf(syslog.h, SYSLOG_RING_SIZE);
+    if (syslog.ring == INVALID_ADDRESS) {
+        rprintf("syslog: unable to allocate ring\n");
+        return KLIB_INIT_FAILED;
+    }
+    init_closure_func(&syslog.ship_kick, thunk, syslog_ship_kick_func);
     init_timer(&syslog.flush_timer);
     init_closure_func(&syslog.flush, timer_handler, syslog_timer_func);
     add_shutdown_completion(init_closure_func(&syslog.shutdown, shutdown_handler,
@@ -0,0 +1,23 @@
+#include <kernel.h>
+
+#include "../../test/bench/kbench.h"
+
+/* In-kernel runtime microbenchmarks; see test/bench/kbench.h */
+
+static u64 kbench_nsecs(void)
+{
+    return nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW));
+}
+
+static void kbench_report(sstring name, u64 ops, u64 nsecs)
+{
+    rprintf(KBENCH_REPORT_FORMAT, name, ops, nsecs);
+}
+
+int init(status_handler complete)
+{
+    kernel_heaps kh = get_kernel_heaps();
+    kbench_alloc((heap)heap_general(kh), ss("alloc_64_general"));
+    kbench_run_common(heap_locked(kh));
+    return KLIB_INIT_OK;
+}
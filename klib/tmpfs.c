@@ -4,12 +4,12 @@
 #include <storage.h>
 #include <tmpfs.h>
 
+#define TMPFS_SIZE_DIVISOR  2
+
 typedef struct tmpfs_file {
     struct fsfile f;
-    struct rangemap dirty;
     u64 seals;
     closure_struct(sg_io, read);
-    closure_struct(sg_io, write);
     closure_struct(pagecache_node_reserve, reserve);
     closure_struct(thunk, free);
 } *tmpfs_file;
@@ -31,43 +31,16 @@ closure_func_basic(sg_io, void, tmpfsfile_read,
     apply(complete, STATUS_OK);
 }
 
-closure_function(2, 1, boolean, tmpfsfile_write_handler,
-                 rangemap, dirty, pagecache_node, pn,
-                 range r)
-{
-    if (rangemap_insert_range(bound(dirty), r)) {
-        /* Pin the pages so that they cannot be evicted from the page cache. */
-        pagecache_nodelocked_pin(bound(pn), r);
-
-        return false;   /* abort the search, since the range map has been modified */
-    }
-    return true;
-}
-
-closure_func_basic(sg_io, void, tmpfsfile_write,
-                   sg_list sg, range q, status_handler complete)
-{
-    tmpfs_file fsf = struct_from_field(closure_self(), tmpfs_file, write);
-    tmpfs fs = (tmpfs)fsf->f.fs;
-    range pages = range_rshift_pad(q, fs->page_order);
-    int res;
-    filesystem_lock(&fs->fs);
-    do {
-        res = rangemap_range_find_gaps(&fsf->dirty, pages,
-                                       stack_closure(tmpfsfile_write_handler, &fsf->dirty,
-                                                     fsf->f.cache_node));
-    } while (res == RM_ABORT);
-    filesystem_unlock(&fs->fs);
-
-    /* If there are still gaps in the range map (res == RM_MATCH), it means a range could not be
-     * inserted, i.e we are out of memory. */
-    async_apply_status_handler(complete, (res == RM_NOMATCH) ? STATUS_OK : timm_oom);
-}
-
 closure_func_basic(pagecache_node_reserve, status, tmpfsfile_reserve,
                    range q)
 {
     tmpfs_file fsf = struct_from_field(closure_self(), tmpfs_file, reserve);
+    filesystem fs = fsf->f.fs;
+    u64 needed = pagecache_node_get_nonresident(fsf->f.cache_node, q);
+    if (needed && (pagecache_get_volume_resident(fs->pv) + needed > fs->size)) {
+        status s = timm("result", "filesystem size limit reached");
+        return timm_append(s, "fsstatus", "%d", FS_STATUS_NOSPACE);
+    }
     if (fsfile_get_length(&fsf->f) < q.end) {
         fs_status fss = filesystem_truncate(fsf->f.fs, &fsf->f, q.end);
         if (fss != FS_STATUS_OK) {
@@ -78,29 +51,14 @@ closure_func_basic(pagecache_node_reserve, status, tmpfsfile_reserve,
     return STATUS_OK;
 }
 
-closure_function(1, 1, boolean, tmpfs_dirty_destruct,
-                 heap, h,
-                 rmnode n)
-{
-    deallocate(bound(h), n, sizeof(*n));
-    return false;
-}
-
 closure_func_basic(status_handler, void, tmpfsfile_sync_complete,
                    status s)
 {
     if (!is_ok(s))  /* any error during node purge is innocuous */
         timm_dealloc(s);
     fsfile f = struct_from_closure(fsfile, sync_complete);
-    tmpfs_file fsf = (tmpfs_file)f;
-    pagecache_node pn = f->cache_node;
-    rangemap dirty = &fsf->dirty;
-    rangemap_foreach(dirty, n) {
-        pagecache_node_unpin(pn, n->r);
-    }
-    destruct_rangemap(dirty, stack_closure(tmpfs_dirty_destruct, dirty->h));
-    pagecache_deallocate_node(pn);
-    deallocate(f->fs->h, fsf, sizeof(*fsf));
+    pagecache_deallocate_node(f->cache_node);
+    deallocate(f->fs->h, f, sizeof(struct tmpfs_file));
 }
 
 closure_func_basic(thunk, void, tmpfsfile_free)
@@ -114,11 +72,7 @@ closure_func_basic(thunk, void, tmpfsfile_free)
 
 static s64 tmpfsfile_get_blocks(fsfile f)
 {
-    s64 pages = 0;
-    rangemap_foreach(&((tmpfs_file)f)->dirty, n) {
-        pages += range_span(n->r);
-    }
-    return (pages << ((tmpfs)f->fs)->page_order) >> SECTOR_OFFSET;
+    return pagecache_get_node_resident(f->cache_node) >> SECTOR_OFFSET;
 }
 
 static fs_status tmpfs_create(filesystem fs, tuple parent, string name, tuple md, fsfile *f)
@@ -131,8 +85,8 @@ static fs_status tmpfs_create(filesystem fs, tuple parent, string name, tuple md
         fsf = allocate(h, sizeof(*fsf));
         if (fsf == INVALID_ADDRESS)
             return FS_STATUS_NOMEM;
-        fss = fsfile_init(fs, &fsf->f, md, init_closure_func(&fsf->read, sg_io, tmpfsfile_read),
-                          init_closure_func(&fsf->write, sg_io, tmpfsfile_write),
+        /* file contents are resident in the page cache, thus there is no writer */
+        fss = fsfile_init(fs, &fsf->f, md, init_closure_func(&fsf->read, sg_io, tmpfsfile_read), 0,
                           init_closure_func(&fsf->reserve, pagecache_node_reserve,
                                             tmpfsfile_reserve),
                           init_closure_func(&fsf->free, thunk, tmpfsfile_free));
@@ -140,7 +94,6 @@ static fs_status tmpfs_create(filesystem fs, tuple parent, string name, tuple md
             deallocate(h, fsf, sizeof(*fsf));
             return fss;
         }
-        init_rangemap(&fsf->dirty, h);
         fsf->seals = 0;
         fsf->f.get_blocks = tmpfsfile_get_blocks;
         if (f)
@@ -197,7 +150,8 @@ static fs_status tmpfs_get_seals(filesystem fs, fsfile f, u64 *seals)
 
 static u64 tmpfs_freeblocks(filesystem fs)
 {
-    return 0;
+    u64 used = pagecache_get_volume_resident(fs->pv);
+    return (fs->size - MIN(used, fs->size)) >> fs->blocksize_order;
 }
 
 static status_handler tmpfs_get_sync_handler(filesystem fs, fsfile fsf, boolean datasync,
@@ -208,22 +162,27 @@ static status_handler tmpfs_get_sync_handler(filesystem fs, fsfile fsf, boolean
 
 filesystem tmpfs_new(void)
 {
-    heap h = heap_locked(get_kernel_heaps());
+    kernel_heaps kh = get_kernel_heaps();
+    heap h = heap_locked(kh);
     tmpfs fs = allocate(h, sizeof(*fs));
     if (fs == INVALID_ADDRESS)
         return INVALID_ADDRESS;
-    status s = filesystem_init(&fs->fs, h, 0, 1, false);
+
+    /* Since file contents cannot be reclaimed under memory pressure, the filesystem size is limited
+     * to a fraction of the physical memory. */
+    u64 size = heap_total((heap)heap_physical(kh)) / TMPFS_SIZE_DIVISOR;
+    status s = filesystem_init(&fs->fs, h, size, 1, false);
     if (!is_ok(s)) {
         msg_err("%v\n", s);
         timm_dealloc(s);
         goto err_fsinit;
     }
+    pagecache_set_volume_resident(fs->fs.pv);
     fs->fs.get_seals = tmpfs_get_seals;
     fs->fs.set_seals = tmpfs_set_seals;
     fs->files = allocate_table(h, identity_key, pointer_equal);
     if (fs->files == INVALID_ADDRESS)
         goto err_filetable;
-    fs->page_order = pagecache_get_page_order();
     tuple root = allocate_tuple();
     set(root, sym(children), allocate_tuple());
     set(root, sym_this(".."), root);
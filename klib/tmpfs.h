@@ -4,7 +4,6 @@
 typedef struct tmpfs {
     struct filesystem fs;
     table files;
-    int page_order;
 } *tmpfs;
 
 filesystem tmpfs_new(void);
@@ -1,6 +1,7 @@
 #include <unix_internal.h>
 #include <filesystem.h>
 #include <lwip.h>
+#include <lwip/inet_chksum.h>
 #include <socket.h>
 
 #define TUN_MINOR   200
@@ -9,10 +10,15 @@
 #define TUNSETIFF   0x400454ca
 #define TUNGETIFF   0x800454d2
 #define TUNSETQUEUE 0x400454d9
+#define TUNGETFEATURES  0x800454cf
+#define TUNSETOFFLOAD   0x400454d0
+#define TUNGETVNETHDRSZ 0x800454d7
+#define TUNSETVNETHDRSZ 0x400454d8
 
 /* ifreq flags */
 #define IFF_TUN         0x0001
 #define IFF_MULTI_QUEUE 0x0100
+#define IFF_VNET_HDR    0x4000
 
 /* TUNSETQUEUE ifreq flags */
 #define IFF_ATTACH_QUEUE 0x0200
@@ -21,9 +27,33 @@
 #define TUN_TYPE_MASK   0x000f
 #define IFF_NO_PI       0x1000
 
+#define TUN_FEATURES    (IFF_TUN | IFF_NO_PI | IFF_MULTI_QUEUE | IFF_VNET_HDR)
+
 /* Packet information flags */
 #define TUN_PKT_STRIP   0x0001
 
+/* TUNSETOFFLOAD flags */
+#define TUN_F_CSUM      0x01
+#define TUN_F_TSO4      0x02
+#define TUN_F_TSO6      0x04
+#define TUN_F_TSO_ECN   0x08
+#define TUN_F_USO4      0x20
+#define TUN_F_USO6      0x40
+
+#define TUN_OFFLOADS    (TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6 | TUN_F_TSO_ECN | TUN_F_USO4 | \
+                         TUN_F_USO6)
+
+/* virtio net header flags and GSO types */
+#define VIRTIO_NET_HDR_F_NEEDS_CSUM     1
+#define VIRTIO_NET_HDR_GSO_NONE         0
+#define VIRTIO_NET_HDR_GSO_TCPV4        1
+#define VIRTIO_NET_HDR_GSO_TCPV6        4
+#define VIRTIO_NET_HDR_GSO_UDP_L4       5
+#define VIRTIO_NET_HDR_GSO_ECN          0x80
+
+#define TUN_TCP_CSUM_OFFSET 16
+#define TUN_UDP_CSUM_OFFSET 6
+
 #define TUN_QUEUE_LEN   512
 
 typedef struct tun_pi { /* packet information */
@@ -31,6 +61,15 @@ typedef struct tun_pi { /* packet information */
     u16 proto;  /* expressed in network byte order */
 } *tun_pi;
 
+typedef struct tun_vnet_hdr {   /* virtio net header, prepended to packets with IFF_VNET_HDR */
+    u8 flags;
+    u8 gso_type;
+    u16 hdr_len;
+    u16 gso_size;
+    u16 csum_start;
+    u16 csum_offset;
+} *tun_vnet_hdr;
+
 typedef struct tun_file {
     file f;
     queue pq;  /* packet queue */
@@ -50,7 +89,8 @@ typedef struct tun {
     struct spinlock lock;
     struct list files;
     short flags;
-    tun_file next_tx;
+    u32 offloads;
+    int vnet_hdr_sz;
 } *tun;
 
 static heap tun_heap;
@@ -62,36 +102,67 @@ static void notify_events(fdesc f)
     notify_dispatch(f->ns, events);
 }
 
+/* Returns a hash of the addresses, protocol and ports of a packet, so that all the packets of a
+ * given flow are delivered to the same queue. */
+static u32 tun_flow_hash(struct pbuf *p)
+{
+    u32 buf[(IP6_HLEN + 4) / sizeof(u32)];
+    u8 *iph = (u8 *)buf;
+    u16 len = pbuf_copy_partial(p, buf, sizeof(buf), 0);
+    u32 hash;
+    u16 hlen;
+    u8 proto;
+    if ((len >= IP_HLEN) && ((iph[0] >> 4) == 4)) {
+        hlen = (iph[0] & 0xf) * 4;
+        proto = iph[9];
+        hash = buf[3] ^ buf[4];
+        if ((iph[6] & 0x3f) || iph[7])  /* fragment: don't look at ports */
+            proto = 0;
+    } else if ((len >= IP6_HLEN) && ((iph[0] >> 4) == 6)) {
+        hlen = IP6_HLEN;
+        proto = iph[6];
+        hash = 0;
+        for (int i = 2; i < 10; i++)
+            hash ^= buf[i];
+    } else {
+        return 0;
+    }
+    hash ^= proto;
+    if ((proto == IP_PROTO_TCP) || (proto == IP_PROTO_UDP)) {
+        u32 ports;
+        if (pbuf_copy_partial(p, &ports, sizeof(ports), hlen) == sizeof(ports))
+            hash ^= ports;
+    }
+    hash *= 0x9e3779b1;
+    return hash ^ (hash >> 16);
+}
+
 static err_t tun_if_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
 {
     tun t = netif->state;
-    u64 min_ql = U64_MAX;
-    tun_file selected = 0;
+    u32 hash = tun_flow_hash(p);
     int ret = ERR_WOULDBLOCK;
     spin_lock(&t->lock);
-    tun_file f = t->next_tx;
-    do {
-        if (f->attached) {
-            u64 len = queue_length(f->pq);
-            if (len == 0) {
+    int count = 0;
+    list_foreach(&t->files, l) {
+        if (struct_from_list(l, tun_file, l)->attached)
+            count++;
+    }
+    tun_file selected = 0;
+    if (count > 0) {
+        int index = hash % count;
+        list_foreach(&t->files, l) {
+            tun_file f = struct_from_list(l, tun_file, l);
+            if (f->attached && (index-- == 0)) {
                 selected = f;
                 break;
             }
-            if (len < min_ql) {
-                selected = f;
-                min_ql = len;
-            }
         }
-        list next = f->l.next;
-        if (next == &t->files)
-            next = next->next;
-        f = struct_from_list(next, tun_file, l);
-    } while (f != t->next_tx);
+    }
     if (selected && enqueue(selected->pq, p)) {
         pbuf_ref(p);
         if (blockq_wake_one(selected->bq) == INVALID_ADDRESS)
             notify_events(&selected->f->f);
-        t->next_tx = selected;
         ret = ERR_OK;
     }
     spin_unlock(&t->lock);
@@ -106,6 +177,61 @@ static err_t tun_if_init(struct netif *netif)
     return ERR_OK;
 }
 
+/* With the TUN_F_CSUM offload, lwIP doesn't generate TCP checksums for outgoing packets: returns
+ * the offset of the TCP header of a packet (0 if the packet is not a TCP segment) and the
+ * pseudo-header sum its checksum field must be seeded with, so that the reader can complete the
+ * checksum (or let a device compute it) as indicated by the virtio net header. */
+static u16 tun_tcp_csum_seed(struct pbuf *p, u16 *csum)
+{
+    u16 buf[IP6_HLEN / sizeof(u16)];
+    u8 *iph = (u8 *)buf;
+    u16 len = pbuf_copy_partial(p, buf, sizeof(buf), 0);
+    u64 sum = 0;
+    u16 hlen, l4len;
+    if ((len >= IP_HLEN) && ((iph[0] >> 4) == 4)) {
+        hlen = (iph[0] & 0xf) * 4;
+        if ((hlen < IP_HLEN) || (iph[9] != IP_PROTO_TCP) || (iph[6] & 0x3f) || iph[7])
+            return 0;
+        l4len = lwip_ntohs(buf[1]) - hlen;
+        for (int i = 6; i < 10; i++)    /* source and destination */
+            sum += buf[i];
+    } else if ((len >= IP6_HLEN) && ((iph[0] >> 4) == 6)) {
+        if (iph[6] != IP6_NEXTH_TCP)
+            return 0;
+        hlen = IP6_HLEN;
+        l4len = lwip_ntohs(buf[2]);
+        for (int i = 4; i < 20; i++)    /* source and destination */
+            sum += buf[i];
+    } else {
+        return 0;
+    }
+    sum += lwip_htons(IP_PROTO_TCP) + lwip_htons(l4len);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    *csum = sum;
+    return hlen;
+}
+
+/* Completes the checksum of an incoming packet with VIRTIO_NET_HDR_F_NEEDS_CSUM: the checksum
+ * field has been seeded by the writer, and the sum covers the packet from csum_start to its end. */
+static boolean tun_csum_complete(struct pbuf *p, tun_vnet_hdr hdr)
+{
+    if (hdr->csum_start + hdr->csum_offset + sizeof(u16) > p->tot_len)
+        return false;
+    u16 offset = hdr->csum_start;
+    struct pbuf *q = p;
+    while (q->len <= offset) {
+        offset -= q->len;
+        q = q->next;
+    }
+    q->payload += offset;
+    q->len -= offset;
+    u16 csum = inet_chksum_pbuf(q);
+    q->payload -= offset;
+    q->len += offset;
+    return (pbuf_take_at(p, &csum, sizeof(csum), hdr->csum_start + hdr->csum_offset) == ERR_OK);
+}
+
 closure_function(4, 1, sysreturn, tun_read_bh,
                  tun_file, tf, void *, dest, u64, len, io_completion, completion,
                  u64 flags)
@@ -157,12 +283,37 @@ closure_function(4, 1, sysreturn, tun_read_bh,
         dest += sizeof(pi);
         len -= sizeof(pi);
     }
+    u16 csum_start = 0, csum;
+    if (tun->flags & IFF_VNET_HDR) {
+        struct tun_vnet_hdr hdr;
+        if (len < tun->vnet_hdr_sz) {
+            ret = -EINVAL;
+            context_clear_err(ctx);
+            pbuf_free(p);
+            goto out;
+        }
+        zero(&hdr, sizeof(hdr));
+        if ((tun->offloads & TUN_F_CSUM) && (len >= tun->vnet_hdr_sz + p->tot_len))
+            csum_start = tun_tcp_csum_seed(p, &csum);
+        if (csum_start) {
+            hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+            hdr.csum_start = csum_start;
+            hdr.csum_offset = TUN_TCP_CSUM_OFFSET;
+        }
+        runtime_memcpy(dest, &hdr, sizeof(hdr));
+        dest += tun->vnet_hdr_sz;
+        len -= tun->vnet_hdr_sz;
+    }
     ret = MIN(len, p->tot_len);
     pbuf_copy_partial(p, dest, ret, 0);
+    if (csum_start)
+        runtime_memcpy(dest + csum_start + TUN_TCP_CSUM_OFFSET, &csum, sizeof(csum));
     context_clear_err(ctx);
     pbuf_free(p);
     if (!(tun->flags & IFF_NO_PI))
         ret += sizeof(struct tun_pi);
+    if (tun->flags & IFF_VNET_HDR)
+        ret += tun->vnet_hdr_sz;
   out:
     apply(bound(completion), ret);
     if (queue_empty(tf->pq))
@@ -184,6 +335,75 @@ closure_func_basic(file_io, sysreturn, tun_read,
     return blockq_check(tf->bq, ba, bh);
 }
 
+/* Splits a UDP GSO packet (VIRTIO_NET_HDR_GSO_UDP_L4) into datagrams carrying gso_size bytes of
+ * payload each, and passes them to the network stack. */
+static sysreturn tun_write_uso(tun tun, void *src, u64 len, tun_vnet_hdr hdr, context ctx)
+{
+    u8 h[IP_HLEN_MAX + UDP_HLEN];
+    u16 hlen = hdr->csum_start + UDP_HLEN;
+    if ((hlen > sizeof(h)) || (len <= hlen) || (hdr->gso_size == 0) ||
+        (hdr->csum_offset != TUN_UDP_CSUM_OFFSET))
+        return -EINVAL;
+    if (context_set_err(ctx))
+        return -EFAULT;
+    runtime_memcpy(h, src, hlen);
+    context_clear_err(ctx);
+    struct ip_hdr *iph = (struct ip_hdr *)h;
+    struct ip6_hdr *ip6h = (struct ip6_hdr *)h;
+    boolean ipv4;
+    if ((IPH_V(iph) == 4) && (IPH_HL_BYTES(iph) == hdr->csum_start) &&
+        (IPH_PROTO(iph) == IP_PROTO_UDP))
+        ipv4 = true;
+    else if ((IPH_V(iph) == 6) && (hdr->csum_start == IP6_HLEN) &&
+             (IP6H_NEXTH(ip6h) == IP6_NEXTH_UDP))
+        ipv4 = false;
+    else
+        return -EINVAL;
+    struct udp_hdr *udph = (struct udp_hdr *)(h + hdr->csum_start);
+    ip_addr_t ip_src, ip_dest;
+    if (ipv4) {
+        ip_addr_copy_from_ip4(ip_src, iph->src);
+        ip_addr_copy_from_ip4(ip_dest, iph->dest);
+    } else {
+        ip_addr_copy_from_ip6_packed(ip_src, ip6h->src);
+        ip_addr_copy_from_ip6_packed(ip_dest, ip6h->dest);
+    }
+    u16 ip_id = lwip_ntohs(IPH_ID(iph));
+    struct netif *n = &tun->ndev.n;
+    for (u64 offset = hlen; offset < len; offset += hdr->gso_size) {
+        u16 seg_len = MIN(hdr->gso_size, len - offset);
+        u16 udp_len = UDP_HLEN + seg_len;
+        udph->len = lwip_htons(udp_len);
+        udph->chksum = 0;
+        if (ipv4) {
+            IPH_LEN_SET(iph, lwip_htons(hdr->csum_start + udp_len));
+            IPH_ID_SET(iph, lwip_htons(ip_id++));
+            IPH_CHKSUM_SET(iph, 0);
+            IPH_CHKSUM_SET(iph, inet_chksum(iph, hdr->csum_start));
+        } else {
+            IP6H_PLEN_SET(ip6h, udp_len);
+        }
+        struct pbuf *p = pbuf_alloc(PBUF_LINK, hlen + seg_len, PBUF_POOL);
+        if (!p)
+            return -ENOMEM;
+        pbuf_take(p, h, hlen);
+        if (context_set_err(ctx)) {
+            pbuf_free(p);
+            return -EFAULT;
+        }
+        pbuf_take_at(p, src + offset, seg_len, hlen);
+        context_clear_err(ctx);
+        pbuf_remove_header(p, hdr->csum_start);
+        u16 csum = ip_chksum_pseudo(p, IP_PROTO_UDP, udp_len, &ip_src, &ip_dest);
+        if (csum == 0)
+            csum = 0xffff;
+        pbuf_take_at(p, &csum, sizeof(csum), TUN_UDP_CSUM_OFFSET);
+        pbuf_add_header(p, hdr->csum_start);
+        n->input(p, n);
+    }
+    return 0;
+}
+
 closure_func_basic(file_io, sysreturn, tun_write,
                    void *src, u64 len, u64 offset, context ctx, boolean bh, io_completion completion)
 {
@@ -191,20 +411,45 @@ closure_func_basic(file_io, sysreturn, tun_write,
     tun tun = tf->tun;
     if (!tun)
         return io_complete(completion, -EBADFD);
-    if (tun->flags & IFF_NO_PI) {
-        if (len == 0)
-            return io_complete(completion, -EINVAL);
+    u64 hdr_len = 0;
+    if (!(tun->flags & IFF_NO_PI))
+        hdr_len += sizeof(struct tun_pi);
+    if (tun->flags & IFF_VNET_HDR)
+        hdr_len += tun->vnet_hdr_sz;
+    if ((len < hdr_len) || ((tun->flags & IFF_NO_PI) && (len == hdr_len)))
+        return io_complete(completion, -EINVAL);
+    if (len == hdr_len)
+        return io_complete(completion, len);
+    struct tun_vnet_hdr hdr;
+    if (tun->flags & IFF_VNET_HDR) {
+        if (context_set_err(ctx))
+            return io_complete(completion, -EFAULT);
+        runtime_memcpy(&hdr, src + hdr_len - tun->vnet_hdr_sz, sizeof(hdr));
+        context_clear_err(ctx);
     } else {
-        if (len < sizeof(struct tun_pi))
-            return io_complete(completion, -EINVAL);
-        if (len == sizeof(struct tun_pi))
-            return io_complete(completion, len);
+        zero(&hdr, sizeof(hdr));
+    }
 
-        /* Discard packet information. */
-        src += sizeof(struct tun_pi);
-        len -= sizeof(struct tun_pi);
+    /* Discard packet information and virtio net header. */
+    src += hdr_len;
+    u64 pkt_len = len - hdr_len;
+    switch (hdr.gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+    case VIRTIO_NET_HDR_GSO_NONE:
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        /* lwIP accepts TCP segments larger than the MTU (see net_gro_receive()), thus a TCP GSO
+         * packet is passed to the network stack as is, without segmentation. */
+        break;
+    case VIRTIO_NET_HDR_GSO_UDP_L4: {
+        sysreturn rv = tun_write_uso(tun, src, pkt_len, &hdr, ctx);
+        return io_complete(completion, (rv == 0) ? len : rv);
     }
-    struct pbuf *p = pbuf_alloc(PBUF_LINK, len, PBUF_POOL);
+    default:
+        return io_complete(completion, -EINVAL);
+    }
+    if (pkt_len > U16_MAX)
+        return io_complete(completion, -EINVAL);
+    struct pbuf *p = pbuf_alloc(PBUF_LINK, pkt_len, PBUF_POOL);
     if (!p)
         return io_complete(completion, -ENOMEM);
     u64 copied = 0;
@@ -219,10 +464,12 @@ closure_func_basic(file_io, sysreturn, tun_write,
         q = q->next;
     } while (q);
     context_clear_err(ctx);
+    if ((hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) && !tun_csum_complete(p, &hdr)) {
+        pbuf_free(p);
+        return io_complete(completion, -EINVAL);
+    }
     struct netif *n = &tun->ndev.n;
     n->input(p, n);
-    if (!(tun->flags & IFF_NO_PI))
-        len += sizeof(struct tun_pi);
     return io_complete(completion, len);
 }
 
@@ -287,7 +534,7 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
         default:
             return -EINVAL;
         }
-        if ((ifreq->ifr.ifr_flags & ~TUN_TYPE_MASK) & ~(IFF_NO_PI | IFF_MULTI_QUEUE))
+        if ((ifreq->ifr.ifr_flags & ~TUN_TYPE_MASK) & ~(IFF_NO_PI | IFF_MULTI_QUEUE | IFF_VNET_HDR))
             return -EINVAL;
         struct netif *netif = netif_find(sstring_from_cstring(ifreq->ifr_name, IFNAMSIZ));
         if (netif) {
@@ -303,6 +550,8 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
                 return -ENOMEM;
             spin_lock_init(&tun->lock);
             tun->flags = ifreq->ifr.ifr_flags;
+            tun->offloads = 0;
+            tun->vnet_hdr_sz = sizeof(struct tun_vnet_hdr);
             netif_dev_init(&tun->ndev);
             struct netif *n = &tun->ndev.n;
             if (ifreq->ifr_name[0] && ifreq->ifr_name[1]) {
@@ -321,7 +570,6 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
             netif_add(n, &ipaddr, &netmask, &ipaddr, tun, tun_if_init, netif_input);
             netif_name_cpy(ifreq->ifr_name, n);
             list_init(&tun->files);
-            tun->next_tx = tf;
             if (mtu > 0)
                 n->mtu = mtu;
             if (bringup)
@@ -360,6 +608,47 @@ closure_func_basic(fdesc_ioctl, sysreturn, tun_ioctl,
             tf->attached = false;
         break;
     }
+    case TUNGETFEATURES: {
+        unsigned int features = TUN_FEATURES;
+        if (!set_user_value(varg(ap, unsigned int *), features))
+            return -EFAULT;
+        break;
+    }
+    case TUNSETOFFLOAD: {
+        if (!tun)
+            return -EBADFD;
+        unsigned long offloads = varg(ap, unsigned long);
+        if (offloads & ~TUN_OFFLOADS)
+            return -EINVAL;
+        if (!(offloads & TUN_F_CSUM))
+            offloads = 0;   /* segmentation offloads require checksum offload */
+        tun->offloads = offloads;
+
+        /* with checksum offload, TCP checksums of outgoing packets are completed by the reader */
+        struct netif *n = &tun->ndev.n;
+        if (offloads & TUN_F_CSUM)
+            NETIF_SET_CHECKSUM_CTRL(n, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
+        else
+            NETIF_SET_CHECKSUM_CTRL(n, NETIF_CHECKSUM_ENABLE_ALL);
+        break;
+    }
+    case TUNGETVNETHDRSZ:
+        if (!tun)
+            return -EBADFD;
+        if (!set_user_value(varg(ap, int *), tun->vnet_hdr_sz))
+            return -EFAULT;
+        break;
+    case TUNSETVNETHDRSZ: {
+        if (!tun)
+            return -EBADFD;
+        int size;
+        if (!get_user_value(varg(ap, int *), &size))
+            return -EFAULT;
+        if (size < (int)sizeof(struct tun_vnet_hdr))
+            return -EINVAL;
+        tun->vnet_hdr_sz = size;
+        break;
+    }
     default:
         return ioctl_generic(&tf->f->f, request, ap);
     }
@@ -380,8 +669,6 @@ closure_func_basic(fdesc_close, sysreturn, tun_close,
             netif_remove(&tun->ndev.n);
             deallocate(tun_heap, tun, sizeof(struct tun_file));
             tun = 0;
-        } else if (tun->next_tx == tf) {
-            tun->next_tx = struct_from_list(tun->files.next, tun_file, l);
         }
         if (tun)
             spin_unlock(&tun->lock);
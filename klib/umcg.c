@@ -460,12 +460,12 @@ static sysreturn umcg_ctx_switch(thread t, int next_tid, u64 abs_timeout, u64 *e
         next->server_bq = worker->server_bq;
         set_syscall_return(t, 0);
     }
-    remove_timer(kernel_timers, &next->tmr, 0);
+    if (timer_is_active(&next->tmr))
+        remove_timer(kernel_timers, &next->tmr, 0);
     next->start_time = kern_now(CLOCK_ID_MONOTONIC_RAW);
-    if (next_t->syscall)
-        syscall_return(next_t, get_syscall_return(next_t));
-    else
-        schedule_thread(next_t);
+
+    /* The current thread is about to sleep: hand over the CPU directly to the next thread. */
+    thread_switch_to(next_t);
     if (worker == INVALID_ADDRESS)
         return blockq_check(t->thread_bq, ba, false);
     else
@@ -11,11 +11,30 @@
 
 #define UNVEIL_PERMS_VALID  U64_FROM_BIT(63)
 
+/* Per-CPU cache of the unveil permissions of paths, keyed by starting directory and path: an entry
+ * is valid as long as neither the unveil rules nor the filesystem namespace have changed since it was
+ * filled. */
+#define UNVEIL_CACHE_ORDER      6
+#define UNVEIL_CACHE_PATH_MAX   110
+
+typedef struct unveil_cache_entry {
+    u64 gen;
+    u64 ns_gen;
+    filesystem fs;
+    inode cwd;
+    u64 perms;
+    u8 nofollow;
+    u8 path_len;
+    char path[UNVEIL_CACHE_PATH_MAX];
+} *unveil_cache_entry;
+
 static struct {
     heap h;
     table dirs;
     struct rw_spinlock lock;
     boolean locked;
+    u64 gen;    /* bumped on any change to the unveil rules */
+    unveil_cache_entry cache;
 } unv;
 
 typedef struct unveil_dir {
@@ -104,6 +123,7 @@ static sysreturn unveil_set_dir_perms(filesystem fs, tuple md, u64 perms)
     if ((old_perms & UNVEIL_PERMS_VALID) && (perms & ~old_perms))
         return -EPERM;
     dir->perms = perms;
+    fetch_and_add(&unv.gen, 1);
     return 0;
 }
 
@@ -125,6 +145,7 @@ static sysreturn unveil_set_dir_entry_perms(filesystem fs, tuple md, symbol name
     if ((old_perms & UNVEIL_PERMS_VALID) && (perms & ~old_perms))
         return -EPERM;
     table_set(dir->dir_entries, name, pointer_from_u64(perms));
+    fetch_and_add(&unv.gen, 1);
     return 0;
 }
 
@@ -250,12 +271,16 @@ static u64 unveil_get_perms(filesystem fs, tuple md)
     return perms;
 }
 
-static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring path, boolean nofollow,
-                                            u64 perms)
+/* Retrieves the unveil permissions of a path; cacheable is cleared if the path resolution involves a
+ * filesystem whose namespace changes are not tracked. */
+static u64 unveil_path_perms(filesystem fs, inode cwd, sstring path, boolean nofollow,
+                             boolean *cacheable)
 {
     tuple n;
     fs_status fss = filesystem_get_node(&fs, cwd, path, nofollow,
                                         false, false, false, &n, 0);
+    if (!filesystem_namespace_tracked(fs))
+        *cacheable = false;
     u64 unveil_perms = 0;
     if (fss == FS_STATUS_OK) {
         do {
@@ -267,6 +292,8 @@ static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring pa
             inode ino = fs->get_inode(fs, n);
             filesystem_put_node(fs, n);
             fss = filesystem_get_node(&fs, ino, ss(".."), true, false, false, false, &n, 0);
+            if (!filesystem_namespace_tracked(fs))
+                *cacheable = false;
         } while (fss == FS_STATUS_OK);
     } else {
         /* Nonexistent path: look for the parent directory. */
@@ -283,6 +310,8 @@ static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring pa
             parent_path = ss(".");
         }
         fss = filesystem_get_node(&fs, cwd, parent_path, false, false, false, false, &n, 0);
+        if (!filesystem_namespace_tracked(fs))
+            *cacheable = false;
         if (fss == FS_STATUS_OK) {
             unveil_dir dir = unveil_find_dir(fs, n);
             if (dir && dir->dir_entries) {
@@ -301,7 +330,7 @@ static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring pa
         if (!(unveil_perms & UNVEIL_PERMS_VALID)) {
             if (dir_separator) {
                 path.len = dir_separator - path.ptr;
-                return unveil_check_path_internal(fs, cwd, path, false, perms);
+                return unveil_path_perms(fs, cwd, path, false, cacheable);
             } else {
                 tuple md = filesystem_get_meta(fs, cwd);
                 if (md) {
@@ -311,6 +340,62 @@ static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring pa
             }
         }
     }
+    return unveil_perms;
+}
+
+static u64 unveil_cache_hash(filesystem fs, inode cwd, sstring path, boolean nofollow)
+{
+    u64 hash = 0xcbf29ce484222325;
+    for (int i = 0; i < path.len; i++) {
+        hash ^= (u8)path.ptr[i];
+        hash *= 1099511628211;
+    }
+    hash ^= cwd ^ (u64_from_pointer(fs) >> 4);
+    return (hash ^ (hash >> 32) ^ (hash >> UNVEIL_CACHE_ORDER)) + nofollow;
+}
+
+static unveil_cache_entry unveil_cache_get(u64 hash)
+{
+    return unv.cache + (current_cpu()->id << UNVEIL_CACHE_ORDER) +
+           (hash & MASK(UNVEIL_CACHE_ORDER));
+}
+
+static sysreturn unveil_check_path_internal(filesystem fs, inode cwd, sstring path, boolean nofollow,
+                                            u64 perms)
+{
+    u64 hash = 0;
+    boolean cacheable = unv.cache && (path.len <= UNVEIL_CACHE_PATH_MAX);
+
+    /* The generation numbers are read before retrieving the permissions, so that an entry filled
+     * with results that raced with a change is never valid. */
+    u64 gen = unv.gen;
+    u64 ns_gen = filesystem_namespace_gen();
+    u64 unveil_perms;
+    if (cacheable) {
+        hash = unveil_cache_hash(fs, cwd, path, nofollow);
+        unveil_cache_entry e = unveil_cache_get(hash);
+        if ((e->gen == gen) && (e->ns_gen == ns_gen) && (e->fs == fs) && (e->cwd == cwd) &&
+            (e->nofollow == nofollow) && (e->path_len == path.len) &&
+            !runtime_memcmp(e->path, path.ptr, path.len)) {
+            unveil_perms = e->perms;
+            goto check;
+        }
+        cacheable = filesystem_namespace_tracked(fs);
+    }
+    unveil_perms = unveil_path_perms(fs, cwd, path, nofollow, &cacheable);
+    if (cacheable) {
+        /* path resolution may have suspended this context, thus the CPU may be a different one */
+        unveil_cache_entry e = unveil_cache_get(hash);
+        e->gen = gen;
+        e->ns_gen = ns_gen;
+        e->fs = fs;
+        e->cwd = cwd;
+        e->perms = unveil_perms;
+        e->nofollow = nofollow;
+        e->path_len = path.len;
+        runtime_memcpy(e->path, path.ptr, path.len);
+    }
+  check:
     if (!(unveil_perms & UNVEIL_PERMS_VALID))
         return -ENOENT;
     return (perms & ~unveil_perms) ? -EACCES : 0;
@@ -519,6 +604,8 @@ static boolean unveil_unlinkat(u64 arg0, u64 arg1, u64 arg2, u64 arg3, u64 arg4,
             };
             spin_wlock(&unv.lock);
             unveil_dir dir = table_remove(unv.dirs, &d);
+            if (dir)
+                fetch_and_add(&unv.gen, 1);
             spin_wunlock(&unv.lock);
             if (dir) {
                 if (dir->dir_entries)
@@ -658,6 +745,11 @@ boolean unveil_init(sb_syscall syscalls, tuple cfg)
 {
     unv.h = heap_locked(get_kernel_heaps());
     spin_rw_lock_init(&unv.lock);
+    unv.gen = 1;
+    unv.cache = allocate_zero(unv.h,
+                              total_processors * sizeof(*unv.cache) << UNVEIL_CACHE_ORDER);
+    if (unv.cache == INVALID_ADDRESS)
+        unv.cache = 0;  /* run without cache */
     register_syscall(linux_syscalls, unveil, unveil, 0);
     unveil_syscall_register(syscalls, bind);
     unveil_syscall_register(syscalls, truncate);
@@ -0,0 +1,907 @@
+/* AF_XDP sockets
+ *
+ * Raw packet access for userspace, compatible with the Linux AF_XDP interface: the application
+ * registers a packet buffer area (UMEM) and four rings mapped in its address space, a fill and an rx
+ * ring to receive packets, and a tx and a completion ring to send them. A socket bound to a network
+ * interface takes over the packets received on the interface (as if an XDP program redirected them
+ * all), which are copied into the UMEM frames taken from the fill ring; when multiple sockets are
+ * bound to the same interface, packets are steered by a hash of their IP addresses. Frames queued to
+ * the tx ring are handed to the interface driver without copying, and are returned to the completion
+ * ring when the driver releases them; transmission is started by sendto(), as with the
+ * XDP_USE_NEED_WAKEUP flag.
+ */
+
+#include <unix_internal.h>
+#include <lwip.h>
+#include <net_system_structs.h>
+#include <socket.h>
+
+//#define XDP_DEBUG
+#ifdef XDP_DEBUG
+#define xdp_debug(x, ...) do {rprintf("XDP: " x "\n", ##__VA_ARGS__);} while(0)
+#else
+#define xdp_debug(x, ...)
+#endif
+
+#define SOL_XDP 283
+
+/* bind flags */
+#define XDP_SHARED_UMEM     (1 << 0)
+#define XDP_COPY            (1 << 1)
+#define XDP_ZEROCOPY        (1 << 2)
+#define XDP_USE_NEED_WAKEUP (1 << 3)
+
+/* UMEM flags */
+#define XDP_UMEM_UNALIGNED_CHUNK_FLAG   (1 << 0)
+
+/* ring flags */
+#define XDP_RING_NEED_WAKEUP    (1 << 0)
+
+/* socket options */
+#define XDP_MMAP_OFFSETS            1
+#define XDP_RX_RING                 2
+#define XDP_TX_RING                 3
+#define XDP_UMEM_REG                4
+#define XDP_UMEM_FILL_RING          5
+#define XDP_UMEM_COMPLETION_RING    6
+#define XDP_STATISTICS              7
+#define XDP_OPTIONS                 8
+
+/* mmap offsets of the rings */
+#define XDP_PGOFF_RX_RING               0
+#define XDP_PGOFF_TX_RING               0x80000000
+#define XDP_UMEM_PGOFF_FILL_RING        0x100000000ull
+#define XDP_UMEM_PGOFF_COMPLETION_RING  0x180000000ull
+
+#define XDP_UMEM_MIN_CHUNK_SIZE 2048
+
+#define XSK_RING_MAX_ENTRIES    (32 * KB)
+#define XSK_TX_BATCH            64
+
+struct sockaddr_xdp {
+    u16 sxdp_family;
+    u16 sxdp_flags;
+    u32 sxdp_ifindex;
+    u32 sxdp_queue_id;
+    u32 sxdp_shared_umem_fd;
+};
+
+struct xdp_ring_offset {
+    u64 producer;
+    u64 consumer;
+    u64 desc;
+    u64 flags;
+};
+
+struct xdp_mmap_offsets {
+    struct xdp_ring_offset rx;
+    struct xdp_ring_offset tx;
+    struct xdp_ring_offset fr;
+    struct xdp_ring_offset cr;
+};
+
+struct xdp_umem_reg {
+    u64 addr;
+    u64 len;
+    u32 chunk_size;
+    u32 headroom;
+    u32 flags;
+};
+
+/* size of the original structure, without flags */
+#define XDP_UMEM_REG_V1_SIZE    24
+
+struct xdp_statistics {
+    u64 rx_dropped;
+    u64 rx_invalid_descs;
+    u64 tx_invalid_descs;
+    u64 rx_ring_full;
+    u64 rx_fill_ring_empty_descs;
+    u64 tx_ring_empty_descs;
+};
+
+struct xdp_options {
+    u32 flags;
+};
+
+struct xdp_desc {
+    u64 addr;
+    u32 len;
+    u32 options;
+};
+
+/* Ring header shared with userspace: the producer and consumer indexes and the flags are in separate
+ * cache lines, and are followed by the ring entries (struct xdp_desc for the rx and tx rings, UMEM
+ * addresses for the fill and completion rings). */
+struct xsk_ring_hdr {
+    u32 producer;
+    u8 pad0[60];
+    u32 consumer;
+    u8 pad1[60];
+    u32 flags;
+    u8 pad2[60];
+};
+
+typedef struct xsk_ring {
+    struct xsk_ring_hdr *hdr;   /* 0 if the ring has not been created */
+    void *entries;
+    u32 mask;
+    bytes alloc_size;
+} *xsk_ring;
+
+typedef struct xsk_netif *xsk_netif;
+
+typedef struct xsk {
+    struct sock sock;   /* must be first */
+    struct {
+        u64 addr;       /* user address */
+        u64 len;
+        u32 chunk_size;
+        u32 headroom;
+        boolean unaligned;
+    } umem;
+    boolean umem_registered;
+    struct xsk_ring rx, tx, fill, comp;
+    struct netif *netif;        /* 0 if not bound */
+    xsk_netif xn;               /* rx binding, 0 for sockets without an rx ring */
+    u32 queue_id;
+    u32 tx_inflight;            /* frames handed to the driver and not yet completed */
+    struct xdp_statistics stats;
+    struct refcount refcount;   /* held by the file descriptor and by in-flight tx frames */
+    closure_struct(thunk, free);
+    closure_struct(fdesc_events, events);
+    closure_struct(fdesc_mmap, mmap);
+    closure_struct(fdesc_close, close);
+} *xsk;
+
+/* Interface whose received packets are diverted to AF_XDP sockets. Entries are never removed, so
+ * that the rx hook can always find the original input function of the interface, even if it runs
+ * concurrently with the last socket being unbound. */
+struct xsk_netif {
+    struct list l;
+    struct netif *netif;
+    netif_input_fn input;       /* input function replaced by the rx hook */
+    vector socks;
+};
+
+/* Transmitted frame, referenced by the driver until transmission is complete */
+typedef struct xsk_tx_buf {
+    struct pbuf_custom p;
+    xsk s;
+    u64 addr;
+} *xsk_tx_buf;
+
+static struct {
+    heap h;
+    struct list netifs;
+    struct rw_spinlock lock;    /* covers netifs list and bindings */
+} xdp;
+
+#define xsk_lock(s)     spin_lock(&(s)->sock.f.lock)
+#define xsk_unlock(s)   spin_unlock(&(s)->sock.f.lock)
+
+static boolean xsk_ring_create(xsk_ring r, u32 entries, bytes entry_size)
+{
+    bytes size = pad(sizeof(struct xsk_ring_hdr) + entries * entry_size, PAGESIZE);
+    void *mem = allocate((heap)heap_linear_backed(get_kernel_heaps()), size);
+    if (mem == INVALID_ADDRESS)
+        return false;
+    zero(mem, size);
+    r->entries = mem + sizeof(struct xsk_ring_hdr);
+    r->mask = entries - 1;
+    r->alloc_size = size;
+    write_barrier();
+    r->hdr = mem;
+    return true;
+}
+
+static void xsk_ring_destroy(xsk_ring r)
+{
+    if (r->hdr)
+        deallocate((heap)heap_linear_backed(get_kernel_heaps()), r->hdr, r->alloc_size);
+}
+
+/* Number of entries available to the kernel in a ring produced by userspace; an inconsistent
+ * producer index makes the ring appear empty. */
+static u32 xsk_ring_avail(xsk_ring r)
+{
+    u32 avail = *(volatile u32 *)&r->hdr->producer - r->hdr->consumer;
+    if (avail > r->mask + 1)
+        return 0;
+    read_barrier();
+    return avail;
+}
+
+static void xsk_ring_consume(xsk_ring r)
+{
+    memory_barrier();
+    r->hdr->consumer++;
+}
+
+/* Number of free entries in a ring produced by the kernel */
+static u32 xsk_ring_free(xsk_ring r)
+{
+    u32 used = r->hdr->producer - *(volatile u32 *)&r->hdr->consumer;
+    return (used > r->mask + 1) ? 0 : r->mask + 1 - used;
+}
+
+static void xsk_ring_produce(xsk_ring r)
+{
+    write_barrier();
+    r->hdr->producer++;
+}
+
+static boolean xsk_ring_empty(xsk_ring r)
+{
+    return (*(volatile u32 *)&r->hdr->producer == *(volatile u32 *)&r->hdr->consumer);
+}
+
+/* Returns a kernel address of the UMEM memory at offset, valid up to the end of its page, or 0 if the
+ * memory is not mapped. The translation is done on each access, so that unmapping the UMEM cannot
+ * make the kernel access memory the application does not own. */
+static void *xsk_umem_ptr(xsk s, u64 offset, u64 *page_avail)
+{
+    u64 va = s->umem.addr + offset;
+    physical phys = physical_from_virtual(pointer_from_u64(va));
+    if (phys == INVALID_PHYSICAL)
+        return 0;
+    *page_avail = PAGESIZE - (va & PAGEMASK);
+    return pointer_from_u64(virt_from_linear_backed_phys(phys));
+}
+
+static boolean xsk_umem_write(xsk s, u64 offset, struct pbuf *p)
+{
+    for (; p; p = p->next) {
+        u64 done = 0;
+        while (done < p->len) {
+            u64 avail;
+            void *dest = xsk_umem_ptr(s, offset, &avail);
+            if (!dest)
+                return false;
+            u64 len = MIN(p->len - done, avail);
+            runtime_memcpy(dest, p->payload + done, len);
+            done += len;
+            offset += len;
+        }
+    }
+    return true;
+}
+
+static boolean xsk_umem_read(xsk s, u64 offset, void *dest, u64 len)
+{
+    while (len > 0) {
+        u64 avail;
+        void *src = xsk_umem_ptr(s, offset, &avail);
+        if (!src)
+            return false;
+        u64 xfer = MIN(len, avail);
+        runtime_memcpy(dest, src, xfer);
+        dest += xfer;
+        offset += xfer;
+        len -= xfer;
+    }
+    return true;
+}
+
+/* Checks that a buffer lies within the UMEM and, in aligned mode, within a single chunk. */
+static boolean xsk_umem_valid(xsk s, u64 addr, u64 len)
+{
+    if ((addr >= s->umem.len) || (len > s->umem.len - addr))
+        return false;
+    if (!s->umem.unaligned && (len > 0) &&
+        ((addr & ~(u64)(s->umem.chunk_size - 1)) !=
+         ((addr + len - 1) & ~(u64)(s->umem.chunk_size - 1))))
+        return false;
+    return true;
+}
+
+static void xsk_notify(xsk s)
+{
+    fdesc_notify_events(&s->sock.f);
+}
+
+static void xsk_rx(xsk s, struct pbuf *p)
+{
+    boolean notify = false;
+    xsk_lock(s);
+    if (xsk_ring_avail(&s->fill) == 0) {
+        s->stats.rx_fill_ring_empty_descs++;
+        goto out;
+    }
+    if (xsk_ring_free(&s->rx) == 0) {
+        s->stats.rx_ring_full++;
+        goto out;
+    }
+    u64 addr = ((u64 *)s->fill.entries)[s->fill.hdr->consumer & s->fill.mask];
+    xsk_ring_consume(&s->fill);
+    if (!s->umem.unaligned)
+        addr &= ~(u64)(s->umem.chunk_size - 1);
+    addr += s->umem.headroom;
+    if (!xsk_umem_valid(s, addr, p->tot_len)) {
+        s->stats.rx_dropped++;
+        goto out;
+    }
+    if (!xsk_umem_write(s, addr, p)) {
+        s->stats.rx_invalid_descs++;
+        goto out;
+    }
+    notify = xsk_ring_empty(&s->rx);
+    struct xdp_desc *desc = (struct xdp_desc *)s->rx.entries + (s->rx.hdr->producer & s->rx.mask);
+    desc->addr = addr;
+    desc->len = p->tot_len;
+    desc->options = 0;
+    xsk_ring_produce(&s->rx);
+  out:
+    xsk_unlock(s);
+    if (notify)
+        xsk_notify(s);
+}
+
+/* Hash of the source and destination IP addresses of a packet, used to select the receiving socket
+ * among those bound to an interface. */
+static u32 xsk_flow_hash(struct netif *n, struct pbuf *p)
+{
+    u8 *data = p->payload;
+    u64 offset = (n->flags & NETIF_FLAG_ETHERNET) ? SIZEOF_ETH_HDR : 0;
+    u64 addr_offset, addr_len;
+    if (p->len <= offset)
+        return 0;
+    switch (data[offset] >> 4) {
+    case 4:
+        addr_offset = offset + 12;
+        addr_len = 2 * sizeof(ip4_addr_t);
+        break;
+    case 6:
+        addr_offset = offset + 8;
+        addr_len = 2 * sizeof(ip6_addr_p_t);
+        break;
+    default:
+        return 0;
+    }
+    if (p->len < addr_offset + addr_len)
+        return 0;
+    u32 hash = 0;
+    for (u64 i = 0; i < addr_len; i++)
+        hash = hash * 31 + data[addr_offset + i];
+    return hash * 0x9e3779b1;
+}
+
+static xsk_netif xsk_netif_find(struct netif *n)
+{
+    list_foreach(&xdp.netifs, l) {
+        xsk_netif xn = struct_from_list(l, xsk_netif, l);
+        if (xn->netif == n)
+            return xn;
+    }
+    return 0;
+}
+
+/* Input function of interfaces with bound sockets */
+static err_t xsk_netif_input(struct pbuf *p, struct netif *n)
+{
+    spin_rlock(&xdp.lock);
+    xsk_netif xn = xsk_netif_find(n);
+    assert(xn);
+    int count = vector_length(xn->socks);
+    if (count == 0) {
+        netif_input_fn input = xn->input;
+        spin_runlock(&xdp.lock);
+        return input(p, n);
+    }
+    xsk s = vector_get(xn->socks, (count > 1) ? (xsk_flow_hash(n, p) >> 16) % count : 0);
+    xsk_rx(s, p);
+    spin_runlock(&xdp.lock);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static void xsk_tx_free(struct pbuf *p)
+{
+    xsk_tx_buf b = (xsk_tx_buf)p;
+    xsk s = b->s;
+    xsk_lock(s);
+    boolean notify = xsk_ring_empty(&s->comp);
+    ((u64 *)s->comp.entries)[s->comp.hdr->producer & s->comp.mask] = b->addr;
+    xsk_ring_produce(&s->comp);
+    s->tx_inflight--;
+    xsk_unlock(s);
+    deallocate(xdp.h, b, sizeof(*b));
+    if (notify)
+        xsk_notify(s);
+    refcount_release(&s->refcount);
+}
+
+static err_t xsk_netif_output(struct netif *n, struct pbuf *p)
+{
+    if (n->flags & NETIF_FLAG_ETHERNET)
+        return n->linkoutput(n, p);
+
+    /* layer 3 interface (e.g. tun): frames are IP packets */
+    u8 *data = p->payload;
+    switch (data[0] >> 4) {
+    case 4: {
+        if ((p->len < IP_HLEN) || !n->output)
+            return ERR_VAL;
+        ip4_addr_t dest;
+        runtime_memcpy(&dest, data + 16, sizeof(dest));
+        return n->output(n, p, &dest);
+    }
+    case 6: {
+        if ((p->len < IP6_HLEN) || !n->output_ip6)
+            return ERR_VAL;
+        ip6_addr_t dest;
+        ip6_addr_copy_from_packed(dest, *(ip6_addr_p_t *)(data + 24));
+        return n->output_ip6(n, p, &dest);
+    }
+    default:
+        return ERR_VAL;
+    }
+}
+
+/* Sends the frames queued in the tx ring; frames contained in a page are sent without copying, and
+ * are completed when released by the driver. */
+static sysreturn xsk_tx(xsk s)
+{
+    sysreturn rv = 0;
+    xsk_lock(s);
+    if (!s->netif || !s->tx.hdr) {
+        rv = -ENXIO;
+        goto out;
+    }
+    struct netif *n = s->netif;
+    if (!netif_is_up(n) || !netif_is_link_up(n)) {
+        rv = -ENETDOWN;
+        goto out;
+    }
+    for (int sent = 0; sent < XSK_TX_BATCH; sent++) {
+        if (xsk_ring_avail(&s->tx) == 0) {
+            if (sent == 0)
+                s->stats.tx_ring_empty_descs++;
+            break;
+        }
+
+        /* reserve a completion ring entry for each in-flight frame */
+        if (xsk_ring_free(&s->comp) <= s->tx_inflight) {
+            rv = -EAGAIN;
+            break;
+        }
+        struct xdp_desc desc = ((struct xdp_desc *)s->tx.entries)[s->tx.hdr->consumer & s->tx.mask];
+        xsk_ring_consume(&s->tx);
+        if ((desc.len == 0) || (desc.len > n->mtu + SIZEOF_ETH_HDR) ||
+            !xsk_umem_valid(s, desc.addr, desc.len)) {
+            s->stats.tx_invalid_descs++;
+            continue;
+        }
+        u64 avail;
+        void *data = xsk_umem_ptr(s, desc.addr, &avail);
+        if (!data) {
+            s->stats.tx_invalid_descs++;
+            continue;
+        }
+        struct pbuf *p;
+        xsk_tx_buf b = 0;
+        if (desc.len <= avail) {
+            b = allocate(xdp.h, sizeof(*b));
+            if (b == INVALID_ADDRESS) {
+                rv = -ENOMEM;
+                break;
+            }
+            b->s = s;
+            b->addr = desc.addr;
+            b->p.custom_free_function = xsk_tx_free;
+            p = pbuf_alloced_custom(PBUF_RAW, desc.len, PBUF_REF, &b->p, data, desc.len);
+            s->tx_inflight++;
+            refcount_reserve(&s->refcount);
+        } else {
+            /* frame crossing a page boundary: copy it */
+            p = pbuf_alloc(PBUF_RAW, desc.len, PBUF_RAM);
+            if (!p) {
+                rv = -ENOMEM;
+                break;
+            }
+            if (!xsk_umem_read(s, desc.addr, p->payload, desc.len)) {
+                pbuf_free(p);
+                s->stats.tx_invalid_descs++;
+                continue;
+            }
+        }
+        xsk_unlock(s);  /* the driver may release the frame synchronously */
+        err_t err = xsk_netif_output(n, p);
+        xdp_debug("tx addr 0x%lx, len %d, err %d", desc.addr, desc.len, err);
+        pbuf_free(p);
+        xsk_lock(s);
+        if (!b) {
+            ((u64 *)s->comp.entries)[s->comp.hdr->producer & s->comp.mask] = desc.addr;
+            xsk_ring_produce(&s->comp);
+        }
+        if (err != ERR_OK) {
+            rv = (err == ERR_MEM || err == ERR_BUF) ? -ENOBUFS : -EIO;
+            break;
+        }
+    }
+  out:
+    xsk_unlock(s);
+    return rv;
+}
+
+static void xsk_unbind(xsk s)
+{
+    spin_wlock(&xdp.lock);
+    xsk_netif xn = s->xn;
+    if (xn) {
+        for (int i = 0; i < vector_length(xn->socks); i++) {
+            if (vector_get(xn->socks, i) == s) {
+                vector_delete(xn->socks, i);
+                break;
+            }
+        }
+        if (vector_length(xn->socks) == 0)
+            xn->netif->input = xn->input;
+        s->xn = 0;
+    }
+    spin_wunlock(&xdp.lock);
+    if (s->netif) {
+        netif_unref(s->netif);
+        s->netif = 0;
+    }
+}
+
+static sysreturn xsk_bind(struct sock *sock, struct sockaddr *addr, socklen_t addrlen)
+{
+    xsk s = (xsk)sock;
+    struct sockaddr_xdp sxdp;
+    sysreturn rv;
+    if (addrlen < sizeof(sxdp)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx)) {
+        rv = -EFAULT;
+        goto out;
+    }
+    runtime_memcpy(&sxdp, addr, sizeof(sxdp));
+    context_clear_err(ctx);
+    if (sxdp.sxdp_family != AF_XDP) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (sxdp.sxdp_flags & (XDP_SHARED_UMEM | XDP_ZEROCOPY)) {
+        rv = -EOPNOTSUPP;
+        goto out;
+    }
+    xsk_lock(s);
+    if (s->netif) {
+        rv = -EINVAL;
+        goto unlock;
+    }
+    if (!s->umem_registered || !s->fill.hdr || !s->comp.hdr || (!s->rx.hdr && !s->tx.hdr)) {
+        rv = -EINVAL;
+        goto unlock;
+    }
+    struct netif *n = netif_get_by_index(sxdp.sxdp_ifindex);
+    if (!n) {
+        rv = -ENODEV;
+        goto unlock;
+    }
+    xdp_debug("bind to interface %d, queue %d, flags 0x%x", sxdp.sxdp_ifindex,
+              sxdp.sxdp_queue_id, sxdp.sxdp_flags);
+    s->netif = n;
+    s->queue_id = sxdp.sxdp_queue_id;
+    if (s->tx.hdr && (sxdp.sxdp_flags & XDP_USE_NEED_WAKEUP))
+        s->tx.hdr->flags = XDP_RING_NEED_WAKEUP;
+    xsk_unlock(s);
+    rv = 0;
+    if (s->rx.hdr) {
+        spin_wlock(&xdp.lock);
+        xsk_netif xn = xsk_netif_find(n);
+        if (!xn) {
+            xn = allocate(xdp.h, sizeof(*xn));
+            if (xn != INVALID_ADDRESS) {
+                xn->socks = allocate_vector(xdp.h, 4);
+                if (xn->socks != INVALID_ADDRESS) {
+                    xn->netif = n;
+                    list_push_back(&xdp.netifs, &xn->l);
+                } else {
+                    deallocate(xdp.h, xn, sizeof(*xn));
+                    xn = INVALID_ADDRESS;
+                }
+            }
+        }
+        if (xn != INVALID_ADDRESS) {
+            if (vector_length(xn->socks) == 0) {
+                xn->input = n->input;
+                n->input = xsk_netif_input;
+            }
+            vector_push(xn->socks, s);
+            s->xn = xn;
+        } else {
+            rv = -ENOMEM;
+        }
+        spin_wunlock(&xdp.lock);
+        if (rv)
+            xsk_unbind(s);
+    }
+    goto out;
+  unlock:
+    xsk_unlock(s);
+  out:
+    socket_release(sock);
+    return rv;
+}
+
+static sysreturn xsk_umem_reg(xsk s, void *optval, socklen_t optlen)
+{
+    struct xdp_umem_reg mr;
+    if (optlen < XDP_UMEM_REG_V1_SIZE)
+        return -EINVAL;
+    zero(&mr, sizeof(mr));
+    sysreturn rv = sockopt_copy_from_user(optval, MIN(optlen, sizeof(mr)), &mr,
+                                          MIN(optlen, sizeof(mr)));
+    if (rv)
+        return rv;
+    boolean unaligned = (mr.flags & XDP_UMEM_UNALIGNED_CHUNK_FLAG) != 0;
+    if ((mr.flags & ~XDP_UMEM_UNALIGNED_CHUNK_FLAG) ||
+        (mr.chunk_size < XDP_UMEM_MIN_CHUNK_SIZE) || (mr.chunk_size > PAGESIZE) ||
+        (!unaligned && (mr.chunk_size & (mr.chunk_size - 1))) ||
+        (mr.addr & PAGEMASK) || (mr.len < mr.chunk_size) || (mr.headroom >= mr.chunk_size))
+        return -EINVAL;
+    if (!fault_in_user_memory(pointer_from_u64(mr.addr), mr.len, true))
+        return -EFAULT;
+    xsk_lock(s);
+    if (s->umem_registered) {
+        rv = -EBUSY;
+    } else {
+        s->umem.addr = mr.addr;
+        s->umem.len = mr.len;
+        s->umem.chunk_size = mr.chunk_size;
+        s->umem.headroom = mr.headroom;
+        s->umem.unaligned = unaligned;
+        s->umem_registered = true;
+    }
+    xsk_unlock(s);
+    return rv;
+}
+
+static sysreturn xsk_setsockopt(struct sock *sock, int level, int optname, void *optval,
+                                socklen_t optlen)
+{
+    xsk s = (xsk)sock;
+    sysreturn rv;
+    if (level != SOL_XDP) {
+        rv = -ENOPROTOOPT;
+        goto out;
+    }
+    switch (optname) {
+    case XDP_UMEM_REG:
+        rv = xsk_umem_reg(s, optval, optlen);
+        break;
+    case XDP_RX_RING:
+    case XDP_TX_RING:
+    case XDP_UMEM_FILL_RING:
+    case XDP_UMEM_COMPLETION_RING: {
+        int entries;
+        rv = sockopt_copy_from_user(optval, optlen, &entries, sizeof(entries));
+        if (rv)
+            break;
+        if ((entries <= 0) || (entries > XSK_RING_MAX_ENTRIES) || (entries & (entries - 1))) {
+            rv = -EINVAL;
+            break;
+        }
+        xsk_ring r = (optname == XDP_RX_RING) ? &s->rx : (optname == XDP_TX_RING) ? &s->tx :
+                     (optname == XDP_UMEM_FILL_RING) ? &s->fill : &s->comp;
+        bytes entry_size = ((optname == XDP_RX_RING) || (optname == XDP_TX_RING)) ?
+                           sizeof(struct xdp_desc) : sizeof(u64);
+        xsk_lock(s);
+        if (s->netif)
+            rv = -EBUSY;
+        else if (r->hdr)
+            rv = -EINVAL;
+        else if (!xsk_ring_create(r, entries, entry_size))
+            rv = -ENOMEM;
+        xsk_unlock(s);
+        break;
+    }
+    default:
+        rv = -ENOPROTOOPT;
+    }
+  out:
+    socket_release(sock);
+    return rv;
+}
+
+static sysreturn xsk_getsockopt(struct sock *sock, int level, int optname, void *optval,
+                                socklen_t *optlen)
+{
+    xsk s = (xsk)sock;
+    sysreturn rv;
+    union {
+        struct xdp_mmap_offsets off;
+        struct xdp_statistics stats;
+        struct xdp_options opts;
+    } val;
+    socklen_t len;
+    if (level != SOL_XDP) {
+        rv = -ENOPROTOOPT;
+        goto out;
+    }
+    switch (optname) {
+    case XDP_MMAP_OFFSETS: {
+        struct xdp_ring_offset ring_off = {
+            .producer = offsetof(struct xsk_ring_hdr *, producer),
+            .consumer = offsetof(struct xsk_ring_hdr *, consumer),
+            .desc = sizeof(struct xsk_ring_hdr),
+            .flags = offsetof(struct xsk_ring_hdr *, flags),
+        };
+        val.off.rx = val.off.tx = val.off.fr = val.off.cr = ring_off;
+        len = sizeof(val.off);
+        break;
+    }
+    case XDP_STATISTICS:
+        xsk_lock(s);
+        val.stats = s->stats;
+        xsk_unlock(s);
+        len = sizeof(val.stats);
+        break;
+    case XDP_OPTIONS:
+        val.opts.flags = 0;
+        len = sizeof(val.opts);
+        break;
+    default:
+        rv = -ENOPROTOOPT;
+        goto out;
+    }
+    rv = sockopt_copy_to_user(optval, optlen, &val, len);
+  out:
+    socket_release(sock);
+    return rv;
+}
+
+static sysreturn xsk_sendto(struct sock *sock, void *buf, u64 len, int flags,
+                            struct sockaddr *dest_addr, socklen_t addrlen)
+{
+    sysreturn rv = xsk_tx((xsk)sock);
+    socket_release(sock);
+    return rv;
+}
+
+static sysreturn xsk_sendmsg(struct sock *sock, const struct msghdr *msg, int flags, context ctx,
+                             boolean in_bh, io_completion completion)
+{
+    return io_complete(completion, xsk_tx((xsk)sock));
+}
+
+/* Received packets are placed in the rx ring as they arrive, so there is nothing to wake up. */
+static sysreturn xsk_recvfrom(struct sock *sock, void *buf, u64 len, int flags,
+                              struct sockaddr *src_addr, socklen_t *addrlen)
+{
+    socket_release(sock);
+    return 0;
+}
+
+static sysreturn xsk_recvmsg(struct sock *sock, struct msghdr *msg, int flags, context ctx,
+                             boolean in_bh, io_completion completion)
+{
+    return io_complete(completion, 0);
+}
+
+closure_func_basic(fdesc_events, u32, xsk_events,
+                   thread t)
+{
+    xsk s = struct_from_closure(xsk, events);
+    u32 events = 0;
+    if (s->rx.hdr && !xsk_ring_empty(&s->rx))
+        events |= EPOLLIN;
+    if (s->tx.hdr && (*(volatile u32 *)&s->tx.hdr->producer - s->tx.hdr->consumer <= s->tx.mask))
+        events |= EPOLLOUT;
+    return events;
+}
+
+closure_func_basic(fdesc_mmap, sysreturn, xsk_mmap,
+                   vmap vm, u64 offset)
+{
+    xsk s = struct_from_closure(xsk, mmap);
+    u64 len = range_span(vm->node.r);
+    xdp_debug("mmap offset 0x%lx, len %ld", offset, len);
+    xsk_ring r;
+    switch (offset) {
+    case XDP_PGOFF_RX_RING:
+        r = &s->rx;
+        break;
+    case XDP_PGOFF_TX_RING:
+        r = &s->tx;
+        break;
+    case XDP_UMEM_PGOFF_FILL_RING:
+        r = &s->fill;
+        break;
+    case XDP_UMEM_PGOFF_COMPLETION_RING:
+        r = &s->comp;
+        break;
+    default:
+        return -EINVAL;
+    }
+    if (!r->hdr || (len > r->alloc_size))
+        return -EINVAL;
+    if (vm->flags & VMAP_FLAG_EXEC)
+        return -EACCES;
+    u64 virt = vm->node.r.start;
+    remap(virt, physical_from_virtual(r->hdr), len, pageflags_from_vmflags(vm->flags));
+    vm->allowed_flags |= VMAP_FLAG_WRITABLE | VMAP_FLAG_READABLE;
+    return virt;
+}
+
+closure_func_basic(thunk, void, xsk_free)
+{
+    xsk s = struct_from_closure(xsk, free);
+    xdp_debug("free %p", s);
+    xsk_ring_destroy(&s->rx);
+    xsk_ring_destroy(&s->tx);
+    xsk_ring_destroy(&s->fill);
+    xsk_ring_destroy(&s->comp);
+    socket_deinit(&s->sock);
+    deallocate(xdp.h, s, sizeof(*s));
+}
+
+closure_func_basic(fdesc_close, sysreturn, xsk_close,
+                   context ctx, io_completion completion)
+{
+    xsk s = struct_from_closure(xsk, close);
+    xdp_debug("close %p", s);
+    xsk_unbind(s);
+    socket_flush_q(&s->sock);
+    refcount_release(&s->refcount);
+    return io_complete(completion, 0);
+}
+
+closure_func_basic(socket_family_open, sysreturn, xsk_open,
+                   int type, int protocol)
+{
+    xdp_debug("open: type %d, protocol %d", type, protocol);
+    int flags = type & ~SOCK_TYPE_MASK;
+    if (flags & ~SOCK_FLAGS_MASK)
+        return -EINVAL;
+    type &= SOCK_TYPE_MASK;
+    if (type != SOCK_RAW)
+        return -ESOCKTNOSUPPORT;
+    if (protocol)
+        return -EPROTONOSUPPORT;
+    xsk s = allocate_zero(xdp.h, sizeof(*s));
+    if (s == INVALID_ADDRESS)
+        return -ENOMEM;
+    if (socket_init(xdp.h, AF_XDP, type, flags, &s->sock) < 0) {
+        deallocate(xdp.h, s, sizeof(*s));
+        return -ENOMEM;
+    }
+    init_refcount(&s->refcount, 1, init_closure_func(&s->free, thunk, xsk_free));
+    s->sock.f.events = init_closure_func(&s->events, fdesc_events, xsk_events);
+    s->sock.f.mmap = init_closure_func(&s->mmap, fdesc_mmap, xsk_mmap);
+    s->sock.f.close = init_closure_func(&s->close, fdesc_close, xsk_close);
+    s->sock.bind = xsk_bind;
+    s->sock.setsockopt = xsk_setsockopt;
+    s->sock.getsockopt = xsk_getsockopt;
+    s->sock.sendto = xsk_sendto;
+    s->sock.sendmsg = xsk_sendmsg;
+    s->sock.recvfrom = xsk_recvfrom;
+    s->sock.recvmsg = xsk_recvmsg;
+    s->sock.fd = allocate_fd(current->p, s);
+    if (s->sock.fd == INVALID_PHYSICAL) {
+        apply(s->sock.f.close, 0, io_completion_ignore);
+        return -EMFILE;
+    }
+    return s->sock.fd;
+}
+
+int init(status_handler complete)
+{
+    xdp.h = heap_locked(get_kernel_heaps());
+    list_init(&xdp.netifs);
+    spin_rw_lock_init(&xdp.lock);
+    socket_family_open open = closure_func(xdp.h, socket_family_open, xsk_open);
+    if (open == INVALID_ADDRESS)
+        return KLIB_INIT_FAILED;
+    if (!socket_family_register(AF_XDP, open)) {
+        deallocate_closure(open);
+        return KLIB_INIT_FAILED;
+    }
+    return KLIB_INIT_OK;
+}
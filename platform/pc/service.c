@@ -167,17 +167,24 @@ static void new_cpu()
         kernel_sleep();
 }
 
+/* Processors started at boot; present processors beyond these are not enabled in the MADT and can
+ * be hot-added later. */
+BSS_RO_AFTER_INIT static u64 boot_processors;
+static struct spinlock hotplug_lock;
+
 closure_func_basic(madt_handler, void, count_processors_handler,
                    u8 type, void *p)
 {
     switch (type) {
     case ACPI_MADT_LAPIC:
         if (((acpi_lapic)p)->flags & MADT_LAPIC_ENABLED)
-            present_processors++;
+            boot_processors++;
+        present_processors++;
         break;
     case ACPI_MADT_LAPICx2:
         if (((acpi_lapic_x2)p)->flags & MADT_LAPIC_ENABLED)
-            present_processors++;
+            boot_processors++;
+        present_processors++;
         break;
     }
 }
@@ -185,16 +192,63 @@ closure_func_basic(madt_handler, void, count_processors_handler,
 static void count_processors()
 {
     if (acpi_walk_madt(stack_closure_func(madt_handler, count_processors_handler))) {
-        init_debug("ACPI reports %d processors", present_processors);
+        init_debug("ACPI reports %d processors (%d hotpluggable)", present_processors,
+                   present_processors - boot_processors);
     } else {
-        present_processors = 1;
+        boot_processors = present_processors = 1;
         rprintf("warning: ACPI MADT not found, default to 1 processor\n");
     }
 }
 
+closure_func_basic(srat_handler, void, numa_srat_handler,
+                   u8 type, void *p)
+{
+    switch (type) {
+    case ACPI_SRAT_LAPIC: {
+        acpi_srat_lapic l = p;
+        int cpu = lookup_cpuid_from_apicid(l->apic_id);
+        if ((l->flags & SRAT_LAPIC_ENABLED) && (cpu >= 0))
+            numa_set_cpu_domain(cpu, l->domain_lo | (l->domain_hi[0] << 8) |
+                                (l->domain_hi[1] << 16) | (l->domain_hi[2] << 24));
+        break;
+    }
+    case ACPI_SRAT_LAPICx2: {
+        acpi_srat_lapic_x2 lx2 = p;
+        int cpu = lookup_cpuid_from_apicid(lx2->apic_id);
+        if ((lx2->flags & SRAT_LAPIC_ENABLED) && (cpu >= 0))
+            numa_set_cpu_domain(cpu, lx2->domain);
+        break;
+    }
+    case ACPI_SRAT_MEM: {
+        acpi_srat_mem m = p;
+        if ((m->flags & SRAT_MEM_ENABLED) && m->length_bytes)
+            numa_add_memory(m->domain, irangel(m->base, m->length_bytes));
+        break;
+    }
+    }
+}
+
+closure_func_basic(slit_handler, void, numa_slit_handler,
+                   u64 localities, u8 *distances)
+{
+    for (u64 from = 0; from < localities; from++)
+        for (u64 to = 0; to < localities; to++)
+            numa_set_distance(from, to, distances[from * localities + to]);
+}
+
+static void init_numa(void)
+{
+    if (!acpi_walk_srat(stack_closure_func(srat_handler, numa_srat_handler)))
+        return;
+    acpi_parse_slit(stack_closure_func(slit_handler, numa_slit_handler));
+    numa_topology_done();
+    init_debug("NUMA nodes: %d", numa_node_count());
+}
+
 void count_cpus_present(void)
 {
     count_processors();
+    init_numa();
 }
 
 void start_secondary_cores(kernel_heaps kh)
@@ -204,12 +258,37 @@ void start_secondary_cores(kernel_heaps kh)
     init_mxcsr();
     init_debug("starting APs");
     allocate_apboot((heap)heap_page_backed(kh), new_cpu);
-    for (int i = 1; i < present_processors; i++)
+    for (int i = 1; i < boot_processors; i++)
         start_cpu(i);
     deallocate_apboot((heap)heap_page_backed(kh));
     init_flush(heap_locked(kh));
     init_debug("started %d total processors", total_processors);
 }
+
+/* Starts a processor that has been hot-added after boot. The AP boot page (which is not part of
+ * the physical heap) is mapped only while the processor is being started. */
+boolean start_hotplug_cpu(u64 hw_id)
+{
+    boolean started = false;
+    spin_lock(&hotplug_lock);
+    int cpu = total_processors;
+    int prev = (cpu >= boot_processors) ? apic_hotplug_cpuid(hw_id) : -1;
+    if (prev >= 0) {
+        numa_swap_cpus(prev, cpu);
+        heap stackheap = (heap)heap_page_backed(get_kernel_heaps());
+        map(AP_BOOT_START, AP_BOOT_START, AP_BOOT_END - AP_BOOT_START,
+            pageflags_writable(pageflags_exec(pageflags_memory())));
+        allocate_apboot(stackheap, new_cpu);
+        start_cpu(cpu);
+        deallocate_apboot(stackheap);
+        unmap(AP_BOOT_START, AP_BOOT_END - AP_BOOT_START);
+        started = (total_processors > cpu);
+        if (!started)
+            msg_err("failed to start hot-added processor (APIC ID %ld)\n", hw_id);
+    }
+    spin_unlock(&hotplug_lock);
+    return started;
+}
 #else
 void start_secondary_cores(kernel_heaps kh)
 {
@@ -219,6 +298,11 @@ void count_cpus_present(void)
 {
     present_processors = 1;
 }
+
+boolean start_hotplug_cpu(u64 hw_id)
+{
+    return false;
+}
 #endif
 
 u64 xsave_features();
@@ -514,6 +598,7 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
         init_ata_pci(kh, sa);
 
         init_virtio_9p(kh);
+        init_virtio_fs(kh);
         init_virtio_socket(kh);
     }
 
@@ -521,7 +606,9 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
     init_acpi(kh);
 
     init_virtio_balloon(kh);
+    init_virtio_mem(kh);
     init_virtio_rng(kh);
+    init_virtio_console(kh);
 }
 
 void cmdline_consume(sstring opt_name, cmdline_handler h)
@@ -124,7 +124,7 @@ void pci_platform_init_bar(pci_dev dev, int bar_idx)
 }
 
 u64 pci_platform_allocate_msi(pci_dev dev, thunk h, sstring name, u32 target_cpu,
-                              u32 *address, u32 *data)
+                              range cpu_affinity, u32 *address, u32 *data)
 {
     u64 v = allocate_msi_interrupt();
     if (v == INVALID_PHYSICAL)
@@ -163,7 +163,10 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
     init_virtio_blk(kh, sa);
     init_virtio_scsi(kh, sa);
     init_virtio_balloon(kh);
+    init_virtio_mem(kh);
     init_virtio_rng(kh);
+    init_virtio_console(kh);
     init_virtio_9p(kh);
+    init_virtio_fs(kh);
     init_virtio_socket(kh);
 }
@@ -147,13 +147,13 @@ void pci_platform_init_bar(pci_dev dev, int bar_idx)
 }
 
 u64 pci_platform_allocate_msi(pci_dev dev, thunk h, sstring name, u32 target_cpu,
-                              u32 *address, u32 *data)
+                              range cpu_affinity, u32 *address, u32 *data)
 {
     u64 v = allocate_msi_interrupt();
     if (v == INVALID_PHYSICAL)
         return v;
     register_interrupt(v, h, name);
-    if (!dev_irq_enable(pci_dev_id(dev), v, target_cpu)) {
+    if (!dev_irq_enable(pci_dev_id(dev), v, target_cpu, cpu_affinity)) {
         unregister_interrupt(v);
         deallocate_msi_interrupt(v);
         return INVALID_PHYSICAL;
@@ -342,8 +342,11 @@ void detect_devices(kernel_heaps kh, storage_attach sa)
     init_virtio_scsi(kh, sa);
     init_nvme(kh, sa);
     init_virtio_balloon(kh);
+    init_virtio_mem(kh);
     init_virtio_rng(kh);
+    init_virtio_console(kh);
     init_virtio_9p(kh);
+    init_virtio_fs(kh);
     init_virtio_socket(kh);
     if (!vm_halt) {
         vm_halt = closure_func(heap_locked(kh), halt_handler, psci_vm_halt);
@@ -5,6 +5,7 @@
 
 BSS_RO_AFTER_INIT clock_now platform_monotonic_now;
 BSS_RO_AFTER_INIT clock_timer platform_timer;
+BSS_RO_AFTER_INIT timestamp platform_timer_max;
 
 static inline u64 cntfrq(void)
 {
@@ -37,8 +38,13 @@ BSS_RO_AFTER_INIT closure_struct(arm_timer_percpu_init, _timer_percpu_init);
 
 void init_clock(void)
 {
-    register_platform_clock_now(init_closure(&_clock_now, arm_clock_now), VDSO_CLOCK_SYSCALL, 0);
+    register_platform_clock_now(init_closure(&_clock_now, arm_clock_now), VDSO_CLOCK_ARM_GENERIC,
+                                0);
     register_platform_clock_timer(init_closure_func(&_deadline_timer, clock_timer,
                                                     arm_deadline_timer),
                                   init_closure(&_timer_percpu_init, arm_timer_percpu_init));
+
+    /* CNTV_TVAL_EL0 holds a signed 32-bit count of timer ticks */
+    platform_timer_max = MIN(microseconds(RUNLOOP_TIMER_IDLE_MAX_PERIOD_US),
+                             ((u64)S32_MAX << 32) / cntfrq());
 }
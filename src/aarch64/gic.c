@@ -16,6 +16,22 @@
 /* The physical address of the command queue must be aligned to 64 KB. */
 #define GIC_CMD_QUEUE_SIZE  (64 * KB)
 
+/* Interrupt balancing: at each interval, an LPI may be moved from the CPU taking the most
+ * interrupts to a less loaded CPU in the LPI affinity, if the former CPU takes at least
+ * GIC_IRQ_BALANCE_MIN_COUNT interrupts. */
+#define GIC_IRQ_BALANCE_INTERVAL    seconds(1)
+#define GIC_IRQ_BALANCE_MIN_COUNT   1000
+
+typedef struct its_lpi {
+    u32 dev_id;
+    u32 target_cpu;
+    range affinity;
+    boolean enabled;
+    u64 count;          /* interrupts taken (approximate, not updated atomically) */
+    u64 last_count;     /* value of count at the last balancing pass */
+    u64 rate;           /* interrupts taken during the last balancing interval */
+} *its_lpi;
+
 static struct {
     boolean v3_iface;
     u32 intid_mask;
@@ -31,7 +47,13 @@ static struct {
     u32 dev_id_limit;
     void *its_cmd_queue;
     struct list devices;
-    table its_irq_map;  /* maps interrupt vectors to target CPUs */
+    struct spinlock its_lock;
+    its_lpi *lpis;      /* indexed by event ID; never freed, so that interrupt handlers can count */
+    u32 lpi_num;
+    u64 *cpu_irqs;      /* per-CPU interrupt count used by the balancing pass */
+    boolean balancing;
+    struct timer balance_timer;
+    closure_struct(timer_handler, balance_func);
 } gic;
 
 typedef struct its_dev {
@@ -54,6 +76,7 @@ typedef struct its_dev {
 #define gits_write_32(reg, value)   mmio_write_32(gic.its_base + GITS_ ## reg, value)
 #define gits_write_64(reg, value)   mmio_write_64(gic.its_base + GITS_ ## reg, value)
 
+/* called with its_lock held */
 static void gic_its_cmd(u64 dw0, u64 dw1, u64 dw2, u64 dw3)
 {
     u64 cwrite = gits_read_64(CWRITER);
@@ -273,6 +296,11 @@ u64 gic_dispatch_int(void)
 {
     u64 v = (gic.v3_iface ? read_psr_s(ICC_IAR1_EL1) : mmio_read_32(GICC_IAR)) & gic.intid_mask;
     gic_debug("intid %ld\n", v);
+    if (gic.lpis && (v >= gic_msi_vector_base) && (v - gic_msi_vector_base < gic.lpi_num)) {
+        its_lpi lpi = gic.lpis[v - gic_msi_vector_base];
+        if (lpi)
+            lpi->count++;
+    }
     return v;
 }
 
@@ -282,10 +310,119 @@ void gic_eoi(int irq)
     gicc_write(EOIR1, irq);
 }
 
-boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu)
+/* called with its_lock held */
+static void gic_its_sync(u32 target_cpu)
+{
+    gic_its_cmd(ITS_CMD_SYNC, 0, cpuinfo_from_id(target_cpu)->m.gic_rdist_rdbase << 16, 0);
+}
+
+/* Finds the CPU in the LPI affinity with the least interrupts, giving priority to the current
+ * target of the LPI. */
+static u32 gic_lpi_balance_target(its_lpi lpi)
+{
+    range affinity = lpi->affinity;
+    if (range_empty(affinity))
+        affinity = irange(0, total_processors);
+    u32 target = lpi->target_cpu;
+    for (u32 cpu = affinity.start; cpu < affinity.end; cpu++) {
+        if (gic.cpu_irqs[cpu] < gic.cpu_irqs[target])
+            target = cpu;
+    }
+    return target;
+}
+
+closure_func_basic(timer_handler, void, gic_irq_balance,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    u64 irqflags = spin_lock_irq(&gic.its_lock);
+    zero(gic.cpu_irqs, total_processors * sizeof(gic.cpu_irqs[0]));
+    for (u32 event_id = 0; event_id < gic.lpi_num; event_id++) {
+        its_lpi lpi = gic.lpis[event_id];
+        if (!lpi || !lpi->enabled)
+            continue;
+        u64 count = lpi->count;
+        lpi->rate = count - lpi->last_count;
+        lpi->last_count = count;
+        gic.cpu_irqs[lpi->target_cpu] += lpi->rate;
+    }
+    u32 busiest = 0;
+    for (u32 cpu = 1; cpu < total_processors; cpu++) {
+        if (gic.cpu_irqs[cpu] > gic.cpu_irqs[busiest])
+            busiest = cpu;
+    }
+    u64 busiest_irqs = gic.cpu_irqs[busiest];
+    if (busiest_irqs < GIC_IRQ_BALANCE_MIN_COUNT)
+        goto out;
+
+    /* Move the LPI that results in the lowest maximum load between the busiest CPU and the new
+     * target, if any LPI reduces it. */
+    u32 best_event = 0, best_target = 0;
+    u64 best_max = busiest_irqs;
+    for (u32 event_id = 0; event_id < gic.lpi_num; event_id++) {
+        its_lpi lpi = gic.lpis[event_id];
+        if (!lpi || !lpi->enabled || (lpi->target_cpu != busiest) || !lpi->rate)
+            continue;
+        u32 target = gic_lpi_balance_target(lpi);
+        if (target == busiest)
+            continue;
+        u64 max = MAX(busiest_irqs - lpi->rate, gic.cpu_irqs[target] + lpi->rate);
+        if (max < best_max) {
+            best_max = max;
+            best_event = event_id;
+            best_target = target;
+        }
+    }
+    if (best_max == busiest_irqs)
+        goto out;
+    its_lpi lpi = gic.lpis[best_event];
+    gic_debug("moving event %d of dev 0x%x (%ld interrupts) from CPU %d to CPU %d\n",
+              best_event, lpi->dev_id, lpi->rate, busiest, best_target);
+    gic_its_cmd(((u64)lpi->dev_id << 32) | ITS_CMD_MOVI, best_event, GIC_ICID(best_target), 0);
+    gic_its_sync(best_target);
+    lpi->target_cpu = best_target;
+    irq_put_target_cpu(busiest);
+    cpuinfo_from_id(best_target)->targeted_irqs++;
+  out:
+    spin_unlock_irq(&gic.its_lock, irqflags);
+}
+
+/* called with its_lock held */
+static void gic_irq_balance_start(void)
+{
+    if (gic.balancing || (total_processors < 2))
+        return;
+    heap h = heap_locked(get_kernel_heaps());
+    gic.cpu_irqs = allocate(h, total_processors * sizeof(gic.cpu_irqs[0]));
+    if (gic.cpu_irqs == INVALID_ADDRESS) {
+        gic.cpu_irqs = 0;
+        return;
+    }
+    gic.balancing = true;
+    init_timer(&gic.balance_timer);
+    timer_set_slack(&gic.balance_timer, GIC_IRQ_BALANCE_INTERVAL / 4);
+    register_timer(kernel_timers, &gic.balance_timer, CLOCK_ID_MONOTONIC,
+                   GIC_IRQ_BALANCE_INTERVAL, false, GIC_IRQ_BALANCE_INTERVAL,
+                   init_closure_func(&gic.balance_func, timer_handler, gic_irq_balance));
+}
+
+boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu, range cpu_affinity)
 {
     gic_debug("dev 0x%x, irq %d\n", dev_id, vector);
     if ((vector >= gic_msi_vector_base) && gic.its_base) {
+        u32 event_id = vector - gic_msi_vector_base;
+        if (event_id >= gic.lpi_num)
+            return false;
+        kernel_heaps kh = get_kernel_heaps();
+        u64 irqflags = spin_lock_irq(&gic.its_lock);
+        boolean success = false;
+        its_lpi lpi = gic.lpis[event_id];
+        if (!lpi) {
+            lpi = allocate_zero(heap_locked(kh), sizeof(*lpi));
+            if (lpi == INVALID_ADDRESS)
+                goto out;
+        }
         its_dev dev = 0;
         list_foreach(&gic.devices, l) {
             its_dev d = struct_from_list(l, its_dev, l);
@@ -296,10 +433,9 @@ boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu)
         }
         if (!dev) {
             assert(dev_id < gic.dev_id_limit);
-            kernel_heaps kh = get_kernel_heaps();
             dev = allocate(heap_locked(kh), sizeof(*dev));
             if (dev == INVALID_ADDRESS)
-                return false;
+                goto out;
 
             /* The number of interrupt table entries must be a power of 2. */
             u64 ite_num = U64_FROM_BIT(find_order(gic_msi_vector_num));
@@ -310,7 +446,7 @@ boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu)
             dev->itt = alloc_map(heap_linear_backed(kh), itt_size, &pa);
             if (dev->itt == INVALID_ADDRESS) {
                 deallocate(heap_locked(kh), dev, sizeof(*dev));
-                return false;
+                goto out;
             }
 
             zero(dev->itt, itt_size);
@@ -319,13 +455,24 @@ boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu)
             gic_its_cmd(((u64)dev_id << 32) | ITS_CMD_MAPD, find_order(ite_num) - 1,
                         ITS_MAPD_V | pa, 0);
         }
-        u32 event_id = vector - gic_msi_vector_base;
         gic_its_cmd(((u64)dev_id << 32) | ITS_CMD_MAPTI, ((u64)vector << 32) | event_id,
                     GIC_ICID(target_cpu), 0);
         gic_its_cmd(((u64)dev_id << 32) | ITS_CMD_INV, event_id, 0, 0);
-        cpuinfo ci = cpuinfo_from_id(target_cpu);
-        gic_its_cmd(ITS_CMD_SYNC, 0, ci->m.gic_rdist_rdbase << 16, 0);
-        table_set(gic.its_irq_map, pointer_from_u64((u64)vector), ci);
+        gic_its_sync(target_cpu);
+        lpi->dev_id = dev_id;
+        lpi->target_cpu = target_cpu;
+        lpi->affinity = cpu_affinity;
+        lpi->last_count = lpi->count;
+        lpi->rate = 0;
+        lpi->enabled = true;
+        gic.lpis[event_id] = lpi;
+        gic_irq_balance_start();
+        success = true;
+      out:
+        if (!success && lpi != INVALID_ADDRESS && !gic.lpis[event_id])
+            deallocate(heap_locked(kh), lpi, sizeof(*lpi));
+        spin_unlock_irq(&gic.its_lock, irqflags);
+        return success;
     } else {
         gic_set_int_target(vector, target_cpu);
     }
@@ -337,11 +484,17 @@ void dev_irq_disable(u32 dev_id, int vector)
     gic_debug("dev 0x%x, irq %d\n", dev_id, vector);
     if ((vector >= gic_msi_vector_base) && gic.its_base) {
         u32 event_id = vector - gic_msi_vector_base;
+        if (event_id >= gic.lpi_num)
+            return;
+        u64 irqflags = spin_lock_irq(&gic.its_lock);
         gic_its_cmd(((u64)dev_id << 32) | ITS_CMD_DISCARD, event_id, 0, 0);
         gic_its_cmd(((u64)dev_id << 32) | ITS_CMD_INV, event_id, 0, 0);
-        cpuinfo ci = table_remove(gic.its_irq_map, pointer_from_u64((u64)vector));
-        if (ci)
-            gic_its_cmd(ITS_CMD_SYNC, 0, ci->m.gic_rdist_rdbase << 16, 0);
+        its_lpi lpi = gic.lpis[event_id];
+        if (lpi && lpi->enabled) {
+            gic_its_sync(lpi->target_cpu);
+            lpi->enabled = false;
+        }
+        spin_unlock_irq(&gic.its_lock, irqflags);
     }
 }
 
@@ -359,9 +512,9 @@ void msi_format(u32 *address, u32 *data, int vector, u32 target_cpu)
 void msi_get_config(u32 address, u32 data, int *vector, u32 *target_cpu) {
     if (gic.its_base) {
         *vector = data + gic_msi_vector_base;
-        cpuinfo ci = table_find(gic.its_irq_map, pointer_from_u64((u64)*vector));
-        if (ci)
-            *target_cpu = ci->id;
+        its_lpi lpi = (data < gic.lpi_num) ? gic.lpis[data] : 0;
+        if (lpi && lpi->enabled)
+            *target_cpu = lpi->target_cpu;
         else
             *target_cpu = 0;
     } else {
@@ -417,7 +570,9 @@ static void gits_percpu_init(void)
     ci->m.gic_rdist_rdbase = rdbase;
 
     /* map an interrupt collection to the redistributor associated to this CPU */
+    u64 irqflags = spin_lock_irq(&gic.its_lock);
     gic_its_cmd(ITS_CMD_MAPC, 0, ITS_MAPC_V | (rdbase << 16) | GIC_ICID(ci->id), 0);
+    spin_unlock_irq(&gic.its_lock, irqflags);
 }
 
 static void init_gits(kernel_heaps kh)
@@ -460,9 +615,12 @@ static void init_gits(kernel_heaps kh)
             break;
         }
     }
-    gic.its_irq_map = allocate_table(h, identity_key, pointer_equal);
-    assert(gic.its_irq_map != INVALID_ADDRESS);
+    /* LPI configuration is limited to a page-sized table */
+    gic.lpi_num = MIN(gic_msi_vector_num, PAGESIZE);
+    gic.lpis = allocate_zero(h, gic.lpi_num * sizeof(gic.lpis[0]));
+    assert(gic.lpis != INVALID_ADDRESS);
     list_init(&gic.devices);
+    spin_lock_init(&gic.its_lock);
 
     /* Set up the command queue. */
     gic.its_cmd_queue = alloc_map(backed, GIC_CMD_QUEUE_SIZE, &pa);
@@ -610,3 +768,12 @@ void send_ipi(u64 cpu, u8 vector)
         gicd_write_32(SGIR, sgi);
     }
 }
+
+void send_ipi_mask(u64 *cpus, u8 vector)
+{
+    u64 self = current_cpu()->id;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        if ((cpu != self) && (cpus[cpu / 64] & U64_FROM_BIT(cpu % 64)))
+            send_ipi(cpu, vector);
+    }
+}
@@ -71,6 +71,7 @@ void cpu_init(int cpu)
     register u64 a = u64_from_pointer(ci);
     asm volatile("mov x18, %0; msr tpidr_el1, %0" ::"r"(a));
     write_psr(CNTKCTL_EL1, CNTKCTL_EL1_EL0VCTEN);
+    write_psr(TPIDRRO_EL0, cpu);    /* used by vdso_getcpu() */
 }
 
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
@@ -190,21 +191,33 @@ void count_cpus_present(void)
     }
 }
 
+/* Only the processors enabled in the MADT are present, so there are none to hot-add. */
+boolean start_hotplug_cpu(u64 hw_id)
+{
+    return false;
+}
+
 #ifdef KERNEL
 #define EXTENDED_FRAME_SIZE (FRAME_EXTENDED_MAX * sizeof(u64))
 void init_context_machine(context c)
 {
-    void *e = allocate_zero((heap)heap_page_backed(get_kernel_heaps()),
-                            EXTENDED_FRAME_SIZE);
-    assert(e != INVALID_ADDRESS);
+    void *e;
+    if ((c->type == CONTEXT_TYPE_THREAD) && ((e = thread_extended_frame_get()) != INVALID_ADDRESS)) {
+        zero(e, EXTENDED_FRAME_SIZE);
+    } else {
+        e = allocate_zero((heap)heap_page_backed(get_kernel_heaps()), EXTENDED_FRAME_SIZE);
+        assert(e != INVALID_ADDRESS);
+    }
     c->frame[FRAME_EXTENDED] = u64_from_pointer(e);
 }
 
 void destruct_context(context c)
 {
     if (c->frame[FRAME_EXTENDED]) {
-        deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
-                       c->frame[FRAME_EXTENDED], EXTENDED_FRAME_SIZE);
+        if ((c->type != CONTEXT_TYPE_THREAD) ||
+            !thread_extended_frame_put(pointer_from_u64(c->frame[FRAME_EXTENDED])))
+            deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
+                           c->frame[FRAME_EXTENDED], EXTENDED_FRAME_SIZE);
         c->frame[FRAME_EXTENDED] = 0;
     }
 }
@@ -205,6 +205,15 @@ static inline void wait_for_interrupt(void)
     enable_interrupts();
 }
 
+/* Zeroes memory with non-temporal stores, bypassing the cache; address and length must be
+ * 32-byte aligned. */
+static inline void zero_nontemporal(void *p, bytes len)
+{
+    for (u64 *w = p, *end = p + len; w < end; w += 4)
+        asm volatile("stnp xzr, xzr, [%0]; stnp xzr, xzr, [%0, #16]" :: "r"(w) : "memory");
+    asm volatile("dmb ishst" ::: "memory");
+}
+
 #define cmdline_consume(o, h)   (void)(h)
 #define boot_params_apply(t)
 
@@ -526,6 +535,18 @@ static inline void return_offset(u64 offset) {
             rv;                                                         \
         })
 
+#define do_syscall3(sysnr, arg0, arg1, arg2) ({                         \
+            sysreturn rv;                                               \
+            register u64 _v asm ("x8") = sysnr;                         \
+            register u64 _x0 asm ("x0") = (u64)arg0;                    \
+            register u64 _x1 asm ("x1") = (u64)arg1;                    \
+            register u64 _x2 asm ("x2") = (u64)arg2;                    \
+            asm ("svc 0" : "=r" (_x0) : "r" (_v),                       \
+                "r" (_x0), "r" (_x1), "r" (_x2) : "memory");            \
+            rv = _x0;                                                   \
+            rv;                                                         \
+        })
+
 /* IPI */
 static inline void machine_halt(void)
 {
@@ -325,3 +325,43 @@ static inline __attribute__((always_inline)) u64 rdtsc_precise(void)
     return vct;
 }
 #endif
+
+/* Bulk copy / fill of co-aligned words using 16-byte register pairs, 64 bytes
+   per iteration; returns the number of words processed. */
+#define ARCH_MEMCPY_WORDS
+static inline __attribute__((always_inline)) u64 arch_memcpy_words(u64 *dst, const u64 *src, u64 n)
+{
+    u64 blocks = n >> 3;
+    u64 t0, t1, t2, t3, t4, t5, t6, t7;
+    for (u64 i = blocks; i > 0; i--) {
+        asm volatile("ldp %0, %1, [%8]\n"
+                     "ldp %2, %3, [%8, #16]\n"
+                     "ldp %4, %5, [%8, #32]\n"
+                     "ldp %6, %7, [%8, #48]\n"
+                     "stp %0, %1, [%9]\n"
+                     "stp %2, %3, [%9, #16]\n"
+                     "stp %4, %5, [%9, #32]\n"
+                     "stp %6, %7, [%9, #48]\n"
+                     : "=&r"(t0), "=&r"(t1), "=&r"(t2), "=&r"(t3),
+                       "=&r"(t4), "=&r"(t5), "=&r"(t6), "=&r"(t7)
+                     : "r"(src), "r"(dst) : "memory");
+        src += 8;
+        dst += 8;
+    }
+    return blocks << 3;
+}
+
+#define ARCH_MEMSET_WORDS
+static inline __attribute__((always_inline)) u64 arch_memset_words(u64 *dst, u64 w, u64 n)
+{
+    u64 blocks = n >> 3;
+    for (u64 i = blocks; i > 0; i--) {
+        asm volatile("stp %1, %1, [%0]\n"
+                     "stp %1, %1, [%0, #16]\n"
+                     "stp %1, %1, [%0, #32]\n"
+                     "stp %1, %1, [%0, #48]\n"
+                     : : "r"(dst), "r"(w) : "memory");
+        dst += 8;
+    }
+    return blocks << 3;
+}
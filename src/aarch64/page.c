@@ -30,6 +30,11 @@ void flush_tlb(boolean full_flush)
         asm volatile("tlbi vmalle1is");
 }
 
+void flush_tlb_global(void)
+{
+    flush_tlb(true);
+}
+
 extern void *START, *READONLY_END, *END;
 
 /* init_pt is a 2M block to use for inital ptes */
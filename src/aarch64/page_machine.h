@@ -272,6 +272,12 @@ static inline pageflags pageflags_no_minpage(pageflags flags)
     return (pageflags){.w = flags.w & ~PAGE_NO_BLOCK};
 }
 
+/* kernel (TTBR1) mappings are global already, and full flushes are not ASID-scoped */
+static inline pageflags pageflags_global(pageflags flags)
+{
+    return flags;
+}
+
 /* no-exec, read-only */
 static inline pageflags pageflags_default_user(void)
 {
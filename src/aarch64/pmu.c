@@ -0,0 +1,135 @@
+/* arm64 performance monitoring: PMUv3 event counters
+ *
+ * Counters are accessed through the PMSELR_EL0 selector; the overflow interrupt (a PPI whose number
+ * is platform-specific) is not wired, so only counting events are supported.
+ */
+
+#include <kernel.h>
+#include <pmu.h>
+
+//#define PMU_DEBUG
+#ifdef PMU_DEBUG
+#define pmu_debug(x, ...) do {rprintf("PMU: " x, ##__VA_ARGS__);} while(0)
+#else
+#define pmu_debug(x, ...)
+#endif
+
+#define ID_AA64DFR0_PMUVER_SHIFT    8
+#define ID_AA64DFR0_PMUVER_MASK     0xf
+#define ID_AA64DFR0_PMUVER_IMP_DEF  0xf
+
+#define PMCR_E          U64_FROM_BIT(0)
+#define PMCR_N_SHIFT    11
+#define PMCR_N_MASK     0x1f
+
+#define PMEVTYPER_P     U64_FROM_BIT(31)    /* don't count at EL1 */
+#define PMEVTYPER_U     U64_FROM_BIT(30)    /* don't count at EL0 */
+#define PMEVTYPER_EVENT_MASK    0xffff
+
+#define PMU_COUNTER_WIDTH   32
+
+#define pmu_isb()   asm volatile("isb" ::: "memory")
+
+static const struct {
+    u8 generic;
+    u16 event;
+} pmuv3_events[] = {
+    {PMU_EVENT_CPU_CYCLES, 0x11},           /* CPU_CYCLES */
+    {PMU_EVENT_INSTRUCTIONS, 0x08},         /* INST_RETIRED */
+    {PMU_EVENT_CACHE_REFERENCES, 0x04},     /* L1D_CACHE */
+    {PMU_EVENT_CACHE_MISSES, 0x03},         /* L1D_CACHE_REFILL */
+    {PMU_EVENT_BRANCH_INSTRUCTIONS, 0x21},  /* BR_RETIRED */
+    {PMU_EVENT_BRANCH_MISSES, 0x10},        /* BR_MIS_PRED */
+    {PMU_EVENT_BUS_CYCLES, 0x1d},           /* BUS_CYCLES */
+};
+
+BSS_RO_AFTER_INIT static struct {
+    int counters;
+} pmu;
+
+boolean init_pmu(kernel_heaps kh, thunk overflow_handler)
+{
+    u64 ver = (read_psr(ID_AA64DFR0_EL1) >> ID_AA64DFR0_PMUVER_SHIFT) & ID_AA64DFR0_PMUVER_MASK;
+    if ((ver == 0) || (ver == ID_AA64DFR0_PMUVER_IMP_DEF))
+        return false;
+    pmu.counters = (read_psr(PMCR_EL0) >> PMCR_N_SHIFT) & PMCR_N_MASK;
+    pmu_debug("PMUv3 version %ld, %d counters\n", ver, pmu.counters);
+    return (pmu.counters > 0);
+}
+
+int pmu_counter_count(void)
+{
+    return pmu.counters;
+}
+
+u64 pmu_counter_mask(void)
+{
+    return MASK(PMU_COUNTER_WIDTH);
+}
+
+boolean pmu_sampling_supported(void)
+{
+    return false;
+}
+
+boolean pmu_hw_event(u64 id, u64 *event)
+{
+    for (int i = 0; i < _countof(pmuv3_events); i++)
+        if (pmuv3_events[i].generic == id) {
+            *event = pmuv3_events[i].event;
+            return true;
+        }
+    return false;
+}
+
+boolean pmu_raw_event(u64 config, u64 *event)
+{
+    if (config & ~PMEVTYPER_EVENT_MASK)
+        return false;
+    *event = config;
+    return true;
+}
+
+static void pmu_select(int idx)
+{
+    write_psr(PMSELR_EL0, idx);
+    pmu_isb();
+}
+
+void pmu_counter_start(int idx, u64 event, u64 flags, u64 value)
+{
+    u64 type = event;
+    if (!(flags & PMU_COUNT_USER))
+        type |= PMEVTYPER_U;
+    if (!(flags & PMU_COUNT_KERNEL))
+        type |= PMEVTYPER_P;
+    write_psr(PMCNTENCLR_EL0, U64_FROM_BIT(idx));
+    write_psr(PMOVSCLR_EL0, U64_FROM_BIT(idx));
+    pmu_select(idx);
+    write_psr(PMXEVTYPER_EL0, type);
+    write_psr(PMXEVCNTR_EL0, value & MASK(PMU_COUNTER_WIDTH));
+    write_psr(PMCR_EL0, read_psr(PMCR_EL0) | PMCR_E);
+    write_psr(PMCNTENSET_EL0, U64_FROM_BIT(idx));
+    pmu_isb();
+}
+
+u64 pmu_counter_stop(int idx)
+{
+    write_psr(PMCNTENCLR_EL0, U64_FROM_BIT(idx));
+    pmu_isb();
+    return pmu_counter_read(idx);
+}
+
+u64 pmu_counter_read(int idx)
+{
+    pmu_select(idx);
+    return read_psr(PMXEVCNTR_EL0) & MASK(PMU_COUNTER_WIDTH);
+}
+
+u64 pmu_overflow_status(void)
+{
+    u64 status = read_psr(PMOVSCLR_EL0) & MASK(pmu.counters);
+    if (status)
+        write_psr(PMOVSCLR_EL0, status);
+    return status;
+}
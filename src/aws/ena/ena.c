@@ -227,6 +227,7 @@ static void ena_init_io_rings_basic(struct ena_adapter *adapter)
 
         rxr->empty_rx_queue = 0;
         rxr->rx_mbuf_sz = PBUF_POOL_BUFSIZE;
+        net_gro_init(&rxr->gro, &adapter->ndev.n, false);
     }
 }
 
@@ -748,6 +749,25 @@ closure_func_basic(thunk, void, ena_cleanup_task)
     ena_cleanup(que, 1);
 }
 
+/* The cleanup task of a queue is scheduled by the queue interrupt, by the timer service, and by
+ * CPUs busy polling the queue; it must not run on more than one CPU at a time. */
+static void ena_schedule_cleanup(struct ena_que *que, boolean bh)
+{
+    if (!compare_and_swap_boolean(&que->cleanup_scheduled, false, true))
+        return;
+    if (bh)
+        async_apply_bh((thunk)&que->cleanup_task);
+    else
+        async_apply((thunk)&que->cleanup_task);
+}
+
+closure_func_basic(thunk, void, ena_busy_poll)
+{
+    struct ena_que *que = struct_from_closure(struct ena_que *, busy_poll);
+    if (!ena_com_cq_empty(que->rx_ring->ena_com_io_cq))
+        ena_schedule_cleanup(que, true);
+}
+
 static int ena_create_io_queues(struct ena_adapter *adapter)
 {
     struct ena_com_dev *ena_dev = adapter->ena_dev;
@@ -810,6 +830,9 @@ static int ena_create_io_queues(struct ena_adapter *adapter)
     for (i = 0; i < adapter->num_io_queues; i++) {
         queue = &adapter->que[i];
         init_closure_func(&queue->cleanup_task, thunk, ena_cleanup_task);
+        queue->cleanup_scheduled = false;
+        net_napi_init(&queue->napi, &queue->rx_ring->gro,
+                      init_closure_func(&queue->busy_poll, thunk, ena_busy_poll));
     }
 
     return 0;
@@ -861,7 +884,7 @@ static void ena_handle_msix(void *arg)
     struct netif *netif = &adapter->ndev.n;
 
     if (likely(netif_is_flag_set(netif, NETIF_FLAG_UP)))
-        async_apply_bh((thunk)&queue->cleanup_task);
+        ena_schedule_cleanup(queue, true);
 }
 
 static int ena_enable_msix(struct ena_adapter *adapter)
@@ -946,13 +969,16 @@ static int ena_request_io_irq(struct ena_adapter *adapter)
         return ENA_COM_INVAL;
     }
 
+    /* Queue i is used for transmission by the CPUs whose id is i modulo the number of queues
+     * (see ena_linkoutput()), so its completions are handled on CPU i. */
     for (i = ENA_IO_IRQ_FIRST_IDX; i < adapter->msix_vecs; i++) {
+        int qid = i - ENA_IO_IRQ_FIRST_IDX;
         irq = &adapter->irq_tbl[i];
-        if (pci_setup_msix(adapter->pdev, irq->vector,
-                           init_closure_func(&irq->th, thunk, ena_irq_handler),
-                           ss("ena_io")) == INVALID_PHYSICAL)
+        if (pci_setup_msix_aff(adapter->pdev, irq->vector,
+                               init_closure_func(&irq->th, thunk, ena_irq_handler),
+                               ss("ena_io"), irangel(qid, 1)) == INVALID_PHYSICAL)
             return ENA_COM_FAULT;
-        ena_trace(NULL, ENA_INFO, "queue %d\n", i - ENA_IO_IRQ_FIRST_IDX);
+        ena_trace(NULL, ENA_INFO, "queue %d\n", qid);
     }
 
     return 0;
@@ -1004,10 +1030,65 @@ static void ena_unmask_all_io_irqs(struct ena_adapter *adapter)
     }
 }
 
+/* Spreads receive flows over the IO queues; since the interrupt of each queue
+ * targets the CPU that transmits on the queue, a flow is processed by a single
+ * CPU in both directions. The indirection table is rebuilt on each bring-up, as
+ * the number of IO queues may change after a device reset. */
+static int ena_rss_configure(struct ena_adapter *adapter)
+{
+    struct ena_com_dev *ena_dev = adapter->ena_dev;
+    int rc, i;
+
+    if (!ena_dev->rss.tbl_log_size) {
+        rc = ena_com_rss_init(ena_dev, ENA_RX_RSS_TABLE_LOG_SIZE);
+        if (unlikely(rc != 0)) {
+            device_printf(adapter->pdev, "Cannot init indirect table\n");
+            return rc;
+        }
+    }
+
+    for (i = 0; i < ENA_RX_RSS_TABLE_SIZE; i++) {
+        rc = ena_com_indirect_table_fill_entry(ena_dev, i,
+            ENA_IO_RXQ_IDX(i % adapter->num_io_queues));
+        if (unlikely(rc != 0)) {
+            device_printf(adapter->pdev, "Cannot fill indirect table\n");
+            goto err_rss_destroy;
+        }
+    }
+
+    rc = ena_com_indirect_table_set(ena_dev);
+    if (unlikely(rc != 0))
+        goto err_rss_destroy;
+
+    /* Hash function and hash inputs are optional, the device defaults apply if unsupported */
+    rc = ena_com_fill_hash_function(ena_dev, ENA_ADMIN_CRC32, NULL, ENA_HASH_KEY_SIZE, 0xFFFFFFFF);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED)))
+        goto err_rss_destroy;
+
+    rc = ena_com_set_default_hash_ctrl(ena_dev);
+    if (unlikely((rc != 0) && (rc != ENA_COM_UNSUPPORTED)))
+        goto err_rss_destroy;
+
+    ENA_FLAG_SET_ATOMIC(ENA_FLAG_RSS_ACTIVE, adapter);
+    return 0;
+
+err_rss_destroy:
+    ena_com_rss_destroy(ena_dev);
+    return rc;
+}
+
 static int ena_up_complete(struct ena_adapter *adapter)
 {
     int rc;
 
+    if (adapter->num_io_queues > 1) {
+        rc = ena_rss_configure(adapter);
+        if (rc == ENA_COM_UNSUPPORTED)
+            ena_trace(NULL, ENA_INFO, "RSS is not supported, receiving on a single queue\n");
+        else if (unlikely(rc != 0))
+            return rc;
+    }
+
     rc = ena_change_mtu(adapter, adapter->ndev.n.mtu);
     if (unlikely(rc != 0))
         return rc;
@@ -1300,7 +1381,7 @@ static void check_for_empty_rx_ring(struct ena_adapter *adapter)
 
                 device_printf(adapter->pdev, "trigger refill for ring %d\n", i);
 
-                async_apply((thunk)&rx_ring->que->cleanup_task);
+                ena_schedule_cleanup(rx_ring->que, false);
                 rx_ring->empty_rx_queue = 0;
             }
         }
@@ -1493,14 +1574,52 @@ static uint32_t ena_calc_max_io_queue_num(struct ena_adapter *adapter,
     return max_num_io_queues;
 }
 
+/* With LLQ, tx descriptors and packet headers are written by the driver into
+ * device memory exposed by a separate BAR, which may not be implemented. */
+static boolean ena_map_llq_mem_bar(struct ena_adapter *adapter)
+{
+    pci_dev pdev = adapter->pdev;
+    u64 base;
+
+    pci_platform_init_bar(pdev, ENA_MEM_BAR);
+    base = pci_cfgread(pdev, PCIR_BAR(ENA_MEM_BAR), 4);
+    if ((base & PCI_BAR_B_TYPE_MASK) != PCI_BAR_MEMORY)
+        return false;
+    if (base & PCI_BAR_F_64BIT)
+        base |= (u64)pci_cfgread(pdev, PCIR_BAR(ENA_MEM_BAR + 1), 4) << 32;
+    if (!(base & ~PCI_BAR_B_MEMORY_MASK))
+        return false;
+    pci_bar_init(pdev, &adapter->memory, ENA_MEM_BAR, 0, -1);
+    adapter->ena_dev->mem_bar = pointer_from_u64(adapter->memory.vaddr);
+    return true;
+}
+
 static int ena_set_queues_placement_policy(struct ena_adapter *adapter,
     struct ena_admin_feature_llq_desc *llq,
     struct ena_llq_configurations *llq_default_configurations)
 {
     struct ena_com_dev *ena_dev = adapter->ena_dev;
+    pci_dev pdev = adapter->pdev;
+    int rc;
+
+    if (!(ena_dev->supported_features & BIT(ENA_ADMIN_LLQ))) {
+        ena_trace(NULL, ENA_INFO, "LLQ is not supported, using host mode policy\n");
+        ena_dev->tx_mem_queue_type = ENA_ADMIN_PLACEMENT_POLICY_HOST;
+        return 0;
+    }
+
+    if (!ena_dev->mem_bar && !ena_map_llq_mem_bar(adapter)) {
+        device_printf(pdev, "LLQ is advertised as supported but device doesn't expose mem bar\n");
+        ena_dev->tx_mem_queue_type = ENA_ADMIN_PLACEMENT_POLICY_HOST;
+        return 0;
+    }
+
+    rc = ena_com_config_dev_mode(ena_dev, llq, llq_default_configurations);
+    if (unlikely(rc != 0)) {
+        device_printf(pdev, "Failed to configure the device mode, using host mode policy\n");
+        ena_dev->tx_mem_queue_type = ENA_ADMIN_PLACEMENT_POLICY_HOST;
+    }
 
-    /* LLQ not supported */
-    ena_dev->tx_mem_queue_type = ENA_ADMIN_PLACEMENT_POLICY_HOST;
     return 0;
 }
 
@@ -1622,6 +1741,7 @@ static int ena_device_init(struct ena_adapter *adapter,
                            int *wd_active)
 {
     struct ena_com_dev *ena_dev = adapter->ena_dev;
+    struct ena_llq_configurations llq_config;
     pci_dev pdev = adapter->pdev;
     bool readless_supported;
     uint32_t aenq_groups;
@@ -1694,6 +1814,14 @@ static int ena_device_init(struct ena_adapter *adapter,
 
     *wd_active = !!(aenq_groups & BIT (ENA_ADMIN_KEEP_ALIVE));
 
+    /* Re-done on each device init, as a device reset also resets the placement policy */
+    set_default_llq_configurations(&llq_config);
+    rc = ena_set_queues_placement_policy(adapter, &get_feat_ctx->llq, &llq_config);
+    if (unlikely(rc != 0)) {
+        device_printf(pdev, "failed to set placement policy\n");
+        goto err_admin_init;
+    }
+
     return 0;
 
 err_admin_init:
@@ -2025,7 +2153,6 @@ closure_func_basic(thunk, void, ena_link_down_task)
 static boolean ena_attach(heap general, heap page_allocator, pci_dev d)
 {
     struct ena_com_dev_get_features_ctx get_feat_ctx;
-    struct ena_llq_configurations llq_config;
     struct ena_calc_queue_size_ctx calc_queue_ctx = { 0 };
     static int version_printed;
     struct ena_adapter *adapter;
@@ -2086,14 +2213,6 @@ static boolean ena_attach(heap general, heap page_allocator, pci_dev d)
         goto err_bus_free;
     }
 
-    set_default_llq_configurations(&llq_config);
-
-    rc = ena_set_queues_placement_policy(adapter, &get_feat_ctx.llq, &llq_config);
-    if (unlikely (rc != 0)) {
-        device_printf (d, "failed to set placement policy\n");
-        goto err_com_free;
-    }
-
     rc = ena_phc_init(adapter);
     if (unlikely(rc && (rc != ENA_COM_UNSUPPORTED))) {
         device_printf(d, "failed initializing PHC, error: %d\n", rc);
@@ -2179,6 +2298,8 @@ err_com_free:
     ena_com_admin_destroy(ena_dev);
     ena_com_delete_host_info(ena_dev);
     ena_com_mmio_reg_read_request_destroy(ena_dev);
+    if (ena_dev->mem_bar)
+        pci_bar_deinit(&adapter->memory);
 err_bus_free:
     deallocate(general, ena_dev->bus, sizeof(struct ena_bus));
 err_dev_free:
@@ -190,6 +190,9 @@ struct ena_que {
     struct ena_ring *tx_ring;
     struct ena_ring *rx_ring;
     closure_struct(thunk, cleanup_task);
+    boolean cleanup_scheduled;  /* cleared by ena_cleanup() before unmasking the interrupt */
+    struct net_napi napi;
+    closure_struct(thunk, busy_poll);
     uint32_t id;
 };
 
@@ -287,6 +290,8 @@ struct ena_ring {
     queue br; /* only for TX */
     uint32_t buf_ring_size;
 
+    struct net_gro gro; /* only for RX */
+
     ena_spinlock_t ring_mtx;
 
     closure_struct(thunk, enqueue_task);
@@ -63,8 +63,10 @@ void ena_cleanup(void *arg, int pending)
     int qid, ena_qid;
     int txc, rxc, i;
 
-    if (unlikely(!netif_is_flag_set(netif, NETIF_FLAG_UP)))
+    if (unlikely(!netif_is_flag_set(netif, NETIF_FLAG_UP))) {
+        que->cleanup_scheduled = false;
         return;
+    }
 
     ena_trace(NULL, ENA_DBG, "MSI-X TX/RX routine\n");
 
@@ -81,13 +83,19 @@ void ena_cleanup(void *arg, int pending)
         rxc = ena_rx_cleanup(rx_ring);
         txc = ena_tx_cleanup(tx_ring);
 
-        if (unlikely(!netif_is_flag_set(netif, NETIF_FLAG_UP)))
+        if (unlikely(!netif_is_flag_set(netif, NETIF_FLAG_UP))) {
+            que->cleanup_scheduled = false;
             return;
+        }
 
         if ((txc != TX_BUDGET) && (rxc != RX_BUDGET))
             break;
     }
 
+    /* an interrupt following the unmask schedules a new cleanup */
+    que->cleanup_scheduled = false;
+    memory_barrier();
+
     /* Signal that work is done and unmask interrupt */
     ena_com_update_intr_reg(&intr_reg,
     RX_IRQ_INTERVAL,
@@ -361,7 +369,6 @@ static int ena_rx_cleanup(struct ena_ring *rx_ring)
     struct ena_com_io_cq *io_cq;
     struct ena_com_io_sq *io_sq;
     enum ena_regs_reset_reason_types reset_reason;
-    struct netif *ifp;
     uint16_t ena_qid;
     uint16_t next_to_clean;
     uint32_t refill_required;
@@ -371,7 +378,6 @@ static int ena_rx_cleanup(struct ena_ring *rx_ring)
     int budget = RX_BUDGET;
 
     adapter = rx_ring->que->adapter;
-    ifp = &adapter->ndev.n;
     qid = rx_ring->que->id;
     ena_qid = ENA_IO_RXQ_IDX(qid);
     io_cq = &adapter->ena_dev->io_cq_queues[ena_qid];
@@ -396,6 +402,7 @@ static int ena_rx_cleanup(struct ena_ring *rx_ring)
                 reset_reason = ENA_REGS_RESET_INV_RX_REQ_ID;
             }
             ena_trigger_reset(adapter, reset_reason);
+            net_gro_flush(&rx_ring->gro);
             return (0);
         }
 
@@ -422,12 +429,13 @@ static int ena_rx_cleanup(struct ena_ring *rx_ring)
         adapter->hw_stats.rx_bytes += mbuf->tot_len;
 
         ena_trace(NULL, ENA_DBG | ENA_RXPTH, "calling if_input() with mbuf %p\n", mbuf);
-        (*ifp->input)(mbuf, ifp);
+        net_gro_receive(&rx_ring->gro, mbuf);
 
         rx_ring->rx_stats.cnt++;
         adapter->hw_stats.rx_packets++;
     } while (--budget);
 
+    net_gro_flush(&rx_ring->gro);
     rx_ring->next_to_clean = next_to_clean;
 
     refill_required = ena_com_free_q_entries(io_sq);
@@ -442,23 +450,44 @@ static int ena_rx_cleanup(struct ena_ring *rx_ring)
     return (RX_BUDGET - budget);
 }
 
+/* In LLQ mode, the first tx_max_header_size bytes of the packet are pushed to
+ * the device together with the descriptors, and only the rest of the packet is
+ * fetched by the device via DMA. */
 static int ena_tx_map_mbuf(struct ena_ring *tx_ring, struct ena_tx_buffer *tx_info,
-                           struct pbuf *mbuf)
+                           struct pbuf *mbuf, void **push_hdr, u16 *header_len)
 {
     struct ena_com_buf *ena_buf;
     int nsegs = 0;
+    u16 offset = 0;
 
     tx_info->mbuf = mbuf;
 
+    if (tx_ring->tx_mem_queue_type == ENA_ADMIN_PLACEMENT_POLICY_DEV) {
+        offset = MIN(mbuf->tot_len, tx_ring->tx_max_header_size);
+        if (mbuf->len >= offset) {
+            *push_hdr = mbuf->payload;
+        } else {
+            pbuf_copy_partial(mbuf, tx_ring->push_buf_intermediate_buf, offset, 0);
+            *push_hdr = tx_ring->push_buf_intermediate_buf;
+        }
+        *header_len = offset;
+    } else {
+        *push_hdr = NULL;
+        *header_len = 0;
+    }
+
     for (struct pbuf *q = mbuf; q != NULL; q = q->next) {
-        if (q->len) {
-            ena_buf = &tx_info->bufs[nsegs];
-            ena_buf->paddr = physical_from_virtual(q->payload);
-            ena_buf->len = q->len;
-            tx_info->num_of_bufs++;
-            if (++nsegs >= ENA_PKT_MAX_BUFS)
-                break;
+        if (q->len <= offset) {
+            offset -= q->len;
+            continue;
         }
+        ena_buf = &tx_info->bufs[nsegs];
+        ena_buf->paddr = physical_from_virtual(q->payload + offset);
+        ena_buf->len = q->len - offset;
+        offset = 0;
+        tx_info->num_of_bufs++;
+        if (++nsegs >= ENA_PKT_MAX_BUFS)
+            break;
     }
 
     return (0);
@@ -474,6 +503,8 @@ static int ena_xmit_mbuf(struct ena_ring *tx_ring, struct pbuf **mbuf)
     uint16_t next_to_use;
     uint16_t req_id;
     uint16_t ena_qid;
+    uint16_t header_len;
+    void *push_hdr;
     int rc;
     int nb_hw_desc;
 
@@ -489,17 +520,17 @@ static int ena_xmit_mbuf(struct ena_ring *tx_ring, struct pbuf **mbuf)
     tx_info = &tx_ring->tx_buffer_info[req_id];
     tx_info->num_of_bufs = 0;
 
-    rc = ena_tx_map_mbuf(tx_ring, tx_info, *mbuf);
+    rc = ena_tx_map_mbuf(tx_ring, tx_info, *mbuf, &push_hdr, &header_len);
     if (unlikely(rc != 0)) {
         ena_trace(NULL, ENA_WARNING, "Failed to map TX mbuf\n");
         return (rc);
     }
     zero(&ena_tx_ctx, sizeof(struct ena_com_tx_ctx));
     ena_tx_ctx.ena_bufs = tx_info->bufs;
-    ena_tx_ctx.push_header = NULL;
+    ena_tx_ctx.push_header = push_hdr;
     ena_tx_ctx.num_bufs = tx_info->num_of_bufs;
     ena_tx_ctx.req_id = req_id;
-    ena_tx_ctx.header_len = 0;
+    ena_tx_ctx.header_len = header_len;
 
     if (tx_ring->acum_pkts == DB_THRESHOLD ||
             ena_com_is_doorbell_needed(tx_ring->ena_com_io_sq, &ena_tx_ctx)) {
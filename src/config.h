@@ -20,18 +20,45 @@
 /* maximum buckets that can fit within a PAGESIZE_2M mcache */
 #define TABLE_MAX_BUCKETS 131072
 
+/* attributes held in a sorted array before a tuple is promoted to a hash table */
+#define TUPLE_INLINE_MAX 8
+
 /* runloop timer minimum and maximum */
 #define RUNLOOP_TIMER_MAX_PERIOD_US     100000
 #define RUNLOOP_TIMER_MIN_PERIOD_US     1000
 
+/* maximum timer period of an idle CPU, if supported by the platform timer */
+#define RUNLOOP_TIMER_IDLE_MAX_PERIOD_US    10000000
+
+/* default time slice of fair tasks, and bounds of the slices they can request */
+#define SCHED_SLICE_DEFAULT_US  3000
+#define SCHED_SLICE_MIN_US      100
+#define SCHED_SLICE_MAX_US      100000
+
+/* time slice of round-robin real-time tasks */
+#define SCHED_RR_INTERVAL_US    100000
+
 /* length of thread scheduling queue */
 #define MAX_THREADS 8192
 
+/* closure arena embedded in each kernel context, serving contextual closures without a heap
+   allocation (see init_kernel_context()) */
+#define CONTEXT_CLOSURE_SLOTS       4
+#define CONTEXT_CLOSURE_SLOT_SIZE   128
+
 /* size of free context queues */
 #define FREE_KERNEL_CONTEXT_QUEUE_SIZE  8
 #define FREE_SYSCALL_CONTEXT_QUEUE_SIZE 8
 #define FREE_PROCESS_CONTEXT_QUEUE_SIZE 8
 
+/* size of per-cpu queue of recycled thread extended frames */
+#define FREE_EXTENDED_FRAME_QUEUE_SIZE  32
+
+/* per-cpu pool of DMA bounce buffers (used with memory encryption) */
+#define DMA_BOUNCE_SLOT_SIZE    (32 * KB)
+#define DMA_BOUNCE_POOL_SLOTS   32
+#define DMA_BOUNCE_POOL_SIZE    (DMA_BOUNCE_SLOT_SIZE * DMA_BOUNCE_POOL_SLOTS)
+
 /* per-cpu queue */
 #define CPU_QUEUE_SIZE 512
 
@@ -40,9 +67,42 @@
 #define RUNQUEUE_SIZE      8192
 #define ASYNC_QUEUE_1_SIZE 65536
 
+/* per-cpu scheduling queues; the general queues are used when these are full */
+#define CPU_BHQUEUE_SIZE   2048
+#define CPU_RUNQUEUE_SIZE  2048
+
+/* max number of thunks stolen from other CPUs in a runloop pass */
+#define SCHED_STEAL_BATCH  16
+
 /* locking */
 #define MUTEX_ACQUIRE_SPIN_LIMIT (1ull << 20)
 
+/* initial capacity of the per-cpu vector of deferred RCU callbacks */
+#define RCU_CALLBACKS_INITIAL 16
+
+/* block layer request merging: limits on the requests (and the blocks they
+   span) that are coalesced into a single submission */
+#define STORAGE_PLUG_MAX_REQS   32
+#define STORAGE_PLUG_MAX_BLOCKS 2048
+
+/* I/O scheduler: maximum number of requests in flight to a device, of which at most
+   STORAGE_SCHED_ASYNC_DEPTH may belong to the background (writeback and idle) classes, and
+   per-class deadlines (in milliseconds) after which a queued request is dispatched ahead of
+   higher priority classes */
+#define STORAGE_SCHED_DEPTH             32
+#define STORAGE_SCHED_ASYNC_DEPTH       8
+#define STORAGE_SCHED_DEADLINE_RT       10
+#define STORAGE_SCHED_DEADLINE_SYNC     50
+#define STORAGE_SCHED_DEADLINE_ASYNC    500
+#define STORAGE_SCHED_DEADLINE_IDLE     5000
+
+/* hybrid polled I/O: bounds (in microseconds) of the window during which a
+   submitter spins for a completion, and the number of submissions after which
+   a window that has shrunk to the minimum is reset to probe the device again */
+#define IO_POLL_WINDOW_MIN      2
+#define IO_POLL_WINDOW_MAX      100
+#define IO_POLL_PROBE_INTERVAL  64
+
 /* could probably find progammatically via cpuid... */
 #define DEFAULT_CACHELINE_SIZE 64
 
@@ -55,6 +115,12 @@
 /* Log compaction is not triggered if the ratio between total entries and
  * obsolete entries is above the constant below. */
 #define TFS_LOG_COMPACT_RATIO   2
+/* For a log spanning at least TFS_LOG_COMPACT_EXTENSIONS extensions, the ratio
+ * above is relaxed to TFS_LOG_COMPACT_RATIO_LARGE. */
+#define TFS_LOG_COMPACT_EXTENSIONS  8
+#define TFS_LOG_COMPACT_RATIO_LARGE 8
+/* Amount of freed storage that triggers a batch of discard requests. */
+#define TFS_DISCARD_BATCH_SIZE  (8*MB)
 
 /* Xen stuff */
 #define XENNET_INIT_RX_BUFFERS_FACTOR 4
@@ -64,6 +130,9 @@
 /* mm stuff */
 #define MEM_CLEAN_THRESHOLD (64 * MB)
 #define MEM_CLEAN_THRESHOLD_SHIFT   6
+#define MEM_RECLAIM_BATCH           (4 * MB)
+#define MEM_RECLAIM_BACKOFF_MS      100
+#define MEM_PRESSURE_PERIOD_SECONDS 2
 #define PAGECACHE_SCAN_PERIOD_SECONDS 5
 #define PAGEHEAP_MEMORY_RESERVE         (8 * MB)
 #define PAGEHEAP_LOWMEM_MEMORY_RESERVE  (4 * MB)
@@ -71,6 +140,10 @@
 #define LOW_MEMORY_THRESHOLD   (64 * MB)
 #define SG_FRAG_BYTE_THRESHOLD (128*KB)
 #define PAGECACHE_MAX_SG_ENTRIES    8192
+#define PAGECACHE_DIRTY_BACKGROUND_RATIO    10  /* percent of memory */
+#define PAGECACHE_DIRTY_RATIO               20  /* percent of memory */
+#define PAGECACHE_DIRTY_PAUSE_MAX_MS        200
+#define PAGECACHE_DIRTY_PAUSE_ROUNDS        16
 
 /* don't go below this minimum amount of physical memory when inflating balloon */
 #define BALLOON_MEMORY_MINIMUM (16 * MB)
@@ -59,6 +59,35 @@ boolean acpi_parse_spcr(spcr_handler h)
     return true;
 }
 
+boolean acpi_walk_srat(srat_handler h)
+{
+    ACPI_TABLE_HEADER *srat;
+    ACPI_STATUS rv = AcpiGetTable(ACPI_SIG_SRAT, 1, &srat);
+    if (ACPI_FAILURE(rv))
+        return false;
+    u8 *p = (u8 *)srat + sizeof(ACPI_TABLE_SRAT);
+    u8 *pe = (u8 *)srat + srat->Length;
+    for (; (p < pe) && p[1]; p += p[1])
+        apply(h, p[0], p);
+    AcpiPutTable(srat);
+    return true;
+}
+
+/* distances is a localities x localities matrix, indexed by proximity domain */
+boolean acpi_parse_slit(slit_handler h)
+{
+    ACPI_TABLE_HEADER *t;
+    ACPI_STATUS rv = AcpiGetTable(ACPI_SIG_SLIT, 1, &t);
+    if (ACPI_FAILURE(rv))
+        return false;
+    ACPI_TABLE_SLIT *slit = (ACPI_TABLE_SLIT *)t;
+    if (sizeof(*slit) - sizeof(slit->Entry) + slit->LocalityCount * slit->LocalityCount <=
+        t->Length)
+        apply(h, slit->LocalityCount, slit->Entry);
+    AcpiPutTable(t);
+    return true;
+}
+
 closure_function(1, 0, void, acpi_eject,
                  ACPI_HANDLE, device)
 {
@@ -325,6 +354,109 @@ static ACPI_STATUS acpi_ged_probe(ACPI_HANDLE object, u32 nesting_level, void *c
     return AcpiWalkResources(object, METHOD_NAME__CRS, acpi_ged_res_probe, object);
 }
 
+/* VM generation ID device: the hypervisor changes the 128-bit generation ID, and sends a
+   notification, when the VM is restored from a snapshot (or otherwise duplicated). */
+#define VMGENID_LEN 16
+
+static struct {
+    volatile u8 *id;
+    u8 last[VMGENID_LEN];
+} vmgenid;
+
+static void acpi_vmgenid_handler(ACPI_HANDLE device, UINT32 value, void *context)
+{
+    acpi_debug("VM generation ID notify 0x%x", value);
+    if (value != 0x80)
+        return;
+    u8 id[VMGENID_LEN];
+    for (int i = 0; i < VMGENID_LEN; i++)
+        id[i] = vmgenid.id[i];
+    if (!runtime_memcmp(id, vmgenid.last, VMGENID_LEN))
+        return;
+    runtime_memcpy(vmgenid.last, id, VMGENID_LEN);
+    snapshot_resumed();
+}
+
+static ACPI_STATUS acpi_vmgenid_probe(ACPI_HANDLE object, u32 nesting_level, void *context,
+                                      void **return_value)
+{
+    acpi_debug("found VM generation ID device");
+    ACPI_BUFFER retb = {
+        .Length = ACPI_ALLOCATE_BUFFER,
+    };
+    ACPI_STATUS rv = AcpiEvaluateObjectTyped(object, "ADDR", NULL, &retb, ACPI_TYPE_PACKAGE);
+    if (ACPI_FAILURE(rv)) {
+        msg_err("failed to get VM generation ID address: %d\n", rv);
+        return AE_OK;
+    }
+    ACPI_OBJECT *obj = retb.Pointer;
+    if ((obj->Package.Count == 2) && (obj->Package.Elements[0].Type == ACPI_TYPE_INTEGER) &&
+        (obj->Package.Elements[1].Type == ACPI_TYPE_INTEGER)) {
+        u64 addr = obj->Package.Elements[0].Integer.Value |
+                   (obj->Package.Elements[1].Integer.Value << 32);
+        vmgenid.id = AcpiOsMapMemory(addr, VMGENID_LEN);
+        if (vmgenid.id) {
+            for (int i = 0; i < VMGENID_LEN; i++)
+                vmgenid.last[i] = vmgenid.id[i];
+            rv = AcpiInstallNotifyHandler(object, ACPI_DEVICE_NOTIFY, acpi_vmgenid_handler, NULL);
+            if (ACPI_FAILURE(rv))
+                msg_err("failed to install VM generation ID handler: %d\n", rv);
+        }
+    } else {
+        msg_err("unexpected VM generation ID address object\n");
+    }
+    AcpiOsFree(obj);
+    return AE_OK;
+}
+
+/* A hot-added processor is reported via a Device Check notification on its processor device,
+ * whose _MAT object returns the MADT entry of the processor (now enabled). */
+static void acpi_cpu_notify(ACPI_HANDLE device, UINT32 value, void *context)
+{
+    acpi_debug("processor notify %p %d", device, value);
+    if ((value != ACPI_NOTIFY_DEVICE_CHECK) && (value != ACPI_NOTIFY_BUS_CHECK))
+        return;
+    ACPI_BUFFER retb = {
+        .Length = ACPI_ALLOCATE_BUFFER,
+    };
+    ACPI_STATUS rv = AcpiEvaluateObjectTyped(device, "_MAT", NULL, &retb, ACPI_TYPE_BUFFER);
+    if (ACPI_FAILURE(rv)) {
+        msg_err("failed to get processor MADT entry: %d\n", rv);
+        return;
+    }
+    ACPI_OBJECT *obj = retb.Pointer;
+    void *entry = obj->Buffer.Pointer;
+    u32 len = obj->Buffer.Length;
+    u64 hw_id = INVALID_PHYSICAL;
+    if (len >= sizeof(struct acpi_lapic)) {
+        switch (*(u8 *)entry) {
+        case ACPI_MADT_LAPIC:
+            if (((acpi_lapic)entry)->flags & MADT_LAPIC_ENABLED)
+                hw_id = ((acpi_lapic)entry)->id;
+            break;
+        case ACPI_MADT_LAPICx2:
+            if ((len >= sizeof(struct acpi_lapic_x2)) &&
+                (((acpi_lapic_x2)entry)->flags & MADT_LAPIC_ENABLED))
+                hw_id = ((acpi_lapic_x2)entry)->id;
+            break;
+        }
+    }
+    AcpiOsFree(obj);
+    if (hw_id != INVALID_PHYSICAL) {
+        acpi_debug("starting processor %ld", hw_id);
+        start_hotplug_cpu(hw_id);
+    }
+}
+
+static ACPI_STATUS acpi_cpu_probe(ACPI_HANDLE object, u32 nesting_level, void *context,
+                                  void **return_value)
+{
+    ACPI_STATUS rv = AcpiInstallNotifyHandler(object, ACPI_SYSTEM_NOTIFY, acpi_cpu_notify, NULL);
+    if (ACPI_FAILURE(rv))
+        msg_err("failed to install processor notify handler: %d\n", rv);
+    return AE_OK;
+}
+
 static void acpi_powerdown_init(kernel_heaps kh)
 {
     ACPI_TABLE_HEADER *fadt;
@@ -385,6 +517,8 @@ void init_acpi(kernel_heaps kh)
     acpi_powerdown_init(kh);
     AcpiGetDevices("ACPI0013", acpi_ged_probe, NULL, NULL);
     AcpiGetDevices("PNP0C0C", acpi_pwrbtn_probe, NULL, NULL);
+    AcpiGetDevices("VM_Gen_Counter", acpi_vmgenid_probe, NULL, NULL);
+    AcpiGetDevices("ACPI0007", acpi_cpu_probe, NULL, NULL);
     rv = AcpiInstallFixedEventHandler(ACPI_EVENT_POWER_BUTTON, acpi_shutdown, 0);
     if (ACPI_FAILURE(rv))
         acpi_debug("cannot install power button hander: %d", rv);
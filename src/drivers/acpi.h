@@ -29,6 +29,15 @@
 #define ACPI_MADT_GEN_TRANS 15
 
 #define MADT_LAPIC_ENABLED  1
+
+/* SRAT structure types */
+#define ACPI_SRAT_LAPIC     0
+#define ACPI_SRAT_MEM       1
+#define ACPI_SRAT_LAPICx2   2
+
+#define SRAT_LAPIC_ENABLED  1
+#define SRAT_MEM_ENABLED    1
+
 /* ACPI table structures */
 typedef struct acpi_rsdp {
     u8 sig[8];
@@ -113,6 +122,40 @@ typedef struct acpi_gen_int
 
 } __attribute__((packed)) *acpi_gen_int;
 
+typedef struct acpi_srat_lapic {
+    u8 type;
+    u8 length;
+    u8 domain_lo;
+    u8 apic_id;
+    u32 flags;
+    u8 sapic_eid;
+    u8 domain_hi[3];
+    u32 clock_domain;
+} __attribute__((packed)) *acpi_srat_lapic;
+
+typedef struct acpi_srat_mem {
+    u8 type;
+    u8 length;
+    u32 domain;
+    u16 res;
+    u64 base;
+    u64 length_bytes;
+    u32 res2;
+    u32 flags;
+    u64 res3;
+} __attribute__((packed)) *acpi_srat_mem;
+
+typedef struct acpi_srat_lapic_x2 {
+    u8 type;
+    u8 length;
+    u16 res;
+    u32 domain;
+    u32 apic_id;
+    u32 flags;
+    u32 clock_domain;
+    u32 res2;
+} __attribute__((packed)) *acpi_srat_lapic_x2;
+
 /* acpi_gen_int flags */
 #define MADT_GENINT_ENABLED U64_FROM_BIT(0)
 
@@ -156,6 +199,8 @@ static inline boolean acpi_checksum(void *a, u8 len)
 closure_type(madt_handler, void, u8 type, void *p);
 closure_type(mcfg_handler, boolean, u64 addr, u16 segment, u8 bus_start, u8 bus_end);
 closure_type(spcr_handler, void, u8 type, u64 addr);
+closure_type(srat_handler, void, u8 type, void *p);
+closure_type(slit_handler, void, u64 localities, u8 *distances);
 
 void init_acpi(kernel_heaps kh);
 void init_acpi_tables(kernel_heaps kh);
@@ -164,6 +209,8 @@ void acpi_register_irq_handler(int irq, thunk t, sstring name);
 boolean acpi_walk_madt(madt_handler mh);
 boolean acpi_walk_mcfg(mcfg_handler mh);
 boolean acpi_parse_spcr(spcr_handler h);
+boolean acpi_walk_srat(srat_handler h);
+boolean acpi_parse_slit(slit_handler h);
 
 typedef struct acpi_mmio_dev {
     u64 membase;
@@ -3,8 +3,33 @@
 #include "console.h"
 #include "netconsole.h"
 
+/* When a console buffer size is configured (console_buffer_size), console_write() copies output
+ * to a ring, which is drained to the console drivers from a bottom half, so that writers on
+ * different CPUs do not serialize on slow console devices. The ring has a single consumer, and
+ * its producers are serialized by a lock that is held only while copying. With the "drop" policy
+ * (console_drop_policy, default), output that does not fit in the ring is discarded and the amount
+ * discarded is reported on the console; with the "block" policy, a writer that finds the ring
+ * full drains it synchronously. Output beyond an optional rate limit (console_rate_limit, in bytes
+ * per second) is discarded. */
+#define CONSOLE_FLUSH_BATCH     (4 * KB)
+
 static boolean inited;
 
+static heap console_heap;
+
+static struct {
+    ringbuf ring;
+    struct spinlock lock;
+    boolean drop;
+    boolean bypass;
+    boolean flush_scheduled;
+    u64 rate;
+    u64 tokens;
+    timestamp refill_time;
+    u64 dropped;
+    closure_struct(thunk, flush);
+} console_buf;
+
 void serial_console_write(void *d, const char *s, bytes count)
 {
     for (; count--; s++) {
@@ -24,6 +49,88 @@ void attach_console_driver(struct console_driver *driver)
     spin_unlock(&write_lock);
 }
 
+/* called with write_lock held */
+static void console_write_drivers(const char *s, bytes count)
+{
+    list_foreach(&console_drivers, e) {
+        struct console_driver *d = struct_from_list(e, struct console_driver *, l);
+        if (d->disabled)
+            break;
+        d->write(d, s, count);
+    }
+}
+
+/* called with write_lock held */
+static void console_drain_locked(bytes limit)
+{
+    ringbuf r = console_buf.ring;
+    bytes len = MIN(ringbuf_length_sync(r), limit);
+    while (len > 0) {
+        bytes offset = r->start & (r->length - 1);
+        bytes n = MIN(len, r->length - offset);
+        console_write_drivers(r->contents + offset, n);
+        ringbuf_release(r, n);
+        len -= n;
+    }
+    u64 dropped = console_buf.dropped;
+    if (dropped && compare_and_swap_64(&console_buf.dropped, dropped, 0)) {
+        buffer b = little_stack_buffer(64);
+        bprintf(b, "\n[console: %ld bytes dropped]\n", dropped);
+        console_write_drivers(buffer_ref(b, 0), buffer_length(b));
+    }
+}
+
+static void console_flush_schedule(void)
+{
+    if (!console_buf.flush_scheduled &&
+        compare_and_swap_boolean(&console_buf.flush_scheduled, false, true))
+        async_apply_bh((thunk)&console_buf.flush);
+}
+
+closure_func_basic(thunk, void, console_flush_func)
+{
+    console_buf.flush_scheduled = false;
+    memory_barrier();
+    spin_lock(&write_lock);
+    console_drain_locked(CONSOLE_FLUSH_BATCH);
+    spin_unlock(&write_lock);
+    if ((ringbuf_length_sync(console_buf.ring) > 0) || console_buf.dropped)
+        console_flush_schedule();
+}
+
+/* Returns false if the output must be written synchronously. */
+static boolean console_buffer_write(const char *s, bytes count)
+{
+    boolean buffered = true;
+    u64 irqflags = spin_lock_irq(&console_buf.lock);
+    if (console_buf.rate) {
+        timestamp here = kern_now(CLOCK_ID_MONOTONIC);
+        timestamp elapsed = MIN(here - console_buf.refill_time, seconds(1));
+        console_buf.refill_time = here;
+        console_buf.tokens = MIN(console_buf.tokens + console_buf.rate * elapsed / seconds(1),
+                                 console_buf.rate);
+        if (count > console_buf.tokens) {
+            fetch_and_add(&console_buf.dropped, count);
+            goto out;
+        }
+        console_buf.tokens -= count;
+    }
+    ringbuf r = console_buf.ring;
+    if (ringbuf_space_sync(r) >= count) {
+        ringbuf_stage(r, 0, s, count);
+        ringbuf_publish(r, count);
+    } else if (console_buf.drop) {
+        fetch_and_add(&console_buf.dropped, count);
+    } else {
+        buffered = false;
+    }
+  out:
+    spin_unlock_irq(&console_buf.lock, irqflags);
+    if (buffered)
+        console_flush_schedule();
+    return buffered;
+}
+
 void console_write(const char *s, bytes count)
 {
     if (!inited) {
@@ -31,19 +138,31 @@ void console_write(const char *s, bytes count)
             serial_putchar(*s++);
         return;
     }
+    if (console_buf.ring && !console_buf.bypass && console_buffer_write(s, count))
+        return;
     spin_lock(&write_lock);
-    list_foreach(&console_drivers, e) {
-        struct console_driver *d = struct_from_list(e, struct console_driver *, l);
-        if (d->disabled)
-            break;
-        d->write(d, s, count);
-    }
+    if (console_buf.ring)
+        console_drain_locked(infinity);
+    console_write_drivers(s, count);
+    spin_unlock(&write_lock);
+}
+
+void console_flush(void)
+{
+    if (!inited || !console_buf.ring)
+        return;
+    spin_lock(&write_lock);
+    console_drain_locked(infinity);
     spin_unlock(&write_lock);
 }
 
+/* Used on fatal errors: output is written synchronously from now on, without taking the buffer
+ * lock (which may be held by a CPU that will not release it). */
 void console_force_unlock(void)
 {
+    console_buf.bypass = true;
     spin_unlock(&write_lock);
+    console_flush();
 }
 
 closure_func_basic(console_attach, void, attach_console,
@@ -56,6 +175,7 @@ void init_console(kernel_heaps kh)
 {
     list_init(&console_drivers);
     heap h = heap_general(kh);
+    console_heap = h;
     console_attach a = closure_func(h, console_attach, attach_console);
     netconsole_register(kh, a);
     inited = true;
@@ -99,8 +219,48 @@ closure_function(1, 2, boolean, config_console_each,
     return true;
 }
 
+static void config_console_buffer(tuple root)
+{
+    u64 size;
+    value v = get(root, sym(console_buffer_size));
+    if (!v)
+        return;
+    if (!u64_from_value(v, &size) || (size == 0)) {
+        msg_err("invalid console buffer size\n");
+        return;
+    }
+    v = get(root, sym(console_drop_policy));
+    if (!v || (is_string(v) && !buffer_strcmp(v, "drop"))) {
+        console_buf.drop = true;
+    } else if (is_string(v) && !buffer_strcmp(v, "block")) {
+        console_buf.drop = false;
+    } else {
+        msg_err("invalid console drop policy '%v'\n", v);
+        return;
+    }
+    v = get(root, sym(console_rate_limit));
+    if (v) {
+        if (!u64_from_value(v, &console_buf.rate) || (console_buf.rate > U32_MAX)) {
+            msg_err("invalid console rate limit\n");
+            return;
+        }
+        console_buf.tokens = console_buf.rate;
+        console_buf.refill_time = kern_now(CLOCK_ID_MONOTONIC);
+    }
+    ringbuf r = allocate_ringbuf(console_heap, size);
+    if (r == INVALID_ADDRESS) {
+        msg_err("failed to allocate console buffer\n");
+        return;
+    }
+    spin_lock_init(&console_buf.lock);
+    init_closure_func(&console_buf.flush, thunk, console_flush_func);
+    write_barrier();
+    console_buf.ring = r;
+}
+
 void config_console(tuple root)
 {
+    config_console_buffer(root);
     value v = get(root, sym(consoles));
     if (v == 0)
         return;
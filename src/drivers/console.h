@@ -11,6 +11,7 @@ closure_type(console_attach, void, struct console_driver *driver);
 void init_console(kernel_heaps kh);
 void config_console(tuple root);
 void attach_console_driver(struct console_driver *driver);
+void console_flush(void);
 void console_force_unlock(void);
 
 void serial_console_write(void *d, const char *s, bytes count);
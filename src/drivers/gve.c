@@ -19,6 +19,8 @@
 #define GVE_REGISTER_BAR    0
 #define GVE_DOORBELL_BAR    2
 
+#define GVE_MAX_QUEUES  16  /* maximum number of TX/RX queue pairs */
+
 /* Register BAR */
 #define GVE_REG_DEVICE_STATUS   0x00
 #define GVE_REG_DRIVER_STATUS   0x04
@@ -86,6 +88,29 @@ struct gve_device_descriptor {
     u8 reserved2[6];
 } __attribute__((packed));
 
+struct gve_device_option {
+    u16 option_id;
+    u16 option_length;
+    u32 required_features_mask;
+} __attribute__((packed));
+
+#define GVE_DEV_OPT_ID_DQO_RDA      0x4
+#define GVE_DEV_OPT_ID_BUFFER_SIZES 0xa
+
+struct gve_device_option_dqo_rda {
+    u32 supported_features_mask;
+    u16 tx_comp_ring_entries;
+    u16 rx_buff_ring_entries;
+} __attribute__((packed));
+
+#define GVE_SUP_BUFFER_SIZES_MASK   htobe32(U32_FROM_BIT(4))
+
+struct gve_device_option_buffer_sizes {
+    u32 supported_features_mask;
+    u16 packet_buffer_size;
+    u16 header_buffer_size;
+} __attribute__((packed));
+
 struct gve_adminq_describe_device {
     u64 device_descriptor_addr;
     u32 device_descriptor_version;
@@ -99,6 +124,9 @@ enum gve_queue_format {
     GVE_DQO_RDA_FORMAT,
 };
 
+/* queue page list ID for queues that use raw DMA addresses (DQO RDA format) */
+#define GVE_RAW_ADDRESSING_QPL_ID   0xFFFFFFFF
+
 struct gve_adminq_configure_device_resources {
     u64 counter_array;
     u64 irq_db_addr;
@@ -145,7 +173,9 @@ struct gve_adminq_create_rx_queue {
     u16 packet_buffer_size;
     u16 rx_buff_ring_size;
     u8 enable_rsc;
-    u8 padding[5];
+    u8 padding1;
+    u16 header_buffer_size;
+    u8 padding2[2];
 } __attribute__((packed));
 
 struct gve_adminq_destroy_tx_queue {
@@ -218,8 +248,6 @@ struct gve_tx_seg_desc {
 #define GVE_RXF_ERR         htobe16(1 << 11)
 #define GVE_RXF_PKT_CONT    htobe16(1 << 13)
 
-#define GVE_IRQ_DB_COUNT    2   /* one for TX, one for RX */
-
 /* padding added at the beginning of received Ethernet frames */
 #define GVE_RX_PADDING  2
 
@@ -235,7 +263,107 @@ struct gve_rx_desc {
     u16 flags_seq;
 } __attribute__((packed));
 
+/* DQO format: descriptors are little-endian; completions are reported out of order in separate
+ * rings, where the generation bit of each entry is flipped by the device at each wrap-around. */
+
+#define GVE_TXD_DQO_DTYPE_PKT   0x0c
+#define GVE_TXD_DQO_EOP         U32_FROM_BIT(5)
+#define GVE_TXD_DQO_RE          U32_FROM_BIT(7) /* report a descriptor completion */
+
+#define GVE_TX_DQO_MAX_BUF_SIZE (16 * KB - 1)
+#define GVE_TX_DQO_MAX_DESCS    10      /* per packet */
+#define GVE_TX_DQO_RE_INTERVAL  32
+#define GVE_TX_DQO_REINJECT_TIMEOUT seconds(1)
+
+struct gve_tx_pkt_desc_dqo {
+    u64 buf_addr;
+    u8 dtype_flags;
+    u8 reserved0;
+    u16 reserved1;
+    u16 compl_tag;
+    u16 buf_size;
+} __attribute__((packed));
+
+#define GVE_TX_DQO_COMPL_TYPE(x)    (((x) >> 11) & 0x7)
+#define GVE_TX_DQO_COMPL_GEN        U32_FROM_BIT(15)
+
+#define GVE_TX_DQO_COMPL_MISS       1
+#define GVE_TX_DQO_COMPL_PKT        2
+#define GVE_TX_DQO_COMPL_REINJECT   3
+#define GVE_TX_DQO_COMPL_DESC       4
+
+struct gve_tx_compl_desc_dqo {
+    u16 id_type_gen;
+    u16 tag;    /* descriptor ring head for descriptor completions, packet tag otherwise */
+    u32 reserved;
+} __attribute__((packed));
+
+struct gve_rx_desc_dqo {
+    u16 buf_id;
+    u16 reserved0;
+    u32 reserved1;
+    u64 buf_addr;
+    u64 header_buf_addr;
+    u64 reserved2;
+} __attribute__((packed));
+
+#define GVE_RX_DQO_ERROR        U32_FROM_BIT(2)     /* status0 */
+#define GVE_RX_DQO_LEN_MASK     MASK(14)
+#define GVE_RX_DQO_GEN          U32_FROM_BIT(14)
+#define GVE_RX_DQO_HDR_LEN_MASK MASK(10)
+#define GVE_RX_DQO_SPLIT_HEADER U32_FROM_BIT(11)
+#define GVE_RX_DQO_EOP          U32_FROM_BIT(1)     /* status1 */
+
+struct gve_rx_compl_desc_dqo {
+    u8 rxdid;
+    u8 status0;
+    u16 packet_type;
+    u16 len_gen;
+    u16 hdr_len_flags;
+    u8 status1;
+    u8 status_error1;
+    u16 reserved0;
+    u16 buf_id;
+    u16 raw_cs;
+    u32 hash;
+    u32 reserved1;
+    u64 reserved2;
+} __attribute__((packed));
+
+#define GVE_RX_BUF_SIZE_DQO     2048
+#define GVE_RX_BUF_POOL_FACTOR  2   /* receive buffers per buffer queue slot */
+
+#define GVE_ITR_ENABLE_BIT_DQO      U32_FROM_BIT(0)
+#define GVE_ITR_NO_UPDATE_DQO       (3 << 3)
+#define GVE_ITR_INTERVAL_DQO_SHIFT  5
+#define GVE_ITR_INTERVAL_DQO_MASK   MASK(12)
+#define GVE_TX_IRQ_INTERVAL_US_DQO  50
+#define GVE_RX_IRQ_INTERVAL_US_DQO  20
+
+enum gve_tx_pending_state {
+    GVE_TX_PENDING_FREE,
+    GVE_TX_PENDING_DATA,        /* awaiting packet completion */
+    GVE_TX_PENDING_REINJECT,    /* awaiting re-injection completion after a miss completion */
+};
+
+struct gve_tx_pending_dqo {
+    struct pbuf *p;
+    timestamp deadline;         /* for re-injection completion */
+    u8 state;
+};
+
+struct gve_rx_queue;
+
+typedef struct gve_rx_buf_dqo {
+    struct pbuf_custom p;       /* must be first field */
+    struct list l;              /* free list */
+    struct gve_rx_queue *rx;
+    void *buf;
+    u64 paddr;
+} *gve_rx_buf_dqo;
+
 typedef struct gve_tx_queue {
+    struct spinlock lock;
     u32 head, tail;
     u32 qpl_head, qpl_available;
     struct gve *adapter;
@@ -248,6 +376,22 @@ typedef struct gve_tx_queue {
     } *desc;
     u32 *qpl_allocated;
     struct gve_queue_resources *q_res;
+    struct {
+        struct gve_tx_pkt_desc_dqo *desc;
+        u16 head, tail;         /* descriptor ring indexes */
+        u16 last_re;            /* last descriptor with a completion report */
+        struct gve_tx_compl_desc_dqo *compl;
+        u16 compl_mask;
+        u16 compl_head;
+        u16 compl_gen;          /* generation bit of stale completion entries */
+        struct gve_tx_pending_dqo *pending;     /* indexed by completion tag */
+        u16 *free_tags;
+        u16 free_tag_count;
+        u16 reinject_count;     /* packets awaiting re-injection completion */
+        u32 *irq_db_index;
+        closure_struct(thunk, irq_handler);
+        closure_struct(thunk, service);
+    } dqo;
 } *gve_tx_queue;
 
 typedef struct gve_rx_queue {
@@ -265,6 +409,24 @@ typedef struct gve_rx_queue {
     closure_struct(thunk, irq_handler);
     closure_struct(thunk, service);
     struct gve_queue_resources *q_res;
+    struct net_gro gro;
+    struct {
+        struct gve_rx_desc_dqo *bufq;
+        u16 bufq_mask;
+        u16 bufq_head, bufq_tail;
+        struct gve_rx_compl_desc_dqo *complq;
+        u16 complq_mask;
+        u16 complq_head;
+        u16 complq_gen;         /* generation bit of stale completion entries */
+        struct gve_rx_buf_dqo *bufs;    /* buffer pool, indexed by buffer ID */
+        void *buf_mem;
+        u32 buf_count;
+        struct spinlock free_lock;
+        struct list free;       /* buffers not posted to the device nor held by the network stack */
+        boolean starved;        /* no buffers posted to the device */
+        void *hdr_bufs;         /* header buffers (if header split is enabled) */
+        struct pbuf *pkt;       /* multi-buffer packet being received */
+    } dqo;
 } *gve_rx_queue;
 
 typedef struct gve {
@@ -276,13 +438,19 @@ typedef struct gve {
     struct gve_adminq_command *adminq;
     u32 adminq_head;
     u32 adminq_mask;
+    u8 queue_format;
+    u16 num_queues;
+    u16 default_num_queues;
+    u64 max_registered_pages;
     u16 tx_desc_cnt, rx_desc_cnt;
     u16 tx_pages_per_qpl, rx_data_slot_cnt;
+    u16 tx_compq_cnt, rx_bufq_cnt;  /* DQO completion and buffer ring sizes */
+    u16 hdr_buf_size;               /* DQO header split buffer size (0 if disabled) */
     u16 num_event_counters;
     u32 *event_counters;
     struct gve_irq_db *irq_db_indices;
-    struct gve_tx_queue tx;
-    struct gve_rx_queue rx;
+    struct gve_tx_queue tx[GVE_MAX_QUEUES];
+    struct gve_rx_queue rx[GVE_MAX_QUEUES];
     closure_struct(thunk, mgmt_irq_handler);
     closure_struct(thunk, link_status_handler);
     u16 mtu;
@@ -328,6 +496,49 @@ static boolean gve_adminq_execute_cmd(gve adapter, struct gve_adminq_command *cm
     return (status == GVE_ADMINQ_COMMAND_PASSED);
 }
 
+static void gve_parse_device_options(gve adapter, struct gve_device_descriptor *desc)
+{
+    struct gve_device_option *opt = (struct gve_device_option *)(desc + 1);
+    void *desc_end = (void *)desc + MIN(be16toh(desc->total_length), PAGESIZE);
+    struct gve_device_option_dqo_rda *dqo_rda = 0;
+    struct gve_device_option_buffer_sizes *buf_sizes = 0;
+    for (u16 i = 0; i < be16toh(desc->num_device_options); i++) {
+        if ((void *)(opt + 1) > desc_end)
+            break;
+        u16 id = be16toh(opt->option_id);
+        u16 len = be16toh(opt->option_length);
+        void *opt_data = opt + 1;
+        if (opt_data + len > desc_end)
+            break;
+        gve_debug("device option %d, length %d", id, len);
+        if (opt->required_features_mask == 0) {
+            switch (id) {
+            case GVE_DEV_OPT_ID_DQO_RDA:
+                if (len >= sizeof(*dqo_rda))
+                    dqo_rda = opt_data;
+                break;
+            case GVE_DEV_OPT_ID_BUFFER_SIZES:
+                if (len >= sizeof(*buf_sizes))
+                    buf_sizes = opt_data;
+                break;
+            }
+        }
+        opt = opt_data + len;
+    }
+    adapter->hdr_buf_size = 0;
+    if (dqo_rda) {
+        adapter->queue_format = GVE_DQO_RDA_FORMAT;
+        adapter->tx_compq_cnt = be16toh(dqo_rda->tx_comp_ring_entries);
+        adapter->rx_bufq_cnt = be16toh(dqo_rda->rx_buff_ring_entries);
+        if (buf_sizes && (buf_sizes->supported_features_mask & GVE_SUP_BUFFER_SIZES_MASK))
+            adapter->hdr_buf_size = be16toh(buf_sizes->header_buffer_size);
+        gve_debug("DQO format, TX completions %d, RX buffers %d, header buffer size %d",
+                  adapter->tx_compq_cnt, adapter->rx_bufq_cnt, adapter->hdr_buf_size);
+    } else {
+        adapter->queue_format = GVE_GQI_QPL_FORMAT;
+    }
+}
+
 static boolean gve_describe_device(gve adapter)
 {
     struct gve_device_descriptor *desc = allocate(adapter->contiguous, PAGESIZE);
@@ -348,6 +559,9 @@ static boolean gve_describe_device(gve adapter)
         adapter->rx_desc_cnt = be16toh(desc->rx_queue_entries);
         adapter->tx_pages_per_qpl = be16toh(desc->tx_pages_per_qpl);
         adapter->rx_data_slot_cnt = be16toh(desc->rx_pages_per_qpl);
+        adapter->default_num_queues = be16toh(desc->default_num_queues);
+        adapter->max_registered_pages = be64toh(desc->max_registered_pages);
+        gve_parse_device_options(adapter, desc);
         gve_debug("MAC %02x:%02x:%02x:%02x:%02x:%02x, MTU %d, TX descriptors %d, RX descriptors %d",
                   mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], adapter->mtu,
                   adapter->tx_desc_cnt, adapter->rx_desc_cnt);
@@ -364,7 +578,8 @@ static boolean gve_cfg_device_resources(gve adapter)
     if (adapter->event_counters == INVALID_ADDRESS)
         return false;
 
-    u64 irq_db_size = sizeof(struct gve_irq_db) * GVE_IRQ_DB_COUNT;
+    /* one notification block for each TX queue, followed by one for each RX queue */
+    u64 irq_db_size = sizeof(struct gve_irq_db) * 2 * adapter->num_queues;
     adapter->irq_db_indices = allocate(adapter->contiguous, irq_db_size);
     if (adapter->irq_db_indices == INVALID_ADDRESS)
         goto err;
@@ -373,10 +588,10 @@ static boolean gve_cfg_device_resources(gve adapter)
     cmd->cfg_dev_resources.counter_array = htobe64(physical_from_virtual(adapter->event_counters));
     cmd->cfg_dev_resources.irq_db_addr = htobe64(physical_from_virtual(adapter->irq_db_indices));
     cmd->cfg_dev_resources.num_counters = htobe32(adapter->num_event_counters);
-    cmd->cfg_dev_resources.num_irq_dbs = htobe32(2);
+    cmd->cfg_dev_resources.num_irq_dbs = htobe32(2 * adapter->num_queues);
     cmd->cfg_dev_resources.irq_db_stride = htobe32(sizeof(*adapter->irq_db_indices));
     cmd->cfg_dev_resources.ntfy_blk_msix_base_idx = htobe32(0); /* management vector is last */
-    cmd->cfg_dev_resources.queue_format = GVE_GQI_QPL_FORMAT;
+    cmd->cfg_dev_resources.queue_format = adapter->queue_format;
     boolean success = gve_adminq_execute_cmd(adapter, cmd);
     if (success)
         return success;
@@ -392,7 +607,7 @@ static void gve_free_device_resources(gve adapter)
     cmd->opcode = htobe32(GVE_ADMINQ_DECONFIGURE_DEVICE_RESOURCES);
     gve_adminq_execute_cmd(adapter, cmd);
     deallocate(adapter->contiguous, adapter->irq_db_indices,
-               sizeof(struct gve_irq_db) * GVE_IRQ_DB_COUNT);
+               sizeof(struct gve_irq_db) * 2 * adapter->num_queues);
     deallocate(adapter->contiguous, adapter->event_counters,
                MAX(adapter->num_event_counters * sizeof(u32), PAGESIZE));
 }
@@ -444,10 +659,9 @@ static void gve_tx_qpl_cpy(gve_tx_queue tx, struct pbuf *p, u32 *offset, u32 *al
     tx->qpl_available -= *allocated;
 }
 
-err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
+static err_t gve_tx_gqi(gve_tx_queue tx, struct pbuf *p)
 {
-    gve adapter = netif->state;
-    gve_tx_queue tx = &adapter->tx;
+    gve adapter = tx->adapter;
     gve_tx_cleanup(tx);
     int seg_count = 0;
     u32 head = tx->qpl_head;
@@ -462,10 +676,10 @@ err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
     gve_debug("TX len %d (%d segments)", p->tot_len, seg_count);
     if (head < tx->qpl_head)
         head += tx->qpl_size;
-    if ((tx->head - tx->tail + seg_count > tx->adapter->tx_desc_cnt) ||
+    if ((tx->head - tx->tail + seg_count > adapter->tx_desc_cnt) ||
             (head - tx->qpl_head > tx->qpl_available)) {
         gve_debug("cannot transmit (%d available descriptors, %d bytes of QPL space)",
-                  tx->adapter->tx_desc_cnt - tx->head + tx->tail, tx->qpl_available);
+                  adapter->tx_desc_cnt - tx->head + tx->tail, tx->qpl_available);
         return ERR_MEM;
     }
     u32 offset;
@@ -483,7 +697,7 @@ err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
         struct gve_tx_seg_desc *seg = &tx->desc[tx->head++ & tx->mask].seg;
         seg->type_flags = GVE_TXD_SEG;
         seg->seg_len = htobe16(q->len);
-        pkt->seg_addr = htobe64(offset);
+        seg->seg_addr = htobe64(offset);
     }
     gve_debug("TX head %d, QPL available %d", tx->head, tx->qpl_available);
     write_barrier();
@@ -492,6 +706,179 @@ err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
     return ERR_OK;
 }
 
+static void gve_irq_enable_dqo(gve adapter, u32 *irq_db_index, u32 val)
+{
+    pci_bar_write_4(&adapter->db_bar, be32toh(*irq_db_index) * sizeof(u32),
+                    GVE_ITR_ENABLE_BIT_DQO | val);
+}
+
+static u32 gve_irq_interval_dqo(u32 interval_us)
+{
+    /* the interval has a granularity of 2 microseconds */
+    return ((interval_us >> 1) & GVE_ITR_INTERVAL_DQO_MASK) << GVE_ITR_INTERVAL_DQO_SHIFT;
+}
+
+static void gve_tx_free_tag_dqo(gve_tx_queue tx, u16 tag)
+{
+    tx->dqo.pending[tag].state = GVE_TX_PENDING_FREE;
+    tx->dqo.free_tags[tx->dqo.free_tag_count++] = tag;
+}
+
+static void gve_tx_complete_pkt_dqo(gve_tx_queue tx, u16 tag, u8 type)
+{
+    if (tag >= tx->adapter->tx_desc_cnt) {
+        msg_err("invalid completion tag %d\n", tag);
+        return;
+    }
+    struct gve_tx_pending_dqo *pending = &tx->dqo.pending[tag];
+    switch (type) {
+    case GVE_TX_DQO_COMPL_PKT:
+        if (pending->state != GVE_TX_PENDING_DATA)
+            break;
+        pbuf_free(pending->p);
+        pending->p = 0;
+        gve_tx_free_tag_dqo(tx, tag);
+        break;
+    case GVE_TX_DQO_COMPL_MISS:
+        /* The packet has been transmitted, but its tag cannot be reused until the corresponding
+         * re-injection completion is received (or a timeout expires). */
+        if (pending->state != GVE_TX_PENDING_DATA)
+            break;
+        pbuf_free(pending->p);
+        pending->p = 0;
+        pending->state = GVE_TX_PENDING_REINJECT;
+        pending->deadline = uptime() + GVE_TX_DQO_REINJECT_TIMEOUT;
+        tx->dqo.reinject_count++;
+        break;
+    case GVE_TX_DQO_COMPL_REINJECT:
+        if (pending->state != GVE_TX_PENDING_REINJECT)
+            break;
+        tx->dqo.reinject_count--;
+        gve_tx_free_tag_dqo(tx, tag);
+        break;
+    }
+}
+
+/* called with TX queue lock held */
+static void gve_tx_cleanup_dqo(gve_tx_queue tx)
+{
+    while (true) {
+        struct gve_tx_compl_desc_dqo *compl = &tx->dqo.compl[tx->dqo.compl_head];
+        u16 id_type_gen = *(volatile u16 *)&compl->id_type_gen;
+        if ((id_type_gen & GVE_TX_DQO_COMPL_GEN) == tx->dqo.compl_gen)
+            break;
+        read_barrier();
+        u8 type = GVE_TX_DQO_COMPL_TYPE(id_type_gen);
+        if (type == GVE_TX_DQO_COMPL_DESC)
+            tx->dqo.head = compl->tag & tx->mask;
+        else
+            gve_tx_complete_pkt_dqo(tx, compl->tag, type);
+        tx->dqo.compl_head = (tx->dqo.compl_head + 1) & tx->dqo.compl_mask;
+        if (tx->dqo.compl_head == 0)
+            tx->dqo.compl_gen ^= GVE_TX_DQO_COMPL_GEN;
+    }
+    if (tx->dqo.reinject_count) {
+        timestamp here = uptime();
+        for (u16 tag = 0; tag < tx->adapter->tx_desc_cnt; tag++) {
+            struct gve_tx_pending_dqo *pending = &tx->dqo.pending[tag];
+            if ((pending->state == GVE_TX_PENDING_REINJECT) && (here >= pending->deadline)) {
+                gve_debug("TX re-injection completion timeout, tag %d", tag);
+                tx->dqo.reinject_count--;
+                gve_tx_free_tag_dqo(tx, tag);
+            }
+        }
+    }
+}
+
+/* Packet data is transmitted directly from the pbufs, which are referenced until the packet
+ * completion is received; a packet that needs more descriptors than the device accepts is copied
+ * into a single buffer. */
+static err_t gve_tx_dqo(gve_tx_queue tx, struct pbuf *p)
+{
+    gve adapter = tx->adapter;
+    gve_tx_cleanup_dqo(tx);
+    int desc_count = 0;
+    for (struct pbuf *q = p; q != NULL; q = q->next)
+        desc_count += (q->len + GVE_TX_DQO_MAX_BUF_SIZE - 1) / GVE_TX_DQO_MAX_BUF_SIZE;
+    boolean linearize = (desc_count > GVE_TX_DQO_MAX_DESCS);
+    if (linearize)
+        desc_count = (p->tot_len + GVE_TX_DQO_MAX_BUF_SIZE - 1) / GVE_TX_DQO_MAX_BUF_SIZE;
+    u16 avail = (tx->dqo.head - tx->dqo.tail - 1) & tx->mask;
+    if ((desc_count > avail) || (tx->dqo.free_tag_count == 0)) {
+        gve_debug("cannot transmit (%d available descriptors, %d available tags)", avail,
+                  tx->dqo.free_tag_count);
+        return ERR_MEM;
+    }
+    if (linearize) {
+        gve_debug("TX packet copy");
+        struct pbuf *q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+        if (!q)
+            return ERR_MEM;
+        pbuf_copy(q, p);
+        p = q;
+    } else {
+        pbuf_ref(p);
+    }
+    u16 tag = tx->dqo.free_tags[--tx->dqo.free_tag_count];
+    struct gve_tx_pending_dqo *pending = &tx->dqo.pending[tag];
+    pending->p = p;
+    pending->state = GVE_TX_PENDING_DATA;
+    u16 tail = tx->dqo.tail;
+    struct gve_tx_pkt_desc_dqo *desc = 0;
+    for (struct pbuf *q = p; q != NULL; q = q->next) {
+        u64 addr = physical_from_virtual(q->payload);
+        for (u32 offset = 0; offset < q->len; offset += GVE_TX_DQO_MAX_BUF_SIZE) {
+            desc = &tx->dqo.desc[tail];
+            desc->buf_addr = addr + offset;
+            desc->dtype_flags = GVE_TXD_DQO_DTYPE_PKT;
+            desc->compl_tag = tag;
+            desc->buf_size = MIN(q->len - offset, GVE_TX_DQO_MAX_BUF_SIZE);
+            tail = (tail + 1) & tx->mask;
+        }
+    }
+    desc->dtype_flags |= GVE_TXD_DQO_EOP;
+
+    /* request periodic descriptor completions, to know when ring slots can be reused */
+    if (((tail - tx->dqo.last_re) & tx->mask) >= GVE_TX_DQO_RE_INTERVAL) {
+        desc->dtype_flags |= GVE_TXD_DQO_RE;
+        tx->dqo.last_re = tail;
+    }
+    tx->dqo.tail = tail;
+    gve_debug("TX len %d, tag %d, tail %d", p->tot_len, tag, tail);
+    write_barrier();
+    pci_bar_write_4(&adapter->db_bar, be32toh(tx->q_res->db_index) * sizeof(u32), tail);
+    return ERR_OK;
+}
+
+err_t gve_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    gve adapter = netif->state;
+    gve_tx_queue tx = &adapter->tx[current_cpu()->id % adapter->num_queues];
+    err_t err;
+    spin_lock(&tx->lock);
+    if (adapter->queue_format == GVE_DQO_RDA_FORMAT)
+        err = gve_tx_dqo(tx, p);
+    else
+        err = gve_tx_gqi(tx, p);
+    spin_unlock(&tx->lock);
+    return err;
+}
+
+closure_func_basic(thunk, void, gve_tx_irq_dqo)
+{
+    gve_tx_queue tx = struct_from_field(closure_self(), gve_tx_queue, dqo.irq_handler);
+    async_apply_bh((thunk)&tx->dqo.service);
+}
+
+closure_func_basic(thunk, void, gve_tx_service_dqo)
+{
+    gve_tx_queue tx = struct_from_field(closure_self(), gve_tx_queue, dqo.service);
+    spin_lock(&tx->lock);
+    gve_tx_cleanup_dqo(tx);
+    spin_unlock(&tx->lock);
+    gve_irq_enable_dqo(tx->adapter, tx->dqo.irq_db_index, GVE_ITR_NO_UPDATE_DQO);
+}
+
 static void gve_rx_fill(gve_rx_queue rx)
 {
     gve adapter = rx->adapter;
@@ -524,14 +911,14 @@ closure_func_basic(thunk, void, gve_rx_irq)
     gve_debug("RX irq");
     gve_rx_queue rx = struct_from_field(closure_self(), gve_rx_queue, irq_handler);
     async_apply_bh((thunk)&rx->service);
-    /* further interrupts are masked until this interrupt is acked in the RX service thunk */
+    /* further interrupts are masked until this interrupt is acked (GQI) or re-enabled (DQO) in the
+     * RX service thunk */
 }
 
 closure_func_basic(thunk, void, gve_rx_service)
 {
     gve_rx_queue rx = struct_from_field(closure_self(), gve_rx_queue, service);
     gve adapter = rx->adapter;
-    struct netif *net_if = &adapter->ndev.n;
     u32 tail;
     boolean irq_acked = false;
     spin_lock(&rx->lock);
@@ -569,9 +956,7 @@ closure_func_basic(thunk, void, gve_rx_service)
                 continue;
             }
         }
-        err_t err = net_if->input(p, net_if);
-        if (err != ERR_OK)
-            pbuf_free(p);
+        net_gro_receive(&rx->gro, p);
     }
     if (rx->head - rx->tail <= (rx->mask + 1) / 2)
         gve_rx_fill(rx);
@@ -584,35 +969,179 @@ closure_func_basic(thunk, void, gve_rx_service)
         memory_barrier();
         goto begin;
     }
+    net_gro_flush(&rx->gro);
     spin_unlock(&rx->lock);
 }
 
+/* Posts free buffers from the pool to the buffer queue; called with RX queue lock held. */
+static void gve_rx_fill_dqo(gve_rx_queue rx)
+{
+    gve adapter = rx->adapter;
+    u16 tail = rx->dqo.bufq_tail;
+    u16 avail = (rx->dqo.bufq_head - tail - 1) & rx->dqo.bufq_mask;
+    u64 flags = spin_lock_irq(&rx->dqo.free_lock);
+    for (; avail; avail--) {
+        list l = list_get_next(&rx->dqo.free);
+        if (!l)
+            break;
+        list_delete(l);
+        gve_rx_buf_dqo rxb = struct_from_list(l, gve_rx_buf_dqo, l);
+        struct gve_rx_desc_dqo *desc = &rx->dqo.bufq[tail];
+        desc->buf_id = rxb - rx->dqo.bufs;
+        desc->buf_addr = rxb->paddr;
+        if (rx->dqo.hdr_bufs)
+            desc->header_buf_addr = physical_from_virtual(rx->dqo.hdr_bufs +
+                                                          tail * adapter->hdr_buf_size);
+        tail = (tail + 1) & rx->dqo.bufq_mask;
+    }
+
+    /* if the buffer queue is empty, no completions will trigger a refill, so the next buffer
+     * returned to the pool has to do it */
+    rx->dqo.starved = (tail == rx->dqo.bufq_head);
+    spin_unlock_irq(&rx->dqo.free_lock, flags);
+    gve_debug("RX fill: buffer queue head %d, tail %d -> %d", rx->dqo.bufq_head,
+              rx->dqo.bufq_tail, tail);
+    if (tail != rx->dqo.bufq_tail) {
+        rx->dqo.bufq_tail = tail;
+        write_barrier();
+        pci_bar_write_4(&adapter->db_bar, be32toh(rx->q_res->db_index) * sizeof(u32), tail);
+    }
+}
+
+/* called by the network stack or by the RX service when dropping a packet */
+static void gve_rx_buf_release_dqo(struct pbuf *p)
+{
+    gve_rx_buf_dqo rxb = (gve_rx_buf_dqo)p;
+    gve_rx_queue rx = rxb->rx;
+    u64 flags = spin_lock_irq(&rx->dqo.free_lock);
+    list_insert_before(&rx->dqo.free, &rxb->l);
+    boolean starved = rx->dqo.starved;
+    rx->dqo.starved = false;
+    spin_unlock_irq(&rx->dqo.free_lock, flags);
+    if (starved)
+        async_apply_bh((thunk)&rx->service);
+}
+
+closure_func_basic(thunk, void, gve_rx_service_dqo)
+{
+    gve_rx_queue rx = struct_from_field(closure_self(), gve_rx_queue, service);
+    gve adapter = rx->adapter;
+    spin_lock(&rx->lock);
+    while (true) {
+        struct gve_rx_compl_desc_dqo *desc = &rx->dqo.complq[rx->dqo.complq_head];
+        u16 len_gen = *(volatile u16 *)&desc->len_gen;
+        if ((len_gen & GVE_RX_DQO_GEN) == rx->dqo.complq_gen)
+            break;
+        read_barrier();
+        rx->dqo.complq_head = (rx->dqo.complq_head + 1) & rx->dqo.complq_mask;
+        if (rx->dqo.complq_head == 0)
+            rx->dqo.complq_gen ^= GVE_RX_DQO_GEN;
+
+        /* buffer queue entries (and their header buffers) are consumed in order */
+        u16 hdr_index = rx->dqo.bufq_head;
+        rx->dqo.bufq_head = (rx->dqo.bufq_head + 1) & rx->dqo.bufq_mask;
+        if (desc->buf_id >= rx->dqo.buf_count) {
+            msg_err("invalid buffer ID %d\n", desc->buf_id);
+            continue;
+        }
+        gve_rx_buf_dqo rxb = &rx->dqo.bufs[desc->buf_id];
+        struct pbuf *p = &rxb->p.pbuf;
+        if (desc->status0 & GVE_RX_DQO_ERROR) {
+            gve_debug("RX error");
+            gve_rx_buf_release_dqo(p);
+            if (rx->dqo.pkt) {
+                pbuf_free(rx->dqo.pkt);
+                rx->dqo.pkt = 0;
+            }
+            continue;
+        }
+        u16 length = len_gen & GVE_RX_DQO_LEN_MASK;
+        pbuf_alloced_custom(PBUF_RAW, length, PBUF_REF, &rxb->p, rxb->buf, GVE_RX_BUF_SIZE_DQO);
+        if ((desc->hdr_len_flags & GVE_RX_DQO_SPLIT_HEADER) && !rx->dqo.pkt) {
+            /* Header buffers are reused as soon as they are posted again, so the packet headers are
+             * copied; lwIP expects protocol headers to be in the first pbuf of a chain. */
+            u16 hdr_len = desc->hdr_len_flags & GVE_RX_DQO_HDR_LEN_MASK;
+            struct pbuf *h = pbuf_alloc(PBUF_RAW, hdr_len, PBUF_RAM);
+            if (!h) {
+                msg_err("failed to allocate pbuf\n");
+                pbuf_free(p);
+                continue;
+            }
+            runtime_memcpy(h->payload, rx->dqo.hdr_bufs + hdr_index * adapter->hdr_buf_size,
+                           hdr_len);
+            if (length)
+                pbuf_cat(h, p);
+            else
+                pbuf_free(p);
+            p = h;
+        }
+        if (rx->dqo.pkt)
+            pbuf_cat(rx->dqo.pkt, p);
+        else
+            rx->dqo.pkt = p;
+        if (!(desc->status1 & GVE_RX_DQO_EOP))
+            continue;
+        p = rx->dqo.pkt;
+        rx->dqo.pkt = 0;
+        gve_debug("RX len %d", p->tot_len);
+        net_gro_receive(&rx->gro, p);
+    }
+    net_gro_flush(&rx->gro);
+    gve_rx_fill_dqo(rx);
+    spin_unlock(&rx->lock);
+    gve_irq_enable_dqo(adapter, rx->irq_db_index, GVE_ITR_NO_UPDATE_DQO);
+}
+
+/* MSI-X vectors: one for each notification block (TX queues first, then RX queues), then the
+ * management vector. The interrupts of queue pair i target CPU i, which is also the CPU that
+ * transmits on TX queue i (see gve_linkoutput()). */
+#define gve_mgmt_vector(adapter)    (2 * (adapter)->num_queues)
+
 static boolean gve_init_interrupts(gve adapter)
 {
-    int msix_avail = pci_enable_msix(adapter->pdev);
-    if (msix_avail < 3) /* TX irq, RX irq, management irq */
-        return false;
-    if (pci_setup_msix(adapter->pdev, 2,
+    pci_dev dev = adapter->pdev;
+    int mgmt_vector = gve_mgmt_vector(adapter);
+    int q;
+    if (pci_setup_msix(dev, mgmt_vector,
                        init_closure_func(&adapter->mgmt_irq_handler, thunk, gve_mgmt_irq),
                        ss("gve_mgmt")) == INVALID_PHYSICAL)
-        goto error;
-    if (pci_setup_msix(adapter->pdev, 1,
-                       init_closure_func(&adapter->rx.irq_handler, thunk, gve_rx_irq),
-                       ss("gve_rx")) == INVALID_PHYSICAL)
-        goto err_disable_mgmt;
+        return false;
+    for (q = 0; q < adapter->num_queues; q++) {
+        if (pci_setup_msix_aff(dev, adapter->num_queues + q,
+                               init_closure_func(&adapter->rx[q].irq_handler, thunk, gve_rx_irq),
+                               ss("gve_rx"), irangel(q, 1)) == INVALID_PHYSICAL)
+            goto err_teardown;
+        if (adapter->queue_format != GVE_DQO_RDA_FORMAT)
+            continue;
+
+        /* with GQI, TX completions are processed lazily when transmitting */
+        if (pci_setup_msix_aff(dev, q,
+                               init_closure_func(&adapter->tx[q].dqo.irq_handler, thunk,
+                                                 gve_tx_irq_dqo),
+                               ss("gve_tx"), irangel(q, 1)) == INVALID_PHYSICAL) {
+            pci_teardown_msix(dev, adapter->num_queues + q);
+            goto err_teardown;
+        }
+    }
     return true;
-  err_disable_mgmt:
-    pci_teardown_msix(adapter->pdev, 2);
-  error:
-    pci_disable_msix(adapter->pdev);
+  err_teardown:
+    while (q-- > 0) {
+        pci_teardown_msix(dev, adapter->num_queues + q);
+        if (adapter->queue_format == GVE_DQO_RDA_FORMAT)
+            pci_teardown_msix(dev, q);
+    }
+    pci_teardown_msix(dev, mgmt_vector);
     return false;
 }
 
 static void gve_deinit_interrupts(gve adapter)
 {
-    pci_teardown_msix(adapter->pdev, 1);
-    pci_teardown_msix(adapter->pdev, 2);
-    pci_disable_msix(adapter->pdev);
+    for (int q = 0; q < adapter->num_queues; q++) {
+        pci_teardown_msix(adapter->pdev, adapter->num_queues + q);
+        if (adapter->queue_format == GVE_DQO_RDA_FORMAT)
+            pci_teardown_msix(adapter->pdev, q);
+    }
+    pci_teardown_msix(adapter->pdev, gve_mgmt_vector(adapter));
 }
 
 static void *gve_create_qpl(gve adapter, u16 num_pages, u32 id)
@@ -683,6 +1212,7 @@ static boolean gve_create_tx_queue(gve adapter, gve_tx_queue tx, u32 index)
     tx->qpl_head = 0;
     tx->qpl_available = tx->qpl_size = num_pages * PAGESIZE;
     tx->adapter = adapter;
+    spin_lock_init(&tx->lock);
     return true;
   err4:
     deallocate(adapter->contiguous, tx->q_res, sizeof(*tx->q_res));
@@ -709,10 +1239,87 @@ static void gve_destroy_tx_queue(gve adapter, gve_tx_queue tx, u32 index)
     gve_destroy_qpl(adapter, tx->qpl_base, adapter->tx_pages_per_qpl, index);
 }
 
+static boolean gve_create_tx_queue_dqo(gve adapter, gve_tx_queue tx, u32 index)
+{
+    u16 desc_cnt = adapter->tx_desc_cnt;
+    u16 compl_cnt = adapter->tx_compq_cnt;
+    tx->dqo.desc = allocate_zero(adapter->contiguous, desc_cnt * sizeof(*tx->dqo.desc));
+    if (tx->dqo.desc == INVALID_ADDRESS)
+        return false;
+    tx->dqo.compl = allocate_zero(adapter->contiguous, compl_cnt * sizeof(*tx->dqo.compl));
+    if (tx->dqo.compl == INVALID_ADDRESS)
+        goto err1;
+    tx->dqo.pending = allocate_zero(adapter->general, desc_cnt * sizeof(*tx->dqo.pending));
+    if (tx->dqo.pending == INVALID_ADDRESS)
+        goto err2;
+    tx->dqo.free_tags = allocate(adapter->general, desc_cnt * sizeof(*tx->dqo.free_tags));
+    if (tx->dqo.free_tags == INVALID_ADDRESS)
+        goto err3;
+    tx->q_res = allocate(adapter->contiguous, sizeof(*tx->q_res));
+    if (tx->q_res == INVALID_ADDRESS)
+        goto err4;
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_CREATE_TX_QUEUE);
+    cmd->create_tx_queue.queue_id = htobe32(index);
+    cmd->create_tx_queue.queue_resources_addr = htobe64(physical_from_virtual(tx->q_res));
+    cmd->create_tx_queue.tx_ring_addr = htobe64(physical_from_virtual(tx->dqo.desc));
+    cmd->create_tx_queue.queue_page_list_id = htobe32(GVE_RAW_ADDRESSING_QPL_ID);
+    cmd->create_tx_queue.ntfy_id = htobe32(index);
+    cmd->create_tx_queue.tx_comp_ring_addr = htobe64(physical_from_virtual(tx->dqo.compl));
+    cmd->create_tx_queue.tx_ring_size = htobe16(desc_cnt);
+    cmd->create_tx_queue.tx_comp_ring_size = htobe16(compl_cnt);
+    if (!gve_adminq_execute_cmd(adapter, cmd))
+        goto err5;
+    tx->mask = desc_cnt - 1;
+    tx->dqo.head = tx->dqo.tail = tx->dqo.last_re = 0;
+    tx->dqo.compl_mask = compl_cnt - 1;
+    tx->dqo.compl_head = 0;
+    tx->dqo.compl_gen = 0;
+    for (u16 tag = 0; tag < desc_cnt; tag++)
+        tx->dqo.free_tags[tag] = desc_cnt - 1 - tag;
+    tx->dqo.free_tag_count = desc_cnt;
+    tx->dqo.reinject_count = 0;
+    tx->dqo.irq_db_index = &adapter->irq_db_indices[index].index;
+    tx->adapter = adapter;
+    spin_lock_init(&tx->lock);
+    init_closure_func(&tx->dqo.service, thunk, gve_tx_service_dqo);
+    gve_irq_enable_dqo(adapter, tx->dqo.irq_db_index,
+                       gve_irq_interval_dqo(GVE_TX_IRQ_INTERVAL_US_DQO));
+    return true;
+  err5:
+    deallocate(adapter->contiguous, tx->q_res, sizeof(*tx->q_res));
+  err4:
+    deallocate(adapter->general, tx->dqo.free_tags, desc_cnt * sizeof(*tx->dqo.free_tags));
+  err3:
+    deallocate(adapter->general, tx->dqo.pending, desc_cnt * sizeof(*tx->dqo.pending));
+  err2:
+    deallocate(adapter->contiguous, tx->dqo.compl, compl_cnt * sizeof(*tx->dqo.compl));
+  err1:
+    deallocate(adapter->contiguous, tx->dqo.desc, desc_cnt * sizeof(*tx->dqo.desc));
+    return false;
+}
+
+static void gve_destroy_tx_queue_dqo(gve adapter, gve_tx_queue tx, u32 index)
+{
+    u16 desc_cnt = adapter->tx_desc_cnt;
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_DESTROY_TX_QUEUE);
+    cmd->destroy_tx_queue.queue_id = htobe32(index);
+    gve_adminq_execute_cmd(adapter, cmd);
+    for (u16 tag = 0; tag < desc_cnt; tag++)
+        if (tx->dqo.pending[tag].p)
+            pbuf_free(tx->dqo.pending[tag].p);
+    deallocate(adapter->contiguous, tx->q_res, sizeof(*tx->q_res));
+    deallocate(adapter->general, tx->dqo.free_tags, desc_cnt * sizeof(*tx->dqo.free_tags));
+    deallocate(adapter->general, tx->dqo.pending, desc_cnt * sizeof(*tx->dqo.pending));
+    deallocate(adapter->contiguous, tx->dqo.compl, adapter->tx_compq_cnt * sizeof(*tx->dqo.compl));
+    deallocate(adapter->contiguous, tx->dqo.desc, desc_cnt * sizeof(*tx->dqo.desc));
+}
+
 static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
 {
     u16 num_pages = adapter->rx_data_slot_cnt;
-    u32 id = 1 + index; /* used for both QPL and notify block */
+    u32 id = adapter->num_queues + index;   /* used for both QPL and notify block */
     rx->qpl_base = gve_create_qpl(adapter, num_pages, id);
     if (rx->qpl_base == INVALID_ADDRESS)
         return false;
@@ -756,6 +1363,7 @@ static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
     rx->adapter = adapter;
     init_closure_func(&rx->service, thunk, gve_rx_service);
     spin_lock_init(&rx->lock);
+    net_gro_init(&rx->gro, &adapter->ndev.n, false);
     gve_rx_fill(rx);
     return true;
   err5:
@@ -771,15 +1379,176 @@ static boolean gve_create_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
     return false;
 }
 
-static boolean gve_setup_queues(gve adapter)
+static void gve_destroy_rx_queue(gve adapter, gve_rx_queue rx, u32 index)
 {
-    if (!gve_create_tx_queue(adapter, &adapter->tx, 0))
-        return false;
-    if (!gve_create_rx_queue(adapter, &adapter->rx, 0)) {
-        gve_destroy_tx_queue(adapter, &adapter->tx, 0);
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_DESTROY_RX_QUEUE);
+    cmd->destroy_rx_queue.queue_id = htobe32(index);
+    gve_adminq_execute_cmd(adapter, cmd);
+    deallocate(adapter->contiguous, rx->q_res, sizeof(*rx->q_res));
+    deallocate(adapter->contiguous, rx->data, adapter->rx_data_slot_cnt * sizeof(*rx->data));
+    deallocate(adapter->contiguous, rx->desc, adapter->rx_desc_cnt * sizeof(*rx->desc));
+    deallocate(adapter->general, rx->pbufs, rx->qpl_count * sizeof(*rx->pbufs));
+    gve_destroy_qpl(adapter, rx->qpl_base, adapter->rx_data_slot_cnt,
+                    adapter->num_queues + index);
+}
+
+/* The receive buffer pool is larger than the buffer queue, so that buffers held by the network
+ * stack do not prevent the device from receiving more packets. */
+static boolean gve_create_rx_queue_dqo(gve adapter, gve_rx_queue rx, u32 index)
+{
+    u16 bufq_cnt = adapter->rx_bufq_cnt;
+    u16 complq_cnt = adapter->rx_desc_cnt;
+    u32 buf_count = bufq_cnt * GVE_RX_BUF_POOL_FACTOR;
+    u32 id = adapter->num_queues + index;   /* notify block */
+    rx->dqo.bufq = allocate_zero(adapter->contiguous, bufq_cnt * sizeof(*rx->dqo.bufq));
+    if (rx->dqo.bufq == INVALID_ADDRESS)
         return false;
+    rx->dqo.complq = allocate_zero(adapter->contiguous, complq_cnt * sizeof(*rx->dqo.complq));
+    if (rx->dqo.complq == INVALID_ADDRESS)
+        goto err1;
+    rx->dqo.bufs = allocate(adapter->general, buf_count * sizeof(*rx->dqo.bufs));
+    if (rx->dqo.bufs == INVALID_ADDRESS)
+        goto err2;
+    rx->dqo.buf_mem = allocate(adapter->contiguous, buf_count * GVE_RX_BUF_SIZE_DQO);
+    if (rx->dqo.buf_mem == INVALID_ADDRESS)
+        goto err3;
+    if (adapter->hdr_buf_size) {
+        rx->dqo.hdr_bufs = allocate(adapter->contiguous, bufq_cnt * adapter->hdr_buf_size);
+        if (rx->dqo.hdr_bufs == INVALID_ADDRESS)
+            goto err4;
+    } else {
+        rx->dqo.hdr_bufs = 0;
+    }
+    rx->q_res = allocate(adapter->contiguous, sizeof(*rx->q_res));
+    if (rx->q_res == INVALID_ADDRESS)
+        goto err5;
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_CREATE_RX_QUEUE);
+    cmd->create_rx_queue.queue_id = cmd->create_rx_queue.index = htobe32(index);
+    cmd->create_rx_queue.ntfy_id = htobe32(id);
+    cmd->create_rx_queue.queue_resources_addr = htobe64(physical_from_virtual(rx->q_res));
+    cmd->create_rx_queue.rx_desc_ring_addr = htobe64(physical_from_virtual(rx->dqo.complq));
+    cmd->create_rx_queue.rx_data_ring_addr = htobe64(physical_from_virtual(rx->dqo.bufq));
+    cmd->create_rx_queue.queue_page_list_id = htobe32(GVE_RAW_ADDRESSING_QPL_ID);
+    cmd->create_rx_queue.rx_ring_size = htobe16(complq_cnt);
+    cmd->create_rx_queue.packet_buffer_size = htobe16(GVE_RX_BUF_SIZE_DQO);
+    cmd->create_rx_queue.rx_buff_ring_size = htobe16(bufq_cnt);
+    cmd->create_rx_queue.header_buffer_size = htobe16(adapter->hdr_buf_size);
+    if (!gve_adminq_execute_cmd(adapter, cmd))
+        goto err6;
+    rx->dqo.bufq_mask = bufq_cnt - 1;
+    rx->dqo.bufq_head = rx->dqo.bufq_tail = 0;
+    rx->dqo.complq_mask = complq_cnt - 1;
+    rx->dqo.complq_head = 0;
+    rx->dqo.complq_gen = 0;
+    rx->dqo.buf_count = buf_count;
+    rx->dqo.pkt = 0;
+    spin_lock_init(&rx->dqo.free_lock);
+    list_init(&rx->dqo.free);
+    for (u32 i = 0; i < buf_count; i++) {
+        gve_rx_buf_dqo rxb = &rx->dqo.bufs[i];
+        rxb->p.custom_free_function = gve_rx_buf_release_dqo;
+        rxb->rx = rx;
+        rxb->buf = rx->dqo.buf_mem + i * GVE_RX_BUF_SIZE_DQO;
+        rxb->paddr = physical_from_virtual(rxb->buf);
+        list_insert_before(&rx->dqo.free, &rxb->l);
+    }
+    rx->irq_db_index = &adapter->irq_db_indices[id].index;
+    rx->adapter = adapter;
+    init_closure_func(&rx->service, thunk, gve_rx_service_dqo);
+    spin_lock_init(&rx->lock);
+    net_gro_init(&rx->gro, &adapter->ndev.n, false);
+    gve_rx_fill_dqo(rx);
+    gve_irq_enable_dqo(adapter, rx->irq_db_index,
+                       gve_irq_interval_dqo(GVE_RX_IRQ_INTERVAL_US_DQO));
+    return true;
+  err6:
+    deallocate(adapter->contiguous, rx->q_res, sizeof(*rx->q_res));
+  err5:
+    if (rx->dqo.hdr_bufs)
+        deallocate(adapter->contiguous, rx->dqo.hdr_bufs, bufq_cnt * adapter->hdr_buf_size);
+  err4:
+    deallocate(adapter->contiguous, rx->dqo.buf_mem, buf_count * GVE_RX_BUF_SIZE_DQO);
+  err3:
+    deallocate(adapter->general, rx->dqo.bufs, buf_count * sizeof(*rx->dqo.bufs));
+  err2:
+    deallocate(adapter->contiguous, rx->dqo.complq, complq_cnt * sizeof(*rx->dqo.complq));
+  err1:
+    deallocate(adapter->contiguous, rx->dqo.bufq, bufq_cnt * sizeof(*rx->dqo.bufq));
+    return false;
+}
+
+static void gve_destroy_rx_queue_dqo(gve adapter, gve_rx_queue rx, u32 index)
+{
+    u16 bufq_cnt = adapter->rx_bufq_cnt;
+    struct gve_adminq_command *cmd = gve_adminq_new_cmd(adapter);
+    cmd->opcode = htobe32(GVE_ADMINQ_DESTROY_RX_QUEUE);
+    cmd->destroy_rx_queue.queue_id = htobe32(index);
+    gve_adminq_execute_cmd(adapter, cmd);
+    deallocate(adapter->contiguous, rx->q_res, sizeof(*rx->q_res));
+    if (rx->dqo.hdr_bufs)
+        deallocate(adapter->contiguous, rx->dqo.hdr_bufs, bufq_cnt * adapter->hdr_buf_size);
+    deallocate(adapter->contiguous, rx->dqo.buf_mem, rx->dqo.buf_count * GVE_RX_BUF_SIZE_DQO);
+    deallocate(adapter->general, rx->dqo.bufs, rx->dqo.buf_count * sizeof(*rx->dqo.bufs));
+    deallocate(adapter->contiguous, rx->dqo.complq,
+               adapter->rx_desc_cnt * sizeof(*rx->dqo.complq));
+    deallocate(adapter->contiguous, rx->dqo.bufq, bufq_cnt * sizeof(*rx->dqo.bufq));
+}
+
+static void gve_destroy_queue_pair(gve adapter, u32 index)
+{
+    if (adapter->queue_format == GVE_DQO_RDA_FORMAT) {
+        gve_destroy_rx_queue_dqo(adapter, &adapter->rx[index], index);
+        gve_destroy_tx_queue_dqo(adapter, &adapter->tx[index], index);
+    } else {
+        gve_destroy_rx_queue(adapter, &adapter->rx[index], index);
+        gve_destroy_tx_queue(adapter, &adapter->tx[index], index);
+    }
+}
+
+static boolean gve_setup_queues(gve adapter)
+{
+    boolean dqo = (adapter->queue_format == GVE_DQO_RDA_FORMAT);
+    u32 q;
+    for (q = 0; q < adapter->num_queues; q++) {
+        gve_tx_queue tx = &adapter->tx[q];
+        gve_rx_queue rx = &adapter->rx[q];
+        if (!(dqo ? gve_create_tx_queue_dqo(adapter, tx, q) : gve_create_tx_queue(adapter, tx, q)))
+            goto error;
+        if (!(dqo ? gve_create_rx_queue_dqo(adapter, rx, q) : gve_create_rx_queue(adapter, rx, q))) {
+            if (dqo)
+                gve_destroy_tx_queue_dqo(adapter, tx, q);
+            else
+                gve_destroy_tx_queue(adapter, tx, q);
+            goto error;
+        }
     }
     return true;
+  error:
+    while (q-- > 0)
+        gve_destroy_queue_pair(adapter, q);
+    return false;
+}
+
+/* Uses as many queue pairs as supported by the device, up to one per CPU. */
+static void gve_set_num_queues(gve adapter, int msix_avail)
+{
+    u32 max_tx = be32toh(pci_bar_read_4(&adapter->reg_bar, GVE_REG_MAX_TX_QUEUES));
+    u32 max_rx = be32toh(pci_bar_read_4(&adapter->reg_bar, GVE_REG_MAX_RX_QUEUES));
+    u32 num_queues = MIN(MIN(max_tx, max_rx), MIN(total_processors, GVE_MAX_QUEUES));
+    if (adapter->default_num_queues)
+        num_queues = MIN(num_queues, adapter->default_num_queues);
+    num_queues = MIN(num_queues, (msix_avail - 1) / 2);
+
+    /* with GQI, all queue page lists must fit in the registered pages limit */
+    if (adapter->queue_format != GVE_DQO_RDA_FORMAT) {
+        u64 qpl_pages = adapter->tx_pages_per_qpl + adapter->rx_data_slot_cnt;
+        while ((num_queues > 1) && (num_queues * qpl_pages > adapter->max_registered_pages))
+            num_queues--;
+    }
+    adapter->num_queues = MAX(num_queues, 1);
+    gve_debug("%d queue pairs (max TX %d, max RX %d)", adapter->num_queues, max_tx, max_rx);
 }
 
 static boolean gve_init(gve adapter)
@@ -799,23 +1568,31 @@ static boolean gve_init(gve adapter)
         msg_err("failed to describe device\n");
         goto err1;
     }
+    int msix_avail = pci_enable_msix(adapter->pdev);
+    if (msix_avail < 3) { /* TX irq, RX irq, management irq */
+        msg_err("insufficient MSI-X vectors (%d)\n", msix_avail);
+        goto err2;
+    }
+    gve_set_num_queues(adapter, msix_avail);
     if (!gve_cfg_device_resources(adapter)) {
         msg_err("failed to configure device resources\n");
-        goto err1;
+        goto err2;
     }
     if (!gve_init_interrupts(adapter)) {
         msg_err("failed to initialize interrupts\n");
-        goto err2;
+        goto err3;
     }
     if (!gve_setup_queues(adapter)) {
         msg_err("failed to set up TX/RX queues\n");
-        goto err3;
+        goto err4;
     }
     return true;
-  err3:
+  err4:
     gve_deinit_interrupts(adapter);
-  err2:
+  err3:
     gve_free_device_resources(adapter);
+  err2:
+    pci_disable_msix(adapter->pdev);
   err1:
     pci_bar_deinit(&adapter->db_bar);
     pci_bar_deinit(&adapter->reg_bar);
@@ -34,8 +34,8 @@
 #define NVME_AQ_IDX     0   /* admin queue index */
 #define NVME_AQ_MSIX    0   /* admin queue MSI-X slot */
 
-#define NVME_IOQ_IDX    1   /* I/O queue index and identifier */
-#define NVME_IOQ_MSIX   1   /* I/O queue MSI-X slot */
+#define NVME_IOQ_IDX(i)     (1 + (i))   /* I/O queue index and identifier */
+#define NVME_IOQ_MSIX(i)    (1 + (i))   /* I/O queue MSI-X slot */
 
 /* command Dword 0 */
 #define NVME_CID(id)    ((id) << 16)
@@ -85,6 +85,16 @@
 #define CNS_NVM_SET_LIST        4
 #define NVME_IDENTIFY_RESP_SIZE 4096
 
+/* Optional NVM Command Support (identify controller) */
+#define NVME_ONCS_DSM       U64_FROM_BIT(2)
+#define NVME_ONCS_WRITE_Z   U64_FROM_BIT(3)
+
+/* Feature identifiers */
+#define NVME_FID_NUM_QUEUES 0x07
+#define NVME_NUM_QUEUES(ncq, nsq)   ((((ncq) - 1) << 16) | ((nsq) - 1))
+#define NVME_NSQA(dw0)  (((dw0) & 0xFFFF) + 1)
+#define NVME_NCQA(dw0)  (((dw0) >> 16) + 1)
+
 /* NVM command set opcodes */
 #define NVME_OPC_FLUSH      0x00
 #define NVME_OPC_WRITE      0x01
@@ -99,6 +109,13 @@
 #define NVME_OPC_RSV_ACQ    0x11
 #define NVME_OPC_RSV_REL    0x15
 
+/* Dataset Management command */
+#define NVME_DSM_AD         U64_FROM_BIT(2) /* deallocate */
+#define NVME_DSM_RANGES_MAX 256
+#define NVME_DSM_SIZE       (NVME_DSM_RANGES_MAX * sizeof(struct nvme_dsm_range))
+
+#define NVME_WRITE_Z_NLB_MAX    0x10000
+
 #define NVME_ASQ_ORDER  1
 #define NVME_ACQ_ORDER  1
 
@@ -144,6 +161,12 @@ struct nvme_sqe {   /* submission queue entry */
     u32 cdw15;
 } __attribute__((packed));
 
+struct nvme_dsm_range {
+    u32 cattr;  /* context attributes */
+    u32 nlb;
+    u64 slba;
+} __attribute__((packed));
+
 struct nvme_cqe {   /* completion queue entry */
     u32 dw0;
     u32 dw1;
@@ -170,36 +193,57 @@ declare_closure_struct(3, 3, void, nvme_io,
                        struct nvme *, n, u32, namespace, boolean, write,
                        void *buf, range blocks, status_handler sh);
 
+declare_closure_struct(2, 1, void, nvme_req_handler,
+                       struct nvme *, n, u32, namespace,
+                       storage_req req);
+
+/* I/O queue pair, serving a group of CPUs */
+typedef struct nvme_ioq {
+    struct nvme *n;
+    int idx;    /* queue index and identifier */
+    struct nvme_sq sq;
+    struct nvme_cq cq;
+    struct list pending_reqs, free_reqs, done_reqs;
+    vector cmds;
+    struct list free_cmds;
+    closure_struct(thunk, irq);
+    closure_struct(thunk, bh_service);
+    struct spinlock lock;
+    u64 completions;    /* number of completed requests */
+    struct io_poll poll;
+} *nvme_ioq;
+
 typedef struct nvme {
     heap general, contiguous;
     pci_dev d;
     struct pci_bar bar;
     u32 vs; /* controller version */
+    u16 oncs;   /* optional NVM command support */
     int dstrd;  /* doorbell stride */
     struct nvme_sq asq; /* admin submission queue */
     struct nvme_cq acq; /* admin completion queue */
     closure_struct(thunk, admin_irq);
     nvme_ac_handler ac_handler; /* admin completion handler */
     int ioq_order;     /* I/O queue size */
-    struct nvme_sq iosq;    /* I/O submission queue */
-    struct nvme_cq iocq;    /* I/O completion queue */
+    int ioq_count;     /* number of I/O queue pairs */
+    int ioq_created;   /* number of I/O queue pairs created in the controller */
+    nvme_ioq ioqs;
+    nvme_ioq *ioq_map;  /* CPU to I/O queue mapping */
+    boolean io_poll;    /* hybrid polled completion */
     int attach_id;
-    closure_struct(thunk, io_irq);
-    struct list pending_reqs, free_reqs, done_reqs;
-    vector cmds;
-    struct list free_cmds;
-    closure_struct(thunk, bh_service);
     closure_struct(nvme_io, r);
     closure_struct(nvme_io, w);
-    closure_struct(storage_simple_req_handler, req_handler);
-    struct spinlock lock;
+    closure_struct(storage_simple_req_handler, simple_req_handler);
+    storage_req_handler simple_rh;  /* handler of read and write requests */
+    closure_struct(nvme_req_handler, req_handler);
 } *nvme;
 
 typedef struct nvme_ioreq {
     struct list l;
+    nvme_ioq q;
     u32 namespace;
-    boolean write;
-    void *buf;
+    u8 opcode;
+    void *buf;  /* DSM command: range list */
     range blocks;
     u64 pending_cmds;
     status_handler sh;
@@ -282,6 +326,12 @@ static struct nvme_cqe *nvme_get_cqe(nvme_cq q)
     return cqe;
 }
 
+static boolean nvme_cqe_pending(nvme_cq q)
+{
+    volatile struct nvme_cqe *cqe = q->ring + q->head;
+    return (NVME_PHASE_TAG(cqe->dw3) != q->phase);
+}
+
 static inline void nvme_cq_doorbell(nvme n, int q_idx, nvme_cq q)
 {
     /* Completion queue head doorbell register offset */
@@ -290,38 +340,123 @@ static inline void nvme_cq_doorbell(nvme n, int q_idx, nvme_cq q)
     pci_bar_write_4(&n->bar, cqhdbl, q->head);
 }
 
-static nvme_ioreq nvme_get_ioreq(nvme n)
+static boolean nvme_ioq_init(nvme n, nvme_ioq q, int idx)
+{
+    q->cmds = allocate_vector(n->general, U64_FROM_BIT(MIN(n->ioq_order, 8)));
+    if (q->cmds == INVALID_ADDRESS)
+        return false;
+    q->n = n;
+    q->idx = idx;
+    q->sq.ring = 0;
+    q->cq.ring = 0;
+    list_init(&q->pending_reqs);
+    list_init(&q->free_reqs);
+    list_init(&q->done_reqs);
+    list_init(&q->free_cmds);
+    spin_lock_init(&q->lock);
+    q->completions = 0;
+    io_poll_init(&q->poll);
+    return true;
+}
+
+static void nvme_ioq_deinit(nvme n, nvme_ioq q)
+{
+    nvme_iocmd cmd;
+    vector_foreach(q->cmds, cmd)
+        deallocate(n->general, cmd, sizeof(*cmd));
+    deallocate_vector(q->cmds);
+    list l;
+    while ((l = list_get_next(&q->free_reqs))) {
+        list_delete(l);
+        deallocate(n->general, struct_from_list(l, nvme_ioreq, l), sizeof(struct nvme_ioreq));
+    }
+    if (q->sq.ring)
+        nvme_deinit_sq(n, &q->sq);
+    if (q->cq.ring)
+        nvme_deinit_cq(n, &q->cq);
+}
+
+static void nvme_ioqs_deinit(nvme n)
+{
+    for (int i = 0; i < n->ioq_count; i++) {
+        nvme_ioq q = &n->ioqs[i];
+        if (q->cq.ring)
+            pci_teardown_msix(n->d, NVME_IOQ_MSIX(i));
+        nvme_ioq_deinit(n, q);
+    }
+    deallocate(n->general, n->ioqs, n->ioq_count * sizeof(n->ioqs[0]));
+    deallocate(n->general, n->ioq_map, present_processors * sizeof(n->ioq_map[0]));
+    n->ioq_count = 0;
+}
+
+/* Distributes the CPUs among the I/O queue pairs, so that each CPU is served by the I/O queue
+ * whose interrupt is targeted at one of the CPUs in the same group. */
+static boolean nvme_ioqs_alloc(nvme n, int ioq_count)
+{
+    n->ioqs = allocate(n->general, ioq_count * sizeof(n->ioqs[0]));
+    if (n->ioqs == INVALID_ADDRESS)
+        return false;
+    n->ioq_map = allocate(n->general, present_processors * sizeof(n->ioq_map[0]));
+    if (n->ioq_map == INVALID_ADDRESS)
+        goto free_ioqs;
+    u64 cpus_per_ioq = total_processors / ioq_count;
+    u64 excess_cpus = total_processors - cpus_per_ioq * ioq_count;
+    u64 cpu = 0;
+    for (n->ioq_count = 0; n->ioq_count < ioq_count; n->ioq_count++) {
+        nvme_ioq q = &n->ioqs[n->ioq_count];
+        if (!nvme_ioq_init(n, q, NVME_IOQ_IDX(n->ioq_count)))
+            goto deinit_ioqs;
+        u64 num_cpus = (n->ioq_count < excess_cpus) ? (cpus_per_ioq + 1) : cpus_per_ioq;
+        for (u64 i = 0; i < num_cpus; i++)
+            n->ioq_map[cpu++] = q;
+    }
+    for (; cpu < present_processors; cpu++)
+        n->ioq_map[cpu] = n->ioq_map[cpu % total_processors];
+    return true;
+  deinit_ioqs:
+    while (n->ioq_count > 0)
+        nvme_ioq_deinit(n, &n->ioqs[--n->ioq_count]);
+    deallocate(n->general, n->ioq_map, present_processors * sizeof(n->ioq_map[0]));
+  free_ioqs:
+    deallocate(n->general, n->ioqs, ioq_count * sizeof(n->ioqs[0]));
+    return false;
+}
+
+static nvme_ioreq nvme_get_ioreq(nvme_ioq q)
 {
     nvme_ioreq req;
-    spin_lock(&n->lock);
-    list l = list_get_next(&n->free_reqs);
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list l = list_get_next(&q->free_reqs);
     if (l) {
         list_delete(l);
         req = struct_from_list(l, nvme_ioreq, l);
     } else {
         nvme_debug("new request allocation");
-        req = allocate(n->general, sizeof(*req));
+        req = allocate(q->n->general, sizeof(*req));
     }
-    spin_unlock(&n->lock);
+    spin_unlock_irq(&q->lock, irqflags);
     return req;
 }
 
-/* Called with the lock held. */
-static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
+/* Called with the queue lock held. */
+static nvme_iocmd nvme_get_iocmd(nvme_ioq q, boolean allocate)
 {
-    list l = list_get_next(&n->free_cmds);
+    list l = list_get_next(&q->free_cmds);
     if (l) {
         list_delete(l);
         return struct_from_list(l, nvme_iocmd, l);
-    } else if (allocate && (vector_length(n->cmds) <= NVME_CID_MAX)) {
-        nvme_debug("new command allocation");
-        nvme_iocmd cmd = allocate(n->general, sizeof(*cmd));
+    } else if (allocate && (vector_length(q->cmds) < MIN(U64_FROM_BIT(q->sq.order),
+                                                           NVME_CID_MAX + 1))) {
+        /* The number of in-flight commands is bounded by the submission queue size, thus command
+         * identifiers (which are unique within a submission queue) never exceed this value. */
+        nvme_debug("queue %d: new command allocation", q->idx);
+        nvme_iocmd cmd = allocate(q->n->general, sizeof(*cmd));
         if (cmd == INVALID_ADDRESS) {
             nvme_debug("command allocation failed");
             return cmd;
         }
-        cmd->id = vector_length(n->cmds);
-        vector_push(n->cmds, cmd);
+        cmd->id = vector_length(q->cmds);
+        vector_push(q->cmds, cmd);
         return cmd;
     } else {
         nvme_debug("no available commands");
@@ -329,124 +464,224 @@ static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
     }
 }
 
-/* Called with the lock held. */
-static void nvme_service_pending(nvme n, boolean allocate)
+/* Called with the queue lock held. */
+static void nvme_service_pending(nvme_ioq q, boolean allocate)
 {
     boolean new_reqs = false;
     list l;
-    while ((l = list_get_next(&n->pending_reqs))) {
-        nvme_iocmd cmd = nvme_get_iocmd(n, allocate);
+    while ((l = list_get_next(&q->pending_reqs))) {
+        nvme_iocmd cmd = nvme_get_iocmd(q, allocate);
         if (cmd == INVALID_ADDRESS)
             break;
-        struct nvme_sqe *sqe = nvme_get_sqe(&n->iosq);
+        struct nvme_sqe *sqe = nvme_get_sqe(&q->sq);
         if (!sqe) {
-            list_insert_before(list_begin(&n->free_cmds), &cmd->l);
+            list_insert_before(list_begin(&q->free_cmds), &cmd->l);
             break;
         }
         new_reqs = true;
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
-        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP |
-                (req->write ? NVME_OPC_WRITE : NVME_OPC_READ);
+        zero(sqe, sizeof(*sqe));
+        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP | req->opcode;
         sqe->nsid = req->namespace;
-        u64 buf_start = physical_from_virtual(req->buf);
         u64 nlb = range_span(req->blocks);
-        u64 buf_end = buf_start + nlb * SECTOR_SIZE;
-        sqe->dptr.prp1 = buf_start;
-        if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
-            sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
-            if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
-                nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
-                req->buf += nlb * SECTOR_SIZE;
+        switch (req->opcode) {
+        case NVME_OPC_DS_MGMT:
+            /* the range list covers all the request blocks */
+            sqe->dptr.prp1 = physical_from_virtual(req->buf);
+            sqe->cdw10 = (nlb + U32_MAX - 1) / U32_MAX - 1;    /* number of ranges - 1 */
+            sqe->cdw11 = NVME_DSM_AD;
+            break;
+        case NVME_OPC_WRITE_Z:
+            nlb = MIN(nlb, NVME_WRITE_Z_NLB_MAX);
+            break;
+        default: {
+            u64 buf_start = physical_from_virtual(req->buf);
+            u64 buf_end = buf_start + nlb * SECTOR_SIZE;
+            sqe->dptr.prp1 = buf_start;
+            if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
+                sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
+                if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
+                    nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
+                    req->buf += nlb * SECTOR_SIZE;
+                }
             }
         }
+        }
         if (nlb == range_span(req->blocks))
             list_delete(l);
-        nvme_debug("request sectors [0x%x, 0x%x), cmd ID 0x%0x",
-                   req->blocks.start, req->blocks.start + nlb, cmd->id);
-        sqe->cdw10 = req->blocks.start;
-        sqe->cdw12 = nlb - 1;
+        nvme_debug("queue %d: opcode 0x%x, request sectors [0x%x, 0x%x), cmd ID 0x%0x",
+                   q->idx, req->opcode, req->blocks.start, req->blocks.start + nlb, cmd->id);
+        if (req->opcode != NVME_OPC_DS_MGMT) {
+            sqe->cdw10 = req->blocks.start;
+            sqe->cdw11 = req->blocks.start >> 32;
+            sqe->cdw12 = nlb - 1;
+        }
         cmd->req = req;
         req->pending_cmds++;
         req->blocks.start += nlb;
         new_reqs = true;
     }
     if (new_reqs)
-        nvme_sq_doorbell(n, NVME_IOQ_IDX, &n->iosq);
+        nvme_sq_doorbell(q->n, q->idx, &q->sq);
 }
 
-define_closure_function(3, 3, void, nvme_io,
-                        nvme, n, u32, namespace, boolean, write,
-                        void *buf, range blocks, status_handler sh)
+/* Called with the queue lock held. */
+static void nvme_ioq_service(nvme_ioq q)
 {
-    nvme n = bound(n);
-    u32 namespace = bound(namespace);
-    boolean write = bound(write);
-    nvme_debug("[%d] %c %R", namespace, write ? 'w' : 'r', blocks);
-    nvme_ioreq req = nvme_get_ioreq(n);
+    boolean done_empty = list_empty(&q->done_reqs);
+    struct nvme_cqe *cqe;
+    while ((cqe = nvme_get_cqe(&q->cq))) {
+        q->sq.head = NVME_SQ_HEAD(cqe->dw2);
+        nvme_iocmd cmd = vector_get(q->cmds, NVME_CMD_ID(cqe->dw3));
+        nvme_debug("  cmd ID 0x%0x complete", cmd->id);
+        nvme_ioreq req = cmd->req;
+        list_insert_before(list_begin(&q->free_cmds), &cmd->l);
+        int sc = NVME_STATUS_CODE(cqe->dw3);
+        u64 remaining = range_span(req->blocks);
+        if ((sc != NVME_SC_OK) && (remaining != 0))
+            list_delete(&req->l);   /* remove from pending list */
+        if (sc != NVME_SC_OK)
+            req->sc = sc;
+        boolean req_complete = !(--req->pending_cmds) && (!remaining || (sc != NVME_SC_OK));
+        if (req_complete) {
+            list_push_back(&q->done_reqs, &req->l);
+            q->completions++;
+        }
+    }
+    nvme_cq_doorbell(q->n, q->idx, &q->cq);
+    nvme_service_pending(q, false);
+    if (done_empty && !list_empty(&q->done_reqs))
+        async_apply_bh((thunk)&q->bh_service);
+}
+
+/* Spin on the completion queue until a request completes or the polling window expires; the
+ * queue interrupt stays enabled and handles any completion that is not reaped here. */
+static void nvme_io_poll(nvme_ioq q, u64 completions)
+{
+    timestamp start = io_poll_start(&q->poll);
+    timestamp deadline = start + q->poll.window;
+    boolean completed;
+    do {
+        if (nvme_cqe_pending(&q->cq)) {
+            u64 irqflags = spin_lock_irq(&q->lock);
+            nvme_ioq_service(q);
+            spin_unlock_irq(&q->lock, irqflags);
+        }
+        completed = (*(volatile u64 *)&q->completions != completions);
+        if (completed)
+            break;
+        kern_pause();
+    } while (now(CLOCK_ID_MONOTONIC_RAW) < deadline);
+    io_poll_end(&q->poll, start, completed);
+}
+
+static void nvme_submit(nvme n, u32 namespace, u8 opcode, void *buf, range blocks,
+                        status_handler sh)
+{
+    nvme_ioq q = n->ioq_map[current_cpu()->id];
+    nvme_debug("[%d] opcode 0x%x %R, queue %d", namespace, opcode, blocks, q->idx);
+    nvme_ioreq req = nvme_get_ioreq(q);
     if (req == INVALID_ADDRESS) {
         apply(sh, timm("result", "request allocation failed"));
         return;
     }
+    req->q = q;
     req->namespace = namespace;
-    req->write = write;
+    req->opcode = opcode;
     req->buf = buf;
     req->blocks = blocks;
     req->pending_cmds = 0;
     req->sh = sh;
     req->sc = NVME_SC_OK;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    list_push_back(&n->pending_reqs, &req->l);
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list_push_back(&q->pending_reqs, &req->l);
+    nvme_service_pending(q, true);
+    u64 completions = q->completions;
+    spin_unlock_irq(&q->lock, irqflags);
+    if (n->io_poll && !in_interrupt())
+        nvme_io_poll(q, completions);
 }
 
-closure_func_basic(thunk, void, nvme_io_irq)
+define_closure_function(3, 3, void, nvme_io,
+                        nvme, n, u32, namespace, boolean, write,
+                        void *buf, range blocks, status_handler sh)
 {
-    nvme_debug("%s", func_ss);
-    nvme n = struct_from_closure(nvme, io_irq);
-    spin_lock(&n->lock);
-    boolean done_empty = list_empty(&n->done_reqs);
-    struct nvme_cqe *cqe;
-    while ((cqe = nvme_get_cqe(&n->iocq))) {
-        n->iosq.head = NVME_SQ_HEAD(cqe->dw2);
-        nvme_iocmd cmd = vector_get(n->cmds, NVME_CMD_ID(cqe->dw3));
-        nvme_debug("  cmd ID 0x%0x complete", cmd->id);
-        nvme_ioreq req = cmd->req;
-        list_insert_before(list_begin(&n->free_cmds), &cmd->l);
-        int sc = NVME_STATUS_CODE(cqe->dw3);
-        u64 remaining = range_span(req->blocks);
-        if ((sc != NVME_SC_OK) && (remaining != 0))
-            list_delete(&req->l);   /* remove from pending list */
-        if (sc != NVME_SC_OK)
-            req->sc = sc;
-        boolean req_complete = !(--req->pending_cmds) && (!remaining || (sc != NVME_SC_OK));
-        if (req_complete)
-            list_push_back(&n->done_reqs, &req->l);
+    nvme_submit(bound(n), bound(namespace), bound(write) ? NVME_OPC_WRITE : NVME_OPC_READ, buf,
+                blocks, sh);
+}
+
+/* Deallocates the blocks with a single Dataset Management command; since deallocation is advisory,
+ * the blocks that do not fit in the range list (an unlikely case) are left alone. */
+static void nvme_discard(nvme n, u32 namespace, range blocks, status_handler sh)
+{
+    blocks.end = MIN(blocks.end, blocks.start + (u64)NVME_DSM_RANGES_MAX * U32_MAX);
+    struct nvme_dsm_range *dsm = allocate(n->contiguous, NVME_DSM_SIZE);
+    if (dsm == INVALID_ADDRESS) {
+        apply(sh, timm_oom);
+        return;
+    }
+    range r = blocks;
+    for (int i = 0; range_span(r); i++) {
+        u32 nlb = MIN(range_span(r), U32_MAX);
+        dsm[i].cattr = 0;
+        dsm[i].nlb = nlb;
+        dsm[i].slba = r.start;
+        r.start += nlb;
     }
-    nvme_cq_doorbell(n, NVME_IOQ_IDX, &n->iocq);
-    nvme_service_pending(n, false);
-    if (done_empty && !list_empty(&n->done_reqs))
-        async_apply_bh((thunk)&n->bh_service);
-    spin_unlock(&n->lock);
+    nvme_submit(n, namespace, NVME_OPC_DS_MGMT, dsm, blocks, sh);
+}
+
+define_closure_function(2, 1, void, nvme_req_handler,
+                        nvme, n, u32, namespace,
+                        storage_req req)
+{
+    nvme n = bound(n);
+    switch (req->op) {
+    case STORAGE_OP_DISCARD:
+        if (n->oncs & NVME_ONCS_DSM)
+            nvme_discard(n, bound(namespace), req->blocks, req->completion);
+        else
+            storage_req_unsupported(req);
+        break;
+    case STORAGE_OP_WRITE_ZEROES:
+        if (n->oncs & NVME_ONCS_WRITE_Z)
+            nvme_submit(n, bound(namespace), NVME_OPC_WRITE_Z, 0, req->blocks, req->completion);
+        else
+            storage_req_unsupported(req);
+        break;
+    default:
+        apply(n->simple_rh, req);
+    }
+}
+
+closure_func_basic(thunk, void, nvme_io_irq)
+{
+    nvme_ioq q = struct_from_closure(nvme_ioq, irq);
+    nvme_debug("%s: queue %d", func_ss, q->idx);
+    spin_lock(&q->lock);
+    nvme_ioq_service(q);
+    spin_unlock(&q->lock);
 }
 
 closure_func_basic(thunk, void, nvme_bh_service)
 {
-    nvme_debug("%s", func_ss);
-    nvme n = struct_from_closure(nvme, bh_service);
+    nvme_ioq q = struct_from_closure(nvme_ioq, bh_service);
+    nvme_debug("%s: queue %d", func_ss, q->idx);
     list l;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    while ((l = list_get_next(&n->done_reqs))) {
+    u64 irqflags = spin_lock_irq(&q->lock);
+    while ((l = list_get_next(&q->done_reqs))) {
         list_delete(l);
-        spin_unlock_irq(&n->lock, irqflags);
+        spin_unlock_irq(&q->lock, irqflags);
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
+        if (req->opcode == NVME_OPC_DS_MGMT)
+            deallocate(q->n->contiguous, req->buf, NVME_DSM_SIZE);
         apply(req->sh, (req->sc == NVME_SC_OK) ? STATUS_OK :
                 timm("result", "NVMe status code 0x%x", req->sc));
-        irqflags = spin_lock_irq(&n->lock);
-        list_insert_before(list_begin(&n->free_reqs), l);
+        irqflags = spin_lock_irq(&q->lock);
+        list_insert_before(list_begin(&q->free_reqs), l);
     }
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    nvme_service_pending(q, true);
+    spin_unlock_irq(&q->lock, irqflags);
 }
 
 closure_function(4, 0, void, nvme_ns_attach,
@@ -455,9 +690,10 @@ closure_function(4, 0, void, nvme_ns_attach,
     nvme n = bound(n);
     u32 ns_id = bound(ns_id);
     u64 disk_size = bound(disk_size);
-    apply(bound(a),
-          storage_init_req_handler(&n->req_handler, init_closure(&n->r, nvme_io, n, ns_id, false),
-                                   init_closure(&n->w, nvme_io, n, ns_id, true)),
+    n->simple_rh = storage_init_req_handler(&n->simple_req_handler,
+                                            init_closure(&n->r, nvme_io, n, ns_id, false),
+                                            init_closure(&n->w, nvme_io, n, ns_id, true));
+    apply(bound(a), init_closure(&n->req_handler, nvme_req_handler, n, ns_id),
           disk_size, n->attach_id);
     closure_finish();
 }
@@ -570,7 +806,8 @@ closure_function(3, 1, void, nvme_identify_controller_resp,
     }
     u16 vid = *(u16 *)resp; /* PCI Vendor ID */
     u32 nn = *(u32 *)(resp + 516);  /* number of namespaces */
-    nvme_debug("controller (vendor ID 0x%x) reports %d namespace(s)", vid, nn);
+    n->oncs = *(u16 *)(resp + 520);
+    nvme_debug("controller (vendor ID 0x%x) reports %d namespace(s), ONCS 0x%x", vid, nn, n->oncs);
     if (vid == AMZN_NVME_VID) {
         /* Retrieve block device name in vendor-specific field.
          * Expected name format (after trimming whitespace): '/dev/sd[a-z]' */
@@ -679,93 +916,155 @@ static boolean nvme_get_active_namespaces(nvme n, u32 start_id, storage_attach a
     return true;
 }
 
-closure_function(2, 1, void, nvme_create_iosq_resp,
-                 nvme, n, storage_attach, a,
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a);
+
+closure_function(3, 1, void, nvme_create_iosq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a,
                  struct nvme_cqe *cqe)
 {
     nvme n = bound(n);
-    storage_attach a = bound(a);
+    nvme_ioq q = bound(q);
     int sc = NVME_STATUS_CODE(cqe->dw3);
     if (sc == NVME_SC_OK) {
-        nvme_debug("I/O SQ created");
-        if (n->vs >= NVME_VER(1, 1, 0))
-            nvme_get_active_namespaces(n, 0, a);
+        nvme_debug("I/O SQ %d created", q->idx);
+        n->ioq_created++;
+        if (n->ioq_created < n->ioq_count)
+            nvme_create_iocq(n, &n->ioqs[n->ioq_created], bound(a));
+        else if (n->vs >= NVME_VER(1, 1, 0))
+            nvme_get_active_namespaces(n, 0, bound(a));
         else
-            nvme_identify_controller(n, a);
+            nvme_identify_controller(n, bound(a));
     } else {
-        msg_err("failed to create I/O SQ: status code 0x%x\n", sc);
+        msg_err("failed to create I/O SQ %d: status code 0x%x\n", q->idx, sc);
     }
     closure_finish();
 }
 
-static boolean nvme_create_iosq(nvme n, storage_attach a)
+static boolean nvme_create_iosq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_sq(n, &n->iosq, n->ioq_order)) {
+    if (!nvme_init_sq(n, &q->sq, n->ioq_order)) {
         msg_err("failed to initialize queue\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, a);
+    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_sq(n, &n->iosq);
+        nvme_deinit_sq(n, &q->sq);
+        q->sq.ring = 0;
         return false;
     }
 
     /* Zero out all submission queue entries, so that when submitting an entry
      * only used fields need to be set. This relies on the fact that all I/O
      * commands use the same set of fields. */
-    zero(n->iosq.ring, U64_FROM_BIT(n->iosq.order) * sizeof(struct nvme_sqe));
+    zero(q->sq.ring, U64_FROM_BIT(q->sq.order) * sizeof(struct nvme_sqe));
 
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOSQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iosq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_IDX << 16) | 0x01;  /* completion queue ID, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->sq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx;  /* queue size and queue ID */
+    cmd->cdw11 = (q->idx << 16) | 0x01;  /* completion queue ID, physically contiguous */
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
 
-closure_function(2, 1, void, nvme_create_iocq_resp,
-                 nvme, n, storage_attach, a,
+closure_function(3, 1, void, nvme_create_iocq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a,
                  struct nvme_cqe *cqe)
 {
     nvme n = bound(n);
+    nvme_ioq q = bound(q);
     int sc = NVME_STATUS_CODE(cqe->dw3);
     if (sc == NVME_SC_OK) {
-        nvme_debug("I/O CQ created");
-        nvme_create_iosq(n, bound(a));
+        nvme_debug("I/O CQ %d created", q->idx);
+        nvme_create_iosq(n, q, bound(a));
     } else {
-        msg_err("failed to create I/O CQ: status code 0x%x\n", sc);
+        msg_err("failed to create I/O CQ %d: status code 0x%x\n", q->idx, sc);
     }
     closure_finish();
 }
 
-static boolean nvme_create_iocq(nvme n, storage_attach a)
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_cq(n, &n->iocq, n->ioq_order)) {
+    if (!nvme_init_cq(n, &q->cq, n->ioq_order)) {
         msg_err("failed to initialize queue\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, a);
+    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_cq(n, &n->iocq);
-        return false;
+        goto deinit_cq;
     }
-    if (pci_setup_msix(n->d, NVME_IOQ_MSIX, init_closure_func(&n->io_irq, thunk, nvme_io_irq),
-                       ss("nvme I/O")) == INVALID_PHYSICAL) {
+    init_closure_func(&q->bh_service, thunk, nvme_bh_service);
+
+    /* The interrupt of each queue is steered to one of the CPUs that submit to that queue. */
+    int first_cpu = 0;
+    while (n->ioq_map[first_cpu] != q)
+        first_cpu++;
+    int num_cpus = 1;
+    while ((first_cpu + num_cpus < total_processors) && (n->ioq_map[first_cpu + num_cpus] == q))
+        num_cpus++;
+    if (pci_setup_msix_aff(n->d, NVME_IOQ_MSIX(q - n->ioqs), init_closure_func(&q->irq, thunk, nvme_io_irq),
+                           ss("nvme I/O"), irangel(first_cpu, num_cpus)) == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
-        return false;
+        deallocate_closure(n->ac_handler);
+        goto deinit_cq;
     }
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOCQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iocq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_MSIX << 16) | 0x03;  /* interrupts enabled, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->cq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx;  /* queue size and queue ID */
+    /* interrupt vector, interrupts enabled, physically contiguous */
+    cmd->cdw11 = (NVME_IOQ_MSIX(q - n->ioqs) << 16) | 0x03;
+    nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
+    return true;
+  deinit_cq:
+    nvme_deinit_cq(n, &q->cq);
+    q->cq.ring = 0;
+    return false;
+}
+
+closure_function(3, 1, void, nvme_set_num_queues_resp,
+                 nvme, n, int, max_ioqs, storage_attach, a,
+                 struct nvme_cqe *cqe)
+{
+    nvme n = bound(n);
+    int ioq_count = bound(max_ioqs);
+    int sc = NVME_STATUS_CODE(cqe->dw3);
+    if (sc == NVME_SC_OK) {
+        ioq_count = MIN(ioq_count, MIN(NVME_NSQA(cqe->dw0), NVME_NCQA(cqe->dw0)));
+    } else {
+        /* at least one I/O queue pair is always supported */
+        msg_warn("failed to set number of queues: status code 0x%x\n", sc);
+        ioq_count = 1;
+    }
+    nvme_debug("using %d I/O queue pair(s)", ioq_count);
+    if (nvme_ioqs_alloc(n, ioq_count))
+        nvme_create_iocq(n, &n->ioqs[0], bound(a));
+    else
+        msg_err("failed to allocate I/O queues\n");
+    closure_finish();
+}
+
+/* Requests from the controller as many I/O queue pairs as the available MSI-X vectors allow (up
+ * to one pair per CPU); the controller replies with the number of queues actually allocated. */
+static boolean nvme_set_num_queues(nvme n, int max_ioqs, storage_attach a)
+{
+    n->ac_handler = closure(n->general, nvme_set_num_queues_resp, n, max_ioqs, a);
+    if (n->ac_handler == INVALID_ADDRESS) {
+        msg_err("failed to allocate completion handler\n");
+        return false;
+    }
+    struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
+    assert(cmd);
+    zero(cmd, sizeof(*cmd));
+    cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_SET_FEAT;
+    cmd->cdw10 = NVME_FID_NUM_QUEUES;
+    cmd->cdw11 = NVME_NUM_QUEUES(max_ioqs, max_ioqs);
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
@@ -826,11 +1125,6 @@ closure_function(3, 1, boolean, nvme_probe,
         n->ioq_order--;
     nvme_debug("new controller (version %d.%d.%d), MQES %d, I/O queue order %d",
                NVME_VS_MJR(n->vs), NVME_VS_MNR(n->vs), NVME_VS_TER(n->vs), mqes, n->ioq_order);
-    n->cmds = allocate_vector(general, NVME_CID_MAX + 1);
-    if (n->cmds == INVALID_ADDRESS) {
-        msg_err("failed to allocate request vector\n");
-        goto deinit_acq;
-    }
     pci_bar_write_4(&n->bar, NVME_AQA, NVME_AQA_ACQS(U64_FROM_BIT(NVME_ACQ_ORDER)) |
                     NVME_AQA_ASQS(U64_FROM_BIT(NVME_ASQ_ORDER)));
     pci_bar_write_8(&n->bar, NVME_ASQ, physical_from_virtual(n->asq.ring));
@@ -845,29 +1139,29 @@ closure_function(3, 1, boolean, nvme_probe,
             kernel_delay(milliseconds(1 << retries));
         } else {
             msg_err("failed to enable controller\n");
-            goto free_cmds;
+            goto deinit_acq;
         }
     }
     n->d = d;
-    pci_enable_msix(d);
+    int msix_count = pci_enable_msix(d);
+    if (msix_count < 2) {
+        msg_err("insufficient MSI-X vectors (%d)\n", msix_count);
+        goto deinit_acq;
+    }
     if (pci_setup_msix(d, NVME_AQ_MSIX, init_closure_func(&n->admin_irq, thunk, nvme_admin_irq),
                        ss("nvme admin")) == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
-        goto free_cmds;
+        goto deinit_acq;
     }
     n->attach_id = -1;
-    list_init(&n->pending_reqs);
-    list_init(&n->free_reqs);
-    list_init(&n->done_reqs);
-    list_init(&n->free_cmds);
-    spin_lock_init(&n->lock);
-    init_closure_func(&n->bh_service, thunk, nvme_bh_service);
-    if (nvme_create_iocq(n, bound(a))) {
+    n->oncs = 0;
+    n->io_poll = storage_io_poll_enabled(ss("nvme"));
+    n->ioq_count = n->ioq_created = 0;
+    if (nvme_set_num_queues(n, MIN(total_processors, msix_count - NVME_IOQ_MSIX(0)), bound(a))) {
         d->driver_data = n;
         return true;
     }
-  free_cmds:
-    deallocate_vector(n->cmds);
+    pci_teardown_msix(d, NVME_AQ_MSIX);
   deinit_acq:
     nvme_deinit_cq(n, &n->acq);
   deinit_asq:
@@ -882,11 +1176,10 @@ closure_function(2, 0, void, nvme_detach_complete,
 {
     nvme_debug("detach complete");
     nvme n = bound(n);
-    pci_teardown_msix(n->d, NVME_IOQ_MSIX);
-    nvme_deinit_cq(n, &n->iocq);
+    if (n->ioq_count)
+        nvme_ioqs_deinit(n);
     pci_teardown_msix(n->d, NVME_AQ_MSIX);
     pci_disable_msix(n->d);
-    deallocate_vector(n->cmds);
     pci_bar_deinit(&n->bar);
     nvme_deinit_cq(n, &n->acq);
     nvme_deinit_sq(n, &n->asq);
@@ -12,11 +12,15 @@
 #define p9_debug(x, ...)
 #endif
 
+#define P9_IO_SEGS_MAX      32          /* maximum number of sg buffers in a read/write request */
+#define P9_READDIR_BUF_SIZE (64 * KB)
+
 typedef struct p9_dentry {
     struct list l;
     u32 fid;
     u64 qid;
     tuple md;
+    timestamp validated;    /* last time the dentry has been refreshed from the server */
     boolean pinned;
 } *p9_dentry;
 
@@ -26,7 +30,10 @@ typedef struct p9fs {
     u32 msize;
     struct p9_dentry root;
     struct list dentries;
+    table md_dentries;      /* metadata tuple -> dentry */
+    table qid_dentries;     /* qid -> dentry */
     struct list fsfiles;
+    timestamp cache_timeout;    /* validity of cached lookups and attributes (0: no caching) */
     void *transport;
 } *p9fs;
 
@@ -93,30 +100,73 @@ static void p9_fid_release(p9fs fs, u32 fid)
     deallocate_u64(fs->fid_h, fid, 1);
 }
 
+static void p9_dentry_set_md(p9fs fs, p9_dentry dentry, tuple md)
+{
+    if (dentry->md && (table_find(fs->md_dentries, dentry->md) == dentry))
+        table_set(fs->md_dentries, dentry->md, 0);
+    dentry->md = md;
+    if (md)
+        table_set(fs->md_dentries, md, dentry);
+}
+
+/* With hard links, multiple dentries may have the same qid: the table references the most recent
+ * one. */
+static void p9_dentry_set_qid(p9fs fs, p9_dentry dentry, u64 qid)
+{
+    if (dentry->qid && (table_find(fs->qid_dentries, pointer_from_u64(dentry->qid)) == dentry))
+        table_set(fs->qid_dentries, pointer_from_u64(dentry->qid), 0);
+    dentry->qid = qid;
+    if (qid)
+        table_set(fs->qid_dentries, pointer_from_u64(qid), dentry);
+}
+
+/* Removes a dentry from the lookup tables and the LRU list, without deallocating it. */
+static void p9_dentry_unlink(p9fs fs, p9_dentry dentry)
+{
+    if (list_inserted(&dentry->l))
+        list_delete(&dentry->l);
+    p9_dentry_set_md(fs, dentry, 0);
+    p9_dentry_set_qid(fs, dentry, 0);
+}
+
 static p9_dentry p9_dentry_new(p9fs fs, u32 fid, u64 qid, tuple md)
 {
     p9_dentry dentry = allocate(fs->fs.h, sizeof(*dentry));
     if (dentry == INVALID_ADDRESS)
         return 0;
     dentry->fid = fid;
-    dentry->qid = qid;
-    dentry->md = md;
+    dentry->qid = dentry->validated = 0;
+    dentry->md = 0;
     dentry->pinned = false;
+    p9_dentry_set_md(fs, dentry, md);
+    p9_dentry_set_qid(fs, dentry, qid);
     list_insert_after(list_end(&fs->dentries), &dentry->l);
     return dentry;
 }
 
 static void p9_dentry_delete(p9fs fs, p9_dentry dentry)
 {
-    if (list_inserted(&dentry->l))
-        list_delete(&dentry->l);
+    tuple md = dentry->md;
+    p9_dentry_unlink(fs, dentry);
     if (dentry->fid != P9_NOFID)
         p9_fid_release(fs, dentry->fid);
-    if (dentry->md)
-        p9_md_cleanup(dentry->md);
+    if (md)
+        p9_md_cleanup(md);
     deallocate(fs->fs.h, dentry, sizeof(*dentry));
 }
 
+static boolean p9_dentry_is_valid(p9fs fs, p9_dentry dentry)
+{
+    return (fs->cache_timeout && dentry->validated &&
+            (now(CLOCK_ID_MONOTONIC_RAW) - dentry->validated < fs->cache_timeout));
+}
+
+static void p9_dentry_validate(p9fs fs, p9_dentry dentry)
+{
+    if (fs->cache_timeout)
+        dentry->validated = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
 define_closure_function(1, 3, void, p9_fsf_io,
                         boolean, write,
                         sg_list sg, range q, status_handler complete)
@@ -137,13 +187,19 @@ define_closure_function(1, 3, void, p9_fsf_io,
     u32 iounit = fsf->iounit;
     u64 offset = q.start;
     do {
-        u32 count = MIN(iounit, len);
-        sg_buf sgb = sg_list_head_peek(sg);
-        count = MIN(count, sg_buf_len(sgb));
+        /* transfer as many sg buffers as allowed by the I/O unit in a single request */
+        u32 max = MIN(iounit, len);
+        u32 count = 0;
+        for (u64 i = 0; (i < P9_IO_SEGS_MAX) && (count < max); i++) {
+            sg_buf sgb = sg_list_peek_at(sg, i);
+            if (sgb == INVALID_ADDRESS)
+                break;
+            count += MIN(sg_buf_len(sgb), max - count);
+        }
         if (write)
-            v9p_write(p9fs->transport, fid, offset, count, sgb->buf + sgb->offset, apply_merge(m));
+            v9p_write(p9fs->transport, fid, offset, count, sg, apply_merge(m));
         else
-            v9p_read(p9fs->transport, fid, offset, count, sgb->buf + sgb->offset, apply_merge(m));
+            v9p_read(p9fs->transport, fid, offset, count, sg, apply_merge(m));
         sg_consume(sg, count);
         offset += count;
         len -= count;
@@ -219,10 +275,8 @@ closure_func_basic(thunk, void, p9_fsf_free)
     if (!fs_file_is_busy(fs, md)) {
         /* dentry will be deallocated when the pagecache sync is done: delete its metadata tuple now
          * so that it cannot be looked up (e.g. via its parent tuple). */
+        p9_dentry_unlink((p9fs)fs, dentry);
         p9_md_cleanup(md);
-        dentry->md = 0;
-
-        list_delete(&dentry->l);
     }
     list_delete(&fsf->l);
     filesystem_unlock(fs);
@@ -276,14 +330,11 @@ static void p9_fsfile_cache_hit(p9fs fs, p9_fsfile f)
     {                                                               \
         if (name == fs->root.name)                                  \
             return &fs->root;                                       \
-        list_foreach(&fs->dentries, e) {                            \
-             p9_dentry dentry = struct_from_list(e, p9_dentry, l);  \
-             if (dentry->name == name) {                            \
-                 p9_dentry_cache_hit(fs, dentry);                   \
-                 return dentry;                                     \
-             }                                                      \
-        }                                                           \
-        return 0;                                                   \
+        p9_dentry dentry = table_find(fs->name##_dentries,          \
+                                      pointer_from_u64(name));      \
+        if (dentry)                                                 \
+            p9_dentry_cache_hit(fs, dentry);                        \
+        return dentry;                                              \
 }
 
 P9_GET_DENTRY_FROM(tuple, md)
@@ -347,7 +398,7 @@ static fs_status p9_readdir(p9fs fs, u32 fid, tuple md)
         s = FS_STATUS_OK;
     else if (s != FS_STATUS_OK)
         return s;
-    const int iobuf_size = PAGESIZE;
+    const u32 iobuf_size = MIN(P9_READDIR_BUF_SIZE, fs->msize - P9_IOHDR_SIZE);
     u8 *buf = v9p_get_iobuf(fs->transport, iobuf_size);
     if (buf == INVALID_ADDRESS)
         return FS_STATUS_NOMEM;
@@ -469,7 +520,7 @@ static fs_status p9_rename(filesystem fs, tuple old_parent, string old_name, tup
     if ((s == FS_STATUS_OK) && new_md) {
         p9_dentry dentry = p9_get_dentry_from_md(p9fs, new_md);
         if (dentry) {
-            dentry->md = 0;
+            p9_dentry_set_md(p9fs, dentry, 0);
             p9_dentry_delete(p9fs, dentry);
         }
         *destruct_md = true;
@@ -488,7 +539,7 @@ static fs_status p9_unlink(filesystem fs, tuple parent, string name, tuple md, b
     if (s == FS_STATUS_OK) {
         p9_dentry dentry = p9_get_dentry_from_md(p9fs, md);
         if (dentry) {
-            dentry->md = 0;
+            p9_dentry_set_md(p9fs, dentry, 0);
             p9_dentry_delete(p9fs, dentry);
         }
         *destruct_md = true;
@@ -519,8 +570,12 @@ static fs_status p9_get_fsfile(filesystem fs, tuple md, fsfile *f)
     fs_status s = v9p_getattr(p9fs->transport, dentry->fid, P9_GETATTR_BASIC, &resp);
     if ((s == FS_STATUS_OK) && ((resp.valid & P9_GETATTR_BASIC) != P9_GETATTR_BASIC))
         s = FS_STATUS_IOERR;
-    if (s == FS_STATUS_OK)
-        s = v9p_lopen(p9fs->transport, dentry->fid, O_RDWR, &dentry->qid, &fsf->iounit);
+    u64 qid;
+    if (s == FS_STATUS_OK) {
+        s = v9p_lopen(p9fs->transport, dentry->fid, O_RDWR, &qid, &fsf->iounit);
+        if (s == FS_STATUS_OK)
+            p9_dentry_set_qid(p9fs, dentry, qid);
+    }
     if (s == FS_STATUS_INVAL) { /* this happens if fid has been already opened */
         s = FS_STATUS_OK;
     } else if (s != FS_STATUS_OK) {
@@ -562,8 +617,25 @@ static tuple p9_lookup(filesystem fs, tuple parent, string name)
     p9_dentry parent_dentry = p9_get_dentry_from_md(p9fs, parent);
     if (!parent_dentry)
         return 0;
-    if (!buffer_strcmp(name, "."))
-        return (p9_readdir(p9fs, parent_dentry->fid, parent) == FS_STATUS_OK) ? parent : 0;
+    boolean parent_valid = p9_dentry_is_valid(p9fs, parent_dentry);
+    if (!buffer_strcmp(name, ".")) {
+        if (!parent_valid) {
+            if (p9_readdir(p9fs, parent_dentry->fid, parent) != FS_STATUS_OK)
+                return 0;
+            p9_dentry_validate(p9fs, parent_dentry);
+        }
+        return parent;
+    }
+    if (parent_valid) {
+        /* The directory contents are up to date: positive and negative lookups can be served
+         * without querying the server. */
+        tuple md = lookup(parent, intern(name));
+        if (!md)
+            return 0;
+        p9_dentry dentry = p9_get_dentry_from_md(p9fs, md);
+        if (dentry && (dentry->fid != P9_NOFID) && p9_dentry_is_valid(p9fs, dentry))
+            return md;
+    }
     parent_dentry->pinned = true;
     u32 fid = p9_fid_new(p9fs);
     parent_dentry->pinned = false;
@@ -601,6 +673,7 @@ static tuple p9_lookup(filesystem fs, tuple parent, string name)
         if (!dentry)
             goto error;
     }
+    p9_dentry_validate(p9fs, dentry);
     return md;
   error:
     if (!dentry) {
@@ -624,10 +697,11 @@ static fs_status p9_create(filesystem fs, tuple parent, string name, tuple md, f
     if (!dentry)
         return FS_STATUS_NOMEM;
     fs_status ret;
+    u64 qid;
     if (is_dir(md)) {
-        ret = v9p_mkdir(p9fs->transport, parent_dentry->fid, name, 0777, &dentry->qid);
+        ret = v9p_mkdir(p9fs->transport, parent_dentry->fid, name, 0777, &qid);
     } else if (is_symlink(md)) {
-        ret = v9p_symlink(p9fs->transport, parent_dentry->fid, name, linktarget(md), &dentry->qid);
+        ret = v9p_symlink(p9fs->transport, parent_dentry->fid, name, linktarget(md), &qid);
     } else {
         boolean mknod;
         u32 mode;
@@ -645,7 +719,7 @@ static fs_status p9_create(filesystem fs, tuple parent, string name, tuple md, f
         }
         if (mknod) {
             ret = v9p_mknod(p9fs->transport, parent_dentry->fid, name, mode | 0644, major, minor,
-                          &dentry->qid);
+                          &qid);
         } else {
             p9_fsfile fsf = p9_fsfile_new(p9fs, dentry);
             if (!fsf) {
@@ -657,7 +731,7 @@ static fs_status p9_create(filesystem fs, tuple parent, string name, tuple md, f
             parent_dentry->pinned = false;
             ret = v9p_walk(p9fs->transport, parent_dentry->fid, dentry->fid, 0, 0);
             if (ret == FS_STATUS_OK)
-                ret = v9p_lcreate(p9fs->transport, dentry->fid, name, O_RDWR, 0644, &dentry->qid,
+                ret = v9p_lcreate(p9fs->transport, dentry->fid, name, O_RDWR, 0644, &qid,
                                   &fsf->iounit);
             if (ret == FS_STATUS_OK) {
                 if (fsf->iounit == 0)
@@ -669,8 +743,11 @@ static fs_status p9_create(filesystem fs, tuple parent, string name, tuple md, f
         }
     }
   out:
-    if (ret != FS_STATUS_OK) {
-        dentry->md = 0;
+    if (ret == FS_STATUS_OK) {
+        p9_dentry_set_qid(p9fs, dentry, qid);
+        p9_dentry_validate(p9fs, dentry);
+    } else {
+        p9_dentry_set_md(p9fs, dentry, 0);
         p9_dentry_delete(p9fs, dentry);
     }
     return ret;
@@ -692,6 +769,28 @@ static status_handler p9_get_sync_handler(filesystem fs, fsfile fsf, boolean dat
     return closure(fs->h, p9_cache_sync_complete, fs, fsf, datasync, completion);
 }
 
+/* The "virtfs_cache" root tuple option enables caching of lookups and attributes, which are
+ * otherwise refreshed from the server at each access: "loose" keeps cached data indefinitely (for
+ * exported trees that are not modified by the host), while a number specifies the validity in
+ * milliseconds of cached data. */
+static timestamp p9_cache_timeout(void)
+{
+    tuple root = get_root_tuple();
+    if (!root)
+        return 0;
+    symbol s = sym(virtfs_cache);
+    u64 ms;
+    if (get_u64(root, s, &ms))
+        return milliseconds(ms);
+    string mode = get_string(root, s);
+    if (!mode || !buffer_strcmp(mode, "none"))
+        return 0;
+    if (!buffer_strcmp(mode, "loose"))
+        return infinity;
+    msg_err("invalid %v value \"%b\"; caching disabled\n", s, mode);
+    return 0;
+}
+
 void p9_create_fs(heap h, void *transport, boolean readonly, filesystem_complete complete)
 {
     p9fs fs = allocate(h, sizeof(*fs));
@@ -727,6 +826,16 @@ void p9_create_fs(heap h, void *transport, boolean readonly, filesystem_complete
         s = timm_up(s, "result", "failed to init fs");
         goto clunk_root;
     }
+    fs->md_dentries = allocate_table(h, identity_key, pointer_equal);
+    if (fs->md_dentries == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate dentry table");
+        goto deinit_fs;
+    }
+    fs->qid_dentries = allocate_table(h, identity_key, pointer_equal);
+    if (fs->qid_dentries == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate dentry table");
+        goto dealloc_md_table;
+    }
     fs->fs.root = fs->root.md = allocate_tuple();
     set(fs->root.md, sym_this(".."), fs->root.md);
     fs->fs.lookup = p9_lookup;
@@ -740,9 +849,15 @@ void p9_create_fs(heap h, void *transport, boolean readonly, filesystem_complete
     fs->fs.get_sync_handler = p9_get_sync_handler;
     list_init(&fs->dentries);
     list_init(&fs->fsfiles);
+    fs->root.validated = 0;
+    fs->cache_timeout = p9_cache_timeout();
     fs->transport = transport;
     apply(complete, &fs->fs, STATUS_OK);
     return;
+  dealloc_md_table:
+    deallocate_table(fs->md_dentries);
+  deinit_fs:
+    filesystem_deinit(&fs->fs);
   clunk_root:
     v9p_clunk(transport, fs->root.fid);
   dealloc_fid_h:
@@ -37,6 +37,38 @@ static inline void report_sha256(buffer b)
 #define report_sha256(b)
 #endif
 
+#ifdef KERNEL
+/* Path lookup cache: the results (including negative ones) of path resolutions that start and end in
+ * the same filesystem are cached in the filesystem, keyed by starting directory and path. Any change
+ * to the namespace of any filesystem (entry creation, deletion, rename, mount) bumps the global
+ * generation number, which invalidates all cached entries. */
+#define FS_DCACHE_ORDER     8
+#define FS_DCACHE_PATH_MAX  110
+
+struct fs_dcache_entry {
+    u64 gen;
+    tuple start;
+    tuple entry;    /* 0 for a negative entry */
+    tuple parent;
+    u8 nofollow;
+    u8 path_len;
+    char path[FS_DCACHE_PATH_MAX];
+};
+
+static u64 fs_dcache_gen = 1;
+
+#define fs_dcache_invalidate()  fetch_and_add(&fs_dcache_gen, 1)
+
+static fs_status filesystem_resolve_cached(filesystem *fs, tuple cwd, sstring path,
+                                           boolean nofollow, tuple *entry, tuple *parent);
+#else
+#define fs_dcache_invalidate()
+
+#define filesystem_resolve_cached(fs, cwd, path, nofollow, entry, parent)                       \
+    ((nofollow) ? filesystem_resolve_sstring(fs, cwd, path, entry, parent) :                    \
+                  filesystem_resolve_sstring_follow(fs, cwd, path, entry, parent))
+#endif
+
 sstring string_from_fs_status(fs_status s)
 {
     switch (s) {
@@ -116,12 +148,12 @@ static inline timestamp filesystem_get_time(filesystem fs, tuple t, symbol s)
 
 timestamp filesystem_get_atime(filesystem fs, tuple t)
 {
-    return filesystem_get_time(fs, t, sym(atime));
+    return filesystem_get_time(fs, t, sym_const(atime));
 }
 
 timestamp filesystem_get_mtime(filesystem fs, tuple t)
 {
-    return filesystem_get_time(fs, t, sym(mtime));
+    return filesystem_get_time(fs, t, sym_const(mtime));
 }
 
 static inline void filesystem_set_time(filesystem fs, tuple t, symbol s,
@@ -144,25 +176,25 @@ static inline void filesystem_set_time(filesystem fs, tuple t, symbol s,
 
 void filesystem_set_atime(filesystem fs, tuple t, timestamp tim)
 {
-    filesystem_set_time(fs, t, sym(atime), tim);
+    filesystem_set_time(fs, t, sym_const(atime), tim);
 }
 
 void filesystem_set_mtime(filesystem fs, tuple t, timestamp tim)
 {
-    filesystem_set_time(fs, t, sym(mtime), tim);
+    filesystem_set_time(fs, t, sym_const(mtime), tim);
 }
 
 u64 filesystem_get_rdev(filesystem fs, tuple t)
 {
     u64 rdev = 0;
-    get_u64(t, sym(rdev), &rdev);
+    get_u64(t, sym_const(rdev), &rdev);
     return rdev;
 }
 
 void filesystem_set_rdev(filesystem fs, tuple t, u64 rdev)
 {
     value rdev_val = value_from_u64(rdev);
-    set(t, sym(rdev), rdev_val);
+    set(t, sym_const(rdev), rdev_val);
 }
 
 /* TODO moving sg up to syscall level means eliminating this extra step */
@@ -225,7 +257,9 @@ void filesystem_read_entire(filesystem fs, tuple t, heap bufheap, buffer_handler
     fs_debug("filesystem_read_entire: t %p, bufheap %p, buffer_handler %p, status_handler %p\n",
              t, bufheap, c, sh);
     fsfile f;
+    filesystem_lock(fs);
     fs_status fss = fs->get_fsfile(fs, t, &f);
+    filesystem_unlock(fs);
     status s;
     if ((fss != FS_STATUS_OK) || !f) {
         s = timm("result", "no such file %v", t);
@@ -388,6 +422,7 @@ static fs_status fs_create_dir_entry(filesystem fs, tuple parent, string name, t
         symbol name_sym = intern(name);
         set(children(parent), name_sym, md);
         set(md, sym_this(".."), parent);
+        fs_dcache_invalidate();
         filesystem_update_mtime(fs, parent);
         fs_notify_create(md, parent, name_sym);
     }
@@ -452,11 +487,7 @@ fs_status filesystem_get_node(filesystem *fs, inode cwd, sstring path, boolean n
         return FS_STATUS_NOENT;
     tuple parent, t;
     fsfile fsf = 0;
-    fs_status fss;
-    if (nofollow)
-        fss = filesystem_resolve_sstring(fs, cwd_t, path, &t, &parent);
-    else
-        fss = filesystem_resolve_sstring_follow(fs, cwd_t, path, &t, &parent);
+    fs_status fss = filesystem_resolve_cached(fs, cwd_t, path, nofollow, &t, &parent);
     if (fss == FS_STATUS_NOENT) {
         if (create) {
             if (!parent)
@@ -592,6 +623,7 @@ fs_status filesystem_delete(filesystem fs, inode cwd, sstring path, boolean dire
     if (fss == FS_STATUS_OK) {
         symbol name_sym = intern(name);
         set(children(parent), name_sym, 0);
+        fs_dcache_invalidate();
         fs_notify_delete(t, parent, name_sym);
         fs_notify_release(t, false);
         file_unlink(t, destruct_md);
@@ -676,6 +708,7 @@ fs_status filesystem_rename(filesystem oldfs, inode oldwd, sstring oldpath,
         set(children(oldparent), old_s, 0);
         set(children(newparent), new_s, old);
         set(old, sym_this(".."), newparent);
+        fs_dcache_invalidate();
         filesystem_update_mtime(oldfs, oldparent);
         if (newparent != oldparent)
             filesystem_update_mtime(oldfs, newparent);
@@ -750,6 +783,7 @@ fs_status filesystem_exchange(filesystem fs1, inode wd1, sstring path1,
         set(n2, sym_this(".."), parent1);
         set(children(parent2), intern(name2), n1);
         set(n1, sym_this(".."), parent2);
+        fs_dcache_invalidate();
         filesystem_update_mtime(fs1, parent1);
         if (parent2 != parent1)
             filesystem_update_mtime(fs1, parent2);
@@ -796,6 +830,9 @@ status filesystem_init(filesystem fs, heap h, u64 size, u64 blocksize, boolean r
     init_refcount(&fs->refcount, 1, init_closure_func(&fs->sync, thunk, fs_sync));
     fs->sync_complete = 0;
     filesystem_lock_init(fs);
+#endif
+#ifdef KERNEL
+    fs->dcache = 0;
 #endif
     fs->ro = ro;
     return STATUS_OK;
@@ -803,6 +840,10 @@ status filesystem_init(filesystem fs, heap h, u64 size, u64 blocksize, boolean r
 
 void filesystem_deinit(filesystem fs)
 {
+#ifdef KERNEL
+    if (fs->dcache)
+        deallocate(fs->h, fs->dcache, sizeof(struct fs_dcache_entry) << FS_DCACHE_ORDER);
+#endif
     pagecache_dealloc_volume(fs->pv);
 }
 
@@ -882,6 +923,94 @@ void fs_set_path_helper(filesystem (*get_root_fs)(), inode (*get_mountpoint)(tup
     fs_path_helper.get_mountpoint = get_mountpoint;
 }
 
+#ifdef KERNEL
+
+/* Can be used by filesystems whose namespace changes only via the functions in this file. */
+boolean filesystem_enable_dcache(filesystem fs)
+{
+    fs->dcache = allocate_zero(fs->h, sizeof(struct fs_dcache_entry) << FS_DCACHE_ORDER);
+    if (fs->dcache == INVALID_ADDRESS) {
+        fs->dcache = 0;
+        return false;
+    }
+    return true;
+}
+
+/* Returns the namespace generation number, which can be used (for filesystems where
+ * filesystem_namespace_tracked() is true) to validate cached results derived from path lookups. */
+u64 filesystem_namespace_gen(void)
+{
+    return fs_dcache_gen;
+}
+
+static u64 fs_dcache_hash(tuple start, sstring path, boolean nofollow)
+{
+    u64 hash = 0xcbf29ce484222325;
+    for (int i = 0; i < path.len; i++) {
+        hash ^= (u8)path.ptr[i];
+        hash *= 1099511628211;
+    }
+    hash ^= u64_from_pointer(start) >> 4;
+    return (hash ^ (hash >> 32) ^ (hash >> FS_DCACHE_ORDER)) + nofollow;
+}
+
+/* Same as filesystem_resolve_sstring() (or filesystem_resolve_sstring_follow() if nofollow is false),
+ * but looks up the path in the lookup cache first. */
+static fs_status filesystem_resolve_cached(filesystem *fs, tuple cwd, sstring path,
+                                           boolean nofollow, tuple *entry, tuple *parent)
+{
+    tuple start = cwd;
+    if (!sstring_is_empty(path) && (path.ptr[0] == '/')) {
+        filesystem root_fs = fs_path_helper.get_root_fs();
+        if (root_fs != *fs) {
+            filesystem_unlock(*fs);
+            *fs = root_fs;
+            filesystem_lock(*fs);
+        }
+        start = filesystem_getroot(root_fs);
+    }
+    filesystem start_fs = *fs;
+    struct fs_dcache_entry *e = 0;
+
+    /* The generation number is read before resolving the path, so that an entry filled with the
+     * results of a resolution that raced with a namespace change is never valid. */
+    u64 gen = fs_dcache_gen;
+    if (start_fs->dcache && (path.len <= FS_DCACHE_PATH_MAX)) {
+        e = start_fs->dcache + (fs_dcache_hash(start, path, nofollow) & MASK(FS_DCACHE_ORDER));
+        if ((e->gen == gen) && (e->start == start) && (e->nofollow == nofollow) &&
+            (e->path_len == path.len) && !runtime_memcmp(e->path, path.ptr, path.len)) {
+            filesystem_reserve(start_fs);
+            if (entry)
+                *entry = e->entry;
+            if (parent)
+                *parent = e->parent;
+            return e->entry ? FS_STATUS_OK : FS_STATUS_NOENT;
+        }
+    }
+    tuple t, p = 0;
+    fs_status fss;
+    if (nofollow)
+        fss = filesystem_resolve_sstring(fs, cwd, path, &t, &p);
+    else
+        fss = filesystem_resolve_sstring_follow(fs, cwd, path, &t, &p);
+    if (e && (*fs == start_fs) && ((fss == FS_STATUS_OK) || (fss == FS_STATUS_NOENT))) {
+        e->gen = gen;
+        e->start = start;
+        e->entry = (fss == FS_STATUS_OK) ? t : 0;
+        e->parent = p;
+        e->nofollow = nofollow;
+        e->path_len = path.len;
+        runtime_memcpy(e->path, path.ptr, path.len);
+    }
+    if (entry && (fss == FS_STATUS_OK))
+        *entry = t;
+    if (parent)
+        *parent = p;
+    return fss;
+}
+
+#endif
+
 /* Requires that a mount point does not change while at least one of its two filesystems (parent and
  * child) is locked. */
 static tuple lookup_follow(filesystem *fs, tuple t, string a, tuple *p)
@@ -1191,6 +1320,7 @@ fs_status filesystem_mount(filesystem parent, inode mount_dir, filesystem child)
     set(mount, sym(fs), b);
     set(mount, sym(no_encode), null_value); /* non-persistent entry */
     set(mount_dir_t, sym(mount), mount);
+    fs_dcache_invalidate();
     fss = FS_STATUS_OK;
   out:
     filesystem_unlock(parent);
@@ -1204,6 +1334,7 @@ void filesystem_unmount(filesystem parent, inode mount_dir, filesystem child, th
     if (mount_dir_t) {
         tuple mount = get_tuple(mount_dir_t, sym(mount));
         set(mount_dir_t, sym(mount), 0);
+        fs_dcache_invalidate();
         destruct_value(mount, true);
     }
     child->sync_complete = complete;
@@ -72,6 +72,8 @@ void filesystem_alloc(fsfile f, long offset, long len,
         boolean keep_size, fs_status_handler completion);
 void filesystem_dealloc(fsfile f, long offset, long len,
         fs_status_handler completion);
+fs_status filesystem_clone(fsfile in, u64 in_offset, fsfile out, u64 out_offset, u64 len,
+                           fs_status_handler completion);
 fs_status filesystem_truncate(filesystem fs, fsfile f, u64 len);
 fs_status filesystem_truncate_locked(filesystem fs, fsfile f, u64 len);
 
@@ -103,6 +105,7 @@ struct filesystem {
     tuple root;
 #ifdef KERNEL
     struct mutex lock;
+    struct fs_dcache_entry *dcache; /* path lookup cache, protected by the filesystem lock */
 #endif
     struct refcount refcount;
     closure_struct(thunk, sync);
@@ -147,6 +150,12 @@ static inline u64 sector_from_offset(filesystem fs, bytes b)
 #define filesystem_lock(fs)         mutex_lock(&(fs)->lock)
 #define filesystem_unlock(fs)       mutex_unlock(&(fs)->lock)
 
+boolean filesystem_enable_dcache(filesystem fs);
+u64 filesystem_namespace_gen(void);
+
+/* true if every change to the namespace of the filesystem bumps the namespace generation number */
+#define filesystem_namespace_tracked(fs)    ((fs)->dcache != 0)
+
 #else
 
 #define filesystem_lock_init(fs)
@@ -0,0 +1,1434 @@
+#include <kernel.h>
+#include <pagecache.h>
+#include <fs.h>
+#include <fuse.h>
+#include <unix/system_structs.h>
+#include <virtio/virtio_fs.h>
+
+//#define FUSE_DEBUG
+#ifdef FUSE_DEBUG
+#define fuse_debug(x, ...) do {tprintf(sym(fuse), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define fuse_debug(x, ...)
+#endif
+
+#define FUSE_IO_SEGS_MAX        32  /* maximum number of sg buffers in a read/write request */
+#define FUSE_DIR_BUF_SIZE       (64 * KB)
+#define FUSE_TIMEOUT_MAX_SECS   U32_MAX /* longer timeouts do not expire */
+
+/* The DAX window is divided in fixed-size chunks, each of which maps a file range. */
+#define FUSE_DAX_CHUNK_ORDER    21
+#define FUSE_DAX_CHUNK_SIZE     U64_FROM_BIT(FUSE_DAX_CHUNK_ORDER)
+
+typedef struct fuse_node {
+    u64 nodeid;             /* 0 if the node has not been looked up (i.e. it comes from readdir) */
+    u64 nlookup;            /* lookup count to be released with a FORGET request */
+    u64 ino;
+    tuple md;
+    timestamp entry_expiry; /* lookups can be served from the metadata tree until this time */
+    timestamp dir_expiry;   /* directory contents are valid until this time */
+    struct fuse_fsfile *fsf;
+} *fuse_node;
+
+typedef struct fuse_dax_chunk {
+    struct list l;              /* LRU list */
+    struct fuse_fsfile *fsf;    /* file whose contents are mapped in the chunk */
+    u64 nodeid;
+    u64 index;                  /* file chunk index */
+    u32 users;                  /* in-progress I/O operations */
+    enum {
+        FUSE_DAX_FREE,
+        FUSE_DAX_PENDING,       /* SETUPMAPPING request in progress */
+        FUSE_DAX_MAPPED,
+        FUSE_DAX_REMOVING,      /* REMOVEMAPPING request in progress */
+    } state;
+} *fuse_dax_chunk;
+
+typedef struct fusefs {
+    struct filesystem fs;
+    void *transport;
+    word unique;
+    struct fuse_node root;
+    table md_nodes;     /* metadata tuple -> node */
+    table ino_nodes;    /* inode number -> node */
+    struct list fsfiles;
+    u32 max_read;
+    u32 max_write;
+    struct {
+        void *window;   /* 0 if DAX is not available */
+        fuse_dax_chunk chunks;
+        u64 nchunks;
+        struct list lru;
+        struct spinlock lock;
+    } dax;
+} *fusefs;
+
+declare_closure_struct(1, 3, void, fuse_fsf_io,
+                       boolean, write,
+                       sg_list sg, range q, status_handler complete);
+typedef struct fuse_fsfile {
+    struct fsfile f;
+    struct list l;
+    fuse_node node;
+    u64 fh;
+    u64 blocks;
+    table dax_chunks;   /* file chunk index + 1 -> DAX chunk (protected by the DAX lock) */
+    closure_struct(fuse_fsf_io, read);
+    closure_struct(fuse_fsf_io, write);
+    closure_struct(pagecache_node_reserve, reserve);
+    closure_struct(thunk, free);
+} *fuse_fsfile;
+
+typedef struct fuse_req {
+    void *buf;
+    u32 size;
+    void *reply;
+    u32 reply_len;
+} *fuse_req;
+
+closure_type(fuse_reply_handler, void, fs_status s, void *reply, u32 reply_len);
+
+static fs_status fuse_errno_to_fs_status(s32 error)
+{
+    switch (-error) {
+    case ENOENT:
+        return FS_STATUS_NOENT;
+    case EEXIST:
+        return FS_STATUS_EXIST;
+    case ENOTDIR:
+        return FS_STATUS_NOTDIR;
+    case EISDIR:
+        return FS_STATUS_ISDIR;
+    case ENOTEMPTY:
+        return FS_STATUS_NOTEMPTY;
+    case ENOSPC:
+        return FS_STATUS_NOSPACE;
+    case ENOMEM:
+        return FS_STATUS_NOMEM;
+    case ENAMETOOLONG:
+        return FS_STATUS_NAMETOOLONG;
+    case ELOOP:
+        return FS_STATUS_LINKLOOP;
+    case EXDEV:
+        return FS_STATUS_XDEV;
+    case EROFS:
+        return FS_STATUS_READONLY;
+    case EIO:
+        return FS_STATUS_IOERR;
+    default:
+        return FS_STATUS_INVAL;
+    }
+}
+
+static timestamp fuse_expiry(u64 sec, u32 nsec)
+{
+    if (sec >= FUSE_TIMEOUT_MAX_SECS)
+        return infinity;
+    return now(CLOCK_ID_MONOTONIC_RAW) + seconds(sec) + nanoseconds(nsec);
+}
+
+static boolean fuse_is_valid(timestamp expiry)
+{
+    return (now(CLOCK_ID_MONOTONIC_RAW) < expiry);
+}
+
+static void fuse_fill_hdr(fusefs fs, struct fuse_in_header *hdr, u32 len, u32 opcode, u64 nodeid)
+{
+    zero(hdr, sizeof(*hdr));
+    hdr->len = len;
+    hdr->opcode = opcode;
+    hdr->unique = fetch_and_add(&fs->unique, 1);
+    hdr->nodeid = nodeid;
+}
+
+static u8 *fuse_put_name(u8 *p, string name)
+{
+    u32 len = buffer_length(name);
+    buffer_read_at(name, 0, p, len);
+    p[len] = '\0';
+    return p + len + 1;
+}
+
+static void fuse_req_done(fusefs fs, fuse_req r)
+{
+    vtfs_put_iobuf(fs->transport, r->buf, r->size);
+}
+
+/* Sends a request made of an argument structure followed by up to two names, and waits for the
+ * reply (up to reply_len bytes long), which on success must be released with fuse_req_done(). */
+static fs_status fuse_request(fusefs fs, fuse_req r, u32 opcode, u64 nodeid,
+                              const void *arg, u32 arg_len, string name, string name2,
+                              u32 reply_len)
+{
+    u32 in_len = sizeof(struct fuse_in_header) + arg_len;
+    if (name)
+        in_len += buffer_length(name) + 1;
+    if (name2)
+        in_len += buffer_length(name2) + 1;
+    u32 out_offset = pad(in_len, sizeof(u64));
+    u32 out_len = sizeof(struct fuse_out_header) + reply_len;
+    r->size = out_offset + out_len;
+    r->buf = vtfs_get_iobuf(fs->transport, r->size);
+    if (r->buf == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    struct fuse_in_header *hdr = r->buf;
+    fuse_fill_hdr(fs, hdr, in_len, opcode, nodeid);
+    u8 *p = (u8 *)(hdr + 1);
+    runtime_memcpy(p, arg, arg_len);
+    p += arg_len;
+    if (name)
+        p = fuse_put_name(p, name);
+    if (name2)
+        fuse_put_name(p, name2);
+    struct fuse_out_header *out = r->buf + out_offset;
+    u32 ret_len = vtfs_request(fs->transport, hdr, in_len, out, out_len);
+    fs_status s;
+    if ((ret_len < sizeof(*out)) || (out->len < sizeof(*out)))
+        s = FS_STATUS_IOERR;
+    else if (out->error)
+        s = fuse_errno_to_fs_status(out->error);
+    else
+        s = FS_STATUS_OK;
+    if (s == FS_STATUS_OK) {
+        r->reply = out + 1;
+        r->reply_len = MIN(ret_len, out->len) - sizeof(*out);
+    } else {
+        fuse_req_done(fs, r);
+    }
+    return s;
+}
+
+/* Sends a request and copies its reply (if any) to the supplied buffer. */
+static fs_status fuse_call(fusefs fs, u32 opcode, u64 nodeid, const void *arg, u32 arg_len,
+                           string name, string name2, void *reply, u32 reply_len)
+{
+    struct fuse_req r;
+    fs_status s = fuse_request(fs, &r, opcode, nodeid, arg, arg_len, name, name2, reply_len);
+    if (s != FS_STATUS_OK)
+        return s;
+    if (r.reply_len < reply_len)
+        s = FS_STATUS_IOERR;
+    else
+        runtime_memcpy(reply, r.reply, reply_len);
+    fuse_req_done(fs, &r);
+    return s;
+}
+
+closure_function(5, 1, void, fuse_async_complete,
+                 fusefs, fs, void *, buf, u32, size, struct fuse_out_header *, out, fuse_reply_handler, rh,
+                 status s)
+{
+    fusefs fs = bound(fs);
+    struct fuse_out_header *out = bound(out);
+    fuse_reply_handler rh = bound(rh);
+    fs_status fss;
+    if (!is_ok(s)) {
+        fuse_debug("async request failed: %v\n", s);
+        timm_dealloc(s);
+        fss = FS_STATUS_IOERR;
+    } else if (out->len < sizeof(*out)) {
+        fss = FS_STATUS_IOERR;
+    } else if (out->error) {
+        fss = fuse_errno_to_fs_status(out->error);
+    } else {
+        fss = FS_STATUS_OK;
+    }
+    if (rh)
+        apply(rh, fss, out + 1, (fss == FS_STATUS_OK) ? out->len - sizeof(*out) : 0);
+    vtfs_put_iobuf(fs->transport, bound(buf), bound(size));
+    closure_finish();
+}
+
+/* Sends a request without waiting for its reply, which is passed to the reply handler (if any).
+ * The request data payload (if sg_len is non-zero) is taken from (or, if sg_write is true, the
+ * reply data payload is written to) the sg list. */
+static void fuse_request_async(fusefs fs, u32 opcode, u64 nodeid, const void *arg, u32 arg_len,
+                               u32 reply_len, sg_list sg, u32 sg_len, boolean sg_write,
+                               fuse_reply_handler rh)
+{
+    u32 in_len = sizeof(struct fuse_in_header) + arg_len;
+    u32 out_offset = pad(in_len, sizeof(u64));
+    u32 out_len = sizeof(struct fuse_out_header) + reply_len;
+    u32 size = out_offset + out_len;
+    void *buf = vtfs_get_iobuf(fs->transport, size);
+    if (buf == INVALID_ADDRESS)
+        goto error;
+    struct fuse_out_header *out = buf + out_offset;
+    status_handler sh = closure(fs->fs.h, fuse_async_complete, fs, buf, size, out, rh);
+    if (sh == INVALID_ADDRESS) {
+        vtfs_put_iobuf(fs->transport, buf, size);
+        goto error;
+    }
+    fuse_fill_hdr(fs, buf, in_len + (sg_write ? 0 : sg_len), opcode, nodeid);
+    runtime_memcpy(buf + sizeof(struct fuse_in_header), arg, arg_len);
+    zero(out, sizeof(*out));
+    vtfs_request_async(fs->transport, buf, in_len, out, out_len, sg, sg_len, sg_write, sh);
+    return;
+  error:
+    if (rh)
+        apply(rh, FS_STATUS_NOMEM, 0, 0);
+}
+
+closure_function(3, 1, void, fuse_forget_complete,
+                 fusefs, fs, void *, buf, u32, size,
+                 status s)
+{
+    if (!is_ok(s))
+        timm_dealloc(s);
+    vtfs_put_iobuf(bound(fs)->transport, bound(buf), bound(size));
+    closure_finish();
+}
+
+static void fuse_forget(fusefs fs, u64 nodeid, u64 nlookup)
+{
+    fuse_debug("forget node %ld, nlookup %ld\n", nodeid, nlookup);
+    u32 len = sizeof(struct fuse_in_header) + sizeof(struct fuse_forget_in);
+    struct fuse_in_header *hdr = vtfs_get_iobuf(fs->transport, len);
+    if (hdr == INVALID_ADDRESS)
+        return;
+    status_handler sh = closure(fs->fs.h, fuse_forget_complete, fs, hdr, len);
+    if (sh == INVALID_ADDRESS) {
+        vtfs_put_iobuf(fs->transport, hdr, len);
+        return;
+    }
+    fuse_fill_hdr(fs, hdr, len, FUSE_FORGET, nodeid);
+    ((struct fuse_forget_in *)(hdr + 1))->nlookup = nlookup;
+    vtfs_request_hiprio(fs->transport, hdr, len, sh);
+}
+
+static void fuse_md_cleanup(tuple md)
+{
+    symbol parent_sym = sym_this("..");
+    tuple parent = get_tuple(md, parent_sym);
+    if (parent) {
+        tuple c = children(parent);
+        if (c) {
+            symbol name = tuple_get_symbol(c, md);
+            if (name)
+                set(c, name, 0);
+        }
+        set(md, parent_sym, 0);
+    }
+    destruct_value(md, true);
+}
+
+static void fuse_node_set_md(fusefs fs, fuse_node n, tuple md)
+{
+    if (n->md && (table_find(fs->md_nodes, n->md) == n))
+        table_set(fs->md_nodes, n->md, 0);
+    n->md = md;
+    if (md)
+        table_set(fs->md_nodes, md, n);
+}
+
+/* With hard links, multiple nodes may have the same inode number: the table references the most
+ * recent one. */
+static void fuse_node_set_ino(fusefs fs, fuse_node n, u64 ino)
+{
+    if (n->ino && (table_find(fs->ino_nodes, pointer_from_u64(n->ino)) == n))
+        table_set(fs->ino_nodes, pointer_from_u64(n->ino), 0);
+    n->ino = ino;
+    if (ino)
+        table_set(fs->ino_nodes, pointer_from_u64(ino), n);
+}
+
+static fuse_node fuse_node_new(fusefs fs, u64 nodeid, u64 ino, tuple md)
+{
+    fuse_node n = allocate(fs->fs.h, sizeof(*n));
+    if (n == INVALID_ADDRESS)
+        return 0;
+    n->nodeid = nodeid;
+    n->nlookup = nodeid ? 1 : 0;
+    n->ino = 0;
+    n->md = 0;
+    n->entry_expiry = n->dir_expiry = 0;
+    n->fsf = 0;
+    fuse_node_set_md(fs, n, md);
+    fuse_node_set_ino(fs, n, ino);
+    return n;
+}
+
+static void fuse_node_delete(fusefs fs, fuse_node n)
+{
+    tuple md = n->md;
+    fuse_node_set_md(fs, n, 0);
+    fuse_node_set_ino(fs, n, 0);
+    if (n->nlookup)
+        fuse_forget(fs, n->nodeid, n->nlookup);
+    if (md)
+        fuse_md_cleanup(md);
+    deallocate(fs->fs.h, n, sizeof(*n));
+}
+
+/* Called when the directory entry of a node has been removed: nodes in use by an open file are
+ * deleted when the file is released. */
+static void fuse_node_unlink(fusefs fs, fuse_node n)
+{
+    fuse_node_set_md(fs, n, 0);
+    fuse_node_set_ino(fs, n, 0);
+    if (!n->fsf)
+        fuse_node_delete(fs, n);
+}
+
+#define FUSE_GET_NODE_FROM(type, name)                              \
+    static fuse_node fuse_get_node_from_##name(fusefs fs, type name)\
+    {                                                               \
+        if (name == fs->root.name)                                  \
+            return &fs->root;                                       \
+        return table_find(fs->name##_nodes, pointer_from_u64(name));\
+    }
+
+FUSE_GET_NODE_FROM(tuple, md)
+FUSE_GET_NODE_FROM(inode, ino)
+
+static void fuse_set_md_type(tuple md, u32 mode)
+{
+    symbol attr;
+    switch (mode & S_IFMT) {
+    case S_IFDIR:
+        attr = sym(children);
+        if (!get(md, attr))
+            set(md, attr, allocate_tuple());
+        break;
+    case S_IFLNK:
+        attr = sym(linktarget);
+        if (!get(md, attr))
+            set(md, attr, null_value);
+        break;
+    case S_IFSOCK:
+        attr = sym(socket);
+        if (!get(md, attr))
+            set(md, attr, null_value);
+        break;
+    }
+}
+
+static void fuse_set_times(filesystem fs, tuple md, struct fuse_attr *attr)
+{
+    filesystem_set_atime(fs, md, seconds(attr->atime) + nanoseconds(attr->atimensec));
+    filesystem_set_mtime(fs, md, seconds(attr->mtime) + nanoseconds(attr->mtimensec));
+}
+
+/* DAX window management */
+
+static void fuse_dax_init(fusefs fs, u16 map_alignment)
+{
+    u64 size;
+    void *window = vtfs_get_dax_window(fs->transport, &size);
+    fs->dax.window = 0;
+    if (!window || (map_alignment > FUSE_DAX_CHUNK_ORDER))
+        return;
+    u64 nchunks = size >> FUSE_DAX_CHUNK_ORDER;
+    if (!nchunks)
+        return;
+    fs->dax.chunks = allocate(fs->fs.h, nchunks * sizeof(struct fuse_dax_chunk));
+    if (fs->dax.chunks == INVALID_ADDRESS)
+        return;
+    list_init(&fs->dax.lru);
+    for (u64 i = 0; i < nchunks; i++) {
+        fuse_dax_chunk c = &fs->dax.chunks[i];
+        c->fsf = 0;
+        c->users = 0;
+        c->state = FUSE_DAX_FREE;
+        list_push_back(&fs->dax.lru, &c->l);
+    }
+    spin_lock_init(&fs->dax.lock);
+    fs->dax.nchunks = nchunks;
+    fs->dax.window = window;
+    fuse_debug("DAX window %p, %ld chunks\n", window, nchunks);
+}
+
+#define fuse_dax_chunk_key(index)   pointer_from_u64((index) + 1)
+#define fuse_dax_moffset(fs, c)     ((u64)((c) - (fs)->dax.chunks) << FUSE_DAX_CHUNK_ORDER)
+
+closure_function(2, 3, void, fuse_dax_remove_complete,
+                 fusefs, fs, fuse_dax_chunk, c,
+                 fs_status s, void *reply, u32 reply_len)
+{
+    fusefs fs = bound(fs);
+    spin_lock(&fs->dax.lock);
+    bound(c)->state = FUSE_DAX_FREE;
+    spin_unlock(&fs->dax.lock);
+    closure_finish();
+}
+
+static void fuse_dax_remove_mapping(fusefs fs, fuse_dax_chunk c)
+{
+    struct {
+        struct fuse_removemapping_in in;
+        struct fuse_removemapping_one one;
+    } __attribute__((packed)) arg = {
+        .in.count = 1,
+        .one.moffset = fuse_dax_moffset(fs, c),
+        .one.len = FUSE_DAX_CHUNK_SIZE,
+    };
+    fuse_reply_handler rh = closure(fs->fs.h, fuse_dax_remove_complete, fs, c);
+    if (rh == INVALID_ADDRESS) {
+        /* leave the chunk in the REMOVING state, so that it is not reused */
+        return;
+    }
+    fuse_request_async(fs, FUSE_REMOVEMAPPING, c->nodeid, &arg, sizeof(arg), 0, 0, 0, false, rh);
+}
+
+closure_function(2, 3, void, fuse_dax_map_complete,
+                 fusefs, fs, fuse_dax_chunk, c,
+                 fs_status s, void *reply, u32 reply_len)
+{
+    fusefs fs = bound(fs);
+    fuse_dax_chunk c = bound(c);
+    fuse_debug("DAX chunk %ld mapped, status %d\n", c - fs->dax.chunks, s);
+    spin_lock(&fs->dax.lock);
+    if (!c->fsf) {
+        /* the file has been released while the mapping was being set up */
+        c->state = (s == FS_STATUS_OK) ? FUSE_DAX_REMOVING : FUSE_DAX_FREE;
+    } else if (s == FS_STATUS_OK) {
+        c->state = FUSE_DAX_MAPPED;
+    } else {
+        table_set(c->fsf->dax_chunks, fuse_dax_chunk_key(c->index), 0);
+        c->fsf = 0;
+        c->state = FUSE_DAX_FREE;
+    }
+    boolean remove = (c->state == FUSE_DAX_REMOVING);
+    spin_unlock(&fs->dax.lock);
+    if (s == FS_STATUS_INVAL) {
+        /* the server does not support DAX mappings */
+        msg_err("failed to set up DAX mapping; disabling DAX\n");
+        fs->dax.window = 0;
+    }
+    if (remove)
+        fuse_dax_remove_mapping(fs, c);
+    closure_finish();
+}
+
+static void fuse_dax_setup_mapping(fusefs fs, fuse_fsfile fsf, fuse_dax_chunk c)
+{
+    struct fuse_setupmapping_in arg = {
+        .fh = fsf->fh,
+        .foffset = c->index << FUSE_DAX_CHUNK_ORDER,
+        .len = FUSE_DAX_CHUNK_SIZE,
+        .flags = FUSE_SETUPMAPPING_FLAG_READ | (fs->fs.ro ? 0 : FUSE_SETUPMAPPING_FLAG_WRITE),
+        .moffset = fuse_dax_moffset(fs, c),
+    };
+    fuse_reply_handler rh = closure(fs->fs.h, fuse_dax_map_complete, fs, c);
+    if (rh == INVALID_ADDRESS) {
+        spin_lock(&fs->dax.lock);
+        table_set(fsf->dax_chunks, fuse_dax_chunk_key(c->index), 0);
+        c->fsf = 0;
+        c->state = FUSE_DAX_FREE;
+        spin_unlock(&fs->dax.lock);
+        return;
+    }
+    fuse_request_async(fs, FUSE_SETUPMAPPING, c->nodeid, &arg, sizeof(arg), 0, 0, 0, false, rh);
+}
+
+/* Returns the DAX chunk where a file chunk is mapped, or 0 if the file chunk is not mapped (in
+ * which case a mapping is set up, if possible, for future accesses). */
+static fuse_dax_chunk fuse_dax_get_chunk(fusefs fs, fuse_fsfile fsf, u64 index)
+{
+    fuse_dax_chunk c = 0;
+    boolean map = false;
+    spin_lock(&fs->dax.lock);
+    if (!fsf->dax_chunks) {
+        fsf->dax_chunks = allocate_table(fs->fs.h, identity_key, pointer_equal);
+        if (fsf->dax_chunks == INVALID_ADDRESS) {
+            fsf->dax_chunks = 0;
+            goto out;
+        }
+    }
+    c = table_find(fsf->dax_chunks, fuse_dax_chunk_key(index));
+    if (c) {
+        if (c->state == FUSE_DAX_MAPPED) {
+            c->users++;
+            list_delete(&c->l);
+            list_push_back(&fs->dax.lru, &c->l);
+        } else {
+            c = 0;
+        }
+        goto out;
+    }
+
+    /* reuse the least recently used chunk that is not being accessed */
+    list_foreach(&fs->dax.lru, e) {
+        fuse_dax_chunk lru = struct_from_list(e, fuse_dax_chunk, l);
+        if ((lru->state == FUSE_DAX_FREE) || ((lru->state == FUSE_DAX_MAPPED) && !lru->users)) {
+            c = lru;
+            break;
+        }
+    }
+    if (c) {
+        if (c->fsf)
+            table_set(c->fsf->dax_chunks, fuse_dax_chunk_key(c->index), 0);
+        c->fsf = fsf;
+        c->nodeid = fsf->node->nodeid;
+        c->index = index;
+        c->state = FUSE_DAX_PENDING;
+        table_set(fsf->dax_chunks, fuse_dax_chunk_key(index), c);
+        list_delete(&c->l);
+        list_push_back(&fs->dax.lru, &c->l);
+        map = true;
+    }
+  out:
+    spin_unlock(&fs->dax.lock);
+    if (map) {
+        fuse_dax_setup_mapping(fs, fsf, c);
+        c = 0;
+    }
+    return c;
+}
+
+static void fuse_dax_put_chunk(fusefs fs, fuse_dax_chunk c)
+{
+    spin_lock(&fs->dax.lock);
+    c->users--;
+    spin_unlock(&fs->dax.lock);
+}
+
+closure_function(2, 2, boolean, fuse_dax_release_each,
+                 fusefs, fs, vector, remove,
+                 value k, value v)
+{
+    fuse_dax_chunk c = v;
+    c->fsf = 0;
+    if (c->state == FUSE_DAX_MAPPED) {
+        c->state = FUSE_DAX_REMOVING;
+        vector_push(bound(remove), c);
+    }
+    return true;
+}
+
+/* Releases the DAX chunks of a file. */
+static void fuse_dax_release(fusefs fs, fuse_fsfile fsf)
+{
+    if (!fsf->dax_chunks)
+        return;
+    vector remove = allocate_vector(fs->fs.h, 8);
+    if (remove == INVALID_ADDRESS)
+        remove = 0;
+    spin_lock(&fs->dax.lock);
+    if (remove) {
+        iterate(fsf->dax_chunks, stack_closure(fuse_dax_release_each, fs, remove));
+    } else {
+        /* mappings are left in place and overwritten when the chunks are reused */
+        table_foreach(fsf->dax_chunks, k, v) {
+            (void)k;
+            fuse_dax_chunk c = v;
+            c->fsf = 0;
+            if (c->state == FUSE_DAX_MAPPED)
+                c->state = FUSE_DAX_FREE;
+        }
+    }
+    spin_unlock(&fs->dax.lock);
+    deallocate_table(fsf->dax_chunks);
+    fsf->dax_chunks = 0;
+    if (remove) {
+        fuse_dax_chunk c;
+        vector_foreach(remove, c)
+            fuse_dax_remove_mapping(fs, c);
+        deallocate_vector(remove);
+    }
+}
+
+/* Transfers data between the DAX window and an sg list; returns the number of bytes transferred,
+ * or 0 if the file range is not mapped in the DAX window. */
+static u64 fuse_dax_io(fusefs fs, fuse_fsfile fsf, boolean write, sg_list sg, u64 offset,
+                       u64 len)
+{
+    if (!fs->dax.window)
+        return 0;
+    u64 file_len = fsfile_get_length(&fsf->f);
+    if (offset >= file_len) {
+        /* accessing the window beyond the end of the file would fault in the host */
+        if (write)
+            return 0;
+        return sg_zero_fill(sg, len);
+    }
+    u64 index = offset >> FUSE_DAX_CHUNK_ORDER;
+    u64 chunk_offset = offset & (FUSE_DAX_CHUNK_SIZE - 1);
+    u64 count = MIN(len, FUSE_DAX_CHUNK_SIZE - chunk_offset);
+    fuse_dax_chunk c = fuse_dax_get_chunk(fs, fsf, index);
+    if (!c)
+        return 0;
+    void *p = fs->dax.window + fuse_dax_moffset(fs, c) + chunk_offset;
+    u64 data_len = MIN(count, file_len - offset);
+    if (write) {
+        count = sg_copy_to_buf(p, sg, data_len);
+    } else {
+        count = sg_copy_from_buf(p, sg, data_len);
+        if (count == data_len)
+            count += sg_zero_fill(sg, MIN(len, FUSE_DAX_CHUNK_SIZE - chunk_offset) - data_len);
+    }
+    fuse_dax_put_chunk(fs, c);
+    return count;
+}
+
+/* File I/O */
+
+closure_function(3, 3, void, fuse_io_complete,
+                 boolean, write, u32, count, status_handler, complete,
+                 fs_status fss, void *reply, u32 reply_len)
+{
+    boolean write = bound(write);
+    u32 count = bound(count);
+    status st;
+    if (fss != FS_STATUS_OK) {
+        st = timm("result", "failed to %s %d bytes (%s)", write ? ss("write") : ss("read"), count,
+                  string_from_fs_status(fss));
+        st = timm_append(st, "fsstatus", "%d", fss);
+    } else if (write) {
+        struct fuse_write_out *wo = reply;
+        if ((reply_len >= sizeof(*wo)) && (wo->size == count))
+            st = STATUS_OK;
+        else
+            st = timm("result", "failed to write %d bytes, written %d", count,
+                      (reply_len >= sizeof(*wo)) ? wo->size : 0);
+    } else {
+        if (reply_len == count)
+            st = STATUS_OK;
+        else
+            st = timm("result", "failed to read %d bytes, read %d", count, reply_len);
+    }
+    apply(bound(complete), st);
+    closure_finish();
+}
+
+/* Issues a READ or WRITE request for (part of) a file range; returns the number of bytes of the
+ * request. */
+static u32 fuse_io_request(fusefs fs, fuse_fsfile fsf, boolean write, sg_list sg, u64 offset,
+                           u64 len, status_handler complete)
+{
+    /* transfer as many sg buffers as allowed by the maximum I/O size in a single request */
+    u32 max = MIN(write ? fs->max_write : fs->max_read, len);
+    if (fs->dax.window)
+        /* do not cross a DAX chunk boundary, so that the next chunk can go through the window */
+        max = MIN(max, FUSE_DAX_CHUNK_SIZE - (offset & (FUSE_DAX_CHUNK_SIZE - 1)));
+    u32 count = 0;
+    for (u64 i = 0; (i < FUSE_IO_SEGS_MAX) && (count < max); i++) {
+        sg_buf sgb = sg_list_peek_at(sg, i);
+        if (sgb == INVALID_ADDRESS)
+            break;
+        count += MIN(sg_buf_len(sgb), max - count);
+    }
+    fuse_reply_handler rh = closure(fs->fs.h, fuse_io_complete, write, count, complete);
+    if (rh == INVALID_ADDRESS) {
+        apply(complete, timm("result", "failed to allocate I/O completion"));
+    } else if (write) {
+        struct fuse_write_in arg = {
+            .fh = fsf->fh,
+            .offset = offset,
+            .size = count,
+        };
+        fuse_request_async(fs, FUSE_WRITE, fsf->node->nodeid, &arg, sizeof(arg),
+                           sizeof(struct fuse_write_out), sg, count, false, rh);
+    } else {
+        struct fuse_read_in arg = {
+            .fh = fsf->fh,
+            .offset = offset,
+            .size = count,
+        };
+        fuse_request_async(fs, FUSE_READ, fsf->node->nodeid, &arg, sizeof(arg), 0, sg, count,
+                           true, rh);
+    }
+    sg_consume(sg, count);
+    return count;
+}
+
+define_closure_function(1, 3, void, fuse_fsf_io,
+                        boolean, write,
+                        sg_list sg, range q, status_handler complete)
+{
+    boolean write = bound(write);
+    fuse_fsfile fsf;
+    if (write)
+        fsf = struct_from_field(closure_self(), fuse_fsfile, write);
+    else
+        fsf = struct_from_field(closure_self(), fuse_fsfile, read);
+    fuse_debug("%s file %p, sg %p, r %R, sh %F\n", write ? ss("write") : ss("read"), fsf, sg, q,
+               complete);
+    fusefs fs = (fusefs)fsf->f.fs;
+    merge m = allocate_merge(fs->fs.h, complete);
+    complete = apply_merge(m);
+    u64 len = range_span(q);
+    u64 offset = q.start;
+    while (len > 0) {
+        u64 count = fuse_dax_io(fs, fsf, write, sg, offset, len);
+        if (!count)
+            count = fuse_io_request(fs, fsf, write, sg, offset, len, apply_merge(m));
+        offset += count;
+        len -= count;
+    }
+    apply(complete, STATUS_OK);
+}
+
+static fs_status fuse_setattr_size(fusefs fs, fuse_fsfile fsf, u64 size)
+{
+    struct fuse_setattr_in arg = {
+        .valid = FATTR_SIZE | FATTR_FH,
+        .fh = fsf->fh,
+        .size = size,
+    };
+    struct fuse_attr_out attr;
+    return fuse_call(fs, FUSE_SETATTR, fsf->node->nodeid, &arg, sizeof(arg), 0, 0, &attr,
+                     sizeof(attr));
+}
+
+closure_func_basic(pagecache_node_reserve, status, fuse_fsf_reserve,
+                   range q)
+{
+    fuse_fsfile fsf = struct_from_field(closure_self(), fuse_fsfile, reserve);
+    fuse_debug("reserve file %p range %R\n", fsf, q);
+    fsfile f = &fsf->f;
+    fs_status s;
+    if (f->length >= q.end) {
+        s = FS_STATUS_OK;
+    } else {
+        s = fuse_setattr_size((fusefs)f->fs, fsf, q.end);
+        if (s == FS_STATUS_OK)
+            f->length = q.end;
+    }
+    return (s == FS_STATUS_OK) ? STATUS_OK : timm("result", "setattr failed (%d)", s);
+}
+
+static s64 fuse_get_blocks(fsfile f)
+{
+    return ((fuse_fsfile)f)->blocks;
+}
+
+static void fuse_fsfile_delete(fusefs fs, fuse_fsfile fsf)
+{
+    if (list_inserted(&fsf->l))
+        list_delete(&fsf->l);
+    if (fsf->node->fsf == fsf)
+        fsf->node->fsf = 0;
+    pagecache_deallocate_node(fsf->f.cache_node);
+    deallocate(fs->fs.h, fsf, sizeof(*fsf));
+}
+
+closure_func_basic(status_handler, void, fuse_fsf_sync_complete,
+                   status s)
+{
+    if (!is_ok(s)) {
+        msg_err("failed to sync page cache node: %v\n", s);
+        timm_dealloc(s);
+    }
+    fsfile f = struct_from_closure(fsfile, sync_complete);
+    fuse_fsfile fsf = (fuse_fsfile)f;
+    fusefs fs = (fusefs)f->fs;
+    fuse_node n = fsf->node;
+    fuse_dax_release(fs, fsf);
+    struct fuse_release_in arg = {
+        .fh = fsf->fh,
+    };
+    fuse_request_async(fs, FUSE_RELEASE, n->nodeid, &arg, sizeof(arg), 0, 0, 0, false, 0);
+    filesystem_lock(&fs->fs);
+    fuse_fsfile_delete(fs, fsf);
+    if (!n->md && !n->fsf)
+        fuse_node_delete(fs, n);
+    filesystem_unlock(&fs->fs);
+}
+
+closure_func_basic(thunk, void, fuse_fsf_free)
+{
+    fuse_fsfile fsf = struct_from_field(closure_self(), fuse_fsfile, free);
+    fuse_debug("free file %p, node %p\n", fsf, fsf->node);
+    fsfile f = &fsf->f;
+    filesystem fs = f->fs;
+    filesystem_lock(fs);
+    if (f->refcount.c != 0) {
+        /* Someone obtained a reference to this fsfile before we could remove it from the open file
+         * list. */
+        filesystem_unlock(fs);
+        return;
+    }
+    list_delete(&fsf->l);
+    if (fsf->node->fsf == fsf)
+        fsf->node->fsf = 0;
+    filesystem_unlock(fs);
+    pagecache_sync_node(f->cache_node,
+                        init_closure_func(&f->sync_complete, status_handler,
+                                          fuse_fsf_sync_complete));
+}
+
+static fuse_fsfile fuse_fsfile_new(fusefs fs, fuse_node n, u64 fh)
+{
+    heap h = fs->fs.h;
+    fuse_fsfile fsf = allocate(h, sizeof(*fsf));
+    if (fsf == INVALID_ADDRESS)
+        return 0;
+    fsf->node = n;
+    fsf->fh = fh;
+    fsf->blocks = 0;
+    fsf->dax_chunks = 0;
+    fs_status s = fsfile_init(&fs->fs, &fsf->f, n->md,
+                              init_closure(&fsf->read, fuse_fsf_io, false),
+                              init_closure(&fsf->write, fuse_fsf_io, true),
+                              init_closure_func(&fsf->reserve, pagecache_node_reserve,
+                                                fuse_fsf_reserve),
+                              init_closure_func(&fsf->free, thunk, fuse_fsf_free));
+    if (s != FS_STATUS_OK) {
+        deallocate(h, fsf, sizeof(*fsf));
+        return 0;
+    }
+    fsf->f.get_blocks = fuse_get_blocks;
+    list_push_back(&fs->fsfiles, &fsf->l);
+    n->fsf = fsf;
+    return fsf;
+}
+
+closure_function(4, 1, void, fuse_cache_sync_complete,
+                 filesystem, fs, fsfile, f, boolean, datasync, status_handler, completion,
+                 status s)
+{
+    fuse_debug("cache sync complete, status %v\n", s);
+    if (is_ok(s)) {
+        fusefs fs = (fusefs)bound(fs);
+        fuse_fsfile f = (fuse_fsfile)bound(f);
+        struct fuse_fsync_in arg = {
+            .fsync_flags = bound(datasync) ? FUSE_FSYNC_FDATASYNC : 0,
+        };
+        fs_status fss = FS_STATUS_OK;
+        filesystem_lock(&fs->fs);
+        if (f) {
+            arg.fh = f->fh;
+            fss = fuse_call(fs, FUSE_FSYNC, f->node->nodeid, &arg, sizeof(arg), 0, 0, 0, 0);
+        } else {
+            list_foreach(&fs->fsfiles, e) {
+                f = struct_from_list(e, fuse_fsfile, l);
+                arg.fh = f->fh;
+                fss = fuse_call(fs, FUSE_FSYNC, f->node->nodeid, &arg, sizeof(arg), 0, 0, 0, 0);
+                if (fss != FS_STATUS_OK)
+                    break;
+            }
+        }
+        filesystem_unlock(&fs->fs);
+        if (fss != FS_STATUS_OK)
+            s = timm("result", "fsync failed (%d)", fss);
+    }
+    async_apply_status_handler(bound(completion), s);
+    closure_finish();
+}
+
+/* Metadata operations */
+
+closure_function(2, 2, boolean, fuse_dir_cleanup,
+                 fusefs, fs, tuple, other_c,
+                 value k, value v)
+{
+    fusefs fs = bound(fs);
+    tuple other_c = bound(other_c);
+    if (!other_c || !get_tuple(other_c, k)) {
+        fuse_node n = fuse_get_node_from_md(fs, v);
+        if (n) {
+            if (!n->fsf) {
+                fs_notify_release(n->md, false);
+                fuse_node_delete(fs, n);
+            }
+        } else {
+            deallocate_value(v);
+        }
+    }
+    return true;
+}
+
+static fs_status fuse_readdir(fusefs fs, fuse_node n, tuple md)
+{
+    fuse_debug("readdir: node %ld, md %p\n", n->nodeid, md);
+    struct fuse_open_in open_in = {
+        .flags = O_RDONLY,
+    };
+    struct fuse_open_out open_out;
+    fs_status s = fuse_call(fs, FUSE_OPENDIR, n->nodeid, &open_in, sizeof(open_in), 0, 0,
+                            &open_out, sizeof(open_out));
+    if (s != FS_STATUS_OK)
+        return s;
+    tuple old_c = children(md);
+    tuple new_c = allocate_tuple();
+    struct fuse_read_in read_in = {
+        .fh = open_out.fh,
+        .size = FUSE_DIR_BUF_SIZE,
+    };
+    u32 count;
+    do {
+        struct fuse_req r;
+        s = fuse_request(fs, &r, FUSE_READDIR, n->nodeid, &read_in, sizeof(read_in), 0, 0,
+                         FUSE_DIR_BUF_SIZE);
+        if (s != FS_STATUS_OK)
+            break;
+        count = r.reply_len;
+        u32 buf_offset = 0;
+        while (count >= buf_offset + sizeof(struct fuse_dirent)) {
+            struct fuse_dirent *entry = r.reply + buf_offset;
+            if ((entry->namelen > NAME_MAX) ||
+                (buf_offset + FUSE_DIRENT_SIZE(entry) > count)) {
+                s = FS_STATUS_IOERR;
+                break;
+            }
+            sstring name = isstring(entry->name, entry->namelen);
+            if (runtime_strcmp(name, ss(".")) && runtime_strcmp(name, ss(".."))) {
+                symbol name_sym = intern(alloca_wrap_buffer(entry->name, entry->namelen));
+                tuple t = old_c ? get_tuple(old_c, name_sym) : 0;
+                fuse_node child;
+                if (t) {
+                    child = fuse_get_node_from_md(fs, t);
+                } else {
+                    t = allocate_tuple();
+                    child = 0;
+                }
+                fuse_debug("  dir entry '%s', type 0x%x, md %p\n", name, entry->type, t);
+                if (!child) {
+                    child = fuse_node_new(fs, 0, entry->ino, t);
+                    if (!child) {
+                        deallocate_value(t);
+                        s = FS_STATUS_NOMEM;
+                        break;
+                    }
+                }
+                switch (entry->type) {
+                case DT_DIR:
+                    fuse_set_md_type(t, S_IFDIR);
+                    break;
+                case DT_LNK:
+                    fuse_set_md_type(t, S_IFLNK);
+                    break;
+                case DT_SOCK:
+                    fuse_set_md_type(t, S_IFSOCK);
+                    break;
+                }
+                set(new_c, name_sym, t);
+                set(t, sym(..), md);
+            }
+            read_in.offset = entry->off;
+            buf_offset += FUSE_DIRENT_SIZE(entry);
+        }
+        fuse_req_done(fs, &r);
+    } while ((s == FS_STATUS_OK) && (count > 0));
+    struct fuse_release_in release_in = {
+        .fh = open_out.fh,
+    };
+    fuse_request_async(fs, FUSE_RELEASEDIR, n->nodeid, &release_in, sizeof(release_in), 0, 0, 0,
+                       false, 0);
+    if (s == FS_STATUS_OK) {
+        if (old_c) {
+            iterate(old_c, stack_closure(fuse_dir_cleanup, fs, new_c));
+            deallocate_value(old_c);
+        }
+        set(md, sym(children), new_c);
+        n->dir_expiry = n->entry_expiry;
+    } else {
+        iterate(new_c, stack_closure(fuse_dir_cleanup, fs, old_c));
+        deallocate_value(new_c);
+    }
+    return s;
+}
+
+static fs_status fuse_readlink(fusefs fs, fuse_node n, tuple md)
+{
+    struct fuse_req r;
+    fs_status s = fuse_request(fs, &r, FUSE_READLINK, n->nodeid, 0, 0, 0, 0, PATH_MAX);
+    if (s != FS_STATUS_OK)
+        return s;
+    buffer target = allocate_buffer(fs->fs.h, r.reply_len);
+    if (target != INVALID_ADDRESS)
+        assert(buffer_write(target, r.reply, r.reply_len));
+    fuse_req_done(fs, &r);
+    if (target == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    symbol target_sym = sym(linktarget);
+    buffer old_target = get_string(md, target_sym);
+    if (old_target && (old_target != null_value))
+        deallocate_buffer(old_target);
+    set(md, target_sym, target);
+    return FS_STATUS_OK;
+}
+
+static tuple fuse_lookup(filesystem fs, tuple parent, string name)
+{
+    fuse_debug("lookup %p '%b'\n", parent, name);
+    fusefs ffs = (fusefs)fs;
+    fuse_node parent_node = fuse_get_node_from_md(ffs, parent);
+    if (!parent_node || !parent_node->nodeid)
+        return 0;
+    if (!buffer_strcmp(name, ".")) {
+        if (!fuse_is_valid(parent_node->dir_expiry) &&
+            (fuse_readdir(ffs, parent_node, parent) != FS_STATUS_OK))
+            return 0;
+        return parent;
+    }
+    if (!buffer_strcmp(name, ".."))
+        return get_tuple(parent, sym_this(".."));
+
+    /* Serve the lookup from the metadata tree if the server-supplied entry timeout (or, for a
+     * negative lookup, the parent directory contents) has not expired. */
+    symbol name_sym = intern(name);
+    tuple md = lookup(parent, name_sym);
+    fuse_node n = md ? fuse_get_node_from_md(ffs, md) : 0;
+    if (n && n->nodeid && fuse_is_valid(n->entry_expiry) &&
+        (!is_dir(md) || fuse_is_valid(n->dir_expiry)))
+        return md;
+    if (!md && fuse_is_valid(parent_node->dir_expiry))
+        return 0;
+
+    struct fuse_entry_out entry;
+    if ((fuse_call(ffs, FUSE_LOOKUP, parent_node->nodeid, 0, 0, name, 0, &entry,
+                   sizeof(entry)) != FS_STATUS_OK) || !entry.nodeid)
+        return 0;
+    fuse_node found = fuse_get_node_from_ino(ffs, entry.attr.ino);
+    if (found && (found->nodeid != entry.nodeid)) {
+        if (found->nodeid || (found != n))
+            found = 0;
+    }
+    if (!found && n && n->nodeid && (n->nodeid != entry.nodeid)) {
+        /* the directory entry has been replaced on the server */
+        if (n->fsf) {
+            fuse_forget(ffs, entry.nodeid, 1);
+            return md;
+        }
+        fs_notify_release(md, false);
+        fuse_node_delete(ffs, n);
+        md = 0;
+        n = 0;
+    }
+    if (!found && n && !n->nodeid)
+        found = n;
+    if (found) {
+        if (!found->nodeid)
+            found->nodeid = entry.nodeid;
+        found->nlookup++;
+        n = found;
+        md = n->md;
+    } else {
+        md = allocate_tuple();
+        set(md, sym_this(".."), parent);
+        n = fuse_node_new(ffs, entry.nodeid, entry.attr.ino, md);
+        if (!n) {
+            deallocate_value(md);
+            fuse_forget(ffs, entry.nodeid, 1);
+            return 0;
+        }
+        tuple c = children(parent);
+        if (c)
+            set(c, name_sym, md);
+    }
+    n->entry_expiry = fuse_expiry(entry.entry_valid, entry.entry_valid_nsec);
+    fuse_set_md_type(md, entry.attr.mode);
+    fuse_set_times(fs, md, &entry.attr);
+    fs_status s;
+    switch (entry.attr.mode & S_IFMT) {
+    case S_IFDIR:
+        s = fuse_readdir(ffs, n, md);
+        break;
+    case S_IFLNK:
+        s = fuse_readlink(ffs, n, md);
+        break;
+    default:
+        s = FS_STATUS_OK;
+    }
+    return (s == FS_STATUS_OK) ? md : 0;
+}
+
+static fs_status fuse_get_fsfile(filesystem fs, tuple md, fsfile *f)
+{
+    fuse_debug("get fsfile, md %p\n", md);
+    fusefs ffs = (fusefs)fs;
+    fuse_node n = fuse_get_node_from_md(ffs, md);
+    if (!n || !n->nodeid)
+        return FS_STATUS_NOENT;
+    if (n->fsf) {
+        fsfile_reserve(&n->fsf->f);
+        *f = &n->fsf->f;
+        return FS_STATUS_OK;
+    }
+    struct fuse_getattr_in getattr_in = {0};
+    struct fuse_attr_out attr;
+    fs_status s = fuse_call(ffs, FUSE_GETATTR, n->nodeid, &getattr_in, sizeof(getattr_in), 0, 0,
+                            &attr, sizeof(attr));
+    if (s != FS_STATUS_OK)
+        return s;
+    struct fuse_open_in open_in = {
+        .flags = fs->ro ? O_RDONLY : O_RDWR,
+    };
+    struct fuse_open_out open_out;
+    s = fuse_call(ffs, FUSE_OPEN, n->nodeid, &open_in, sizeof(open_in), 0, 0, &open_out,
+                  sizeof(open_out));
+    if ((s != FS_STATUS_OK) && (s != FS_STATUS_NOENT) && !fs->ro) {
+        /* the file may not be writable on the server */
+        open_in.flags = O_RDONLY;
+        s = fuse_call(ffs, FUSE_OPEN, n->nodeid, &open_in, sizeof(open_in), 0, 0, &open_out,
+                      sizeof(open_out));
+    }
+    if (s != FS_STATUS_OK)
+        return s;
+    fuse_fsfile fsf = fuse_fsfile_new(ffs, n, open_out.fh);
+    if (!fsf) {
+        struct fuse_release_in release_in = {
+            .fh = open_out.fh,
+        };
+        fuse_request_async(ffs, FUSE_RELEASE, n->nodeid, &release_in, sizeof(release_in), 0, 0, 0,
+                           false, 0);
+        return FS_STATUS_NOMEM;
+    }
+    fsf->blocks = attr.attr.blocks;
+    fuse_set_times(fs, md, &attr.attr);
+    fsfile_set_length(&fsf->f, attr.attr.size);
+    *f = &fsf->f;
+    return FS_STATUS_OK;
+}
+
+static fs_status fuse_create(filesystem fs, tuple parent, string name, tuple md, fsfile *f)
+{
+    if (!name)
+        return FS_STATUS_INVAL;
+    fuse_debug("create parent %p name '%b' md %p f %p\n", parent, name, md, f);
+    fusefs ffs = (fusefs)fs;
+    fuse_node parent_node = fuse_get_node_from_md(ffs, parent);
+    if (!parent_node || !parent_node->nodeid)
+        return FS_STATUS_NOENT;
+    u64 parent_id = parent_node->nodeid;
+    struct {
+        struct fuse_entry_out entry;
+        struct fuse_open_out open;
+    } out;
+    boolean open = false;
+    fs_status s;
+    if (is_dir(md)) {
+        struct fuse_mkdir_in arg = {
+            .mode = 0777,
+        };
+        s = fuse_call(ffs, FUSE_MKDIR, parent_id, &arg, sizeof(arg), name, 0, &out.entry,
+                      sizeof(out.entry));
+    } else if (is_symlink(md)) {
+        s = fuse_call(ffs, FUSE_SYMLINK, parent_id, 0, 0, name, linktarget(md), &out.entry,
+                      sizeof(out.entry));
+    } else if (is_socket(md) || !f) {
+        struct fuse_mknod_in arg = {
+            .mode = (is_socket(md) ? S_IFSOCK : S_IFREG) | 0644,
+        };
+        s = fuse_call(ffs, FUSE_MKNOD, parent_id, &arg, sizeof(arg), name, 0, &out.entry,
+                      sizeof(out.entry));
+    } else {
+        struct fuse_create_in arg = {
+            .flags = O_RDWR | O_CREAT | O_EXCL,
+            .mode = S_IFREG | 0644,
+        };
+        s = fuse_call(ffs, FUSE_CREATE, parent_id, &arg, sizeof(arg), name, 0, &out,
+                      sizeof(out));
+        open = true;
+    }
+    if (s != FS_STATUS_OK)
+        return s;
+    fuse_node n = fuse_node_new(ffs, out.entry.nodeid, out.entry.attr.ino, md);
+    if (!n) {
+        s = FS_STATUS_NOMEM;
+        goto release;
+    }
+    n->entry_expiry = fuse_expiry(out.entry.entry_valid, out.entry.entry_valid_nsec);
+    if (is_dir(md))
+        n->dir_expiry = n->entry_expiry;    /* new directories are empty */
+    if (open) {
+        fuse_fsfile fsf = fuse_fsfile_new(ffs, n, out.open.fh);
+        if (!fsf) {
+            fuse_node_set_md(ffs, n, 0);
+            fuse_node_delete(ffs, n);
+            s = FS_STATUS_NOMEM;
+            goto release_fh;
+        }
+        *f = &fsf->f;
+    }
+    return FS_STATUS_OK;
+  release:
+    fuse_forget(ffs, out.entry.nodeid, 1);
+  release_fh:
+    if (open) {
+        struct fuse_release_in release_in = {
+            .fh = out.open.fh,
+        };
+        fuse_request_async(ffs, FUSE_RELEASE, out.entry.nodeid, &release_in, sizeof(release_in),
+                           0, 0, 0, false, 0);
+    }
+    return s;
+}
+
+static fs_status fuse_unlink(filesystem fs, tuple parent, string name, tuple md,
+                             boolean *destruct_md)
+{
+    fusefs ffs = (fusefs)fs;
+    fuse_node parent_node = fuse_get_node_from_md(ffs, parent);
+    if (!parent_node || !parent_node->nodeid)
+        return FS_STATUS_NOENT;
+    fs_status s = fuse_call(ffs, is_dir(md) ? FUSE_RMDIR : FUSE_UNLINK, parent_node->nodeid, 0, 0,
+                            name, 0, 0, 0);
+    if (s == FS_STATUS_OK) {
+        fuse_node n = fuse_get_node_from_md(ffs, md);
+        if (n)
+            fuse_node_unlink(ffs, n);
+        *destruct_md = true;
+    }
+    return s;
+}
+
+static fs_status fuse_rename(filesystem fs, tuple old_parent, string old_name, tuple old_md,
+                             tuple new_parent, string new_name, tuple new_md, boolean exchange,
+                             boolean *destruct_md)
+{
+    fusefs ffs = (fusefs)fs;
+    fuse_node oldp_node = fuse_get_node_from_md(ffs, old_parent);
+    if (!oldp_node || !oldp_node->nodeid)
+        return FS_STATUS_NOENT;
+    fuse_node newp_node = fuse_get_node_from_md(ffs, new_parent);
+    if (!newp_node || !newp_node->nodeid)
+        return FS_STATUS_NOENT;
+    fs_status s;
+    if (exchange) {
+        struct fuse_rename2_in arg = {
+            .newdir = newp_node->nodeid,
+            .flags = FUSE_RENAME_EXCHANGE,
+        };
+        s = fuse_call(ffs, FUSE_RENAME2, oldp_node->nodeid, &arg, sizeof(arg), old_name,
+                      new_name, 0, 0);
+    } else {
+        struct fuse_rename_in arg = {
+            .newdir = newp_node->nodeid,
+        };
+        s = fuse_call(ffs, FUSE_RENAME, oldp_node->nodeid, &arg, sizeof(arg), old_name, new_name,
+                      0, 0);
+        if ((s == FS_STATUS_OK) && new_md) {
+            fuse_node n = fuse_get_node_from_md(ffs, new_md);
+            if (n)
+                fuse_node_unlink(ffs, n);
+            *destruct_md = true;
+        }
+    }
+    return s;
+}
+
+static fs_status fuse_truncate(filesystem fs, fsfile f, u64 len)
+{
+    return fuse_setattr_size((fusefs)fs, (fuse_fsfile)f, len);
+}
+
+static inode fuse_get_inode(filesystem fs, tuple md)
+{
+    fuse_node n = fuse_get_node_from_md((fusefs)fs, md);
+    if (n)
+        return n->ino;
+    return 0;
+}
+
+static tuple fuse_get_meta(filesystem fs, inode ino)
+{
+    fuse_node n = fuse_get_node_from_ino((fusefs)fs, ino);
+    if (n)
+        return n->md;
+    return 0;
+}
+
+static status_handler fuse_get_sync_handler(filesystem fs, fsfile fsf, boolean datasync,
+                                            status_handler completion)
+{
+    return closure(fs->h, fuse_cache_sync_complete, fs, fsf, datasync, completion);
+}
+
+static status fuse_init(fusefs fs, u16 *map_alignment)
+{
+    struct fuse_init_in arg = {
+        .major = FUSE_KERNEL_VERSION,
+        .minor = FUSE_KERNEL_MINOR_VERSION,
+        .flags = FUSE_ASYNC_READ | FUSE_BIG_WRITES | FUSE_MAX_PAGES | FUSE_MAP_ALIGNMENT,
+    };
+    struct fuse_req r;
+    fs_status fss = fuse_request(fs, &r, FUSE_INIT, 0, &arg, sizeof(arg), 0, 0,
+                                 sizeof(struct fuse_init_out));
+    if (fss != FS_STATUS_OK)
+        return timm("result", "failed to initialize session (%s)", string_from_fs_status(fss));
+    struct fuse_init_out *init = r.reply;
+    status s;
+    if ((r.reply_len < offsetof(struct fuse_init_out *, time_gran)) ||
+        (init->major != FUSE_KERNEL_VERSION)) {
+        s = timm("result", "unsupported protocol version");
+        goto out;
+    }
+    fuse_debug("protocol version %d.%d, flags 0x%x, max_write %d\n", init->major, init->minor,
+               init->flags, init->max_write);
+    boolean has_max_pages = (r.reply_len >= offsetof(struct fuse_init_out *, map_alignment));
+    u32 max_pages = (has_max_pages && (init->flags & FUSE_MAX_PAGES) && init->max_pages) ?
+                    init->max_pages : FUSE_DEFAULT_MAX_PAGES;
+    fs->max_read = max_pages * PAGESIZE;
+    fs->max_write = MAX(MIN(init->max_write, fs->max_read), PAGESIZE);
+    *map_alignment = ((r.reply_len >= offsetof(struct fuse_init_out *, flags2)) &&
+                      (init->flags & FUSE_MAP_ALIGNMENT)) ? init->map_alignment : U16_MAX;
+    s = STATUS_OK;
+  out:
+    fuse_req_done(fs, &r);
+    return s;
+}
+
+void fuse_create_fs(heap h, void *transport, boolean readonly, filesystem_complete complete)
+{
+    fusefs fs = allocate(h, sizeof(*fs));
+    if (fs == INVALID_ADDRESS) {
+        apply(complete, INVALID_ADDRESS, timm("result", "failed to allocate fs"));
+        return;
+    }
+    fs->transport = transport;
+    fs->unique = 1;
+    u16 map_alignment = U16_MAX;
+    status s = fuse_init(fs, &map_alignment);
+    if (!is_ok(s))
+        goto dealloc_fs;
+    struct fuse_getattr_in getattr_in = {0};
+    struct fuse_attr_out attr;
+    fs_status fss = fuse_call(fs, FUSE_GETATTR, FUSE_ROOT_ID, &getattr_in, sizeof(getattr_in), 0,
+                              0, &attr, sizeof(attr));
+    if (fss != FS_STATUS_OK) {
+        s = timm("result", "failed to get root attributes (%d)", fss);
+        goto dealloc_fs;
+    }
+    struct fuse_kstatfs statfs;
+    fss = fuse_call(fs, FUSE_STATFS, FUSE_ROOT_ID, 0, 0, 0, 0, &statfs, sizeof(statfs));
+    if (fss != FS_STATUS_OK) {
+        s = timm("result", "failed to get filesystem information (%d)", fss);
+        goto dealloc_fs;
+    }
+    s = filesystem_init(&fs->fs, h, statfs.blocks * statfs.bsize, 1, readonly);
+    if (!is_ok(s)) {
+        s = timm_up(s, "result", "failed to init fs");
+        goto dealloc_fs;
+    }
+    fs->md_nodes = allocate_table(h, identity_key, pointer_equal);
+    if (fs->md_nodes == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate node table");
+        goto deinit_fs;
+    }
+    fs->ino_nodes = allocate_table(h, identity_key, pointer_equal);
+    if (fs->ino_nodes == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate node table");
+        goto dealloc_md_table;
+    }
+    fs->fs.root = fs->root.md = allocate_tuple();
+    set(fs->root.md, sym_this(".."), fs->root.md);
+    fs->root.nodeid = FUSE_ROOT_ID;
+    fs->root.nlookup = 0;
+    fs->root.ino = attr.attr.ino;
+    fs->root.entry_expiry = fuse_expiry(attr.attr_valid, attr.attr_valid_nsec);
+    fs->root.dir_expiry = 0;
+    fs->root.fsf = 0;
+    fs->fs.lookup = fuse_lookup;
+    fs->fs.create = fuse_create;
+    fs->fs.unlink = fuse_unlink;
+    fs->fs.rename = fuse_rename;
+    fs->fs.truncate = fuse_truncate;
+    fs->fs.get_fsfile = fuse_get_fsfile;
+    fs->fs.get_inode = fuse_get_inode;
+    fs->fs.get_meta = fuse_get_meta;
+    fs->fs.get_sync_handler = fuse_get_sync_handler;
+    list_init(&fs->fsfiles);
+    fuse_dax_init(fs, map_alignment);
+    apply(complete, &fs->fs, STATUS_OK);
+    return;
+  dealloc_md_table:
+    deallocate_table(fs->md_nodes);
+  deinit_fs:
+    filesystem_deinit(&fs->fs);
+  dealloc_fs:
+    deallocate(h, fs, sizeof(*fs));
+    apply(complete, INVALID_ADDRESS, s);
+}
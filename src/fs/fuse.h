@@ -0,0 +1,283 @@
+/* FUSE protocol definitions (as used by virtio-fs) */
+
+#define FUSE_KERNEL_VERSION         7
+#define FUSE_KERNEL_MINOR_VERSION   31
+
+#define FUSE_ROOT_ID    1
+
+/* INIT request/reply flags */
+#define FUSE_ASYNC_READ     U64_FROM_BIT(0)
+#define FUSE_BIG_WRITES     U64_FROM_BIT(5)
+#define FUSE_MAX_PAGES      U64_FROM_BIT(22)
+#define FUSE_MAP_ALIGNMENT  U64_FROM_BIT(26)
+
+/* SETATTR valid flags */
+#define FATTR_SIZE  U64_FROM_BIT(3)
+#define FATTR_FH    U64_FROM_BIT(6)
+
+/* FSYNC flags */
+#define FUSE_FSYNC_FDATASYNC    U64_FROM_BIT(0)
+
+/* RENAME2 flags */
+#define FUSE_RENAME_EXCHANGE    U64_FROM_BIT(1)
+
+/* SETUPMAPPING flags */
+#define FUSE_SETUPMAPPING_FLAG_WRITE    U64_FROM_BIT(0)
+#define FUSE_SETUPMAPPING_FLAG_READ     U64_FROM_BIT(1)
+
+#define FUSE_DEFAULT_MAX_PAGES  32
+
+enum fuse_opcode {
+    FUSE_LOOKUP = 1,
+    FUSE_FORGET = 2,
+    FUSE_GETATTR = 3,
+    FUSE_SETATTR = 4,
+    FUSE_READLINK = 5,
+    FUSE_SYMLINK = 6,
+    FUSE_MKNOD = 8,
+    FUSE_MKDIR = 9,
+    FUSE_UNLINK = 10,
+    FUSE_RMDIR = 11,
+    FUSE_RENAME = 12,
+    FUSE_OPEN = 14,
+    FUSE_READ = 15,
+    FUSE_WRITE = 16,
+    FUSE_STATFS = 17,
+    FUSE_RELEASE = 18,
+    FUSE_FSYNC = 20,
+    FUSE_INIT = 26,
+    FUSE_OPENDIR = 27,
+    FUSE_READDIR = 28,
+    FUSE_RELEASEDIR = 29,
+    FUSE_CREATE = 35,
+    FUSE_RENAME2 = 45,
+    FUSE_SETUPMAPPING = 48,
+    FUSE_REMOVEMAPPING = 49,
+};
+
+struct fuse_in_header {
+    u32 len;
+    u32 opcode;
+    u64 unique;
+    u64 nodeid;
+    u32 uid;
+    u32 gid;
+    u32 pid;
+    u16 total_extlen;
+    u16 padding;
+};
+
+struct fuse_out_header {
+    u32 len;
+    s32 error;
+    u64 unique;
+};
+
+struct fuse_attr {
+    u64 ino;
+    u64 size;
+    u64 blocks;
+    u64 atime;
+    u64 mtime;
+    u64 ctime;
+    u32 atimensec;
+    u32 mtimensec;
+    u32 ctimensec;
+    u32 mode;
+    u32 nlink;
+    u32 uid;
+    u32 gid;
+    u32 rdev;
+    u32 blksize;
+    u32 flags;
+};
+
+struct fuse_entry_out {
+    u64 nodeid;
+    u64 generation;
+    u64 entry_valid;
+    u64 attr_valid;
+    u32 entry_valid_nsec;
+    u32 attr_valid_nsec;
+    struct fuse_attr attr;
+};
+
+struct fuse_forget_in {
+    u64 nlookup;
+};
+
+struct fuse_getattr_in {
+    u32 getattr_flags;
+    u32 dummy;
+    u64 fh;
+};
+
+struct fuse_attr_out {
+    u64 attr_valid;
+    u32 attr_valid_nsec;
+    u32 dummy;
+    struct fuse_attr attr;
+};
+
+struct fuse_mknod_in {
+    u32 mode;
+    u32 rdev;
+    u32 umask;
+    u32 padding;
+};
+
+struct fuse_mkdir_in {
+    u32 mode;
+    u32 umask;
+};
+
+struct fuse_rename_in {
+    u64 newdir;
+};
+
+struct fuse_rename2_in {
+    u64 newdir;
+    u32 flags;
+    u32 padding;
+};
+
+struct fuse_setattr_in {
+    u32 valid;
+    u32 padding;
+    u64 fh;
+    u64 size;
+    u64 lock_owner;
+    u64 atime;
+    u64 mtime;
+    u64 ctime;
+    u32 atimensec;
+    u32 mtimensec;
+    u32 ctimensec;
+    u32 mode;
+    u32 unused4;
+    u32 uid;
+    u32 gid;
+    u32 unused5;
+};
+
+struct fuse_open_in {
+    u32 flags;
+    u32 open_flags;
+};
+
+struct fuse_create_in {
+    u32 flags;
+    u32 mode;
+    u32 umask;
+    u32 open_flags;
+};
+
+struct fuse_open_out {
+    u64 fh;
+    u32 open_flags;
+    s32 backing_id;
+};
+
+struct fuse_release_in {
+    u64 fh;
+    u32 flags;
+    u32 release_flags;
+    u64 lock_owner;
+};
+
+struct fuse_read_in {
+    u64 fh;
+    u64 offset;
+    u32 size;
+    u32 read_flags;
+    u64 lock_owner;
+    u32 flags;
+    u32 padding;
+};
+
+struct fuse_write_in {
+    u64 fh;
+    u64 offset;
+    u32 size;
+    u32 write_flags;
+    u64 lock_owner;
+    u32 flags;
+    u32 padding;
+};
+
+struct fuse_write_out {
+    u32 size;
+    u32 padding;
+};
+
+struct fuse_kstatfs {
+    u64 blocks;
+    u64 bfree;
+    u64 bavail;
+    u64 files;
+    u64 ffree;
+    u32 bsize;
+    u32 namelen;
+    u32 frsize;
+    u32 padding;
+    u32 spare[6];
+};
+
+struct fuse_fsync_in {
+    u64 fh;
+    u32 fsync_flags;
+    u32 padding;
+};
+
+struct fuse_init_in {
+    u32 major;
+    u32 minor;
+    u32 max_readahead;
+    u32 flags;
+    u32 flags2;
+    u32 unused[11];
+};
+
+struct fuse_init_out {
+    u32 major;
+    u32 minor;
+    u32 max_readahead;
+    u32 flags;
+    u16 max_background;
+    u16 congestion_threshold;
+    u32 max_write;
+    u32 time_gran;
+    u16 max_pages;
+    u16 map_alignment;
+    u32 flags2;
+    u32 unused[7];
+};
+
+struct fuse_dirent {
+    u64 ino;
+    u64 off;
+    u32 namelen;
+    u32 type;
+    char name[0];
+};
+
+#define FUSE_DIRENT_SIZE(d) pad(offsetof(struct fuse_dirent *, name) + (d)->namelen, sizeof(u64))
+
+struct fuse_setupmapping_in {
+    u64 fh;
+    u64 foffset;
+    u64 len;
+    u64 flags;
+    u64 moffset;
+};
+
+struct fuse_removemapping_in {
+    u32 count;
+};
+
+struct fuse_removemapping_one {
+    u64 moffset;
+    u64 len;
+};
+
+void fuse_create_fs(heap h, void *transport, boolean readonly, filesystem_complete complete);
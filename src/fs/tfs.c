@@ -20,11 +20,15 @@
 
 #define tfs_storage_lock(fs)    spin_lock(&(fs)->storage_lock)
 #define tfs_storage_unlock(fs)  spin_unlock(&(fs)->storage_lock)
+#define tfs_flush_lock(fs)      spin_lock(&(fs)->flush_lock)
+#define tfs_flush_unlock(fs)    spin_unlock(&(fs)->flush_lock)
 
 #else
 
 #define tfs_storage_lock(fs)    ((void)fs)
 #define tfs_storage_unlock(fs)  ((void)fs)
+#define tfs_flush_lock(fs)      ((void)fs)
+#define tfs_flush_unlock(fs)    ((void)fs)
 
 #endif
 
@@ -32,6 +36,9 @@
 
 #define tfs_from_file(f)    ((tfs)((f)->f.fs))
 
+/* value in the files table for a regular file whose fsfile has not been created yet */
+#define TFSFILE_UNLOADED    pointer_from_u64(1)
+
 /* Called with fs locked */
 static tuple tmpfs_get_meta(filesystem fs, inode n)
 {
@@ -80,6 +87,8 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     e->start_block = storage_blocks.start;
     e->allocated = range_span(storage_blocks);
     e->uninited = 0;
+    e->compressed = 0;
+    e->shared = false;
     return e;
 }
 
@@ -94,17 +103,62 @@ closure_function(2, 1, boolean, tfs_storage_alloc,
     return true;
 }
 
+#ifdef KERNEL
+
+/* Freed blocks are discarded in batches; until the batch that discards them completes, they stay
+ * allocated in the storage map, so that they cannot be reused (and written to) while a discard
+ * request covering them is in flight. Called with the storage lock held. */
+static boolean tfs_discard_defer(tfs fs, range blocks)
+{
+    rmnode n = rangemap_lookup(fs->storage, blocks.start);
+    if ((n == INVALID_ADDRESS) || (n->r.end < blocks.end) ||
+        rangemap_range_intersects(fs->discard_pending, blocks) ||
+        rangemap_range_intersects(fs->discard_inflight, blocks) ||
+        !rangemap_insert_range(fs->discard_pending, blocks))
+        return false;
+    fs->discard_pending_blocks += range_span(blocks);
+    if (!fs->discarding &&
+        (fs->discard_pending_blocks >= (TFS_DISCARD_BATCH_SIZE >> fs->fs.blocksize_order))) {
+        fs->discarding = true;
+        async_apply(fs->discard_thunk);
+    }
+    return true;
+}
+
+/* Frees the blocks waiting for the next discard batch without discarding them. Called with the
+ * storage lock held. */
+static void tfs_discard_cancel(tfs fs)
+{
+    rmnode n;
+    while ((n = rangemap_first_node(fs->discard_pending)) != INVALID_ADDRESS) {
+        if (rangemap_insert_hole(fs->storage, n->r))
+            fs->used_blocks -= range_span(n->r);
+        rangemap_remove_range(fs->discard_pending, n);
+    }
+    fs->discard_pending_blocks = 0;
+}
+
+#endif
+
 u64 filesystem_allocate_storage(tfs fs, u64 nblocks)
 {
     if (fs->storage) {
         tfs_storage_lock(fs);
         u64 start_block;
-        int result = rangemap_range_find_gaps(fs->storage,
-                                              irange(0, fs->fs.size >> fs->fs.blocksize_order),
-                                              stack_closure(tfs_storage_alloc,
-                                                            nblocks, &start_block));
+        range_handler alloc = stack_closure(tfs_storage_alloc, nblocks, &start_block);
+        range q = irange(0, fs->fs.size >> fs->fs.blocksize_order);
+        int result = rangemap_range_find_gaps(fs->storage, q, alloc);
+#ifdef KERNEL
+        if ((result != RM_ABORT) && fs->discard_pending_blocks) {
+            /* rather than failing, give up discarding the blocks freed since the last batch */
+            tfs_discard_cancel(fs);
+            result = rangemap_range_find_gaps(fs->storage, q, alloc);
+        }
+#endif
         boolean success = (result == RM_ABORT) &&
                           rangemap_insert_range(fs->storage, irangel(start_block, nblocks));
+        if (success)
+            fs->used_blocks += nblocks;
         tfs_storage_unlock(fs);
         if (success)
             return start_block;
@@ -118,24 +172,146 @@ boolean filesystem_reserve_storage(tfs fs, range blocks)
         tfs_storage_lock(fs);
         boolean success = !rangemap_range_intersects(fs->storage, blocks) &&
                           rangemap_insert_range(fs->storage, blocks);
+        if (success)
+            fs->used_blocks += range_span(blocks);
         tfs_storage_unlock(fs);
         return success;
     }
     return true;
 }
 
+/* Called with the storage lock held. */
+static boolean tfs_storage_free(tfs fs, range blocks)
+{
+#ifdef KERNEL
+    if (fs->discard)
+        return tfs_discard_defer(fs, blocks);
+#endif
+    if (!rangemap_insert_hole(fs->storage, blocks))
+        return false;
+    fs->used_blocks -= range_span(blocks);
+    return true;
+}
+
+/* Storage blocks referenced by more than one extent (e.g. after a file range has been cloned) are
+ * tracked in the shared map with their reference count; blocks that are not in the map have a single
+ * reference. The functions below are called with the storage lock held. */
+
+typedef struct tfs_shared {
+    struct rmnode node;     /* must be first */
+    u64 refs;
+} *tfs_shared;
+
+/* Splits the shared node containing a block (if any), so that a node starts at the block. */
+static boolean tfs_shared_split(tfs fs, u64 block)
+{
+    rmnode n = rangemap_lookup(fs->shared, block);
+    if ((n == INVALID_ADDRESS) || (n->r.start == block))
+        return true;
+    tfs_shared s = allocate(fs->fs.h, sizeof(*s));
+    if (s == INVALID_ADDRESS)
+        return false;
+    rmnode_init(&s->node, irange(block, n->r.end));
+    s->refs = ((tfs_shared)n)->refs;
+    n->r.end = block;
+    rangemap_update_node(fs->shared, n);
+    assert(rangemap_insert(fs->shared, &s->node));
+    return true;
+}
+
+/* Drops a reference to allocated blocks, and frees the blocks that are no longer referenced. */
+static boolean tfs_storage_unref(tfs fs, range blocks)
+{
+    if (!tfs_shared_split(fs, blocks.start) || !tfs_shared_split(fs, blocks.end))
+        return false;
+    boolean success = true;
+    u64 block = blocks.start;
+    while (block < blocks.end) {
+        rmnode n = rangemap_lookup_at_or_next(fs->shared, block);
+        u64 end;
+        if ((n != INVALID_ADDRESS) && (n->r.start == block)) {
+            end = n->r.end;
+            if (--((tfs_shared)n)->refs == 1) {
+                rangemap_remove_node(fs->shared, n);
+                deallocate(fs->fs.h, n, sizeof(struct tfs_shared));
+            }
+        } else {
+            end = ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) ? n->r.start : blocks.end;
+            success = tfs_storage_free(fs, irange(block, end)) && success;
+        }
+        block = end;
+    }
+    return success;
+}
+
+/* Adds a reference to allocated blocks. */
+static boolean tfs_storage_ref(tfs fs, range blocks)
+{
+    if (!tfs_shared_split(fs, blocks.start) || !tfs_shared_split(fs, blocks.end))
+        return false;
+    u64 block = blocks.start;
+    while (block < blocks.end) {
+        rmnode n = rangemap_lookup_at_or_next(fs->shared, block);
+        if ((n != INVALID_ADDRESS) && (n->r.start == block)) {
+            ((tfs_shared)n)->refs++;
+            block = n->r.end;
+            continue;
+        }
+        u64 end = ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) ? n->r.start : blocks.end;
+        tfs_shared s = allocate(fs->fs.h, sizeof(*s));
+        if (s == INVALID_ADDRESS) {
+            /* none of the blocks referenced so far can be freed by this */
+            tfs_storage_unref(fs, irange(blocks.start, block));
+            return false;
+        }
+        rmnode_init(&s->node, irange(block, end));
+        s->refs = 2;
+        assert(rangemap_insert(fs->shared, &s->node));
+        block = end;
+    }
+    return true;
+}
+
 boolean filesystem_free_storage(tfs fs, range blocks)
 {
     if (fs->storage) {
         tfs_storage_lock(fs);
-        boolean success = rangemap_insert_hole(fs->storage, blocks);
+        boolean success = rangemap_range_intersects(fs->shared, blocks) ?
+                          tfs_storage_unref(fs, blocks) : tfs_storage_free(fs, blocks);
         tfs_storage_unlock(fs);
         return success;
     }
     return true;
 }
 
-void ingest_extent(tfsfile f, symbol off, tuple value)
+/* Reserves the storage of a shared extent when mounting the filesystem: the blocks already reserved
+ * by other extents get an additional reference. */
+static boolean tfs_share_storage(tfs fs, range blocks)
+{
+    if (!fs->storage)
+        return true;
+    boolean success = true;
+    tfs_storage_lock(fs);
+    u64 block = blocks.start;
+    while (success && (block < blocks.end)) {
+        rmnode n = rangemap_lookup_at_or_next(fs->storage, block);
+        u64 end;
+        if ((n != INVALID_ADDRESS) && (n->r.start <= block)) {
+            end = MIN(n->r.end, blocks.end);
+            success = tfs_storage_ref(fs, irange(block, end));
+        } else {
+            end = ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) ? n->r.start : blocks.end;
+            success = rangemap_insert_range(fs->storage, irange(block, end));
+            if (success)
+                fs->used_blocks += end - block;
+        }
+        block = end;
+    }
+    tfs_storage_unlock(fs);
+    return success;
+}
+
+static extent tfs_extent_from_md(tfsfile f, symbol off, tuple value)
 {
     tfs_debug("ingest_extent: f %p, off %b, value %v\n", f, symbol_string(off), value);
     u64 length, file_offset, start_block, allocated;
@@ -147,12 +323,9 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
     tfs_debug("   file offset %ld, length %ld, start_block 0x%lx, allocated %ld\n",
               file_offset, length, start_block, allocated);
 
+    /* storage has been reserved when mounting the filesystem */
     range storage_blocks = irangel(start_block, allocated);
     tfs fs = tfs_from_file(f);
-    if (!filesystem_reserve_storage(fs, storage_blocks)) {
-        /* soft error... */
-        msg_err("unable to reserve storage blocks %R\n", storage_blocks);
-    }
     range r = irangel(file_offset, length);
     extent ex = allocate_extent(fs->fs.h, r, storage_blocks);
     if (ex == INVALID_ADDRESS)
@@ -160,18 +333,74 @@ void ingest_extent(tfsfile f, symbol off, tuple value)
     ex->md = value;
     if (get(value, sym(uninited)))
         ex->uninited = INVALID_ADDRESS;
+    ingest_parse_int(value, sym(compressed), &ex->compressed);
+    ex->shared = (get(value, sym(shared)) != 0);
+    return ex;
+}
+
+void ingest_extent(tfsfile f, symbol off, tuple value)
+{
+    extent ex = tfs_extent_from_md(f, off, value);
     assert(rangemap_insert(f->extentmap, &ex->node));
 }
 
-closure_function(1, 2, boolean, tfs_ingest_extent,
-                 tfsfile, f,
+closure_function(2, 2, boolean, tfs_ingest_extent,
+                 tfsfile, f, vector, extents,
                  value s, value v)
 {
     assert(is_symbol(s));
-    ingest_extent(bound(f), s, v);
+    extent ex = tfs_extent_from_md(bound(f), s, v);
+    vector_push(bound(extents), &ex->node);
+    return true;
+}
+
+closure_function(1, 2, boolean, tfs_reserve_extent,
+                 tfs, fs,
+                 value s, value v)
+{
+    u64 start_block, allocated;
+    if (!is_tuple(v) || !ingest_parse_int(v, sym(offset), &start_block) ||
+        !ingest_parse_int(v, sym(allocated), &allocated))
+        return true;
+    range storage_blocks = irangel(start_block, allocated);
+    tfs fs = bound(fs);
+    boolean reserved;
+    /* the storage of shared extents (deduplicated by mkfs, or cloned) may be already reserved */
+    if (get(v, sym(shared)))
+        reserved = tfs_share_storage(fs, storage_blocks);
+    else
+        reserved = filesystem_reserve_storage(fs, storage_blocks);
+    if (!reserved) {
+        /* soft error... */
+        msg_err("unable to reserve storage blocks %R\n", storage_blocks);
+    }
     return true;
 }
 
+/* Create the fsfile of a regular file and its extent map from the file metadata. */
+static tfsfile tfs_load_fsfile(tfs fs, tuple t)
+{
+    tfs_debug("%s: %p\n", func_ss, t);
+    tfsfile f = allocate_fsfile(fs, t);
+    if (f == INVALID_ADDRESS)
+        return f;
+    value filelength = get(t, sym_const(filelength));
+    u64 len;
+    if (filelength && u64_from_value(filelength, &len))
+        fsfile_set_length(&f->f, len);
+    tuple extents = get_tuple(t, sym_const(extents));
+    if (extents) {
+        /* extents are iterated in no particular order: build the extent map in one pass */
+        vector v = allocate_vector(fs->fs.h, tuple_count(extents));
+        if (v == INVALID_ADDRESS)
+            halt("out of memory\n");
+        iterate(extents, stack_closure(tfs_ingest_extent, f, v));
+        assert(rangemap_insert_bulk(f->extentmap, buffer_ref(v, 0), vector_length(v)));
+        deallocate_vector(v);
+    }
+    return f;
+}
+
 static boolean enumerate_dir_entries(tfs fs, tuple t);
 
 closure_function(1, 2, boolean, enumerate_dir_entries_each,
@@ -186,17 +415,14 @@ closure_function(1, 2, boolean, enumerate_dir_entries_each,
 
 static boolean enumerate_dir_entries(tfs fs, tuple t)
 {
-    tuple extents = get_tuple(t, sym(extents));
+    tuple extents = get_tuple(t, sym_const(extents));
     if (extents) {
-        tfsfile f = allocate_fsfile(fs, t);
-        if (f == INVALID_ADDRESS)
-            return false;
-        table_set(fs->files, t, f);
-        value filelength = get(t, sym(filelength));
-        u64 len;
-        if (filelength && u64_from_value(filelength, &len))
-            fsfile_set_length(&f->f, len);
-        return iterate(extents, stack_closure(tfs_ingest_extent, f));
+        /* Regular files are loaded on first access: only the storage used by their extents is
+         * accounted for at mount time. */
+        table_set(fs->files, t, TFSFILE_UNLOADED);
+        if (!fs->storage)
+            return true;
+        return iterate(extents, stack_closure(tfs_reserve_extent, fs));
     }
     table_set(fs->files, t, INVALID_ADDRESS);
     tuple c = children(t);
@@ -230,11 +456,10 @@ closure_function(2, 1, void, zero_blocks_complete,
     closure_finish();
 }
 
-void zero_blocks(tfs fs, range blocks, merge m)
+/* Zeroes storage by writing the zero page to each page worth of blocks. */
+static void zero_blocks_write(tfs fs, range blocks, status_handler completion)
 {
     int blocks_per_page = U64_FROM_BIT(fs->page_order - fs->fs.blocksize_order);
-    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
-    status_handler completion = apply_merge(m);
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         apply(completion, timm("result", "failed to allocate sg list"));
@@ -269,6 +494,145 @@ void zero_blocks(tfs fs, range blocks, merge m)
     apply(fs->req_handler, &req);
 }
 
+#ifdef KERNEL
+closure_function(3, 1, void, write_zeroes_complete,
+                 tfs, fs, range, blocks, status_handler, completion,
+                 status s)
+{
+    if (is_ok(s)) {
+        apply(bound(completion), s);
+    } else {
+        /* the device does not support write zeroes requests (or failed one): write zeros instead,
+         * and stop using these requests */
+        tfs fs = bound(fs);
+        tfs_debug("%s: fs %p, blocks %R, status %v\n", func_ss, fs, bound(blocks), s);
+        fs->write_zeroes = false;
+        timm_dealloc(s);
+        zero_blocks_write(fs, bound(blocks), bound(completion));
+    }
+    closure_finish();
+}
+#endif
+
+void zero_blocks(tfs fs, range blocks, merge m)
+{
+    tfs_debug("%s: fs %p, blocks %R\n", func_ss, fs, blocks);
+    status_handler completion = apply_merge(m);
+#ifdef KERNEL
+    if (fs->write_zeroes) {
+        status_handler sh = closure(fs->fs.h, write_zeroes_complete, fs, blocks, completion);
+        if (sh != INVALID_ADDRESS) {
+            struct storage_req req = {
+                .op = STORAGE_OP_WRITE_ZEROES,
+                .blocks = blocks,
+                .completion = sh,
+            };
+            apply(fs->req_handler, &req);
+            return;
+        }
+    }
+#endif
+    zero_blocks_write(fs, blocks, completion);
+}
+
+#ifdef BOOT
+/* The boot loader heaps do not reclaim memory, and their storage reads complete synchronously, so
+ * that compressed extents are processed one at a time: the buffers to read and decompress extents
+ * are allocated once and reused. */
+static void *compressed_bufs[2];
+
+static void *compressed_buf_get(heap h, int index, u64 size)
+{
+    if (size > COMPRESSED_EXTENT_SIZE)
+        return INVALID_ADDRESS;
+    if (!compressed_bufs[index])
+        compressed_bufs[index] = allocate(h, COMPRESSED_EXTENT_SIZE);
+    return compressed_bufs[index];
+}
+
+#define compressed_buf_alloc(h, index, size)        compressed_buf_get(h, index, size)
+#define compressed_buf_dealloc(h, index, buf, size)
+#else
+#define compressed_buf_alloc(h, index, size)        allocate(h, size)
+#define compressed_buf_dealloc(h, index, buf, size) deallocate(h, buf, size)
+#endif
+
+closure_function(7, 1, void, read_compressed_complete,
+                 tfs, fs, sg_list, sg, void *, buf, u64, compressed, range, r, sg_list, dest,
+                 status_handler, complete,
+                 status s)
+{
+    tfs fs = bound(fs);
+    sg_list sg = bound(sg);
+    void *buf = bound(buf);
+    range r = bound(r);
+    sg_list dest = bound(dest);
+    tfs_debug("%s: compressed %ld, r %R, status %v\n", func_ss, bound(compressed), r, s);
+    if (is_ok(s)) {
+        void *data = compressed_buf_alloc(fs->fs.h, 1, r.end);
+        if (data != INVALID_ADDRESS) {
+            if (lz4_decompress(buf, bound(compressed), data, r.end) == r.end)
+                sg_copy_from_buf(data + r.start, dest, range_span(r));
+            else
+                s = timm("result", "corrupted compressed extent");
+            compressed_buf_dealloc(fs->fs.h, 1, data, r.end);
+        } else {
+            s = timm("result", "failed to allocate decompression buffer");
+        }
+    }
+    sg_list_release(dest);
+    deallocate_sg_list(dest);
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    compressed_buf_dealloc(fs->dma, 0, buf,
+                           pad(bound(compressed), U64_FROM_BIT(fs->fs.blocksize_order)));
+    apply(bound(complete), s);
+    closure_finish();
+}
+
+/* The whole extent is read and decompressed, then the requested blocks are copied out; the
+ * destination buffers are detached from sg, whose remainder is filled by the following extents
+ * and holes before the storage read completes. */
+static void read_compressed_extent(tfs fs, sg_list sg, extent e, range blocks,
+                                   status_handler complete)
+{
+    int order = fs->fs.blocksize_order;
+    range r = range_lshift(blocks, order);
+    u64 buf_size = pad(e->compressed, U64_FROM_BIT(order));
+    sg_list dest = allocate_sg_list();
+    if (dest == INVALID_ADDRESS)
+        goto fail;
+    sg_list src = allocate_sg_list();
+    if (src == INVALID_ADDRESS)
+        goto fail_dealloc_dest;
+    void *buf = compressed_buf_alloc(fs->dma, 0, buf_size);
+    if (buf == INVALID_ADDRESS)
+        goto fail_dealloc_src;
+    sg_buf sgb = sg_list_tail_add(src, buf_size);
+    if (sgb == INVALID_ADDRESS)
+        goto fail_dealloc_buf;
+    sgb->buf = buf;
+    sgb->offset = 0;
+    sgb->size = buf_size;
+    sgb->refcount = 0;
+    status_handler sh = closure(fs->fs.h, read_compressed_complete, fs, src, buf, e->compressed,
+                                r, dest, complete);
+    if (sh == INVALID_ADDRESS)
+        goto fail_dealloc_buf;
+    sg_move(dest, sg, range_span(r));
+    filesystem_storage_op(fs, src, irangel(e->start_block, buf_size >> order), false, sh);
+    return;
+  fail_dealloc_buf:
+    compressed_buf_dealloc(fs->dma, 0, buf, buf_size);
+  fail_dealloc_src:
+    deallocate_sg_list(src);
+  fail_dealloc_dest:
+    deallocate_sg_list(dest);
+  fail:
+    sg_zero_fill(sg, range_span(r));
+    apply(complete, timm("result", "failed to allocate compressed extent read"));
+}
+
 closure_function(4, 1, boolean, read_extent,
                  tfs, fs, sg_list, sg, merge, m, range, blocks,
                  rmnode node)
@@ -283,7 +647,9 @@ closure_function(4, 1, boolean, read_extent,
     tfs_debug("%s: e %p, uninited %p, sg %p m %p blocks %R, i %R, len %ld, blocks %R\n",
               func_ss, e, e->uninited, bound(sg), bound(m), bound(blocks), i, len, blocks);
     uninited u = e->uninited;
-    if (!u || ((u != INVALID_ADDRESS) && u->initialized))
+    if (e->compressed)
+        read_compressed_extent(fs, sg, e, irangel(e_offset, len), apply_merge(bound(m)));
+    else if (!u || ((u != INVALID_ADDRESS) && u->initialized))
         filesystem_storage_op(fs, sg, blocks, false, apply_merge(bound(m)));
     else
         sg_zero_fill(sg, range_span(blocks) << fs->fs.blocksize_order);
@@ -324,6 +690,46 @@ closure_function(2, 3, void, filesystem_storage_read,
     apply(k, STATUS_OK);
 }
 
+closure_func_basic(rmnode_handler, boolean, tfs_extent_not_compressed,
+                   rmnode node)
+{
+    return !((extent)node)->compressed;
+}
+
+closure_function(2, 1, boolean, tfs_map_extent,
+                 range, blocks, tfs_block_map_handler, h,
+                 rmnode node)
+{
+    extent e = (extent)node;
+    range i = range_intersection(bound(blocks), node->r);
+    uninited u = e->uninited;
+    u64 storage_block = (!u || ((u != INVALID_ADDRESS) && u->initialized)) ?
+                        e->start_block + i.start - node->r.start : INVALID_PHYSICAL;
+    return apply(bound(h), i, storage_block);
+}
+
+closure_function(2, 1, boolean, tfs_map_hole,
+                 range, blocks, tfs_block_map_handler, h,
+                 range z)
+{
+    range i = range_intersection(bound(blocks), z);
+    return !range_span(i) || apply(bound(h), i, INVALID_PHYSICAL);
+}
+
+/* Called with fs locked: returns false if the handler returned false or the range includes
+ * compressed extents (in which case the handler is not invoked). */
+boolean tfsfile_map_blocks(fsfile f, range blocks, tfs_block_map_handler h)
+{
+    tfsfile tf = (tfsfile)f;
+    if (rangemap_range_lookup(tf->extentmap, blocks,
+                              stack_closure_func(rmnode_handler, tfs_extent_not_compressed)) ==
+        RM_ABORT)
+        return false;
+    return (rangemap_range_lookup_with_gaps(tf->extentmap, blocks,
+                                            stack_closure(tfs_map_extent, blocks, h),
+                                            stack_closure(tfs_map_hole, blocks, h)) != RM_ABORT);
+}
+
 #ifndef TFS_READ_ONLY
 static tuple cleanup_directory(tuple dir);
 
@@ -358,19 +764,96 @@ fs_status filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean clean
         return FS_STATUS_NOSPACE;
 }
 
+closure_function(1, 1, boolean, tfs_delalloc_count,
+                 u64 *, nblocks,
+                 range r)
+{
+    *bound(nblocks) += range_span(r);
+    return true;
+}
+
+closure_function(2, 1, boolean, tfs_delalloc_gap,
+                 tfsfile, f, u64 *, nblocks,
+                 range r)
+{
+    rangemap_range_find_gaps(bound(f)->delalloc, r, stack_closure(tfs_delalloc_count,
+                                                                  bound(nblocks)));
+    return true;
+}
+
+closure_function(2, 1, boolean, tfs_delalloc_insert,
+                 tfsfile, f, boolean *, success,
+                 range r)
+{
+    if (!rangemap_insert_range(bound(f)->delalloc, r)) {
+        *bound(success) = false;
+        return false;
+    }
+    return true;
+}
+
+/* Reserve free space for the blocks in a file range that are neither backed by an extent nor
+ * already reserved. Called with fs locked. */
+static fs_status tfs_delalloc_reserve(tfs fs, tfsfile f, range blocks)
+{
+    u64 nblocks = 0;
+    rangemap_range_find_gaps(f->extentmap, blocks, stack_closure(tfs_delalloc_gap, f, &nblocks));
+    if (nblocks == 0)
+        return FS_STATUS_OK;
+    tfs_storage_lock(fs);
+    u64 free_blocks = (fs->fs.size >> fs->fs.blocksize_order) - fs->used_blocks -
+                      fs->delalloc_blocks;
+    boolean success = (nblocks <= free_blocks);
+    if (success)
+        fs->delalloc_blocks += nblocks;
+    tfs_storage_unlock(fs);
+    if (!success)
+        return FS_STATUS_NOSPACE;
+    rangemap_range_find_gaps(f->extentmap, blocks,
+                             stack_closure(tfs_delalloc_insert, f, &success));
+    tfs_debug("%s: f %p, blocks %R, reserved %ld\n", func_ss, f, blocks, nblocks);
+    return success ? FS_STATUS_OK : FS_STATUS_NOMEM;
+}
+
+/* Drop the delayed allocation reservation for a file range, either because the range is being
+ * backed by extents or because its data is being discarded. Called with fs locked. */
+static void tfs_delalloc_release(tfs fs, tfsfile f, range blocks)
+{
+    u64 nblocks = 0;
+    while (range_span(blocks)) {
+        rmnode n = rangemap_lookup_at_or_next(f->delalloc, blocks.start);
+        if ((n == INVALID_ADDRESS) || (n->r.start >= blocks.end))
+            break;
+        range i = range_intersection(n->r, blocks);
+        if (!rangemap_insert_hole(f->delalloc, i))
+            break;
+        nblocks += range_span(i);
+        blocks.start = i.end;
+    }
+    if (nblocks == 0)
+        return;
+    tfs_debug("%s: f %p, released %ld\n", func_ss, f, nblocks);
+    tfs_storage_lock(fs);
+    fs->delalloc_blocks -= nblocks;
+    tfs_storage_unlock(fs);
+}
+
 static fs_status tfs_truncate(filesystem fs, fsfile f, u64 len)
 {
     if (f->md) {
         value v = value_from_u64(len);
         if (v == INVALID_ADDRESS)
             return FS_STATUS_NOMEM;
-        symbol l = sym(filelength);
+        symbol l = sym_const(filelength);
         fs_status s = filesystem_write_eav((tfs)fs, f->md, l, v, false);
         if (s != FS_STATUS_OK)
             return s;
         set(f->md, l, v);
         f->status |= FSF_DIRTY_DATASYNC;
     }
+    tfs_delalloc_release((tfs)fs, (tfsfile)f,
+                         irange((len + MASK(fs->blocksize_order)) >> fs->blocksize_order,
+                                infinity));
     return FS_STATUS_OK;
 }
 
@@ -379,20 +862,20 @@ static fs_status tfs_truncate(filesystem fs, fsfile f, u64 len)
    The life an extent depends on a particular allocation of contiguous
    storage space. The extent is tied to this allocated area (nominally
    page size). Only the extent data length and allocation size may be
-   updated; the file offset and block start are immutable. As an
-   optimization, adjacent extents on the disk could be joined into
-   larger extents with only a meta update.
+   updated; the file offset and block start are immutable. A new
+   extent that is adjacent on the disk to the preceding extent of the
+   file is joined into it with only a meta update (see merge_extent()).
 
 */
 
-static fs_status create_extent(tfs fs, range blocks, boolean uninited, extent *ex)
+static fs_status create_extent(tfs fs, range blocks, u64 prealloc, boolean uninited, extent *ex)
 {
     assert(!fs->fs.ro);
     heap h = fs->fs.h;
-    u64 nblocks = MAX(range_span(blocks), MIN_EXTENT_SIZE >> fs->fs.blocksize_order);
-    nblocks = MIN(range_span(blocks), MAX_EXTENT_SIZE >> fs->fs.blocksize_order);
+    u64 nblocks = MIN(range_span(blocks) + prealloc, MAX_EXTENT_SIZE >> fs->fs.blocksize_order);
 
-    tfs_debug("create_extent: blocks %R, uninited %p, nblocks %ld\n", blocks, uninited, nblocks);
+    tfs_debug("create_extent: blocks %R, prealloc %ld, uninited %d, nblocks %ld\n", blocks,
+              prealloc, uninited, nblocks);
     if (!filesystem_reserve_log_space(fs, &fs->next_extend_log_offset, 0, 0) ||
         !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
         return FS_STATUS_NOSPACE;
@@ -420,23 +903,72 @@ static fs_status create_extent(tfs fs, range blocks, boolean uninited, extent *e
     return FS_STATUS_OK;
 }
 
+static void extent_release(tfs fs, extent ex)
+{
+    if (ex->uninited && ex->uninited != INVALID_ADDRESS)
+        refcount_release(&ex->uninited->refcount);
+    deallocate(fs->fs.h, ex, sizeof(*ex));
+}
+
 static void destroy_extent(tfs fs, extent ex)
 {
     range q = irangel(ex->start_block, ex->allocated);
     if (!filesystem_free_storage(fs, q))
         msg_err("failed to mark extent at %R as free", q);
-    if (ex->uninited && ex->uninited != INVALID_ADDRESS)
-        refcount_release(&ex->uninited->refcount);
-    deallocate(fs->fs.h, ex, sizeof(*ex));
+    extent_release(fs, ex);
 }
 
-static fs_status add_extent_to_file(tfsfile f, extent ex)
+static fs_status update_extent_allocated(tfsfile f, extent ex, u64 allocated);
+static fs_status update_extent_length(tfsfile f, extent ex, u64 new_length);
+
+/* Merge a new extent into the extent that precedes it in the file, if the storage of the former
+ * immediately follows the (fully used) storage of the latter: this only updates the meta of the
+ * existing extent instead of logging a new one, and keeps the extent map small. */
+static boolean merge_extent(tfsfile f, extent ex, fs_status *fss)
 {
+    if (ex->node.r.start == 0)
+        return false;
+    extent prev = (extent)rangemap_lookup(f->extentmap, ex->node.r.start - 1);
+    if (prev == INVALID_ADDRESS)
+        return false;
+    tfs fs = tfs_from_file(f);
+    u64 length = range_span(prev->node.r);
+    /* an extent sharing storage is not merged, as the previous extent would not be marked as
+     * shared */
+    if (prev->compressed || ex->compressed || ex->shared || (prev->uninited != ex->uninited) ||
+        (ex->uninited && (ex->uninited != INVALID_ADDRESS)) ||
+        (length != prev->allocated) || (prev->start_block + length != ex->start_block) ||
+        (length + ex->allocated > (MAX_EXTENT_SIZE >> fs->fs.blocksize_order)))
+        return false;
+    tfs_debug("%s: f %p, merging %R into %R\n", func_ss, f, ex->node.r, prev->node.r);
+    *fss = update_extent_allocated(f, prev, length + ex->allocated);
+    if (*fss != FS_STATUS_OK)
+        return false;
+    *fss = update_extent_length(f, prev, length + range_span(ex->node.r));
+    if (*fss != FS_STATUS_OK) {
+        /* the storage now belongs to the previous extent */
+        ex->allocated = 0;
+        return false;
+    }
+    return true;
+}
+
+static fs_status add_extent_to_file(tfsfile f, extent *exp)
+{
+    extent ex = *exp;
+    fs_status fss = FS_STATUS_OK;
+    if (merge_extent(f, ex, &fss)) {
+        *exp = (extent)rangemap_lookup(f->extentmap, ex->node.r.start);
+        deallocate(tfs_from_file(f)->fs.h, ex, sizeof(*ex));
+        return FS_STATUS_OK;
+    }
+    if (fss != FS_STATUS_OK)
+        return fss;
     tuple md = f->f.md;
     if (md) {
         tfs fs = tfs_from_file(f);
         tuple extents;
-        symbol a = sym(extents);
+        symbol a = sym_const(extents);
         if (!(extents = get_tuple(md, a))) {
             extents = allocate_tuple();
             fs_status s = filesystem_write_eav(fs, md, a, extents, false);
@@ -450,11 +982,15 @@ static fs_status add_extent_to_file(tfsfile f, extent ex)
         // XXX encode this as an immediate bitstring
         tuple e = allocate_tuple();
         ex->md = e;
-        set(e, sym(offset), value_from_u64(ex->start_block));
-        set(e, sym(length), value_from_u64(range_span(ex->node.r)));
-        set(e, sym(allocated), value_from_u64(ex->allocated));
+        set(e, sym_const(offset), value_from_u64(ex->start_block));
+        set(e, sym_const(length), value_from_u64(range_span(ex->node.r)));
+        set(e, sym_const(allocated), value_from_u64(ex->allocated));
         if (ex->uninited == INVALID_ADDRESS)
-            set(e, sym(uninited), null_value);
+            set(e, sym_const(uninited), null_value);
+        if (ex->compressed)
+            set(e, sym_const(compressed), value_from_u64(ex->compressed));
+        if (ex->shared)
+            set(e, sym_const(shared), null_value);
         symbol offs = intern_u64(ex->node.r.start);
         fs_status s = filesystem_write_eav(fs, extents, offs, e, false);
         if (s != FS_STATUS_OK) {
@@ -466,7 +1002,8 @@ static fs_status add_extent_to_file(tfsfile f, extent ex)
     }
     tfs_debug("%s: f %p, reserve %R\n", func_ss, f, ex->node.r);
     if (!rangemap_insert(f->extentmap, &ex->node)) {
-        rbtree_dump(&f->extentmap->t, RB_INORDER);
+        rangemap_foreach(f->extentmap, n)
+            rprintf(" %R", n->r);
         assert(0);
     }
     return FS_STATUS_OK;
@@ -479,7 +1016,7 @@ static void remove_extent_from_file(tfsfile f, extent ex)
 
     tuple md = f->f.md;
     if (md) {
-        tuple extents = get(md, sym(extents));
+        tuple extents = get(md, sym_const(extents));
         assert(extents);
         symbol offs = intern_u64(ex->node.r.start);
         filesystem_write_eav(tfs_from_file(f), extents, offs, 0, false);
@@ -493,7 +1030,7 @@ static fs_status add_extents(tfs fs, range i, rangemap rm)
     extent ex;
     fs_status fss;
     while (range_span(i)) {
-        fss = create_extent(fs, i, true, &ex);
+        fss = create_extent(fs, i, 0, true, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
@@ -545,11 +1082,17 @@ static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
     tfs_debug("   %s: ex %p, uninited %p, sg %p, m %p, blocks %R, write %R\n",
               func_ss, ex, ex->uninited, sg, m, blocks, r);
 
+    if (ex->compressed) {
+        /* compressed extents (created by mkfs for read-only images) cannot be modified */
+        apply(apply_merge(m), timm("result", "cannot write to compressed extent"));
+        return i.end;
+    }
+
     if (ex->uninited == INVALID_ADDRESS) {
         /* Begin process of normalizing uninited extent */
         if (f->f.md) {
             assert(ex->md);
-            symbol a = sym(uninited);
+            symbol a = sym_const(uninited);
             tfs_debug("%s: log write %p, %p\n", func_ss, ex->md, a);
             fs_status fss = filesystem_write_eav(fs, ex->md, a, 0, false);
             if (fss != FS_STATUS_OK) {
@@ -593,16 +1136,16 @@ static u64 write_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m)
     return i.end;
 }
 
-static fs_status fill_gap(tfsfile f, sg_list sg, range blocks, merge m, u64 *edge)
+static fs_status fill_gap(tfsfile f, sg_list sg, range blocks, u64 prealloc, merge m, u64 *edge)
 {
     tfs_debug("   %s: writing new extent blocks %R\n", func_ss, blocks);
     extent ex;
     tfs fs = tfs_from_file(f);
-    fs_status fss = create_extent(fs, blocks, m ? false : true, &ex);
+    fs_status fss = create_extent(fs, blocks, prealloc, m ? false : true, &ex);
     if (fss != FS_STATUS_OK)
         return fss;
     blocks = ex->node.r;
-    fss = add_extent_to_file(f, ex);
+    fss = add_extent_to_file(f, &ex);
     if (fss != FS_STATUS_OK) {
         destroy_extent(fs, ex);
         return fss;
@@ -613,6 +1156,54 @@ static fs_status fill_gap(tfsfile f, sg_list sg, range blocks, merge m, u64 *edg
     return FS_STATUS_OK;
 }
 
+/* Write file blocks to a new extent, bypassing the page cache (used by mkfs). If compressed is
+ * non-zero, data holds that many bytes of LZ4-compressed contents for the blocks, otherwise the
+ * blocks themselves; in both cases the data buffer must be padded to a whole number of blocks and
+ * remain valid until the write completes. */
+fs_status filesystem_write_extent(tfsfile f, range blocks, void *data, u64 compressed,
+                                  status_handler complete)
+{
+    tfs fs = tfs_from_file(f);
+    int order = fs->fs.blocksize_order;
+    u64 nblocks = compressed ? (pad(compressed, U64_FROM_BIT(order)) >> order) : range_span(blocks);
+    tfs_debug("%s: f %p, blocks %R, compressed %ld\n", func_ss, f, blocks, compressed);
+    u64 start_block = filesystem_allocate_storage(fs, nblocks);
+    if (start_block == INVALID_PHYSICAL)
+        return FS_STATUS_NOSPACE;
+    range storage_blocks = irangel(start_block, nblocks);
+    extent ex = allocate_extent(fs->fs.h, blocks, storage_blocks);
+    if (ex == INVALID_ADDRESS) {
+        filesystem_free_storage(fs, storage_blocks);
+        return FS_STATUS_NOMEM;
+    }
+    ex->md = 0;
+    ex->compressed = compressed;
+    fs_status fss = add_extent_to_file(f, &ex);
+    if (fss != FS_STATUS_OK) {
+        destroy_extent(fs, ex);
+        return fss;
+    }
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    sg_buf sgb = sg_list_tail_add(sg, nblocks << order);
+    if (sgb == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        return FS_STATUS_NOMEM;
+    }
+    sgb->buf = data;
+    sgb->offset = 0;
+    sgb->size = nblocks << order;
+    sgb->refcount = 0;
+    status_handler sh = closure(fs->fs.h, zero_blocks_complete, sg, complete);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        return FS_STATUS_NOMEM;
+    }
+    filesystem_storage_op(fs, sg, storage_blocks, true, sh);
+    return FS_STATUS_OK;
+}
+
 static fs_status update_extent(tfsfile f, extent ex, symbol l, u64 val)
 {
     if (f->f.md) {
@@ -632,7 +1223,7 @@ static fs_status update_extent(tfsfile f, extent ex, symbol l, u64 val)
 
 static fs_status update_extent_allocated(tfsfile f, extent ex, u64 allocated)
 {
-    fs_status s = update_extent(f, ex, sym(allocated), allocated);
+    fs_status s = update_extent(f, ex, sym_const(allocated), allocated);
     if (s != FS_STATUS_OK)
         return s;
     tfs_debug("   %s: was 0x%lx, now 0x%lx\n", func_ss, ex->allocated, allocated);
@@ -642,29 +1233,139 @@ static fs_status update_extent_allocated(tfsfile f, extent ex, u64 allocated)
 
 static fs_status update_extent_length(tfsfile f, extent ex, u64 new_length)
 {
-    fs_status s = update_extent(f, ex, sym(length), new_length);
+    fs_status s = update_extent(f, ex, sym_const(length), new_length);
     if (s != FS_STATUS_OK)
         return s;
 
-    /* TODO cheating; should be reinsert - update rangemap interface? */
     tfs_debug("   %s: was %R\n", func_ss, ex->node.r);
     ex->node.r = irangel(ex->node.r.start, new_length);
+    rangemap_update_node(f->extentmap, &ex->node);
     tfs_debug("   %s: now %R\n", func_ss, ex->node.r);
     return FS_STATUS_OK;
 }
 
-static fs_status extend(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *edge)
+/* Removes a range of blocks from an extent and releases their storage: the part of the extent
+ * before the range (if any) stays in the extent, and the part after the range (if any) becomes a
+ * new extent. */
+static fs_status punch_extent(tfsfile f, extent ex, range i)
+{
+    tfs fs = tfs_from_file(f);
+    range r = ex->node.r;
+    tfs_debug("%s: f %p, extent %R, punch %R\n", func_ss, f, r, i);
+    if (ex->compressed && !range_contains(i, r))
+        return FS_STATUS_INVAL;
+    range storage = irange(ex->start_block + (i.start - r.start), ex->start_block + ex->allocated);
+    extent tail = 0;
+    if (i.end < r.end) {
+        u64 tail_start = ex->start_block + (i.end - r.start);
+        tail = allocate_extent(fs->fs.h, irange(i.end, r.end), irange(tail_start, storage.end));
+        if (tail == INVALID_ADDRESS)
+            return FS_STATUS_NOMEM;
+        tail->md = 0;
+        tail->uninited = ex->uninited;
+        if (tail->uninited && (tail->uninited != INVALID_ADDRESS))
+            refcount_reserve(&tail->uninited->refcount);
+        tail->shared = ex->shared;
+        storage.end = tail_start;
+    }
+    fs_status fss = FS_STATUS_OK;
+    if (i.start > r.start) {
+        u64 length = i.start - r.start;
+        fss = update_extent_length(f, ex, length);
+        if (fss == FS_STATUS_OK)
+            fss = update_extent_allocated(f, ex, length);
+    } else {
+        remove_extent_from_file(f, ex);
+        extent_release(fs, ex);
+    }
+    if (fss != FS_STATUS_OK) {
+        /* the storage stays with the extent */
+        if (tail)
+            extent_release(fs, tail);
+        return fss;
+    }
+    if (tail) {
+        fss = add_extent_to_file(f, &tail);
+        if (fss != FS_STATUS_OK)
+            destroy_extent(fs, tail);
+    }
+    if (range_span(storage) && !filesystem_free_storage(fs, storage))
+        msg_err("failed to mark extent at %R as free", storage);
+    return fss;
+}
+
+static boolean extent_storage_is_shared(tfs fs, extent ex, range blocks)
+{
+    range i = range_intersection(blocks, ex->node.r);
+    range storage = irangel(ex->start_block + (i.start - ex->node.r.start), range_span(i));
+    tfs_storage_lock(fs);
+    boolean shared = rangemap_range_intersects(fs->shared, storage);
+    tfs_storage_unlock(fs);
+    return shared;
+}
+
+/* Copy-on-write of extent blocks whose storage is shared with other extents: the written blocks
+ * are removed from the extent and written to newly allocated storage (zeroed blocks are left as a
+ * hole). */
+static fs_status unshare_extent(tfsfile f, extent ex, sg_list sg, range blocks, merge m, u64 *edge)
+{
+    range i = range_intersection(blocks, ex->node.r);
+    tfs_debug("%s: f %p, extent %R, write %R\n", func_ss, f, ex->node.r, i);
+    fs_status fss = punch_extent(f, ex, i);
+    if (fss != FS_STATUS_OK)
+        return fss;
+    if (sg) {
+        while (i.start < i.end) {
+            fss = fill_gap(f, sg, i, 0, m, &i.start);
+            if (fss != FS_STATUS_OK)
+                return fss;
+        }
+    }
+    *edge = i.end;
+    return FS_STATUS_OK;
+}
+
+static fs_status extent_set_shared(tfsfile f, extent ex)
+{
+    if (ex->shared)
+        return FS_STATUS_OK;
+    if (f->f.md) {
+        assert(ex->md);
+        symbol a = sym_const(shared);
+        fs_status fss = filesystem_write_eav(tfs_from_file(f), ex->md, a, null_value, false);
+        if (fss != FS_STATUS_OK)
+            return fss;
+        set(ex->md, a, null_value);
+        f->f.status |= FSF_DIRTY_DATASYNC;
+    }
+    ex->shared = true;
+    return FS_STATUS_OK;
+}
+
+static fs_status extend(tfsfile f, extent ex, sg_list sg, range blocks, u64 prealloc, merge m,
+                        u64 *edge)
 {
     tfs fs = tfs_from_file(f);
-    blocks.end = MIN(blocks.end, ex->node.r.start + (MAX_EXTENT_SIZE >> fs->fs.blocksize_order));
+    u64 max_blocks = MAX_EXTENT_SIZE >> fs->fs.blocksize_order;
+    blocks.end = MIN(blocks.end, ex->node.r.start + max_blocks);
     u64 free = ex->allocated - range_span(ex->node.r);
     range r = irangel(ex->node.r.end, free);
     if (blocks.end > r.end) {
         range new = irangel(ex->start_block + ex->allocated, blocks.end - r.end);
-        u64 limit = fs->fs.size >> fs->fs.blocksize_order;
+        u64 limit = MIN(fs->fs.size >> fs->fs.blocksize_order, ex->start_block + max_blocks);
         if (new.end > limit)
             new.end = limit;
-        if (range_span(new) && filesystem_reserve_storage(fs, new)) {
+        boolean reserved = false;
+        if (prealloc) {
+            range p = irange(new.start, MIN(new.end + prealloc, limit));
+            if ((p.end > new.end) && filesystem_reserve_storage(fs, p)) {
+                new = p;
+                reserved = true;
+            }
+        }
+        if (!reserved)
+            reserved = range_span(new) && filesystem_reserve_storage(fs, new);
+        if (reserved) {
             fs_status s = update_extent_allocated(f, ex, ex->allocated + range_span(new));
             if (s == FS_STATUS_OK) {
                 r.end = blocks.end;
@@ -704,6 +1405,22 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
     range blocks = range_rshift_pad(q, fs->fs.blocksize_order);
     tfs_debug("%s: file %p blocks %R sg %p m %p\n", func_ss, f, blocks, sg, m);
     assert(!sg || sg->count >= range_span(blocks) << fs->fs.blocksize_order);
+    fs_status fss;
+
+    if (!m) {
+        /* Delayed allocation: only reserve space for the blocks that are not backed by storage;
+         * extents are created when the data is written back. */
+        fss = tfs_delalloc_reserve(fs, f, blocks);
+        if (fss != FS_STATUS_OK) {
+            status s = timm("result", "unable to reserve storage");
+            return timm_append(s, "fsstatus", "%d", fss);
+        }
+        goto update_length;
+    }
+
+    /* The written (or zeroed) range is about to be backed by extents (or discarded), so its
+     * reservation can be returned before allocating storage for it. */
+    tfs_delalloc_release(fs, f, blocks);
 
     rmnode prev;            /* prior to edge, but could be extended */
     rmnode next;            /* intersecting or succeeding */
@@ -719,16 +1436,26 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
         next = rangemap_next_node(f->extentmap, prev);
     }
 
+    /* Writes that continue the allocated part of the file allocate additional storage past their
+     * end, proportionally to the file size, so that a file growing through many writebacks ends up
+     * with few extents. */
+    u64 prealloc = 0;
+    if (sg && ((prev != INVALID_ADDRESS) ? (prev->r.end == blocks.start) :
+               ((next != INVALID_ADDRESS) && (next->r.start <= blocks.start))))
+        prealloc = MIN(blocks.start, MAX_PREALLOC_SIZE >> fs->fs.blocksize_order);
+
     do {
         tfs_debug("   prev %p, next %p\n", prev, next);
         u64 limit = next == INVALID_ADDRESS ? blocks.end : MIN(blocks.end, next->r.start);
-        fs_status fss;
-        if (!m || sg) {
+        u64 pa = (next == INVALID_ADDRESS) ? prealloc : 0;
+        if (sg) {
             if (blocks.start < limit) {
                 /* try to extend previous node */
-                if (prev != INVALID_ADDRESS && prev->r.end < limit) {
+                if (prev != INVALID_ADDRESS && prev->r.end < limit &&
+                    !((extent)prev)->compressed) {
                     tfs_debug("   extent start 0x%lx, limit 0x%lx\n", blocks.start, limit);
-                    fss = extend(f, (extent)prev, sg, irange(blocks.start, limit), m, &blocks.start);
+                    fss = extend(f, (extent)prev, sg, irange(blocks.start, limit), pa, m,
+                                 &blocks.start);
                     if (fss != FS_STATUS_OK) {
                         status s = timm("result", "unable to extend extent");
                         return timm_append(s, "fsstatus", "%d", fss);
@@ -738,7 +1465,7 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
                 /* fill space */
                 while (blocks.start < limit) {
                     tfs_debug("   fill start 0x%lx, limit 0x%lx\n", blocks.start, limit);
-                    fss = fill_gap(f, sg, irange(blocks.start, limit), m, &blocks.start);
+                    fss = fill_gap(f, sg, irange(blocks.start, limit), pa, m, &blocks.start);
                     if (fss != FS_STATUS_OK) {
                         status s = timm("result", "unable to create extent");
                         return timm_append(s, "fsstatus", "%d", fss);
@@ -762,15 +1489,25 @@ static status extents_range_handler(tfs fs, tfsfile f, range q, sg_list sg, merg
                 prev = INVALID_ADDRESS; /* prev isn't used in zero, but just to be safe */
             } else if (blocks.end > ex->node.r.start) {
                 /* TODO: improve write_extent to trim extent on zero */
-                if (m)
+                if (m && ex->shared && !ex->compressed &&
+                    extent_storage_is_shared(fs, ex, blocks)) {
+                    fss = unshare_extent(f, ex, sg, blocks, m, &blocks.start);
+                    if (fss != FS_STATUS_OK) {
+                        status s = timm("result", "unable to unshare extent");
+                        return timm_append(s, "fsstatus", "%d", fss);
+                    }
+                    prev = INVALID_ADDRESS; /* the extent may have been removed */
+                } else if (m) {
                     blocks.start = write_extent(f, ex, sg, blocks, m);
-                else
+                } else {
                     blocks.start = range_intersection(blocks, ex->node.r).end;
+                }
             }
         }
         assert(blocks.start <= blocks.end); // XXX tmp
     } while (range_span(blocks) > 0);
 
+  update_length:
     if (fsfile_get_length(&f->f) < q.end) {
         tfs_debug("   append; update length to %ld\n", q.end);
         fs_status fss = filesystem_truncate_locked(&fs->fs, &f->f, q.end);
@@ -823,8 +1560,170 @@ closure_function(2, 3, void, filesystem_storage_write,
     apply(sh, s);
 }
 
-closure_function(3, 1, void, fs_cache_sync_complete,
-                 tfs, fs, status_handler, completion, boolean, flush_log,
+static void tfs_device_flush(tfs fs)
+{
+    struct storage_req req = {
+        .op = STORAGE_OP_FLUSH,
+        .blocks = irange(0, 0),
+        .completion = (status_handler)&fs->flush_complete,
+    };
+    apply(fs->req_handler, &req);
+}
+
+closure_func_basic(status_handler, void, tfs_flush_complete,
+                   status s)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, flush_complete);
+    status_handler sh;
+    vector_foreach(fs->flush_waiters, sh)
+#ifdef KERNEL
+        async_apply_status_handler(sh, s);
+#else
+        apply(sh, s);
+#endif
+    vector_clear(fs->flush_waiters);
+    tfs_flush_lock(fs);
+    boolean again = (vector_length(fs->flush_pending) != 0);
+    if (again) {
+        vector v = fs->flush_waiters;
+        fs->flush_waiters = fs->flush_pending;
+        fs->flush_pending = v;
+    } else {
+        fs->flushing = false;
+    }
+    tfs_flush_unlock(fs);
+    if (again)
+        tfs_device_flush(fs);
+}
+
+/* A device cache flush issued before a write completed does not cover that write: flushes requested
+ * while a flush is in progress are coalesced into a single flush, issued when the current flush
+ * completes. */
+static void tfs_flush(tfs fs, status_handler completion)
+{
+    tfs_flush_lock(fs);
+    vector_push(fs->flushing ? fs->flush_pending : fs->flush_waiters, completion);
+    boolean start = !fs->flushing;
+    fs->flushing = true;
+    tfs_flush_unlock(fs);
+    if (start)
+        tfs_device_flush(fs);
+}
+
+#ifdef KERNEL
+
+/* Frees the blocks of the current discard batch and completes the requests waiting for it. */
+static void tfs_discard_done(tfs fs, status s)
+{
+    tfs_storage_lock(fs);
+    rmnode n;
+    while ((n = rangemap_first_node(fs->discard_inflight)) != INVALID_ADDRESS) {
+        if (rangemap_insert_hole(fs->storage, n->r))
+            fs->used_blocks -= range_span(n->r);
+        rangemap_remove_range(fs->discard_inflight, n);
+    }
+    if (!fs->discard)
+        tfs_discard_cancel(fs);
+    status_handler sh;
+    vector_foreach(fs->discard_waiters, sh)
+        async_apply_status_handler(sh, s);
+    vector_clear(fs->discard_waiters);
+    boolean again = fs->discard &&
+            (fs->discard_pending_blocks >= (TFS_DISCARD_BATCH_SIZE >> fs->fs.blocksize_order));
+    fs->discarding = again;
+    tfs_storage_unlock(fs);
+    if (again)
+        async_apply(fs->discard_thunk);
+}
+
+/* A block can only be discarded after the log entries that free it have been persisted: a discard
+ * batch flushes the log and the device cache before issuing its discard requests. */
+closure_func_basic(thunk, void, tfs_discard_start)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, discard_start);
+    tfs_storage_lock(fs);
+    rangemap batch = fs->discard_pending;
+    fs->discard_pending = fs->discard_inflight;
+    fs->discard_inflight = batch;
+    fs->discard_pending_blocks = 0;
+    tfs_storage_unlock(fs);
+    tfs_debug("%s: fs %p\n", func_ss, fs);
+    filesystem_lock(&fs->fs);
+    log_flush(fs->tl, (status_handler)&fs->discard_logged);
+    filesystem_unlock(&fs->fs);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_logged,
+                   status s)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, discard_logged);
+    if (is_ok(s))
+        tfs_flush(fs, (status_handler)&fs->discard_flushed);
+    else
+        tfs_discard_done(fs, s);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_flushed,
+                   status s)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, discard_flushed);
+    if (!is_ok(s)) {
+        tfs_discard_done(fs, s);
+        return;
+    }
+    merge m = allocate_merge(fs->fs.h, (status_handler)&fs->discard_complete);
+    status_handler sh = apply_merge(m);
+    rangemap_foreach(fs->discard_inflight, n) {
+        tfs_debug("  discarding %R\n", n->r);
+        struct storage_req req = {
+            .op = STORAGE_OP_DISCARD,
+            .blocks = n->r,
+            .completion = apply_merge(m),
+        };
+        apply(fs->req_handler, &req);
+    }
+    apply(sh, STATUS_OK);
+}
+
+closure_func_basic(status_handler, void, tfs_discard_complete,
+                   status s)
+{
+    tfs fs = struct_from_field(closure_self(), tfs, discard_complete);
+    if (!is_ok(s)) {
+        /* the device does not support discard requests (or failed one): stop deferring the release
+         * of freed blocks */
+        tfs_debug("%s: fs %p, status %v\n", func_ss, fs, s);
+        fs->discard = false;
+        timm_dealloc(s);
+    }
+    tfs_discard_done(fs, STATUS_OK);
+}
+
+/* Flushes the device cache, then waits for the discard batch in progress, if any; if no batch is in
+ * progress, the blocks freed since the last batch are discarded (the batch flushes the device
+ * cache). */
+static void tfs_discard(tfs fs, status_handler completion)
+{
+    merge m = allocate_merge(fs->fs.h, completion);
+    status_handler sh = apply_merge(m);
+    tfs_storage_lock(fs);
+    boolean start = !fs->discarding && (fs->discard_pending_blocks != 0);
+    if (start)
+        fs->discarding = true;
+    if (fs->discarding)
+        vector_push(fs->discard_waiters, apply_merge(m));
+    tfs_storage_unlock(fs);
+    if (start)
+        apply(fs->discard_thunk);
+    else
+        tfs_flush(fs, apply_merge(m));
+    apply(sh, STATUS_OK);
+}
+
+#endif
+
+closure_function(4, 1, void, fs_cache_sync_complete,
+                 tfs, fs, status_handler, completion, boolean, flush_log, boolean, discard,
                  status s)
 {
     if (!is_ok(s)) {
@@ -844,12 +1743,12 @@ closure_function(3, 1, void, fs_cache_sync_complete,
         filesystem_unlock(&fs->fs);
         return;
     }
-    struct storage_req req = {
-        .op = STORAGE_OP_FLUSH,
-        .blocks = irange(0, 0),
-        .completion = bound(completion),
-    };
-    apply(bound(fs)->req_handler, &req);
+#ifdef KERNEL
+    if (bound(discard))
+        tfs_discard(bound(fs), bound(completion));
+    else
+#endif
+        tfs_flush(bound(fs), bound(completion));
     closure_finish();
 }
 
@@ -861,7 +1760,8 @@ static status_handler tfs_get_sync_handler(filesystem fs, fsfile fsf, boolean da
         flush_log = datasync ? (fsf->status & FSF_DIRTY_DATASYNC) : (fsf->status & FSF_DIRTY);
     else
         flush_log = true;
-    return closure(fs->h, fs_cache_sync_complete, (tfs)fs, completion, flush_log);
+    /* a volume sync (e.g. before unmounting) also waits for freed storage to be discarded */
+    return closure(fs->h, fs_cache_sync_complete, (tfs)fs, completion, flush_log, !fsf);
 }
 
 closure_function(2, 1, void, filesystem_op_complete,
@@ -892,7 +1792,8 @@ static fs_status add_extents_to_file(tfsfile f, rangemap rm)
     tfs_debug("%s: tuple %p\n", func_ss, f->f.md);
     rangemap_foreach(rm, node) {
         rangemap_remove_node(rm, node);
-        fs_status s = add_extent_to_file(f, (extent) node);
+        extent ex = (extent)node;
+        fs_status s = add_extent_to_file(f, &ex);
         if (s != FS_STATUS_OK)
             return s;
     }
@@ -946,6 +1847,7 @@ void filesystem_alloc(fsfile f, long offset, long len,
     status = add_extents_to_file(fsf, new_rm);
     if (status != FS_STATUS_OK)
         goto done;
+    tfs_delalloc_release(tfs, fsf, blocks);
     u64 end = offset + len;
     if (!keep_size && (end > fsfile_get_length(f))) {
         status = filesystem_truncate_locked(fs, f, end);
@@ -974,6 +1876,140 @@ void filesystem_dealloc(fsfile f, long offset, long len,
     filesystem_write_sg(f, 0, irangel(offset, len), sh);
 }
 
+/* Returns the first extent of a file intersecting a range of blocks, or the extent following a
+ * given one if it intersects the range. */
+static extent extent_in_range(tfsfile f, extent prev, range blocks)
+{
+    rmnode n = prev ? rangemap_next_node(f->extentmap, &prev->node) :
+                      rangemap_lookup_at_or_next(f->extentmap, blocks.start);
+    return ((n != INVALID_ADDRESS) && (n->r.start < blocks.end)) ? (extent)n : INVALID_ADDRESS;
+}
+
+/* Replaces the destination range (in blocks) with extents sharing the storage of the source
+ * range. */
+static fs_status clone_extents(tfsfile in, range src, tfsfile out, u64 dst)
+{
+    tfs fs = (tfs)in->f.fs;
+    range dst_blocks = irangel(dst, range_span(src));
+    tfs_debug("%s: in %p, blocks %R, out %p, blocks %R\n", func_ss, in, src, out, dst_blocks);
+    extent ex;
+    for (ex = extent_in_range(in, 0, src); ex != INVALID_ADDRESS; ex = extent_in_range(in, ex, src))
+        if (ex->compressed)
+            return FS_STATUS_INVAL;
+    fs_status fss;
+    tfs_delalloc_release(fs, out, dst_blocks);
+    while ((ex = extent_in_range(out, 0, dst_blocks)) != INVALID_ADDRESS) {
+        fss = punch_extent(out, ex, range_intersection(ex->node.r, dst_blocks));
+        if (fss != FS_STATUS_OK)
+            return fss;
+    }
+    for (ex = extent_in_range(in, 0, src); ex != INVALID_ADDRESS; ex = extent_in_range(in, ex, src)) {
+        /* unwritten extents are left as holes in the destination */
+        if (ex->uninited == INVALID_ADDRESS)
+            continue;
+        range i = range_intersection(ex->node.r, src);
+        range storage = irangel(ex->start_block + (i.start - ex->node.r.start), range_span(i));
+        fss = extent_set_shared(in, ex);
+        if (fss != FS_STATUS_OK)
+            return fss;
+        extent clone = allocate_extent(fs->fs.h, range_add(i, dst - src.start), storage);
+        if (clone == INVALID_ADDRESS)
+            return FS_STATUS_NOMEM;
+        clone->md = 0;
+        clone->shared = true;
+        tfs_storage_lock(fs);
+        boolean referenced = tfs_storage_ref(fs, storage);
+        tfs_storage_unlock(fs);
+        if (!referenced) {
+            deallocate(fs->fs.h, clone, sizeof(*clone));
+            return FS_STATUS_NOMEM;
+        }
+        fss = add_extent_to_file(out, &clone);
+        if (fss != FS_STATUS_OK) {
+            destroy_extent(fs, clone);
+            return fss;
+        }
+    }
+    return FS_STATUS_OK;
+}
+
+closure_function(6, 1, void, filesystem_clone_synced,
+                 tfsfile, in, u64, in_offset, tfsfile, out, u64, out_offset, u64, len, fs_status_handler, completion,
+                 status s)
+{
+    tfsfile in = bound(in);
+    tfsfile out = bound(out);
+    u64 out_offset = bound(out_offset);
+    u64 len = bound(len);
+    fs_status fss;
+    if (is_ok(s)) {
+        filesystem fs = in->f.fs;
+        int order = fs->blocksize_order;
+        filesystem_lock(fs);
+        fss = clone_extents(in, range_rshift_pad(irangel(bound(in_offset), len), order), out,
+                            out_offset >> order);
+        if ((fss == FS_STATUS_OK) && (fsfile_get_length(&out->f) < out_offset + len))
+            fss = filesystem_truncate_locked(fs, &out->f, out_offset + len);
+        filesystem_unlock(fs);
+
+        /* cached pages of the destination range have stale contents */
+        pagecache_node_invalidate(out->f.cache_node, irangel(out_offset, len));
+    } else {
+        timm_dealloc(s);
+        fss = FS_STATUS_IOERR;
+    }
+    apply(bound(completion), &out->f, fss);
+    closure_finish();
+}
+
+/* Clones a range of a file into a range of another file (or of the same file) of the same
+ * filesystem: both files share the storage of the range, which is copied on write. Offsets must be
+ * aligned to the filesystem block size, and so must the length, unless the range extends to the
+ * end of the source file and the destination range extends to (or past) the end of the destination
+ * file. The completion is invoked only if the function returns FS_STATUS_OK. */
+fs_status filesystem_clone(fsfile in, u64 in_offset, fsfile out, u64 out_offset, u64 len,
+                           fs_status_handler completion)
+{
+    filesystem fs = in->fs;
+    if (out->fs != fs)
+        return FS_STATUS_XDEV;
+    if (!fs_is_tfs(fs))
+        return FS_STATUS_INVAL;
+    if (fs->ro)
+        return FS_STATUS_READONLY;
+    u64 mask = MASK(fs->blocksize_order);
+    if ((in_offset & mask) || (out_offset & mask) ||
+        ((len & mask) && ((in_offset + len < fsfile_get_length(in)) ||
+                          (out_offset + len < fsfile_get_length(out)))))
+        return FS_STATUS_INVAL;
+    if ((in == out) &&
+        range_span(range_intersection(irangel(in_offset, len), irangel(out_offset, len))))
+        return FS_STATUS_INVAL;
+    if (len == 0) {
+        apply(completion, out, FS_STATUS_OK);
+        return FS_STATUS_OK;
+    }
+    tfs_debug("%s: in %p offset %ld, out %p offset %ld, len %ld\n", func_ss, in, in_offset,
+              out, out_offset, len);
+
+    /* extents are cloned once the data cached for both files has been written back */
+    status_handler sh = closure(fs->h, filesystem_clone_synced, (tfsfile)in, in_offset,
+                                (tfsfile)out, out_offset, len, completion);
+    if (sh == INVALID_ADDRESS)
+        return FS_STATUS_NOMEM;
+    merge m = allocate_merge(fs->h, sh);
+    if (m == INVALID_ADDRESS) {
+        deallocate_closure(sh);
+        return FS_STATUS_NOMEM;
+    }
+    status_handler k = apply_merge(m);
+    pagecache_sync_node(in->cache_node, apply_merge(m));
+    if (out != in)
+        pagecache_sync_node(out->cache_node, apply_merge(m));
+    apply(k, STATUS_OK);
+    return FS_STATUS_OK;
+}
+
 closure_func_basic(binding_handler, boolean, cleanup_directory_each,
                    value s, value v)
 {
@@ -984,9 +2020,10 @@ closure_func_basic(binding_handler, boolean, cleanup_directory_each,
 
 static tuple cleanup_directory(tuple n)
 {
-    tuple parent = table_remove(&n->t, sym(..));
+    tuple parent = get(n, sym(..));
     if (!parent)
         return 0;
+    set(n, sym(..), 0);
     tuple c = children(n);
     if (c)
         iterate(c, stack_closure_func(binding_handler, cleanup_directory_each));
@@ -1001,6 +2038,12 @@ static void destruct_dir_entry(tuple n)
 
 static boolean tfs_file_unlink(tfs fs, tuple t)
 {
+    /* an unlinked file frees its storage when its fsfile is released */
+    if ((table_find(fs->files, t) == TFSFILE_UNLOADED) &&
+        (tfs_load_fsfile(fs, t) == INVALID_ADDRESS)) {
+        msg_err("failed to load file %p; storage not freed\n", t);
+        table_set(fs->files, t, INVALID_ADDRESS);
+    }
     fs_unlink(fs->files, t);
 
     /* If a tuple is not present in the filesystem log dictionary, it can (and should) be destroyed
@@ -1113,6 +2156,8 @@ tfsfile allocate_fsfile(tfs fs, tuple md);
 static void deallocate_fsfile(tfs fs, tfsfile f, rmnode_handler extent_destructor)
 {
     deallocate_rangemap(f->extentmap, extent_destructor);
+    tfs_delalloc_release(fs, f, irange(0, infinity));
+    deallocate_rangemap(f->delalloc, stack_closure_func(rmnode_handler, assert_no_node));
     pagecache_deallocate_node(f->f.cache_node);
     deallocate(fs->fs.h, f, sizeof(*f));
 }
@@ -1186,21 +2231,13 @@ static fs_status tfs_rename(filesystem fs, tuple old_parent, string old_name, tu
     return s;
 }
 
-closure_function(1, 1, boolean, tfs_storage_freeblocks,
-                 u64 *, free_blocks,
-                 range r)
-{
-    *bound(free_blocks) += range_span(r);
-    return true;
- }
-
+/* Blocks reserved for delayed allocation are not free, even though they are not in the storage
+ * map yet. */
 static u64 tfs_freeblocks(filesystem fs)
 {
-    u64 free_blocks = 0;
-    range q = irangel(0, fs->size >> fs->blocksize_order);
     tfs tfs = (struct tfs *)fs;
     tfs_storage_lock(tfs);
-    rangemap_range_find_gaps(tfs->storage, q, stack_closure(tfs_storage_freeblocks, &free_blocks));
+    u64 free_blocks = (fs->size >> fs->blocksize_order) - tfs->used_blocks - tfs->delalloc_blocks;
     tfs_storage_unlock(tfs);
     return free_blocks;
 }
@@ -1288,7 +2325,10 @@ tfsfile allocate_fsfile(tfs fs, tuple md)
         deallocate(h, f, sizeof(struct tfsfile));
         return INVALID_ADDRESS;
     }
-    f->extentmap = allocate_rangemap(h);
+    f->extentmap = allocate_rangemap_btree(h, 0);
+#ifndef TFS_READ_ONLY
+    f->delalloc = allocate_rangemap(h);
+#endif
     fsf->get_blocks = tfsfile_get_blocks;
     if (md)
         table_set(fs->files, md, f);
@@ -1299,6 +2339,8 @@ tfsfile allocate_fsfile(tfs fs, tuple md)
 fsfile fsfile_from_node(filesystem fs, tuple n)
 {
     fsfile fsf = table_find(((tfs)fs)->files, n);
+    if (fsf == TFSFILE_UNLOADED)
+        fsf = (fsfile)tfs_load_fsfile((tfs)fs, n);
     return (fsf != INVALID_ADDRESS) ? fsf : 0;
 }
 
@@ -1354,9 +2396,27 @@ boolean filesystem_reserve_log_space(tfs fs, u64 *next_offset, u64 *offset, u64
     return true;
 }
 
+/* Called with fs locked */
 static fs_status tfs_get_fsfile(filesystem fs, tuple n, fsfile *f)
 {
-    return fs_get_fsfile(((tfs)fs)->files, n, f);
+    tfs tfs = (struct tfs *)fs;
+    if ((table_find(tfs->files, n) == TFSFILE_UNLOADED) &&
+        (tfs_load_fsfile(tfs, n) == INVALID_ADDRESS))
+        return FS_STATUS_NOMEM;
+    return fs_get_fsfile(tfs->files, n, f);
+}
+
+/* Called with fs locked: stops at the first file for which the handler returns false; returns false
+ * if fs is not a TFS or the iteration has been stopped. */
+boolean tfs_foreach_loaded_file(filesystem fs, tfs_file_handler h)
+{
+    if (!fs_is_tfs(fs))
+        return false;
+    table_foreach(((tfs)fs)->files, k, v) {
+        if ((v != INVALID_ADDRESS) && (v != TFSFILE_UNLOADED) && !apply(h, k, v))
+            return false;
+    }
+    return true;
 }
 
 void create_filesystem(heap h,
@@ -1388,6 +2448,9 @@ void create_filesystem(heap h,
     fs->fs.get_fsfile = tfs_get_fsfile;
     fs->fs.get_inode = fs_get_inode;
     fs->fs.get_meta = tmpfs_get_meta;
+#ifdef KERNEL
+    filesystem_enable_dcache(&fs->fs);
+#endif
 #ifndef TFS_READ_ONLY
     fs->fs.create = tfs_create;
     fs->fs.unlink = tfs_unlink;
@@ -1398,10 +2461,39 @@ void create_filesystem(heap h,
     fs->fs.destroy_fs = destroy_filesystem;
     fs->storage = allocate_rangemap(h);
     assert(fs->storage != INVALID_ADDRESS);
+    fs->shared = allocate_rangemap(h);
+    assert(fs->shared != INVALID_ADDRESS);
     spin_lock_init(&fs->storage_lock);
+    spin_lock_init(&fs->flush_lock);
+    fs->flush_waiters = allocate_vector(h, 8);
+    assert(fs->flush_waiters != INVALID_ADDRESS);
+    fs->flush_pending = allocate_vector(h, 8);
+    assert(fs->flush_pending != INVALID_ADDRESS);
+    fs->flushing = false;
+    init_closure_func(&fs->flush_complete, status_handler, tfs_flush_complete);
+#ifdef KERNEL
+    fs->discard = fs->write_zeroes = !ro;
+    fs->discard_pending = allocate_rangemap(h);
+    assert(fs->discard_pending != INVALID_ADDRESS);
+    fs->discard_inflight = allocate_rangemap(h);
+    assert(fs->discard_inflight != INVALID_ADDRESS);
+    fs->discard_pending_blocks = 0;
+    fs->discarding = false;
+    fs->discard_waiters = allocate_vector(h, 8);
+    assert(fs->discard_waiters != INVALID_ADDRESS);
+    fs->discard_thunk = init_closure_func(&fs->discard_start, thunk, tfs_discard_start);
+    init_closure_func(&fs->discard_logged, status_handler, tfs_discard_logged);
+    init_closure_func(&fs->discard_flushed, status_handler, tfs_discard_flushed);
+    init_closure_func(&fs->discard_complete, status_handler, tfs_discard_complete);
+#else
+    fs->discard = fs->write_zeroes = false;
+#endif
+    fs->used_blocks = 0;
+    fs->delalloc_blocks = 0;
     fs->temp_log = 0;
 #else
     fs->storage = 0;
+    fs->shared = 0;
 #endif
     if (!sstring_is_null(label)) {
         int label_len = label.len;
@@ -1434,6 +2526,14 @@ closure_function(1, 1, boolean, tfs_storage_destroy,
     return false;
 }
 
+closure_function(1, 1, boolean, tfs_shared_destroy,
+                 heap, h,
+                 rmnode n)
+{
+    deallocate(bound(h), n, sizeof(struct tfs_shared));
+    return false;
+}
+
 /* If the filesystem is not read-only, this function can only be called after flushing any pending
  * writes. */
 void destroy_filesystem(filesystem fs)
@@ -1443,7 +2543,7 @@ void destroy_filesystem(filesystem fs)
     log_destroy(tfs->tl);
     table_foreach(tfs->files, k, v) {
         fs_notify_release(k, true);
-        if (v != INVALID_ADDRESS)
+        if ((v != INVALID_ADDRESS) && (v != TFSFILE_UNLOADED))
             deallocate_fsfile(tfs, v, stack_closure(dealloc_extent_node, fs));
     }
     if (fs->root)
@@ -1451,6 +2551,14 @@ void destroy_filesystem(filesystem fs)
     filesystem_deinit(fs);
     deallocate_table(tfs->files);
     deallocate_rangemap(tfs->storage, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_rangemap(tfs->shared, stack_closure(tfs_shared_destroy, fs->h));
+    deallocate_vector(tfs->flush_waiters);
+    deallocate_vector(tfs->flush_pending);
+#ifdef KERNEL
+    deallocate_rangemap(tfs->discard_pending, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_rangemap(tfs->discard_inflight, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_vector(tfs->discard_waiters);
+#endif
     deallocate(fs->h, fs, sizeof(*fs));
 }
 
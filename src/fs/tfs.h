@@ -8,6 +8,8 @@ extern io_status_handler ignore_io_status;
 #define MIN_EXTENT_SIZE PAGESIZE
 #define MAX_EXTENT_SIZE (PAGECACHE_MAX_SG_ENTRIES * PAGESIZE)
 #define MIN_EXTENT_ALLOC_SIZE   (1 * MB)
+#define MAX_PREALLOC_SIZE       (4 * MB)    /* speculative preallocation on file append */
+#define COMPRESSED_EXTENT_SIZE  (64 * KB)   /* file data per compressed extent (mkfs) */
 
 status filesystem_probe(u8 *first_sector, u8 *uuid, char *label);
 sstring filesystem_get_label(filesystem fs);
@@ -23,8 +25,21 @@ void create_filesystem(heap h,
 void destroy_filesystem(filesystem fs);
 
 fsfile fsfile_from_node(filesystem fs, tuple n);
+
+/* regular files whose contents have been accessed (see tfs_foreach_loaded_file()) */
+closure_type(tfs_file_handler, boolean, tuple md, fsfile f);
+boolean tfs_foreach_loaded_file(filesystem fs, tfs_file_handler h);
+
+/* Mapping of file blocks to storage blocks, for direct access to the storage of a filesystem that
+ * is not being modified: the handler is called for each run of file blocks stored contiguously,
+ * with INVALID_PHYSICAL as storage block for holes and uninitialized extents (which read as
+ * zeros). */
+closure_type(tfs_block_map_handler, boolean, range file_blocks, u64 storage_block);
+boolean tfsfile_map_blocks(fsfile f, range blocks, tfs_block_map_handler h);
 tfsfile allocate_fsfile(tfs fs, tuple md);
 
+fs_status filesystem_write_extent(tfsfile f, range blocks, void *data, u64 compressed,
+                                  status_handler complete);
 fs_status filesystem_write_tuple(tfs fs, tuple t);
 fs_status filesystem_write_eav(tfs fs, tuple t, symbol a, value v, boolean cleanup);
 
@@ -7,14 +7,18 @@
 #include <storage.h>
 #include <tfs.h>
 
-#define TFS_VERSION 0x00000005
+#define TFS_VERSION 0x00000006
+#define TFS_VERSION_NO_COMPACT  0x00000005  /* without compact log records */
 
 typedef struct log *log;
 
 typedef struct tfs {
     struct filesystem fs;   /* must be first */
     rangemap storage;
+    rangemap shared;            /* storage referenced by more than one extent, with reference counts */
     struct spinlock storage_lock;
+    u64 used_blocks;            /* blocks in the storage map */
+    u64 delalloc_blocks;        /* blocks reserved for delayed allocation */
     int alignment_order;        /* in blocks */
     int page_order;
     u8 uuid[UUID_LEN];
@@ -27,11 +31,29 @@ typedef struct tfs {
     log temp_log;
     u64 next_extend_log_offset;
     u64 next_new_log_offset;
+    struct spinlock flush_lock;
+    vector flush_waiters;       /* waiting for the device cache flush in progress */
+    vector flush_pending;       /* waiting for the next device cache flush */
+    boolean flushing;
+    closure_struct(status_handler, flush_complete);
+    boolean discard;            /* discard freed storage */
+    boolean write_zeroes;       /* zero storage without data transfers */
+    rangemap discard_pending;   /* freed blocks to be discarded by the next batch */
+    rangemap discard_inflight;  /* blocks being discarded by the current batch */
+    u64 discard_pending_blocks;
+    boolean discarding;
+    vector discard_waiters;     /* waiting for the current discard batch */
+    closure_struct(thunk, discard_start);
+    thunk discard_thunk;        /* starts a discard batch */
+    closure_struct(status_handler, discard_logged);
+    closure_struct(status_handler, discard_flushed);
+    closure_struct(status_handler, discard_complete);
 } *tfs;
 
 typedef struct tfsfile {
     struct fsfile f;    /* must be first */
     rangemap extentmap;
+    rangemap delalloc;  /* written ranges (in blocks) not yet backed by extents */
 } *tfsfile;
 
 declare_closure_struct(2, 0, void, free_uninited,
@@ -56,6 +78,8 @@ typedef struct extent {
     u64 allocated;
     tuple md;                   /* shortcut to extent meta */
     uninited uninited;
+    u64 compressed;             /* length in bytes of the LZ4 data in storage (0: not compressed) */
+    boolean shared;             /* storage may be referenced by other extents */
 } *extent;
 
 void ingest_extent(tfsfile f, symbol foff, tuple value);
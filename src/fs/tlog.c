@@ -24,6 +24,12 @@ static const char *tfs_magic = "NVMTFS";
 #define TUPLE_EXTENDED 3
 #define END_OF_SEGMENT 4
 #define LOG_EXTENSION_LINK 5
+#define TUPLE_EAV_INTEGER 6     /* entry and attribute indices, unsigned integer value */
+#define TUPLE_EAV_REMOVE 7      /* entry and attribute indices */
+
+/* Flags a compact record in the encoding lengths of the tuple staging buffer: such records carry
+ * their own frame identifier and are never split across log extensions. */
+#define TUPLE_COMPACT_RECORD    U64_FROM_BIT(63)
 
 #define COMPLETION_QUEUE_SIZE 10
 
@@ -63,6 +69,7 @@ struct log_ext {
     struct buffer staging;
     boolean open;
     boolean old_encoding;
+    boolean old_version;        /* cannot be appended to with the current format */
 
     range sectors;
     closure_struct(log_storage_op, read);
@@ -80,15 +87,18 @@ struct log {
     table dictionary;
     u64 total_entries, obsolete_entries;
     rangemap extensions;
+    u64 extension_count;
     log_ext current;
     buffer tuple_staging;
     vector encoding_lengths;
     u64 tuple_bytes_remain;
 
     struct timer flush_timer;
-    vector flush_completions;
+    vector flush_completions;   /* waiting for the flush in progress */
+    vector flush_next;          /* waiting for entries staged after the flush in progress started */
     boolean dirty;
     boolean flushing;
+    boolean flush_again;
     enum {
         TLOG_STATE_INIT,
         TLOG_STATE_LINKED,
@@ -137,6 +147,7 @@ static log_ext open_log_extension(log tl, range sectors)
     init_buffer(&ext->staging, size_bytes, true, 0, staging);
     ext->open = false;
     ext->old_encoding = false;
+    ext->old_version = false;
     init_closure(&ext->read, log_storage_op, fs, sectors.start, false);
     init_closure(&ext->write, log_storage_op, fs, sectors.start, true);
     ext->sectors = sectors;
@@ -150,6 +161,7 @@ static log_ext open_log_extension(log tl, range sectors)
         }
         rmnode_init(n, sectors);
         rangemap_insert(tl->extensions, n);
+        tl->extension_count++;
     }
 #endif
     return ext;
@@ -205,16 +217,20 @@ static log log_new(heap h, tfs fs)
         goto fail_dealloc_staging;
     tl->tuple_bytes_remain = 0;
     tl->dirty = false;
-    tl->flushing = false;
+    tl->flushing = tl->flush_again = false;
     init_timer(&tl->flush_timer);
     tl->flush_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
     if (tl->flush_completions == INVALID_ADDRESS)
         goto fail_dealloc_encoding_lengths;
+    tl->flush_next = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
+    if (tl->flush_next == INVALID_ADDRESS)
+        goto fail_dealloc_completions;
     tl->total_entries = tl->obsolete_entries = 0;
 #ifndef TLOG_READ_ONLY
+    tl->extension_count = 0;
     tl->extensions = allocate_rangemap(h);
     if (tl->extensions == INVALID_ADDRESS) {
-        goto fail_dealloc_completions;
+        goto fail_dealloc_next;
     }
     init_refcount(&tl->refcount, 1, init_closure_func(&tl->free, thunk, log_free));
 #endif
@@ -224,9 +240,11 @@ static log log_new(heap h, tfs fs)
 #ifndef TLOG_READ_ONLY
         deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node, tl));
 #endif
-        goto fail_dealloc_completions;
+        goto fail_dealloc_next;
     }
     return tl;
+  fail_dealloc_next:
+    deallocate_vector(tl->flush_next);
   fail_dealloc_completions:
     deallocate_vector(tl->flush_completions);
   fail_dealloc_encoding_lengths:
@@ -404,13 +422,15 @@ static inline boolean log_write_internal(log tl, merge m)
         u64 size;
         u64 written = 0;
         u64 remaining = (u64)vector_get(tl->encoding_lengths, i);
+        boolean compact = (remaining & TUPLE_COMPACT_RECORD) != 0;
+        remaining &= ~TUPLE_COMPACT_RECORD;
         assert(remaining > 0);
         do {
             assert(buffer_length(tl->tuple_staging) > 0);
             size = log_size(ext);
             buffer staging = &ext->staging;
             u64 min = TFS_EXTENSION_LINK_BYTES + TUPLE_AVAILABLE_MIN_SIZE;
-            if (staging->end + min >= size || ext->old_encoding) {
+            if (staging->end + min >= size || ext->old_version) {
                 tlog_ext_unlock(ext);
                 status_handler sh = apply_merge(m);
                 ext = log_extend(tl, TFS_LOG_DEFAULT_EXTENSION_SIZE, sh);
@@ -421,6 +441,12 @@ static inline boolean log_write_internal(log tl, merge m)
                 tlog_ext_lock(ext);
             }
             assert(staging->end + min < size);
+            if (compact) {
+                /* compact records are smaller than TUPLE_AVAILABLE_MIN_SIZE */
+                assert(buffer_write(staging, buffer_ref(tl->tuple_staging, 0), remaining));
+                buffer_consume(tl->tuple_staging, remaining);
+                break;
+            }
             u64 avail = size - (staging->end + TFS_EXTENSION_LINK_BYTES + TUPLE_AVAILABLE_HEADER_SIZE);
             u64 length = MIN(avail, remaining);
             if (written == 0) {
@@ -463,12 +489,22 @@ closure_function(1, 1, void, log_flush_complete,
                  status s)
 {
     /* would need to move these to runqueue if a flush is ever invoked from a tfs op */
-    tlog_lock(bound(tl));
-    bound(tl)->dirty = false;
-    run_flush_completions(bound(tl), s);
-    bound(tl)->flushing = false;
-    tlog_unlock(bound(tl));
-    refcount_release(&bound(tl)->refcount);
+    log tl = bound(tl);
+    tlog_lock(tl);
+    run_flush_completions(tl, s);
+    tl->flushing = false;
+
+    /* Flush requests received while this flush was in progress are served by a single flush,
+     * started right away (group commit). */
+    if (tl->flush_again) {
+        tl->flush_again = false;
+        vector v = tl->flush_completions;
+        tl->flush_completions = tl->flush_next;
+        tl->flush_next = v;
+        log_flush(tl, 0);
+    }
+    tlog_unlock(tl);
+    refcount_release(&tl->refcount);
     closure_finish();
 }
 
@@ -513,10 +549,38 @@ closure_function(2, 1, void, log_switch_complete,
     closure_finish();
 }
 
+/* A log is compacted (i.e. rewritten as a snapshot of the live metadata) when it contains a
+ * significant fraction of obsolete entries, or a smaller fraction if it spans many extensions. */
+static boolean log_compaction_needed(log tl)
+{
+    if ((tl->state != TLOG_STATE_LINKED) || (tl->obsolete_entries < TFS_LOG_COMPACT_OBSOLETE))
+        return false;
+    if (tl->extension_count >= TFS_LOG_COMPACT_EXTENSIONS)
+        return (tl->total_entries <= TFS_LOG_COMPACT_RATIO_LARGE * tl->obsolete_entries);
+    return (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries);
+}
+
+/* Entries staged while a flush is in progress are not covered by that flush: the requests for these
+ * entries are queued in flush_next and served together by the next flush. */
 void log_flush(log tl, status_handler completion)
 {
     tlog_debug("%s: log %p, completion %p, dirty %d\n", func_ss, tl, completion, tl->dirty);
-    if (!tl->dirty && (tl->state != TLOG_STATE_COMPACTING)) {
+    if (tl->state == TLOG_STATE_COMPACTING) {
+        if (completion)
+            vector_push(tl->flush_completions, completion);
+        return;
+    }
+    if (tl->flushing) {
+        if (tl->dirty) {
+            if (completion)
+                vector_push(tl->flush_next, completion);
+            tl->flush_again = true;
+        } else if (completion) {
+            vector_push(tl->flush_completions, completion);
+        }
+        return;
+    }
+    if (!tl->dirty) {
         if (completion)
 #ifdef KERNEL
             async_apply_status_handler(completion, STATUS_OK);
@@ -527,11 +591,10 @@ void log_flush(log tl, status_handler completion)
     }
     if (completion)
         vector_push(tl->flush_completions, completion);
-    if (tl->flushing || (tl->state == TLOG_STATE_COMPACTING))
-        return;
 #ifdef KERNEL
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
+    tl->dirty = false;
     tl->flushing = true;
     refcount_reserve(&tl->refcount);
     merge m = allocate_merge(tl->h, closure(tl->h, log_flush_complete, tl));
@@ -547,8 +610,7 @@ void log_flush(log tl, status_handler completion)
     flush_log_extension(tl->current, false, sh);
     tlog_lock(tl);
 
-    if ((tl->state == TLOG_STATE_LINKED) && (tl->obsolete_entries >= TFS_LOG_COMPACT_OBSOLETE) &&
-        (tl->total_entries <= TFS_LOG_COMPACT_RATIO * tl->obsolete_entries)) {
+    if (log_compaction_needed(tl)) {
         tlog_debug("%ld obsolete entries out of %ld, starting log compaction\n",
             tl->obsolete_entries, tl->total_entries);
         tfs fs = tl->fs;
@@ -622,16 +684,51 @@ static void log_set_dirty(log tl)
 }
 #endif
 
+/* Updates of an attribute of an already logged entry (such as the length of an extent) and removals
+ * of an attribute (such as an unlinked directory entry) are logged as compact records, which refer
+ * to the entry and the attribute by their dictionary index and do not go through the generic
+ * tuple encoder. */
+static boolean log_encode_eav_compact(log tl, tuple e, symbol a, value v)
+{
+    u64 e_index = u64_from_pointer(table_find(tl->dictionary, e));
+    u64 a_index = u64_from_pointer(table_find(tl->dictionary, a));
+    if (!e_index || !a_index)
+        return false;
+    buffer b = tl->tuple_staging;
+    u64 n;
+    if (!v) {
+        push_u8(b, TUPLE_EAV_REMOVE);
+    } else if (is_integer(v) && !is_signed_integer_value(v) && u64_from_value(v, &n)) {
+        push_u8(b, TUPLE_EAV_INTEGER);
+    } else {
+        return false;
+    }
+    push_varint(b, e_index);
+    push_varint(b, a_index);
+    if (v)
+        push_varint(b, n);
+    if (get(e, a)) {
+        tl->obsolete_entries++;
+        if (!v)
+            tl->obsolete_entries++;
+    }
+    return true;
+}
+
 boolean log_write_eav(log tl, tuple e, symbol a, value v)
 {
     tlog_debug("log_write_eav: tl %p, e %p, a %b, v %p\n", tl, e, symbol_string(a), v);
     u64 len = buffer_length(tl->tuple_staging);
     if ((tl->state == TLOG_STATE_FAILED) || len >= TFS_LOG_MAX_TUPLE_STAGING_BYTES)
         return false;
-    encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries);
+    u64 flags = 0;
+    if (log_encode_eav_compact(tl, e, a, v))
+        flags = TUPLE_COMPACT_RECORD;
+    else
+        encode_eav(tl->tuple_staging, tl->dictionary, e, a, v, &tl->obsolete_entries);
     tl->total_entries++;
     len = buffer_length(tl->tuple_staging) - len;
-    vector_push(tl->encoding_lengths, (void *)len);
+    vector_push(tl->encoding_lengths, (void *)(len | flags));
     log_set_dirty(tl);
     return (tl->state != TLOG_STATE_FAILED);
 }
@@ -660,6 +757,26 @@ static boolean log_parse_tuple(log tl, buffer b, boolean old_encoding)
     return true;
 }
 
+static status log_parse_eav_compact(log tl, buffer b, u8 frame)
+{
+    u64 e_index = pop_varint(b);
+    u64 a_index = pop_varint(b);
+    tuple e = table_find(tl->dictionary, pointer_from_u64(e_index));
+    symbol a = table_find(tl->dictionary, pointer_from_u64(a_index));
+    if (!e || !is_tuple(e) || !a || !is_symbol(a))
+        return timm("result", "compact record with invalid entry (%ld) or attribute (%ld)",
+                    e_index, a_index);
+    value v = (frame == TUPLE_EAV_INTEGER) ? value_from_u64(pop_varint(b)) : 0;
+    if (get(e, a)) {
+        tl->obsolete_entries++;
+        if (!v)
+            tl->obsolete_entries++;
+    }
+    set(e, a, v);
+    tl->total_entries++;
+    return STATUS_OK;
+}
+
 static inline void log_tuple_produce(log tl, buffer b, u64 length)
 {
     assert(buffer_write(tl->tuple_staging, buffer_ref(b, 0), length));
@@ -682,11 +799,15 @@ static status log_hdr_parse(log_ext ext, buffer b, boolean first_ext,
             rprintf("WARNING: old version of TFS found (4); please upgrade ops/mkfs\n");
         }
 #endif
-        if (ext)
+        if (ext) {
             ext->old_encoding = true;
-    } else if (version == TFS_VERSION) {
-        if (ext)
+            ext->old_version = true;
+        }
+    } else if ((version == TFS_VERSION) || (version == TFS_VERSION_NO_COMPACT)) {
+        if (ext) {
             ext->old_encoding = false;
+            ext->old_version = (version != TFS_VERSION);
+        }
     } else {
         return timm("result", "tfs version mismatch (read %ld, build %ld)",
             version, TFS_VERSION);
@@ -795,6 +916,18 @@ closure_function(4, 1, void, log_read_complete,
                 log_tuple_produce(tl, b, length);
             }
             break;
+        case TUPLE_EAV_INTEGER:
+        case TUPLE_EAV_REMOVE:
+            tlog_debug("-> compact record\n");
+            if (tl->tuple_bytes_remain > 0) {
+                s = timm("result", "compact record read while parsing tuple (%ld remaining)",
+                         tl->tuple_bytes_remain);
+                goto out_apply_status;
+            }
+            s = log_parse_eav_compact(tl, b, frame);
+            if (!is_ok(s))
+                goto out_apply_status;
+            break;
         case TUPLE_EXTENDED:
             tlog_debug("-> tuple extended data\n");
             length = pop_varint(b);
@@ -842,6 +975,11 @@ closure_function(4, 1, void, log_read_complete,
         }
         deallocate_table(tl->dictionary);
         tl->dictionary = newdict;
+#if defined(KERNEL) && !defined(TLOG_READ_ONLY)
+        /* compact a log with a long history now rather than waiting for the next write */
+        if (log_compaction_needed(tl))
+            log_set_dirty(tl);
+#endif
     }
 
   out_apply_status:
@@ -937,6 +1075,7 @@ void log_destroy(log tl)
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
     deallocate_vector(tl->flush_completions);
+    deallocate_vector(tl->flush_next);
 #ifndef TLOG_READ_ONLY
     deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node,
         tl));
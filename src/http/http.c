@@ -1,4 +1,16 @@
+#ifdef KERNEL
+#include <kernel.h>
+#define http_lock_init(l)   spin_lock_init(l)
+#define http_lock(l)        spin_lock(l)
+#define http_unlock(l)      spin_unlock(l)
+#define http_schedule(t)    async_apply(t)
+#else
 #include <runtime.h>
+#define http_lock_init(l)
+#define http_lock(l)
+#define http_unlock(l)
+#define http_schedule(t)    apply(t)
+#endif
 #include <http.h>
 
 #define HTTP_VER(x, y) (((x)<<16)|((y)&MASK(16)))
@@ -20,15 +32,34 @@ typedef struct http_parser {
     tuple header;
     value_handler each;
     u64 content_length;
+    http_responder hr;          /* server side only */
 } *http_parser;
 
+/* Server side of a connection. Requests are dispatched one at a time: while a response is in
+ * progress (i.e. its handler completes it asynchronously), pipelined requests are held in the
+ * backlog, and parsing resumes when the response is complete. */
 struct http_responder {
     heap h;
-    buffer_handler out;
+    buffer_handler out;         /* zero once the connection is closed */
     u32 http_version;
     boolean keepalive;
+    boolean busy;               /* a response is in progress */
+    boolean dispatching;        /* a request handler is running */
+    boolean closed;
+    buffer_handler parser;
+    buffer backlog;
+    struct refcount refcount;
+    closure_struct(thunk, resume);
+    closure_struct(thunk, free);
+#ifdef KERNEL
+    struct spinlock lock;       /* serializes output */
+    struct spinlock parse_lock;
+#endif
 };
 
+static status http_send(http_responder out, buffer b);
+static void http_response_done(http_responder out);
+
 closure_function(3, 2, boolean, each_header,
                  buffer, dest, symbol, ignore, boolean, dealloc,
                  value n, value v)
@@ -94,37 +125,40 @@ static status send_http_headers(http_responder out, tuple t)
     deallocate_value(t);
     bprintf(d, "\r\n");
 
-    s = apply(out->out, d);
-    if (!is_ok(s)) {
-        deallocate_buffer(d);
+    s = http_send(out, d);
+    if (!is_ok(s))
         return timm_up(s, "result", "%s failed to send", func_ss);
-    }
     return STATUS_OK;
 }
 
-/* consumes c, c == 0 indicates terminate */
+/* consumes c, c == 0 indicates terminate; the contents of c are sent as they are, so c may wrap
+ * memory that stays untouched until the buffer is deallocated */
 status send_http_chunk(http_responder out, buffer c)
 {
-    if (c)
-        assert(!buffer_is_wrapped(c));
-
     status s = STATUS_OK;
     buffer d = allocate_buffer(transient, 32);
     int len = c ? buffer_length(c) : 0;
     bprintf(d, "%x\r\n", len);
-    s = apply(out->out, d);
-    if (!is_ok(s))
-        goto out_fail;
-
-    if (!c)
-        c = allocate_buffer(transient, 2);
-
-    bprintf(c, "\r\n");
-    s = apply(out->out, c);
+    if (c) {
+        s = http_send(out, d);
+        if (!is_ok(s)) {
+            deallocate_buffer(c);
+            goto out_fail;
+        }
+        s = http_send(out, c);
+        if (!is_ok(s))
+            goto out_fail;
+        d = allocate_buffer(transient, 2);
+    }
+    bprintf(d, "\r\n");
+    s = http_send(out, d);
     if (!is_ok(s))
         goto out_fail;
-    if (len == 0 && !out->keepalive)
-        apply(out->out, 0);
+    if (len == 0) {
+        if (!out->keepalive)
+            http_send(out, 0);
+        http_response_done(out);
+    }
     /* could support trailers... */
     return s;
   out_fail:
@@ -146,7 +180,7 @@ status send_http_chunked_response(http_responder out, tuple t)
 status send_http_response(http_responder out, tuple t, buffer c)
 {
     if (c) {
-        assert(!buffer_is_wrapped(c));
+        assert(!buffer_is_wrapped(c) || buffer_is_chain(c));
         set(t, sym(Content-Length), aprintf(transient, "%d", buffer_length(c)));
     }
 
@@ -155,19 +189,45 @@ status send_http_response(http_responder out, tuple t, buffer c)
         goto out_fail;
 
     if (c) {
-        s = apply(out->out, c);
-        if (!is_ok(s)) {
-            deallocate_buffer(c);
+        s = http_send(out, c);
+        if (!is_ok(s))
             goto out_fail;
-        }
     }
     if (!out->keepalive)
-        apply(out->out, 0);
+        http_send(out, 0);
+    http_response_done(out);
     return STATUS_OK;
   out_fail:
     return timm_up(s, "result", "%s failed to send", func_ss);
 }
 
+/* Sends the headers of a response whose body, of the given length, is then streamed with
+ * send_http_body(); consumes t. */
+status send_http_response_header(http_responder out, tuple t, u64 content_length)
+{
+    set(t, sym(Content-Length), aprintf(transient, "%ld", content_length));
+    status s = send_http_headers(out, t);
+    if (!is_ok(s))
+        return timm_up(s, "result", "%s failed to send", func_ss);
+    return s;
+}
+
+/* consumes c, c == 0 indicates the end of the body; as with send_http_chunk(), c may wrap memory
+ * that must stay untouched until the buffer is deallocated */
+status send_http_body(http_responder out, buffer c)
+{
+    if (c) {
+        status s = http_send(out, c);
+        if (!is_ok(s))
+            return timm_up(s, "result", "%s failed to send", func_ss);
+        return s;
+    }
+    if (!out->keepalive)
+        http_send(out, 0);
+    http_response_done(out);
+    return STATUS_OK;
+}
+
 static void reset_parser(http_parser p)
 {
     p->state = STATE_INIT;
@@ -191,6 +251,31 @@ static void deallocate_parser(http_parser p)
     deallocate(p->h, p, sizeof(*p));
 }
 
+static void deliver_message(http_parser p)
+{
+    set(p->header, sym(start_line), p->start_line);
+    set(p->header, sym(content), p->word);
+    p->word = INVALID_ADDRESS;
+    apply(p->each, p->header);
+}
+
+/* holds received data until the response in progress is complete */
+static void http_backlog_append(http_responder hr, void *data, bytes len)
+{
+    if (!len)
+        return;
+    if (!hr->backlog) {
+        hr->backlog = allocate_buffer(hr->h, len);
+        if (hr->backlog == INVALID_ADDRESS) {
+            hr->backlog = 0;
+            msg_err("failed to allocate backlog\n");
+            return;
+        }
+    }
+    if (!buffer_write(hr->backlog, data, len))
+        msg_err("failed to extend backlog\n");
+}
+
 // we're going to patch the connection together by looking at the
 // leftover bits in buffer...defer until we need to actually
 // switch protocols
@@ -204,14 +289,19 @@ closure_function(1, 1, status, http_recv,
     if (!b) {
         int state = p->state;
         if (state == STATE_BODY)
-            goto content_finish;
+            deliver_message(p);
         deallocate_parser(p);
         closure_finish();
-        if (state == STATE_INIT)
+        if ((state == STATE_INIT) || (state == STATE_BODY))
             return STATUS_OK;   /* XXX teardown */
         return timm("result", "http_recv: connection closed before finished parsing (state %d)", state);
     }
-    
+
+    http_responder hr = p->hr;
+    if (hr && hr->busy) {
+        http_backlog_append(hr, buffer_ref(b, 0), buffer_length(b));
+        return STATUS_OK;
+    }
     for (bytes i = b->start; i < b->end; i++) {
         char x = ((unsigned char *)b->contents)[i];
         switch (p->state) {
@@ -273,37 +363,42 @@ closure_function(1, 1, status, http_recv,
             --p->content_length;
         }
 
-        if ((p->state == STATE_BODY) && (p->content_length == 0))
-            goto content_finish;
-    }
-    if ((p->state != STATE_BODY) || (p->content_length != 0))
-        /* Incomplete HTTP message; parsing can continue when the next packet arrives. */
-        return STATUS_OK;
+        if ((p->state == STATE_BODY) && (p->content_length == 0)) {
+            deliver_message(p);
+            cleanup_parser(p);
+            reset_parser(p);
 
-  content_finish:
-    set(p->header, sym(start_line), p->start_line);
-    set(p->header, sym(content), p->word);
-    p->word = INVALID_ADDRESS;
-    apply(p->each, p->header);
-    if (b) {
-        cleanup_parser(p);
-        reset_parser(p);
-    } else {
-        deallocate_parser(p);
-        closure_finish();
+            /* requests pipelined after one whose response is still in progress are held */
+            if (hr && hr->busy) {
+                http_backlog_append(hr, b->contents + i + 1, b->end - i - 1);
+                break;
+            }
+        }
     }
+    /* An incomplete HTTP message continues when the next packet arrives. */
     return STATUS_OK;
 }
 
-buffer_handler allocate_http_parser(heap h, value_handler each)
+static buffer_handler allocate_parser(heap h, value_handler each, http_responder hr)
 {
     http_parser p = allocate(h, sizeof(struct http_parser));
     if (p == INVALID_ADDRESS)
         return INVALID_ADDRESS;
     p->h = h;
     p->each = each;
+    p->hr = hr;
     reset_parser(p);
-    return closure(h, http_recv, p);
+    buffer_handler bh = closure(h, http_recv, p);
+    if (bh == INVALID_ADDRESS) {
+        cleanup_parser(p);
+        deallocate(h, p, sizeof(*p));
+    }
+    return bh;
+}
+
+buffer_handler allocate_http_parser(heap h, value_handler each)
+{
+    return allocate_parser(h, each, 0);
 }
 
 const sstring http_request_methods[] = {
@@ -376,14 +471,113 @@ static void check_keepalive(http_responder hr, tuple v)
     }
 }
 
-/* XXX need refcount of outstanding http handlers for safe dealloc */
+/* consumes b, which may be 0 to close the connection */
+static status http_send(http_responder out, buffer b)
+{
+    status s;
+    http_lock(&out->lock);
+    buffer_handler bh = out->out;
+    if (!bh) {
+        http_unlock(&out->lock);
+        if (b)
+            deallocate_buffer(b);
+        return timm("result", "connection closed");
+    }
+    if (b) {
+        s = apply(bh, b);
+        http_unlock(&out->lock);
+        if (!is_ok(s))
+            deallocate_buffer(b);
+        return s;
+    }
+
+    /* closing may tear down the connection synchronously, which ends in http_disconnect() */
+    out->out = 0;
+    http_unlock(&out->lock);
+    return apply(bh, 0);
+}
+
+static void http_disconnect(http_responder hr)
+{
+    /* a zero output means that the connection is being closed by the sender, which holds the lock */
+    if (!hr->out)
+        return;
+    http_lock(&hr->lock);
+    hr->out = 0;
+    http_unlock(&hr->lock);
+}
+
+closure_func_basic(thunk, void, http_responder_resume)
+{
+    http_responder hr = struct_from_field(closure_self(), http_responder, resume);
+    http_lock(&hr->parse_lock);
+    buffer b = hr->backlog;
+    if (b && !hr->busy && !hr->closed) {
+        hr->backlog = 0;
+        status s = apply(hr->parser, b);
+        if (!is_ok(s))
+            timm_dealloc(s);
+        deallocate_buffer(b);
+    }
+    http_unlock(&hr->parse_lock);
+    http_responder_release(hr);
+}
+
+static void http_response_done(http_responder out)
+{
+    out->busy = false;
+    memory_barrier();
+
+    /* A response completed by its handler before returning lets the parser continue by itself;
+     * otherwise, the parser may have held pipelined requests in the meantime. */
+    if (!out->dispatching) {
+        thunk t = (thunk)&out->resume;
+        http_responder_hold(out);
+        http_schedule(t);
+    }
+}
+
+static void http_dispatch(http_responder hr, http_request_handler h, http_method method, value v)
+{
+    hr->busy = hr->dispatching = true;
+    apply(h, method, hr, v);
+    hr->dispatching = false;
+    memory_barrier();   /* pairs with http_response_done() */
+}
+
+closure_func_basic(thunk, void, http_responder_free)
+{
+    http_responder hr = struct_from_field(closure_self(), http_responder, free);
+    if (hr->backlog)
+        deallocate_buffer(hr->backlog);
+    deallocate(hr->h, hr, sizeof(*hr));
+}
+
+/* closes the connection, e.g. to abort a response that cannot be completed */
+void http_responder_close(http_responder out)
+{
+    status s = http_send(out, 0);
+    if (!is_ok(s))
+        timm_dealloc(s);
+}
+
+void http_responder_hold(http_responder out)
+{
+    refcount_reserve(&out->refcount);
+}
+
+void http_responder_release(http_responder out)
+{
+    refcount_release(&out->refcount);
+}
+
 closure_function(2, 1, void, each_http_request,
-                 http_listener, hl, struct http_responder, hr,
+                 http_listener, hl, http_responder, hr,
                  value v)
 {
     http_method method;
     http_listener hl = bound(hl);
-    http_responder hr = &bound(hr);
+    http_responder hr = bound(hr);
     vector vsl = get_vector(v, sym(start_line));
     if (!vsl || vsl == INVALID_ADDRESS)
         goto not_found;
@@ -414,7 +608,7 @@ closure_function(2, 1, void, each_http_request,
     if (buffer_length(uri) == 1) {
         if (!hl->default_handler)
             goto not_found;
-        apply(hl->default_handler, method, hr, v);
+        http_dispatch(hr, hl->default_handler, method, v);
         return;
     }
 
@@ -447,8 +641,13 @@ closure_function(2, 1, void, each_http_request,
     else
         deallocate_buffer(rel_uri);
 
+    /* the default handler also serves URIs not matched by any registrant */
     if (match)
-        apply(match->each, method, hr, v);
+        http_dispatch(hr, match->each, method, v);
+    else if (hl->default_handler)
+        http_dispatch(hr, hl->default_handler, method, v);
+    else
+        goto not_found;
     return;
   not_found:
     send_http_response(hr, timm("status", "404 Not Found"),
@@ -463,12 +662,21 @@ closure_function(2, 1, void, each_http_request,
 }
 
 closure_function(1, 1, boolean, http_ibh,
-                 buffer_handler, parser,
+                 http_responder, hr,
                  buffer b)
 {
-    status s = apply(bound(parser), b);
+    http_responder hr = bound(hr);
     if (!b)
+        http_disconnect(hr);
+    http_lock(&hr->parse_lock);
+    status s = hr->closed ? STATUS_OK : apply(hr->parser, b);
+    if (!b)
+        hr->closed = true;
+    http_unlock(&hr->parse_lock);
+    if (!b) {
+        http_responder_release(hr);
         closure_finish();
+    }
     if (s == STATUS_OK)
         return false;
     timm_dealloc(s);
@@ -480,18 +688,28 @@ closure_function(1, 1, input_buffer_handler, each_http_connection,
                  buffer_handler out)
 {
     http_listener hl = bound(hl);
-    struct http_responder hr;
-    hr.h = hl->h;
-    hr.keepalive = true;
-    hr.out = out;
-    hr.http_version = HTTP_VER(1, 1);
-    buffer_handler parser = allocate_http_parser(hl->h, closure(hl->h, each_http_request, hl, hr));
-    if (parser == INVALID_ADDRESS)
+    http_responder hr = allocate(hl->h, sizeof(*hr));
+    if (hr == INVALID_ADDRESS)
         return INVALID_ADDRESS;
-    input_buffer_handler ibh = closure(hl->h, http_ibh, parser);
+    hr->h = hl->h;
+    hr->keepalive = true;
+    hr->out = out;
+    hr->http_version = HTTP_VER(1, 1);
+    hr->busy = hr->dispatching = hr->closed = false;
+    hr->backlog = 0;
+    init_closure_func(&hr->resume, thunk, http_responder_resume);
+    init_refcount(&hr->refcount, 1, init_closure_func(&hr->free, thunk, http_responder_free));
+    http_lock_init(&hr->lock);
+    http_lock_init(&hr->parse_lock);
+    hr->parser = allocate_parser(hl->h, closure(hl->h, each_http_request, hl, hr), hr);
+    if (hr->parser == INVALID_ADDRESS)
+        goto fail;
+    input_buffer_handler ibh = closure(hl->h, http_ibh, hr);
     if (ibh != INVALID_ADDRESS)
         return ibh;
-    apply(parser, 0);
+    apply(hr->parser, 0);
+  fail:
+    deallocate(hl->h, hr, sizeof(*hr));
     return INVALID_ADDRESS;
 }
 
@@ -23,6 +23,14 @@ status send_http_response(http_responder out,
 status send_http_chunk(http_responder out, buffer c);
 status send_http_chunked_response(http_responder out, tuple t);
 status send_http_response(http_responder out, tuple t, buffer c);
+status send_http_response_header(http_responder out, tuple t, u64 content_length);
+status send_http_body(http_responder out, buffer c);
+
+/* A handler that completes its response asynchronously holds a reference to the responder, whose
+ * sends fail once the connection is closed. */
+void http_responder_hold(http_responder out);
+void http_responder_release(http_responder out);
+void http_responder_close(http_responder out);
 
 extern const sstring http_request_methods[];
 
@@ -172,4 +172,7 @@ bool		vmbus_chan_is_revoked(const struct vmbus_channel *chan);
 int             vmbus_chan_prplist_nelem(int br_size, int prpcnt_max,
                     int dlen_max);
 void           vmbus_chan_poll_messages(struct vmbus_channel *chan);
+int            vmbus_subchan_get(struct vmbus_channel *prichan,
+                   struct vmbus_channel **subchan, int count);
+int            vmbus_chan_cpu_to_index(int cpu, int nchan);
 #endif	/* !_VMBUS_H_ */
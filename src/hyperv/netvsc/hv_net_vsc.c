@@ -51,7 +51,7 @@
 /*
  * Forward declarations
  */
-static void hv_nv_on_channel_callback(struct vmbus_channel *, void *hv_device);
+static void hv_nv_on_channel_callback(struct vmbus_channel *, void *nv_chan);
 static int  hv_nv_init_send_buffer_with_net_vsp(struct hv_device *device);
 static int  hv_nv_init_rx_buffer_with_net_vsp(struct hv_device *device);
 static int  hv_nv_destroy_rx_buffer(netvsc_dev *net_dev);
@@ -60,11 +60,18 @@ static int  hv_nv_connect_to_vsp(struct hv_device *device);
 static int  hv_nv_destroy_send_buffer(netvsc_dev *net_dev);
 static void hv_nv_on_send_completion(struct hv_device *device,
                      struct vmbus_chanpkt_hdr *pkt);
-static void hv_nv_on_receive(struct hv_device *device,
+static void hv_nv_on_receive(netvsc_channel *nv_chan,
                  struct vmbus_chanpkt_hdr *pkt);
-static void hv_nv_send_receive_completion(struct hv_device *device,
+static void hv_nv_send_receive_completion(struct vmbus_channel *channel,
                       uint64_t tid);
 
+static const uint32_t nvsp_protocol_versions[] = {
+    NVSP_PROTOCOL_VERSION_5,
+    NVSP_PROTOCOL_VERSION_4,
+    NVSP_PROTOCOL_VERSION_2,
+    NVSP_PROTOCOL_VERSION_1,
+};
+
 /*
  *
  */
@@ -530,18 +537,17 @@ hv_nv_connect_to_vsp(struct hv_device *device)
     net_dev = hv_nv_get_outbound_net_device(device);
 
     /*
-     * Negotiate the NVSP version.  Try NVSP v2 first.
+     * Negotiate the NVSP version, starting from the most recent one.
      */
-    nvsp_vers = NVSP_PROTOCOL_VERSION_2;
-    ret = hv_nv_negotiate_nvsp_protocol(device, net_dev, nvsp_vers);
-    if (ret != 0) {
-        /* NVSP v2 failed, try NVSP v1 */
-        nvsp_vers = NVSP_PROTOCOL_VERSION_1;
+    for (int i = 0; i < _countof(nvsp_protocol_versions); i++) {
+        nvsp_vers = nvsp_protocol_versions[i];
         ret = hv_nv_negotiate_nvsp_protocol(device, net_dev, nvsp_vers);
-        if (ret != 0) {
-            /* NVSP v1 failed, return bad status */
-            return (ret);
-        }
+        if (ret == 0)
+            break;
+    }
+    if (ret != 0) {
+        /* No version supported, return bad status */
+        return (ret);
     }
     net_dev->nvsp_version = nvsp_vers;
 
@@ -561,9 +567,11 @@ hv_nv_connect_to_vsp(struct hv_device *device)
     runtime_memset((u8 *)init_pkt, 0, sizeof(nvsp_msg));
 
     /*
-     * Updated to version 5.1, minimum, for VLAN per Haiyang
+     * Updated to version 5.1, minimum, for VLAN per Haiyang; RSS
+     * parameters (used with sub-channels) require NDIS 6.20 or later.
      */
-    ndis_version = NDIS_VERSION;
+    ndis_version = (nvsp_vers >= NVSP_PROTOCOL_VERSION_4) ?
+        NDIS_VERSION_6_30 : NDIS_VERSION;
 
     init_pkt->hdr.msg_type = nvsp_msg_1_type_send_ndis_vers;
     init_pkt->msgs.vers_1_msgs.send_ndis_vers.ndis_major_vers =
@@ -596,6 +604,19 @@ cleanup:
     return (ret);
 }
 
+/*
+ * Net VSC set transmit channels
+ *
+ * Each CPU transmits on the channel of its group of CPUs.
+ */
+static void
+hv_nv_set_tx_channels(netvsc_dev *net_dev)
+{
+    for (int cpu = 0; cpu < total_processors; cpu++)
+        net_dev->tx_channels[cpu] = &net_dev->channels[
+            vmbus_chan_cpu_to_index(cpu, net_dev->num_channels)];
+}
+
 /*
  * Net VSC on device add
  * 
@@ -630,11 +651,20 @@ hv_nv_on_device_add(struct hv_device *device, void *additional_info)
     }
 
     /*
-     * Open the channel
+     * Open the primary channel; until sub-channels are added, all
+     * CPUs transmit on it.
      */
+    net_dev->tx_channels = allocate(device->device->general,
+        total_processors * sizeof(net_dev->tx_channels[0]));
+    assert(net_dev->tx_channels != INVALID_ADDRESS);
+    netvsc_channel *nv_chan = &net_dev->channels[0];
+    nv_chan->dev = device;
+    nv_chan->channel = device->channel;
+    net_dev->num_channels = 1;
+    hv_nv_set_tx_channels(net_dev);
     vmbus_chan_open(device->channel,
         NETVSC_DEVICE_RING_BUFFER_SIZE, NETVSC_DEVICE_RING_BUFFER_SIZE,
-        NULL, 0, hv_nv_on_channel_callback, device, runqueue);
+        NULL, 0, hv_nv_on_channel_callback, nv_chan, runqueue);
     /*
      * Connect with the NetVsp
      */
@@ -645,6 +675,63 @@ hv_nv_on_device_add(struct hv_device *device, void *additional_info)
     return (net_dev);
 }
 
+/*
+ * Net VSC on sub-channels add
+ *
+ * Requests count sub-channels from the host (NVSP v5 or later) and opens
+ * the ones that are offered, sharing the receive buffer of the primary
+ * channel.  Returns the resulting number of channels.
+ */
+int
+hv_nv_on_subchannels_add(struct hv_device *device, int count)
+{
+    netvsc_dev *net_dev = hv_nv_get_outbound_net_device(device);
+    struct vmbus_channel *subchan[NETVSC_MAX_CHANNELS - 1];
+    nvsp_msg *init_pkt;
+    int ret;
+
+    count = MIN(count, NETVSC_MAX_CHANNELS - 1);
+    if ((net_dev->nvsp_version < NVSP_PROTOCOL_VERSION_5) || (count <= 0))
+        return (net_dev->num_channels);
+
+    init_pkt = &net_dev->channel_init_packet;
+    zero(init_pkt, sizeof(nvsp_msg));
+    init_pkt->hdr.msg_type = nvsp_msg_5_type_subchannel;
+    init_pkt->msgs.vers_5_msgs.subchannel_request.op = NVSP_SUBCHANNEL_ALLOCATE;
+    init_pkt->msgs.vers_5_msgs.subchannel_request.num_subchannels = count;
+
+    hv_nv_prepare_wait_for_channel_message(net_dev);
+    ret = vmbus_chan_send(device->channel,
+        VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
+        init_pkt, sizeof(nvsp_msg), (uint64_t)init_pkt);
+    if (ret != 0)
+        return (net_dev->num_channels);
+
+    hv_nv_wait_for_channel_message(net_dev);
+
+    if (init_pkt->msgs.vers_5_msgs.subchannel_complete.status
+        != nvsp_status_success) {
+        netvsc_debug("sub-channel allocation failed");
+        return (net_dev->num_channels);
+    }
+    count = MIN(count,
+        init_pkt->msgs.vers_5_msgs.subchannel_complete.num_subchannels);
+    count = vmbus_subchan_get(device->channel, subchan, count);
+
+    for (int i = 0; i < count; i++) {
+        netvsc_channel *nv_chan = &net_dev->channels[net_dev->num_channels];
+        nv_chan->dev = device;
+        nv_chan->channel = subchan[i];
+        vmbus_chan_open(subchan[i],
+            NETVSC_DEVICE_RING_BUFFER_SIZE, NETVSC_DEVICE_RING_BUFFER_SIZE,
+            NULL, 0, hv_nv_on_channel_callback, nv_chan, runqueue);
+        net_dev->num_channels++;
+    }
+    hv_nv_set_tx_channels(net_dev);
+    netvsc_debug("%d channels", net_dev->num_channels);
+    return (net_dev->num_channels);
+}
+
 /*
  * Net VSC on send completion
  */
@@ -667,7 +754,9 @@ hv_nv_on_send_completion(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt
         || nvsp_msg_pkt->hdr.msg_type
             == nvsp_msg_1_type_send_rx_buf_complete
         || nvsp_msg_pkt->hdr.msg_type
-            == nvsp_msg_1_type_send_send_buf_complete) {
+            == nvsp_msg_1_type_send_send_buf_complete
+        || nvsp_msg_pkt->hdr.msg_type
+            == nvsp_msg_5_type_subchannel) {
         /* Copy the response back */
         runtime_memcpy(&net_dev->channel_init_packet, nvsp_msg_pkt,
             sizeof(nvsp_msg));
@@ -695,6 +784,7 @@ int
 hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
 {
     netvsc_dev *net_dev;
+    struct vmbus_channel *channel;
     nvsp_msg send_msg;
     int ret;
 
@@ -702,6 +792,15 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
     if (!net_dev)
         return (ENODEV);
 
+    /*
+     * RNDIS control messages go through the primary channel, data
+     * packets through the channel of the sending CPU.
+     */
+    if (pkt->is_data_pkt)
+        channel = net_dev->tx_channels[current_cpu()->id]->channel;
+    else
+        channel = device->channel;
+
     send_msg.hdr.msg_type = nvsp_msg_1_type_send_rndis_pkt;
     if (pkt->is_data_pkt) {
         /* 0 is RMC_DATA */
@@ -717,11 +816,11 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
     send_msg.msgs.vers_1_msgs.send_rndis_pkt.send_buf_section_size = 0;
 
     if (pkt->page_buf_count) {
-        ret = vmbus_chan_send_sglist(device->channel,
+        ret = vmbus_chan_send_sglist(channel,
             pkt->page_buffers, pkt->page_buf_count,
             &send_msg, sizeof(nvsp_msg), (uint64_t)pkt);
     } else {
-        ret = vmbus_chan_send(device->channel,
+        ret = vmbus_chan_send(channel,
             VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
             &send_msg, sizeof(nvsp_msg), (uint64_t)pkt);
     }
@@ -740,8 +839,9 @@ hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt)
  * with virtual addresses.
  */
 static void 
-hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
+hv_nv_on_receive(netvsc_channel *nv_chan, struct vmbus_chanpkt_hdr *pkt)
 {
+    struct hv_device *device = nv_chan->dev;
     netvsc_dev *net_dev;
     struct vmbus_chanpkt_rxbuf *vm_xfer_page_pkt;
     nvsp_msg *nvsp_msg_pkt;
@@ -811,7 +911,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
         }
         spin_unlock_irq(&net_dev->rx_pkt_list_lock, flags);
 
-        hv_nv_send_receive_completion(device,
+        hv_nv_send_receive_completion(nv_chan->channel,
             vm_xfer_page_pkt->cp_hdr.cph_xactid);
 
         return;
@@ -837,6 +937,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
         net_vsc_pkt->xfer_page_pkt = xfer_page_pkt;
         net_vsc_pkt->compl.rx.rx_completion_context = net_vsc_pkt;
         net_vsc_pkt->device = device;
+        net_vsc_pkt->channel = nv_chan->channel;
         /* Save this so that we can send it back */
         net_vsc_pkt->compl.rx.rx_completion_tid =
             vm_xfer_page_pkt->cp_hdr.cph_xactid;
@@ -887,7 +988,7 @@ hv_nv_on_receive(struct hv_device *device, struct vmbus_chanpkt_hdr *pkt)
  * Net VSC send receive completion
  */
 static void
-hv_nv_send_receive_completion(struct hv_device *device, uint64_t tid)
+hv_nv_send_receive_completion(struct vmbus_channel *channel, uint64_t tid)
 {
     nvsp_msg rx_comp_msg;
     int retries = 0;
@@ -901,7 +1002,7 @@ hv_nv_send_receive_completion(struct hv_device *device, uint64_t tid)
 
 retry_send_cmplt:
     /* Send the completion */
-    ret = vmbus_chan_send(device->channel,
+    ret = vmbus_chan_send(channel,
         VMBUS_CHANPKT_TYPE_COMP, 0,
         &rx_comp_msg, sizeof(nvsp_msg), tid);
     if (ret == 0) {
@@ -964,18 +1065,19 @@ hv_nv_on_receive_completion(void *context)
 
     /* Send a receive completion for the xfer page packet */
     if (send_rx_completion)
-        hv_nv_send_receive_completion(device, tid);
+        hv_nv_send_receive_completion(packet->channel, tid);
 }
 
 /*
  * Net VSC on channel callback
  */
 static void
-hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
+hv_nv_on_channel_callback(struct vmbus_channel *context, void *nv_chan)
 {
     /* Fixme:  Magic number */
     const int net_pkt_size = 2048;
-    struct hv_device *device = (struct hv_device *)hv_device;
+    netvsc_channel *chan = (netvsc_channel *)nv_chan;
+    struct hv_device *device = chan->dev;
     netvsc_dev *net_dev;
     int     bufferlen = net_pkt_size;
     int     ret = 0;
@@ -989,7 +1091,7 @@ hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
     do {
         struct vmbus_chanpkt_hdr *desc = (struct vmbus_chanpkt_hdr *)buffer;
         int bytes_rxed = bufferlen;
-        ret = vmbus_chan_recv_pkt(device->channel,
+        ret = vmbus_chan_recv_pkt(chan->channel,
             desc, &bytes_rxed);
         if (ret == ENOBUFS) {
             /* Handle large packet */
@@ -1010,7 +1112,7 @@ hv_nv_on_channel_callback(struct vmbus_channel *context, void *hv_device)
             hv_nv_on_send_completion(device, desc);
             break;
         case VMBUS_CHANPKT_TYPE_RXBUF:
-            hv_nv_on_receive(device, desc);
+            hv_nv_on_receive(chan, desc);
             break;
         default:
             break;
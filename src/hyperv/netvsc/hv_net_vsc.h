@@ -51,10 +51,12 @@ typedef boolean boolean_t;
 
 #define NVSP_PROTOCOL_VERSION_1                 2
 #define NVSP_PROTOCOL_VERSION_2                 0x30002
+#define NVSP_PROTOCOL_VERSION_4                 0x40000
+#define NVSP_PROTOCOL_VERSION_5                 0x50000
 #define NVSP_MIN_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_1)
-#define NVSP_MAX_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_2)
+#define NVSP_MAX_PROTOCOL_VERSION               (NVSP_PROTOCOL_VERSION_5)
 
-#define NVSP_PROTOCOL_VERSION_CURRENT           NVSP_PROTOCOL_VERSION_2
+#define NVSP_PROTOCOL_VERSION_CURRENT           NVSP_PROTOCOL_VERSION_5
 
 #define NVSP_OPERATIONAL_STATUS_OK              (0x00000000)
 #define NVSP_OPERATIONAL_STATUS_DEGRADED        (0x00000001)
@@ -127,6 +129,21 @@ typedef enum nvsp_msg_type_ {
 
 	nvsp_msg_2_type_alloc_chimney_handle,
 	nvsp_msg_2_type_alloc_chimney_handle_complete,
+
+	/*
+	 * Version 4 Messages
+	 */
+	nvsp_msg_4_type_send_vf_association,
+	nvsp_msg_4_type_switch_data_path,
+	nvsp_msg_4_type_uplink_connect_state_deprecated,
+
+	/*
+	 * Version 5 Messages
+	 */
+	nvsp_msg_5_type_oid_query_ex,
+	nvsp_msg_5_type_oid_query_ex_comp,
+	nvsp_msg_5_type_subchannel,
+	nvsp_msg_5_type_send_indirection_table,
 } nvsp_msg_type;
 
 typedef enum nvsp_status_ {
@@ -819,11 +836,41 @@ typedef union nvsp_2_msg_uber_ {
 	nvsp_2_msg_alloc_chimney_handle_complete alloc_chimney_handle_complete;
 } __packed nvsp_2_msg_uber;
 
+/*
+ * Version 5 Messages
+ */
+
+/*
+ * NvspMessage5TypeSubchannel
+ *
+ * This message is used by the VSC to request the allocation of
+ * sub-channels; once it completes, the sub-channels are offered
+ * through vmbus with the type and instance of the primary channel.
+ */
+#define NVSP_SUBCHANNEL_ALLOCATE                1
+
+typedef struct nvsp_5_msg_subchannel_request_ {
+	uint32_t                                op;
+	uint32_t                                num_subchannels;
+} __packed nvsp_5_msg_subchannel_request;
+
+typedef struct nvsp_5_msg_subchannel_complete_ {
+	uint32_t                                status;
+	/* Number of sub-channels allocated */
+	uint32_t                                num_subchannels;
+} __packed nvsp_5_msg_subchannel_complete;
+
+typedef union nvsp_5_msg_uber_ {
+	nvsp_5_msg_subchannel_request           subchannel_request;
+	nvsp_5_msg_subchannel_complete          subchannel_complete;
+} __packed nvsp_5_msg_uber;
+
 
 typedef union nvsp_all_msgs_ {
 	nvsp_msg_init_uber                      init_msgs;
 	nvsp_1_msg_uber                         vers_1_msgs;
 	nvsp_2_msg_uber                         vers_2_msgs;
+	nvsp_5_msg_uber                         vers_5_msgs;
 } __packed nvsp_all_msgs;
 
 /*
@@ -863,11 +910,25 @@ typedef struct nvsp_msg_ {
  */
 #define NETVSC_MAX_CONFIGURABLE_MTU		(9 * 1024)
 
+/* Maximum number of channels (primary plus sub-channels) */
+#define NETVSC_MAX_CHANNELS			16
+
 /*
  * Data types
  */
 
 typedef struct hn_softc hn_softc_t;
+
+/*
+ * Per vmbus channel: the primary channel and each sub-channel carry
+ * the share of received traffic that RSS steers to them, and the
+ * traffic transmitted from the CPUs assigned to them.
+ */
+typedef struct netvsc_channel_ {
+	struct hv_device			*dev;
+	struct vmbus_channel			*channel;
+} netvsc_channel;
+
 /*
  * Per netvsc channel-specific
  */
@@ -904,6 +965,11 @@ typedef struct netvsc_dev_ {
 	hv_bool_uint8_t				destroy;
 	/* Negotiated NVSP version */
 	uint32_t				nvsp_version;
+
+	/* Channels, primary first, and the transmit channel of each CPU */
+	netvsc_channel				channels[NETVSC_MAX_CHANNELS];
+	int					num_channels;
+	netvsc_channel				**tx_channels;
 } netvsc_dev;
 
 
@@ -930,6 +996,8 @@ typedef struct netvsc_packet_ {
 	 */
 	struct list mylist_entry;
 	struct hv_device           *device;
+	/* Channel on which a received packet is to be completed */
+	struct vmbus_channel       *channel;
 	hv_bool_uint8_t            is_data_pkt;      /* One byte */
 	uint16_t		   vlan_tci;
 	xfer_page_packet           *xfer_page_pkt;
@@ -987,5 +1055,6 @@ extern netvsc_dev *hv_nv_on_device_add(struct hv_device *device, void *additiona
 extern int  hv_nv_on_device_remove(struct hv_device *device,
 				   boolean_t destroy_channel);
 extern int  hv_nv_on_send(struct hv_device *device, netvsc_packet *pkt);
+extern int  hv_nv_on_subchannels_add(struct hv_device *device, int count);
 
 #endif  /* __HV_NET_VSC_H__ */
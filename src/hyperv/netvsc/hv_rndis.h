@@ -36,6 +36,7 @@
 #define NDIS_VERSION_5_0                        0x00050000
 #define NDIS_VERSION_5_1                        0x00050001
 #define NDIS_VERSION_6_0                        0x00060000
+#define NDIS_VERSION_6_30                       0x0006001e
 #define NDIS_VERSION                            (NDIS_VERSION_5_1)
 
 /*
@@ -187,6 +188,12 @@
 #define RNDIS_OID_GEN_GET_TIME_CAPS                     0x0002020F
 #define RNDIS_OID_GEN_GET_NETCARD_TIME                  0x00020210
 
+/*
+ * Receive side scaling OIDs (NDIS 6)
+ */
+#define RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES        0x00010203
+#define RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS          0x00010204
+
 /*
  * These are connection-oriented general OIDs.
  * These replace the above OIDs for connection-oriented media.
@@ -585,6 +592,71 @@ typedef struct ndis_8021q_info_ {
 	} u1;
 } ndis_8021q_info;
 
+/*
+ * Header of NDIS 6 objects passed in query and set requests.
+ */
+typedef struct ndis_object_header_ {
+	uint8_t                                 type;
+	uint8_t                                 revision;
+	uint16_t                                size;
+} __packed ndis_object_header;
+
+#define NDIS_OBJECT_TYPE_RSS_CAPABILITIES       0x88
+#define NDIS_OBJECT_TYPE_RSS_PARAMETERS         0x89
+
+/*
+ * Information buffer returned for the OID
+ * OID_GEN_RECEIVE_SCALE_CAPABILITIES.
+ */
+typedef struct ndis_rss_capabilities_ {
+	ndis_object_header                      hdr;
+	uint32_t                                capabilities;
+	uint32_t                                num_msi;
+	uint32_t                                num_rx_queues;
+	/* Revision 2 */
+	uint16_t                                num_indirection_entries;
+	uint16_t                                pad;
+} __packed ndis_rss_capabilities;
+
+#define NDIS_RSS_CAPS_REVISION_2                2
+
+/*
+ * Information buffer passed in a SetRequest for the OID
+ * OID_GEN_RECEIVE_SCALE_PARAMETERS, followed by the hash key and the
+ * indirection table, whose entries are channel indices.
+ */
+typedef struct ndis_rss_parameters_ {
+	ndis_object_header                      hdr;
+	uint16_t                                flags;
+	uint16_t                                base_cpu_number;
+	uint32_t                                hash_info;
+	uint16_t                                indirection_table_size;
+	uint32_t                                indirection_table_offset;
+	uint16_t                                hash_secret_key_size;
+	uint32_t                                hash_secret_key_offset;
+	/* Revision 2 */
+	uint32_t                                processor_masks_offset;
+	uint32_t                                num_processor_masks;
+	uint32_t                                processor_masks_entry_size;
+} __packed ndis_rss_parameters;
+
+#define NDIS_RSS_PARAMETERS_REVISION_2          2
+
+#define NDIS_HASH_FUNCTION_TOEPLITZ             0x00000001
+#define NDIS_HASH_IPV4                          0x00000100
+#define NDIS_HASH_TCP_IPV4                      0x00000200
+#define NDIS_HASH_IPV6                          0x00000400
+#define NDIS_HASH_TCP_IPV6                      0x00001000
+
+#define NDIS_RSS_HASH_KEY_SIZE_TOEPLITZ         40
+#define NDIS_RSS_INDIRECTION_TABLE_SIZE         128
+
+typedef struct ndis_rss_parameters_toeplitz_ {
+	ndis_rss_parameters                     params;
+	uint8_t                                 key[NDIS_RSS_HASH_KEY_SIZE_TOEPLITZ];
+	uint32_t                                indirection_table[NDIS_RSS_INDIRECTION_TABLE_SIZE];
+} __packed ndis_rss_parameters_toeplitz;
+
 /*
  * Format of Information buffer passed in a SetRequest for the OID
  * OID_GEN_RNDIS_CONFIG_PARAMETER.
@@ -56,6 +56,8 @@ static void hv_rf_receive_data(rndis_device *device, rndis_msg *message,
 static int  hv_rf_query_device(rndis_device *device, uint32_t oid,
                    void *result, uint32_t *result_size);
 static inline int hv_rf_query_device_mac(rndis_device *device);
+static int  hv_rf_set_device(rndis_device *device, uint32_t oid, void *data,
+                 uint32_t size);
 static int  hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter);
 static int  hv_rf_init_device(rndis_device *device);
 static int  hv_rf_open_device(rndis_device *device);
@@ -187,13 +189,23 @@ hv_rf_send_request(rndis_device *device, rndis_request *request,
 
     packet->is_data_pkt = false;
     packet->tot_data_buf_len = request->request_msg.msg_len;
-    packet->page_buf_count = 1;
 
-    packet->page_buffers[0].gpa_page =
-        hv_get_phys_addr(&request->request_msg) >> PAGELOG;
-    packet->page_buffers[0].gpa_len = request->request_msg.msg_len;
-    packet->page_buffers[0].gpa_ofs =
-        (unsigned long)&request->request_msg & (PAGESIZE - 1);
+    /* The message may span pages, each needing its own page buffer */
+    unsigned long va = (unsigned long)&request->request_msg;
+    uint32_t left = request->request_msg.msg_len;
+    int i = 0;
+    while (left > 0) {
+        uint32_t ofs = va & (PAGESIZE - 1);
+        uint32_t len = MIN(left, PAGESIZE - ofs);
+        packet->page_buffers[i].gpa_page =
+            hv_get_phys_addr((void *)va) >> PAGELOG;
+        packet->page_buffers[i].gpa_len = len;
+        packet->page_buffers[i].gpa_ofs = ofs;
+        va += len;
+        left -= len;
+        i++;
+    }
+    packet->page_buf_count = i;
 
     packet->compl.send.send_completion_context = request; /* packet */
     if (message_type != REMOTE_NDIS_HALT_MSG) {
@@ -276,9 +288,17 @@ hv_rf_receive_data(rndis_device *device, rndis_msg *message, netvsc_packet *pkt)
     rndis_per_packet_info *rppi;
     ndis_8021q_info       *rppi_vlan_info;
     uint32_t data_offset;
+    uint8_t *rx_pkt;
 
     rndis_pkt = &message->msg.packet;
 
+    /*
+     * Per-packet info may extend beyond the copy of the message, so it
+     * is parsed in the receive buffer.
+     */
+    rx_pkt = (uint8_t *)(pkt->page_buffers[0].gpa_page << PAGELOG) +
+        pkt->page_buffers[0].gpa_ofs + RNDIS_HEADER_SIZE;
+
     /*
      * Fixme:  Handle multiple rndis pkt msgs that may be enclosed in this
      * netvsc packet (ie tot_data_buf_len != message_length)
@@ -303,14 +323,21 @@ hv_rf_receive_data(rndis_device *device, rndis_msg *message, netvsc_packet *pkt)
      * Ignore CFI, priority for now as FreeBSD does not support these.
      */
     if (rndis_pkt->per_pkt_info_offset != 0) {
-        /* rppi struct exists; compute its address */
-        rppi = (rndis_per_packet_info *)((uint8_t *)rndis_pkt +
-            rndis_pkt->per_pkt_info_offset);
-        /* if VLAN ppi struct, get the VLAN ID */
-        if (rppi->type == ieee_8021q_info) {
-            rppi_vlan_info = (ndis_8021q_info *)((uint8_t *)rppi
-                +  rppi->per_packet_info_offset);
-            pkt->vlan_tci = rppi_vlan_info->u1.s1.vlan_id;
+        /* rppi structs exist; look for the VLAN one among them */
+        uint32_t ppi_offset = rndis_pkt->per_pkt_info_offset;
+        uint32_t ppi_end = ppi_offset + rndis_pkt->per_pkt_info_length;
+        while (ppi_offset + sizeof(rndis_per_packet_info) <= ppi_end) {
+            rppi = (rndis_per_packet_info *)(rx_pkt + ppi_offset);
+            if (rppi->size == 0 || ppi_offset + rppi->size > ppi_end)
+                break;
+            /* if VLAN ppi struct, get the VLAN ID */
+            if (rppi->type == ieee_8021q_info) {
+                rppi_vlan_info = (ndis_8021q_info *)((uint8_t *)rppi
+                    +  rppi->per_packet_info_offset);
+                pkt->vlan_tci = rppi_vlan_info->u1.s1.vlan_id;
+                break;
+            }
+            ppi_offset += rppi->size;
         }
     }
 
@@ -403,11 +430,17 @@ hv_rf_query_device(rndis_device *device, uint32_t oid, void *result,
     uint32_t in_result_size = *result_size;
     rndis_query_request *query;
     rndis_query_complete *query_complete;
+    ndis_rss_capabilities *rss_caps;
+    uint32_t info_length = 0;
     int ret = 0;
 
+    /* NDIS 6 objects are queried with their header as input */
+    if (oid == RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES)
+        info_length = sizeof(ndis_rss_capabilities);
+
     *result_size = 0;
     request = hv_rndis_request(device, REMOTE_NDIS_QUERY_MSG,
-        RNDIS_MESSAGE_SIZE(rndis_query_request));
+        RNDIS_MESSAGE_SIZE(rndis_query_request) + info_length);
     if (request == NULL) {
         ret = -1;
         goto cleanup;
@@ -417,9 +450,16 @@ hv_rf_query_device(rndis_device *device, uint32_t oid, void *result,
     query = &request->request_msg.msg.query_request;
     query->oid = oid;
     query->info_buffer_offset = sizeof(rndis_query_request); 
-    query->info_buffer_length = 0;
+    query->info_buffer_length = info_length;
     query->device_vc_handle = 0;
 
+    if (oid == RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES) {
+        rss_caps = (ndis_rss_capabilities *)(query + 1);
+        rss_caps->hdr.type = NDIS_OBJECT_TYPE_RSS_CAPABILITIES;
+        rss_caps->hdr.revision = NDIS_RSS_CAPS_REVISION_2;
+        rss_caps->hdr.size = sizeof(ndis_rss_capabilities);
+    }
+
     hv_request_prepare_wait(request);
     ret = hv_rf_send_request(device, request, REMOTE_NDIS_QUERY_MSG);
     if (ret != 0) {
@@ -464,13 +504,13 @@ hv_rf_query_device_mac(rndis_device *device)
 }
 
 /*
- * RNDIS filter set packet filter
- * Sends an rndis request with the new filter, then waits for a response
+ * RNDIS filter set device
+ * Sends an rndis request setting the given OID, then waits for a response
  * from the host.
  * Returns zero on success, non-zero on failure.
  */
 static int
-hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
+hv_rf_set_device(rndis_device *device, uint32_t oid, void *data, uint32_t size)
 {
 
     rndis_request *request;
@@ -479,8 +519,10 @@ hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
     uint32_t status;
     int ret;
 
+    assert(RNDIS_MESSAGE_SIZE(rndis_set_request) + size <=
+        sizeof(rndis_msg) + sizeof(request->request_ext));
     request = hv_rndis_request(device, REMOTE_NDIS_SET_MSG,
-        RNDIS_MESSAGE_SIZE(rndis_set_request) + sizeof(uint32_t));
+        RNDIS_MESSAGE_SIZE(rndis_set_request) + size);
     if (request == NULL) {
         ret = -1;
         goto cleanup;
@@ -488,12 +530,12 @@ hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
 
     /* Set up the rndis set */
     set = &request->request_msg.msg.set_request;
-    set->oid = RNDIS_OID_GEN_CURRENT_PACKET_FILTER;
-    set->info_buffer_length = sizeof(uint32_t);
+    set->oid = oid;
+    set->info_buffer_length = size;
     set->info_buffer_offset = sizeof(rndis_set_request); 
 
     runtime_memcpy((void *)((unsigned long)set + sizeof(rndis_set_request)),
-        &new_filter, sizeof(uint32_t));
+        data, size);
 
     hv_request_prepare_wait(request);
     ret = hv_rf_send_request(device, request, REMOTE_NDIS_SET_MSG);
@@ -522,6 +564,87 @@ cleanup:
     return (ret);
 }
 
+/*
+ * RNDIS filter set packet filter
+ */
+static int
+hv_rf_set_packet_filter(rndis_device *device, uint32_t new_filter)
+{
+    return (hv_rf_set_device(device, RNDIS_OID_GEN_CURRENT_PACKET_FILTER,
+        &new_filter, sizeof(uint32_t)));
+}
+
+/*
+ * RNDIS filter set RSS parameters
+ * Spreads received flows across the channels of the device by a Toeplitz
+ * hash of their addresses and ports.
+ */
+static int
+hv_rf_set_rss_params(rndis_device *device, int num_channels)
+{
+    hn_softc_t *dev = device->net_dev->dev->device;
+    ndis_rss_parameters_toeplitz *rss;
+    ndis_rss_parameters *params;
+    int ret;
+
+    rss = allocate_zero(dev->general, sizeof(*rss));
+    assert(rss != INVALID_ADDRESS);
+    params = &rss->params;
+    params->hdr.type = NDIS_OBJECT_TYPE_RSS_PARAMETERS;
+    params->hdr.revision = NDIS_RSS_PARAMETERS_REVISION_2;
+    params->hdr.size = sizeof(ndis_rss_parameters);
+    params->hash_info = NDIS_HASH_FUNCTION_TOEPLITZ | NDIS_HASH_IPV4 |
+        NDIS_HASH_TCP_IPV4 | NDIS_HASH_IPV6 | NDIS_HASH_TCP_IPV6;
+    params->indirection_table_size = sizeof(rss->indirection_table);
+    params->indirection_table_offset =
+        offsetof(ndis_rss_parameters_toeplitz *, indirection_table);
+    params->hash_secret_key_size = sizeof(rss->key);
+    params->hash_secret_key_offset =
+        offsetof(ndis_rss_parameters_toeplitz *, key);
+    for (int i = 0; i < sizeof(rss->key); i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(rss->key + i, &r, MIN(sizeof(r), sizeof(rss->key) - i));
+    }
+    for (int i = 0; i < NDIS_RSS_INDIRECTION_TABLE_SIZE; i++)
+        rss->indirection_table[i] = i % num_channels;
+
+    ret = hv_rf_set_device(device, RNDIS_OID_GEN_RECEIVE_SCALE_PARAMETERS,
+        rss, sizeof(*rss));
+    deallocate(dev->general, rss, sizeof(*rss));
+    return (ret);
+}
+
+/*
+ * RNDIS filter init channels
+ * With NVSP v5 or later, requests a sub-channel for each additional CPU,
+ * up to the number of receive queues supported by the host, and enables
+ * RSS across all channels.
+ */
+static void
+hv_rf_init_channels(struct hv_device *dev, rndis_device *device)
+{
+    ndis_rss_capabilities rss_caps;
+    uint32_t size = sizeof(rss_caps);
+    int num_channels;
+
+    if (total_processors == 1 ||
+        device->net_dev->nvsp_version < NVSP_PROTOCOL_VERSION_5)
+        return;
+    if (hv_rf_query_device(device, RNDIS_OID_GEN_RECEIVE_SCALE_CAPABILITIES,
+        &rss_caps, &size) != 0 ||
+        size < offsetof(ndis_rss_capabilities *, num_indirection_entries))
+        return;
+    num_channels = MIN(MIN(rss_caps.num_rx_queues, total_processors),
+        NETVSC_MAX_CHANNELS);
+    if (num_channels <= 1)
+        return;
+
+    num_channels = hv_nv_on_subchannels_add(dev, num_channels - 1);
+    hyperv_rndis_debug("%d channels", num_channels);
+    if (num_channels > 1 && hv_rf_set_rss_params(device, num_channels) != 0)
+        hyperv_rndis_debug("failed to set RSS parameters");
+}
+
 /*
  * RNDIS filter init device
  */
@@ -731,6 +854,9 @@ hv_rf_on_device_add(struct hv_device *dev, void *additl_info)
 
     runtime_memcpy(netif->hwaddr, rndis_dev->hw_mac_addr, sizeof(netif->hwaddr));
 
+    if (ret == 0)
+        hv_rf_init_channels(dev, rndis_dev);
+
     return (ret);
 }
 
@@ -73,6 +73,8 @@ typedef struct rndis_request_ {
 	struct vmbus_gpa		buffer;
 	/* Fixme:  We assumed a fixed size request here. */
 	rndis_msg			request_msg;
+	/* Room for set requests that exceed rndis_msg (RSS parameters) */
+	uint8_t				request_ext[sizeof(ndis_rss_parameters_toeplitz)];
 	/* Fixme:  Poor man's semaphore. */
 	uint32_t			halt_complete_flag;
 } rndis_request;
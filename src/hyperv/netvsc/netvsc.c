@@ -276,7 +276,8 @@ netvsc_attach(kernel_heaps kh, hv_device* device)
               vmxif_init,
               ethernet_input);
 
-    mm_register_mem_cleaner(init_closure_func(&hn->mem_cleaner, mem_cleaner, hn_mem_cleaner));
+    mm_register_mem_cleaner(init_closure_func(&hn->mem_cleaner, mem_cleaner, hn_mem_cleaner),
+                            ss("netvsc"), MM_CLEANER_CACHE);
     netvsc_debug("%s: hwaddr %02x:%02x:%02x:%02x:%02x:%02x", func_ss,
                  netif->hwaddr[0], netif->hwaddr[1], netif->hwaddr[2],
                  netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
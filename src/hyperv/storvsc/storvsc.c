@@ -119,8 +119,10 @@ struct storvsc_hcb {
 
 static u32 hv_storvsc_use_win8ext_flags = 1;
 
-#define HV_STORVSC_MAX_IO           512
+#define HV_STORVSC_MAX_IO           512     /* per channel */
+#define HV_STORVSC_MAX_IO_TOTAL     2048
 #define HV_STORVSC_RINGBUFFER_SIZE  (64 * PAGESIZE)
+#define HV_STORVSC_MAX_CHANNELS     16
 
 #define STORVSC_MAX_IO                        \
     vmbus_chan_prplist_nelem(HV_STORVSC_RINGBUFFER_SIZE,    \
@@ -154,6 +156,9 @@ struct storvsc_softc {
     struct spinlock queue_lock;
 
     struct vmbus_channel        *hs_chan;
+    int                 hs_nchan;
+    struct vmbus_channel        *hs_chans[HV_STORVSC_MAX_CHANNELS];
+    struct vmbus_channel        **hs_cpu_chans;    /* channel used by each CPU */
     struct list             hs_free_list;
     struct spinlock        hs_lock;
     struct storvsc_driver_props    *hs_drv_props;
@@ -336,6 +341,67 @@ static inline void hv_storvsc_wait_for_channel_message(struct hv_storvsc_request
     }
 }
 
+/*
+ * Set the channel used by each CPU to submit requests; completions are
+ * received on the channel of the request.
+ */
+static void hv_storvsc_set_cpu_channels(struct storvsc_softc *sc)
+{
+    for (int cpu = 0; cpu < total_processors; cpu++)
+        sc->hs_cpu_chans[cpu] =
+            sc->hs_chans[vmbus_chan_cpu_to_index(cpu, sc->hs_nchan)];
+}
+
+/**
+ * @brief Request sub-channels from the host and open the offered ones
+ *
+ * @param sc  storvsc device
+ * @param count  number of sub-channels to request
+ */
+static void hv_storvsc_subchannels_add(struct storvsc_softc *sc, int count)
+{
+    struct hv_storvsc_request *request = &sc->hs_init_req;
+    struct vstor_packet *vstor_packet = &request->vstor_packet;
+    struct vmbus_channel *subchan[HV_STORVSC_MAX_CHANNELS - 1];
+    struct vmstor_chan_props props;
+
+    count = MIN(count, HV_STORVSC_MAX_CHANNELS - 1);
+    if (count <= 0)
+        return;
+    zero(vstor_packet, sizeof(struct vstor_packet));
+    vstor_packet->operation = VSTOR_OPERATION_CREATE_MULTI_CHANNELS;
+    vstor_packet->flags = REQUEST_COMPLETION_FLAG;
+    vstor_packet->u.multi_channels_cnt = count;
+
+    hv_storvsc_prepare_wait_for_message(request);
+    int ret = vmbus_chan_send(sc->hs_chan,
+        VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
+        vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
+    if (ret != 0)
+        return;
+
+    hv_storvsc_wait_for_channel_message(request);
+
+    if (vstor_packet->operation != VSTOR_OPERATION_COMPLETEIO ||
+        vstor_packet->status != 0) {
+        storvsc_debug("sub-channel allocation failed");
+        return;
+    }
+    count = vmbus_subchan_get(sc->hs_chan, subchan, count);
+
+    zero(&props, sizeof(struct vmstor_chan_props));
+    for (int i = 0; i < count; i++) {
+        vmbus_chan_open(subchan[i],
+            sc->hs_drv_props->drv_ringbuffer_size,
+            sc->hs_drv_props->drv_ringbuffer_size,
+            (void *)&props, sizeof(struct vmstor_chan_props),
+            hv_storvsc_on_channel_callback, sc, bhqueue);
+        sc->hs_chans[sc->hs_nchan++] = subchan[i];
+    }
+    hv_storvsc_set_cpu_channels(sc);
+    storvsc_debug("%d channels", sc->hs_nchan);
+}
+
 /**
  * @brief initialize channel connection to parent partition
  *
@@ -426,10 +492,7 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
     assert(vstor_packet->operation == VSTOR_OPERATION_COMPLETEIO);
     assert(vstor_packet->status == 0);
 
-
-#ifdef STORVSC_DEBUG
     uint16_t max_subch = vstor_packet->u.chan_props.max_channel_cnt;
-    // we don't use subchannels but let's report these capabilities
     /* multi-channels feature is supported by WIN8 and above version */
     uint32_t version = vmbus_current_version;
     boolean support_multichannel = false;
@@ -441,7 +504,7 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
 
     storvsc_debug("max chans %d%s", max_subch + 1,
                   support_multichannel ? ss(", multi-chan capable") : sstring_empty());
-#endif
+
     zero(vstor_packet, sizeof(struct vstor_packet));
     vstor_packet->operation = VSTOR_OPERATION_ENDINITIALIZATION;
     vstor_packet->flags = REQUEST_COMPLETION_FLAG;
@@ -456,6 +519,9 @@ static void hv_storvsc_channel_init(struct storvsc_softc *sc)
 
     assert(vstor_packet->operation == VSTOR_OPERATION_COMPLETEIO);
     assert(vstor_packet->status == 0);
+
+    if (support_multichannel && max_subch > 0)
+        hv_storvsc_subchannels_add(sc, MIN(max_subch, total_processors - 1));
 }
 
 /**
@@ -473,8 +539,15 @@ static void hv_storvsc_connect_vsp(struct storvsc_softc *sc)
     zero(&props, sizeof(struct vmstor_chan_props));
 
     /*
-     * Open the channel
+     * Open the primary channel; until sub-channels are added, all
+     * CPUs submit requests on it.
      */
+    sc->hs_cpu_chans = allocate(sc->general,
+        total_processors * sizeof(sc->hs_cpu_chans[0]));
+    assert(sc->hs_cpu_chans != INVALID_ADDRESS);
+    sc->hs_chans[0] = sc->hs_chan;
+    sc->hs_nchan = 1;
+    hv_storvsc_set_cpu_channels(sc);
     vmbus_chan_open(
         sc->hs_chan,
         sc->hs_drv_props->drv_ringbuffer_size,
@@ -509,13 +582,14 @@ static int hv_storvsc_io_request(struct storvsc_softc *sc, struct hv_storvsc_req
 
     vstor_packet->operation = VSTOR_OPERATION_EXECUTESRB;
 
+    struct vmbus_channel *chan = sc->hs_cpu_chans[current_cpu()->id];
     int ret;
     if (request->prp_list.gpa_range.gpa_len) {
-        ret = vmbus_chan_send_prplist(sc->hs_chan,
+        ret = vmbus_chan_send_prplist(chan,
             &request->prp_list.gpa_range, request->prp_cnt,
             vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
     } else {
-        ret = vmbus_chan_send(sc->hs_chan,
+        ret = vmbus_chan_send(chan,
             VMBUS_CHANPKT_TYPE_INBAND, VMBUS_CHANPKT_FLAG_RC,
             vstor_packet, VSTOR_PKT_SIZE, (uint64_t)request);
     }
@@ -972,7 +1046,8 @@ static status storvsc_attach(kernel_heaps kh, hv_device* device, storage_attach
     // setup hcb cache
     sc->hcb_objcache = allocate_objcache(sc->general, sc->contiguous,
                                          sizeof(struct storvsc_hcb), PAGESIZE_2M, true);
-    mm_register_mem_cleaner(init_closure_func(&sc->mem_cleaner, mem_cleaner, storvsc_mem_cleaner));
+    mm_register_mem_cleaner(init_closure_func(&sc->mem_cleaner, mem_cleaner, storvsc_mem_cleaner),
+                            ss("storvsc"), MM_CLEANER_CACHE);
     sc->sa = a;
     sc->disks = allocate_vector(h, 1);
     spin_lock_init(&sc->disks_lock);
@@ -983,17 +1058,19 @@ static status storvsc_attach(kernel_heaps kh, hv_device* device, storage_attach
     /* fill in driver specific properties */
     sc->hs_drv_props = &g_drv_props_table[stor_type];
     sc->hs_drv_props->drv_ringbuffer_size = HV_STORVSC_RINGBUFFER_SIZE;
-    sc->hs_drv_props->drv_max_ios_per_target = HV_STORVSC_MAX_IO;
-    storvsc_debug("storvsc ringbuffer size: %d, max_io: %d",
-                  sc->hs_drv_props->drv_ringbuffer_size,
-                  sc->hs_drv_props->drv_max_ios_per_target);
 
     spin_lock_init(&sc->hs_lock); //hvslck
 
-    storvsc_init_requests(sc);
-
     hv_storvsc_connect_vsp(sc);
 
+    /* the request pool is sized for the number of channels */
+    sc->hs_drv_props->drv_max_ios_per_target =
+        MIN(HV_STORVSC_MAX_IO * sc->hs_nchan, HV_STORVSC_MAX_IO_TOTAL);
+    storvsc_debug("storvsc ringbuffer size: %d, max_io: %d",
+                  sc->hs_drv_props->drv_ringbuffer_size,
+                  sc->hs_drv_props->drv_max_ios_per_target);
+    storvsc_init_requests(sc);
+
     // scan bus
     for (int targ = 0; targ < STORVSC_MAX_TARGETS; targ++)
         storvsc_report_luns(sc, targ);
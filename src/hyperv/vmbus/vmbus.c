@@ -17,6 +17,8 @@
 
 static void         vmbus_chanmsg_handle(vmbus_dev,
                     const struct vmbus_message *);
+static void         vmbus_chanmsg_choffer(vmbus_dev,
+                    const struct vmbus_message *);
 
 static const uint32_t       vmbus_version[] = {
     VMBUS_VERSION_WIN10,
@@ -28,7 +30,7 @@ static const uint32_t       vmbus_version[] = {
 
 static const vmbus_chanmsg_proc_t
 vmbus_chanmsg_handlers[VMBUS_CHANMSG_TYPE_MAX] = {
-    VMBUS_CHANMSG_PROC_WAKEUP(CHOFFER),
+    VMBUS_CHANMSG_PROC(CHOFFER, vmbus_chanmsg_choffer),
     VMBUS_CHANMSG_PROC_WAKEUP(CHOFFER_DONE),
     VMBUS_CHANMSG_PROC_WAKEUP(CONNECT_RESP)
 };
@@ -454,6 +456,24 @@ vmbus_init(vmbus_dev dev)
     return false;
 }
 
+/*
+ * Primary channel offers are collected by vmbus_probe_channels(); sub-channels
+ * are offered later, when requested by the device driver through its own
+ * protocol, and are linked to their primary channel as they arrive.
+ */
+static void
+vmbus_chanmsg_choffer(vmbus_dev sc, const struct vmbus_message *msg)
+{
+    const struct vmbus_chanmsg_choffer *offer = (const struct vmbus_chanmsg_choffer *)msg->msg_data;
+
+    if (offer->chm_subidx != 0) {
+        if (vmbus_chan_choffer_open_channel(sc, msg) == NULL)
+            vmbus_debug("failed to add sub-channel %d", offer->chm_chanid);
+        return;
+    }
+    vmbus_msghc_wakeup(sc, msg);
+}
+
 static void
 vmbus_chanmsg_handle(vmbus_dev sc, const struct vmbus_message *msg)
 {
@@ -1052,6 +1052,58 @@ vmbus_chan_is_revoked(const struct vmbus_channel *chan)
     return (false);
 }
 
+#define VMBUS_SUBCHAN_WAIT_MS   1000
+
+/*
+ * Waits for the offers of count sub-channels of a primary channel, which the
+ * device has been asked to allocate, and stores them in subchan; returns the
+ * number of sub-channels that have been offered.
+ */
+int
+vmbus_subchan_get(struct vmbus_channel *prichan, struct vmbus_channel **subchan, int count)
+{
+    vmbus_dev sc = prichan->ch_vmbus;
+
+    assert(VMBUS_CHAN_ISPRIMARY(prichan));
+    for (int i = 0; prichan->ch_subchan_cnt < count; i++) {
+        if (i == VMBUS_SUBCHAN_WAIT_MS) {
+            vmbus_chan_debug("chan%d: %d of %d sub-channels offered",
+                             prichan->ch_id, prichan->ch_subchan_cnt, count);
+            break;
+        }
+        vmbus_poll_messages(sc);
+        kernel_delay(milliseconds(1));
+    }
+
+    int n = 0;
+    u64 flags = spin_lock_irq(&prichan->ch_subchan_lock);
+    list_foreach(&prichan->ch_subchans, l) {
+        if (n == count)
+            break;
+        subchan[n++] = struct_from_list(l, struct vmbus_channel *, ch_sublink);
+    }
+    spin_unlock_irq(&prichan->ch_subchan_lock, flags);
+    return n;
+}
+
+/*
+ * Returns the index of the channel used by a CPU in a multi-channel device
+ * with nchan channels: as in the other multi-queue drivers, channels are
+ * assigned to groups of consecutive CPUs, with any excess CPUs going to the
+ * first channels.
+ */
+int
+vmbus_chan_cpu_to_index(int cpu, int nchan)
+{
+    int cpus_per_chan = total_processors / nchan;
+    int excess_cpus = total_processors - cpus_per_chan * nchan;
+    int excess_limit = excess_cpus * (cpus_per_chan + 1);
+
+    if (cpu < excess_limit)
+        return (cpu / (cpus_per_chan + 1));
+    return (excess_cpus + (cpu - excess_limit) / cpus_per_chan);
+}
+
 void
 vmbus_chan_poll_messages(struct vmbus_channel *chan)
 {
@@ -1,21 +1,95 @@
 #include <kernel.h>
 #include <dma.h>
 
+/* Per-CPU pool of bounce buffers, made of contiguous slots tracked by a bitmap of free slots; slots
+ * are allocated and freed (possibly by a different CPU) without locking. */
+typedef struct dma_bounce_pool {
+    void *base;
+    u64 free;
+} *dma_bounce_pool;
+
 BSS_RO_AFTER_INIT static struct {
     heap general;
     heap io;
+    backed_heap backed;
     boolean bounce_buffering;
+    dma_bounce_pool pools;
+    int pool_count;
 } dma;
 
 void dma_init(kernel_heaps kh)
 {
     dma.general = heap_locked(kh);
     dma.io = kh->dma;
+    dma.backed = heap_linear_backed(kh);
     dma.bounce_buffering = (dma.io != dma.general);
 }
 
-closure_function(6, 1, void, dma_sg_io_complete,
-                 sg_list, sg, sg_list, dma_sg, void *, buf, u64, buf_size, boolean, write, status_handler, completion,
+boolean dma_percpu_init(int cpu_count)
+{
+    if (!dma.bounce_buffering)
+        return true;
+    dma_bounce_pool pools = allocate(dma.general, cpu_count * sizeof(pools[0]));
+    if (pools == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        void *base = allocate((heap)dma.backed, DMA_BOUNCE_POOL_SIZE);
+        if (base == INVALID_ADDRESS) {
+            while (--cpu >= 0)
+                deallocate((heap)dma.backed, pools[cpu].base, DMA_BOUNCE_POOL_SIZE);
+            deallocate(dma.general, pools, cpu_count * sizeof(pools[0]));
+            return false;
+        }
+        pools[cpu].base = base;
+        pools[cpu].free = MASK(DMA_BOUNCE_POOL_SLOTS);
+    }
+    dma.pool_count = cpu_count;
+    write_barrier();
+    dma.pools = pools;
+    return true;
+}
+
+static void *dma_bounce_alloc(u64 len, dma_bounce_pool *pool)
+{
+    u64 slots = (len + DMA_BOUNCE_SLOT_SIZE - 1) / DMA_BOUNCE_SLOT_SIZE;
+    if (dma.pools && (slots <= DMA_BOUNCE_POOL_SLOTS)) {
+        dma_bounce_pool p = &dma.pools[current_cpu()->id];
+        u64 mask = MASK(slots);
+        u64 free;
+        while ((free = p->free)) {
+            int slot;
+            for (slot = 0; slot <= DMA_BOUNCE_POOL_SLOTS - slots; slot++) {
+                if (((free >> slot) & mask) == mask)
+                    break;
+            }
+            if (slot > DMA_BOUNCE_POOL_SLOTS - slots)
+                break;
+            if (compare_and_swap_64(&p->free, free, free & ~(mask << slot))) {
+                *pool = p;
+                return p->base + slot * DMA_BOUNCE_SLOT_SIZE;
+            }
+        }
+    }
+    *pool = 0;
+    return allocate(dma.io, len);
+}
+
+static void dma_bounce_dealloc(dma_bounce_pool pool, void *buf, u64 len)
+{
+    if (!pool) {
+        deallocate(dma.io, buf, len);
+        return;
+    }
+    u64 slots = (len + DMA_BOUNCE_SLOT_SIZE - 1) / DMA_BOUNCE_SLOT_SIZE;
+    u64 mask = MASK(slots) << ((buf - pool->base) / DMA_BOUNCE_SLOT_SIZE);
+    u64 free;
+    do {
+        free = pool->free;
+    } while (!compare_and_swap_64(&pool->free, free, free | mask));
+}
+
+closure_function(7, 1, void, dma_sg_io_complete,
+                 sg_list, sg, sg_list, dma_sg, void *, buf, u64, buf_size, dma_bounce_pool, pool, boolean, write, status_handler, completion,
                  status s)
 {
     sg_list sg = bound(sg);
@@ -24,7 +98,7 @@ closure_function(6, 1, void, dma_sg_io_complete,
     u64 buf_size = bound(buf_size);
     if (!bound(write) && is_ok(s))
         sg_copy_from_buf(buf, sg, buf_size - dma_sg->count);
-    deallocate(dma.io, buf, buf_size);
+    dma_bounce_dealloc(bound(pool), buf, buf_size);
     deallocate_sg_list(dma_sg);
     apply(bound(completion), s);
     closure_finish();
@@ -40,11 +114,12 @@ void dma_sg_io(sg_io op, sg_list sg, range r, boolean write, status_handler comp
     if (dma_sg == INVALID_ADDRESS)
         goto oom;
     u64 len = sg->count;
-    void *buf = allocate(dma.io, len);
+    dma_bounce_pool pool;
+    void *buf = dma_bounce_alloc(len, &pool);
     if (buf == INVALID_ADDRESS)
         goto err_buf;
     status_handler dma_completion = closure(dma.general, dma_sg_io_complete, sg, dma_sg, buf, len,
-                                            write, completion);
+                                            pool, write, completion);
     if (dma_completion == INVALID_ADDRESS)
         goto err_closure;
     sg_buf sgb = sg_list_tail_add(dma_sg, len);
@@ -57,7 +132,7 @@ void dma_sg_io(sg_io op, sg_list sg, range r, boolean write, status_handler comp
     apply(op, dma_sg, r, dma_completion);
     return;
   err_closure:
-    deallocate(dma.io, buf, len);
+    dma_bounce_dealloc(pool, buf, len);
   err_buf:
     deallocate_sg_list(dma_sg);
   oom:
@@ -6,11 +6,13 @@ heap heap_dma(void);
 #ifdef DMA_BUFFERING
 
 void dma_init(kernel_heaps kh);
+boolean dma_percpu_init(int cpu_count);
 void dma_sg_io(sg_io op, sg_list sg, range r, boolean write, status_handler completion);
 
 #else
 
 static inline void dma_init(void *arg) {}
+static inline boolean dma_percpu_init(int cpu_count) {return true;}
 
 static inline void dma_sg_io(sg_io op, sg_list sg, range r, boolean write,
                              status_handler completion)
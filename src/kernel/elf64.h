@@ -121,6 +121,7 @@ typedef struct {
  */
 
 #define PT_LOAD 1
+#define PT_DYNAMIC 2
 #define PT_INTERP 3
 #define PT_NOTE 4
 
@@ -226,7 +227,9 @@ typedef struct {
 #define DT_RELA     7
 #define DT_RELASZ   8
 #define DT_RELAENT  9
+#define DT_RPATH    15
 #define DT_JMPREL   23
+#define DT_RUNPATH  29
 #define DT_RELACOUNT    0x6ffffff9
 
 #define SHT_PROGBITS 1
@@ -255,6 +258,7 @@ typedef struct {
     for (int __i = 0; __i< __e->e_shnum; __i++) \
         for (Elf64_Shdr *__s = (void *)__e + __e->e_shoff + (__i * __e->e_shentsize); __s ; __s = 0) \
 
+#if defined(KERNEL) || defined(BOOT)
 /* returns virtual address to access map (e.g. vaddr or identity in stage2) */
 closure_type(elf_map_handler, boolean, u64 vaddr, u64 offset, u64 data_size, u64 bss_size,
              pageflags flags);
@@ -271,6 +275,7 @@ boolean elf_plt_get(buffer elf, u64 *addr, u64 *offset, u64 *size);
 void walk_elf(buffer elf, range_handler rh);
 void *load_elf(buffer elf, u64 load_offset, elf_map_handler mapper);
 void load_elf_to_physical(heap h, elf_loader loader, u64 *entry, status_handler sh);
+#endif
 
 /* Architecture-specific */
 closure_type(elf_sym_relocator, boolean, Elf64_Rela *rel);
@@ -4,6 +4,7 @@
 #define MAX_FLUSH_ENTRIES 1024
 #define COMP_QUEUE_SIZE (MAX_FLUSH_ENTRIES*2)
 #define ENTRIES_SERVICE_THRESHOLD (MAX_FLUSH_ENTRIES/2)
+#define FLUSH_COMPLETION_BATCH 16
 
 BSS_RO_AFTER_INIT static boolean initialized;
 BSS_RO_AFTER_INIT static int flush_ipi;
@@ -15,6 +16,8 @@ static volatile boolean service_scheduled;
 BSS_RO_AFTER_INIT static thunk flush_service;
 BSS_RO_AFTER_INIT static queue flush_completion_queue;
 static struct rw_spinlock flush_lock;
+BSS_RO_AFTER_INIT static int target_words;
+BSS_RO_AFTER_INIT boolean (*pv_flush_tlb_deferred)(u64 cpu);
 
 static void queue_flush_service(void);
 
@@ -23,10 +26,12 @@ struct flush_entry {
     u64 gen;
     struct refcount ref;
     boolean flush;
+    boolean kernel;     /* includes kernel addresses */
     u64 pages[FLUSH_THRESHOLD];
     int npages;
     status_handler completion;
     closure_struct(thunk, finish);
+    u64 *targets;       /* CPUs that have yet to acknowledge this entry */
 };
 
 closure_func_basic(thunk, void, flush_complete)
@@ -41,17 +46,29 @@ static void _flush_handler(void)
     /* Each generation has at least one page, so if the gen difference is
      * greater than FLUSH_THRESHOLD, just do a full tlb flush */
     boolean full_flush = inval_gen - ci->inval_gen > FLUSH_THRESHOLD;
+    boolean kernel = false;
 
     spin_rlock(&flush_lock);
+    /* entries skipped while this CPU was idle may have been retired already */
+    boolean lazy = ci->flush_lazy;
+    ci->flush_lazy = false;
     while (ci->inval_gen != inval_gen) {
         word oldgen = ci->inval_gen;
         ci->inval_gen = inval_gen;
+        word next = oldgen + 1;
         list_foreach(&entries, l) {
             flush_entry f = struct_from_list(l, flush_entry, l);
             if (f->gen <= oldgen)
                 continue;
             if (f->gen > ci->inval_gen)
                 break;
+            /* A missing generation is an entry that did not target this CPU and has since been
+             * retired; if this CPU was skipped because it was idle, its pages are unknown. */
+            if (lazy && (f->gen != next))
+                full_flush = true;
+            next = f->gen + 1;
+            if (f->kernel)
+                kernel = true;
             if (!full_flush) {
                 if (f->flush)
                     full_flush = true;
@@ -60,12 +77,19 @@ static void _flush_handler(void)
                         invalidate(f->pages[i]);
                 }
             }
-            refcount_release(&f->ref);
+            if (atomic_test_and_clear_bit(f->targets, ci->id))
+                refcount_release(&f->ref);
         }
+        if (lazy && (next != ci->inval_gen + 1))
+            full_flush = true;
     }
     spin_runlock(&flush_lock);
 
-    flush_tlb(full_flush);
+    /* a full flush leaves global (kernel) entries alone unless kernel mappings have changed */
+    if (full_flush && kernel)
+        flush_tlb_global();
+    else
+        flush_tlb(full_flush);
 }
 
 closure_function(0, 0, void, flush_handler)
@@ -73,15 +97,31 @@ closure_function(0, 0, void, flush_handler)
     _flush_handler();
 }
 
+/* Called by a CPU before it starts running work; this is where idle CPUs, which are not
+ * interrupted for user mapping invalidations, catch up with them. */
 void page_invalidate_flush(void)
 {
-    if (initialized)
+    if (initialized) {
+        /* order the CPU state update before reading the invalidation generation */
+        memory_barrier();
         _flush_handler();
+    }
+}
+
+/* Called by a CPU coming online before it is counted in total_processors (and thus can be selected
+ * as a flush target): entries published from now on are caught up with via the invalidation
+ * generation, while the CPU does a global TLB flush once counted to cover earlier entries. */
+void page_invalidate_cpu_online(void)
+{
+    current_cpu()->inval_gen = inval_gen;
+    memory_barrier();
 }
 
 void page_invalidate(flush_entry f, u64 p)
 {
     if (f && initialized) {
+        if (p >= USER_LIMIT)
+            f->kernel = true;
         if (f->flush)
             return;
         f->pages[f->npages++] = p;
@@ -112,17 +152,50 @@ static void service_list(boolean trydefer)
     }
 }
 
+/* Select the CPUs that must take part in invalidating the mappings of f: user mappings can only
+ * be cached by CPUs that have run a user or syscall context, and idle CPUs are left to flush
+ * when they wake up (see page_invalidate_flush()). Kernel mappings are invalidated everywhere.
+ * Called after f has been published, so that a CPU going out of idle either sees the new
+ * generation or is seen as non-idle here. Returns the number of targets besides this CPU. */
+static int select_flush_targets(flush_entry f, cpuinfo self, boolean *all)
+{
+    int n = 0;
+    runtime_memset((void *)f->targets, 0, target_words * sizeof(u64));
+    for (int i = 0; i < total_processors; i++) {
+        if (i == self->id)
+            continue;
+        cpuinfo ci = cpuinfo_from_id(i);
+        if (!f->kernel && ci->user_tlb && (ci->state == cpu_idle))
+            ci->flush_lazy = true;
+        else if (f->kernel || ci->user_tlb) {
+            /* a preempted virtual CPU may have its TLB flushed by the hypervisor when it
+             * resumes, and the invalidations it misses are covered by that flush */
+            if (pv_flush_tlb_deferred && pv_flush_tlb_deferred(i))
+                continue;
+            atomic_set_bit(f->targets, i);
+            n++;
+        }
+    }
+    atomic_set_bit(f->targets, self->id);
+    *all = (n == total_processors - 1);
+    return n;
+}
+
 closure_function(0, 0, void, do_flush_service)
 {
-    status_handler c;
+    status_handler completions[FLUSH_COMPLETION_BATCH];
 
     while (service_scheduled) {
         service_scheduled = false;
         u64 flags = spin_wlock_irq(&flush_lock);
         service_list(false);
         spin_wunlock_irq(&flush_lock, flags);
-        while ((c = dequeue(flush_completion_queue)) != INVALID_ADDRESS)
-            async_apply_status_handler(c, STATUS_OK);
+        u32 n;
+        while ((n = dequeue_batch(flush_completion_queue, (void **)completions,
+                                  FLUSH_COMPLETION_BATCH)) > 0) {
+            for (u32 i = 0; i < n; i++)
+                async_apply_status_handler(completions[i], STATUS_OK);
+        }
     }
 }
 
@@ -141,7 +214,19 @@ static void queue_flush_service(void)
 void page_invalidate_sync(flush_entry f, status_handler completion)
 {
     if (initialized) {
+        u64 flags = irq_disable_save();
+        cpuinfo ci = current_cpu();
+        if (f == ci->flush_batch) {
+            /* this entry will be synced when the batch ends */
+            if (!completion) {
+                irq_restore(flags);
+                return;
+            }
+            assert(!ci->flush_batch_completion);
+            ci->flush_batch = 0;
+        }
         if (f->npages == 0) {
+            irq_restore(flags);
             assert(enqueue(free_flush_entries, f));
             if (completion) {
                 assert(enqueue(flush_completion_queue, completion));
@@ -149,11 +234,7 @@ void page_invalidate_sync(flush_entry f, status_handler completion)
             }
             return;
         }
-        init_refcount(&f->ref, total_processors,
-                      init_closure_func(&f->finish, thunk, flush_complete));
         f->completion = completion;
-
-        u64 flags = irq_disable_save();
         spin_wlock(&flush_lock);
 
         /* The service thunk doesn't always get a chance to run before
@@ -173,9 +254,17 @@ void page_invalidate_sync(flush_entry f, status_handler completion)
         list_push_back(&entries, &f->l);
         entries_count++;
         f->gen = fetch_and_add((word *)&inval_gen, 1) + 1;
+        memory_barrier();
+        boolean all;
+        int n = select_flush_targets(f, ci, &all);
+        init_refcount(&f->ref, n + 1, init_closure_func(&f->finish, thunk, flush_complete));
         spin_wunlock(&flush_lock);
 
-        send_ipi(TARGET_EXCLUSIVE_BROADCAST, flush_ipi);
+        if (all) {
+            send_ipi(TARGET_EXCLUSIVE_BROADCAST, flush_ipi);
+        } else if (n > 0) {
+            send_ipi_mask(f->targets, flush_ipi);
+        }
         _flush_handler();
         irq_restore(flags);
     } else {
@@ -185,27 +274,71 @@ void page_invalidate_sync(flush_entry f, status_handler completion)
     }
 }
 
-flush_entry get_page_flush_entry(void)
+static flush_entry alloc_flush_entry(void)
 {
     flush_entry fe;
 
+    /* This spins because it must succeed */
+    while ((fe = dequeue(free_flush_entries)) == INVALID_ADDRESS)
+        kern_pause();
+
+    assert(fe != INVALID_ADDRESS);
+    u64 *targets = fe->targets;
+    runtime_memset((void *)fe, 0, sizeof(*fe));
+    fe->targets = targets;
+    return fe;
+}
+
+flush_entry get_page_flush_entry(void)
+{
     if (!initialized)
         return 0;
 
     u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
     /* Do the flush work here if this cpu gets too far behind which
         * can happen with large mapping operations */
-    if (inval_gen - current_cpu()->inval_gen > FLUSH_THRESHOLD)
+    if (inval_gen - ci->inval_gen > FLUSH_THRESHOLD)
         _flush_handler();
+    flush_entry fe;
+    if (ci->flush_batch_depth > 0) {
+        if (!ci->flush_batch)
+            ci->flush_batch = alloc_flush_entry();
+        fe = ci->flush_batch;
+    } else {
+        fe = 0;
+    }
     irq_restore(flags);
+    return fe ? fe : alloc_flush_entry();
+}
 
-    /* This spins because it must succeed */
-    while ((fe = dequeue(free_flush_entries)) == INVALID_ADDRESS)
-        kern_pause();
+/* Between page_flush_batch_start() and page_flush_batch_end(), all flush entries obtained on
+ * this CPU are the same entry, and syncing it without a completion is deferred to the end of
+ * the batch, so that a sequence of mapping updates (e.g. unmapping several areas in one munmap
+ * call) results in a single TLB shootdown. The caller must stay on this CPU (i.e. run with
+ * interrupts disabled, as under the vmap lock) for the whole batch. Work that must wait for the
+ * shootdown can be attached to the batch via the flush_batch_completion field of the CPU. */
+void page_flush_batch_start(void)
+{
+    if (initialized)
+        current_cpu()->flush_batch_depth++;
+}
 
-    assert(fe != INVALID_ADDRESS);
-    runtime_memset((void *)fe, 0, sizeof(*fe));
-    return fe;
+void page_flush_batch_end(void)
+{
+    if (!initialized)
+        return;
+    cpuinfo ci = current_cpu();
+    assert(ci->flush_batch_depth > 0);
+    if (--ci->flush_batch_depth == 0) {
+        flush_entry fe = ci->flush_batch;
+        if (fe) {
+            status_handler completion = ci->flush_batch_completion;
+            ci->flush_batch = 0;
+            ci->flush_batch_completion = 0;
+            page_invalidate_sync(fe, completion);
+        }
+    }
 }
 
 void init_flush(heap h)
@@ -218,7 +351,13 @@ void init_flush(heap h)
     flush_completion_queue = allocate_queue(h, COMP_QUEUE_SIZE);
     flush_entry fa = allocate(h, sizeof(struct flush_entry) * MAX_FLUSH_ENTRIES);
     assert(fa);
-    for (flush_entry f = fa; f < fa + MAX_FLUSH_ENTRIES; f++)
+    target_words = pad(present_processors, 64) / 64;
+    u64 *targets = allocate_zero(h, target_words * sizeof(u64) * MAX_FLUSH_ENTRIES);
+    assert(targets != INVALID_ADDRESS);
+    for (flush_entry f = fa; f < fa + MAX_FLUSH_ENTRIES; f++) {
+        f->targets = targets;
+        targets += target_words;
         assert(enqueue(free_flush_entries, f));
+    }
     initialized = true;
 }
@@ -17,11 +17,6 @@
 #define init_debug(x, ...)
 #endif
 
-typedef struct mm_cleaner {
-    struct list l;
-    mem_cleaner cleaner;
-} *mm_cleaner;
-
 BSS_RO_AFTER_INIT filesystem root_fs;
 BSS_RO_AFTER_INIT halt_handler vm_halt;
 BSS_RO_AFTER_INIT u64 kas_kern_offset;
@@ -55,16 +50,21 @@ static u64 bootstrap_alloc(heap h, bytes length)
 BSS_RO_AFTER_INIT static struct kernel_heaps heaps;
 BSS_RO_AFTER_INIT static vector shutdown_completions;
 
+/* In theory, when initializing the physical heap, the bootstrap heap must accommodate 1 bit per
+ * physical memory page (as needed by the id heap bitmap); but due to the way buffer extension
+ * works, when an id heap is pre-allocated, its bitmap allocates twice the amount of memory
+ * needed; thus, the bootstrap heap needs twice the theoretical amount of memory.
+ * The bitmap summaries need 2 bits per 64 pages, i.e. (doubled as above) 1 byte per 128 pages. */
+#define bootstrap_phys_meta_size(page_count)    \
+    (pad((page_count) >> 2, PAGESIZE) + pad((page_count) >> 7, PAGESIZE))
+
 u64 init_bootstrap_heap(u64 phys_length)
 {
     u64 page_count = phys_length >> PAGELOG;
 
-    /* In theory, when initializing the physical heap, the bootstrap heap must accommodate 1 bit per
-     * physical memory page (as needed by the id heap bitmap); but due to the way buffer extension
-     * works, when an id heap is pre-allocated, its bitmap allocates twice the amount of memory
-     * needed; thus, the bootstrap heap needs twice the theoretical amount of memory.
-     * In addition, we need some extra space for various initial allocations. */
-    u64 bootstrap_size = 8 * PAGESIZE + pad(page_count >> 2, PAGESIZE);
+    /* In addition to the physical heap metadata, we need some extra space for various initial
+     * allocations. */
+    u64 bootstrap_size = 8 * PAGESIZE + bootstrap_phys_meta_size(page_count);
 
     bootstrap_limit = BOOTSTRAP_BASE + bootstrap_size;
     return bootstrap_size;
@@ -166,12 +166,10 @@ void init_kernel_heaps(void)
                                     true);
     int max_mcache_order = is_lowmem ? MAX_LOWMEM_MCACHE_ORDER : MAX_MCACHE_ORDER;
     bytes pagesize = is_lowmem ? U64_FROM_BIT(max_mcache_order + 1) : PAGESIZE_2M;
-    heaps.general = allocate_mcache(&bootstrap, (heap)heaps.page_backed, 5, max_mcache_order,
-                                    pagesize, false);
+    heaps.general = allocate_locking_mcache(&bootstrap, (heap)heaps.page_backed, 5,
+                                            max_mcache_order, pagesize, false);
     assert(heaps.general != INVALID_ADDRESS);
-
-    heaps.locked = locking_heap_wrapper(heaps.general, heaps.general);
-    assert(heaps.locked != INVALID_ADDRESS);
+    heaps.locked = heaps.general;
 
     if (kernmem_equals_dmamem) {
         heaps.dma = heaps.locked;
@@ -183,10 +181,8 @@ void init_kernel_heaps(void)
 
     /* The malloc-style heap is used by the network stack to allocate network packets, thus it must
      * be backed by a DMA-compatible heap. */
-    heaps.malloc = allocate_mcache(heaps.locked, (heap)heaps.linear_backed, 5, max_mcache_order,
-                                   pagesize, true);
-    assert(heaps.malloc != INVALID_ADDRESS);
-    heaps.malloc = locking_heap_wrapper(heaps.general, heaps.malloc);
+    heaps.malloc = allocate_locking_mcache(heaps.locked, (heap)heaps.linear_backed, 5,
+                                           max_mcache_order, pagesize, true);
     assert(heaps.malloc != INVALID_ADDRESS);
 
     id_heap kas_ih = create_id_heap(heaps.general, heaps.locked,
@@ -198,6 +194,44 @@ void init_kernel_heaps(void)
     kas_heap = (heap)kas_ih;
 }
 
+/* Adds a range of hotpluggable memory to the physical heap; the memory is offline (i.e. not
+ * available for allocation) until it is plugged and brought online with id_heap_set_online().
+ * Must be called during boot (e.g. when attaching a device), before the bootstrap heap state
+ * becomes read-only. */
+boolean kernel_add_hotplug_memory(range r)
+{
+    /* The physical heap metadata for the new range is allocated from the bootstrap heap while
+     * holding the physical heap lock: make sure the bootstrap heap does not need to grow (which
+     * would allocate from the physical heap) at that point. */
+    u64 meta_size = PAGESIZE + bootstrap_phys_meta_size(range_span(r) >> PAGELOG);
+    if (bootstrap_base + meta_size > bootstrap_limit) {
+        u64 alloc = pad(bootstrap_base + meta_size - bootstrap_limit, PAGESIZE);
+        u64 pa = allocate_u64((heap)heaps.physical, alloc);
+        if (pa == INVALID_PHYSICAL)
+            return false;
+        map(bootstrap_limit, pa, alloc, pageflags_kernel_data());
+        bootstrap_limit += alloc;
+    }
+    linear_backed_map_phys(r);
+    return id_heap_add_offline_range(heaps.physical, r.start, range_span(r));
+}
+
+/* Enables per-CPU object magazines in the general-purpose heaps, per-CPU page magazines in the
+ * physical memory heap, per-CPU sg_list caches, per-CPU random number pools, per-CPU DMA bounce
+ * buffer pools and per-CPU page cache LRU batches, so that most small allocations and deallocations
+ * do not contend for the heap and free list locks, and neither random number generation nor page
+ * cache hits serialize CPUs. */
+static void init_kernel_heaps_percpu(void)
+{
+    assert(mcache_percpu_init(heaps.general, present_processors));
+    assert(mcache_percpu_init(heaps.malloc, present_processors));
+    assert(sg_percpu_init(present_processors));
+    assert(random_percpu_init(heaps.locked, present_processors));
+    assert(dma_percpu_init(present_processors));
+    assert(id_heap_percpu_init(heaps.physical, present_processors));
+    assert(pagecache_percpu_init(present_processors));
+}
+
 heap heap_dma(void)
 {
     return heaps.dma;
@@ -255,6 +289,7 @@ closure_function(4, 2, void, fsstarted,
     u8 *mbr = bound(mbr);
     root_fs = fs;
     storage_set_root_fs(fs);
+    boot_phase(ss("rootfs mounted"));
 
     tuple fs_root = filesystem_getroot(fs);
     wrapped_root = tuple_notifier_wrap(fs_root, true);
@@ -294,6 +329,7 @@ closure_function(4, 2, void, fsstarted,
         init_klib(init_heaps, fs, root, apply_merge(m));
 
     config_console(root);
+    config_scheduler(root);
     status_handler complete = bound(complete);
     apply(complete, STATUS_OK);
     closure_finish();
@@ -399,99 +435,6 @@ void cmdline_apply(char *cmdline_start, int cmdline_len, tuple t)
     }
 }
 
-#ifdef MM_DEBUG
-#define mm_debug(x, ...) do {tprintf(sym(mm), 0, ss(x), ##__VA_ARGS__);} while(0)
-#else
-#define mm_debug(x, ...) do { } while(0)
-#endif
-
-static struct list mm_cleaners;
-static struct spinlock mm_lock;
-
-static u64 mm_clean(u64 clean_bytes)
-{
-    s64 remain = clean_bytes;
-    spin_lock(&mm_lock);
-    list end = list_end(&mm_cleaners);
-    list last = end->prev;
-    list e = list_begin(&mm_cleaners);
-    while (e != end) {
-        mm_cleaner mmc = struct_from_list(e, mm_cleaner, l);
-        remain -= apply(mmc->cleaner, remain);
-        if (remain <= 0)
-            break;
-
-        /* This cleaner couldn't satisfy the clean request: move it to the back of the list, i.e.
-         * de-prioritize it for future requests. */
-        list next = e->next;
-        list_delete(e);
-        list_push_back(&mm_cleaners, e);
-
-        if (e == last)
-            /* any further elements down the list are cleaners that couldn't satisfy this request */
-            break;
-        e = next;
-    }
-    spin_unlock(&mm_lock);
-    u64 cleaned = clean_bytes - remain;
-    if (cleaned)
-        /* Memory cleaners may have deallocated page heap memory: drain the page heap, so that
-         * deallocated memory can be returned to the physical heap. */
-        cache_drain(init_heaps->pages, cleaned, 0);
-    return cleaned;
-}
-
-boolean mm_register_mem_cleaner(mem_cleaner cleaner)
-{
-    mm_cleaner mmc = allocate(heap_locked(init_heaps), sizeof(*mmc));
-    if (mmc == INVALID_ADDRESS)
-        return false;
-    mmc->cleaner = cleaner;
-    spin_lock(&mm_lock);
-    list_push_back(&mm_cleaners, &mmc->l);
-    spin_unlock(&mm_lock);
-    return true;
-}
-
-closure_function(1, 1, void, mm_service_sync,
-                 context, ctx,
-                 status s)
-{
-    if (!is_ok(s)) {
-        mm_debug("%s: storage sync failed: %v\n", func_ss, s);
-        timm_dealloc(s);
-    }
-    context_schedule_return(bound(ctx));
-    closure_finish();
-}
-
-void mm_service(boolean flush)
-{
-    heap phys = (heap)heap_physical(init_heaps);
-    u64 total = heap_total(phys);
-    u64 free = total - heap_allocated(phys);
-    u64 threshold = total >> MEM_CLEAN_THRESHOLD_SHIFT;
-    if (threshold < MEM_CLEAN_THRESHOLD)
-        threshold = MEM_CLEAN_THRESHOLD;
-    mm_debug("%s: total %ld, alloc %ld, free %ld\n", func_ss,
-             heap_total(phys), heap_allocated(phys), free);
-    if (free < threshold) {
-        u64 clean_bytes = threshold - free;
-        u64 cleaned = mm_clean(clean_bytes);
-        if (cleaned > 0)
-            mm_debug("   cleaned %ld / %ld requested...\n", cleaned, clean_bytes);
-        if ((cleaned < clean_bytes) && flush) {
-            context ctx = get_current_context(current_cpu());
-            status_handler complete = closure(heap_locked(init_heaps), mm_service_sync, ctx);
-            if (complete != INVALID_ADDRESS) {
-                context_pre_suspend(ctx);
-                storage_sync(complete);
-                context_suspend();
-            }
-        }
-    }
-}
-
 kernel_heaps get_kernel_heaps(void)
 {
     return &heaps;
@@ -517,16 +460,33 @@ tuple get_environment(void)
     return get(get_root_tuple(), sym(environment));
 }
 
+/* Stages between a filesystem and its storage device: the optional I/O scheduler orders requests by
+ * priority class, and the plug stage merges adjacent requests on their way to the device. */
+static storage_req_handler storage_stages_init(heap h, storage_req_handler target)
+{
+    storage_req_handler plug = storage_plug_init(h, target);
+    if (plug != INVALID_ADDRESS)
+        target = plug;
+    if (storage_sched_enabled()) {
+        storage_req_handler sched = storage_sched_init(h, target);
+        if (sched != INVALID_ADDRESS)
+            target = sched;
+    }
+    return target;
+}
+
 static void rootfs_init(u8 *mbr, u64 offset, storage_req_handler req_handler, u64 length,
                         void *start, status_handler complete)
 {
     init_debug("%s", func_ss);
     length -= offset;
     heap h = heap_locked(init_heaps);
+    storage_req_handler fs_req_handler = closure(h, offset_req_handler, offset, req_handler);
+    assert(fs_req_handler != INVALID_ADDRESS);
     create_filesystem(h,
                       SECTOR_SIZE,
                       length,
-                      closure(h, offset_req_handler, offset, req_handler),
+                      storage_stages_init(h, fs_req_handler),
                       false,
                       sstring_null(),
                       closure(h, fsstarted, mbr, req_handler, start, complete));
@@ -536,7 +496,8 @@ closure_function(2, 2, void, volume_fs_init,
                  storage_req_handler, req_handler, u64, length,
                  boolean readonly, filesystem_complete complete)
 {
-    create_filesystem(heap_locked(init_heaps), SECTOR_SIZE, bound(length), bound(req_handler),
+    heap h = heap_locked(init_heaps);
+    create_filesystem(h, SECTOR_SIZE, bound(length), storage_stages_init(h, bound(req_handler)),
                       readonly, sstring_null() /* no label */, complete);
     closure_finish();
 }
@@ -546,6 +507,7 @@ closure_function(6, 1, void, mbr_read,
                  status s)
 {
     init_debug("%s", func_ss);
+    boot_phase(ss("partitions read"));
     if (!is_ok(s)) {
         msg_err("unable to read partitions: %v\n", s);
         goto out;
@@ -587,6 +549,7 @@ closure_function(2, 3, void, attach_storage,
 {
     heap h = heap_locked(init_heaps);
     heap bh = (heap)heap_linear_backed(init_heaps);
+    boot_phase(ss("storage attached"));
     /* Read partition table from disk, use backed heap for guaranteed alignment */
     u8 *mbr = allocate(bh, PAGESIZE);
     if (mbr == INVALID_ADDRESS) {
@@ -628,6 +591,65 @@ static void read_kernel_syms(void)
     unmap(v, kern_len);
 }
 
+static heap accounted_tagged_region(kernel_heaps kh, u64 tag, bytes pagesize, boolean locking,
+                                    sstring name)
+{
+    heap h = mem_account_heap(heap_locked(kh), allocate_tagged_region(kh, tag, pagesize, locking),
+                              name);
+    assert(h != INVALID_ADDRESS);
+    return h;
+}
+
+#define BOOT_PHASES_MAX 128
+
+static struct boot_phase {
+    sstring name;
+    int dev;
+    u32 cpu;
+    timestamp t;    /* set last, 0 while the entry is being written */
+} boot_phases[BOOT_PHASES_MAX];
+static word boot_phase_count;
+
+void boot_phase_device(sstring name, int dev)
+{
+    word n = fetch_and_add(&boot_phase_count, 1);
+    if (n >= BOOT_PHASES_MAX)
+        return;
+    struct boot_phase *p = &boot_phases[n];
+    p->name = name;
+    p->dev = dev;
+    p->cpu = current_cpu()->id;
+    write_barrier();
+    p->t = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+/* Phases are printed relative to the first one, along with the time elapsed since the previous
+ * phase; PCI devices are identified by bus:slot.function. */
+void boot_phases_print(void)
+{
+    word count = MIN(boot_phase_count, BOOT_PHASES_MAX);
+    read_barrier();
+    timestamp start = boot_phases[0].t;
+    timestamp prev = start;
+    rprintf("boot phases (ms):\n");
+    for (word i = 0; i < count; i++) {
+        struct boot_phase *p = &boot_phases[i];
+        timestamp t = p->t;
+        if (!t)
+            continue;
+        u64 usec = (t > start) ? usec_from_timestamp(t - start) : 0;
+        u64 delta = (t > prev) ? usec_from_timestamp(t - prev) : 0;
+        prev = MAX(prev, t);
+        if (p->dev >= 0)
+            rprintf("  %4ld.%03ld +%ld.%03ld [%d] %s %02x:%02x.%x\n", usec / THOUSAND,
+                    usec % THOUSAND, delta / THOUSAND, delta % THOUSAND, p->cpu, p->name,
+                    p->dev >> 8, (p->dev >> 3) & 0x1f, p->dev & 0x7);
+        else
+            rprintf("  %4ld.%03ld +%ld.%03ld [%d] %s\n", usec / THOUSAND, usec % THOUSAND,
+                    delta / THOUSAND, delta % THOUSAND, p->cpu, p->name);
+    }
+}
+
 void kernel_runtime_init(kernel_heaps kh)
 {
     heap misc = heap_general(kh);
@@ -636,12 +658,13 @@ void kernel_runtime_init(kernel_heaps kh)
     init_heaps = kh;
 
     bytes pagesize = lowmem ? PAGESIZE : PAGESIZE_2M;
-    init_integers(allocate_tagged_region(kh, tag_integer, pagesize, true));
-    init_tuples(allocate_tagged_region(kh, tag_table_tuple, pagesize, true));
-    init_symbols(allocate_tagged_region(kh, tag_symbol, pagesize, false), locked);
-    init_vectors(allocate_tagged_region(kh, tag_vector, pagesize, true), locked);
-    init_strings(allocate_tagged_region(kh, tag_string, pagesize, true), locked);
-    init_management(allocate_tagged_region(kh, tag_function_tuple, pagesize, true), locked);
+    init_integers(accounted_tagged_region(kh, tag_integer, pagesize, true, ss("integers")));
+    init_tuples(accounted_tagged_region(kh, tag_table_tuple, pagesize, true, ss("tuples")));
+    init_symbols(accounted_tagged_region(kh, tag_symbol, pagesize, false, ss("symbols")), locked);
+    init_vectors(accounted_tagged_region(kh, tag_vector, pagesize, true, ss("vectors")), locked);
+    init_strings(accounted_tagged_region(kh, tag_string, pagesize, true, ss("strings")), locked);
+    init_management(accounted_tagged_region(kh, tag_function_tuple, pagesize, true,
+                                            ss("function_tuples")), locked);
 
     /* runtime and console init */
 #ifdef INIT_DEBUG
@@ -651,12 +674,13 @@ void kernel_runtime_init(kernel_heaps kh)
     timm_oom = timm("result", "out of memory");
     init_sg(locked);
     dma_init(kh);
-    list_init(&mm_cleaners);
-    spin_lock_init(&mm_lock);
-    init_pagecache(locked, (heap)kh->pages, PAGESIZE);
+    init_mm_reclaim();
+    heap pagecache_pages = mem_account_heap(locked, (heap)kh->pages, ss("pagecache"));
+    assert(pagecache_pages != INVALID_ADDRESS);
+    init_pagecache(locked, pagecache_pages, PAGESIZE);
     mem_cleaner pc_cleaner = closure_func(misc, mem_cleaner, mm_pagecache_cleaner);
     assert(pc_cleaner != INVALID_ADDRESS);
-    assert(mm_register_mem_cleaner(pc_cleaner));
+    assert(mm_register_mem_cleaner(pc_cleaner, ss("pagecache"), MM_CLEANER_DATA));
     init_extra_prints();
     init_pci(kh);
     init_console(kh);
@@ -673,6 +697,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("clock");
     init_clock();
+    boot_phase(ss("clock"));
 
     init_debug("init_scheduler");
     init_scheduler(locked);
@@ -680,6 +705,7 @@ void kernel_runtime_init(kernel_heaps kh)
     /* platform detection and early init */
     init_debug("probing for hypervisor platform");
     detect_hypervisor(kh);
+    boot_phase(ss("hypervisor detected"));
 
     /* RNG, stack canaries */
     init_debug("RNG");
@@ -689,11 +715,17 @@ void kernel_runtime_init(kernel_heaps kh)
     /* networking */
     init_debug("LWIP init");
     init_net(kh);
+    boot_phase(ss("network stack"));
 
     init_debug("start_secondary_cores");
     count_cpus_present();
+    /* processors hot-added later must not cause the vector to be resized while being read */
+    bytes cpuinfos_size = present_processors * sizeof(cpuinfo);
+    assert(buffer_set_capacity(cpuinfos, cpuinfos_size) == cpuinfos_size);
+    init_kernel_heaps_percpu();
     init_scheduler_cpus(misc);
     start_secondary_cores(kh);
+    boot_phase(ss("secondary cores"));
 
 #ifdef CONFIG_TRACELOG
     init_debug("init_tracelog");
@@ -711,9 +743,13 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("detect_devices");
     detect_devices(kh, sa);
+    boot_phase(ss("devices detected"));
 
+    /* PCI device drivers are probed on the secondary CPUs, while this CPU goes on to service
+       storage attach and root filesystem mount; stage3 starts after all probes have completed. */
     init_debug("pci_discover (for other devices)");
-    pci_discover();
+    pci_discover_parallel(m);
+    boot_phase(ss("pci enumerated"));
     init_debug("discover done");
     apply(complete, STATUS_OK);
 
@@ -811,6 +847,7 @@ static boolean vm_exit_match(u8 exit_code, tuple config, symbol option, boolean
 
 void vm_exit(u8 code)
 {
+    console_flush();
 #ifdef SMP_DUMP_FRAME_RETURN_COUNT
     rprintf("cpu\tframe returns\n");
     cpuinfo ci;
@@ -116,6 +116,56 @@ closure_func_basic(thunk, void, kernel_context_return)
 
 static void kernel_context_pre_suspend(context ctx);
 
+static u64 closure_arena_alloc(heap h, bytes b)
+{
+    closure_arena a = (closure_arena)h;
+    if (b <= CONTEXT_CLOSURE_SLOT_SIZE) {
+        u64 free;
+        while ((free = a->free)) {
+            u64 slot = lsb(free);
+            if (compare_and_swap_64(&a->free, free, free & ~U64_FROM_BIT(slot)))
+                return u64_from_pointer(a->slots[slot]);
+        }
+    }
+    closure_alloc_account();
+    return allocate_u64(a->parent, b);
+}
+
+static void closure_arena_dealloc(heap h, u64 x, bytes b)
+{
+    closure_arena a = (closure_arena)h;
+    u64 offset = x - u64_from_pointer(a->slots);
+    if (offset < sizeof(a->slots)) {
+        atomic_set_bit(&a->free, offset / CONTEXT_CLOSURE_SLOT_SIZE);
+        return;
+    }
+    deallocate_u64(a->parent, x, b);
+}
+
+static void init_closure_arena(closure_arena a, heap parent)
+{
+    zero(&a->h, sizeof(a->h));
+    a->h.alloc = closure_arena_alloc;
+    a->h.dealloc = closure_arena_dealloc;
+    a->h.pagesize = parent->pagesize;
+    a->parent = parent;
+    a->free = MASK(CONTEXT_CLOSURE_SLOTS);
+}
+
+void closure_alloc_account(void)
+{
+    current_cpu()->closure_allocs++;
+}
+
+u64 closure_alloc_count(void)
+{
+    u64 count = 0;
+    cpuinfo ci;
+    vector_foreach(cpuinfos, ci)
+        count += ci->closure_allocs;
+    return count;
+}
+
 void init_kernel_context(kernel_context kc, int type, int size, queue free_ctx_q)
 {
     context c = &kc->context;
@@ -128,7 +178,8 @@ void init_kernel_context(kernel_context kc, int type, int size, queue free_ctx_q
     c->pre_suspend = kernel_context_pre_suspend;
     init_closure_func(&kc->kernel_return, thunk, kernel_context_return);
     c->fault_handler = 0;
-    c->transient_heap = heap_locked(get_kernel_heaps());
+    init_closure_arena(&kc->arena, heap_locked(get_kernel_heaps()));
+    c->transient_heap = &kc->arena.h;
     void *stack_top = ((void *)kc) + size - STACK_ALIGNMENT;
     frame_set_stack_top(c->frame, stack_top);
     kc->size = size;
@@ -186,13 +237,21 @@ cpuinfo init_cpuinfo(heap backed, int cpu)
     assert(ci->free_syscall_contexts != INVALID_ADDRESS);
     ci->free_process_contexts = allocate_queue(backed, FREE_PROCESS_CONTEXT_QUEUE_SIZE);
     assert(ci->free_process_contexts != INVALID_ADDRESS);
+    ci->free_extended_frames = allocate_queue(backed, FREE_EXTENDED_FRAME_QUEUE_SIZE);
+    assert(ci->free_extended_frames != INVALID_ADDRESS);
     ci->cpu_queue = allocate_queue(backed, CPU_QUEUE_SIZE);
     assert(ci->cpu_queue != INVALID_ADDRESS);
+    ci->bhqueue = allocate_queue(backed, CPU_BHQUEUE_SIZE);
+    assert(ci->bhqueue != INVALID_ADDRESS);
+    ci->runqueue = allocate_queue(backed, CPU_RUNQUEUE_SIZE);
+    assert(ci->runqueue != INVALID_ADDRESS);
     ci->last_timer_update = 0;
     ci->targeted_irqs = 0;
     ci->mcs_prev = 0;
     ci->mcs_next = 0;
     ci->mcs_waiting = false;
+    ci->rcu_callbacks = allocate_vector(backed, RCU_CALLBACKS_INITIAL);
+    assert(ci->rcu_callbacks != INVALID_ADDRESS);
     init_cpuinfo_machine(ci, backed);
     return ci;
 }
@@ -277,7 +336,8 @@ u64 hw_get_seed(void)
 u32 irq_get_target_cpu(range cpu_affinity)
 {
     static u32 last_target;
-    if (range_empty(cpu_affinity))
+    boolean any_cpu = range_empty(cpu_affinity);   /* not to be targeted to isolated CPUs */
+    if (any_cpu)
         cpu_affinity = irange(0, total_processors);
     u32 first, last;
     if (point_in_range(cpu_affinity, last_target)) {
@@ -293,15 +353,17 @@ u32 irq_get_target_cpu(range cpu_affinity)
         for (u32 cpu_id = first; ; cpu_id++) {
             if (cpu_id == cpu_affinity.end)
                 cpu_id = cpu_affinity.start;
-            cpuinfo ci = cpuinfo_from_id(cpu_id);
-            int targeted_irqs = ci->targeted_irqs;
-            if (targeted_irqs == irq_count) {
-                ci->targeted_irqs++;
-                cpu = cpu_id;
-                break;
+            if (!any_cpu || !cpu_is_isolated(cpu_id)) {
+                cpuinfo ci = cpuinfo_from_id(cpu_id);
+                int targeted_irqs = ci->targeted_irqs;
+                if (targeted_irqs == irq_count) {
+                    ci->targeted_irqs++;
+                    cpu = cpu_id;
+                    break;
+                }
+                if (targeted_irqs < min_irq)
+                    min_irq = targeted_irqs;
             }
-            if (targeted_irqs < min_irq)
-                min_irq = targeted_irqs;
             if (cpu_id == last)
                 break;
         }
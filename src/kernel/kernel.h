@@ -19,6 +19,7 @@ void runloop_target(void) __attribute__((noreturn));
 #else
 void tprintf(symbol tag, tuple attrs, sstring format, ...);
 #endif
+#include <tracepoint.h>
 
 #ifdef LOCK_STATS
 #include <lockstats.h>
@@ -35,12 +36,23 @@ void tprintf(symbol tag, tuple attrs, sstring format, ...);
 declare_closure_struct(2, 0, void, free_kernel_context,
                        queue, free_ctx_q, boolean, queued);
 
+/* Transient heap of a kernel context: the contextual closures of the operation running in the
+   context are served from a few embedded slots, with larger or excess allocations falling back to
+   the parent heap. Slots may be released from any CPU. */
+typedef struct closure_arena {
+    struct heap h;
+    heap parent;
+    u64 free;                   /* bitmap of free slots */
+    u64 slots[CONTEXT_CLOSURE_SLOTS][CONTEXT_CLOSURE_SLOT_SIZE / sizeof(u64)];
+} *closure_arena;
+
 typedef struct kernel_context {
     struct context context;
     closure_struct(thunk, kernel_return);
     closure_struct(free_kernel_context, free);
     u64 size;
     u64 err_frame[ERR_FRAME_SIZE];  /* must contain all callee-saved registers */
+    struct closure_arena arena;
 } *kernel_context;
 
 void init_kernel_context(kernel_context kc, int type, int size, queue free_ctx_q);
@@ -62,14 +74,60 @@ extern u32 shutting_down;
 
 void kernel_powerdown(void);
 
+/* Scheduling classes: runnable real-time tasks (FIFO and round-robin) always run before fair
+ * tasks, in order of priority (from 1 to SCHED_RT_PRIO_MAX); fair tasks share the CPU in
+ * proportion to their weight. */
+enum sched_class {
+    SCHED_CLASS_FAIR,
+    SCHED_CLASS_FIFO,
+    SCHED_CLASS_RR,
+};
+
+#define SCHED_RT_PRIO_MAX       99
+#define SCHED_WEIGHT_DEFAULT    1024    /* weight of a fair task with nice value 0 */
+
 typedef struct sched_task {
     thunk t;
-    timestamp runtime;
+    timestamp runtime;      /* CPU time used since the task was last enqueued */
+    timestamp enqueued;     /* when the task last became runnable */
+    timestamp wait_time;    /* total time spent runnable in a scheduling queue */
+    u64 runs;
+    u64 migrations;
+    u8 sched_class;
+    u8 rt_prio;
+    s8 nice;
+    u32 weight;
+    timestamp slice;        /* requested time slice of a fair task (0: default) */
+    s64 lag;                /* virtual time owed to a fair task (negative if it ran ahead) */
+    timestamp eligible;     /* virtual eligible time and deadline of an enqueued fair task */
+    timestamp deadline;
+    struct list l;          /* real-time priority list of an enqueued real-time task */
 } *sched_task;
 
+/* Run queue wait histogram: bucket 0 counts waits shorter than 2^SCHED_WAIT_MIN_ORDER
+   nanoseconds, each following bucket doubles the range. */
+#define SCHED_WAIT_BUCKETS      24
+#define SCHED_WAIT_MIN_ORDER    10
+
+typedef struct sched_cpu_stats {
+    u64 runs;
+    u64 migrations_in;      /* tasks pulled from the queue of another CPU */
+    u64 migrations_out;     /* tasks taken from this CPU's queue by another CPU */
+    u64 wakeups;            /* tasks that last ran on another CPU woken up by this CPU */
+    u64 wake_local;         /* woken tasks moved to this CPU */
+    u64 wake_idle;          /* woken tasks moved to an idle CPU in the NUMA node of this CPU */
+    timestamp wait_time;
+    timestamp idle_time;
+    timestamp idle_start;
+    u32 wait_hist[SCHED_WAIT_BUCKETS];
+} *sched_cpu_stats;
+
 typedef struct sched_queue {
-    pqueue q;
-    timestamp min_runtime;
+    pqueue q;               /* fair tasks, by virtual deadline */
+    timestamp vtime;        /* virtual time of the fair class */
+    u64 rt_count;
+    u64 rt_mask[2];         /* non-empty real-time priority lists */
+    struct list rt[SCHED_RT_PRIO_MAX + 1];
     struct spinlock lock;
 } *sched_queue;
 
@@ -80,20 +138,64 @@ struct cpuinfo {
     struct cpuinfo_machine m;
     u32 id;
     int state;
-    queue cpu_queue;
+    queue cpu_queue;    /* CPU-specific operations, never serviced by other CPUs */
+    queue bhqueue;      /* deferred operations enqueued by interrupt handlers on this CPU */
+    queue runqueue;     /* deferred operations enqueued on this CPU */
     struct sched_queue thread_queue;
+    sched_task switch_target;   /* task being made runnable for a direct switch */
+    sched_task switch_to;       /* task to run next, bypassing the thread queue */
+    struct sched_cpu_stats sched_stats;
+    timestamp idle_poll;        /* interval of polling for work before halting when idle */
+    boolean idle_polling;       /* polling while idle: wakeups need no IPI */
+    u8 running_prio;            /* real-time priority of the task being run (0 if fair) */
+    thunk busy_poll;            /* applied by the idle loop until busy_poll_end */
+    timestamp busy_poll_end;
     timestamp last_timer_update;
     int targeted_irqs;
     u64 inval_gen; /* Generation number for invalidates */
+    boolean user_tlb;   /* may hold TLB entries for user mappings */
+    boolean flush_lazy; /* skipped by TLB shootdowns while idle */
+    int flush_batch_depth;
+    flush_entry flush_batch;
+    status_handler flush_batch_completion;  /* invoked when flush_batch has been synced */
 
     cpuinfo mcs_prev;
     cpuinfo mcs_next;
     boolean mcs_waiting;
 
+    u64 closure_allocs;     /* closures allocated from a heap */
+
+    /* last symbol resolved by find_elf_sym() */
+    struct {
+        void *table;
+        u32 index;
+        u32 gen;
+    } symtab_hit;
+
+    /* I/O statistics; the difference between storage requests and completions summed over all
+     * CPUs is the number of requests in flight */
+    u64 net_rx_packets;     /* IP packets received */
+    u64 net_rx_bytes;
+    struct net_napi *net_rx_napi;   /* rx queue whose frames are being input, if any */
+    u64 storage_reqs;       /* requests submitted to storage drivers */
+    u64 storage_completions;
+
+    /* RCU read-side state: rcu_seq is odd while inside a read section */
+    u64 rcu_seq;
+    u32 rcu_nest;
+    vector rcu_callbacks;   /* thunks awaiting a grace period */
+
+#ifdef CONFIG_QSPINLOCK
+    /* queued spinlock waiter nodes, one per lock nesting level */
+    struct qspin_node qspin_nodes[QSPIN_NODES];
+    int qspin_depth;
+#endif
+
     /* multiple producers, single consumer */
     queue free_kernel_contexts;
     queue free_syscall_contexts;
     queue free_process_contexts;
+    queue free_extended_frames; /* extended frames of exited threads */
 #ifdef CONFIG_FTRACE
     int graph_idx;
     struct ftrace_graph_entry * graph_stack;
@@ -110,7 +212,159 @@ struct cpuinfo {
 
 extern vector cpuinfos;
 
-#if defined(KERNEL) && defined(SMP_ENABLE)
+u64 closure_alloc_count(void);
+
+/* Lock contention profiler hooks (see lockprof.c) */
+#define LOCKPROF_SPIN       0
+#define LOCKPROF_MUTEX      1
+#define LOCKPROF_CONTENDED  2   /* lock word flag set by a sampled waiter */
+
+extern boolean lockprof_enabled;
+u64 lockprof_sample_wait(void);
+void lockprof_wait_end(void *lock, int type, u64 start);
+void lockprof_holder(void *lock, int type);
+void lockprof_init(kernel_heaps kh, tuple root);
+
+/* returns the start time of a sampled contended acquisition, or 0 if not sampled */
+static inline u64 lockprof_wait_start(void)
+{
+    return __builtin_expect(lockprof_enabled, 0) ? lockprof_sample_wait() : 0;
+}
+
+#define lockprof_release(l, w, type) do {                                       \
+    if (__builtin_expect(lockprof_enabled, 0) && ((w) & LOCKPROF_CONTENDED))    \
+        lockprof_holder(l, type);                                               \
+} while (0)
+
+#if defined(KERNEL) && defined(SMP_ENABLE) && defined(CONFIG_QSPINLOCK)
+/* Queued spinlocks: the fast path is a single CAS on an unowned lock with no
+   waiters. Contended acquisitions queue up in FIFO order (see qspinlock.c). */
+u64 spin_lock_slowpath(spinlock l);
+
+static inline boolean spin_try(spinlock l)
+{
+    boolean success = compare_and_swap_64(&l->w, 0, QSPIN_LOCKED);
+#ifdef LOCK_STATS
+    LOCKSTATS_RECORD_LOCK(l->s, success, 0, 0);
+#endif
+    return success;
+}
+
+static inline u64 spin_lock_nostats(spinlock l)
+{
+    if (compare_and_swap_64(&l->w, 0, QSPIN_LOCKED))
+        return 0;
+    return spin_lock_slowpath(l);
+}
+
+static inline void spin_unlock_nostats(spinlock l)
+{
+    /* only the locked byte is cleared; the waiter queue tail may be updated
+       concurrently */
+    compiler_barrier();
+    lockprof_release(l, *(volatile u8 *)&l->w, LOCKPROF_SPIN);
+    *(volatile u8 *)&l->w = 0;
+}
+
+static inline void spin_lock(spinlock l)
+{
+#ifdef LOCK_STATS
+    u64 spins = spin_lock_nostats(l);
+    LOCKSTATS_RECORD_LOCK(l->s, true, spins, 0);
+#else
+    spin_lock_nostats(l);
+#endif
+}
+
+static inline void spin_unlock(spinlock l)
+{
+#ifdef LOCK_STATS
+    LOCKSTATS_RECORD_UNLOCK(l->s);
+#endif
+    spin_unlock_nostats(l);
+}
+
+/* Fair reader-writer lock, after the Linux qrwlock: l->readers holds the
+   reader count (in units of QRW_READER_BIAS) and the writer state, and
+   contended lockers of either type wait in turn on the queued spinlock l->l,
+   so that neither readers nor writers can be starved. */
+#define QRW_WLOCKED     1
+#define QRW_WAITING     2
+#define QRW_WMASK       (QRW_WLOCKED | QRW_WAITING)
+#define QRW_READER_BIAS 4
+
+static inline boolean spin_tryrlock(rw_spinlock l)
+{
+    if (*(volatile word *)&l->readers & QRW_WMASK)
+        return false;
+    if (!(fetch_and_add(&l->readers, QRW_READER_BIAS) & QRW_WMASK))
+        return true;
+    fetch_and_add(&l->readers, -QRW_READER_BIAS);
+    return false;
+}
+
+static inline void spin_rlock(rw_spinlock l)
+{
+    if (!(fetch_and_add(&l->readers, QRW_READER_BIAS) & QRW_WMASK))
+        return;
+    fetch_and_add(&l->readers, -QRW_READER_BIAS);
+
+    /* wait in line behind any writer */
+    spin_lock_nostats(&l->l);
+    fetch_and_add(&l->readers, QRW_READER_BIAS);
+    while (*(volatile word *)&l->readers & QRW_WLOCKED)
+        kern_pause();
+    spin_unlock_nostats(&l->l);
+}
+
+static inline void spin_runlock(rw_spinlock l)
+{
+    fetch_and_add(&l->readers, -QRW_READER_BIAS);
+}
+
+static inline boolean spin_trywlock(rw_spinlock l)
+{
+    boolean success = compare_and_swap_64(&l->readers, 0, QRW_WLOCKED);
+#ifdef LOCK_STATS
+    LOCKSTATS_RECORD_LOCK(l->l.s, success, 0, 0);
+#endif
+    return success;
+}
+
+static inline void spin_wlock(rw_spinlock l)
+{
+    u64 spins = 0;
+    if (!compare_and_swap_64(&l->readers, 0, QRW_WLOCKED)) {
+        spins = spin_lock_nostats(&l->l);
+        word r;
+        do {
+            r = *(volatile word *)&l->readers;
+        } while (!compare_and_swap_64(&l->readers, r, r | QRW_WAITING));
+
+        /* wait for readers to drain */
+        while (!compare_and_swap_64(&l->readers, QRW_WAITING, QRW_WLOCKED)) {
+            spins++;
+            kern_pause();
+        }
+        spin_unlock_nostats(&l->l);
+    }
+#ifdef LOCK_STATS
+    LOCKSTATS_RECORD_LOCK(l->l.s, true, spins, 0);
+#else
+    (void)spins;
+#endif
+}
+
+static inline void spin_wunlock(rw_spinlock l)
+{
+#ifdef LOCK_STATS
+    LOCKSTATS_RECORD_UNLOCK(l->l.s);
+#endif
+    fetch_and_add(&l->readers, -QRW_WLOCKED);
+}
+#elif defined(KERNEL) && defined(SMP_ENABLE)
+void spin_lock_contended(spinlock l);
+
 static inline boolean spin_try(spinlock l)
 {
     boolean success = compare_and_swap_64(&l->w, 0, 1);
@@ -131,8 +385,8 @@ static inline void spin_lock(spinlock l)
     }
     LOCKSTATS_RECORD_LOCK(l->s, true, spins, 0);
 #else
-    while (*p || !compare_and_swap_64(&l->w, 0, 1))
-        kern_pause();
+    if (*p || !compare_and_swap_64(&l->w, 0, 1))
+        spin_lock_contended(l);
 #endif
 }
 
@@ -142,6 +396,7 @@ static inline void spin_unlock(spinlock l)
     LOCKSTATS_RECORD_UNLOCK(l->s);
 #endif
     compiler_barrier();
+    lockprof_release(l, *(volatile u64 *)&l->w, LOCKPROF_SPIN);
     *(volatile u64 *)&l->w = 0;
 }
 
@@ -377,6 +632,8 @@ static inline void spin_lock_2(spinlock l1, spinlock l2)
 struct mm_stats {
     word minor_faults;
     word major_faults;
+    word huge_faults;           /* faults served with a huge page */
+    word huge_fault_fallbacks;  /* huge page faults served with a small page */
 };
 
 extern struct mm_stats mm_stats;
@@ -429,6 +686,46 @@ closure_type(clock_timer, void, timestamp t);
 
 extern clock_timer platform_timer;
 
+/* Longest duration accepted by the platform timer; if zero, the runloop timer is re-armed at least
+ * every RUNLOOP_TIMER_MAX_PERIOD_US even when no timer expires sooner. */
+extern timestamp platform_timer_max;
+
+/* RCU-style read-mostly synchronization. A read section must not block or
+   take a lock that may be held by a thread waiting for a grace period;
+   sections may nest, including from interrupt handlers. Objects that readers
+   may still reference are released with call_rcu() or rcu_deallocate(), and
+   the deferred callbacks are run at the quiescent points of the CPU that
+   queued them (kernel_sleep() and return to user). */
+static inline void rcu_read_lock(void)
+{
+    cpuinfo ci = current_cpu();
+    if (ci->rcu_nest++ == 0) {
+        ci->rcu_seq++;
+        memory_barrier();
+    }
+}
+
+static inline void rcu_read_unlock(void)
+{
+    cpuinfo ci = current_cpu();
+    assert(ci->rcu_nest > 0);
+    if (--ci->rcu_nest == 0) {
+        memory_barrier();
+        ci->rcu_seq++;
+    }
+}
+
+void synchronize_rcu(void);
+void call_rcu(thunk t);
+void rcu_deallocate(heap h, void *p, bytes size);
+void rcu_process_callbacks(cpuinfo ci);
+
+static inline void rcu_quiescent(cpuinfo ci)
+{
+    if (ci->rcu_callbacks && vector_length(ci->rcu_callbacks))
+        rcu_process_callbacks(ci);
+}
+
 void register_percpu_init(thunk t);
 void run_percpu_init(void);
 
@@ -443,15 +740,19 @@ static inline void set_platform_timer(timestamp duration)
     apply(platform_timer, duration);
 }
 
+/* Thunks are queued on the current CPU if its queues have room, otherwise on the general queues;
+ * thunks in the per-CPU queues may be stolen by other CPUs. */
 static inline void async_apply(thunk t)
 {
     assert(!in_interrupt());
-    assert(enqueue(runqueue, t));
+    if (!enqueue(current_cpu()->runqueue, t))
+        assert(enqueue(runqueue, t));
 }
 
 static inline void async_apply_bh(thunk t)
 {
-    assert(enqueue_irqsafe(bhqueue, t));
+    if (!enqueue_irqsafe(current_cpu()->bhqueue, t))
+        assert(enqueue_irqsafe(bhqueue, t));
 }
 
 closure_type(async_1, void, u64 arg0);
@@ -488,6 +789,7 @@ static inline void zero_context_frame(context_frame f)
 static inline void init_context(context c, int type)
 {
     c->type = type;
+    c->ioprio = 0;
     c->transient_heap = 0;
     c->waiting_on = 0;
     list_init_member(&c->mutex_l);
@@ -517,6 +819,11 @@ static inline void __attribute__((always_inline)) context_acquire(context ctx, c
         assert(remain-- > 0);
     }
     ctx->active_cpu = ci->id;
+    if ((ctx->type != CONTEXT_TYPE_KERNEL) && !ci->user_tlb) {
+        /* make this visible to TLB shootdowns before any user mapping is accessed */
+        ci->user_tlb = true;
+        memory_barrier();
+    }
     context_debug("%s: ctx %p, cpu %d acquired\n", func_ss, ctx, ci->id);
 }
 
@@ -694,6 +1001,16 @@ static inline void count_major_fault(void)
     fetch_and_add(&mm_stats.major_faults, 1);
 }
 
+static inline void count_huge_fault(void)
+{
+    fetch_and_add(&mm_stats.huge_faults, 1);
+}
+
+static inline void count_huge_fault_fallback(void)
+{
+    fetch_and_add(&mm_stats.huge_fault_fallbacks, 1);
+}
+
 void runloop_internal(void) __attribute__((noreturn));
 
 NOTRACE static inline __attribute__((always_inline)) __attribute__((noreturn)) void runloop(void)
@@ -746,10 +1063,21 @@ void kaslr(void);
 u64 init_bootstrap_heap(u64 phys_length);
 id_heap init_physical_id_heap(heap h);
 void init_kernel_heaps(void);
+boolean kernel_add_hotplug_memory(range r);
 void init_platform_devices(kernel_heaps kh);
 void init_cpuinfo_machine(cpuinfo ci, heap backed);
 void kernel_runtime_init(kernel_heaps kh);
 range kern_get_elf(void);
+
+/* Boot phase timing: phases are recorded with a timestamp and the current CPU, and printed at
+ * program start if "boot" is included in the trace flags. dev is a device identifier, or -1. */
+void boot_phase_device(sstring name, int dev);
+void boot_phases_print(void);
+
+static inline void boot_phase(sstring name)
+{
+    boot_phase_device(name, -1);
+}
 void reclaim_regions(void);
 
 extern u64 kas_kern_offset;
@@ -761,6 +1089,19 @@ void cmdline_apply(char *cmdline_start, int cmdline_len, tuple t);
 boolean breakpoint_insert(heap h, u64 a, u8 type, u8 length, thunk completion);
 boolean breakpoint_remove(heap h, u32 a, thunk completion);
 void destruct_context(context c);
+
+/* Thread extended frames are recycled via per-cpu queues, so that creating and destroying threads
+   does not go through the heap. Not used for other context types, which may be allocated before
+   the cpu is initialized (and are recycled as whole contexts anyway). */
+static inline void *thread_extended_frame_get(void)
+{
+    return dequeue(current_cpu()->free_extended_frames);
+}
+
+static inline boolean thread_extended_frame_put(void *e)
+{
+    return enqueue(current_cpu()->free_extended_frames, e);
+}
 void *allocate_stack(heap h, u64 size);
 void deallocate_stack(heap h, u64 size, void *stack);
 cpuinfo init_cpuinfo(heap backed, int cpu);
@@ -779,6 +1120,7 @@ backed_heap allocate_page_backed_heap(heap meta, heap virtual, heap physical,
 void page_backed_dealloc_virtual(backed_heap bh, u64 x, bytes length);
 
 backed_heap allocate_linear_backed_heap(heap meta, id_heap physical, range mapped_virt);
+void linear_backed_map_phys(range r);
 
 static inline boolean is_linear_backed_address(u64 address)
 {
@@ -802,12 +1144,32 @@ static inline u64 phys_from_linear_backed_virt(u64 virt)
 }
 
 void unmap_and_free_phys(u64 virtual, u64 length);
+void unmap_and_free_phys_heap(u64 virtual, u64 length, heap pageheap);
+u64 unmap_clean_and_free_phys_heap(u64 virtual, u64 length, heap pageheap);
 void page_free_phys(u64 phys);
 
+/* NUMA topology, reported by platform code during initialization */
+#define NUMA_MAX_NODES  16
+
+void numa_add_memory(u32 domain, range r);
+void numa_set_cpu_domain(int cpu, u32 domain);
+void numa_swap_cpus(int cpu1, int cpu2);
+void numa_set_distance(u32 from, u32 to, u8 distance);
+void numa_topology_done(void);
+int numa_node_count(void);
+int numa_cpu_node(int cpu);
+u64 numa_alloc_phys(id_heap physical, bytes size, u64 limit);
+
 #if !defined(BOOT)
 
 heap allocate_tagged_region(kernel_heaps kh, u64 tag, bytes pagesize, boolean locking);
 heap locking_heap_wrapper(heap meta, heap parent);
+heap mem_account_heap(heap meta, heap parent, sstring name);
+value mem_accounts_management(heap h);
+
+void snapshot_register_resume(thunk handler);
+void snapshot_resumed(void);
+u64 snapshot_generation(void);
 
 #endif
 
@@ -835,32 +1197,69 @@ void irq_register_handler(int irq, thunk h, sstring name, range cpu_affinity);
 u64 allocate_shirq(void);
 void register_shirq(int vector, thunk t, sstring name);
 
-boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu);
+boolean dev_irq_enable(u32 dev_id, int vector, u32 target_cpu, range cpu_affinity);
 void dev_irq_disable(u32 dev_id, int vector);
 
 #define TARGET_EXCLUSIVE_BROADCAST  (-1ull)
 
 void send_ipi(u64 cpu, u8 vector);
 
+/* Sends an IPI to the CPUs in a bitmap of CPU ids, except the current CPU. */
+void send_ipi_mask(u64 *cpus, u8 vector);
+
+/* Paravirtual CPU operations, set up by hypervisor detection if available:
+ * pv_steal_clock() returns the time a virtual CPU has been runnable while not running, and
+ * pv_flush_tlb_deferred() marks a preempted virtual CPU to have its TLB flushed by the hypervisor
+ * before it resumes, returning false (without marking it) if the CPU is running. */
+extern timestamp (*pv_steal_clock)(u64 cpu);
+extern boolean (*pv_flush_tlb_deferred)(u64 cpu);
+
 u32 irq_get_target_cpu(range cpu_affinity);
 void irq_put_target_cpu(u32 cpu_id);
 
 void init_scheduler(heap);
 void init_scheduler_cpus(heap h);
+void config_scheduler(tuple root);
+int sched_poll_cpu(void);
+void sched_busy_poll(thunk poll, timestamp interval);
+
+/* Background work run by a CPU with nothing else to do, with interrupts disabled and in small
+ * steps; the handler returns true if more work is pending. */
+closure_type(idle_work_handler, boolean);
+void sched_set_idle_work(idle_work_handler h);
 void mm_service(boolean flush);
+u64 mm_watermark_high(void);
 
 boolean sched_queue_init(sched_queue sq, heap h);
+void sched_task_init(sched_task task, thunk t);
+void sched_task_set_nice(sched_task task, int nice);
+void sched_task_set_class(sched_task task, enum sched_class class, u8 rt_prio);
+timestamp sched_task_quantum(sched_task task);
 void sched_enqueue(sched_queue sq, sched_task task);
+void sched_wakeup(sched_queue prev, bitmap affinity, sched_task task);
 sched_task sched_dequeue(sched_queue sq);
 u64 sched_queue_length(sched_queue sq);
+value sched_management(heap h);
 
 static inline boolean sched_queue_empty(sched_queue sq)
 {
     return (sched_queue_length(sq) == 0);
 }
 
+/* memory cleaner classes, in the order in which they are invoked */
+enum mm_cleaner_prio {
+    MM_CLEANER_CACHE,       /* caches of unused objects, reclaimable at no cost */
+    MM_CLEANER_DATA,        /* data which may have to be re-read or written back */
+    MM_CLEANER_EXTERNAL,    /* memory to be taken back from the host */
+};
+#define MM_CLEANER_PRIO_MAX         MM_CLEANER_EXTERNAL
+#define MM_CLEANER_BACKGROUND_MAX   MM_CLEANER_DATA
+
 closure_type(mem_cleaner, u64, u64 clean_bytes);
-boolean mm_register_mem_cleaner(mem_cleaner cleaner);
+boolean mm_register_mem_cleaner(mem_cleaner cleaner, sstring name, int prio);
+u64 mm_reclaim_memory(u64 clean_bytes);
+void init_mm_reclaim(void);
+value mm_reclaim_management(heap h);
 
 kernel_heaps get_kernel_heaps(void);
 
@@ -882,12 +1281,21 @@ extern const sstring * const state_strings;
 void kernel_unlock();
 
 extern bitmap idle_cpu_mask;
+extern bitmap isolated_cpu_mask;
+
+static inline boolean cpu_is_isolated(u64 cpu)
+{
+    bitmap mask = isolated_cpu_mask;
+    return mask && bitmap_get(mask, cpu);
+}
+
 extern u64 total_processors;
 extern u64 present_processors;
 
 void cpu_init(int cpu);
 void start_secondary_cores(kernel_heaps kh);
 void count_cpus_present(void);
+boolean start_hotplug_cpu(u64 hw_id);
 void detect_hypervisor(kernel_heaps kh);
 void detect_devices(kernel_heaps kh, storage_attach sa);
 
@@ -897,6 +1305,7 @@ closure_type(shutdown_handler, void, int status, merge m);
 void add_shutdown_completion(shutdown_handler h);
 extern int shutdown_vector;
 void wakeup_or_interrupt_cpu_all();
+void wakeup_cpu(u64 cpu);
 
 closure_type(halt_handler, void, int status);
 extern halt_handler vm_halt;
@@ -24,6 +24,11 @@ BSS_RO_AFTER_INIT static filesystem klib_fs;
 BSS_RO_AFTER_INIT static tuple klib_root;
 BSS_RO_AFTER_INIT static vector klib_loaded;
 
+/* klibs whose files have been read while the kernel symbols are being ingested, waiting to be
+ * linked (see klib_wait_kernel_syms()) */
+static struct spinlock klib_link_lock;
+static vector klib_link_pending;
+
 static void klib_missing_deps(klib_autoload autoload);
 
 closure_function(1, 1, boolean, klib_elf_walk,
@@ -118,19 +123,16 @@ static int klib_initialize(klib kl, status_handler sh)
         return KLIB_MISSING_DEP;
 }
 
-closure_function(3, 1, status, load_klib_complete,
-                 buffer, name, klib_handler, complete, status_handler, sh,
-                 buffer b)
+static void klib_link(buffer name, klib_handler complete, status_handler sh, buffer b)
 {
     heap h = heap_locked(klib_kh);
-    klib_handler complete = bound(complete);
     klib kl = allocate(h, sizeof(struct klib));
     assert(kl != INVALID_ADDRESS);
 
     kl->mappings = allocate_rangemap(h);
     assert(kl->mappings != INVALID_ADDRESS);
 
-    kl->name = clone_buffer(h, bound(name));
+    kl->name = clone_buffer(h, name);
     kl->elf = b;
 
     klib_debug("%s: klib %b, read length %ld\n", func_ss, kl->name, buffer_length(b));
@@ -149,9 +151,33 @@ closure_function(3, 1, status, load_klib_complete,
 
     klib_debug("   init entry @ %p, first word 0x%lx\n", entry, *(u64*)entry);
     kl->ki = (klib_init)entry;
-    int rv = klib_initialize(kl, bound(sh));
+    int rv = klib_initialize(kl, sh);
     klib_debug("   init return value %d, applying completion\n", rv);
     apply(complete, kl, rv);
+}
+
+closure_function(4, 0, void, klib_link_deferred,
+                 buffer, name, klib_handler, complete, status_handler, sh, buffer, b)
+{
+    klib_link(bound(name), bound(complete), bound(sh), bound(b));
+    closure_finish();
+}
+
+closure_function(3, 1, status, load_klib_complete,
+                 buffer, name, klib_handler, complete, status_handler, sh,
+                 buffer b)
+{
+    thunk t = 0;
+    spin_lock(&klib_link_lock);
+    if (klib_link_pending) {
+        t = closure(heap_locked(klib_kh), klib_link_deferred, bound(name), bound(complete),
+                    bound(sh), b);
+        assert(t != INVALID_ADDRESS);
+        vector_push(klib_link_pending, t);
+    }
+    spin_unlock(&klib_link_lock);
+    if (!t)
+        klib_link(bound(name), bound(complete), bound(sh), b);
     closure_finish();
     return STATUS_OK;
 }
@@ -332,6 +358,29 @@ void print_loaded_klibs(void)
     rputs("\n");
 }
 
+/* Called before init_klib() if the kernel symbols, which klibs are linked against, are still
+ * being ingested: klib files are read in the meantime, and linked when klib_kernel_syms_ready() is
+ * called. */
+void klib_wait_kernel_syms(kernel_heaps kh)
+{
+    klib_link_pending = allocate_vector(heap_locked(kh), 4);
+    assert(klib_link_pending != INVALID_ADDRESS);
+}
+
+void klib_kernel_syms_ready(void)
+{
+    spin_lock(&klib_link_lock);
+    vector pending = klib_link_pending;
+    klib_link_pending = 0;
+    spin_unlock(&klib_link_lock);
+    if (!pending)
+        return;
+    thunk t;
+    vector_foreach(pending, t)
+        apply(t);
+    deallocate_vector(pending);
+}
+
 void init_klib(kernel_heaps kh, void *fs, tuple config_root, status_handler complete)
 {
     assert(fs);
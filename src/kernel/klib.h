@@ -25,5 +25,7 @@ void load_klib(buffer name, klib_handler complete, status_handler sh);
 void unload_klib(klib kl);
 
 void init_klib(kernel_heaps kh, void *fs, tuple root, status_handler complete);
+void klib_wait_kernel_syms(kernel_heaps kh);
+void klib_kernel_syms_ready(void);
 
 void print_loaded_klibs(void);
@@ -0,0 +1,435 @@
+/* Dynamic kernel probes
+ *
+ * A probe replaces the first instruction of a kernel function (looked up in the kernel symbol
+ * table) with a breakpoint, whose handler counts the calls to the function and emulates the
+ * replaced instruction. Optionally, the probe also hooks the function return, to aggregate call
+ * durations in a histogram, and collects the distinct call stacks. Kernel text is only modified
+ * while a probe is in place, so there is no cost for functions without probes.
+ * Probes are managed via the management tree under "kprobes": setting a function name adds a
+ * probe (if the value is a tuple, its "latency" and "stack" attributes enable the respective
+ * measurements), and setting it to a null value removes the probe; reading a function name
+ * returns the probe statistics.
+ * Breakpoints hit while the handler is running on a CPU (i.e. in functions called by the handler)
+ * only have their instruction emulated. Functions whose name starts with "kprobe" cannot be
+ * probed.
+ */
+#include <kernel.h>
+#include <management.h>
+#include <symtab.h>
+#include <kprobe.h>
+
+#if !defined(__x86_64__)
+#error "kprobes not implemented for this architecture"
+#endif
+
+//#define KPROBE_DEBUG
+#ifdef KPROBE_DEBUG
+#define kprobe_debug(x, ...) do {rprintf("KPROBE: " x, ##__VA_ARGS__);} while(0)
+#else
+#define kprobe_debug(x, ...)
+#endif
+
+#define KPROBE_MAX          64
+#define KPROBE_RET_SLOTS    1024
+#define KPROBE_STACKS       16
+#define KPROBE_STACK_DEPTH  8
+#define KPROBE_HIST_BUCKETS 40
+
+#define KPROBE_INSN_BKPT        0xcc
+#define KPROBE_INSN_PUSH_RBP    0x55
+
+static const u8 kprobe_endbr64[] = {0xf3, 0x0f, 0x1e, 0xfa};
+
+typedef struct kprobe {
+    u64 addr;           /* address of the breakpoint, zero if not in place */
+    symbol name;        /* zero if the slot is free */
+    u64 gen;            /* incremented each time the slot is reused */
+    boolean latency;
+    boolean stack;
+    u64 calls;
+    u64 returns;
+    u64 missed;         /* returns that could not be hooked */
+    u64 hist[KPROBE_HIST_BUCKETS];  /* call durations, by power of 2 of nanoseconds */
+    struct spinlock stack_lock;
+    struct {
+        u64 pc[KPROBE_STACK_DEPTH];
+        u64 count;
+    } stacks[KPROBE_STACKS];
+    u64 stacks_dropped;
+    tuple mgmt;
+} *kprobe;
+
+/* hooked return of a function call */
+typedef struct kprobe_ret {
+    u64 *slot;          /* stack location of the return address, zero if the entry is free */
+    u64 retaddr;
+    timestamp start;
+    kprobe kp;
+    u64 gen;
+} *kprobe_ret;
+
+static struct {
+    heap h;
+    u8 *active;         /* per-CPU flag set while the handler is running */
+    struct spinlock lock;
+    struct spinlock ret_lock;
+    struct spinlock mgmt_lock;
+    struct kprobe probes[KPROBE_MAX];
+    struct kprobe_ret rets[KPROBE_RET_SLOTS];
+} kprobes;
+
+static inline kprobe kprobe_find(u64 addr)
+{
+    for (int i = 0; i < KPROBE_MAX; i++) {
+        kprobe kp = &kprobes.probes[i];
+        if (kp->addr == addr)
+            return kp;
+    }
+    return 0;
+}
+
+static kprobe kprobe_find_name(symbol name)
+{
+    for (int i = 0; i < KPROBE_MAX; i++) {
+        kprobe kp = &kprobes.probes[i];
+        if (kp->name == name)
+            return kp;
+    }
+    return 0;
+}
+
+static void kprobe_record_stack(kprobe kp, struct kprobe_regs *regs)
+{
+    u64 pc[KPROBE_STACK_DEPTH];
+    int depth = 0;
+    zero(pc, sizeof(pc));
+    pc[depth++] = *(u64 *)pointer_from_u64(regs->rsp);
+    u64 *fp = pointer_from_u64(regs->rbp);
+    u64 *nfp;
+    while ((depth < KPROBE_STACK_DEPTH) && validate_frame_ptr(fp)) {
+        u64 *rap = get_frame_ra_ptr(fp, &nfp);
+        if (*rap == 0)
+            break;
+        pc[depth++] = *rap;
+        if (nfp <= fp)
+            break;
+        fp = nfp;
+    }
+    spin_lock(&kp->stack_lock);
+    int i;
+    for (i = 0; i < KPROBE_STACKS; i++) {
+        if (!kp->stacks[i].count) {
+            runtime_memcpy(kp->stacks[i].pc, pc, sizeof(pc));
+            kp->stacks[i].count = 1;
+            break;
+        }
+        if (!runtime_memcmp(kp->stacks[i].pc, pc, sizeof(pc))) {
+            kp->stacks[i].count++;
+            break;
+        }
+    }
+    if (i == KPROBE_STACKS)
+        kp->stacks_dropped++;
+    spin_unlock(&kp->stack_lock);
+}
+
+/* Redirects the return of the probed function to kprobe_ret_trampoline; the return address is at
+ * the top of the stack, as the breakpoint is at the function entry. */
+static void kprobe_hook_return(kprobe kp, struct kprobe_regs *regs)
+{
+    u64 *slot = pointer_from_u64(regs->rsp);
+    u64 trampoline = u64_from_pointer(kprobe_ret_trampoline);
+    timestamp start = now(CLOCK_ID_MONOTONIC_RAW);
+    kprobe_ret r = 0;
+    spin_lock(&kprobes.ret_lock);
+
+    /* a tail call from a hooked function keeps the hooked return address */
+    if (*slot != trampoline) {
+        for (int i = 0; i < KPROBE_RET_SLOTS; i++) {
+            kprobe_ret e = &kprobes.rets[i];
+
+            /* an entry for the same location is left by a call that did not return */
+            if (e->slot == slot) {
+                r = e;
+                break;
+            }
+            if (!r && !e->slot)
+                r = e;
+        }
+    }
+    if (r) {
+        r->slot = slot;
+        r->retaddr = *slot;
+        r->start = start;
+        r->kp = kp;
+        r->gen = kp->gen;
+        *slot = trampoline;
+    }
+    spin_unlock(&kprobes.ret_lock);
+    if (!r)
+        fetch_and_add(&kp->missed, 1);
+}
+
+static void kprobe_return(struct kprobe_regs *regs)
+{
+    /* the return address has been popped */
+    u64 *slot = pointer_from_u64(regs->rsp - sizeof(u64));
+    timestamp end = now(CLOCK_ID_MONOTONIC_RAW);
+    kprobe_ret r = 0;
+    spin_lock(&kprobes.ret_lock);
+    for (int i = 0; i < KPROBE_RET_SLOTS; i++) {
+        if (kprobes.rets[i].slot == slot) {
+            r = &kprobes.rets[i];
+            break;
+        }
+    }
+    if (!r)
+        halt("%s: no hooked return for stack location %p\n", func_ss, slot);
+    regs->rip = r->retaddr;
+    kprobe kp = r->kp;
+    boolean valid = (r->gen == kp->gen);
+    timestamp start = r->start;
+    r->slot = 0;
+    spin_unlock(&kprobes.ret_lock);
+    if (!valid)
+        return;     /* the probe has been removed */
+    u64 nsecs = nsec_from_timestamp(end - start);
+    int bucket = nsecs ? MIN(msb(nsecs) + 1, KPROBE_HIST_BUCKETS - 1) : 0;
+    fetch_and_add(&kp->returns, 1);
+    fetch_and_add(&kp->hist[bucket], 1);
+}
+
+/* Called by kprobe_bp_entry on a breakpoint in kernel mode, with interrupts disabled; returns
+ * false if the breakpoint does not belong to a probe. */
+boolean kprobe_handle_bp(struct kprobe_regs *regs)
+{
+    u64 addr = regs->rip - 1;
+    u8 *active = &kprobes.active[current_cpu()->id];
+    if (addr == u64_from_pointer(kprobe_ret_trampoline)) {
+        *active = 1;
+        kprobe_return(regs);
+        *active = 0;
+        return true;
+    }
+    kprobe kp = kprobe_find(addr);
+    if (!kp) {
+        /* the probe has been removed after the breakpoint was hit: execute the original
+         * instruction */
+        if (*(u8 *)pointer_from_u64(addr) != KPROBE_INSN_BKPT) {
+            regs->rip = addr;
+            return true;
+        }
+        return false;
+    }
+    if (!*active) {
+        *active = 1;
+        fetch_and_add(&kp->calls, 1);
+        if (kp->stack)
+            kprobe_record_stack(kp, regs);
+        if (kp->latency)
+            kprobe_hook_return(kp, regs);
+        *active = 0;
+    }
+
+    /* emulate the replaced instruction (push %rbp) */
+    regs->rsp -= sizeof(u64);
+    *(u64 *)pointer_from_u64(regs->rsp) = regs->rbp;
+    regs->rip = addr + 1;
+    return true;
+}
+
+/* Kernel text is mapped read-only: write via a temporary mapping of the physical page. */
+static void kprobe_write_insn(u64 addr, u8 insn)
+{
+    heap vh = (heap)heap_virtual_page(get_kernel_heaps());
+    u64 v = allocate_u64(vh, PAGESIZE);
+    assert(v != INVALID_PHYSICAL);
+    physical p = physical_from_virtual(pointer_from_u64(addr & ~PAGEMASK));
+    assert(p != INVALID_PHYSICAL);
+    map(v, p, PAGESIZE, pageflags_writable(pageflags_memory()));
+    *(volatile u8 *)pointer_from_u64(v + (addr & PAGEMASK)) = insn;
+    unmap(v, PAGESIZE);
+    deallocate_u64(vh, v, PAGESIZE);
+}
+
+static void kprobe_add(symbol name, value v)
+{
+    sstring s = buffer_to_sstring(symbol_string(name));
+    if ((s.len >= 6) && !runtime_memcmp(s.ptr, "kprobe", 6)) {
+        msg_err("%s: cannot probe %s\n", func_ss, s);
+        return;
+    }
+    void *f = symtab_get_addr(s);
+    if (f == INVALID_ADDRESS) {
+        msg_err("%s: symbol %s not found\n", func_ss, s);
+        return;
+    }
+    if (!runtime_memcmp(f, kprobe_endbr64, sizeof(kprobe_endbr64)))
+        f += sizeof(kprobe_endbr64);
+    u8 insn = *(u8 *)f;
+    if (insn != KPROBE_INSN_PUSH_RBP) {
+        msg_err("%s: unsupported instruction 0x%x at %s entry\n", func_ss, insn, s);
+        return;
+    }
+    boolean latency = is_tuple(v) && get(v, sym(latency));
+    boolean stack = is_tuple(v) && get(v, sym(stack));
+    spin_lock(&kprobes.lock);
+    kprobe kp = kprobe_find_name(name);
+    if (kp) {
+        kp->latency = latency;
+        kp->stack = stack;
+        spin_unlock(&kprobes.lock);
+        return;
+    }
+    kp = kprobe_find_name(0);
+    if (kp)
+        kp->name = name;
+    spin_unlock(&kprobes.lock);
+    if (!kp) {
+        msg_err("%s: too many probes\n", func_ss);
+        return;
+    }
+    kp->gen++;
+    kp->latency = latency;
+    kp->stack = stack;
+    kp->calls = kp->returns = kp->missed = 0;
+    zero(kp->hist, sizeof(kp->hist));
+    zero(kp->stacks, sizeof(kp->stacks));
+    kp->stacks_dropped = 0;
+    spin_lock(&kprobes.mgmt_lock);
+    if (kp->mgmt) {
+        deallocate_value(kp->mgmt);
+        kp->mgmt = 0;
+    }
+    spin_unlock(&kprobes.mgmt_lock);
+    write_barrier();
+    kp->addr = u64_from_pointer(f);
+    kprobe_write_insn(kp->addr, KPROBE_INSN_BKPT);
+    kprobe_debug("added probe at %p (%s)\n", f, s);
+}
+
+static void kprobe_remove(symbol name)
+{
+    spin_lock(&kprobes.lock);
+    kprobe kp = kprobe_find_name(name);
+    spin_unlock(&kprobes.lock);
+    if (!kp)
+        return;
+    kprobe_write_insn(kp->addr, KPROBE_INSN_PUSH_RBP);
+    kp->addr = 0;
+    kp->gen++;
+    write_barrier();
+    kp->name = 0;
+    kprobe_debug("removed probe for %b\n", symbol_string(name));
+}
+
+/* returns the management tuple of a probe, updated with the current statistics */
+static tuple kprobe_value(kprobe kp)
+{
+    spin_lock(&kprobes.mgmt_lock);
+    tuple t = kp->mgmt;
+    if (!t) {
+        t = allocate_tuple();
+        assert(t != INVALID_ADDRESS);
+        kp->mgmt = t;
+    }
+    set(t, sym(calls), value_from_u64(kp->calls));
+    if (kp->latency) {
+        set(t, sym(returns), value_from_u64(kp->returns));
+        set(t, sym(missed), value_from_u64(kp->missed));
+        tuple hist = get_tuple(t, sym(latency));
+        if (!hist) {
+            hist = allocate_tuple();
+            assert(hist != INVALID_ADDRESS);
+            set(t, sym(latency), hist);
+        }
+        for (int i = 0; i < KPROBE_HIST_BUCKETS; i++) {
+            if (kp->hist[i])
+                set(hist, intern_u64(i ? U64_FROM_BIT(i - 1) : 0), value_from_u64(kp->hist[i]));
+        }
+    }
+    if (kp->stack) {
+        tuple stacks = get_tuple(t, sym(stacks));
+        if (!stacks) {
+            stacks = allocate_tuple();
+            assert(stacks != INVALID_ADDRESS);
+            set(t, sym(stacks), stacks);
+        }
+        spin_lock(&kp->stack_lock);
+        for (int i = 0; i < KPROBE_STACKS && kp->stacks[i].count; i++) {
+            symbol k = intern_u64(i);
+            tuple st = get_tuple(stacks, k);
+            if (!st) {
+                /* the call stack of an entry does not change once recorded */
+                st = allocate_tuple();
+                assert(st != INVALID_ADDRESS);
+                buffer b = allocate_buffer(kprobes.h, 128);
+                assert(b != INVALID_ADDRESS);
+                for (int j = 0; j < KPROBE_STACK_DEPTH && kp->stacks[i].pc[j]; j++) {
+                    u64 pc = kp->stacks[i].pc[j];
+                    u64 offset;
+                    sstring name = find_elf_sym(pc, &offset, 0);
+                    if (j)
+                        bprintf(b, " < ");
+                    if (sstring_is_null(name))
+                        bprintf(b, "0x%lx", pc);
+                    else
+                        bprintf(b, "%s+0x%lx", name, offset);
+                }
+                set(st, sym(frames), b);
+                set(stacks, k, st);
+            }
+            set(st, sym(count), value_from_u64(kp->stacks[i].count));
+        }
+        set(t, sym(stacks_dropped), value_from_u64(kp->stacks_dropped));
+        spin_unlock(&kp->stack_lock);
+    }
+    spin_unlock(&kprobes.mgmt_lock);
+    return t;
+}
+
+closure_func_basic(tuple_get, value, kprobes_get,
+                   value a)
+{
+    kprobe kp = kprobe_find_name(a);
+    return (kp && kp->addr) ? kprobe_value(kp) : 0;
+}
+
+closure_func_basic(tuple_set, void, kprobes_set,
+                   value a, value v)
+{
+    if (v)
+        kprobe_add(a, v);
+    else
+        kprobe_remove(a);
+}
+
+closure_func_basic(tuple_iterate, boolean, kprobes_iterate,
+                   binding_handler h)
+{
+    for (int i = 0; i < KPROBE_MAX; i++) {
+        kprobe kp = &kprobes.probes[i];
+        symbol name = kp->name;
+        if (name && kp->addr && !apply(h, name, kprobe_value(kp)))
+            return false;
+    }
+    return true;
+}
+
+/* Exposes the kernel probes, keyed by function name, in the management tree */
+value kprobe_management(heap h)
+{
+    kprobes.h = h;
+    kprobes.active = allocate_zero(h, present_processors);
+    assert(kprobes.active != INVALID_ADDRESS);
+    spin_lock_init(&kprobes.lock);
+    spin_lock_init(&kprobes.ret_lock);
+    spin_lock_init(&kprobes.mgmt_lock);
+    for (int i = 0; i < KPROBE_MAX; i++)
+        spin_lock_init(&kprobes.probes[i].stack_lock);
+    tuple ft = allocate_function_tuple(closure_func(h, tuple_get, kprobes_get),
+                                       closure_func(h, tuple_set, kprobes_set),
+                                       closure_func(h, tuple_iterate, kprobes_iterate));
+    assert(ft != INVALID_ADDRESS);
+    return ft;
+}
@@ -0,0 +1,15 @@
+#ifdef CONFIG_KPROBES
+
+/* registers saved by kprobe_bp_entry on the interrupted stack */
+struct kprobe_regs {
+    u64 r15, r14, r13, r12, r11, r10, r9, r8;
+    u64 rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    u64 rip, cs, rflags, rsp, ss;
+};
+
+void kprobe_bp_entry(void);
+void kprobe_ret_trampoline(void);
+boolean kprobe_handle_bp(struct kprobe_regs *regs);
+value kprobe_management(heap h);
+
+#endif
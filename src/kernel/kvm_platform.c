@@ -20,6 +20,35 @@
 #define KVM_CPUID_FEATURES  1
 #define KVM_MSR_SYSTEM_TIME 0x4b564d01
 #define KVM_MSR_WALL_CLOCK  0x4b564d00
+#define KVM_MSR_STEAL_TIME  0x4b564d03
+#define KVM_MSR_PV_EOI_EN   0x4b564d04
+#define KVM_MSR_ENABLED     1
+
+/* bits of the features (eax) and hints (edx) returned by KVM_CPUID_FEATURES */
+#define KVM_FEATURE_STEAL_TIME      5
+#define KVM_FEATURE_PV_EOI          6
+#define KVM_FEATURE_PV_TLB_FLUSH    9
+#define KVM_FEATURE_PV_SEND_IPI     11
+#define KVM_HINTS_REALTIME          0
+
+/* kvm_steal_time.preempted */
+#define KVM_VCPU_PREEMPTED  U64_FROM_BIT(0)
+#define KVM_VCPU_FLUSH_TLB  U64_FROM_BIT(1)
+
+#define KVM_HC_SEND_IPI     10
+
+BSS_RO_AFTER_INIT static physical kvm_wall_clock_phys;
+BSS_RO_AFTER_INIT static u32 kvm_features;
+BSS_RO_AFTER_INIT static boolean kvm_amd;
+
+/* The wall clock structure is only updated by the hypervisor when its address is written to the
+   MSR, so after a snapshot restore it is refreshed to get the current host time. */
+closure_func_basic(thunk, void, kvm_snapshot_resume)
+{
+    write_msr(KVM_MSR_WALL_CLOCK, kvm_wall_clock_phys);
+    memory_barrier();
+    clock_reset_rtc(pvclock_wallclock_now());
+}
 
 static boolean probe_kvm_pvclock(kernel_heaps kh, u32 cpuid_fn)
 {
@@ -38,7 +67,8 @@ static boolean probe_kvm_pvclock(kernel_heaps kh, u32 cpuid_fn)
     kvm_debug("before write msr");
     physical vc_phys = physical_from_virtual(vc);
     write_msr(KVM_MSR_SYSTEM_TIME, vc_phys | /* enable */ 1);
-    write_msr(KVM_MSR_WALL_CLOCK, vc_phys + sizeof(*vc));
+    kvm_wall_clock_phys = vc_phys + sizeof(*vc);
+    write_msr(KVM_MSR_WALL_CLOCK, kvm_wall_clock_phys);
     memory_barrier();
     kvm_debug("after write msr");
     if (vc->system_time == 0) {
@@ -47,9 +77,107 @@ static boolean probe_kvm_pvclock(kernel_heaps kh, u32 cpuid_fn)
         return false;
     }
     init_pvclock(heap_general(kh), vc, (struct pvclock_wall_clock *)(vc + 1));
+    thunk resume = closure_func(heap_general(kh), thunk, kvm_snapshot_resume);
+    assert(resume != INVALID_ADDRESS);
+    snapshot_register_resume(resume);
     return true;
 }
 
+static s64 kvm_hypercall4(u64 nr, u64 a0, u64 a1, u64 a2, u64 a3)
+{
+    s64 ret;
+    if (kvm_amd)
+        asm volatile("vmmcall" : "=a"(ret) : "a"(nr), "b"(a0), "c"(a1), "d"(a2), "S"(a3) : "memory");
+    else
+        asm volatile("vmcall" : "=a"(ret) : "a"(nr), "b"(a0), "c"(a1), "d"(a2), "S"(a3) : "memory");
+    return ret;
+}
+
+static boolean kvm_pv_ipi(u64 *bitmap, u32 min, u32 icr)
+{
+    return kvm_hypercall4(KVM_HC_SEND_IPI, bitmap[0], bitmap[1], min, icr) >= 0;
+}
+
+static timestamp kvm_steal_clock(u64 cpu)
+{
+    volatile struct kvm_steal_time *st = &cpuinfo_from_id(cpu)->m.kvm_steal_time;
+    u32 version;
+    u64 steal;
+    do {
+        version = st->version;
+        read_barrier();
+        steal = st->steal;
+        read_barrier();
+    } while ((version & 1) || (version != st->version));
+    return nanoseconds(steal);
+}
+
+static boolean kvm_flush_tlb_deferred(u64 cpu)
+{
+    struct kvm_steal_time *st = &cpuinfo_from_id(cpu)->m.kvm_steal_time;
+    u8 state = *(volatile u8 *)&st->preempted;
+    return (state & KVM_VCPU_PREEMPTED) &&
+        compare_and_swap_8(&st->preempted, state, state | KVM_VCPU_FLUSH_TLB);
+}
+
+/* Registers the areas shared with the hypervisor for the current CPU. */
+closure_func_basic(thunk, void, kvm_pv_percpu_init)
+{
+    struct cpuinfo_machine *m = &current_cpu()->m;
+    if (kvm_features & U64_FROM_BIT(KVM_FEATURE_STEAL_TIME)) {
+        /* the area must be 64-byte aligned; if not, the steal time of this CPU reads as zero */
+        physical st_phys = physical_from_virtual(&m->kvm_steal_time);
+        if ((st_phys & (sizeof(m->kvm_steal_time) - 1)) == 0)
+            write_msr(KVM_MSR_STEAL_TIME, st_phys | KVM_MSR_ENABLED);
+    }
+    if (kvm_features & U64_FROM_BIT(KVM_FEATURE_PV_EOI)) {
+        m->kvm_pv_eoi = 0;
+        write_msr(KVM_MSR_PV_EOI_EN, physical_from_virtual((void *)&m->kvm_pv_eoi) | KVM_MSR_ENABLED);
+    }
+}
+
+/* Paravirtual features that spare VM exits, which matter most when the host is oversubscribed:
+ * EOIs that are not needed are not written to the APIC, IPIs to multiple CPUs are sent with a
+ * single hypercall, preempted CPUs are not interrupted for TLB shootdowns, and the time stolen
+ * from a CPU is not charged to the threads running on it. */
+static void kvm_pv_init(kernel_heaps kh, u32 cpuid_fn)
+{
+    u32 v[4];
+    cpuid(0, 0, v);
+    kvm_amd = (v[1] == 0x68747541) ||       /* "Auth"enticAMD */
+              (v[1] == 0x6f677948);         /* "Hygo"nGenuine */
+    cpuid(cpuid_fn + KVM_CPUID_FEATURES, 0, v);
+    u32 features = v[0];
+    u32 hints = v[3];
+    kvm_features = features & (U64_FROM_BIT(KVM_FEATURE_STEAL_TIME) |
+                               U64_FROM_BIT(KVM_FEATURE_PV_EOI));
+    if (features & U64_FROM_BIT(KVM_FEATURE_STEAL_TIME)) {
+        kvm_debug("steal time available");
+        pv_steal_clock = kvm_steal_clock;
+
+        /* with dedicated physical CPUs, virtual CPUs are never preempted */
+        if ((features & U64_FROM_BIT(KVM_FEATURE_PV_TLB_FLUSH)) &&
+            !(hints & U64_FROM_BIT(KVM_HINTS_REALTIME))) {
+            kvm_debug("PV TLB flush available");
+            pv_flush_tlb_deferred = kvm_flush_tlb_deferred;
+        }
+    }
+    if (features & U64_FROM_BIT(KVM_FEATURE_PV_EOI)) {
+        kvm_debug("PV EOI available");
+        apic_pv_eoi = true;
+    }
+    if (features & U64_FROM_BIT(KVM_FEATURE_PV_SEND_IPI)) {
+        kvm_debug("PV send IPI available");
+        apic_pv_ipi = kvm_pv_ipi;
+    }
+    if (kvm_features) {
+        thunk percpu_init = closure_func(heap_general(kh), thunk, kvm_pv_percpu_init);
+        assert(percpu_init != INVALID_ADDRESS);
+        apply(percpu_init);
+        register_percpu_init(percpu_init);
+    }
+}
+
 boolean kvm_detect(kernel_heaps kh)
 {
     kvm_debug("probing for KVM...");
@@ -68,6 +196,7 @@ boolean kvm_detect(kernel_heaps kh)
         msg_err("unable to probe pvclock\n");
         return false;
     }
+    kvm_pv_init(kh, fn);
 
     clock_timer ct;
     thunk per_cpu_init;
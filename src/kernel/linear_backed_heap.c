@@ -16,6 +16,10 @@ typedef struct linear_backed_heap {
     u64 phys_limit;
 } *linear_backed_heap;
 
+/* heaps whose mappings must be extended when physical memory is hotplugged */
+static linear_backed_heap linear_backed_heaps[2];
+static int linear_backed_heap_count;
+
 #define LINEAR_BACKED_IDX_LIMIT ((LINEAR_BACKED_LIMIT - LINEAR_BACKED_BASE) >> LINEAR_BACKED_PAGELOG)
 
 static inline u64 linear_backed_base_from_index(linear_backed_heap hb, int index)
@@ -26,7 +30,9 @@ static inline u64 linear_backed_base_from_index(linear_backed_heap hb, int index
 static inline u64 linear_backed_alloc_internal(linear_backed_heap hb, bytes size)
 {
     u64 len = pad(size, hb->bh.h.pagesize);
-    u64 p = id_heap_alloc_subrange(hb->physical, len, 0, hb->phys_limit);
+    u64 p = numa_alloc_phys(hb->physical, len, hb->phys_limit);
+    if (p == INVALID_PHYSICAL)
+        p = id_heap_alloc_subrange(hb->physical, len, 0, hb->phys_limit);
     if (p == INVALID_PHYSICAL)
         return p;
     u64 v = p + hb->virt_base;
@@ -78,8 +84,8 @@ static void linear_backed_dealloc_unmap(backed_heap bh, void *virt, u64 phys, by
     linear_backed_dealloc_internal((linear_backed_heap)bh, u64_from_pointer(virt), len);
 }
 
-/* Though the bitmap is currently only used during initialization, it would be
-   needed if we ever have to support hotplug memory. Just leave it. */
+/* The bitmap tracks which parts of the linear mapping have been set up, so that hotplugged
+   memory can be mapped without remapping existing pages. */
 static void add_linear_backed_page(linear_backed_heap hb, int index)
 {
     assert(index <= LINEAR_BACKED_IDX_LIMIT);
@@ -87,7 +93,7 @@ static void add_linear_backed_page(linear_backed_heap hb, int index)
         u64 length = U64_FROM_BIT(LINEAR_BACKED_PAGELOG);
         u64 vbase = linear_backed_base_from_index(hb, index);
         u64 pbase = index * length;
-        map(vbase, pbase, length, pageflags_dma());
+        map(vbase, pbase, length, pageflags_global(pageflags_dma()));
         bitmap_set(hb->mapped, index, 1);
     }
 }
@@ -123,6 +129,29 @@ static void linear_backed_init_maps(linear_backed_heap hb)
     id_heap_range_foreach(hb->physical, stack_closure(physmem_range_handler, hb));
 }
 
+/* Maps a range of hotplugged physical memory in all linear backed heaps, before the range is added
+ * to the physical heap. */
+void linear_backed_map_phys(range r)
+{
+    for (int i = 0; i < linear_backed_heap_count; i++) {
+        linear_backed_heap hb = linear_backed_heaps[i];
+        if (hb->mapped) {
+            apply(stack_closure(physmem_range_handler, hb), r);
+        } else if (r.start < hb->phys_limit) {
+            /* Memory above the physical limit is never allocated from this heap; below the limit,
+             * the linear mapping has been set up in aligned chunks, which may not cover the new
+             * range. */
+            u64 length = U64_FROM_BIT(LINEAR_BACKED_PAGELOG);
+            u64 end = MIN(r.end, hb->phys_limit);
+            for (u64 p = r.start & ~(length - 1); p < end; p += length) {
+                u64 v = hb->virt_base + p;
+                if (physical_from_virtual(pointer_from_u64(v)) == INVALID_PHYSICAL)
+                    map(v, p, length, pageflags_kernel_data());
+            }
+        }
+    }
+}
+
 backed_heap allocate_linear_backed_heap(heap meta, id_heap physical, range mapped_virt)
 {
     linear_backed_heap hb = allocate(meta, sizeof(*hb));
@@ -148,5 +177,7 @@ backed_heap allocate_linear_backed_heap(heap meta, id_heap physical, range mappe
         hb->virt_base = LINEAR_BACKED_BASE;
         hb->phys_limit = LINEAR_BACKED_PHYSLIMIT;
     }
+    assert(linear_backed_heap_count < _countof(linear_backed_heaps));
+    linear_backed_heaps[linear_backed_heap_count++] = hb;
     return &hb->bh;
 }
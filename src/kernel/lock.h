@@ -3,7 +3,7 @@
 #endif
 
 typedef struct spinlock {
-    word w;
+    word w;             /* with CONFIG_QSPINLOCK: locked byte and waiter tail */
 #ifdef LOCK_STATS
     struct lockstats_lock s;
 #endif
@@ -11,9 +11,19 @@ typedef struct spinlock {
 
 typedef struct rw_spinlock {
     struct spinlock l;
-    word readers;
+    word readers;       /* with CONFIG_QSPINLOCK: also holds writer state */
 } *rw_spinlock;
 
+#ifdef CONFIG_QSPINLOCK
+#define QSPIN_LOCKED    1
+#define QSPIN_NODES     4
+
+typedef struct qspin_node {
+    struct qspin_node *next;
+    boolean locked;
+} *qspin_node;
+#endif
+
 static inline void spin_lock_init(spinlock l)
 {
     l->w = 0;
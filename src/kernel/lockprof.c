@@ -0,0 +1,454 @@
+/* Lock contention profiler
+ *
+ * A low-overhead alternative to the LOCK_STATS build, which can be enabled at runtime. Only
+ * contended acquisitions of spinlocks and mutexes reach the profiler: while it is disabled, the
+ * cost to the lock paths is a test of lockprof_enabled on the contended (spin) and release paths.
+ * While it is enabled, one in sample_rate contended acquisitions on each CPU is sampled, which
+ * records the time spent waiting for the lock into a per-lock wait-time histogram, along with the
+ * call chain of the waiter.
+ *
+ * A sampled waiter also flags the lock word (LOCKPROF_CONTENDED), so that the holder records its
+ * own call chain on release; for mutexes, the holder checks for waiters instead. Reader-writer
+ * locks are covered as far as their writer queue is contended.
+ *
+ * Samples and per-lock statistics are stored in per-CPU buffers allocated when the profiler is
+ * initialized, so that the lock paths never allocate memory. They are retrieved over HTTP:
+ *   curl http://<address>:9092/lockprof/start
+ *   curl http://<address>:9092/lockprof/stats
+ *   curl http://<address>:9092/lockprof/samples > out.perf
+ *   stackcollapse-perf.pl out.perf | flamegraph.pl > contention.svg
+ * "stats" lists contended locks by total sampled wait time; "samples" streams and clears the
+ * sampled call chains in the text format produced by `perf script`, with waiter chains weighted by
+ * their wait time in nanoseconds (event "lock-wait") and holder chains counted once each (event
+ * "lock-holder").
+ *
+ * The profiler is set up if "lockprof" is present in the manifest root, e.g.
+ * "lockprof:(sample_rate:16 start:t)"; the default sample rate is 1 (every contended acquisition).
+ */
+
+#include <kernel.h>
+#include <net.h>
+#include <http.h>
+#include <symtab.h>
+
+#define LOCKPROF_PORT               9092
+#define LOCKPROF_URI                "lockprof"
+#define LOCKPROF_LOCKS              256     /* per-CPU lock statistics slots */
+#define LOCKPROF_PROBES             8
+#define LOCKPROF_SAMPLES_PER_CPU    1024
+#define LOCKPROF_MAX_DEPTH          16
+#define LOCKPROF_HIST_BUCKETS       16
+#define LOCKPROF_HIST_MIN_ORDER     8       /* first bucket: waits below 256 ns */
+#define LOCKPROF_HTTP_CHUNK_MAXSIZE (64*KB)
+
+typedef struct lockprof_sample {
+    timestamp ts;
+    u64 lock;
+    u64 wait;                   /* nanoseconds; 0 for holder samples */
+    u8 type;
+    u8 holder;
+    u8 depth;
+    u64 pcs[LOCKPROF_MAX_DEPTH];
+} *lockprof_sample;
+
+typedef struct lockprof_lock {
+    u64 lock;
+    u64 type;
+    u64 waits;                  /* sampled contended acquisitions */
+    u64 wait_total;
+    u64 wait_max;
+    u64 holds;                  /* holder samples */
+    u64 hist[LOCKPROF_HIST_BUCKETS];
+} *lockprof_lock;
+
+typedef struct lockprof_cpu {
+    u64 contended;
+    boolean busy;               /* guards against recording from nested lock paths */
+    u64 nsamples;
+    u64 dropped;
+    lockprof_sample samples;
+    lockprof_lock locks;
+} *lockprof_cpu;
+
+boolean lockprof_enabled;
+
+static struct {
+    heap h;
+    u64 sample_rate;
+    lockprof_cpu cpus;
+    u64 dropped_locks;
+    http_listener hl;
+} lockprof;
+
+static int lockprof_save_stack(u64 *pcs)
+{
+    u64 *fp = get_current_fp();
+    int depth = 0;
+    while (depth < LOCKPROF_MAX_DEPTH) {
+        /* simple bounds check, as page table walks could recurse into the lock paths */
+        if (!is_kernel_memory(fp) || (u64_from_pointer(fp) & (sizeof(u64) - 1)))
+            break;
+        u64 *nfp;
+        u64 *rap = get_frame_ra_ptr(fp, &nfp);
+        if (!rap || (*rap == 0))
+            break;
+        pcs[depth++] = *rap;
+        if (nfp <= fp)
+            break;
+        fp = nfp;
+    }
+    return depth;
+}
+
+static lockprof_lock lockprof_lookup(lockprof_cpu pc, u64 lock, int type)
+{
+    u64 h = (lock >> 3) * 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < LOCKPROF_PROBES; i++) {
+        lockprof_lock l = &pc->locks[(h + i) % LOCKPROF_LOCKS];
+        if (l->lock == lock)
+            return l;
+        if (!l->lock) {
+            l->lock = lock;
+            l->type = type;
+            return l;
+        }
+    }
+    fetch_and_add(&lockprof.dropped_locks, 1);
+    return 0;
+}
+
+static void lockprof_record(lockprof_cpu pc, void *lock, int type, u64 wait, boolean holder)
+{
+    u64 n = pc->nsamples;
+    if (n < LOCKPROF_SAMPLES_PER_CPU) {
+        lockprof_sample s = &pc->samples[n];
+        s->ts = now(CLOCK_ID_MONOTONIC_RAW);
+        s->lock = u64_from_pointer(lock);
+        s->wait = wait;
+        s->type = type;
+        s->holder = holder;
+        s->depth = lockprof_save_stack(s->pcs);
+        write_barrier();
+        pc->nsamples = n + 1;
+    } else {
+        pc->dropped++;
+    }
+}
+
+u64 lockprof_sample_wait(void)
+{
+    lockprof_cpu pc = &lockprof.cpus[current_cpu()->id];
+    if (pc->busy || (++pc->contended % lockprof.sample_rate))
+        return 0;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    return t ? t : 1;
+}
+
+void lockprof_wait_end(void *lock, int type, u64 start)
+{
+    lockprof_cpu pc = &lockprof.cpus[current_cpu()->id];
+    if (pc->busy || !lockprof_enabled)
+        return;
+    pc->busy = true;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    u64 wait = (here > start) ? nsec_from_timestamp(here - start) : 0;
+    lockprof_lock l = lockprof_lookup(pc, u64_from_pointer(lock), type);
+    if (l) {
+        l->waits++;
+        l->wait_total += wait;
+        if (wait > l->wait_max)
+            l->wait_max = wait;
+        int order = wait ? msb(wait) : 0;
+        int bucket = (order < LOCKPROF_HIST_MIN_ORDER) ? 0 : order - LOCKPROF_HIST_MIN_ORDER + 1;
+        l->hist[MIN(bucket, LOCKPROF_HIST_BUCKETS - 1)]++;
+    }
+    lockprof_record(pc, lock, type, wait, false);
+    pc->busy = false;
+}
+
+void lockprof_holder(void *lock, int type)
+{
+    lockprof_cpu pc = &lockprof.cpus[current_cpu()->id];
+    if (pc->busy)
+        return;
+    pc->busy = true;
+    lockprof_lock l = lockprof_lookup(pc, u64_from_pointer(lock), type);
+    if (l)
+        l->holds++;
+    lockprof_record(pc, lock, type, 0, true);
+    pc->busy = false;
+}
+
+/* Contended path of the test-and-set spinlock; see spin_lock() */
+void spin_lock_contended(spinlock l)
+{
+    volatile u64 *p = (volatile u64 *)&l->w;
+    u64 start = lockprof_wait_start();
+    boolean flagged = !start;
+    while (*p || !compare_and_swap_64(&l->w, 0, 1)) {
+        if (!flagged)
+            flagged = compare_and_swap_64(&l->w, 1, 1 | LOCKPROF_CONTENDED);
+        kern_pause();
+    }
+    if (start)
+        lockprof_wait_end(l, LOCKPROF_SPIN, start);
+}
+
+static void lockprof_start(void)
+{
+    lockprof_enabled = true;
+}
+
+static void lockprof_stop(void)
+{
+    lockprof_enabled = false;
+}
+
+static void lockprof_reset(void)
+{
+    lockprof_stop();
+    for (u64 i = 0; i < total_processors; i++) {
+        lockprof_cpu pc = &lockprof.cpus[i];
+        pc->nsamples = 0;
+        pc->dropped = 0;
+        zero(pc->locks, LOCKPROF_LOCKS * sizeof(struct lockprof_lock));
+    }
+    lockprof.dropped_locks = 0;
+}
+
+static void lockprof_print_pc(buffer b, u64 pc)
+{
+    u64 offset, len;
+    sstring name = find_elf_sym(pc, &offset, &len);
+    if (sstring_is_null(name))
+        bprintf(b, "%lx", pc);
+    else
+        bprintf(b, "%s+0x%lx", name, offset);
+}
+
+static sstring lockprof_type_name(u64 type)
+{
+    return (type == LOCKPROF_MUTEX) ? ss("mutex") : ss("spin");
+}
+
+static void lockprof_print_sample(buffer b, int cpu, lockprof_sample s)
+{
+    u64 usec = usec_from_timestamp(s->ts);
+    bprintf(b, "lock %d [%03d] %ld.%06ld: %ld %s: %s ", cpu, cpu, usec / MILLION, usec % MILLION,
+            s->holder ? 1 : MAX(s->wait, 1), s->holder ? ss("lock-holder") : ss("lock-wait"),
+            lockprof_type_name(s->type));
+    lockprof_print_pc(b, s->lock);
+    bprintf(b, "\n");
+    for (int i = 0; i < s->depth; i++) {
+        bprintf(b, "\t%16lx ", s->pcs[i]);
+        lockprof_print_pc(b, s->pcs[i]);
+        bprintf(b, " ([kernel.kallsyms])\n");
+    }
+    bprintf(b, "\n");
+}
+
+#define catch_err(s) do {if (!is_ok(s)) msg_err("lockprof: failed to send HTTP response: %v\n", (s));} while(0)
+
+static void lockprof_send_http_response(http_responder handler, buffer b)
+{
+    catch_err(send_http_response(handler, timm("ContentType", "text/plain"), b));
+}
+
+static void lockprof_send_http_error(http_responder handler, sstring status, sstring msg)
+{
+    buffer b = aprintf(lockprof.h, "<html><head><title>%s %s</title></head>"
+                       "<body><h1>%s</h1></body></html>\r\n", status, msg, msg);
+    catch_err(send_http_response(handler, timm("status", "%s %s", status, msg), b));
+}
+
+static buffer lockprof_chunk(http_responder out, buffer b)
+{
+    if (b && (buffer_length(b) > LOCKPROF_HTTP_CHUNK_MAXSIZE - 4*KB)) {
+        send_http_chunk(out, b);
+        b = 0;
+    }
+    if (!b) {
+        b = allocate_buffer(lockprof.h, LOCKPROF_HTTP_CHUNK_MAXSIZE);
+        assert(b != INVALID_ADDRESS);
+    }
+    return b;
+}
+
+/* Sampling is suspended while samples are being sent, so that the per-CPU buffers are stable;
+ * the buffers are cleared afterwards, so that successive requests stream new samples. */
+static void lockprof_send_samples(http_responder out)
+{
+    boolean enabled = lockprof_enabled;
+    lockprof_stop();
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = 0;
+    u64 dropped = 0;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        lockprof_cpu pc = &lockprof.cpus[cpu];
+        u64 n = pc->nsamples;
+        read_barrier();
+        dropped += pc->dropped;
+        for (u64 i = 0; i < n; i++) {
+            b = lockprof_chunk(out, b);
+            lockprof_print_sample(b, cpu, &pc->samples[i]);
+        }
+        pc->nsamples = 0;
+        pc->dropped = 0;
+    }
+    if (b)
+        send_http_chunk(out, b);
+    if (dropped)
+        msg_warn("lockprof: %ld samples dropped\n", dropped);
+    send_http_chunk(out, 0);
+    if (enabled)
+        lockprof_start();
+}
+
+static boolean lockprof_wait_compare(void *a, void *b)
+{
+    return ((lockprof_lock)a)->wait_total < ((lockprof_lock)b)->wait_total;
+}
+
+/* Per-lock statistics, merged across CPUs and sorted by total wait time */
+static void lockprof_send_stats(http_responder out)
+{
+    table merged = allocate_table(lockprof.h, identity_key, pointer_equal);
+    pqueue pq = allocate_pqueue(lockprof.h, lockprof_wait_compare);
+    if ((merged == INVALID_ADDRESS) || (pq == INVALID_ADDRESS)) {
+        if (merged != INVALID_ADDRESS)
+            deallocate_table(merged);
+        lockprof_send_http_error(out, ss("500"), ss("Internal Server Error"));
+        return;
+    }
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        lockprof_lock locks = lockprof.cpus[cpu].locks;
+        for (int i = 0; i < LOCKPROF_LOCKS; i++) {
+            lockprof_lock l = &locks[i];
+            if (!l->lock)
+                continue;
+            lockprof_lock m = table_find(merged, pointer_from_u64(l->lock));
+            if (!m) {
+                m = allocate_zero(lockprof.h, sizeof(*m));
+                assert(m != INVALID_ADDRESS);
+                m->lock = l->lock;
+                m->type = l->type;
+                table_set(merged, pointer_from_u64(l->lock), m);
+            }
+            m->waits += l->waits;
+            m->wait_total += l->wait_total;
+            m->wait_max = MAX(m->wait_max, l->wait_max);
+            m->holds += l->holds;
+            for (int j = 0; j < LOCKPROF_HIST_BUCKETS; j++)
+                m->hist[j] += l->hist[j];
+        }
+    }
+    table_foreach(merged, k, m) {
+        (void)k;
+        pqueue_insert(pq, m);
+    }
+    deallocate_table(merged);
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = lockprof_chunk(out, 0);
+    bprintf(b, "# sample rate 1/%ld, %ld locks dropped\n"
+            "# lock type waits wait_total_ns wait_max_ns holder_samples "
+            "wait_histogram(<%ldns, doubling)\n", lockprof.sample_rate, lockprof.dropped_locks,
+            U64_FROM_BIT(LOCKPROF_HIST_MIN_ORDER));
+    lockprof_lock l;
+    while ((l = pqueue_pop(pq)) != INVALID_ADDRESS) {
+        b = lockprof_chunk(out, b);
+        lockprof_print_pc(b, l->lock);
+        bprintf(b, " %s %ld %ld %ld %ld ", lockprof_type_name(l->type), l->waits,
+                l->wait_total, l->wait_max, l->holds);
+        for (int j = 0; j < LOCKPROF_HIST_BUCKETS; j++)
+            bprintf(b, "%ld%c", l->hist[j], (j < LOCKPROF_HIST_BUCKETS - 1) ? ',' : '\n');
+        deallocate(lockprof.h, l, sizeof(*l));
+    }
+    deallocate_pqueue(pq);
+    send_http_chunk(out, b);
+    send_http_chunk(out, 0);
+}
+
+closure_func_basic(http_request_handler, void, lockprof_http_request,
+                   http_method method, http_responder handler, value val)
+{
+    string relative_uri = get_string(val, sym(relative_uri));
+    if (!relative_uri) {
+        lockprof_send_http_error(handler, ss("500"), ss("Internal Server Error"));
+        return;
+    }
+    if (method != HTTP_REQUEST_METHOD_GET) {
+        lockprof_send_http_error(handler, ss("501"), ss("Not Implemented"));
+        return;
+    }
+    if (!buffer_strcmp(relative_uri, "samples")) {
+        lockprof_send_samples(handler);
+    } else if (!buffer_strcmp(relative_uri, "stats")) {
+        lockprof_send_stats(handler);
+    } else if (!buffer_strcmp(relative_uri, "start")) {
+        lockprof_start();
+        lockprof_send_http_response(handler, aprintf(lockprof.h,
+            "lock contention profiling started, sample rate 1/%ld\n", lockprof.sample_rate));
+    } else if (!buffer_strcmp(relative_uri, "stop")) {
+        lockprof_stop();
+        lockprof_send_http_response(handler, aprintf(lockprof.h,
+                                                     "lock contention profiling stopped\n"));
+    } else if (!buffer_strcmp(relative_uri, "reset")) {
+        lockprof_reset();
+        lockprof_send_http_response(handler, aprintf(lockprof.h,
+            "lock contention profiling stopped, statistics cleared\n"));
+    } else {
+        lockprof_send_http_error(handler, ss("404"), ss("Not Found"));
+    }
+}
+
+static void lockprof_init_http_listener(void)
+{
+    lockprof.hl = allocate_http_listener(lockprof.h, LOCKPROF_PORT);
+    if (lockprof.hl == INVALID_ADDRESS) {
+        msg_err("could not allocate lockprof HTTP listener\n");
+        return;
+    }
+    http_register_uri_handler(lockprof.hl, ss(LOCKPROF_URI),
+                              closure_func(lockprof.h, http_request_handler,
+                                           lockprof_http_request));
+    status s = listen_port(lockprof.h, LOCKPROF_PORT,
+                           connection_handler_from_http_listener(lockprof.hl));
+    if (!is_ok(s)) {
+        msg_err("listen_port(port=%d) failed for lockprof HTTP listener\n", LOCKPROF_PORT);
+        deallocate_http_listener(lockprof.h, lockprof.hl);
+        return;
+    }
+    rprintf("started lockprof http listener on port %d\n", LOCKPROF_PORT);
+}
+
+void lockprof_init(kernel_heaps kh, tuple root)
+{
+    value config = get(root, sym(lockprof));
+    if (!config)
+        return;
+    lockprof.h = heap_locked(kh);
+    lockprof.sample_rate = 1;
+    if (is_tuple(config)) {
+        u64 rate;
+        if (get_u64(config, sym(sample_rate), &rate)) {
+            if (rate > 0)
+                lockprof.sample_rate = rate;
+            else
+                msg_err("lockprof: invalid sample rate %ld\n", rate);
+        }
+    }
+    heap backed = (heap)heap_page_backed(kh);
+    lockprof_cpu cpus = allocate_zero(lockprof.h, present_processors * sizeof(struct lockprof_cpu));
+    assert(cpus != INVALID_ADDRESS);
+    for (u64 i = 0; i < present_processors; i++) {
+        cpus[i].samples = allocate(backed, LOCKPROF_SAMPLES_PER_CPU *
+                                   sizeof(struct lockprof_sample));
+        assert(cpus[i].samples != INVALID_ADDRESS);
+        cpus[i].locks = allocate_zero(backed, LOCKPROF_LOCKS * sizeof(struct lockprof_lock));
+        assert(cpus[i].locks != INVALID_ADDRESS);
+    }
+    lockprof.cpus = cpus;
+    lockprof_init_http_listener();
+    if (is_tuple(config) && get(config, sym(start)))
+        lockprof_start();
+}
@@ -24,6 +24,8 @@ u64 trace_get_flags(value v)
                     flags |= TRACE_THREAD_RUN;
                 else if (!buffer_strcmp(b, "pf"))
                     flags |= TRACE_PAGE_FAULT;
+                else if (!buffer_strcmp(b, "boot"))
+                    flags |= TRACE_BOOT;
                 else
                     flags |= TRACE_OTHER;
                 if (delim < 0)
@@ -1,6 +1,7 @@
 #define TRACE_OTHER         U64_FROM_BIT(0)
 #define TRACE_THREAD_RUN    U64_FROM_BIT(1)
 #define TRACE_PAGE_FAULT    U64_FROM_BIT(2)
+#define TRACE_BOOT          U64_FROM_BIT(3)
 
 u64 trace_get_flags(value v);
 
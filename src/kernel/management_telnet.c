@@ -16,6 +16,7 @@ closure_function(3, 1, status, telnet_recv,
     if (!b) {
         // XXX need tuple parser dealloc
         mgmt_debug("%s: remote closed\n", func_ss);
+        management_reset();     /* stop timed requests and subscriptions writing to out */
         return STATUS_OK;
     }
     mgmt_debug("%s: got request \"%b\"\n", func_ss, b);
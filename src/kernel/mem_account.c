@@ -0,0 +1,185 @@
+/* Memory accounting
+ *
+ * An accounting heap is a wrapper that counts the bytes allocated through it, and their
+ * high-water mark, on behalf of a named kernel subsystem. Wrappers created with the same name
+ * share one account. The accounts are exposed in the management tree under "memory", keyed by
+ * name, giving a breakdown of kernel memory by owner.
+ *
+ * Deallocations must specify the allocation size: wrapping a malloc-style heap (deallocations of
+ * size -1ull) is not supported.
+ */
+#include <kernel.h>
+#include <management.h>
+
+typedef struct mem_account {
+    sstring name;
+    word allocated;
+    u64 peak;
+    struct mem_account *next;
+    tuple mgmt;
+} *mem_account;
+
+typedef struct accounting_heap {
+    struct heap h;
+    heap parent;
+    heap meta;
+    mem_account acct;
+} *accounting_heap;
+
+static struct {
+    mem_account list;
+    struct spinlock lock;
+} mem_accounts;
+
+static void mem_account_add(mem_account acct, bytes size)
+{
+    u64 allocated = fetch_and_add(&acct->allocated, size) + size;
+    u64 peak;
+    while (allocated > (peak = acct->peak)) {
+        if (compare_and_swap_64(&acct->peak, peak, allocated))
+            break;
+    }
+}
+
+static u64 mem_account_alloc(heap h, bytes size)
+{
+    accounting_heap mh = (accounting_heap)h;
+    u64 a = allocate_u64(mh->parent, size);
+    if (a != INVALID_PHYSICAL)
+        mem_account_add(mh->acct, size);
+    return a;
+}
+
+static void mem_account_dealloc(heap h, u64 x, bytes size)
+{
+    accounting_heap mh = (accounting_heap)h;
+    deallocate_u64(mh->parent, x, size);
+    fetch_and_add(&mh->acct->allocated, -size);
+}
+
+static void mem_account_destroy(heap h)
+{
+    accounting_heap mh = (accounting_heap)h;
+    deallocate(mh->meta, mh, sizeof(*mh));
+}
+
+static bytes mem_account_allocated(heap h)
+{
+    return heap_allocated(((accounting_heap)h)->parent);
+}
+
+static bytes mem_account_total(heap h)
+{
+    return heap_total(((accounting_heap)h)->parent);
+}
+
+static value mem_account_management(heap h)
+{
+    return heap_management(((accounting_heap)h)->parent);
+}
+
+static mem_account mem_account_find(sstring name)
+{
+    for (mem_account acct = mem_accounts.list; acct; acct = acct->next) {
+        if (!runtime_strcmp(acct->name, name))
+            return acct;
+    }
+    return 0;
+}
+
+heap mem_account_heap(heap meta, heap parent, sstring name)
+{
+    accounting_heap mh = allocate(meta, sizeof(*mh));
+    if (mh == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    spin_lock(&mem_accounts.lock);
+    mem_account acct = mem_account_find(name);
+    if (!acct) {
+        acct = allocate(meta, sizeof(*acct));
+        if (acct == INVALID_ADDRESS) {
+            spin_unlock(&mem_accounts.lock);
+            deallocate(meta, mh, sizeof(*mh));
+            return INVALID_ADDRESS;
+        }
+        acct->name = name;
+        acct->allocated = 0;
+        acct->peak = 0;
+        acct->mgmt = 0;
+        acct->next = mem_accounts.list;
+        mem_accounts.list = acct;
+    }
+    spin_unlock(&mem_accounts.lock);
+    mh->h.alloc = mem_account_alloc;
+    mh->h.dealloc = mem_account_dealloc;
+    mh->h.destroy = mem_account_destroy;
+    mh->h.allocated = mem_account_allocated;
+    mh->h.total = mem_account_total;
+    mh->h.management = mem_account_management;
+    mh->h.pagesize = parent->pagesize;
+    mh->parent = parent;
+    mh->meta = meta;
+    mh->acct = acct;
+    return &mh->h;
+}
+
+/* returns the management tuple of an account, updated with the current values */
+static tuple mem_account_value(mem_account acct)
+{
+    tuple t = acct->mgmt;
+    if (!t) {
+        t = allocate_tuple();
+        assert(t != INVALID_ADDRESS);
+        acct->mgmt = t;
+    }
+    set(t, sym(allocated), value_from_u64(acct->allocated));
+    set(t, sym(peak), value_from_u64(acct->peak));
+    return t;
+}
+
+closure_func_basic(tuple_get, value, mem_accounts_get,
+                   value a)
+{
+    if (!is_symbol(a))
+        return 0;
+    string name = symbol_string(a);
+    spin_lock(&mem_accounts.lock);
+    value v = 0;
+    for (mem_account acct = mem_accounts.list; acct; acct = acct->next) {
+        if (!buffer_compare_with_sstring(name, acct->name)) {
+            v = mem_account_value(acct);
+            break;
+        }
+    }
+    spin_unlock(&mem_accounts.lock);
+    return v;
+}
+
+closure_func_basic(tuple_set, void, mem_accounts_set,
+                   value a, value v)
+{
+    /* read-only */
+}
+
+closure_func_basic(tuple_iterate, boolean, mem_accounts_iterate,
+                   binding_handler h)
+{
+    /* the list is only ever prepended to, so it can be walked without holding the lock */
+    for (mem_account acct = mem_accounts.list; acct; acct = acct->next) {
+        spin_lock(&mem_accounts.lock);
+        tuple t = mem_account_value(acct);
+        spin_unlock(&mem_accounts.lock);
+        if (!apply(h, sym_sstring(acct->name), t))
+            return false;
+    }
+    return true;
+}
+
+/* Exposes the memory accounts, keyed by name, in the management tree */
+value mem_accounts_management(heap h)
+{
+    tuple ft = allocate_function_tuple(closure_func(h, tuple_get, mem_accounts_get),
+                                       closure_func(h, tuple_set, mem_accounts_set),
+                                       closure_func(h, tuple_iterate, mem_accounts_iterate));
+    assert(ft != INVALID_ADDRESS);
+    return ft;
+}
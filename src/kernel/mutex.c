@@ -76,6 +76,19 @@ static inline void mcs_unlock(mutex m, cpuinfo ci)
         next->mcs_waiting = false;
 }
 
+/* A contended acquisition is sampled once, when the locker first has to wait. */
+#define mutex_contended() do {                          \
+        if (!contended) {                               \
+            contended = true;                           \
+            lp_start = lockprof_wait_start();           \
+        }                                               \
+    } while (0)
+
+#define mutex_acquired() do {                                   \
+        if (lp_start)                                           \
+            lockprof_wait_end(m, LOCKPROF_MUTEX, lp_start);     \
+    } while (0)
+
 static inline boolean mutex_lock_internal(mutex m, boolean wait)
 {
     cpuinfo ci = current_cpu();
@@ -107,6 +120,8 @@ static inline boolean mutex_lock_internal(mutex m, boolean wait)
     }
 
     assert(!frame_is_full(ctx->frame));
+    boolean contended = false;
+    u64 lp_start = 0;
     boolean on_mcs = true;
     ci->mcs_waiting = true;
     cpuinfo prev = pointer_from_u64(atomic_swap_64((u64*)&m->mcs_tail,
@@ -118,6 +133,8 @@ static inline boolean mutex_lock_internal(mutex m, boolean wait)
         goto acquire;
     }
 
+    mutex_contended();
+
     /* prev write must occur before next */
     ci->mcs_prev = prev;
     write_barrier();
@@ -187,6 +204,7 @@ static inline boolean mutex_lock_internal(mutex m, boolean wait)
         ci->lock_stats_disable = lsd;
         LOCKSTATS_RECORD_LOCK(m->s, true, spins, sleeps);
 #endif
+        mutex_acquired();
         return true;
     }
     mutex_debug("   inserting into waiters list and suspending\n");
@@ -207,8 +225,10 @@ static inline boolean mutex_lock_internal(mutex m, boolean wait)
 #ifdef LOCK_STATS
             LOCKSTATS_RECORD_LOCK(m->s, true, spins, sleeps);
 #endif
+            mutex_acquired();
             return true;
         }
+        mutex_contended();
         mutex_pause();
 #ifdef LOCK_STATS
         spins++;
@@ -261,6 +281,9 @@ void mutex_unlock(mutex m)
     context ctx = get_current_context(ci);
     mutex_debug("mutex %p, ctx %p, ra %p\n", m, ctx, __builtin_return_address(0));
     assert(ctx == m->turn);
+    if (__builtin_expect(lockprof_enabled, 0) &&
+        (((volatile mutex)m)->mcs_tail || !list_empty(&m->waiters)))
+        lockprof_holder(m, LOCKPROF_MUTEX);
     m->turn = 0;
 
     /* MCS owner can grab the mutex now, but we'll also schedule a waiter if we can. */
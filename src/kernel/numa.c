@@ -0,0 +1,166 @@
+/* NUMA topology and node-local physical allocation
+ *
+ * Platform code reports the proximity domain of memory ranges and CPUs (e.g. from the ACPI SRAT)
+ * during initialization, before secondary cores are started; proximity domains are mapped to dense
+ * node numbers in the order they are reported. Physical memory remains managed by the single
+ * physical id heap: node-local allocations are subrange allocations within the memory ranges of a
+ * node, so that accounting and memory cleaning are unaffected by the topology.
+ * The node of each CPU number is the only state updated afterwards, when a hot-added processor is
+ * assigned a different CPU number.
+ */
+
+#include <kernel.h>
+
+//#define NUMA_DEBUG
+#ifdef NUMA_DEBUG
+#define numa_debug(x, ...) do {rprintf("NUMA: " x, ##__VA_ARGS__);} while(0)
+#else
+#define numa_debug(x, ...)
+#endif
+
+#define NUMA_MAX_MEMRANGES  64
+#define NUMA_MAX_CPUS       1024
+
+#define NUMA_LOCAL_DISTANCE     10
+#define NUMA_REMOTE_DISTANCE    20
+
+BSS_RO_AFTER_INIT static struct {
+    boolean active;                     /* topology complete, with multiple nodes */
+    int node_count;
+    u32 domains[NUMA_MAX_NODES];        /* proximity domain of each node */
+    int mem_count;
+    struct {
+        range r;
+        int node;
+    } mem[NUMA_MAX_MEMRANGES];
+    u8 distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+    u8 fallback[NUMA_MAX_NODES][NUMA_MAX_NODES];    /* nodes in order of distance */
+} numa;
+
+static u8 numa_cpu_nodes[NUMA_MAX_CPUS];
+
+static int numa_find_domain(u32 domain)
+{
+    for (int node = 0; node < numa.node_count; node++)
+        if (numa.domains[node] == domain)
+            return node;
+    return -1;
+}
+
+static int numa_get_domain(u32 domain)
+{
+    int node = numa_find_domain(domain);
+    if (node >= 0)
+        return node;
+    if (numa.node_count == NUMA_MAX_NODES) {
+        msg_warn("too many NUMA nodes; ignoring proximity domain %d\n", domain);
+        return -1;
+    }
+    node = numa.node_count++;
+    numa.domains[node] = domain;
+    for (int i = 0; i < node; i++)
+        numa.distance[i][node] = numa.distance[node][i] = NUMA_REMOTE_DISTANCE;
+    numa.distance[node][node] = NUMA_LOCAL_DISTANCE;
+    numa_debug("proximity domain %d -> node %d\n", domain, node);
+    return node;
+}
+
+void numa_add_memory(u32 domain, range r)
+{
+    int node = numa_get_domain(domain);
+    if (node < 0)
+        return;
+    if (numa.mem_count == NUMA_MAX_MEMRANGES) {
+        msg_warn("too many NUMA memory ranges; ignoring %R\n", r);
+        return;
+    }
+    numa_debug("memory %R -> node %d\n", r, node);
+    numa.mem[numa.mem_count].r = r;
+    numa.mem[numa.mem_count++].node = node;
+}
+
+void numa_set_cpu_domain(int cpu, u32 domain)
+{
+    int node = numa_get_domain(domain);
+    if ((node < 0) || (cpu >= NUMA_MAX_CPUS))
+        return;
+    numa_debug("cpu %d -> node %d\n", cpu, node);
+    numa_cpu_nodes[cpu] = node;
+}
+
+void numa_swap_cpus(int cpu1, int cpu2)
+{
+    if ((cpu1 >= NUMA_MAX_CPUS) || (cpu2 >= NUMA_MAX_CPUS))
+        return;
+    u8 node = numa_cpu_nodes[cpu1];
+    numa_cpu_nodes[cpu1] = numa_cpu_nodes[cpu2];
+    numa_cpu_nodes[cpu2] = node;
+}
+
+/* Unknown domains are ignored, as distances are only meaningful for nodes with memory or CPUs. */
+void numa_set_distance(u32 from, u32 to, u8 distance)
+{
+    int from_node = numa_find_domain(from);
+    int to_node = numa_find_domain(to);
+    if ((from_node >= 0) && (to_node >= 0))
+        numa.distance[from_node][to_node] = distance;
+}
+
+/* Computes the allocation fallback order of each node, once the topology is complete. */
+void numa_topology_done(void)
+{
+    for (int node = 0; node < numa.node_count; node++) {
+        u8 *order = numa.fallback[node];
+        int count = 0;
+        order[count++] = node;
+        for (int i = 0; i < numa.node_count; i++)
+            if (i != node)
+                order[count++] = i;
+        /* sort remote nodes by distance */
+        for (int i = 2; i < count; i++) {
+            u8 n = order[i];
+            int j = i;
+            while ((j > 1) && (numa.distance[node][order[j - 1]] > numa.distance[node][n])) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = n;
+        }
+    }
+    numa.active = (numa.node_count > 1);
+    numa_debug("%d nodes\n", numa.node_count);
+}
+
+int numa_node_count(void)
+{
+    return numa.active ? numa.node_count : 1;
+}
+
+int numa_cpu_node(int cpu)
+{
+    return (cpu < NUMA_MAX_CPUS) ? numa_cpu_nodes[cpu] : 0;
+}
+
+/* Allocates physical memory below limit from the memory of the node of the current CPU or, if not
+ * available, from the nearest node that has it; returns INVALID_PHYSICAL if the topology is flat
+ * or no node memory is available, in which case the caller falls back to a plain allocation. */
+u64 numa_alloc_phys(id_heap physical, bytes size, u64 limit)
+{
+    if (!numa.active)
+        return INVALID_PHYSICAL;
+    int local = numa_cpu_node(current_cpu()->id);
+    for (int i = 0; i < numa.node_count; i++) {
+        int node = numa.fallback[local][i];
+        for (int m = 0; m < numa.mem_count; m++) {
+            if (numa.mem[m].node != node)
+                continue;
+            range r = numa.mem[m].r;
+            if (r.start >= limit)
+                continue;
+            u64 p = id_heap_alloc_subrange(physical, size, r.start, MIN(r.end, limit));
+            if (p != INVALID_PHYSICAL)
+                return p;
+        }
+    }
+    return INVALID_PHYSICAL;
+}
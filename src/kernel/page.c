@@ -4,6 +4,10 @@
 
 struct spinlock pt_lock;
 
+/* zero-filled page mapped read-only in place of untouched anonymous memory; it is never made
+ * writable or freed when unmapped */
+u64 zero_page_phys = INVALID_PHYSICAL;
+
 //#define PAGE_INIT_DEBUG
 //#define PAGE_DEBUG
 //#define PAGE_UPDATE_DEBUG
@@ -143,6 +147,64 @@ boolean traverse_ptes(u64 vaddr, u64 length, entry_handler ph)
     return result;
 }
 
+/* called with lock held; replaces the block mapping at entry with a table of mappings of the next
+ * level covering the same physical memory with the same flags */
+static boolean split_block(pteptr entry, int level, u64 vaddr, flush_entry fe)
+{
+    pte e = pte_from_pteptr(entry);
+    u64 phys = page_from_pte(e);
+    u64 flags = flags_from_pte(e);
+    u64 size = U64_FROM_BIT(pt_level_shift(level + 1));
+    u64 tp_phys;
+    u64 *tp = allocate_table_page(&tp_phys);
+    if (tp == INVALID_ADDRESS) {
+        msg_err("failed to allocate page table memory\n");
+        return false;
+    }
+    for (int i = 0; i < PTE_ENTRIES; i++, phys += size)
+        tp[i] = (level + 1 == PT_PTE_LEVEL) ? page_pte(phys, flags) : block_pte(phys, flags);
+    write_barrier();
+    pte_set(entry, new_level_pte(tp_phys));
+    page_invalidate(fe, vaddr);
+    return true;
+}
+
+/* called with lock held; makes sure that no block mapping straddles vaddr */
+static boolean split_blocks_at(u64 vaddr, flush_entry fe)
+{
+    u64 vmask = vaddr & ~MASK(VIRTUAL_ADDRESS_BITS);
+    u64 *table_ptr = pointer_from_pteaddr(get_pagetable_base(vaddr));
+    vaddr &= MASK(VIRTUAL_ADDRESS_BITS);
+    for (int level = PT_FIRST_LEVEL; level < PT_PTE_LEVEL; level++) {
+        int shift = pt_level_shift(level);
+        pteptr entry = &table_ptr[(vaddr >> shift) & (PTE_ENTRIES - 1)];
+        pte e = pte_from_pteptr(entry);
+        if (!pte_is_present(e))
+            return true;
+        if (level > PT_FIRST_LEVEL && pte_is_mapping(level, e)) {
+            if ((vaddr & MASK(shift)) == 0)
+                return true;
+            if (!split_block(entry, level, vmask | (vaddr & ~MASK(shift)), fe))
+                return false;
+            e = pte_from_pteptr(entry);
+        }
+        table_ptr = pointer_from_pteaddr(page_from_pte(e));
+    }
+    return true;
+}
+
+/* Operations on part of a block mapping (e.g. unmapping or changing the protection of a few pages
+ * within a 2MB mapping) must not affect the rest of the block: split any block mapping crossing
+ * the boundaries of the given range. */
+static void split_range_edges(u64 vaddr, u64 length, flush_entry fe)
+{
+    pagetable_lock();
+    if (!split_blocks_at(vaddr, fe) || !split_blocks_at(vaddr + length, fe))
+        halt("%s: failed to split block mappings for v 0x%lx, len 0x%lx\n", func_ss,
+             vaddr, length);
+    pagetable_unlock();
+}
+
 closure_func_basic(entry_handler, boolean, dump_entry,
                    int level, u64 vaddr, pteptr entry)
 {
@@ -215,7 +277,10 @@ closure_function(2, 3, boolean, update_pte_flags,
     if (!pte_is_present(orig_pte) || !pte_is_mapping(level, orig_pte))
         return true;
 
-    pte_set(entry, (orig_pte & ~PAGE_PROT_FLAGS) | bound(flags).w);
+    pageflags flags = bound(flags);
+    if (page_from_pte(orig_pte) == zero_page_phys)
+        flags = pageflags_readonly(flags);
+    pte_set(entry, (orig_pte & ~PAGE_PROT_FLAGS) | flags.w);
 #ifdef PAGE_UPDATE_DEBUG
     page_debug("update 0x%lx: pte @ 0x%lx, 0x%lx -> 0x%lx\n", addr, entry, orig_pte,
                pte_from_pteptr(entry));
@@ -233,6 +298,7 @@ void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, stat
     /* Catch any attempt to change page flags in a linear_backed mapping */
     assert(!intersects_linear_backed(irangel(vaddr, length)));
     flush_entry fe = get_page_flush_entry();
+    split_range_edges(vaddr, length, fe);
     traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags, fe));
     page_invalidate_sync(fe, complete);
 #ifdef PAGE_DUMP_ALL
@@ -292,6 +358,7 @@ void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length)
     assert(range_empty(range_intersection(irange(vaddr_new, vaddr_new + length),
                                           irange(vaddr_old, vaddr_old + length))));
     flush_entry fe = get_page_flush_entry();
+    split_range_edges(vaddr_old, length, fe);
     traverse_ptes(vaddr_old, length, stack_closure(remap_entry, vaddr_new, vaddr_old, fe));
     page_invalidate_sync(fe, 0);
 #ifdef PAGE_DUMP_ALL
@@ -348,6 +415,7 @@ void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh)
 {
     assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
     flush_entry fe = get_page_flush_entry();
+    split_range_edges(virtual, length, fe);
     traverse_ptes(virtual, length, stack_closure(unmap_page, rh, fe));
     page_invalidate_sync(fe, 0);
 #ifdef PAGE_DUMP_ALL
@@ -356,6 +424,58 @@ void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh)
 #endif
 }
 
+closure_function(1, 3, boolean, clean_page,
+                 flush_entry, fe,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (pte_is_present(old_entry) && pte_is_mapping(level, old_entry) &&
+        pte_is_dirty(old_entry)) {
+        pt_pte_clean(entry);
+        page_invalidate(bound(fe), vaddr);
+    }
+    return true;
+}
+
+/* Clear the dirty state of the pages mapped in a range, so that subsequent writes can be detected
+   by unmap_clean_pages_with_handler(). */
+void clean_pages(u64 virtual, u64 length)
+{
+    assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
+    flush_entry fe = get_page_flush_entry();
+    traverse_ptes(virtual, length, stack_closure(clean_page, fe));
+    page_invalidate_sync(fe, 0);
+}
+
+/* called with lock held */
+closure_function(2, 3, boolean, unmap_clean_page,
+                 range_handler, rh, flush_entry, fe,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (!pte_is_present(old_entry) || !pte_is_mapping(level, old_entry) ||
+        pte_is_dirty(old_entry))
+        return true;
+    /* A write racing with the removal of the entry either sets the dirty bit before the entry is
+       replaced (and the page is kept), or faults on the non-present entry. */
+    if (!compare_and_swap_64((u64 *)entry, old_entry, 0))
+        return true;
+    page_invalidate(bound(fe), vaddr);
+    apply(bound(rh), irangel(page_from_pte(old_entry), pte_map_size(level, old_entry)));
+    return true;
+}
+
+/* Unmap the pages in a range that have not been written since the last clean_pages() on them.
+   The page table lock is held when rh is called. */
+void unmap_clean_pages_with_handler(u64 virtual, u64 length, range_handler rh)
+{
+    assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
+    flush_entry fe = get_page_flush_entry();
+    split_range_edges(virtual, length, fe);
+    traverse_ptes(virtual, length, stack_closure(unmap_clean_page, rh, fe));
+    page_invalidate_sync(fe, 0);
+}
+
 #define next_addr(a, mask) (a = (a + (mask) + 1) & ~(mask))
 #define INDEX_MASK (PAGEMASK >> 3)
 /* If the flush_entry argument is non-null, the virtual address range is remapped, i.e. any existing
@@ -511,6 +631,80 @@ physical map_with_complete(u64 v, physical p, u64 length, pageflags flags, statu
     return p - length;
 }
 
+/* called with lock held */
+closure_func_basic(entry_handler, boolean, unmapped_entry,
+                   int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    return !pte_is_present(e) || !pte_is_mapping(level, e);
+}
+
+/* Map the virtual address range only if no page is mapped anywhere in the range, checking and
+ * mapping atomically with respect to other mappers; this allows a caller to install a block
+ * mapping without racing against concurrent faults on single pages within the block. */
+boolean map_if_unmapped(u64 v, physical p, u64 length, pageflags flags)
+{
+    assert((v & PAGEMASK) == 0);
+    assert((p & PAGEMASK) == 0);
+    range r = irangel(v, pad(length, PAGESIZE));
+    boolean mapped;
+    pagetable_lock();
+    mapped = recurse_ptes(get_pagetable_base(v), PT_FIRST_LEVEL, v, range_span(r), 0,
+                          stack_closure_func(entry_handler, unmapped_entry));
+    if (mapped) {
+        u64 *table_ptr = pointer_from_pteaddr(get_pagetable_base(v));
+        if (!map_level(table_ptr, PT_FIRST_LEVEL, r, &p, flags.w, 0))
+            halt("%s: map failed for v 0x%lx, p 0x%lx, len 0x%lx, flags 0x%lx\n", func_ss,
+                 v, p, length, flags.w);
+    }
+    pagetable_unlock();
+    if (mapped)
+        flush_tlb(false);
+    return mapped;
+}
+
+/* Map a batch of pages, not necessarily physically contiguous, at consecutive virtual addresses
+ * within a single last-level page table, with one page table walk and one TLB flush. Pages whose
+ * physical address is INVALID_PHYSICAL, or whose virtual address is already mapped, are skipped.
+ * Returns a bitmask of the pages that have been mapped. */
+u64 map_pages_if_unmapped(u64 v, u64 *phys, int count, pageflags flags)
+{
+    assert((v & PAGEMASK) == 0);
+    assert((count > 0) && (count <= 64));
+    assert(((v ^ (v + ((count - 1) << PAGELOG))) & ~MASK(pt_level_shift(PT_PTE_LEVEL - 1))) == 0);
+    u64 mapped = 0;
+    pagetable_lock();
+    u64 *table_ptr = pointer_from_pteaddr(get_pagetable_base(v));
+    u64 vaddr = v & MASK(VIRTUAL_ADDRESS_BITS);
+    for (int level = PT_FIRST_LEVEL; level < PT_PTE_LEVEL; level++) {
+        pteptr entry = &table_ptr[(vaddr >> pt_level_shift(level)) & (PTE_ENTRIES - 1)];
+        pte e = pte_from_pteptr(entry);
+        if (!pte_is_present(e)) {
+            u64 tp_phys;
+            if (allocate_table_page(&tp_phys) == INVALID_ADDRESS)
+                goto out;
+            e = new_level_pte(tp_phys);
+            pte_set(entry, e);
+        } else if (level > PT_FIRST_LEVEL && pte_is_mapping(level, e)) {
+            goto out;   /* block mapping */
+        }
+        table_ptr = pointer_from_pteaddr(page_from_pte(e));
+    }
+    for (int i = 0; i < count; i++) {
+        pteptr entry = &table_ptr[((vaddr >> PAGELOG) + i) & (PTE_ENTRIES - 1)];
+        if ((phys[i] == INVALID_PHYSICAL) || pte_is_present(pte_from_pteptr(entry)))
+            continue;
+        pte_set(entry, page_pte(phys[i], flags.w));
+        page_invalidate(0, v + (i << PAGELOG));
+        mapped |= U64_FROM_BIT(i);
+    }
+  out:
+    pagetable_unlock();
+    if (mapped)
+        flush_tlb(false);
+    return mapped;
+}
+
 /* Set up a mapping, like the map() function but without acquiring the page table lock; this
  * function is meant to be called by init code, when there is only one CPU running. */
 void map_nolock(u64 v, physical p, u64 length, pageflags flags)
@@ -551,15 +745,174 @@ closure_function(1, 1, boolean, page_dealloc,
                  heap, pageheap,
                  range r)
 {
+    if (r.start == zero_page_phys)
+        return true;
+    u64 virt = pagemem.pagevirt.start + r.start;
+    deallocate_u64(bound(pageheap), virt, range_span(r));
+    return true;
+}
+
+/* Physical pages unmapped by unmap_and_free_phys_heap() are not freed until the TLB shootdown for
+ * the unmap has completed, so that they can't be reused while other CPUs may still access them;
+ * they are gathered in chunks of (possibly merged) ranges, released together by the completion of
+ * the flush entry. */
+#define PAGE_FREE_CHUNK_RANGES  62
+
+typedef struct page_free_chunk {
+    struct page_free_chunk *next;
+    heap pageheap;
+    u32 count;
+    range r[PAGE_FREE_CHUNK_RANGES];
+} *page_free_chunk;
+
+typedef struct page_free_batch {
+    heap h;
+    page_free_chunk chunks;     /* most recent first */
+    closure_struct(status_handler, free);
+} *page_free_batch;
+
+closure_func_basic(status_handler, void, page_free_batch_free,
+                   status s)
+{
+    page_free_batch b = struct_from_field(closure_self(), page_free_batch, free);
+    page_free_chunk c = b->chunks;
+    while (c) {
+        for (u32 i = 0; i < c->count; i++)
+            deallocate_u64(c->pageheap, pagemem.pagevirt.start + c->r[i].start,
+                           range_span(c->r[i]));
+        page_free_chunk next = c->next;
+        deallocate(b->h, c, sizeof(*c));
+        c = next;
+    }
+    deallocate(b->h, b, sizeof(*b));
+}
+
+/* Within a flush batch, pages unmapped from different areas are freed by a single batch. */
+static page_free_batch page_free_batch_get(flush_entry fe)
+{
+    cpuinfo ci = current_cpu();
+    if (fe && (fe == ci->flush_batch) && ci->flush_batch_completion)
+        return struct_from_field(ci->flush_batch_completion, page_free_batch, free);
+    heap h = heap_locked(get_kernel_heaps());
+    page_free_batch b = allocate(h, sizeof(*b));
+    if (b == INVALID_ADDRESS)
+        return b;
+    b->h = h;
+    b->chunks = 0;
+    init_closure_func(&b->free, status_handler, page_free_batch_free);
+    return b;
+}
+
+/* Makes room in the batch for ranges of pageheap. */
+static boolean page_free_batch_reserve(page_free_batch b, heap pageheap)
+{
+    page_free_chunk c = b->chunks;
+    if (c && (c->pageheap == pageheap) && (c->count < PAGE_FREE_CHUNK_RANGES))
+        return true;
+    c = allocate(b->h, sizeof(*c));
+    if (c == INVALID_ADDRESS)
+        return false;
+    c->pageheap = pageheap;
+    c->count = 0;
+    c->next = b->chunks;
+    b->chunks = c;
+    return true;
+}
+
+/* Syncs the flush entry, freeing the pages in the batch when the shootdown completes; within a
+ * flush batch, this happens at the end of the flush batch. */
+static void page_free_batch_commit(page_free_batch b, flush_entry fe)
+{
+    cpuinfo ci = current_cpu();
+    if (fe && (fe == ci->flush_batch)) {
+        ci->flush_batch_completion = (status_handler)&b->free;
+        page_invalidate_sync(fe, 0);
+    } else {
+        page_invalidate_sync(fe, (status_handler)&b->free);
+    }
+}
+
+/* called with lock held; stops the traversal at the first page that doesn't fit in the batch */
+closure_function(4, 3, boolean, unmap_page_deferred,
+                 page_free_batch, b, flush_entry, fe, u64 *, resume, boolean *, full,
+                 int level, u64 vaddr, pteptr entry)
+{
+    pte old_entry = pte_from_pteptr(entry);
+    if (!pte_is_present(old_entry) || !pte_is_mapping(level, old_entry))
+        return true;
+    range r = irangel(page_from_pte(old_entry), pte_map_size(level, old_entry));
+    if (r.start != zero_page_phys) {
+        page_free_chunk c = bound(b)->chunks;
+        if (c->count && (c->r[c->count - 1].end == r.start)) {
+            c->r[c->count - 1].end = r.end;
+        } else if (c->count < PAGE_FREE_CHUNK_RANGES) {
+            c->r[c->count++] = r;
+        } else {
+            *bound(resume) = vaddr;
+            *bound(full) = true;
+            return false;
+        }
+    }
+    *entry = 0;
+    page_invalidate(bound(fe), vaddr);
+    return true;
+}
+
+void unmap_and_free_phys_heap(u64 virtual, u64 length, heap pageheap)
+{
+    assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
+    flush_entry fe = get_page_flush_entry();
+    split_range_edges(virtual, length, fe);
+    range_handler dealloc = stack_closure(page_dealloc, pageheap);
+    page_free_batch b = page_free_batch_get(fe);
+    if (b == INVALID_ADDRESS) {
+        /* free pages as they are unmapped */
+        traverse_ptes(virtual, length, stack_closure(unmap_page, dealloc, fe));
+        page_invalidate_sync(fe, 0);
+        return;
+    }
+    u64 resume;
+    boolean full;
+    do {
+        full = false;
+        if (!page_free_batch_reserve(b, pageheap)) {
+            traverse_ptes(virtual, length, stack_closure(unmap_page, dealloc, fe));
+            break;
+        }
+        traverse_ptes(virtual, length,
+                      stack_closure(unmap_page_deferred, b, fe, &resume, &full));
+        if (full) {
+            length -= resume - virtual;
+            virtual = resume;
+        }
+    } while (full);
+    page_free_batch_commit(b, fe);
+}
+
+closure_function(2, 1, boolean, page_dealloc_count,
+                 heap, pageheap, u64 *, freed,
+                 range r)
+{
+    if (r.start == zero_page_phys)
+        return true;
     u64 virt = pagemem.pagevirt.start + r.start;
     deallocate_u64(bound(pageheap), virt, range_span(r));
+    *bound(freed) += range_span(r);
     return true;
 }
 
+/* returns the number of bytes freed */
+u64 unmap_clean_and_free_phys_heap(u64 virtual, u64 length, heap pageheap)
+{
+    u64 freed = 0;
+    unmap_clean_pages_with_handler(virtual, length,
+                                   stack_closure(page_dealloc_count, pageheap, &freed));
+    return freed;
+}
+
 void unmap_and_free_phys(u64 virtual, u64 length)
 {
-    unmap_pages_with_handler(virtual, length,
-                             stack_closure(page_dealloc, (heap)get_kernel_heaps()->pages));
+    unmap_and_free_phys_heap(virtual, length, (heap)get_kernel_heaps()->pages);
 }
 
 void page_free_phys(u64 phys)
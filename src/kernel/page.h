@@ -1,5 +1,6 @@
 #ifdef KERNEL
 extern struct spinlock pt_lock;
+extern u64 zero_page_phys;
 #define pagetable_lock() u64 _savedflags = spin_lock_irq(&pt_lock)
 #define pagetable_unlock() spin_unlock_irq(&pt_lock, _savedflags)
 #else
@@ -27,9 +28,13 @@ flush_entry get_page_flush_entry();
 void page_invalidate(flush_entry f, u64 address);
 void page_invalidate_sync(flush_entry f, status_handler completion);
 void page_invalidate_flush();
+void page_invalidate_cpu_online(void);
+void page_flush_batch_start(void);
+void page_flush_batch_end(void);
 
 void invalidate(u64 page);
 void flush_tlb(boolean full_flush);
+void flush_tlb_global(void);
 
 /* mapping and flag update */
 physical map_with_complete(u64 v, physical p, u64 length, pageflags flags, status_handler complete);
@@ -40,6 +45,8 @@ static inline void map(u64 v, physical p, u64 length, pageflags flags)
 }
 
 void map_nolock(u64 v, physical p, u64 length, pageflags flags);
+boolean map_if_unmapped(u64 v, physical p, u64 length, pageflags flags);
+u64 map_pages_if_unmapped(u64 v, u64 *phys, int count, pageflags flags);
 
 void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, status_handler complete);
 
@@ -55,6 +62,8 @@ void zero_mapped_pages(u64 vaddr, u64 length);
 void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length);
 void unmap(u64 virtual, u64 length);
 void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh);
+void clean_pages(u64 virtual, u64 length);
+void unmap_clean_pages_with_handler(u64 virtual, u64 length, range_handler rh);
 
 static inline void unmap_pages(u64 virtual, u64 length)
 {
@@ -1,5 +1,4 @@
 /* TODO:
-   - keep refault stats
    - interface to physical free page list / shootdown epochs
 
    - would be nice to propagate a priority alone with requests to
@@ -62,6 +61,11 @@ static inline range byte_range_from_page(pagecache pc, pagecache_page pp)
     return range_lshift(irangel(page_offset(pp), 1), pc->page_order);
 }
 
+static inline void page_ref(pagecache_page pp)
+{
+    fetch_and_add_32(&pp->refcount, 1);
+}
+
 static inline void pagelist_enqueue(pagelist pl, pagecache_page pp)
 {
     list_insert_before(&pl->l, &pp->l);
@@ -86,6 +90,159 @@ static inline void pagelist_touch(pagelist pl, pagecache_page pp)
     list_insert_before(&pl->l, &pp->l);
 }
 
+static inline boolean page_index_covers(page_index_node n, u64 pi)
+{
+    return (n->shift + PAGE_INDEX_ORDER >= 64) || !(pi >> (n->shift + PAGE_INDEX_ORDER));
+}
+
+static inline int page_index_slot(page_index_node n, u64 pi)
+{
+    return (pi >> n->shift) & MASK(PAGE_INDEX_ORDER);
+}
+
+/* May run concurrently with insertions, which publish fully initialized index nodes. */
+static pagecache_page page_index_lookup(pagecache_node pn, u64 pi)
+{
+    page_index_node n = *(page_index_node volatile *)&pn->pages;
+    if (!n || !page_index_covers(n, pi))
+        return INVALID_ADDRESS;
+    while (n->shift) {
+        n = *(page_index_node volatile *)&n->slots[page_index_slot(n, pi)];
+        if (!n)
+            return INVALID_ADDRESS;
+    }
+    pagecache_page pp = *(pagecache_page volatile *)&n->slots[page_index_slot(n, pi)];
+    return pp ? pp : INVALID_ADDRESS;
+}
+
+/* first page at or after offset pi in the subtree rooted at n */
+static pagecache_page page_index_find_next(page_index_node n, u64 pi)
+{
+    int slot = page_index_slot(n, pi);
+    u64 present = n->present & ~MASK(slot);
+    while (present) {
+        int i = lsb(present);
+        if (!n->shift)
+            return n->slots[i];
+        /* in subtrees past the one containing pi, start from the first page */
+        pagecache_page pp = page_index_find_next(n->slots[i], (i == slot) ? pi : 0);
+        if (pp != INVALID_ADDRESS)
+            return pp;
+        present &= ~U64_FROM_BIT(i);
+    }
+    return INVALID_ADDRESS;
+}
+
+static pagecache_page page_index_next(pagecache_node pn, u64 pi)
+{
+    page_index_node n = pn->pages;
+    if (!n || !page_index_covers(n, pi))
+        return INVALID_ADDRESS;
+    return page_index_find_next(n, pi);
+}
+
+static page_index_node allocate_page_index_node(pagecache pc, int shift)
+{
+    page_index_node n = allocate_zero(pc->h, sizeof(struct page_index_node));
+    if (n != INVALID_ADDRESS)
+        n->shift = shift;
+    return n;
+}
+
+static boolean page_index_insert(pagecache_node pn, u64 pi, pagecache_page pp)
+{
+    pagecache pc = pn->pv->pc;
+    page_index_node n = pn->pages;
+    if (!n) {
+        n = allocate_page_index_node(pc, 0);
+        if (n == INVALID_ADDRESS)
+            return false;
+    }
+    while (!page_index_covers(n, pi)) {
+        page_index_node root = allocate_page_index_node(pc, n->shift + PAGE_INDEX_ORDER);
+        if (root == INVALID_ADDRESS) {
+            /* discard the levels not yet published */
+            while (n != pn->pages) {
+                page_index_node child = n->shift ? n->slots[0] : 0;
+                deallocate(pc->h, n, sizeof(*n));
+                n = child;
+            }
+            return false;
+        }
+        root->slots[0] = n;
+        root->present = 1;
+        n = root;
+    }
+    if (n != pn->pages) {
+        write_barrier();
+        pn->pages = n;
+    }
+    while (n->shift) {
+        int slot = page_index_slot(n, pi);
+        page_index_node child = n->slots[slot];
+        if (!child) {
+            /* left in place, if the page cannot be inserted */
+            child = allocate_page_index_node(pc, n->shift - PAGE_INDEX_ORDER);
+            if (child == INVALID_ADDRESS)
+                return false;
+            write_barrier();
+            n->slots[slot] = child;
+            n->present |= U64_FROM_BIT(slot);
+        }
+        n = child;
+    }
+    int slot = page_index_slot(n, pi);
+    assert(!n->slots[slot]);
+    write_barrier();
+    n->slots[slot] = pp;
+    n->present |= U64_FROM_BIT(slot);
+    return true;
+}
+
+/* Called with the node and state locks held. */
+static void page_index_remove(pagecache_node pn, u64 pi)
+{
+    pagecache pc = pn->pv->pc;
+    page_index_node path[PAGE_INDEX_LEVELS];
+    int level = 0;
+    page_index_node n = pn->pages;
+    assert(n && page_index_covers(n, pi));
+    while (true) {
+        path[level++] = n;
+        if (!n->shift)
+            break;
+        n = n->slots[page_index_slot(n, pi)];
+        assert(n);
+    }
+
+    /* clear the page slot, then free the nodes left empty */
+    while (level-- > 0) {
+        n = path[level];
+        int slot = page_index_slot(n, pi);
+        n->slots[slot] = 0;
+        n->present &= ~U64_FROM_BIT(slot);
+        if (n->present)
+            break;
+        if (level == 0)
+            pn->pages = 0;
+        deallocate(pc->h, n, sizeof(*n));
+    }
+}
+
+static void page_index_destroy(pagecache pc, page_index_node n, void (*release)(pagecache, pagecache_page))
+{
+    u64 present = n->present;
+    while (present) {
+        int i = lsb(present);
+        if (n->shift)
+            page_index_destroy(pc, n->slots[i], release);
+        else
+            release(pc, n->slots[i]);
+        present &= ~U64_FROM_BIT(i);
+    }
+    deallocate(pc->h, n, sizeof(*n));
+}
+
 #ifdef KERNEL
 static inline void pagecache_lock(pagecache pc)
 {
@@ -189,9 +346,14 @@ static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int
         } else if (old_state == PAGECACHE_PAGESTATE_WRITING) {
             pagelist_move(&pc->new, &pc->writing, pp);
             refcount_release(&pp->node->refcount);
+        } else if (pp->refault && (pc->policy == PAGECACHE_POLICY_2Q)) {
+            /* ghost hit: admit directly to the active list */
+            pagelist_enqueue(&pc->active, pp);
+            state = PAGECACHE_PAGESTATE_ACTIVE;
         } else {
             pagelist_enqueue(&pc->new, pp);
         }
+        pp->refault = false;
         break;
     case PAGECACHE_PAGESTATE_ACTIVE:
         assert(old_state == PAGECACHE_PAGESTATE_NEW);
@@ -211,6 +373,17 @@ static inline void change_page_state_locked(pagecache pc, pagecache_page pp, int
     default:
         halt("%s: bad state %d, old %d\n", func_ss, state, old_state);
     }
+    if ((state == PAGECACHE_PAGESTATE_DIRTY) != (old_state == PAGECACHE_PAGESTATE_DIRTY)) {
+        s64 delta = (state == PAGECACHE_PAGESTATE_DIRTY) ? 1 : -1;
+        pagecache_node pn = pp->node;
+        if (pn->pv->resident) {
+            pn->resident_pages += delta;
+            pn->pv->resident_pages += delta;
+        } else {
+            pc->dirty_pages += delta;
+            pn->pv->dirty_pages += delta;
+        }
+    }
 
     pp->state_offset = (pp->state_offset & MASK(PAGECACHE_PAGESTATE_SHIFT)) |
         ((u64)state << PAGECACHE_PAGESTATE_SHIFT);
@@ -258,6 +431,8 @@ static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
     fetch_and_add(&pc->total_pages, 1);
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ALLOC);
     pp->evicted = false;
+    pp->refault = true;
+    pc->refaults++;
     return true;
 }
 
@@ -273,6 +448,27 @@ static sg_buf pagecache_add_sgb(pagecache_page pp, sg_list sg, u64 size)
     return sgb;
 }
 
+static inline boolean page_is_filled(pagecache_page pp)
+{
+    return page_state(pp) >= PAGECACHE_PAGESTATE_NEW;
+}
+
+/* Updates the LRU lists on a cache hit. */
+static void pagecache_lru_touch_locked(pagecache pc, pagecache_page pp)
+{
+    switch (page_state(pp)) {
+    case PAGECACHE_PAGESTATE_ACTIVE:
+        /* move to bottom of active list */
+        pagelist_touch(&pc->active, pp);
+        break;
+    case PAGECACHE_PAGESTATE_NEW:
+        /* cache hit -> active (2Q keeps new pages in FIFO order) */
+        if (pc->policy == PAGECACHE_POLICY_LRU)
+            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        break;
+    }
+}
+
 /* Returns true if the page is already cached (or is being fetched from disk), false if a disk read
  * needs to be requested to fetch the page (or re-allocation of a freed page failed). */
 static boolean touch_page_locked(pagecache_node pn, pagecache_page pp, merge m)
@@ -290,21 +486,159 @@ static boolean touch_page_locked(pagecache_node pn, pagecache_page pp, merge m)
             return false;
         /* no break */
     case PAGECACHE_PAGESTATE_ALLOC:
+        pc->misses++;
         change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_READING);
         return false;
-    case PAGECACHE_PAGESTATE_ACTIVE:
-        /* move to bottom of active list */
-        list_delete(&pp->l);
-        list_insert_before(&pc->active.l, &pp->l);
-        break;
-    case PAGECACHE_PAGESTATE_NEW:
-        /* cache hit -> active */
-        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
-        break;
+    default:
+        pagecache_lru_touch_locked(pc, pp);
     }
+    pc->hits++;
     return true;
 }
 
+static void pagecache_page_release_locked(pagecache pc, pagecache_page pp, boolean full_delete);
+
+#ifdef KERNEL
+/* Takes a reference to a page that may be concurrently released (i.e. without the state lock held);
+ * fails if the page has already been released. */
+static boolean page_ref_if_live(pagecache_page pp)
+{
+    u32 refcount;
+    do {
+        refcount = pp->refcount;
+        if (refcount == 0)
+            return false;
+    } while (!compare_and_swap_32(&pp->refcount, refcount, refcount + 1));
+    return true;
+}
+
+boolean pagecache_percpu_init(int cpu_count)
+{
+    pagecache pc = global_pagecache;
+    pagecache_lru_batch batches = allocate_zero(pc->h, cpu_count * sizeof(batches[0]));
+    if (batches == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++)
+        spin_lock_init(&batches[cpu].lock);
+    pc->lru_batch_count = cpu_count;
+    write_barrier();
+    pc->lru_batches = batches;
+    return true;
+}
+
+static void pagecache_lru_apply(pagecache pc, pagecache_page *pages, int count, u64 hits)
+{
+    pagecache_lock_state(pc);
+    pc->hits += hits;
+    for (int i = 0; i < count; i++) {
+        pagecache_page pp = pages[i];
+        if (!pp->evicted)
+            pagecache_lru_touch_locked(pc, pp);
+        pagecache_page_release_locked(pc, pp, pc->policy == PAGECACHE_POLICY_LRU);
+    }
+    pagecache_unlock_state(pc);
+}
+
+/* The batch contents are applied after releasing the batch lock, which is taken with a node lock
+ * held and thus must not be held while acquiring the state lock. */
+static int pagecache_lru_batch_take_locked(pagecache_lru_batch b, pagecache_page *pages, u64 *hits)
+{
+    int count = b->count;
+    runtime_memcpy(pages, b->pages, count * sizeof(pages[0]));
+    *hits = b->hits;
+    b->count = 0;
+    b->hits = 0;
+    return count;
+}
+
+/* Applies the batched hits of all CPUs, so that the LRU lists are up to date and the batched pages
+ * are no longer referenced. */
+static void pagecache_lru_drain(pagecache pc)
+{
+    pagecache_lru_batch batches = pc->lru_batches;
+    if (!batches)
+        return;
+    pagecache_page pages[PAGECACHE_LRU_BATCH];
+    for (int cpu = 0; cpu < pc->lru_batch_count; cpu++) {
+        pagecache_lru_batch b = &batches[cpu];
+        u64 hits;
+        spin_lock(&b->lock);
+        int count = pagecache_lru_batch_take_locked(b, pages, &hits);
+        spin_unlock(&b->lock);
+        if (count || hits)
+            pagecache_lru_apply(pc, pages, count, hits);
+    }
+}
+
+/* Cache hit with the node lock held (which excludes removal of the page from the index): if the page
+ * is filled, takes a page reference and records the hit in the per-CPU LRU batch. Returns false if
+ * the page is not filled or per-CPU batches are not available, in which case the state lock is
+ * needed. */
+static boolean pagecache_hit_nodelocked(pagecache pc, pagecache_page pp)
+{
+    pagecache_lru_batch batches = pc->lru_batches;
+    if (!batches || !page_is_filled(pp) || !page_ref_if_live(pp))
+        return false;
+    if (!page_is_filled(pp)) {
+        /* released and re-allocated in the meantime */
+        pagecache_lock_state(pc);
+        pagecache_page_release_locked(pc, pp, false);
+        pagecache_unlock_state(pc);
+        return false;
+    }
+    page_ref(pp);   /* held by the batch */
+    pagecache_lru_batch b = &batches[current_cpu()->id];
+    spin_lock(&b->lock);
+    b->pages[b->count++] = pp;
+    b->hits++;
+    if (b->count < PAGECACHE_LRU_BATCH) {
+        spin_unlock(&b->lock);
+        return true;
+    }
+    pagecache_page pages[PAGECACHE_LRU_BATCH];
+    u64 hits;
+    int count = pagecache_lru_batch_take_locked(b, pages, &hits);
+    spin_unlock(&b->lock);
+    pagecache_lru_apply(pc, pages, count, hits);
+    return true;
+}
+
+/* Takes a reference to a page if it is filled, recording the hit; the state lock is only taken if the
+ * hit cannot be recorded in the per-CPU LRU batch. */
+static boolean pagecache_ref_filled_nodelocked(pagecache_node pn, pagecache_page pp)
+{
+    pagecache pc = pn->pv->pc;
+    if (pagecache_hit_nodelocked(pc, pp))
+        return true;
+    pagecache_lock_state(pc);
+    boolean filled = page_is_filled(pp);
+    if (filled) {
+        touch_page_locked(pn, pp, 0);
+        page_ref(pp);
+    }
+    pagecache_unlock_state(pc);
+    return filled;
+}
+
+/* Drops a page reference, taking the state lock only if this may be the last reference. */
+static void pagecache_page_unref(pagecache pc, pagecache_page pp)
+{
+    u32 refcount;
+    do {
+        refcount = pp->refcount;
+        if (refcount <= 1) {
+            pagecache_lock_state(pc);
+            pagecache_page_release_locked(pc, pp, false);
+            pagecache_unlock_state(pc);
+            return;
+        }
+    } while (!compare_and_swap_32(&pp->refcount, refcount, refcount - 1));
+}
+#else
+#define pagecache_hit_nodelocked(pc, pp)    false
+static void pagecache_lru_drain(pagecache pc) {}
+#endif
+
 #ifndef PAGECACHE_READ_ONLY
 
 closure_function(3, 1, void, pagecache_read_page_complete,
@@ -337,14 +671,17 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     pagecache pc = pv->pc;
     range r;
 
+    if (pagecache_hit_nodelocked(pc, pp))
+        return true;
     pagecache_lock_state(pc);
     pagecache_debug("%s: pn %p, pp %p, m %p, state %d\n", func_ss, pn, pp, m, page_state(pp));
     switch (page_state(pp)) {
     case PAGECACHE_PAGESTATE_READING:
         if (m) {
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
-            pp->refcount++;
+            page_ref(pp);
         }
+        pc->hits++;
         pagecache_unlock_state(pc);
         return false;
     case PAGECACHE_PAGESTATE_FREE:
@@ -356,6 +693,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
         }
         /* fall through */
     case PAGECACHE_PAGESTATE_ALLOC:
+        pc->misses++;
         if (m) {
             r = range_intersection(byte_range_from_page(pc, pp),
                                    irangel(0, pad(pn->length, U64_FROM_BIT(pv->block_order))));
@@ -366,7 +704,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
                 zero(pp->kvirt, cache_pagesize(pc));
                 change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
             }
-            pp->refcount++;
+            page_ref(pp);
         }
         pagecache_unlock_state(pc);
 
@@ -387,13 +725,8 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
         }
         return false;
     case PAGECACHE_PAGESTATE_ACTIVE:
-        /* move to bottom of active list */
-        list_delete(&pp->l);
-        list_insert_before(&pc->active.l, &pp->l);
-        break;
     case PAGECACHE_PAGESTATE_NEW:
-        /* cache hit -> active */
-        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+        pagecache_lru_touch_locked(pc, pp);
         break;
     case PAGECACHE_PAGESTATE_WRITING:
     case PAGECACHE_PAGESTATE_DIRTY:
@@ -401,7 +734,8 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     default:
         halt("%s: invalid state %d\n", func_ss, page_state(pp));
     }
-    pp->refcount++;
+    pc->hits++;
+    page_ref(pp);
     pagecache_unlock_state(pc);
     return true;
 }
@@ -417,7 +751,7 @@ static void pagecache_page_delete_locked(pagecache pc, pagecache_page pp)
     if (!pagecache_trylock_node(pn))
         return;
 
-    rbtree_remove_node(&pn->pages, &pp->rbnode);
+    page_index_remove(pn, page_offset(pp));
     pagecache_unlock_node(pn);
     pagelist_remove(&pc->free, pp);
     deallocate(pc->pp_heap, pp, sizeof(*pp));
@@ -425,7 +759,7 @@ static void pagecache_page_delete_locked(pagecache pc, pagecache_page pp)
 
 static void pagecache_page_release_locked(pagecache pc, pagecache_page pp, boolean full_delete)
 {
-    if (--pp->refcount > 0)
+    if (fetch_and_add_32(&pp->refcount, -1) > 1)
         return;
     pagecache_debug("%s: pp %p state %d\n", func_ss, pp, page_state(pp));
     assert(pp->write_count == 0);
@@ -464,7 +798,6 @@ static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
     if (pp == INVALID_ADDRESS)
         goto fail_dealloc_contiguous;
 
-    init_rbnode(&pp->rbnode);
     pp->refcount = 1;
     init_refcount(&pp->read_refcount, 0,
                   init_closure_func(&pp->read_release, thunk, pagecache_page_read_release));
@@ -475,20 +808,25 @@ static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
     pp->node = pn;
     pp->l.next = pp->l.prev = 0;
     pp->evicted = false;
+    pp->refault = false;
 #ifdef KERNEL
     pp->phys = physical_from_virtual(p);
 #endif
     list_init(&pp->bh_completions);
-    assert(rbtree_insert_node(&pn->pages, &pp->rbnode));
+    if (!page_index_insert(pn, offset, pp))
+        goto fail_dealloc_page;
     fetch_and_add(&pc->total_pages, 1); /* decrement happens without cache lock */
     return pp;
+  fail_dealloc_page:
+    deallocate(pc->pp_heap, pp, sizeof(*pp));
   fail_dealloc_contiguous:
     deallocate(pc->contiguous, p, pagesize);
     return INVALID_ADDRESS;
 }
 
 #ifndef PAGECACHE_READ_ONLY
-static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
+static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages,
+                                  boolean full_delete)
 {
     u64 evicted = 0;
     list_foreach(&pl->l, l) {
@@ -505,7 +843,7 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
         pp->evicted = true;
         if (pp->refcount == 1)
             evicted++;
-        pagecache_page_release_locked(pc, pp, true);
+        pagecache_page_release_locked(pc, pp, full_delete);
     }
     return evicted;
 }
@@ -534,9 +872,7 @@ static void balance_page_lists_locked(pagecache pc)
 
 static pagecache_page page_lookup_nodelocked(pagecache_node pn, u64 n)
 {
-    struct pagecache_page k;
-    k.state_offset = n;
-    return (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
+    return page_index_lookup(pn, n);
 }
 
 static pagecache_page page_lookup_or_alloc_nodelocked(pagecache_node pn, u64 n)
@@ -571,28 +907,9 @@ static boolean pagecache_set_dirty(pagecache_node pn, range r)
     return true;
 }
 
-static void pagecache_nodelocked_traverse(pagecache_node pn, range pages,
-                                          pp_handler handler)
-{
-    if (range_span(pages) == 0)
-        return;
-    pagecache_page pp = page_lookup_nodelocked(pn, pages.start);
-    pagecache_lock_state(global_pagecache);
-    while (true) {
-        apply(handler, pp);
-        if (++pages.start == pages.end)
-            break;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
-    }
-    pagecache_unlock_state(global_pagecache);
-}
-
-static void pagecache_node_traverse(pagecache_node pn, range pages, pp_handler handler)
-{
-    pagecache_lock_node(pn);
-    pagecache_nodelocked_traverse(pn, pages, handler);
-    pagecache_unlock_node(pn);
-}
+#ifdef KERNEL
+static boolean pagecache_balance_dirty(pagecache_volume pv, status_handler completion);
+#endif
 
 closure_function(6, 1, void, pagecache_write_sg_finish,
                  pagecache_node, pn, range, q, u64, pi, sg_list, sg, status_handler, completion, context, saved_ctx,
@@ -668,9 +985,9 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
         pagecache_unlock_state(pc);
         offset = 0;
         bound(pi)++;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_index_next(pn, page_offset(pp) + 1);
     } while (bound(pi) < end);
-    if ((bound(pi) == end) && !pagecache_set_dirty(pn, r))
+    if ((bound(pi) == end) && !pn->pv->resident && !pagecache_set_dirty(pn, r))
         s = timm("result", "failed to add dirty range");
     pagecache_unlock_node(pn);
 #ifdef KERNEL
@@ -682,7 +999,8 @@ closure_function(6, 1, void, pagecache_write_sg_finish,
   exit:
     closure_finish();
 #ifdef KERNEL
-    async_apply_status_handler(completion, s);
+    if (!is_ok(s) || pn->pv->resident || !pagecache_balance_dirty(pn->pv, completion))
+        async_apply_status_handler(completion, s);
 #else
     apply(completion, s);
 #endif
@@ -797,7 +1115,7 @@ closure_function(1, 3, void, pagecache_write_sg,
             err_msg = ss("failed to re-allocate pagecache page");
             break;
         }
-        pp->refcount++;
+        page_ref(pp);
         if (page_state(pp) == PAGECACHE_PAGESTATE_READING)
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
         pagecache_unlock_state(pc);
@@ -837,15 +1155,45 @@ closure_function(1, 3, void, pagecache_write_sg,
     apply(sh, sstring_is_null(err_msg) ? STATUS_OK : timm_sstring(ss("result"), err_msg));
 }
 
+/* limit the number of evicted pages retained in the index, oldest first */
+static void trim_ghost_pages_locked(pagecache pc)
+{
+    u64 limit = pc->total_pages * PAGECACHE_2Q_GHOST_QUARTERS / 4;
+    list_foreach(&pc->free.l, l) {
+        if (pc->free.pages <= limit)
+            break;
+        pagecache_page_delete_locked(pc, struct_from_list(l, pagecache_page, l));
+    }
+}
+
+/* Evict new pages in excess of their share of the cache (keeping them as ghost entries), then
+ * active pages, then the remaining new pages. */
+static u64 evict_pages_2q_locked(pagecache pc, u64 pages)
+{
+    u64 new_target = (pc->new.pages + pc->active.pages) * PAGECACHE_2Q_NEW_QUARTERS / 4;
+    u64 evicted = 0;
+    if (pc->new.pages > new_target)
+        evicted = evict_from_list_locked(pc, &pc->new, MIN(pages, pc->new.pages - new_target),
+                                         false);
+    if (evicted < pages)
+        evicted += evict_from_list_locked(pc, &pc->active, pages - evicted, true);
+    if (evicted < pages)
+        evicted += evict_from_list_locked(pc, &pc->new, pages - evicted, false);
+    trim_ghost_pages_locked(pc);
+    return evicted;
+}
+
 /* evict pages from new and active lists, then rebalance */
 static u64 evict_pages_locked(pagecache pc, u64 pages)
 {
-    u64 evicted = evict_from_list_locked(pc, &pc->new, pages);
+    if (pc->policy == PAGECACHE_POLICY_2Q)
+        return evict_pages_2q_locked(pc, pages);
+    u64 evicted = evict_from_list_locked(pc, &pc->new, pages, true);
     if (evicted < pages) {
         /* To fill the requested pages evictions, we are more
            aggressive here, evicting even in-use pages (rc > 1) in the
            active list. */
-        evicted += evict_from_list_locked(pc, &pc->active, pages - evicted);
+        evicted += evict_from_list_locked(pc, &pc->active, pages - evicted, true);
     }
     return evicted;
 }
@@ -862,9 +1210,11 @@ u64 pagecache_drain(u64 drain_bytes)
     pagecache pc = global_pagecache;
     u64 pages = pad(drain_bytes, cache_pagesize(pc)) >> pc->page_order;
 
+    pagecache_lru_drain(pc);
     pagecache_lock_state(pc);
     u64 drained = evict_pages_locked(pc, pages) * cache_pagesize(pc);
-    balance_page_lists_locked(pc);
+    if (pc->policy == PAGECACHE_POLICY_LRU)
+        balance_page_lists_locked(pc);
     if (drained < drain_bytes)
         pagecache_delete_pages_locked(pc);
     pagecache_unlock_state(pc);
@@ -937,7 +1287,7 @@ closure_function(5, 1, void, pagecache_commit_complete,
         if (is_ok(s) || (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY))
             pagecache_page_release_locked(pc, pp, false);
 
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_index_next(pn, page_offset(pp) + 1);
     } while (--page_count > 0);
     pagecache_unlock_state(pc);
     if (!is_ok(s))
@@ -1041,8 +1391,8 @@ define_closure_function(3, 1, void, pagecache_commit_dirty_ranges,
         sg_buf sgb = 0;
 
         do {
-            u64 page_offset = start & MASK(pc->page_order);
-            u64 len = pad(MIN(cache_pagesize(pc) - page_offset, r.end - start),
+            u64 offset = start & MASK(pc->page_order);
+            u64 len = pad(MIN(cache_pagesize(pc) - offset, r.end - start),
                           U64_FROM_BIT(pv->block_order));
             if (sgb && (sgb->buf + sgb->size == pp->kvirt)) {
                 sgb->size += len;
@@ -1056,7 +1406,7 @@ define_closure_function(3, 1, void, pagecache_commit_dirty_ranges,
                     r.end = start;
                     break;
                 }
-                sgb->buf = pp->kvirt + page_offset;
+                sgb->buf = pp->kvirt + offset;
                 sgb->offset = 0;
                 sgb->size = len;
                 sgb->refcount = 0;
@@ -1066,13 +1416,13 @@ define_closure_function(3, 1, void, pagecache_commit_dirty_ranges,
             /* Reserve the page, unless it is in DIRTY state (in which case it has been reserved
              * when switching to DIRTY state). */
             if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY)
-                pp->refcount++;
+                page_ref(pp);
             change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_WRITING);
             pp->write_count++;
             pagecache_unlock_state(pc);
             page_count++;
             start += len;
-            pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+            pp = page_index_next(pn, page_offset(pp) + 1);
             if (committing >= PAGECACHE_MAX_SG_ENTRIES && start < r.end) {
                 r.end = start;
                 break;
@@ -1145,31 +1495,35 @@ static void pagecache_commit_dirty_node(pagecache_node pn, status_handler comple
         apply(complete, timm_oom);
 }
 
+static void pagecache_commit_volume(pagecache_volume pv)
+{
+    pagecache_node pn = 0;
+    do {
+        pagecache_lock_volume(pv);
+        list l = list_get_next(&pv->dirty_nodes);
+        pagecache_unlock_volume(pv);
+        if (l) {
+            pn = struct_from_list(l, pagecache_node, l);
+            pagecache_commit_dirty_node(pn, 0);
+        } else {
+            pn = 0;
+        }
+    } while (pn);
+}
+
 static void pagecache_commit_dirty_pages(pagecache pc)
 {
     pagecache_debug("%s\n", func_ss);
 
     pagecache_lock(pc);
-    list_foreach(&pc->volumes, l) {
-        pagecache_volume pv = struct_from_list(l, pagecache_volume, l);
-        pagecache_node pn = 0;
-        do {
-            pagecache_lock_volume(pv);
-            list l = list_get_next(&pv->dirty_nodes);
-            pagecache_unlock_volume(pv);
-            if (l) {
-                pn = struct_from_list(l, pagecache_node, l);
-                pagecache_commit_dirty_node(pn, 0);
-            } else {
-                pn = 0;
-            }
-        } while (pn);
-    }
+    list_foreach(&pc->volumes, l)
+        pagecache_commit_volume(struct_from_list(l, pagecache_volume, l));
     pagecache_unlock(pc);
 }
 
 static void pagecache_scan(pagecache pc)
 {
+    pagecache_lru_drain(pc);
     pagecache_scan_shared_mappings(pc);
     pagecache_commit_dirty_pages(pc);
 }
@@ -1212,14 +1566,27 @@ closure_function(1, 1, boolean, purge_range_handler,
             refcount_release(&pn->refcount);
         }
         node_offset += page_size;
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_index_next(pn, page_offset(pp) + 1);
     } while (node_offset < n->r.end);
     rangemap_remove_range(&pn->dirty, n);
     return true;
 }
 
-/* Wait for completion of in-progress writes to disk, discard any other dirty ranges, then call
- * status handler. */
+static void purge_resident_pages_locked(pagecache_node pn)
+{
+    pagecache pc = pn->pv->pc;
+    for (pagecache_page pp = page_index_next(pn, 0); pp != INVALID_ADDRESS;
+         pp = page_index_next(pn, page_offset(pp) + 1)) {
+        if (page_state(pp) == PAGECACHE_PAGESTATE_DIRTY) {
+            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ALLOC);
+            pagecache_page_release_locked(pc, pp, false);
+            refcount_release(&pn->refcount);
+        }
+    }
+}
+
+/* Wait for completion of in-progress writes to disk, discard any other dirty ranges (and, in
+ * resident volumes, the node contents), then call status handler. */
 void pagecache_purge_node(pagecache_node pn, status_handler complete)
 {
     pagecache_debug("%s: pn %p, complete %F\n", func_ss, pn, complete);
@@ -1227,6 +1594,8 @@ void pagecache_purge_node(pagecache_node pn, status_handler complete)
     pagecache pc = pn->pv->pc;
     pagecache_lock_state(pc);
     destruct_rangemap(&pn->dirty, stack_closure(purge_range_handler, pn));
+    if (pn->pv->resident)
+        purge_resident_pages_locked(pn);
     pagecache_unlock_state(pc);
     pagecache_lock_volume(pn->pv);
     if (list_inserted(&pn->l))
@@ -1252,28 +1621,31 @@ void pagecache_purge_node(pagecache_node pn, status_handler complete)
         apply(complete, s);
 }
 
-closure_func_basic(pp_handler, boolean, pagecache_pin_handler,
-                   pagecache_page pp)
+/* Drops the cached pages of a node range that are clean and not in use, so that subsequent accesses
+ * to the range fetch the contents from the backing storage (used when the filesystem changes the
+ * file contents without going through the cache). */
+void pagecache_node_invalidate(pagecache_node pn, range q /* bytes */)
 {
-    pp->refcount++;
-    return true;
-}
-
-void pagecache_nodelocked_pin(pagecache_node pn, range pages)
-{
-    pagecache_nodelocked_traverse(pn, pages, stack_closure_func(pp_handler, pagecache_pin_handler));
-}
-
-closure_func_basic(pp_handler, boolean, pagecache_unpin_handler,
-                   pagecache_page pp)
-{
-    pagecache_page_release_locked(global_pagecache, pp, false);
-    return true;
-}
-
-void pagecache_node_unpin(pagecache_node pn, range pages)
-{
-    pagecache_node_traverse(pn, pages, stack_closure_func(pp_handler, pagecache_unpin_handler));
+    pagecache_debug("%s: pn %p, q %R\n", func_ss, pn, q);
+    if (pn->pv->resident)
+        return;
+    pagecache pc = pn->pv->pc;
+    range pages = range_rshift_pad(q, pc->page_order);
+    pagecache_lru_drain(pc);    /* release batched page references */
+    pagecache_lock_node(pn);
+    pagecache_lock_state(pc);
+    for (pagecache_page pp = page_index_next(pn, pages.start);
+         (pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end);
+         pp = page_index_next(pn, page_offset(pp) + 1)) {
+        int state = page_state(pp);
+        if (!pp->evicted && (pp->refcount == 1) &&
+            ((state == PAGECACHE_PAGESTATE_NEW) || (state == PAGECACHE_PAGESTATE_ACTIVE))) {
+            pp->evicted = true;
+            pagecache_page_release_locked(pc, pp, false);
+        }
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
 }
 
 #endif /* !PAGECACHE_READ_ONLY */
@@ -1293,7 +1665,7 @@ closure_function(5, 1, void, pagecache_node_fetch_complete,
             is_ok(s) ? PAGECACHE_PAGESTATE_NEW : PAGECACHE_PAGESTATE_ALLOC);
         pagecache_page_queue_completions_locked(pc, pp, s);
         pagecache_page_release_locked(pc, pp, false);
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_index_next(pp->node, page_offset(pp) + 1);
     }
     pagecache_unlock_state(pc);
     sg_list_release(sg);
@@ -1311,25 +1683,75 @@ static void pagecache_node_fetch_sg(pagecache pc, pagecache_node pn, range r, sg
     dma_sg_read(pn->fs_read, sg, r, fetch_complete);
 }
 
+declare_closure_function(3, 1, boolean, pagecache_read_pp_handler,
+                         pagecache, pc, range, q, sg_list, sg,
+                         pagecache_page pp);
+
+/* Page handlers are applied via apply_func(), which calls the handler of pagecache reads (the
+ * common case) directly. */
+#define pagecache_apply_ph(ph, pp)  apply_func(ph, pagecache_read_pp_handler, pp)
+
+#ifdef KERNEL
+/* Lookup of pages that are all present and filled, with the node lock held (which excludes removal of
+ * pages from the index): the hits are recorded in the per-CPU LRU batches, so that concurrent cached
+ * reads of different nodes do not serialize on the state lock. */
+static boolean pagecache_fetch_filled(pagecache_node pn, u64 start, u64 end, pp_handler ph,
+                                      status_handler sh)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_lock_node(pn);
+    u64 pi;
+    for (pi = start; pi < end; pi++) {
+        pagecache_page pp = page_index_lookup(pn, pi);
+        if ((pp == INVALID_ADDRESS) || !pagecache_ref_filled_nodelocked(pn, pp))
+            break;
+    }
+    if (pi < end) {
+        while (pi-- > start)
+            pagecache_page_unref(pc, page_index_lookup(pn, pi));
+        pagecache_unlock_node(pn);
+        return false;
+    }
+    status s = STATUS_OK;
+    boolean handled = true;
+    for (pi = start; pi < end; pi++) {
+        pagecache_page pp = page_index_lookup(pn, pi);
+        if (handled && !pagecache_apply_ph(ph, pp)) {
+            if (pi == start)
+                s = timm("result", "page fetch handler error");
+            handled = false;
+        }
+        pagecache_page_unref(pc, pp);
+    }
+    pagecache_unlock_node(pn);
+    apply(sh, s);
+    return true;
+}
+#endif
+
 static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler ph,
                                           status_handler completion)
 {
     pagecache pc = pn->pv->pc;
-    merge m = allocate_merge(pc->h, completion);
-    status_handler sh = apply_merge(m);
-    struct pagecache_page k;
     if (q.end > pn->length)
         q.end = pn->length;
     u64 read_limit = pad(pn->length, U64_FROM_BIT(pn->pv->block_order));
-    k.state_offset = q.start >> pc->page_order;
+    u64 first = q.start >> pc->page_order;
     u64 end = (q.end + MASK(pc->page_order)) >> pc->page_order;
-    end = MIN(end, k.state_offset + PAGECACHE_MAX_SG_ENTRIES);
+    end = MIN(end, first + PAGECACHE_MAX_SG_ENTRIES);
+#ifdef KERNEL
+    /* cached data is handed over synchronously, without a merge */
+    if (ph && pagecache_fetch_filled(pn, first, end, ph, completion))
+        return;
+#endif
+    merge m = allocate_merge(pc->h, completion);
+    status_handler sh = apply_merge(m);
 #ifdef KERNEL
     boolean mem_cleaned = false;
   begin:
 #endif
     pagecache_lock_node(pn);
-    pagecache_page pp = (pagecache_page)rbtree_lookup(&pn->pages, &k.rbnode);
+    pagecache_page pp = page_index_lookup(pn, first);
     sg_list read_sg = 0;
     range read_r;
     sg_buf sgb = 0;
@@ -1337,7 +1759,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
     status_handler fetch_complete = 0;
     pagecache_lock_state(pc);
     u64 pi;
-    for (pi = k.state_offset; pi < end; pi++) {
+    for (pi = first; pi < end; pi++) {
         if (pp == INVALID_ADDRESS || page_offset(pp) > pi) {
             pp = allocate_page_nodelocked(pn, pi);
             if (pp == INVALID_ADDRESS) {
@@ -1395,14 +1817,14 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
                     break;
                 }
             }
-            pp->refcount++;
+            page_ref(pp);
             read_r.end += read_size;
         }
-        if (ph && !apply(ph, pp)) {
+        if (ph && !pagecache_apply_ph(ph, pp)) {
             err_msg = ss("page fetch handler error");
             break;
         }
-        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+        pp = page_index_next(pn, page_offset(pp) + 1);
     }
     pagecache_unlock_state(pc);
     pagecache_unlock_node(pn);
@@ -1410,16 +1832,16 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
         pagecache_node_fetch_sg(pc, pn, read_r, read_sg, fetch_complete);
     if (!sstring_is_null(err_msg)) {
 #ifdef KERNEL
-        if (!mem_cleaned || (pi != k.state_offset)) {
+        if (!mem_cleaned || (pi != first)) {
             pagecache_debug("   trying to free memory (r %R, pi 0x%lx)\n",
-                            irange(k.state_offset, end), pi);
+                            irange(first, end), pi);
             mm_service(true);
             mem_cleaned = true;
-            k.state_offset = pi;
+            first = pi;
             goto begin;
         }
 #endif
-        if (k.state_offset == q.start >> pc->page_order) {  /* no pages could be fetched */
+        if (first == q.start >> pc->page_order) {  /* no pages could be fetched */
             apply(sh, timm_sstring(ss("result"), err_msg));
             return;
         }
@@ -1429,9 +1851,9 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
     apply(sh, STATUS_OK);
 }
 
-closure_function(3, 1, boolean, pagecache_read_pp_handler,
-                 pagecache, pc, range, q, sg_list, sg,
-                 pagecache_page pp)
+define_closure_function(3, 1, boolean, pagecache_read_pp_handler,
+                        pagecache, pc, range, q, sg_list, sg,
+                        pagecache_page pp)
 {
     range r = byte_range_from_page(bound(pc), pp);
     range i = range_intersection(bound(q), r);
@@ -1444,7 +1866,7 @@ closure_function(3, 1, boolean, pagecache_read_pp_handler,
     sgb->offset = 0;
     sgb->refcount = &pp->read_refcount;
     if (fetch_and_add(&pp->read_refcount.c, 1) == 0)
-        pp->refcount++;
+        page_ref(pp);
     return true;
 }
 
@@ -1462,41 +1884,44 @@ closure_function(1, 3, void, pagecache_read_sg,
 
 
 #ifdef KERNEL
-closure_function(3, 3, boolean, pagecache_check_dirty_page,
-                 pagecache, pc, pagecache_shared_map, sm, flush_entry, fe,
+/* Pages of shared mappings are mapped read-only, and are made writable on the first write
+ * access, which marks the page dirty and records its address in the shared map. Scanning a shared
+ * map write-protects again the recorded pages, so that further writes are detected after the
+ * pages are written back; the cost of a scan is thus proportional to the number of pages written
+ * since the previous scan, not to the size of the mapping. */
+closure_function(2, 3, boolean, pagecache_write_protect_page,
+                 pagecache_page, pp, flush_entry, fe,
                  int level, u64 vaddr, pteptr entry)
 {
-    pagecache pc = bound(pc);
-    pagecache_shared_map sm = bound(sm);
     pte old_entry = pte_from_pteptr(entry);
-    if (pte_is_present(old_entry) &&
-        pte_is_mapping(level, old_entry) &&
-        pte_is_dirty(old_entry)) {
-        range r = irangel(sm->node_offset + (vaddr - sm->n.r.start), cache_pagesize(pc));
-        u64 pi = r.start >> pc->page_order;
-        pagecache_debug("   dirty: vaddr 0x%lx, pi 0x%lx\n", vaddr, pi);
+    /* the page may have been unmapped (and the address reused) since it was recorded */
+    if (pte_is_present(old_entry) && pte_is_mapping(level, old_entry) &&
+        (page_from_pte(old_entry) == bound(pp)->phys)) {
+        pagecache_debug("   write protect: vaddr 0x%lx\n", vaddr);
+        pageflags flags = pageflags_readonly(pageflags_from_pte(old_entry));
+        pte_set(entry, (old_entry & ~PAGE_PROT_FLAGS) | (flags.w & PAGE_PROT_FLAGS));
         pt_pte_clean(entry);
         page_invalidate(bound(fe), vaddr);
-        pagecache_node pn = sm->pn;
-        pagecache_lock_node(pn);
-        pagecache_page pp = page_lookup_nodelocked(pn, pi);
-        assert(pp != INVALID_ADDRESS);
-        pagecache_lock_state(pc);
-        if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
-            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
-            pp->refcount++;
-        }
-        pagecache_unlock_state(pc);
-        pagecache_set_dirty(pn, r);
-        pagecache_unlock_node(pn);
     }
     return true;
 }
 
 static void pagecache_scan_shared_map(pagecache pc, pagecache_shared_map sm, flush_entry fe)
 {
-    traverse_ptes(sm->n.r.start, range_span(sm->n.r),
-                  stack_closure(pagecache_check_dirty_page, pc, sm, fe));
+    pagecache_node pn = sm->pn;
+    pagecache_lock_node(pn);
+    void *va;
+    vector_foreach(sm->writable, va) {
+        u64 vaddr = u64_from_pointer(va);
+        u64 pi = (sm->node_offset + (vaddr - sm->n.r.start)) >> pc->page_order;
+        pagecache_page pp = page_lookup_nodelocked(pn, pi);
+        if (pp == INVALID_ADDRESS)
+            continue;
+        traverse_ptes(vaddr, cache_pagesize(pc),
+                      stack_closure(pagecache_write_protect_page, pp, fe));
+    }
+    vector_clear(sm->writable);
+    pagecache_unlock_node(pn);
 }
 
 static void pagecache_scan_shared_mappings(pagecache pc)
@@ -1541,6 +1966,86 @@ closure_func_basic(status_handler, void, pagecache_writeback_complete,
     pc->writeback_in_progress = false;
 }
 
+/* Background writeback of a volume, started when the amount of dirty pages exceeds the background
+ * threshold: all the dirty nodes of the volume are committed, which results in large writes of
+ * contiguous dirty ranges. */
+closure_func_basic(thunk, void, pagecache_volume_writeback)
+{
+    pagecache_volume pv = struct_from_closure(pagecache_volume, writeback);
+    pagecache_commit_volume(pv);
+    pagecache_finish_pending_writes(pv->pc, pv, 0, (status_handler)&pv->writeback_complete);
+}
+
+closure_func_basic(status_handler, void, pagecache_volume_writeback_complete,
+                   status s)
+{
+    pagecache_volume pv = struct_from_field(closure_self(), pagecache_volume, writeback_complete);
+    pv->writeback_active = false;
+}
+
+typedef struct pagecache_throttle {
+    struct timer t;
+    pagecache_volume pv;
+    status_handler completion;
+    int rounds;
+    closure_struct(timer_handler, expired);
+} *pagecache_throttle;
+
+static timestamp pagecache_dirty_pause(pagecache pc, u64 dirty)
+{
+    u64 freerun = (pc->dirty_background + pc->dirty_limit) / 2;
+    if (dirty <= freerun)
+        return 0;
+    u64 pause_max = milliseconds(PAGECACHE_DIRTY_PAUSE_MAX_MS);
+    if (dirty >= pc->dirty_limit)
+        return pause_max;
+    return pause_max * (dirty - freerun) / (pc->dirty_limit - freerun);
+}
+
+closure_func_basic(timer_handler, void, pagecache_throttle_expired,
+                   u64 expiry, u64 overruns)
+{
+    pagecache_throttle t = struct_from_closure(pagecache_throttle, expired);
+    pagecache pc = t->pv->pc;
+
+    /* above the dirty limit, keep the writer paused while writeback is making progress */
+    if ((overruns != timer_disabled) && (pc->dirty_pages >= pc->dirty_limit) &&
+        t->pv->writeback_active && (++t->rounds < PAGECACHE_DIRTY_PAUSE_ROUNDS)) {
+        register_timer(kernel_timers, &t->t, CLOCK_ID_MONOTONIC,
+                       milliseconds(PAGECACHE_DIRTY_PAUSE_MAX_MS), false, 0,
+                       (timer_handler)&t->expired);
+        return;
+    }
+    async_apply_status_handler(t->completion, STATUS_OK);
+    deallocate(pc->h, t, sizeof(*t));
+}
+
+/* Called on completion of a write to the cache; returns true if the completion of the write has
+ * been deferred. */
+static boolean pagecache_balance_dirty(pagecache_volume pv, status_handler completion)
+{
+    pagecache pc = pv->pc;
+    u64 dirty = pc->dirty_pages;
+    if (!pc->dirty_limit || (dirty <= pc->dirty_background))
+        return false;
+    if (pv->dirty_pages && compare_and_swap_boolean(&pv->writeback_active, false, true))
+        async_apply((thunk)&pv->writeback);
+    timestamp pause = pagecache_dirty_pause(pc, dirty);
+    if (!pause)
+        return false;
+    pagecache_throttle t = allocate(pc->h, sizeof(*t));
+    if (t == INVALID_ADDRESS)
+        return false;
+    t->pv = pv;
+    t->completion = completion;
+    t->rounds = 0;
+    init_timer(&t->t);
+    fetch_and_add(&pc->throttled, 1);
+    register_timer(kernel_timers, &t->t, CLOCK_ID_MONOTONIC, pause, false, 0,
+                   init_closure_func(&t->expired, timer_handler, pagecache_throttle_expired));
+    return true;
+}
+
 void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 node_offset)
 {
     pagecache pc = pn->pv->pc;
@@ -1549,6 +2054,8 @@ void pagecache_node_add_shared_map(pagecache_node pn, range q /* bytes */, u64 n
     sm->n.r = q;
     sm->pn = pn;
     sm->node_offset = node_offset;
+    sm->writable = allocate_vector(pc->h, 8);
+    assert(sm->writable != INVALID_ADDRESS);
     pagecache_debug("%s: pn %p, q %R, node_offset 0x%lx\n", func_ss, pn, q, node_offset);
     pagecache_lock_state(pc);
     list_insert_before(&pc->shared_maps, &sm->l);
@@ -1576,6 +2083,7 @@ closure_function(3, 1, boolean, close_shared_pages_intersection,
     if (!head && !tail) {
         rangemap_remove_node(pn->shared_maps, n);
         list_delete(&sm->l);
+        deallocate_vector(sm->writable);
         deallocate(pc->h, sm, sizeof(struct pagecache_shared_map));
     } else if (head) {
         /* truncate map at start */
@@ -1605,8 +2113,6 @@ closure_function(2, 1, boolean, scan_shared_pages_intersection,
                  pagecache, pc, flush_entry, fe,
                  rmnode n)
 {
-    /* currently just scanning the whole map - it could be just a range,
-       but with scan and sync timers imminent, does it really matter? */
     pagecache_shared_map sm = (pagecache_shared_map)n;
     pagecache_debug("   map %p\n", sm);
     pagecache_scan_shared_map(bound(pc), sm, bound(fe));
@@ -1623,6 +2129,40 @@ void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* b
     page_invalidate_sync(fe, 0);
 }
 
+/* Write access to a page of a shared mapping: the page is marked dirty and made writable. Pages of
+ * resident volumes are never written back, so they are left writable until unmapped. */
+boolean pagecache_node_shared_write_fault(pagecache_node pn, u64 vaddr, pageflags flags)
+{
+    pagecache_debug("%s: node %p, vaddr 0x%lx, flags 0x%lx\n", func_ss, pn, vaddr, flags.w);
+    pagecache pc = pn->pv->pc;
+    u64 pagesize = cache_pagesize(pc);
+    pagecache_lock_node(pn);
+    pagecache_lock_state(pc);
+    pagecache_shared_map sm = (pagecache_shared_map)rangemap_lookup(pn->shared_maps, vaddr);
+    if (sm == INVALID_ADDRESS) {
+        pagecache_unlock_state(pc);
+        pagecache_unlock_node(pn);
+        return false;
+    }
+    range r = irangel(sm->node_offset + (vaddr - sm->n.r.start), pagesize);
+    pagecache_page pp = page_lookup_nodelocked(pn, r.start >> pc->page_order);
+    assert(pp != INVALID_ADDRESS);
+    if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
+        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
+        page_ref(pp);
+    }
+    pagecache_unlock_state(pc);
+    boolean resident = pn->pv->resident;
+    boolean success = resident || pagecache_set_dirty(pn, r);
+    if (success) {
+        if (!resident)
+            vector_push(sm->writable, pointer_from_u64(vaddr));
+        update_map_flags(vaddr, pagesize, flags);
+    }
+    pagecache_unlock_node(pn);
+    return success;
+}
+
 boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags)
 {
     pagecache_debug("%s: node %p, node_offset 0x%lx, vaddr 0x%lx, flags 0x%lx\n",
@@ -1649,17 +2189,115 @@ boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr
     return true;
 }
 
+/* Direct I/O transfers data between storage and the buffers of sg, which must be physically
+ * contiguous and sized in multiples of the volume block size, without going through the cache.
+ * Filled, clean pages overlapping q are coherent with storage: reads ignore them, while writes
+ * evict them (keeping them as ghost entries) so that later cached reads fetch the new data. If any
+ * other page overlaps q (dirty, being read or written back, or, for writes, in use e.g. by a
+ * mapping), no I/O is issued and false is returned: the caller then uses the cached path. */
+boolean pagecache_node_direct_io(pagecache_node pn, sg_list sg, range q, boolean write,
+                                 status_handler complete)
+{
+    pagecache pc = pn->pv->pc;
+    sg_io op = write ? pn->fs_write : pn->fs_read;
+    if (!op)
+        return false;
+    range pages = range_rshift_pad(q, pc->page_order);
+    boolean conflict = false;
+    if (write)
+        pagecache_lru_drain(pc);    /* release batched page references */
+    pagecache_lock_node(pn);
+    pagecache_lock_state(pc);
+    for (int pass = 0; pass < (write ? 2 : 1); pass++) {
+        for (pagecache_page pp = page_index_next(pn, pages.start);
+             (pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end);
+             pp = page_index_next(pn, page_offset(pp) + 1)) {
+            int state = page_state(pp);
+            if ((state == PAGECACHE_PAGESTATE_FREE) || (state == PAGECACHE_PAGESTATE_EVICTED))
+                continue;
+            if ((state != PAGECACHE_PAGESTATE_NEW) && (state != PAGECACHE_PAGESTATE_ACTIVE)) {
+                conflict = true;
+                break;
+            }
+            if (!write)
+                continue;
+            if (pass == 0) {
+                if ((pp->refcount > 1) || pp->evicted) {
+                    conflict = true;
+                    break;
+                }
+            } else {
+                pp->evicted = true;
+                pagecache_page_release_locked(pc, pp, false);
+            }
+        }
+        if (conflict)
+            break;
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+    pagecache_debug("%s: node %p, q %R, %s, conflict %d\n", func_ss, pn, q,
+                    write ? ss("write") : ss("read"), conflict);
+    if (conflict)
+        return false;
+    dma_sg_io(op, sg, q, write, complete);
+    return true;
+}
+
 void pagecache_node_fetch_pages(pagecache_node pn, range r)
 {
     pagecache_debug("%s: node %p, r %R\n", func_ss, pn, r);
     pagecache_node_fetch_internal(pn, r, 0, ignore_status);
 }
 
+/* Reads the non-resident pages of a node range (of at most PAGECACHE_MAX_SG_ENTRIES pages) without
+ * handing over their data, with a single request per run of non-resident pages. */
+void pagecache_node_prefetch(pagecache_node pn, range r, status_handler complete)
+{
+    pagecache_debug("%s: node %p, r %R\n", func_ss, pn, r);
+    pagecache_node_fetch_internal(pn, r, 0, complete);
+}
+
+/* Calls rh (with the node locked) for each run of pages of the node holding file data. */
+void pagecache_node_resident_ranges(pagecache_node pn, range_handler rh)
+{
+    pagecache pc = pn->pv->pc;
+    range run = irange(0, 0);
+    pagecache_lock_node(pn);
+    pagecache_lock_state(pc);
+    for (pagecache_page pp = page_index_next(pn, 0); pp != INVALID_ADDRESS;
+         pp = page_index_next(pn, page_offset(pp) + 1)) {
+        int state = page_state(pp);
+        if ((state < PAGECACHE_PAGESTATE_NEW) || pp->evicted)
+            continue;
+        u64 pi = page_offset(pp);
+        if (range_span(run) && (run.end == pi)) {
+            run.end++;
+            continue;
+        }
+        if (range_span(run) && !apply(rh, range_lshift(run, pc->page_order)))
+            goto out;
+        run = irange(pi, pi + 1);
+    }
+    if (range_span(run))
+        apply(rh, range_lshift(run, pc->page_order));
+  out:
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+}
+
 static void map_page(pagecache pc, pagecache_page pp, u64 vaddr, pageflags flags, status_handler complete)
 {
     assert(pp->refcount != 0);
     assert(pp->kvirt != INVALID_ADDRESS);
-    map_with_complete(vaddr, pp->phys, cache_pagesize(pc), flags, complete);
+    if (!map_if_unmapped(vaddr, pp->phys, cache_pagesize(pc), flags)) {
+        /* already mapped, e.g. by a fault-around from a neighboring page */
+        pagecache_lock_state(pc);
+        pagecache_page_release_locked(pc, pp, false);
+        pagecache_unlock_state(pc);
+    }
+    if (complete)
+        apply(complete, STATUS_OK);
 }
 
 closure_function(5, 1, void, map_page_finish,
@@ -1701,20 +2339,58 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
 boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
                                      status_handler complete)
 {
-    boolean mapped = false;
-    pagecache_lock_node(pn);
-    pagecache_page pp = page_lookup_nodelocked(pn, node_offset >> pn->pv->pc->page_order);
+    pagecache pc = pn->pv->pc;
+    pagecache_lock_node(pn);    /* excludes removal of pages from the index */
+    pagecache_page pp = page_index_lookup(pn, node_offset >> pc->page_order);
     pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, flags 0x%lx, pp %p\n",
                     func_ss, pn, node_offset, vaddr, flags.w, pp);
-    if (pp == INVALID_ADDRESS)
-        goto out;
-    if (touch_or_fill_page_nodelocked(pn, pp, 0)) {
-        mapped = true;
-        map_page(pn->pv->pc, pp, vaddr, flags, complete);
+    if (pp == INVALID_ADDRESS) {
+        pagecache_unlock_node(pn);
+        return false;
+    }
+    if (!pagecache_ref_filled_nodelocked(pn, pp)) {
+        pagecache_unlock_node(pn);
+        return false;
     }
-  out:
     pagecache_unlock_node(pn);
-    return mapped;
+    map_page(pc, pp, vaddr, flags, complete);
+    return true;
+}
+
+/* Fault-around: maps the pages of a node range that are already filled, without waiting for any
+ * I/O, at consecutive virtual addresses within a single page table. */
+void pagecache_map_filled_pages(pagecache_node pn, u64 node_offset, u64 vaddr, int count,
+                                pageflags flags)
+{
+    pagecache pc = pn->pv->pc;
+    pagecache_debug("%s: pn %p, node_offset 0x%lx, vaddr 0x%lx, count %d, flags 0x%lx\n",
+                    func_ss, pn, node_offset, vaddr, count, flags.w);
+    assert(cache_pagesize(pc) == PAGESIZE);
+    assert(count <= PAGECACHE_MAP_BATCH_MAX);
+    pagecache_page pages[PAGECACHE_MAP_BATCH_MAX];
+    u64 phys[PAGECACHE_MAP_BATCH_MAX];
+    boolean found = false;
+    u64 pi = node_offset >> pc->page_order;
+    pagecache_lock_node(pn);    /* excludes removal of pages from the index */
+    for (int i = 0; i < count; i++) {
+        pagecache_page pp = page_index_lookup(pn, pi + i);
+        if ((pp != INVALID_ADDRESS) && pagecache_ref_filled_nodelocked(pn, pp)) {
+            pages[i] = pp;
+            phys[i] = pp->phys;
+            found = true;
+        } else {
+            pages[i] = 0;
+            phys[i] = INVALID_PHYSICAL;
+        }
+    }
+    pagecache_unlock_node(pn);
+    if (!found)
+        return;
+    u64 mapped = map_pages_if_unmapped(vaddr, phys, count, flags);
+    for (int i = 0; i < count; i++) {
+        if (pages[i] && !(mapped & U64_FROM_BIT(i)))
+            pagecache_page_unref(pc, pages[i]);
+    }
 }
 
 closure_function(4, 3, boolean, pagecache_unmap_page_nodelocked,
@@ -1759,38 +2435,42 @@ void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node
 }
 #endif
 
-closure_func_basic(rbnode_handler, boolean, pagecache_page_print_key,
-                   rbnode n)
+void pagecache_set_node_length(pagecache_node pn, u64 length)
 {
-    pagecache pc = struct_from_closure(pagecache, page_print_key);
-    rprintf(" 0x%lx", page_offset((pagecache_page)n) << cache_pagesize(pc));
-    return true;
+    pn->length = length;
 }
 
-closure_func_basic(rb_key_compare, int, pagecache_page_compare,
-                   rbnode a, rbnode b)
+u64 pagecache_get_node_length(pagecache_node pn)
 {
-    u64 oa = page_offset((pagecache_page)a);
-    u64 ob = page_offset((pagecache_page)b);
-    return oa == ob ? 0 : (oa < ob ? -1 : 1);
+    return pn->length;
 }
 
-void pagecache_set_node_length(pagecache_node pn, u64 length)
+u64 pagecache_get_node_resident(pagecache_node pn)
 {
-    pn->length = length;
+    return pn->resident_pages << pn->pv->pc->page_order;
 }
 
-u64 pagecache_get_node_length(pagecache_node pn)
+/* Returns the amount of memory that would be made resident by writing to a node range. */
+u64 pagecache_node_get_nonresident(pagecache_node pn, range q /* bytes */)
 {
-    return pn->length;
+    pagecache pc = pn->pv->pc;
+    range pages = range_rshift_pad(q, pc->page_order);
+    u64 count = range_span(pages);
+    pagecache_lock_node(pn);
+    pagecache_lock_state(pc);
+    for (pagecache_page pp = page_index_next(pn, pages.start);
+         (pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end);
+         pp = page_index_next(pn, page_offset(pp) + 1)) {
+        if (page_state(pp) == PAGECACHE_PAGESTATE_DIRTY)
+            count--;
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+    return count << pc->page_order;
 }
 
-closure_function(1, 1, boolean, pagecache_page_release,
-                 pagecache, pc,
-                 rbnode n)
+static void pagecache_page_release(pagecache pc, pagecache_page pp)
 {
-    pagecache pc = bound(pc);
-    pagecache_page pp = struct_from_list(n, pagecache_page, rbnode);
     pagecache_lock_state(pc);
     if (!pp->evicted)
         pagecache_page_release_locked(pc, pp, false);
@@ -1799,7 +2479,6 @@ closure_function(1, 1, boolean, pagecache_page_release,
     pagelist_remove(&pc->free, pp);
     pagecache_unlock_state(pc);
     deallocate(pc->pp_heap, pp, sizeof(*pp));
-    return true;
 }
 
 closure_func_basic(rmnode_handler, boolean, pagecache_node_assert,
@@ -1824,7 +2503,10 @@ closure_func_basic(thunk, void, pagecache_node_free)
     deallocate_closure(pn->cache_write);
 #endif
     pagecache pc = pn->pv->pc;
-    destruct_rbtree(&pn->pages, stack_closure(pagecache_page_release, pc));
+    if (pn->pages) {
+        pagecache_lru_drain(pc);    /* release batched page references */
+        page_index_destroy(pc, pn->pages, pagecache_page_release);
+    }
     deallocate_rangemap(pn->shared_maps, stack_closure_func(rmnode_handler, pagecache_node_assert));
     deallocate(pc->h, pn, sizeof(*pn));
 }
@@ -1873,9 +2555,9 @@ pagecache_node pagecache_allocate_node(pagecache_volume pv, sg_io fs_read, sg_io
 #endif
     list_init_member(&pn->l);
     init_rangemap(&pn->dirty, h);
-    init_rbtree(&pn->pages, (rb_key_compare)&pv->pc->page_compare,
-                (rbnode_handler)&pv->pc->page_print_key);
+    pn->pages = 0;
     pn->length = 0;
+    pn->resident_pages = 0;
     pn->cache_read = closure(h, pagecache_read_sg, pn);
 #ifndef PAGECACHE_READ_ONLY
     pn->cache_write = closure(h, pagecache_write_sg, pn);
@@ -1907,6 +2589,93 @@ u64 pagecache_get_occupancy(void)
     return global_pagecache->total_pages << pagecache_get_page_order();
 }
 
+#ifdef KERNEL
+static u64 pagecache_dirty_threshold(tuple root, symbol s, u64 ratio, u64 total)
+{
+    if (get_u64(root, s, &ratio) && (ratio > 100)) {
+        msg_err("invalid %v value; using default\n", s);
+        ratio = 0;
+    }
+    return total * ratio / 100;
+}
+
+void init_pagecache_config(tuple root)
+{
+    pagecache pc = global_pagecache;
+    u64 total = heap_total((heap)heap_physical(get_kernel_heaps())) >> pc->page_order;
+    u64 background = pagecache_dirty_threshold(root, sym(pagecache_dirty_background_ratio),
+                                               PAGECACHE_DIRTY_BACKGROUND_RATIO, total);
+    u64 limit = pagecache_dirty_threshold(root, sym(pagecache_dirty_ratio),
+                                          PAGECACHE_DIRTY_RATIO, total);
+    if (background && limit) {
+        pc->dirty_background = MIN(background, limit);
+        pc->dirty_limit = limit;
+    }
+    value policy = get_string(root, sym(pagecache_policy));
+    if (!policy || !buffer_strcmp(policy, "lru"))
+        return;
+    if (!buffer_strcmp(policy, "2q")) {
+        pagecache_lock_state(pc);
+        pc->policy = PAGECACHE_POLICY_2Q;
+        pagecache_unlock_state(pc);
+    } else {
+        msg_err("invalid pagecache_policy value \"%b\"; using lru\n", policy);
+    }
+}
+
+closure_function(2, 0, value, pagecache_get_hits,
+                 pagecache, pc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(pc)->hits);
+}
+
+closure_function(2, 0, value, pagecache_get_misses,
+                 pagecache, pc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(pc)->misses);
+}
+
+closure_function(2, 0, value, pagecache_get_refaults,
+                 pagecache, pc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(pc)->refaults);
+}
+
+closure_function(2, 0, value, pagecache_get_dirty_pages,
+                 pagecache, pc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(pc)->dirty_pages);
+}
+
+closure_function(2, 0, value, pagecache_get_throttled,
+                 pagecache, pc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(pc)->throttled);
+}
+
+#define register_stat(pc, n, t, name)                                   \
+    v = value_from_u64(0);                                              \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(n, s, closure(pc->h, pagecache_get_ ##name, pc, v));
+
+value pagecache_management(void)
+{
+    pagecache pc = global_pagecache;
+    value v;
+    symbol s;
+    tuple t = timm("policy", "%s", (pc->policy == PAGECACHE_POLICY_2Q) ? ss("2q") : ss("lru"));
+    tuple_notifier n = tuple_notifier_wrap(t, false);
+    assert(n != INVALID_ADDRESS);
+    register_stat(pc, n, t, hits);
+    register_stat(pc, n, t, misses);
+    register_stat(pc, n, t, refaults);
+    register_stat(pc, n, t, dirty_pages);
+    register_stat(pc, n, t, throttled);
+    return n;
+}
+#endif
+
 pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
 {
     pagecache pc = global_pagecache;
@@ -1918,8 +2687,15 @@ pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
     list_insert_before(&pc->volumes, &pv->l);
     pagecache_unlock(pc);
     list_init(&pv->dirty_nodes);
+    pv->dirty_pages = 0;
+    pv->resident = false;
+    pv->resident_pages = 0;
 #ifdef KERNEL
     spin_lock_init(&pv->lock);
+    pv->writeback_active = false;
+    init_closure_func(&pv->writeback, thunk, pagecache_volume_writeback);
+    init_closure_func(&pv->writeback_complete, status_handler,
+                      pagecache_volume_writeback_complete);
     if (!timer_is_active(&pc->scan_timer)) {
         timestamp t = seconds(PAGECACHE_SCAN_PERIOD_SECONDS);
         register_timer(kernel_timers, &pc->scan_timer, CLOCK_ID_MONOTONIC, t, false, t,
@@ -1931,6 +2707,19 @@ pagecache_volume pagecache_allocate_volume(u64 length, int block_order)
     return pv;
 }
 
+/* In a resident volume, written pages stay in the cache until their node is purged: they are neither
+ * accounted as dirty nor written back (thus the volume is not subject to dirty page throttling), and
+ * they are not evicted. */
+void pagecache_set_volume_resident(pagecache_volume pv)
+{
+    pv->resident = true;
+}
+
+u64 pagecache_get_volume_resident(pagecache_volume pv)
+{
+    return pv->resident_pages << pv->pc->page_order;
+}
+
 void pagecache_dealloc_volume(pagecache_volume pv)
 {
     pagecache_lock(pv->pc);
@@ -1978,12 +2767,19 @@ void init_pagecache(heap general, heap contiguous, u64 pagesize)
     page_list_init(&pc->writing);
     list_init(&pc->volumes);
     list_init(&pc->shared_maps);
-    init_closure_func(&pc->page_compare, rb_key_compare, pagecache_page_compare);
-    init_closure_func(&pc->page_print_key, rbnode_handler, pagecache_page_print_key);
+    pc->lru_batches = 0;    /* set by pagecache_percpu_init() */
+    pc->lru_batch_count = 0;
+    pc->policy = PAGECACHE_POLICY_LRU;
+    pc->hits = pc->misses = pc->refaults = 0;
+    pc->dirty_pages = pc->throttled = 0;
+    pc->dirty_background = pc->dirty_limit = 0;   /* set by init_pagecache_config() */
 
 #ifdef KERNEL
     pc->writeback_in_progress = false;
     init_timer(&pc->scan_timer);
+
+    /* the scan is not time-critical: let it be coalesced with other timers */
+    timer_set_slack(&pc->scan_timer, seconds(PAGECACHE_SCAN_PERIOD_SECONDS) / 2);
     init_closure_func(&pc->do_scan_timer, timer_handler, pagecache_scan_timer);
     init_closure_func(&pc->writeback_complete, status_handler, pagecache_writeback_complete);
 #endif
@@ -8,13 +8,15 @@ void pagecache_set_node_length(pagecache_node pn, u64 length);
 
 u64 pagecache_get_node_length(pagecache_node pn);
 
+u64 pagecache_get_node_resident(pagecache_node pn);
+
+u64 pagecache_node_get_nonresident(pagecache_node pn, range q /* bytes */);
+
 void pagecache_node_finish_pending_writes(pagecache_node pn, status_handler complete);
 
 void pagecache_sync_node(pagecache_node pn, status_handler complete);
 void pagecache_purge_node(pagecache_node pn, status_handler complete);
-
-void pagecache_nodelocked_pin(pagecache_node pn, range pages);
-void pagecache_node_unpin(pagecache_node pn, range pages);
+void pagecache_node_invalidate(pagecache_node pn, range q /* bytes */);
 
 void pagecache_sync_volume(pagecache_volume pv, status_handler complete);
 
@@ -41,22 +43,42 @@ void pagecache_node_close_shared_pages(pagecache_node pn, range q /* bytes */, f
 
 void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* bytes */);
 
+boolean pagecache_node_shared_write_fault(pagecache_node pn, u64 vaddr, pageflags flags);
+
 boolean pagecache_node_do_page_cow(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags);
 
 void pagecache_node_fetch_pages(pagecache_node pn, range r /* bytes */);
 
+void pagecache_node_prefetch(pagecache_node pn, range r /* bytes */, status_handler complete);
+
+void pagecache_node_resident_ranges(pagecache_node pn, range_handler rh);
+
+boolean pagecache_node_direct_io(pagecache_node pn, sg_list sg, range q /* bytes */, boolean write,
+                                 status_handler complete);
+
 void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
                         status_handler complete);
 
 boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
                                      status_handler complete);
 
+#define PAGECACHE_MAP_BATCH_MAX 32
+void pagecache_map_filled_pages(pagecache_node pn, u64 node_offset, u64 vaddr, int count,
+                                pageflags flags);
+
 void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
+
+void init_pagecache_config(tuple root);
+void init_pagecache_warm(tuple root);
+value pagecache_management(void);
 #endif
 
 
 
 pagecache_volume pagecache_allocate_volume(u64 length, int block_order);
+void pagecache_set_volume_resident(pagecache_volume pv);
+u64 pagecache_get_volume_resident(pagecache_volume pv);
 void pagecache_dealloc_volume(pagecache_volume pv);
 
 void init_pagecache(heap general, heap contiguous, u64 pagesize);
+boolean pagecache_percpu_init(int cpu_count);
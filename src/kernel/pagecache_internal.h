@@ -33,15 +33,40 @@ typedef struct pagecache {
     struct pagelist writing;
     struct list volumes;
     struct list shared_maps;
+    struct pagecache_lru_batch *lru_batches;    /* per-CPU */
+    int lru_batch_count;
+
+    int policy;                 /* page replacement policy */
+    u64 hits;                   /* lookups of cached pages */
+    u64 misses;                 /* lookups requiring a page fill */
+    u64 refaults;               /* misses on pages evicted while retained in the index */
+
+    /* Dirty page throttling: above dirty_background pages, writeback of the volume being written to
+     * is started right away; above the midpoint between dirty_background and dirty_limit, writers
+     * are paused for a time proportional to the excess of dirty pages. */
+    u64 dirty_pages;
+    u64 dirty_background;
+    u64 dirty_limit;
+    u64 throttled;              /* writes paused */
 
     boolean writeback_in_progress;
     struct timer scan_timer;
     closure_struct(timer_handler, do_scan_timer);
     closure_struct(status_handler, writeback_complete);
-    closure_struct(rb_key_compare, page_compare);
-    closure_struct(rbnode_handler, page_print_key);
 } *pagecache;
 
+/* Replacement policies: with LRU, pages are promoted to the active list on their second access and
+ * the active and new lists are balanced against each other. With 2Q, the new list is a FIFO whose
+ * hits are ignored; evicted new pages are retained in the index (as FREE pages) as ghost entries, and
+ * only a refault of a ghost page promotes it to the active list, so a single scan cannot displace the
+ * active working set. */
+#define PAGECACHE_POLICY_LRU    0
+#define PAGECACHE_POLICY_2Q     1
+
+/* 2Q list sizes, as fractions (in units of 1/4) of the resident pages */
+#define PAGECACHE_2Q_NEW_QUARTERS   1
+#define PAGECACHE_2Q_GHOST_QUARTERS 2
+
 typedef struct pagecache_volume {
     struct list l;              /* volumes list */
     pagecache pc;
@@ -49,22 +74,43 @@ typedef struct pagecache_volume {
     struct list dirty_nodes;    /* head of pagecache_nodes */
     u64 length;                 /* end of volume */
     int block_order;
+    u64 dirty_pages;
+    boolean resident;           /* no backing storage: written pages stay in the cache */
+    u64 resident_pages;
+#ifdef KERNEL
+    boolean writeback_active;
+    closure_struct(thunk, writeback);
+    closure_struct(status_handler, writeback_complete);
+#endif
 } *pagecache_volume;
 
+/* Radix tree of pages indexed by page offset, with PAGE_INDEX_ORDER bits of the offset resolved at
+ * each level; leaf nodes (shift 0) point to pages, other nodes to their children. */
+#define PAGE_INDEX_ORDER    6
+#define PAGE_INDEX_LEVELS   ((64 + PAGE_INDEX_ORDER - 1) / PAGE_INDEX_ORDER)
+
+typedef struct page_index_node {
+    void *slots[U64_FROM_BIT(PAGE_INDEX_ORDER)];
+    u64 present;                /* bitmap of non-empty slots */
+    int shift;                  /* offset bits below this level */
+} *page_index_node;
+
 typedef struct pagecache_node {
     struct list l;              /* volume-wide node list */
     pagecache_volume pv;
 
-    /* pages_lock covers traversal, insertions and removals - consider
-       changing to a rw lock or semaphore */
+    /* pages_lock covers traversal, insertions and removals; since removals are also done with the
+       cache state lock held, lookups can alternatively be done with just the state lock; cache hits
+       on filled pages are handled with just pages_lock held */
 #ifdef KERNEL
     struct spinlock pages_lock;
 #endif
-    struct rbtree pages;
+    page_index_node pages;
     rangemap shared_maps;       /* shared mappings associated with this node */
     struct rangemap dirty;
     struct list ops;
     u64 length;
+    u64 resident_pages;
 
     sg_io cache_read;
     sg_io cache_write;
@@ -102,6 +148,7 @@ typedef struct pagecache_shared_map {
     struct list l;              /* pc->shared_maps */
     pagecache_node pn;
     u64 node_offset;            /* file offset of va.start */
+    vector writable;            /* addresses of pages made writable since the last scan */
 } *pagecache_shared_map;
 
 #define PAGECACHE_PAGESTATE_SHIFT   61
@@ -118,19 +165,34 @@ typedef struct pagecache_shared_map {
 typedef struct pagecache_page *pagecache_page;
 
 struct pagecache_page {
-    struct rbnode rbnode;
-    struct refcount read_refcount;  /* 24 */
-    u64 state_offset;           /* 40 - state and offset in pages */
-    void *kvirt;                /* 48 */
-    int write_count;            /* 56 */
-    int refcount;               /* 60 */
+    struct refcount read_refcount;  /* 0 */
+    u64 state_offset;           /* 16 - state and offset in pages */
+    void *kvirt;                /* 24 */
+    int write_count;            /* 32 */
+    u32 refcount;               /* 36 - atomic; incremented without the state lock on cache hits */
+    pagecache_node node;        /* 40 */
+    struct list l;              /* 48 */
     /* end of first cacheline */
 
-    pagecache_node node;
-    struct list l;
     u64 phys;                   /* physical address */
     struct list bh_completions; /* default for non-kernel use */
 
     closure_struct(thunk, read_release);
     boolean evicted;
+    boolean refault;            /* re-allocated after eviction */
 };
+
+/* Cache hits on filled pages are recorded in a per-CPU batch, with just the node lock held; the
+ * corresponding LRU list updates are applied with the state lock held when the batch fills up (or
+ * before the lists are scanned for eviction), so that a cache hit does not take the state lock.
+ * Each batched page holds a reference, so that it cannot be released before the batch is applied. */
+#define PAGECACHE_LRU_BATCH 15
+
+typedef struct pagecache_lru_batch {
+#ifdef KERNEL
+    struct spinlock lock;
+#endif
+    int count;
+    u64 hits;
+    pagecache_page pages[PAGECACHE_LRU_BATCH];
+} *pagecache_lru_batch;
@@ -0,0 +1,457 @@
+#include <kernel.h>
+#include <pagecache.h>
+#include <storage.h>
+#include <tfs.h>
+
+/* Page cache warm restart: the file ranges held in the page cache are recorded in a residency map,
+ * stored in a file of the root filesystem when the kernel shuts down (and optionally at regular
+ * intervals); at the next boot, the ranges listed in the map are read back in the background, in
+ * requests of up to PAGECACHE_MAX_SG_ENTRIES pages submitted with the idle I/O priority class, so
+ * that demand reads are not delayed by the prefetcher.
+ * Map format (all numbers are varints): magic, version, then for each file the path length, the
+ * path, the number of ranges and, for each range, its start (relative to the end of the preceding
+ * range) and its length, in pages. Only regular files of a TFS root filesystem whose contents
+ * have been accessed since it was mounted are recorded. */
+
+//#define PCWARM_DEBUG
+#ifdef PCWARM_DEBUG
+#define pcwarm_debug(x, ...) do {tprintf(sym(pcwarm), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define pcwarm_debug(x, ...)
+#endif
+
+#define PCWARM_MAGIC            0x6d726177  /* "warm" */
+#define PCWARM_VERSION          1
+#define PCWARM_DEFAULT_FILE     "/.pagecache_residency"
+#define PCWARM_DEFAULT_MAX_DIV  4           /* default prefetch limit: 1/4 of physical memory */
+#define PCWARM_INFLIGHT_MAX     4
+
+static struct {
+    heap h;
+    filesystem fs;
+    fsfile map;                 /* residency map file; 0 if the map is not saved */
+    int page_order;
+    timestamp interval;
+    struct timer timer;
+    closure_struct(timer_handler, timer_func);
+    closure_struct(thunk, save);
+    closure_struct(io_status_handler, save_written);
+    closure_struct(status_handler, save_complete);
+    u32 saving;
+    status_handler save_sh;     /* invoked when the save in progress completes */
+    buffer save_buf;
+
+    /* boot-time prefetch */
+    buffer load_buf;
+    closure_struct(io_status_handler, load_complete);
+    closure_struct(thunk, prefetch);
+    closure_struct(status_handler, prefetch_complete);
+    struct spinlock lock;
+    fsfile cur;                 /* file being prefetched */
+    u64 ranges_left;
+    range cur_r;                /* bytes of cur not yet prefetched */
+    u64 prev_end;               /* end page of the preceding range */
+    u64 budget;                 /* bytes that may still be prefetched */
+    u32 inflight;
+    boolean prefetch_active;    /* prefetch thunk queued or running */
+    boolean load_done;          /* no more chunks to prefetch */
+    boolean finished;
+} pcwarm;
+
+/* pop_varint() without reading past the end of the buffer */
+static boolean pcwarm_pop_varint(buffer b, u64 *v)
+{
+    u64 out = 0;
+    u8 m;
+    int n = 0;
+    do {
+        if (!buffer_length(b) || (n++ == 10))
+            return false;
+        m = pop_u8(b);
+        out = (out << 7) | (m & MASK(7));
+    } while (m & 0x80);
+    *v = out;
+    return true;
+}
+
+closure_function(2, 2, boolean, pcwarm_collect_file,
+                 vector, files, vector, inodes,
+                 tuple md, fsfile f)
+{
+    if ((f == pcwarm.map) || !fsfile_get_cachenode(f) ||
+        !pagecache_get_node_resident(fsfile_get_cachenode(f)))
+        return true;
+    fsfile_reserve(f);
+    vector_push(bound(files), f);
+    vector_push(bound(inodes), pointer_from_u64(pcwarm.fs->get_inode(pcwarm.fs, md)));
+    return true;
+}
+
+closure_function(3, 1, boolean, pcwarm_encode_range,
+                 buffer, b, u64 *, count, u64 *, prev_end,
+                 range r)
+{
+    range pages = range_rshift(r, pcwarm.page_order);
+    push_varint(bound(b), pages.start - *bound(prev_end));
+    push_varint(bound(b), range_span(pages));
+    *bound(prev_end) = pages.end;
+    (*bound(count))++;
+    return true;
+}
+
+/* Encodes the residency map of the loaded files; returns false if the root filesystem is not a TFS
+ * or memory could not be allocated. */
+static boolean pcwarm_encode(buffer b)
+{
+    filesystem fs = pcwarm.fs;
+    boolean success = false;
+    vector files = allocate_vector(pcwarm.h, 64);
+    if (files == INVALID_ADDRESS)
+        return false;
+    vector inodes = allocate_vector(pcwarm.h, 64);
+    if (inodes == INVALID_ADDRESS)
+        goto out_files;
+    buffer ranges = allocate_buffer(pcwarm.h, 256);
+    if (ranges == INVALID_ADDRESS)
+        goto out_inodes;
+    char *path = allocate(pcwarm.h, PATH_MAX);
+    if (path == INVALID_ADDRESS)
+        goto out_ranges;
+    filesystem_lock(fs);
+    success = tfs_foreach_loaded_file(fs, stack_closure(pcwarm_collect_file, files, inodes));
+    filesystem_unlock(fs);
+    push_varint(b, PCWARM_MAGIC);
+    push_varint(b, PCWARM_VERSION);
+    for (int i = 0; i < vector_length(files); i++) {
+        fsfile f = vector_get(files, i);
+
+        /* files that have been removed in the meantime have no path */
+        int len = success ? file_get_path(fs, u64_from_pointer(vector_get(inodes, i)),
+                                          path, PATH_MAX) : -1;
+        if (len > 1) {
+            len--;  /* terminator */
+            u64 count = 0, prev_end = 0;
+            buffer_clear(ranges);
+            pagecache_node_resident_ranges(fsfile_get_cachenode(f),
+                                           stack_closure(pcwarm_encode_range, ranges, &count,
+                                                         &prev_end));
+            if (count) {
+                push_varint(b, len);
+                buffer_write(b, path, len);
+                push_varint(b, count);
+                push_buffer(b, ranges);
+            }
+        }
+        fsfile_release(f);
+    }
+    deallocate(pcwarm.h, path, PATH_MAX);
+  out_ranges:
+    deallocate_buffer(ranges);
+  out_inodes:
+    deallocate_vector(inodes);
+  out_files:
+    deallocate_vector(files);
+    return success;
+}
+
+static void pcwarm_save_done(status s)
+{
+    if (!is_ok(s)) {
+        msg_err("failed to save pagecache residency map: %v\n", s);
+        timm_dealloc(s);
+    }
+    if (pcwarm.save_buf)
+        deallocate_buffer(pcwarm.save_buf);
+    status_handler sh = pcwarm.save_sh;
+    pcwarm.save_sh = 0;
+    write_barrier();
+    pcwarm.saving = false;
+    if (sh)
+        apply(sh, STATUS_OK);
+}
+
+closure_func_basic(status_handler, void, pcwarm_save_complete,
+                   status s)
+{
+    pcwarm_save_done(s);
+}
+
+closure_func_basic(io_status_handler, void, pcwarm_save_written,
+                   status s, bytes len)
+{
+    if (is_ok(s)) {
+        fs_status fss = filesystem_truncate(pcwarm.fs, pcwarm.map, len);
+        if (fss == FS_STATUS_OK) {
+            fsfile_flush(pcwarm.map, true, (status_handler)&pcwarm.save_complete);
+            return;
+        }
+        s = timm("result", "failed to truncate file: %s", string_from_fs_status(fss));
+    }
+    pcwarm_save_done(s);
+}
+
+closure_func_basic(thunk, void, pcwarm_save)
+{
+    buffer b = allocate_buffer(pcwarm.h, PAGESIZE);
+    if (b == INVALID_ADDRESS) {
+        pcwarm.save_buf = 0;
+        pcwarm_save_done(timm_oom);
+        return;
+    }
+    pcwarm.save_buf = b;
+    if (!pcwarm_encode(b)) {
+        pcwarm_save_done(timm("result", "failed to encode map"));
+        return;
+    }
+    pcwarm_debug("saving map (%ld bytes)\n", buffer_length(b));
+    filesystem_write_linear(pcwarm.map, buffer_ref(b, 0), irangel(0, buffer_length(b)),
+                            (io_status_handler)&pcwarm.save_written);
+}
+
+/* The map is saved from a kernel context, where the filesystem lock can be taken. */
+static boolean pcwarm_start_save(status_handler sh)
+{
+    if (!compare_and_swap_32(&pcwarm.saving, false, true))
+        return false;
+    pcwarm.save_sh = sh;
+    async_apply_bh((thunk)&pcwarm.save);
+    return true;
+}
+
+closure_func_basic(timer_handler, void, pcwarm_timer_func,
+                   u64 expiry, u64 overruns)
+{
+    if ((overruns != timer_disabled) && !shutting_down)
+        pcwarm_start_save(0);
+}
+
+closure_func_basic(shutdown_handler, void, pcwarm_shutdown,
+                   int status, merge m)
+{
+    if (pcwarm.interval)
+        remove_timer(kernel_timers, &pcwarm.timer, 0);
+    status_handler sh = apply_merge(m);
+    if (!pcwarm_start_save(sh))
+        apply(sh, STATUS_OK);   /* a periodic save is in progress */
+    closure_finish();
+}
+
+/* Takes the next chunk to prefetch from the map; returns false when done. Only called from the
+ * prefetch thunk, which does not run concurrently with itself. */
+static boolean pcwarm_next_chunk(fsfile *f, range *r)
+{
+    buffer b = pcwarm.load_buf;
+    while (!range_span(pcwarm.cur_r)) {
+        if (!pcwarm.ranges_left) {
+            if (pcwarm.cur) {
+                fsfile_release(pcwarm.cur);
+                pcwarm.cur = 0;
+            }
+            u64 len;
+            if (!pcwarm.budget || !pcwarm_pop_varint(b, &len) || (len >= PATH_MAX) ||
+                (len > buffer_length(b)))
+                return false;
+            sstring path = isstring(buffer_ref(b, 0), len);
+            filesystem fs = pcwarm.fs;
+            tuple t;
+            fsfile fsf = 0;
+            fs_status fss = filesystem_get_node(&fs, fs->get_inode(fs, filesystem_getroot(fs)),
+                                                path, true, false, false, false, &t, &fsf);
+            if (fss == FS_STATUS_OK)
+                filesystem_put_node(fs, t);
+            if (fsf && !fsfile_get_cachenode(fsf)) {
+                fsfile_release(fsf);
+                fsf = 0;
+            }
+            pcwarm_debug("%s: %s%s\n", func_ss, path, fsf ? sstring_empty() : ss(" (skipped)"));
+            buffer_consume(b, len);
+            if (!pcwarm_pop_varint(b, &pcwarm.ranges_left))
+                return false;
+            pcwarm.cur = fsf;
+            pcwarm.prev_end = 0;
+            continue;
+        }
+        u64 start, len;
+        if (!pcwarm_pop_varint(b, &start) || !pcwarm_pop_varint(b, &len))
+            return false;
+        pcwarm.ranges_left--;
+        start += pcwarm.prev_end;
+        pcwarm.prev_end = start + len;
+        if (!pcwarm.cur)
+            continue;
+        range q = range_intersection(range_lshift(irangel(start, len), pcwarm.page_order),
+                                     irangel(0, fsfile_get_length(pcwarm.cur)));
+        if (range_span(q)) {
+            pcwarm.cur_r = irangel(q.start, MIN(range_span(q), pcwarm.budget));
+            pcwarm.budget -= range_span(pcwarm.cur_r);
+        }
+    }
+    u64 end = ((pcwarm.cur_r.start >> pcwarm.page_order) + PAGECACHE_MAX_SG_ENTRIES) <<
+              pcwarm.page_order;
+    *r = irange(pcwarm.cur_r.start, MIN(end, pcwarm.cur_r.end));
+    pcwarm.cur_r.start = r->end;
+    fsfile_reserve(pcwarm.cur);
+    *f = pcwarm.cur;
+    return true;
+}
+
+static void pcwarm_prefetch_done(void)
+{
+    if (pcwarm.cur) {
+        fsfile_release(pcwarm.cur);
+        pcwarm.cur = 0;
+    }
+    deallocate_buffer(pcwarm.load_buf);
+    pcwarm.load_buf = 0;
+    pcwarm_debug("prefetch complete\n");
+}
+
+closure_func_basic(status_handler, void, pcwarm_prefetch_complete,
+                   status s)
+{
+    if (!is_ok(s))
+        timm_dealloc(s);    /* the data will be read on demand */
+    spin_lock(&pcwarm.lock);
+    pcwarm.inflight--;
+    boolean queue = !pcwarm.prefetch_active;
+    pcwarm.prefetch_active = true;
+    spin_unlock(&pcwarm.lock);
+    if (queue)
+        async_apply_bh((thunk)&pcwarm.prefetch);
+}
+
+closure_func_basic(thunk, void, pcwarm_prefetch)
+{
+    context ctx = get_current_context(current_cpu());
+    spin_lock(&pcwarm.lock);
+    while (!pcwarm.load_done && !shutting_down && (pcwarm.inflight < PCWARM_INFLIGHT_MAX)) {
+        pcwarm.inflight++;
+        spin_unlock(&pcwarm.lock);
+        fsfile f;
+        range r;
+        boolean more = pcwarm_next_chunk(&f, &r);
+        if (more) {
+            /* the storage scheduler takes the priority class from the submitting context */
+            u16 ioprio = ctx->ioprio;
+            ctx->ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+            pagecache_node_prefetch(fsfile_get_cachenode(f), r,
+                                    (status_handler)&pcwarm.prefetch_complete);
+            ctx->ioprio = ioprio;
+            fsfile_release(f);
+        }
+        spin_lock(&pcwarm.lock);
+        if (!more) {
+            pcwarm.inflight--;
+            pcwarm.load_done = true;
+        }
+    }
+    pcwarm.prefetch_active = false;
+    boolean done = (pcwarm.load_done || shutting_down) && !pcwarm.inflight && !pcwarm.finished;
+    if (done)
+        pcwarm.finished = true;
+    spin_unlock(&pcwarm.lock);
+    if (done)
+        pcwarm_prefetch_done();
+}
+
+closure_func_basic(io_status_handler, void, pcwarm_load_complete,
+                   status s, bytes len)
+{
+    buffer b = pcwarm.load_buf;
+    u64 magic, version;
+    if (!is_ok(s)) {
+        msg_err("failed to read pagecache residency map: %v\n", s);
+        timm_dealloc(s);
+        goto done;
+    }
+    buffer_produce(b, len);
+    if (!pcwarm_pop_varint(b, &magic) || (magic != PCWARM_MAGIC) ||
+        !pcwarm_pop_varint(b, &version) || (version != PCWARM_VERSION)) {
+        msg_warn("invalid pagecache residency map\n");
+        goto done;
+    }
+    pcwarm_debug("prefetching from map (%ld bytes)\n", len);
+    pcwarm.prefetch_active = true;
+    async_apply_bh((thunk)&pcwarm.prefetch);
+    return;
+  done:
+    pcwarm.finished = true;
+    pcwarm_prefetch_done();
+}
+
+static void pcwarm_load(fsfile map)
+{
+    u64 len = fsfile_get_length(map);
+    if (!len)
+        return;
+    pcwarm.load_buf = allocate_buffer(pcwarm.h, len);
+    if (pcwarm.load_buf == INVALID_ADDRESS) {
+        pcwarm.load_buf = 0;
+        return;
+    }
+    filesystem_read_linear(map, buffer_ref(pcwarm.load_buf, 0), irange(0, len),
+                           init_closure_func(&pcwarm.load_complete, io_status_handler,
+                                             pcwarm_load_complete));
+}
+
+void init_pagecache_warm(tuple root)
+{
+    value v = get(root, sym(pagecache_warm));
+    if (!v)
+        return;
+    tuple config = is_tuple(v) ? v : 0;
+    filesystem fs = get_root_fs();
+    heap h = heap_locked(get_kernel_heaps());
+    pcwarm.h = h;
+    pcwarm.fs = fs;
+    pcwarm.page_order = pagecache_get_page_order();
+    pcwarm.budget = heap_total((heap)heap_physical(get_kernel_heaps())) / PCWARM_DEFAULT_MAX_DIV;
+    spin_lock_init(&pcwarm.lock);
+    string file = config ? get_string(config, sym(file)) : 0;
+    sstring path = file ? buffer_to_sstring(file) : ss(PCWARM_DEFAULT_FILE);
+    u64 val;
+    if (config && get_u64(config, sym(max), &val))
+        pcwarm.budget = val;
+    if (config && get_u64(config, sym(interval), &val))
+        pcwarm.interval = seconds(val);
+    init_closure_func(&pcwarm.prefetch, thunk, pcwarm_prefetch);
+    init_closure_func(&pcwarm.prefetch_complete, status_handler, pcwarm_prefetch_complete);
+
+    /* the map is rewritten only on a writable filesystem */
+    boolean save = !filesystem_is_readonly(fs);
+    tuple t;
+    fsfile map = 0;
+    fs_status fss = filesystem_get_node(&fs, fs->get_inode(fs, filesystem_getroot(fs)), path,
+                                        true, save, false, false, &t, &map);
+    if (fss != FS_STATUS_OK) {
+        if (save || (fss != FS_STATUS_NOENT))
+            msg_err("failed to open pagecache residency map \"%s\": %s\n", path,
+                    string_from_fs_status(fss));
+        return;
+    }
+    filesystem_put_node(fs, t);
+    if (!map)
+        return;
+    if (fs != pcwarm.fs) {
+        msg_err("pagecache residency map must be in the root filesystem\n");
+        fsfile_release(map);
+        return;
+    }
+    pcwarm_load(map);
+    if (!save) {
+        fsfile_release(map);
+        return;
+    }
+    pcwarm.map = map;
+    init_closure_func(&pcwarm.save, thunk, pcwarm_save);
+    init_closure_func(&pcwarm.save_written, io_status_handler, pcwarm_save_written);
+    init_closure_func(&pcwarm.save_complete, status_handler, pcwarm_save_complete);
+    add_shutdown_completion(closure_func(h, shutdown_handler, pcwarm_shutdown));
+    if (pcwarm.interval) {
+        init_timer(&pcwarm.timer);
+        timer_set_slack(&pcwarm.timer, pcwarm.interval / 2);
+        register_timer(kernel_timers, &pcwarm.timer, CLOCK_ID_MONOTONIC, pcwarm.interval, false,
+                       pcwarm.interval, init_closure_func(&pcwarm.timer_func, timer_handler,
+                                                          pcwarm_timer_func));
+    }
+}
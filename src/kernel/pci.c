@@ -20,6 +20,9 @@ BSS_RO_AFTER_INIT static vector drivers;
 static struct spinlock pci_lock;
 BSS_RO_AFTER_INIT static heap virtual_page;
 
+/* devices found by pci_discover_parallel(), pending driver probing */
+static vector pci_pending;
+
 static u32 pci_bar_len(pci_dev dev, int bar)
 {
     u32 orig = pci_cfgread(dev, 0x10 + 4 * bar, 4);
@@ -169,7 +172,8 @@ u64 pci_setup_msix_aff(pci_dev dev, int msi_slot, thunk h, sstring name, range c
 
     u32 target_cpu = irq_get_target_cpu(cpu_affinity);
     u32 address, data;
-    u64 vector = pci_platform_allocate_msi(dev, h, name, target_cpu, &address, &data);
+    u64 vector = pci_platform_allocate_msi(dev, h, name, target_cpu, cpu_affinity,
+                                           &address, &data);
     if (vector == INVALID_PHYSICAL)
         return vector;
 
@@ -212,7 +216,9 @@ void register_pci_driver(pci_probe probe, pci_remove remove)
     assert(d != INVALID_ADDRESS); 
     d->probe = probe;
     d->remove = remove;
+    spin_lock(&pci_lock);
     vector_push(drivers, d);
+    spin_unlock(&pci_lock);
 }
 
 static int pci_dev_find(pci_dev dev)
@@ -262,6 +268,30 @@ static void pci_parse_iomem(pci_dev dev, boolean allocate)
     }
 }
 
+/* Drivers are probed without holding pci_lock, so that devices can be probed in parallel; the
+   probing flag keeps the device from being probed again meanwhile. */
+static void pci_probe_drivers(pci_dev pcid)
+{
+    pci_driver d;
+    for (int i = 0; ; i++) {
+        spin_lock(&pci_lock);
+        d = vector_get(drivers, i);
+        spin_unlock(&pci_lock);
+        if (!d)
+            break;
+        pci_debug(" driver %p / %F\n", d, d->probe);
+        if (apply(d->probe, pcid)) {
+            pci_debug("  dev %02x:%02x:%x: attached to %F\n", pcid->bus, pcid->slot,
+                      pcid->function, d->probe);
+            break;
+        }
+    }
+    spin_lock(&pci_lock);
+    pcid->driver = d;
+    pcid->probing = false;
+    spin_unlock(&pci_lock);
+}
+
 void pci_probe_device(pci_dev dev)
 {
     u16 vendor = pci_get_vendor(dev);
@@ -281,6 +311,7 @@ void pci_probe_device(pci_dev dev)
         }
         *new_dev = *dev;
         new_dev->driver = 0;
+        new_dev->probing = false;
         pci_parse_iomem(new_dev, true);
         vector_push(devices, new_dev);
         pcid = new_dev;
@@ -305,21 +336,18 @@ void pci_probe_device(pci_dev dev)
 
     // probe drivers
     spin_lock(&pci_lock);
-    if (pcid->driver) {
+    if (pcid->driver || pcid->probing) {
         spin_unlock(&pci_lock);
         return;
     }
-    struct pci_driver *d;
-    vector_foreach(drivers, d) {
-        pci_debug(" driver %p / %F\n", d, d->probe);
-        if (apply(d->probe, pcid)) {
-            pci_debug("  dev %02x:%02x:%x: attached to %F\n", dev->bus, dev->slot, dev->function,
-                      d->probe);
-            pcid->driver = d;
-            break;
-        }
+    pcid->probing = true;
+    if (pci_pending) {
+        vector_push(pci_pending, pcid);
+        spin_unlock(&pci_lock);
+        return;
     }
     spin_unlock(&pci_lock);
+    pci_probe_drivers(pcid);
 }
 
 closure_function(4, 0, void, pci_device_remove_complete,
@@ -445,6 +473,61 @@ void pci_discover()
     }
 }
 
+closure_function(2, 0, void, pci_probe_class,
+                 vector, devs, status_handler, complete)
+{
+    vector devs = bound(devs);
+    pci_dev dev;
+    vector_foreach(devs, dev) {
+        boot_phase_device(ss("pci probe"), pci_dev_id(dev));
+        pci_probe_drivers(dev);
+        boot_phase_device(dev->driver ? ss("pci attached") : ss("pci no driver"),
+                          pci_dev_id(dev));
+    }
+    deallocate_vector(devs);
+    apply(bound(complete), STATUS_OK);
+    closure_finish();
+}
+
+/* Enumerates PCI devices like pci_discover(), then probes drivers for the devices found on the
+ * secondary CPUs: devices of the same class (e.g. all NICs) are probed in sequence by one task,
+ * since drivers of a class may share unlocked state (such as the lwIP interface list), while
+ * different classes (e.g. storage and network) are probed in parallel. The merge is joined when
+ * all probes have completed. */
+void pci_discover_parallel(merge m)
+{
+    heap h = devices->h;
+    vector pending = allocate_vector(h, 8);
+    assert(pending != INVALID_ADDRESS);
+    spin_lock(&pci_lock);
+    pci_pending = pending;
+    spin_unlock(&pci_lock);
+    pci_discover();
+    spin_lock(&pci_lock);
+    pci_pending = 0;
+    spin_unlock(&pci_lock);
+    u64 classes[256 / 64];
+    zero(classes, sizeof(classes));
+    pci_dev dev;
+    vector_foreach(pending, dev)
+        classes[pci_get_class(dev) / 64] |= U64_FROM_BIT(pci_get_class(dev) % 64);
+    for (int class = 0; class < 256; class++) {
+        if (!(classes[class / 64] & U64_FROM_BIT(class % 64)))
+            continue;
+        vector devs = allocate_vector(h, 4);
+        assert(devs != INVALID_ADDRESS);
+        vector_foreach(pending, dev) {
+            if (pci_get_class(dev) == class)
+                vector_push(devs, dev);
+        }
+        thunk t = closure(h, pci_probe_class, devs, apply_merge(m));
+        assert(t != INVALID_ADDRESS);
+        assert(enqueue(runqueue, t));
+    }
+    deallocate_vector(pending);
+    wakeup_or_interrupt_cpu_all();
+}
+
 void init_pci(kernel_heaps kh)
 {
     // should use the global node space
@@ -84,6 +84,7 @@ struct pci_dev {
     int function;
     pci_driver driver;
     void *driver_data;
+    boolean probing;    /* drivers are being probed */
     struct pci_bar msix_bar;
 };
 
@@ -161,7 +162,7 @@ void pci_bar_deinit(struct pci_bar *b);
 void pci_platform_init(void);
 void pci_platform_init_bar(pci_dev dev, int bar);
 u64 pci_platform_allocate_msi(pci_dev dev, thunk h, sstring name, u32 target_cpu,
-                              u32 *address, u32 *data);
+                              range cpu_affinity, u32 *address, u32 *data);
 void pci_platform_deallocate_msi(pci_dev dev, u64 v);
 boolean pci_platform_has_msi(void);
 
@@ -188,6 +189,7 @@ u32 pci_find_next_cap(pci_dev dev, u8 cap, u32 cp);
 void pci_bridge_set_iomem(range window, id_heap iomem);
 id_heap pci_bus_get_iomem(int bus);
 void pci_discover();
+void pci_discover_parallel(merge m);
 void pci_probe_device(pci_dev dev);
 void pci_remove_device(pci_dev dev, thunk completion);
 void pci_set_bus_master(pci_dev dev);
@@ -0,0 +1,40 @@
+/* Hardware performance monitoring unit
+ *
+ * Architecture code exposes the general-purpose counters of the local CPU; counters are assigned to
+ * events and virtualized per thread by the perf_event layer, which programs them while the thread
+ * runs. Counter values are truncated to the counter width (see pmu_counter_mask()).
+ */
+
+/* generic hardware events, with the numbering of PERF_TYPE_HARDWARE event configs */
+#define PMU_EVENT_CPU_CYCLES            0
+#define PMU_EVENT_INSTRUCTIONS          1
+#define PMU_EVENT_CACHE_REFERENCES      2
+#define PMU_EVENT_CACHE_MISSES          3
+#define PMU_EVENT_BRANCH_INSTRUCTIONS   4
+#define PMU_EVENT_BRANCH_MISSES         5
+#define PMU_EVENT_BUS_CYCLES            6
+#define PMU_EVENT_REF_CPU_CYCLES        9
+
+/* counter flags */
+#define PMU_COUNT_USER          U64_FROM_BIT(0)
+#define PMU_COUNT_KERNEL        U64_FROM_BIT(1)
+#define PMU_COUNT_INTERRUPT     U64_FROM_BIT(2)     /* raise an overflow interrupt */
+
+/* Detects the PMU; overflow_handler is invoked in interrupt context when a counter started with
+ * PMU_COUNT_INTERRUPT overflows. Returns false if no PMU is available. */
+boolean init_pmu(kernel_heaps kh, thunk overflow_handler);
+
+int pmu_counter_count(void);
+u64 pmu_counter_mask(void);
+boolean pmu_sampling_supported(void);
+
+/* Translate a generic or a raw (architecture-specific) event into an event selector */
+boolean pmu_hw_event(u64 id, u64 *event);
+boolean pmu_raw_event(u64 config, u64 *event);
+
+void pmu_counter_start(int idx, u64 event, u64 flags, u64 value);
+u64 pmu_counter_stop(int idx);     /* returns the counter value */
+u64 pmu_counter_read(int idx);
+
+/* Returns and clears the bitmap of overflowed counters of the local CPU */
+u64 pmu_overflow_status(void);
@@ -4,6 +4,7 @@
 
 BSS_RO_AFTER_INIT static heap pvclock_heap;
 BSS_RO_AFTER_INIT static volatile struct pvclock_vcpu_time_info *vclock;
+BSS_RO_AFTER_INIT static volatile struct pvclock_wall_clock *wall_clock;
 
 static timestamp pvclock_get_rtc_offset(volatile struct pvclock_wall_clock *wc)
 {
@@ -32,11 +33,18 @@ void init_pvclock(heap h, struct pvclock_vcpu_time_info *vti, struct pvclock_wal
 {
     assert(vti);
     vclock = vti;
+    wall_clock = wc;
     pvclock_heap = h;
     register_platform_clock_now(closure_func(h, clock_now, pvclock_now), VDSO_CLOCK_PVCLOCK,
                                 pvclock_get_rtc_offset(wc));
 }
 
+/* Returns the current wall clock time, as reported by the hypervisor */
+timestamp pvclock_wallclock_now(void)
+{
+    return pvclock_get_rtc_offset(wall_clock) + nanoseconds(pvclock_now_ns());
+}
+
 physical pvclock_get_physaddr(void)
 {
     return (vclock == 0) ? INVALID_PHYSICAL
@@ -82,6 +90,7 @@ boolean init_tsc_deadline_timer(clock_timer *ct, thunk *per_cpu_init)
         return false;           /* no TSC-Deadline */
 
     *ct = closure_func(pvclock_heap, clock_timer, tsc_deadline_timer);
+    platform_timer_max = microseconds(RUNLOOP_TIMER_IDLE_MAX_PERIOD_US);
     int irq = allocate_interrupt();
     register_interrupt(irq, timer_interrupt_handler, ss("tsc deadline timer"));
     *per_cpu_init = closure(pvclock_heap, tsc_deadline_percpu_init, irq);
@@ -18,4 +18,5 @@ struct pvclock_wall_clock {
 u64 pvclock_now_ns(void);
 boolean init_tsc_deadline_timer(clock_timer *ct, thunk *per_cpu_init);
 void init_pvclock(heap h, struct pvclock_vcpu_time_info *pvclock, struct pvclock_wall_clock *wc);
+timestamp pvclock_wallclock_now(void);
 physical pvclock_get_physaddr(void);
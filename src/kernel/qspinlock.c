@@ -0,0 +1,100 @@
+#include <kernel.h>
+
+/* Queued spinlock slow path, after the Linux qspinlock (without the pending
+   bit optimization). A contended locker appends a per-CPU node to a queue
+   whose tail is encoded in the upper half of the lock word, and spins on its
+   own node until it reaches the head of the queue. Only the head spins on the
+   lock word itself, waiting for the owner to clear the locked byte, so the
+   lock is handed off in FIFO order and the cache line holding the lock word
+   is not contended by all waiters at once.
+
+   Each CPU has QSPIN_NODES nodes, one per level of nesting (e.g. a lock taken
+   by an interrupt handler which interrupted a spinning locker). Should the
+   nesting be deeper, the locker falls back to unqueued test-and-set. */
+
+#define QSPIN_LOCKED_MASK   MASK(8)
+#define QSPIN_TAIL_SHIFT    32
+#define QSPIN_TAIL_MASK     (MASK(32) << QSPIN_TAIL_SHIFT)
+#define QSPIN_IDX_BITS      2
+
+static inline u64 qspin_encode_tail(cpuinfo ci, int idx)
+{
+    return ((u64)(((ci->id + 1) << QSPIN_IDX_BITS) | idx)) << QSPIN_TAIL_SHIFT;
+}
+
+static inline qspin_node qspin_decode_tail(u64 tail)
+{
+    u32 t = tail >> QSPIN_TAIL_SHIFT;
+    return &cpuinfo_from_id((t >> QSPIN_IDX_BITS) - 1)->qspin_nodes[t & MASK(QSPIN_IDX_BITS)];
+}
+
+/* Returns the number of spins taken to acquire the lock (for lock stats). */
+u64 spin_lock_slowpath(spinlock l)
+{
+    cpuinfo ci = current_cpu();
+    volatile u64 *p = (volatile u64 *)&l->w;
+    u64 spins = 0;
+    u64 old;
+    u64 start = lockprof_wait_start();
+
+    int idx = ci->qspin_depth;
+    if (idx >= QSPIN_NODES) {
+        while (*p || !compare_and_swap_64(&l->w, 0, QSPIN_LOCKED)) {
+            spins++;
+            kern_pause();
+        }
+        goto profile;
+    }
+    qspin_node node = &ci->qspin_nodes[idx];
+    ci->qspin_depth = idx + 1;
+    node->next = 0;
+    node->locked = false;
+    write_barrier();
+
+    /* publish as the new tail and link behind the previous one, if any */
+    u64 tail = qspin_encode_tail(ci, idx);
+    do {
+        old = *p;
+    } while (!compare_and_swap_64(&l->w, old, (old & ~QSPIN_TAIL_MASK) | tail));
+    if (old & QSPIN_TAIL_MASK) {
+        qspin_node prev = qspin_decode_tail(old & QSPIN_TAIL_MASK);
+        *(volatile qspin_node *)&prev->next = node;
+        while (!*(volatile boolean *)&node->locked) {
+            spins++;
+            kern_pause();
+        }
+    }
+
+    /* At the head of the queue; no other locker can take the lock while the
+       tail is set, so wait for the owner to release it and then claim it. A
+       sampled waiter flags the locked byte for the owner to record itself. */
+    boolean flagged = !start;
+    while ((old = *p) & QSPIN_LOCKED_MASK) {
+        if (!flagged)
+            flagged = compare_and_swap_64(&l->w, old, old | LOCKPROF_CONTENDED);
+        spins++;
+        kern_pause();
+    }
+    while (1) {
+        if ((old & QSPIN_TAIL_MASK) == tail) {
+            /* last in queue: clear the tail as well */
+            if (compare_and_swap_64(&l->w, old, QSPIN_LOCKED))
+                goto out;
+        } else if (compare_and_swap_64(&l->w, old, old | QSPIN_LOCKED)) {
+            break;
+        }
+        old = *p;
+    }
+
+    /* pass the head of the queue to the successor */
+    qspin_node next;
+    while (!(next = *(volatile qspin_node *)&node->next))
+        kern_pause();
+    *(volatile boolean *)&next->locked = true;
+  out:
+    ci->qspin_depth = idx;
+  profile:
+    if (start)
+        lockprof_wait_end(l, LOCKPROF_SPIN, start);
+    return spins;
+}
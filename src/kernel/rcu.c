@@ -0,0 +1,79 @@
+#include <kernel.h>
+
+/* RCU-style deferred reclamation. Readers mark their (short, non-blocking)
+   read sections by making the per-CPU sequence counter odd, so a writer that
+   has unpublished an object only needs to wait for each CPU that was inside a
+   read section at the time to leave it; CPUs outside a read section, be they
+   idle, running user code or executing elsewhere in the kernel, are not
+   waited on. Deferred callbacks are batched per CPU and run after one such
+   grace period at the next quiescent point of the CPU that queued them. */
+
+void synchronize_rcu(void)
+{
+    cpuinfo self = current_cpu();
+    assert(self->rcu_nest == 0);
+    memory_barrier();
+    for (int i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        if (ci == self)
+            continue;
+        u64 seq = *(volatile u64 *)&ci->rcu_seq;
+        if (!(seq & 1))
+            continue;
+        while (*(volatile u64 *)&ci->rcu_seq == seq)
+            kern_pause();
+    }
+    memory_barrier();
+}
+
+void call_rcu(thunk t)
+{
+    cpuinfo ci = current_cpu();
+    u64 flags = irq_disable_save();
+    vector v = ci->rcu_callbacks;
+    boolean queued = v && vector_set(v, vector_length(v), t);
+    irq_restore(flags);
+    if (!queued) {
+        synchronize_rcu();
+        apply(t);
+    }
+}
+
+void rcu_process_callbacks(cpuinfo ci)
+{
+    assert(ci->rcu_nest == 0);
+    u64 flags = irq_disable_save();
+    int n = vector_length(ci->rcu_callbacks);
+    irq_restore(flags);
+    if (n == 0)
+        return;
+
+    /* Callbacks queued from here on (e.g. by interrupt handlers) are after
+       the grace period below and stay in the vector for the next pass. */
+    synchronize_rcu();
+    for (int i = 0; i < n; i++) {
+        thunk t = vector_get(ci->rcu_callbacks, i);
+        apply(t);
+    }
+    flags = irq_disable_save();
+    vector_consume(ci->rcu_callbacks, n);
+    irq_restore(flags);
+}
+
+closure_function(3, 0, void, rcu_free,
+                 heap, h, void *, p, bytes, size)
+{
+    deallocate(bound(h), bound(p), bound(size));
+    closure_finish();
+}
+
+void rcu_deallocate(heap h, void *p, bytes size)
+{
+    thunk t = closure(h, rcu_free, h, p, size);
+    if (t == INVALID_ADDRESS) {
+        synchronize_rcu();
+        deallocate(h, p, size);
+        return;
+    }
+    call_rcu(t);
+}
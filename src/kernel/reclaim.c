@@ -0,0 +1,393 @@
+/* Memory reclaim
+ *
+ * Kernel subsystems holding memory that can be given back on demand register a mem_cleaner with a
+ * priority class (enum mm_cleaner_prio). Reclaim is driven by three watermarks on the amount of
+ * free physical memory:
+ * - below the low watermark, a background reclaim thunk is scheduled, which invokes the cleaners
+ *   of the classes up to MM_CLEANER_BACKGROUND_MAX, in batches, until free memory is back above
+ *   the high watermark
+ * - below the min watermark, or when an allocation has failed, memory is reclaimed synchronously
+ *   ("direct reclaim") by the caller, using all cleaner classes; the time spent by contexts in
+ *   direct reclaim is accounted as memory stall time
+ * Within a class, cleaners are invoked in order of their measured cost (time spent per reclaimed
+ * byte), so that a cleaner which could not satisfy previous requests is de-prioritized.
+ * Memory pressure, i.e. the share of time during which at least one context was stalled in direct
+ * reclaim, is averaged over 10, 60 and 300 seconds in the same fashion as Linux PSI. Watermarks,
+ * pressure and reclaim statistics are exposed in the management tree under "reclaim".
+ */
+#include <kernel.h>
+#include <management.h>
+#include <storage.h>
+
+//#define MM_DEBUG
+#ifdef MM_DEBUG
+#define mm_debug(x, ...) do {tprintf(sym(mm), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define mm_debug(x, ...) do { } while(0)
+#endif
+
+/* cost assigned to a cleaner invocation that did not reclaim anything, in ns per MB */
+#define MM_CLEANER_FAIL_COST    1000000
+
+/* fixed-point exponential decay factors for pressure averages updated every 2 seconds */
+#define MM_PRESSURE_FSHIFT      11
+#define MM_PRESSURE_FIXED_1     (1 << MM_PRESSURE_FSHIFT)
+#define MM_PRESSURE_EXP_10s     1677
+#define MM_PRESSURE_EXP_60s     1981
+#define MM_PRESSURE_EXP_300s    2034
+
+typedef struct mm_cleaner {
+    struct list l;
+    mem_cleaner cleaner;
+    sstring name;
+    int prio;
+    u64 cost;           /* moving average of ns spent per reclaimed MB */
+    u64 calls;
+    u64 cleaned;
+} *mm_cleaner;
+
+struct mm_watermarks {
+    u64 min, low, high;
+};
+
+static struct {
+    struct list cleaners;   /* sorted by priority class, then cost */
+    struct spinlock lock;
+    boolean bg_pending;
+    timestamp bg_backoff;
+    timestamp direct_backoff;
+    u64 bg_runs, bg_cleaned;
+    u64 direct_runs, direct_cleaned;
+    closure_struct(thunk, bg_reclaim);
+
+    /* memory stall accounting */
+    struct spinlock stall_lock;
+    u64 stalled;
+    timestamp stall_start;
+    timestamp stall_total;
+    timestamp stall_last;
+    u64 avg[3];             /* fixed-point percentages */
+    struct timer pressure_timer;
+    closure_struct(timer_handler, pressure_update);
+
+    tuple mgmt;
+    struct spinlock mgmt_lock;
+} mm_reclaim;
+
+static u64 mm_free_memory(struct mm_watermarks *wm)
+{
+    heap phys = (heap)heap_physical(get_kernel_heaps());
+    u64 total = heap_total(phys);
+    u64 allocated = heap_allocated(phys);
+    u64 high = total >> MEM_CLEAN_THRESHOLD_SHIFT;
+    if (high < MEM_CLEAN_THRESHOLD)
+        high = MEM_CLEAN_THRESHOLD;
+    wm->high = high;
+    wm->low = high - high / 4;
+    wm->min = high / 2;
+    return (total > allocated) ? total - allocated : 0;
+}
+
+/* Amount of free memory which reclaim strives to maintain; memory held by the kernel for other
+ * purposes than allocation (e.g. free page reporting) should not push free memory below it. */
+u64 mm_watermark_high(void)
+{
+    struct mm_watermarks wm;
+    mm_free_memory(&wm);
+    return wm.high;
+}
+
+static void mm_cleaner_insert(mm_cleaner mmc)
+{
+    list_foreach(&mm_reclaim.cleaners, e) {
+        mm_cleaner c = struct_from_list(e, mm_cleaner, l);
+        if ((c->prio > mmc->prio) || ((c->prio == mmc->prio) && (c->cost > mmc->cost))) {
+            list_insert_before(e, &mmc->l);
+            return;
+        }
+    }
+    list_push_back(&mm_reclaim.cleaners, &mmc->l);
+}
+
+static void mm_cleaner_update_cost(mm_cleaner mmc, u64 cleaned, timestamp elapsed)
+{
+    u64 sample;
+    if (cleaned) {
+        sample = (nsec_from_timestamp(elapsed) << 20) / cleaned;
+    } else {
+        sample = mmc->cost * 2;
+        if (sample < MM_CLEANER_FAIL_COST)
+            sample = MM_CLEANER_FAIL_COST;
+    }
+    mmc->cost = mmc->cost - mmc->cost / 4 + sample / 4;
+    mmc->calls++;
+    mmc->cleaned += cleaned;
+}
+
+static u64 mm_clean(u64 clean_bytes, int max_prio)
+{
+    s64 remain = clean_bytes;
+    boolean reorder = false;
+    spin_lock(&mm_reclaim.lock);
+    list_foreach(&mm_reclaim.cleaners, e) {
+        mm_cleaner mmc = struct_from_list(e, mm_cleaner, l);
+        if (mmc->prio > max_prio)
+            break;
+        timestamp start = now(CLOCK_ID_MONOTONIC_RAW);
+        u64 cleaned = apply(mmc->cleaner, remain);
+        mm_cleaner_update_cost(mmc, cleaned, now(CLOCK_ID_MONOTONIC_RAW) - start);
+        reorder = true;
+        remain -= cleaned;
+        if (remain <= 0)
+            break;
+    }
+    if (reorder) {
+        /* cleaner costs have changed: re-sort the list */
+        struct list sorted;
+        list_init(&sorted);
+        list_move(&sorted, &mm_reclaim.cleaners);
+        list e;
+        while ((e = list_get_next(&sorted))) {
+            list_delete(e);
+            mm_cleaner_insert(struct_from_list(e, mm_cleaner, l));
+        }
+    }
+    spin_unlock(&mm_reclaim.lock);
+    u64 cleaned = (remain > 0) ? clean_bytes - remain : clean_bytes;
+    if (cleaned)
+        /* Memory cleaners may have deallocated page heap memory: drain the page heap, so that
+         * deallocated memory can be returned to the physical heap. */
+        cache_drain(get_kernel_heaps()->pages, cleaned, 0);
+    return cleaned;
+}
+
+/* Reclaims memory on behalf of a subsystem which needs to take free memory out of the physical heap
+ * (e.g. to unplug it), using the cleaners that do not take memory back from the host. */
+u64 mm_reclaim_memory(u64 clean_bytes)
+{
+    return mm_clean(clean_bytes, MM_CLEANER_BACKGROUND_MAX);
+}
+
+boolean mm_register_mem_cleaner(mem_cleaner cleaner, sstring name, int prio)
+{
+    mm_cleaner mmc = allocate(heap_locked(get_kernel_heaps()), sizeof(*mmc));
+    if (mmc == INVALID_ADDRESS)
+        return false;
+    mmc->cleaner = cleaner;
+    mmc->name = name;
+    mmc->prio = prio;
+    mmc->cost = 0;
+    mmc->calls = 0;
+    mmc->cleaned = 0;
+    spin_lock(&mm_reclaim.lock);
+    mm_cleaner_insert(mmc);
+    spin_unlock(&mm_reclaim.lock);
+    return true;
+}
+
+closure_func_basic(thunk, void, mm_bg_reclaim)
+{
+    struct mm_watermarks wm;
+    u64 free = mm_free_memory(&wm);
+    if (free < wm.high) {
+        u64 clean_bytes = MIN(wm.high - free, MEM_RECLAIM_BATCH);
+        u64 cleaned = mm_clean(clean_bytes, MM_CLEANER_BACKGROUND_MAX);
+        mm_debug("%s: free %ld, cleaned %ld / %ld requested\n", func_ss, free, cleaned,
+                 clean_bytes);
+        fetch_and_add(&mm_reclaim.bg_runs, 1);
+        fetch_and_add(&mm_reclaim.bg_cleaned, cleaned);
+        if (cleaned == clean_bytes) {
+            /* continue in a later batch, so as not to monopolize the CPU */
+            async_apply((thunk)&mm_reclaim.bg_reclaim);
+            return;
+        }
+        mm_reclaim.bg_backoff = now(CLOCK_ID_MONOTONIC_RAW) +
+                                milliseconds(MEM_RECLAIM_BACKOFF_MS);
+    }
+    mm_reclaim.bg_pending = false;
+}
+
+static void mm_stall_begin(void)
+{
+    spin_lock(&mm_reclaim.stall_lock);
+    if (mm_reclaim.stalled++ == 0)
+        mm_reclaim.stall_start = now(CLOCK_ID_MONOTONIC_RAW);
+    spin_unlock(&mm_reclaim.stall_lock);
+}
+
+static void mm_stall_end(void)
+{
+    spin_lock(&mm_reclaim.stall_lock);
+    if (--mm_reclaim.stalled == 0)
+        mm_reclaim.stall_total += now(CLOCK_ID_MONOTONIC_RAW) - mm_reclaim.stall_start;
+    spin_unlock(&mm_reclaim.stall_lock);
+}
+
+static timestamp mm_stall_time(void)
+{
+    spin_lock(&mm_reclaim.stall_lock);
+    timestamp t = mm_reclaim.stall_total;
+    if (mm_reclaim.stalled)
+        t += now(CLOCK_ID_MONOTONIC_RAW) - mm_reclaim.stall_start;
+    spin_unlock(&mm_reclaim.stall_lock);
+    return t;
+}
+
+closure_func_basic(timer_handler, void, mm_pressure_update,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    timestamp stall = mm_stall_time();
+    timestamp period = seconds(MEM_PRESSURE_PERIOD_SECONDS) * (overruns + 1);
+    timestamp delta = MIN(stall - mm_reclaim.stall_last, period);
+    mm_reclaim.stall_last = stall;
+    u64 pct = delta * 100 * MM_PRESSURE_FIXED_1 / period;
+    const u64 exp[3] = {MM_PRESSURE_EXP_10s, MM_PRESSURE_EXP_60s, MM_PRESSURE_EXP_300s};
+    for (int i = 0; i < 3; i++)
+        mm_reclaim.avg[i] = (mm_reclaim.avg[i] * exp[i] +
+                             pct * (MM_PRESSURE_FIXED_1 - exp[i])) >> MM_PRESSURE_FSHIFT;
+}
+
+closure_function(1, 1, void, mm_service_sync,
+                 context, ctx,
+                 status s)
+{
+    if (!is_ok(s)) {
+        mm_debug("%s: storage sync failed: %v\n", func_ss, s);
+        timm_dealloc(s);
+    }
+    context_schedule_return(bound(ctx));
+    closure_finish();
+}
+
+/* Checks the amount of free memory against the watermarks: schedules background reclaim if below
+ * the low watermark, and reclaims memory synchronously if below the min watermark or if flush is
+ * true (i.e. the caller failed to allocate memory); in the latter case, if not enough memory can
+ * be reclaimed, pending storage writes are flushed so that dirty cached data can be released. */
+void mm_service(boolean flush)
+{
+    struct mm_watermarks wm;
+    u64 free = mm_free_memory(&wm);
+    if (free >= wm.low)
+        return;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    if (!mm_reclaim.bg_pending && (t >= mm_reclaim.bg_backoff) &&
+        compare_and_swap_boolean(&mm_reclaim.bg_pending, false, true))
+        async_apply((thunk)&mm_reclaim.bg_reclaim);
+    if (!flush && ((free >= wm.min) || (t < mm_reclaim.direct_backoff)))
+        return;
+    mm_debug("%s: free %ld, watermarks %ld/%ld/%ld\n", func_ss, free, wm.min, wm.low, wm.high);
+    mm_stall_begin();
+    u64 clean_bytes = wm.high - free;
+    u64 cleaned = mm_clean(clean_bytes, MM_CLEANER_PRIO_MAX);
+    if (cleaned > 0)
+        mm_debug("   cleaned %ld / %ld requested...\n", cleaned, clean_bytes);
+    fetch_and_add(&mm_reclaim.direct_runs, 1);
+    fetch_and_add(&mm_reclaim.direct_cleaned, cleaned);
+    if (cleaned < clean_bytes) {
+        if (flush) {
+            context ctx = get_current_context(current_cpu());
+            status_handler complete = closure(heap_locked(get_kernel_heaps()), mm_service_sync,
+                                              ctx);
+            if (complete != INVALID_ADDRESS) {
+                context_pre_suspend(ctx);
+                storage_sync(complete);
+                context_suspend();
+            }
+        } else {
+            mm_reclaim.direct_backoff = now(CLOCK_ID_MONOTONIC_RAW) +
+                                        milliseconds(MEM_RECLAIM_BACKOFF_MS);
+        }
+    }
+    mm_stall_end();
+}
+
+void init_mm_reclaim(void)
+{
+    list_init(&mm_reclaim.cleaners);
+    spin_lock_init(&mm_reclaim.lock);
+    spin_lock_init(&mm_reclaim.stall_lock);
+    spin_lock_init(&mm_reclaim.mgmt_lock);
+    init_closure_func(&mm_reclaim.bg_reclaim, thunk, mm_bg_reclaim);
+    init_timer(&mm_reclaim.pressure_timer);
+    timer_set_slack(&mm_reclaim.pressure_timer, seconds(MEM_PRESSURE_PERIOD_SECONDS) / 2);
+}
+
+/* returns the management tuple, updated with the current values */
+static tuple mm_reclaim_value(void)
+{
+    struct mm_watermarks wm;
+    u64 free = mm_free_memory(&wm);
+    spin_lock(&mm_reclaim.mgmt_lock);
+    tuple t = mm_reclaim.mgmt;
+    set(t, sym(free), value_from_u64(free));
+    set(t, sym(watermark_min), value_from_u64(wm.min));
+    set(t, sym(watermark_low), value_from_u64(wm.low));
+    set(t, sym(watermark_high), value_from_u64(wm.high));
+    set(t, sym(background_runs), value_from_u64(mm_reclaim.bg_runs));
+    set(t, sym(background_cleaned), value_from_u64(mm_reclaim.bg_cleaned));
+    set(t, sym(direct_runs), value_from_u64(mm_reclaim.direct_runs));
+    set(t, sym(direct_cleaned), value_from_u64(mm_reclaim.direct_cleaned));
+    set(t, sym(stall_nsecs), value_from_u64(nsec_from_timestamp(mm_stall_time())));
+
+    /* pressure averages are in hundredths of a percent */
+    set(t, sym(pressure_avg10), value_from_u64((mm_reclaim.avg[0] * 100) >> MM_PRESSURE_FSHIFT));
+    set(t, sym(pressure_avg60), value_from_u64((mm_reclaim.avg[1] * 100) >> MM_PRESSURE_FSHIFT));
+    set(t, sym(pressure_avg300), value_from_u64((mm_reclaim.avg[2] * 100) >> MM_PRESSURE_FSHIFT));
+    tuple cleaners = get_tuple(t, sym(cleaners));
+    spin_lock(&mm_reclaim.lock);
+    list_foreach(&mm_reclaim.cleaners, e) {
+        mm_cleaner mmc = struct_from_list(e, mm_cleaner, l);
+        symbol s = sym_sstring(mmc->name);
+        tuple c = get_tuple(cleaners, s);
+        if (!c) {
+            c = allocate_tuple();
+            assert(c != INVALID_ADDRESS);
+            set(cleaners, s, c);
+        }
+        set(c, sym(priority), value_from_u64(mmc->prio));
+        set(c, sym(calls), value_from_u64(mmc->calls));
+        set(c, sym(cleaned), value_from_u64(mmc->cleaned));
+        set(c, sym(cost_nsecs_per_mb), value_from_u64(mmc->cost));
+    }
+    spin_unlock(&mm_reclaim.lock);
+    spin_unlock(&mm_reclaim.mgmt_lock);
+    return t;
+}
+
+closure_func_basic(tuple_get, value, mm_reclaim_get,
+                   value a)
+{
+    return get(mm_reclaim_value(), a);
+}
+
+closure_func_basic(tuple_set, void, mm_reclaim_set,
+                   value a, value v)
+{
+    /* read-only */
+}
+
+closure_func_basic(tuple_iterate, boolean, mm_reclaim_iterate,
+                   binding_handler h)
+{
+    return iterate(mm_reclaim_value(), h);
+}
+
+/* Exposes reclaim watermarks, statistics and memory pressure in the management tree, and starts
+ * the periodic update of pressure averages */
+value mm_reclaim_management(heap h)
+{
+    mm_reclaim.mgmt = allocate_tuple();
+    assert(mm_reclaim.mgmt != INVALID_ADDRESS);
+    set(mm_reclaim.mgmt, sym(cleaners), allocate_tuple());
+    timestamp period = seconds(MEM_PRESSURE_PERIOD_SECONDS);
+    register_timer(kernel_timers, &mm_reclaim.pressure_timer, CLOCK_ID_MONOTONIC, period, false,
+                   period, init_closure_func(&mm_reclaim.pressure_update, timer_handler,
+                                             mm_pressure_update));
+    tuple ft = allocate_function_tuple(closure_func(h, tuple_get, mm_reclaim_get),
+                                       closure_func(h, tuple_set, mm_reclaim_set),
+                                       closure_func(h, tuple_iterate, mm_reclaim_iterate));
+    assert(ft != INVALID_ADDRESS);
+    return ft;
+}
@@ -25,54 +25,166 @@ BSS_RO_AFTER_INIT queue runqueue;
 BSS_RO_AFTER_INIT queue async_queue_1;            /* queue of async 1 arg completions */
 BSS_RO_AFTER_INIT bitmap idle_cpu_mask;
 
+/* CPUs isolated via the isolated_cpus option (null if none): see config_isolated_cpus(). */
+bitmap isolated_cpu_mask;
+static u64 housekeeping_cpu;
+static u64 poll_cpu_next;
+
 BSS_RO_AFTER_INIT timerqueue kernel_timers;
 BSS_RO_AFTER_INIT thunk timer_interrupt_handler;
+BSS_RO_AFTER_INIT timestamp (*pv_steal_clock)(u64 cpu);
+
+/* Halt polling: an idle CPU spins waiting for work for up to an adaptive interval before halting,
+ * which on a hypervisor spares the VM exits of the halt and of the wakeup IPI. The interval of
+ * each CPU grows when it halted for less than the maximum interval (so that polling for longer
+ * would have caught the wakeup), and shrinks when it halted for longer. */
+#define IDLE_POLL_GROW_START_US 50
+static timestamp idle_poll_max;
+
+static idle_work_handler idle_work;
+
+/* Placement of tasks woken up by another CPU (wake_affine option) */
+enum sched_wake_policy {
+    SCHED_WAKE_PREV,    /* "off": the CPU where the task last ran */
+    SCHED_WAKE_IDLE,    /* "idle": the previous CPU if idle, else an idle CPU near the waker */
+    SCHED_WAKE_WAKER,   /* "waker": as above, but the waker CPU is preferred to idle CPUs if it
+                         * has no other tasks to run */
+};
+static enum sched_wake_policy wake_policy = SCHED_WAKE_WAKER;
+
+static boolean idle_work_pending(cpuinfo ci)
+{
+    return !bitmap_get(idle_cpu_mask, ci->id) ||
+        queue_length(ci->cpu_queue) || queue_length(ci->bhqueue) || queue_length(bhqueue) ||
+        queue_length(ci->runqueue) || queue_length(runqueue) || queue_length(async_queue_1);
+}
+
+/* Returns true if work has arrived before the polling interval expired. While busy polling is
+ * armed, the poll function is applied instead of pausing, and the interval extends to the end of
+ * busy polling. */
+static boolean idle_poll(cpuinfo ci)
+{
+    timestamp end = ci->sched_stats.idle_start + ci->idle_poll;
+    thunk poll = ci->busy_poll;
+    if (poll) {
+        if (ci->busy_poll_end > ci->sched_stats.idle_start)
+            end = MAX(end, ci->busy_poll_end);
+        else
+            poll = ci->busy_poll = 0;
+    }
+    boolean work;
+    ci->idle_polling = true;
+    memory_barrier();
+    enable_interrupts();
+    while (!(work = idle_work_pending(ci)) && (now(CLOCK_ID_MONOTONIC_RAW) < end)) {
+        if (poll)
+            apply(poll);
+        else
+            kern_pause();
+    }
+    disable_interrupts();
+    if (work)
+        return true;
+
+    /* a wakeup that saw this CPU polling is seen here */
+    ci->idle_polling = false;
+    memory_barrier();
+    return idle_work_pending(ci);
+}
+
+static void idle_poll_adjust(cpuinfo ci, timestamp idle)
+{
+    timestamp poll = ci->idle_poll;
+    if (idle <= poll)
+        return;
+    if (idle <= idle_poll_max) {
+        poll = poll ? poll * 2 : microseconds(IDLE_POLL_GROW_START_US);
+        ci->idle_poll = MIN(poll, idle_poll_max);
+    } else {
+        poll /= 2;
+        ci->idle_poll = (poll < microseconds(IDLE_POLL_GROW_START_US)) ? 0 : poll;
+    }
+}
 
 NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
 {
     // we're going to cover up this race by checking the state in the interrupt
     // handler...we shouldn't return here if we do get interrupted
     cpuinfo ci = current_cpu();
+    rcu_quiescent(ci);
     sched_debug("sleep\n");
+    ci->sched_stats.idle_start = now(CLOCK_ID_MONOTONIC_RAW);
     ci->state = cpu_idle;
     bitmap_set_atomic(idle_cpu_mask, ci->id, 1);
 
+    if ((ci->idle_poll || ci->busy_poll) && idle_poll(ci)) {
+        bitmap_set_atomic(idle_cpu_mask, ci->id, 0);
+        runloop();
+    }
     while (1) {
         wait_for_interrupt();
     }
 }
 
+/* Arms busy polling on the current CPU: for the given interval, if the CPU goes idle (e.g. because
+ * the calling thread blocks), it applies the poll function (e.g. to reap the frames of a network
+ * rx queue) instead of halting, so that the work it produces is picked up without waiting for an
+ * interrupt, and the tasks it wakes up can run on this CPU without an IPI. */
+void sched_busy_poll(thunk poll, timestamp interval)
+{
+    cpuinfo ci = current_cpu();
+    ci->busy_poll_end = now(CLOCK_ID_MONOTONIC_RAW) + interval;
+    ci->busy_poll = poll;
+}
+
 void wakeup_or_interrupt_cpu_all()
 {
     cpuinfo ci = current_cpu();
     for (int i = 0; i < total_processors; i++) {
-        if (i != ci->id) {
+        if (i != ci->id)
             bitmap_set_atomic(idle_cpu_mask, i, 0);
-            send_ipi(i, wakeup_vector);
-        }
     }
+    send_ipi(TARGET_EXCLUSIVE_BROADCAST, wakeup_vector);
 }
 
-static void wakeup_cpu(u64 cpu)
+void wakeup_cpu(u64 cpu)
 {
     if (bitmap_test_and_set_atomic(idle_cpu_mask, cpu, 0)) {
+        /* a polling CPU notices that its idle bit has been cleared */
+        memory_barrier();
+        if (cpuinfo_from_id(cpu)->idle_polling)
+            return;
         sched_debug("waking up CPU %d\n", cpu);
         send_ipi(cpu, wakeup_vector);
     }
 }
 
+/* t has been taken from the thread queue of cpui to run on ci */
+static void sched_count_migration(cpuinfo ci, cpuinfo cpui, sched_task t)
+{
+    t->migrations++;
+    ci->sched_stats.migrations_in++;
+    fetch_and_add(&cpui->sched_stats.migrations_out, 1);
+}
+
+/* Isolated CPUs neither give threads to nor take threads from other CPUs, but idle isolated CPUs
+ * with runnable threads are woken up. */
 static sched_task migrate_to_self(sched_task t, u64 first_cpu, u64 ncpus)
 {
+    cpuinfo ci = current_cpu();
+    boolean pull = !cpu_is_isolated(ci->id);
     u64 cpu;
     while ((ncpus > 0) &&
             ((cpu = bitmap_range_get_first(idle_cpu_mask, first_cpu, ncpus)) != INVALID_PHYSICAL)) {
         cpuinfo cpui = cpuinfo_from_id(cpu);
-        if (t == INVALID_ADDRESS) {
+        if ((t == INVALID_ADDRESS) && pull && !cpu_is_isolated(cpu)) {
             t = sched_dequeue(&cpui->thread_queue);
-            if (t != INVALID_ADDRESS)
+            if (t != INVALID_ADDRESS) {
                 sched_debug("migrating thread from idle CPU %d to self\n", cpu);
+                sched_count_migration(ci, cpui, t);
+            }
         }
-        if ((t != INVALID_ADDRESS) && !sched_queue_empty(&cpui->thread_queue))
+        if (!sched_queue_empty(&cpui->thread_queue))
             wakeup_cpu(cpu);
         ncpus -= cpu - first_cpu + 1;
         first_cpu = cpu + 1;
@@ -89,8 +201,12 @@ static void migrate_from_self(cpuinfo ci, u64 first_cpu, u64 ncpus)
         sched_task task;
         if (!sched_queue_empty(&cpui->thread_queue)) {
             wakeup_cpu(cpu);
-        } else if ((task = sched_dequeue(&ci->thread_queue)) != INVALID_ADDRESS) {
+        } else if (!cpu_is_isolated(cpu) && !cpu_is_isolated(ci->id) &&
+                   (task = sched_dequeue(&ci->thread_queue)) != INVALID_ADDRESS) {
             sched_debug("migrating thread from self to idle CPU %d\n", cpu);
+            task->migrations++;
+            ci->sched_stats.migrations_out++;
+            fetch_and_add(&cpui->sched_stats.migrations_in, 1);
             sched_enqueue(&cpui->thread_queue, task);
             wakeup_cpu(cpu);
         }
@@ -99,13 +215,68 @@ static void migrate_from_self(cpuinfo ci, u64 first_cpu, u64 ncpus)
     }
 }
 
+static inline u8 sched_queue_rt_prio(sched_queue sq);
+
+/* Steals a task from a CPU that is running another task: a real-time task waiting behind a task of
+ * equal or higher priority is pulled first (the one with the highest priority among all CPUs),
+ * otherwise the first task found is taken. */
+static sched_task steal_busy_task(cpuinfo ci)
+{
+    u64 rt_cpu = INVALID_PHYSICAL;
+    u8 rt_prio = 0;
+    for (u64 cpu = ci->id + 1; ; cpu++) {
+        if (cpu == total_processors)
+            cpu = 0;
+        if (cpu == ci->id)
+            break;
+        cpuinfo cpui = cpuinfo_from_id(cpu);
+        if ((cpui->state == cpu_user) && !cpu_is_isolated(cpu)) {
+            u8 prio = sched_queue_rt_prio(&cpui->thread_queue);
+            if ((prio > rt_prio) && (prio <= cpui->running_prio)) {
+                rt_cpu = cpu;
+                rt_prio = prio;
+            }
+        }
+    }
+    sched_task t;
+    if (rt_cpu != INVALID_PHYSICAL) {
+        cpuinfo cpui = cpuinfo_from_id(rt_cpu);
+        t = sched_dequeue(&cpui->thread_queue);
+        if (t != INVALID_ADDRESS) {
+            sched_debug("migrating real-time thread from CPU %d to self\n", rt_cpu);
+            sched_count_migration(ci, cpui, t);
+            return t;
+        }
+    }
+    for (u64 cpu = ci->id + 1; ; cpu++) {
+        if (cpu == total_processors)
+            cpu = 0;
+        if (cpu == ci->id)
+            break;
+        cpuinfo cpui = cpuinfo_from_id(cpu);
+        if ((cpui->state == cpu_user) && !cpu_is_isolated(cpu)) {
+            t = sched_dequeue(&cpui->thread_queue);
+            if (t != INVALID_ADDRESS) {
+                sched_debug("migrating thread from CPU %d to self\n", cpu);
+                sched_count_migration(ci, cpui, t);
+                return t;
+            }
+        }
+    }
+    return INVALID_ADDRESS;
+}
+
 static inline boolean update_timer(timestamp here)
 {
     timestamp next = kernel_timers->next_expiry;
     if (!compare_and_swap_32(&kernel_timers->update, true, false))
         return false;
     s64 delta = next - here;
-    timestamp timeout = delta > (s64)kernel_timers->min ? MIN(delta, kernel_timers->max) : kernel_timers->min;
+
+    /* The scheduler quantum is enforced separately when a thread is run, so an idle CPU only
+     * needs to wake up for the next timer expiry. */
+    timestamp max = platform_timer_max ? platform_timer_max : kernel_timers->max;
+    timestamp timeout = delta > (s64)kernel_timers->min ? MIN(delta, max) : kernel_timers->min;
     sched_debug("set platform timer: delta %lx, timeout %lx\n", delta, timeout);
     current_cpu()->last_timer_update = next + timeout - delta;
     set_platform_timer(timeout);
@@ -121,21 +292,59 @@ closure_function(0, 0, void, kernel_timers_service)
 
 closure_function(0, 0, void, timer_interrupt_handler_fn)
 {
+    /* On an isolated CPU, the timer only acts as scheduler tick: hand the kernel timers over to a
+     * housekeeping CPU, in case they were being serviced here before the CPU was isolated. */
+    if (cpu_is_isolated(current_cpu()->id)) {
+        kernel_timers->update = true;
+        wakeup_cpu(housekeeping_cpu);
+        return;
+    }
     schedule_timer_service();
 }
 
+static inline void run_thunk(thunk t)
+{
+    context c = context_from_closure(t);
+    sched_debug(" run: %F state: %s context: %p\n", t, state_strings[current_cpu()->state], c);
+    if (c)
+        context_apply(c, t);
+    else
+        apply(t);
+}
+
 static inline void service_thunk_queue(queue q)
 {
     thunk t;
-    context c;
-    while ((t = dequeue(q)) != INVALID_ADDRESS) {
-        c = context_from_closure(t);
-        sched_debug(" run: %F state: %s context: %p\n", t, state_strings[current_cpu()->state], c);
-        if (c)
-            context_apply(c, t);
-        else
-            apply(t);
+    while ((t = dequeue(q)) != INVALID_ADDRESS)
+        run_thunk(t);
+}
+
+/* Runs a bounded number of thunks taken from the per-CPU queues of other CPUs, so that work
+ * enqueued on a CPU that is busy (e.g. running a long syscall) does not wait for that CPU to go
+ * back to the runloop. Returns true if any thunks have been run. */
+static boolean steal_thunks(cpuinfo ci)
+{
+    int stolen = 0;
+    for (u64 cpu = ci->id + 1; ; cpu++) {
+        if (cpu == total_processors)
+            cpu = 0;
+        if (cpu == ci->id)
+            break;
+        if (cpu_is_isolated(cpu))
+            continue;
+        cpuinfo cpui = cpuinfo_from_id(cpu);
+        thunk t;
+        while ((stolen < SCHED_STEAL_BATCH) &&
+               (((t = dequeue(cpui->bhqueue)) != INVALID_ADDRESS) ||
+                ((t = dequeue(cpui->runqueue)) != INVALID_ADDRESS))) {
+            sched_debug("stealing thunk %F from CPU %d\n", t, cpu);
+            run_thunk(t);
+            stolen++;
+        }
+        if (stolen == SCHED_STEAL_BATCH)
+            break;
     }
+    return (stolen > 0);
 }
 
 static inline void service_async_1(queue q)
@@ -151,16 +360,39 @@ static inline void service_async_1(queue q)
     }
 }
 
+static void sched_count_run(cpuinfo ci, sched_task t, timestamp here)
+{
+    timestamp wait = (here > t->enqueued) ? here - t->enqueued : 0;
+    u64 ns = nsec_from_timestamp(wait);
+    int bucket = (ns >> SCHED_WAIT_MIN_ORDER) ? msb(ns) + 1 - SCHED_WAIT_MIN_ORDER : 0;
+    t->enqueued = 0;
+    t->wait_time += wait;
+    t->runs++;
+    sched_cpu_stats stats = &ci->sched_stats;
+    stats->runs++;
+    stats->wait_time += wait;
+    stats->wait_hist[MIN(bucket, SCHED_WAIT_BUCKETS - 1)]++;
+}
+
 NOTRACE void __attribute__((noreturn)) runloop_internal(void)
 {
     cpuinfo ci = current_cpu();
 
     disable_interrupts();
-    sched_debug("runloop from %s c: %d  a1: %d b:%d  r:%d  t:%d\n",
+    sched_debug("runloop from %s c: %d  a1: %d b:%d/%d  r:%d/%d  t:%d\n",
                 state_strings[ci->state], queue_length(ci->cpu_queue),
-                queue_length(async_queue_1), queue_length(bhqueue),
-                queue_length(runqueue), sched_queue_length(&ci->thread_queue));
+                queue_length(async_queue_1), queue_length(ci->bhqueue), queue_length(bhqueue),
+                queue_length(ci->runqueue), queue_length(runqueue),
+                sched_queue_length(&ci->thread_queue));
     ci->state = cpu_kernel;
+    if (ci->sched_stats.idle_start) {
+        timestamp idle = now(CLOCK_ID_MONOTONIC_RAW) - ci->sched_stats.idle_start;
+        ci->sched_stats.idle_time += idle;
+        ci->sched_stats.idle_start = 0;
+        ci->idle_polling = false;
+        if (idle_poll_max)
+            idle_poll_adjust(ci, idle);
+    }
     /* Make sure TLB entries are appropriately flushed before doing any work */
     page_invalidate_flush();
 
@@ -169,22 +401,39 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
     service_thunk_queue(ci->cpu_queue);
 
     /* bhqueue is for deferred operations, enqueued by interrupt handlers */
+    service_thunk_queue(ci->bhqueue);
     service_thunk_queue(bhqueue);
 
     /* serve deferred status_handlers, some of which may not return */
     service_async_1(async_queue_1);
 
+    service_thunk_queue(ci->runqueue);
     service_thunk_queue(runqueue);
 
+    boolean isolated = cpu_is_isolated(ci->id);
+    boolean stolen = !isolated && queue_empty(ci->bhqueue) && queue_empty(ci->runqueue) &&
+            steal_thunks(ci);
+
     /* should be a list of per-runloop checks - also low-pri background */
     mm_service(false);
 
     timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
-    boolean timer_updated = update_timer(here);
+    boolean timer_updated;
+    if (isolated) {
+        /* leave the kernel timers to a housekeeping CPU */
+        timer_updated = false;
+        if (kernel_timers->update)
+            wakeup_cpu(housekeeping_cpu);
+    } else {
+        timer_updated = update_timer(here);
+    }
 
     if (!(shutting_down & SHUTDOWN_ONGOING)) {
-        sched_task t = sched_dequeue(&ci->thread_queue);
-        if (t == INVALID_ADDRESS) {
+        sched_task t = ci->switch_to;
+        if (t) {
+            /* direct switch: the task has not been enqueued */
+            ci->switch_to = 0;
+        } else if ((t = sched_dequeue(&ci->thread_queue)) == INVALID_ADDRESS) {
             /* Try to steal a thread from an idle CPU (so that it doesn't
              * have to be woken up), and wake up CPUs that have a non-empty
              * thread queue). */
@@ -192,23 +441,10 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
                 t = migrate_to_self(t, ci->id + 1, total_processors - ci->id - 1);
             if (ci->id > 0)
                 t = migrate_to_self(t, 0, ci->id);
-            if (t == INVALID_ADDRESS) {
+            if ((t == INVALID_ADDRESS) && !isolated) {
                 /* No threads found in idle CPUs: try to steal a thread from a
                  * CPU that is currently running another thread. */
-                for (u64 cpu = ci->id + 1; ; cpu++) {
-                    if (cpu == total_processors)
-                        cpu = 0;
-                    if (cpu == ci->id)
-                        break;
-                    cpuinfo cpui = cpuinfo_from_id(cpu);
-                    if (cpui->state == cpu_user) {
-                        t = sched_dequeue(&cpui->thread_queue);
-                        if (t != INVALID_ADDRESS) {
-                            sched_debug("migrating thread from CPU %d to self\n", cpu);
-                            break;
-                        }
-                    }
-                }
+                t = steal_busy_task(ci);
             }
         } else {
             /* Wake up idle CPUs that have a non-empty thread queue, and if our
@@ -218,33 +454,46 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
             if (ci->id > 0)
                 migrate_from_self(ci, 0, ci->id);
         }
+        /* An isolated CPU runs a thread with nothing else to schedule without a timer tick, and a
+         * FIFO real-time thread runs without a timer tick. */
         if (t != INVALID_ADDRESS) {
-            if (!timer_updated) {
+            timestamp quantum = sched_task_quantum(t);
+            boolean queue_empty = sched_queue_empty(&ci->thread_queue);
+            if (!timer_updated && quantum && !(isolated && queue_empty)) {
                 /* Before we schedule a thread on this CPU, we want to be sure
-                   that a timer will fire on this core within the interval
-                   kernel_timers->max into the future. Taking the place of a
-                   true time quantum per thread, this acts to prevent a thread
-                   from running for too long and starving out other threads. */
+                   that a timer will fire on this core within the time quantum
+                   of the thread (or the interval kernel_timers->max if no other
+                   threads are waiting). This prevents a thread from running for
+                   too long and starving out other threads. */
+                quantum = queue_empty ? kernel_timers->max : MIN(quantum, kernel_timers->max);
                 s64 timeout = ci->last_timer_update - here;
-                if (kernel_timers->empty || (timeout > (s64)kernel_timers->max)) {
+                if (kernel_timers->empty || (timeout > (s64)quantum)) {
                     sched_debug("setting CPU scheduler timer\n");
-                    set_platform_timer(kernel_timers->max);
-                    ci->last_timer_update = here + kernel_timers->max;
+                    set_platform_timer(quantum);
+                    ci->last_timer_update = here + quantum;
                 }
             }
+            ci->running_prio = t->rt_prio;
+            sched_count_run(ci, t, here);
             apply(t->t);
         }
     }
 
     /* We want to pick up items that were enqueued during this last pass, else
-       runnable items may get stuck waiting for the next interrupt.
+       runnable items may get stuck waiting for the next interrupt. If thunks
+       have been stolen from other CPUs, more might be available.
 
        Find cost of sleep / wakeup and consider spinning this check for that interval. */
-    if (queue_length(ci->cpu_queue) || queue_length(async_queue_1) ||
-        queue_length(bhqueue) || queue_length(runqueue) ||
+    if (stolen || queue_length(ci->cpu_queue) || queue_length(async_queue_1) ||
+        queue_length(ci->bhqueue) || queue_length(bhqueue) ||
+        queue_length(ci->runqueue) || queue_length(runqueue) ||
         (!(shutting_down & SHUTDOWN_ONGOING) && !sched_queue_empty(&ci->thread_queue)))
         goto retry;
 
+    /* Do a step of idle work (if any) and then look for new work before doing the next step. */
+    if (idle_work && !isolated && !(shutting_down & SHUTDOWN_ONGOING) && apply(idle_work))
+        goto retry;
+
     kernel_sleep();
 }
 
@@ -282,53 +531,401 @@ void init_scheduler(heap h)
     async_queue_1 = allocate_queue(h, ASYNC_QUEUE_1_SIZE);
 }
 
+/* The isolated_cpus option (array of CPU numbers) reserves CPUs for dedicated work such as
+ * polling I/O queues or running latency-sensitive threads: isolated CPUs are excluded from load
+ * balancing (threads run there only if placed via sched_setaffinity()), do not share thunks with
+ * other CPUs, are not default interrupt targets, and leave kernel timers and idle work to the
+ * other (housekeeping) CPUs. */
+static void config_isolated_cpus(value v)
+{
+    if (!is_composite(v)) {
+        msg_err("invalid isolated_cpus value\n");
+        return;
+    }
+    heap h = heap_locked(get_kernel_heaps());
+    bitmap mask = allocate_bitmap(h, h, present_processors);
+    assert(mask != INVALID_ADDRESS);
+    u64 cpu;
+    for (int i = 0; get_u64(v, intern_u64(i), &cpu); i++) {
+        if (cpu >= present_processors) {
+            msg_err("invalid isolated CPU %ld\n", cpu);
+            goto error;
+        }
+        bitmap_set(mask, cpu, 1);
+    }
+    for (cpu = 0; (cpu < total_processors) && bitmap_get(mask, cpu); cpu++);
+    if (cpu == total_processors) {
+        msg_err("isolated_cpus: no housekeeping CPU left\n");
+        goto error;
+    }
+    housekeeping_cpu = cpu;
+    write_barrier();
+    isolated_cpu_mask = mask;
+    return;
+  error:
+    deallocate_bitmap(mask);
+}
+
+/* The wake_affine option selects the placement of woken tasks ("off", "idle" or "waker", the
+ * default: see sched_wakeup()). The idle_poll option sets the maximum halt polling interval in
+ * microseconds (disabled by default, as polling takes CPU time away from other guests). */
+void config_scheduler(tuple root)
+{
+    value v = get(root, sym(isolated_cpus));
+    if (v)
+        config_isolated_cpus(v);
+    string s = get_string(root, sym(wake_affine));
+    if (s) {
+        if (!buffer_strcmp(s, "off"))
+            wake_policy = SCHED_WAKE_PREV;
+        else if (!buffer_strcmp(s, "idle"))
+            wake_policy = SCHED_WAKE_IDLE;
+        else if (!buffer_strcmp(s, "waker"))
+            wake_policy = SCHED_WAKE_WAKER;
+        else
+            msg_err("invalid wake_affine value\n");
+    }
+    v = get(root, sym(idle_poll));
+    if (!v)
+        return;
+    u64 us;
+    if (!u64_from_value(v, &us))
+        msg_err("invalid idle_poll value\n");
+    else
+        idle_poll_max = microseconds(us);
+}
+
+/* Returns the CPU to run a polling task, chosen in round-robin among online isolated CPUs, or -1
+ * if there are none. */
+int sched_poll_cpu(void)
+{
+    if (!isolated_cpu_mask)
+        return -1;
+    for (u64 i = 0; i < total_processors; i++) {
+        u64 cpu = fetch_and_add(&poll_cpu_next, 1) % total_processors;
+        if (cpu_is_isolated(cpu))
+            return cpu;
+    }
+    return -1;
+}
+
+void sched_set_idle_work(idle_work_handler h)
+{
+    idle_work = h;
+}
+
 void init_scheduler_cpus(heap h)
 {
     idle_cpu_mask = allocate_bitmap(h, h, present_processors);
     assert(idle_cpu_mask != INVALID_ADDRESS);
     bitmap_alloc(idle_cpu_mask, present_processors);
+    assert(timerqueue_init_wheels(kernel_timers, present_processors));
+}
+
+/* Weights of fair tasks by nice value (from -20 to 19): each nice level changes the CPU share of
+ * a task relative to other tasks by about 10%. */
+static const u32 sched_nice_weights[] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45, 36, 29, 23, 18, 15,
+};
+
+void sched_task_init(sched_task task, thunk t)
+{
+    zero(task, sizeof(*task));
+    task->t = t;
+    task->sched_class = SCHED_CLASS_FAIR;
+    task->weight = SCHED_WEIGHT_DEFAULT;
+}
+
+/* Changes to the scheduling parameters of a task take effect the next time it is enqueued. */
+void sched_task_set_nice(sched_task task, int nice)
+{
+    nice = MAX(MIN(nice, 19), -20);
+    task->nice = nice;
+    task->weight = sched_nice_weights[nice + 20];
+}
+
+void sched_task_set_class(sched_task task, enum sched_class class, u8 rt_prio)
+{
+    task->sched_class = class;
+    task->rt_prio = (class == SCHED_CLASS_FAIR) ? 0 : MAX(MIN(rt_prio, SCHED_RT_PRIO_MAX), 1);
+}
+
+static inline timestamp sched_task_slice(sched_task task)
+{
+    return task->slice ? task->slice : microseconds(SCHED_SLICE_DEFAULT_US);
+}
+
+/* Returns the longest interval a task can run before being preempted, or 0 if it is not
+ * time-sliced (FIFO class). */
+timestamp sched_task_quantum(sched_task task)
+{
+    switch (task->sched_class) {
+    case SCHED_CLASS_FIFO:
+        return 0;
+    case SCHED_CLASS_RR:
+        return microseconds(SCHED_RR_INTERVAL_US);
+    default:
+        return sched_task_slice(task);
+    }
+}
+
+/* virtual time corresponding to a CPU time of a fair task */
+static inline s64 sched_vtime(sched_task task, timestamp t)
+{
+    return t * SCHED_WEIGHT_DEFAULT / task->weight;
 }
 
 static boolean sched_sort(void *a, void *b)
 {
     sched_task ta = a, tb = b;
-    return (ta->runtime > tb->runtime);
+    return ((s64)(ta->deadline - tb->deadline) > 0);
 }
 
 boolean sched_queue_init(sched_queue sq, heap h)
 {
-    sq->q = allocate_pqueue(h, sched_sort);
+    sq->q = allocate_pqueue_dary(h, sched_sort, 2);
     if (sq->q == INVALID_ADDRESS)
         return false;
-    sq->min_runtime = 0;
+    sq->vtime = 0;
+    sq->rt_count = 0;
+    zero(sq->rt_mask, sizeof(sq->rt_mask));
+    for (int i = 0; i <= SCHED_RT_PRIO_MAX; i++)
+        list_init(&sq->rt[i]);
     spin_lock_init(&sq->lock);
     return true;
 }
 
+/* Returns the highest priority of the enqueued real-time tasks (0 if none); called without the
+ * queue lock by load balancing, as a hint. */
+static inline u8 sched_queue_rt_prio(sched_queue sq)
+{
+    u64 high = sq->rt_mask[1];
+    if (high)
+        return 64 + msb(high);
+    u64 low = sq->rt_mask[0];
+    return low ? msb(low) : 0;
+}
+
+/* EEVDF-style placement of fair tasks: a task becomes eligible when the virtual time of the queue
+ * reaches its eligible time (the queue virtual time minus the lag of the task), and tasks are
+ * picked in order of virtual deadline (the eligible time plus the requested slice, scaled by the
+ * inverse of the task weight), so that tasks requesting shorter slices run sooner, and all tasks
+ * receive CPU time in proportion to their weight. The lag carried by a task is bounded by its
+ * slice, so that a task can neither accumulate credit (e.g. while sleeping) nor debt. */
+static void sched_fair_place(sched_queue sq, sched_task task)
+{
+    s64 slice = sched_vtime(task, sched_task_slice(task));
+    s64 lag = task->lag - sched_vtime(task, task->runtime);
+    lag = MAX(MIN(lag, slice), -slice);
+    task->lag = lag;
+    task->eligible = sq->vtime - lag;
+    task->deadline = task->eligible + slice;
+    pqueue_insert(sq->q, task);
+}
+
+/* Tasks with real-time priority are kept in per-priority FIFO lists, with a bitmap of non-empty
+ * lists, so that both enqueue and dequeue take constant time. */
 void sched_enqueue(sched_queue sq, sched_task task)
 {
     spin_lock(&sq->lock);
-    sched_debug("sq %p, enqueuing task %p, runtime %T\n", sq, task, task->runtime);
-    task->runtime += sq->min_runtime;
-    pqueue_insert(sq->q, task);
+    sched_debug("sq %p, enqueuing task %p, class %d, runtime %T\n", sq, task, task->sched_class,
+                task->runtime);
+    if (!task->enqueued)    /* keep the original time if migrating between queues */
+        task->enqueued = now(CLOCK_ID_MONOTONIC_RAW);
+    u8 prio = task->rt_prio;
+    if (prio) {
+        list_push_back(&sq->rt[prio], &task->l);
+        sq->rt_mask[prio / 64] |= U64_FROM_BIT(prio % 64);
+        sq->rt_count++;
+    } else {
+        sched_fair_place(sq, task);
+    }
+    task->runtime = 0;
     spin_unlock(&sq->lock);
+
+    /* Isolated CPUs are not woken up by load balancing and may be running a thread without timer
+     * tick, and a real-time task must preempt a lower-priority task: notify the target CPU
+     * directly. */
+    cpuinfo ci = struct_from_field(sq, cpuinfo, thread_queue);
+    if (ci == current_cpu())
+        return;
+    if (cpu_is_isolated(ci->id)) {
+        if (ci->state == cpu_user)
+            send_ipi(ci->id, wakeup_vector);
+        else
+            wakeup_cpu(ci->id);
+    } else if (prio && (ci->state == cpu_user) && (ci->running_prio < prio)) {
+        send_ipi(ci->id, wakeup_vector);
+    }
 }
 
 sched_task sched_dequeue(sched_queue sq)
 {
     spin_lock(&sq->lock);
-    sched_task task = pqueue_pop(sq->q);
-    if (task != INVALID_ADDRESS) {
-        sched_debug("sq %p, dequeued task %p, runtime %T\n", sq, task,
-                    task->runtime - sq->min_runtime);
-        sq->min_runtime = task->runtime;
-        task->runtime = 0;
+    sched_task task;
+    if (sq->rt_count) {
+        u8 prio = sched_queue_rt_prio(sq);
+        struct list *l = list_get_next(&sq->rt[prio]);
+        list_delete(l);
+        if (list_empty(&sq->rt[prio]))
+            sq->rt_mask[prio / 64] &= ~U64_FROM_BIT(prio % 64);
+        sq->rt_count--;
+        task = struct_from_list(l, sched_task, l);
+        sched_debug("sq %p, dequeued task %p, priority %d\n", sq, task, prio);
+    } else {
+        task = pqueue_pop(sq->q);
+        if (task != INVALID_ADDRESS) {
+            sched_debug("sq %p, dequeued task %p, lag %ld\n", sq, task, task->lag);
+
+            /* The queue virtual time advances to the eligible time of the picked task (if not
+             * already past it): the tasks left in the queue gain the corresponding lag. */
+            if ((s64)(task->eligible - sq->vtime) > 0)
+                sq->vtime = task->eligible;
+            task->lag = sq->vtime - task->eligible;
+        }
     }
     spin_unlock(&sq->lock);
     return task;
 }
 
+/* Returns the first idle CPU in [first_cpu, first_cpu + ncpus) that is in the given NUMA node and
+ * allowed by the affinity bitmap, or INVALID_PHYSICAL. */
+static u64 sched_idle_sibling(u64 first_cpu, u64 ncpus, int node, bitmap affinity)
+{
+    u64 cpu;
+    while ((ncpus > 0) &&
+            ((cpu = bitmap_range_get_first(idle_cpu_mask, first_cpu, ncpus)) != INVALID_PHYSICAL)) {
+        if (!cpu_is_isolated(cpu) && (numa_cpu_node(cpu) == node) && bitmap_get(affinity, cpu))
+            return cpu;
+        ncpus -= cpu - first_cpu + 1;
+        first_cpu = cpu + 1;
+    }
+    return INVALID_PHYSICAL;
+}
+
+/* Enqueues a task being made runnable, which last ran on the CPU of the prev queue. When woken
+ * up by another CPU, the task stays on its previous CPU if idle (so that it finds a warm cache),
+ * and is otherwise moved, depending on the wake-affine policy, to the waker CPU (which has just
+ * touched the data the task is woken up for) or to an idle CPU near the waker. Isolated CPUs are
+ * never a source or destination of these moves. */
+void sched_wakeup(sched_queue prev, bitmap affinity, sched_task task)
+{
+    cpuinfo ci = current_cpu();
+    cpuinfo prev_ci = struct_from_field(prev, cpuinfo, thread_queue);
+    if ((prev_ci == ci) || (wake_policy == SCHED_WAKE_PREV)) {
+        sched_enqueue(prev, task);
+        return;
+    }
+    sched_cpu_stats stats = &ci->sched_stats;
+    stats->wakeups++;
+    u64 cpu = prev_ci->id;
+    if (!bitmap_get(idle_cpu_mask, cpu) && !cpu_is_isolated(cpu) && !cpu_is_isolated(ci->id)) {
+        if ((wake_policy == SCHED_WAKE_WAKER) && sched_queue_empty(&ci->thread_queue) &&
+            bitmap_get(affinity, ci->id)) {
+            sched_debug("waking task %p on waker CPU (previous CPU %d)\n", task, cpu);
+            stats->wake_local++;
+            task->migrations++;
+            sched_enqueue(&ci->thread_queue, task);
+            return;
+        }
+        int node = numa_cpu_node(ci->id);
+        u64 sibling = sched_idle_sibling(ci->id + 1, total_processors - ci->id - 1, node, affinity);
+        if (sibling == INVALID_PHYSICAL)
+            sibling = sched_idle_sibling(0, ci->id, node, affinity);
+        if (sibling != INVALID_PHYSICAL) {
+            sched_debug("waking task %p on idle CPU %d (previous CPU %d)\n", task, sibling, cpu);
+            stats->wake_idle++;
+            task->migrations++;
+            cpu = sibling;
+        }
+    }
+    sched_enqueue(&cpuinfo_from_id(cpu)->thread_queue, task);
+    wakeup_cpu(cpu);
+}
+
 u64 sched_queue_length(sched_queue sq)
 {
-    return pqueue_length(sq->q);
+    return pqueue_length(sq->q) + sq->rt_count;
+}
+
+static struct {
+    tuple *values;          /* per-CPU management tuples, allocated on access */
+    struct spinlock lock;
+} sched_mgmt;
+
+/* returns the management tuple of a CPU, updated with the current statistics */
+static tuple sched_cpu_value(u64 cpu)
+{
+    sched_cpu_stats stats = &cpuinfo_from_id(cpu)->sched_stats;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    timestamp idle_start = stats->idle_start;
+    timestamp idle = stats->idle_time + (idle_start && (here > idle_start) ? here - idle_start : 0);
+    timestamp busy = (here > idle) ? here - idle : 0;
+    spin_lock(&sched_mgmt.lock);
+    tuple t = sched_mgmt.values[cpu];
+    if (!t) {
+        t = allocate_tuple();
+        assert(t != INVALID_ADDRESS);
+        set(t, sym(wait_latency), allocate_tuple());
+        sched_mgmt.values[cpu] = t;
+    }
+    set(t, sym(runs), value_from_u64(stats->runs));
+    set(t, sym(migrations_in), value_from_u64(stats->migrations_in));
+    set(t, sym(migrations_out), value_from_u64(stats->migrations_out));
+    set(t, sym(wakeups), value_from_u64(stats->wakeups));
+    set(t, sym(wake_local), value_from_u64(stats->wake_local));
+    set(t, sym(wake_idle), value_from_u64(stats->wake_idle));
+    set(t, sym(wait_nsecs), value_from_u64(nsec_from_timestamp(stats->wait_time)));
+    set(t, sym(idle_nsecs), value_from_u64(nsec_from_timestamp(idle)));
+    set(t, sym(busy_nsecs), value_from_u64(nsec_from_timestamp(busy)));
+    set(t, sym(busy_percent), value_from_u64(here ? busy * 100 / here : 0));
+    tuple hist = get_tuple(t, sym(wait_latency));
+    for (int i = 0; i < SCHED_WAIT_BUCKETS; i++) {
+        if (stats->wait_hist[i])
+            set(hist, intern_u64(i ? U64_FROM_BIT(SCHED_WAIT_MIN_ORDER + i - 1) : 0),
+                value_from_u64(stats->wait_hist[i]));
+    }
+    spin_unlock(&sched_mgmt.lock);
+    return t;
+}
+
+closure_func_basic(tuple_get, value, sched_stats_get,
+                   value a)
+{
+    u64 cpu;
+    if (!u64_from_attribute(a, &cpu) || (cpu >= total_processors))
+        return 0;
+    return sched_cpu_value(cpu);
+}
+
+closure_func_basic(tuple_set, void, sched_stats_set,
+                   value a, value v)
+{
+    /* read-only */
+}
+
+closure_func_basic(tuple_iterate, boolean, sched_stats_iterate,
+                   binding_handler h)
+{
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        if (!apply(h, intern_u64(cpu), sched_cpu_value(cpu)))
+            return false;
+    }
+    return true;
+}
+
+/* Exposes the per-CPU scheduler statistics, keyed by CPU number, in the management tree */
+value sched_management(heap h)
+{
+    sched_mgmt.values = allocate_zero(h, present_processors * sizeof(tuple));
+    assert(sched_mgmt.values != INVALID_ADDRESS);
+    spin_lock_init(&sched_mgmt.lock);
+    tuple ft = allocate_function_tuple(closure_func(h, tuple_get, sched_stats_get),
+                                       closure_func(h, tuple_set, sched_stats_set),
+                                       closure_func(h, tuple_iterate, sched_stats_iterate));
+    assert(ft != INVALID_ADDRESS);
+    return ft;
 }
@@ -0,0 +1,61 @@
+/* VM snapshot support
+ *
+ * The hypervisor takes snapshots of the whole VM (memory and device state) while its vCPUs are
+ * paused, and may restore a snapshot any number of times, possibly on a different host. The
+ * kernel does not take part in saving state, but is notified of each restore (e.g. via the ACPI
+ * VM generation ID device), so that state which must not be shared between restored instances,
+ * or which has become stale while the VM was not running, is renewed:
+ * - the random number generator is reseeded from fresh hardware entropy
+ * - the real-time clock is resynchronized with the host (by the platform clock code)
+ * - network interfaces announce their addresses and revalidate DHCP leases
+ * Subsystems register the actions to be run on restore with snapshot_register_resume(); actions
+ * run in a kernel context, in the order in which they were registered.
+ */
+#include <kernel.h>
+
+static struct {
+    vector handlers;
+    u64 generation;
+    struct spinlock lock;
+    closure_struct(thunk, resume);
+} snapshot;
+
+void snapshot_register_resume(thunk handler)
+{
+    spin_lock(&snapshot.lock);
+    if (!snapshot.handlers) {
+        snapshot.handlers = allocate_vector(heap_locked(get_kernel_heaps()), 4);
+        assert(snapshot.handlers != INVALID_ADDRESS);
+    }
+    vector_push(snapshot.handlers, handler);
+    spin_unlock(&snapshot.lock);
+}
+
+closure_func_basic(thunk, void, snapshot_resume)
+{
+    rprintf("snapshot restore detected (generation %ld)\n", snapshot.generation);
+    random_reseed();
+    spin_lock(&snapshot.lock);
+    vector handlers = snapshot.handlers;
+    spin_unlock(&snapshot.lock);
+    if (handlers) {
+        thunk h;
+        vector_foreach(handlers, h)
+            apply(h);
+    }
+
+    /* let all CPUs re-evaluate their timers against the current time */
+    wakeup_or_interrupt_cpu_all();
+}
+
+/* Called by the platform when the VM has been restored from a snapshot */
+void snapshot_resumed(void)
+{
+    fetch_and_add(&snapshot.generation, 1);
+    async_apply(init_closure_func(&snapshot.resume, thunk, snapshot_resume));
+}
+
+u64 snapshot_generation(void)
+{
+    return snapshot.generation;
+}
@@ -9,6 +9,9 @@
 #include <symtab.h>
 #include <virtio/virtio.h>
 #include <elf64.h>
+#ifdef CONFIG_KPROBES
+#include <kprobe.h>
+#endif
 
 closure_function(3, 1, void, program_start,
                  process, kp, string, path, boolean, exec_started,
@@ -33,6 +36,9 @@ closure_function(3, 1, void, program_start,
                      &bss_ro_after_init_end - &bss_ro_after_init_start,
                      pageflags_memory());
     bound(exec_started) = true;
+    boot_phase(ss("program start"));
+    if (trace_get_flags(get(get_root_tuple(), sym(trace))) & TRACE_BOOT)
+        boot_phases_print();
     exec_elf(bound(kp), bound(path), (status_handler)closure_self());
 }
 
@@ -57,17 +63,24 @@ closure_function(6, 0, void, startup,
     kernel_heaps kh = bound(kh);
     tuple root = bound(root);
     filesystem fs = bound(fs);
+    boot_phase(ss("stage3"));
 
 #ifdef CONFIG_TRACELOG
     init_tracelog_config(root);
 #endif
 
+    /* Configure network interfaces first, so that address acquisition (e.g. DHCP) overlaps with
+       the rest of the initialization. */
+    init_network_iface(root, bound(m));
+    boot_phase(ss("network configured"));
+
     /* kernel process is used as a handle for unix */
     process kp = init_unix(kh, root, fs);
     if (kp == INVALID_ADDRESS) {
 	s = timm("result", "unable to initialize unix instance");
         goto out;
     }
+    boot_phase(ss("unix"));
     status_handler start = bound(start);
     closure_member(program_start, start, kp) = kp;
     heap general = heap_locked(kh);
@@ -75,15 +88,23 @@ closure_function(6, 0, void, startup,
     /* register root tuple with management and kick off interfaces, if any */
     init_management_root(root);
     init_kernel_heaps_management(root);
+    init_pagecache_config(root);
+    set(root, sym(pagecache), pagecache_management());
+    set(root, sym(sched), sched_management(general));
+    set(root, sym(memory), mem_accounts_management(general));
+    set(root, sym(reclaim), mm_reclaim_management(general));
+#ifdef CONFIG_KPROBES
+    set(root, sym(kprobes), kprobe_management(general));
+#endif
     if (get(root, sym(readonly_rootfs)))
         filesystem_set_readonly(fs);
+    init_pagecache_warm(root);
     value p = get(root, sym(program));
     assert(p && is_string(p));
     tuple pro = resolve_path(filesystem_getroot(fs), split(general, p, '/'));
     if (!pro)
         halt("unable to resolve program path \"%b\"\n", p);
     program_set_perms(root, pro);
-    init_network_iface(root, bound(m));
     closure_member(program_start, start, path) = (string)p;
     if (trace_get_flags(get(root, sym(trace))) & TRACE_OTHER) {
         rprintf("read program complete: %p ", root);
@@ -103,23 +124,33 @@ thunk create_init(kernel_heaps kh, tuple root, filesystem fs, merge *m)
     return closure(h, startup, kh, root, fs, *m, start, apply_merge(*m));
 }
 
-closure_function(5, 1, status, kernel_read_complete,
-                 kernel_heaps, kh, filesystem, fs, filesystem, klib_fs, status_handler, klibs_complete, tuple, root,
+closure_function(2, 1, status, kernel_read_complete,
+                 filesystem, fs, filesystem, klib_fs,
                  buffer b)
 {
     add_elf_syms(b, kas_kern_offset);
     deallocate_buffer(b);
+    klib_kernel_syms_ready();
     filesystem fs = bound(fs);
-    filesystem klib_fs = bound(klib_fs);
-    status_handler klibs_complete = bound(klibs_complete);
-    if (klibs_complete)
-        init_klib(bound(kh), klib_fs, bound(root), klibs_complete);
-    if (fs != klib_fs)
+    if (fs != bound(klib_fs))
         destroy_filesystem(fs);
     closure_finish();
     return STATUS_OK;
 }
 
+closure_function(2, 1, void, kernel_read_failed,
+                 filesystem, fs, filesystem, klib_fs,
+                 status s)
+{
+    msg_err("failed to read kernel symbols: %v\n", s);
+    timm_dealloc(s);
+    klib_kernel_syms_ready();
+    filesystem fs = bound(fs);
+    if (fs != bound(klib_fs))
+        destroy_filesystem(fs);
+    closure_finish();
+}
+
 closure_function(5, 2, void, bootfs_complete,
                  kernel_heaps, kh, tuple, root, status_handler, klibs_complete, boolean, klibs_in_bootfs, boolean, ingest_kernel_syms,
                  filesystem fs, status s)
@@ -127,22 +158,23 @@ closure_function(5, 2, void, bootfs_complete,
     tuple boot_root = filesystem_getroot(fs);
     tuple c = children(boot_root);
     assert(c);
-    tuple root = bound(root);
+    kernel_heaps kh = bound(kh);
     filesystem klib_fs = bound(klibs_in_bootfs) ? fs : get_root_fs();
     status_handler klibs_complete = bound(klibs_complete);
+    tuple v = bound(ingest_kernel_syms) ? get_tuple(c, sym(kernel)) : 0;
 
-    if (bound(ingest_kernel_syms)) {
-        tuple v = get_tuple(c, sym(kernel));
-        if (v) {
-            kernel_heaps kh = bound(kh);
-            filesystem_read_entire(fs, v, (heap)heap_page_backed(kh),
-                                   closure(heap_locked(kh), kernel_read_complete, kh, fs, klib_fs,
-                                           klibs_complete, root),
-                                   ignore_status);
-        }
-    } else {
-        init_klib(bound(kh), klib_fs, root, klibs_complete);
+    /* Klib files are read (and decompressed, if stored as such) while the kernel symbols are
+     * ingested; klibs are linked after that. */
+    if (v) {
+        heap h = heap_locked(kh);
+        if (klibs_complete)
+            klib_wait_kernel_syms(kh);
+        filesystem_read_entire(fs, v, (heap)heap_page_backed(kh),
+                               closure(h, kernel_read_complete, fs, klib_fs),
+                               closure(h, kernel_read_failed, fs, klib_fs));
     }
+    if (klibs_complete)
+        init_klib(kh, klib_fs, bound(root), klibs_complete);
     closure_finish();
 }
 
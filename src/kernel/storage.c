@@ -202,15 +202,442 @@ define_closure_function(2, 1, void, storage_simple_req_handler,
     case STORAGE_OP_WRITE:
         apply(bound(write), req->data, req->blocks, req->completion);
         break;
+    default:
+        storage_req_unsupported(req);
     }
 }
 
+/* Completes a request whose operation is not supported by the device; the caller is expected to
+ * either do without the operation (discard) or fall back to regular I/O (write zeroes). */
+void storage_req_unsupported(storage_req req)
+{
+    async_apply_status_handler(req->completion,
+                               timm("result", "unsupported storage operation %d", req->op));
+}
+
 storage_req_handler storage_init_req_handler(closure_ref(storage_simple_req_handler, handler),
                                              block_io read, block_io write)
 {
     return init_closure(handler, storage_simple_req_handler, read, write);
 }
 
+/* Plug/merge stage: scatter-gather requests are held in a per-handler batch
+   until the queued unplug thunk runs, and a request that continues the batch
+   (same direction, starting at the block where the batch ends) has its buffers
+   appended to it, so that runs of adjacent requests (e.g. sequential page
+   writeback) reach the driver as a single request. Any other request submits
+   the pending batch first, which preserves submission order. */
+typedef struct storage_plug_batch {
+    closure_struct(status_handler, complete);
+    heap h;
+    u8 op;
+    range blocks;
+    sg_list sg;
+    int count;
+    status_handler completions[STORAGE_PLUG_MAX_REQS];
+} *storage_plug_batch;
+
+typedef struct storage_plug {
+    closure_struct(storage_req_handler, handler);
+    closure_struct(thunk, unplug);
+    heap h;
+    storage_req_handler target;
+    struct spinlock lock;
+    storage_plug_batch batch;
+    boolean unplug_queued;
+} *storage_plug;
+
+closure_func_basic(status_handler, void, storage_plug_batch_complete,
+                   status s)
+{
+    storage_plug_batch b = struct_from_field(closure_self(), storage_plug_batch, complete);
+    storage_debug("%s: batch %p, %d requests", func_ss, b, b->count);
+    u64 flags = irq_disable_save();
+    current_cpu()->storage_completions++;
+    irq_restore(flags);
+    sg_list_release(b->sg);
+    deallocate_sg_list(b->sg);
+
+    /* each completion owns its status */
+    for (int i = 1; i < b->count; i++)
+        apply(b->completions[i], is_ok(s) ? STATUS_OK : timm_clone(s));
+    apply(b->completions[0], s);
+    deallocate(b->h, b, sizeof(*b));
+}
+
+static void storage_plug_submit(storage_plug p, storage_plug_batch b)
+{
+    storage_debug("%s: op %d, blocks %R, %d requests", func_ss, b->op, b->blocks, b->count);
+    struct storage_req req = {
+        .op = b->op,
+        .blocks = b->blocks,
+        .data = b->sg,
+        .completion = (status_handler)&b->complete,
+    };
+    u64 flags = irq_disable_save();
+    current_cpu()->storage_reqs++;
+    irq_restore(flags);
+    apply(p->target, &req);
+}
+
+static storage_plug_batch storage_plug_take_batch(storage_plug p)
+{
+    u64 flags = spin_lock_irq(&p->lock);
+    storage_plug_batch b = p->batch;
+    p->batch = 0;
+    spin_unlock_irq(&p->lock, flags);
+    return b;
+}
+
+closure_func_basic(thunk, void, storage_unplug)
+{
+    storage_plug p = struct_from_field(closure_self(), storage_plug, unplug);
+    u64 flags = spin_lock_irq(&p->lock);
+    storage_plug_batch b = p->batch;
+    p->batch = 0;
+    p->unplug_queued = false;
+    spin_unlock_irq(&p->lock, flags);
+    if (b)
+        storage_plug_submit(p, b);
+}
+
+static boolean storage_plug_mergeable(storage_plug_batch b, storage_req req)
+{
+    return (b->op == req->op) && (b->blocks.end == req->blocks.start) &&
+        (b->count < STORAGE_PLUG_MAX_REQS) &&
+        (range_span(b->blocks) + range_span(req->blocks) <= STORAGE_PLUG_MAX_BLOCKS);
+}
+
+static boolean storage_plug_sg(storage_plug p, storage_req req)
+{
+    storage_plug_batch prev = 0;
+    boolean queue_unplug = false;
+    u64 flags = spin_lock_irq(&p->lock);
+    storage_plug_batch b = p->batch;
+    if (b && !storage_plug_mergeable(b, req)) {
+        prev = b;
+        b = 0;
+    }
+    if (!b) {
+        b = allocate(p->h, sizeof(*b));
+        if (b == INVALID_ADDRESS)
+            goto fail;
+        b->sg = allocate_sg_list();
+        if (b->sg == INVALID_ADDRESS) {
+            deallocate(p->h, b, sizeof(*b));
+            goto fail;
+        }
+        init_closure_func(&b->complete, status_handler, storage_plug_batch_complete);
+        b->h = p->h;
+        b->op = req->op;
+        b->blocks = irange(req->blocks.start, req->blocks.start);
+        b->count = 0;
+        if (!p->unplug_queued)
+            p->unplug_queued = queue_unplug = true;
+    }
+    sg_move(b->sg, req->data, range_span(req->blocks) << SECTOR_OFFSET);
+    b->blocks.end = req->blocks.end;
+    b->completions[b->count++] = req->completion;
+    p->batch = b;
+    spin_unlock_irq(&p->lock, flags);
+    if (prev)
+        storage_plug_submit(p, prev);
+    if (queue_unplug)
+        async_apply_bh((thunk)&p->unplug);
+    return true;
+  fail:
+    p->batch = 0;
+    spin_unlock_irq(&p->lock, flags);
+    if (prev)
+        storage_plug_submit(p, prev);
+    return false;
+}
+
+closure_func_basic(storage_req_handler, void, storage_plug_handler,
+                   storage_req req)
+{
+    storage_plug p = struct_from_field(closure_self(), storage_plug, handler);
+    switch (req->op) {
+    case STORAGE_OP_READSG:
+    case STORAGE_OP_WRITESG:
+        if (storage_plug_sg(p, req))
+            return;
+        break;
+    default: {
+        storage_plug_batch b = storage_plug_take_batch(p);
+        if (b)
+            storage_plug_submit(p, b);
+        break;
+    }
+    }
+    apply(p->target, req);
+}
+
+storage_req_handler storage_plug_init(heap h, storage_req_handler target)
+{
+    storage_plug p = allocate(h, sizeof(*p));
+    if (p == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    p->h = h;
+    p->target = target;
+    spin_lock_init(&p->lock);
+    p->batch = 0;
+    p->unplug_queued = false;
+    init_closure_func(&p->unplug, thunk, storage_unplug);
+    return init_closure_func(&p->handler, storage_req_handler, storage_plug_handler);
+}
+
+/* I/O scheduler stage: requests are queued in priority classes and dispatched to the target while
+   the number of requests in flight is below a limit, so that latency-sensitive requests do not
+   queue in the device behind bulk writeback. Reads, flushes and writes submitted on behalf of a
+   thread go to the sync class, writes submitted from kernel contexts (background writeback) to the
+   async class, and discards to the idle class; the I/O priority class of the submitting context
+   (set via ioprio_set(2) or io_uring SQEs) overrides this classification. The background classes
+   may only use part of the device queue depth, and a request waiting past the deadline of its class
+   is dispatched ahead of higher priority classes. A queued scatter-gather request that is continued
+   by a new request of the same class has the new request merged into it. */
+enum storage_sched_class {
+    STORAGE_SCHED_RT,
+    STORAGE_SCHED_SYNC,
+    STORAGE_SCHED_ASYNC,
+    STORAGE_SCHED_IDLE,
+    STORAGE_SCHED_CLASSES,
+};
+
+static const u32 storage_sched_deadlines[STORAGE_SCHED_CLASSES] = {
+    STORAGE_SCHED_DEADLINE_RT,
+    STORAGE_SCHED_DEADLINE_SYNC,
+    STORAGE_SCHED_DEADLINE_ASYNC,
+    STORAGE_SCHED_DEADLINE_IDLE,
+};
+
+typedef struct storage_sched {
+    closure_struct(storage_req_handler, handler);
+    heap h;
+    storage_req_handler target;
+    struct spinlock lock;
+    struct list queues[STORAGE_SCHED_CLASSES];
+    u32 inflight;
+} *storage_sched;
+
+typedef struct storage_sched_req {
+    struct list l;
+    closure_struct(status_handler, complete);
+    storage_sched s;
+    struct storage_req req;
+    timestamp deadline;
+    sg_list sg;             /* buffers of merged requests */
+    int count;
+    status_handler completions[STORAGE_PLUG_MAX_REQS];
+} *storage_sched_req;
+
+static void storage_sched_dispatch(storage_sched s);
+
+closure_func_basic(status_handler, void, storage_sched_req_complete,
+                   status st)
+{
+    storage_sched_req r = struct_from_field(closure_self(), storage_sched_req, complete);
+    storage_sched s = r->s;
+    u64 flags = spin_lock_irq(&s->lock);
+    s->inflight--;
+    spin_unlock_irq(&s->lock, flags);
+    storage_sched_dispatch(s);
+    if (r->sg) {
+        sg_list_release(r->sg);
+        deallocate_sg_list(r->sg);
+    }
+    for (int i = 1; i < r->count; i++)
+        apply(r->completions[i], is_ok(st) ? STATUS_OK : timm_clone(st));
+    apply(r->completions[0], st);
+    deallocate(s->h, r, sizeof(*r));
+}
+
+static int storage_sched_class(storage_req req)
+{
+    context ctx = get_current_context(current_cpu());
+    switch (IOPRIO_PRIO_CLASS(ctx->ioprio)) {
+    case IOPRIO_CLASS_RT:
+        return STORAGE_SCHED_RT;
+    case IOPRIO_CLASS_IDLE:
+        return STORAGE_SCHED_IDLE;
+    }
+    switch (req->op) {
+    case STORAGE_OP_READ:
+    case STORAGE_OP_READSG:
+    case STORAGE_OP_FLUSH:  /* covers the writes completed before its submission */
+        return STORAGE_SCHED_SYNC;
+    case STORAGE_OP_DISCARD:
+        return STORAGE_SCHED_IDLE;
+    default:
+        return is_kernel_context(ctx) ? STORAGE_SCHED_ASYNC : STORAGE_SCHED_SYNC;
+    }
+}
+
+static boolean storage_sched_merge(storage_sched_req r, storage_req req)
+{
+    if ((req->op != STORAGE_OP_READSG) && (req->op != STORAGE_OP_WRITESG))
+        return false;
+    if ((r->req.op != req->op) || (r->req.blocks.end != req->blocks.start) ||
+        (r->count >= STORAGE_PLUG_MAX_REQS) ||
+        (range_span(r->req.blocks) + range_span(req->blocks) > STORAGE_PLUG_MAX_BLOCKS))
+        return false;
+    if (!r->sg) {
+        sg_list sg = allocate_sg_list();
+        if (sg == INVALID_ADDRESS)
+            return false;
+        sg_move(sg, r->req.data, range_span(r->req.blocks) << SECTOR_OFFSET);
+        r->sg = r->req.data = sg;
+    }
+    sg_move(r->sg, req->data, range_span(req->blocks) << SECTOR_OFFSET);
+    r->req.blocks.end = req->blocks.end;
+    r->completions[r->count++] = req->completion;
+    return true;
+}
+
+/* Returns the next request to be dispatched, if any: the request with the earliest expired
+ * deadline, otherwise the oldest request of the highest priority class, within the depth limit of
+ * the class. */
+static storage_sched_req storage_sched_next_locked(storage_sched s, timestamp t)
+{
+    storage_sched_req expired = 0;
+    for (int c = 0; c < STORAGE_SCHED_CLASSES; c++) {
+        list l = list_get_next(&s->queues[c]);
+        if (!l)
+            continue;
+        storage_sched_req r = struct_from_list(l, storage_sched_req, l);
+        if ((r->deadline <= t) && (!expired || (r->deadline < expired->deadline)))
+            expired = r;
+    }
+    if (expired)
+        return (s->inflight < STORAGE_SCHED_DEPTH) ? expired : 0;
+    for (int c = 0; c < STORAGE_SCHED_CLASSES; c++) {
+        list l = list_get_next(&s->queues[c]);
+        if (!l)
+            continue;
+        u32 depth = (c <= STORAGE_SCHED_SYNC) ? STORAGE_SCHED_DEPTH : STORAGE_SCHED_ASYNC_DEPTH;
+        return (s->inflight < depth) ? struct_from_list(l, storage_sched_req, l) : 0;
+    }
+    return 0;
+}
+
+static void storage_sched_dispatch(storage_sched s)
+{
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    while (true) {
+        u64 flags = spin_lock_irq(&s->lock);
+        storage_sched_req r = storage_sched_next_locked(s, t);
+        if (r) {
+            list_delete(&r->l);
+            s->inflight++;
+        }
+        spin_unlock_irq(&s->lock, flags);
+        if (!r)
+            break;
+        storage_debug("%s: op %d, blocks %R, %d requests", func_ss, r->req.op, r->req.blocks,
+                      r->count);
+        apply(s->target, &r->req);
+    }
+}
+
+closure_func_basic(storage_req_handler, void, storage_sched_handler,
+                   storage_req req)
+{
+    storage_sched s = struct_from_field(closure_self(), storage_sched, handler);
+    int c = storage_sched_class(req);
+    list q = &s->queues[c];
+    u64 flags = spin_lock_irq(&s->lock);
+    if (!list_empty(q) &&
+        storage_sched_merge(struct_from_list(q->prev, storage_sched_req, l), req)) {
+        spin_unlock_irq(&s->lock, flags);
+        return;
+    }
+    storage_sched_req r = allocate(s->h, sizeof(*r));
+    if (r == INVALID_ADDRESS) {
+        spin_unlock_irq(&s->lock, flags);
+        apply(s->target, req);
+        return;
+    }
+    r->s = s;
+    r->req = *req;
+    r->req.completion = init_closure_func(&r->complete, status_handler,
+                                          storage_sched_req_complete);
+    r->deadline = now(CLOCK_ID_MONOTONIC_RAW) + milliseconds(storage_sched_deadlines[c]);
+    r->sg = 0;
+    r->count = 1;
+    r->completions[0] = req->completion;
+    list_insert_before(q, &r->l);
+    spin_unlock_irq(&s->lock, flags);
+    storage_sched_dispatch(s);
+}
+
+/* The io_scheduler manifest option enables the I/O scheduler for all storage volumes. */
+boolean storage_sched_enabled(void)
+{
+    tuple root = get_root_tuple();
+    return root && get(root, sym(io_scheduler));
+}
+
+storage_req_handler storage_sched_init(heap h, storage_req_handler target)
+{
+    storage_sched s = allocate(h, sizeof(*s));
+    if (s == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    s->h = h;
+    s->target = target;
+    spin_lock_init(&s->lock);
+    for (int c = 0; c < STORAGE_SCHED_CLASSES; c++)
+        list_init(&s->queues[c]);
+    s->inflight = 0;
+    return init_closure_func(&s->handler, storage_req_handler, storage_sched_handler);
+}
+
+/* The io_poll manifest option enables polled I/O either for all storage
+   devices (io_poll:t) or for the devices handled by the listed drivers (e.g.
+   io_poll:(nvme:t virtio_blk:t)). */
+boolean storage_io_poll_enabled(sstring driver)
+{
+    tuple root = get_root_tuple();
+    if (!root)
+        return false;
+    value v = get(root, sym(io_poll));
+    if (!v)
+        return false;
+    if (!is_tuple(v))
+        return true;
+    return get(v, sym_sstring(driver)) != 0;
+}
+
+/* The spin window tracks twice the mean latency of completions observed while
+   polling, so that a device that completes quickly is reaped by its
+   submitter, and shrinks when the window expires with no completion, so that
+   a slow device falls back to interrupts without burning CPU time. */
+void io_poll_init(io_poll p)
+{
+    p->mean = 0;
+    p->window = microseconds(IO_POLL_WINDOW_MAX);
+    p->submissions = 0;
+}
+
+timestamp io_poll_start(io_poll p)
+{
+    if ((p->window == microseconds(IO_POLL_WINDOW_MIN)) &&
+        ((++p->submissions % IO_POLL_PROBE_INTERVAL) == 0))
+        p->window = microseconds(IO_POLL_WINDOW_MAX);
+    return now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+void io_poll_end(io_poll p, timestamp start, boolean completed)
+{
+    if (completed) {
+        timestamp elapsed = now(CLOCK_ID_MONOTONIC_RAW) - start;
+        p->mean = p->mean ? (p->mean * 7 + elapsed) / 8 : elapsed;
+        p->window = MAX(MIN(2 * p->mean, microseconds(IO_POLL_WINDOW_MAX)),
+                        microseconds(IO_POLL_WINDOW_MIN));
+    } else {
+        p->window = MAX(p->window / 2, microseconds(IO_POLL_WINDOW_MIN));
+    }
+}
+
 void init_volumes(heap h)
 {
     storage.h = h;
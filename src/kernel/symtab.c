@@ -1,98 +1,240 @@
 #include <kernel.h>
 #include <elf64.h>
 
+/* Symbols are held in one table per ELF image added (kernel, klibs, user program and interpreter):
+ * a compact array of entries sorted by address, with the names in a string table, which is looked
+ * up with a binary search. Tables are linked in an RCU-protected list, so that lookups (e.g. from
+ * profilers and fault handlers) take no lock; each CPU remembers the last symbol it resolved, which
+ * is checked first, as consecutive lookups (e.g. of samples or stack frames) often hit the same
+ * function. */
+
+typedef struct symtab_entry {
+    u64 start;
+    u32 len;
+    u32 name;                   /* offset in string table (null-terminated) */
+} *symtab_entry;
+
+typedef struct symtab {
+    struct symtab *next;
+    range r;                    /* span of all entries */
+    u32 count;
+    u32 capacity;               /* allocated entries */
+    u32 strtab_len;
+    symtab_entry entries;
+    char *strtab;
+    closure_struct(thunk, free);
+} *symtab;
+
 /* really this should be an instance... */
 BSS_RO_AFTER_INIT static heap general;
-BSS_RO_AFTER_INIT static rangemap elf_symtable;
+static symtab symtabs;
+static struct spinlock symtab_lock;     /* serializes updates of symtabs */
+static u32 symtab_gen;                  /* incremented when a table is removed */
 
-typedef struct elfsym {
-    struct rmnode node;
-    sstring name;
-} *elfsym;
-
-static inline elfsym allocate_elfsym(range r, sstring name)
+closure_function(2, 4, void, elf_symtable_count,
+                 u32 *, count, u32 *, strtab_len,
+                 sstring name, u64 a, u64 len, u8 info)
 {
-    elfsym es = allocate(general, sizeof(struct elfsym));
-    assert(es != INVALID_ADDRESS);
-    rmnode_init(&es->node, r);
-    int bytes = name.len;
-    es->name.ptr = allocate(general, bytes);
-    assert(es->name.ptr != INVALID_ADDRESS);
-    runtime_memcpy(es->name.ptr, name.ptr, bytes);
-    es->name.len = bytes;
-    return es;
-}
+    int type = ELF64_ST_TYPE(info);
 
-static inline void deallocate_elfsym(elfsym es)
-{
-    deallocate(general, es->name.ptr, es->name.len);
-    deallocate(general, es, sizeof(struct elfsym));
+    /* store bind info? */
+    if (a == 0 || len == 0 || len > MASK(32) || sstring_is_empty(name) ||
+	(type != STT_FUNC && type != STT_OBJECT))
+	return;
+    (*bound(count))++;
+    *bound(strtab_len) += name.len + 1;
 }
 
-closure_function(1, 4, void, elf_symtable_add,
-                 u64, load_offset,
+closure_function(2, 4, void, elf_symtable_add,
+                 u64, load_offset, symtab, st,
                  sstring name, u64 a, u64 len, u8 info)
 {
     int type = ELF64_ST_TYPE(info);
-
-    /* store bind info? */
-    if (a == 0 || len == 0 || sstring_is_empty(name) ||
+    if (a == 0 || len == 0 || len > MASK(32) || sstring_is_empty(name) ||
 	(type != STT_FUNC && type != STT_OBJECT))
 	return;
+    symtab st = bound(st);
+    symtab_entry e = &st->entries[st->count++];
+    e->start = a + bound(load_offset);
+    e->len = len;
+    e->name = st->strtab_len;
+    runtime_memcpy(st->strtab + st->strtab_len, name.ptr, name.len);
+    st->strtab_len += name.len;
+    st->strtab[st->strtab_len++] = '\0';
+}
 
-    assert(elf_symtable);
+static inline boolean symtab_entry_lt(symtab_entry a, symtab_entry b)
+{
+    return (a->start < b->start) || ((a->start == b->start) && (a->name < b->name));
+}
 
-    range r = irangel(a + bound(load_offset), len);
-    boolean match = rangemap_range_intersects(elf_symtable, r);
-    if (match) {
-#ifdef ELF_SYMTAB_DEBUG
-	msg_err("\"%s\" %R would overlap in rangemap; skipping\n", name, r);
-#endif
-	return;
+static void symtab_sift_down(symtab_entry e, u32 i, u32 n)
+{
+    struct symtab_entry v = e[i];
+    u32 c;
+    while ((c = 2 * i + 1) < n) {
+        if ((c + 1 < n) && symtab_entry_lt(&e[c], &e[c + 1]))
+            c++;
+        if (!symtab_entry_lt(&v, &e[c]))
+            break;
+        e[i] = e[c];
+        i = c;
     }
+    e[i] = v;
+}
 
-    elfsym es = allocate_elfsym(r, name);
-    if (!rangemap_insert(elf_symtable, &es->node)) {
-        /* shouldn't ever happen, so bark if it does */
-        msg_err("unable to add symbol \"%s\" of range %R to map; skipping\n",
-                name, r);
+/* Sorts the entries by address (heapsort, so that no memory is needed besides the table), then
+ * drops the entries overlapping a preceding one (e.g. aliases), which also orders their ends. */
+static void symtab_sort(symtab st)
+{
+    symtab_entry e = st->entries;
+    u32 n = st->count;
+    for (u32 i = n / 2; i > 0; i--)
+        symtab_sift_down(e, i - 1, n);
+    for (u32 i = n; i > 1; i--) {
+        struct symtab_entry t = e[0];
+        e[0] = e[i - 1];
+        e[i - 1] = t;
+        symtab_sift_down(e, 0, i - 1);
+    }
+    u32 count = 0;
+    for (u32 i = 0; i < n; i++) {
+        if (count && (e[i].start < e[count - 1].start + e[count - 1].len)) {
+#ifdef ELF_SYMTAB_DEBUG
+            msg_err("\"%s\" at 0x%lx would overlap; skipping\n",
+                    sstring_from_cstring(st->strtab + e[i].name, st->strtab_len), e[i].start);
+#endif
+            continue;
+        }
+        e[count++] = e[i];
     }
+    st->count = count;
+    if (count)
+        st->r = irange(e[0].start, e[count - 1].start + e[count - 1].len);
 }
 
-closure_func_basic(rmnode_handler, boolean, symtab_remove_sym,
-                   rmnode n)
+static void symtab_dealloc(symtab st, u32 count, u32 strtab_len)
 {
-    elfsym sym = struct_from_field(n, elfsym, node);
-    rangemap_remove_node(elf_symtable, n);
-    deallocate_elfsym(sym);
-    return true;
+    if (count)
+        deallocate(general, st->entries, count * sizeof(struct symtab_entry));
+    if (strtab_len)
+        deallocate(general, st->strtab, strtab_len);
+    deallocate(general, st, sizeof(*st));
 }
 
-sstring find_elf_sym(u64 a, u64 *offset, u64 *len)
+closure_func_basic(thunk, void, symtab_free)
 {
-    if (!elf_symtable)
-        return sstring_null();
+    symtab st = struct_from_field(closure_self(), symtab, free);
+    symtab_dealloc(st, st->capacity, st->strtab_len);
+}
 
-    elfsym es = (elfsym)rangemap_lookup(elf_symtable, a);
-    if (es == INVALID_ADDRESS)
-        return sstring_null();
-    range r = range_from_rmnode(&es->node);
+/* Returns the index of the entry containing a, or -1. */
+static s64 symtab_search(symtab st, u64 a)
+{
+    symtab_entry e = st->entries;
+    u32 lo = 0, hi = st->count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (a < e[mid].start)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    if (lo == 0 || a >= e[lo - 1].start + e[lo - 1].len)
+        return -1;
+    return lo - 1;
+}
 
-    if (offset)
-        *offset = a - r.start;
+sstring find_elf_sym(u64 a, u64 *offset, u64 *len)
+{
+    sstring name = sstring_null();
+    if (!symtabs)
+        return name;
+    cpuinfo ci = current_cpu();
+    rcu_read_lock();
 
-    if (len)
-        *len = r.end - r.start;
+    /* the index is checked in case this interrupted an update of the cache */
+    symtab st = ci->symtab_hit.table;
+    symtab_entry e = 0;
+    if (st && (ci->symtab_hit.gen == symtab_gen) && (ci->symtab_hit.index < st->count)) {
+        e = &st->entries[ci->symtab_hit.index];
+        if ((a < e->start) || (a >= e->start + e->len))
+            e = 0;
+    }
+    if (!e) {
+        for (st = symtabs; st; st = st->next) {
+            if (!point_in_range(st->r, a))
+                continue;
+            s64 i = symtab_search(st, a);
+            if (i >= 0) {
+                e = &st->entries[i];
+                ci->symtab_hit.table = st;
+                ci->symtab_hit.index = i;
+                ci->symtab_hit.gen = symtab_gen;
+            }
+            break;
+        }
+    }
+    if (e) {
+        if (offset)
+            *offset = a - e->start;
+        if (len)
+            *len = e->len;
+        name = sstring_from_cstring(st->strtab + e->name, st->strtab_len - e->name);
+    }
+    rcu_read_unlock();
 
-    return es->name;
+    /* names stay valid until the symbols are removed, as with the image they belong to */
+    return name;
 }
 
 void add_elf_syms(buffer b, u64 load_offset)
 {
-    if (elf_symtable)
-	elf_symbols(b, stack_closure(elf_symtable_add, load_offset));
-    else
+    if (!general) {
 	rputs("can't add ELF symbols; symtab not initialized\n");
+        return;
+    }
+    u32 count = 0, strtab_len = 0;
+    elf_symbols(b, stack_closure(elf_symtable_count, &count, &strtab_len));
+    if (count == 0)
+        return;
+    symtab st = allocate(general, sizeof(*st));
+    if (st == INVALID_ADDRESS)
+        goto alloc_fail;
+    st->entries = allocate(general, count * sizeof(struct symtab_entry));
+    if (st->entries == INVALID_ADDRESS) {
+        symtab_dealloc(st, 0, 0);
+        goto alloc_fail;
+    }
+    st->strtab = allocate(general, strtab_len);
+    if (st->strtab == INVALID_ADDRESS) {
+        symtab_dealloc(st, count, 0);
+        goto alloc_fail;
+    }
+    st->count = st->strtab_len = 0;
+    st->capacity = count;
+    elf_symbols(b, stack_closure(elf_symtable_add, load_offset, st));
+    assert(st->count == count);
+    symtab_sort(st);
+    if (st->count < count) {
+        /* trim the entries of the symbols dropped as overlapping */
+        symtab_entry e = allocate(general, st->count * sizeof(struct symtab_entry));
+        if (e != INVALID_ADDRESS) {
+            runtime_memcpy(e, st->entries, st->count * sizeof(struct symtab_entry));
+            deallocate(general, st->entries, count * sizeof(struct symtab_entry));
+            st->entries = e;
+            st->capacity = st->count;
+        }
+    }
+    init_closure_func(&st->free, thunk, symtab_free);
+    spin_lock(&symtab_lock);
+    st->next = symtabs;
+    write_barrier();
+    symtabs = st;
+    spin_unlock(&symtab_lock);
+    return;
+  alloc_fail:
+    msg_err("failed to allocate symbol table (%d symbols)\n", count);
 }
 
 void print_u64_with_sym(u64 a)
@@ -116,26 +258,47 @@ void print_u64_with_sym(u64 a)
 
 boolean symtab_is_empty(void)
 {
-    return (rangemap_first_node(elf_symtable) == INVALID_ADDRESS);
+    return (symtabs == 0);
 }
 
 void *symtab_get_addr(sstring sym_name)
 {
-    rangemap_foreach(elf_symtable, n) {
-        elfsym sym = struct_from_field(n, elfsym, node);
-        if (!runtime_strcmp(sym->name, sym_name))
-            return pointer_from_u64(sym->node.r.start);
+    void *addr = INVALID_ADDRESS;
+    rcu_read_lock();
+    for (symtab st = symtabs; st && (addr == INVALID_ADDRESS); st = st->next) {
+        for (u32 i = 0; i < st->count; i++) {
+            symtab_entry e = &st->entries[i];
+            if (!runtime_strcmp(sstring_from_cstring(st->strtab + e->name,
+                                                     st->strtab_len - e->name), sym_name)) {
+                addr = pointer_from_u64(e->start);
+                break;
+            }
+        }
     }
-    return INVALID_ADDRESS;
+    rcu_read_unlock();
+    return addr;
 }
 
+/* removes the symbol tables of the images loaded in r */
 void symtab_remove_addrs(range r)
 {
-    rangemap_range_lookup(elf_symtable, r, stack_closure_func(rmnode_handler, symtab_remove_sym));
+    spin_lock(&symtab_lock);
+    symtab *prev = &symtabs;
+    symtab st;
+    while ((st = *prev)) {
+        if (range_span(st->r) && range_contains(r, st->r)) {
+            *prev = st->next;
+            symtab_gen++;
+            call_rcu((thunk)&st->free);
+        } else {
+            prev = &st->next;
+        }
+    }
+    spin_unlock(&symtab_lock);
 }
 
 void init_symtab(kernel_heaps kh)
 {
     general = heap_locked(kh);
-    elf_symtable = allocate_rangemap(heap_general(kh));
+    spin_lock_init(&symtab_lock);
 }
@@ -22,6 +22,7 @@
 #define TRACELOG_MAX_FREE_BYTES            (TRACELOG_DEFAULT_BUFFER_SIZE * 16)
 #define TRACELOG_COLLATE_TIMER_PERIOD_SEC  1
 #define TRACELOG_FILE_WRITE_THRESHOLD      PAGESIZE
+#define TRACEPOINT_RING_DEFAULT_ORDER      18   /* bytes per CPU */
 
 declare_closure_struct(2, 0, void, tracelog_send_http_chunk,
                        http_responder, out, buffer, relative_uri);
@@ -42,6 +43,7 @@ struct tracelog {
     bytes file_offset;
     struct timer collate_timer;
     closure_struct(timer_handler, collate_timer_func);
+    closure_struct(thunk, cpu_online);
     boolean collator_scheduled;
     boolean disabled;
 } tracelog;
@@ -270,6 +272,106 @@ void tprintf(symbol tag, tuple attrs, sstring format, ...)
     vend(ap);
 }
 
+/* Binary tracepoint events
+ *
+ * Each CPU owns a ring of 64-bit words that only it writes, with interrupts disabled, so records
+ * can be produced without locks or atomics; the reader drains the rings under the tracelog mutex.
+ * Head, tail and the lost count are free-running word / record counters.
+ */
+extern struct tracepoint tracepoints_start[], tracepoints_end[];
+
+#define tracepoint_count()      (tracepoints_end - tracepoints_start)
+#define TRACEPOINT_RECORD_WORDS (sizeof(struct tracepoint_record) / sizeof(u64))
+
+typedef struct tracepoint_ring {
+    u64 head;           /* written by the owning CPU */
+    u64 lost;           /* written by the owning CPU */
+    u64 tail;           /* written by the reader */
+    u64 lost_reported;  /* written by the reader */
+    u64 mask;
+    u64 words[0];
+} *tracepoint_ring;
+
+/* indexed by CPU number, for all present CPUs: the ring of a hot-added CPU is allocated when the
+ * CPU comes online */
+static tracepoint_ring *tracepoint_rings;
+
+static tracepoint_ring allocate_tracepoint_ring(heap h)
+{
+    tracepoint_ring r = allocate(h, sizeof(*r) + U64_FROM_BIT(TRACEPOINT_RING_DEFAULT_ORDER));
+    if (r == INVALID_ADDRESS)
+        return r;
+    r->head = r->lost = r->tail = r->lost_reported = 0;
+    r->mask = U64_FROM_BIT(TRACEPOINT_RING_DEFAULT_ORDER) / sizeof(u64) - 1;
+    return r;
+}
+
+void tracepoint_emit(tracepoint tp, u64 *args, int nargs)
+{
+    if (!tracepoint_rings)
+        return;
+    u64 saved_flags = irq_disable_save();
+    tracepoint_ring r = tracepoint_rings[current_cpu()->id];
+    if (!r)
+        goto out;
+    u64 head = r->head;
+    u64 words = TRACEPOINT_RECORD_WORDS + nargs;
+    if (r->mask + 1 - (head - r->tail) < words) {
+        r->lost++;
+        goto out;
+    }
+    struct tracepoint_record tr = {
+        .t = now(CLOCK_ID_MONOTONIC),
+        .id = tp - tracepoints_start,
+        .nargs = nargs,
+    };
+    u64 *w = (u64 *)&tr;
+    for (int i = 0; i < TRACEPOINT_RECORD_WORDS; i++)
+        r->words[(head + i) & r->mask] = w[i];
+    for (int i = 0; i < nargs; i++)
+        r->words[(head + TRACEPOINT_RECORD_WORDS + i) & r->mask] = args[i];
+    write_barrier();
+    r->head = head + words;
+  out:
+    irq_restore(saved_flags);
+}
+
+static tracepoint tracepoint_lookup(sstring name)
+{
+    for (tracepoint tp = tracepoints_start; tp < tracepoints_end; tp++) {
+        if (tp->name.len == name.len && !runtime_memcmp(tp->name.ptr, name.ptr, name.len))
+            return tp;
+    }
+    return 0;
+}
+
+/* name "all" selects every tracepoint */
+static boolean tracepoint_set_enabled(sstring name, boolean enabled)
+{
+    if (!tracepoint_rings)
+        return false;
+    if (!runtime_strcmp(name, ss("all"))) {
+        for (tracepoint tp = tracepoints_start; tp < tracepoints_end; tp++)
+            tp->enabled = enabled;
+        return true;
+    }
+    tracepoint tp = tracepoint_lookup(name);
+    if (!tp)
+        return false;
+    tp->enabled = enabled;
+    return true;
+}
+
+closure_func_basic(binding_handler, boolean, tracepoint_config_each,
+                   value a, value v)
+{
+    sstring name = buffer_to_sstring(symbol_string(a));
+    if (!tracepoint_set_enabled(name, true))
+        msg_err("tracelog: unknown tracepoint \"%s\"\n", name);
+    return true;
+}
+
+
 /* mutex held */
 closure_func_basic(thunk, void, tracelog_buffer_free_locked)
 {
@@ -541,6 +643,126 @@ static boolean tracelog_do_http_get(http_responder out, buffer relative_uri)
     return more;
 }
 
+/* Stream layout, little-endian:
+ *   header: u32 magic, u16 version, u16 cpu count, u32 tracepoint count, u32 reserved
+ *   per tracepoint: u16 id, u16 name length, u16 fields length, u16 reserved, name, fields,
+ *                   padded to 8 bytes
+ *   per CPU: u32 cpu, u32 reserved, u64 records lost, u64 record words, record words
+ * Records are struct tracepoint_record followed by nargs 64-bit arguments.
+ */
+#define TRACEPOINT_STREAM_MAGIC     0x5054534e  /* "NSTP" */
+#define TRACEPOINT_STREAM_VERSION   1
+
+static void tracepoint_stream_header(buffer b)
+{
+    buffer_write_le32(b, TRACEPOINT_STREAM_MAGIC);
+    buffer_write_le16(b, TRACEPOINT_STREAM_VERSION);
+    buffer_write_le16(b, total_processors);
+    buffer_write_le32(b, tracepoint_count());
+    buffer_write_le32(b, 0);
+    for (tracepoint tp = tracepoints_start; tp < tracepoints_end; tp++) {
+        buffer_write_le16(b, tp - tracepoints_start);
+        buffer_write_le16(b, tp->name.len);
+        buffer_write_le16(b, tp->fields.len);
+        buffer_write_le16(b, 0);
+        buffer_write_sstring(b, tp->name);
+        buffer_write_sstring(b, tp->fields);
+        bytes padding = pad(tp->name.len + tp->fields.len, sizeof(u64)) -
+            (tp->name.len + tp->fields.len);
+        while (padding-- > 0)
+            buffer_write_byte(b, 0);
+    }
+}
+
+/* The records of a CPU are copied in page-sized fragments of a chained buffer, instead of a buffer
+ * that would be reallocated (and copied) as it grows to the size of the ring; mutex held. */
+static boolean tracepoint_drain_locked(buffer_chain c, int cpu)
+{
+    tracepoint_ring r = tracepoint_rings[cpu];
+    buffer b = little_stack_buffer(3 * sizeof(u64));
+    buffer_write_le32(b, cpu);
+    buffer_write_le32(b, 0);
+    if (!r) {
+        buffer_write_le64(b, 0);
+        buffer_write_le64(b, 0);
+        return buffer_chain_write(c, buffer_ref(b, 0), buffer_length(b));
+    }
+    u64 head = r->head;
+    read_barrier();
+    u64 lost = r->lost;
+    buffer_write_le64(b, lost - r->lost_reported);
+    buffer_write_le64(b, head - r->tail);
+    if (!buffer_chain_write(c, buffer_ref(b, 0), buffer_length(b)))
+        return false;
+
+    /* ring words are native little-endian: copy the (at most two) contiguous runs */
+    for (u64 i = r->tail; i != head;) {
+        u64 n = MIN(head - i, r->mask + 1 - (i & r->mask));
+        if (!buffer_chain_write(c, &r->words[i & r->mask], n * sizeof(u64)))
+            return false;
+        i += n;
+    }
+    r->lost_reported = lost;
+    memory_barrier();
+    r->tail = head;
+    return true;
+}
+
+static void tracepoint_send_stream(http_responder out)
+{
+    catch_err(send_http_chunked_response(out, timm("ContentType", "application/octet-stream")));
+    buffer b = allocate_buffer(tracelog.h, TRACELOG_HTTP_CHUNK_MAXSIZE);
+    if (b == INVALID_ADDRESS)
+        goto out;
+    tracepoint_stream_header(b);
+    send_http_chunk(out, b);
+    mutex_lock(tracelog.m);
+    for (int i = 0; i < total_processors; i++) {
+        buffer_chain c = allocate_buffer_chain(tracelog.h);
+        if (c == INVALID_ADDRESS)
+            break;
+        if (!tracepoint_drain_locked(c, i)) {
+            deallocate_buffer(buffer_chain_buffer(c));
+            break;
+        }
+        send_http_chunk(out, buffer_chain_buffer(c));
+    }
+    mutex_unlock(tracelog.m);
+  out:
+    send_http_chunk(out, 0);
+}
+
+/* relative URI "tracepoint/<name|all>/<on|off>" */
+static void tracepoint_http_request(http_responder handler, buffer relative_uri)
+{
+    buffer_consume(relative_uri, sizeof("tracepoint/") - 1);
+    sstring path = buffer_to_sstring(relative_uri);
+    int sep;
+    for (sep = path.len - 1; sep >= 0; sep--)
+        if (path.ptr[sep] == '/')
+            break;
+    if (sep <= 0) {
+        tracelog_send_http_uri_not_found(handler);
+        return;
+    }
+    sstring name = isstring(path.ptr, sep);
+    sstring op = isstring(path.ptr + sep + 1, path.len - sep - 1);
+    boolean enable;
+    if (!runtime_strcmp(op, ss("on")))
+        enable = true;
+    else if (!runtime_strcmp(op, ss("off")))
+        enable = false;
+    else
+        goto not_found;
+    if (!tracepoint_set_enabled(name, enable))
+        goto not_found;
+    tracelog_send_http_simple_result(handler, enable ? ss("tracepoint enabled") :
+                                     ss("tracepoint disabled"));
+    return;
+  not_found:
+    tracelog_send_http_uri_not_found(handler);
+}
+
 static inline void schedule_send_http_chunk(void)
 {
     async_apply((thunk)&tracelog.send_http_chunk);
@@ -573,6 +795,12 @@ closure_func_basic(http_request_handler, void, tracelog_http_request,
                 tracelog_collate(0);
                 tracelog_clear();
                 tracelog_send_http_simple_result(handler, ss("tracelog cleared"));
+            } else if (!buffer_strcmp(relative_uri, "binary")) {
+                tracepoint_send_stream(handler);
+            } else if (buffer_length(relative_uri) > sizeof("tracepoint/") - 1 &&
+                       !runtime_memcmp(buffer_ref(relative_uri, 0), "tracepoint/",
+                                       sizeof("tracepoint/") - 1)) {
+                tracepoint_http_request(handler, relative_uri);
             } else {
                 tracelog_send_http_uri_not_found(handler);
             }
@@ -667,6 +895,13 @@ void init_tracelog_config(tuple root)
         tracelog.alloc_size = alloc_size;
 
     tracelog.trace_tags = get_tuple(tl, sym(trace_tags));
+    value tp = get(tl, sym(tracepoints));
+    if (tp) {
+        if (is_tuple(tp))
+            iterate(tp, stack_closure_func(binding_handler, tracepoint_config_each));
+        else if (is_string(tp))
+            tracepoint_set_enabled(buffer_to_sstring(tp), true);
+    }
     value v = get(tl, sym(file));
     if (v)
         init_tracelog_file_writer(v);
@@ -674,8 +909,26 @@ void init_tracelog_config(tuple root)
         init_tracelog_http_listener();
 }
 
+/* Per-CPU state of a CPU hot-added after initialization: its tracelog buffer is assigned by the
+ * next collation. */
+closure_func_basic(thunk, void, tracelog_cpu_online)
+{
+    int cpu = current_cpu()->id;
+    if (tracepoint_rings[cpu])
+        return;
+    tracepoint_ring r = allocate_tracepoint_ring(tracelog.h);
+    if (r == INVALID_ADDRESS) {
+        msg_err("failed to allocate tracepoint ring for cpu %d\n", cpu);
+        return;
+    }
+    write_barrier();
+    tracepoint_rings[cpu] = r;
+}
+
 void init_tracelog(heap h)
 {
+    h = mem_account_heap(h, h, ss("tracelog"));
+    assert(h != INVALID_ADDRESS);
     tracelog.h = h;
     tracelog.m = allocate_mutex(h, 0 /* no spinning */);
     assert(tracelog.m != INVALID_ADDRESS);
@@ -698,4 +951,13 @@ void init_tracelog(heap h)
     tracelog.logfile = 0;
     tracelog.fs_write = 0;
     tracelog.file_offset = 0;
+
+    tracepoint_ring *rings = allocate_zero(h, present_processors * sizeof(tracepoint_ring));
+    assert(rings != INVALID_ADDRESS);
+    for (int i = 0; i < total_processors; i++) {
+        rings[i] = allocate_tracepoint_ring(h);
+        assert(rings[i] != INVALID_ADDRESS);
+    }
+    tracepoint_rings = rings;
+    register_percpu_init(init_closure_func(&tracelog.cpu_online, thunk, tracelog_cpu_online));
 }
@@ -0,0 +1,59 @@
+/* Static tracepoints
+ *
+ * A tracepoint is defined once, in the file that emits it, with
+ *     DEFINE_TRACEPOINT(name, "field:type ...");
+ * where the field list documents the layout of the event payload for the host-side decoder
+ * (tools/trace-utilities/decode-tracelog.py); types are u64, s64 and x64 (hexadecimal). Events are
+ * emitted with trace(name, arg, ...), each argument taking a 64-bit payload slot. Tracepoint
+ * descriptors are collected by the linker in the .tracepoints section; their IDs are their index in
+ * the section, and are reported with the event stream.
+ *
+ * Events are written as fixed-layout binary records into a per-CPU ring without formatting or
+ * locking. A disabled tracepoint costs a test of its enabled flag, and without CONFIG_TRACELOG
+ * tracepoints compile to nothing.
+ */
+
+typedef struct tracepoint {
+    sstring name;
+    sstring fields;
+    boolean enabled;
+} *tracepoint;
+
+typedef struct tracepoint_record {
+    timestamp t;
+    u16 id;
+    u16 nargs;
+    u32 reserved;
+    u64 args[0];
+} *tracepoint_record;
+
+#ifdef CONFIG_TRACELOG
+
+#define DEFINE_TRACEPOINT(tp, f)                                                \
+    struct tracepoint __tracepoint_##tp                                         \
+    __attribute__((section(".tracepoints"), used, aligned(8))) = {              \
+        .name = ss_static_init(#tp),                                            \
+        .fields = ss_static_init(f),                                            \
+    }
+
+#define DECLARE_TRACEPOINT(name)    extern struct tracepoint __tracepoint_##name
+
+#define trace_enabled(name)     __builtin_expect(__tracepoint_##name.enabled, 0)
+
+#define trace(name, ...) do {                                                   \
+    if (trace_enabled(name)) {                                                  \
+        u64 __args[] = {__VA_ARGS__};                                           \
+        tracepoint_emit(&__tracepoint_##name, __args, _countof(__args));        \
+    }                                                                           \
+} while (0)
+
+void tracepoint_emit(tracepoint tp, u64 *args, int nargs);
+
+#else
+
+#define DEFINE_TRACEPOINT(name, f)
+#define DECLARE_TRACEPOINT(name)
+#define trace_enabled(name)     false
+#define trace(name, ...)        do { } while (0)
+
+#endif
@@ -1,8 +1,9 @@
 /* Various now() callbacks that can be accessed from both the kernel and from
  * the userspace vdso
  *
- * Currently we only support callbacks for pvclock, but others could be
- * implemented by following the general model used here for pvclock
+ * Supported sources are pvclock, the invariant TSC (x86) and the generic
+ * timer virtual counter (aarch64); others could be implemented by following
+ * the general model used here for pvclock
  *
  * NOTE: All functions that can be accessed from the VDSO must be prepended
  * with VDSO or marked static
@@ -56,6 +57,29 @@ vdso_now_pvclock(void)
     return nanoseconds(vdso_pvclock_now_ns(__vdso_pvclock));
 }
 
+#ifdef __x86_64__
+/* same computation as the kernel tsc_now() */
+static inline timestamp
+vdso_now_tsc(void)
+{
+    return (((u128)rdtsc()) * __vdso_dat->machine.tsc_scaling) >> 32;
+}
+#endif
+
+#ifdef __aarch64__
+/* same computation as the kernel arm_clock_now(); EL0 access to the counter
+   and its frequency is enabled by CNTKCTL_EL1 */
+static inline timestamp
+vdso_now_arm_generic(void)
+{
+    u64 t = rdtsc();
+    u64 f = read_psr(CNTFRQ_EL0);
+    u64 secs = t / f;
+    u64 frac = t - secs * f;
+    return seconds(secs) | ((frac << 32) / f);
+}
+#endif
+
 static inline timestamp
 vdso_now_none(void)
 {
@@ -70,6 +94,14 @@ vdso_get_now_fn(vdso_clock_id id)
     switch (id) {
     case VDSO_CLOCK_PVCLOCK:
         return vdso_now_pvclock;
+#ifdef __x86_64__
+    case VDSO_CLOCK_TSC_STABLE:
+        return vdso_now_tsc;
+#endif
+#ifdef __aarch64__
+    case VDSO_CLOCK_ARM_GENERIC:
+        return vdso_now_arm_generic;
+#endif
     default:
         return vdso_now_none;
     }
@@ -116,17 +148,27 @@ vdso_now(clock_id id)
     return _now + _off;
 }
 
-#ifdef __x86_64__
+/* The kernel stores the cpu id in TSC_AUX (x86) or TPIDRRO_EL0 (aarch64) in
+   cpu_init(); returns -1 if it cannot be read from user space. */
 VDSO int
 vdso_getcpu(unsigned *cpu, unsigned *node)
 {
-    if (__vdso_dat->machine.platform_has_rdtscp) {
-        if (cpu)
-            asm volatile("rdtscp" : "=c" (*cpu) :: "eax", "edx");
-        if (node)
-            *node = 0;
-        return 0;
-    }
+    u64 id;
+#if defined(__x86_64__)
+    if (__vdso_dat->machine.platform_has_rdpid)
+        asm volatile("rdpid %0" : "=r" (id));
+    else if (__vdso_dat->machine.platform_has_rdtscp)
+        asm volatile("rdtscp" : "=c" (id) :: "eax", "edx");
+    else
+        return -1;
+#elif defined(__aarch64__)
+    id = read_psr(TPIDRRO_EL0);
+#else
     return -1;
-}
 #endif
+    if (cpu)
+        *cpu = id;
+    if (node)
+        *node = 0;
+    return 0;
+}
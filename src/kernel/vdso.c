@@ -6,12 +6,47 @@
 
 #include <unix_internal.h>
 
+#define CHACHA_EMBED
+#include <crypto/chacha.c>
+
+/* Per-thread state of getrandom, allocated by libc with the parameters returned when calling
+ * __vdso_getrandom(0, 0, 0, params, -1). Output is generated from a key obtained with the
+ * getrandom syscall, with fast key erasure: each refill of the batch also replaces the key. */
+struct vgetrandom_state {
+    union {
+        struct {
+            u8 batch[CHACHA_BLOCKLEN * 3 / 2];
+            u8 key[32];
+        };
+        u8 batch_key[CHACHA_BLOCKLEN * 2];
+    };
+    struct chacha_ctx ctx;
+    u64 generation;
+    u8 pos;
+    u8 in_use;
+};
+
+static const u8 vgetrandom_iv[CHACHA_NONCELEN];
+
+struct vgetrandom_opaque_params {
+    u32 size_of_opaque_state;
+    u32 mmap_prot;
+    u32 mmap_flags;
+    u32 reserved[13];
+};
+
 static sysreturn
 fallback_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
     return do_syscall(SYS_clock_gettime, clk_id, tp);
 }
 
+static sysreturn
+fallback_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_syscall(SYS_clock_getres, clk_id, res);
+}
+
 static sysreturn
 fallback_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -32,6 +67,12 @@ fallback_time(time_t * t)
 #endif
 }
 
+static sysreturn
+fallback_getrandom(void *buf, u64 len, unsigned int flags)
+{
+    return do_syscall3(SYS_getrandom, buf, len, flags);
+}
+
 static sysreturn
 do_vdso_clock_gettime(clockid_t clk_id, struct timespec * tp)
 {
@@ -43,6 +84,21 @@ do_vdso_clock_gettime(clockid_t clk_id, struct timespec * tp)
     return 0;
 }
 
+/* Clocks readable by vdso_now() have the same (nanosecond) resolution as reported by the
+ * clock_getres syscall. */
+static sysreturn
+do_vdso_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    if (vdso_now(clk_id) == VDSO_NO_NOW)
+        return fallback_clock_getres(clk_id, res);
+
+    if (res) {
+        res->tv_sec = 0;
+        res->tv_nsec = 1;
+    }
+    return 0;
+}
+
 static sysreturn
 do_vdso_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -57,11 +113,9 @@ do_vdso_gettimeofday(struct timeval * tv, void * tz)
 static sysreturn
 do_vdso_getcpu(unsigned * cpu, unsigned * node, void * tcache)
 {
-#ifdef __x86_64__
     sysreturn rv = vdso_getcpu(cpu, node);
     if (rv >= 0)
         return rv;
-#endif
     return do_syscall(SYS_getcpu, cpu, node);
 }
 
@@ -79,6 +133,64 @@ do_vdso_time(time_t * t)
     return ret;
 }
 
+static void
+vgetrandom_clear(u8 *p, u64 len)
+{
+    volatile u8 *v = p;
+    while (len-- > 0)
+        *v++ = 0;
+}
+
+static sysreturn
+do_vdso_getrandom(void *buf, u64 len, unsigned int flags, void *opaque_state, u64 opaque_len)
+{
+    struct vgetrandom_state *state = opaque_state;
+    if ((opaque_len == -1ull) && !buf && !len && !flags) {
+        struct vgetrandom_opaque_params *params = opaque_state;
+        params->size_of_opaque_state = sizeof(*state);
+        params->mmap_prot = PROT_READ | PROT_WRITE;
+        params->mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        for (int i = 0; i < sizeof(params->reserved) / sizeof(params->reserved[0]); i++)
+            params->reserved[i] = 0;
+        return 0;
+    }
+    if (!state || (opaque_len != sizeof(*state)) || (flags & GRND_RANDOM) ||
+        (flags & ~(GRND_NONBLOCK | GRND_RANDOM | GRND_INSECURE)) || state->in_use || !len)
+        return fallback_getrandom(buf, len, flags);
+
+    /* in_use catches re-entry from a signal handler */
+    state->in_use = true;
+    u64 gen = __vdso_dat->rng_gen;
+    if (state->generation != gen) {
+        /* the kernel generator has been reseeded (e.g. after a snapshot restore) */
+        if (fallback_getrandom(state->key, sizeof(state->key), 0) != sizeof(state->key)) {
+            state->in_use = false;
+            return fallback_getrandom(buf, len, flags);
+        }
+        state->generation = gen;
+        vgetrandom_clear(state->batch, sizeof(state->batch));
+        state->pos = sizeof(state->batch);
+    }
+    u8 *p = buf;
+    for (u64 remain = len; remain > 0;) {
+        if (state->pos == sizeof(state->batch)) {
+            chacha_keysetup(&state->ctx, state->key, sizeof(state->key) * 8);
+            chacha_ivsetup(&state->ctx, vgetrandom_iv, 0);
+            chacha_keystream_blocks(&state->ctx, state->batch_key, 2);
+            vgetrandom_clear((u8 *)&state->ctx, sizeof(state->ctx));
+            state->pos = 0;
+        }
+        u64 n = MIN(remain, sizeof(state->batch) - state->pos);
+        for (u64 i = 0; i < n; i++)
+            p[i] = state->batch[state->pos + i];
+        vgetrandom_clear(state->batch + state->pos, n);
+        state->pos += n;
+        p += n;
+        remain -= n;
+    }
+    state->in_use = false;
+    return len;
+}
 
 /* --------------------------------------------------------------------- */
 /* Below are the full set of visible functions exported through the VDSO */
@@ -97,6 +209,18 @@ clock_gettime(clockid_t clk_id, struct timespec * tp)
     return do_vdso_clock_gettime(clk_id, tp);
 }
 
+sysreturn
+__vdso_clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_vdso_clock_getres(clk_id, res);
+}
+
+sysreturn
+clock_getres(clockid_t clk_id, struct timespec * res)
+{
+    return do_vdso_clock_getres(clk_id, res);
+}
+
 sysreturn
 __vdso_gettimeofday(struct timeval * tv, void * tz)
 {
@@ -133,6 +257,18 @@ time(time_t * t)
     return do_vdso_time(t);
 }
 
+sysreturn
+__vdso_getrandom(void *buf, u64 len, unsigned int flags, void *opaque_state, u64 opaque_len)
+{
+    return do_vdso_getrandom(buf, len, flags, opaque_state, opaque_len);
+}
+
+sysreturn
+getrandom(void *buf, u64 len, unsigned int flags, void *opaque_state, u64 opaque_len)
+{
+    return do_vdso_getrandom(buf, len, flags, opaque_state, opaque_len);
+}
+
 #ifdef __aarch64__
 sysreturn __vdso_rt_sigreturn(void)
 {
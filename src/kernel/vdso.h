@@ -17,6 +17,7 @@ struct vdso_dat_struct {
     s64 slew_freq;      /* slewing frequency */
     timestamp slew_start;
     timestamp slew_end;
+    volatile u64 rng_gen;   /* changes when the random number generator is reseeded */
     struct arch_vdso_dat machine;
 };
 
@@ -21,12 +21,21 @@ typedef struct direct {
 
 #define DIRECT_CONN_RECEIVE_QUEUE_SIZE 1024
 
+/* Buffers at least this long are sent without copying: lwIP references their contents until
+ * acknowledged by the peer. */
+#define DIRECT_CONN_ZEROCOPY_MIN    512
+
+#define DIRECT_CONN_QBUF_CACHE      16
+
 typedef struct direct_conn {
     direct d;
     struct spinlock send_lock;
     struct list l;              /* direct list */
     struct tcp_pcb *p;
-    struct list sendq_head;
+    struct list sendq_head;     /* not completely written */
+    struct list ackq_head;      /* written, awaiting acknowledgement */
+    struct list qbuf_free;
+    u32 qbuf_free_count;
     closure_struct(buffer_handler, send_bh);
     input_buffer_handler receive_bh;
     queue receive_queue;
@@ -37,8 +46,19 @@ typedef struct direct_conn {
 typedef struct qbuf {
     struct list l;
     buffer b;
+    u32 unacked;                /* bytes written and not yet acknowledged */
+    struct buffer frag;         /* b, for a fragment of a chained buffer */
+    struct sg_buf sgb;
 } *qbuf;
 
+static void qbuf_release_data(qbuf q)
+{
+    if (q->b == &q->frag)
+        sg_buf_release(&q->sgb);
+    else if (q->b)
+        deallocate_buffer(q->b);
+}
+
 static boolean direct_conn_closed(direct_conn dc);
 
 closure_func_basic(thunk, void, direct_receive_service)
@@ -152,10 +172,11 @@ static boolean direct_conn_closed(direct_conn dc)
     list_delete(&dc->l);
     heap h = dc->d->h;
     struct list *send_elem;
-    while ((send_elem = list_get_next(&dc->sendq_head))) {
+    while ((send_elem = list_get_next(&dc->ackq_head)) ||
+           (send_elem = list_get_next(&dc->sendq_head)) ||
+           (send_elem = list_get_next(&dc->qbuf_free))) {
         qbuf q = struct_from_list(send_elem, qbuf, l);
-        if (q->b)
-            deallocate_buffer(q->b);
+        qbuf_release_data(q);
         list_delete(&q->l);
         deallocate(h, q, sizeof(struct qbuf));
     }
@@ -171,7 +192,59 @@ static boolean direct_conn_closed(direct_conn dc)
     return client;
 }
 
-static void direct_conn_send_internal(direct_conn dc, qbuf q, boolean lwip_locked)
+/* send_lock held */
+static qbuf direct_conn_qbuf_alloc(direct_conn dc)
+{
+    struct list *l = list_get_next(&dc->qbuf_free);
+    if (l) {
+        list_delete(l);
+        dc->qbuf_free_count--;
+        return struct_from_list(l, qbuf, l);
+    }
+    return allocate(dc->d->h, sizeof(struct qbuf));
+}
+
+/* send_lock held */
+static void direct_conn_qbuf_free(direct_conn dc, qbuf q)
+{
+    qbuf_release_data(q);
+    q->b = 0;
+    list_delete(&q->l);
+    if (dc->qbuf_free_count < DIRECT_CONN_QBUF_CACHE) {
+        list_push_back(&dc->qbuf_free, &q->l);
+        dc->qbuf_free_count++;
+    } else {
+        deallocate(dc->d->h, q, sizeof(struct qbuf));
+    }
+}
+
+/* Releases the buffers whose contents have been acknowledged; send_lock held. */
+static void direct_conn_acked(direct_conn dc, u32 len)
+{
+    struct list *l;
+    while (len > 0) {
+        boolean written = true;
+        l = list_get_next(&dc->ackq_head);
+        if (!l) {
+            /* the data acknowledged ends in the buffer being written */
+            l = list_get_next(&dc->sendq_head);
+            if (!l)
+                break;
+            written = false;
+        }
+        qbuf q = struct_from_list(l, qbuf, l);
+        u32 n = MIN(len, q->unacked);
+        q->unacked -= n;
+        len -= n;
+        if (!written)
+            break;
+        if (q->unacked == 0)
+            direct_conn_qbuf_free(dc, q);
+    }
+}
+
+/* qs, if non-zero, is a list of qbufs to be appended to the send queue */
+static void direct_conn_send_internal(direct_conn dc, struct list *qs, boolean lwip_locked)
 {
     direct_debug("dc %p\n", dc);
     list next;
@@ -183,11 +256,20 @@ static void direct_conn_send_internal(direct_conn dc, qbuf q, boolean lwip_locke
        tcp_write or tcp_output, this will need to be revised to avoid
        deadlock. */
     spin_lock(&dc->send_lock);
-    if (q)
-        list_insert_before(&dc->sendq_head, &q->l);
+    if (qs) {
+        while ((next = list_get_next(qs))) {
+            list_delete(next);
+            list_insert_before(&dc->sendq_head, next);
+        }
+    }
     while ((next = list_get_next(&dc->sendq_head))) {
         qbuf q = struct_from_list(next, qbuf, l);
         if (!q->b) {
+            /* Data sent without copying must not be freed while lwIP may retransmit it, so closing
+             * waits until everything has been acknowledged. */
+            if (!list_empty(&dc->ackq_head))
+                break;
+
             /* close connection - should check error, but would need status handler... */
             direct_debug("connection close by sender\n");
             tcp_arg(dc->p, 0);
@@ -206,29 +288,31 @@ static void direct_conn_send_internal(direct_conn dc, qbuf q, boolean lwip_locke
             break;
 
         int write_len = MIN(avail, buffer_length(q->b));
-        /* Fix interface: can send with PSH flag clear
-           (TCP_WRITE_FLAG_MORE) if we know more data is on the way... */
-        direct_debug("write %p, len %d\n", buffer_ref(q->b, 0), write_len);
-        err_t err = tcp_write(dc->p, buffer_ref(q->b, 0), write_len, TCP_WRITE_FLAG_COPY);
+        u8 flags = (buffer_length(q->b) >= DIRECT_CONN_ZEROCOPY_MIN) ? 0 : TCP_WRITE_FLAG_COPY;
+
+        /* leave PSH clear if more data is on the way */
+        if ((write_len < buffer_length(q->b)) || (q->l.next != &dc->sendq_head))
+            flags |= TCP_WRITE_FLAG_MORE;
+        direct_debug("write %p, len %d, flags 0x%x\n", buffer_ref(q->b, 0), write_len, flags);
+        err_t err = tcp_write(dc->p, buffer_ref(q->b, 0), write_len, flags);
         if (err == ERR_MEM)
             break;
+        q->unacked += write_len;
+        buffer_consume(q->b, write_len);
+        direct_debug("remaining %d\n", buffer_length(q->b));
+
+        /* once written, the qbuf is retained until acknowledged */
+        if (buffer_length(q->b) == 0) {
+            list_delete(&q->l);
+            list_push_back(&dc->ackq_head, &q->l);
+        }
 
         err = tcp_output(dc->p);
         if (err != ERR_OK) {
             msg_err("tcp_output failed with %d\n", err);
             break;
         }
-
-        buffer_consume(q->b, write_len);
-        direct_debug("remaining %d\n", buffer_length(q->b));
-
-        /* pop off qbuf if work finished, else loop around to attempt to send more */
-        if (!q->b || buffer_length(q->b) == 0) {
-            if (q->b)
-                deallocate_buffer(q->b);
-            list_delete(&q->l);
-            deallocate(dc->d->h, q, sizeof(struct qbuf));
-        }
+        /* loop around to attempt to send more */
     }
     if (dc) {
         spin_unlock(&dc->send_lock);
@@ -240,27 +324,77 @@ static void direct_conn_send_internal(direct_conn dc, qbuf q, boolean lwip_locke
 static err_t direct_conn_sent(void *arg, struct tcp_pcb *pcb, u16 len)
 {
     assert(arg);
-    direct_conn_send_internal((direct_conn)arg, 0, true);
+    direct_conn dc = arg;
+    spin_lock(&dc->send_lock);
+    direct_conn_acked(dc, len);
+    spin_unlock(&dc->send_lock);
+    direct_conn_send_internal(dc, 0, true);
     return ERR_OK;
 }
 
+/* Queues the fragments of a chained buffer, so that they are written in sequence without being
+ * copied into contiguous memory; consumes b on success. */
+static status direct_conn_queue_chain(direct_conn dc, buffer b, struct list *qs)
+{
+    sg_list sg = buffer_chain_sg(b);
+    if (sg == INVALID_ADDRESS)
+        return timm("result", "%s: failed to seal chained buffer", func_ss);
+    u64 count = sg_list_length(sg);
+    spin_lock(&dc->send_lock);
+    for (u64 i = 0; i < count; i++) {
+        qbuf q = direct_conn_qbuf_alloc(dc);
+        if (q == INVALID_ADDRESS) {
+            struct list *l;
+            while ((l = list_get_next(qs))) {
+                qbuf q = struct_from_list(l, qbuf, l);
+                q->b = 0;
+                direct_conn_qbuf_free(dc, q);
+            }
+            spin_unlock(&dc->send_lock);
+            return timm("result", "%s: failed to allocate qbuf", func_ss);
+        }
+        list_push_back(qs, &q->l);
+    }
+    spin_unlock(&dc->send_lock);
+    list_foreach(qs, l) {
+        qbuf q = struct_from_list(l, qbuf, l);
+        q->sgb = *sg_list_head_remove(sg);
+        init_buffer(&q->frag, sg_buf_len(&q->sgb), true, 0, q->sgb.buf + q->sgb.offset);
+        buffer_produce(&q->frag, sg_buf_len(&q->sgb));
+        q->b = &q->frag;
+        q->unacked = 0;
+    }
+    deallocate_buffer(b);
+    return STATUS_OK;
+}
+
 closure_func_basic(buffer_handler, status, direct_conn_send,
                    buffer b)
 {
     direct_conn dc = struct_from_closure(direct_conn, send_bh);
     direct_debug("dc %p, b %p, len %ld\n", dc, b, b ? buffer_length(b) : 0);
-    status s = STATUS_OK;
+    struct list qs;
+    list_init(&qs);
+    if (b && buffer_is_chain(b)) {
+        status s = direct_conn_queue_chain(dc, b, &qs);
+        if (is_ok(s))
+            direct_conn_send_internal(dc, &qs, false);
+        return s;
+    }
 
     /* enqueue qbuf, even if !b */
-    qbuf q = allocate(dc->d->h, sizeof(struct qbuf));
-    if (q == INVALID_ADDRESS) {
-        s = timm("result", "%s: failed to allocate qbuf", func_ss);
-    } else {
-        /* queue even if b == 0 (acts as close connection command) */
-        q->b = b;
-        direct_conn_send_internal(dc, q, false);
-    }
-    return s;
+    spin_lock(&dc->send_lock);
+    qbuf q = direct_conn_qbuf_alloc(dc);
+    spin_unlock(&dc->send_lock);
+    if (q == INVALID_ADDRESS)
+        return timm("result", "%s: failed to allocate qbuf", func_ss);
+
+    /* queue even if b == 0 (acts as close connection command) */
+    q->b = b;
+    q->unacked = 0;
+    list_push_back(&qs, &q->l);
+    direct_conn_send_internal(dc, &qs, false);
+    return STATUS_OK;
 }
 
 static void direct_conn_enqueue(direct_conn dc, struct pbuf *p)
@@ -303,6 +437,9 @@ static direct_conn direct_conn_alloc(direct d, struct tcp_pcb *pcb)
     dc->d = d;
     dc->p = pcb;
     list_init(&dc->sendq_head);
+    list_init(&dc->ackq_head);
+    list_init(&dc->qbuf_free);
+    dc->qbuf_free_count = 0;
     init_closure_func(&dc->send_bh, buffer_handler, direct_conn_send);
     dc->receive_bh = 0;
     dc->receive_queue = allocate_queue(d->h, DIRECT_CONN_RECEIVE_QUEUE_SIZE);
@@ -411,6 +548,7 @@ status direct_connect(heap h, ip_addr_t *addr, u16 port, connection_handler ch)
     tcp_err(d->p, direct_connect_err);
     err_t err = tcp_connect(d->p, addr, port, direct_connect_complete);
     tcp_unlock(d->p);
+    net_tcp_timer_kick();
     if (err != ERR_OK) {
         direct_dealloc(d);
         s = timm("result", "connect failed (%d)", err);
@@ -5,6 +5,7 @@
 #include <lwip/def.h>
 #include <lwip/ip.h>
 #include <lwip/tcp.h>
+#include <lwip/udp.h>
 #include <lwip/timeouts.h>
 #include <lwip/ip4_frag.h>
 #include <lwip/ip6_frag.h>
@@ -18,6 +19,73 @@
 
 status direct_connect(heap h, ip_addr_t *addr, u16 port, connection_handler ch);
 
+/* restarts the TCP timer if stopped while there were no connections */
+void net_tcp_timer_kick(void);
+
+/* In-kernel TLS record layer (kTLS): after a handshake done in user space, the application hands the
+ * session keys to a TCP socket with setsockopt(SOL_TLS, TLS_TX/TLS_RX), and records are then
+ * encrypted and decrypted by the socket send and receive paths. The ciphers are implemented by a
+ * klib, which registers its operations with ktls_register(). */
+#define TLS_RECORD_HDR_LEN      5
+#define TLS_MAX_PAYLOAD_LEN     16384
+#define TLS_MAX_RECORD_LEN      (TLS_RECORD_HDR_LEN + TLS_MAX_PAYLOAD_LEN + 256)
+#define TLS_RECORD_TYPE_DATA    23
+
+typedef struct ktls_ops {
+    /* Sets up a cipher context from the crypto_info structure (as defined by Linux) supplied by the
+     * application; returns 0 or a negative errno value. */
+    int (*init)(heap h, void *crypto_info, u64 len, void **ctx);
+    void (*deinit)(void *ctx);
+
+    /* Builds in out (of at least TLS_MAX_RECORD_LEN bytes) a record of the given type from up to
+     * TLS_MAX_PAYLOAD_LEN bytes of plaintext, and advances the record sequence number; returns the
+     * record length. */
+    u64 (*encrypt)(void *ctx, u8 type, void *in, u64 len, void *out);
+
+    /* Authenticates and decrypts in place a complete record, and advances the record sequence
+     * number; returns the plaintext length, with the plaintext offset in the record and the record
+     * type in *offset and *type, or a negative errno value. */
+    s64 (*decrypt)(void *ctx, void *rec, u64 len, u64 *offset, u8 *type);
+} *ktls_ops;
+
+boolean ktls_register(ktls_ops ops);
+
+/* TCP congestion control (TCP_CONGESTION): algorithms other than the lwIP built-in one ("reno") keep
+ * per-connection state, which is updated with tcp_cc_ack() from the sent callback of the pcb. */
+#define TCP_CA_NAME_MAX 16
+
+typedef const struct tcp_cc_ops *tcp_cc_ops;
+typedef struct tcp_cc *tcp_cc;
+
+extern tcp_cc_ops tcp_cc_default;
+
+tcp_cc_ops tcp_cc_find(sstring name);
+sstring tcp_cc_name(tcp_cc_ops ops);
+tcp_cc tcp_cc_alloc(heap h, tcp_cc_ops ops);   /* returns 0 for the built-in algorithm */
+void tcp_cc_free(heap h, tcp_cc cc);
+void tcp_cc_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked);
+
+/* SYN queue and SYN cookies: the handshakes of connections to a registered listening pcb are
+ * completed before lwIP allocates a pcb for them. With a non-zero fastopen queue length, the listener
+ * accepts TCP Fast Open connections. */
+typedef struct tcp_syn_listener *tcp_syn_listener;
+
+boolean tcp_syn_init(heap h, tuple cfg);
+tcp_syn_listener tcp_syn_listen(struct tcp_pcb *lw, u32 defer_accept,
+                                u32 fastopen);     /* returns 0 if disabled */
+void tcp_syn_unlisten(tcp_syn_listener l);
+void tcp_syn_set_defer_accept(tcp_syn_listener l, u32 secs);
+void tcp_syn_set_fastopen(tcp_syn_listener l, u32 qlen);
+void tcp_syn_closed(struct tcp_pcb *pcb);
+
+/* Hash-indexed demultiplexing of received UDP datagrams to registered pcbs, ahead of lwIP. */
+typedef struct udp_demux_entry *udp_demux_entry;
+
+void udp_demux_init(heap h);
+udp_demux_entry udp_demux_add(struct udp_pcb *pcb);    /* returns 0 on failure */
+void udp_demux_remove(udp_demux_entry e);
+void udp_demux_update(udp_demux_entry e);
+
 closure_type(netif_dev_setup, boolean, tuple config);
 
 typedef struct netif_dev {
@@ -41,3 +109,48 @@ bytes netif_name_cpy(char *dest, struct netif *netif);
                                  ARPHRD_VOID)
 
 extern int (*net_ip_input_filter)(struct pbuf *pbuf, struct netif *input_netif);
+
+/* Receive-side coalescing (GRO) of in-order TCP segments, done by drivers on the frames of an rx
+ * queue before handing them to netif->input: segments held within a poll batch are delivered to
+ * lwIP as a single frame per flow when the batch is flushed. */
+#define NET_GRO_FLOWS   8
+
+struct net_gro_flow {
+    struct pbuf *head;          /* frame of the first segment, with payloads of the others chained */
+    void *iph;
+    void *tcph;
+    u32 next_seq;
+    u32 payload_csum;           /* ones' complement sum of the payloads, if checked by lwIP */
+    u16 payload_len;
+    u16 mss;                    /* payload length of the first segment */
+    u16 segs;
+    boolean ipv6;
+};
+
+typedef struct net_gro {
+    struct netif *netif;
+    struct net_napi *napi;      /* set by net_napi_init() */
+    struct spinlock lock;
+    boolean deferred_flush;
+    boolean flush_pending;
+    closure_struct(thunk, flush);
+    struct net_gro_flow flows[NET_GRO_FLOWS];
+} *net_gro;
+
+/* With deferred_flush, held segments are flushed from the runqueue, for drivers whose frames are
+ * delivered by individual completions rather than by a poll loop that calls net_gro_flush(). */
+void net_gro_init(net_gro gro, struct netif *netif, boolean deferred_flush);
+void net_gro_receive(net_gro gro, struct pbuf *p);
+void net_gro_flush(net_gro gro);
+
+/* Busy polling of an rx queue (SO_BUSY_POLL, EPIOCSPARAMS): frames input from the GRO context of a
+ * queue record the queue in the CPU that inputs them, so that sockets (and epoll instances) know
+ * which queue their data arrives on; a thread about to block on a busy polling socket arms its CPU
+ * to apply the poll function of the queue while idle. The poll function reaps the frames received
+ * by the device without waiting for the queue interrupt, and may be applied concurrently with the
+ * interrupt-driven processing of the queue. */
+typedef struct net_napi {
+    thunk poll;
+} *net_napi;
+
+void net_napi_init(net_napi napi, net_gro gro, thunk poll);
@@ -58,17 +58,20 @@
 #define LWIP_PBUF_REF_T u32_t
 
 #define LWIP_CHKSUM_ALGORITHM   3
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1   /* for devices with checksum offload */
 
 #define LWIP_WND_SCALE 1
 #define TCP_MSS 1460            /* Assuming ethernet; may want to derive this */
-#define TCP_WND 0x34000         /* For maximum throughput should be the same as TCP_SND_BUF */
-#define TCP_SND_BUF 0x34000     /* Same as /proc/sys/net/core/wmem_default on Linux */
+/* Maximum receive window: the window of each socket is limited to its receive buffer size, which
+ * starts smaller and is grown by autotuning. */
+#define TCP_WND 0x400000
+#define TCP_SND_BUF 0x10000     /* Initial send buffer size, grown by autotuning */
 #define TCP_SNDLOWAT (0xFFFE - (4 * TCP_MSS))   /* Unused, but needed to pass lwIP sanity checks */
 #define TCP_SND_QUEUELEN TCP_SNDQUEUELEN_OVERFLOW
 #define TCP_OVERSIZE TCP_MSS
 #define TCP_QUEUE_OOSEQ 1
 
-#define TCP_RCV_SCALE 2         /* (0xFFFFU << TCP_RCV_SCALE) must be greater than TCP_WND */
+#define TCP_RCV_SCALE 7         /* (0xFFFFU << TCP_RCV_SCALE) must be greater than TCP_WND */
 #define TCP_LISTEN_BACKLOG 1
 #define LWIP_DHCP 1
 // would prefer to set this dynamically...also,
@@ -110,6 +113,12 @@ typedef struct spinlock sys_lock_t;
 typedef u64_t ptrdiff_t;
 typedef unsigned long mem_ptr_t;
 
+/* initial sequence numbers of TCP connections (see tcp_syn.c) */
+struct ip_addr;
+u32_t net_tcp_isn(const struct ip_addr *local_ip, u16_t local_port,
+                  const struct ip_addr *remote_ip, u16_t remote_port);
+#define LWIP_HOOK_TCP_ISN   net_tcp_isn
+
 // format specifiers
 #define X8_F "2x"		/* not actually hex */
 #define U16_F "d"
@@ -120,6 +129,9 @@ typedef unsigned long mem_ptr_t;
 #define X32_F "8x"
 #define SZT_F "d"
 
+/* The lwIP port has no global stack lock: TCP PCBs (tcp_lock()/tcp_unlock()) and the PCB lists
+ * are protected by their own spinlocks, so input, output and timer processing of different
+ * connections can run concurrently on the CPUs targeted by the rx queues of each NIC. */
 #define SYS_ARCH_LOCK_INIT  spin_lock_init
 #define SYS_ARCH_LOCK       spin_lock
 #define SYS_ARCH_UNLOCK     spin_unlock
@@ -196,7 +208,17 @@ struct netif;
 static inline int net_ip_input_hook(struct pbuf *pbuf, struct netif *input_netif)
 {
     extern int (*net_ip_input_filter)(struct pbuf *, struct netif *);
+    extern void net_ip_input_csum(struct pbuf *, struct netif *);
+    extern void net_tcp_timer_kick(void);
+    extern int net_tcp_syn_input(struct pbuf *, struct netif *);
+    extern int net_udp_demux_input(struct pbuf *, struct netif *);
+    extern void net_ip_input_count(struct pbuf *);
+    net_ip_input_count(pbuf);
     if (net_ip_input_filter && !net_ip_input_filter(pbuf, input_netif))
         return 1;
+    net_ip_input_csum(pbuf, input_netif);
+    if (net_tcp_syn_input(pbuf, input_netif) || net_udp_demux_input(pbuf, input_netif))
+        return 1;
+    net_tcp_timer_kick();
     return 0;
 }
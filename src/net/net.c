@@ -1,5 +1,6 @@
 #include <kernel.h>
 #include <lwip.h>
+#include <lwip/inet_chksum.h>
 #include <lwip/priv/tcp_priv.h>
 
 /* Network interface flags */
@@ -13,6 +14,356 @@
 BSS_RO_AFTER_INIT static heap lwip_heap;
 BSS_RO_AFTER_INIT int (*net_ip_input_filter)(struct pbuf *pbuf, struct netif *input_netif);
 
+/* per-CPU receive statistics (called from the IP input hook) */
+void net_ip_input_count(struct pbuf *p)
+{
+    cpuinfo ci = current_cpu();
+    ci->net_rx_packets++;
+    ci->net_rx_bytes += p->tot_len;
+}
+
+/* lwIP loops packets sent to an address of a netif back to the input of the
+   same netif. If the netif offloads TCP checksum generation to its device,
+   these packets carry no valid checksum, so compute it before lwIP checks it
+   (called from the IP input hook). */
+void net_ip_input_csum(struct pbuf *p, struct netif *inp)
+{
+    if ((inp->chksum_flags & NETIF_CHECKSUM_GEN_TCP) || (p->len < IP_HLEN))
+        return;
+    struct tcp_hdr *tcph;
+    u16 hlen, tcplen;
+    if (IP_HDR_GET_VERSION(p->payload) == 4) {
+        struct ip_hdr *iph = p->payload;
+        hlen = IPH_HL_BYTES(iph);
+        if ((IPH_PROTO(iph) != IP_PROTO_TCP) ||
+            (iph->src.addr != ip4_addr_get_u32(netif_ip4_addr(inp))))
+            return;
+        u16 len = lwip_ntohs(IPH_LEN(iph));
+        if ((hlen < IP_HLEN) || (len < hlen + TCP_HLEN) || (len > p->tot_len) ||
+            (p->len < hlen + TCP_HLEN))
+            return;
+        ip4_addr_t src, dest;
+        ip4_addr_copy(src, iph->src);
+        ip4_addr_copy(dest, iph->dest);
+        tcph = (struct tcp_hdr *)((u8 *)p->payload + hlen);
+        tcplen = len - hlen;
+        tcph->chksum = 0;
+        pbuf_remove_header(p, hlen);
+        tcph->chksum = ip4_chksum_pseudo_partial(p, IP_PROTO_TCP, tcplen, tcplen, &src, &dest);
+        pbuf_add_header(p, hlen);
+    } else {
+        struct ip6_hdr *ip6h = p->payload;
+        hlen = IP6_HLEN;
+        if ((p->len < hlen + TCP_HLEN) || (IP6H_NEXTH(ip6h) != IP6_NEXTH_TCP))
+            return;
+        ip6_addr_t src, dest;
+        ip6_addr_copy_from_packed(src, ip6h->src);
+        int i;
+        for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+            if (ip6_addr_isvalid(netif_ip6_addr_state(inp, i)) &&
+                ip6_addr_cmp_zoneless(&src, netif_ip6_addr(inp, i)))
+                break;
+        }
+        tcplen = IP6H_PLEN(ip6h);
+        if ((i == LWIP_IPV6_NUM_ADDRESSES) || (tcplen < TCP_HLEN) ||
+            (hlen + tcplen > p->tot_len))
+            return;
+        ip6_addr_copy_from_packed(dest, ip6h->dest);
+        tcph = (struct tcp_hdr *)((u8 *)p->payload + hlen);
+        tcph->chksum = 0;
+        pbuf_remove_header(p, hlen);
+        tcph->chksum = ip6_chksum_pseudo_partial(p, IP6_NEXTH_TCP, tcplen, tcplen, &src, &dest);
+        pbuf_add_header(p, hlen);
+    }
+}
+
+#define NET_GRO_MAX_SEGS    64
+
+typedef struct net_gro_seg {
+    void *iph;
+    struct tcp_hdr *tcph;
+    u16 hlen;                   /* Ethernet, IP and TCP headers */
+    u16 payload_len;
+    u8 flags;
+    boolean ipv6;
+    boolean mergeable;
+} *net_gro_seg;
+
+/* Returns false if the frame is not a TCP segment. Segments can be merged if they carry payload
+   and only the ACK and PSH flags, their headers are in the first pbuf of the frame, and the frame
+   is not referenced by its driver (since pbuf chains are freed only up to a referenced pbuf). */
+static boolean net_gro_parse(struct netif *netif, struct pbuf *p, net_gro_seg s)
+{
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN)
+        return false;
+    struct eth_hdr *ethh = p->payload;
+    u16 iphlen;
+    u32 iplen;
+    s->iph = (u8 *)p->payload + SIZEOF_ETH_HDR;
+    s->mergeable = true;
+    if (ethh->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr *iph = s->iph;
+        iphlen = IPH_HL_BYTES(iph);
+        if ((IPH_V(iph) != 4) || (IPH_PROTO(iph) != IP_PROTO_TCP) ||
+            (p->len < SIZEOF_ETH_HDR + iphlen + TCP_HLEN))
+            return false;
+        iplen = lwip_ntohs(IPH_LEN(iph));
+        s->ipv6 = false;
+        if ((iphlen != IP_HLEN) || (IPH_OFFSET(iph) & PP_HTONS(IP_MF | IP_OFFMASK)) ||
+            ((netif->chksum_flags & NETIF_CHECKSUM_CHECK_IP) && inet_chksum(iph, IP_HLEN)))
+            s->mergeable = false;
+    } else if (ethh->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr *ip6h = s->iph;
+        iphlen = IP6_HLEN;
+        if ((p->len < SIZEOF_ETH_HDR + IP6_HLEN + TCP_HLEN) || (IP6H_V(ip6h) != 6) ||
+            (IP6H_NEXTH(ip6h) != IP6_NEXTH_TCP))
+            return false;
+        iplen = IP6_HLEN + IP6H_PLEN(ip6h);
+        s->ipv6 = true;
+    } else {
+        return false;
+    }
+    s->tcph = (struct tcp_hdr *)((u8 *)s->iph + iphlen);
+    u16 tcphlen = TCPH_HDRLEN_BYTES(s->tcph);
+    s->hlen = SIZEOF_ETH_HDR + iphlen + tcphlen;
+    s->flags = lwip_ntohs(s->tcph->_hdrlen_rsvd_flags) & 0xff;
+    if ((p->ref != 1) || (tcphlen < TCP_HLEN) || (s->hlen > p->len) ||
+        (SIZEOF_ETH_HDR + iplen != p->tot_len) ||
+        (iplen <= iphlen + tcphlen) || (s->flags & ~(TCP_ACK | TCP_PSH)) || !(s->flags & TCP_ACK))
+        s->mergeable = false;
+    else
+        s->payload_len = iplen - iphlen - tcphlen;
+    return true;
+}
+
+static boolean net_gro_same_flow(struct net_gro_flow *f, net_gro_seg s)
+{
+    struct tcp_hdr *tcph = f->tcph;
+    if ((f->ipv6 != s->ipv6) || (tcph->src != s->tcph->src) || (tcph->dest != s->tcph->dest))
+        return false;
+    if (s->ipv6) {
+        struct ip6_hdr *ip6h = f->iph;
+        return !runtime_memcmp(&ip6h->src, &((struct ip6_hdr *)s->iph)->src,
+                               2 * sizeof(ip6h->src));
+    }
+    struct ip_hdr *iph = f->iph;
+    return (iph->src.addr == ((struct ip_hdr *)s->iph)->src.addr) &&
+           (iph->dest.addr == ((struct ip_hdr *)s->iph)->dest.addr);
+}
+
+/* Segments are appended if they are next in sequence, acknowledge the same data, carry the same
+   TCP options (e.g. timestamps) and are not larger than the first segment. */
+static boolean net_gro_can_merge(struct net_gro_flow *f, net_gro_seg s)
+{
+    struct tcp_hdr *tcph = f->tcph;
+    u16 tcphlen = TCPH_HDRLEN_BYTES(tcph);
+    if ((lwip_ntohl(s->tcph->seqno) != f->next_seq) || (s->tcph->ackno != tcph->ackno) ||
+        (TCPH_HDRLEN_BYTES(s->tcph) != tcphlen) || (s->payload_len > f->mss) ||
+        (f->segs == NET_GRO_MAX_SEGS) || (f->head->tot_len + s->payload_len > 0xffff) ||
+        runtime_memcmp(tcph + 1, s->tcph + 1, tcphlen - TCP_HLEN))
+        return false;
+    if (!s->ipv6) {
+        struct ip_hdr *iph = f->iph;
+        if ((IPH_TOS(iph) != IPH_TOS((struct ip_hdr *)s->iph)) ||
+            (IPH_TTL(iph) != IPH_TTL((struct ip_hdr *)s->iph)))
+            return false;
+    }
+    return true;
+}
+
+static u32 net_gro_pseudo_sum(void *iph, boolean ipv6, u16 tcplen)
+{
+    u32 sum = lwip_htons(IP_PROTO_TCP) + lwip_htons(tcplen);
+    if (ipv6)
+        sum += (u16)~inet_chksum(&((struct ip6_hdr *)iph)->src, 2 * sizeof(ip6_addr_p_t));
+    else
+        sum += (u16)~inet_chksum(&((struct ip_hdr *)iph)->src, 2 * sizeof(ip4_addr_p_t));
+    return sum;
+}
+
+/* Returns the sum of the segment payload as implied by the TCP checksum (without reading the
+   payload), so that lwIP still detects corrupted segments when checking the merged one. */
+static u16 net_gro_payload_csum(net_gro_seg s)
+{
+    u16 tcphlen = TCPH_HDRLEN_BYTES(s->tcph);
+    u32 sum = net_gro_pseudo_sum(s->iph, s->ipv6, tcphlen + s->payload_len) +
+              (u16)~inet_chksum(s->tcph, tcphlen);
+    sum = FOLD_U32T(sum);
+    sum = FOLD_U32T(sum);
+    return ~sum;
+}
+
+static void net_gro_hold(struct netif *netif, struct net_gro_flow *f, net_gro_seg s,
+                         struct pbuf *p)
+{
+    f->head = p;
+    f->iph = s->iph;
+    f->tcph = s->tcph;
+    f->next_seq = lwip_ntohl(s->tcph->seqno) + s->payload_len;
+    if (netif->chksum_flags & NETIF_CHECKSUM_CHECK_TCP)
+        f->payload_csum = net_gro_payload_csum(s);
+    f->payload_len = f->mss = s->payload_len;
+    f->segs = 1;
+    f->ipv6 = s->ipv6;
+}
+
+static void net_gro_merge(struct netif *netif, struct net_gro_flow *f, net_gro_seg s,
+                          struct pbuf *p)
+{
+    if (netif->chksum_flags & NETIF_CHECKSUM_CHECK_TCP) {
+        u16 csum = net_gro_payload_csum(s);
+        f->payload_csum += (f->payload_len & 1) ? SWAP_BYTES_IN_WORD(csum) : csum;
+    }
+    struct tcp_hdr *tcph = f->tcph;
+    tcph->wnd = s->tcph->wnd;
+    if (s->flags & TCP_PSH)
+        TCPH_SET_FLAG(tcph, TCP_PSH);
+    pbuf_remove_header(p, s->hlen);
+    pbuf_cat(f->head, p);
+    f->next_seq += s->payload_len;
+    f->payload_len += s->payload_len;
+    f->segs++;
+}
+
+/* Rewrites the headers of the first segment to cover the merged payload. */
+static struct pbuf *net_gro_complete(struct netif *netif, struct net_gro_flow *f)
+{
+    if (f->segs == 1)
+        return f->head;
+    struct tcp_hdr *tcph = f->tcph;
+    u16 tcphlen = TCPH_HDRLEN_BYTES(tcph);
+    u16 tcplen = tcphlen + f->payload_len;
+    if (f->ipv6) {
+        IP6H_PLEN_SET((struct ip6_hdr *)f->iph, tcplen);
+    } else {
+        struct ip_hdr *iph = f->iph;
+        IPH_LEN_SET(iph, lwip_htons(IP_HLEN + tcplen));
+        IPH_CHKSUM_SET(iph, 0);
+        IPH_CHKSUM_SET(iph, inet_chksum(iph, IP_HLEN));
+    }
+    if (netif->chksum_flags & NETIF_CHECKSUM_CHECK_TCP) {
+        tcph->chksum = 0;
+        u32 sum = net_gro_pseudo_sum(f->iph, f->ipv6, tcplen) +
+                  (u16)~inet_chksum(tcph, tcphlen) + f->payload_csum;
+        sum = FOLD_U32T(sum);
+        sum = FOLD_U32T(sum);
+        tcph->chksum = ~sum;
+    }
+    return f->head;
+}
+
+static void net_gro_input(net_gro gro, struct pbuf *p)
+{
+    struct netif *netif = gro->netif;
+    cpuinfo ci = current_cpu();
+    struct net_napi *prev = ci->net_rx_napi;
+    ci->net_rx_napi = gro->napi;
+    if (netif->input(p, netif) != ERR_OK)
+        pbuf_free(p);
+    ci->net_rx_napi = prev;
+}
+
+closure_func_basic(thunk, void, net_gro_flush_deferred)
+{
+    net_gro_flush(struct_from_field(closure_self(), net_gro, flush));
+}
+
+void net_gro_init(net_gro gro, struct netif *netif, boolean deferred_flush)
+{
+    gro->netif = netif;
+    gro->napi = 0;
+    spin_lock_init(&gro->lock);
+    gro->deferred_flush = deferred_flush;
+    gro->flush_pending = false;
+    init_closure_func(&gro->flush, thunk, net_gro_flush_deferred);
+    for (int i = 0; i < NET_GRO_FLOWS; i++)
+        gro->flows[i].head = 0;
+}
+
+/* Takes ownership of the frame, which is either held for merging or passed to the netif input
+   (after any held segments of the same flow). */
+void net_gro_receive(net_gro gro, struct pbuf *p)
+{
+    struct netif *netif = gro->netif;
+    struct net_gro_seg s;
+    if (!net_gro_parse(netif, p, &s)) {
+        net_gro_input(gro, p);
+        return;
+    }
+    struct net_gro_flow flushed;
+    flushed.head = 0;
+    boolean schedule_flush = false;
+    spin_lock(&gro->lock);
+    struct net_gro_flow *f = 0, *free = 0;
+    for (int i = 0; i < NET_GRO_FLOWS; i++) {
+        struct net_gro_flow *flow = &gro->flows[i];
+        if (!flow->head) {
+            if (!free)
+                free = flow;
+        } else if (net_gro_same_flow(flow, &s)) {
+            f = flow;
+            break;
+        }
+    }
+    if (f && !(s.mergeable && net_gro_can_merge(f, &s))) {
+        flushed = *f;
+        f->head = 0;
+        free = f;
+        f = 0;
+    }
+    if (f) {
+        net_gro_merge(netif, f, &s, p);
+        p = 0;
+        if ((s.flags & TCP_PSH) || (s.payload_len < f->mss)) {
+            flushed = *f;
+            f->head = 0;
+        }
+    } else if (s.mergeable && !(s.flags & TCP_PSH) && free) {
+        net_gro_hold(netif, free, &s, p);
+        p = 0;
+        if (gro->deferred_flush && !gro->flush_pending) {
+            gro->flush_pending = true;
+            schedule_flush = true;
+        }
+    }
+    spin_unlock(&gro->lock);
+    if (schedule_flush)
+        async_apply((thunk)&gro->flush);
+    if (flushed.head)
+        net_gro_input(gro, net_gro_complete(netif, &flushed));
+    if (p)
+        net_gro_input(gro, p);
+}
+
+/* Passes all held segments to the netif input; called at the end of a poll batch. */
+void net_gro_flush(net_gro gro)
+{
+    struct net_gro_flow flows[NET_GRO_FLOWS];
+    int count = 0;
+    spin_lock(&gro->lock);
+    gro->flush_pending = false;
+    for (int i = 0; i < NET_GRO_FLOWS; i++) {
+        if (gro->flows[i].head) {
+            flows[count++] = gro->flows[i];
+            gro->flows[i].head = 0;
+        }
+    }
+    spin_unlock(&gro->lock);
+    for (int i = 0; i < count; i++)
+        net_gro_input(gro, net_gro_complete(gro->netif, &flows[i]));
+}
+
+void net_napi_init(net_napi napi, net_gro gro, thunk poll)
+{
+    napi->poll = poll;
+    gro->napi = napi;
+}
+
+void net_busy_poll(net_napi napi, u32 usecs)
+{
+    sched_busy_poll(napi->poll, microseconds(usecs));
+}
+
 typedef struct net_complete {
     struct list l;
     struct netif *netif;
@@ -49,8 +400,41 @@ struct net_lwip_timer {
 #define NET_LWIP_TIMER_INIT(interval, func, name)   {interval, func}
 #endif
 
+/* The periodic lwIP timers tolerate being late by a fraction of their period, which allows them to
+ * be coalesced with each other on the kernel timer wheels. */
+#define NET_LWIP_TIMER_SLACK_ORDER  2
+
+/* The TCP timer only runs while there are active or TIME-WAIT PCBs: it is stopped when there are
+ * none, and restarted on any received packet or outgoing connection. */
+static struct net_lwip_timer net_tcp_timer;
+static boolean net_tcp_timer_stopped;
+
+closure_func_basic(timer_handler, void, dispatch_tcp_timer,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    tcp_tmr();
+    net_tcp_timer_stopped = true;
+    memory_barrier();
+    if ((tcp_active_pcbs || tcp_tw_pcbs) &&
+        compare_and_swap_boolean(&net_tcp_timer_stopped, true, false)) {
+        timestamp interval = milliseconds(TCP_TMR_INTERVAL);
+        register_timer(kernel_timers, &net_tcp_timer.t, CLOCK_ID_MONOTONIC_RAW, interval, false, 0,
+                       (timer_handler)&net_tcp_timer.timer_func);
+    }
+}
+
+void net_tcp_timer_kick(void)
+{
+    if (net_tcp_timer_stopped && compare_and_swap_boolean(&net_tcp_timer_stopped, true, false)) {
+        timestamp interval = milliseconds(TCP_TMR_INTERVAL);
+        register_timer(kernel_timers, &net_tcp_timer.t, CLOCK_ID_MONOTONIC_RAW, interval, false, 0,
+                       (timer_handler)&net_tcp_timer.timer_func);
+    }
+}
+
 static struct net_lwip_timer net_lwip_timers[] = {
-    NET_LWIP_TIMER_INIT(TCP_TMR_INTERVAL, tcp_tmr, "tcp"),
     NET_LWIP_TIMER_INIT(IP_TMR_INTERVAL, ip_reass_tmr, "ip"),
     NET_LWIP_TIMER_INIT(ARP_TMR_INTERVAL, etharp_tmr, "arp"),
     NET_LWIP_TIMER_INIT(DHCP_COARSE_TIMER_MSECS, dhcp_coarse_tmr, "dhcp coarse"),
@@ -83,12 +467,18 @@ void sys_timeouts_init(void)
         struct net_lwip_timer * t = (struct net_lwip_timer *)&net_lwip_timers[i];
         init_timer(&t->t);
         timestamp interval = milliseconds(t->interval_ms);
+        timer_set_slack(&t->t, interval >> NET_LWIP_TIMER_SLACK_ORDER);
         register_timer(kernel_timers, &t->t, CLOCK_ID_MONOTONIC_RAW, interval, false, interval,
                        init_closure_func(&t->timer_func, timer_handler, dispatch_lwip_timer));
 #ifdef LWIP_DEBUG
         lwip_debug("registered %s timer with period of %ld ms\n", t->name, t->interval_ms);
 #endif
     }
+    init_timer(&net_tcp_timer.t);
+    timer_set_slack(&net_tcp_timer.t, milliseconds(TCP_TMR_INTERVAL) >> NET_LWIP_TIMER_SLACK_ORDER);
+    init_closure_func(&net_tcp_timer.timer_func, timer_handler, dispatch_tcp_timer);
+    net_tcp_timer_stopped = true;
+    net_tcp_timer_kick();
 }
 
 void lwip_debug_sstring(sstring format, ...)
@@ -151,6 +541,7 @@ static void lwip_ext_callback(struct netif* netif, netif_nsc_reason_t reason,
     if (reason & LWIP_NSC_IPV4_ADDRESS_CHANGED) {
         u8 *n = (u8 *)&netif->ip_addr;
         rprintf("%s: assigned %d.%d.%d.%d\n", ifname, n[0], n[1], n[2], n[3]);
+        boot_phase(ss("ip4 address assigned"));
         check_netif_ready(netif, false);
     }
     if ((reason & LWIP_NSC_IPV6_ADDR_STATE_CHANGED) &&
@@ -338,6 +729,7 @@ static void net_complete_cfg(tuple t, symbol opt, struct netif *n, boolean ipv6,
     spin_lock(&net_lock);
     list_push_back(&net_complete_list, &c->l);
     init_timer(&c->timeout);
+    timer_set_slack(&c->timeout, seconds(1));
     register_timer(kernel_timers, &c->timeout, CLOCK_ID_MONOTONIC, seconds(timeout), false, 0,
                    init_closure_func(&c->timeout_handler, rmnode_handler, net_timeout_handler));
     spin_unlock(&net_lock);
@@ -434,6 +826,21 @@ void init_network_iface(tuple root, merge m) {
 
 extern void lwip_init();
 
+/* After a snapshot restore, the network may have changed (e.g. a clone of the VM runs on another
+   host): cycling the link of each interface announces its addresses (gratuitous ARP, IPv6
+   neighbor advertisements) and makes DHCP revalidate its lease. */
+closure_func_basic(thunk, void, net_snapshot_resume)
+{
+    struct netif *n;
+    for (int i = 1; (n = netif_get_by_index(i)); i++) {
+        if (!netif_is_loopback(n) && netif_is_link_up(n)) {
+            netif_set_link_down(n);
+            netif_set_link_up(n);
+        }
+        netif_unref(n);
+    }
+}
+
 void init_net(kernel_heaps kh)
 {
     lwip_heap = kh->malloc;
@@ -441,4 +848,7 @@ void init_net(kernel_heaps kh)
     lwip_init();
     BSS_RO_AFTER_INIT NETIF_DECLARE_EXT_CALLBACK(netif_callback);
     netif_add_ext_callback(&netif_callback, lwip_ext_callback);
+    thunk resume = closure_func(heap_general(kh), thunk, net_snapshot_resume);
+    assert(resume != INVALID_ADDRESS);
+    snapshot_register_resume(resume);
 }
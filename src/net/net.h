@@ -4,3 +4,6 @@
 void init_net(kernel_heaps kh);
 void init_network_iface(tuple root, merge m);
 status listen_port(heap h, u16 port, connection_handler c);
+
+struct net_napi;
+void net_busy_poll(struct net_napi *napi, u32 usecs);
@@ -33,6 +33,8 @@ enum protocol_type {
 #define AF_INET6    10
 #define AF_NETLINK  16
 #define AF_VSOCK    40
+#define AF_XDP      44
+#define AF_MAX      46
 
 #define SIOCGIFNAME    0x8910
 #define SIOCGIFCONF    0x8912
@@ -58,14 +60,31 @@ enum protocol_type {
 #define MSG_OOB         0x00000001
 #define MSG_PEEK        0x00000002
 #define MSG_DONTROUTE   0x00000004
+#define MSG_CTRUNC      0x00000008
 #define MSG_PROBE       0x00000010
 #define MSG_TRUNC       0x00000020
 #define MSG_DONTWAIT    0x00000040
 #define MSG_EOR         0x00000080
 #define MSG_CONFIRM     0x00000800
+#define MSG_ERRQUEUE    0x00002000
 #define MSG_NOSIGNAL    0x00004000
 #define MSG_MORE        0x00008000
 #define MSG_WAITFORONE  0x00010000
+#define MSG_ZEROCOPY    0x04000000
+#define MSG_FASTOPEN    0x20000000
+
+struct sock_extended_err {
+    unsigned int ee_errno;
+    unsigned char ee_origin;
+    unsigned char ee_type;
+    unsigned char ee_code;
+    unsigned char ee_pad;
+    unsigned int ee_info;
+    unsigned int ee_data;
+};
+
+#define SO_EE_ORIGIN_ZEROCOPY       5
+#define SO_EE_CODE_ZEROCOPY_COPIED  1
 
 // tuplify
 #define SOCK_NONBLOCK 00004000
@@ -97,6 +116,18 @@ enum protocol_type {
 #define TCP_CC_INFO		26	/* Get Congestion Control (optional) info */
 #define TCP_SAVE_SYN		27	/* Record SYN headers for new connections */
 #define TCP_SAVED_SYN		28	/* Get SYN headers recorded for connection */
+#define TCP_ULP			31	/* Attach a ULP to a TCP connection */
+
+/* SOL_TLS options */
+#define TLS_TX			1	/* Set transmit parameters */
+#define TLS_RX			2	/* Set receive parameters */
+
+/* SOL_TLS control messages */
+#define TLS_SET_RECORD_TYPE	1
+#define TLS_GET_RECORD_TYPE	2
+
+#define UDP_SEGMENT		103	/* Set GSO segmentation size */
+#define UDP_GRO			104	/* This socket can receive UDP GRO packets */
 
 #define SHUT_RD   0
 #define SHUT_WR   1
@@ -21,6 +21,9 @@
 
 #define MTU_MAX (32 * KB)
 
+DEFINE_TRACEPOINT(net_udp_rx, "fd:u64 len:u64");
+DEFINE_TRACEPOINT(net_tcp_rx, "fd:u64 len:u64");
+
 #define resolve_socket(__p, __fd) ({fdesc f = resolve_fd(__p, __fd); \
     if (f->type != FDESC_TYPE_SOCKET) {              \
         fdesc_put(f);                                \
@@ -81,21 +84,125 @@ enum udp_socket_state {
     UDP_SOCK_SHUTDOWN = 2,
 };
 
+/* Zero-copy transmit tracking: data queued to lwIP without copying (e.g. page cache pages sent
+ * via sendfile) holds a reference to its source until the peer acknowledges the TCP sequence
+ * number that ends it. Accessed with the tcp pcb lock held. */
+typedef struct tcp_zc_entry {
+    refcount r;
+    u32 end_seq;
+} *tcp_zc_entry;
+
+typedef struct tcp_zc {
+    heap h;
+    buffer pending;     /* tcp_zc_entry array, in sequence order */
+} *tcp_zc;
+
+/* MSG_ZEROCOPY notifications (SO_ZEROCOPY): each zero-copy send is assigned a sequence number, which
+ * is queued to the error queue of the socket when lwIP no longer references the data of the send;
+ * consecutive numbers are merged into a range. The notification state is shared with the sends in
+ * flight, which may complete after the socket is closed. */
+typedef struct netsock_zc_range {
+    u32 lo, hi;
+    boolean copied;
+} *netsock_zc_range;
+
+typedef struct netsock_zc {
+    heap h;
+    struct spinlock lock;
+    struct netsock *s;      /* zero after the socket is closed */
+    buffer completions;     /* netsock_zc_range array */
+    u32 next_seq;
+    struct refcount r;      /* held by the socket and by each send in flight */
+    closure_struct(thunk, free);
+} *netsock_zc;
+
+typedef struct netsock_zc_send {
+    struct refcount r;      /* held by the sender until the send is done, and by each tcp_zc_entry */
+    closure_struct(thunk, complete);
+    netsock_zc zc;
+    u32 seq;
+    boolean copied;         /* some of the data could not be sent in place */
+} *netsock_zc_send;
+
+/* kTLS state of a TCP socket. The transmit side is accessed with the tcp pcb lock held, the receive
+ * side with the socket lock held. */
+typedef struct netsock_tls {
+    void *tx, *rx;              /* cipher contexts, null if the direction is not offloaded */
+    u8 *tx_rec;                 /* last record built, possibly not yet entirely queued to lwIP */
+    u8 *tx_plain;               /* payload gathered from scattered source buffers */
+    u32 tx_rec_len;
+    u32 tx_pending;             /* bytes at the end of tx_rec that have not been queued */
+    u8 *rx_rec;                 /* record being received, decrypted in place when complete */
+    u32 rx_rec_len;             /* bytes of the record received so far */
+    u32 rx_plain_offset;        /* decrypted payload not yet read */
+    u32 rx_plain_len;
+    u8 rx_type;
+    sysreturn rx_err;           /* sticky error after a record failed authentication */
+} *netsock_tls;
+
+static ktls_ops ktls;
+
+/* SO_REUSEPORT group of TCP sockets listening on the same address and port. lwIP allows a single
+ * listening pcb per address and port, so the members share the pcb of the first socket that
+ * listened, and each incoming connection is queued to one of the members. */
+typedef struct reuseport_group {
+    struct list l;              /* reuseport_groups */
+    struct tcp_pcb *lw;
+    struct spinlock lock;       /* held while selecting a member and queueing a connection to it */
+    vector members;
+    tcp_syn_listener syn;
+} *reuseport_group;
+
+static struct list reuseport_groups;
+static struct spinlock reuseport_lock;  /* covers group list and membership changes */
+
 typedef struct netsock {
     struct sock sock;             /* must be first */
     process p;
     queue incoming;
     err_t lwip_error;             /* lwIP error code; ERR_OK if normal */
+    u32 rcvbuf;                   /* limit of queued received data; for TCP, also of the window */
+    u32 busy_poll;                /* SO_BUSY_POLL interval, in microseconds */
+    net_napi napi;                /* rx queue the last received data arrived on */
+    netsock_zc zc;                /* MSG_ZEROCOPY notifications, allocated with SO_ZEROCOPY */
     u8 ipv6only:1;
+    u8 reuseport:1;
+    u8 sndbuf_lock:1;             /* buffer sizes set by the application are not autotuned */
+    u8 rcvbuf_lock:1;
+    u8 zerocopy:1;                /* SO_ZEROCOPY */
     union {
 	struct {
 	    struct tcp_pcb *lw;
 	    tcpflags_t flags;
 	    enum tcp_socket_state state; // half open?
+	    tcp_zc zc;
+	    reuseport_group group;
+	    u64 accept_cpu;         /* CPU where the socket was last listened or accepted on */
+	    netsock_tls tls;        /* set by the "tls" upper layer protocol (TCP_ULP) */
+	    tcp_cc_ops cc_ops;      /* congestion control algorithm (TCP_CONGESTION) */
+	    tcp_cc cc;              /* state of cc_ops, if not built into lwIP */
+	    tcp_syn_listener syn;   /* SYN queue registration of the listening pcb, if not shared */
+	    u32 defer_accept;       /* TCP_DEFER_ACCEPT, in seconds */
+	    u32 fastopen;           /* TCP_FASTOPEN queue length of a listening socket */
+	    boolean cork;           /* TCP_CORK */
+	    boolean pingpong;       /* interactive traffic: ACKs are delayed (cleared by TCP_QUICKACK) */
+	    u32 snd_sml;            /* end of the last partial segment sent (Minshall's Nagle) */
+	    u32 sndbuf;             /* send buffer size, grown with the send window */
+	    u32 sndbuf_debt;        /* send buffer space to be taken back as data is acked */
+	    u32 rcv_withheld;       /* receive window withheld from lwIP, beyond rcvbuf */
+	    u32 rcv_pending;        /* bytes read whose window credit is not yet handed to lwIP */
+	    u32 rcv_copied;         /* bytes read since rcv_space_time */
+	    timestamp rcv_space_time;
+	    u32 rcv_rtt_seq;        /* receive RTT: time for the sender to fill an updated window */
+	    timestamp rcv_rtt_start;
+	    u64 rcv_rtt_us;
 	} tcp;
 	struct {
 	    struct udp_pcb *lw;
 	    enum udp_socket_state state;
+	    u16 gso_size;           /* UDP_SEGMENT: datagram size for sends, 0 if disabled */
+	    boolean gro;            /* UDP_GRO: coalesce received datagrams */
+	    udp_demux_entry demux;  /* registered on the first received datagram */
 	} udp;
     } info;
     closure_struct(file_io, read);
@@ -117,13 +224,68 @@ typedef struct netsock {
 
 int so_rcvbuf;
 
+static u32 busy_read;   /* default SO_BUSY_POLL interval */
+
+#define DEFAULT_TCP_SNDBUF_MAX  0x400000    /* same as the maximum of Linux tcp_wmem */
+#define TCP_RCVBUF_INIT         0x10000
+
+/* window credit for data read is batched up to this amount (the default window update threshold
+ * of lwIP), bounded by a quarter of the receive buffer */
+#define TCP_RCV_CREDIT_BATCH    (4 * TCP_MSS)
+#define TCP_MEM_PRESSURE_TIME   seconds(1)
+
+static u32 tcp_sndbuf_max;
+static u32 tcp_rcvbuf_init, tcp_rcvbuf_max;
+
+/* Memory budget for the growth of TCP socket buffers beyond their initial sizes; under memory
+ * pressure, buffers shrink back instead of growing. */
+static u64 tcp_buf_mem_max;
+static u64 tcp_buf_mem;
+static timestamp tcp_mem_pressure_end;
+static closure_struct(mem_cleaner, tcp_mem_cleaner);
+
+static boolean tcp_mem_pressure(void)
+{
+    return (now(CLOCK_ID_MONOTONIC_RAW) < tcp_mem_pressure_end);
+}
+
+/* Accounts for the resizing of a TCP socket buffer; if budgeted, growth fails when it would exceed
+ * the budget. */
+static boolean tcp_buf_mem_resize(u32 old_size, u32 new_size, u32 init_size, boolean budgeted)
+{
+    s64 delta = (s64)MAX(new_size, init_size) - MAX(old_size, init_size);
+    if (delta <= 0) {
+        fetch_and_add(&tcp_buf_mem, delta);
+        return true;
+    }
+    if (budgeted && tcp_mem_pressure())
+        return false;
+    u64 mem = fetch_and_add(&tcp_buf_mem, delta) + delta;
+    if (budgeted && (mem > tcp_buf_mem_max)) {
+        fetch_and_add(&tcp_buf_mem, -delta);
+        return false;
+    }
+    return true;
+}
+
+closure_func_basic(mem_cleaner, u64, tcp_mem_clean,
+                   u64 clean_bytes)
+{
+    /* socket buffers are shrunk by their connections as data is transferred */
+    if (tcp_buf_mem)
+        tcp_mem_pressure_end = now(CLOCK_ID_MONOTONIC_RAW) + TCP_MEM_PRESSURE_TIME;
+    return 0;
+}
+
 static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
 static sysreturn netsock_listen(struct sock *sock, int backlog);
+static reuseport_group netsock_reuseport_leave(netsock s);
 static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
+static sysreturn netsock_fastopen_connect(netsock s, struct sockaddr *addr, socklen_t addrlen);
 static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags);
+        socklen_t *addrlen, int flags, context ctx, boolean in_bh, io_completion completion);
 static sysreturn netsock_getsockname(struct sock *sock, struct sockaddr *addr, socklen_t *addrlen);
 static sysreturn netsock_getsockopt(struct sock *sock, int level,
                                     int optname, void *optval, socklen_t *optlen);
@@ -134,9 +296,9 @@ static sysreturn netsock_sendto(struct sock *sock, void *buf, u64 len,
 static sysreturn netsock_recvfrom(struct sock *sock, void *buf, u64 len,
         int flags, struct sockaddr *src_addr, socklen_t *addrlen);
 static sysreturn netsock_sendmsg(struct sock *sock, const struct msghdr *msg,
-                                 int flags, boolean in_bh, io_completion completion);
+                                 int flags, context ctx, boolean in_bh, io_completion completion);
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
-                                 int flags, boolean in_bh, io_completion completion);
+                                 int flags, context ctx, boolean in_bh, io_completion completion);
 
 BSS_RO_AFTER_INIT static thunk net_loop_poll;
 static boolean net_loop_poll_queued;
@@ -167,12 +329,18 @@ static u32 netsock_events_locked(netsock s)
 {
     boolean in = !queue_empty(s->incoming);
     u32 rv;
+    /* the notification queue is checked without its lock, as a notification may be queued from an
+       lwIP callback */
+    netsock_zc zc = s->zc;
+    u32 err = (zc && buffer_length(zc->completions)) ? EPOLLERR : 0;
     if (s->sock.type == SOCK_STREAM) {
         switch (s->info.tcp.state) {
         case TCP_SOCK_LISTENING:
             rv = in ? EPOLLIN : 0;
             break;
         case TCP_SOCK_OPEN:
+            if (s->info.tcp.tls && s->info.tcp.tls->rx_plain_len)
+                in = true;  /* decrypted data not yet read */
             /* We can't take the lwIP lock here given that notifies are
                triggered by lwIP callbackes, but the lwIP state read is atomic
                as is the TCP sendbuf size read. */
@@ -194,7 +362,7 @@ static u32 netsock_events_locked(netsock s)
         assert(s->sock.type == SOCK_DGRAM);
         rv = (in ? EPOLLIN | EPOLLRDNORM : 0) | EPOLLOUT | EPOLLWRNORM;
     }
-    return rv;
+    return rv | err;
 }
 
 closure_func_basic(fdesc_events, u32, socket_events,
@@ -376,12 +544,388 @@ static void netsock_tcp_put(struct tcp_pcb * tcp_lw)
     tcp_unref(tcp_lw);
 }
 
+/* The functions below must be called with the pcb locked. */
+
+static void netsock_sndbuf_settle(netsock s, struct tcp_pcb *pcb)
+{
+    u32 debt = MIN(s->info.tcp.sndbuf_debt, pcb->snd_buf);
+    pcb->snd_buf -= debt;
+    s->info.tcp.sndbuf_debt -= debt;
+}
+
+/* Space in use when the send buffer shrinks is taken back as data is acked. */
+static void netsock_sndbuf_resize(netsock s, struct tcp_pcb *pcb, u32 size)
+{
+    u32 old_size = s->info.tcp.sndbuf;
+    if (size > old_size) {
+        u32 grow = size - old_size;
+        u32 debt = MIN(grow, s->info.tcp.sndbuf_debt);
+        s->info.tcp.sndbuf_debt -= debt;
+        pcb->snd_buf += grow - debt;
+    } else {
+        s->info.tcp.sndbuf_debt += old_size - size;
+    }
+    s->info.tcp.sndbuf = size;
+    netsock_sndbuf_settle(s, pcb);
+}
+
+/* Grows the send buffer to twice the usable send window, so that the next window of data can be
+ * queued while the current one is in flight, or shrinks it under memory pressure. */
+static void netsock_sndbuf_tune(netsock s, struct tcp_pcb *pcb)
+{
+    u32 sndbuf = s->info.tcp.sndbuf;
+    if (!s->sndbuf_lock) {
+        u32 target;
+        if (tcp_mem_pressure())
+            target = MAX(sndbuf / 2, TCP_SND_BUF);
+        else
+            target = MAX(MIN(2 * (u64)MIN(pcb->cwnd, pcb->snd_wnd_max), tcp_sndbuf_max), sndbuf);
+        if ((target != sndbuf) && tcp_buf_mem_resize(sndbuf, target, TCP_SND_BUF, true)) {
+            netsock_sndbuf_resize(s, pcb, target);
+            return;
+        }
+    }
+    netsock_sndbuf_settle(s, pcb);
+}
+
+/* Hands window credit for received data consumed by the application back to lwIP, except for the
+ * part that would let the window exceed the receive buffer size. */
+static void netsock_rcv_credit(netsock s, struct tcp_pcb *pcb, u32 recved)
+{
+    u32 wnd_max = TCP_WND_MAX(pcb);
+    u32 withhold = wnd_max - MIN(s->rcvbuf, wnd_max);
+    u64 total = (u64)s->info.tcp.rcv_withheld + recved;
+    u32 credit = (total > withhold) ? total - withhold : 0;
+    s->info.tcp.rcv_withheld = total - credit;
+    if (credit) {
+        tcp_recved(pcb, credit);
+        if (!s->info.tcp.rcv_rtt_start) {
+            s->info.tcp.rcv_rtt_seq = pcb->rcv_nxt + pcb->rcv_wnd;
+            s->info.tcp.rcv_rtt_start = now(CLOCK_ID_MONOTONIC_RAW);
+        }
+    }
+}
+
+/* Limits the receive window of a new connection to the receive buffer size; must be called before
+ * lwIP sends the first window update. */
+static void netsock_rcv_init(netsock s, struct tcp_pcb *pcb)
+{
+    u32 wnd_max = TCP_WND_MAX(pcb);
+    u32 withhold = MIN(wnd_max - MIN(s->rcvbuf, wnd_max), pcb->rcv_wnd);
+    pcb->rcv_wnd -= withhold;
+    pcb->rcv_ann_wnd = pcb->rcv_wnd;
+    pcb->rcv_ann_right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
+    s->info.tcp.rcv_withheld = withhold;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    s->info.tcp.rcv_copied = 0;
+    s->info.tcp.rcv_space_time = t;
+    s->info.tcp.rcv_rtt_seq = pcb->rcv_ann_right_edge;
+    s->info.tcp.rcv_rtt_start = t;
+    s->info.tcp.rcv_rtt_us = 0;
+}
+
+/* The receive RTT is sampled as the time taken by the sender to fill the window last advertised. */
+static void netsock_rcv_rtt_update(netsock s, struct tcp_pcb *pcb)
+{
+    if (!s->info.tcp.rcv_rtt_start || TCP_SEQ_LT(pcb->rcv_nxt, s->info.tcp.rcv_rtt_seq))
+        return;
+    u64 rtt = MAX(usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - s->info.tcp.rcv_rtt_start), 1);
+    u64 srtt = s->info.tcp.rcv_rtt_us;
+    s->info.tcp.rcv_rtt_us = (!srtt || (rtt < srtt)) ? rtt : (7 * srtt + rtt) / 8;
+    s->info.tcp.rcv_rtt_start = 0;
+}
+
+/* Dynamic right-sizing of the receive buffer: if the application has read in a round trip more
+ * than half of what the window allows, the buffer (and window) is grown to twice that amount, so
+ * that a window-limited sender can double its rate every round trip. */
+static void netsock_rcvbuf_tune(netsock s, u32 recved)
+{
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    s->info.tcp.rcv_copied += recved;
+    if (s->rcvbuf_lock || !s->info.tcp.rcv_rtt_us ||
+        (t - s->info.tcp.rcv_space_time < microseconds(s->info.tcp.rcv_rtt_us)))
+        return;
+    u32 copied = s->info.tcp.rcv_copied;
+    u32 rcvbuf = s->rcvbuf;
+    u32 target;
+    s->info.tcp.rcv_copied = 0;
+    s->info.tcp.rcv_space_time = t;
+    if (tcp_mem_pressure()) {
+        if (rcvbuf <= tcp_rcvbuf_init)
+            return;
+        target = MAX(rcvbuf / 2, tcp_rcvbuf_init);
+    } else if (copied > rcvbuf / 2) {
+        target = MIN(2 * (u64)copied, tcp_rcvbuf_max);
+        if (target <= rcvbuf)
+            return;
+    } else {
+        return;
+    }
+    if (tcp_buf_mem_resize(rcvbuf, target, tcp_rcvbuf_init, true))
+        s->rcvbuf = target;
+}
+
+static tcp_zc tcp_zc_alloc(heap h)
+{
+    tcp_zc zc = allocate(h, sizeof(*zc));
+    if (zc == INVALID_ADDRESS)
+        return zc;
+    zc->pending = allocate_buffer(h, 8 * sizeof(struct tcp_zc_entry));
+    if (zc->pending == INVALID_ADDRESS) {
+        deallocate(h, zc, sizeof(*zc));
+        return INVALID_ADDRESS;
+    }
+    zc->h = h;
+    return zc;
+}
+
+/* Releases the references for data acknowledged up to ack_seq, or for all data if all is true. */
+static void tcp_zc_release(tcp_zc zc, u32 ack_seq, boolean all)
+{
+    while (buffer_length(zc->pending) >= sizeof(struct tcp_zc_entry)) {
+        tcp_zc_entry e = buffer_ref(zc->pending, 0);
+        if (!all && ((s32)(e->end_seq - ack_seq) > 0))
+            break;
+        refcount_release(e->r);
+        buffer_consume(zc->pending, sizeof(*e));
+    }
+}
+
+static void tcp_zc_free(tcp_zc zc)
+{
+    tcp_zc_release(zc, 0, true);
+    deallocate_buffer(zc->pending);
+    deallocate(zc->h, zc, sizeof(*zc));
+}
+
+/* lwIP callbacks for a closed socket whose zero-copy data is still in flight */
+static err_t lwip_tcp_zc_sent(void *arg, struct tcp_pcb *pcb, u16 len)
+{
+    if (!arg)
+        return ERR_OK;
+    tcp_zc zc = arg;
+    tcp_zc_release(zc, pcb->lastack, false);
+    if (buffer_length(zc->pending) == 0) {
+        tcp_arg(pcb, 0);
+        tcp_zc_free(zc);
+    }
+    return ERR_OK;
+}
+
+static void lwip_tcp_zc_err(void *arg, err_t err)
+{
+    if (arg)
+        tcp_zc_free(arg);
+}
+
+closure_func_basic(thunk, void, netsock_zc_free)
+{
+    netsock_zc zc = struct_from_field(closure_self(), netsock_zc, free);
+    deallocate_buffer(zc->completions);
+    deallocate(zc->h, zc, sizeof(*zc));
+}
+
+static netsock_zc netsock_zc_alloc(netsock s)
+{
+    heap h = s->sock.h;
+    netsock_zc zc = allocate(h, sizeof(*zc));
+    if (zc == INVALID_ADDRESS)
+        return zc;
+    zc->completions = allocate_buffer(h, 4 * sizeof(struct netsock_zc_range));
+    if (zc->completions == INVALID_ADDRESS) {
+        deallocate(h, zc, sizeof(*zc));
+        return INVALID_ADDRESS;
+    }
+    zc->h = h;
+    spin_lock_init(&zc->lock);
+    zc->s = s;
+    zc->next_seq = 0;
+    init_refcount(&zc->r, 1, init_closure_func(&zc->free, thunk, netsock_zc_free));
+    return zc;
+}
+
+/* Detaches the notification state from a socket being closed. */
+static void netsock_zc_detach(netsock_zc zc)
+{
+    spin_lock(&zc->lock);
+    zc->s = 0;
+    buffer_clear(zc->completions);
+    spin_unlock(&zc->lock);
+    refcount_release(&zc->r);
+}
+
+/* Invoked when the data of a send is no longer referenced; may be called from lwIP callbacks. */
+closure_func_basic(thunk, void, netsock_zc_send_complete)
+{
+    netsock_zc_send zs = struct_from_field(closure_self(), netsock_zc_send, complete);
+    netsock_zc zc = zs->zc;
+    spin_lock(&zc->lock);
+    netsock s = zc->s;
+    if (s) {
+        buffer b = zc->completions;
+        netsock_zc_range last = buffer_length(b) ? buffer_end(b) - sizeof(*last) : 0;
+        if (last && (last->hi + 1 == zs->seq) && (last->copied == zs->copied)) {
+            last->hi = zs->seq;
+        } else if (buffer_extend(b, sizeof(*last))) {
+            last = buffer_end(b);
+            last->lo = last->hi = zs->seq;
+            last->copied = zs->copied;
+            buffer_produce(b, sizeof(*last));
+        } else {
+            msg_err("failed to queue zerocopy notification %d\n", zs->seq);
+        }
+        /* the lock keeps the socket from being closed */
+        fdesc_notify_events(&s->sock.f);
+    }
+    spin_unlock(&zc->lock);
+    deallocate(zc->h, zs, sizeof(*zs));
+    refcount_release(&zc->r);
+}
+
+static netsock_zc_send netsock_zc_send_alloc(netsock_zc zc)
+{
+    netsock_zc_send zs = allocate(zc->h, sizeof(*zs));
+    if (zs == INVALID_ADDRESS)
+        return zs;
+    init_refcount(&zs->r, 1, init_closure_func(&zs->complete, thunk, netsock_zc_send_complete));
+    zs->zc = zc;
+    zs->copied = false;
+    refcount_reserve(&zc->r);
+    return zs;
+}
+
+/* Ends the submission of a zero-copy send: if any data has been sent, the send consumes a sequence
+ * number and is notified once its data is released. */
+static void netsock_zc_send_done(netsock_zc_send zs, boolean sent)
+{
+    netsock_zc zc = zs->zc;
+    if (!sent) {
+        deallocate(zc->h, zs, sizeof(*zs));
+        refcount_release(&zc->r);
+        return;
+    }
+    spin_lock(&zc->lock);
+    zs->seq = zc->next_seq++;
+    spin_unlock(&zc->lock);
+    refcount_release(&zs->r);
+}
+
+/* Reads a MSG_ZEROCOPY notification from the error queue. */
+static sysreturn netsock_recv_errqueue(netsock s, struct msghdr *msg)
+{
+    netsock_zc zc = s->zc;
+    if (!zc)
+        return -EAGAIN;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    u64 controllen = msg->msg_control ? msg->msg_controllen : 0;
+    context_clear_err(ctx);
+    u64 len = CMSG_SPACE(sizeof(struct sock_extended_err));
+    struct netsock_zc_range r;
+    spin_lock(&zc->lock);
+    buffer b = zc->completions;
+    if (!buffer_length(b)) {
+        spin_unlock(&zc->lock);
+        return -EAGAIN;
+    }
+    if (controllen >= len) {
+        r = *(netsock_zc_range)buffer_ref(b, 0);
+        buffer_consume(b, sizeof(r));
+    }
+    spin_unlock(&zc->lock);
+    if (context_set_err(ctx))
+        return -EFAULT;
+    msg->msg_flags = MSG_ERRQUEUE;
+    if (controllen < len) {
+        msg->msg_flags |= MSG_CTRUNC;
+        msg->msg_controllen = 0;
+    } else {
+        struct cmsghdr *cmsg = msg->msg_control;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(struct sock_extended_err));
+        if (s->sock.domain == AF_INET6) {
+            cmsg->cmsg_level = IPPROTO_IPV6;
+            cmsg->cmsg_type = IPV6_RECVERR;
+        } else {
+            cmsg->cmsg_level = IPPROTO_IP;
+            cmsg->cmsg_type = IP_RECVERR;
+        }
+        struct sock_extended_err *ee = (struct sock_extended_err *)CMSG_DATA(cmsg);
+        ee->ee_errno = 0;
+        ee->ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+        ee->ee_type = 0;
+        ee->ee_code = r.copied ? SO_EE_CODE_ZEROCOPY_COPIED : 0;
+        ee->ee_pad = 0;
+        ee->ee_info = r.lo;
+        ee->ee_data = r.hi;
+        msg->msg_controllen = len;
+    }
+    context_clear_err(ctx);
+    fdesc_notify_events(&s->sock.f);
+    return 0;
+}
+
+boolean ktls_register(ktls_ops ops)
+{
+    if (ktls)
+        return false;
+    ktls = ops;
+    return true;
+}
+
+static void netsock_tls_free(heap h, netsock_tls tls)
+{
+    if (tls->tx) {
+        ktls->deinit(tls->tx);
+        deallocate(h, tls->tx_rec, TLS_MAX_RECORD_LEN);
+        deallocate(h, tls->tx_plain, TLS_MAX_PAYLOAD_LEN);
+    }
+    if (tls->rx) {
+        ktls->deinit(tls->rx);
+        deallocate(h, tls->rx_rec, TLS_MAX_RECORD_LEN);
+    }
+    deallocate(h, tls, sizeof(*tls));
+}
+
+/* Queues to lwIP the part of the last record built that has not been queued yet; called with the
+ * tcp pcb locked. Returns ERR_MEM if the send buffer is full. */
+static err_t netsock_tls_flush(netsock_tls tls, struct tcp_pcb *tcp_lw, boolean more)
+{
+    while (tls->tx_pending) {
+        u64 n = MIN(tls->tx_pending, tcp_sndbuf(tcp_lw));
+        if (n == 0)
+            return ERR_MEM;
+        u8 apiflags = TCP_WRITE_FLAG_COPY;
+        if (more || (n < tls->tx_pending))
+            apiflags |= TCP_WRITE_FLAG_MORE;
+        err_t err = tcp_write(tcp_lw, tls->tx_rec + tls->tx_rec_len - tls->tx_pending, n,
+                              apiflags);
+        if (err != ERR_OK)
+            return err;
+        tls->tx_pending -= n;
+    }
+    return ERR_OK;
+}
+
 static void netsock_tcp_close(netsock s, struct tcp_pcb *tcp_lw)
 {
     netsock_lock(s);
     if (s->info.tcp.state != TCP_SOCK_UNDEFINED) {
+        netsock_tls tls = s->info.tcp.tls;
+        if (tls && tls->tx_pending)
+            netsock_tls_flush(tls, tcp_lw, false);
         tcp_close(tcp_lw);
-        tcp_arg(tcp_lw, 0);
+        tcp_zc zc = s->info.tcp.zc;
+        if (zc && buffer_length(zc->pending) && (tcp_lw->state != CLOSED)) {
+            /* hand the references to unacknowledged data over to the pcb */
+            tcp_arg(tcp_lw, zc);
+            tcp_recv(tcp_lw, 0);
+            tcp_sent(tcp_lw, lwip_tcp_zc_sent);
+            tcp_err(tcp_lw, lwip_tcp_zc_err);
+            s->info.tcp.zc = 0;
+        } else {
+            tcp_arg(tcp_lw, 0);
+        }
         s->info.tcp.state = TCP_SOCK_UNDEFINED;
     }
     netsock_unlock(s);
@@ -423,6 +967,242 @@ struct udp_entry {
     u16 rport;
 };
 
+/* maximum number of datagrams coalesced by UDP_GRO (and sent from one buffer with UDP_SEGMENT) */
+#define UDP_MAX_SEGMENTS    64
+
+/* Copies a buffer to an iovec array, advancing the iovec cursor; returns the number of bytes
+ * copied, which is less than the buffer length if the iovec array is exhausted. */
+static u64 buf_copy_to_iov(void *src, u64 len, struct iovec **iov, u64 *iovlen, u64 *iov_offset)
+{
+    u64 offset = 0;
+    while ((offset < len) && (*iovlen > 0)) {
+        u64 xfer = MIN((*iov)->iov_len - *iov_offset, len - offset);
+        runtime_memcpy((*iov)->iov_base + *iov_offset, src + offset, xfer);
+        offset += xfer;
+        *iov_offset += xfer;
+        if (*iov_offset == (*iov)->iov_len) {
+            (*iov)++;
+            (*iovlen)--;
+            *iov_offset = 0;
+        }
+    }
+    return offset;
+}
+
+/* Copies a pbuf chain to an iovec array, advancing the iovec cursor; returns the number of bytes
+ * copied, which is less than the pbuf length if the iovec array is exhausted. */
+static u64 pbuf_copy_to_iov(struct pbuf *p, struct iovec **iov, u64 *iovlen, u64 *iov_offset)
+{
+    u64 copied = 0;
+    for (; p; p = p->next) {
+        u64 xfer = buf_copy_to_iov(p->payload, p->len, iov, iovlen, iov_offset);
+        copied += xfer;
+        if (xfer < p->len)
+            break;
+    }
+    return copied;
+}
+
+/* Receives the datagram at the head of the incoming queue (which must not be empty); called with
+ * the socket locked and a fault handler set for user memory accesses. With UDP_GRO enabled,
+ * subsequent datagrams from the same source and of the same size as the first one (except the
+ * last, which may be shorter) are coalesced into the same message, and the datagram size is
+ * reported in a UDP_GRO control message. */
+static u64 netsock_udp_dequeue(netsock s, struct msghdr *msg, int flags)
+{
+    struct iovec *iov = msg->msg_iov;
+    u64 iovlen = msg->msg_iovlen;
+    u64 iov_offset = 0;
+    struct udp_entry *e = queue_peek(s->incoming);
+    ip_addr_t raddr = e->raddr;
+    u16 rport = e->rport;
+    u64 seg_len = e->pbuf->tot_len;
+    u64 gro_limit = MIN(iov_total_len(iov, iovlen), U16_MAX);
+    u64 xfer_total = 0;
+    int segs = 0;
+    msg->msg_flags = 0;
+    if (msg->msg_name)
+        addrport_to_sockaddr(s->sock.domain, &raddr, rport, msg->msg_name, &msg->msg_namelen);
+    do {
+        struct pbuf *pbuf = e->pbuf;
+        u64 len = pbuf->tot_len;
+        u64 xfer = pbuf_copy_to_iov(pbuf, &iov, &iovlen, &iov_offset);
+        if (xfer < len) {
+            msg->msg_flags |= MSG_TRUNC;
+            if (flags & MSG_TRUNC)
+                xfer = len;
+        }
+        xfer_total += xfer;
+        segs++;
+        assert(dequeue(s->incoming) == e);
+        s->sock.rx_len -= len;
+        deallocate(s->sock.h, e, sizeof(struct udp_entry));
+        pbuf_free(pbuf);
+        if (!s->info.udp.gro || (len != seg_len) || (segs == UDP_MAX_SEGMENTS))
+            break;
+        e = queue_peek(s->incoming);
+    } while ((e != INVALID_ADDRESS) && (seg_len > 0) && (e->pbuf->tot_len <= seg_len) &&
+             (xfer_total + e->pbuf->tot_len <= gro_limit) && (e->rport == rport) &&
+             ip_addr_cmp(&e->raddr, &raddr));
+    u64 controllen = 0;
+    if (segs > 1) {
+        if (msg->msg_control && (msg->msg_controllen >= CMSG_SPACE(sizeof(int)))) {
+            struct cmsghdr *cmsg = msg->msg_control;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_GRO;
+            *(int *)CMSG_DATA(cmsg) = seg_len;
+            controllen = CMSG_SPACE(sizeof(int));
+        } else {
+            msg->msg_flags |= MSG_CTRUNC;
+        }
+    }
+    msg->msg_controllen = controllen;
+    return xfer_total;
+}
+
+/* Builds records from the data to be sent and queues them to lwIP; called with the tcp pcb locked
+ * and a fault handler set for user memory accesses. Returns the number of bytes of data consumed:
+ * data is accounted as sent as soon as it is encrypted, while the tail of the last record built may
+ * be queued later, when the send buffer has room (see lwip_tcp_sent()). */
+static u64 netsock_tls_write(netsock_tls tls, struct tcp_pcb *tcp_lw, void *buf, sg_list sg,
+                             u64 length, err_t *err)
+{
+    u64 written = 0;
+    while (((*err = netsock_tls_flush(tls, tcp_lw, written < length)) == ERR_OK) &&
+           (written < length)) {
+        u64 n = MIN(length - written, TLS_MAX_PAYLOAD_LEN);
+        void *plain;
+        boolean gathered = false;
+        if (sg) {
+            /* encrypt directly from the source buffer if it holds the entire record payload */
+            sg_buf sgb = sg_list_head_peek(sg);
+            if (sg_buf_len(sgb) >= n) {
+                plain = sgb->buf + sgb->offset;
+            } else {
+                n = sg_copy_to_buf(tls->tx_plain, sg, n);
+                plain = tls->tx_plain;
+                gathered = true;
+            }
+        } else {
+            plain = buf + written;
+        }
+        tls->tx_rec_len = ktls->encrypt(tls->tx, TLS_RECORD_TYPE_DATA, plain, n, tls->tx_rec);
+        tls->tx_pending = tls->tx_rec_len;
+        if (sg && !gathered)
+            sg_consume(sg, n);
+        written += n;
+    }
+    return written;
+}
+
+/* Drops the pbufs at the head of the incoming queue whose data has been entirely consumed. */
+static void netsock_tls_drop_consumed(netsock s)
+{
+    struct pbuf *p;
+    while ((p = queue_peek(s->incoming)) != INVALID_ADDRESS) {
+        for (struct pbuf *q = p; q; q = q->next)
+            if (q->len)
+                return;
+        assert(dequeue(s->incoming) == p);
+        pbuf_free(p);
+    }
+}
+
+/* Reassembles from the incoming queue the next non-empty record and decrypts it; called with the
+ * socket locked. Returns 0, -EAGAIN if a complete record has not been received yet, or another
+ * negative errno value; the number of bytes taken from the incoming queue is added to *consumed. */
+static sysreturn netsock_tls_rx_record(netsock s, u64 *consumed)
+{
+    netsock_tls tls = s->info.tcp.tls;
+    if (tls->rx_err)
+        return tls->rx_err;
+    while (true) {
+        u64 rec_len = TLS_RECORD_HDR_LEN;
+        if (tls->rx_rec_len >= TLS_RECORD_HDR_LEN) {
+            rec_len += (tls->rx_rec[3] << 8) | tls->rx_rec[4];
+            if (rec_len == TLS_RECORD_HDR_LEN)
+                return tls->rx_err = -EBADMSG;
+            if (rec_len > TLS_MAX_RECORD_LEN)
+                return tls->rx_err = -EMSGSIZE;
+            if (tls->rx_rec_len == rec_len) {
+                u64 offset;
+                u8 type;
+                s64 len = ktls->decrypt(tls->rx, tls->rx_rec, rec_len, &offset, &type);
+                tls->rx_rec_len = 0;
+                if (len < 0)
+                    return tls->rx_err = len;
+                if (len == 0)
+                    continue;
+                tls->rx_plain_offset = offset;
+                tls->rx_plain_len = len;
+                tls->rx_type = type;
+                netsock_tls_drop_consumed(s);
+                return 0;
+            }
+        }
+        netsock_tls_drop_consumed(s);
+        struct pbuf *p = queue_peek(s->incoming);
+        if (p == INVALID_ADDRESS)
+            return -EAGAIN;
+        while (!p->len)
+            p = p->next;
+        u64 xfer = MIN(p->len, rec_len - tls->rx_rec_len);
+        runtime_memcpy(tls->rx_rec + tls->rx_rec_len, p->payload, xfer);
+        pbuf_consume(p, xfer);
+        tls->rx_rec_len += xfer;
+        s->sock.rx_len -= xfer;
+        *consumed += xfer;
+    }
+}
+
+/* Receives decrypted data; called with the socket locked and a fault handler set for user memory
+ * accesses. Data from records of different types is never returned by the same call. The record
+ * type is reported in a TLS_GET_RECORD_TYPE control message if the caller supplied a control
+ * buffer, otherwise receiving a record other than application data fails with EIO. */
+static sysreturn netsock_tls_recv(netsock s, struct msghdr *msg, int flags, u64 *consumed)
+{
+    netsock_tls tls = s->info.tcp.tls;
+    struct iovec *iov = msg->msg_iov;
+    u64 iovlen = msg->msg_iovlen;
+    u64 iov_offset = 0;
+    u64 controllen = msg->msg_control ? msg->msg_controllen : 0;
+    u64 xfer_total = 0;
+    int type = -1;
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+    do {
+        if (!tls->rx_plain_len) {
+            sysreturn rv = netsock_tls_rx_record(s, consumed);
+            if (rv < 0)
+                return (type < 0) ? rv : xfer_total;
+        }
+        if (type < 0) {
+            type = tls->rx_type;
+            if (controllen >= CMSG_SPACE(sizeof(u8))) {
+                struct cmsghdr *cmsg = msg->msg_control;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(u8));
+                cmsg->cmsg_level = SOL_TLS;
+                cmsg->cmsg_type = TLS_GET_RECORD_TYPE;
+                *CMSG_DATA(cmsg) = type;
+                msg->msg_controllen = CMSG_SPACE(sizeof(u8));
+            } else if (type != TLS_RECORD_TYPE_DATA) {
+                return -EIO;
+            }
+        } else if (tls->rx_type != type) {
+            break;
+        }
+        u64 xfer = buf_copy_to_iov(tls->rx_rec + tls->rx_plain_offset, tls->rx_plain_len,
+                                   &iov, &iovlen, &iov_offset);
+        xfer_total += xfer;
+        if (flags & MSG_PEEK)
+            break;
+        tls->rx_plain_offset += xfer;
+        tls->rx_plain_len -= xfer;
+    } while (iovlen > 0);
+    return xfer_total;
+}
+
 static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
                                        io_completion completion, u64 bqflags)
 {
@@ -439,7 +1219,8 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
     netsock_lock(s);
     err_t err = get_lwip_error(s);
     struct tcp_pcb *tcp_lw = 0;
-    boolean notify = false;
+    u64 recved = 0;
+    boolean notify = false, block = false;
     net_debug("sock %d, ctx %p, iov %p, len %ld, flags 0x%x, bqflags 0x%lx, lwip err %d\n",
               s->sock.fd, ctx, iov, length, flags, bqflags, err);
     assert(s->sock.type == SOCK_STREAM || s->sock.type == SOCK_DGRAM);
@@ -460,6 +1241,30 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         goto out_unlock;
     }
 
+    if ((s->sock.type == SOCK_STREAM) && s->info.tcp.tls && s->info.tcp.tls->rx) {
+        tcp_lw = s->info.tcp.lw;
+        tcp_ref(tcp_lw);
+        if (context_set_err(ctx)) {
+            rv = -EFAULT;
+            goto out_unlock;
+        }
+        if (msg->msg_name)
+            remote_sockaddr(s, msg->msg_name, &msg->msg_namelen);
+        rv = netsock_tls_recv(s, msg, flags, &recved);
+        context_clear_err(ctx);
+        if (rv == -EAGAIN) {
+            if (tcp_lw->state != ESTABLISHED)
+                rv = 0;
+            else if (!(s->sock.f.flags & SOCK_NONBLOCK) && !(flags & MSG_DONTWAIT))
+                block = true;
+        }
+        if (recved)
+            netsock_check_loop();
+        /* reset a triggered EPOLLIN condition */
+        notify = queue_empty(s->incoming) && !s->info.tcp.tls->rx_plain_len;
+        goto out_unlock;
+    }
+
     /* check if we actually have data */
     void * p = queue_peek(s->incoming);
     if (p == INVALID_ADDRESS) {
@@ -481,6 +1286,12 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         rv = -EFAULT;
         goto rx_done;
     }
+    if ((s->sock.type == SOCK_DGRAM) && !(flags & MSG_PEEK)) {
+        xfer_total = netsock_udp_dequeue(s, msg, flags);
+        context_clear_err(ctx);
+        notify = queue_empty(s->incoming);  /* reset a triggered EPOLLIN condition */
+        goto rx_done;
+    }
     msg->msg_controllen = 0;
     msg->msg_flags = 0;
     sockaddr src_addr = msg->msg_name;
@@ -532,17 +1343,8 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         if (flags & MSG_PEEK) {
             if (!cur_buf)
                 p = queue_peek_at(s->incoming, ++pbuf_idx);
-        } else if (!cur_buf || (s->sock.type == SOCK_DGRAM)) {
+        } else if (!cur_buf) {
             assert(dequeue(s->incoming) == p);
-            if (s->sock.type == SOCK_DGRAM) {
-                s->sock.rx_len -= pbuf->tot_len;
-                if (cur_buf) {
-                    msg->msg_flags |= MSG_TRUNC;
-                    if (flags & MSG_TRUNC)
-                        xfer_total = pbuf->tot_len;
-                }
-                deallocate(s->sock.h, p, sizeof(struct udp_entry));
-            }
             pbuf_free(pbuf);
             p = queue_peek(s->incoming);
             if (p == INVALID_ADDRESS)
@@ -556,21 +1358,42 @@ static sysreturn sock_read_bh_internal(netsock s, struct msghdr *msg, int flags,
         if (s->sock.type == SOCK_STREAM)
             /* Calls to tcp_recved() may have enqueued new packets in the loopback interface. */
             netsock_check_loop();
-        rv = xfer_total;
+        rv = recved = xfer_total;
     }
   out_unlock:
+    if (tcp_lw && recved) {
+        /* Reads of queued data take only the socket lock: the pcb lock is taken to return window
+         * credit to lwIP once enough has accumulated, or when the reader is about to wait for
+         * data, so that the window is never held shut by pending credit. */
+        recved += s->info.tcp.rcv_pending;
+        if (!block && !queue_empty(s->incoming) &&
+            (recved < MIN(TCP_RCV_CREDIT_BATCH, s->rcvbuf / 4))) {
+            s->info.tcp.rcv_pending = recved;
+            recved = 0;
+        } else {
+            s->info.tcp.rcv_pending = 0;
+        }
+    }
     if (notify)
         netsock_notify_events(s);
     else
         netsock_unlock(s);
     if (tcp_lw) {
-        if (rv > 0) {
+        if (recved) {
             tcp_lock(tcp_lw);
-            tcp_recved(tcp_lw, rv);
+            netsock_rcvbuf_tune(s, recved);
+            netsock_rcv_credit(s, tcp_lw, recved);
             tcp_unlock(tcp_lw);
         }
         tcp_unref(tcp_lw);
     }
+    if (block) {
+        /* reap the frames of the rx queue of the socket while waiting */
+        net_napi napi = s->napi;
+        if (s->busy_poll && napi)
+            net_busy_poll(napi, s->busy_poll);
+        return blockq_block_required((unix_context)ctx, bqflags);
+    }
   out:
     net_debug("   completion %p, rv %ld\n", completion, rv);
     apply(completion, rv);
@@ -642,6 +1465,59 @@ closure_func_basic(file_io, sysreturn, socket_read,
     return blockq_check(s->sock.rxbq, ba, bh);
 }
 
+#define TCP_CORK_POLL_INTERVAL  1   /* in lwIP slow timer ticks */
+
+/* Sends the queued data regardless of Nagle's algorithm; called with the pcb locked. */
+static err_t netsock_tcp_output_push(struct tcp_pcb *pcb)
+{
+    if (tcp_nagle_disabled(pcb))
+        return tcp_output(pcb);
+    tcp_nagle_disable(pcb);
+    err_t err = tcp_output(pcb);
+    tcp_nagle_enable(pcb);
+    return err;
+}
+
+/* flushes data held by TCP_CORK or MSG_MORE for longer than a poll interval */
+static err_t lwip_tcp_cork_poll(void *arg, struct tcp_pcb *pcb)
+{
+    tcp_poll(pcb, 0, 0);
+    return netsock_tcp_output_push(pcb);
+}
+
+/* Transmits the data queued by a write; called with the pcb locked. While the socket is corked, or
+ * more data is announced with MSG_MORE, only full-sized segments are sent, and a partial segment is
+ * held until it is completed by later writes, the socket is uncorked, or the poll timer of the pcb
+ * expires. Otherwise, Nagle's algorithm is relaxed as in Minshall's variant: a partial segment is
+ * held only while a partial segment sent earlier is unacknowledged, so that the tail of a response
+ * does not wait for the (possibly delayed) acknowledgment of the full segments before it. */
+static err_t netsock_tcp_push(netsock s, struct tcp_pcb *pcb, boolean more)
+{
+    err_t err;
+    if (more || s->info.tcp.cork) {
+        tcp_poll(pcb, lwip_tcp_cork_poll, TCP_CORK_POLL_INTERVAL);
+        if (pcb->snd_lbb - pcb->snd_nxt < pcb->mss)
+            return ERR_OK;
+
+        /* with Nagle's algorithm, a trailing partial segment is held */
+        if (!tcp_nagle_disabled(pcb))
+            return tcp_output(pcb);
+        tcp_nagle_enable(pcb);
+        err = tcp_output(pcb);
+        tcp_nagle_disable(pcb);
+        return err;
+    }
+    u32 snd_nxt = pcb->snd_nxt;
+    u32 snd_sml = s->info.tcp.snd_sml;
+    if (TCP_SEQ_GT(snd_sml, pcb->lastack) && TCP_SEQ_LEQ(snd_sml, snd_nxt))
+        err = tcp_output(pcb);
+    else
+        err = netsock_tcp_output_push(pcb);
+    if ((pcb->snd_nxt - snd_nxt) % pcb->mss)
+        s->info.tcp.snd_sml = pcb->snd_nxt;
+    return err;
+}
+
 closure_function(6, 1, sysreturn, socket_write_tcp_bh,
                  netsock, s, void *, buf, sg_list, sg, u64, length, int, flags, io_completion, completion,
                  u64 bqflags)
@@ -663,17 +1539,27 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         goto out_unlock;
     }
 
-    if (s->sock.type == SOCK_STREAM && s->info.tcp.state != TCP_SOCK_OPEN) {
-        rv = -ENOTCONN;
-        goto out_unlock;
-    }
-
     if (bqflags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out_unlock;
     }
 
     context ctx = get_current_context(current_cpu());
+    if (s->sock.type == SOCK_STREAM && s->info.tcp.state != TCP_SOCK_OPEN) {
+        if ((flags & MSG_FASTOPEN) && (s->info.tcp.state == TCP_SOCK_IN_CONNECTION)) {
+            /* the data is sent when the handshake completes */
+            if ((bqflags & BLOCKQ_ACTION_BLOCKED) == 0 &&
+                ((s->sock.f.flags & SOCK_NONBLOCK) || (flags & MSG_DONTWAIT))) {
+                rv = -EINPROGRESS;
+                goto out_unlock;
+            }
+            netsock_unlock(s);
+            return blockq_block_required((unix_context)ctx, bqflags);
+        }
+        rv = -ENOTCONN;
+        goto out_unlock;
+    }
+
     struct tcp_pcb *tcp_lw = s->info.tcp.lw;
     tcp_ref(tcp_lw);
     netsock_unlock(s);
@@ -711,26 +1597,95 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         goto write_done;
     }
 
-    /* Figure actual length and flags */
-    u64 n;
-    while (remain) {
-        u8 apiflags = TCP_WRITE_FLAG_COPY;
-        if (sg) {
-            sg_buf sgb = sg_list_head_peek(sg);
-            buf = sgb->buf + sgb->offset;
-            n = sg_buf_len(sgb);
-            if (sg_list_peek_at(sg, 1) != INVALID_ADDRESS)
-                apiflags |= TCP_WRITE_FLAG_MORE;
-        } else {
+    netsock_tls tls = s->info.tcp.tls;
+    if (tls && tls->tx) {
+        rv = netsock_tls_write(tls, tcp_lw, buf, sg, remain, &err);
+        avail = tcp_sndbuf(tcp_lw);
+        if (err == ERR_MEM) {
+            if (rv == 0) {
+                context_clear_err(ctx);
+                goto full;
+            }
+            err = ERR_OK;
+        } else if (err != ERR_OK) {
+            net_debug(" tcp_write() lwip error: %d\n", err);
+            rv = lwip_to_errno(err);
+        }
+        context_clear_err(ctx);
+        goto write_done;
+    }
+
+    /* With MSG_ZEROCOPY, user memory is sent in place and the send is notified via the error queue
+     * when the data is acknowledged. */
+    netsock_zc_send zs = 0;
+    if ((flags & MSG_ZEROCOPY) && s->zerocopy) {
+        zs = netsock_zc_send_alloc(s->zc);
+        if (zs == INVALID_ADDRESS)
+            zs = 0;
+    }
+
+    /* Figure actual length and flags */
+    u64 n;
+    while (remain) {
+        u8 apiflags = TCP_WRITE_FLAG_COPY;
+        sg_buf sgb = 0;
+        refcount r = 0;
+        void *src;
+        if (sg) {
+            sgb = sg_list_head_peek(sg);
+            buf = sgb->buf + sgb->offset;
+            n = sg_buf_len(sgb);
+            if (sg_list_peek_at(sg, 1) != INVALID_ADDRESS)
+                apiflags |= TCP_WRITE_FLAG_MORE;
+
+            /* Buffers backed by a reference (e.g. page cache pages) are sent in place, pinned
+             * until acknowledged; anything else (user memory) must be copied. */
+            r = sgb->refcount;
+        } else {
             n = remain;
         }
         if (avail < n) {
             n = avail;
             apiflags |= TCP_WRITE_FLAG_MORE;
         }
+        src = buf;
+        if (!r && zs) {
+            /* User data is referenced via the kernel mapping of its page, which stays valid
+             * regardless of changes to the user mapping. The page is not pinned: as with Linux,
+             * the application must not reuse the buffer until the send is notified. */
+            u64 page_remain = PAGESIZE - (u64_from_pointer(buf) & PAGEMASK);
+            if (n > page_remain) {
+                n = page_remain;
+                apiflags |= TCP_WRITE_FLAG_MORE;
+            }
+            (void)*(volatile u8 *)buf;  /* fault in */
+            u64 phys = physical_from_virtual(buf);
+            if (phys != INVALID_PHYSICAL) {
+                src = pointer_from_u64(virt_from_linear_backed_phys(phys));
+                r = &zs->r;
+            }
+        }
+        if (r) {
+            if (!s->info.tcp.zc)
+                s->info.tcp.zc = tcp_zc_alloc(s->sock.h);
+            if (s->info.tcp.zc == INVALID_ADDRESS)
+                s->info.tcp.zc = 0;
+            else if (buffer_extend(s->info.tcp.zc->pending, sizeof(struct tcp_zc_entry)))
+                apiflags &= ~TCP_WRITE_FLAG_COPY;
+        }
 
-        err = tcp_write(tcp_lw, buf, n, apiflags);
+        err = tcp_write(tcp_lw, (apiflags & TCP_WRITE_FLAG_COPY) ? buf : src, n, apiflags);
         if (err == ERR_OK) {
+            if (!(apiflags & TCP_WRITE_FLAG_COPY)) {
+                buffer pending = s->info.tcp.zc->pending;
+                tcp_zc_entry e = buffer_end(pending);
+                refcount_reserve(r);
+                e->r = r;
+                e->end_seq = tcp_lw->snd_lbb;
+                buffer_produce(pending, sizeof(*e));
+            } else if (zs && !(sgb && sgb->refcount)) {
+                zs->copied = true;
+            }
             if (sg)
                 sg_consume(sg, n);
             else
@@ -744,6 +1699,9 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         if (err == ERR_MEM) {
             /* XXX some ambiguity in lwIP - investigate */
             net_debug(" tcp_write() returned ERR_MEM\n");
+            if (zs)
+                netsock_zc_send_done(zs, rv > 0);
+            context_clear_err(ctx);
             goto full;
         } else {
             net_debug(" tcp_write() lwip error: %d\n", err);
@@ -751,12 +1709,15 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         }
         break;
     }
+    if (zs)
+        netsock_zc_send_done(zs, rv > 0);
     context_clear_err(ctx);
   write_done:
     if (err == ERR_OK) {
-        /* XXX prob add a flag to determine whether to continuously
-           post data, e.g. if used by send/sendto... */
-        err = tcp_output(tcp_lw);
+        /* a pending delayed ACK goes out with the data: the connection is interactive */
+        if (tcp_lw->flags & TF_ACK_DELAY)
+            s->info.tcp.pingpong = true;
+        err = netsock_tcp_push(s, tcp_lw, (flags & MSG_MORE) != 0);
         if (err == ERR_OK) {
             net_debug(" tcp_write and tcp_output successful for %ld bytes\n", rv);
             netsock_check_loop();
@@ -780,6 +1741,49 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     return rv;
 }
 
+/* Sends a datagram, or with UDP_SEGMENT a train of datagrams of the segment size (the last of which
+ * may be shorter); called with the socket locked. */
+static sysreturn socket_send_udp_locked(netsock s, void *source, sg_list sg, u64 length,
+                                        ip_addr_t *ipaddr, u16 port)
+{
+    context ctx = get_current_context(current_cpu());
+    u64 seg_size = s->info.udp.gso_size;
+    if (!seg_size)
+        seg_size = length;
+    else if (length > seg_size * UDP_MAX_SEGMENTS)
+        return -EINVAL;
+    u64 offset = 0;
+    do {
+        u64 seg_len = MIN(length - offset, seg_size);
+        struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, seg_len, PBUF_RAM);
+        if (!pbuf) {
+            msg_err("failed to allocate pbuf for udp_send()\n");
+            return -ENOBUFS;
+        }
+        if (context_set_err(ctx)) {
+            pbuf_free(pbuf);
+            return -EFAULT;
+        }
+        if (source)
+            runtime_memcpy(pbuf->payload, source + offset, seg_len);
+        else
+            sg_copy_to_buf(pbuf->payload, sg, seg_len);
+        context_clear_err(ctx);
+        err_t err;
+        if (ipaddr)
+            err = udp_sendto(s->info.udp.lw, pbuf, ipaddr, port);
+        else
+            err = udp_send(s->info.udp.lw, pbuf);
+        pbuf_free(pbuf);
+        if (err != ERR_OK) {
+            net_debug("lwip error %d\n", err);
+            return lwip_to_errno(err);
+        }
+        offset += seg_len;
+    } while (offset < length);
+    return length;
+}
+
 static sysreturn socket_write_udp(netsock s, void *source, sg_list sg, u64 length,
                                   struct sockaddr *dest_addr, socklen_t addrlen)
 {
@@ -795,43 +1799,18 @@ static sysreturn socket_write_udp(netsock s, void *source, sg_list sg, u64 lengt
         if (ret)
             return ret;
     }
-    err_t err = ERR_OK;
+    sysreturn rv;
 
     /* XXX check how much we can queue, maybe make udp bh */
     netsock_lock(s);
-    if (!dest_addr && !udp_is_flag_set(s->info.udp.lw, UDP_FLAGS_CONNECTED)) {
-        netsock_unlock(s);
-        return -EDESTADDRREQ;
-    }
-
-    struct pbuf *pbuf = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM);
-    if (!pbuf) {
-        netsock_unlock(s);
-        msg_err("failed to allocate pbuf for udp_send()\n");
-        return -ENOBUFS;
-    }
-    if (context_set_err(ctx)) {
-        netsock_unlock(s);
-        pbuf_free(pbuf);
-        return -EFAULT;
-    }
-    if (source)
-        runtime_memcpy(pbuf->payload, source, length);
+    if (!dest_addr && !udp_is_flag_set(s->info.udp.lw, UDP_FLAGS_CONNECTED))
+        rv = -EDESTADDRREQ;
     else
-        sg_copy_to_buf(pbuf->payload, sg, length);
-    context_clear_err(ctx);
-    if (dest_addr)
-        err = udp_sendto(s->info.udp.lw, pbuf, &ipaddr, port);
-    else
-        err = udp_send(s->info.udp.lw, pbuf);
+        rv = socket_send_udp_locked(s, source, sg, length, dest_addr ? &ipaddr : 0, port);
     netsock_unlock(s);
-    pbuf_free(pbuf);
-    if (err != ERR_OK) {
-        net_debug("lwip error %d\n", err);
-        return lwip_to_errno(err);
-    }
-    netsock_check_loop();
-    return length;
+    if (rv >= 0)
+        netsock_check_loop();
+    return rv;
 }
 
 static sysreturn socket_write_internal(struct sock *sock, void *source, sg_list sg,
@@ -843,10 +1822,16 @@ static sysreturn socket_write_internal(struct sock *sock, void *source, sg_list
     sysreturn rv;
 
     if (sock->type == SOCK_STREAM) {
-	if (s->info.tcp.state != TCP_SOCK_OPEN) { /* XXX maybe defer to lwip for connect state */
-	    rv = -EPIPE;
-	    goto out;
-	}
+        if ((flags & MSG_FASTOPEN) && (s->info.tcp.state == TCP_SOCK_CREATED)) {
+            rv = netsock_fastopen_connect(s, dest_addr, addrlen);
+            if (rv)
+                goto out;
+        }
+        if ((s->info.tcp.state != TCP_SOCK_OPEN) &&
+            !((flags & MSG_FASTOPEN) && (s->info.tcp.state == TCP_SOCK_IN_CONNECTION))) {
+            rv = -EPIPE;    /* XXX maybe defer to lwip for connect state */
+            goto out;
+        }
 
         if (length == 0) {
             rv = 0;
@@ -1006,6 +1991,7 @@ static sysreturn socket_set_mtu(struct ifreq *ifreq, struct netif *netif)
     if ((mtu <= 0) || (mtu > MTU_MAX))
         return -EINVAL;
     netif->mtu = mtu;
+    netlink_link_changed(netif);
     return 0;
 }
 
@@ -1142,21 +2128,58 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
     netsock s = struct_from_field(closure_self(), netsock, close);
     net_debug("sock %d, type %d\n", s->sock.fd, s->sock.type);
     struct tcp_pcb *tcp_lw;
+    reuseport_group group = 0;
     switch (s->sock.type) {
     case SOCK_STREAM:
+        if (s->info.tcp.group)
+            group = netsock_reuseport_leave(s);
+        /* the listening pcb stops being looked up by the SYN queue before it is closed */
+        if (group && group->syn)
+            tcp_syn_unlisten(group->syn);
+        if (s->info.tcp.syn) {
+            tcp_syn_unlisten(s->info.tcp.syn);
+            s->info.tcp.syn = 0;
+        }
         /* tcp_close() doesn't really stop everything synchronously; in order to
          * prevent any lwIP callback that might be called after tcp_close() from
          * using a stale reference to the socket structure, set the callback
          * argument to NULL. */
         tcp_lw = netsock_tcp_get(s);
         if (tcp_lw) {
+            if (s->info.tcp.state != TCP_SOCK_LISTENING)
+                tcp_syn_closed(tcp_lw);
             netsock_tcp_close(s, tcp_lw);
+            if (s->info.tcp.zc) {
+                tcp_zc_free(s->info.tcp.zc);
+                s->info.tcp.zc = 0;
+            }
             netsock_tcp_put(tcp_lw);
             tcp_unref(tcp_lw);
             netsock_check_loop();
         }
+        if (s->info.tcp.tls) {
+            netsock_tls_free(s->sock.h, s->info.tcp.tls);
+            s->info.tcp.tls = 0;
+        }
+        if (s->info.tcp.cc) {
+            tcp_cc_free(s->sock.h, s->info.tcp.cc);
+            s->info.tcp.cc = 0;
+        }
+        tcp_buf_mem_resize(s->info.tcp.sndbuf, TCP_SND_BUF, TCP_SND_BUF, false);
+        tcp_buf_mem_resize(s->rcvbuf, tcp_rcvbuf_init, tcp_rcvbuf_init, false);
+        if (group) {
+            /* the shared pcb has been closed by its last member */
+            deallocate_vector(group->members);
+            deallocate(s->sock.h, group, sizeof(*group));
+        }
         break;
     case SOCK_DGRAM:
+        netsock_lock(s);
+        udp_demux_entry demux = s->info.udp.demux;
+        s->info.udp.demux = INVALID_ADDRESS;    /* no registration from now on */
+        netsock_unlock(s);
+        if (demux)
+            udp_demux_remove(demux);
         udp_remove(s->info.udp.lw);
         break;
     }
@@ -1175,6 +2198,8 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
             break;
         }
     }
+    if (s->zc)
+        netsock_zc_detach(s->zc);
     deallocate_queue(s->incoming);
     socket_deinit(&s->sock);
     unix_cache_free(s->p->uh, socket, s);
@@ -1261,6 +2286,14 @@ sysreturn shutdown(int sockfd, int how)
     return s->shutdown(s, how);
 }
 
+/* Records the rx queue of received data (if known) for busy polling. */
+static void netsock_rx_napi(netsock s)
+{
+    net_napi napi = current_cpu()->net_rx_napi;
+    if (napi)
+        s->napi = napi;
+}
+
 static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
                             struct ip_globals *ip_data, u16 port)
 {
@@ -1272,8 +2305,9 @@ static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
 	      s->sock.fd, pcb, p, n[0], n[1], n[2], n[3], port);
     assert(pcb == s->info.udp.lw);
     if (p) {
+        trace(net_udp_rx, s->sock.fd, p->tot_len);
 	netsock_lock(s);
-	if ((s->sock.rx_len + p->tot_len > so_rcvbuf) || queue_full(s->incoming)) {
+	if ((s->sock.rx_len + p->tot_len > s->rcvbuf) || queue_full(s->incoming)) {
 	    netsock_unlock(s);
 	    pbuf_free(p);
 	    return;
@@ -1286,6 +2320,10 @@ static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
 	e->rport = port;
 	assert(enqueue(s->incoming, e));
 	s->sock.rx_len += p->tot_len;
+	netsock_rx_napi(s);
+	/* datagrams delivered by lwIP: look up the socket in the demux tables from now on */
+	if (!s->info.udp.demux)
+	    s->info.udp.demux = udp_demux_add(pcb);
 	wakeup_sock(s, WAKEUP_SOCK_RX);
     } else {
 	msg_err("null pbuf\n");
@@ -1333,6 +2371,32 @@ static int allocate_sock(process p, int af, int type, u32 flags, boolean alloc_f
     s->sock.recvmsg = netsock_recvmsg;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->reuseport = 0;
+    s->sndbuf_lock = 0;
+    s->rcvbuf_lock = 0;
+    s->rcvbuf = (type == SOCK_STREAM) ? tcp_rcvbuf_init : so_rcvbuf;
+    s->busy_poll = busy_read;
+    s->napi = 0;
+    s->zc = 0;
+    s->zerocopy = 0;
+    if (type == SOCK_STREAM) {
+        s->info.tcp.zc = 0;
+        s->info.tcp.group = 0;
+        s->info.tcp.tls = 0;
+        s->info.tcp.cc_ops = tcp_cc_default;
+        s->info.tcp.cc = 0;
+        s->info.tcp.syn = 0;
+        s->info.tcp.defer_accept = 0;
+        s->info.tcp.fastopen = 0;
+        s->info.tcp.cork = false;
+        s->info.tcp.pingpong = false;
+        s->info.tcp.snd_sml = 0;
+        s->info.tcp.sndbuf = TCP_SND_BUF;
+        s->info.tcp.sndbuf_debt = 0;
+        s->info.tcp.rcv_withheld = 0;
+        s->info.tcp.rcv_pending = 0;
+        s->info.tcp.rcv_rtt_start = 0;
+    }
     set_lwip_error(s, ERR_OK);
     if (alloc_fd) {
         fd = s->sock.fd = allocate_fd(p, s);
@@ -1354,6 +2418,20 @@ err_sock:
     return -ENOMEM;
 }
 
+/* Must be called with the pcb (if any) locked, or not yet visible to lwIP callbacks. */
+static sysreturn netsock_set_cc(netsock s, tcp_cc_ops ops)
+{
+    tcp_cc cc = tcp_cc_alloc(s->sock.h, ops);
+    if (cc == INVALID_ADDRESS)
+        return -ENOMEM;
+    tcp_cc old = s->info.tcp.cc;
+    s->info.tcp.cc_ops = ops;
+    s->info.tcp.cc = cc;
+    if (old)
+        tcp_cc_free(s->sock.h, old);
+    return 0;
+}
+
 static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags)
 {
     netsock s;
@@ -1363,6 +2441,11 @@ static int allocate_tcp_sock(process p, int af, struct tcp_pcb *pcb, u32 flags)
 	s->info.tcp.flags = pcb->flags & SOCK_TCP_CFG_FLAGS;
 	s->info.tcp.state = TCP_SOCK_CREATED;
 	tcp_ref(pcb);
+	if (netsock_set_cc(s, s->info.tcp.cc_ops) < 0) {
+	    deallocate_fd(p, fd);
+	    apply(s->sock.f.close, 0, io_completion_ignore);
+	    return -ENOMEM;
+	}
     }
     return fd;
 }
@@ -1374,11 +2457,24 @@ static int allocate_udp_sock(process p, int af, struct udp_pcb *pcb, u32 flags)
     if (fd >= 0) {
         s->info.udp.lw = pcb;
         s->info.udp.state = UDP_SOCK_CREATED;
+        s->info.udp.gso_size = 0;
+        s->info.udp.gro = false;
+        s->info.udp.demux = 0;
         udp_recv(pcb, udp_input_lower, s);
     }
     return fd;
 }
 
+static socket_family_open socket_families[AF_MAX];
+
+boolean socket_family_register(int domain, socket_family_open open)
+{
+    if ((domain < 0) || (domain >= AF_MAX) || socket_families[domain])
+        return false;
+    socket_families[domain] = open;
+    return true;
+}
+
 sysreturn socket(int domain, int type, int protocol)
 {
     switch (domain) {
@@ -1398,6 +2494,8 @@ sysreturn socket(int domain, int type, int protocol)
     case AF_VSOCK:
         return vsock_open(type, protocol);
     default:
+        if ((domain >= 0) && (domain < AF_MAX) && socket_families[domain])
+            return apply(socket_families[domain], type, protocol);
         msg_warn("domain %d not supported\n", domain);
         return -EAFNOSUPPORT;
     }
@@ -1456,14 +2554,23 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
     }
 
     /* A null pbuf indicates connection closed. */
+    trace(net_tcp_rx, s->sock.fd, p ? p->tot_len : 0);
     netsock_lock(s);
     if (p) {
-        if ((s->sock.rx_len + p->tot_len > so_rcvbuf) || !enqueue(s->incoming, p)) {
+        if ((s->sock.rx_len + p->tot_len > s->rcvbuf) || !enqueue(s->incoming, p)) {
 	    netsock_unlock(s);
 	    msg_err("incoming queue full\n");
             return ERR_BUF;     /* XXX verify */
         }
         s->sock.rx_len += p->tot_len;
+        netsock_rx_napi(s);
+        netsock_rcv_rtt_update(s, pcb);
+
+        /* Unless the connection is interactive (and the ACK can go out with the reply), a partial
+         * segment is acknowledged at once: the peer may be holding data with Nagle's algorithm
+         * until then. */
+        if (!s->info.tcp.pingpong && (p->tot_len < pcb->mss))
+            tcp_ack_now(pcb);
     }
     wakeup_sock(s, WAKEUP_SOCK_RX);
 
@@ -1539,6 +2646,9 @@ static void lwip_tcp_conn_err(void * z, err_t err) {
     netsock s = z;
     net_debug("sock %d, err %d\n", s->sock.fd, err);
     netsock_lock(s);
+    /* the pcb is gone, and any data still referencing zero-copy sources with it */
+    if (s->info.tcp.zc)
+        tcp_zc_release(s->info.tcp.zc, 0, true);
     s->info.tcp.state = TCP_SOCK_UNDEFINED;
     set_lwip_error(s, err);
     wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
@@ -1551,6 +2661,14 @@ static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
     }
     netsock s = (netsock)arg;
     net_debug("fd %d, pcb %p, len %d\n", s->sock.fd, pcb, len);
+    if (s->info.tcp.cc)
+        tcp_cc_ack(s->info.tcp.cc, pcb, len);
+    netsock_sndbuf_tune(s, pcb);
+    if (s->info.tcp.zc)
+        tcp_zc_release(s->info.tcp.zc, pcb->lastack, false);
+    netsock_tls tls = s->info.tcp.tls;
+    if (tls && tls->tx_pending)
+        netsock_tls_flush(tls, pcb, false); /* sent out by lwIP after this callback returns */
     netsock_lock(s);
     wakeup_sock(s, WAKEUP_SOCK_TX);
     return ERR_OK;
@@ -1629,13 +2747,14 @@ static err_t connect_tcp_complete(void* arg, struct tcp_pcb* tpcb, err_t err)
    }
    assert(s->info.tcp.state == TCP_SOCK_IN_CONNECTION);
    s->info.tcp.state = TCP_SOCK_OPEN;
+   netsock_rcv_init(s, tpcb);
    set_lwip_error(s, err);
    wakeup_sock(s, WAKEUP_SOCK_TX);
    return ERR_OK;
 }
 
-static inline sysreturn connect_tcp(netsock s, const ip_addr_t* address,
-                                    unsigned short port)
+/* Sends the SYN of a connection; called with the socket locked. */
+static sysreturn connect_tcp_start(netsock s, const ip_addr_t *address, unsigned short port)
 {
     sysreturn rv;
     net_debug("sock %d, tcp state %d, port %d\n", s->sock.fd,
@@ -1664,14 +2783,23 @@ static inline sysreturn connect_tcp(netsock s, const ip_addr_t* address,
     set_lwip_error(s, ERR_OK);
     err_t err = tcp_connect(lw, address, port, connect_tcp_complete);
     tcp_unlock(lw);
+    net_tcp_timer_kick();
     if (err != ERR_OK)
         return lwip_to_errno(err);
     netsock_check_loop();
+    return 0;
+  out:
+    return rv;
+}
 
+static inline sysreturn connect_tcp(netsock s, const ip_addr_t* address,
+                                    unsigned short port)
+{
+    sysreturn rv = connect_tcp_start(s, address, port);
+    if (rv)
+        return rv;
     return blockq_check(s->sock.txbq,
                         contextual_closure(connect_tcp_bh, s, current), false);
-  out:
-    return rv;
 }
 
 static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
@@ -1705,6 +2833,8 @@ static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
     } else if (s->sock.type == SOCK_DGRAM) {
         /* Set remote endpoint */
         ret = lwip_to_errno(udp_connect(s->info.udp.lw, &ipaddr, port));
+        if (!ret && s->info.udp.demux && (s->info.udp.demux != INVALID_ADDRESS))
+            udp_demux_update(s->info.udp.demux);
     } else {
         msg_err("can't connect on socket type %d\n", s->sock.type);
         ret = -EINVAL;
@@ -1715,6 +2845,30 @@ static sysreturn netsock_connect(struct sock *sock, struct sockaddr *addr,
     return ret;
 }
 
+/* MSG_FASTOPEN: the connection is initiated by sendto() or sendmsg(), whose data is sent as soon as
+ * the handshake completes (lwIP builds its own SYN, which carries no data). */
+static sysreturn netsock_fastopen_connect(netsock s, struct sockaddr *addr, socklen_t addrlen)
+{
+    if (!addr)
+        return -EDESTADDRREQ;
+    ip_addr_t ipaddr;
+    u16 port;
+    sysreturn ret;
+    context ctx = get_current_context(current_cpu());
+    if (!context_set_err(ctx)) {
+        ret = sockaddr_to_addrport(s, addr, addrlen, &ipaddr, &port);
+        context_clear_err(ctx);
+    } else {
+        ret = -EFAULT;
+    }
+    if (ret)
+        return ret;
+    netsock_lock(s);
+    ret = connect_tcp_start(s, &ipaddr, port);
+    netsock_unlock(s);
+    return ret;
+}
+
 sysreturn connect(int sockfd, struct sockaddr *addr, socklen_t addrlen)
 {
     if (!validate_user_memory(addr, addrlen, false))
@@ -1741,9 +2895,6 @@ static sysreturn sendto_prepare(struct sock *sock, int flags)
 	return -EOPNOTSUPP;
     }
 
-    if (flags & MSG_MORE)
-	msg_warn("MSG_MORE unimplemented; ignored\n");
-
     if (flags & MSG_NOSIGNAL)
 	msg_warn("MSG_NOSIGNAL unimplemented; ignored\n");
 
@@ -1794,7 +2945,7 @@ closure_function(2, 1, void, netsock_sendmsg_complete,
 }
 
 static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg, int flags,
-                                 boolean in_bh, io_completion completion)
+                                 context ctx, boolean in_bh, io_completion completion)
 {
     sysreturn rv = sendto_prepare(s, flags);
     if (rv < 0)
@@ -1804,14 +2955,13 @@ static sysreturn netsock_sendmsg(struct sock *s, const struct msghdr *msg, int f
         rv = -ENOMEM;
         goto out;
     }
-    io_completion complete = contextual_closure(netsock_sendmsg_complete, sg, completion);
+    io_completion complete = closure_from_context(ctx, netsock_sendmsg_complete, sg, completion);
     if (complete == INVALID_ADDRESS)
         goto err_dealloc_sg;
     if (!iov_to_sg(sg, msg->msg_iov, msg->msg_iovlen))
         goto err_dealloc_sg;
     return socket_write_internal(s, 0, sg, sg->count, flags,
-                                 msg->msg_name, msg->msg_namelen,
-                                 get_current_context(current_cpu()), in_bh, complete);
+                                 msg->msg_name, msg->msg_namelen, ctx, in_bh, complete);
   err_dealloc_sg:
     deallocate_sg_list(sg);
     rv = -ENOMEM;
@@ -1829,7 +2979,8 @@ sysreturn sendmsg(int sockfd, const struct msghdr *msg, int flags)
         socket_release(s);
         return -EOPNOTSUPP;
     }
-    return s->sendmsg(s, msg, flags, false, (io_completion)&s->f.io_complete);
+    return s->sendmsg(s, msg, flags, get_current_context(current_cpu()), false,
+                      (io_completion)&s->f.io_complete);
 }
 
 declare_closure_struct(0, 0, void, sendmmsg_next);
@@ -1865,8 +3016,56 @@ define_closure_function(0, 0, void, sendmmsg_next)
     closure_ref(sendmmsg_complete, completion) =
         struct_from_field(closure_self(), closure_struct_type(sendmmsg_complete) *, next);
     struct mmsghdr *hdr = &completion->msgvec[completion->index];
-    completion->s->sendmsg(completion->s, &hdr->msg_hdr, completion->flags, true,
-        (io_completion)completion);
+    completion->s->sendmsg(completion->s, &hdr->msg_hdr, completion->flags,
+        get_current_context(current_cpu()), true, (io_completion)completion);
+}
+
+/* Native batch path for UDP sockets: the datagrams are sent with the socket locked once, instead of
+ * going through the generic sendmsg path (and a trip through the runqueue) for each message. */
+static sysreturn netsock_sendmmsg_udp(netsock s, struct mmsghdr *msgvec, unsigned int vlen)
+{
+    context ctx = get_current_context(current_cpu());
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return -ENOMEM;
+    sysreturn rv = 0;
+    unsigned int index;
+    netsock_lock(s);
+    for (index = 0; index < vlen; index++) {
+        struct msghdr *msg = &msgvec[index].msg_hdr;
+        ip_addr_t ipaddr;
+        u16 port = 0;
+        boolean dest;
+        if (context_set_err(ctx)) {
+            sg_list_release(sg);
+            rv = -EFAULT;
+            break;
+        }
+        dest = (msg->msg_name != 0);
+        if (dest)
+            rv = sockaddr_to_addrport(s, msg->msg_name, msg->msg_namelen, &ipaddr, &port);
+        else if (!udp_is_flag_set(s->info.udp.lw, UDP_FLAGS_CONNECTED))
+            rv = -EDESTADDRREQ;
+        if (!rv && !iov_to_sg(sg, msg->msg_iov, msg->msg_iovlen))
+            rv = -ENOMEM;
+        context_clear_err(ctx);
+        if (!rv)
+            rv = socket_send_udp_locked(s, 0, sg, sg->count, dest ? &ipaddr : 0, port);
+        sg_list_release(sg);
+        if (rv < 0)
+            break;
+        if (!set_user_value(&msgvec[index].msg_len, (unsigned int)rv)) {
+            rv = -EFAULT;
+            break;
+        }
+        rv = 0;
+    }
+    netsock_unlock(s);
+    deallocate_sg_list(sg);
+    if (index == 0)
+        return rv;
+    netsock_check_loop();
+    return index;
 }
 
 sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
@@ -1884,6 +3083,12 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
     struct sock *s = resolve_socket(t->p, sockfd);
 
     net_debug("sock %d, type %d, flags 0x%x, vlen %d\n", s->fd, s->type, flags, vlen);
+    netsock ns = get_netsock(s);
+    if (ns && (s->type == SOCK_DGRAM)) {
+        sysreturn rv = netsock_sendmmsg_udp(ns, msgvec, vlen);
+        socket_release(s);
+        return rv;
+    }
     closure_struct(sendmmsg_next, next);
     contextual_closure_init(sendmmsg_next, &next);
     io_completion completion = contextual_closure(sendmmsg_complete,
@@ -1892,7 +3097,7 @@ sysreturn sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
         socket_release(s);
         return -ENOMEM;
     }
-    s->sendmsg(s, &msgvec->msg_hdr, flags, false, completion);
+    s->sendmsg(s, &msgvec->msg_hdr, flags, get_current_context(current_cpu()), false, completion);
     return thread_maybe_sleep_uninterruptible(t);
 }
 
@@ -1940,16 +3145,20 @@ sysreturn recvfrom(int sockfd, void * buf, u64 len, int flags,
 }
 
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
-                                 int flags, boolean in_bh, io_completion completion)
+                                 int flags, context ctx, boolean in_bh, io_completion completion)
 {
     netsock s = (netsock) sock;
     sysreturn rv;
 
+    if (flags & MSG_ERRQUEUE) {
+        rv = netsock_recv_errqueue(s, msg);
+        goto out;
+    }
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
         rv = (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN;
         goto out;
     }
-    blockq_action ba = contextual_closure(recvmsg_bh, s, msg, flags, completion);
+    blockq_action ba = closure_from_context(ctx, recvmsg_bh, s, msg, flags, completion);
     return blockq_check(sock->rxbq, ba, in_bh);
   out:
     return io_complete(completion, rv);
@@ -1965,7 +3174,8 @@ sysreturn recvmsg(int sockfd, struct msghdr *msg, int flags)
         socket_release(s);
         return -EOPNOTSUPP;
     }
-    return s->recvmsg(s, msg, flags, false, (io_completion)&s->f.io_complete);
+    return s->recvmsg(s, msg, flags, get_current_context(current_cpu()), false,
+                      (io_completion)&s->f.io_complete);
 }
 
 declare_closure_struct(0, 0, void, recvmmsg_next);
@@ -2004,8 +3214,41 @@ define_closure_function(0, 0, void, recvmmsg_next)
     closure_ref(recvmmsg_complete, completion) =
         struct_from_field(closure_self(), closure_struct_type(recvmmsg_complete) *, next);
     struct mmsghdr *hdr = &completion->msgvec[completion->index];
-    completion->s->recvmsg(completion->s, &hdr->msg_hdr, completion->flags, true,
-        (io_completion)completion);
+    completion->s->recvmsg(completion->s, &hdr->msg_hdr, completion->flags,
+        get_current_context(current_cpu()), true, (io_completion)completion);
+}
+
+/* Native batch path for UDP sockets: the queued datagrams, up to vlen, are received with the socket
+ * locked once; returns the number of messages received, which is 0 if no datagrams are queued or
+ * the socket is in a state that must be handled by the generic recvmsg path. */
+static sysreturn netsock_recvmmsg_udp(netsock s, struct mmsghdr *msgvec, unsigned int vlen,
+                                      int flags)
+{
+    context ctx = get_current_context(current_cpu());
+    unsigned int index = 0;
+    sysreturn rv = 0;
+    netsock_lock(s);
+    if ((s->info.udp.state == UDP_SOCK_SHUTDOWN) || (get_lwip_error(s) != ERR_OK) ||
+        queue_empty(s->incoming)) {
+        netsock_unlock(s);
+        return 0;
+    }
+    if (context_set_err(ctx)) {
+        rv = -EFAULT;
+        goto out;
+    }
+    while ((index < vlen) && !queue_empty(s->incoming)) {
+        struct mmsghdr *hdr = &msgvec[index];
+        hdr->msg_len = netsock_udp_dequeue(s, &hdr->msg_hdr, flags);
+        index++;
+    }
+    context_clear_err(ctx);
+  out:
+    if (queue_empty(s->incoming))
+        netsock_notify_events(s);   /* reset a triggered EPOLLIN condition */
+    else
+        netsock_unlock(s);
+    return (index > 0) ? index : rv;
 }
 
 sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags,
@@ -2024,24 +3267,34 @@ sysreturn recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int fl
     thread t = current;
     struct sock *s = resolve_socket(t->p, sockfd);
     net_debug("sock %d, type %d, flags 0x%x, vlen %d\n", s->fd, s->type, flags, vlen);
+    unsigned int index = 0;
+    netsock ns = get_netsock(s);
+    if (ns && (s->type == SOCK_DGRAM) && !(flags & MSG_PEEK)) {
+        sysreturn rv = netsock_recvmmsg_udp(ns, msgvec, vlen, flags);
+        if ((rv < 0) || (rv == vlen) || ((rv > 0) && ((flags & (MSG_WAITFORONE | MSG_DONTWAIT)) ||
+                                                      (s->f.flags & SOCK_NONBLOCK)))) {
+            socket_release(s);
+            return rv;
+        }
+
+        /* block for the remaining messages */
+        index = rv;
+    }
     closure_struct(recvmmsg_next, next);
     contextual_closure_init(recvmmsg_next, &next);
     io_completion completion = contextual_closure(recvmmsg_complete,
-                                                  s, msgvec, vlen, flags, 0, next);
+                                                  s, msgvec, vlen, flags, index, next);
     if (completion == INVALID_ADDRESS) {
         socket_release(s);
         return -ENOMEM;
     }
-    s->recvmsg(s, &msgvec->msg_hdr, flags & ~MSG_WAITFORONE, false, completion);
+    s->recvmsg(s, &msgvec[index].msg_hdr, flags & ~MSG_WAITFORONE,
+               get_current_context(current_cpu()), false, completion);
     return thread_maybe_sleep_uninterruptible(t);
 }
 
-static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
+static err_t netsock_accept_tcp(netsock s, struct tcp_pcb *lw, err_t err)
 {
-    if (!z) {
-        return ERR_CLSD;
-    }
-    netsock s = z;
     netsock_lock(s);
 
     if (err == ERR_MEM) {
@@ -2058,9 +3311,28 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     }
 
     net_debug("new socket %p, pcb %p\n", sn, lw);
+    if (netsock_set_cc(sn, s->info.tcp.cc_ops) < 0) {
+        sn->info.tcp.lw = 0;
+        apply(sn->sock.f.close, 0, io_completion_ignore);
+        err = ERR_MEM;      /* lwIP will do tcp_abort */
+        goto unlock_out;
+    }
     sn->info.tcp.lw = lw;
     tcp_ref(lw);
     sn->info.tcp.state = TCP_SOCK_OPEN;
+
+    /* buffer sizes set on the listening socket are inherited */
+    if (s->sndbuf_lock) {
+        sn->sndbuf_lock = 1;
+        tcp_buf_mem_resize(sn->info.tcp.sndbuf, s->info.tcp.sndbuf, TCP_SND_BUF, false);
+        netsock_sndbuf_resize(sn, lw, s->info.tcp.sndbuf);
+    }
+    if (s->rcvbuf_lock) {
+        sn->rcvbuf_lock = 1;
+        tcp_buf_mem_resize(sn->rcvbuf, s->rcvbuf, tcp_rcvbuf_init, false);
+        sn->rcvbuf = s->rcvbuf;
+    }
+    netsock_rcv_init(sn, lw);
     set_lwip_error(s, ERR_OK);
     tcp_arg(lw, sn);
     tcp_recv(lw, tcp_input_lower);
@@ -2082,10 +3354,126 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     return err;
 }
 
+static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
+{
+    if (!z) {
+        return ERR_CLSD;
+    }
+    return netsock_accept_tcp(z, lw, err);
+}
+
+/* Selects the group member for a new connection: members that accept on the current CPU (which
+ * received the segment completing the handshake) are preferred, and the remote address and port
+ * select among multiple candidates. Called with the group lock held. */
+static netsock netsock_reuseport_select(reuseport_group g, struct tcp_pcb *lw)
+{
+    u32 n = vector_length(g->members);
+    if (n == 0)
+        return 0;
+    u32 hash = 0;
+    if (lw) {
+        hash = lw->remote_port;
+        if (IP_IS_V6_VAL(lw->remote_ip)) {
+            for (int i = 0; i < 4; i++)
+                hash ^= ip_2_ip6(&lw->remote_ip)->addr[i];
+        } else {
+            hash ^= ip4_addr_get_u32(ip_2_ip4(&lw->remote_ip));
+        }
+        hash *= 0x9e3779b1;
+    }
+    u32 start = (hash >> 16) % n;
+    u64 cpu = current_cpu()->id;
+    for (u32 i = 0; i < n; i++) {
+        netsock s = vector_get(g->members, (start + i) % n);
+        if (s->info.tcp.accept_cpu == cpu)
+            return s;
+    }
+    return vector_get(g->members, start);
+}
+
+static err_t accept_tcp_reuseport(void *z, struct tcp_pcb *lw, err_t err)
+{
+    if (!z)
+        return ERR_CLSD;
+    reuseport_group g = z;
+    spin_lock(&g->lock);
+    netsock s = netsock_reuseport_select(g, lw);
+    err = s ? netsock_accept_tcp(s, lw, err) : ERR_CLSD;
+    spin_unlock(&g->lock);
+    return err;
+}
+
+/* Called with reuseport_lock held. */
+static reuseport_group netsock_reuseport_find(struct tcp_pcb *lw)
+{
+    list_foreach(&reuseport_groups, e) {
+        reuseport_group g = struct_from_list(e, reuseport_group, l);
+        if ((g->lw->local_port == lw->local_port) && ip_addr_cmp(&g->lw->local_ip, &lw->local_ip))
+            return g;
+    }
+    return 0;
+}
+
+/* Called with reuseport_lock and socket lock held. */
+static reuseport_group netsock_reuseport_create(netsock s, struct tcp_pcb *lw)
+{
+    reuseport_group g = allocate(s->sock.h, sizeof(*g));
+    if (g == INVALID_ADDRESS)
+        return 0;
+    g->members = allocate_vector(s->sock.h, 2);
+    if (g->members == INVALID_ADDRESS) {
+        deallocate(s->sock.h, g, sizeof(*g));
+        return 0;
+    }
+    vector_push(g->members, s);
+    g->lw = lw;
+    g->syn = 0;
+    spin_lock_init(&g->lock);
+    list_push_back(&reuseport_groups, &g->l);
+    return g;
+}
+
+/* Removes a socket from its SO_REUSEPORT group. If other members remain, the reference of the
+ * socket to the shared pcb is released and 0 is returned; otherwise the group is returned, and the
+ * caller closes the pcb as for any listening socket and then deallocates the group. */
+static reuseport_group netsock_reuseport_leave(netsock s)
+{
+    reuseport_group g = s->info.tcp.group;
+    spin_lock(&reuseport_lock);
+    spin_lock(&g->lock);
+    for (int i = 0; i < vector_length(g->members); i++) {
+        if (vector_get(g->members, i) == s) {
+            vector_delete(g->members, i);
+            break;
+        }
+    }
+    boolean last = (vector_length(g->members) == 0);
+    spin_unlock(&g->lock);
+    if (last)
+        list_delete(&g->l);
+    spin_unlock(&reuseport_lock);
+    struct tcp_pcb *tcp_lw = 0;
+    netsock_lock(s);
+    s->info.tcp.group = 0;
+    if (!last) {
+        tcp_lw = s->info.tcp.lw;
+        s->info.tcp.lw = 0;
+    }
+    netsock_unlock(s);
+    if (tcp_lw)
+        tcp_unref(tcp_lw);
+    return last ? g : 0;
+}
+
 static sysreturn netsock_listen(struct sock *sock, int backlog)
 {
     netsock s = (netsock) sock;
     sysreturn rv;
+    boolean reuseport = s->reuseport;
+    reuseport_group group = 0;
+    boolean join = false;
+    if (reuseport)
+        spin_lock(&reuseport_lock);
     netsock_lock(s);
     backlog = MIN(backlog, SOCK_QUEUE_LEN);
     if (s->sock.type != SOCK_STREAM) {
@@ -2101,17 +3489,52 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
         }
         goto unlock_out;
     }
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
-    tcp_unref(s->info.tcp.lw);
-    tcp_ref(lw);
-    s->info.tcp.lw = lw;
+    err_t err;
+    struct tcp_pcb * lw = tcp_listen_with_backlog_and_err(s->info.tcp.lw, backlog, &err);
+    if (!lw) {
+        /* another socket of an SO_REUSEPORT group is listening on the same address and port */
+        if (!reuseport || (err != ERR_USE) ||
+            !(group = netsock_reuseport_find(s->info.tcp.lw))) {
+            rv = lwip_to_errno(err);
+            goto unlock_out;
+        }
+        tcp_close(s->info.tcp.lw);
+        tcp_unref(s->info.tcp.lw);
+        lw = group->lw;
+        tcp_ref(lw);
+        s->info.tcp.lw = lw;
+        join = true;
+    } else {
+        tcp_unref(s->info.tcp.lw);
+        tcp_ref(lw);
+        s->info.tcp.lw = lw;
+        if (reuseport)
+            group = netsock_reuseport_create(s, lw);
+        tcp_syn_listener syn = tcp_syn_listen(lw, s->info.tcp.defer_accept, s->info.tcp.fastopen);
+        if (group) {
+            group->syn = syn;
+            tcp_arg(lw, group);
+            tcp_accept(lw, accept_tcp_reuseport);
+        } else {
+            s->info.tcp.syn = syn;
+            tcp_arg(lw, s);
+            tcp_accept(lw, accept_tcp_from_lwip);
+        }
+    }
     s->info.tcp.state = TCP_SOCK_LISTENING;
+    s->info.tcp.group = group;
+    s->info.tcp.accept_cpu = current_cpu()->id;
     set_lwip_error(s, ERR_OK);
-    tcp_arg(lw, s);
-    tcp_accept(lw, accept_tcp_from_lwip);
     rv = 0;
   unlock_out:
     netsock_unlock(s);
+    if (join) {
+        spin_lock(&group->lock);
+        vector_push(group->members, s);
+        spin_unlock(&group->lock);
+    }
+    if (reuseport)
+        spin_unlock(&reuseport_lock);
     socket_release(sock);
     return rv;
 }
@@ -2128,17 +3551,15 @@ sysreturn listen(int sockfd, int backlog)
 }
 
 closure_function(5, 1, sysreturn, accept_bh,
-                 netsock, s, thread, t, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+                 netsock, s, struct sockaddr *, addr, socklen_t *, addrlen, int, flags, io_completion, completion,
                  u64 bqflags)
 {
     netsock s = bound(s);
-    thread t = bound(t);
     netsock child = INVALID_ADDRESS;
     sysreturn rv = 0;
 
     err_t err = get_lwip_error(s);
-    net_debug("sock %d, target thread %ld, lwip err %d\n", s->sock.fd, t->tid,
-            err);
+    net_debug("sock %d, lwip err %d\n", s->sock.fd, err);
 
     if (err != ERR_OK) {
         rv = lwip_to_errno(err);
@@ -2214,15 +3635,13 @@ closure_function(5, 1, sysreturn, accept_bh,
   out:
     if ((rv < 0) && (child != INVALID_ADDRESS))
         apply(child->sock.f.close, 0, io_completion_ignore);
-    syscall_return(t, rv);
-
-    socket_release(&s->sock);
+    apply(bound(completion), rv);
     closure_finish();
     return rv;
 }
 
 static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags)
+        socklen_t *addrlen, int flags, context ctx, boolean in_bh, io_completion completion)
 {
     netsock s = (netsock) sock;
     sysreturn rv;
@@ -2236,12 +3655,16 @@ static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
         rv = -EINVAL;
         goto out;
     }
+    s->info.tcp.accept_cpu = current_cpu()->id;
 
-    blockq_action ba = contextual_closure(accept_bh, s, current, addr, addrlen, flags);
-    return blockq_check(sock->rxbq, ba, false);
+    blockq_action ba = closure_from_context(ctx, accept_bh, s, addr, addrlen, flags, completion);
+    if (ba == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    return blockq_check(sock->rxbq, ba, in_bh);
   out:
-    socket_release(sock);
-    return rv;
+    return io_complete(completion, rv);
 }
 
 sysreturn accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
@@ -2261,7 +3684,8 @@ sysreturn accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen,
         socket_release(sock);
         return -EOPNOTSUPP;
     }
-    return sock->accept4(sock, addr, addrlen, flags);
+    return sock->accept4(sock, addr, addrlen, flags, get_current_context(current_cpu()), false,
+                         (io_completion)&sock->f.io_complete);
 }
 
 sysreturn accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
@@ -2345,6 +3769,147 @@ sysreturn getpeername(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
     return rv;
 }
 
+#define TCP_ULP_NAME_MAX    16
+
+/* Attaches an upper layer protocol to a connected TCP socket; the only one implemented is "tls",
+ * which is available if a klib has registered the kTLS operations. */
+static sysreturn netsock_set_ulp(netsock s, void *optval, socklen_t optlen)
+{
+    char name[TCP_ULP_NAME_MAX];
+    optlen = MIN(optlen, sizeof(name) - 1);
+    if (!copy_from_user(optval, name, optlen))
+        return -EFAULT;
+    name[optlen] = '\0';
+    if (runtime_strcmp(sstring_from_cstring(name, sizeof(name)), ss("tls")) || !ktls)
+        return -ENOENT;
+    sysreturn rv;
+    netsock_lock(s);
+    if (s->info.tcp.state != TCP_SOCK_OPEN) {
+        rv = -ENOTCONN;
+    } else if (s->info.tcp.tls) {
+        rv = -EEXIST;
+    } else {
+        netsock_tls tls = allocate(s->sock.h, sizeof(*tls));
+        if (tls != INVALID_ADDRESS) {
+            zero(tls, sizeof(*tls));
+            s->info.tcp.tls = tls;
+            rv = 0;
+        } else {
+            rv = -ENOMEM;
+        }
+    }
+    netsock_unlock(s);
+    return rv;
+}
+
+/* As in Linux, the size requested with SO_SNDBUF or SO_RCVBUF is doubled, and disables autotuning
+ * of the buffer. */
+static sysreturn netsock_set_bufsize(netsock s, boolean snd, int val)
+{
+    if (val < 0)
+        return -EINVAL;
+    u64 size = 2 * (u64)val;
+    if (s->sock.type != SOCK_STREAM) {
+        if (!snd)
+            s->rcvbuf = MIN(MAX(size, 256), MAX(so_rcvbuf, tcp_rcvbuf_max));
+        return 0;
+    }
+    struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+    boolean open = tcp_lw && (s->info.tcp.state != TCP_SOCK_LISTENING);
+    if (snd) {
+        size = MIN(MAX(size, 2 * TCP_MSS), tcp_sndbuf_max);
+        tcp_buf_mem_resize(s->info.tcp.sndbuf, size, TCP_SND_BUF, false);
+        if (open)
+            netsock_sndbuf_resize(s, tcp_lw, size);
+        else
+            s->info.tcp.sndbuf = size;
+        s->sndbuf_lock = 1;
+    } else {
+        size = MIN(MAX(size, 2 * TCP_MSS), tcp_rcvbuf_max);
+        tcp_buf_mem_resize(s->rcvbuf, size, tcp_rcvbuf_init, false);
+        s->rcvbuf = size;
+        s->rcvbuf_lock = 1;
+        if (open && (s->info.tcp.state == TCP_SOCK_OPEN))
+            netsock_rcv_credit(s, tcp_lw, 0);
+    }
+    if (tcp_lw)
+        netsock_tcp_put(tcp_lw);
+    return 0;
+}
+
+static sysreturn netsock_set_congestion(netsock s, void *optval, socklen_t optlen)
+{
+    char name[TCP_CA_NAME_MAX];
+    optlen = MIN(optlen, sizeof(name) - 1);
+    if (!copy_from_user(optval, name, optlen))
+        return -EFAULT;
+    name[optlen] = '\0';
+    tcp_cc_ops ops = tcp_cc_find(sstring_from_cstring(name, sizeof(name)));
+    if (!ops)
+        return -ENOENT;
+    struct tcp_pcb *tcp_lw = netsock_tcp_get(s);
+    sysreturn rv = netsock_set_cc(s, ops);
+    if (tcp_lw)
+        netsock_tcp_put(tcp_lw);
+    return rv;
+}
+
+/* Hands the record layer of one direction of a TLS connection over to the kernel. */
+static sysreturn netsock_tls_setup(netsock s, boolean tx, void *optval, socklen_t optlen)
+{
+    u8 crypto_info[64];
+    if ((optlen < 2 * sizeof(u16)) || (optlen > sizeof(crypto_info)))
+        return -EINVAL;
+    if (!copy_from_user(optval, crypto_info, optlen))
+        return -EFAULT;
+    heap h = s->sock.h;
+    void *ctx;
+    sysreturn rv = ktls->init(h, crypto_info, optlen, &ctx);
+    zero(crypto_info, sizeof(crypto_info));
+    if (rv)
+        return rv;
+    u8 *rec = allocate(h, TLS_MAX_RECORD_LEN);
+    if (rec == INVALID_ADDRESS)
+        goto err_rec;
+    u8 *plain = 0;
+    if (tx) {
+        plain = allocate(h, TLS_MAX_PAYLOAD_LEN);
+        if (plain == INVALID_ADDRESS)
+            goto err_plain;
+    }
+    struct tcp_pcb *tcp_lw = netsock_tcp_get(s);    /* the transmit state is covered by the pcb lock */
+    netsock_lock(s);
+    netsock_tls tls = s->info.tcp.tls;
+    if (tx ? (tls->tx != 0) : (tls->rx != 0)) {
+        rv = -EBUSY;
+    } else if (tx) {
+        tls->tx_rec = rec;
+        tls->tx_plain = plain;
+        tls->tx_rec_len = tls->tx_pending = 0;
+        tls->tx = ctx;
+    } else {
+        tls->rx_rec = rec;
+        tls->rx_rec_len = tls->rx_plain_len = 0;
+        tls->rx_err = 0;
+        tls->rx = ctx;
+    }
+    netsock_unlock(s);
+    if (tcp_lw)
+        netsock_tcp_put(tcp_lw);
+    if (!rv)
+        return 0;
+    if (plain)
+        deallocate(h, plain, TLS_MAX_PAYLOAD_LEN);
+    deallocate(h, rec, TLS_MAX_RECORD_LEN);
+    ktls->deinit(ctx);
+    return rv;
+  err_plain:
+    deallocate(h, rec, TLS_MAX_RECORD_LEN);
+  err_rec:
+    ktls->deinit(ctx);
+    return -ENOMEM;
+}
+
 static sysreturn netsock_setsockopt(struct sock *sock, int level,
                                     int optname, void *optval, socklen_t optlen)
 {
@@ -2395,8 +3960,56 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
                 netsock_unlock(s);
             }
             break;
+        case SO_SNDBUF:
+        case SO_RCVBUF:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            rv = netsock_set_bufsize(s, optname == SO_SNDBUF, int_optval);
+            goto out;
         case SO_REUSEPORT:
-            goto unimplemented;
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->reuseport = !!int_optval;
+            /* lwIP needs SOF_REUSEADDR to bind multiple pcbs to the same address and port */
+            if (int_optval && (s->sock.type == SOCK_STREAM) && s->info.tcp.lw &&
+                (s->info.tcp.state == TCP_SOCK_CREATED))
+                ip_set_option(s->info.tcp.lw, SOF_REUSEADDR);
+            netsock_unlock(s);
+            break;
+        case SO_BUSY_POLL:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if (int_optval < 0) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->busy_poll = int_optval;
+            break;
+        case SO_ZEROCOPY:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if (s->sock.type != SOCK_STREAM) {
+                rv = -EOPNOTSUPP;
+                goto out;
+            }
+            netsock_lock(s);
+            if (int_optval && !s->zc) {
+                netsock_zc zc = netsock_zc_alloc(s);
+                if (zc == INVALID_ADDRESS) {
+                    netsock_unlock(s);
+                    rv = -ENOMEM;
+                    goto out;
+                }
+                s->zc = zc;
+            }
+            s->zerocopy = !!int_optval;
+            netsock_unlock(s);
+            break;
         default:
             goto unimplemented;
         }
@@ -2431,6 +4044,131 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
                 netsock_unlock(s);
             }
             break;
+        case TCP_ULP:
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            rv = netsock_set_ulp(s, optval, optlen);
+            goto out;
+        case TCP_CONGESTION:
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            rv = netsock_set_congestion(s, optval, optlen);
+            goto out;
+        case TCP_DEFER_ACCEPT:
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->info.tcp.defer_accept = MAX(int_optval, 0);
+            tcp_syn_listener syn = s->info.tcp.group ? s->info.tcp.group->syn : s->info.tcp.syn;
+            if (syn)
+                tcp_syn_set_defer_accept(syn, s->info.tcp.defer_accept);
+            netsock_unlock(s);
+            break;
+        case TCP_FASTOPEN:
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->info.tcp.fastopen = MAX(int_optval, 0);
+            syn = s->info.tcp.group ? s->info.tcp.group->syn : s->info.tcp.syn;
+            if (syn)
+                tcp_syn_set_fastopen(syn, s->info.tcp.fastopen);
+            netsock_unlock(s);
+            break;
+        case TCP_CORK:
+        case TCP_QUICKACK:
+            if ((s->sock.type != SOCK_STREAM)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            boolean flush;
+            if (optname == TCP_CORK) {
+                flush = s->info.tcp.cork && !int_optval;
+                s->info.tcp.cork = (int_optval != 0);
+            } else {
+                flush = (int_optval != 0);
+                s->info.tcp.pingpong = !int_optval;
+            }
+            tcp_lw = s->info.tcp.lw;
+            if (flush && tcp_lw && (s->info.tcp.state == TCP_SOCK_OPEN)) {
+                /* send the held data, or a pending delayed ACK */
+                tcp_ref(tcp_lw);
+                netsock_unlock(s);
+                tcp_lock(tcp_lw);
+                if (optname == TCP_QUICKACK) {
+                    if (tcp_lw->flags & TF_ACK_DELAY)
+                        tcp_ack_now(tcp_lw);
+                    tcp_output(tcp_lw);
+                } else {
+                    netsock_tcp_output_push(tcp_lw);
+                }
+                tcp_unlock(tcp_lw);
+                tcp_unref(tcp_lw);
+            } else {
+                netsock_unlock(s);
+            }
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_TLS:
+        if ((s->sock.type != SOCK_STREAM) || !s->info.tcp.tls) {
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        switch (optname) {
+        case TLS_TX:
+        case TLS_RX:
+            rv = netsock_tls_setup(s, optname == TLS_TX, optval, optlen);
+            goto out;
+        default:
+            goto unimplemented;
+        }
+        break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -ENOPROTOOPT;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if ((int_optval < 0) || (int_optval > U16_MAX)) {
+                rv = -EINVAL;
+                goto out;
+            }
+            netsock_lock(s);
+            s->info.udp.gso_size = int_optval;
+            netsock_unlock(s);
+            break;
+        case UDP_GRO:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->info.udp.gro = !!int_optval;
+            netsock_unlock(s);
+            break;
         default:
             goto unimplemented;
         }
@@ -2461,6 +4199,8 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
     union {
         int val;
         struct linger linger;
+        char ulp[TCP_ULP_NAME_MAX];
+        char cc[TCP_CA_NAME_MAX];
     } ret_optval;
     int ret_optlen = sizeof(ret_optval.val);
 
@@ -2474,10 +4214,10 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             ret_optval.val = -lwip_to_errno(get_and_clear_lwip_error(s));
             break;
         case SO_SNDBUF:
-            ret_optval.val = (s->sock.type == SOCK_STREAM) ? TCP_SND_BUF : 0;
+            ret_optval.val = (s->sock.type == SOCK_STREAM) ? s->info.tcp.sndbuf : 0;
             break;
         case SO_RCVBUF:
-            ret_optval.val = so_rcvbuf;
+            ret_optval.val = s->rcvbuf;
             break;
         case SO_PRIORITY:
             ret_optval.val = 0; /* default value in Linux */
@@ -2509,7 +4249,13 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             break;
         }
         case SO_REUSEPORT:
-            ret_optval.val = 0;
+            ret_optval.val = s->reuseport;
+            break;
+        case SO_BUSY_POLL:
+            ret_optval.val = s->busy_poll;
+            break;
+        case SO_ZEROCOPY:
+            ret_optval.val = s->zerocopy;
             break;
         case SO_PROTOCOL:
             ret_optval.val = s->sock.type == SOCK_STREAM ? IP_PROTO_TCP : IP_PROTO_UDP;
@@ -2550,13 +4296,34 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             ret_optval.val = TCP_FIN_WAIT_TIMEOUT / THOUSAND;
             break;
         case TCP_WINDOW_CLAMP:
-            ret_optval.val = TCP_WND_MAX(s->info.tcp.lw);
+            ret_optval.val = MIN(TCP_WND_MAX(s->info.tcp.lw), s->rcvbuf);
             break;
-        case TCP_CORK:
+        case TCP_ULP:
+            if (s->info.tcp.tls) {
+                runtime_memcpy(ret_optval.ulp, "tls", sizeof("tls"));
+                ret_optlen = sizeof("tls");
+            } else {
+                ret_optlen = 0;
+            }
+            break;
+        case TCP_CONGESTION: {
+            sstring name = tcp_cc_name(s->info.tcp.cc_ops);
+            runtime_memcpy(ret_optval.cc, name.ptr, name.len);
+            ret_optval.cc[name.len] = '\0';
+            ret_optlen = name.len + 1;
+            break;
+        }
         case TCP_DEFER_ACCEPT:
+            ret_optval.val = s->info.tcp.defer_accept;
+            break;
+        case TCP_CORK:
+            ret_optval.val = s->info.tcp.cork;
+            break;
         case TCP_QUICKACK:
+            ret_optval.val = !s->info.tcp.pingpong;
+            break;
         case TCP_FASTOPEN:
-            ret_optval.val = 0; /* unsupported options */
+            ret_optval.val = s->info.tcp.fastopen;
             break;
         default:
             goto unimplemented;
@@ -2571,6 +4338,22 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             goto unimplemented;
         }
         break;
+    case SOL_UDP:
+        if (s->sock.type != SOCK_DGRAM) {
+            rv = -EOPNOTSUPP;
+            goto out;
+        }
+        switch (optname) {
+        case UDP_SEGMENT:
+            ret_optval.val = s->info.udp.gso_size;
+            break;
+        case UDP_GRO:
+            ret_optval.val = s->info.udp.gro;
+            break;
+        default:
+            goto unimplemented;
+        }
+        break;
     default:
         rv = -EOPNOTSUPP;
         goto out;
@@ -2634,14 +4417,49 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
         so_rcvbuf = MIN(MAX(rcvbuf, 256), MASK(sizeof(so_rcvbuf) * 8 - 1));
     else
         so_rcvbuf = DEFAULT_SO_RCVBUF;
+    u64 sndbuf_max;
+    if (get_u64(cfg, sym(tcp_sndbuf_max), &sndbuf_max))
+        tcp_sndbuf_max = MIN(MAX(sndbuf_max, TCP_SND_BUF), MASK(31));
+    else
+        tcp_sndbuf_max = DEFAULT_TCP_SNDBUF_MAX;
+    tcp_rcvbuf_init = MIN(so_rcvbuf, TCP_RCVBUF_INIT);
+    u64 busy_read_us;
+    if (get_u64(cfg, sym(busy_read), &busy_read_us))
+        busy_read = MIN(busy_read_us, U32_MAX);
+    u64 rcvbuf_max;
+    if (get_u64(cfg, sym(tcp_rcvbuf_max), &rcvbuf_max))
+        tcp_rcvbuf_max = MIN(MAX(rcvbuf_max, tcp_rcvbuf_init), TCP_WND);
+    else
+        tcp_rcvbuf_max = TCP_WND;
+    value cc_name = get_string(cfg, sym(tcp_congestion));
+    if (cc_name) {
+        tcp_cc_ops ops = tcp_cc_find(buffer_to_sstring(cc_name));
+        if (ops)
+            tcp_cc_default = ops;
+        else
+            msg_err("invalid tcp_congestion value \"%b\"; using %s\n", cc_name,
+                    tcp_cc_name(tcp_cc_default));
+    }
     kernel_heaps kh = (kernel_heaps)uh;
+    if (!get_u64(cfg, sym(tcp_mem_max), &tcp_buf_mem_max))
+        tcp_buf_mem_max = heap_total((heap)heap_physical(kh)) / 8;
+    mm_register_mem_cleaner(init_closure_func(&tcp_mem_cleaner, mem_cleaner, tcp_mem_clean),
+                            ss("tcp_buffers"), MM_CLEANER_CACHE);
     heap h = heap_locked(kh);
-    caching_heap socket_cache = allocate_objcache(h, (heap)heap_page_backed(kh),
-                                                  sizeof(struct netsock), PAGESIZE, true);
+    udp_demux_init(h);
+    if (!tcp_syn_init(h, cfg))
+        return false;
+    heap socket_pages = mem_account_heap(h, (heap)heap_page_backed(kh), ss("sockets"));
+    if (socket_pages == INVALID_ADDRESS)
+        return false;
+    caching_heap socket_cache = allocate_objcache(h, socket_pages, sizeof(struct netsock),
+                                                  PAGESIZE, true);
     if (socket_cache == INVALID_ADDRESS)
 	return false;
     uh->socket_cache = socket_cache;
     net_loop_poll = closure(h, netsock_poll);
+    list_init(&reuseport_groups);
+    spin_lock_init(&reuseport_lock);
     netlink_init();
     vsock_init();
     return true;
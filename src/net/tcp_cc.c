@@ -0,0 +1,377 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/priv/tcp_priv.h>
+
+/* TCP congestion control algorithms alternative to the Reno-style one built into lwIP.
+ * lwIP offers no hook into its congestion window computations: an alternative algorithm runs from
+ * the sent callback of a connection, which lwIP invokes after processing each ACK that advances
+ * the send window, and overrides the congestion window and slow start threshold set by lwIP. Loss
+ * events are detected from lwIP changing the slow start threshold, which it does when entering fast
+ * recovery and on retransmission timeouts; during fast recovery, the congestion window is left to
+ * lwIP. Round trip times and delivery rates are sampled once per round trip. */
+
+//#define TCP_CC_DEBUG
+#ifdef TCP_CC_DEBUG
+#define tcp_cc_debug(x, ...) do {tprintf(sym(tcp_cc), 0, ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define tcp_cc_debug(x, ...)
+#endif
+
+#define TCP_CC_CWND_MAX (1ull << 30)
+
+struct tcp_cc_ops {
+    sstring name;
+    bytes priv_size;
+    void (*ack)(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t);
+    void (*round)(tcp_cc cc, struct tcp_pcb *pcb, u64 rtt_us, u64 bw, timestamp t);
+    void (*loss)(tcp_cc cc, struct tcp_pcb *pcb, boolean rto);
+};
+
+struct tcp_cc {
+    tcp_cc_ops ops;
+    boolean started;
+    tcpwnd_size_t cwnd;         /* values last set in the pcb */
+    tcpwnd_size_t ssthresh;
+    u32 rtt_seq;                /* an ACK beyond this sequence number ends the current sample */
+    timestamp rtt_start;        /* zero if no sample is in progress */
+    u64 rtt_delivered;
+    u64 delivered;              /* total bytes acknowledged */
+    u64 priv[0];
+};
+
+#define tcp_cc_priv(cc) ((void *)(cc)->priv)
+
+/* CUBIC (RFC 9438) */
+
+#define CUBIC_BETA          7       /* multiplicative decrease factor, in tenths */
+#define CUBIC_T_MAX_MS      1000000
+
+typedef struct cubic {
+    u64 w_max;                  /* window before the last reduction */
+    u64 w_est;                  /* Reno-friendly window, in 1/1024 bytes */
+    u64 acc;                    /* window increase not yet applied, in bytes times cwnd */
+    u64 k_ms;                   /* time to grow back to w_max */
+    timestamp epoch_start;      /* start of the current congestion avoidance period */
+    u64 min_rtt_us;
+} *cubic;
+
+/* Integer cube root (Hacker's Delight) */
+static u64 cubic_root(u64 x)
+{
+    u64 y = 0;
+    for (int s = 63; s >= 0; s -= 3) {
+        y += y;
+        u64 b = 3 * y * (y + 1) + 1;
+        if ((x >> s) >= b) {
+            x -= b << s;
+            y++;
+        }
+    }
+    return y;
+}
+
+/* W_cubic(t) = C * (t - K)^3 + W_max, with C = 0.4 segments/s^3 */
+static s64 cubic_window(cubic c, s64 t_ms, u32 mss)
+{
+    s64 d = t_ms - (s64)c->k_ms;
+    d = MAX(MIN(d, CUBIC_T_MAX_MS), -CUBIC_T_MAX_MS);
+    s64 segs_milli = d * d * d / 2500000;
+    return (s64)c->w_max + segs_milli * (s64)mss / 1000;
+}
+
+static void cubic_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t)
+{
+    cubic c = tcp_cc_priv(cc);
+    u32 mss = pcb->mss;
+    u64 cwnd = cc->cwnd;
+    if (cwnd < cc->ssthresh) {
+        cc->cwnd = MIN(cwnd + MIN(acked, 2 * mss), TCP_CC_CWND_MAX);
+        return;
+    }
+    if (!c->epoch_start) {
+        c->epoch_start = t;
+        c->acc = 0;
+        if (cwnd < c->w_max) {
+            c->k_ms = cubic_root((c->w_max - cwnd) * 2500000000ull / mss);
+        } else {
+            c->k_ms = 0;
+            c->w_max = cwnd;
+        }
+        c->w_est = cwnd << 10;
+    }
+    s64 t_ms = msec_from_timestamp(t - c->epoch_start) + c->min_rtt_us / THOUSAND;
+    s64 target = cubic_window(c, t_ms, mss);
+
+    /* Reno-friendly region: the window grows by 3 * (1 - beta) / (1 + beta) segments per RTT */
+    c->w_est += ((u64)acked * mss << 10) * 3 * (10 - CUBIC_BETA) / ((10 + CUBIC_BETA) * cwnd);
+    target = MAX(target, (s64)(c->w_est >> 10));
+
+    if (target > (s64)cwnd)
+        c->acc += (MIN(target, (s64)(cwnd + cwnd / 2)) - cwnd) * acked;
+    else
+        c->acc += (u64)acked * mss / 100;
+    cwnd += c->acc / cwnd;
+    c->acc %= cwnd;
+    cc->cwnd = MIN(cwnd, TCP_CC_CWND_MAX);
+}
+
+static void cubic_round(tcp_cc cc, struct tcp_pcb *pcb, u64 rtt_us, u64 bw, timestamp t)
+{
+    cubic c = tcp_cc_priv(cc);
+    if (!c->min_rtt_us || (rtt_us < c->min_rtt_us))
+        c->min_rtt_us = rtt_us;
+}
+
+static void cubic_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean rto)
+{
+    cubic c = tcp_cc_priv(cc);
+    u64 cwnd = cc->cwnd;
+    c->epoch_start = 0;
+
+    /* fast convergence: release bandwidth to flows that started more recently */
+    if (cwnd < c->w_max)
+        c->w_max = cwnd * (10 + CUBIC_BETA) / 20;
+    else
+        c->w_max = cwnd;
+    cc->ssthresh = MAX(cwnd * CUBIC_BETA / 10, 2 * pcb->mss);
+    cc->cwnd = rto ? pcb->cwnd : cc->ssthresh;
+    tcp_cc_debug("cwnd %ld, w_max %ld, ssthresh %d%s\n", cwnd, c->w_max, cc->ssthresh,
+                 rto ? ss(" (RTO)") : sstring_empty());
+}
+
+/* BBR: the congestion window is derived from a model of the path, made of the maximum delivery
+ * rate seen in the last BBR_BW_ROUNDS round trips and the minimum RTT seen in the last
+ * BBR_MIN_RTT_WIN. Since segments are not paced, the pacing gain cycle of the bandwidth probing
+ * state is applied to the congestion window. */
+
+#define BBR_UNIT            256
+#define BBR_HIGH_GAIN       739     /* 2 / ln(2) */
+#define BBR_BW_ROUNDS       10
+#define BBR_FULL_BW_ROUNDS  3
+#define BBR_CYCLE_LEN       8
+#define BBR_MIN_RTT_WIN     seconds(10)
+#define BBR_PROBE_RTT_TIME  milliseconds(200)
+#define BBR_MIN_CWND(mss)   (4 * (mss))
+#define BBR_CWND_EXTRA(mss) (3 * (mss))     /* headroom for delayed and stretched ACKs */
+
+static const u16 bbr_cycle_gain[BBR_CYCLE_LEN] = {
+    BBR_UNIT * 5 / 4, BBR_UNIT * 3 / 4, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT, BBR_UNIT
+};
+
+enum bbr_mode {
+    BBR_STARTUP,
+    BBR_DRAIN,
+    BBR_PROBE_BW,
+    BBR_PROBE_RTT,
+};
+
+typedef struct bbr {
+    enum bbr_mode mode;
+    u8 cycle_idx;
+    u8 full_bw_cnt;
+    boolean full_bw_reached;
+    u64 round;
+    u64 bw_samples[BBR_BW_ROUNDS];
+    u64 btl_bw;                 /* bytes per second */
+    u64 full_bw;
+    u64 min_rtt_us;
+    timestamp min_rtt_stamp;
+    timestamp probe_rtt_done;
+    u64 prior_cwnd;
+} *bbr;
+
+static u64 bbr_bdp(bbr b, u64 gain)
+{
+    return b->btl_bw * b->min_rtt_us / MILLION * gain / BBR_UNIT;
+}
+
+static void bbr_enter_probe_bw(bbr b)
+{
+    b->mode = BBR_PROBE_BW;
+    b->cycle_idx = BBR_CYCLE_LEN - 1 - random_u64() % (BBR_CYCLE_LEN - 1);
+}
+
+static void bbr_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked, timestamp t)
+{
+    bbr b = tcp_cc_priv(cc);
+    u32 mss = pcb->mss;
+    u64 cwnd = cc->cwnd;
+    if (!b->btl_bw) {
+        /* no path model yet */
+        cc->cwnd = MIN(cwnd + acked, TCP_CC_CWND_MAX);
+        return;
+    }
+    u64 gain;
+    switch (b->mode) {
+    case BBR_STARTUP:
+        gain = BBR_HIGH_GAIN;
+        break;
+    case BBR_DRAIN:
+        if ((u32)(pcb->snd_nxt - pcb->lastack) <= bbr_bdp(b, BBR_UNIT)) {
+            tcp_cc_debug("drained, bw %ld, min_rtt %ld us\n", b->btl_bw, b->min_rtt_us);
+            bbr_enter_probe_bw(b);
+            gain = bbr_cycle_gain[b->cycle_idx];
+        } else {
+            gain = BBR_UNIT;
+        }
+        break;
+    case BBR_PROBE_BW:
+        gain = bbr_cycle_gain[b->cycle_idx];
+        break;
+    case BBR_PROBE_RTT:
+        if (t < b->probe_rtt_done) {
+            cc->cwnd = MIN(cwnd, BBR_MIN_CWND(mss));
+            return;
+        }
+        b->min_rtt_stamp = t;
+        if (b->full_bw_reached)
+            bbr_enter_probe_bw(b);
+        else
+            b->mode = BBR_STARTUP;
+        cwnd = MAX(cwnd, b->prior_cwnd);
+        gain = (b->mode == BBR_STARTUP) ? BBR_HIGH_GAIN : bbr_cycle_gain[b->cycle_idx];
+        break;
+    default:
+        assert(0);
+    }
+    u64 target = bbr_bdp(b, gain) + BBR_CWND_EXTRA(mss);
+    if (b->full_bw_reached)
+        cwnd = MIN(cwnd + acked, target);
+    else if (cwnd < target)
+        cwnd += acked;
+    cc->cwnd = MIN(MAX(cwnd, BBR_MIN_CWND(mss)), TCP_CC_CWND_MAX);
+}
+
+static void bbr_round(tcp_cc cc, struct tcp_pcb *pcb, u64 rtt_us, u64 bw, timestamp t)
+{
+    bbr b = tcp_cc_priv(cc);
+    b->round++;
+    b->bw_samples[b->round % BBR_BW_ROUNDS] = bw;
+    b->btl_bw = 0;
+    for (int i = 0; i < BBR_BW_ROUNDS; i++)
+        b->btl_bw = MAX(b->btl_bw, b->bw_samples[i]);
+
+    boolean expired = b->min_rtt_us && (t - b->min_rtt_stamp > BBR_MIN_RTT_WIN);
+    if (!b->min_rtt_us || (rtt_us < b->min_rtt_us) || expired) {
+        b->min_rtt_us = rtt_us;
+        b->min_rtt_stamp = t;
+    }
+    if (expired && (b->mode != BBR_PROBE_RTT)) {
+        /* drain the queue at the bottleneck to measure the path RTT */
+        b->prior_cwnd = cc->cwnd;
+        b->mode = BBR_PROBE_RTT;
+        b->probe_rtt_done = t + BBR_PROBE_RTT_TIME;
+        return;
+    }
+    switch (b->mode) {
+    case BBR_STARTUP:
+        if (b->btl_bw >= b->full_bw * 5 / 4) {
+            b->full_bw = b->btl_bw;
+            b->full_bw_cnt = 0;
+        } else if (++b->full_bw_cnt >= BBR_FULL_BW_ROUNDS) {
+            tcp_cc_debug("full bandwidth %ld reached\n", b->full_bw);
+            b->full_bw_reached = true;
+            b->mode = BBR_DRAIN;
+        }
+        break;
+    case BBR_PROBE_BW:
+        b->cycle_idx = (b->cycle_idx + 1) % BBR_CYCLE_LEN;
+        break;
+    default:
+        break;
+    }
+}
+
+static void bbr_loss(tcp_cc cc, struct tcp_pcb *pcb, boolean rto)
+{
+    /* Losses are not a congestion signal for the model: the window is restored by lwIP when fast
+     * recovery ends, and grown back within the model after a retransmission timeout. */
+    cc->ssthresh = MAX(cc->cwnd, 2 * pcb->mss);
+    if (rto)
+        cc->cwnd = pcb->cwnd;
+}
+
+static const struct tcp_cc_ops tcp_cc_algs[] = {
+    {
+        .name = ss_static_init("reno"),
+    },
+    {
+        .name = ss_static_init("cubic"),
+        .priv_size = sizeof(struct cubic),
+        .ack = cubic_ack,
+        .round = cubic_round,
+        .loss = cubic_loss,
+    },
+    {
+        .name = ss_static_init("bbr"),
+        .priv_size = sizeof(struct bbr),
+        .ack = bbr_ack,
+        .round = bbr_round,
+        .loss = bbr_loss,
+    },
+};
+
+tcp_cc_ops tcp_cc_default = &tcp_cc_algs[0];
+
+tcp_cc_ops tcp_cc_find(sstring name)
+{
+    for (int i = 0; i < _countof(tcp_cc_algs); i++) {
+        if (!runtime_strcmp(tcp_cc_algs[i].name, name))
+            return &tcp_cc_algs[i];
+    }
+    return 0;
+}
+
+sstring tcp_cc_name(tcp_cc_ops ops)
+{
+    return ops->name;
+}
+
+tcp_cc tcp_cc_alloc(heap h, tcp_cc_ops ops)
+{
+    if (!ops->ack)
+        return 0;   /* built into lwIP */
+    bytes size = sizeof(struct tcp_cc) + ops->priv_size;
+    tcp_cc cc = allocate_zero(h, size);
+    if (cc != INVALID_ADDRESS)
+        cc->ops = ops;
+    return cc;
+}
+
+void tcp_cc_free(heap h, tcp_cc cc)
+{
+    deallocate(h, cc, sizeof(struct tcp_cc) + cc->ops->priv_size);
+}
+
+void tcp_cc_ack(tcp_cc cc, struct tcp_pcb *pcb, u32 acked)
+{
+    tcp_cc_ops ops = cc->ops;
+    timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
+    if (!cc->started) {
+        /* the initial window and threshold are set by lwIP when the connection is established */
+        cc->cwnd = pcb->cwnd;
+        cc->ssthresh = pcb->ssthresh;
+        cc->started = true;
+    }
+    cc->delivered += acked;
+    if (cc->rtt_start && TCP_SEQ_GT(pcb->lastack, cc->rtt_seq)) {
+        u64 rtt_us = MAX(usec_from_timestamp(t - cc->rtt_start), 1);
+        u64 bw = (cc->delivered - cc->rtt_delivered) * MILLION / rtt_us;
+        ops->round(cc, pcb, rtt_us, bw, t);
+        cc->rtt_start = 0;
+    }
+    if (!cc->rtt_start) {
+        cc->rtt_seq = pcb->snd_nxt;
+        cc->rtt_start = t;
+        cc->rtt_delivered = cc->delivered;
+    }
+    if (pcb->ssthresh != cc->ssthresh) {
+        /* lwIP has entered fast recovery, or retransmitted on timeout and reset the window */
+        ops->loss(cc, pcb, pcb->cwnd < pcb->ssthresh);
+        pcb->ssthresh = cc->ssthresh;
+    } else if (!(pcb->flags & TF_INFR)) {
+        ops->ack(cc, pcb, acked, t);
+    }
+    if (!(pcb->flags & TF_INFR))
+        pcb->cwnd = cc->cwnd;
+}
@@ -0,0 +1,742 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/priv/tcp_priv.h>
+
+/* SYN queue and SYN cookies for the listening sockets.
+ * lwIP allocates a pcb for each SYN it receives, and keeps it until the handshake completes or times
+ * out, so that a flood of connection requests exhausts memory. Instead, segments addressed to a
+ * registered listener are intercepted by the IP input hook before lwIP sees them: a SYN is answered
+ * directly with a SYN-ACK whose initial sequence number is a cookie (a keyed hash of the connection
+ * 4-tuple, the peer sequence number and a coarse timestamp, plus the encoded MSS and window scale
+ * options of the peer), and the request is recorded in a fixed-size table indexed by a hash of the
+ * 4-tuple. When the table slot is taken by another request, only the cookie is kept.
+ * An ACK that acknowledges a valid cookie (or matches a recorded request) completes the handshake:
+ * a SYN with the original options is synthesized and fed to lwIP, whose new pcb gets the cookie as
+ * its initial sequence number (via the ISN hook), and then the ACK is handed to lwIP as well. lwIP
+ * answers the synthesized SYN with a duplicate SYN-ACK, which the peer acknowledges again.
+ * Once a handshake has been completed, the table slot is kept as a marker of the connection until
+ * the cookie expires or the socket is closed, so that early segments of the connection (which
+ * acknowledge the cookie as well) are not mistaken for new handshakes.
+ * TCP Fast Open (RFC 7413) is implemented on the same path: a listener with a Fast Open queue length
+ * gives a cookie (a keyed hash of the peer address) to peers that request one, and a SYN that carries
+ * a valid cookie and data completes the handshake at once, its data being fed to lwIP in a segment
+ * that follows the synthesized SYN. */
+
+//#define TCP_SYN_DEBUG
+#ifdef TCP_SYN_DEBUG
+#define tcp_syn_debug(x, ...) do {tprintf(sym(tcp_syn), 0, ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define tcp_syn_debug(x, ...)
+#endif
+
+#define TCP_SYN_QUEUE_DEFAULT   4096
+#define TCP_SYN_QUEUE_TIMEOUT   64      /* seconds */
+#define TCP_SYN_LOCKS           64
+#define TCP_SYN_LISTENER_BUCKETS    64
+
+/* Cookie layout: 23-bit MAC, 2-bit counter of 64-second periods, 3-bit MSS index, 4-bit window
+ * scale; a cookie is accepted during the period in which it is generated and the next one. */
+#define TCP_SYN_COOKIE_PERIOD_ORDER 6
+#define TCP_SYN_COOKIE_MAC_SHIFT    9
+#define TCP_SYN_COOKIE_COUNT_SHIFT  7
+#define TCP_SYN_COOKIE_MSS_SHIFT    4
+#define TCP_SYN_COOKIE_LIFETIME     (2 << TCP_SYN_COOKIE_PERIOD_ORDER)
+
+#define TCP_SYN_NO_WSCALE       0xf
+#define TCP_SYN_DEFAULT_MSS     536
+
+#define TCP_SYN_TUPLE_WORDS     5
+
+#define TCP_SYN_OPT_FASTOPEN        34
+#define TCP_SYN_FASTOPEN_COOKIE_LEN 8
+
+static const u16 tcp_syn_mss_table[] = {536, 1220, 1300, 1380, 1440, 1460, 4312, 8960};
+
+enum tcp_syn_state {
+    TCP_SYN_RECEIVED = 1,
+    TCP_SYN_ESTABLISHED,
+};
+
+typedef struct tcp_syn_entry {
+    u64 tag;                    /* hash of the 4-tuple, 0 if the slot is free */
+    u32 cookie;
+    u32 peer_isn;
+    u32 expiry;                 /* in seconds */
+    u16 mss;
+    u8 wscale;
+    u8 state;
+} *tcp_syn_entry;
+
+struct tcp_syn_listener {
+    struct list l;
+    struct tcp_pcb_listen *lpcb;
+    u32 defer_accept;
+    u32 fastopen;               /* maximum number of pending Fast Open connections, 0 if disabled */
+};
+
+enum tcp_syn_fastopen {
+    TCP_SYN_FASTOPEN_OFF,
+    TCP_SYN_FASTOPEN_FULL,      /* too many pending connections: cookies are given but not accepted */
+    TCP_SYN_FASTOPEN_ON,
+};
+
+typedef struct tcp_syn_opts {
+    u16 mss;
+    u8 wscale;
+    s8 fastopen_len;            /* length of the Fast Open cookie, -1 if there is no Fast Open option */
+    u8 *fastopen_cookie;
+} *tcp_syn_opts;
+
+/* handshake being completed on a CPU: the ISN hook returns the cookie for the pcb created by lwIP */
+typedef struct tcp_syn_replay {
+    u32 isn;
+    u16 local_port, remote_port;
+    boolean active;
+    boolean used;
+} *tcp_syn_replay;
+
+typedef struct tcp_syn_pkt {
+    ip_addr_t src, dest;
+    struct tcp_hdr *tcph;
+    u16 iphlen;
+    u16 len;                    /* length of the IP packet */
+    u16 datalen;
+} *tcp_syn_pkt;
+
+static heap tcp_syn_heap;
+static u64 tcp_syncookies;
+static u64 tcp_syn_keys[6];     /* cookie key, ISN key, Fast Open key */
+static tcp_syn_entry tcp_syn_entries;
+static u64 tcp_syn_mask;
+static struct spinlock tcp_syn_locks[TCP_SYN_LOCKS];
+static struct list tcp_syn_listeners[TCP_SYN_LISTENER_BUCKETS];
+static u32 tcp_syn_listener_count;
+static struct rw_spinlock tcp_syn_lock;    /* covers listener registrations */
+static tcp_syn_replay tcp_syn_replays;
+
+static inline u64 tcp_syn_rotl(u64 x, int b)
+{
+    return (x << b) | (x >> (64 - b));
+}
+
+#define SIPROUND do {                                                           \
+        v0 += v1; v1 = tcp_syn_rotl(v1, 13); v1 ^= v0; v0 = tcp_syn_rotl(v0, 32); \
+        v2 += v3; v3 = tcp_syn_rotl(v3, 16); v3 ^= v2;                          \
+        v0 += v3; v3 = tcp_syn_rotl(v3, 21); v3 ^= v0;                          \
+        v2 += v1; v1 = tcp_syn_rotl(v1, 17); v1 ^= v2; v2 = tcp_syn_rotl(v2, 32); \
+    } while (0)
+
+/* SipHash-2-4 of n 64-bit words */
+static u64 tcp_syn_hash(const u64 *key, const u64 *m, int n)
+{
+    u64 v0 = 0x736f6d6570736575ull ^ key[0];
+    u64 v1 = 0x646f72616e646f6dull ^ key[1];
+    u64 v2 = 0x6c7967656e657261ull ^ key[0];
+    u64 v3 = 0x7465646279746573ull ^ key[1];
+    for (int i = 0; i < n; i++) {
+        v3 ^= m[i];
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m[i];
+    }
+    u64 b = (u64)(n * sizeof(u64)) << 56;
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static void tcp_syn_tuple(u64 *w, const ip_addr_t *local_ip, u16 local_port,
+                          const ip_addr_t *remote_ip, u16 remote_port)
+{
+    if (IP_IS_V6(local_ip)) {
+        const u32 *l = ip_2_ip6(local_ip)->addr, *r = ip_2_ip6(remote_ip)->addr;
+        w[0] = ((u64)l[1] << 32) | l[0];
+        w[1] = ((u64)l[3] << 32) | l[2];
+        w[2] = ((u64)r[1] << 32) | r[0];
+        w[3] = ((u64)r[3] << 32) | r[2];
+    } else {
+        w[0] = ip4_addr_get_u32(ip_2_ip4(local_ip));
+        w[1] = 0;
+        w[2] = ip4_addr_get_u32(ip_2_ip4(remote_ip));
+        w[3] = 0;
+    }
+    w[4] = ((u64)local_port << 16) | remote_port;
+}
+
+static inline u64 tcp_syn_tag(const u64 *tuple)
+{
+    return tcp_syn_hash(tcp_syn_keys, tuple, TCP_SYN_TUPLE_WORDS) | 1;
+}
+
+static u32 tcp_syn_cookie_mac(const u64 *tuple, u32 peer_isn, u32 count, u32 data)
+{
+    u64 m[TCP_SYN_TUPLE_WORDS + 1];
+    runtime_memcpy(m, tuple, TCP_SYN_TUPLE_WORDS * sizeof(u64));
+    m[TCP_SYN_TUPLE_WORDS] = ((u64)peer_isn << 32) | ((count & MASK(24)) << 8) | data;
+    return tcp_syn_hash(tcp_syn_keys, m, TCP_SYN_TUPLE_WORDS + 1) &
+           MASK(32 - TCP_SYN_COOKIE_MAC_SHIFT);
+}
+
+static u32 tcp_syn_cookie(const u64 *tuple, u32 peer_isn, u32 count, u16 mss, u8 wscale)
+{
+    int i;
+    for (i = _countof(tcp_syn_mss_table) - 1; i > 0; i--)
+        if (tcp_syn_mss_table[i] <= mss)
+            break;
+    u32 data = (i << TCP_SYN_COOKIE_MSS_SHIFT) | wscale;
+    return (tcp_syn_cookie_mac(tuple, peer_isn, count, data) << TCP_SYN_COOKIE_MAC_SHIFT) |
+           ((count & 3) << TCP_SYN_COOKIE_COUNT_SHIFT) | data;
+}
+
+static boolean tcp_syn_cookie_check(const u64 *tuple, u32 peer_isn, u32 count, u32 cookie,
+                                    u16 *mss, u8 *wscale)
+{
+    u32 age = (count - ((cookie >> TCP_SYN_COOKIE_COUNT_SHIFT) & 3)) & 3;
+    if (age > 1)
+        return false;
+    u32 data = cookie & MASK(TCP_SYN_COOKIE_COUNT_SHIFT);
+    if ((cookie >> TCP_SYN_COOKIE_MAC_SHIFT) != tcp_syn_cookie_mac(tuple, peer_isn, count - age, data))
+        return false;
+    *mss = tcp_syn_mss_table[data >> TCP_SYN_COOKIE_MSS_SHIFT];
+    *wscale = data & MASK(TCP_SYN_COOKIE_MSS_SHIFT);
+    return true;
+}
+
+static u64 tcp_syn_fastopen_cookie(const ip_addr_t *peer)
+{
+    u64 w[2];
+    if (IP_IS_V6(peer)) {
+        const u32 *a = ip_2_ip6(peer)->addr;
+        w[0] = ((u64)a[1] << 32) | a[0];
+        w[1] = ((u64)a[3] << 32) | a[2];
+    } else {
+        w[0] = ip4_addr_get_u32(ip_2_ip4(peer));
+        w[1] = 0;
+    }
+    return tcp_syn_hash(&tcp_syn_keys[4], w, 2);
+}
+
+static inline spinlock tcp_syn_slot_lock(tcp_syn_entry e)
+{
+    return &tcp_syn_locks[(e - tcp_syn_entries) & (TCP_SYN_LOCKS - 1)];
+}
+
+/* RFC 6528: a clock-driven counter plus a keyed hash of the connection 4-tuple */
+u32_t net_tcp_isn(const ip_addr_t *local_ip, u16_t local_port, const ip_addr_t *remote_ip,
+                  u16_t remote_port)
+{
+    if (tcp_syn_replays) {
+        tcp_syn_replay r = &tcp_syn_replays[current_cpu()->id];
+        if (r->active && (r->local_port == local_port) && (r->remote_port == remote_port)) {
+            r->used = true;
+            return r->isn;
+        }
+    }
+    u64 tuple[TCP_SYN_TUPLE_WORDS];
+    tcp_syn_tuple(tuple, local_ip, local_port, remote_ip, remote_port);
+    return usec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW)) / 4 +
+           tcp_syn_hash(&tcp_syn_keys[2], tuple, TCP_SYN_TUPLE_WORDS);
+}
+
+static boolean tcp_syn_parse(struct pbuf *p, struct netif *inp, tcp_syn_pkt pkt)
+{
+    if (p->len < IP_HLEN)
+        return false;
+    u16 len;
+    if (IP_HDR_GET_VERSION(p->payload) == 4) {
+        struct ip_hdr *iph = p->payload;
+        pkt->iphlen = IPH_HL_BYTES(iph);
+        len = lwip_ntohs(IPH_LEN(iph));
+        if ((IPH_PROTO(iph) != IP_PROTO_TCP) || (pkt->iphlen < IP_HLEN) || (len > p->tot_len) ||
+            (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF)) ||
+            (iph->dest.addr != ip4_addr_get_u32(netif_ip4_addr(inp))))
+            return false;
+        ip_addr_copy_from_ip4(pkt->src, iph->src);
+        ip_addr_copy_from_ip4(pkt->dest, iph->dest);
+    } else {
+        struct ip6_hdr *ip6h = p->payload;
+        pkt->iphlen = IP6_HLEN;
+        if ((p->len < IP6_HLEN) || (IP6H_NEXTH(ip6h) != IP6_NEXTH_TCP))
+            return false;
+        len = IP6_HLEN + IP6H_PLEN(ip6h);
+        if (len > p->tot_len)
+            return false;
+        ip6_addr_copy_from_packed(*ip_2_ip6(&pkt->src), ip6h->src);
+        ip6_addr_copy_from_packed(*ip_2_ip6(&pkt->dest), ip6h->dest);
+        IP_SET_TYPE_VAL(pkt->src, IPADDR_TYPE_V6);
+        IP_SET_TYPE_VAL(pkt->dest, IPADDR_TYPE_V6);
+        int i;
+        for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+            if (ip6_addr_isvalid(netif_ip6_addr_state(inp, i)) &&
+                ip6_addr_cmp_zoneless(ip_2_ip6(&pkt->dest), netif_ip6_addr(inp, i)))
+                break;
+        }
+        if (i == LWIP_IPV6_NUM_ADDRESSES)
+            return false;
+        ip6_addr_assign_zone(ip_2_ip6(&pkt->src), IP6_UNICAST, inp);
+        ip6_addr_assign_zone(ip_2_ip6(&pkt->dest), IP6_UNICAST, inp);
+    }
+    if ((len < pkt->iphlen + TCP_HLEN) || (p->len < pkt->iphlen + TCP_HLEN))
+        return false;
+    pkt->tcph = (struct tcp_hdr *)((u8 *)p->payload + pkt->iphlen);
+    u16 tcphlen = TCPH_HDRLEN_BYTES(pkt->tcph);
+    if ((tcphlen < TCP_HLEN) || (pkt->iphlen + tcphlen > len) || (p->len < pkt->iphlen + tcphlen))
+        return false;
+    pkt->len = len;
+    pkt->datalen = len - pkt->iphlen - tcphlen;
+    return true;
+}
+
+/* Checks the packet as lwIP would, before acting on it. */
+static boolean tcp_syn_csum_ok(struct pbuf *p, struct netif *inp, tcp_syn_pkt pkt)
+{
+    if (pkt->len < p->tot_len)
+        pbuf_realloc(p, pkt->len);
+    if (IP_IS_V4_VAL(pkt->src) && NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_IP) &&
+        inet_chksum(p->payload, pkt->iphlen))
+        return false;
+    if (!NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_TCP))
+        return true;
+    pbuf_remove_header(p, pkt->iphlen);
+    u16 sum = ip_chksum_pseudo(p, IP_PROTO_TCP, p->tot_len, &pkt->src, &pkt->dest);
+    pbuf_add_header(p, pkt->iphlen);
+    return (sum == 0);
+}
+
+static void tcp_syn_parse_opts(struct tcp_hdr *tcph, tcp_syn_opts opts)
+{
+    opts->mss = TCP_SYN_DEFAULT_MSS;
+    opts->wscale = TCP_SYN_NO_WSCALE;
+    opts->fastopen_len = -1;
+    u8 *opt = (u8 *)(tcph + 1);
+    u16 len = TCPH_HDRLEN_BYTES(tcph) - TCP_HLEN;
+    u16 i = 0;
+    while (i < len) {
+        u8 kind = opt[i];
+        if (kind == LWIP_TCP_OPT_EOL)
+            break;
+        if (kind == LWIP_TCP_OPT_NOP) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len)
+            break;
+        u8 optlen = opt[i + 1];
+        if ((optlen < 2) || (i + optlen > len))
+            break;
+        if ((kind == LWIP_TCP_OPT_MSS) && (optlen == LWIP_TCP_OPT_LEN_MSS)) {
+            opts->mss = MAX((opt[i + 2] << 8) | opt[i + 3], TCP_SYN_DEFAULT_MSS);
+        } else if ((kind == LWIP_TCP_OPT_WS) && (optlen == LWIP_TCP_OPT_LEN_WS)) {
+            opts->wscale = MIN(opt[i + 2], 14);
+        } else if (kind == TCP_SYN_OPT_FASTOPEN) {
+            opts->fastopen_len = optlen - 2;
+            opts->fastopen_cookie = &opt[i + 2];
+        }
+        i += optlen;
+    }
+}
+
+/* Writes the MSS and window scale options, and returns their length. */
+static u16 tcp_syn_write_opts(u8 *opt, u16 mss, u8 wscale)
+{
+    opt[0] = LWIP_TCP_OPT_MSS;
+    opt[1] = LWIP_TCP_OPT_LEN_MSS;
+    opt[2] = mss >> 8;
+    opt[3] = mss;
+    if (wscale == TCP_SYN_NO_WSCALE)
+        return LWIP_TCP_OPT_LEN_MSS;
+    opt[4] = LWIP_TCP_OPT_NOP;
+    opt[5] = LWIP_TCP_OPT_WS;
+    opt[6] = LWIP_TCP_OPT_LEN_WS;
+    opt[7] = wscale;
+    return LWIP_TCP_OPT_LEN_MSS + 1 + LWIP_TCP_OPT_LEN_WS;
+}
+
+/* Answers a SYN, acknowledging ackno; with a non-null fastopen_cookie, the SYN-ACK carries a Fast
+ * Open cookie for the peer. */
+static void tcp_syn_send_synack(struct netif *inp, tcp_syn_pkt pkt, u32 isn, u32 ackno,
+                                boolean wscale, u64 *fastopen_cookie)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_IP, TCP_HLEN + 20, PBUF_RAM);
+    if (!p)
+        return;
+    struct tcp_hdr *tcph = p->payload;
+    u8 *opt = (u8 *)(tcph + 1);
+    u16 mss = tcp_eff_send_mss_netif(TCP_MSS, inp, &pkt->src);
+    u16 hlen = TCP_HLEN + tcp_syn_write_opts(opt, mss, wscale ? TCP_RCV_SCALE : TCP_SYN_NO_WSCALE);
+    if (fastopen_cookie) {
+        opt = (u8 *)tcph + hlen;
+        opt[0] = TCP_SYN_OPT_FASTOPEN;
+        opt[1] = 2 + TCP_SYN_FASTOPEN_COOKIE_LEN;
+        runtime_memcpy(&opt[2], fastopen_cookie, TCP_SYN_FASTOPEN_COOKIE_LEN);
+        opt[2 + TCP_SYN_FASTOPEN_COOKIE_LEN] = LWIP_TCP_OPT_NOP;
+        opt[3 + TCP_SYN_FASTOPEN_COOKIE_LEN] = LWIP_TCP_OPT_NOP;
+        hlen += 4 + TCP_SYN_FASTOPEN_COOKIE_LEN;
+    }
+    pbuf_realloc(p, hlen);
+    tcph->src = pkt->tcph->dest;
+    tcph->dest = pkt->tcph->src;
+    tcph->seqno = lwip_htonl(isn);
+    tcph->ackno = lwip_htonl(ackno);
+    TCPH_HDRLEN_FLAGS_SET(tcph, hlen / 4, TCP_SYN | TCP_ACK);
+    tcph->wnd = lwip_htons(TCPWND_MIN16(TCP_WND));
+    tcph->chksum = 0;
+    tcph->urgp = 0;
+    if (NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_GEN_TCP))
+        tcph->chksum = ip_chksum_pseudo(p, IP_PROTO_TCP, hlen, &pkt->dest, &pkt->src);
+    ip_output_if(p, &pkt->dest, &pkt->src, TCP_TTL, 0, IP_PROTO_TCP, inp);
+    pbuf_free(p);
+}
+
+/* Builds a segment of the connection of the packet in p, from the peer, with the IP header of that
+ * packet; a SYN carries the given options, and the segment payload is the first datalen bytes of the
+ * payload of the packet. */
+static struct pbuf *tcp_syn_segment(struct pbuf *p, tcp_syn_pkt pkt, u32 seqno, u32 ackno, u8 flags,
+                                    u16 wnd, u16 mss, u8 wscale, u16 datalen)
+{
+    u16 len = pkt->iphlen + TCP_HLEN + 8 + datalen;
+    struct pbuf *q = pbuf_alloc(PBUF_RAW, len, PBUF_RAM);
+    if (!q)
+        return 0;
+    runtime_memcpy(q->payload, p->payload, pkt->iphlen);
+    struct tcp_hdr *tcph = (struct tcp_hdr *)((u8 *)q->payload + pkt->iphlen);
+    u16 hlen = TCP_HLEN;
+    if (flags & TCP_SYN)
+        hlen += tcp_syn_write_opts((u8 *)(tcph + 1), mss, wscale);
+    if (datalen)
+        pbuf_copy_partial(p, (u8 *)tcph + hlen, datalen,
+                          pkt->iphlen + TCPH_HDRLEN_BYTES(pkt->tcph));
+    len = pkt->iphlen + hlen + datalen;
+    pbuf_realloc(q, len);
+    tcph->src = pkt->tcph->src;
+    tcph->dest = pkt->tcph->dest;
+    tcph->seqno = lwip_htonl(seqno);
+    tcph->ackno = lwip_htonl(ackno);
+    TCPH_HDRLEN_FLAGS_SET(tcph, hlen / 4, flags);
+    tcph->wnd = lwip_htons(wnd);
+    tcph->chksum = 0;
+    tcph->urgp = 0;
+    if (IP_IS_V4_VAL(pkt->src)) {
+        struct ip_hdr *iph = q->payload;
+        IPH_LEN_SET(iph, lwip_htons(len));
+        IPH_CHKSUM_SET(iph, 0);
+        IPH_CHKSUM_SET(iph, inet_chksum(iph, pkt->iphlen));
+    } else {
+        IP6H_PLEN_SET((struct ip6_hdr *)q->payload, hlen + datalen);
+    }
+    pbuf_remove_header(q, pkt->iphlen);
+    tcph->chksum = ip_chksum_pseudo(q, IP_PROTO_TCP, hlen + datalen, &pkt->src, &pkt->dest);
+    pbuf_add_header(q, pkt->iphlen);
+    return q;
+}
+
+/* Feeds lwIP the SYN that started a completed handshake, followed by the segment (if any) with the
+ * data that came with it. */
+static void tcp_syn_inject(struct netif *inp, tcp_syn_pkt pkt, u32 isn, struct pbuf *syn,
+                           struct pbuf *data)
+{
+    tcp_syn_replay r = &tcp_syn_replays[current_cpu()->id];
+    r->isn = isn;
+    r->local_port = lwip_ntohs(pkt->tcph->dest);
+    r->remote_port = lwip_ntohs(pkt->tcph->src);
+    r->used = false;
+    r->active = true;
+    ip_input(syn, inp);
+    if (data)
+        ip_input(data, inp);
+    r->active = false;
+    tcp_syn_debug("port %d: pcb %s\n", r->local_port, r->used ? ss("created") : ss("not created"));
+}
+
+/* Looks up the listener of a segment; returns false if there is none. */
+static boolean tcp_syn_find_listener(tcp_syn_pkt pkt, u32 *defer_accept, boolean *backlog_full,
+                                     enum tcp_syn_fastopen *fastopen)
+{
+    u16 port = lwip_ntohs(pkt->tcph->dest);
+    struct tcp_pcb_listen *match = 0;
+    u32 defer = 0, fastopen_qlen = 0;
+    spin_rlock(&tcp_syn_lock);
+    list_foreach(&tcp_syn_listeners[port & (TCP_SYN_LISTENER_BUCKETS - 1)], e) {
+        tcp_syn_listener l = struct_from_list(e, tcp_syn_listener, l);
+        struct tcp_pcb_listen *lpcb = l->lpcb;
+        if (lpcb->local_port != port)
+            continue;
+        if ((IP_GET_TYPE(&lpcb->local_ip) != IPADDR_TYPE_ANY) &&
+            (IP_GET_TYPE(&lpcb->local_ip) != IP_GET_TYPE(&pkt->dest)))
+            continue;
+        if (ip_addr_cmp(&lpcb->local_ip, &pkt->dest)) {
+            /* an exact match takes precedence over a wildcard one */
+            match = lpcb;
+            defer = l->defer_accept;
+            fastopen_qlen = l->fastopen;
+            break;
+        }
+        if (ip_addr_isany(&lpcb->local_ip)) {
+            match = lpcb;
+            defer = l->defer_accept;
+            fastopen_qlen = l->fastopen;
+        }
+    }
+    if (match) {
+        *defer_accept = defer;
+        *backlog_full = (match->accepts_pending >= match->backlog);
+        *fastopen = !fastopen_qlen ? TCP_SYN_FASTOPEN_OFF :
+                    (match->accepts_pending >= fastopen_qlen) ? TCP_SYN_FASTOPEN_FULL :
+                    TCP_SYN_FASTOPEN_ON;
+    }
+    spin_runlock(&tcp_syn_lock);
+    return (match != 0);
+}
+
+/* Completes at once the handshake of a SYN with data and a valid Fast Open cookie; returns false if
+ * the handshake must go the regular way. */
+static boolean tcp_syn_fastopen(struct pbuf *p, struct netif *inp, tcp_syn_pkt pkt,
+                                tcp_syn_opts opts, u32 isn)
+{
+    u32 peer_isn = lwip_ntohl(pkt->tcph->seqno);
+    u16 wnd = lwip_ntohs(pkt->tcph->wnd);
+    struct pbuf *syn = tcp_syn_segment(p, pkt, peer_isn, 0, TCP_SYN, wnd, opts->mss, opts->wscale, 0);
+    if (!syn)
+        return false;
+    if (opts->wscale != TCP_SYN_NO_WSCALE)
+        wnd >>= opts->wscale;
+    struct pbuf *data = tcp_syn_segment(p, pkt, peer_isn + 1, isn + 1, TCP_ACK | TCP_PSH, wnd, 0, 0,
+                                        pkt->datalen);
+    if (!data) {
+        pbuf_free(syn);
+        return false;
+    }
+    tcp_syn_send_synack(inp, pkt, isn, peer_isn + 1 + pkt->datalen,
+                        opts->wscale != TCP_SYN_NO_WSCALE, 0);
+    tcp_syn_inject(inp, pkt, isn, syn, data);
+    return true;
+}
+
+static int tcp_syn_input_syn(struct pbuf *p, struct netif *inp, tcp_syn_pkt pkt, u64 *tuple,
+                             u64 tag, u32 secs, boolean backlog_full,
+                             enum tcp_syn_fastopen fastopen)
+{
+    if (!tcp_syn_csum_ok(p, inp, pkt))
+        return 0;
+    if (backlog_full)
+        goto drop;
+    struct tcp_syn_opts opts;
+    tcp_syn_parse_opts(pkt->tcph, &opts);
+    u32 peer_isn = lwip_ntohl(pkt->tcph->seqno);
+    u32 cookie = tcp_syn_cookie(tuple, peer_isn, secs >> TCP_SYN_COOKIE_PERIOD_ORDER, opts.mss,
+                                opts.wscale);
+    u64 fastopen_cookie;
+    boolean fastopen_valid = false;
+    if ((fastopen != TCP_SYN_FASTOPEN_OFF) && (opts.fastopen_len >= 0)) {
+        fastopen_cookie = tcp_syn_fastopen_cookie(&pkt->src);
+        fastopen_valid = (opts.fastopen_len == TCP_SYN_FASTOPEN_COOKIE_LEN) &&
+                         !runtime_memcmp(opts.fastopen_cookie, &fastopen_cookie,
+                                         TCP_SYN_FASTOPEN_COOKIE_LEN);
+    }
+    boolean fastopen_accept = fastopen_valid && pkt->datalen &&
+                              (fastopen == TCP_SYN_FASTOPEN_ON);
+    tcp_syn_entry e = &tcp_syn_entries[tag & tcp_syn_mask];
+    spinlock lock = tcp_syn_slot_lock(e);
+    spin_lock(lock);
+    boolean live = e->tag && ((s32)(e->expiry - secs) > 0);
+    if (live && (e->tag == tag) && (e->state == TCP_SYN_ESTABLISHED)) {
+        /* let lwIP handle a SYN for an existing connection */
+        spin_unlock(lock);
+        return 0;
+    }
+    if (fastopen_accept) {
+        if (!live || (e->tag == tag)) {
+            e->tag = tag;
+            e->expiry = secs + TCP_SYN_COOKIE_LIFETIME;
+            e->state = TCP_SYN_ESTABLISHED;
+        }
+    } else if ((tcp_syncookies == 1) && (!live || (e->tag == tag))) {
+        e->tag = tag;
+        e->cookie = cookie;
+        e->peer_isn = peer_isn;
+        e->expiry = secs + TCP_SYN_QUEUE_TIMEOUT;
+        e->mss = opts.mss;
+        e->wscale = opts.wscale;
+        e->state = TCP_SYN_RECEIVED;
+    }
+    spin_unlock(lock);
+    if (fastopen_accept && tcp_syn_fastopen(p, inp, pkt, &opts, cookie))
+        goto drop;
+
+    /* The data of a SYN without a valid cookie is not acknowledged, and is sent again by the peer
+     * after the handshake; a peer that requested a cookie, or presented an invalid one, gets a new
+     * cookie. */
+    boolean fastopen_give = (fastopen != TCP_SYN_FASTOPEN_OFF) && (opts.fastopen_len >= 0) &&
+                            !fastopen_valid;
+    tcp_syn_send_synack(inp, pkt, cookie, peer_isn + 1, opts.wscale != TCP_SYN_NO_WSCALE,
+                        fastopen_give ? &fastopen_cookie : 0);
+  drop:
+    pbuf_free(p);
+    return 1;
+}
+
+static int tcp_syn_input_ack(struct pbuf *p, struct netif *inp, tcp_syn_pkt pkt, u64 *tuple,
+                             u64 tag, u32 secs, u32 defer_accept, boolean backlog_full)
+{
+    u32 cookie = lwip_ntohl(pkt->tcph->ackno) - 1;
+    u32 peer_isn = lwip_ntohl(pkt->tcph->seqno) - 1;
+    u16 mss;
+    u8 wscale;
+    tcp_syn_entry e = &tcp_syn_entries[tag & tcp_syn_mask];
+    spinlock lock = tcp_syn_slot_lock(e);
+    spin_lock(lock);
+    boolean live = e->tag && ((s32)(e->expiry - secs) > 0);
+    if (live && (e->tag == tag) && (e->state == TCP_SYN_ESTABLISHED))
+        goto pass;
+    if (live && (e->tag == tag) && (e->cookie == cookie) && (e->peer_isn == peer_isn)) {
+        mss = e->mss;
+        wscale = e->wscale;
+    } else if (!tcp_syn_cookie_check(tuple, peer_isn, secs >> TCP_SYN_COOKIE_PERIOD_ORDER, cookie,
+                                     &mss, &wscale)) {
+        goto pass;
+    }
+    spin_unlock(lock);
+    if (!tcp_syn_csum_ok(p, inp, pkt))
+        return 0;
+    u8 flags = TCPH_FLAGS(pkt->tcph);
+    if ((defer_accept && !pkt->datalen && !(flags & TCP_FIN)) || backlog_full) {
+        /* TCP_DEFER_ACCEPT: the handshake is completed when the peer sends data */
+        pbuf_free(p);
+        return 1;
+    }
+    spin_lock(lock);
+    if (!live || (e->tag == tag)) {
+        e->tag = tag;
+        e->expiry = secs + TCP_SYN_COOKIE_LIFETIME;
+        e->state = TCP_SYN_ESTABLISHED;
+    }
+    spin_unlock(lock);
+    struct pbuf *syn = tcp_syn_segment(p, pkt, peer_isn, 0, TCP_SYN, lwip_ntohs(pkt->tcph->wnd), mss,
+                                       wscale, 0);
+    if (syn)
+        tcp_syn_inject(inp, pkt, cookie, syn, 0);
+    return 0;
+  pass:
+    spin_unlock(lock);
+    return 0;
+}
+
+/* Called from the IP input hook; returns non-zero if the packet has been consumed. */
+int net_tcp_syn_input(struct pbuf *p, struct netif *inp)
+{
+    if (!tcp_syn_listener_count || tcp_syn_replays[current_cpu()->id].active)
+        return 0;
+    struct tcp_syn_pkt pkt;
+    if (!tcp_syn_parse(p, inp, &pkt))
+        return 0;
+    u8 flags = TCPH_FLAGS(pkt.tcph);
+    boolean syn = ((flags & (TCP_SYN | TCP_ACK | TCP_RST | TCP_FIN)) == TCP_SYN);
+    if (!syn && ((flags & (TCP_SYN | TCP_ACK | TCP_RST)) != TCP_ACK))
+        return 0;
+    u32 defer_accept;
+    boolean backlog_full;
+    enum tcp_syn_fastopen fastopen;
+    if (!tcp_syn_find_listener(&pkt, &defer_accept, &backlog_full, &fastopen))
+        return 0;
+    u64 tuple[TCP_SYN_TUPLE_WORDS];
+    tcp_syn_tuple(tuple, &pkt.dest, lwip_ntohs(pkt.tcph->dest), &pkt.src,
+                  lwip_ntohs(pkt.tcph->src));
+    u64 tag = tcp_syn_tag(tuple);
+    u32 secs = sec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW));
+    if (syn)
+        return tcp_syn_input_syn(p, inp, &pkt, tuple, tag, secs, backlog_full, fastopen);
+    return tcp_syn_input_ack(p, inp, &pkt, tuple, tag, secs, defer_accept, backlog_full);
+}
+
+tcp_syn_listener tcp_syn_listen(struct tcp_pcb *lw, u32 defer_accept, u32 fastopen)
+{
+    if (!tcp_syncookies)
+        return 0;
+    tcp_syn_listener l = allocate(tcp_syn_heap, sizeof(*l));
+    if (l == INVALID_ADDRESS)
+        return 0;
+    l->lpcb = (struct tcp_pcb_listen *)lw;
+    l->defer_accept = defer_accept;
+    l->fastopen = fastopen;
+    spin_wlock(&tcp_syn_lock);
+    list_push_back(&tcp_syn_listeners[lw->local_port & (TCP_SYN_LISTENER_BUCKETS - 1)], &l->l);
+    tcp_syn_listener_count++;
+    spin_wunlock(&tcp_syn_lock);
+    return l;
+}
+
+void tcp_syn_unlisten(tcp_syn_listener l)
+{
+    spin_wlock(&tcp_syn_lock);
+    list_delete(&l->l);
+    tcp_syn_listener_count--;
+    spin_wunlock(&tcp_syn_lock);
+    deallocate(tcp_syn_heap, l, sizeof(*l));
+}
+
+void tcp_syn_set_defer_accept(tcp_syn_listener l, u32 secs)
+{
+    l->defer_accept = secs;
+}
+
+void tcp_syn_set_fastopen(tcp_syn_listener l, u32 qlen)
+{
+    l->fastopen = qlen;
+}
+
+void tcp_syn_closed(struct tcp_pcb *pcb)
+{
+    if (!tcp_syn_entries)
+        return;
+    u64 tuple[TCP_SYN_TUPLE_WORDS];
+    tcp_syn_tuple(tuple, &pcb->local_ip, pcb->local_port, &pcb->remote_ip, pcb->remote_port);
+    u64 tag = tcp_syn_tag(tuple);
+    tcp_syn_entry e = &tcp_syn_entries[tag & tcp_syn_mask];
+    spinlock lock = tcp_syn_slot_lock(e);
+    spin_lock(lock);
+    if (e->tag == tag)
+        e->tag = 0;
+    spin_unlock(lock);
+}
+
+boolean tcp_syn_init(heap h, tuple cfg)
+{
+    for (int i = 0; i < _countof(tcp_syn_keys); i++)
+        tcp_syn_keys[i] = random_u64();
+    u64 mode;
+    if (!get_u64(cfg, sym(tcp_syncookies), &mode))
+        mode = 1;
+    if (mode == 0)
+        return true;
+    tcp_syn_replays = allocate_zero(h, present_processors * sizeof(struct tcp_syn_replay));
+    if (tcp_syn_replays == INVALID_ADDRESS) {
+        tcp_syn_replays = 0;
+        return false;
+    }
+    u64 len;
+    if (!get_u64(cfg, sym(tcp_max_syn_backlog), &len))
+        len = TCP_SYN_QUEUE_DEFAULT;
+    len = U64_FROM_BIT(find_order(MAX(len, TCP_SYN_LOCKS)));
+    tcp_syn_entries = allocate_zero(h, len * sizeof(struct tcp_syn_entry));
+    if (tcp_syn_entries == INVALID_ADDRESS) {
+        tcp_syn_entries = 0;
+        return false;
+    }
+    tcp_syn_mask = len - 1;
+    for (int i = 0; i < TCP_SYN_LOCKS; i++)
+        spin_lock_init(&tcp_syn_locks[i]);
+    for (int i = 0; i < TCP_SYN_LISTENER_BUCKETS; i++)
+        list_init(&tcp_syn_listeners[i]);
+    spin_rw_lock_init(&tcp_syn_lock);
+    tcp_syn_heap = h;
+    tcp_syncookies = MIN(mode, 2);
+    return true;
+}
@@ -0,0 +1,254 @@
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/udp.h>
+#include <lwip/prot/udp.h>
+
+/* Hash-indexed demultiplexing of received UDP datagrams.
+ * lwIP looks up the destination pcb of a datagram by walking the list of all UDP pcbs, which costs
+ * a scan of thousands of entries per datagram when many sockets are open. Instead, datagrams
+ * addressed to a registered pcb are delivered by the IP input hook before lwIP sees them, after a
+ * lookup in two hash tables:
+ * - connected pcbs, keyed by local port and remote address and port;
+ * - unconnected pcbs, keyed by local port.
+ * A pcb is looked up in the second table only if it is bound to its port exclusively (without
+ * SO_REUSEADDR), so that no pcb unknown to these tables (e.g. a pcb internal to lwIP, or a socket not
+ * registered yet) can be a better match for the datagram: anything else is left to lwIP. */
+
+//#define UDP_DEMUX_DEBUG
+#ifdef UDP_DEMUX_DEBUG
+#define udp_demux_debug(x, ...) do {tprintf(sym(udp_demux), 0, ss("%s: " x), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define udp_demux_debug(x, ...)
+#endif
+
+#define UDP_DEMUX_BUCKETS_ORDER 10
+#define UDP_DEMUX_BUCKETS       U64_FROM_BIT(UDP_DEMUX_BUCKETS_ORDER)
+
+struct udp_demux_entry {
+    struct list l;
+    struct udp_pcb *pcb;
+};
+
+typedef struct udp_demux_pkt {
+    ip_addr_t src, dest;
+    struct udp_hdr *udph;
+    u16 iphlen;
+    u16 len;                    /* length of the IP packet */
+} *udp_demux_pkt;
+
+static heap udp_demux_heap;
+static u64 udp_demux_seed;
+static struct list udp_demux_connected[UDP_DEMUX_BUCKETS];
+static struct list udp_demux_bound[UDP_DEMUX_BUCKETS];
+static u32 udp_demux_count;
+static struct rw_spinlock udp_demux_lock;
+
+static inline u64 udp_demux_mix(u64 h, u64 v)
+{
+    h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+}
+
+static u64 udp_demux_hash(u16 local_port, const ip_addr_t *remote_ip, u16 remote_port)
+{
+    u64 h = udp_demux_mix(udp_demux_seed, ((u64)local_port << 16) | remote_port);
+    if (!remote_ip)
+        return h >> (64 - UDP_DEMUX_BUCKETS_ORDER);
+    if (IP_IS_V6(remote_ip)) {
+        const u32 *a = ip_2_ip6(remote_ip)->addr;
+        h = udp_demux_mix(h, ((u64)a[1] << 32) | a[0]);
+        h = udp_demux_mix(h, ((u64)a[3] << 32) | a[2]);
+    } else {
+        h = udp_demux_mix(h, ip4_addr_get_u32(ip_2_ip4(remote_ip)));
+    }
+    return h >> (64 - UDP_DEMUX_BUCKETS_ORDER);
+}
+
+/* Inserts an entry in the table matching the current state of its pcb; called with the table
+ * write-locked. */
+static void udp_demux_insert(udp_demux_entry e)
+{
+    struct udp_pcb *pcb = e->pcb;
+    if (pcb->flags & UDP_FLAGS_CONNECTED)
+        list_push_back(&udp_demux_connected[udp_demux_hash(pcb->local_port, &pcb->remote_ip,
+                                                            pcb->remote_port)], &e->l);
+    else
+        list_push_back(&udp_demux_bound[udp_demux_hash(pcb->local_port, 0, 0)], &e->l);
+}
+
+static boolean udp_demux_parse(struct pbuf *p, struct netif *inp, udp_demux_pkt pkt)
+{
+    if (p->len < IP_HLEN)
+        return false;
+    u16 len;
+    if (IP_HDR_GET_VERSION(p->payload) == 4) {
+        struct ip_hdr *iph = p->payload;
+        pkt->iphlen = IPH_HL_BYTES(iph);
+        len = lwip_ntohs(IPH_LEN(iph));
+        if ((IPH_PROTO(iph) != IP_PROTO_UDP) || (pkt->iphlen < IP_HLEN) || (len > p->tot_len) ||
+            (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF)) ||
+            (iph->dest.addr != ip4_addr_get_u32(netif_ip4_addr(inp))))
+            return false;
+        if (NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_IP) &&
+            ((p->len < pkt->iphlen) || inet_chksum(iph, pkt->iphlen)))
+            return false;
+        ip_addr_copy_from_ip4(pkt->src, iph->src);
+        ip_addr_copy_from_ip4(pkt->dest, iph->dest);
+    } else {
+        struct ip6_hdr *ip6h = p->payload;
+        pkt->iphlen = IP6_HLEN;
+        if ((p->len < IP6_HLEN) || (IP6H_NEXTH(ip6h) != IP6_NEXTH_UDP))
+            return false;
+        len = IP6_HLEN + IP6H_PLEN(ip6h);
+        if (len > p->tot_len)
+            return false;
+        ip6_addr_copy_from_packed(*ip_2_ip6(&pkt->src), ip6h->src);
+        ip6_addr_copy_from_packed(*ip_2_ip6(&pkt->dest), ip6h->dest);
+        IP_SET_TYPE_VAL(pkt->src, IPADDR_TYPE_V6);
+        IP_SET_TYPE_VAL(pkt->dest, IPADDR_TYPE_V6);
+        int i;
+        for (i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
+            if (ip6_addr_isvalid(netif_ip6_addr_state(inp, i)) &&
+                ip6_addr_cmp_zoneless(ip_2_ip6(&pkt->dest), netif_ip6_addr(inp, i)))
+                break;
+        }
+        if (i == LWIP_IPV6_NUM_ADDRESSES)
+            return false;
+        ip6_addr_assign_zone(ip_2_ip6(&pkt->src), IP6_UNICAST, inp);
+        ip6_addr_assign_zone(ip_2_ip6(&pkt->dest), IP6_UNICAST, inp);
+    }
+    if ((len < pkt->iphlen + UDP_HLEN) || (p->len < pkt->iphlen + UDP_HLEN))
+        return false;
+    pkt->udph = (struct udp_hdr *)((u8 *)p->payload + pkt->iphlen);
+    if (lwip_ntohs(pkt->udph->len) != len - pkt->iphlen)
+        return false;
+    pkt->len = len;
+    return true;
+}
+
+static boolean udp_demux_local_match(struct udp_pcb *pcb, udp_demux_pkt pkt, struct netif *inp,
+                                     u16 port)
+{
+    if ((pcb->local_port != port) ||
+        ((pcb->netif_idx != NETIF_NO_INDEX) && (pcb->netif_idx != netif_get_index(inp))))
+        return false;
+    if (IP_IS_ANY_TYPE_VAL(pcb->local_ip))
+        return true;
+    if (IP_GET_TYPE(&pcb->local_ip) != IP_GET_TYPE(&pkt->dest))
+        return false;
+    return ip_addr_isany(&pcb->local_ip) || ip_addr_cmp(&pcb->local_ip, &pkt->dest);
+}
+
+static struct udp_pcb *udp_demux_lookup(udp_demux_pkt pkt, struct netif *inp)
+{
+    u16 local_port = lwip_ntohs(pkt->udph->dest);
+    u16 remote_port = lwip_ntohs(pkt->udph->src);
+    list_foreach(&udp_demux_connected[udp_demux_hash(local_port, &pkt->src, remote_port)], e) {
+        struct udp_pcb *pcb = struct_from_list(e, udp_demux_entry, l)->pcb;
+        if ((pcb->flags & UDP_FLAGS_CONNECTED) && (pcb->remote_port == remote_port) &&
+            ip_addr_cmp(&pcb->remote_ip, &pkt->src) &&
+            udp_demux_local_match(pcb, pkt, inp, local_port))
+            return pcb;
+    }
+    list_foreach(&udp_demux_bound[udp_demux_hash(local_port, 0, 0)], e) {
+        struct udp_pcb *pcb = struct_from_list(e, udp_demux_entry, l)->pcb;
+        if (!(pcb->flags & UDP_FLAGS_CONNECTED) && !ip_get_option(pcb, SOF_REUSEADDR) &&
+            udp_demux_local_match(pcb, pkt, inp, local_port))
+            return pcb;
+    }
+    return 0;
+}
+
+static boolean udp_demux_csum_ok(struct pbuf *p, struct netif *inp, udp_demux_pkt pkt)
+{
+    if (!NETIF_CHECKSUM_ENABLED(inp, NETIF_CHECKSUM_CHECK_UDP) ||
+        (IP_IS_V4_VAL(pkt->src) && !pkt->udph->chksum))
+        return true;
+    pbuf_remove_header(p, pkt->iphlen);
+    u16 sum = ip_chksum_pseudo(p, IP_PROTO_UDP, p->tot_len, &pkt->src, &pkt->dest);
+    pbuf_add_header(p, pkt->iphlen);
+    return (sum == 0);
+}
+
+/* Called from the IP input hook; returns non-zero if the packet has been consumed. */
+int net_udp_demux_input(struct pbuf *p, struct netif *inp)
+{
+    if (!udp_demux_count)
+        return 0;
+    struct udp_demux_pkt pkt;
+    if (!udp_demux_parse(p, inp, &pkt))
+        return 0;
+    if (pkt.len < p->tot_len)
+        pbuf_realloc(p, pkt.len);
+    spin_rlock(&udp_demux_lock);
+    struct udp_pcb *pcb = udp_demux_lookup(&pkt, inp);
+    if (!pcb || !pcb->recv || !udp_demux_csum_ok(p, inp, &pkt)) {
+        /* let lwIP handle (or drop) the datagram */
+        spin_runlock(&udp_demux_lock);
+        return 0;
+    }
+    struct ip_globals ip_data;
+    zero(&ip_data, sizeof(ip_data));
+    ip_data.current_netif = ip_data.current_input_netif = inp;
+    if (IP_IS_V4_VAL(pkt.src))
+        ip_data.current_ip4_header = p->payload;
+    else
+        ip_data.current_ip6_header = p->payload;
+    ip_data.current_ip_header_tot_len = pkt.iphlen;
+    ip_addr_copy(ip_data.current_iphdr_src, pkt.src);
+    ip_addr_copy(ip_data.current_iphdr_dest, pkt.dest);
+    u16 remote_port = lwip_ntohs(pkt.udph->src);
+    pbuf_remove_header(p, pkt.iphlen + UDP_HLEN);
+    udp_demux_debug("pcb %p, port %d, len %d\n", pcb, pcb->local_port, p->tot_len);
+
+    /* the table stays read-locked so that the pcb cannot be removed during delivery */
+    pcb->recv(pcb->recv_arg, pcb, p, &ip_data, remote_port);
+    spin_runlock(&udp_demux_lock);
+    return 1;
+}
+
+/* Registers a bound pcb; the pcb must be unregistered before it is removed. */
+udp_demux_entry udp_demux_add(struct udp_pcb *pcb)
+{
+    if (!udp_demux_heap)
+        return 0;
+    udp_demux_entry e = allocate(udp_demux_heap, sizeof(*e));
+    if (e == INVALID_ADDRESS)
+        return 0;
+    e->pcb = pcb;
+    spin_wlock(&udp_demux_lock);
+    udp_demux_insert(e);
+    udp_demux_count++;
+    spin_wunlock(&udp_demux_lock);
+    return e;
+}
+
+void udp_demux_remove(udp_demux_entry e)
+{
+    spin_wlock(&udp_demux_lock);
+    list_delete(&e->l);
+    udp_demux_count--;
+    spin_wunlock(&udp_demux_lock);
+    deallocate(udp_demux_heap, e, sizeof(*e));
+}
+
+/* moves the entry of a pcb that has been connected */
+void udp_demux_update(udp_demux_entry e)
+{
+    spin_wlock(&udp_demux_lock);
+    list_delete(&e->l);
+    udp_demux_insert(e);
+    spin_wunlock(&udp_demux_lock);
+}
+
+void udp_demux_init(heap h)
+{
+    udp_demux_seed = random_u64();
+    for (int i = 0; i < UDP_DEMUX_BUCKETS; i++) {
+        list_init(&udp_demux_connected[i]);
+        list_init(&udp_demux_bound[i]);
+    }
+    spin_rw_lock_init(&udp_demux_lock);
+    udp_demux_heap = h;
+}
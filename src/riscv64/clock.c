@@ -11,6 +11,7 @@
 
 clock_now platform_monotonic_now;
 clock_timer platform_timer;
+timestamp platform_timer_max;
 
 static u64 read_rtc(void)
 {
@@ -60,5 +61,6 @@ void init_clock(void)
     register_platform_clock_timer(init_closure_func(&_deadline_timer, clock_timer,
                                                     riscv_deadline_timer),
                                   init_closure(&_timer_percpu_init, riscv_timer_percpu_init));
+    platform_timer_max = microseconds(RUNLOOP_TIMER_IDLE_MAX_PERIOD_US);
 }
 
@@ -169,8 +169,12 @@ void unregister_interrupt(int vector)
     if (vector == 0)
         return;
     int_debug("%s: vector %d\n", func_ss, vector);
-    if (vector <= PLIC_MAX_INT)
+    if (vector <= PLIC_MAX_INT) {
+        int target_cpu = plic_get_int_target(vector);
+        if (target_cpu >= 0)
+            irq_put_target_cpu(target_cpu);
         plic_disable_int(vector);
+    }
     if (list_empty(&handlers[vector]))
         halt("%s: no handler registered for vector %d\n", func_ss, vector);
     list_foreach(&handlers[vector], l) {
@@ -368,31 +372,61 @@ void trap_exception(void)
     vm_exit(VM_EXIT_FAULT);
 }
 
-static void send_ipi_internal(u64 cpu, u8 vector)
+/* IPIs are sent with the SBI hart mask interface: the mask covers 64 harts starting at hart_base,
+ * so IPIs to multiple harts whose IDs fall within the same window take a single SBI call. */
+typedef struct ipi_batch {
+    u64 hart_mask;
+    u64 hart_base;
+} *ipi_batch;
+
+static void ipi_batch_flush(ipi_batch b)
+{
+    if (!b->hart_mask)
+        return;
+    struct sbiret r = supervisor_ecall(SBI_EXT_IPI, SBI_EXT_IPI_SEND_IPI,
+                                       b->hart_mask, b->hart_base, 0, 0, 0, 0);
+    assert(r.error == 0);
+    b->hart_mask = 0;
+}
+
+static void ipi_batch_add(ipi_batch b, u64 cpu, u8 vector)
 {
-    /* get hartid for cpu */
     cpuinfo target_ci = cpuinfo_from_id(cpu);
     u64 hartid = target_ci->m.hartid;
     assert(vector >= IPI_BASE_INT && vector <= IPI_MAX_INT);
     atomic_set_bit(&target_ci->m.ipi_mask, vector - IPI_BASE_INT);
-    // rewrite to actually use mask, adjust hbase; otherwise limited to 64 cpus
-    struct sbiret r = supervisor_ecall(SBI_EXT_IPI, SBI_EXT_IPI_SEND_IPI,
-                                       (1ull << hartid), 0, 0, 0, 0, 0);
-    assert(r.error == 0);
+    if (b->hart_mask && ((hartid < b->hart_base) || (hartid >= b->hart_base + 64)))
+        ipi_batch_flush(b);
+    if (!b->hart_mask)
+        b->hart_base = hartid & ~MASK(6);
+    b->hart_mask |= U64_FROM_BIT(hartid - b->hart_base);
 }
 
 void send_ipi(u64 cpu, u8 vector)
 {
+    struct ipi_batch b = {0};
     if (cpu == TARGET_EXCLUSIVE_BROADCAST) {
         cpuinfo ci = current_cpu();
         for (int i = 0; i < present_processors; i++) {
             if (i == ci->id)
                 continue;
-            send_ipi_internal(i, vector);
+            ipi_batch_add(&b, i, vector);
         }
     } else {
-        send_ipi_internal(cpu, vector);
+        ipi_batch_add(&b, cpu, vector);
+    }
+    ipi_batch_flush(&b);
+}
+
+void send_ipi_mask(u64 *cpus, u8 vector)
+{
+    struct ipi_batch b = {0};
+    u64 self = current_cpu()->id;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        if ((cpu != self) && (cpus[cpu / 64] & U64_FROM_BIT(cpu % 64)))
+            ipi_batch_add(&b, cpu, vector);
     }
+    ipi_batch_flush(&b);
 }
 
 void init_interrupts(kernel_heaps kh)
@@ -178,17 +178,23 @@ void count_cpus_present(void)
 #define EXTENDED_FRAME_SIZE (FRAME_EXTENDED_MAX * sizeof(u64))
 void init_context_machine(context c)
 {
-    void *e = allocate_zero((heap)heap_page_backed(get_kernel_heaps()),
-                            EXTENDED_FRAME_SIZE);
-    assert(e != INVALID_ADDRESS);
+    void *e;
+    if ((c->type == CONTEXT_TYPE_THREAD) && ((e = thread_extended_frame_get()) != INVALID_ADDRESS)) {
+        zero(e, EXTENDED_FRAME_SIZE);
+    } else {
+        e = allocate_zero((heap)heap_page_backed(get_kernel_heaps()), EXTENDED_FRAME_SIZE);
+        assert(e != INVALID_ADDRESS);
+    }
     c->frame[FRAME_EXTENDED] = u64_from_pointer(e);
 }
 
 void destruct_context(context c)
 {
     if (c->frame[FRAME_EXTENDED]) {
-        deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
-                       c->frame[FRAME_EXTENDED], EXTENDED_FRAME_SIZE);
+        if ((c->type != CONTEXT_TYPE_THREAD) ||
+            !thread_extended_frame_put(pointer_from_u64(c->frame[FRAME_EXTENDED])))
+            deallocate_u64((heap)heap_page_backed(get_kernel_heaps()),
+                           c->frame[FRAME_EXTENDED], EXTENDED_FRAME_SIZE);
         c->frame[FRAME_EXTENDED] = 0;
     }
 }
@@ -135,6 +135,9 @@ static inline void wait_for_interrupt(void)
     disable_interrupts();
 }
 
+/* no non-temporal stores in the base ISA */
+#define zero_nontemporal(p, len)    zero(p, len)
+
 #define cmdline_consume(o, h)   (void)(h)
 #define boot_params_apply(t)
 
@@ -410,6 +413,18 @@ static inline void return_offset(u64 offset) {
             rv = _a0;                                                   \
             rv;                                                         \
         })
+
+#define do_syscall3(sysnr, arg0, arg1, arg2) ({                         \
+            sysreturn rv;                                               \
+            register u64 _v asm ("a7") = sysnr;                         \
+            register u64 _a0 asm ("a0") = (u64)arg0;                    \
+            register u64 _a1 asm ("a1") = (u64)arg1;                    \
+            register u64 _a2 asm ("a2") = (u64)arg2;                    \
+            asm ("ecall" : "=r" (_a0) : "r" (_v),                       \
+                "r" (_a0), "r" (_a1), "r" (_a2) : "memory");            \
+            rv = _a0;                                                   \
+            rv;                                                         \
+        })
 /* IPI */
 static inline void machine_halt(void)
 {
@@ -36,10 +36,18 @@ void invalidate(u64 page)
     asm volatile("sfence.vma %0, x0" :: "r"(page) : "memory");
 }
 
+/* a full flush only covers non-global entries of the (single) address space, ASID 0 */
 void flush_tlb(boolean full_flush)
 {
-    if (full_flush)
-        asm volatile("sfence.vma" ::: "memory");
+    if (full_flush) {
+        u64 asid = 0;
+        asm volatile("sfence.vma x0, %0" :: "r"(asid) : "memory");
+    }
+}
+
+void flush_tlb_global(void)
+{
+    asm volatile("sfence.vma" ::: "memory");
 }
 
 void init_mmu(range init_pt, u64 vtarget, void *dtb)
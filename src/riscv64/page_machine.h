@@ -93,6 +93,12 @@ static inline pageflags pageflags_no_minpage(pageflags flags)
     return (pageflags){.w = flags.w & ~PAGE_NO_BLOCK};
 }
 
+/* kernel mappings that are not flushed by a non-global full TLB flush */
+static inline pageflags pageflags_global(pageflags flags)
+{
+    return (pageflags){.w = flags.w | PAGE_GLOBAL};
+}
+
 /* no-exec, read-only */
 static inline pageflags pageflags_default_user(void)
 {
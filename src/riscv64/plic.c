@@ -15,18 +15,29 @@ static inline u64 context_from_hartid(u64 hartid)
     return (hartid << 1) + 1;
 }
 
+/* Each interrupt is enabled in the S-mode context of a single hart. */
+static s32 plic_int_target[PLIC_MAX_INT + 1] = { [0 ... PLIC_MAX_INT] = -1 };
+
 void plic_disable_int(int irq)
 {
     for (int cpuid = 0; cpuid < present_processors; cpuid++) {
         cpuinfo ci = cpuinfo_from_id(cpuid);
         clear_plic_bit(PLIC_ENABLE(context_from_hartid(ci->m.hartid)), irq);
     }
+    plic_int_target[irq] = -1;
 }
 
 void plic_enable_int(int irq, u32 target_cpu)
 {
     cpuinfo ci = cpuinfo_from_id(target_cpu);
     set_plic_bit(PLIC_ENABLE(context_from_hartid(ci->m.hartid)), irq);
+    plic_int_target[irq] = target_cpu;
+}
+
+/* Returns the CPU an interrupt is routed to, or -1 if the interrupt is not enabled. */
+int plic_get_int_target(int irq)
+{
+    return plic_int_target[irq];
 }
 
 void plic_set_int_priority(int irq, u32 pri)
@@ -18,6 +18,7 @@
 
 void plic_disable_int(int irq);
 void plic_enable_int(int irq, u32 target_cpu);
+int plic_get_int_target(int irq);
 void plic_set_int_priority(int irq, u32 pri);
 void plic_set_threshold(u64 hartid, u32 thresh);
 void plic_set_int_config(int irq, u32 cfg);
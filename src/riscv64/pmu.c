@@ -0,0 +1,54 @@
+/* The RISC-V hardware performance monitor counters are not accessible from supervisor mode without
+ * SBI PMU extension support, which is not implemented. */
+
+#include <kernel.h>
+#include <pmu.h>
+
+boolean init_pmu(kernel_heaps kh, thunk overflow_handler)
+{
+    return false;
+}
+
+int pmu_counter_count(void)
+{
+    return 0;
+}
+
+u64 pmu_counter_mask(void)
+{
+    return 0;
+}
+
+boolean pmu_sampling_supported(void)
+{
+    return false;
+}
+
+boolean pmu_hw_event(u64 id, u64 *event)
+{
+    return false;
+}
+
+boolean pmu_raw_event(u64 config, u64 *event)
+{
+    return false;
+}
+
+void pmu_counter_start(int idx, u64 event, u64 flags, u64 value)
+{
+}
+
+u64 pmu_counter_stop(int idx)
+{
+    return 0;
+}
+
+u64 pmu_counter_read(int idx)
+{
+    return 0;
+}
+
+u64 pmu_overflow_status(void)
+{
+    return 0;
+}
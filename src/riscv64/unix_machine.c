@@ -38,7 +38,7 @@ boolean setup_sigframe(thread t, int signum, struct siginfo *si)
     context_frame f = thread_frame(t);
     u64 sp;
 
-    if ((sa->sa_flags & SA_ONSTACK) && t->signal_stack)
+    if ((sa->sa_flags & SA_ONSTACK) && t->signal_stack && !thread_is_on_altsigstack(t))
         sp = u64_from_pointer(t->signal_stack + t->signal_stack_length);
     else
         sp = f[FRAME_SP];
@@ -129,8 +129,8 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, fchown, syscall_ignore, 0);
     init_syscall(map, ptrace, 0);
     init_syscall(map, syslog, 0);
-    register_syscall(map, getgid, syscall_ignore, 0);
-    register_syscall(map, getegid, syscall_ignore, 0);
+    register_syscall(map, getgid, syscall_ignore, SYSCALL_F_LEAF);
+    register_syscall(map, getegid, syscall_ignore, SYSCALL_F_LEAF);
     init_syscall(map, setpgid, 0);
     init_syscall(map, getppid, 0);
     init_syscall(map, setsid, 0);
@@ -207,8 +207,6 @@ void register_other_syscalls(struct syscall *map)
     init_syscall(map, add_key, 0);
     init_syscall(map, request_key, 0);
     init_syscall(map, keyctl, 0);
-    init_syscall(map, ioprio_set, 0);
-    init_syscall(map, ioprio_get, 0);
     init_syscall(map, migrate_pages, 0);
     init_syscall(map, mknodat, 0);
     register_syscall(map, fchownat, syscall_ignore, 0);
@@ -241,7 +239,6 @@ void register_other_syscalls(struct syscall *map)
     init_syscall(map, userfaultfd, 0);
     init_syscall(map, membarrier, 0);
     register_syscall(map, mlock2, syscall_ignore, 0);
-    init_syscall(map, copy_file_range, 0);
     init_syscall(map, preadv2, 0);
     init_syscall(map, pwritev2, 0);
     init_syscall(map, pkey_mprotect, 0);
@@ -316,4 +316,8 @@
 #define SYS_openat2                      437
 #define SYS_pidfd_getfd                  438
 #define SYS_faccessat2                   439
-#define SYS_MAX                          440
+#define SYS_futex_waitv                  449
+#define SYS_futex_wake                   454
+#define SYS_futex_wait                   455
+#define SYS_futex_requeue                456
+#define SYS_MAX                          457
@@ -11,6 +11,12 @@
 
    The bitmap length may be arbitrarily sized. The bitmap buffer is
    allocated in ALLOC_EXTEND_BITS / 8 byte increments as needed.
+
+   If a bitmap has a summary, full words are skipped during allocation
+   searches, empty words are skipped when looking for set bits, and
+   multi-word allocation candidates are checked against the summary
+   before looking at the bitmap itself; the summary maps are scanned a
+   word (i.e. 64 bitmap words) at a time.
 */
 
 #include <runtime.h>
@@ -74,6 +80,61 @@ static boolean for_range_in_map(u64 * base, u64 start, u64 nbits, boolean set, b
     return true;
 }
 
+/* Returns the index of the first word in [word, end) whose bit in the given summary map has the
+ * given value, or end if there is no such word. */
+static u64 summary_find(buffer summary, u64 word, u64 end, boolean val)
+{
+    u64 *base = buffer_ref(summary, 0);
+    while (word < end) {
+        u64 w = base[word >> BITMAP_WORDLEN_LOG];
+        if (!val)
+            w = ~w;
+        w &= ~MASK(word & BITMAP_WORDMASK);
+        if (w)
+            return MIN((word & ~BITMAP_WORDMASK) + lsb(w), end);
+        word = (word & ~BITMAP_WORDMASK) + BITMAP_WORDLEN;
+    }
+    return end;
+}
+
+/* Sets or clears a range of bits, keeping the summary (if any) up to date. */
+static void bitmap_range_set(bitmap b, u64 start, u64 nbits, boolean val)
+{
+    for_range_in_map(bitmap_base(b), start, nbits, true, val);
+    if (!b->full_map || (nbits == 0))
+        return;
+    u64 first = start >> BITMAP_WORDLEN_LOG;
+    u64 last = (start + nbits - 1) >> BITMAP_WORDLEN_LOG;
+    bitmap_summary_update(b, first);
+    if (last == first)
+        return;
+    bitmap_summary_update(b, last);
+    if (last - first > 1) {
+        for_range_in_map(buffer_ref(b->full_map, 0), first + 1, last - first - 1, true, val);
+        for_range_in_map(buffer_ref(b->used_map, 0), first + 1, last - first - 1, true, val);
+    }
+}
+
+/* Returns true if the given range might be clear, i.e. the summary (if any) does not show any
+ * word entirely within the range as being in use. */
+static boolean bitmap_range_maybe_clear(bitmap b, u64 start, u64 nbits)
+{
+    if (!b->used_map)
+        return true;
+    u64 first = pad(start, BITMAP_WORDLEN) >> BITMAP_WORDLEN_LOG;
+    u64 end = (start + nbits) >> BITMAP_WORDLEN_LOG;
+    return (end <= first) ||
+        for_range_in_map(buffer_ref(b->used_map, 0), first, end - first, false, false);
+}
+
+static void bitmap_summary_rebuild(bitmap b)
+{
+    zero(buffer_ref(b->full_map, 0), buffer_length(b->full_map));
+    zero(buffer_ref(b->used_map, 0), buffer_length(b->used_map));
+    for (u64 word = 0; word < (b->mapbits >> BITMAP_WORDLEN_LOG); word++)
+        bitmap_summary_update(b, word);
+}
+
 /* Requesting beyond the end of maxbits isn't an error; the caller may
    use it to avoid an additional range check.
 
@@ -88,8 +149,10 @@ boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean valid
 
     bitmap_extend(b, start + nbits - 1);
     u64 * mapbase = bitmap_base(b);
-    return (!validate || for_range_in_map(mapbase, start, nbits, false, !set)) &&
-        for_range_in_map(mapbase, start, nbits, true, set);
+    if (validate && !for_range_in_map(mapbase, start, nbits, false, !set))
+        return false;
+    bitmap_range_set(b, start, nbits, set);
+    return true;
 }
 
 /* Returns the first bit set in a given range, or INVALID_PHYSICAL if no bits are set. */
@@ -97,6 +160,7 @@ u64 bitmap_range_get_first(bitmap b, u64 start, u64 nbits)
 {
     u64 word_offset = start >> 6;
     u64 bit_offset = start & MASK(6);
+    u64 end_word = MIN((start + nbits) >> 6, b->mapbits >> 6);
     for (; nbits > 0; word_offset++, bit_offset = 0) {
         u64 *p = bitmap_base(b) + word_offset;
         u64 w = *p;
@@ -111,6 +175,12 @@ u64 bitmap_range_get_first(bitmap b, u64 start, u64 nbits)
             nbits -= 64 - bit_offset;
         else
             nbits = 0;
+        if (b->used_map && (nbits >= 64) && (word_offset + 1 < end_word)) {
+            /* skip empty words */
+            u64 next = summary_find(b->used_map, word_offset + 1, end_word, true);
+            nbits -= (next - word_offset - 1) << 6;
+            word_offset = next - 1;
+        }
     }
     return INVALID_PHYSICAL;
 }
@@ -135,8 +205,9 @@ static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 e
             if (bitmap_extend(b, bit + nbits))
                 mapbase = bitmap_base(b);
 
-            if (for_range_in_map(mapbase, bit, nbits, false, false)) {
-                for_range_in_map(mapbase, bit, nbits, true, true);
+            if (bitmap_range_maybe_clear(b, bit, nbits) &&
+                for_range_in_map(mapbase, bit, nbits, false, false)) {
+                bitmap_range_set(b, bit, nbits, true);
                 return bit;
             }
 
@@ -153,15 +224,19 @@ static inline u64 bitmap_alloc_internal(bitmap b, u64 nbits, u64 startbit, u64 e
             u64 mask = MASK(nbits) << word_offset;
             u64 bw = *pointer_from_bit(mapbase, bit);
 
-            if (bw == -1ull)    /* skip full words */
+            if (bw == -1ull) {  /* skip full words */
+                if (b->full_map)
+                    bit = (summary_find(b->full_map, (bit >> 6) + 1,
+                                        MIN((endbit >> 6) + 1, b->mapbits >> 6), false) - 1) << 6;
                 continue;
+            }
 
             do {
                 if (bit + word_offset > endbit)
                     return INVALID_PHYSICAL;
 
                 if ((bw & mask) == 0) {
-                    assert(for_range_in_map(mapbase, bit + word_offset, nbits, true, true));
+                    bitmap_range_set(b, bit + word_offset, nbits, true);
                     return bit + word_offset;
                 }
 
@@ -202,7 +277,7 @@ boolean bitmap_dealloc(bitmap b, u64 bit, u64 size)
 	return false;
     }
 
-    for_range_in_map(mapbase, bit, size, true, false);
+    bitmap_range_set(b, bit, size, false);
     return true;
 }
 
@@ -217,6 +292,7 @@ static inline bitmap allocate_bitmap_internal(heap meta, u64 length)
 	length = -1ull << 6; /* don't pad to 0 */
     b->maxbits = length;
     b->mapbits = MIN(ALLOC_EXTEND_BITS, pad(b->maxbits, 64));
+    b->full_map = b->used_map = 0;
     return b;
 }
 
@@ -239,6 +315,10 @@ void deallocate_bitmap(bitmap b)
 {
     if (b->alloc_map)
 	deallocate_buffer(b->alloc_map);
+    if (b->full_map) {
+        deallocate_buffer(b->full_map);
+        deallocate_buffer(b->used_map);
+    }
     deallocate(b->meta, b, sizeof(struct bitmap));
 }
 
@@ -275,6 +355,12 @@ bitmap bitmap_clone(bitmap b)
     c->meta = b->meta;
     runtime_memcpy(buffer_ref(c->alloc_map, 0), buffer_ref(b->alloc_map, 0), mapbytes);
     buffer_produce(c->alloc_map, mapbytes);
+    if (b->full_map) {
+        c->full_map = clone_buffer(b->map, b->full_map);
+        c->used_map = clone_buffer(b->map, b->used_map);
+        if ((c->full_map == INVALID_ADDRESS) || (c->used_map == INVALID_ADDRESS))
+	    return INVALID_ADDRESS;
+    }
     return c;
 }
 
@@ -292,4 +378,30 @@ void bitmap_copy(bitmap dest, bitmap src)
 	bytes len = (dest->mapbits - src->mapbits) >> 3;
 	zero(buffer_ref(dest->alloc_map, off), len);
     }
+    if (dest->full_map)
+        bitmap_summary_rebuild(dest);
+}
+
+/* Adds a summary to a bitmap (not applicable to wrapped bitmaps). */
+boolean bitmap_enable_summary(bitmap b)
+{
+    if (!b->map)
+        return false;
+    if (b->full_map)
+        return true;
+    bytes summary_bytes = bitmap_summary_bytes(b->mapbits);
+    buffer full_map = allocate_buffer(b->map, summary_bytes);
+    if (full_map == INVALID_ADDRESS)
+        return false;
+    buffer used_map = allocate_buffer(b->map, summary_bytes);
+    if (used_map == INVALID_ADDRESS) {
+        deallocate_buffer(full_map);
+        return false;
+    }
+    buffer_produce(full_map, summary_bytes);
+    buffer_produce(used_map, summary_bytes);
+    b->full_map = full_map;
+    b->used_map = used_map;
+    bitmap_summary_rebuild(b);
+    return true;
 }
@@ -6,12 +6,20 @@
    page are b0rked */
 #define ALLOC_EXTEND_BITS	U64_FROM_BIT(12)
 
+/* Bitmaps with a large number of bits can be given a summary (see bitmap_enable_summary()), made of
+ * two maps with one bit per word of the bitmap, which allows searches to skip over full or empty
+ * words without reading them. Bitmaps with a summary must not be modified via atomic operations
+ * or by writing directly to the words returned by bitmap_base(). */
+#define BITMAP_SUMMARY_MIN_BITS U64_FROM_BIT(16)
+
 typedef struct bitmap {
     u64 maxbits;
     u64 mapbits;
     heap meta;
     heap map;
     buffer alloc_map;
+    buffer full_map;    /* summary: bit set if all bits in the word are set */
+    buffer used_map;    /* summary: bit set if any bit in the word is set */
 } *bitmap;
 
 boolean bitmap_range_check_and_set(bitmap b, u64 start, u64 nbits, boolean validate, boolean set);
@@ -25,6 +33,7 @@ bitmap bitmap_wrap(heap h, u64 * map, u64 length);
 void bitmap_unwrap(bitmap b);
 bitmap bitmap_clone(bitmap b);
 void bitmap_copy(bitmap dest, bitmap src);
+boolean bitmap_enable_summary(bitmap b);
 
 #define bitmap_foreach_word(b, w, offset)				\
     for (u64 offset = 0, * __wp = bitmap_base(b), w = *__wp;		\
@@ -42,11 +51,34 @@ static inline u64 *bitmap_base(bitmap b)
     return buffer_ref(b->alloc_map, 0);
 }
 
+/* size in bytes of each summary map for a given number of bitmap bits */
+static inline bytes bitmap_summary_bytes(u64 mapbits)
+{
+    return pad(mapbits, BITMAP_WORDLEN * BITMAP_WORDLEN) >> (BITMAP_WORDLEN_LOG + 3);
+}
+
+/* Updates the summary bits of a bitmap word. */
+static inline void bitmap_summary_update(bitmap b, u64 word)
+{
+    u64 w = bitmap_base(b)[word];
+    u64 mask = 1ull << (word & BITMAP_WORDMASK);
+    u64 *f = (u64 *)buffer_ref(b->full_map, 0) + (word >> BITMAP_WORDLEN_LOG);
+    u64 *u = (u64 *)buffer_ref(b->used_map, 0) + (word >> BITMAP_WORDLEN_LOG);
+    *f = (w == -1ull) ? (*f | mask) : (*f & ~mask);
+    *u = w ? (*u | mask) : (*u & ~mask);
+}
+
 /* no-op if i is within existing bounds, returns true if extended */
 static inline boolean bitmap_extend(bitmap b, u64 i)
 {
     if (i >= b->mapbits) {
         u64 mapbits = pad(i + 1, ALLOC_EXTEND_BITS);
+        if (b->full_map) {
+            bytes summary_bytes = bitmap_summary_bytes(mapbits);
+            if (!extend_total(b->full_map, summary_bytes) ||
+                !extend_total(b->used_map, summary_bytes))
+                return false;
+        }
         if (extend_total(b->alloc_map, mapbits >> 3)) {
             b->mapbits = mapbits;
             return true;
@@ -72,6 +104,8 @@ static inline void bitmap_set(bitmap b, u64 i, int val)
 	*p |= mask;
     else
 	*p &= ~mask;
+    if (b->full_map)
+        bitmap_summary_update(b, i >> 6);
 }
 
 static inline void bitmap_set_atomic(bitmap b, u64 i, int val)
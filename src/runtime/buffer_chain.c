@@ -0,0 +1,136 @@
+#include <runtime.h>
+
+/* an appended buffer, released when its sg_buf is released */
+typedef struct buffer_chain_seg {
+    struct refcount r;
+    closure_struct(thunk, free);
+    heap h;
+    buffer b;
+} *buffer_chain_seg;
+
+closure_func_basic(thunk, void, buffer_chain_seg_free)
+{
+    buffer_chain_seg seg = struct_from_field(closure_self(), buffer_chain_seg, free);
+    deallocate_buffer(seg->b);
+    deallocate(seg->h, seg, sizeof(*seg));
+}
+
+static boolean buffer_chain_add(buffer_chain c, buffer b)
+{
+    bytes len = buffer_length(b);
+    buffer_chain_seg seg = allocate(c->h, sizeof(*seg));
+    if (seg == INVALID_ADDRESS)
+        return false;
+    sg_buf sgb = sg_list_tail_add(c->sg, len);
+    if (sgb == INVALID_ADDRESS) {
+        deallocate(c->h, seg, sizeof(*seg));
+        return false;
+    }
+    seg->h = c->h;
+    seg->b = b;
+    init_refcount(&seg->r, 1, init_closure_func(&seg->free, thunk, buffer_chain_seg_free));
+    sgb->buf = buffer_ref(b, 0);
+    sgb->size = len;
+    sgb->offset = 0;
+    sgb->refcount = &seg->r;
+    return true;
+}
+
+/* appends the fragment being filled (if any) to the sg list */
+static boolean buffer_chain_seal(buffer_chain c)
+{
+    buffer tail = c->tail;
+    if (!tail)
+        return true;
+    if (buffer_length(tail) && !buffer_chain_add(c, tail))
+        return false;
+    if (!buffer_length(tail))
+        deallocate_buffer(tail);
+    c->tail = 0;
+    return true;
+}
+
+boolean buffer_chain_write(buffer_chain c, const void *src, bytes len)
+{
+    while (len > 0) {
+        buffer tail = c->tail;
+        if (!tail || !buffer_space(tail)) {
+            if (!buffer_chain_seal(c))
+                return false;
+            tail = allocate_buffer(c->h, BUFFER_CHAIN_FRAG_SIZE);
+            if (tail == INVALID_ADDRESS)
+                return false;
+            c->tail = tail;
+        }
+        bytes n = MIN(len, buffer_space(tail));
+        runtime_memcpy(buffer_end(tail), src, n);
+        buffer_produce(tail, n);
+        c->b.end += n;
+        src += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Appends the contents of b without copying them; consumes b on success. */
+boolean buffer_chain_push(buffer_chain c, buffer b)
+{
+    assert(!buffer_is_chain(b));
+    bytes len = buffer_length(b);
+    if (len == 0) {
+        deallocate_buffer(b);
+        return true;
+    }
+    if (!buffer_chain_seal(c) || !buffer_chain_add(c, b))
+        return false;
+    c->b.end += len;
+    return true;
+}
+
+/* Moves the first len bytes of an sg list (whose references are transferred to the chain). */
+boolean buffer_chain_push_sg(buffer_chain c, sg_list sg, u64 len)
+{
+    if (!buffer_chain_seal(c))
+        return false;
+    len = sg_move(c->sg, sg, len);
+    c->b.end += len;
+    return true;
+}
+
+/* Returns the fragments of a chained buffer, which must not be appended to afterwards. */
+sg_list buffer_chain_sg(buffer b)
+{
+    buffer_chain c = (buffer_chain)b;
+    assert(buffer_is_chain(b));
+    if (!buffer_chain_seal(c))
+        return INVALID_ADDRESS;
+    return c->sg;
+}
+
+void buffer_chain_dealloc(heap h, u64 a, bytes b)
+{
+    buffer_chain c = struct_from_field(h, buffer_chain, dh);
+    if (c->tail)
+        deallocate_buffer(c->tail);
+    sg_list_release(c->sg);
+    deallocate_sg_list(c->sg);
+    deallocate(c->h, c, sizeof(*c));
+}
+
+buffer_chain allocate_buffer_chain(heap h)
+{
+    buffer_chain c = allocate(h, sizeof(*c));
+    if (c == INVALID_ADDRESS)
+        return c;
+    c->sg = allocate_sg_list();
+    if (c->sg == INVALID_ADDRESS) {
+        deallocate(h, c, sizeof(*c));
+        return INVALID_ADDRESS;
+    }
+    zero(&c->dh, sizeof(c->dh));
+    c->dh.dealloc = buffer_chain_dealloc;
+    init_buffer(&c->b, 0, true, &c->dh, 0);
+    c->h = h;
+    c->tail = 0;
+    return c;
+}
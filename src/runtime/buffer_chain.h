@@ -0,0 +1,33 @@
+/* A chained buffer assembles data from page-sized fragments, existing buffers and sg list
+ * fragments (e.g. page cache pages) without copying or reallocating what has already been
+ * appended. It is itself a buffer, so that it can be passed to buffer handlers and deallocated with
+ * deallocate_buffer(): its length is the total length of the chain, but its contents cannot be
+ * referenced directly. Handlers that transmit data check buffer_is_chain() and consume the
+ * fragments from buffer_chain_sg(), releasing each of them with sg_buf_release() once done. */
+
+typedef struct buffer_chain {
+    struct buffer b;            /* must be first */
+    struct heap dh;             /* b.h: deallocating the buffer releases the chain */
+    heap h;
+    sg_list sg;
+    buffer tail;                /* fragment being filled */
+} *buffer_chain;
+
+#define BUFFER_CHAIN_FRAG_SIZE  PAGESIZE
+
+buffer_chain allocate_buffer_chain(heap h);
+boolean buffer_chain_write(buffer_chain c, const void *src, bytes len);
+boolean buffer_chain_push(buffer_chain c, buffer b);
+boolean buffer_chain_push_sg(buffer_chain c, sg_list sg, u64 len);
+sg_list buffer_chain_sg(buffer b);
+void buffer_chain_dealloc(heap h, u64 a, bytes b);
+
+static inline boolean buffer_is_chain(buffer b)
+{
+    return b->h && (b->h->dealloc == buffer_chain_dealloc);
+}
+
+static inline buffer buffer_chain_buffer(buffer_chain c)
+{
+    return &c->b;
+}
@@ -8,6 +8,13 @@
 
 #define apply(__c, ...) (*(__c))((void *)(__c), ## __VA_ARGS__)
 
+/* Applies a closure that is expected to be of closure_function __f: if so, __f is called directly
+ * and can be inlined (if it is visible to the caller), else the closure is applied as usual. */
+#define apply_func(__c, __f, ...) ({                                                \
+    typeof(__c) __ac = (__c);                                                       \
+    __builtin_expect((void *)*__ac == (void *)__f, 1) ?                             \
+        __f((struct _closure_##__f *)__ac, ## __VA_ARGS__) : apply(__ac, ## __VA_ARGS__); })
+
 #define __closure(__c, __p, __s, __name, ...)    \
     _fill_##__name(__c, __p, __s, ##__VA_ARGS__)
 
@@ -24,7 +31,15 @@ struct _closure_common {
 #define ctx_from_context(__c) (u64_from_pointer(__c) | CLOSURE_COMMON_CTX_DEALLOC_ON_FINISH | \
                                CLOSURE_COMMON_CTX_IS_CONTEXT)
 
+#ifdef KERNEL
+/* per-CPU count of heap-allocated closures, reported in /proc/vmstat */
+void closure_alloc_account(void);
+#else
+#define closure_alloc_account()
+#endif
+
 #define closure_alloc(__h, __name, __var)   do {                \
+    closure_alloc_account();                                    \
     __var = allocate(__h, sizeof(struct _closure_##__name));    \
     if (__var != INVALID_ADDRESS) {                             \
         __var->__apply = __name;                                \
@@ -38,6 +53,7 @@ struct _closure_common {
     closure_alloc(__h, __name, __var)
 
 #define closure_func(__h, __name, __func, ...)  ({                                      \
+    closure_alloc_account();                                                            \
     struct _closure_##__name * __n = allocate(__h, sizeof(struct _closure_##__name));   \
     __closure(ctx_from_heap(__h), __n, sizeof(struct _closure_##__name), __func, ##__VA_ARGS__);})
 #define closure(__h, __name, ...)   closure_func(__h, __name, __name, ##__VA_ARGS__)
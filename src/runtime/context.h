@@ -21,4 +21,5 @@ struct context {
     struct list mutex_l;        /* mutex waiters */
     u32 active_cpu;
     u8 type;
+    u16 ioprio;                 /* I/O priority of storage requests submitted in this context */
 };
@@ -6,7 +6,13 @@ Public domain.
 
 /* $OpenBSD: chacha.c,v 1.1 2013/11/21 00:45:44 djm Exp $ */
 
+#ifndef CHACHA_EMBED
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
+#endif
 #include "crypto/chacha.h"
 
 #define NULL (0)
@@ -254,3 +260,102 @@ chacha_encrypt_bytes(chacha_ctx *x,const u8 *m,u8 *c,u32 bytes)
 #endif
   }
 }
+
+#if defined(__x86_64__) && !defined(CHACHA_NONCE0_CTR128)
+#ifdef __SSE2__
+#define CHACHA_SSE_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8"
+#else
+#define CHACHA_SSE_CLOBBERS
+#endif
+
+static const u32 chacha_ctr_inc[4] __attribute__((aligned(16))) = { 1, 0, 0, 0 };
+
+/* Keystream generation with SSE2, which is part of the x86_64 baseline: the four rows of the
+ * state are held in xmm0-xmm3 and each quarter round operates on the four columns at once; for
+ * the diagonal rounds rows 1-3 are rotated so that the diagonals line up as columns.
+ * The registers are named explicitly, as the kernel is built without vector register support;
+ * in the kernel (but not in the vDSO), they are used between kernel_simd_begin() and
+ * kernel_simd_end(). */
+LOCAL void
+chacha_keystream_blocks(chacha_ctx *x, u8 *c, u32 nblocks)
+{
+  u64 rounds;
+
+  if (!nblocks) return;
+#if defined(KERNEL) && !defined(BUILD_VDSO)
+  u64 flags = kernel_simd_begin();
+#endif
+  asm volatile(
+    ".macro chacha_rot r, n\n"
+    "movdqa \\r, %%xmm4\n"
+    "pslld $\\n, \\r\n"
+    "psrld $(32 - \\n), %%xmm4\n"
+    "por %%xmm4, \\r\n"
+    ".endm\n"
+    ".macro chacha_quarterround\n"
+    "paddd %%xmm1, %%xmm0\n"
+    "pxor %%xmm0, %%xmm3\n"
+    "chacha_rot %%xmm3, 16\n"
+    "paddd %%xmm3, %%xmm2\n"
+    "pxor %%xmm2, %%xmm1\n"
+    "chacha_rot %%xmm1, 12\n"
+    "paddd %%xmm1, %%xmm0\n"
+    "pxor %%xmm0, %%xmm3\n"
+    "chacha_rot %%xmm3, 8\n"
+    "paddd %%xmm3, %%xmm2\n"
+    "pxor %%xmm2, %%xmm1\n"
+    "chacha_rot %%xmm1, 7\n"
+    ".endm\n"
+    "movdqu (%[in]), %%xmm5\n"
+    "movdqu 16(%[in]), %%xmm6\n"
+    "movdqu 32(%[in]), %%xmm7\n"
+    "movdqu 48(%[in]), %%xmm8\n"
+    "1:\n"
+    "movdqa %%xmm5, %%xmm0\n"
+    "movdqa %%xmm6, %%xmm1\n"
+    "movdqa %%xmm7, %%xmm2\n"
+    "movdqa %%xmm8, %%xmm3\n"
+    "mov $10, %[rounds]\n"
+    "2:\n"
+    "chacha_quarterround\n"
+    "pshufd $0x39, %%xmm1, %%xmm1\n"
+    "pshufd $0x4e, %%xmm2, %%xmm2\n"
+    "pshufd $0x93, %%xmm3, %%xmm3\n"
+    "chacha_quarterround\n"
+    "pshufd $0x93, %%xmm1, %%xmm1\n"
+    "pshufd $0x4e, %%xmm2, %%xmm2\n"
+    "pshufd $0x39, %%xmm3, %%xmm3\n"
+    "dec %[rounds]\n"
+    "jnz 2b\n"
+    "paddd %%xmm5, %%xmm0\n"
+    "paddd %%xmm6, %%xmm1\n"
+    "paddd %%xmm7, %%xmm2\n"
+    "paddd %%xmm8, %%xmm3\n"
+    "movdqu %%xmm0, (%[c])\n"
+    "movdqu %%xmm1, 16(%[c])\n"
+    "movdqu %%xmm2, 32(%[c])\n"
+    "movdqu %%xmm3, 48(%[c])\n"
+    "paddq (%[inc]), %%xmm8\n"      /* 64-bit block counter in words 12-13 */
+    "add $64, %[c]\n"
+    "dec %[n]\n"
+    "jnz 1b\n"
+    "movdqu %%xmm8, 48(%[in])\n"
+    ".purgem chacha_rot\n"
+    ".purgem chacha_quarterround\n"
+    : [c] "+r" (c), [n] "+r" (nblocks), [rounds] "=&r" (rounds)
+    : [in] "r" (x->input), [inc] "r" (chacha_ctr_inc)
+    : "memory", "cc" CHACHA_SSE_CLOBBERS);
+#if defined(KERNEL) && !defined(BUILD_VDSO)
+  kernel_simd_end(flags);
+#endif
+}
+#else
+LOCAL void
+chacha_keystream_blocks(chacha_ctx *x, u8 *c, u32 nblocks)
+{
+  static const u8 zero_block[CHACHA_BLOCKLEN];
+
+  for (; nblocks > 0; nblocks--, c += CHACHA_BLOCKLEN)
+    chacha_encrypt_bytes(x, zero_block, c, CHACHA_BLOCKLEN);
+}
+#endif
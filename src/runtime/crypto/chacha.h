@@ -38,6 +38,7 @@ LOCAL void chacha_ivsetup(struct chacha_ctx *x, const u8 *iv CHACHA_UNUSED,
     const u8 *ctr);
 LOCAL void chacha_encrypt_bytes(struct chacha_ctx *x, const u8 *m,
     u8 *c, u32 bytes);
+LOCAL void chacha_keystream_blocks(struct chacha_ctx *x, u8 *c, u32 nblocks);
 
 #undef CHACHA_UNUSED
 
@@ -60,6 +60,11 @@ boolean objcache_validate(heap h);
 heap objcache_from_object(u64 obj, bytes parent_pagesize);
 heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes pagesize,
                      boolean malloc_style);
+#ifdef KERNEL
+heap allocate_locking_mcache(heap meta, heap parent, int min_order, int max_order, bytes pagesize,
+                             boolean malloc_style);
+boolean mcache_percpu_init(heap h, int cpu_count);
+#endif
 heap reserve_heap_wrapper(heap meta, heap parent, bytes reserved);
 backed_heap reserve_backed_heap_wrapper(heap meta, backed_heap parent, bytes reserved);
 
@@ -78,10 +83,23 @@ static inline int subdivide(int quantum, int per, int s, int o)
     return (pad(o + base, quantum));
 }
 
+#ifdef KERNEL
+/* The general purpose kernel heaps are locking mcaches: their methods are called directly. */
+u64 mcache_locking_alloc(heap h, bytes b);
+void mcache_locking_dealloc(heap h, u64 a, bytes b);
+
+#define allocate_u64(__h, __b) ({                                       \
+            heap __ah = (heap)(__h);                                    \
+            indirect_call(__ah->alloc, mcache_locking_alloc, __ah, __b); })
+#define deallocate_u64(__h, __b, __s) ({                                \
+            heap __dh = (heap)(__h);                                    \
+            indirect_call(__dh->dealloc, mcache_locking_dealloc, __dh, __b, __s); })
+#else
 #define allocate_u64(__h, __b) ((__h)->alloc(__h, __b))
+#define deallocate_u64(__h, __b, __s) ((__h)->dealloc(__h, __b, __s))
+#endif
 #define allocate(__h, __b) pointer_from_u64(allocate_u64(__h, __b))
 
-#define deallocate_u64(__h, __b, __s) ((__h)->dealloc(__h, __b, __s))
 #define deallocate(__h, __b, __s) deallocate_u64(__h, u64_from_pointer(__b), __s)
 
 #define allocate_zero(__h, __b) ({\
@@ -80,6 +80,8 @@ static id_range id_add_range(id_heap i, u64 base, u64 length)
         msg_err("failed to allocate bitmap for range %R\n", ir->n.r);
         goto fail;
     }
+    if ((pages >= BITMAP_SUMMARY_MIN_BITS) && !bitmap_enable_summary(ir->b))
+        msg_warn("failed to allocate bitmap summary for range %R\n", ir->n.r);
     if (page_start_mask)
         /* Mark the initial bits (which are not part of the range supplied to this function) as
          * allocated, to prevent the bitmap from returning these bits during allocations. */
@@ -244,11 +246,47 @@ closure_function(1, 1, boolean, destruct_id_range,
     return true;
 }
 
+#ifdef KERNEL
+/* A locking id heap can be fronted by per-CPU magazines of free ids, for allocations of a single
+ * page and of a 2MB huge page (the most frequent allocation sizes for the physical memory heap):
+ * these allocations and deallocations are served from the magazine of the current CPU without
+ * taking the heap lock and without scanning the bitmaps; only when a magazine is empty (or full)
+ * it is refilled from (or flushed to) the bitmaps, in batches of half the magazine capacity.
+ * Ids cached in magazines are accounted as allocated. */
+#define ID_MAGAZINE_SIZE        16
+#define ID_MAGAZINE_HUGE_SIZE   2
+
+typedef struct id_magazine {
+    u32 count;
+    u32 capacity;
+    bytes size;     /* allocation size served by this magazine */
+    u64 ids[ID_MAGAZINE_SIZE];
+} *id_magazine;
+
+typedef struct id_cpu {
+    u64 hits;
+    u64 misses;
+    struct id_magazine page;
+    struct id_magazine huge;
+} *id_cpu;
+
+/* lies just after invariants */
+typedef struct id_heap_locking {
+    struct spinlock lock;
+    int cpu_count;
+    id_cpu *cpus;   /* per-CPU magazines, if enabled */
+} *id_heap_locking;
+
+#define id_locking(h) ((id_heap_locking)(((id_heap)h) + 1))
+
+static u64 id_alloc_locking(heap h, bytes count);
+#endif
+
 static inline bytes id_size(void)
 {
     return sizeof(struct id_heap)
 #ifdef KERNEL
-        + sizeof(struct spinlock)
+        + sizeof(struct id_heap_locking)
 #endif
         ;
 }
@@ -256,6 +294,14 @@ static inline bytes id_size(void)
 static void id_destroy(heap h)
 {
     id_heap i = (id_heap)h;
+#ifdef KERNEL
+    if ((h->alloc == id_alloc_locking) && id_locking(i)->cpus) {
+        id_heap_locking l = id_locking(i);
+        for (int cpu = 0; cpu < l->cpu_count; cpu++)
+            deallocate(i->meta, l->cpus[cpu], sizeof(struct id_cpu));
+        deallocate(i->meta, l->cpus, l->cpu_count * sizeof(l->cpus[0]));
+    }
+#endif
     deallocate_rangemap(i->ranges, stack_closure(destruct_id_range, i));
     deallocate(i->meta, i, id_size());
 }
@@ -317,6 +363,25 @@ static inline boolean set_area(id_heap i, u64 base, u64 length, boolean validate
     return result == RM_MATCH;
 }
 
+/* Takes an area out of the heap (if all of its ids are free) or gives it back (all of its ids must
+ * have been taken out); offline ids count as neither allocated nor available, so that the heap
+ * can hold ranges (e.g. hotpluggable memory) which are only partially usable. */
+static inline boolean set_online(id_heap i, u64 base, u64 length, boolean online)
+{
+    base &= ~page_mask(i);
+    length = pad(length, page_size(i));
+    if (!set_area(i, base, length, true, !online))
+        return false;
+    if (online) {
+        i->allocated += length;
+        i->total += length;
+    } else {
+        i->allocated -= length;
+        i->total -= length;
+    }
+    return true;
+}
+
 static inline void set_randomize(id_heap i, boolean randomize)
 {
     i->flags = randomize ? i->flags | ID_HEAP_FLAG_RANDOMIZE : i->flags & ~ID_HEAP_FLAG_RANDOMIZE;
@@ -364,22 +429,84 @@ static inline void set_next(id_heap i, bytes count, u64 next)
 #ifdef KERNEL
 /* locking variants */
 
-/* spinlock lies just after invariants */
-#define id_lock(h) ((spinlock)(((id_heap)h) + 1))
+#define id_lock(h) (&id_locking(h)->lock)
+
+/* Must be called with interrupts disabled. */
+static id_magazine id_get_magazine(heap h, bytes count, id_cpu *ic)
+{
+    id_heap_locking l = id_locking(h);
+    if (!l->cpus)
+        return 0;
+    id_cpu c = l->cpus[current_cpu()->id];
+    bytes size = pad(count, h->pagesize);
+    id_magazine mag;
+    if (size == c->page.size)
+        mag = &c->page;
+    else if (size == c->huge.size)
+        mag = &c->huge;
+    else
+        return 0;
+    *ic = c;
+    return mag;
+}
 
 static u64 id_alloc_locking(heap h, bytes count)
 {
-    u64 flags = spin_lock_irq(id_lock(h));
+    u64 flags = irq_disable_save();
+    id_cpu ic;
+    id_magazine mag = id_get_magazine(h, count, &ic);
+    if (mag) {
+        if (mag->count > 0) {
+            ic->hits++;
+            u64 a = mag->ids[--mag->count];
+            irq_restore(flags);
+            return a;
+        }
+        ic->misses++;
+    }
+    spin_lock(id_lock(h));
     u64 a = id_alloc(h, count);
-    spin_unlock_irq(id_lock(h), flags);
+    if (mag && (a != INVALID_PHYSICAL)) {
+        /* refill half of the magazine */
+        while (mag->count < mag->capacity / 2) {
+            u64 id = id_alloc(h, mag->size);
+            if (id == INVALID_PHYSICAL)
+                break;
+            mag->ids[mag->count++] = id;
+        }
+    }
+    spin_unlock(id_lock(h));
+    irq_restore(flags);
     return a;
 }
 
 static void id_dealloc_locking(heap h, u64 a, bytes count)
 {
-    u64 flags = spin_lock_irq(id_lock(h));
-    id_dealloc(h, a, count);
-    spin_unlock_irq(id_lock(h), flags);
+    u64 flags = irq_disable_save();
+    id_cpu ic;
+    id_magazine mag = id_get_magazine(h, count, &ic);
+    if (mag && ((a & (mag->size - 1)) == 0)) {
+        if (mag->count < mag->capacity) {
+            ic->hits++;
+            mag->ids[mag->count++] = a;
+            irq_restore(flags);
+            return;
+        }
+        ic->misses++;
+    } else {
+        mag = 0;
+    }
+    spin_lock(id_lock(h));
+    if (mag) {
+        /* flush half of the magazine to the bitmaps */
+        while (mag->count > mag->capacity / 2)
+            id_dealloc(h, mag->ids[--mag->count], mag->size);
+        mag->ids[mag->count++] = a;
+    } else {
+        id_dealloc(h, a, count);
+    }
+    spin_unlock(id_lock(h));
+    irq_restore(flags);
 }
 
 static boolean add_range_locking(id_heap i, u64 base, u64 length)
@@ -398,6 +525,14 @@ static boolean set_area_locking(id_heap i, u64 base, u64 length, boolean validat
     return r;
 }
 
+static boolean set_online_locking(id_heap i, u64 base, u64 length, boolean online)
+{
+    u64 flags = spin_lock_irq(id_lock(i));
+    boolean r = set_online(i, base, length, online);
+    spin_unlock_irq(id_lock(i), flags);
+    return r;
+}
+
 static void set_randomize_locking(id_heap i, boolean randomize)
 {
     u64 flags = spin_lock_irq(id_lock(i));
@@ -493,6 +628,21 @@ boolean id_heap_prealloc(id_heap i)
     return id_heap_range_foreach(i, stack_closure(prealloc_foreach_handler, i));
 }
 
+/* Adds a range whose ids are offline (see set_online()), without ever exposing them to
+ * allocations. */
+boolean id_heap_add_offline_range(id_heap i, u64 base, u64 length)
+{
+#ifdef KERNEL
+    if (i->h.alloc == id_alloc_locking) {
+        u64 flags = spin_lock_irq(id_lock(i));
+        boolean r = add_range(i, base, length) && set_online(i, base, length, false);
+        spin_unlock_irq(id_lock(i), flags);
+        return r;
+    }
+#endif
+    return add_range(i, base, length) && set_online(i, base, length, false);
+}
+
 #ifdef KERNEL
 id_heap clone_id_heap(id_heap source)
 {
@@ -502,8 +652,10 @@ id_heap clone_id_heap(id_heap source)
         return INVALID_ADDRESS;
     boolean locking = source->h.alloc == id_alloc_locking;
     runtime_memcpy(i, source, sizeof(struct id_heap));
-    if (locking)
+    if (locking) {
         spin_lock_init(id_lock(i));
+        id_locking(i)->cpus = 0;
+    }
     i->ranges = allocate_rangemap(h);
     if (i->ranges == INVALID_ADDRESS)
         goto fail_dealloc;
@@ -534,6 +686,49 @@ id_heap clone_id_heap(id_heap source)
 }
 #endif
 
+#ifdef KERNEL
+static void id_magazine_init(id_magazine mag, id_heap i, bytes size, u32 capacity)
+{
+    mag->count = 0;
+    if (size < page_size(i)) {
+        mag->size = 0;
+        mag->capacity = 0;
+    } else {
+        mag->size = size;
+        mag->capacity = capacity;
+    }
+}
+
+/* Enables the per-CPU magazines of a locking id heap; must be called before secondary CPUs start
+ * using the heap. */
+boolean id_heap_percpu_init(id_heap i, int cpu_count)
+{
+    assert(i->h.alloc == id_alloc_locking);
+    heap meta = i->meta;
+    id_cpu *cpus = allocate(meta, cpu_count * sizeof(cpus[0]));
+    if (cpus == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        id_cpu ic = allocate(meta, sizeof(*ic));
+        if (ic == INVALID_ADDRESS) {
+            while (--cpu >= 0)
+                deallocate(meta, cpus[cpu], sizeof(*ic));
+            deallocate(meta, cpus, cpu_count * sizeof(cpus[0]));
+            return false;
+        }
+        ic->hits = ic->misses = 0;
+        id_magazine_init(&ic->page, i, PAGESIZE, ID_MAGAZINE_SIZE);
+        id_magazine_init(&ic->huge, i, PAGESIZE_2M, ID_MAGAZINE_HUGE_SIZE);
+        cpus[cpu] = ic;
+    }
+    id_heap_locking l = id_locking(i);
+    l->cpu_count = cpu_count;
+    write_barrier();
+    l->cpus = cpus;
+    return true;
+}
+#endif
+
 id_heap allocate_id_heap(heap meta, heap map, bytes pagesize, boolean locking)
 {
     assert((pagesize & (pagesize-1)) == 0); /* pagesize is power of 2 */
@@ -551,10 +746,12 @@ id_heap allocate_id_heap(heap meta, heap map, bytes pagesize, boolean locking)
     i->h.management = id_management;
     if (locking) {
         spin_lock_init(id_lock(i));
+        id_locking(i)->cpus = 0;
         i->h.alloc = id_alloc_locking;
         i->h.dealloc = id_dealloc_locking;
         i->add_range = add_range_locking;
         i->set_area = set_area_locking;
+        i->set_online = set_online_locking;
         i->set_randomize = set_randomize_locking;
         i->alloc_subrange = alloc_subrange_locking;
         i->set_next = set_next_locking;
@@ -567,6 +764,7 @@ id_heap allocate_id_heap(heap meta, heap map, bytes pagesize, boolean locking)
         i->h.dealloc = id_dealloc;
         i->add_range = add_range;
         i->set_area = set_area;
+        i->set_online = set_online;
         i->set_randomize = set_randomize;
         i->alloc_subrange = alloc_subrange;
         i->set_next = set_next;
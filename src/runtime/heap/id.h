@@ -2,6 +2,7 @@ typedef struct id_heap {
     struct heap h;
     boolean (*add_range)(struct id_heap *i, u64 base, u64 length);
     boolean (*set_area)(struct id_heap *i, u64 base, u64 length, boolean validate, boolean allocate);
+    boolean (*set_online)(struct id_heap *i, u64 base, u64 length, boolean online);
     void (*set_randomize)(struct id_heap *i, boolean randomize);
     u64 (*alloc_subrange)(struct id_heap *i, bytes count, u64 start, u64 end);
     void (*set_next)(struct id_heap *i, bytes count, u64 next);
@@ -26,6 +27,7 @@ boolean id_heap_range_foreach(id_heap i, range_handler rh);
 #define destroy_id_heap(__h) destroy_heap(&(__h)->h)
 #define id_heap_add_range(__h, __b, __l) ((__h)->add_range(__h, __b, __l))
 #define id_heap_set_area(__h, __b, __l, __v, __a) ((__h)->set_area(__h, __b, __l, __v, __a))
+#define id_heap_set_online(__h, __b, __l, __o) ((__h)->set_online(__h, __b, __l, __o))
 #define id_heap_set_randomize(__h, __r) ((__h)->set_randomize(__h, __r))
 #define id_heap_alloc_subrange(__h, __c, __s, __e) ((__h)->alloc_subrange(__h, __c, __s, __e))
 #define id_heap_set_next(__h, __c, __n) ((__h)->set_next(__h, __c, __n))
@@ -39,3 +41,5 @@ static inline u64 id_heap_alloc_gte(id_heap i, bytes count, u64 min)
 }
 
 boolean id_heap_prealloc(id_heap i);
+boolean id_heap_add_offline_range(id_heap i, u64 base, u64 length);
+boolean id_heap_percpu_init(id_heap i, int cpu_count);
@@ -11,13 +11,42 @@
    child heaps and not the parent. malloc/calloc functions exposed to
    such code should assert that the requested size does not exceed the
    maximum size passed to allocate_mcache (1ull << max_order).
+
+   In the kernel, a locking mcache (see allocate_locking_mcache) can be
+   fronted by a per-CPU tier of object magazines, one per CPU and size
+   class. Allocations and deallocations of (small enough) objects are
+   served from the magazine of the current CPU without taking the
+   mcache lock; only when a magazine is empty (or full) it is refilled
+   from (or flushed to) the shared objcaches, in batches of half the
+   magazine capacity.
 */
 
 //#define MCACHE_DEBUG
 
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 #include <management.h>
 
+#ifdef KERNEL
+#define MCACHE_MAGAZINE_SIZE    32          /* max number of objects in a magazine */
+#define MCACHE_MAGAZINE_BYTES   (16 * KB)   /* max cached bytes per magazine */
+
+typedef struct mcache_magazine {
+    u32 count;
+    u32 capacity;   /* 0 if objects in this size class are not cached per-CPU */
+    u64 objs[MCACHE_MAGAZINE_SIZE];
+} *mcache_magazine;
+
+typedef struct mcache_cpu {
+    u64 hits;       /* allocations and deallocations served by a magazine */
+    u64 misses;     /* magazine refills and flushes */
+    struct mcache_magazine mags[0]; /* indexed by size class */
+} *mcache_cpu;
+#endif
+
 typedef struct mcache {
     struct heap h;
     heap parent;
@@ -29,6 +58,12 @@ typedef struct mcache {
     tuple mgmt;
     boolean malloc_style;   /* if true, deallocation requests are made without a size argument */
     table fallbacks;
+#ifdef KERNEL
+    struct spinlock lock;
+    int min_order;
+    int cpu_count;
+    mcache_cpu *cpus;       /* per-CPU magazines, if enabled */
+#endif
 } *mcache;
 
 /* Mix each set of address bits between PAGELOG and 23 for a more even
@@ -203,6 +238,118 @@ void mcache_dealloc(heap h, u64 a, bytes b)
 #endif
 }
 
+#ifdef KERNEL
+static inline int mcache_class_from_size(mcache m, bytes b)
+{
+    return MAX(find_order(b), m->min_order) - m->min_order;
+}
+
+static inline bytes mcache_class_size(mcache m, int class)
+{
+    return U64_FROM_BIT(m->min_order + class);
+}
+
+u64 mcache_locking_alloc(heap h, bytes b)
+{
+    mcache m = (mcache)h;
+    u64 flags = irq_disable_save();
+    mcache_magazine mag = 0;
+    int class = -1;
+    if (m->cpus && (b <= m->parent_threshold)) {
+        mcache_cpu mc = m->cpus[current_cpu()->id];
+        class = mcache_class_from_size(m, b);
+        mag = &mc->mags[class];
+        if (mag->capacity == 0) {
+            mag = 0;
+        } else if (mag->count > 0) {
+            mc->hits++;
+            u64 a = mag->objs[--mag->count];
+            irq_restore(flags);
+            return a;
+        } else {
+            mc->misses++;
+        }
+    }
+    spin_lock(&m->lock);
+    u64 a = mcache_alloc(h, b);
+    if (mag && (a != INVALID_PHYSICAL)) {
+        /* refill half of the magazine */
+        bytes size = mcache_class_size(m, class);
+        while (mag->count < mag->capacity / 2) {
+            u64 obj = mcache_alloc(h, size);
+            if (obj == INVALID_PHYSICAL)
+                break;
+            mag->objs[mag->count++] = obj;
+        }
+    }
+    spin_unlock(&m->lock);
+    irq_restore(flags);
+    return a;
+}
+
+void mcache_locking_dealloc(heap h, u64 a, bytes b)
+{
+    mcache m = (mcache)h;
+    u64 flags = irq_disable_save();
+    mcache_magazine mag = 0;
+    int class = -1;
+    if (m->cpus) {
+        if (b == -1ull) {
+            /* Objects allocated from the parent heap can only be identified via the fallbacks
+             * table, which requires the lock. */
+            if (!m->fallbacks) {
+                heap o = objcache_from_object(a, m->pagesize);
+                if (o != INVALID_ADDRESS)
+                    class = mcache_class_from_size(m, o->pagesize);
+            }
+        } else if (b <= m->parent_threshold) {
+            class = mcache_class_from_size(m, b);
+        }
+    }
+    if (class >= 0) {
+        mcache_cpu mc = m->cpus[current_cpu()->id];
+        mag = &mc->mags[class];
+        if (mag->capacity == 0) {
+            mag = 0;
+        } else if (mag->count < mag->capacity) {
+            mc->hits++;
+            mag->objs[mag->count++] = a;
+            irq_restore(flags);
+            return;
+        } else {
+            mc->misses++;
+        }
+    }
+    spin_lock(&m->lock);
+    if (mag) {
+        /* flush half of the magazine to the shared objcache */
+        bytes size = mcache_class_size(m, class);
+        while (mag->count > mag->capacity / 2)
+            mcache_dealloc(h, mag->objs[--mag->count], size);
+        mag->objs[mag->count++] = a;
+    } else {
+        mcache_dealloc(h, a, b);
+    }
+    spin_unlock(&m->lock);
+    irq_restore(flags);
+}
+
+/* Objects cached in per-CPU magazines are accounted as allocated in the objcaches. */
+static u64 mcache_cached(mcache m)
+{
+    u64 cached = 0;
+    if (!m->cpus)
+        return cached;
+    int classes = vector_length(m->caches);
+    for (int cpu = 0; cpu < m->cpu_count; cpu++) {
+        mcache_cpu mc = m->cpus[cpu];
+        for (int class = 0; class < classes; class++)
+            cached += mc->mags[class].count * mcache_class_size(m, class);
+    }
+    return cached;
+}
+#endif
+
 void destroy_mcache(heap h)
 {
 #ifdef MCACHE_DEBUG
@@ -229,12 +376,26 @@ void destroy_mcache(heap h)
         }
         deallocate_table(m->fallbacks);
     }
+#ifdef KERNEL
+    if (m->cpus) {
+        bytes cpu_size = sizeof(struct mcache_cpu) +
+                         vector_length(m->caches) * sizeof(struct mcache_magazine);
+        for (int cpu = 0; cpu < m->cpu_count; cpu++)
+            deallocate(m->meta, m->cpus[cpu], cpu_size);
+        deallocate(m->meta, m->cpus, m->cpu_count * sizeof(m->cpus[0]));
+    }
+#endif
     deallocate(m->meta, m, sizeof(struct mcache));
 }
 
 static u64 mcache_allocated(heap h)
 {
+#ifdef KERNEL
+    mcache m = (mcache)h;
+    return m->allocated - mcache_cached(m);
+#else
     return ((mcache)h)->allocated;
+#endif
 }
 
 static u64 mcache_total(heap h)
@@ -273,6 +434,45 @@ closure_function(2, 0, value, mcache_get_free,
     set(t, s, v);                                                       \
     tuple_notifier_register_get_notify(n, s, closure(m->meta, mcache_get_ ##name, m, v));
 
+#ifdef KERNEL
+closure_function(2, 0, value, mcache_cpu_get_hits,
+                 mcache_cpu, mc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(mc)->hits);
+}
+
+closure_function(2, 0, value, mcache_cpu_get_misses,
+                 mcache_cpu, mc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(mc)->misses);
+}
+
+#define register_cpu_stat(m, mc, n, t, name)                            \
+    v = value_from_u64(0);                                              \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(n, s, closure(m->meta, mcache_cpu_get_ ##name, mc, v));
+
+static tuple mcache_percpu_management(mcache m)
+{
+    tuple cpus = allocate_tuple();
+    assert(cpus != INVALID_ADDRESS);
+    for (int cpu = 0; cpu < m->cpu_count; cpu++) {
+        mcache_cpu mc = m->cpus[cpu];
+        value v;
+        symbol s;
+        tuple t = allocate_tuple();
+        assert(t != INVALID_ADDRESS);
+        tuple_notifier n = tuple_notifier_wrap(t, false);
+        assert(n != INVALID_ADDRESS);
+        register_cpu_stat(m, mc, n, t, hits);
+        register_cpu_stat(m, mc, n, t, misses);
+        set(cpus, intern_u64(cpu), n);
+    }
+    return cpus;
+}
+#endif
+
 static value mcache_management(heap h)
 {
     mcache m = (mcache)h;
@@ -295,6 +495,10 @@ static value mcache_management(heap h)
             set(c, intern_u64(o->pagesize), heap_management(o));
     }
     set(t, sym(caches), c);
+#ifdef KERNEL
+    if (m->cpus)
+        set(t, sym(cpus), mcache_percpu_management(m));
+#endif
     m->mgmt = (tuple)n;
     return n;
 }
@@ -345,6 +549,11 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
     m->mgmt = 0;
     m->malloc_style = malloc_style;
     m->fallbacks = 0;
+#ifdef KERNEL
+    m->min_order = min_order;
+    m->cpu_count = 0;
+    m->cpus = 0;
+#endif
 
     for(int i = 0, order = min_order; order <= max_order; i++, order++) {
 	u64 obj_size = U64_FROM_BIT(order);
@@ -371,3 +580,59 @@ heap allocate_mcache(heap meta, heap parent, int min_order, int max_order, bytes
     }
     return (heap)m;
 }
+
+#ifdef KERNEL
+heap allocate_locking_mcache(heap meta, heap parent, int min_order, int max_order, bytes pagesize,
+                             boolean malloc_style)
+{
+    mcache m = (mcache)allocate_mcache(meta, parent, min_order, max_order, pagesize, malloc_style);
+    if (m == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    spin_lock_init(&m->lock);
+    m->h.alloc = mcache_locking_alloc;
+    m->h.dealloc = mcache_locking_dealloc;
+    return (heap)m;
+}
+
+/* Enables the per-CPU magazines; must be called before secondary CPUs start using the heap. */
+boolean mcache_percpu_init(heap h, int cpu_count)
+{
+    mcache m = (mcache)h;
+    assert(m->h.alloc == mcache_locking_alloc);
+#if defined(MEMDEBUG_MCACHE) || defined(MEMDEBUG_ALL)
+    /* keep every allocation visible to the debug objcaches */
+    return true;
+#else
+    heap meta = m->meta;
+    int classes = vector_length(m->caches);
+    bytes cpu_size = sizeof(struct mcache_cpu) + classes * sizeof(struct mcache_magazine);
+    mcache_cpu *cpus = allocate(meta, cpu_count * sizeof(cpus[0]));
+    if (cpus == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        mcache_cpu mc = allocate(meta, cpu_size);
+        if (mc == INVALID_ADDRESS) {
+            while (--cpu >= 0)
+                deallocate(meta, cpus[cpu], cpu_size);
+            deallocate(meta, cpus, cpu_count * sizeof(cpus[0]));
+            return false;
+        }
+        mc->hits = mc->misses = 0;
+        for (int class = 0; class < classes; class++) {
+            mcache_magazine mag = &mc->mags[class];
+            mag->count = 0;
+
+            /* Magazines that would hold less than 2 objects would be of no help in batching. */
+            u64 capacity = MIN(MCACHE_MAGAZINE_BYTES / mcache_class_size(m, class),
+                               MCACHE_MAGAZINE_SIZE);
+            mag->capacity = (capacity >= 2) ? capacity : 0;
+        }
+        cpus[cpu] = mc;
+    }
+    m->cpu_count = cpu_count;
+    write_barrier();
+    m->cpus = cpus;
+    return true;
+#endif
+}
+#endif
@@ -1,654 +1,619 @@
 #include <runtime.h>
 
-closure_type(parse_finish_internal, parser, void *v);
-closure_type(parse_error_internal, parser, string err);
-
-struct parser_common {
-    heap h;
-    parse_finish_internal c;
-    parse_error_internal e;
+/* Streaming JSON parser
+ *
+ * The input is processed a buffer at a time by a state machine, which keeps the nesting of
+ * containers in a bitmap and the text of the string or number being parsed in a buffer that is
+ * reused for all tokens, so that no memory is allocated while parsing. Runs of string characters
+ * (by far the bulk of typical documents) are scanned a word at a time for the characters that end
+ * them.
+ */
+
+#define JSON_MAX_DEPTH  256
+
+enum json_state {
+    JSON_STATE_VALUE,       /* expecting a value (or the end of an array) */
+    JSON_STATE_VALUE_END,   /* expecting a separator or the end of the container */
+    JSON_STATE_KEY,         /* expecting an attribute name (or the end of an object) */
+    JSON_STATE_COLON,
+    JSON_STATE_STRING,
+    JSON_STATE_ESCAPE,
+    JSON_STATE_UNICODE,
+    JSON_STATE_NUMBER,
+    JSON_STATE_LITERAL,
+    JSON_STATE_ERROR,
 };
 
-typedef struct json_string_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    string s;
-    boolean escape;
-} *json_string_p;
-
-typedef struct json_number_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    boolean digit_found;
-    boolean fractional;
-} *json_number_p;
-
-typedef struct json_boolean_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    boolean value;
-    int char_count;
-} *json_boolean_p;
-
-typedef struct json_null_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    int char_count;
-} *json_null_p;
-
-typedef struct json_value_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    closure_struct(parse_finish_internal, c);
-    closure_struct(parse_error_internal, e);
-} *json_value_p;
-
-typedef struct json_attr_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    closure_struct(parse_finish_internal, name_c);
-    closure_struct(parse_finish_internal, value_c);
-    closure_struct(parse_error_internal, e);
-    tuple parent_obj;
-    string name;
-    enum {
-        JSON_ATTR_STATE_NAME,
-        JSON_ATTR_STATE_VALUE,
-    } state;
-} *json_attr_p;
-
-typedef struct json_obj_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    closure_struct(parse_finish_internal, c);
-    closure_struct(parse_error_internal, e);
-    tuple obj;
-    enum {
-        JSON_OBJ_STATE_ATTR_BEGIN,
-        JSON_OBJ_STATE_ATTR_END,
-    } state;
-} *json_obj_p;
-
-typedef struct json_array_p {
-    struct parser_common p;
-    closure_struct(parser, parse);
-    closure_struct(parse_finish_internal, c);
-    closure_struct(parse_error_internal, e);
-    enum {
-        JSON_ARRAY_STATE_ELEM_BEGIN,
-        JSON_ARRAY_STATE_ELEM_END,
-    } state;
-} *json_array_p;
-
-typedef struct json_p {
-    heap h;
-    parse_finish finish;
-    parse_error err;
-    closure_struct(parser, parse);
-    closure_struct(parse_finish_internal, c);
-    closure_struct(parse_error_internal, e);
-} *json_p;
-
-static parser json_obj_parser(heap h, parse_finish_internal c, parse_error_internal e);
-static parser json_array_parser(heap h, parse_finish_internal c, parse_error_internal e);
+/* number parsing flags */
+#define JSON_NUM_DIGITS     U64_FROM_BIT(0) /* digits found in the current part */
+#define JSON_NUM_FRACTION   U64_FROM_BIT(1)
+#define JSON_NUM_EXPONENT   U64_FROM_BIT(2)
+#define JSON_NUM_EXP_START  U64_FROM_BIT(3) /* exponent sign allowed */
+
+struct json_stream {
+    json_handler handler;
+    buffer token;           /* text of the string or number being parsed */
+    string err;
+    enum json_state state;
+    u32 depth;
+    u64 containers[JSON_MAX_DEPTH / 64];    /* bit set for objects, cleared for arrays */
+    boolean key;            /* the string being parsed is an attribute name */
+    u8 flags;               /* number parsing flags */
+    u8 count;               /* characters of literal or unicode escape parsed so far */
+    sstring literal;
+    enum json_event literal_event;
+    u32 codepoint;
+    u32 high_surrogate;
+};
 
-static boolean char_is_whitespace(character in)
-{
-    return (runtime_strchr(ss(" \n\r\t"), in) != 0);
-}
+#define SWAR_LSBS   0x0101010101010101ull
+#define SWAR_MSBS   0x8080808080808080ull
 
-static boolean char_is_numeric(character in)
+/* Bitmask with the most significant bit of each byte equal to c set; may have false positives only
+   in bytes more significant than a true match. */
+static inline u64 swar_match(u64 w, u8 c)
 {
-    return (runtime_strchr(ss("1234567890."), in) != 0);
+    u64 x = w ^ (SWAR_LSBS * c);
+    return (x - SWAR_LSBS) & ~x & SWAR_MSBS;
 }
 
-static parser parse_literal(parser p, character in, int char_index, const char *literal,
-                            int literal_len, parse_finish_internal c, parse_error_internal e)
+/* Returns the first quote or backslash character in [p, end), or end if none. */
+static const u8 *json_scan_string(const u8 *p, const u8 *end)
 {
-    if (in != literal[char_index]) {
-        string err_string = little_stack_buffer(32);
-        bprintf(err_string, "unexpected character %c", in);
-        return apply(e, err_string);
-    }
-    if (char_index == literal_len - 1) {
-        /* Literal value is discarded. */
-        return apply(c, 0);
+    while (end - p >= sizeof(u64)) {
+        u64 w;
+        runtime_memcpy(&w, p, sizeof(w));
+        u64 m = swar_match(w, '"') | swar_match(w, '\\');
+        if (m)
+            return p + (lsb(m) >> 3);
+        p += sizeof(w);
     }
+    while ((p < end) && (*p != '"') && (*p != '\\'))
+        p++;
     return p;
 }
 
-closure_func_basic(parser, void *, json_string_parse,
-                   character in)
+static boolean char_is_whitespace(u8 c)
 {
-    json_string_p p = struct_from_field(closure_self(), json_string_p, parse);
-    string s = p->s;
-    if (in == CHARACTER_INVALID) {
-        parser next = apply(p->p.e, alloca_wrap_cstring("unexpected end of input"));
-        deallocate_buffer(s);
-        deallocate(p->p.h, p, sizeof(*p));
-        return next;
-    }
-    if (!p->escape) {
-        if (in == '\"') {
-            parser next = apply(p->p.c, s);
-            deallocate(p->p.h, p, sizeof(*p));
-            return next;
-        }
-        if (in == '\\')
-            p->escape = true;
-        else
-            push_character(s, in);
-    } else {
-        switch (in) {
-        case 'n':
-            in = '\n';
-            break;
-        case 't':
-            in = '\t';
-            break;
-        case 'r':
-            in = '\r';
-            break;
-        case 'b':
-            in = '\b';
-            break;
-        case 'f':
-            in = '\f';
-            break;
-        }
-        push_character(s, in);
-        p->escape = false;
-    }
-    return (parser)closure_self();
+    return (c == ' ') || (c == '\n') || (c == '\r') || (c == '\t');
 }
 
-static parser json_string_parser(heap h, parse_finish_internal c, parse_error_internal e)
+static boolean char_is_digit(u8 c)
 {
-    json_string_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->s = allocate_string(8);
-    if (p->s == INVALID_ADDRESS) {
-        deallocate(h, p, sizeof(*p));
-        return INVALID_ADDRESS;
-    }
-    p->escape = false;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    return init_closure_func(&p->parse, parser, json_string_parse);
+    return (c >= '0') && (c <= '9');
 }
 
-/* Actual parsing of JSON numbers is not implemented. */
-closure_func_basic(parser, void *, json_number_parse,
-                   character in)
+static int hex_digit(u8 c)
 {
-    json_number_p p = struct_from_field(closure_self(), json_number_p, parse);
-    string err_string;
-    parser next;
-    if (!char_is_numeric(in)) {
-        if (!p->digit_found) {
-            err_string = alloca_wrap_cstring("no digits found");
-            goto error;
-        }
-        parser next = apply(p->p.c, 0);
-        deallocate(p->p.h, p, sizeof(*p));
-        return apply(next, in);
-    }
-    if (in == '.') {
-        if (!p->fractional) {
-            p->fractional = true;
-            p->digit_found = false;
-        } else {
-            err_string = alloca_wrap_cstring("unexpected decimal point");
-            goto error;
-        }
-    } else {
-        p->digit_found = true;
-    }
-    return (parser)closure_self();
-  error:
-    next = apply(p->p.e, err_string);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    if (char_is_digit(c))
+        return c - '0';
+    c |= 0x20;
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    return -1;
 }
 
-static parser json_number_parser(heap h, character first, parse_finish_internal c,
-                                 parse_error_internal e)
+static boolean json_error(json_stream js, sstring msg)
 {
-    json_number_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->digit_found = p->fractional = false;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    parser number_p = init_closure_func(&p->parse, parser, json_number_parse);
-    return (first != '-') ? apply(number_p, first) : number_p;
+    buffer_clear(js->err);
+    buffer_write_sstring(js->err, msg);
+    js->state = JSON_STATE_ERROR;
+    return false;
 }
 
-closure_func_basic(parser, void *, json_boolean_parse,
-                   character in)
+static boolean json_unexpected(json_stream js, u8 c)
 {
-    json_boolean_p p = struct_from_field(closure_self(), json_boolean_p, parse);
-    const char *literal = (p->value ? "true" : "false");
-    int len = (p->value ? 4 : 5);
-    parser self = (parser)closure_self();
-    parser next = parse_literal(self, in, p->char_count, literal, len, p->p.c, p->p.e);
-    if (next == self)
-        p->char_count++;
-    else
-        deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    buffer_clear(js->err);
+    bprintf(js->err, "unexpected character %c", c);
+    js->state = JSON_STATE_ERROR;
+    return false;
 }
 
-static parser json_boolean_parser(heap h, boolean value, parse_finish_internal c,
-                                  parse_error_internal e)
+static boolean json_emit(json_stream js, enum json_event ev, buffer data)
 {
-    json_boolean_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->value = value;
-    p->char_count = 1;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    return init_closure_func(&p->parse, parser, json_boolean_parse);
+    if (apply(js->handler, ev, data))
+        return true;
+    js->state = JSON_STATE_ERROR;
+    return false;
 }
 
-closure_func_basic(parser, void *, json_null_parse,
-                   character in)
+static boolean json_in_object(json_stream js)
 {
-    json_null_p p = struct_from_field(closure_self(), json_null_p, parse);
-    parser self = (parser)closure_self();
-    parser next = parse_literal(self, in, p->char_count, "null", 4, p->p.c, p->p.e);
-    if (next == self)
-        p->char_count++;
-    else
-        deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    u32 level = js->depth - 1;
+    return (js->containers[level / 64] & U64_FROM_BIT(level & 63)) != 0;
 }
 
-static parser json_null_parser(heap h, parse_finish_internal c, parse_error_internal e)
+static void json_value_done(json_stream js)
 {
-    json_null_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->char_count = 1;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    return init_closure_func(&p->parse, parser, json_null_parse);
+    js->state = js->depth ? JSON_STATE_VALUE_END : JSON_STATE_VALUE;
 }
 
-closure_func_basic(parser, void *, json_value_parse,
-                   character in)
+static boolean json_container_start(json_stream js, boolean obj)
 {
-    if (char_is_whitespace(in))
-        return (parser)closure_self();
-    json_value_p p = struct_from_field(closure_self(), json_value_p, parse);
-    parse_error_internal e = (parse_error_internal)&p->e;
-    string err_string;
-    if (in == CHARACTER_INVALID) {
-        err_string = alloca_wrap_cstring("unexpected end of input");
-        goto error;
-    }
-    heap h = p->p.h;
-    parser value_parser;
-    parse_finish_internal c = (parse_finish_internal)&p->c;
-    if (char_is_numeric(in))
-        value_parser = json_number_parser(h, in, c, e);
+    if (js->depth == JSON_MAX_DEPTH)
+        return json_error(js, ss("maximum nesting depth exceeded"));
+    u32 level = js->depth++;
+    if (obj)
+        js->containers[level / 64] |= U64_FROM_BIT(level & 63);
     else
-        switch (in) {
-        case '"':
-            value_parser = json_string_parser(h, c, e);
-            break;
-        case '{':
-            value_parser = json_obj_parser(h, c, e);
-            break;
-        case '[':
-            value_parser = json_array_parser(h, c, e);
-            break;
-        case '-':
-            value_parser = json_number_parser(h, in, c, e);
-            break;
-        case 't':
-        case 'f':
-            value_parser = json_boolean_parser(h, in == 't', c, e);
-            break;
-        case 'n':
-            value_parser = json_null_parser(h, c, e);
-            break;
-        default:
-            err_string = little_stack_buffer(32);
-            bprintf(err_string, "unexpected character %c", in);
-            goto error;
-        }
-    if (value_parser != INVALID_ADDRESS)
-        return value_parser;
-    err_string = alloca_wrap_cstring("failed to allocate value parser");
-  error:
-    return apply(e, err_string);
+        js->containers[level / 64] &= ~U64_FROM_BIT(level & 63);
+    js->state = obj ? JSON_STATE_KEY : JSON_STATE_VALUE;
+    return json_emit(js, obj ? JSON_EVENT_OBJ_START : JSON_EVENT_ARRAY_START, 0);
 }
 
-closure_func_basic(parse_finish_internal, parser, json_value_complete,
-                   void *result)
+static boolean json_container_end(json_stream js, u8 c)
 {
-    json_value_p p = struct_from_field(closure_self(), json_value_p, c);
-    parser next = apply(p->p.c, result);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    boolean obj = (c == '}');
+    if ((js->depth == 0) || (json_in_object(js) != obj))
+        return json_unexpected(js, c);
+    js->depth--;
+    json_value_done(js);
+    return json_emit(js, obj ? JSON_EVENT_OBJ_END : JSON_EVENT_ARRAY_END, 0);
 }
 
-closure_func_basic(parse_error_internal, parser, json_value_error,
-                   string err)
+static void json_token_start(json_stream js, enum json_state state)
 {
-    json_value_p p = struct_from_field(closure_self(), json_value_p, e);
-    parser next = apply(p->p.e, err);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    buffer_clear(js->token);
+    js->state = state;
 }
 
-static parser json_value_parser(heap h, parse_finish_internal c, parse_error_internal e)
+static boolean json_string_end(json_stream js)
 {
-    json_value_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    init_closure_func(&p->c, parse_finish_internal, json_value_complete);
-    init_closure_func(&p->e, parse_error_internal, json_value_error);
-    return init_closure_func(&p->parse, parser, json_value_parse);
+    if (js->key) {
+        js->state = JSON_STATE_COLON;
+        return json_emit(js, JSON_EVENT_KEY, js->token);
+    }
+    json_value_done(js);
+    return json_emit(js, JSON_EVENT_STRING, js->token);
 }
 
-closure_func_basic(parser, void *, json_attr_parse,
-                   character in)
+static boolean json_escape(json_stream js, u8 c)
 {
-    json_attr_p p = struct_from_field(closure_self(), json_attr_p, parse);
-    parse_error_internal e = (parse_error_internal)&p->e;
-    string err_string = 0;
-    if (in == CHARACTER_INVALID) {
-        err_string = alloca_wrap_cstring("unexpected end of input");
-        goto error;
-    }
-    heap h = p->p.h;
-    switch (p->state) {
-    case JSON_ATTR_STATE_NAME: {
-        parser name_p = json_string_parser(h, (parse_finish_internal)&p->name_c, e);
-        if (name_p != INVALID_ADDRESS)
-            return apply(name_p, in);
-        err_string = alloca_wrap_cstring("failed to allocate attribute name parser");
+    switch (c) {
+    case 'n':
+        c = '\n';
         break;
-    }
-    case JSON_ATTR_STATE_VALUE: {
-        if (char_is_whitespace(in))
-            return (parser)closure_self();
-        if (in != ':') {
-            err_string = little_stack_buffer(32);
-            bprintf(err_string, "unexpected character %c", in);
-            break;
-        }
-        parser value_p = json_value_parser(h, (parse_finish_internal)&p->value_c, e);
-        if (value_p != INVALID_ADDRESS)
-            return value_p;
-        err_string = alloca_wrap_cstring("failed to allocate attribute value parser");
+    case 't':
+        c = '\t';
+        break;
+    case 'r':
+        c = '\r';
+        break;
+    case 'b':
+        c = '\b';
         break;
+    case 'f':
+        c = '\f';
+        break;
+    case 'u':
+        js->codepoint = 0;
+        js->count = 0;
+        js->state = JSON_STATE_UNICODE;
+        return true;
+    }
+    js->state = JSON_STATE_STRING;
+    return buffer_write_byte(js->token, c) || json_error(js, ss("out of memory"));
+}
+
+static boolean json_unicode(json_stream js, u8 c)
+{
+    int d = hex_digit(c);
+    if (d < 0)
+        return json_unexpected(js, c);
+    js->codepoint = (js->codepoint << 4) | d;
+    if (++js->count < 4)
+        return true;
+    js->state = JSON_STATE_STRING;
+    character cp = js->codepoint;
+    if ((cp >= 0xd800) && (cp < 0xdc00)) {
+        /* high surrogate: the code point is completed by the next escape sequence */
+        js->high_surrogate = cp;
+        return true;
     }
+    if ((cp >= 0xdc00) && (cp < 0xe000)) {
+        if (!js->high_surrogate)
+            return true;    /* lone low surrogate, dropped */
+        cp = 0x10000 + ((js->high_surrogate - 0xd800) << 10) + (cp - 0xdc00);
     }
-  error:
-    return apply(e, err_string);
+    js->high_surrogate = 0;
+    return push_character(js->token, cp) || json_error(js, ss("out of memory"));
+}
+
+static boolean json_number_end(json_stream js)
+{
+    if (!(js->flags & JSON_NUM_DIGITS))
+        return json_error(js, ss("no digits found"));
+    json_value_done(js);
+    return json_emit(js, JSON_EVENT_NUMBER, js->token);
+}
+
+/* Returns false if c is not part of the number (or is invalid, in which case the parser is put in
+   the error state). */
+static boolean json_number(json_stream js, u8 c)
+{
+    u8 flags = js->flags & ~JSON_NUM_EXP_START;
+    if (char_is_digit(c)) {
+        flags |= JSON_NUM_DIGITS;
+    } else if (c == '.') {
+        if (flags & (JSON_NUM_FRACTION | JSON_NUM_EXPONENT))
+            return json_error(js, ss("unexpected decimal point"));
+        if (!(flags & JSON_NUM_DIGITS))
+            return json_error(js, ss("no digits found"));
+        flags = (flags | JSON_NUM_FRACTION) & ~JSON_NUM_DIGITS;
+    } else if ((c == 'e') || (c == 'E')) {
+        if (flags & JSON_NUM_EXPONENT)
+            return json_unexpected(js, c);
+        if (!(flags & JSON_NUM_DIGITS))
+            return json_error(js, ss("no digits found"));
+        flags = (flags | JSON_NUM_EXPONENT | JSON_NUM_EXP_START) & ~JSON_NUM_DIGITS;
+    } else if (((c == '+') || (c == '-')) && (js->flags & JSON_NUM_EXP_START)) {
+        /* exponent sign */
+    } else {
+        return false;
+    }
+    js->flags = flags;
+    return buffer_write_byte(js->token, c) || json_error(js, ss("out of memory"));
 }
 
-closure_func_basic(parse_finish_internal, parser, json_attr_name_complete,
-                   void *result)
+static boolean json_literal(json_stream js, u8 c)
 {
-    json_attr_p p = struct_from_field(closure_self(), json_attr_p, name_c);
-    p->name = result;
-    if (buffer_length(p->name) == 0) {
-        parse_error_internal e = (parse_error_internal)&p->e;
-        return apply(e, alloca_wrap_cstring("empty attribute name"));
-    }
-    p->state = JSON_ATTR_STATE_VALUE;
-    return (parser)&p->parse;
+    if (c != js->literal.ptr[js->count])
+        return json_unexpected(js, c);
+    if (++js->count < js->literal.len)
+        return true;
+    json_value_done(js);
+    return json_emit(js, js->literal_event, 0);
 }
 
-closure_func_basic(parse_finish_internal, parser, json_attr_value_complete,
-                   void *result)
+static void json_literal_start(json_stream js, sstring literal, enum json_event ev)
 {
-    json_attr_p p = struct_from_field(closure_self(), json_attr_p, value_c);
-    if (result)
-        set(p->parent_obj, intern(p->name), result);
-    deallocate_buffer(p->name);
-    parser next = apply(p->p.c, p->parent_obj);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    js->literal = literal;
+    js->literal_event = ev;
+    js->count = 1;
+    js->state = JSON_STATE_LITERAL;
 }
 
-closure_func_basic(parse_error_internal, parser, json_attr_error,
-                   string err)
+static boolean json_value(json_stream js, u8 c)
 {
-    json_attr_p p = struct_from_field(closure_self(), json_attr_p, e);
-    parser next = apply(p->p.e, err);
-    if (p->name)
-        deallocate_buffer(p->name);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    switch (c) {
+    case '"':
+        js->key = false;
+        json_token_start(js, JSON_STATE_STRING);
+        return true;
+    case '{':
+        return json_container_start(js, true);
+    case '[':
+        return json_container_start(js, false);
+    case ']':
+        /* end of an empty array (or of an array with a trailing separator) */
+        if (js->depth && !json_in_object(js))
+            return json_container_end(js, c);
+        break;
+    case 't':
+        json_literal_start(js, ss("true"), JSON_EVENT_TRUE);
+        return true;
+    case 'f':
+        json_literal_start(js, ss("false"), JSON_EVENT_FALSE);
+        return true;
+    case 'n':
+        json_literal_start(js, ss("null"), JSON_EVENT_NULL);
+        return true;
+    default:
+        if ((c == '-') || char_is_digit(c)) {
+            json_token_start(js, JSON_STATE_NUMBER);
+            js->flags = char_is_digit(c) ? JSON_NUM_DIGITS : 0;
+            return buffer_write_byte(js->token, c) || json_error(js, ss("out of memory"));
+        }
+    }
+    return json_unexpected(js, c);
 }
 
-static parser json_attr_parser(heap h, tuple parent_obj, parse_finish_internal c,
-                               parse_error_internal e)
+static boolean json_structural(json_stream js, u8 c)
 {
-    json_attr_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    p->parent_obj = parent_obj;
-    p->name = 0;
-    p->state = JSON_ATTR_STATE_NAME;
-    init_closure_func(&p->name_c, parse_finish_internal, json_attr_name_complete);
-    init_closure_func(&p->value_c, parse_finish_internal, json_attr_value_complete);
-    init_closure_func(&p->e, parse_error_internal, json_attr_error);
-    return init_closure_func(&p->parse, parser, json_attr_parse);
-}
-
-closure_func_basic(parser, void *, json_obj_parse,
-                   character in)
-{
-    if (char_is_whitespace(in))
-        return (parser)closure_self();
-    json_obj_p p = struct_from_field(closure_self(), json_obj_p, parse);
-    string err_string;
-    parser next;
-    if (in == CHARACTER_INVALID) {
-        err_string = alloca_wrap_cstring("unexpected end of input");
-        goto error;
+    switch (js->state) {
+    case JSON_STATE_VALUE:
+        return json_value(js, c);
+    case JSON_STATE_VALUE_END:
+        if (c == ',') {
+            js->state = json_in_object(js) ? JSON_STATE_KEY : JSON_STATE_VALUE;
+            return true;
+        }
+        if ((c == '}') || (c == ']'))
+            return json_container_end(js, c);
+        break;
+    case JSON_STATE_KEY:
+        if (c == '"') {
+            js->key = true;
+            json_token_start(js, JSON_STATE_STRING);
+            return true;
+        }
+        /* end of an empty object (or of an object with a trailing separator) */
+        if (c == '}')
+            return json_container_end(js, c);
+        break;
+    case JSON_STATE_COLON:
+        if (c == ':') {
+            js->state = JSON_STATE_VALUE;
+            return true;
+        }
+        break;
+    default:
+        assert(0);
     }
-    switch (p->state) {
-    case JSON_OBJ_STATE_ATTR_BEGIN:
-        switch (in) {
-        case '"': {
-            parser attr_p = json_attr_parser(p->p.h, p->obj, (parse_finish_internal)&p->c,
-                                             (parse_error_internal)&p->e);
-            if (attr_p != INVALID_ADDRESS)
-                return attr_p;
-            err_string = alloca_wrap_cstring("failed to allocate attribute parser");
+    return json_unexpected(js, c);
+}
+
+boolean json_stream_feed(json_stream js, buffer b)
+{
+    const u8 *start = buffer_ref(b, 0);
+    const u8 *end = start + buffer_length(b);
+    const u8 *p = start;
+    boolean ok = (js->state != JSON_STATE_ERROR);
+    while (ok && (p < end)) {
+        u8 c = *p;
+        switch (js->state) {
+        case JSON_STATE_STRING: {
+            const u8 *q = json_scan_string(p, end);
+            if (q > p) {
+                if (!buffer_write(js->token, p, q - p))
+                    ok = json_error(js, ss("out of memory"));
+                p = q;
+                continue;
+            }
+            if (c == '"')
+                ok = json_string_end(js);
+            else
+                js->state = JSON_STATE_ESCAPE;
             break;
         }
-        case '}':
-            goto finish;
-        default:
-            goto unexpected_in;
-        }
-    case JSON_OBJ_STATE_ATTR_END:
-        switch (in) {
-        case ',':
-            p->state = JSON_OBJ_STATE_ATTR_BEGIN;
+        case JSON_STATE_ESCAPE:
+            ok = json_escape(js, c);
+            break;
+        case JSON_STATE_UNICODE:
+            ok = json_unicode(js, c);
+            break;
+        case JSON_STATE_NUMBER:
+            if (json_number(js, c))
+                break;
+            if (js->state == JSON_STATE_ERROR) {
+                ok = false;
+                break;
+            }
+            /* the character that ends the number is parsed in the next state */
+            ok = json_number_end(js);
+            if (ok)
+                continue;
+            break;
+        case JSON_STATE_LITERAL:
+            ok = json_literal(js, c);
             break;
-        case '}':
-            goto finish;
         default:
-            goto unexpected_in;
+            if (!char_is_whitespace(c))
+                ok = json_structural(js, c);
         }
-        break;
+        p++;
     }
-    return (parser)closure_self();
-  unexpected_in:
-    err_string = little_stack_buffer(32);
-    bprintf(err_string, "unexpected character %c", in);
-  error:
-    destruct_value(p->obj, true);
-    next = apply(p->p.e, err_string);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
-  finish:
-    next = apply(p->p.c, p->obj);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    buffer_consume(b, p - start);
+    return ok;
 }
 
-closure_func_basic(parse_finish_internal, parser, json_obj_attr_complete,
-                   void *result)
+boolean json_stream_end(json_stream js)
 {
-    json_obj_p p = struct_from_field(closure_self(), json_obj_p, c);
-    p->state = JSON_OBJ_STATE_ATTR_END;
-    return (parser)&p->parse;
+    switch (js->state) {
+    case JSON_STATE_ERROR:
+        return false;
+    case JSON_STATE_NUMBER:
+        if (!json_number_end(js))
+            return false;
+        break;
+    default:
+        break;
+    }
+    if ((js->depth == 0) && (js->state == JSON_STATE_VALUE))
+        return true;
+    return json_error(js, ss("unexpected end of input"));
 }
 
-closure_func_basic(parse_error_internal, parser, json_obj_attr_error,
-                   string err)
+string json_stream_error(json_stream js)
 {
-    json_obj_p p = struct_from_field(closure_self(), json_obj_p, e);
-    destruct_value(p->obj, true);
-    parser next = apply(p->p.e, err);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    return js->err;
 }
 
-static parser json_obj_parser(heap h, parse_finish_internal c, parse_error_internal e)
+void json_stream_reset(json_stream js)
 {
-    json_obj_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->obj = allocate_tuple();
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    p->state = JSON_OBJ_STATE_ATTR_BEGIN;
-    init_closure_func(&p->c, parse_finish_internal, json_obj_attr_complete);
-    init_closure_func(&p->e, parse_error_internal, json_obj_attr_error);
-    return init_closure_func(&p->parse, parser, json_obj_parse);
+    buffer_clear(js->token);
+    buffer_clear(js->err);
+    js->state = JSON_STATE_VALUE;
+    js->depth = 0;
+    js->high_surrogate = 0;
 }
 
-closure_func_basic(parser, void *, json_array_parse,
-                   character in)
+static boolean json_stream_init(json_stream js, heap h, json_handler handler)
 {
-    json_array_p p = struct_from_field(closure_self(), json_array_p, parse);
-    string err_string;
-    parser next;
-    if (in == CHARACTER_INVALID) {
-        err_string = alloca_wrap_cstring("unexpected end of input");
-        goto error;
+    js->token = allocate_buffer(h, 64);
+    if (js->token == INVALID_ADDRESS)
+        return false;
+    js->err = allocate_buffer(h, 32);
+    if (js->err == INVALID_ADDRESS) {
+        deallocate_buffer(js->token);
+        return false;
     }
-    if (in == ']') {
-        /* Array contents are discarded. */
-        next = apply(p->p.c, 0);
-        deallocate(p->p.h, p, sizeof(*p));
-        return next;
-    }
-    switch (p->state) {
-    case JSON_ARRAY_STATE_ELEM_BEGIN:
-        next = json_value_parser(p->p.h, (parse_finish_internal)&p->c, (parse_error_internal)&p->e);
-        if (next != INVALID_ADDRESS)
-            return apply(next, in);
-        err_string = alloca_wrap_cstring("failed to allocate array element parser");
-        goto error;
-    case JSON_ARRAY_STATE_ELEM_END:
-        if (in == ',') {
-            p->state = JSON_OBJ_STATE_ATTR_BEGIN;
-            break;
-        }
-        err_string = little_stack_buffer(32);
-        bprintf(err_string, "unexpected character %c", in);
-        goto error;
+    js->handler = handler;
+    json_stream_reset(js);
+    return true;
+}
+
+static void json_stream_deinit(json_stream js)
+{
+    deallocate_buffer(js->token);
+    deallocate_buffer(js->err);
+}
+
+json_stream allocate_json_stream(heap h, json_handler handler)
+{
+    json_stream js = allocate(h, sizeof(*js));
+    if (js == INVALID_ADDRESS)
+        return js;
+    if (!json_stream_init(js, h, handler)) {
+        deallocate(h, js, sizeof(*js));
+        return INVALID_ADDRESS;
     }
-    return (parser)closure_self();
-  error:
-    next = apply(p->p.e, err_string);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    return js;
 }
 
-closure_func_basic(parse_finish_internal, parser, json_array_elem_complete,
-                   void *result)
+void deallocate_json_stream(heap h, json_stream js)
 {
-    json_array_p p = struct_from_field(closure_self(), json_array_p, c);
-    if (result)
-        deallocate_value(result);
-    p->state = JSON_ARRAY_STATE_ELEM_END;
-    return (parser)&p->parse;
+    json_stream_deinit(js);
+    deallocate(h, js, sizeof(*js));
 }
 
-closure_func_basic(parse_error_internal, parser, json_array_elem_error,
-                   string err)
+/* Tuple-producing parser
+ *
+ * Each top-level object is converted to a tuple; attributes with string and object values are
+ * stored in the tuple, while numeric, boolean, null and array values are discarded.
+ */
+
+typedef struct json_obj_frame {
+    tuple obj;
+    symbol name;            /* name of the attribute whose value is being parsed */
+} *json_obj_frame;
+
+typedef struct json_p {
+    heap h;
+    parse_finish finish;
+    parse_error err;
+    closure_struct(parser, parse);
+    closure_struct(json_handler, handler);
+    struct json_stream js;
+    buffer objs;            /* stack of json_obj_frame structures */
+    u32 skip_depth;         /* nesting level within a discarded value */
+} *json_p;
+
+static json_obj_frame json_p_top(json_p p)
 {
-    json_array_p p = struct_from_field(closure_self(), json_array_p, e);
-    parser next = apply(p->p.e, err);
-    deallocate(p->p.h, p, sizeof(*p));
-    return next;
+    if (buffer_length(p->objs) == 0)
+        return 0;
+    return buffer_end(p->objs) - sizeof(struct json_obj_frame);
 }
 
-static parser json_array_parser(heap h, parse_finish_internal c, parse_error_internal e)
+static void json_p_reset(json_p p)
 {
-    json_array_p p = allocate(h, sizeof(*p));
-    if (p == INVALID_ADDRESS)
-        return INVALID_ADDRESS;
-    p->p.h = h;
-    p->p.c = c;
-    p->p.e = e;
-    p->state = JSON_ARRAY_STATE_ELEM_BEGIN;
-    init_closure_func(&p->c, parse_finish_internal, json_array_elem_complete);
-    init_closure_func(&p->e, parse_error_internal, json_array_elem_error);
-    return init_closure_func(&p->parse, parser, json_array_parse);
+    json_obj_frame f;
+    while ((f = json_p_top(p))) {
+        destruct_value(f->obj, true);
+        p->objs->end -= sizeof(*f);
+    }
+    p->skip_depth = 0;
+    json_stream_reset(&p->js);
+}
+
+static u8 json_event_char(enum json_event ev, buffer data)
+{
+    switch (ev) {
+    case JSON_EVENT_ARRAY_START:
+        return '[';
+    case JSON_EVENT_STRING:
+        return '"';
+    case JSON_EVENT_NUMBER:
+        return byte(data, 0);
+    case JSON_EVENT_TRUE:
+        return 't';
+    case JSON_EVENT_FALSE:
+        return 'f';
+    case JSON_EVENT_NULL:
+        return 'n';
+    default:
+        return '?';
+    }
 }
 
-closure_func_basic(parser, void *, json_parse,
-                   character in)
+closure_func_basic(json_handler, boolean, json_tuple_handler,
+                   enum json_event ev, buffer data)
 {
-    if (char_is_whitespace(in) || (in == CHARACTER_INVALID))
-        return (parser)closure_self();
-    json_p p = struct_from_field(closure_self(), json_p, parse);
-    string err_string;
-    if (in == '{') {
-        parser obj_parser = json_obj_parser(p->h, (parse_finish_internal)&p->c,
-                                            (parse_error_internal)&p->e);
-        if (obj_parser != INVALID_ADDRESS)
-            return obj_parser;
-        err_string = alloca_wrap_cstring("failed to allocate object parser");
-    } else {
-        err_string = little_stack_buffer(32);
-        bprintf(err_string, "unexpected character %c", in);
+    json_p p = struct_from_field(closure_self(), json_p, handler);
+    json_obj_frame f = json_p_top(p);
+    if (p->skip_depth) {
+        if ((ev == JSON_EVENT_OBJ_START) || (ev == JSON_EVENT_ARRAY_START)) {
+            p->skip_depth++;
+        } else if ((ev == JSON_EVENT_OBJ_END) || (ev == JSON_EVENT_ARRAY_END)) {
+            if (--p->skip_depth == 0)
+                f->name = 0;
+        }
+        return true;
     }
-    apply(p->err, err_string);
-    return (parser)closure_self();
+    if (!f && (ev != JSON_EVENT_OBJ_START))
+        return json_unexpected(&p->js, json_event_char(ev, data));
+    switch (ev) {
+    case JSON_EVENT_OBJ_START: {
+        tuple obj = allocate_tuple();
+        if (!buffer_extend(p->objs, sizeof(*f))) {
+            destruct_value(obj, true);
+            return json_error(&p->js, ss("out of memory"));
+        }
+        f = buffer_end(p->objs);
+        f->obj = obj;
+        f->name = 0;
+        buffer_produce(p->objs, sizeof(*f));
+        break;
+    }
+    case JSON_EVENT_OBJ_END: {
+        tuple obj = f->obj;
+        p->objs->end -= sizeof(*f);
+        f = json_p_top(p);
+        if (f) {
+            set(f->obj, f->name, obj);
+            f->name = 0;
+        } else {
+            apply(p->finish, obj);
+        }
+        break;
+    }
+    case JSON_EVENT_ARRAY_START:
+        p->skip_depth = 1;
+        break;
+    case JSON_EVENT_KEY:
+        if (buffer_length(data) == 0)
+            return json_error(&p->js, ss("empty attribute name"));
+        f->name = intern(data);
+        break;
+    case JSON_EVENT_STRING: {
+        string s = allocate_string(buffer_length(data));
+        if (s == INVALID_ADDRESS)
+            return json_error(&p->js, ss("out of memory"));
+        buffer_write(s, buffer_ref(data, 0), buffer_length(data));
+        set(f->obj, f->name, s);
+        f->name = 0;
+        break;
+    }
+    default:
+        f->name = 0;
+    }
+    return true;
 }
 
-closure_func_basic(parse_finish_internal, parser, json_complete,
-                   void *result)
+static void json_p_feed(json_p p, buffer b)
 {
-    json_p p = struct_from_field(closure_self(), json_p, c);
-    apply(p->finish, result);
-    return (parser)&p->parse;
+    while (!json_stream_feed(&p->js, b)) {
+        apply(p->err, json_stream_error(&p->js));
+        json_p_reset(p);
+    }
 }
 
-closure_func_basic(parse_error_internal, parser, json_error,
-                   string err)
+closure_func_basic(parser, void *, json_parse,
+                   character in)
 {
-    json_p p = struct_from_field(closure_self(), json_p, e);
-    apply(p->err, err);
-    return (parser)&p->parse;
+    json_p p = struct_from_field(closure_self(), json_p, parse);
+    if (in == CHARACTER_INVALID) {
+        if (!json_stream_end(&p->js)) {
+            apply(p->err, json_stream_error(&p->js));
+            json_p_reset(p);
+        }
+    } else {
+        buffer b = little_stack_buffer(4);
+        push_character(b, in);
+        json_p_feed(p, b);
+    }
+    return (parser)closure_self();
 }
 
 parser json_parser(heap h, parse_finish c, parse_error err)
@@ -656,16 +621,35 @@ parser json_parser(heap h, parse_finish c, parse_error err)
     json_p p = allocate(h, sizeof(*p));
     if (p == INVALID_ADDRESS)
         return INVALID_ADDRESS;
+    p->objs = allocate_buffer(h, 8 * sizeof(struct json_obj_frame));
+    if (p->objs == INVALID_ADDRESS)
+        goto err_objs;
+    if (!json_stream_init(&p->js, h, init_closure_func(&p->handler, json_handler,
+                                                        json_tuple_handler)))
+        goto err_stream;
     p->h = h;
     p->finish = c;
     p->err = err;
-    init_closure_func(&p->c, parse_finish_internal, json_complete);
-    init_closure_func(&p->e, parse_error_internal, json_error);
+    p->skip_depth = 0;
     return init_closure_func(&p->parse, parser, json_parse);
+  err_stream:
+    deallocate_buffer(p->objs);
+  err_objs:
+    deallocate(h, p, sizeof(*p));
+    return INVALID_ADDRESS;
+}
+
+parser json_parser_feed(parser p, buffer b)
+{
+    json_p_feed(struct_from_field(p, json_p, parse), b);
+    return p;
 }
 
 void json_parser_free(parser p)
 {
     json_p jp = struct_from_field(p, json_p, parse);
+    json_p_reset(jp);
+    json_stream_deinit(&jp->js);
+    deallocate_buffer(jp->objs);
     deallocate(jp->h, jp, sizeof(*jp));
 }
@@ -43,17 +43,17 @@ typedef struct kernel_heaps {
        a general-purpose allocator. Compatible with a malloc/free
        interface, deallocations do not require a size (but will
        attempt to verify one if given, so use -1ull to indicate an
-       unspecified size). Not protected by spinlock; likely to be replaced by
-       the locked heap. Do not use for DMA memory. */
+       unspecified size). Protected by spinlock, with per-CPU magazines
+       serving most small allocations without taking the lock. Do not use
+       for DMA memory. */
     heap general;
 
-    /* Like general, but protected by a spinlock. While heap operations from
-       interrupt handlers are generally discouraged, they should be safe on
-       the locked heap. */
+    /* Same as general. While heap operations from interrupt handlers are
+       generally discouraged, they should be safe on the locked heap. */
     heap locked;
 
     /* mcache for "malloc-style" allocations, i.e. to be used by vendor code where deallocation
-     * requests are made without a size argument. Protected by spinlock. */
+     * requests are made without a size argument. Protected by spinlock, with per-CPU magazines. */
     heap malloc;
 
     /* mcache for allocations of DMA memory. Protected by spinlock. */
@@ -0,0 +1,172 @@
+/* LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+ *
+ * The compressor is a simple greedy single-pass implementation, meant for offline use (image
+ * creation); the decompressor validates its input, as it runs on data read from storage.
+ */
+
+#include <runtime.h>
+
+#define LZ4_MINMATCH        4
+#define LZ4_LAST_LITERALS   5
+#define LZ4_MFLIMIT         12
+#define LZ4_MAX_OFFSET      65535
+#define LZ4_HASH_ORDER      12
+
+build_assert(LZ4_COMPRESS_TABLE_SIZE == U64_FROM_BIT(LZ4_HASH_ORDER) * sizeof(u32));
+
+static inline u32 lz4_read32(const u8 *p)
+{
+    u32 v;
+    runtime_memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+    return (v * 2654435761U) >> (32 - LZ4_HASH_ORDER);
+}
+
+/* encode the part of a length that doesn't fit in a token nibble */
+static u8 *lz4_write_length(u8 *op, u8 *oend, u64 len)
+{
+    while (len >= 255) {
+        if (op >= oend)
+            return 0;
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+        return 0;
+    *op++ = len;
+    return op;
+}
+
+/* a match length of 0 denotes the final (literals-only) sequence */
+static u8 *lz4_write_sequence(u8 *op, u8 *oend, const u8 *literals, u64 literal_len,
+                              u64 offset, u64 match_len)
+{
+    if (op >= oend)
+        return 0;
+    u8 *token = op++;
+    u8 t = MIN(literal_len, 15) << 4;
+    if ((literal_len >= 15) && !(op = lz4_write_length(op, oend, literal_len - 15)))
+        return 0;
+    if (oend - op < literal_len)
+        return 0;
+    runtime_memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len) {
+        if (oend - op < 2)
+            return 0;
+        *op++ = offset;
+        *op++ = offset >> 8;
+        match_len -= LZ4_MINMATCH;
+        t |= MIN(match_len, 15);
+        if ((match_len >= 15) && !(op = lz4_write_length(op, oend, match_len - 15)))
+            return 0;
+    }
+    *token = t;
+    return op;
+}
+
+/* Same as lz4_compress(), with a caller-supplied hash table of LZ4_COMPRESS_TABLE_SIZE bytes (for
+ * callers running on small stacks). */
+u64 lz4_compress_table(const void *source, u64 length, void *dest, u64 capacity, u32 *table)
+{
+    const u8 *src = source;
+    const u8 *ip = src, *anchor = src;
+    const u8 *end = src + length;
+    u8 *op = dest, *oend = op + capacity;
+
+    zero(table, LZ4_COMPRESS_TABLE_SIZE);
+    if (length > LZ4_MFLIMIT) {
+        const u8 *mflimit = end - LZ4_MFLIMIT;
+        const u8 *matchlimit = end - LZ4_LAST_LITERALS;
+        while (ip <= mflimit) {
+            u32 seq = lz4_read32(ip);
+            u32 h = lz4_hash(seq);
+            const u8 *ref = src + table[h];
+            table[h] = ip - src;
+            if ((ref >= ip) || (ip - ref > LZ4_MAX_OFFSET) || (lz4_read32(ref) != seq)) {
+                ip++;
+                continue;
+            }
+            const u8 *match_end = ip + LZ4_MINMATCH;
+            ref += LZ4_MINMATCH;
+            while ((match_end < matchlimit) && (*match_end == *ref)) {
+                match_end++;
+                ref++;
+            }
+            op = lz4_write_sequence(op, oend, anchor, ip - anchor, match_end - ref,
+                                    match_end - ip);
+            if (!op)
+                return 0;
+            ip = anchor = match_end;
+        }
+    }
+    op = lz4_write_sequence(op, oend, anchor, end - anchor, 0, 0);
+    return op ? op - (u8 *)dest : 0;
+}
+
+/* Returns the compressed length, or 0 if the result doesn't fit in capacity bytes. */
+u64 lz4_compress(const void *source, u64 length, void *dest, u64 capacity)
+{
+    u32 table[U64_FROM_BIT(LZ4_HASH_ORDER)];
+    return lz4_compress_table(source, length, dest, capacity, table);
+}
+
+/* Decodes at most capacity bytes (the remainder of the data is ignored); returns the decoded
+ * length, or -1 if the compressed data is malformed. */
+s64 lz4_decompress(const void *source, u64 length, void *dest, u64 capacity)
+{
+    const u8 *ip = source, *iend = ip + length;
+    u8 *op = dest, *oend = op + capacity;
+    while ((ip < iend) && (op < oend)) {
+        u8 token = *ip++;
+        u64 len = token >> 4;
+        if (len == 15) {
+            u8 b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if (iend - ip < len)
+            return -1;
+        u64 n = MIN(len, oend - op);
+        runtime_memcpy(op, ip, n);
+        op += n;
+        ip += len;
+        if ((ip == iend) || (op == oend))
+            break;
+        if (iend - ip < 2)
+            return -1;
+        u64 offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > op - (u8 *)dest))
+            return -1;
+        len = token & 15;
+        if (len == 15) {
+            u8 b;
+            do {
+                if (ip >= iend)
+                    return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        len = MIN(len + LZ4_MINMATCH, oend - op);
+        const u8 *match = op - offset;
+        if (offset >= len) {
+            runtime_memcpy(op, match, len);
+            op += len;
+        } else {
+            /* overlapping match: replicate the pattern */
+            while (len--)
+                *op++ = *match++;
+        }
+    }
+    return op - (u8 *)dest;
+}
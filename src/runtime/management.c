@@ -16,8 +16,38 @@ static struct management {
     struct timer t;
     tuple timer_req;
     closure_struct(mgmt_timer_expiry, timer_expiry);
+#ifdef KERNEL
+    struct list subscriptions;
+    u64 next_subscription_id;
+#endif
 } management;
 
+#ifdef KERNEL
+/* A subscription periodically walks a subtree and sends only the leaf values that changed (or were
+ * removed) since the previous walk; the first walk sends every leaf. Values are compared by the
+ * hash of their formatted representation, so only a hash per leaf is retained. Dynamic values
+ * (e.g. counters summed from per-CPU storage by get notifiers) are evaluated at each walk. Output:
+ *   (subscription:<id> changed:[(path:<path> value:<value>) ...] removed:[<path> ...])
+ */
+typedef struct mgmt_subscription {
+    struct list l;
+    u64 id;
+    string path;
+    u64 depth;
+    buffer_handler out;
+    table leaves;               /* path hash -> mgmt_sub_leaf */
+    u64 gen;
+    struct timer t;
+    closure_struct(timer_handler, expiry);
+} *mgmt_subscription;
+
+typedef struct mgmt_sub_leaf {
+    u64 hash;                   /* of the formatted value */
+    u64 gen;                    /* of the last walk where the leaf was found */
+    string path;
+} *mgmt_sub_leaf;
+#endif
+
 static value resolve_tuple_path(tuple n, string path, tuple *parent, symbol *a)
 {
     vector v = split(management.h, (buffer) /* XXX */ path, '/');
@@ -66,6 +96,169 @@ define_closure_function(1, 2, void, mgmt_timer_expiry,
 }
 #endif
 
+#ifdef KERNEL
+typedef struct mgmt_sub_walk {
+    mgmt_subscription s;
+    buffer path;
+    buffer scratch;
+    buffer changed;
+} *mgmt_sub_walk;
+
+static void mgmt_sub_walk_value(mgmt_sub_walk w, value v, u64 depth);
+
+closure_function(2, 2, boolean, mgmt_sub_walk_each,
+                 mgmt_sub_walk, w, u64, depth,
+                 value a, value v)
+{
+    mgmt_sub_walk w = bound(w);
+    bytes len = buffer_length(w->path);
+    bprintf(w->path, "/%v", sym_from_attribute(a));
+    mgmt_sub_walk_value(w, v, bound(depth));
+    w->path->end = w->path->start + len;
+    return true;
+}
+
+static void mgmt_sub_walk_value(mgmt_sub_walk w, value v, u64 depth)
+{
+    mgmt_subscription s = w->s;
+    if (!v)
+        return;
+    if (is_composite(v)) {
+        if (depth > 0)
+            iterate(v, stack_closure(mgmt_sub_walk_each, w, depth - 1));
+        return;
+    }
+    buffer_clear(w->scratch);
+    bprintf(w->scratch, "%v", v);
+    u64 hash = fnv64(w->scratch);
+    u64 path_hash = fnv64(w->path) | 1;     /* non-zero key */
+    mgmt_sub_leaf leaf = table_find(s->leaves, pointer_from_u64(path_hash));
+    if (!leaf) {
+        leaf = allocate(management.h, sizeof(*leaf));
+        if (leaf == INVALID_ADDRESS)
+            return;
+        leaf->path = clone_buffer(management.h, w->path);
+        if (leaf->path == INVALID_ADDRESS) {
+            deallocate(management.h, leaf, sizeof(*leaf));
+            return;
+        }
+        table_set(s->leaves, pointer_from_u64(path_hash), leaf);
+    } else if (leaf->hash == hash) {
+        leaf->gen = s->gen;
+        return;
+    }
+    leaf->hash = hash;
+    leaf->gen = s->gen;
+    bprintf(w->changed, "(path:%b value:%b) ", w->path, w->scratch);
+}
+
+static void mgmt_sub_leaf_free(mgmt_sub_leaf leaf)
+{
+    deallocate_buffer(leaf->path);
+    deallocate(management.h, leaf, sizeof(*leaf));
+}
+
+closure_func_basic(timer_handler, void, mgmt_sub_expiry,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    mgmt_subscription s = struct_from_field(closure_self(), mgmt_subscription, expiry);
+    s->gen++;
+    struct mgmt_sub_walk w;
+    w.s = s;
+    w.path = allocate_buffer(management.h, 64);
+    w.scratch = allocate_buffer(management.h, 64);
+    w.changed = allocate_buffer(management.h, 256);
+    buffer removed = allocate_buffer(management.h, 64);
+    if ((w.path == INVALID_ADDRESS) || (w.scratch == INVALID_ADDRESS) ||
+        (w.changed == INVALID_ADDRESS) || (removed == INVALID_ADDRESS))
+        goto out;
+    push_buffer(w.path, s->path);
+    if (buffer_length(w.path) && (byte(w.path, buffer_length(w.path) - 1) == '/'))
+        w.path->end--;
+    mgmt_sub_walk_value(&w, resolve_tuple_path(management.root, s->path, 0, 0), s->depth);
+    table_foreach(s->leaves, k, v) {
+        mgmt_sub_leaf leaf = v;
+        if (leaf->gen != s->gen) {
+            bprintf(removed, "%b ", leaf->path);
+            table_set(s->leaves, k, 0);
+            mgmt_sub_leaf_free(leaf);
+        }
+    }
+    if (buffer_length(w.changed) || buffer_length(removed)) {
+        buffer b = allocate_buffer(management.h, buffer_length(w.changed) +
+                                   buffer_length(removed) + 64);
+        if (b != INVALID_ADDRESS) {
+            bprintf(b, "(subscription:%ld changed:[%b] removed:[%b])\n", s->id, w.changed,
+                    removed);
+            apply(s->out, b);
+        }
+    }
+  out:
+    if (w.path != INVALID_ADDRESS)
+        deallocate_buffer(w.path);
+    if (w.scratch != INVALID_ADDRESS)
+        deallocate_buffer(w.scratch);
+    if (w.changed != INVALID_ADDRESS)
+        deallocate_buffer(w.changed);
+    if (removed != INVALID_ADDRESS)
+        deallocate_buffer(removed);
+}
+
+static mgmt_subscription mgmt_subscribe(string path, u64 depth, timestamp period,
+                                        buffer_handler out)
+{
+    mgmt_subscription s = allocate(management.h, sizeof(*s));
+    if (s == INVALID_ADDRESS)
+        return s;
+    s->path = clone_buffer(management.h, path);
+    if (s->path == INVALID_ADDRESS)
+        goto fail;
+    s->leaves = allocate_table(management.h, identity_key, pointer_equal);
+    if (s->leaves == INVALID_ADDRESS) {
+        deallocate_buffer(s->path);
+        goto fail;
+    }
+    s->id = ++management.next_subscription_id;
+    s->depth = depth;
+    s->out = out;
+    s->gen = 0;
+    init_timer(&s->t);
+    list_push_back(&management.subscriptions, &s->l);
+    timer_handler th = init_closure_func(&s->expiry, timer_handler, mgmt_sub_expiry);
+    apply(th, 0, 0);    /* send the initial values right away */
+    register_timer(kernel_timers, &s->t, CLOCK_ID_MONOTONIC, period, false, period, th);
+    return s;
+  fail:
+    deallocate(management.h, s, sizeof(*s));
+    return INVALID_ADDRESS;
+}
+
+static void mgmt_unsubscribe(mgmt_subscription s)
+{
+    remove_timer(kernel_timers, &s->t, 0);
+    list_delete(&s->l);
+    table_foreach(s->leaves, k, v) {
+        (void)k;
+        mgmt_sub_leaf_free(v);
+    }
+    deallocate_table(s->leaves);
+    deallocate_buffer(s->path);
+    deallocate(management.h, s, sizeof(*s));
+}
+
+static mgmt_subscription mgmt_find_subscription(u64 id)
+{
+    list_foreach(&management.subscriptions, l) {
+        mgmt_subscription s = struct_from_list(l, mgmt_subscription, l);
+        if (s->id == id)
+            return s;
+    }
+    return INVALID_ADDRESS;
+}
+#endif
+
 define_closure_function(1, 2, boolean, each_request,
                         buffer_handler, out,
                         value k, value args)
@@ -154,6 +347,45 @@ define_closure_function(1, 2, boolean, each_request,
             goto out;
         }
         bprintf(b, "()\n");
+    } else if (k == sym(subscribe)) {
+        if (!is_tuple(args)) {
+            resultstr = ss("missing arguments tuple");
+            goto out;
+        }
+        string path = get_string(args, sym(path));
+        if (!path) {
+            resultstr = ss("could not parse path attribute");
+            goto out;
+        }
+        u64 period;
+        if (!get_u64(args, sym(period), &period) || (period == 0)) {
+            resultstr = ss("could not parse period");
+            goto out;
+        }
+        u64 depth = infinity;
+        if (get(args, sym(depth)) && !get_u64(args, sym(depth), &depth)) {
+            resultstr = ss("could not parse depth");
+            goto out;
+        }
+        mgmt_subscription s = mgmt_subscribe(path, depth, seconds(period), bound(out));
+        if (s == INVALID_ADDRESS) {
+            resultstr = ss("failed to allocate subscription");
+            goto out;
+        }
+        bprintf(b, "(subscription:%ld)\n", s->id);
+    } else if (k == sym(unsubscribe)) {
+        u64 id;
+        if (!is_tuple(args) || !get_u64(args, sym(id), &id)) {
+            resultstr = ss("could not parse id");
+            goto out;
+        }
+        mgmt_subscription s = mgmt_find_subscription(id);
+        if (s == INVALID_ADDRESS) {
+            resultstr = ss("subscription not found");
+            goto out;
+        }
+        mgmt_unsubscribe(s);
+        bprintf(b, "()\n");
 #endif
     } else {
         resultstr = ss("unknown command");
@@ -192,6 +424,8 @@ void management_reset(void)
         destruct_value(management.timer_req, true);
         management.timer_req = 0;
     }
+    list_foreach(&management.subscriptions, l)
+        mgmt_unsubscribe(struct_from_list(l, mgmt_subscription, l));
 #endif
 }
 
@@ -519,4 +753,8 @@ void init_management(heap function_tuple_heap, heap general)
     management.h = general;
     management.fth = function_tuple_heap;
     management.root = 0;
+#ifdef KERNEL
+    list_init(&management.subscriptions);
+    management.next_subscription_id = 0;
+#endif
 }
@@ -1,5 +1,26 @@
 #include <runtime.h>
 
+/* Architecture-specific fast paths, declared in machine.h: arch_memcpy_fast()
+   and arch_memset_fast() handle a whole (forward, non-overlapping) request,
+   arch_memcpy_words() and arch_memset_words() handle a run of co-aligned
+   words and return how many words they processed. */
+#ifndef ARCH_MEMCPY_FAST
+#define arch_memcpy_fast(dst, src, len) 0
+#endif
+#ifndef ARCH_MEMSET_FAST
+#define arch_memset_fast(dst, b, len)   0
+#endif
+#ifndef ARCH_MEMCPY_WORDS
+#define arch_memcpy_words(dst, src, n)  0
+#endif
+#ifndef ARCH_MEMSET_WORDS
+#define arch_memset_words(dst, w, n)    0
+#endif
+
+#ifdef KERNEL
+u64 memops_rep_min;
+#endif
+
 /* Copy by advancing memory addresses in forward direction. */
 static inline void memcpyf_8(void *dst, const void *src, bytes len)
 {
@@ -44,8 +65,13 @@ void runtime_memcpy(void *a, const void *b, bytes len)
     unsigned long *p_long_dest;
     unsigned long long_word1;
     unsigned long long_word2;
+    boolean disjoint = ((unsigned long)a + len <= (unsigned long)b) ||
+                       ((unsigned long)b + len <= (unsigned long)a);
 
-    if ((unsigned long)a < (unsigned long)b) {
+    /* copy forward unless the destination overlaps the end of the source */
+    if (disjoint || ((unsigned long)a < (unsigned long)b)) {
+        if (disjoint && arch_memcpy_fast(a, b, len))
+            return;
         if (len < sizeof(long)) {
             memcpyf_8(a, b, len);
             return;
@@ -69,6 +95,12 @@ void runtime_memcpy(void *a, const void *b, bytes len)
         }
         p_long_dest = (unsigned long *)((u8 *)a + dest_cnt);
         if (src_cnt == dest_cnt) {
+            if (disjoint) {
+                bytes n = arch_memcpy_words((u64 *)p_long_dest, (u64 *)p_long_src, long_len);
+                p_long_dest += n;
+                p_long_src += n;
+                long_len -= n;
+            }
             while (long_len-- > 0) {
                 *p_long_dest++ = *p_long_src++;
             }
@@ -126,6 +158,8 @@ void runtime_memcpy(void *a, const void *b, bytes len)
 
 void runtime_memset(u8 *a, u8 b, bytes len)
 {
+    if (arch_memset_fast(a, b, len))
+        return;
     if (len < sizeof(long)) {
         memset_8(a, b, len);
         return;
@@ -145,6 +179,9 @@ void runtime_memset(u8 *a, u8 b, bytes len)
     }
     bytes long_len = len / sizeof(long);
     bytes end_len = len & (sizeof(long) - 1);
+    bytes n = arch_memset_words((u64 *)dest, word, long_len);
+    dest += n;
+    long_len -= n;
     while (long_len-- > 0) {
         *dest++ = word;
     }
@@ -184,7 +221,8 @@ int runtime_memcmp(const void *a, const void *b, bytes len)
         while (long_len-- > 0) {
             res = *p_long_a++ - *p_long_b++;
             if (res) {
-                return 1;
+                /* locate the first differing byte to return an ordered result */
+                return memcmp_8(p_long_a - 1, p_long_b - 1, sizeof(long));
             }
         }
     }
@@ -194,10 +232,11 @@ int runtime_memcmp(const void *a, const void *b, bytes len)
         long_word1 = *p_long_a++;
         while (long_len-- > 0) {
             long_word2 = *p_long_a++;
-            res = ((long_word1 >> (8 * (sizeof(long) - alignment))) |
-                    (long_word2 << (8 * alignment))) - *p_long_b++;
+            unsigned long merged = (long_word1 >> (8 * (sizeof(long) - alignment))) |
+                    (long_word2 << (8 * alignment));
+            res = merged - *p_long_b++;
             if (res) {
-                return 1;
+                return memcmp_8(&merged, p_long_b - 1, sizeof(long));
             }
             long_word1 = long_word2;
         }
@@ -2,98 +2,95 @@
 
 //#define PQUEUE_PARANOIA
 
-typedef u32 index; //indices are off by 1 from vector references
+/* Implicit d-ary heap, with d = 1 << order. A wider heap is shallower, so that insertions (and
+ * removals healing up) do fewer comparisons and moves, and the children visited when healing down
+ * are adjacent in memory; binary heaps remain the default. */
+
+typedef u32 index;
 
 struct pqueue {
     heap h;
     vector body;
     boolean (*sort)(void *, void *);
+    u8 order;
 };
 
-static inline void swap(pqueue q, index x, index y)
-{
-    void *temp = vector_get(q->body, x-1);
-    assert(vector_set(q->body, x-1, vector_get(q->body, y-1)));
-    assert(vector_set(q->body, y-1, temp));
-}
+#define pqueue_elems(q)             ((void **)buffer_ref((q)->body, 0))
+#define pqueue_parent(q, i)         (((i) - 1) >> (q)->order)
+#define pqueue_first_child(q, i)    (((i) << (q)->order) + 1)
 
-#define qcompare(__q, __x, __y)\
-    (q->sort(vector_get((__q)->body, ((__x)-1)),        \
-             vector_get((__q)->body, ((__y)-1))))
-
-static void heal_down(pqueue q, index where)
+/* Moves the element at where towards the leaves; returns its new position. */
+static index heal_down(pqueue q, index where)
 {
+    void **e = pqueue_elems(q);
     index last = vector_length(q->body);
-    index i;
-    while ((i = where << 1) <= last) {
-        if (i < last && qcompare(q, i, i+1))
-            i++;                /* right is larger */
-        if (!qcompare(q, where, i))
-            return;
-        swap(q, where, i);
-        where = i;
+    void *v = e[where];
+    index c;
+    while ((c = pqueue_first_child(q, where)) < last) {
+        index end = MIN(c + U64_FROM_BIT(q->order), last);
+        index best = c;
+        for (c++; c < end; c++)
+            if (q->sort(e[best], e[c]))
+                best = c;
+        if (!q->sort(v, e[best]))
+            break;
+        e[where] = e[best];
+        where = best;
     }
+    e[where] = v;
+    return where;
 }
 
-static void heal_up(pqueue q, index where)
+/* Moves the element at where towards the root; returns its new position. */
+static index heal_up(pqueue q, index where)
 {
-    while (where > 1 && qcompare(q, where >> 1, where)) {
-        swap(q, where >> 1, where);
-        where >>= 1;
+    void **e = pqueue_elems(q);
+    void *v = e[where];
+    while (where > 0) {
+        index parent = pqueue_parent(q, where);
+        if (!q->sort(e[parent], v))
+            break;
+        e[where] = e[parent];
+        where = parent;
     }
+    e[where] = v;
+    return where;
 }
 
 #ifdef PQUEUE_PARANOIA
-boolean pqueue_validate(pqueue q, index x)
+boolean pqueue_validate(pqueue q)
 {
-    index last = vector_length(q->body);
-    index i = x << 1;
-    if (i > last)
-        return true;
-    if ((i < last && qcompare(q, x, i + 1)) ||
-        qcompare(q, x, i))
-        return false;
-    return pqueue_validate(q, i) && (i == last || pqueue_validate(q, i + 1));
+    void **e = pqueue_elems(q);
+    for (index i = 1; i < vector_length(q->body); i++)
+        if (q->sort(e[pqueue_parent(q, i)], e[i]))
+            return false;
+    return true;
 }
 #endif
 
-static void add_pqueue(pqueue q, index i)
-{
-    index parent = i >> 1;
-
-    while ((parent > 0) && qcompare(q, parent, i)) {
-        swap(q, i, parent);
-        i = parent;
-        parent >>= 1;
-    }
-}
-
 void pqueue_insert(pqueue q, void *v)
 {
     vector_push(q->body, v);
-    add_pqueue(q, vector_length(q->body));
+    heal_up(q, vector_length(q->body) - 1);
 #ifdef PQUEUE_PARANOIA
-    assert(pqueue_validate(q, 1));
+    assert(pqueue_validate(q));
 #endif
 }
 
 boolean pqueue_remove(pqueue q, void *v)
 {
-    index i;
-    for (i = 0; i < vector_length(q->body); i++) {
-        void *e = vector_get(q->body, i);
-        if (e == v) {
+    void **e = pqueue_elems(q);
+    index len = vector_length(q->body);
+    for (index i = 0; i < len; i++) {
+        if (e[i] == v) {
             void *n = vector_pop(q->body);
             if (n != v) {
-                index idx = i + 1;
-                assert(vector_set(q->body, i, n));
-                if (idx > 1 && qcompare(q, idx >> 1, idx))
-                    heal_up(q, i + 1);
-                else
-                    heal_down(q, i + 1);
+                e[i] = n;
+                if (heal_up(q, i) == i)
+                    heal_down(q, i);
             }
 #ifdef PQUEUE_PARANOIA
-            assert(pqueue_validate(q, 1));
+            assert(pqueue_validate(q));
 #endif
             return true;
         }
@@ -108,13 +105,13 @@ void *pqueue_pop(pqueue q)
     if (vector_length(q->body) > 0) {
         result = vector_get(q->body, 0);
         void *n = vector_pop(q->body);
-        if (vector_peek(q->body)){
-            assert(vector_set(q->body, 0, n));
-            heal_down(q, 1);
+        if (vector_length(q->body) > 0) {
+            pqueue_elems(q)[0] = n;
+            heal_down(q, 0);
         }
     }
 #ifdef PQUEUE_PARANOIA
-    assert(pqueue_validate(q, 1));
+    assert(pqueue_validate(q));
 #endif
     return result;
 }
@@ -133,10 +130,13 @@ u64 pqueue_length(pqueue q)
 void pqueue_reorder(pqueue q)
 {
     /* Floyd's heap construction algorithm */
-    for (index i = vector_length(q->body) / 2; i > 0; i--)
-        heal_down(q, i);
+    index len = vector_length(q->body);
+    if (len < 2)
+        return;
+    for (index i = pqueue_parent(q, len - 1) + 1; i > 0; i--)
+        heal_down(q, i - 1);
 #ifdef PQUEUE_PARANOIA
-    assert(pqueue_validate(q, 1));
+    assert(pqueue_validate(q));
 #endif
 }
 
@@ -149,16 +149,23 @@ boolean pqueue_walk(pqueue q, pqueue_element_handler h)
     return true;
 }
 
-pqueue allocate_pqueue(heap h, boolean(*sort)(void *, void *))
+pqueue allocate_pqueue_dary(heap h, boolean(*sort)(void *, void *), u8 order)
 {
+    assert(order >= 1 && order <= PQUEUE_ORDER_MAX);
     pqueue p = allocate(h, sizeof(struct pqueue));
     assert(p != INVALID_ADDRESS);
     p->h = h;
     p->body = allocate_vector(h, 10);
     p->sort = sort;
+    p->order = order;
     return(p);
 }
 
+pqueue allocate_pqueue(heap h, boolean(*sort)(void *, void *))
+{
+    return allocate_pqueue_dary(h, sort, 1);
+}
+
 void deallocate_pqueue(pqueue p)
 {
     assert(p);
@@ -1,5 +1,10 @@
 typedef struct pqueue *pqueue;
 pqueue allocate_pqueue(heap h, boolean(*)(void *, void *));
+
+/* heap with 1 << order children per node (allocate_pqueue() gives a binary heap) */
+#define PQUEUE_ORDER_MAX    4
+pqueue allocate_pqueue_dary(heap h, boolean(*)(void *, void *), u8 order);
+
 void deallocate_pqueue(pqueue q);
 void pqueue_insert(pqueue q, void *v);
 boolean pqueue_remove(pqueue q, void *v);
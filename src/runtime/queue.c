@@ -23,3 +23,60 @@ void deallocate_queue(queue q)
     if (q->h)
         deallocate(q->h, q, _queue_alloc_size(q->order));
 }
+
+#define _mpmc_cells_offset      pad(sizeof(struct mpmc_queue), DEFAULT_CACHELINE_SIZE)
+#define _mpmc_alloc_size(o)     (_mpmc_cells_offset + (1ull << (o)) * sizeof(struct mpmc_cell))
+
+/* will round up size to next power-of-2 */
+mpmc_queue allocate_mpmc_queue(heap h, u64 size)
+{
+    if (size == 0)
+        return INVALID_ADDRESS;
+    int order = find_order(size);
+    mpmc_queue q = allocate(h, _mpmc_alloc_size(order));
+    if (q == INVALID_ADDRESS)
+        return q;
+    q->cells = ((void *)q) + _mpmc_cells_offset;
+    q->mask = MASK(order);
+    for (u64 i = 0; i <= q->mask; i++) {
+        q->cells[i].seq = i;
+        q->cells[i].data = 0;
+    }
+    q->enqueue_pos = 0;
+    q->dequeue_pos = 0;
+    q->h = h;
+    write_barrier();
+    return q;
+}
+
+void deallocate_mpmc_queue(mpmc_queue q)
+{
+    deallocate(q->h, q, _mpmc_alloc_size(find_order(q->mask + 1)));
+}
+
+#define _spsc_buf_offset        pad(sizeof(struct spsc_queue), DEFAULT_CACHELINE_SIZE)
+#define _spsc_alloc_size(o)     (_spsc_buf_offset + queue_data_size(o))
+
+/* will round up size to next power-of-2 */
+spsc_queue allocate_spsc_queue(heap h, u64 size)
+{
+    if (size == 0)
+        return INVALID_ADDRESS;
+    int order = find_order(size);
+    spsc_queue q = allocate(h, _spsc_alloc_size(order));
+    if (q == INVALID_ADDRESS)
+        return q;
+    q->d = ((void *)q) + _spsc_buf_offset;
+    zero(q->d, queue_data_size(order));
+    q->head = q->cached_head = 0;
+    q->tail = q->cached_tail = 0;
+    q->order = order;
+    q->h = h;
+    write_barrier();
+    return q;
+}
+
+void deallocate_spsc_queue(spsc_queue q)
+{
+    deallocate(q->h, q, _spsc_alloc_size(q->order));
+}
@@ -137,6 +137,37 @@ static inline void *dequeue_single(queue q)
     return p;
 }
 
+/* Dequeue up to n single-word entries into p, returning the number of entries
+   dequeued. This amortizes the atomic update of the consumer head across a
+   batch; it should only be used where the caller will process every entry
+   dequeued (i.e. not by handlers which might not return). */
+static inline u32 dequeue_batch(queue q, void **p, u32 n)
+{
+    u32 count, next, size = _queue_size(q);
+    union combined cc;
+
+  retry:
+    cc.w = q->cc.w;               /* cons_head, prod_tail */
+    count = cc.tail - cc.head;
+    if (count == 0)
+        return 0;
+    _queue_assert(count <= size);
+    if (count > n)
+        count = n;
+    next = cc.head + count;
+    if (!compare_and_swap_32((u32*)&q->cons_head, cc.head, next))
+        goto retry;
+
+    for (u32 i = 0; i < count; i++)
+        p[i] = q->d[_queue_idx(q, cc.head + i)];
+    read_barrier();
+
+    while (q->cons_tail != cc.head)
+        _queue_pause();
+    q->cons_tail = next;
+    return count;
+}
+
 /* These are variants which take a unit size expressed in a power-of-2 number
    of words. Only use one size for a given queue. */
 static inline boolean enqueue_n(queue q, void *p, int n)
@@ -209,3 +240,166 @@ static inline void queue_init(queue q, int order, void ** buf)
 queue allocate_queue(heap h, u64 size);
 
 void deallocate_queue(queue q);
+
+/* Bounded multi-producer, multi-consumer queue with a sequence number per
+   cell (after D. Vyukov). Unlike the queue above, a producer or consumer never
+   waits on another one to commit its operation, so a preempted or interrupted
+   party does not stall others. The producer and consumer positions are kept
+   on separate cache lines. */
+struct mpmc_cell {
+    volatile u64 seq;
+    void *data;
+};
+
+typedef struct mpmc_queue {
+    volatile u64 enqueue_pos;
+    u8 pad0[DEFAULT_CACHELINE_SIZE - sizeof(u64)];
+    volatile u64 dequeue_pos;
+    u8 pad1[DEFAULT_CACHELINE_SIZE - sizeof(u64)];
+    struct mpmc_cell *cells;
+    u64 mask;
+    heap h;
+} *mpmc_queue;
+
+static inline boolean mpmc_enqueue(mpmc_queue q, void *p)
+{
+    if (p == INVALID_ADDRESS)
+        return false;
+    u64 pos = q->enqueue_pos;
+    struct mpmc_cell *c;
+    while (1) {
+        c = &q->cells[pos & q->mask];
+        u64 seq = c->seq;
+        read_barrier();
+        s64 dif = (s64)(seq - pos);
+        if (dif == 0) {
+            if (compare_and_swap_64((u64 *)&q->enqueue_pos, pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return false;       /* full */
+        } else {
+            _queue_pause();
+        }
+        pos = q->enqueue_pos;
+    }
+    c->data = p;
+    write_barrier();
+    c->seq = pos + 1;
+    return true;
+}
+
+static inline void *mpmc_dequeue(mpmc_queue q)
+{
+    u64 pos = q->dequeue_pos;
+    struct mpmc_cell *c;
+    while (1) {
+        c = &q->cells[pos & q->mask];
+        u64 seq = c->seq;
+        read_barrier();
+        s64 dif = (s64)(seq - (pos + 1));
+        if (dif == 0) {
+            if (compare_and_swap_64((u64 *)&q->dequeue_pos, pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return INVALID_ADDRESS;     /* empty */
+        } else {
+            _queue_pause();
+        }
+        pos = q->dequeue_pos;
+    }
+    void *p = c->data;
+    memory_barrier();
+    c->seq = pos + q->mask + 1;
+    return p;
+}
+
+/* approximate when there are concurrent operations */
+static inline u64 mpmc_queue_length(mpmc_queue q)
+{
+    s64 len = (s64)(q->enqueue_pos - q->dequeue_pos);
+    return len > 0 ? len : 0;
+}
+
+static inline boolean mpmc_queue_empty(mpmc_queue q)
+{
+    return mpmc_queue_length(q) == 0;
+}
+
+mpmc_queue allocate_mpmc_queue(heap h, u64 size);
+void deallocate_mpmc_queue(mpmc_queue q);
+
+/* Bounded single-producer, single-consumer queue. Each side keeps a cached
+   copy of the other side's index on its own cache line, so that the shared
+   index is only read when the cached one indicates a full or empty queue.
+   The batch variants publish a whole batch with a single index update. */
+typedef struct spsc_queue {
+    volatile u32 head;          /* written by producer */
+    u32 cached_tail;
+    u8 pad0[DEFAULT_CACHELINE_SIZE - 2 * sizeof(u32)];
+    volatile u32 tail;          /* written by consumer */
+    u32 cached_head;
+    u8 pad1[DEFAULT_CACHELINE_SIZE - 2 * sizeof(u32)];
+    void **d;
+    heap h;
+    int order;
+} *spsc_queue;
+
+/* Enqueue up to n entries from p, returning the number enqueued. */
+static inline u32 spsc_enqueue_batch(spsc_queue q, void **p, u32 n)
+{
+    u32 size = _queue_size(q);
+    u32 head = q->head;
+    u32 space = size - (head - q->cached_tail);
+    if (space < n) {
+        q->cached_tail = q->tail;
+        read_barrier();
+        space = size - (head - q->cached_tail);
+        if (space < n)
+            n = space;
+    }
+    for (u32 i = 0; i < n; i++)
+        q->d[_queue_idx(q, head + i)] = p[i];
+    write_barrier();
+    q->head = head + n;
+    return n;
+}
+
+/* Dequeue up to n entries into p, returning the number dequeued. */
+static inline u32 spsc_dequeue_batch(spsc_queue q, void **p, u32 n)
+{
+    u32 tail = q->tail;
+    u32 avail = q->cached_head - tail;
+    if (avail < n) {
+        q->cached_head = q->head;
+        read_barrier();
+        avail = q->cached_head - tail;
+        if (avail < n)
+            n = avail;
+    }
+    for (u32 i = 0; i < n; i++)
+        p[i] = q->d[_queue_idx(q, tail + i)];
+    memory_barrier();
+    q->tail = tail + n;
+    return n;
+}
+
+static inline boolean spsc_enqueue(spsc_queue q, void *p)
+{
+    if (p == INVALID_ADDRESS)
+        return false;
+    return spsc_enqueue_batch(q, &p, 1) == 1;
+}
+
+static inline void *spsc_dequeue(spsc_queue q)
+{
+    void *p;
+    return spsc_dequeue_batch(q, &p, 1) ? p : INVALID_ADDRESS;
+}
+
+static inline u64 spsc_queue_length(spsc_queue q)
+{
+    return q->head - q->tail;
+}
+
+spsc_queue allocate_spsc_queue(heap h, u64 size);
+void deallocate_spsc_queue(spsc_queue q);
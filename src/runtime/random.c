@@ -27,12 +27,12 @@
 
 #ifdef KERNEL
 #include <kernel.h>
-#define chacha20_lock() do { mutex_lock(chacha20inst.m); } while (0)
-#define chacha20_unlock() do { mutex_unlock(chacha20inst.m); } while (0)
+#define seed_lock() u64 _irqflags = spin_lock_irq(&seed_spinlock)
+#define seed_unlock() spin_unlock_irq(&seed_spinlock, _irqflags)
 #else
 #include <runtime.h>
-#define chacha20_lock()
-#define chacha20_unlock()
+#define seed_lock()
+#define seed_unlock()
 #endif
 #include <crypto/chacha.h>
 
@@ -45,17 +45,37 @@
 #define CHACHA20_RESEED_BYTES   65536
 #define CHACHA20_RESEED_SECONDS 300
 #define CHACHA20_KEYBYTES       32
-#define CHACHA20_BUFFER_SIZE    64
+#define CHACHA20_POOL_BLOCKS    8
+#define CHACHA20_POOL_SIZE      (CHACHA20_POOL_BLOCKS * CHACHA_BLOCKLEN)
 
-static struct chacha20_s {
-#ifdef KERNEL
-    mutex m;
-#endif
-    int numbytes;
+/* In the kernel, output is staged through a stack buffer of this size, so that the caller's
+ * buffer (which may be user memory and fault) is never written with a pool in use. */
+#define CHACHA20_COPY_SIZE      256
+
+/* Keystream pool, refilled CHACHA20_POOL_BLOCKS blocks at a time. With fast key erasure, the
+ * first CHACHA20_KEYBYTES of each refill become the key for the next refill and are never
+ * output, and output bytes are cleared as they are consumed, so that the pool contents do not
+ * reveal past output. In the kernel there is one pool per CPU, accessed with interrupts
+ * disabled. */
+typedef struct chacha20_pool {
     u64 t_reseed;
-    u8 m_buffer[CHACHA20_BUFFER_SIZE];
+    u64 reseed_gen;
+    u32 numbytes;
+    u32 pos;
     struct chacha_ctx ctx;
-} chacha20inst;
+    u8 buf[CHACHA20_POOL_SIZE];
+} *chacha20_pool;
+
+/* used before per-CPU pools are set up, and outside the kernel */
+static struct chacha20_pool chacha20_boot_pool;
+
+/* incremented by random_reseed() to have all pools reseeded on their next use */
+static u64 random_gen;
+
+#ifdef KERNEL
+static struct spinlock seed_spinlock;
+static chacha20_pool *chacha20_pools;
+#endif
 
 /* entropy source mux - for any rng, not just chacha */
 bytes (*preferred_get_seed)(void *seed, bytes len);
@@ -78,6 +98,7 @@ static bytes fallback_get_seed(void *seed, bytes len)
 /* draw from preferred entropy source or resort to fallback */
 void get_seed_complete(void *seed, bytes len)
 {
+    seed_lock();
     while (len > 0) {
         bytes s = preferred_get_seed ? preferred_get_seed(seed, len) : 0;
         if (s == 0)
@@ -86,13 +107,14 @@ void get_seed_complete(void *seed, bytes len)
         assert(len >= s);
         len -= s;
     }
+    seed_unlock();
 }
 
 /*
  * Mix up the current context.
  */
 static void
-chacha20_randomstir_locked(struct chacha20_s *chacha20, timestamp t)
+chacha20_randomstir(chacha20_pool pool, timestamp t)
 {
     u8 key[CHACHA20_KEYBYTES];
     get_seed_complete(key, CHACHA20_KEYBYTES);
@@ -100,60 +122,113 @@ chacha20_randomstir_locked(struct chacha20_s *chacha20, timestamp t)
     u64 now_sec = sec_from_timestamp(t);
     u64 now_usec = usec_from_timestamp(truncate_seconds(t));
 
-    chacha_keysetup(&chacha20->ctx, key, CHACHA20_KEYBYTES*8);
-    chacha_ivsetup(&chacha20->ctx, (u8 *) &now_sec, (u8 *) &now_usec);
-    /* Reset for next reseed cycle. */
-    chacha20->t_reseed = now_sec + CHACHA20_RESEED_SECONDS;
-    chacha20->numbytes = 0;
+    chacha_keysetup(&pool->ctx, key, CHACHA20_KEYBYTES*8);
+    chacha_ivsetup(&pool->ctx, (u8 *) &now_sec, (u8 *) &now_usec);
+    zero(key, sizeof(key));
+    /* Discard keystream generated with the old key and reset for next reseed cycle. */
+    zero(pool->buf, sizeof(pool->buf));
+    pool->pos = CHACHA20_POOL_SIZE;
+    pool->t_reseed = now_sec + CHACHA20_RESEED_SECONDS;
+    pool->reseed_gen = random_gen;
+    pool->numbytes = 0;
 }
 
-void init_random(heap h)
+static void chacha20_refill(chacha20_pool pool)
 {
-#ifdef KERNEL
-    chacha20inst.m = allocate_mutex(h, 2048);
-    assert(chacha20inst.m != INVALID_ADDRESS);
-#endif
-    assert(CHACHA20_KEYBYTES*8 >= CHACHA_MINKEYLEN);
-    chacha20_lock();
-    chacha20_randomstir_locked(&chacha20inst, now(CLOCK_ID_MONOTONIC_RAW));
-    chacha20_unlock();
+    chacha_keystream_blocks(&pool->ctx, pool->buf, CHACHA20_POOL_BLOCKS);
+    chacha_keysetup(&pool->ctx, pool->buf, CHACHA20_KEYBYTES*8);
+    zero(pool->buf, CHACHA20_KEYBYTES);
+    pool->pos = CHACHA20_KEYBYTES;
 }
 
-void arc4rand(void *ptr, bytes len)
+static void chacha20_read(chacha20_pool pool, u8 *p, bytes len)
 {
-    struct chacha20_s *chacha20 = &chacha20inst;
-    bytes length;
-    u8 *p;
-
-    chacha20_lock();
     timestamp t = now(CLOCK_ID_MONOTONIC_RAW);
-    u64 now_sec = sec_from_timestamp(t);
-    if ((chacha20->numbytes > CHACHA20_RESEED_BYTES) || (now_sec > chacha20->t_reseed))
-        chacha20_randomstir_locked(chacha20, t);
-
-    p = ptr;
+    if ((pool->reseed_gen != random_gen) || (pool->numbytes > CHACHA20_RESEED_BYTES) ||
+        (sec_from_timestamp(t) > pool->t_reseed))
+        chacha20_randomstir(pool, t);
     while (len) {
-        length = MIN(CHACHA20_BUFFER_SIZE, len);
-        chacha_encrypt_bytes(&chacha20->ctx, chacha20->m_buffer, p, length);
+        if (pool->pos == CHACHA20_POOL_SIZE) {
+            if (pool->numbytes > CHACHA20_RESEED_BYTES)
+                chacha20_randomstir(pool, t);
+            chacha20_refill(pool);
+        }
+        bytes length = MIN(CHACHA20_POOL_SIZE - pool->pos, len);
+        runtime_memcpy(p, pool->buf + pool->pos, length);
+        zero(pool->buf + pool->pos, length);
+        pool->pos += length;
+        pool->numbytes += length;
         p += length;
         len -= length;
-        chacha20->numbytes += length;
-        if (chacha20->numbytes > CHACHA20_RESEED_BYTES) {
-            chacha20_randomstir_locked(chacha20, t);
+    }
+}
+
+void init_random(heap h)
+{
+    assert(CHACHA20_KEYBYTES*8 >= CHACHA_MINKEYLEN);
+#ifdef KERNEL
+    spin_lock_init(&seed_spinlock);
+#endif
+    random_gen = 1;
+    chacha20_randomstir(&chacha20_boot_pool, now(CLOCK_ID_MONOTONIC_RAW));
+#ifdef KERNEL
+    __vdso_dat->rng_gen = random_gen;
+#endif
+}
+
+#ifdef KERNEL
+boolean random_percpu_init(heap h, int cpu_count)
+{
+    chacha20_pool *pools = allocate(h, cpu_count * sizeof(pools[0]));
+    if (pools == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        chacha20_pool pool = allocate_zero(h, sizeof(struct chacha20_pool));
+        if (pool == INVALID_ADDRESS) {
+            while (--cpu >= 0)
+                deallocate(h, pools[cpu], sizeof(struct chacha20_pool));
+            deallocate(h, pools, cpu_count * sizeof(pools[0]));
+            return false;
         }
+        pools[cpu] = pool;
     }
-    chacha20_unlock();
+    write_barrier();
+    chacha20_pools = pools;
+    return true;
 }
 
+void arc4rand(void *ptr, bytes len)
+{
+    u8 tmp[CHACHA20_COPY_SIZE];
+    while (len > 0) {
+        bytes length = MIN(sizeof(tmp), len);
+        u64 flags = irq_disable_save();
+        chacha20_read(chacha20_pools ? chacha20_pools[current_cpu()->id] : &chacha20_boot_pool,
+                      tmp, length);
+        irq_restore(flags);
+        runtime_memcpy(ptr, tmp, length);
+        ptr += length;
+        len -= length;
+    }
+    zero(tmp, sizeof(tmp));
+}
+#else
+void arc4rand(void *ptr, bytes len)
+{
+    chacha20_read(&chacha20_boot_pool, ptr, len);
+}
+#endif
+
 /* Can generate random numbers before init_random() is called. */
 u64 random_early_u64(void)
 {
     u8 key[CHACHA20_KEYBYTES];
+    struct chacha_ctx ctx;
     get_seed_complete(key, CHACHA20_KEYBYTES);
     u64 retval;
-    chacha_keysetup(&chacha20inst.ctx, key, CHACHA20_KEYBYTES * 8);
-    chacha_ivsetup(&chacha20inst.ctx, (u8 *)&retval, (u8 *)&retval);
-    chacha_encrypt_bytes(&chacha20inst.ctx, chacha20inst.m_buffer, (u8 *)&retval, sizeof(retval));
+    chacha_keysetup(&ctx, key, CHACHA20_KEYBYTES * 8);
+    chacha_ivsetup(&ctx, (u8 *)&retval, (u8 *)&retval);
+    chacha_encrypt_bytes(&ctx, chacha20_boot_pool.buf, (u8 *)&retval, sizeof(retval));
     return retval;
 }
 
@@ -170,16 +245,12 @@ u64 random_buffer(buffer b)
     return buffer_length(b);
 }
 
-/* Do any cleanup necessary after a random_buffer() call has been interrupted by an exception when
- * writing to the supplied buffer. */
-void random_buffer_aborted(void)
-{
-    chacha20_unlock();
-}
-
 void random_reseed(void)
 {
-    chacha20_lock();
-    chacha20_randomstir_locked(&chacha20inst, now(CLOCK_ID_MONOTONIC_RAW));
-    chacha20_unlock();
+    u64 gen = fetch_and_add(&random_gen, 1) + 1;
+#ifdef KERNEL
+    __vdso_dat->rng_gen = gen;
+#else
+    (void)gen;
+#endif
 }
@@ -17,6 +17,477 @@ void range_difference(range a, range b, range *d1, range *d2)
     }
 }
 
+#define RANGEMAP_UNLOCKED_MAX_DEPTH 128
+
+/* B+tree index */
+
+#define rmbtree_next_leaf(n)    ((n)->slots[RANGEMAP_BTREE_KEYS])
+
+static rmbtree_node rmbtree_alloc_node(rangemap rm, boolean leaf)
+{
+    rmbtree_node n = allocate(rm->bt.h, sizeof(*n));
+    if (n != INVALID_ADDRESS) {
+        zero(n, sizeof(*n));
+        n->leaf = leaf;
+    }
+    return n;
+}
+
+static void rmbtree_free_node(rangemap rm, rmbtree_node n)
+{
+    deallocate(rm->bt.h, n, sizeof(*n));
+}
+
+/* Entries are moved one word at a time, so that lockless readers never see torn pointers. */
+static inline void rmbtree_move(void *dst, void *src, u32 n)
+{
+    u64 *d = dst, *s = src;
+    if (d < s) {
+        for (u32 i = 0; i < n; i++)
+            d[i] = s[i];
+    } else {
+        for (u32 i = n; i > 0; i--)
+            d[i - 1] = s[i - 1];
+    }
+}
+
+/* returns the number of keys in the node that are less than or equal to key */
+static inline u32 rmbtree_index(rmbtree_node n, u64 key)
+{
+    u32 i = 0;
+    while ((i < n->count) && (n->keys[i] <= key))
+        i++;
+    return i;
+}
+
+static rmbtree_node rmbtree_find_leaf(rangemap rm, u64 key, u32 *index)
+{
+    rmbtree_node n = rm->bt.root;
+    if (!n)
+        return 0;
+    while (true) {
+        u32 i = rmbtree_index(n, key);
+        if (n->leaf) {
+            *index = i;
+            return n;
+        }
+        n = n->slots[i];
+    }
+}
+
+/* returns the node at the cursor position, moving the cursor to the next leaf if needed */
+static rmnode rmbtree_cursor_node(rmbtree_node *leaf, u32 *index)
+{
+    rmbtree_node l = *leaf;
+    if (*index >= l->count) {
+        l = rmbtree_next_leaf(l);
+        if (!l)
+            return INVALID_ADDRESS;
+        *leaf = l;
+        *index = 0;
+    }
+    return l->slots[*index];
+}
+
+static u64 rmbtree_min_key(rmbtree_node n)
+{
+    while (!n->leaf)
+        n = n->slots[0];
+    return n->keys[0];
+}
+
+/* Recomputes the gap tracking fields of a node from its entries. */
+static void rmbtree_update(rmbtree_node n)
+{
+    u64 max_gap = 0;
+    if (n->leaf) {
+        for (u32 i = 1; i < n->count; i++)
+            max_gap = MAX(max_gap, n->keys[i] - ((rmnode)n->slots[i - 1])->r.end);
+        n->last_end = n->count ? ((rmnode)n->slots[n->count - 1])->r.end : 0;
+    } else {
+        for (u32 i = 0; i <= n->count; i++) {
+            rmbtree_node c = n->slots[i];
+            max_gap = MAX(max_gap, c->max_gap);
+            if (i > 0)
+                max_gap = MAX(max_gap,
+                              n->keys[i - 1] - ((rmbtree_node)n->slots[i - 1])->last_end);
+        }
+        n->last_end = ((rmbtree_node)n->slots[n->count])->last_end;
+    }
+    n->max_gap = max_gap;
+}
+
+/* Recomputes the gap tracking fields of the nodes on the path from n to the leaf holding key. */
+static void rmbtree_update_path(rmbtree_node n, u64 key)
+{
+    if (!n->leaf)
+        rmbtree_update_path(n->slots[rmbtree_index(n, key)], key);
+    rmbtree_update(n);
+}
+
+rmnode rmbtree_lookup_max_lte(rangemap rm, u64 key)
+{
+    u32 i;
+    rmbtree_node leaf = rmbtree_find_leaf(rm, key, &i);
+    if (!leaf || !i)
+        return INVALID_ADDRESS;
+    return leaf->slots[i - 1];
+}
+
+/* returns the node with the lowest start greater than key */
+rmnode rmbtree_lookup_next(rangemap rm, u64 key)
+{
+    u32 i;
+    rmbtree_node leaf = rmbtree_find_leaf(rm, key, &i);
+    if (!leaf)
+        return INVALID_ADDRESS;
+    return rmbtree_cursor_node(&leaf, &i);
+}
+
+rmnode rmbtree_first(rangemap rm)
+{
+    rmbtree_node n = rm->bt.root;
+    if (!n)
+        return INVALID_ADDRESS;
+    while (!n->leaf)
+        n = n->slots[0];
+    return n->count ? n->slots[0] : INVALID_ADDRESS;
+}
+
+/* Splits the full child at index i of a non-full node. */
+static boolean rmbtree_split_child(rangemap rm, rmbtree_node p, u32 i)
+{
+    rmbtree_node c = p->slots[i];
+    rmbtree_node r = rmbtree_alloc_node(rm, c->leaf);
+    if (r == INVALID_ADDRESS)
+        return false;
+    u64 sep;
+    if (c->leaf) {
+        u32 lcount = (RANGEMAP_BTREE_KEYS + 1) / 2;
+        r->count = RANGEMAP_BTREE_KEYS - lcount;
+        rmbtree_move(r->keys, c->keys + lcount, r->count);
+        rmbtree_move(r->slots, c->slots + lcount, r->count);
+        rmbtree_next_leaf(r) = rmbtree_next_leaf(c);
+        sep = r->keys[0];
+        write_barrier();
+        rmbtree_next_leaf(c) = r;
+        c->count = lcount;
+    } else {
+        u32 lcount = RANGEMAP_BTREE_KEYS / 2;
+        r->count = RANGEMAP_BTREE_KEYS - lcount - 1;
+        rmbtree_move(r->keys, c->keys + lcount + 1, r->count);
+        rmbtree_move(r->slots, c->slots + lcount + 1, r->count + 1);
+        sep = c->keys[lcount];
+        write_barrier();
+        c->count = lcount;
+    }
+    rmbtree_move(p->keys + i + 1, p->keys + i, p->count - i);
+    rmbtree_move(p->slots + i + 2, p->slots + i + 1, p->count - i);
+    p->keys[i] = sep;
+    p->slots[i + 1] = r;
+    p->count++;
+    rmbtree_update(c);
+    rmbtree_update(r);
+    rmbtree_update(p);
+    return true;
+}
+
+/* Full nodes are split on the way down, so that an allocation failure leaves a valid tree. */
+static boolean rmbtree_insert(rangemap rm, rmnode n)
+{
+    u64 key = n->r.start;
+    rmbtree_node p = rm->bt.root;
+    if (!p) {
+        p = rmbtree_alloc_node(rm, true);
+        if (p == INVALID_ADDRESS)
+            return false;
+        p->keys[0] = key;
+        p->slots[0] = n;
+        p->count = 1;
+        write_barrier();
+        rm->bt.root = p;
+        goto done;
+    }
+    if (p->count == RANGEMAP_BTREE_KEYS) {
+        rmbtree_node root = rmbtree_alloc_node(rm, false);
+        if (root == INVALID_ADDRESS)
+            return false;
+        root->slots[0] = p;
+        if (!rmbtree_split_child(rm, root, 0)) {
+            rmbtree_free_node(rm, root);
+            return false;
+        }
+        write_barrier();
+        rm->bt.root = p = root;
+    }
+    while (!p->leaf) {
+        u32 i = rmbtree_index(p, key);
+        rmbtree_node c = p->slots[i];
+        if (c->count == RANGEMAP_BTREE_KEYS) {
+            if (!rmbtree_split_child(rm, p, i))
+                return false;
+            if (key >= p->keys[i])
+                c = p->slots[i + 1];
+        }
+        p = c;
+    }
+    u32 i = rmbtree_index(p, key);
+    if ((i > 0) && (p->keys[i - 1] == key))
+        return false;
+    rmbtree_move(p->keys + i + 1, p->keys + i, p->count - i);
+    rmbtree_move(p->slots + i + 1, p->slots + i, p->count - i);
+    p->keys[i] = key;
+    p->slots[i] = n;
+    p->count++;
+  done:
+    rmbtree_update_path(rm->bt.root, key);
+    rm->bt.count++;
+    rm->bt.gen++;
+    return true;
+}
+
+/* Refills the child at index i of p, which has fewer than the minimum number of keys, by borrowing
+   an entry from a sibling or by merging with a sibling. */
+static void rmbtree_fix_child(rangemap rm, rmbtree_node p, u32 i)
+{
+    rmbtree_node c = p->slots[i];
+    if (i > 0) {
+        rmbtree_node l = p->slots[i - 1];
+        if (l->count > RANGEMAP_BTREE_MIN_KEYS) {
+            if (c->leaf) {
+                rmbtree_move(c->keys + 1, c->keys, c->count);
+                rmbtree_move(c->slots + 1, c->slots, c->count);
+                c->keys[0] = l->keys[l->count - 1];
+                c->slots[0] = l->slots[l->count - 1];
+                p->keys[i - 1] = c->keys[0];
+            } else {
+                rmbtree_move(c->keys + 1, c->keys, c->count);
+                rmbtree_move(c->slots + 1, c->slots, c->count + 1);
+                c->keys[0] = p->keys[i - 1];
+                c->slots[0] = l->slots[l->count];
+                p->keys[i - 1] = l->keys[l->count - 1];
+            }
+            c->count++;
+            l->count--;
+            rmbtree_update(l);
+            rmbtree_update(c);
+            return;
+        }
+        /* merge c into its left sibling */
+        if (c->leaf) {
+            rmbtree_move(l->keys + l->count, c->keys, c->count);
+            rmbtree_move(l->slots + l->count, c->slots, c->count);
+            l->count += c->count;
+            rmbtree_next_leaf(l) = rmbtree_next_leaf(c);
+        } else {
+            l->keys[l->count] = p->keys[i - 1];
+            rmbtree_move(l->keys + l->count + 1, c->keys, c->count);
+            rmbtree_move(l->slots + l->count + 1, c->slots, c->count + 1);
+            l->count += c->count + 1;
+        }
+        rmbtree_update(l);
+        rmbtree_move(p->keys + i - 1, p->keys + i, p->count - i);
+        rmbtree_move(p->slots + i, p->slots + i + 1, p->count - i);
+        p->count--;
+        rmbtree_free_node(rm, c);
+        return;
+    }
+    rmbtree_node r = p->slots[1];
+    if (r->count > RANGEMAP_BTREE_MIN_KEYS) {
+        if (c->leaf) {
+            c->keys[c->count] = r->keys[0];
+            c->slots[c->count] = r->slots[0];
+            rmbtree_move(r->keys, r->keys + 1, r->count - 1);
+            rmbtree_move(r->slots, r->slots + 1, r->count - 1);
+            p->keys[0] = r->keys[0];
+        } else {
+            c->keys[c->count] = p->keys[0];
+            c->slots[c->count + 1] = r->slots[0];
+            p->keys[0] = r->keys[0];
+            rmbtree_move(r->keys, r->keys + 1, r->count - 1);
+            rmbtree_move(r->slots, r->slots + 1, r->count);
+        }
+        c->count++;
+        r->count--;
+        rmbtree_update(c);
+        rmbtree_update(r);
+        return;
+    }
+    /* merge the right sibling into c */
+    if (c->leaf) {
+        rmbtree_move(c->keys + c->count, r->keys, r->count);
+        rmbtree_move(c->slots + c->count, r->slots, r->count);
+        c->count += r->count;
+        rmbtree_next_leaf(c) = rmbtree_next_leaf(r);
+    } else {
+        c->keys[c->count] = p->keys[0];
+        rmbtree_move(c->keys + c->count + 1, r->keys, r->count);
+        rmbtree_move(c->slots + c->count + 1, r->slots, r->count + 1);
+        c->count += r->count + 1;
+    }
+    rmbtree_update(c);
+    rmbtree_move(p->keys, p->keys + 1, p->count - 1);
+    rmbtree_move(p->slots + 1, p->slots + 2, p->count - 1);
+    p->count--;
+    rmbtree_free_node(rm, r);
+}
+
+/* sep points to the separator key (if any) that is equal to the lowest key of the subtree rooted
+   at n; returns true if n is left with fewer than the minimum number of keys. */
+static boolean rmbtree_remove_internal(rangemap rm, rmbtree_node n, rmnode rn, u64 *sep)
+{
+    u64 key = rn->r.start;
+    u32 i = rmbtree_index(n, key);
+    if (n->leaf) {
+        assert((i > 0) && (n->slots[i - 1] == rn));
+        i--;
+        rmbtree_move(n->keys + i, n->keys + i + 1, n->count - i - 1);
+        rmbtree_move(n->slots + i, n->slots + i + 1, n->count - i - 1);
+        n->count--;
+        if ((i == 0) && n->count && sep)
+            *sep = n->keys[0];
+    } else if (rmbtree_remove_internal(rm, n->slots[i], rn, i ? &n->keys[i - 1] : sep)) {
+        rmbtree_fix_child(rm, n, i);
+    }
+    rmbtree_update(n);
+    return n->count < RANGEMAP_BTREE_MIN_KEYS;
+}
+
+void rmbtree_remove(rangemap rm, rmnode n)
+{
+    rmbtree_node root = rm->bt.root;
+    assert(root);
+    rmbtree_remove_internal(rm, root, n, 0);
+    if (!root->count) {
+        rm->bt.root = root->leaf ? 0 : root->slots[0];
+        rmbtree_free_node(rm, root);
+    }
+    rm->bt.count--;
+    rm->bt.gen++;
+}
+
+/* Changes the start of a node without changing its position in the map. */
+static void rmbtree_set_start(rangemap rm, rmnode rn, u64 start)
+{
+    u64 key = rn->r.start;
+    u64 *sep = 0;
+    rmbtree_node n = rm->bt.root;
+    while (true) {
+        u32 i = rmbtree_index(n, key);
+        if (n->leaf) {
+            assert((i > 0) && (n->slots[i - 1] == rn));
+            n->keys[i - 1] = start;
+            if ((i == 1) && sep)
+                *sep = start;
+            break;
+        }
+        if (i > 0)
+            sep = &n->keys[i - 1];
+        n = n->slots[i];
+    }
+    rn->r.start = start;
+}
+
+static void rmbtree_destruct(rangemap rm, rmbtree_node n, rmnode_handler destructor)
+{
+    if (n->leaf) {
+        if (destructor) {
+            for (u32 i = 0; i < n->count; i++)
+                apply(destructor, n->slots[i]);
+        }
+    } else {
+        for (u32 i = 0; i <= n->count; i++)
+            rmbtree_destruct(rm, n->slots[i], destructor);
+    }
+    rmbtree_free_node(rm, n);
+}
+
+/* Builds the tree bottom-up from a sorted array of nodes, with entries spread evenly among the
+   nodes of each level. */
+static boolean rmbtree_build(rangemap rm, rmnode *nodes, u64 count)
+{
+    u64 width = (count + RANGEMAP_BTREE_KEYS - 1) / RANGEMAP_BTREE_KEYS;
+    u64 levelsize = width;
+    rmbtree_node *level = allocate(rm->h, levelsize * sizeof(rmbtree_node));
+    if (level == INVALID_ADDRESS)
+        return false;
+    u64 n = 0;
+    for (u64 l = 0; l < width; l++) {
+        rmbtree_node leaf = rmbtree_alloc_node(rm, true);
+        if (leaf == INVALID_ADDRESS) {
+            while (l > 0)
+                rmbtree_free_node(rm, level[--l]);
+            goto fail;
+        }
+        u32 c = (count - n) / (width - l);
+        for (u32 j = 0; j < c; j++) {
+            leaf->keys[j] = nodes[n + j]->r.start;
+            leaf->slots[j] = nodes[n + j];
+        }
+        leaf->count = c;
+        rmbtree_update(leaf);
+        n += c;
+        if (l > 0)
+            rmbtree_next_leaf(level[l - 1]) = leaf;
+        level[l] = leaf;
+    }
+    while (width > 1) {
+        u64 parents = (width + RANGEMAP_BTREE_KEYS) / (RANGEMAP_BTREE_KEYS + 1);
+        u64 c = 0;
+        for (u64 p = 0; p < parents; p++) {
+            rmbtree_node parent = rmbtree_alloc_node(rm, false);
+            if (parent == INVALID_ADDRESS) {
+                for (u64 j = 0; j < p; j++)
+                    rmbtree_destruct(rm, level[j], 0);
+                for (u64 j = c; j < width; j++)
+                    rmbtree_destruct(rm, level[j], 0);
+                goto fail;
+            }
+            u32 children = (width - c) / (parents - p);
+            for (u32 j = 0; j < children; j++) {
+                parent->slots[j] = level[c + j];
+                if (j > 0)
+                    parent->keys[j - 1] = rmbtree_min_key(level[c + j]);
+            }
+            parent->count = children - 1;
+            rmbtree_update(parent);
+            c += children;
+            level[p] = parent;
+        }
+        width = parents;
+    }
+    write_barrier();
+    rm->bt.root = level[0];
+    rm->bt.count = count;
+    rm->bt.gen++;
+    deallocate(rm->h, level, levelsize * sizeof(rmbtree_node));
+    return true;
+  fail:
+    deallocate(rm->h, level, levelsize * sizeof(rmbtree_node));
+    return false;
+}
+
+static rmnode rmbtree_lookup_unlocked(rangemap rm, u64 point)
+{
+    rmbtree_node n = *(rmbtree_node volatile *)&rm->bt.root;
+    for (int depth = 0; n && depth < RANGEMAP_UNLOCKED_MAX_DEPTH; depth++) {
+        u32 count = MIN(*(volatile u32 *)&n->count, RANGEMAP_BTREE_KEYS);
+        u32 i = 0;
+        while ((i < count) && (*(volatile u64 *)&n->keys[i] <= point))
+            i++;
+        if (n->leaf) {
+            if (i > 0) {
+                rmnode rn = *(rmnode volatile *)&n->slots[i - 1];
+                if (rn && point_in_range(rn->r, point))
+                    return rn;
+            }
+            break;
+        }
+        n = *(rmbtree_node volatile *)&n->slots[i];
+    }
+    return INVALID_ADDRESS;
+}
+
 boolean rangemap_insert(rangemap rm, rmnode n)
 {
     init_rbnode(&n->n);
@@ -30,6 +501,8 @@ boolean rangemap_insert(rangemap rm, rmnode n)
             return false;
         }
     }
+    if (rangemap_is_btree(rm))
+        return rmbtree_insert(rm, n);
     if (!rbtree_insert_node(&rm->t, &n->n)) {
         halt("scan found no intersection but rb insert failed, node %p (%R)\n",
              n, n->r);
@@ -56,20 +529,21 @@ boolean rangemap_reinsert(rangemap rm, rmnode n, range k)
  */
 boolean rangemap_insert_range(rangemap rm, range r)
 {
-    struct rmnode k = {
-        .r = r,
-    };
-    rmnode n = (rmnode)rbtree_lookup_max_lte(&rm->t, &k.n);
+    rmnode n = rangemap_lookup_max_lte(rm, r.start);
     if (n == INVALID_ADDRESS)
-        n = (rmnode)rbtree_find_first(&rm->t);
+        n = rangemap_first_node(rm);
     if ((n != INVALID_ADDRESS) && (n->r.end < r.start))
         n = rangemap_next_node(rm, n);
     rmnode merged = 0;
     while ((n != INVALID_ADDRESS) && (n->r.start <= r.end)) {
         rmnode next = rangemap_next_node(rm, n);
         if (!merged) {
-            if (n->r.start > r.start)
-                n->r.start = r.start;
+            if (n->r.start > r.start) {
+                if (rangemap_is_btree(rm))
+                    rmbtree_set_start(rm, n, r.start);
+                else
+                    n->r.start = r.start;
+            }
             if (n->r.end < r.end)
                 n->r.end = r.end;
             merged = n;
@@ -80,8 +554,11 @@ boolean rangemap_insert_range(rangemap rm, range r)
         }
         n = next;
     }
-    if (merged)
+    if (merged) {
+        if (rangemap_is_btree(rm))
+            rmbtree_update_path(rm->bt.root, merged->r.start);
         return true;
+    }
     n = allocate(rm->h, sizeof(*n));
     if (n == INVALID_ADDRESS)
         return false;
@@ -123,6 +600,68 @@ boolean rangemap_insert_hole(rangemap rm, range r)
     return false;
 }
 
+static void rmnode_sift_down(rmnode *nodes, u64 i, u64 count)
+{
+    while (true) {
+        u64 c = 2 * i + 1;
+        if (c >= count)
+            return;
+        if ((c + 1 < count) && (nodes[c + 1]->r.start > nodes[c]->r.start))
+            c++;
+        if (nodes[i]->r.start >= nodes[c]->r.start)
+            return;
+        rmnode tmp = nodes[i];
+        nodes[i] = nodes[c];
+        nodes[c] = tmp;
+        i = c;
+    }
+}
+
+/* in-place heap sort by range start */
+static void rmnode_sort(rmnode *nodes, u64 count)
+{
+    for (u64 i = count / 2; i > 0; i--)
+        rmnode_sift_down(nodes, i - 1, count);
+    for (u64 i = count; i > 1; i--) {
+        rmnode tmp = nodes[0];
+        nodes[0] = nodes[i - 1];
+        nodes[i - 1] = tmp;
+        rmnode_sift_down(nodes, 0, i - 1);
+    }
+}
+
+boolean rangemap_insert_bulk(rangemap rm, rmnode *nodes, u64 count)
+{
+    if (!count)
+        return true;
+    rmnode_sort(nodes, count);
+    for (u64 i = 1; i < count; i++) {
+        if ((nodes[i]->r.start < nodes[i - 1]->r.end) ||
+            (nodes[i]->r.start == nodes[i - 1]->r.start)) {
+            msg_warn("attempt to insert %p (%R) but overlap with %p (%R)\n",
+                     nodes[i], nodes[i]->r, nodes[i - 1], nodes[i - 1]->r);
+            return false;
+        }
+    }
+    if (rangemap_is_btree(rm) && !rm->bt.root)
+        return rmbtree_build(rm, nodes, count);
+    for (u64 i = 0; i < count; i++) {
+        if (rangemap_range_intersects(rm, nodes[i]->r)) {
+            msg_warn("attempt to insert %p (%R) but overlap with existing node\n",
+                     nodes[i], nodes[i]->r);
+            return false;
+        }
+    }
+    for (u64 i = 0; i < count; i++) {
+        if (!rangemap_insert(rm, nodes[i])) {
+            while (i > 0)
+                rangemap_remove_node(rm, nodes[--i]);
+            return false;
+        }
+    }
+    return true;
+}
+
 void rangemap_remove_range(rangemap rm, rmnode n)
 {
     rangemap_remove_node(rm, n);
@@ -131,6 +670,10 @@ void rangemap_remove_range(rangemap rm, rmnode n)
 
 rmnode rangemap_lookup(rangemap rm, u64 point)
 {
+    if (rangemap_is_btree(rm)) {
+        rmnode n = rmbtree_lookup_max_lte(rm, point);
+        return ((n != INVALID_ADDRESS) && point_in_range(n->r, point)) ? n : INVALID_ADDRESS;
+    }
     struct rmnode k;
     k.r = irange(point, point + 1);
     rangemap_foreach_of_range(rm, curr, &k) {
@@ -142,9 +685,35 @@ rmnode rangemap_lookup(rangemap rm, u64 point)
     return INVALID_ADDRESS;
 }
 
+/* Point lookup for readers which don't serialize with modifications of the
+   map. It only descends from the root, with a bounded number of steps so that
+   a concurrent rebalancing can't trap it in a loop; the caller must validate
+   the result and keep removed nodes (and B+tree nodes) from being freed while
+   the lookup is in progress. */
+rmnode rangemap_lookup_unlocked(rangemap rm, u64 point)
+{
+    if (rangemap_is_btree(rm))
+        return rmbtree_lookup_unlocked(rm, point);
+    rbnode n = *(rbnode volatile *)&rm->t.root;
+    for (int depth = 0; n && depth < RANGEMAP_UNLOCKED_MAX_DEPTH; depth++) {
+        range r = ((rmnode)n)->r;
+        if (point < r.start)
+            n = *(rbnode volatile *)&n->c[0];
+        else if (point >= r.end)
+            n = *(rbnode volatile *)&n->c[1];
+        else
+            return (rmnode)n;
+    }
+    return INVALID_ADDRESS;
+}
+
 /* return either an exact match or the neighbor to the right */
 rmnode rangemap_lookup_at_or_next(rangemap rm, u64 point)
 {
+    if (rangemap_is_btree(rm)) {
+        struct rangemap_iter it;
+        return rangemap_iter_start(rm, &it, point);
+    }
     struct rmnode k;
     k.r = irange(point, point + 1);
     if (!rm->t.root)
@@ -162,6 +731,49 @@ rmnode rangemap_lookup_at_or_next(rangemap rm, u64 point)
     return n;
 }
 
+rmnode rangemap_iter_start(rangemap rm, rangemap_iter it, u64 point)
+{
+    it->rm = rm;
+    if (!rangemap_is_btree(rm)) {
+        it->n = rangemap_lookup_at_or_next(rm, point);
+        return it->n;
+    }
+    it->gen = rm->bt.gen;
+    rmnode n = INVALID_ADDRESS;
+    u32 i = 0;
+    rmbtree_node leaf = rmbtree_find_leaf(rm, point, &i);
+    if (leaf) {
+        if ((i > 0) && (((rmnode)leaf->slots[i - 1])->r.end > point))
+            i--;
+        n = rmbtree_cursor_node(&leaf, &i);
+    }
+    it->leaf = leaf;
+    it->index = i;
+    it->n = n;
+    return n;
+}
+
+rmnode rangemap_iter_next(rangemap_iter it)
+{
+    rangemap rm = it->rm;
+    rmnode n = it->n;
+    if (n == INVALID_ADDRESS)
+        return n;
+    if (!rangemap_is_btree(rm)) {
+        n = rangemap_next_node(rm, n);
+    } else if (it->gen == rm->bt.gen) {
+        it->index++;
+        n = rmbtree_cursor_node(&it->leaf, &it->index);
+    } else {
+        /* the map has been modified: look up the successor of the current node */
+        it->gen = rm->bt.gen;
+        it->leaf = rmbtree_find_leaf(rm, n->r.start, &it->index);
+        n = it->leaf ? rmbtree_cursor_node(&it->leaf, &it->index) : INVALID_ADDRESS;
+    }
+    it->n = n;
+    return n;
+}
+
 boolean rangemap_range_intersects(rangemap rm, range q)
 {
     struct rmnode k;
@@ -180,9 +792,12 @@ static inline int rangemap_range_lookup_internal(rangemap rm, range q,
 {
     boolean match = false;
     u64 lastedge = q.start;
-    struct rmnode k;
-    k.r = q;
-    rangemap_foreach_of_range(rm, curr, &k) {
+    struct rangemap_iter it;
+    rmnode next;
+    for (rmnode curr = rangemap_iter_start(rm, &it, q.start);
+         (curr != INVALID_ADDRESS) && (range_span(range_intersection(q, curr->r)) > 0);
+         curr = next) {
+        next = rangemap_iter_next(&it);
         if (gap_handler) {
             u64 edge = curr->r.start;
             range i = range_intersection(irange(lastedge, edge), q);
@@ -232,6 +847,84 @@ int rangemap_range_find_gaps(rangemap rm, range q, range_handler gap_handler)
     return rangemap_range_lookup_internal(rm, q, 0, gap_handler);
 }
 
+/* Invokes the handler if the part of a gap within q is larger than min_span; returns false if the
+   handler aborted the traversal. */
+static boolean rangemap_large_gap(range gap, range q, u64 min_span, range_handler gap_handler,
+                                  int *ret)
+{
+    range i = range_intersection(gap, q);
+    if (range_span(i) <= min_span)
+        return true;
+    if (!apply(gap_handler, i)) {
+        *ret = RM_ABORT;
+        return false;
+    }
+    *ret = RM_MATCH;
+    return true;
+}
+
+/* Visits the gaps preceding the ranges in the subtree rooted at n (whose lowest key is lo), where
+   lastedge is the end of the last range before the subtree; subtrees that lie before q or that
+   have no gap larger than min_span are skipped. Returns false if the traversal is finished. */
+static boolean rmbtree_find_large_gaps(rmbtree_node n, u64 lo, range q, u64 min_span,
+                                       range_handler gap_handler, u64 *lastedge, int *ret)
+{
+    if (n->leaf) {
+        for (u32 i = 0; i < n->count; i++) {
+            rmnode rn = n->slots[i];
+            if (rn->r.start >= q.end)
+                return false;
+            if (!rangemap_large_gap(irange(*lastedge, rn->r.start), q, min_span, gap_handler, ret))
+                return false;
+            *lastedge = rn->r.end;
+        }
+        return true;
+    }
+    for (u32 i = 0; i <= n->count; i++) {
+        rmbtree_node c = n->slots[i];
+        if (i > 0)
+            lo = n->keys[i - 1];
+        if (lo >= q.end)
+            return false;
+        if ((c->last_end > q.start) && ((lo - *lastedge > min_span) || (c->max_gap > min_span))) {
+            if (!rmbtree_find_large_gaps(c, lo, q, min_span, gap_handler, lastedge, ret))
+                return false;
+        } else {
+            *lastedge = c->last_end;
+        }
+    }
+    return true;
+}
+
+int rangemap_range_find_large_gaps(rangemap rm, range q, u64 min_span, range_handler gap_handler)
+{
+    int ret = RM_NOMATCH;
+    u64 lastedge = 0;
+    if (rangemap_is_btree(rm)) {
+        rmbtree_node root = rm->bt.root;
+        if (root && !rmbtree_find_large_gaps(root, rmbtree_min_key(root), q, min_span,
+                                             gap_handler, &lastedge, &ret) && (ret == RM_ABORT))
+            return ret;
+    } else {
+        struct rangemap_iter it;
+        for (rmnode n = rangemap_iter_start(rm, &it, q.start);
+             (n != INVALID_ADDRESS) && (n->r.start < q.end); n = rangemap_iter_next(&it)) {
+            if (!rangemap_large_gap(irange(lastedge, n->r.start), q, min_span, gap_handler, &ret))
+                return ret;
+            lastedge = n->r.end;
+        }
+    }
+    /* check for a gap between the last range and q.end */
+    rangemap_large_gap(irange(lastedge, infinity), q, min_span, gap_handler, &ret);
+    return ret;
+}
+
+void rangemap_update_node(rangemap rm, rmnode n)
+{
+    if (rangemap_is_btree(rm))
+        rmbtree_update_path(rm->bt.root, n->r.start);
+}
+
 closure_func_basic(rb_key_compare, int, rmnode_compare,
                    rbnode a, rbnode b)
 {
@@ -261,6 +954,25 @@ void init_rangemap(rangemap rm, heap h)
     rm->h = h;
     init_rbtree(&rm->t, init_closure_func(&rm->compare, rb_key_compare, rmnode_compare),
                 init_closure_func(&rm->print, rbnode_handler, print_key));
+    rm->bt.h = 0;
+    rm->bt.root = 0;
+    rm->bt.count = 0;
+    rm->bt.gen = 0;
+}
+
+rangemap allocate_rangemap_btree(heap h, heap node_heap)
+{
+    rangemap rm = allocate(h, sizeof(struct rangemap));
+    if (rm == INVALID_ADDRESS)
+        return rm;
+    init_rangemap_btree(rm, h, node_heap);
+    return rm;
+}
+
+void init_rangemap_btree(rangemap rm, heap h, heap node_heap)
+{
+    init_rangemap(rm, h);
+    rm->bt.h = node_heap ? node_heap : h;
 }
 
 closure_function(1, 1, boolean, destruct_rmnode,
@@ -273,6 +985,13 @@ closure_function(1, 1, boolean, destruct_rmnode,
 
 void destruct_rangemap(rangemap rm, rmnode_handler destructor)
 {
+    if (rangemap_is_btree(rm)) {
+        if (rm->bt.root)
+            rmbtree_destruct(rm, rm->bt.root, destructor);
+        rm->bt.root = 0;
+        rm->bt.count = 0;
+        return;
+    }
     destruct_rbtree(&rm->t, stack_closure(destruct_rmnode, destructor));
 }
 
@@ -1,8 +1,34 @@
+/* Rangemaps are indexed either by a red-black tree of their nodes, or (for maps that hold a large
+ * number of ranges) by a B+tree keyed by range start: the keys of a B+tree node fill one cache
+ * line, so that a lookup touches two cache lines per level, and leaves are linked to each other
+ * so that range scans don't need to walk back up the tree. Separator keys in inner nodes are kept
+ * equal to the lowest key of their right subtree. Each node also tracks the largest gap between
+ * consecutive ranges of its subtree, so that searches for free space of a given size can skip the
+ * subtrees where no gap is large enough. */
+#define RANGEMAP_BTREE_KEYS     7
+#define RANGEMAP_BTREE_MIN_KEYS (RANGEMAP_BTREE_KEYS / 2)
+
+typedef struct rmbtree_node {
+    u64 keys[RANGEMAP_BTREE_KEYS];
+    u32 count;
+    u32 leaf;
+    /* children of inner nodes; rmnodes of leaves, with the last slot linking to the next leaf */
+    void *slots[RANGEMAP_BTREE_KEYS + 1];
+    u64 max_gap;                /* largest gap between consecutive ranges in the subtree */
+    u64 last_end;               /* end of the last range in the subtree */
+} *rmbtree_node;
+
 typedef struct rangemap {
     heap h;
     struct rbtree t;
     closure_struct(rb_key_compare, compare);
     closure_struct(rbnode_handler, print);
+    struct {
+        heap h;                 /* non-zero if the map is indexed by a B+tree */
+        rmbtree_node root;
+        u64 count;
+        u64 gen;                /* incremented on each modification */
+    } bt;
 } *rangemap;
 
 // [start, end)
@@ -28,6 +54,7 @@ boolean rangemap_insert_range(rangemap rm, range r);
 boolean rangemap_insert_hole(rangemap rm, range r);
 void rangemap_remove_range(rangemap rm, rmnode n);
 rmnode rangemap_lookup(rangemap rm, u64 point);
+rmnode rangemap_lookup_unlocked(rangemap rm, u64 point);
 rmnode rangemap_lookup_at_or_next(rangemap rm, u64 point);
 boolean rangemap_range_intersects(rangemap rm, range q);
 
@@ -40,8 +67,37 @@ int rangemap_range_lookup_with_gaps(rangemap rm, range q, rmnode_handler node_ha
                                     range_handler gap_handler);
 int rangemap_range_find_gaps(rangemap rm, range q, range_handler gap_handler);
 
+/* Like rangemap_range_find_gaps(), but only invokes the handler for gaps (clipped to q) whose span
+   is greater than min_span; on B+tree maps, runs in logarithmic time in the number of nodes. */
+int rangemap_range_find_large_gaps(rangemap rm, range q, u64 min_span, range_handler gap_handler);
+
+/* To be called after the end of a node has been changed in place (changes to the start of a node
+   must be done via rangemap_reinsert()). */
+void rangemap_update_node(rangemap rm, rmnode n);
+
+/* Inserts an array of nodes, in any order (the array is sorted in place); fails without inserting
+   any node if the nodes overlap with each other or with existing nodes. */
+boolean rangemap_insert_bulk(rangemap rm, rmnode *nodes, u64 count);
+
+/* Range-scan iterator: visits nodes in ascending order, starting from the first node whose range
+   ends after a given point; the current node can be removed or modified while iterating. */
+typedef struct rangemap_iter {
+    rangemap rm;
+    rmnode n;
+    rmbtree_node leaf;          /* B+tree leaf containing n, valid while gen is unchanged */
+    u32 index;
+    u64 gen;
+} *rangemap_iter;
+
+rmnode rangemap_iter_start(rangemap rm, rangemap_iter it, u64 point);
+rmnode rangemap_iter_next(rangemap_iter it);
+
 rangemap allocate_rangemap(heap h);
 void init_rangemap(rangemap rm, heap h);
+
+/* B+tree nodes are allocated from node_heap if non-zero, else from h. */
+rangemap allocate_rangemap_btree(heap h, heap node_heap);
+void init_rangemap_btree(rangemap rm, heap h, heap node_heap);
 void destruct_rangemap(rangemap rm, rmnode_handler destructor);
 void deallocate_rangemap(rangemap rm, rmnode_handler destructor);
 
@@ -76,37 +132,60 @@ static inline void rmnode_init(rmnode n, range r)
     init_rbnode(&n->n);
 }
 
+rmnode rmbtree_lookup_max_lte(rangemap rm, u64 key);
+rmnode rmbtree_lookup_next(rangemap rm, u64 key);
+rmnode rmbtree_first(rangemap rm);
+void rmbtree_remove(rangemap rm, rmnode n);
+
+static inline boolean rangemap_is_btree(rangemap rm)
+{
+    return rm->bt.h != 0;
+}
+
+static inline rmnode rangemap_lookup_max_lte(rangemap rm, u64 point)
+{
+    struct rmnode k;
+    if (rangemap_is_btree(rm))
+        return rmbtree_lookup_max_lte(rm, point);
+    k.r = irange(point, point + 1);
+    if (!rm->t.root)
+        return INVALID_ADDRESS;
+    return (rmnode)rbtree_lookup_max_lte(&rm->t, &k.n);
+}
+
 static inline rmnode rangemap_prev_node(rangemap rm, rmnode n)
 {
+    if (rangemap_is_btree(rm))
+        return n->r.start ? rmbtree_lookup_max_lte(rm, n->r.start - 1) : INVALID_ADDRESS;
     return (rmnode)rbnode_get_prev(&n->n);
 }
 
 static inline rmnode rangemap_next_node(rangemap rm, rmnode n)
 {
+    if (rangemap_is_btree(rm))
+        return rmbtree_lookup_next(rm, n->r.start);
     return (rmnode)rbnode_get_next(&n->n);
 }
 
 static inline rmnode rangemap_first_node(rangemap rm)
 {
+    if (rangemap_is_btree(rm))
+        return rmbtree_first(rm);
     return (rmnode)rbtree_find_first(&rm->t);
 }
 
-static inline rmnode rangemap_lookup_max_lte(rangemap rm, u64 point)
-{
-    struct rmnode k;
-    k.r = irange(point, point + 1);
-    if (!rm->t.root)
-        return INVALID_ADDRESS;
-    return (rmnode)rbtree_lookup_max_lte(&rm->t, &k.n);
-}
-
 static inline void rangemap_remove_node(rangemap rm, rmnode n)
 {
-    rbtree_remove_node(&(rm->t), &n->n);
+    if (rangemap_is_btree(rm))
+        rmbtree_remove(rm, n);
+    else
+        rbtree_remove_node(&(rm->t), &n->n);
 }
 
 static inline u64 rangemap_count(rangemap rm)
 {
+    if (rangemap_is_btree(rm))
+        return rm->bt.count;
     return rbtree_get_count(&rm->t);
 }
 
@@ -157,7 +236,7 @@ static inline range range_add(range r, s64 delta)
 }
 
 #define rangemap_foreach(rm, n)                                         \
-    for (rmnode __next, (n) = (rmnode)rbtree_find_first(&(rm)->t);          \
+    for (rmnode __next, (n) = rangemap_first_node(rm);                  \
          __next = ((n) == INVALID_ADDRESS) ? 0 : rangemap_next_node(rm, n), \
              ((n) != INVALID_ADDRESS);                                  \
          (n) = __next)
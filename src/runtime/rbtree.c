@@ -595,6 +595,7 @@ void destruct_rbtree(rbtree t, rbnode_handler destructor)
 {
     rbtree_traverse(t, RB_POSTORDER, destructor);
     t->root = 0;
+    t->count = 0;
 }
 
 void deallocate_rbtree(rbtree t, rbnode_handler destructor)
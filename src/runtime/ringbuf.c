@@ -59,6 +59,14 @@ void ringbuf_overwrite(ringbuf b, bytes offset, const void *src, bytes len)
     ringbuf_write_at(b, b->start + offset, src, len);
 }
 
+/* Copies data at `offset` bytes past the end of the buffer contents; does not change the buffer
+ * length.
+ */
+void ringbuf_stage(ringbuf b, bytes offset, const void *src, bytes len)
+{
+    ringbuf_write_at(b, b->end + offset, src, len);
+}
+
 boolean ringbuf_extend(ringbuf b, bytes len)
 {
     if (ringbuf_space(b) < len) {
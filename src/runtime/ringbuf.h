@@ -39,3 +39,35 @@ static inline bytes ringbuf_space(ringbuf b)
 
 boolean ringbuf_extend(ringbuf b, bytes len);
 bytes ringbuf_set_capacity(ringbuf b, bytes len);
+
+/* Lockless access to a ring with a fixed capacity, by one producer and one consumer that may run
+ * concurrently: the producer checks the available space with ringbuf_space_sync(), copies data past
+ * the end of the ring contents with ringbuf_stage() and makes it visible to the consumer with
+ * ringbuf_publish(); the consumer reads data with ringbuf_peek() after checking the ring length
+ * with ringbuf_length_sync(), and hands the space back to the producer with ringbuf_release().
+ * The ring must not be extended or resized while in use. */
+void ringbuf_stage(ringbuf b, bytes offset, const void *src, bytes len);
+
+static inline bytes ringbuf_space_sync(ringbuf b)
+{
+    return b->length - (b->end - *(volatile bytes *)&b->start);
+}
+
+static inline void ringbuf_publish(ringbuf b, bytes len)
+{
+    write_barrier();
+    *(volatile bytes *)&b->end = b->end + len;
+}
+
+static inline bytes ringbuf_length_sync(ringbuf b)
+{
+    bytes len = *(volatile bytes *)&b->end - b->start;
+    read_barrier();
+    return len;
+}
+
+static inline void ringbuf_release(ringbuf b, bytes len)
+{
+    memory_barrier();
+    *(volatile bytes *)&b->start = b->start + len;
+}
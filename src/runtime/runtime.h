@@ -124,6 +124,16 @@ static inline void console_sstring(sstring s)
 
 #define check_flags_and_clear(x, f) ({boolean match = ((x) & (f)) != 0; (x) &= ~(f); match;})
 
+/* Calls a function pointer via a direct call to the expected target when the pointer matches it.
+ * Where the target is fixed at boot (e.g. the kernel heaps, the APIC mode), this replaces an
+ * indirect branch, which is expensive with speculative execution mitigations, with a compare that
+ * is always predicted correctly. The function pointer is evaluated twice. */
+#define indirect_call(__f, __t, ...)                                            \
+    (__builtin_expect((__f) == (__t), 1) ? (__t)(__VA_ARGS__) : (__f)(__VA_ARGS__))
+#define indirect_call_2(__f, __t1, __t2, ...)                                   \
+    (__builtin_expect((__f) == (__t1), 1) ? (__t1)(__VA_ARGS__) :               \
+     indirect_call(__f, __t2, __VA_ARGS__))
+
 static inline void zero(void *x, bytes length)
 {
     runtime_memset(x, 0, length);
@@ -143,6 +153,7 @@ static inline void touch_memory(const void *x, bytes length)
 
 typedef struct heap *heap;
 #include <table.h>
+#include <swisstable.h>
 #include <heap/heap.h>
 
 // transient is supposed to be cleaned up when we can guarantee that
@@ -170,6 +181,11 @@ boolean validate_virtual_writable(void *base, u64 length);
 
 void sha256(buffer dest, buffer source);
 
+#define LZ4_COMPRESS_TABLE_SIZE (16 * KB)
+u64 lz4_compress(const void *source, u64 length, void *dest, u64 capacity);
+u64 lz4_compress_table(const void *source, u64 length, void *dest, u64 capacity, u32 *table);
+s64 lz4_decompress(const void *source, u64 length, void *dest, u64 capacity);
+
 #define stack_allocate __builtin_alloca
 
 typedef struct buffer *buffer;
@@ -241,6 +257,7 @@ closure_type(storage_req_handler, void, struct storage_req *req);
 closure_type(storage_attach, void, storage_req_handler h, u64 size, int attach_id);
 
 #include <sg.h>
+#include <buffer_chain.h>
 
 void print_value(buffer dest, value v, tuple attrs);
 
@@ -252,9 +269,38 @@ closure_type(parse_finish, void, void *v);
 parser tuple_parser(heap h, parse_finish c, parse_error err);
 parser value_parser(heap h, parse_finish c, parse_error err);
 parser json_parser(heap h, parse_finish c, parse_error err);
+parser json_parser_feed(parser p, buffer b);
 void json_parser_free(parser p);
 parser parser_feed (parser p, buffer b);
 
+/* Streaming (SAX-style) JSON parser: events are delivered to the handler as the input is fed;
+ * the data of string, number and attribute name events is only valid during the handler call.
+ * If the handler returns false, parsing stops with an error. */
+enum json_event {
+    JSON_EVENT_OBJ_START,
+    JSON_EVENT_OBJ_END,
+    JSON_EVENT_ARRAY_START,
+    JSON_EVENT_ARRAY_END,
+    JSON_EVENT_KEY,
+    JSON_EVENT_STRING,
+    JSON_EVENT_NUMBER,
+    JSON_EVENT_TRUE,
+    JSON_EVENT_FALSE,
+    JSON_EVENT_NULL,
+};
+closure_type(json_handler, boolean, enum json_event ev, buffer data);
+typedef struct json_stream *json_stream;
+json_stream allocate_json_stream(heap h, json_handler handler);
+void deallocate_json_stream(heap h, json_stream js);
+
+/* Consumes the buffer contents, up to and including the character that caused an error if false is
+ * returned; after an error, the parser must be reset before feeding it again. */
+boolean json_stream_feed(json_stream js, buffer b);
+
+boolean json_stream_end(json_stream js);    /* signals end of input */
+string json_stream_error(json_stream js);
+void json_stream_reset(json_stream js);
+
 /* RNG */
 void init_random(heap h);
 u64 hw_get_seed(void);
@@ -264,8 +310,10 @@ void get_seed_complete(void *seed, bytes len);
 u64 random_early_u64(void);
 u64 random_u64(void);
 u64 random_buffer(buffer b);
-void random_buffer_aborted(void);
 void random_reseed(void);
+#ifdef KERNEL
+boolean random_percpu_init(heap h, int cpu_count);
+#endif
 
 typedef struct signature {
     u64 s[4];
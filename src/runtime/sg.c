@@ -17,6 +17,18 @@ BSS_RO_AFTER_INIT static heap sg_heap;
 static struct list free_sg_lists;
 
 #ifdef KERNEL
+/* In the kernel, free sg_lists are cached per CPU, so that most allocations and deallocations do
+   not take the global free list lock; an empty (or full) CPU cache is refilled from (or flushed
+   to) the global free list in batches of half the cache capacity. */
+#define SG_CPU_CACHE_SIZE   32
+
+typedef struct sg_cpu_cache {
+    u32 count;
+    sg_list lists[SG_CPU_CACHE_SIZE];
+} *sg_cpu_cache;
+
+BSS_RO_AFTER_INIT static sg_cpu_cache *sg_cpu_caches;
+
 static struct spinlock sg_spinlock;   /* for free list */
 static inline void sg_lock_init(void)
 {
@@ -95,24 +107,42 @@ u64 sg_copy_from_buf(void *src, sg_list sg, u64 length)
 
 u64 sg_move(sg_list dest, sg_list src, u64 n)
 {
-    sg_buf ssgb;
     u64 remain = n;
-    while (remain > 0 && (ssgb = sg_list_head_peek(src)) != INVALID_ADDRESS) {
+
+    /* Buffers that are moved entirely are copied to dest in one batch, and their references are
+       transferred to dest instead of being reserved for dest and released from src. */
+    sg_buf head = buffer_ref(src->b, 0);
+    sg_buf end = buffer_end(src->b);
+    sg_buf ssgb = head;
+    word moved_size = 0;
+    while (ssgb != end && sg_buf_len(ssgb) <= remain) {
         assert(ssgb->size > ssgb->offset);
-        u64 len = MIN(remain, sg_buf_len(ssgb));
-        sg_buf dsgb = sg_list_tail_add(dest, len);
+        remain -= sg_buf_len(ssgb);
+        moved_size += ssgb->size;
+        ssgb++;
+    }
+    if (ssgb != head) {
+        bytes len = (void *)ssgb - (void *)head;
+        assert(buffer_extend(dest->b, len));
+        runtime_memcpy(buffer_end(dest->b), head, len);
+        buffer_produce(dest->b, len);
+        fetch_and_add(&dest->count, n - remain);
+        fetch_and_add(&src->count, -moved_size);
+        buffer_consume(src->b, len);
+    }
+
+    /* part of the next buffer */
+    if (remain > 0 && ssgb != end) {
+        sg_buf dsgb = sg_list_tail_add(dest, remain);
         assert(dsgb != INVALID_ADDRESS);
         dsgb->buf = ssgb->buf;
-        dsgb->size = ssgb->offset + len;
+        dsgb->size = ssgb->offset + remain;
         dsgb->offset = ssgb->offset;
-        refcount_reserve(ssgb->refcount);
+        if (ssgb->refcount)
+            refcount_reserve(ssgb->refcount);
         dsgb->refcount = ssgb->refcount;
-        ssgb->offset += len;
-        remain -= len;
-        if (ssgb->offset < ssgb->size)
-            break;
-        sg_list_head_remove(src);
-        sg_buf_release(ssgb);
+        ssgb->offset += remain;
+        remain = 0;
     }
     return n - remain;
 }
@@ -187,8 +217,77 @@ boolean sg_fault_in(sg_list sg, u64 n)
 
 #endif
 
+#ifdef KERNEL
+static sg_list sg_cache_get(void)
+{
+    if (!sg_cpu_caches)
+        return 0;
+    sg_list sg = 0;
+    u64 flags = irq_disable_save();
+    sg_cpu_cache c = sg_cpu_caches[current_cpu()->id];
+    if (c->count == 0) {
+        sg_lock();
+        list l;
+        while ((c->count < SG_CPU_CACHE_SIZE / 2) && (l = list_get_next(&free_sg_lists))) {
+            list_delete(l);
+            c->lists[c->count++] = struct_from_list(l, sg_list, l);
+        }
+        sg_unlock();
+    }
+    if (c->count > 0)
+        sg = c->lists[--c->count];
+    irq_restore(flags);
+    return sg;
+}
+
+static boolean sg_cache_put(sg_list sg)
+{
+    if (!sg_cpu_caches)
+        return false;
+    u64 flags = irq_disable_save();
+    sg_cpu_cache c = sg_cpu_caches[current_cpu()->id];
+    if (c->count == SG_CPU_CACHE_SIZE) {
+        sg_lock();
+        while (c->count > SG_CPU_CACHE_SIZE / 2)
+            list_insert_after(&free_sg_lists, &c->lists[--c->count]->l);
+        sg_unlock();
+    }
+    c->lists[c->count++] = sg;
+    irq_restore(flags);
+    return true;
+}
+
+/* Enables the per-CPU caches; must be called before secondary CPUs start using sg_lists. */
+boolean sg_percpu_init(int cpu_count)
+{
+    sg_cpu_cache *caches = allocate(sg_heap, cpu_count * sizeof(caches[0]));
+    if (caches == INVALID_ADDRESS)
+        return false;
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        sg_cpu_cache c = allocate(sg_heap, sizeof(struct sg_cpu_cache));
+        if (c == INVALID_ADDRESS) {
+            while (--cpu >= 0)
+                deallocate(sg_heap, caches[cpu], sizeof(struct sg_cpu_cache));
+            deallocate(sg_heap, caches, cpu_count * sizeof(caches[0]));
+            return false;
+        }
+        c->count = 0;
+        caches[cpu] = c;
+    }
+    write_barrier();
+    sg_cpu_caches = caches;
+    return true;
+}
+#else
+#define sg_cache_get()      0
+#define sg_cache_put(sg)    false
+#endif
+
 sg_list allocate_sg_list(void)
 {
+    sg_list sg = sg_cache_get();
+    if (sg)
+        return sg;
     sg_lock();
     list l = list_get_next(&free_sg_lists);
     if (l) {
@@ -198,7 +297,7 @@ sg_list allocate_sg_list(void)
     }
     sg_unlock();
 
-    sg_list sg = allocate(sg_heap, sizeof(struct sg_list));
+    sg = allocate(sg_heap, sizeof(struct sg_list));
     if (!sg)
         return sg;
     sg->b = allocate_buffer(sg_heap, sizeof(struct sg_buf) * DEFAULT_SG_FRAGS);
@@ -218,6 +317,8 @@ void deallocate_sg_list(sg_list sg)
     if (buffer_space(sg->b) > SG_FRAG_BYTE_THRESHOLD)
         assert(buffer_set_capacity(sg->b, SG_FRAG_BYTE_THRESHOLD) == SG_FRAG_BYTE_THRESHOLD);
     sg->count = 0;
+    if (sg_cache_put(sg))
+        return;
     sg_lock();
     list_insert_after(&free_sg_lists, &sg->l);
     sg_unlock();
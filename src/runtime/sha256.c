@@ -13,7 +13,11 @@
 *********************************************************************/
 
 /*************************** HEADER FILES ***************************/
+#ifdef KERNEL
+#include <kernel.h>
+#else
 #include <runtime.h>
+#endif
 
 typedef struct {
 	u8 data[64];
@@ -87,6 +91,246 @@ void sha256_transform(sha256_ctx *ctx, const u8 data[])
 	ctx->state[7] += h;
 }
 
+/*********************** HARDWARE ACCELERATION **********************/
+/* Block processing with the SHA extensions on x86_64 and the SHA2 cryptographic extension on
+ * aarch64, used if the CPU supports them (the check is done on first use).
+ * The kernel is built without vector register support, so the vector registers used are named
+ * explicitly in the assembly code, and blocks are processed one chunk at a time with interrupts
+ * disabled. On x86_64 the registers of a user thread are saved on kernel entry, and
+ * kernel_simd_begin() makes sure they are restored on return to the thread; on aarch64 the FP/SIMD
+ * state is saved only lazily for user threads, and the kernel saves and restores the registers it
+ * uses. */
+#define SHA256_IMPL_UNKNOWN	0
+#define SHA256_IMPL_GENERIC	1
+#define SHA256_IMPL_HW		2
+
+#if defined(__x86_64__)
+#define SHA256_HW
+
+#ifdef __SSE__
+#define SHA256_HW_CLOBBERS	, "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", \
+				"xmm8", "xmm9", "xmm10"
+#else
+#define SHA256_HW_CLOBBERS
+#endif
+
+/* big endian to little endian conversion of 32-bit message words */
+static const u8 sha256_bswap_mask[16] __attribute__((aligned(16))) = {
+	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static inline void sha256_cpuid(u32 leaf, u32 *v)
+{
+	asm volatile("cpuid" : "=a"(v[0]), "=b"(v[1]), "=c"(v[2]), "=d"(v[3]) : "0"(leaf), "2"(0));
+}
+
+static boolean sha256_hw_detect(void)
+{
+	u32 v[4];
+
+	sha256_cpuid(0, v);
+	if (v[0] < 7)
+		return false;
+	sha256_cpuid(1, v);
+	if (!(v[2] & (1 << 9)))		// SSSE3
+		return false;
+	sha256_cpuid(7, v);
+	return (v[1] & (1 << 29)) != 0;	// SHA
+}
+
+#ifdef KERNEL
+#define sha256_hw_begin()	kernel_simd_begin()
+#define sha256_hw_end(flags)	kernel_simd_end(flags)
+#endif
+
+static void sha256_blocks_hw_chunk(u32 *state, const u8 *data, u64 nblocks)
+{
+	/* xmm1 and xmm2 hold the state in the ABEF and CDGH order used by sha256rnds2, xmm3-xmm6
+	 * hold 16 message schedule words, xmm8 holds the byte swap mask. */
+	asm volatile(
+		".macro sha256_ni_4rounds i, m0, m1, m2, m3\n"
+		".if \\i < 16\n"
+		"movdqu \\i*4(%[data]), \\m0\n"
+		"pshufb %%xmm8, \\m0\n"
+		".endif\n"
+		"movdqu \\i*4(%[k]), %%xmm0\n"
+		"paddd \\m0, %%xmm0\n"
+		"sha256rnds2 %%xmm1, %%xmm2\n"
+		".if \\i >= 12 && \\i < 60\n"
+		"movdqa \\m0, %%xmm7\n"
+		"palignr $4, \\m3, %%xmm7\n"
+		"paddd %%xmm7, \\m1\n"
+		"sha256msg2 \\m0, \\m1\n"
+		".endif\n"
+		"punpckhqdq %%xmm0, %%xmm0\n"
+		"sha256rnds2 %%xmm2, %%xmm1\n"
+		".if \\i >= 4 && \\i < 52\n"
+		"sha256msg1 \\m0, \\m3\n"
+		".endif\n"
+		".endm\n"
+		"movdqu (%[state]), %%xmm1\n"
+		"movdqu 16(%[state]), %%xmm2\n"
+		"movdqa (%[mask]), %%xmm8\n"
+		"movdqa %%xmm1, %%xmm7\n"
+		"punpcklqdq %%xmm2, %%xmm1\n"
+		"punpckhqdq %%xmm7, %%xmm2\n"
+		"pshufd $0x1b, %%xmm1, %%xmm1\n"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n"
+		"1:\n"
+		"movdqa %%xmm1, %%xmm9\n"
+		"movdqa %%xmm2, %%xmm10\n"
+		".irp i, 0, 16, 32, 48\n"
+		"sha256_ni_4rounds (\\i + 0), %%xmm3, %%xmm4, %%xmm5, %%xmm6\n"
+		"sha256_ni_4rounds (\\i + 4), %%xmm4, %%xmm5, %%xmm6, %%xmm3\n"
+		"sha256_ni_4rounds (\\i + 8), %%xmm5, %%xmm6, %%xmm3, %%xmm4\n"
+		"sha256_ni_4rounds (\\i + 12), %%xmm6, %%xmm3, %%xmm4, %%xmm5\n"
+		".endr\n"
+		"paddd %%xmm9, %%xmm1\n"
+		"paddd %%xmm10, %%xmm2\n"
+		"add $64, %[data]\n"
+		"dec %[n]\n"
+		"jnz 1b\n"
+		"movdqa %%xmm1, %%xmm7\n"
+		"punpcklqdq %%xmm2, %%xmm1\n"
+		"punpckhqdq %%xmm7, %%xmm2\n"
+		"pshufd $0xb1, %%xmm1, %%xmm1\n"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n"
+		"movdqu %%xmm2, (%[state])\n"
+		"movdqu %%xmm1, 16(%[state])\n"
+		".purgem sha256_ni_4rounds\n"
+		: [data] "+r"(data), [n] "+r"(nblocks)
+		: [state] "r"(state), [k] "r"(k), [mask] "r"(sha256_bswap_mask)
+		: "memory", "cc" SHA256_HW_CLOBBERS);
+}
+
+#elif defined(__aarch64__)
+#define SHA256_HW
+
+#if defined(__ARM_NEON) && !defined(KERNEL)
+#define SHA256_HW_CLOBBERS	, "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v16", "v17", "v18"
+#else
+#define SHA256_HW_CLOBBERS
+#endif
+
+#ifdef KERNEL
+#define sha256_hw_begin()	irq_disable_save()
+#define sha256_hw_end(flags)	irq_restore(flags)
+#endif
+
+static boolean sha256_hw_detect(void)
+{
+	u64 isar0;
+
+	asm volatile("mrs %0, id_aa64isar0_el1" : "=r"(isar0));
+	return ((isar0 >> 12) & 0xf) != 0;	// SHA2 field
+}
+
+static void sha256_blocks_hw_chunk(u32 *state, const u8 *data, u64 nblocks)
+{
+	const u32 *kp;
+#ifdef KERNEL
+	u8 save[11 * 16] __attribute__((aligned(16)));
+#endif
+
+	/* v0 and v1 hold the state (abcd and efgh), v4-v7 hold 16 message schedule words. */
+	asm volatile(
+		".arch armv8-a+crypto\n"
+		".macro sha256_ce_4rounds m0, m1, m2, m3, update\n"
+		"ld1 {v18.4s}, [%[kp]], #16\n"
+		"add v16.4s, \\m0\\().4s, v18.4s\n"
+		"mov v17.16b, v0.16b\n"
+		"sha256h q0, q1, v16.4s\n"
+		"sha256h2 q1, q17, v16.4s\n"
+		".if \\update\n"
+		"sha256su0 \\m0\\().4s, \\m1\\().4s\n"
+		"sha256su1 \\m0\\().4s, \\m2\\().4s, \\m3\\().4s\n"
+		".endif\n"
+		".endm\n"
+#ifdef KERNEL
+		"stp q0, q1, [%[save]]\n"
+		"stp q2, q3, [%[save], #32]\n"
+		"stp q4, q5, [%[save], #64]\n"
+		"stp q6, q7, [%[save], #96]\n"
+		"stp q16, q17, [%[save], #128]\n"
+		"str q18, [%[save], #160]\n"
+#endif
+		"ld1 {v0.4s, v1.4s}, [%[state]]\n"
+		"1:\n"
+		"ld1 {v4.16b, v5.16b, v6.16b, v7.16b}, [%[data]], #64\n"
+		"mov %[kp], %[k]\n"
+		"mov v2.16b, v0.16b\n"
+		"mov v3.16b, v1.16b\n"
+		"rev32 v4.16b, v4.16b\n"
+		"rev32 v5.16b, v5.16b\n"
+		"rev32 v6.16b, v6.16b\n"
+		"rev32 v7.16b, v7.16b\n"
+		".irp u, 1, 1, 1, 0\n"
+		"sha256_ce_4rounds v4, v5, v6, v7, \\u\n"
+		"sha256_ce_4rounds v5, v6, v7, v4, \\u\n"
+		"sha256_ce_4rounds v6, v7, v4, v5, \\u\n"
+		"sha256_ce_4rounds v7, v4, v5, v6, \\u\n"
+		".endr\n"
+		"add v0.4s, v0.4s, v2.4s\n"
+		"add v1.4s, v1.4s, v3.4s\n"
+		"subs %[n], %[n], #1\n"
+		"b.ne 1b\n"
+		"st1 {v0.4s, v1.4s}, [%[state]]\n"
+#ifdef KERNEL
+		"ldp q0, q1, [%[save]]\n"
+		"ldp q2, q3, [%[save], #32]\n"
+		"ldp q4, q5, [%[save], #64]\n"
+		"ldp q6, q7, [%[save], #96]\n"
+		"ldp q16, q17, [%[save], #128]\n"
+		"ldr q18, [%[save], #160]\n"
+#endif
+		".purgem sha256_ce_4rounds\n"
+		: [data] "+r"(data), [n] "+r"(nblocks), [kp] "=&r"(kp)
+		: [state] "r"(state), [k] "r"(k)
+#ifdef KERNEL
+		, [save] "r"(save)
+#endif
+		: "memory", "cc" SHA256_HW_CLOBBERS);
+}
+
+#endif
+
+#ifdef SHA256_HW
+/* maximum number of blocks processed with interrupts disabled */
+#define SHA256_HW_CHUNK	64
+
+static void sha256_blocks_hw(u32 *state, const u8 *data, u64 nblocks)
+{
+	while (nblocks > 0) {
+		u64 n = MIN(nblocks, SHA256_HW_CHUNK);
+#ifdef KERNEL
+		u64 flags = sha256_hw_begin();
+#endif
+		sha256_blocks_hw_chunk(state, data, n);
+#ifdef KERNEL
+		sha256_hw_end(flags);
+#endif
+		data += n * 64;
+		nblocks -= n;
+	}
+}
+
+static int sha256_impl;
+#endif
+
+static void sha256_blocks(sha256_ctx *ctx, const u8 *data, u64 nblocks)
+{
+#ifdef SHA256_HW
+	if (sha256_impl == SHA256_IMPL_UNKNOWN)
+		sha256_impl = sha256_hw_detect() ? SHA256_IMPL_HW : SHA256_IMPL_GENERIC;
+	if (sha256_impl == SHA256_IMPL_HW) {
+		sha256_blocks_hw(ctx->state, data, nblocks);
+		return;
+	}
+#endif
+	for (; nblocks > 0; nblocks--, data += 64)
+		sha256_transform(ctx, data);
+}
+
 void sha256_init(sha256_ctx *ctx)
 {
 	ctx->datalen = 0;
@@ -104,15 +348,31 @@ void sha256_init(sha256_ctx *ctx)
 void sha256_update(sha256_ctx *ctx, const u8 data[], bytes len)
 {
 	u32 i;
+	u64 nblocks;
 
-	for (i = 0; i < len; ++i) {
-		ctx->data[ctx->datalen] = data[i];
-		ctx->datalen++;
-		if (ctx->datalen == 64) {
-			sha256_transform(ctx, ctx->data);
-			ctx->bitlen += 512;
-			ctx->datalen = 0;
-		}
+	// Complete a partially filled block, then process whole blocks directly from the input.
+	if (ctx->datalen > 0) {
+		i = MIN(64 - ctx->datalen, len);
+		runtime_memcpy(ctx->data + ctx->datalen, data, i);
+		ctx->datalen += i;
+		data += i;
+		len -= i;
+		if (ctx->datalen < 64)
+			return;
+		sha256_blocks(ctx, ctx->data, 1);
+		ctx->bitlen += 512;
+		ctx->datalen = 0;
+	}
+	nblocks = len / 64;
+	if (nblocks > 0) {
+		sha256_blocks(ctx, data, nblocks);
+		ctx->bitlen += nblocks * 512;
+		data += nblocks * 64;
+		len -= nblocks * 64;
+	}
+	if (len > 0) {
+		runtime_memcpy(ctx->data, data, len);
+		ctx->datalen = len;
 	}
 }
 
@@ -132,7 +392,7 @@ void sha256_final(sha256_ctx *ctx, u8 hash[])
 		ctx->data[i++] = 0x80;
 		while (i < 64)
 			ctx->data[i++] = 0x00;
-		sha256_transform(ctx, ctx->data);
+		sha256_blocks(ctx, ctx->data, 1);
 		zero(ctx->data, 56);
 	}
 
@@ -146,7 +406,7 @@ void sha256_final(sha256_ctx *ctx, u8 hash[])
 	ctx->data[58] = ctx->bitlen >> 40;
 	ctx->data[57] = ctx->bitlen >> 48;
 	ctx->data[56] = ctx->bitlen >> 56;
-	sha256_transform(ctx, ctx->data);
+	sha256_blocks(ctx, ctx->data, 1);
 
 	// Since this implementation uses little endian u8 ordering and SHA uses big endian,
 	// reverse all the bytes when copying the final state to the output hash.
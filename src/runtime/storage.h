@@ -77,6 +77,8 @@ enum storage_op {
     STORAGE_OP_READSG,
     STORAGE_OP_WRITESG,
     STORAGE_OP_FLUSH,
+    STORAGE_OP_DISCARD,         /* advisory: the device may deallocate the blocks */
+    STORAGE_OP_WRITE_ZEROES,    /* the blocks read back as zeros, without a data transfer */
 };
 
 typedef struct storage_req {
@@ -91,6 +93,33 @@ declare_closure_struct(2, 1, void, storage_simple_req_handler,
                        storage_req req);
 storage_req_handler storage_init_req_handler(closure_ref(storage_simple_req_handler, handler),
                                              block_io read, block_io write);
+void storage_req_unsupported(storage_req req);
+storage_req_handler storage_plug_init(heap h, storage_req_handler target);
+boolean storage_sched_enabled(void);
+storage_req_handler storage_sched_init(heap h, storage_req_handler target);
+
+/* I/O priorities, encoded as in ioprio_set(2): class in the upper bits, level (unused) in the lower
+ * bits */
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_NONE   0
+#define IOPRIO_CLASS_RT     1
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_PRIO_CLASS(ioprio)   ((ioprio) >> IOPRIO_CLASS_SHIFT)
+#define IOPRIO_PRIO_DATA(ioprio)    ((ioprio) & MASK(IOPRIO_CLASS_SHIFT))
+
+/* Hybrid polled completion: after submitting a request, a driver spins for
+   completions for an adaptive window before relying on interrupts. */
+typedef struct io_poll {
+    timestamp mean;     /* moving average of polled completion latency */
+    timestamp window;   /* current spin window */
+    u64 submissions;
+} *io_poll;
+
+boolean storage_io_poll_enabled(sstring driver);
+void io_poll_init(io_poll p);
+timestamp io_poll_start(io_poll p);
+void io_poll_end(io_poll p, timestamp start, boolean completed);
 
 closure_type(fs_init_complete, void, struct filesystem *fs, status s);
 closure_type(fs_init_handler, void, boolean readonly, fs_init_complete complete);
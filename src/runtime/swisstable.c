@@ -0,0 +1,355 @@
+#include <runtime.h>
+
+/* Debug only: Enabling SWISSTABLE_PARANOIA will perform a (costly) table
+   integrity check with each affective operation. */
+//#define SWISSTABLE_PARANOIA
+
+#ifdef SWISSTABLE_PARANOIA
+#define swisstable_paranoia(t, n)   swisstable_validate(t, ss(n))
+#else
+#define swisstable_paranoia(t, n)
+#endif
+
+#define SWISSTABLE_MIN_CAPACITY     SWISSTABLE_GROUP_WIDTH
+
+/* number of groups of the old slot array migrated by each insertion or removal while growing */
+#define SWISSTABLE_MIGRATE_GROUPS   2
+
+#define GROUP_LSBS  0x0101010101010101ull
+#define GROUP_MSBS  0x8080808080808080ull
+
+/* bitmask with the most significant bit of each matching control byte set */
+typedef u64 group_mask;
+
+/* Key functions are not required to return well-distributed values (e.g. identity_key() on
+   aligned pointers), so mix the bits of keys before use. */
+static inline u64 swisstable_hash(key k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    return k;
+}
+
+static inline u8 hash_h2(u64 h)
+{
+    return h & 0x7f;
+}
+
+static inline u64 hash_h1(u64 h)
+{
+    return h >> 7;
+}
+
+static inline u64 group_load(u8 *ctrl)
+{
+    return *(u64 *)ctrl;
+}
+
+/* May return false positives, which are always full slots (so they are sorted out by comparing
+   keys). */
+static inline group_mask group_match(u64 g, u8 h2)
+{
+    u64 x = g ^ (GROUP_LSBS * h2);
+    return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+}
+
+static inline group_mask group_match_empty(u64 g)
+{
+    /* empty slots are the only ones with bit 7 set and bit 1 cleared */
+    return g & ~(g << 6) & GROUP_MSBS;
+}
+
+static inline group_mask group_match_free(u64 g)
+{
+    return g & GROUP_MSBS;
+}
+
+static inline u64 group_mask_next(group_mask *m)
+{
+    u64 i = lsb(*m) >> 3;
+    *m &= *m - 1;
+    return i;
+}
+
+static inline boolean ctrl_is_full(u8 ctrl)
+{
+    return !(ctrl & SWISSTABLE_CTRL_EMPTY);
+}
+
+static boolean swisstable_array_alloc(heap h, swisstable_array a, u64 capacity)
+{
+    a->ctrl = allocate(h, capacity);
+    if (a->ctrl == INVALID_ADDRESS)
+        return false;
+    a->slots = allocate(h, capacity * sizeof(struct swisstable_slot));
+    if (a->slots == INVALID_ADDRESS) {
+        deallocate(h, a->ctrl, capacity);
+        return false;
+    }
+    runtime_memset(a->ctrl, SWISSTABLE_CTRL_EMPTY, capacity);
+    a->capacity = capacity;
+    a->growth_left = capacity - capacity / 8;
+    return true;
+}
+
+static void swisstable_array_dealloc(heap h, swisstable_array a)
+{
+    deallocate(h, a->ctrl, a->capacity);
+    deallocate(h, a->slots, a->capacity * sizeof(struct swisstable_slot));
+    a->ctrl = 0;
+    a->slots = 0;
+    a->capacity = 0;
+}
+
+/* Groups are probed in triangular sequence, which visits each group once. */
+#define swisstable_probe(a, h, g, i)                                                \
+    for (u64 __gmask = ((a)->capacity / SWISSTABLE_GROUP_WIDTH) - 1,                \
+         g = hash_h1(h) & __gmask, i = 0; i <= __gmask; g = (g + ++i) & __gmask)
+
+static swisstable_slot swisstable_array_find(swisstable t, swisstable_array a, key k, u64 h,
+                                             void *c, u64 *index)
+{
+    swisstable_probe(a, h, g, i) {
+        u8 *ctrl = a->ctrl + g * SWISSTABLE_GROUP_WIDTH;
+        u64 grp = group_load(ctrl);
+        group_mask m = group_match(grp, hash_h2(h));
+        while (m) {
+            u64 s = g * SWISSTABLE_GROUP_WIDTH + group_mask_next(&m);
+            swisstable_slot slot = &a->slots[s];
+            if ((slot->k == k) && t->equals_function(slot->c, c)) {
+                *index = s;
+                return slot;
+            }
+        }
+        if (group_match_empty(grp))
+            break;
+    }
+    return 0;
+}
+
+/* the caller must ensure that the array has room for the new element */
+static void swisstable_array_insert(swisstable_array a, key k, u64 h, void *c, void *v)
+{
+    swisstable_probe(a, h, g, i) {
+        group_mask m = group_match_free(group_load(a->ctrl + g * SWISSTABLE_GROUP_WIDTH));
+        if (m) {
+            u64 s = g * SWISSTABLE_GROUP_WIDTH + group_mask_next(&m);
+            if (a->ctrl[s] == SWISSTABLE_CTRL_EMPTY)
+                a->growth_left--;
+            a->ctrl[s] = hash_h2(h);
+            swisstable_slot slot = &a->slots[s];
+            slot->k = k;
+            slot->c = c;
+            slot->v = v;
+            return;
+        }
+    }
+    halt("%s: no free slot in array %p\n", func_ss, a);
+}
+
+static void swisstable_array_erase(swisstable_array a, u64 s)
+{
+    /* If the group has an empty slot, it always had one, and no probe sequence ever went past
+       this group: the slot can be marked as empty instead of deleted. */
+    if (group_match_empty(group_load(a->ctrl + (s & ~(SWISSTABLE_GROUP_WIDTH - 1))))) {
+        a->ctrl[s] = SWISSTABLE_CTRL_EMPTY;
+        a->growth_left++;
+    } else {
+        a->ctrl[s] = SWISSTABLE_CTRL_DELETED;
+    }
+}
+
+static void swisstable_migrate(swisstable t, u64 groups)
+{
+    swisstable_array old = &t->old;
+    u64 end = MIN(t->migrate_pos + groups * SWISSTABLE_GROUP_WIDTH, old->capacity);
+    for (u64 s = t->migrate_pos; s < end; s++) {
+        if (!ctrl_is_full(old->ctrl[s]))
+            continue;
+        swisstable_slot slot = &old->slots[s];
+        swisstable_array_insert(&t->cur, slot->k, swisstable_hash(slot->k), slot->c, slot->v);
+        old->ctrl[s] = SWISSTABLE_CTRL_DELETED;
+    }
+    t->migrate_pos = end;
+    if (end == old->capacity)
+        swisstable_array_dealloc(t->h, old);
+}
+
+/* Replaces the current slot array with a new one: twice as large if mostly filled with elements,
+   or of the same size if mostly filled with deleted slots. */
+static void swisstable_grow(swisstable t)
+{
+    if (t->old.ctrl)
+        swisstable_migrate(t, t->old.capacity / SWISSTABLE_GROUP_WIDTH);
+    u64 capacity = t->cur.capacity;
+    if (t->count >= capacity / 2)
+        capacity *= 2;
+    t->old = t->cur;
+    if (!swisstable_array_alloc(t->h, &t->cur, capacity))
+        halt("%s: allocate fail for capacity %ld\n", func_ss, capacity);
+    t->migrate_pos = 0;
+    swisstable_paranoia(t, "grow");
+}
+
+swisstable allocate_swisstable(heap h, key (*key_function)(void *x),
+                               boolean (*equals_function)(void *x, void *y))
+{
+    swisstable t = allocate(h, sizeof(struct swisstable));
+    if (t == INVALID_ADDRESS)
+        return t;
+    if (!swisstable_array_alloc(h, &t->cur, SWISSTABLE_MIN_CAPACITY)) {
+        deallocate(h, t, sizeof(struct swisstable));
+        return INVALID_ADDRESS;
+    }
+    t->h = h;
+    t->count = 0;
+    t->old.ctrl = 0;
+    t->old.slots = 0;
+    t->old.capacity = 0;
+    t->migrate_pos = 0;
+    t->key_function = key_function;
+    t->equals_function = equals_function;
+    return t;
+}
+
+void deallocate_swisstable(swisstable t)
+{
+    swisstable_paranoia(t, "deallocate");
+    if (t->old.ctrl)
+        swisstable_array_dealloc(t->h, &t->old);
+    swisstable_array_dealloc(t->h, &t->cur);
+    deallocate(t->h, t, sizeof(struct swisstable));
+}
+
+static void swisstable_validate_array(swisstable t, swisstable_array a, u64 *count, sstring n)
+{
+    for (u64 s = 0; s < a->capacity; s++) {
+        u8 ctrl = a->ctrl[s];
+        if (!ctrl_is_full(ctrl)) {
+            if ((ctrl != SWISSTABLE_CTRL_EMPTY) && (ctrl != SWISSTABLE_CTRL_DELETED))
+                halt("swisstable_validate fail on %s: table %p, slot %ld, invalid ctrl 0x%x\n",
+                     n, t, s, ctrl);
+            continue;
+        }
+        if (ctrl != hash_h2(swisstable_hash(a->slots[s].k)))
+            halt("swisstable_validate fail on %s: table %p, slot %ld, hash mismatch\n", n, t, s);
+        (*count)++;
+    }
+}
+
+void swisstable_validate(swisstable t, sstring n)
+{
+    u64 count = 0;
+    swisstable_validate_array(t, &t->cur, &count, n);
+    if (t->old.ctrl)
+        swisstable_validate_array(t, &t->old, &count, n);
+    if (count != t->count)
+        halt("swisstable_validate fail on %s: table %p, %ld elements found, count %ld\n",
+             n, t, count, t->count);
+}
+
+/* Looks up an element in both arrays; returns the array and index of the matching slot. */
+static swisstable_slot swisstable_lookup(swisstable t, key k, u64 h, void *c,
+                                         swisstable_array *a, u64 *index)
+{
+    *a = &t->cur;
+    swisstable_slot slot = swisstable_array_find(t, *a, k, h, c, index);
+    if (!slot && t->old.ctrl) {
+        *a = &t->old;
+        slot = swisstable_array_find(t, *a, k, h, c, index);
+    }
+    return slot;
+}
+
+void *swisstable_find(swisstable t, void *c)
+{
+    assert(t);
+    key k = t->key_function(c);
+    swisstable_array a;
+    u64 s;
+    swisstable_slot slot = swisstable_lookup(t, k, swisstable_hash(k), c, &a, &s);
+    return slot ? slot->v : 0;
+}
+
+static void swisstable_insert(swisstable t, key k, u64 h, void *c, void *v)
+{
+    if (t->cur.growth_left == 0)
+        swisstable_grow(t);
+    swisstable_array_insert(&t->cur, k, h, c, v);
+    t->count++;
+    swisstable_paranoia(t, "insert");
+}
+
+static void swisstable_erase(swisstable t, swisstable_array a, u64 s)
+{
+    assert(t->count > 0);
+    swisstable_array_erase(a, s);
+    t->count--;
+    swisstable_paranoia(t, "remove");
+}
+
+void swisstable_set(swisstable t, void *c, void *v)
+{
+    key k = t->key_function(c);
+    u64 h = swisstable_hash(k);
+    swisstable_array a;
+    u64 s;
+    swisstable_slot slot = swisstable_lookup(t, k, h, c, &a, &s);
+    if (slot) {
+        if (v == 0)
+            swisstable_erase(t, a, s);
+        else
+            slot->v = v;
+        return;
+    }
+    if (v != 0) {
+        if (t->old.ctrl)
+            swisstable_migrate(t, SWISSTABLE_MIGRATE_GROUPS);
+        swisstable_insert(t, k, h, c, v);
+    }
+}
+
+/* Returns true if the element was not in the table and has been inserted, false if the element is
+ * in the table and has not been replaced. */
+boolean swisstable_set_noreplace(swisstable t, void *c, void *v)
+{
+    key k = t->key_function(c);
+    u64 h = swisstable_hash(k);
+    swisstable_array a;
+    u64 s;
+    if (swisstable_lookup(t, k, h, c, &a, &s))
+        return false;
+    if (t->old.ctrl)
+        swisstable_migrate(t, SWISSTABLE_MIGRATE_GROUPS);
+    swisstable_insert(t, k, h, c, v);
+    return true;
+}
+
+void *swisstable_remove(swisstable t, void *c)
+{
+    key k = t->key_function(c);
+    u64 h = swisstable_hash(k);
+    swisstable_array a;
+    u64 s;
+    swisstable_slot slot = swisstable_lookup(t, k, h, c, &a, &s);
+    if (!slot)
+        return 0;
+    void *v = slot->v;
+    swisstable_erase(t, a, s);
+    return v;
+}
+
+u64 swisstable_elements(swisstable t)
+{
+    return t->count;
+}
+
+void swisstable_clear(swisstable t)
+{
+    if (t->old.ctrl)
+        swisstable_array_dealloc(t->h, &t->old);
+    runtime_memset(t->cur.ctrl, SWISSTABLE_CTRL_EMPTY, t->cur.capacity);
+    t->cur.growth_left = t->cur.capacity - t->cur.capacity / 8;
+    t->count = 0;
+}
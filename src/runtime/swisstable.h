@@ -0,0 +1,62 @@
+/* Open-addressing hash table, with the same interface as table.h
+ *
+ * Elements are stored inline in a slot array, with a parallel array of control bytes which hold,
+ * for each slot, either a marker of an empty or deleted slot or 7 bits of the hash of the element
+ * key. Lookups probe groups of SWISSTABLE_GROUP_WIDTH control bytes at a time, with word-wide
+ * (SWAR) operations, and only compare keys for the slots whose control byte matches.
+ * The table grows incrementally: when the slot array is full, a larger array is allocated, and the
+ * elements of the old array are migrated a few groups at a time by subsequent insertions, so that
+ * no single operation incurs the cost of rehashing the whole table.
+ */
+typedef struct swisstable *swisstable;
+
+#define SWISSTABLE_GROUP_WIDTH  8
+
+typedef struct swisstable_slot {
+    key k;
+    void *c;
+    void *v;
+} *swisstable_slot;
+
+typedef struct swisstable_array {
+    u8 *ctrl;
+    swisstable_slot slots;
+    u64 capacity;               /* number of slots, power of 2 */
+    u64 growth_left;            /* number of empty slots that can be filled before growing */
+} *swisstable_array;
+
+struct swisstable {
+    heap h;
+    u64 count;
+    struct swisstable_array cur;
+    struct swisstable_array old;    /* being migrated into cur if old.ctrl is non-null */
+    u64 migrate_pos;                /* next slot of the old array to be migrated */
+    key (*key_function)(void *x);
+    boolean (*equals_function)(void *x, void *y);
+};
+
+swisstable allocate_swisstable(heap h, key (*key_function)(void *x),
+                               boolean (*equals_function)(void *x, void *y));
+void deallocate_swisstable(swisstable t);
+void swisstable_validate(swisstable t, sstring n);
+u64 swisstable_elements(swisstable t);
+void *swisstable_find(swisstable t, void *c);
+void swisstable_set(swisstable t, void *c, void *v);
+boolean swisstable_set_noreplace(swisstable t, void *c, void *v);
+void swisstable_clear(swisstable t);
+
+/* Returns the value being removed if found, 0 otherwise. */
+void *swisstable_remove(swisstable t, void *c);
+
+/* control bytes of full slots have the most significant bit cleared */
+#define SWISSTABLE_CTRL_EMPTY   0x80
+#define SWISSTABLE_CTRL_DELETED 0xfe
+
+/* Elements can be removed (but not inserted) while iterating. */
+#define swisstable_foreach(__t, __k, __v)                                                   \
+    for (swisstable_array __a = &(__t)->cur; __a;                                           \
+         __a = ((__a == &(__t)->cur) && (__t)->old.ctrl) ? &(__t)->old : 0)                 \
+        for (u64 __i = 0; __i < __a->capacity; __i++)                                       \
+            if (!(__a->ctrl[__i] & SWISSTABLE_CTRL_EMPTY))                                  \
+                for (void *__k = __a->slots[__i].c, *__v = __a->slots[__i].v, *__j = __a;   \
+                     __j; __j = 0)
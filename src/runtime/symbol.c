@@ -4,7 +4,23 @@
 #include <runtime.h>
 #endif
 
-BSS_RO_AFTER_INIT static table symbols;
+/* Symbols are looked up in an open-addressing hash table with linear probing. Lookups are
+ * lock-free: slots are only ever filled, each by publishing the symbol pointer after the hash, and
+ * the table is replaced as a whole when it grows. Superseded tables are not freed, as readers may
+ * still be walking them; since the table doubles in size on growth, they add up to less than the
+ * size of the current one. Insertions are serialized by the symbol lock. */
+#define SYMTAB_MIN_SIZE 1024
+
+typedef struct symtab {
+    u64 mask;       /* table size - 1 */
+    u64 count;
+    struct symtab_entry {
+        u64 hash;
+        symbol s;
+    } entries[0];
+} *symtab;
+
+static symtab symbols;
 BSS_RO_AFTER_INIT static heap sheap;
 BSS_RO_AFTER_INIT static heap iheap;
 
@@ -29,6 +45,10 @@ struct symbol {
     key k;
 };
 
+/* bounds of the sym_const section; defined by the linker */
+extern struct sym_const __start_sym_const[] __attribute__((weak));
+extern struct sym_const __stop_sym_const[] __attribute__((weak));
+
 symbol intern_u64(u64 u)
 {
     buffer b = little_stack_buffer(20);
@@ -54,12 +74,60 @@ static u64 intern_hash_u64()
     return result;
 }
 
+static symtab allocate_symtab(u64 size)
+{
+    bytes alloc_size = sizeof(struct symtab) + size * sizeof(struct symtab_entry);
+    symtab t = allocate(iheap, alloc_size);
+    if (t == INVALID_ADDRESS)
+        halt("intern: alloc fail\n");
+    zero(t, alloc_size);
+    t->mask = size - 1;
+    return t;
+}
+
+static symbol symtab_lookup(symtab t, string name, u64 hash)
+{
+    for (u64 i = hash & t->mask; ; i = (i + 1) & t->mask) {
+        struct symtab_entry *e = &t->entries[i];
+        symbol s = __atomic_load_n(&e->s, __ATOMIC_ACQUIRE);
+        if (!s)
+            return 0;
+        if ((e->hash == hash) && buffer_compare(s->s, name))
+            return s;
+    }
+}
+
+static void symtab_insert(symtab t, symbol s, u64 hash)
+{
+    u64 i;
+    for (i = hash & t->mask; t->entries[i].s; i = (i + 1) & t->mask);
+    t->entries[i].hash = hash;
+    __atomic_store_n(&t->entries[i].s, s, __ATOMIC_RELEASE);
+    t->count++;
+}
+
+static void symtab_grow(symtab t)
+{
+    symtab n = allocate_symtab(2 * (t->mask + 1));
+    for (u64 i = 0; i <= t->mask; i++) {
+        struct symtab_entry *e = &t->entries[i];
+        if (e->s)
+            symtab_insert(n, e->s, e->hash);
+    }
+    __atomic_store_n(&symbols, n, __ATOMIC_RELEASE);
+}
+
 symbol intern(string name)
 {
-    symbol s;
+    u64 hash = fnv64(name);
+    symbol s = symtab_lookup(__atomic_load_n(&symbols, __ATOMIC_ACQUIRE), name, hash);
+    if (s)
+        return s;
     sym_lock();
-    if (!(s = table_find(symbols, name))) {
-        // shouldnt really be on transient
+    symtab t = symbols;
+
+    /* the symbol may have been added since the lookup above */
+    if (!(s = symtab_lookup(t, name, hash))) {
         buffer b = allocate_buffer(iheap, buffer_length(name));
         if (b == INVALID_ADDRESS)
             goto alloc_fail;
@@ -69,7 +137,11 @@ symbol intern(string name)
             goto alloc_fail;
         s->k = intern_hash_u64();
         s->s = b;
-        table_set(symbols, b, s);
+        if (4 * (t->count + 1) > 3 * (t->mask + 1)) {
+            symtab_grow(t);
+            t = symbols;
+        }
+        symtab_insert(t, s, hash);
     }
     sym_unlock();
     return s;
@@ -92,7 +164,15 @@ void init_symbols(heap h, heap init)
 {
     sheap = h;
     iheap = init;    
-    symbols = allocate_table(iheap, fnv64, buffer_compare);
     sym_lock_init();
+
+    /* intern the symbols referenced with sym_const() up front, in a table sized for them */
+    u64 nconst = __stop_sym_const - __start_sym_const;
+    u64 size = SYMTAB_MIN_SIZE;
+    while (size < 2 * nconst)
+        size <<= 1;
+    symbols = allocate_symtab(size);
+    for (struct sym_const *sc = __start_sym_const; sc < __stop_sym_const; sc++)
+        sc->s = intern(alloca_wrap_buffer(sc->name.ptr, sc->name.len));
 }
 
@@ -10,6 +10,27 @@ string symbol_string(symbol s);
       if (!__s){char x[] = #name; __s = intern(alloca_wrap_buffer(x, sizeof(x)-1));} \
      __s;})              
 
+/* Symbol for a name known at build time, interned by init_symbols() so that a reference costs a
+ * load and no check: the name is recorded in the sym_const section, collected by the linker. Klibs
+ * are loaded without processing their sections, so there (as in the boot stages) it is equivalent
+ * to sym(). */
+struct sym_const {
+    sstring name;
+    symbol s;
+};
+
+#if defined(KLIB) || defined(BOOT)
+#define sym_const(__n)  sym(__n)
+#else
+#define sym_const(__n) ({                                                       \
+    static struct sym_const __sc                                                \
+    __attribute__((section("sym_const"), used, aligned(8))) = {                 \
+        .name = { .len = sizeof(#__n) - 1, .ptr = #__n },                       \
+    };                                                                          \
+    *(symbol volatile *)&__sc.s;                                                \
+})
+#endif
+
 #define sym_this(name)  ({                              \
     assert_string_literal(name);                        \
     intern(alloca_wrap_buffer(name, sizeof(name) - 1)); \
@@ -30,6 +30,191 @@ static boolean timer_compare_simple(void *za, void *zb)
     return ((timer)za)->expiry > ((timer)zb)->expiry;
 }
 
+#ifdef KERNEL
+/* Hierarchical timer wheels hold timers that tolerate some slack. Each level
+   has TIMER_WHEEL_SLOTS slots, and the slot granularity grows by a factor of
+   2^TIMER_WHEEL_LEVEL_ORDER from one level to the next, beginning at about
+   one millisecond. A timer is placed in the lowest level that spans its
+   expiry and fires at the end of its slot, so it is never early and at most
+   one slot granularity late (12.5% of the timeout for upper levels). There is
+   no cascading between levels; a timer popped from a slot before its expiry
+   is simply placed again. Timers whose slack does not allow the granularity
+   of the required level go to the exact pqueue tier. */
+#define TIMER_WHEEL_LEVELS      6
+#define TIMER_WHEEL_SLOTS_ORDER 6
+#define TIMER_WHEEL_SLOTS       U64_FROM_BIT(TIMER_WHEEL_SLOTS_ORDER)
+#define TIMER_WHEEL_LEVEL_ORDER 3
+#define TIMER_WHEEL_TICK_ORDER  22
+
+#define timer_wheel_shift(level)    (TIMER_WHEEL_TICK_ORDER + (level) * TIMER_WHEEL_LEVEL_ORDER)
+
+struct timer_wheel_level {
+    u64 clk;                    /* index of the last serviced slot */
+    u64 occupied;               /* bitmap of non-empty slots */
+    struct list slots[TIMER_WHEEL_SLOTS];
+};
+
+struct timer_wheel {
+    struct spinlock lock;
+    timestamp next_expiry;      /* infinity if empty */
+    struct timer_wheel_level levels[TIMER_WHEEL_LEVELS];
+};
+
+/* Only clocks which are not subject to steps can be bucketed by expiry. */
+static boolean timer_wheel_eligible(timer t)
+{
+    if (!t->slack)
+        return false;
+    switch (t->id) {
+    case CLOCK_ID_MONOTONIC:
+    case CLOCK_ID_MONOTONIC_RAW:
+    case CLOCK_ID_MONOTONIC_COARSE:
+    case CLOCK_ID_BOOTTIME:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Returns the level for a timer expiring delta from now, or -1 if the timer
+   slack does not allow the granularity of that level. */
+static int timer_wheel_level(timer t, timestamp delta)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = timer_wheel_shift(level);
+        if ((delta >> shift) >= TIMER_WHEEL_SLOTS - 1)
+            continue;
+        return (U64_FROM_BIT(shift) <= t->slack) ? level : -1;
+    }
+    return -1;
+}
+
+static void timer_wheel_place_locked(struct timer_wheel *w, timer t, timestamp here)
+{
+    timestamp expiry = timer_expiry(t);
+    timestamp delta = expiry > here ? expiry - here : 0;
+    int level = timer_wheel_level(t, delta);
+    if (level < 0)
+        level = TIMER_WHEEL_LEVELS - 1;
+    int shift = timer_wheel_shift(level);
+    struct timer_wheel_level *lvl = &w->levels[level];
+    u64 base = here >> shift;
+    if (!lvl->occupied && lvl->clk < base)
+        lvl->clk = base;
+
+    /* Round up so that the timer never fires early. If this level lags behind
+       the current time, the slot is clamped and the timer placed again once
+       popped. */
+    u64 idx = MAX((expiry + MASK(shift)) >> shift, lvl->clk + 1);
+    idx = MIN(idx, lvl->clk + TIMER_WHEEL_SLOTS - 1);
+    u64 slot = idx & MASK(TIMER_WHEEL_SLOTS_ORDER);
+    list_push_back(&lvl->slots[slot], &t->l);
+    lvl->occupied |= U64_FROM_BIT(slot);
+    t->level = level;
+    t->slot = slot;
+    timestamp slot_expiry = idx << shift;
+    if (slot_expiry < w->next_expiry)
+        w->next_expiry = slot_expiry;
+}
+
+static void timer_wheel_unlink_locked(struct timer_wheel *w, timer t)
+{
+    struct timer_wheel_level *lvl = &w->levels[t->level];
+    list_delete(&t->l);
+    if (list_empty(&lvl->slots[t->slot]))
+        lvl->occupied &= ~U64_FROM_BIT(t->slot);
+}
+
+static timestamp timer_wheel_next_locked(struct timer_wheel *w)
+{
+    timestamp next = infinity;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        struct timer_wheel_level *lvl = &w->levels[level];
+        if (!lvl->occupied)
+            continue;
+        u64 first = (lvl->clk + 1) & MASK(TIMER_WHEEL_SLOTS_ORDER);
+        u64 rot = first ? (lvl->occupied >> first) |
+            (lvl->occupied << (TIMER_WHEEL_SLOTS - first)) : lvl->occupied;
+        timestamp slot_expiry = (lvl->clk + 1 + lsb(rot)) << timer_wheel_shift(level);
+        if (slot_expiry < next)
+            next = slot_expiry;
+    }
+    return next;
+}
+
+/* Pop a timer from a slot that is due, advancing the level clocks. */
+static timer timer_wheel_pop_locked(struct timer_wheel *w, timestamp here)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        struct timer_wheel_level *lvl = &w->levels[level];
+        u64 target = here >> timer_wheel_shift(level);
+        while (lvl->clk < target) {
+            if (!lvl->occupied) {
+                lvl->clk = target;
+                break;
+            }
+            u64 slot = (lvl->clk + 1) & MASK(TIMER_WHEEL_SLOTS_ORDER);
+            if (lvl->occupied & U64_FROM_BIT(slot)) {
+                timer t = struct_from_list(list_get_next(&lvl->slots[slot]), timer, l);
+                timer_wheel_unlink_locked(w, t);
+                return t;
+            }
+            lvl->clk++;
+        }
+    }
+    return INVALID_ADDRESS;
+}
+
+static struct timer_wheel *timer_wheel_local(timerqueue tq)
+{
+    return &tq->wheels[current_cpu()->id % tq->nwheels];
+}
+
+boolean timerqueue_init_wheels(timerqueue tq, int nwheels)
+{
+    struct timer_wheel *wheels = allocate(tq->h, nwheels * sizeof(struct timer_wheel));
+    if (wheels == INVALID_ADDRESS)
+        return false;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    for (int i = 0; i < nwheels; i++) {
+        struct timer_wheel *w = &wheels[i];
+        spin_lock_init(&w->lock);
+        w->next_expiry = infinity;
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            struct timer_wheel_level *lvl = &w->levels[level];
+            lvl->clk = here >> timer_wheel_shift(level);
+            lvl->occupied = 0;
+            for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                list_init(&lvl->slots[slot]);
+        }
+    }
+    tq->wheels = wheels;
+    write_barrier();
+    tq->nwheels = nwheels;
+    return true;
+}
+#endif
+
+/* Called with the timerqueue lock held; sets the next expiry across the
+   pqueue and any timer wheels. */
+static void timerqueue_refresh_locked(timerqueue tq)
+{
+    timer next = pqueue_peek(tq->pq);
+    timestamp n = next != INVALID_ADDRESS ? timerqueue_expiry(tq, next) : infinity;
+#ifdef KERNEL
+    for (int i = 0; i < tq->nwheels; i++)
+        n = MIN(n, tq->wheels[i].next_expiry);
+#endif
+    if (n == infinity) {
+        tq->empty = true;
+        return;
+    }
+    if (n != tq->next_expiry)
+        tq->next_expiry = n;
+    tq->empty = false;
+    tq->update = true;
+}
+
 void register_timer(timerqueue tq, timer t, clock_id id,
                     timestamp val, boolean absolute, timestamp interval, timer_handler n)
 {
@@ -41,17 +226,81 @@ void register_timer(timerqueue tq, timer t, clock_id id,
     t->active = true;
     t->queued = true;
     t->handler = n;
+    t->wheel = -1;
+
+#ifdef KERNEL
+    if (tq->nwheels && !tq->now && timer_wheel_eligible(t)) {
+        timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+        timestamp expiry = timer_expiry(t);
+        if (timer_wheel_level(t, expiry > here ? expiry - here : 0) >= 0 &&
+            (!interval || timer_wheel_level(t, interval) >= 0)) {
+            struct timer_wheel *w = timer_wheel_local(tq);
+            spin_lock(&w->lock);
+            t->wheel = w - tq->wheels;
+            timestamp prev = w->next_expiry;
+            timer_wheel_place_locked(w, t, here);
+            boolean earliest = w->next_expiry < prev;
+            spin_unlock(&w->lock);
 
+            /* The timerqueue lock is only needed if the platform timer may
+               need to be re-programmed. */
+            if (earliest) {
+                timer_lock(tq);
+                timerqueue_refresh_locked(tq);
+                timer_unlock(tq);
+            }
+            timer_debug("register wheel timer: %p, expiry %T, interval %T, handler %p\n",
+                        t, t->expiry, interval, n);
+            return;
+        }
+    }
+#endif
     timer_lock(tq);
     pqueue_insert(tq->pq, t);
-    timer next = pqueue_peek(tq->pq);
-    refresh_timer_update_locked(tq, next);
+    timerqueue_refresh_locked(tq);
     timer_unlock(tq);
     timer_debug("register timer: %p, expiry %T, interval %T, handler %p\n", t, t->expiry, interval, n);
 }
 
+#ifdef KERNEL
+static boolean remove_wheel_timer(timerqueue tq, timer t, timestamp *remain)
+{
+    struct timer_wheel *w = &tq->wheels[t->wheel];
+    spin_lock(&w->lock);
+    timestamp x = t->expiry;
+
+    if (!t->active) {
+        assert(!t->queued);
+        spin_unlock(&w->lock);
+        return false;
+    }
+
+    t->active = false;
+    if (t->queued) {
+        t->queued = false;
+        timer_wheel_unlink_locked(w, t);
+        spin_unlock(&w->lock);
+        apply(t->handler, 0, timer_disabled);
+    } else {
+        /* see remove_timer() */
+        assert(t->interval != 0);
+        spin_unlock(&w->lock);
+    }
+
+    if (remain) {
+        timestamp n = timerqueue_now(tq, t);
+        *remain = x > n ? x - n : 0;
+    }
+    return true;
+}
+#endif
+
 boolean remove_timer(timerqueue tq, timer t, timestamp *remain)
 {
+#ifdef KERNEL
+    if (t->wheel >= 0)
+        return remove_wheel_timer(tq, t, remain);
+#endif
     timer_lock(tq);
     timestamp x = t->expiry;
 
@@ -86,6 +335,56 @@ boolean remove_timer(timerqueue tq, timer t, timestamp *remain)
     return true;
 }
 
+#ifdef KERNEL
+static void timer_wheel_service(timerqueue tq, struct timer_wheel *w, timestamp here)
+{
+    timer t;
+    s64 delta;
+    u64 overruns;
+
+    spin_lock(&w->lock);
+    if (w->next_expiry > here) {
+        spin_unlock(&w->lock);
+        return;
+    }
+    while ((t = timer_wheel_pop_locked(w, here)) != INVALID_ADDRESS) {
+        assert(t->active && t->queued);
+        delta = here - timerqueue_expiry(tq, t);
+        if (delta < 0) {
+            /* popped from a clamped slot */
+            timer_wheel_place_locked(w, t, here);
+            continue;
+        }
+        boolean interval = t->interval != 0;
+        if (interval) {
+            overruns = delta > t->interval ? delta / t->interval + 1 : 1;
+            t->expiry += t->interval * overruns;
+        } else {
+            overruns = 1;
+            t->active = false;
+        }
+        t->queued = false;
+        spin_unlock(&w->lock);
+        timer_debug("wheel timer %p: expiry %T, overruns %ld, delta %T, apply handler %p (%F)\n",
+                    t, timerqueue_expiry(tq, t), overruns, delta, t->handler, t->handler);
+        apply(t->handler, t->expiry, overruns);
+        spin_lock(&w->lock);
+        if (interval) {
+            if (t->active) {
+                t->queued = true;
+                timer_wheel_place_locked(w, t, here);
+            } else {
+                spin_unlock(&w->lock);
+                apply(t->handler, 0, timer_disabled);
+                spin_lock(&w->lock);
+            }
+        }
+    }
+    w->next_expiry = timer_wheel_next_locked(w);
+    spin_unlock(&w->lock);
+}
+#endif
+
 void timer_service(timerqueue tq, timestamp here)
 {
     timer t;
@@ -127,7 +426,17 @@ void timer_service(timerqueue tq, timestamp here)
             }
         }
     }
-    refresh_timer_update_locked(tq, t);
+#ifdef KERNEL
+    /* Wheels of all CPUs are serviced here, so timers need not migrate when
+       the CPU that registered them is idle. */
+    if (tq->nwheels) {
+        timer_unlock(tq);
+        for (int i = 0; i < tq->nwheels; i++)
+            timer_wheel_service(tq, &tq->wheels[i], here);
+        timer_lock(tq);
+    }
+#endif
+    timerqueue_refresh_locked(tq);
     timer_unlock(tq);
 }
 
@@ -153,7 +462,7 @@ void timer_adjust_end(timerqueue tq, pqueue_element_handler h)
 timerqueue allocate_timerqueue(heap h, clock_now now, sstring name)
 {
     timerqueue tq = allocate(h, sizeof(struct timerqueue));
-    tq->pq = allocate_pqueue(h, now ? timer_compare_simple : timer_compare);
+    tq->pq = allocate_pqueue_dary(h, now ? timer_compare_simple : timer_compare, 2);
     if (tq->pq == INVALID_ADDRESS) {
         deallocate(h, tq, sizeof(struct timerqueue));
         return INVALID_ADDRESS;
@@ -168,12 +477,18 @@ timerqueue allocate_timerqueue(heap h, clock_now now, sstring name)
     tq->next_expiry = 0;
     tq->service = 0;
     tq->min = tq->max = 0;
+    tq->wheels = 0;
+    tq->nwheels = 0;
 #endif
     return tq;
 }
 
 void deallocate_timerqueue(timerqueue tq)
 {
+#ifdef KERNEL
+    if (tq->nwheels)
+        deallocate(tq->h, tq->wheels, tq->nwheels * sizeof(struct timer_wheel));
+#endif
     deallocate_pqueue(tq->pq);
     deallocate(tq->h, tq, sizeof(struct timerqueue));
 }
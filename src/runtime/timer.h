@@ -23,9 +23,15 @@ typedef struct timer *timer;
 
 closure_type(timer_handler, void, u64 expiry, u64 overruns);
 
+#ifdef KERNEL
+struct timer_wheel;
+#endif
+
 typedef struct timerqueue {
 #ifdef KERNEL
     struct spinlock lock;
+    struct timer_wheel *wheels; /* per-CPU coarse tier, if enabled */
+    int nwheels;
 #endif
     heap h;
     pqueue pq;
@@ -51,18 +57,32 @@ struct timer {
     clock_id id;
     timestamp expiry;
     timestamp interval;
+    timestamp slack;            /* tolerated lateness; 0 for exact expiry */
     boolean absolute;
     boolean active;
     boolean queued;
+    s16 wheel;                  /* index of timer wheel, or -1 if in pqueue */
+    u8 level;
+    u8 slot;
+    struct list l;              /* embedding on timer wheel slot */
     timer_handler handler;
 };
 
 static inline void init_timer(timer t)
 {
+    t->slack = 0;
     t->active = false;
     t->queued = false;
 }
 
+/* A timer with a nonzero slack may expire up to slack past its expiry. This
+   allows it to be placed on a per-CPU timer wheel, where insertion and
+   removal are constant-time, rather than in the exactly-ordered pqueue. */
+static inline void timer_set_slack(timer t, timestamp slack)
+{
+    t->slack = slack;
+}
+
 static inline boolean timer_is_active(timer t)
 {
     return t->active;
@@ -134,19 +154,6 @@ static inline void timer_get_remaining(timerqueue tq, timer t, timestamp *remain
     *interval = t->interval;
 }
 
-static inline void refresh_timer_update_locked(timerqueue tq, timer next)
-{
-    if (next == INVALID_ADDRESS) {
-        tq->empty = true;
-        return;
-    }
-    timestamp n = timerqueue_expiry(tq, next);
-    if (n != tq->next_expiry)
-        tq->next_expiry = n;
-    tq->empty = false;
-    tq->update = true;
-}
-
 /* Returns true if timer was successfully removed from the timer queue. A
    return value of false means that the timer was not found in the queue.
    This could mean that the timer already fired or was previously
@@ -161,6 +168,9 @@ boolean remove_timer(timerqueue tq, timer t, timestamp *remain);
 timerqueue allocate_timerqueue(heap h, clock_now now, sstring name);
 void deallocate_timerqueue(timerqueue tq);
 void timer_service(timerqueue tq, timestamp here);
+#ifdef KERNEL
+boolean timerqueue_init_wheels(timerqueue tq, int nwheels);
+#endif
 void timer_reorder(timerqueue tq);
 
 void timer_adjust_begin(timerqueue tq);
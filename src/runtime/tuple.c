@@ -51,6 +51,122 @@ value indirect_integer_from_s64(s64 n)
     return (value)result;
 }
 
+/* Returns the index of the pair for attribute a if found, or else the index where it would be
+   inserted. */
+static u32 tuple_pair_index(struct table_tuple *tt, symbol a, boolean *found)
+{
+    u32 lo = 0, hi = tt->count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        symbol s = tt->pairs[mid].a;
+        if (s == a) {
+            *found = true;
+            return mid;
+        }
+        if (u64_from_pointer(s) < u64_from_pointer(a))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+static value table_tuple_get(struct table_tuple *tt, symbol a)
+{
+    if (tt->capacity == TUPLE_PROMOTED)
+        return table_find(tt->t, a);
+    boolean found;
+    u32 i = tuple_pair_index(tt, a, &found);
+    return found ? tt->pairs[i].v : 0;
+}
+
+static void table_tuple_promote(struct table_tuple *tt)
+{
+    tuple_debug("%s: tuple %p, %d attributes\n", func_ss, tt, tt->count);
+    table t = allocate_table(theap, key_from_symbol, pointer_equal);
+    if (t == INVALID_ADDRESS)
+        halt("%s: allocate fail\n", func_ss);
+    for (u32 i = 0; i < tt->count; i++)
+        table_set(t, tt->pairs[i].a, tt->pairs[i].v);
+    deallocate(theap, tt->pairs, tt->capacity * sizeof(struct tuple_pair));
+    tt->t = t;
+    tt->capacity = TUPLE_PROMOTED;
+}
+
+static void table_tuple_set(struct table_tuple *tt, symbol a, value v)
+{
+    if (tt->capacity == TUPLE_PROMOTED) {
+        table_set(tt->t, a, v);
+        return;
+    }
+    boolean found;
+    u32 i = tuple_pair_index(tt, a, &found);
+    if (found) {
+        if (v) {
+            tt->pairs[i].v = v;
+        } else {
+            tt->count--;
+            runtime_memcpy(&tt->pairs[i], &tt->pairs[i + 1],
+                           (tt->count - i) * sizeof(struct tuple_pair));
+        }
+        return;
+    }
+    if (!v)
+        return;
+    if (tt->count == tt->capacity) {
+        if (tt->capacity == TUPLE_INLINE_MAX) {
+            table_tuple_promote(tt);
+            table_set(tt->t, a, v);
+            return;
+        }
+        u32 capacity = tt->capacity ? tt->capacity * 2 : 2;
+        tuple_pair pairs = allocate(theap, capacity * sizeof(struct tuple_pair));
+        if (pairs == INVALID_ADDRESS)
+            halt("%s: allocate fail for %d pairs\n", func_ss, capacity);
+        if (tt->capacity) {
+            runtime_memcpy(pairs, tt->pairs, tt->count * sizeof(struct tuple_pair));
+            deallocate(theap, tt->pairs, tt->capacity * sizeof(struct tuple_pair));
+        }
+        tt->pairs = pairs;
+        tt->capacity = capacity;
+    }
+    runtime_memcpy(&tt->pairs[i + 1], &tt->pairs[i], (tt->count - i) * sizeof(struct tuple_pair));
+    tt->pairs[i].a = a;
+    tt->pairs[i].v = v;
+    tt->count++;
+}
+
+static boolean table_tuple_iterate(struct table_tuple *tt, binding_handler h)
+{
+    if (tt->capacity == TUPLE_PROMOTED) {
+        table_foreach(tt->t, a, v) {
+            if (!apply(h, a, v))
+                return false;
+        }
+        return true;
+    }
+
+    /* the handler may remove the current attribute, in which case the next one takes its place */
+    for (u32 i = 0; (tt->capacity != TUPLE_PROMOTED) && (i < tt->count);) {
+        symbol a = tt->pairs[i].a;
+        if (!apply(h, a, tt->pairs[i].v))
+            return false;
+        if ((i < tt->count) && (tt->pairs[i].a == a))
+            i++;
+    }
+    return true;
+}
+
+static void table_tuple_deallocate(struct table_tuple *tt)
+{
+    if (tt->capacity == TUPLE_PROMOTED)
+        deallocate_table(tt->t);
+    else if (tt->capacity)
+        deallocate(theap, tt->pairs, tt->capacity * sizeof(struct tuple_pair));
+    deallocate(theap, tt, sizeof(struct table_tuple));
+}
+
 value get(value e, value a)
 {
     u16 tag = tagof(e);
@@ -59,7 +175,7 @@ value get(value e, value a)
 
     switch (tag) {
     case tag_table_tuple:
-        return (a = sym_from_attribute(a)) ? table_find(&t->t, a) : 0;
+        return (a = sym_from_attribute(a)) ? table_tuple_get(&t->t, a) : 0;
     case tag_function_tuple:
         return apply(t->f.g, a);
     case tag_vector: {
@@ -82,7 +198,7 @@ void set(value e, value a, value v)
     switch (tag) {
     case tag_table_tuple:
         assert(a = sym_from_attribute(a));
-        table_set(&t->t, a, v);
+        table_tuple_set(&t->t, a, v);
         break;
     case tag_function_tuple:
         apply(t->f.s, a, v);
@@ -105,11 +221,7 @@ boolean iterate(value e, binding_handler h)
     validate_tag_type(func_ss, e, tag);
     switch (tag) {
     case tag_table_tuple:
-        table_foreach(&t->t, a, v) {
-            if (!apply(h, a, v))
-                return false;
-        }
-        return true;
+        return table_tuple_iterate(&t->t, h);
     case tag_function_tuple:
         return apply(t->f.i, h);
     case tag_vector: {
@@ -152,7 +264,7 @@ int tuple_count(tuple t)
     int count = 0;
     switch (tag) {
     case tag_table_tuple:
-        return t->t.count;
+        return t->t.capacity == TUPLE_PROMOTED ? table_elements(t->t.t) : t->t.count;
     case tag_function_tuple:
         apply(t->f.i, stack_closure(tuple_count_each, &count));
         return count;
@@ -196,7 +308,13 @@ static inline void srecord(table dictionary, void *x)
 // region?
 tuple allocate_tuple(void)
 {
-    return tag(allocate_table(theap, key_from_symbol, pointer_equal), tag_table_tuple);
+    struct table_tuple *tt = allocate(theap, sizeof(struct table_tuple));
+    if (tt == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    tt->count = 0;
+    tt->capacity = 0;
+    tt->pairs = 0;
+    return tag(tt, tag_table_tuple);
 }
 
 closure_function(1, 2, boolean, clone_tuple_each,
@@ -278,7 +396,7 @@ void timm_dealloc(tuple t)
 {
     if ((t != STATUS_OK) && (t != timm_oom)) {
         iterate(t, stack_closure(timm_dealloc_each, t));
-        deallocate_table(&t->t);
+        table_tuple_deallocate(&t->t);
     }
 }
 
@@ -690,7 +808,7 @@ void deallocate_value(value v)
         /* no safe way to dealloc symbols yet */
         break;
     case tag_table_tuple:
-        deallocate_table((table)v);
+        table_tuple_deallocate(&((tuple)v)->t);
         break;
     case tag_function_tuple:
         /* XXX No standard interface to remove function tuple...release a refcount? */
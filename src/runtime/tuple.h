@@ -13,8 +13,26 @@ typedef struct function_tuple {
     tuple_iterate i;
 } *function_tuple;
 
+/* A table-backed tuple holds up to TUPLE_INLINE_MAX attributes in an array of symbol/value pairs
+   sorted by symbol address, and is promoted to a hash table when more attributes are set. */
+typedef struct tuple_pair {
+    symbol a;
+    value v;
+} *tuple_pair;
+
+#define TUPLE_PROMOTED  ((u32)-1)
+
+struct table_tuple {
+    u32 count;          /* number of pairs (unused once promoted) */
+    u32 capacity;       /* allocated pairs, or TUPLE_PROMOTED if backed by a table */
+    union {
+        tuple_pair pairs;
+        table t;
+    };
+};
+
 union tuple {
-    struct table t;
+    struct table_tuple t;
     struct function_tuple f;
 };
 
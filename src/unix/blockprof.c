@@ -0,0 +1,560 @@
+/* Off-CPU (blocking) profiler
+ *
+ * Records the waits of threads parked on a blockq (socket, pipe, futex, poll and other waits): when
+ * a context blocks in blockq_check_timeout(), the time and the call chain of the blocking code are
+ * saved in the context; when an action is applied to the waiter (on wakeup, timeout or
+ * nullification), the wait time is accounted to the blockq name in a per-CPU log2 histogram, and a
+ * sample is recorded with the call chains of both the blocked code and the waking code. A waiter
+ * that resumes blocking after a spurious wakeup starts a new wait with the same blocked call chain.
+ *
+ * Samples and per-blockq statistics are stored in per-CPU buffers allocated when the profiler is
+ * initialized, so that the blockq paths never allocate memory. They are retrieved over HTTP:
+ *   curl http://<address>:9093/blockprof/start
+ *   curl http://<address>:9093/blockprof/stats
+ *   curl http://<address>:9093/blockprof/stacks
+ *   curl http://<address>:9093/blockprof/samples > out.perf
+ *   stackcollapse-perf.pl out.perf | flamegraph.pl --countname=ns > offcpu.svg
+ * "stats" lists blockqs by total wait time, "stacks" lists the blocked call chains with the
+ * highest total wait time, and "samples" streams and clears the samples in the text format
+ * produced by `perf script`, weighted by wait time in nanoseconds (event "off-cpu"). In a sample,
+ * the blocked chain is followed by a frame naming the blockq and how the wait ended, then by the
+ * waker chain in reverse order, so that flame graphs show the waker on top of the blocked code.
+ *
+ * Optional settings in the manifest root, e.g. "blockprof:(min_wait:1000 start:t)": waits shorter
+ * than min_wait microseconds are counted in the statistics but not sampled, and start enables the
+ * profiler from boot.
+ */
+
+#include <unix_internal.h>
+#include <http.h>
+#include <symtab.h>
+
+#define BLOCKPROF_PORT              9093
+#define BLOCKPROF_URI               "blockprof"
+#define BLOCKPROF_QUEUES            128     /* per-CPU blockq statistics slots */
+#define BLOCKPROF_PROBES            8
+#define BLOCKPROF_SAMPLES_PER_CPU   1024
+#define BLOCKPROF_HIST_BUCKETS      24
+#define BLOCKPROF_HIST_MIN_ORDER    10      /* first bucket: waits below 1024 ns */
+#define BLOCKPROF_TOP_STACKS        32
+#define BLOCKPROF_HTTP_CHUNK_MAXSIZE    (64*KB)
+
+typedef struct blockprof_sample {
+    timestamp ts;
+    u64 wait;                   /* nanoseconds */
+    sstring name;
+    int tid;                    /* 0 for kernel contexts */
+    int waker_tid;
+    u64 flags;                  /* BLOCKQ_ACTION_* */
+    u8 depth;
+    u8 waker_depth;
+    char comm[16];
+    u64 pcs[BLOCKPROF_MAX_DEPTH];
+    u64 waker_pcs[BLOCKPROF_MAX_DEPTH];
+} *blockprof_sample;
+
+typedef struct blockprof_queue {
+    sstring name;
+    u64 waits;
+    u64 wait_total;
+    u64 wait_max;
+    u64 timeouts;
+    u64 nullified;
+    u64 hist[BLOCKPROF_HIST_BUCKETS];
+} *blockprof_queue;
+
+typedef struct blockprof_cpu {
+    boolean busy;               /* guards against recording from nested wakeups */
+    u64 nsamples;
+    u64 dropped;
+    blockprof_sample samples;
+    blockprof_queue queues;
+} *blockprof_cpu;
+
+typedef struct blockprof_stack {
+    blockprof_sample s;         /* first sample with this blocked chain */
+    u64 waits;
+    u64 wait_total;
+} *blockprof_stack;
+
+boolean blockprof_enabled;
+
+static struct {
+    heap h;
+    timestamp min_wait;
+    blockprof_cpu cpus;
+    u64 dropped_queues;
+    http_listener hl;
+} blockprof;
+
+static int blockprof_save_stack(u64 *pcs)
+{
+    u64 *fp = get_current_fp();
+    int depth = 0;
+    while (depth < BLOCKPROF_MAX_DEPTH) {
+        if (!is_kernel_memory(fp) || (u64_from_pointer(fp) & (sizeof(u64) - 1)))
+            break;
+        u64 *nfp;
+        u64 *rap = get_frame_ra_ptr(fp, &nfp);
+        if (!rap || (*rap == 0))
+            break;
+        pcs[depth++] = *rap;
+        if (nfp <= fp)
+            break;
+        fp = nfp;
+    }
+    return depth;
+}
+
+static thread blockprof_context_thread(context ctx)
+{
+    switch (ctx->type) {
+    case CONTEXT_TYPE_THREAD:
+        return (thread)ctx;
+    case CONTEXT_TYPE_SYSCALL:
+        return ((syscall_context)ctx)->t;
+    default:
+        return 0;
+    }
+}
+
+/* Called with the context locked, before it is queued on a blockq */
+void blockprof_block(unix_context t)
+{
+    struct blockprof_wait *w = &t->bq_prof;
+    if (!blockprof_enabled) {
+        w->start = 0;
+        return;
+    }
+    w->depth = blockprof_save_stack(w->pcs);
+    w->start = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+/* A waiter resumes blocking after an action found that it could not proceed. */
+void blockprof_rewait(unix_context t)
+{
+    if (blockprof_enabled)
+        t->bq_prof.start = now(CLOCK_ID_MONOTONIC_RAW);
+}
+
+static blockprof_queue blockprof_lookup(blockprof_cpu pc, sstring name)
+{
+    u64 h = (u64_from_pointer(name.ptr) >> 3) * 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < BLOCKPROF_PROBES; i++) {
+        blockprof_queue q = &pc->queues[(h + i) % BLOCKPROF_QUEUES];
+        if (q->name.ptr == name.ptr)
+            return q;
+        if (!q->name.ptr) {
+            q->name = name;
+            return q;
+        }
+    }
+    fetch_and_add(&blockprof.dropped_queues, 1);
+    return 0;
+}
+
+static void blockprof_record(blockprof_cpu pc, blockq bq, unix_context t, u64 bq_flags,
+                             timestamp here, u64 wait)
+{
+    u64 n = pc->nsamples;
+    if (n == BLOCKPROF_SAMPLES_PER_CPU) {
+        pc->dropped++;
+        return;
+    }
+    blockprof_sample s = &pc->samples[n];
+    s->ts = here;
+    s->wait = wait;
+    s->name = blockq_name(bq);
+    s->flags = bq_flags;
+    thread th = blockprof_context_thread(&t->kc.context);
+    if (th) {
+        s->tid = th->tid;
+        runtime_memcpy(s->comm, th->name, sizeof(s->comm));
+        s->comm[sizeof(s->comm) - 1] = '\0';
+    } else {
+        s->tid = 0;
+        runtime_memcpy(s->comm, "kernel", sizeof("kernel"));
+    }
+    s->depth = t->bq_prof.depth;
+    runtime_memcpy(s->pcs, t->bq_prof.pcs, s->depth * sizeof(u64));
+    thread waker = blockprof_context_thread(get_current_context(current_cpu()));
+    s->waker_tid = waker ? waker->tid : 0;
+    s->waker_depth = blockprof_save_stack(s->waker_pcs);
+    write_barrier();
+    pc->nsamples = n + 1;
+}
+
+/* Called when an action is applied to a waiter, in the context of the waker */
+void blockprof_wake(blockq bq, unix_context t, u64 bq_flags)
+{
+    timestamp start = t->bq_prof.start;
+    if (!start)
+        return;
+    t->bq_prof.start = 0;
+    blockprof_cpu pc = &blockprof.cpus[current_cpu()->id];
+    if (!blockprof_enabled || pc->busy)
+        return;
+    pc->busy = true;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    timestamp elapsed = (here > start) ? here - start : 0;
+    u64 wait = nsec_from_timestamp(elapsed);
+    blockprof_queue q = blockprof_lookup(pc, blockq_name(bq));
+    if (q) {
+        q->waits++;
+        q->wait_total += wait;
+        if (wait > q->wait_max)
+            q->wait_max = wait;
+        if (bq_flags & BLOCKQ_ACTION_TIMEDOUT)
+            q->timeouts++;
+        if (bq_flags & BLOCKQ_ACTION_NULLIFY)
+            q->nullified++;
+        int order = wait ? msb(wait) : 0;
+        int bucket = (order < BLOCKPROF_HIST_MIN_ORDER) ? 0 : order - BLOCKPROF_HIST_MIN_ORDER + 1;
+        q->hist[MIN(bucket, BLOCKPROF_HIST_BUCKETS - 1)]++;
+    }
+    if (elapsed >= blockprof.min_wait)
+        blockprof_record(pc, bq, t, bq_flags, here, wait);
+    pc->busy = false;
+}
+
+static void blockprof_start(void)
+{
+    blockprof_enabled = true;
+}
+
+static void blockprof_stop(void)
+{
+    blockprof_enabled = false;
+}
+
+static void blockprof_reset(void)
+{
+    blockprof_stop();
+    for (u64 i = 0; i < total_processors; i++) {
+        blockprof_cpu pc = &blockprof.cpus[i];
+        pc->nsamples = 0;
+        pc->dropped = 0;
+        zero(pc->queues, BLOCKPROF_QUEUES * sizeof(struct blockprof_queue));
+    }
+    blockprof.dropped_queues = 0;
+}
+
+static sstring blockprof_wake_reason(u64 flags)
+{
+    if (flags & BLOCKQ_ACTION_TIMEDOUT)
+        return ss("timeout");
+    if (flags & BLOCKQ_ACTION_NULLIFY)
+        return ss("nullify");
+    return ss("wakeup");
+}
+
+static void blockprof_print_frame(buffer b, u64 pc)
+{
+    u64 offset, len;
+    sstring name = find_elf_sym(pc, &offset, &len);
+    if (sstring_is_null(name))
+        bprintf(b, "\t%16lx [unknown] ([kernel.kallsyms])\n", pc);
+    else
+        bprintf(b, "\t%16lx %s+0x%lx ([kernel.kallsyms])\n", pc, name, offset);
+}
+
+static void blockprof_print_sample(buffer b, int cpu, blockprof_sample s)
+{
+    u64 usec = usec_from_timestamp(s->ts);
+    bprintf(b, "%s %d [%03d] %ld.%06ld: %ld off-cpu:\n",
+            sstring_from_cstring(s->comm, sizeof(s->comm)), s->tid, cpu, usec / MILLION,
+            usec % MILLION, MAX(s->wait, 1));
+    for (int i = s->waker_depth - 1; i >= 0; i--)
+        blockprof_print_frame(b, s->waker_pcs[i]);
+    bprintf(b, "\t%16lx [%s:%s:%d] ([kernel.kallsyms])\n", 0ull, s->name,
+            blockprof_wake_reason(s->flags), s->waker_tid);
+    for (int i = 0; i < s->depth; i++)
+        blockprof_print_frame(b, s->pcs[i]);
+    bprintf(b, "\n");
+}
+
+#define catch_err(s) do {if (!is_ok(s)) msg_err("blockprof: failed to send HTTP response: %v\n", (s));} while(0)
+
+static void blockprof_send_http_response(http_responder handler, buffer b)
+{
+    catch_err(send_http_response(handler, timm("ContentType", "text/plain"), b));
+}
+
+static void blockprof_send_http_error(http_responder handler, sstring status, sstring msg)
+{
+    buffer b = aprintf(blockprof.h, "<html><head><title>%s %s</title></head>"
+                       "<body><h1>%s</h1></body></html>\r\n", status, msg, msg);
+    catch_err(send_http_response(handler, timm("status", "%s %s", status, msg), b));
+}
+
+static buffer blockprof_chunk(http_responder out, buffer b)
+{
+    if (b && (buffer_length(b) > BLOCKPROF_HTTP_CHUNK_MAXSIZE - 4*KB)) {
+        send_http_chunk(out, b);
+        b = 0;
+    }
+    if (!b) {
+        b = allocate_buffer(blockprof.h, BLOCKPROF_HTTP_CHUNK_MAXSIZE);
+        assert(b != INVALID_ADDRESS);
+    }
+    return b;
+}
+
+/* Recording is suspended while samples are being sent, so that the per-CPU buffers are stable;
+ * the buffers are cleared afterwards, so that successive requests stream new samples. */
+static void blockprof_send_samples(http_responder out)
+{
+    boolean enabled = blockprof_enabled;
+    blockprof_stop();
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = 0;
+    u64 dropped = 0;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        blockprof_cpu pc = &blockprof.cpus[cpu];
+        u64 n = pc->nsamples;
+        read_barrier();
+        dropped += pc->dropped;
+        for (u64 i = 0; i < n; i++) {
+            b = blockprof_chunk(out, b);
+            blockprof_print_sample(b, cpu, &pc->samples[i]);
+        }
+        pc->nsamples = 0;
+        pc->dropped = 0;
+    }
+    if (b)
+        send_http_chunk(out, b);
+    if (dropped)
+        msg_warn("blockprof: %ld samples dropped\n", dropped);
+    send_http_chunk(out, 0);
+    if (enabled)
+        blockprof_start();
+}
+
+static boolean blockprof_queue_compare(void *a, void *b)
+{
+    return ((blockprof_queue)a)->wait_total < ((blockprof_queue)b)->wait_total;
+}
+
+/* Per-blockq statistics, merged across CPUs by name and sorted by total wait time */
+static void blockprof_send_stats(http_responder out)
+{
+    int max = total_processors * BLOCKPROF_QUEUES;
+    blockprof_queue merged = allocate_zero(blockprof.h, max * sizeof(struct blockprof_queue));
+    pqueue pq = allocate_pqueue(blockprof.h, blockprof_queue_compare);
+    if ((merged == INVALID_ADDRESS) || (pq == INVALID_ADDRESS)) {
+        if (merged != INVALID_ADDRESS)
+            deallocate(blockprof.h, merged, max * sizeof(struct blockprof_queue));
+        blockprof_send_http_error(out, ss("500"), ss("Internal Server Error"));
+        return;
+    }
+    int count = 0;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        blockprof_queue queues = blockprof.cpus[cpu].queues;
+        for (int i = 0; i < BLOCKPROF_QUEUES; i++) {
+            blockprof_queue q = &queues[i];
+            if (!q->name.ptr)
+                continue;
+            /* blockqs with the same name share an entry, even if the name strings differ */
+            blockprof_queue m;
+            int j;
+            for (j = 0; j < count; j++) {
+                if (!runtime_strcmp(merged[j].name, q->name))
+                    break;
+            }
+            m = &merged[j];
+            if (j == count) {
+                m->name = q->name;
+                count++;
+            }
+            m->waits += q->waits;
+            m->wait_total += q->wait_total;
+            m->wait_max = MAX(m->wait_max, q->wait_max);
+            m->timeouts += q->timeouts;
+            m->nullified += q->nullified;
+            for (int k = 0; k < BLOCKPROF_HIST_BUCKETS; k++)
+                m->hist[k] += q->hist[k];
+        }
+    }
+    for (int j = 0; j < count; j++)
+        pqueue_insert(pq, &merged[j]);
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = blockprof_chunk(out, 0);
+    bprintf(b, "# %ld blockqs dropped\n"
+            "# blockq waits wait_total_ns wait_max_ns timeouts nullified "
+            "wait_histogram(<%ldns, doubling)\n", blockprof.dropped_queues,
+            U64_FROM_BIT(BLOCKPROF_HIST_MIN_ORDER));
+    blockprof_queue q;
+    while ((q = pqueue_pop(pq)) != INVALID_ADDRESS) {
+        b = blockprof_chunk(out, b);
+        bprintf(b, "%s %ld %ld %ld %ld %ld ", q->name, q->waits, q->wait_total, q->wait_max,
+                q->timeouts, q->nullified);
+        for (int k = 0; k < BLOCKPROF_HIST_BUCKETS; k++)
+            bprintf(b, "%ld%c", q->hist[k], (k < BLOCKPROF_HIST_BUCKETS - 1) ? ',' : '\n');
+    }
+    deallocate_pqueue(pq);
+    deallocate(blockprof.h, merged, max * sizeof(struct blockprof_queue));
+    send_http_chunk(out, b);
+    send_http_chunk(out, 0);
+}
+
+static u64 blockprof_stack_key(blockprof_sample s)
+{
+    u64 key = u64_from_pointer(s->name.ptr);
+    for (int i = 0; i < s->depth; i++)
+        key = (key ^ s->pcs[i]) * 0x100000001b3ull;
+    return key;
+}
+
+static boolean blockprof_same_stack(blockprof_sample a, blockprof_sample b)
+{
+    return (a->name.ptr == b->name.ptr) && (a->depth == b->depth) &&
+        !runtime_memcmp(a->pcs, b->pcs, a->depth * sizeof(u64));
+}
+
+static boolean blockprof_stack_compare(void *a, void *b)
+{
+    return ((blockprof_stack)a)->wait_total < ((blockprof_stack)b)->wait_total;
+}
+
+/* Blocked call chains of the recorded samples with the highest total wait time; unlike
+ * "samples", this does not clear the sample buffers. */
+static void blockprof_send_stacks(http_responder out)
+{
+    boolean enabled = blockprof_enabled;
+    blockprof_stop();
+    table stacks = allocate_table(blockprof.h, identity_key, pointer_equal);
+    pqueue pq = allocate_pqueue(blockprof.h, blockprof_stack_compare);
+    if ((stacks == INVALID_ADDRESS) || (pq == INVALID_ADDRESS)) {
+        if (stacks != INVALID_ADDRESS)
+            deallocate_table(stacks);
+        blockprof_send_http_error(out, ss("500"), ss("Internal Server Error"));
+        goto out;
+    }
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        blockprof_cpu pc = &blockprof.cpus[cpu];
+        u64 n = pc->nsamples;
+        read_barrier();
+        for (u64 i = 0; i < n; i++) {
+            blockprof_sample s = &pc->samples[i];
+            /* on a hash collision between different chains, the chain is accounted separately */
+            u64 key = blockprof_stack_key(s);
+            blockprof_stack st;
+            while ((st = table_find(stacks, pointer_from_u64(key))) &&
+                   !blockprof_same_stack(st->s, s))
+                key++;
+            if (!st) {
+                st = allocate_zero(blockprof.h, sizeof(*st));
+                assert(st != INVALID_ADDRESS);
+                st->s = s;
+                table_set(stacks, pointer_from_u64(key), st);
+            }
+            st->waits++;
+            st->wait_total += s->wait;
+        }
+    }
+    table_foreach(stacks, k, st) {
+        (void)k;
+        pqueue_insert(pq, st);
+    }
+    deallocate_table(stacks);
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = blockprof_chunk(out, 0);
+    blockprof_stack st;
+    int printed = 0;
+    while ((st = pqueue_pop(pq)) != INVALID_ADDRESS) {
+        if (printed++ < BLOCKPROF_TOP_STACKS) {
+            b = blockprof_chunk(out, b);
+            bprintf(b, "%s: %ld waits, %ld ns\n", st->s->name, st->waits, st->wait_total);
+            for (int i = 0; i < st->s->depth; i++)
+                blockprof_print_frame(b, st->s->pcs[i]);
+            bprintf(b, "\n");
+        }
+        deallocate(blockprof.h, st, sizeof(*st));
+    }
+    deallocate_pqueue(pq);
+    send_http_chunk(out, b);
+    send_http_chunk(out, 0);
+  out:
+    if (enabled)
+        blockprof_start();
+}
+
+closure_func_basic(http_request_handler, void, blockprof_http_request,
+                   http_method method, http_responder handler, value val)
+{
+    string relative_uri = get_string(val, sym(relative_uri));
+    if (!relative_uri) {
+        blockprof_send_http_error(handler, ss("500"), ss("Internal Server Error"));
+        return;
+    }
+    if (method != HTTP_REQUEST_METHOD_GET) {
+        blockprof_send_http_error(handler, ss("501"), ss("Not Implemented"));
+        return;
+    }
+    if (!buffer_strcmp(relative_uri, "samples")) {
+        blockprof_send_samples(handler);
+    } else if (!buffer_strcmp(relative_uri, "stats")) {
+        blockprof_send_stats(handler);
+    } else if (!buffer_strcmp(relative_uri, "stacks")) {
+        blockprof_send_stacks(handler);
+    } else if (!buffer_strcmp(relative_uri, "start")) {
+        blockprof_start();
+        blockprof_send_http_response(handler, aprintf(blockprof.h,
+            "blocking profiling started, minimum sampled wait %ld us\n",
+            usec_from_timestamp(blockprof.min_wait)));
+    } else if (!buffer_strcmp(relative_uri, "stop")) {
+        blockprof_stop();
+        blockprof_send_http_response(handler, aprintf(blockprof.h,
+                                                      "blocking profiling stopped\n"));
+    } else if (!buffer_strcmp(relative_uri, "reset")) {
+        blockprof_reset();
+        blockprof_send_http_response(handler, aprintf(blockprof.h,
+            "blocking profiling stopped, statistics cleared\n"));
+    } else {
+        blockprof_send_http_error(handler, ss("404"), ss("Not Found"));
+    }
+}
+
+static void blockprof_init_http_listener(void)
+{
+    blockprof.hl = allocate_http_listener(blockprof.h, BLOCKPROF_PORT);
+    if (blockprof.hl == INVALID_ADDRESS) {
+        msg_err("could not allocate blockprof HTTP listener\n");
+        return;
+    }
+    http_register_uri_handler(blockprof.hl, ss(BLOCKPROF_URI),
+                              closure_func(blockprof.h, http_request_handler,
+                                           blockprof_http_request));
+    status s = listen_port(blockprof.h, BLOCKPROF_PORT,
+                           connection_handler_from_http_listener(blockprof.hl));
+    if (!is_ok(s)) {
+        msg_err("listen_port(port=%d) failed for blockprof HTTP listener\n", BLOCKPROF_PORT);
+        deallocate_http_listener(blockprof.h, blockprof.hl);
+        return;
+    }
+    rprintf("started blockprof http listener on port %d\n", BLOCKPROF_PORT);
+}
+
+void blockprof_init(kernel_heaps kh, tuple root)
+{
+    blockprof.h = heap_locked(kh);
+    tuple config = get_tuple(root, sym(blockprof));
+    if (config) {
+        u64 min_wait;
+        if (get_u64(config, sym(min_wait), &min_wait))
+            blockprof.min_wait = microseconds(min_wait);
+    }
+    blockprof.cpus = allocate_zero(blockprof.h, present_processors * sizeof(struct blockprof_cpu));
+    assert(blockprof.cpus != INVALID_ADDRESS);
+    heap backed = (heap)heap_page_backed(kh);
+    for (u64 i = 0; i < present_processors; i++) {
+        blockprof_cpu pc = &blockprof.cpus[i];
+        pc->samples = allocate(backed, BLOCKPROF_SAMPLES_PER_CPU * sizeof(struct blockprof_sample));
+        assert(pc->samples != INVALID_ADDRESS);
+        pc->queues = allocate_zero(backed, BLOCKPROF_QUEUES * sizeof(struct blockprof_queue));
+        assert(pc->queues != INVALID_ADDRESS);
+    }
+    blockprof_init_http_listener();
+    if (config && get(config, sym(start)))
+        blockprof_start();
+}
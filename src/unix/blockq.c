@@ -46,6 +46,10 @@
 #define blockq_lock(bq) spin_lock(&bq->lock)
 #define blockq_unlock(bq) spin_unlock(&bq->lock)
 
+/* Relative timeouts may expire up to 1/2^BLOCKQ_TIMER_SLACK_ORDER of the
+   timeout late, which lets them be kept on the per-CPU timer wheels. */
+#define BLOCKQ_TIMER_SLACK_ORDER 3
+
 /* This applies a blockq action after it has been removed from the waiters
    list. If the action cannot wake the thread and must continue blocking, it
    needs to re-add itself to the queue (and reinstate any remaining timeout). */
@@ -58,6 +62,9 @@ static void blockq_apply(blockq bq, unix_context t, u64 bq_flags)
                  (bq_flags & BLOCKQ_ACTION_TIMEDOUT) ? ss("timedout") : sstring_empty());
 
     assert(t->blocked_on == bq);
+#ifdef CONFIG_BLOCKPROF
+    blockprof_wake(bq, t, bq_flags);
+#endif
     async_apply_1((async_1)t->bq_action, (void *)bq_flags); /* bq_action retval ignored */
 }
 
@@ -161,6 +168,9 @@ void blockq_resume_blocking(blockq bq, unix_context t)
 {
     blockq_lock(bq);
     list_insert_before(&bq->waiters_head, &t->bq_l);
+#ifdef CONFIG_BLOCKPROF
+    blockprof_rewait(t);
+#endif
     if (t->bq_remain_at_wake) {
         timestamp tr = t->bq_remain_at_wake;
         t->bq_remain_at_wake = 0;
@@ -217,11 +227,16 @@ sysreturn blockq_check_timeout(blockq bq, blockq_action a, boolean in_bh,
     blockq_lock(bq);
     thread_lock(t);
     t->bq_action = a;
-    if (!in_bh)
+    if (!in_bh) {
         t->blocked_on = bq;
+#ifdef CONFIG_BLOCKPROF
+        blockprof_block(t);
+#endif
+    }
     if (timeout > 0) {
         t->bq_timer_pending = true;
         t->bq_clkid = clkid;
+        timer_set_slack(&t->bq_timer, absolute ? 0 : timeout >> BLOCKQ_TIMER_SLACK_ORDER);
         register_timer(kernel_timers, &t->bq_timer, clkid, timeout, absolute, 0,
                        init_closure(&t->bq_timeout_func, blockq_thread_timeout, bq));
     } else {
@@ -268,6 +283,45 @@ void blockq_flush(blockq bq)
     } while (1);
 }
 
+/* Wake up to n waiters whose action is accepted by the filter, returning the
+   number of actions applied. Waiters whose timeout has fired but not yet been
+   serviced are skipped. */
+int blockq_wake_matching(blockq bq, int n, blockq_action_filter filter)
+{
+    int woken = 0;
+    blockq_debug("bq %p (\"%s\") n %d\n", bq, blockq_name(bq), n);
+    blockq_lock(bq);
+    list_foreach(&bq->waiters_head, l) {
+        if (woken >= n)
+            break;
+        unix_context t = struct_from_list(l, unix_context, bq_l);
+        if (!apply(filter, t->bq_action))
+            continue;
+        thread_lock(t);
+        if (t->bq_timer_pending) {
+            if (!remove_timer(kernel_timers, &t->bq_timer, &t->bq_remain_at_wake)) {
+                thread_unlock(t);
+                continue;
+            }
+            t->bq_timer_pending = false;
+        } else {
+            t->bq_remain_at_wake = 0;
+        }
+        list_delete(&t->bq_l);
+        thread_unlock(t);
+        blockq_apply(bq, t, BLOCKQ_ACTION_BLOCKED);
+        woken++;
+    }
+
+    /* As with blockq_wake_one(), cover a waiter which is about to be queued. */
+    if (!woken) {
+        bq->wake = true;
+        write_barrier();
+    }
+    blockq_unlock(bq);
+    return woken;
+}
+
 int blockq_transfer_waiters(blockq dest, blockq src, int n, blockq_action_handler handler)
 {
     int transferred = 0;
@@ -319,6 +373,9 @@ void blockq_thread_init(unix_context t)
     init_timer(&t->bq_timer);
     t->bq_action = 0;
     t->bq_l.prev = t->bq_l.next = 0;
+#ifdef CONFIG_BLOCKPROF
+    t->bq_prof.start = 0;
+#endif
     spin_lock_init(&t->lock);
 }
 
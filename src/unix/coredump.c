@@ -2,7 +2,19 @@
 #include <filesystem.h>
 #include <elf64.h>
 
-#define CORE_PATH "/coredumps/core"
+#define CORE_PATH       "/coredumps/core"
+#define CORE_LZ4_PATH   "/coredumps/core.lz4"
+
+/* Memory segments are written in chunks of (at most) this size. */
+#define COREDUMP_CHUNK_SIZE MB
+
+/* LZ4 frame format: independent blocks of up to 1 MB, no checksums */
+#define LZ4F_MAGIC              0x184d2204
+#define LZ4F_FLG                0x60
+#define LZ4F_BD                 0x60
+#define LZ4F_HC                 0x51    /* second byte of the xxHash-32 of FLG and BD */
+#define LZ4F_HDR_SIZE           7
+#define LZ4F_BLOCK_UNCOMPRESSED 0x80000000
 
 //#define COREDUMP_DEBUG
 #ifdef COREDUMP_DEBUG
@@ -59,6 +71,7 @@ struct elf_prstatus {
 };
 
 static u64 coredump_limit;
+static boolean coredump_compress;
 
 void coredump_set_limit(u64 s)
 {
@@ -71,6 +84,37 @@ u64 coredump_get_limit(void)
     return coredump_limit;
 }
 
+void coredump_set_compression(boolean compress)
+{
+    coredump_compress = compress;
+}
+
+/* Writer state: memory segments are streamed in chunks, each written after the previous one has
+ * completed, so that the amount of memory referenced by in-flight I/O is bounded. Without
+ * compression, pages that are not mapped (i.e. have never been touched) or contain only zeros are
+ * not written, and are left as holes in the core file; with compression, the core file contents are
+ * written as an LZ4 frame to a separate file. */
+typedef struct coredump_writer {
+    heap h;
+    fsfile f;
+    sg_io write;
+    sg_list sg;
+    buffer hdr;
+    Elf64_Phdr *phdr;       /* next memory segment to be written */
+    Elf64_Phdr *phdr_end;
+    u64 pos;                /* offset in the core file of the next data to be written */
+    u64 size;               /* size of the core file */
+    u64 out_offset;         /* offset in the LZ4 frame of the next block */
+    u64 limit;
+    boolean compress;
+    u8 *chunk;
+    u8 *out;
+    u32 *lz4_table;
+    status_handler completion;
+    closure_struct(status_handler, write_done);
+    closure_struct(status_handler, next);
+} *coredump_writer;
+
 static void add_to_sgl(sg_list sgl, void *b, u64 len)
 {
     sg_buf sgb = sg_list_tail_add(sgl, len);
@@ -81,13 +125,20 @@ static void add_to_sgl(sg_list sgl, void *b, u64 len)
     sgb->size = len;
 }
 
-/* touch every page to page it in */
-static void pagein(range q)
+static boolean coredump_page_mapped(u64 va)
 {
-    for (u64 p = q.start; p < q.end; p += PAGESIZE) {
-        volatile u64 x = *(u64 *)pointer_from_u64(p);
-        (void)x;
-    }
+    return (physical_from_virtual(pointer_from_u64(va)) != INVALID_PHYSICAL);
+}
+
+static boolean coredump_page_has_data(u64 va)
+{
+    if (!coredump_page_mapped(va))
+        return false;
+    u64 *p = pointer_from_u64(va);
+    for (int i = 0; i < PAGESIZE / sizeof(u64); i++)
+        if (p[i])
+            return true;
+    return false;
 }
 
 static u64 vmflags_to_pflags(u64 vmflags)
@@ -143,11 +194,9 @@ static boolean add_thread_status(buffer b, thread t, struct siginfo *si)
 
 #ifdef __x86_64__
 #define XCR0_OFFSET 464     /* points into sw_reserved of fxregs_state */
-    extern u8 use_xsave;
     if (use_xsave) {
         u8 *xs = add_note(b, ss("LINUX"), NT_X86_XSTATE, extended_frame_size);
-        runtime_memcpy(xs, pointer_from_u64(thread_frame(t)[FRAME_EXTENDED]),
-            extended_frame_size);
+        xstate_copy_out(xs, frame_extended(thread_frame(t)), extended_frame_size);
         u32 v[2];
         xgetbv(0, &v[0], &v[1]);
         *(u64 *)(xs + XCR0_OFFSET) = (u64)v[0] | (((u64)v[1])<<32);
@@ -170,47 +219,152 @@ closure_function(3, 1, boolean, additional_threads_status,
     return add_thread_status(bound(b), t, bound(si));
 }
 
-closure_function(2, 1, void, dump_complete,
-                 fsfile, f, status_handler, completion,
-                 status s)
+static void coredump_finish(coredump_writer cw, status s)
+{
+    if (is_ok(s) && (cw->pos < cw->size))
+        s = timm("result", "core dump truncated; limit reached");
+    fsfile_release(cw->f);
+    deallocate_sg_list(cw->sg);
+    deallocate_buffer(cw->hdr);
+    if (cw->compress) {
+        deallocate(cw->h, cw->chunk, COREDUMP_CHUNK_SIZE);
+        deallocate(cw->h, cw->out, LZ4F_HDR_SIZE + sizeof(u32) + COREDUMP_CHUNK_SIZE + sizeof(u32));
+        deallocate(cw->h, cw->lz4_table, LZ4_COMPRESS_TABLE_SIZE);
+    }
+    core_debug("calling final completion\n");
+    apply(cw->completion, s);
+    deallocate(cw->h, cw, sizeof(*cw));
+}
+
+static void coredump_write(coredump_writer cw, void *buf, u64 len, u64 offset)
 {
-    fsfile_release(bound(f));
-    apply(bound(completion), s);
-    closure_finish();
+    add_to_sgl(cw->sg, buf, len);
+    apply(cw->write, cw->sg, irangel(offset, len), (status_handler)&cw->write_done);
 }
 
-closure_function(8, 1, void, dump_write_complete,
-                 fsfile, f, sg_io, write, sg_list, sg, Elf64_Phdr *, phdr, Elf64_Phdr *, phdr_end, buffer, b, status_handler, completion, u64, limit_remain,
-                 status s)
+/* Copies the core file contents in the given range (which does not extend beyond the end of the
+ * file); pages that are not mapped are read as zeros. */
+static void coredump_fill(coredump_writer cw, u8 *dest, u64 offset, u64 len)
 {
-    u64 limit_remain = bound(limit_remain);
-    sg_list sg = bound(sg);
-    sg_list_release(sg);
-    Elf64_Phdr *phdr = bound(phdr);
-    core_debug("completed write of vmap at %p (limit remain %ld)\n", (phdr - 1)->p_vaddr, limit_remain);
-    while (phdr < bound(phdr_end) && phdr->p_filesz == 0)
-        phdr++;
-    if (s != STATUS_OK || phdr >= bound(phdr_end) || limit_remain == 0) {
-        if (s != STATUS_OK) {
-            buffer b = get_string(s, sym(result));
-            s = timm("result", "core dump write fail: %b", b);
-        } else if (limit_remain == 0)
-            s = timm("result", "core dump truncated; limit reached");
-        deallocate_sg_list(bound(sg));
-        deallocate_buffer(bound(b));
-        core_debug("calling final completion\n");
-        apply(bound(completion), s);
-        fsfile_release(bound(f));
-        closure_finish();
+    zero(dest, len);
+    u64 end = offset + len;
+    if (offset < buffer_length(cw->hdr))
+        runtime_memcpy(dest, buffer_ref(cw->hdr, offset),
+                       MIN(len, buffer_length(cw->hdr) - offset));
+    for (Elf64_Phdr *phdr = cw->phdr; phdr < cw->phdr_end; phdr++) {
+        if (phdr->p_offset >= end)
+            break;
+        u64 seg_end = phdr->p_offset + phdr->p_filesz;
+        if (seg_end <= offset) {
+            cw->phdr = phdr + 1;    /* segments are sorted by offset */
+            continue;
+        }
+        u64 pos = MAX(offset, phdr->p_offset);
+        u64 copy_end = MIN(end, seg_end);
+        for (; pos < copy_end; pos = (pos & ~MASK(PAGELOG)) + PAGESIZE) {
+            u64 va = phdr->p_vaddr + pos - phdr->p_offset;
+            if (coredump_page_mapped(va & ~MASK(PAGELOG)))
+                runtime_memcpy(dest + pos - offset, pointer_from_u64(va),
+                               MIN(copy_end, (pos & ~MASK(PAGELOG)) + PAGESIZE) - pos);
+        }
+    }
+}
+
+static void coredump_next_compressed(coredump_writer cw)
+{
+    if (cw->pos >= cw->size) {
+        coredump_finish(cw, STATUS_OK);
+        return;
+    }
+    u8 *out = cw->out;
+    if (cw->pos == 0) {
+        *(u32 *)out = LZ4F_MAGIC;
+        out[4] = LZ4F_FLG;
+        out[5] = LZ4F_BD;
+        out[6] = LZ4F_HC;
+        out += LZ4F_HDR_SIZE;
+    }
+    u64 len = MIN(COREDUMP_CHUNK_SIZE, cw->size - cw->pos);
+    coredump_fill(cw, cw->chunk, cw->pos, len);
+    u64 clen = lz4_compress_table(cw->chunk, len, out + sizeof(u32), len - 1, cw->lz4_table);
+    if (clen) {
+        *(u32 *)out = clen;
     } else {
-        add_to_sgl(sg, pointer_from_u64(phdr->p_vaddr), phdr->p_memsz);
-        u64 wlen = sg->count;
-        if (limit_remain < wlen)
-            wlen = limit_remain;
-        bound(limit_remain) -= wlen;
-        bound(phdr) = phdr + 1;
-        apply(bound(write), sg, irangel(phdr->p_offset, wlen), (status_handler)closure_self());
+        runtime_memcpy(out + sizeof(u32), cw->chunk, len);
+        *(u32 *)out = len | LZ4F_BLOCK_UNCOMPRESSED;
+        clen = len;
+    }
+    out += sizeof(u32) + clen;
+    if (cw->pos + len == cw->size) {
+        *(u32 *)out = 0;    /* end mark */
+        out += sizeof(u32);
     }
+    u64 out_len = out - cw->out;
+    if (cw->out_offset + out_len > cw->limit) {
+        coredump_finish(cw, STATUS_OK);
+        return;
+    }
+    core_debug("writing compressed chunk at %ld (%ld -> %ld bytes)\n", cw->pos, len, out_len);
+    cw->pos += len;
+    u64 offset = cw->out_offset;
+    cw->out_offset += out_len;
+    coredump_write(cw, cw->out, out_len, offset);
+}
+
+/* Writes the next run of pages with data in the memory segments. */
+static void coredump_next_sparse(coredump_writer cw)
+{
+    u64 limit = MIN(cw->limit, cw->size);
+    while (cw->phdr < cw->phdr_end) {
+        Elf64_Phdr *phdr = cw->phdr;
+        u64 end = MIN(phdr->p_offset + phdr->p_filesz, limit);
+        u64 pos = MAX(cw->pos, phdr->p_offset);
+        while ((pos < end) && !coredump_page_has_data(phdr->p_vaddr + pos - phdr->p_offset))
+            pos += PAGESIZE;
+        if (pos >= end) {
+            cw->phdr++;
+            continue;
+        }
+        u64 start = pos;
+        do {
+            pos += PAGESIZE;
+        } while ((pos < end) && (pos - start < COREDUMP_CHUNK_SIZE) &&
+                 coredump_page_has_data(phdr->p_vaddr + pos - phdr->p_offset));
+        pos = MIN(pos, end);
+        core_debug("writing segment %p data at %ld, length %ld\n", phdr->p_vaddr, start,
+                   pos - start);
+        cw->pos = pos;
+        coredump_write(cw, pointer_from_u64(phdr->p_vaddr + start - phdr->p_offset),
+                       pos - start, start);
+        return;
+    }
+    cw->pos = limit;
+    coredump_finish(cw, STATUS_OK);
+}
+
+closure_func_basic(status_handler, void, coredump_next,
+                   status s)
+{
+    coredump_writer cw = struct_from_closure(coredump_writer, next);
+    if (cw->compress)
+        coredump_next_compressed(cw);
+    else
+        coredump_next_sparse(cw);
+}
+
+closure_func_basic(status_handler, void, coredump_write_done,
+                   status s)
+{
+    coredump_writer cw = struct_from_closure(coredump_writer, write_done);
+    sg_list_release(cw->sg);
+    if (!is_ok(s)) {
+        buffer b = get_string(s, sym(result));
+        coredump_finish(cw, timm("result", "core dump write fail: %b", b));
+        return;
+    }
+
+    /* writes may complete synchronously: avoid unbounded recursion */
+    async_apply_status_handler((status_handler)&cw->next, s);
 }
 
 void coredump(thread t, struct siginfo *si, status_handler complete)
@@ -226,8 +380,28 @@ void coredump(thread t, struct siginfo *si, status_handler complete)
     process p = t->p;
     status s = STATUS_OK;
 
-    fsfile f = fsfile_open_or_create(ss(CORE_PATH), true);
-    if (f == INVALID_ADDRESS) {
+    coredump_writer cw = allocate_zero(h, sizeof(*cw));
+    if (cw == INVALID_ADDRESS) {
+        core_debug("failed to allocate writer\n");
+        s = timm("result", "no core generated: failed to allocate writer");
+        goto error;
+    }
+    cw->h = h;
+    cw->compress = coredump_compress;
+    if (cw->compress) {
+        cw->chunk = allocate(h, COREDUMP_CHUNK_SIZE);
+        cw->out = allocate(h, LZ4F_HDR_SIZE + sizeof(u32) + COREDUMP_CHUNK_SIZE + sizeof(u32));
+        cw->lz4_table = allocate(h, LZ4_COMPRESS_TABLE_SIZE);
+        if ((cw->chunk == INVALID_ADDRESS) || (cw->out == INVALID_ADDRESS) ||
+            (cw->lz4_table == INVALID_ADDRESS)) {
+            core_debug("failed to allocate compression buffers\n");
+            s = timm("result", "no core generated: failed to allocate compression buffers");
+            goto error;
+        }
+    }
+
+    fsfile f = fsfile_open_or_create(cw->compress ? ss(CORE_LZ4_PATH) : ss(CORE_PATH), true);
+    if (!f) {
         core_debug("failed to open core file\n");
         s = timm("result", "no core generated: failed to open core file");
         goto error;
@@ -353,28 +527,36 @@ void coredump(thread t, struct siginfo *si, status_handler complete)
         phdr->p_offset = doff;
         phdr->p_align = PAGESIZE;
         /* set filesz to 0 to skip copying segment into dump */
-        if (m->flags & VMAP_MMAP_TYPE_FILEBACKED || m->flags == 0) {
+        if (m->flags & VMAP_MMAP_TYPE_FILEBACKED || m->flags == 0)
             phdr->p_filesz = 0;
-        } else {
+        else
             phdr->p_filesz = phdr->p_memsz;
-            pagein(irangel(phdr->p_vaddr, phdr->p_memsz));
-        }
         doff += phdr->p_filesz;
         ++phdr;
     }
     Elf64_Phdr *phdr_end = phdr;
     deallocate_vector(v);
 
-    /* write dump header and first phdr */
-    status_handler completion = closure(h, dump_complete, f, complete);
-    add_to_sgl(sg, buffer_ref(bhdr, 0), buffer_length(bhdr));
-    u64 limit_remain = coredump_limit;
-    u64 wlen = sg->count;
-    if (limit_remain < wlen)
-        wlen = limit_remain;
-    limit_remain -= wlen;
-    apply(write, sg, irangel(0, wlen),
-        closure(h, dump_write_complete, f, write, sg, phdr_begin, phdr_end, bhdr, completion, limit_remain));
+    cw->f = f;
+    cw->write = write;
+    cw->sg = sg;
+    cw->hdr = bhdr;
+    cw->phdr = phdr_begin;
+    cw->phdr_end = phdr_end;
+    cw->size = doff;
+    cw->limit = coredump_limit;
+    cw->completion = complete;
+    init_closure_func(&cw->write_done, status_handler, coredump_write_done);
+    init_closure_func(&cw->next, status_handler, coredump_next);
+    if (cw->compress) {
+        coredump_next_compressed(cw);
+        return;
+    }
+
+    /* the core file is sparse: set its length before writing the segments with data */
+    fsfile_truncate(f, MIN(cw->size, cw->limit));
+    cw->pos = MIN(buffer_length(bhdr), cw->limit);
+    coredump_write(cw, buffer_ref(bhdr, 0), cw->pos, 0);
     return;
 error:
     apply(complete, s);
@@ -35,48 +35,71 @@ closure_func_basic(fdesc_et_handler, u64, efd_edge_handler,
     return lastevents;
 }
 
-closure_function(4, 1, sysreturn, efd_read_bh,
-                 struct efd *, efd, void *, buf, u64, length, io_completion, completion,
+/* The counter is updated lock-free: the blockq machinery (and the allocation of a blockq action)
+ * is only involved when a read or write would block. */
+static boolean efd_counter_take(struct efd *efd, u64 *val)
+{
+    u64 counter;
+    do {
+        counter = *(volatile u64 *)&efd->counter;
+        if (counter == 0)
+            return false;
+        *val = (efd->flags & EFD_SEMAPHORE) ? 1 : counter;
+    } while (!compare_and_swap_64(&efd->counter, counter, counter - *val));
+    return true;
+}
+
+static boolean efd_counter_add(struct efd *efd, u64 val)
+{
+    u64 counter;
+    do {
+        counter = *(volatile u64 *)&efd->counter;
+        if (val > EFD_COUNTER_MAX - counter)
+            return false;
+    } while (!compare_and_swap_64(&efd->counter, counter, counter + val));
+    return true;
+}
+
+static sysreturn efd_read_done(struct efd *efd, void *buf, u64 val)
+{
+    efd->io_event = true;
+    blockq_wake_one(efd->write_bq);
+    fdesc_notify_events(&efd->f);
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    runtime_memcpy(buf, &val, sizeof(val));
+    context_clear_err(ctx);
+    return sizeof(val);
+}
+
+static void efd_write_done(struct efd *efd)
+{
+    efd->io_event = true;
+    blockq_wake_one(efd->read_bq);
+    fdesc_notify_events(&efd->f);
+}
+
+closure_function(3, 1, sysreturn, efd_read_bh,
+                 struct efd *, efd, void *, buf, io_completion, completion,
                  u64 flags)
 {
     struct efd *efd = bound(efd);
-    sysreturn rv = sizeof(efd->counter);
+    sysreturn rv;
+    u64 val;
 
     if (flags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out;
     }
-
-    context ctx = get_current_context(current_cpu());
-    efd_lock(efd);
-    if (efd->counter == 0) {
-        efd_unlock(efd);
+    if (!efd_counter_take(efd, &val)) {
         if (efd->flags & EFD_NONBLOCK) {
             rv = -EAGAIN;
             goto out;
         }
-        return blockq_block_required((unix_context)ctx, flags);
-    }
-    if (context_set_err(ctx)) {
-        efd_unlock(efd);
-        rv = -EFAULT;
-        goto out;
-    }
-    if (efd->flags & EFD_SEMAPHORE) {
-        u64 readVal = 1;
-
-        runtime_memcpy(bound(buf), &readVal, sizeof(readVal));
-        efd->counter--;
-    }
-    else {
-        runtime_memcpy(bound(buf), &efd->counter, sizeof(efd->counter));
-        efd->counter = 0;
+        return blockq_block_required((unix_context)get_current_context(current_cpu()), flags);
     }
-    context_clear_err(ctx);
-    efd->io_event = true;
-    efd_unlock(efd);
-    blockq_wake_one(efd->write_bq);
-    fdesc_notify_events(&efd->f);
+    rv = efd_read_done(efd, bound(buf), val);
 out:
     apply(bound(completion), rv);
     closure_finish();
@@ -91,44 +114,34 @@ closure_func_basic(file_io, sysreturn, efd_read,
     }
 
     struct efd *efd = struct_from_field(closure_self(), struct efd *, read);
-    blockq_action ba = closure_from_context(ctx, efd_read_bh, efd, buf, length, completion);
+    u64 val;
+    if (efd_counter_take(efd, &val))
+        return io_complete(completion, efd_read_done(efd, buf, val));
+    if (efd->flags & EFD_NONBLOCK)
+        return io_complete(completion, -EAGAIN);
+    blockq_action ba = closure_from_context(ctx, efd_read_bh, efd, buf, completion);
     return blockq_check(efd->read_bq, ba, bh);
 }
 
-closure_function(4, 1, sysreturn, efd_write_bh,
-                 struct efd *, efd, void *, buf, u64, length, io_completion, completion,
+closure_function(3, 1, sysreturn, efd_write_bh,
+                 struct efd *, efd, u64, val, io_completion, completion,
                  u64 flags)
 {
     struct efd *efd = bound(efd);
-    sysreturn rv = sizeof(efd->counter);
-    u64 counter;
+    sysreturn rv = sizeof(u64);
 
     if (flags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out;
     }
-
-    context ctx = get_current_context(current_cpu());
-    if (context_set_err(ctx)) {
-        rv = -EFAULT;
-        goto out;
-    }
-    runtime_memcpy(&counter, bound(buf), sizeof(counter));
-    context_clear_err(ctx);
-    efd_lock(efd);
-    if (counter > (EFD_COUNTER_MAX - efd->counter)) {
-        efd_unlock(efd);
+    if (!efd_counter_add(efd, bound(val))) {
         if (efd->flags & EFD_NONBLOCK) {
             rv = -EAGAIN;
             goto out;
         }
-        return blockq_block_required((unix_context)ctx, flags);
+        return blockq_block_required((unix_context)get_current_context(current_cpu()), flags);
     }
-    efd->counter += counter;
-    efd->io_event = true;
-    efd_unlock(efd);
-    blockq_wake_one(efd->read_bq);
-    fdesc_notify_events(&efd->f);
+    efd_write_done(efd);
 out:
     apply(bound(completion), rv);
     closure_finish();
@@ -143,7 +156,21 @@ closure_func_basic(file_io, sysreturn, efd_write,
     }
 
     struct efd *efd = struct_from_field(closure_self(), struct efd *, write);
-    blockq_action ba = closure_from_context(ctx, efd_write_bh, efd, buf, length, completion);
+    u64 val;
+    context cur = get_current_context(current_cpu());
+    if (context_set_err(cur))
+        return io_complete(completion, -EFAULT);
+    runtime_memcpy(&val, buf, sizeof(val));
+    context_clear_err(cur);
+    if (val == -1ull)
+        return io_complete(completion, -EINVAL);
+    if (efd_counter_add(efd, val)) {
+        efd_write_done(efd);
+        return io_complete(completion, sizeof(val));
+    }
+    if (efd->flags & EFD_NONBLOCK)
+        return io_complete(completion, -EAGAIN);
+    blockq_action ba = closure_from_context(ctx, efd_write_bh, efd, val, completion);
     return blockq_check(efd->write_bq, ba, bh);
 }
 
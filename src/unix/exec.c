@@ -204,6 +204,182 @@ void start_process(thread t, void *start)
     }
 }
 
+/* Pre-faulting of read-only program segments at exec time (manifest option "exec_prefault").
+ * Text and read-only data pages are fetched into the page cache with large batched reads and
+ * mapped into the process before it starts, instead of being demand-faulted one by one during
+ * program startup. The option value is either "t", to prefault all read-only segments, or a
+ * tuple with:
+ * - hot_pages: vector of file page indexes to prefault (pages outside read-only segments are
+ *   ignored); this is a profile of the pages touched by program startup
+ * - record: if set, the program file pages that are demand-faulted are recorded, and printed to
+ *   the console at shutdown as a hot_pages list, so that the list can be built from a run of the
+ *   program
+ */
+typedef struct exec_prefault {
+    thread t;
+    void *entry;
+    bitmap hot_pages;   /* by file page index; if null, all pages are prefaulted */
+    heap h;
+    merge m;
+    status_handler start;   /* applied when the process entry point is known (or exec fails) */
+    closure_struct(status_handler, complete);
+} *exec_prefault;
+
+closure_func_basic(status_handler, void, exec_prefault_complete,
+                   status s)
+{
+    exec_prefault ep = struct_from_field(closure_self(), exec_prefault, complete);
+    if (!is_ok(s)) {
+        msg_warn("failed to prefault program pages: %v\n", s);
+        timm_dealloc(s);
+    }
+    if (ep->entry) {
+        exec_debug("prefault complete, starting process tid %d, start %p\n", ep->t->tid, ep->entry);
+        start_process(ep->t, ep->entry);
+    } else {
+        exec_debug("prefault complete, exec of tid %d failed\n", ep->t->tid);
+    }
+    if (ep->hot_pages)
+        deallocate_bitmap(ep->hot_pages);
+    deallocate(ep->h, ep, sizeof(*ep));
+}
+
+closure_function(1, 2, boolean, exec_hot_page_each,
+                 bitmap, b,
+                 value a, value v)
+{
+    u64 pi;
+    if (!u64_from_value(v, &pi)) {
+        msg_err("exec_prefault: invalid hot page %v\n", v);
+        return false;
+    }
+    if (pi < bound(b)->maxbits)   /* ignore pages beyond the end of file */
+        bitmap_set(bound(b), pi, 1);
+    return true;
+}
+
+closure_function(1, 2, void, exec_record_dump,
+                 bitmap, hot_pages,
+                 int status, merge m)
+{
+    buffer b = allocate_buffer(heap_locked(get_kernel_heaps()), 256);
+    if (b == INVALID_ADDRESS)
+        return;
+    bitmap_foreach_set(bound(hot_pages), pi) {
+        if (buffer_length(b))
+            push_u8(b, ' ');
+        bprintf(b, "%ld", pi);
+    }
+    rprintf("exec_prefault: hot_pages:[%b]\n", b);
+    deallocate_buffer(b);
+}
+
+static void exec_record_init(heap h, process p, fsfile f)
+{
+    bitmap hot_pages = allocate_bitmap(h, h, pad(fsfile_get_length(f), PAGESIZE) >> PAGELOG);
+    if (hot_pages == INVALID_ADDRESS)
+        goto alloc_fail;
+    shutdown_handler dump = closure(h, exec_record_dump, hot_pages);
+    if (dump == INVALID_ADDRESS) {
+        deallocate_bitmap(hot_pages);
+        goto alloc_fail;
+    }
+    add_shutdown_completion(dump);
+    p->exec_record_pages = hot_pages;
+    write_barrier();
+    p->exec_record = fsfile_get_cachenode(f);
+    return;
+  alloc_fail:
+    msg_err("exec_prefault: failed to allocate hot page map\n");
+}
+
+static exec_prefault exec_prefault_alloc(heap h, process p, thread t, fsfile f)
+{
+    value v = get(p->process_root, sym(exec_prefault));
+    if (!v)
+        return 0;
+    if (is_tuple(v) && get(v, sym(record))) {
+        /* the profiling run must demand-fault its pages */
+        exec_record_init(h, p, f);
+        return 0;
+    }
+    exec_prefault ep = allocate(h, sizeof(*ep));
+    if (ep == INVALID_ADDRESS)
+        return 0;
+    ep->t = t;
+    ep->entry = 0;
+    ep->hot_pages = 0;
+    ep->h = h;
+    ep->m = allocate_merge(h, init_closure_func(&ep->complete, status_handler,
+                                                exec_prefault_complete));
+    if (ep->m == INVALID_ADDRESS) {
+        deallocate(h, ep, sizeof(*ep));
+        return 0;
+    }
+    if (is_tuple(v)) {
+        value hot_pages = get(v, sym(hot_pages));
+        if (hot_pages) {
+            ep->hot_pages = allocate_bitmap(h, h, pad(fsfile_get_length(f), PAGESIZE) >> PAGELOG);
+            if ((ep->hot_pages == INVALID_ADDRESS) ||
+                !iterate(hot_pages, stack_closure(exec_hot_page_each, ep->hot_pages))) {
+                msg_err("exec_prefault: failed to parse hot page list, prefaulting all pages\n");
+                if (ep->hot_pages != INVALID_ADDRESS)
+                    deallocate_bitmap(ep->hot_pages);
+                ep->hot_pages = 0;
+            }
+        }
+    }
+    ep->start = apply_merge(ep->m);
+    return ep;
+}
+
+static void exec_prefault_pages(exec_prefault ep, pagecache_node pn, u64 vaddr, u64 offset,
+                                u64 len, pageflags flags)
+{
+    pagecache_node_fetch_pages(pn, irangel(offset, len));
+    for (u64 o = 0; o < len; o += PAGESIZE)
+        pagecache_map_page(pn, offset + o, vaddr + o, flags, apply_merge(ep->m));
+}
+
+/* offset and len are page-aligned; the hot page list, if any, applies to the program file only */
+static void exec_prefault_segment(exec_prefault ep, boolean program, pagecache_node pn, u64 vaddr,
+                                  u64 offset, u64 len, pageflags flags)
+{
+    exec_debug("%s: vaddr 0x%lx, offset 0x%lx, len 0x%lx\n", func_ss, vaddr, offset, len);
+    if (!program || !ep->hot_pages) {
+        exec_prefault_pages(ep, pn, vaddr, offset, len, flags);
+        return;
+    }
+
+    /* prefault runs of contiguous hot pages, each with a single read */
+    u64 start = offset >> PAGELOG;
+    u64 end = (offset + len) >> PAGELOG;
+    u64 run = infinity;
+    for (u64 pi = start; pi <= end; pi++) {
+        boolean hot = (pi < end) && bitmap_get(ep->hot_pages, pi);
+        if (hot && run == infinity) {
+            run = pi;
+        } else if (!hot && run != infinity) {
+            exec_prefault_pages(ep, pn, vaddr + ((run - start) << PAGELOG), run << PAGELOG,
+                                (pi - run) << PAGELOG, flags);
+            run = infinity;
+        }
+    }
+}
+
+/* the process is started once its program pages are prefaulted, if prefaulting is enabled */
+static void exec_start(thread t, void *entry, exec_prefault ep)
+{
+    if (ep) {
+        exec_debug("waiting for prefault of tid %d, start %p\n", t->tid, entry);
+        ep->entry = entry;
+        apply(ep->start, STATUS_OK);
+        return;
+    }
+    exec_debug("starting process tid %d, start %p\n", t->tid, entry);
+    start_process(t, entry);
+}
+
 closure_function(4, 5, boolean, static_map,
                  process, p, kernel_heaps, kh, u32, allowed_flags, buffer, b,
                  u64 vaddr, u64 offset, u64 data_size, u64 bss_size, pageflags flags)
@@ -263,8 +439,8 @@ closure_function(4, 5, boolean, static_map,
     return false;
 }
 
-closure_function(4, 5, boolean, faulting_map,
-                 process, p, kernel_heaps, kh, u32, allowed_flags, fsfile, f,
+closure_function(6, 5, boolean, faulting_map,
+                 process, p, kernel_heaps, kh, u32, allowed_flags, fsfile, f, exec_prefault, ep, boolean, program,
                  u64 vaddr, u64 offset, u64 data_size, u64 bss_size, pageflags flags)
 {
     exec_debug("%s: vaddr 0x%lx, offset 0x%lx, data_size 0x%lx, bss_size 0x%lx, flags 0x%lx\n",
@@ -292,6 +468,13 @@ closure_function(4, 5, boolean, faulting_map,
             k.bss_offset = data_size;
         if (allocate_vmap(bound(p), r, k) == INVALID_ADDRESS)
             goto alloc_fail;
+        if (bound(ep) && !pageflags_is_writable(flags)) {
+            /* a page containing bss is left to the fault handler, which zeroes the bss part */
+            u64 len = (tail_bss > 0) ? (data_size & ~PAGEMASK) : data_map_size;
+            if (len > 0)
+                exec_prefault_segment(bound(ep), bound(program), k.cache_node, map_start, offset,
+                                      len, pageflags_from_vmflags(vmflags));
+        }
         map_start += data_map_size;
         bss_size -= tail_bss;
     }
@@ -309,8 +492,9 @@ closure_function(4, 5, boolean, faulting_map,
     return false;
 }
 
-closure_function(7, 2, void, load_interp_complete,
+closure_function(8, 2, void, load_interp_complete,
                  thread, t, kernel_heaps, kh, buffer, b, fsfile, f, u64, load_addr, boolean, static_map, boolean, ingest_symbols,
+                 exec_prefault, ep,
                  status s, bytes length)
 {
     thread t = bound(t);
@@ -331,15 +515,41 @@ closure_function(7, 2, void, load_interp_complete,
     if (bound(static_map))
         emh = stack_closure(static_map, p, kh, 0, b);
     else
-        emh = stack_closure(faulting_map, p, kh, 0, bound(f));
+        emh = stack_closure(faulting_map, p, kh, 0, bound(f), bound(ep), false);
     void *start = load_elf(b, where, emh);
     if (!bound(static_map))
         deallocate_buffer(b);
-    exec_debug("starting process tid %d, start %p\n", t->tid, start);
-    start_process(t, start);
+    exec_start(t, start, bound(ep));
     closure_finish();
 }
 
+closure_func_basic(binding_handler, boolean, loader_cache_each,
+                   value a, value v)
+{
+    if (!is_string(v))
+        return true;
+    fsfile f = fsfile_open(buffer_to_sstring(v));
+    if (!f) {
+        msg_warn("loader cache: library %b not found\n", v);
+        return true;
+    }
+    u64 length = fsfile_get_length(f);
+    exec_debug("loader cache: fetching %b, length %ld\n", v, length);
+    if (length > 0)
+        pagecache_node_fetch_pages(fsfile_get_cachenode(f), irangel(0, pad(length, PAGESIZE)));
+    return true;
+}
+
+/* Reads the shared libraries listed in the loader cache (resolved by mkfs from the dependencies
+ * of the program) into the page cache, in parallel with the loading of the interpreter, so that
+ * the dynamic loader finds their pages in memory when it maps them. */
+static void exec_loader_cache_fetch(tuple root)
+{
+    value v = get(root, sym(loader_cache));
+    if (v && is_vector(v))
+        iterate(v, stack_closure_func(binding_handler, loader_cache_each));
+}
+
 closure_function(1, 1, boolean, trace_notify,
                  process, p,
                  value v)
@@ -405,18 +615,19 @@ static void exec_elf_finish(buffer ex, fsfile f, process kp,
     elf_map_handler emh;
     boolean static_map = get(proc->process_root, sym(ltrace)) ||
         get(proc->process_root, sym(static_map_program));
+    exec_prefault ep = static_map ? 0 : exec_prefault_alloc(general, proc, t, f);
     if (static_map)
         emh = stack_closure(static_map, proc, kh, allowed_flags, ex);
     else
-        emh = stack_closure(faulting_map, proc, kh, allowed_flags, f);
+        emh = stack_closure(faulting_map, proc, kh, allowed_flags, f, ep, true);
     void * entry = load_elf(ex, load_offset, emh);
     u64 brk_offset = aslr ? get_aslr_offset(PROCESS_HEAP_ASLR_RANGE) : 0;
     u64 brk = pad(load_range.end, PAGESIZE) + brk_offset;
     proc->brk = pointer_from_u64(brk);
     proc->heap_base = brk;
     proc->heap_map = allocate_vmap(proc, irange(brk, brk),
-                                   ivmap(VMAP_FLAG_HEAP | VMAP_FLAG_READABLE | VMAP_FLAG_WRITABLE,
-                                         0, 0, 0, 0));
+                                   ivmap(VMAP_FLAG_HEAP | VMAP_FLAG_READABLE | VMAP_FLAG_WRITABLE |
+                                         thp_vmflags(false) | numa_vmflags(), 0, 0, 0, 0));
     assert(proc->heap_map != INVALID_ADDRESS);
     exec_debug("entry %p, brk %p (offset 0x%lx)\n", entry, proc->brk, brk_offset);
 
@@ -447,8 +658,9 @@ static void exec_elf_finish(buffer ex, fsfile f, process kp,
         buffer b = allocate_buffer(general, pad(length, PAGESIZE));
         assert(b != INVALID_ADDRESS);
         io_status_handler sh = closure(general, load_interp_complete, t, kh, b,
-                                       interp, interp_load_addr, static_map, ingest_symbols);
+                                       interp, interp_load_addr, static_map, ingest_symbols, ep);
         filesystem_read_linear(interp, buffer_ref(b, 0), irangel(0, length), sh);
+        exec_loader_cache_fetch(root);
         goto out;
     }
 
@@ -457,14 +669,17 @@ static void exec_elf_finish(buffer ex, fsfile f, process kp,
         fs_status fss = filesystem_chdir(proc, buffer_to_sstring(cwd));
         if (fss != FS_STATUS_OK) {
             s = timm("result", "unable to change cwd to \"%b\"; %s", cwd, string_from_fs_status(fss));
+            /* with no entry point set, prefault completion releases its state without starting
+               the process */
+            if (ep)
+                apply(ep->start, STATUS_OK);
             goto out;
         }
     }
 
     if (!static_map)
         deallocate_buffer(ex);
-    exec_debug("starting process tid %d, start %p\n", t->tid, entry);
-    start_process(t, entry);
+    exec_start(t, entry, ep);
   out:
     apply(complete, s);
 }
@@ -56,22 +56,50 @@ sysreturn sysreturn_from_fs_status_value(status s)
     return rv;
 }
 
+range file_ra_next(file_ra ra, u64 offset, u64 len, u64 init_size, u64 max_size)
+{
+    u64 end = offset + len;
+    range r = irange(0, 0);
+    boolean sequential = (offset == ra->prev) ||
+        ((ra->size != 0) && point_in_range(irangel(ra->start, ra->size), offset));
+    if (!sequential) {
+        /* random access: drop the stream and wait for it to become sequential */
+        ra->size = 0;
+    } else if (ra->size == 0) {
+        /* new stream: size the initial window after the request */
+        ra->start = end;
+        ra->size = MIN(MAX(init_size, 2 * pad(len, PAGESIZE)), max_size);
+        ra->async = ra->start;
+        r = irangel(ra->start, ra->size);
+    } else if (end > ra->async) {
+        /* the reader entered the current window: issue the next one */
+        ra->start = MAX(ra->start + ra->size, end);
+        ra->size = MIN(2 * ra->size, max_size);
+        ra->async = ra->start;
+        r = irangel(ra->start, ra->size);
+    }
+    ra->prev = end;
+    return r;
+}
+
 void file_readahead(file f, u64 offset, u64 len)
 {
-    u64 ra_size = 0;
+    u64 init_size, max_size;
     switch (f->fadv) {
     case POSIX_FADV_NORMAL:
-        ra_size = FILE_READAHEAD_DEFAULT;
-        break;
-    case POSIX_FADV_RANDOM: /* no read-ahead */
+        init_size = FILE_READAHEAD_DEFAULT;
+        max_size = FILE_READAHEAD_MAX;
         break;
     case POSIX_FADV_SEQUENTIAL:
-        ra_size = 2 * FILE_READAHEAD_DEFAULT;
+        init_size = max_size = FILE_READAHEAD_MAX;
         break;
+    default:    /* POSIX_FADV_RANDOM: no read-ahead */
+        return;
     }
-    if (ra_size > 0)
-        pagecache_node_fetch_pages(fsfile_get_cachenode(f->fsf),
-            irangel(offset + len, ra_size));
+    range r = file_ra_next(&f->ra, offset, len, init_size, max_size);
+    if (range_span(r) == 0 || r.start >= fsfile_get_length(f->fsf))
+        return;
+    pagecache_node_fetch_pages(fsfile_get_cachenode(f->fsf), r);
 }
 
 fs_status filesystem_chdir(process p, sstring path)
@@ -428,6 +456,7 @@ sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
     case POSIX_FADV_RANDOM:
     case POSIX_FADV_SEQUENTIAL:
         f->fadv = advice;
+        f->ra.size = 0;
         break;
     case POSIX_FADV_WILLNEED: {
         pagecache_node pn = fsfile_get_cachenode(f->fsf);
@@ -555,20 +584,25 @@ sysreturn fsfile_get_seals(fsfile f, u64 *seals)
     return sysreturn_from_fs_status(fs->get_seals(fs, f, seals));
 }
 
+/* Number of nodes with at least one watch: when zero, file system events are discarded without
+ * looking up any node metadata. */
+static u64 fs_watched_nodes;
+
 notify_entry fs_watch(heap h, tuple n, u64 eventmask, event_handler eh, notify_set *s)
 {
-    tuple watches = get_tuple(n, sym(watches));
+    tuple watches = get_tuple(n, sym_const(watches));
     notify_set ns;
     if (!watches) {
         ns = allocate_notify_set(h);
         if (ns == INVALID_ADDRESS)
             return 0;
         watches = allocate_tuple();
-        set(watches, sym(no_encode), null_value);
-        set(watches, sym(ns), ns);
-        set(n, sym(watches), watches);
+        set(watches, sym_const(no_encode), null_value);
+        set(watches, sym_const(ns), ns);
+        set(n, sym_const(watches), watches);
+        fetch_and_add(&fs_watched_nodes, 1);
     } else {
-        ns = get(watches, sym(ns));
+        ns = get(watches, sym_const(ns));
     }
     notify_entry ne = notify_add(ns, eventmask, eh);
     if (ne != INVALID_ADDRESS) {
@@ -580,28 +614,34 @@ notify_entry fs_watch(heap h, tuple n, u64 eventmask, event_handler eh, notify_s
 
 static void fs_notify_internal(tuple md, u64 event, symbol name, u32 cookie)
 {
-    tuple watches = get_tuple(md, sym(watches));
+    tuple watches = get_tuple(md, sym_const(watches));
     if (watches) {
         struct inotify_evdata evdata = {
             .name = name ? symbol_string(name) : 0,
             .cookie = cookie,
         };
-        notify_dispatch_with_arg(get(watches, sym(ns)), event, &evdata);
+        notify_dispatch_with_arg(get(watches, sym_const(ns)), event, &evdata);
     }
 }
 
 void fs_notify_event(tuple n, u64 event)
 {
+    if (!fs_watched_nodes)
+        return;
     if (is_dir(n))
         event |= IN_ISDIR;
     fs_notify_internal(n, event, 0, 0);
     tuple parent = get_tuple(n, sym_this(".."));
-    if (parent != n)
+
+    /* look up the node name (which requires scanning the parent directory) only if needed */
+    if ((parent != n) && get_tuple(parent, sym_const(watches)))
         fs_notify_internal(parent, event, tuple_get_symbol(children(parent), n), 0);
 }
 
 void fs_notify_create(tuple t, tuple parent, symbol name)
 {
+    if (!fs_watched_nodes)
+        return;
     u64 event = IN_CREATE;
     if (is_dir(t))
         event |= IN_ISDIR;
@@ -610,6 +650,8 @@ void fs_notify_create(tuple t, tuple parent, symbol name)
 
 void fs_notify_move(tuple t, tuple old_parent, symbol old_name, tuple new_parent, symbol new_name)
 {
+    if (!fs_watched_nodes)
+        return;
     u64 flags = is_dir(t) ? IN_ISDIR : 0;
     fs_notify_internal(t, IN_MOVE_SELF | flags, 0, 0);
     u32 cookie = random_u64();
@@ -619,6 +661,8 @@ void fs_notify_move(tuple t, tuple old_parent, symbol old_name, tuple new_parent
 
 void fs_notify_delete(tuple t, tuple parent, symbol name)
 {
+    if (!fs_watched_nodes)
+        return;
     u64 flags = is_dir(t) ? IN_ISDIR : 0;
     fs_notify_internal(t, IN_DELETE_SELF | flags, 0, 0);
     fs_notify_internal(parent, IN_DELETE | flags, name, 0);
@@ -631,18 +675,21 @@ void fs_notify_modify(tuple t)
 
 void fs_notify_release(tuple t, boolean unmounted)
 {
-    tuple watches = get_tuple(t, sym(watches));
+    if (!fs_watched_nodes)
+        return;
+    tuple watches = get_tuple(t, sym_const(watches));
     if (watches) {
-        notify_set ns = get(watches, sym(ns));
+        notify_set ns = get(watches, sym_const(ns));
         if (unmounted)
             notify_dispatch_with_arg(ns, IN_UNMOUNT, 0);
         deallocate_notify_set(ns);
         deallocate_value(watches);
-        set(t, sym(watches), 0);
+        set(t, sym_const(watches), 0);
+        fetch_and_add(&fs_watched_nodes, -1);
     }
 }
 
 boolean fs_file_is_busy(filesystem fs, tuple md)
 {
-    return (get_tuple(md, sym(watches)) != 0);
+    return (get_tuple(md, sym_const(watches)) != 0);
 }
@@ -53,6 +53,9 @@ struct ftrace_tracer * current_tracer = 0;
 /* http listener */
 static http_listener ftrace_hl;
 
+/* a trace.dat export owns the entries it has sized until it has sent them */
+static boolean tracedat_is_open = false;
+
 struct rbuf_entry_function {
     unsigned long ip;
     unsigned long parent_ip;
@@ -66,10 +69,11 @@ struct rbuf_entry_function_graph {
     unsigned short depth; /* must be first */
     unsigned long ip;
     timestamp duration;
+    timestamp ts; /* entry time if duration is UNTIMED, else return time */
     unsigned short cpu;
     unsigned char has_child;
     unsigned char flush;
-    unsigned long tid;
+    int tid;
 };
 
 struct rbuf_entry_switch {
@@ -89,15 +93,21 @@ struct rbuf_entry {
     };
 };
 
+/* A ring buffer is only written by its CPU, with tracing disabled on the CPU so that writes never
+ * nest; readers run concurrently with the writer without stopping tracing. The writer publishes
+ * an entry by advancing write_idx after filling it, and readers release entries by advancing
+ * read_idx after consuming them, so no lock is taken on the write side; rb_lock only serializes
+ * readers among themselves. */
 struct rbuf {
     struct rbuf_entry * trace_array;
     struct spinlock rb_lock;
-    unsigned long count; /* current number of unconsumed items */
     unsigned long total_written; /* total items ever written */
     unsigned long size;
     unsigned long read_idx;
     unsigned long local_idx;    /* index while iterating (but not consuming) */
     unsigned long write_idx;
+    unsigned long export_end;   /* end of the entries being exported in binary form */
+    unsigned long export_pages; /* binary pages still to be exported */
     cpuinfo ci;
 };
 
@@ -125,6 +135,7 @@ struct ftrace_printer {
 #define TRACE_FLAG_HTTP         0x2 /* http based access */
 #define TRACE_FLAG_HEADER       0x4 /* print a header along with the data */
 #define TRACE_FLAG_DESTRUCTIVE  0x8 /* reads consume the buffer data */
+#define TRACE_FLAG_BINARY       0x10 /* binary (trace.dat) data */
 
 struct ftrace_tracer {
     /* human readable */
@@ -188,7 +199,10 @@ ftrace_graph_t  __ftrace_graph_entry_fn = (ftrace_graph_t)ftrace_stub;
 ftrace_graph_t __ftrace_graph_return_fn = (ftrace_graph_t)ftrace_stub;
 
 
+/* indexed by CPU number, with room for all present CPUs */
 static vector cpu_rbufs;
+static u64 cpu_rbuf_kb;
+static closure_struct(thunk, cpu_online);
 
 /*
  * helper to write a buffer to userspace, paying attention
@@ -414,6 +428,14 @@ printer_print_duration_usec(struct ftrace_printer * p, timestamp num, u16 width)
 #define rbuf_next_write_idx(r)  rbuf_next_idx(r, r->write_idx)
 #define rbuf_next_read_idx(r)   rbuf_next_idx(r, r->read_idx)
 
+/* number of unconsumed items */
+static inline __attribute__((always_inline)) unsigned long
+rbuf_count(struct rbuf * rbuf)
+{
+    unsigned long write_idx = rbuf->write_idx, read_idx = rbuf->read_idx;
+    return (write_idx >= read_idx) ? write_idx - read_idx : rbuf->size - read_idx + write_idx;
+}
+
 static inline __attribute__((always_inline)) void
 rbuf_lock(struct rbuf * rbuf) {
     spin_lock(&rbuf->rb_lock);
@@ -426,7 +448,6 @@ rbuf_unlock(struct rbuf * rbuf) {
 static void
 rbuf_reset(struct rbuf * rbuf)
 {
-    rbuf->count = 0;
     rbuf->local_idx = 0;
     rbuf->read_idx = 0;
     rbuf->write_idx = 0;
@@ -500,36 +521,47 @@ global_rbuf_disable(void)
         rbuf_disable(rb);
 }
 
-/* must be locked before calling */
+/* must be called on the rbuf CPU with the rbuf disabled; the entry is not visible to readers
+ * until __rbuf_commit_write_entry() is called */
 static inline __attribute__((always_inline)) boolean
 __rbuf_acquire_write_entry(struct rbuf * rbuf, struct rbuf_entry ** acquired)
 {
-    if (rbuf->count == rbuf->size - 1)
+    if (rbuf_count(rbuf) == rbuf->size - 1)
         return false;
 
     *acquired = &(rbuf->trace_array[rbuf->write_idx]);
+    return true;
+}
 
+static inline __attribute__((always_inline)) void
+__rbuf_commit_write_entry(struct rbuf * rbuf)
+{
+    /* the entry contents must be visible before the new write index */
+    compiler_barrier();
     rbuf->write_idx = rbuf_next_write_idx(rbuf);
-    rbuf->count++;
     rbuf->total_written++;
-    if (rbuf->count == rbuf->size - 1)
+    if (rbuf_count(rbuf) == rbuf->size - 1)
         ft_debug("FTRACE: buffer full (cpu %d)\n", current_cpu()->id);
+}
 
-    return true;
+/* Returns the end of the entries currently readable; entries from read_idx up to this index stay
+ * valid until released. Must be locked before calling. */
+static inline __attribute__((always_inline)) unsigned long
+__rbuf_read_end(struct rbuf * rbuf)
+{
+    unsigned long end = rbuf->write_idx;
+    /* entry contents must not be read before the write index */
+    compiler_barrier();
+    return end;
 }
 
 /* must be locked before calling */
-static inline __attribute__((always_inline)) boolean
-__rbuf_acquire_read_entry(struct rbuf * rbuf, struct rbuf_entry ** acquired)
+static inline __attribute__((always_inline)) void
+__rbuf_release_read_entries(struct rbuf * rbuf, unsigned long idx)
 {
-    if (rbuf->count == 0)
-        return false;
-
-    *acquired = &(rbuf->trace_array[rbuf->read_idx]);
-
-    rbuf->read_idx = rbuf_next_read_idx(rbuf);
-    rbuf->count--;
-    return true;
+    /* entry contents must be consumed before the writer can reuse them */
+    compiler_barrier();
+    rbuf->read_idx = idx;
 }
 
 /*** Start tracer callbacks */
@@ -557,18 +589,16 @@ NOTRACE static void
 function_trace(unsigned long ip, unsigned long parent_ip)
 {
     struct rbuf *rb = vector_get(cpu_rbufs, current_cpu()->id);
-    assert(rb != 0);
+    if (!rb)    /* hot-added CPU not set up yet */
+        return;
     struct rbuf_entry * entry;
     struct rbuf_entry_function * func;
 
     /* disable any more events while we're in here */
     rbuf_disable(rb);
 
-    rbuf_lock(rb);
-    if (!__rbuf_acquire_write_entry(rb, &entry)) {
-        rbuf_unlock(rb);
+    if (!__rbuf_acquire_write_entry(rb, &entry))
         goto drop;
-    }
 
     func = &(entry->func);
     func->cpu = current_cpu()->id;
@@ -587,11 +617,12 @@ function_trace(unsigned long ip, unsigned long parent_ip)
     else
         func->sym_name = 0;
 
-    rbuf_unlock(rb);
+    __rbuf_commit_write_entry(rb);
     rbuf_enable(rb);
     return;
 drop:
     /* XXX count the drop */
+    rbuf_enable(rb);
     return;
 }
 
@@ -668,11 +699,8 @@ function_graph_trace_switch(thread out, thread in)
     struct rbuf_entry * entry;
     struct rbuf_entry_switch * sw;
 
-    rbuf_lock(rb);
-    if (!__rbuf_acquire_write_entry(rb, &entry)) {
-        rbuf_unlock(rb);
+    if (!__rbuf_acquire_write_entry(rb, &entry))
         goto drop;
-    }
 
     sw = &(entry->sw);
     sw->depth = TRACE_GRAPH_SWITCH_DEPTH;
@@ -692,7 +720,7 @@ function_graph_trace_switch(thread out, thread in)
     } else
         sw->sym_name_out = 0;
 
-    rbuf_unlock(rb);
+    __rbuf_commit_write_entry(rb);
     return;
 drop:
     /* XXX count the drop */
@@ -710,21 +738,19 @@ function_graph_trace_entry(struct ftrace_graph_entry * stack_entry)
     struct rbuf_entry * entry;
     struct rbuf_entry_function_graph * graph;
 
-    rbuf_lock(rb);
-    if (!__rbuf_acquire_write_entry(rb, &entry)) {
-        rbuf_unlock(rb);
+    if (!__rbuf_acquire_write_entry(rb, &entry))
         goto drop;
-    }
 
     graph = &(entry->graph);
     graph->ip = stack_entry->func;
     graph->duration = UNTIMED;
+    graph->ts = stack_entry->entry_ts;
     graph->cpu = stack_entry->cpu;
     graph->depth = stack_entry->depth;
     graph->has_child = 1;
     graph->tid = stack_entry->tid;
 
-    rbuf_unlock(rb);
+    __rbuf_commit_write_entry(rb);
     return;
 drop:
     /* XXX count the drop */
@@ -742,22 +768,20 @@ function_graph_trace_return(struct ftrace_graph_entry * stack_entry)
     struct rbuf_entry * entry;
     struct rbuf_entry_function_graph * graph;
 
-    rbuf_lock(rb);
-    if (!__rbuf_acquire_write_entry(rb, &entry)) {
-        rbuf_unlock(rb);
+    if (!__rbuf_acquire_write_entry(rb, &entry))
         goto drop;
-    }
 
     graph = &(entry->graph);
     graph->depth = stack_entry->depth;
     graph->ip = stack_entry->func;
     graph->duration = (stack_entry->return_ts - stack_entry->entry_ts);
+    graph->ts = stack_entry->return_ts;
     graph->cpu = stack_entry->cpu;
     graph->has_child = stack_entry->has_child;
     graph->flush = graph->has_child; //stack_entry->flush;
     graph->tid = stack_entry->tid;
 
-    rbuf_unlock(rb);
+    __rbuf_commit_write_entry(rb);
     return;
 drop:
     /* XXX count the drop */
@@ -858,15 +882,19 @@ static boolean
 ftrace_print_rbuf_destructive(struct ftrace_printer * p, struct rbuf * rbuf,
                               struct ftrace_tracer * tracer)
 {
-    struct rbuf_entry * entry;
+    unsigned long idx = rbuf->read_idx;
+    unsigned long end = __rbuf_read_end(rbuf);
 
-    while (__rbuf_acquire_read_entry(rbuf, &entry)) {
-        tracer->print_entry_fn(p, entry);
+    /* entries written while printing are left for the next read */
+    while (idx != end) {
+        tracer->print_entry_fn(p, &(rbuf->trace_array[idx]));
+        idx = rbuf_next_idx(rbuf, idx);
         if (printer_length(p) >= printer_size(p))
             break;
     }
+    __rbuf_release_read_entries(rbuf, idx);
 
-    return rbuf->count > 0;     /* more */
+    return idx != end;          /* more */
 }
 
 static boolean
@@ -1016,6 +1044,10 @@ FTRACE_FN(current_tracer, put)(struct ftrace_printer * p)
 
         if (runtime_strcmp(tracer->name, str) == 0) {
             if (tracer != current_tracer) {
+                if (tracedat_is_open) {
+                    ret = -EBUSY;
+                    goto out;
+                }
                 global_rbuf_disable();
 
                 /* clear the rbuf */
@@ -1165,10 +1197,13 @@ FTRACE_FN(trace, put)(struct ftrace_printer * p)
 {
     struct rbuf *rb;
 
-    /* writes clear the trace buffer */
+    if (tracedat_is_open)
+        return -EBUSY;
+
+    /* writes clear the trace buffer (by consuming all its entries, as tracing may be running) */
     vector_foreach(cpu_rbufs, rb) {
         rbuf_lock(rb);
-        rbuf_reset(rb);
+        __rbuf_release_read_entries(rb, __rbuf_read_end(rb));
         rbuf_unlock(rb);
     }
 
@@ -1309,7 +1344,7 @@ FTRACE_FN(trace_pipe, init)(struct ftrace_printer * p, u64 flags)
 {
     struct rbuf *rb;
 
-    if (trace_pipe_is_open)
+    if (trace_pipe_is_open || tracedat_is_open)
         return -EBUSY;
 
     if (printer_init(p, flags | TRACE_FLAG_DESTRUCTIVE))
@@ -1334,9 +1369,9 @@ FTRACE_FN(trace_pipe, deinit)(struct ftrace_printer * p)
     return 0;
 }
 
-/* having trace_pipe open does not disable tracing, but
- * to prevent this from running forever we've got to disable
- * it here
+/* having trace_pipe open does not disable tracing; to prevent this from
+ * running forever, each read only covers the entries written before it
+ * started
  */
 static sysreturn
 FTRACE_FN(trace_pipe, get)(struct ftrace_printer * p)
@@ -1344,7 +1379,6 @@ FTRACE_FN(trace_pipe, get)(struct ftrace_printer * p)
     struct rbuf *rb;
     sysreturn rv = 0;
 
-    global_rbuf_disable();
     vector_foreach(cpu_rbufs, rb) {
         rbuf_lock(rb);
         if (ftrace_print_rbuf(p, rb, current_tracer))
@@ -1353,7 +1387,6 @@ FTRACE_FN(trace_pipe, get)(struct ftrace_printer * p)
         if (rv)
             break;
     }
-    global_rbuf_enable();
 
     return rv;
 }
@@ -1403,17 +1436,414 @@ FTRACE_FN(trace_pipe, events)(file f)
     struct rbuf *rb;
 
     vector_foreach(cpu_rbufs, rb) {
-        rbuf_lock(rb);
-        if (rb->count != 0)
+        if (rbuf_count(rb) != 0) {
             mask |= EPOLLIN;
-        rbuf_unlock(rb);
-        if (mask)
             break;
+        }
     }
 
     return mask;
 }
 
+/*
+ * trace.dat callbacks
+ *
+ * Reads are destructive and stream the trace in the trace-cmd binary format (trace.dat version
+ * 6), which can be loaded by "trace-cmd report" and KernelShark. Tracing keeps running while the
+ * data is sent: each request covers the entries written before it started, which are first
+ * scanned to size the per-CPU data sections (whose offsets are in the file header), then sent as
+ * pages in the Linux ring buffer format and released.
+ */
+#define TRACEDAT_PAGE_SIZE          PAGESIZE
+#define TRACEDAT_PAGE_HDR_SIZE      16  /* timestamp, commit */
+
+/* event header: type_len in the lower 5 bits (data length in 32-bit words if up to 28), time delta
+ * from the previous event in the upper 27 bits */
+#define TRACEDAT_TYPE_TIME_EXTEND   30
+#define TRACEDAT_TIME_DELTA_BITS    27
+
+#define TRACEDAT_FUNCTION_ID        1
+#define TRACEDAT_FUNCGRAPH_EXIT_ID  10
+#define TRACEDAT_FUNCGRAPH_ENTRY_ID 11
+
+#define TRACEDAT_OPTION_DONE        0
+#define TRACEDAT_OPTION_TRACECLOCK  4
+
+struct tracedat_common {
+    u16 type;
+    u8 flags;
+    u8 preempt_count;
+    s32 pid;
+} __attribute__((packed));
+
+struct tracedat_function {
+    struct tracedat_common common;
+    u64 ip;
+    u64 parent_ip;
+} __attribute__((packed));
+
+struct tracedat_funcgraph_entry {
+    struct tracedat_common common;
+    u64 func;
+    s32 depth;
+} __attribute__((packed));
+
+struct tracedat_funcgraph_exit {
+    struct tracedat_common common;
+    u64 func;
+    s32 depth;
+    u32 overrun;
+    u64 calltime;
+    u64 rettime;
+} __attribute__((packed));
+
+/* page space an rbuf entry can take: up to 2 events, each possibly preceded by a time extend */
+#define TRACEDAT_ENTRY_MAX  (2 * (8 + 4 + sizeof(struct tracedat_funcgraph_exit)))
+
+struct tracedat_page {
+    u8 * data;
+    u64 len;        /* event data length */
+    u64 ts;         /* timestamp of the last event */
+    table syms;     /* if non-zero, collects the functions referenced by events */
+};
+
+static const sstring tracedat_header_page = ss_static_init(
+    "\tfield: u64 timestamp;\toffset:0;\tsize:8;\tsigned:0;\n"
+    "\tfield: local_t commit;\toffset:8;\tsize:8;\tsigned:1;\n"
+    "\tfield: int overwrite;\toffset:8;\tsize:1;\tsigned:1;\n"
+    "\tfield: char data;\toffset:16;\tsize:4080;\tsigned:1;\n");
+
+static const sstring tracedat_header_event = ss_static_init(
+    "# compressed entry header\n"
+    "\ttype_len    :    5 bits\n"
+    "\ttime_delta  :   27 bits\n"
+    "\tarray       :   32 bits\n"
+    "\n"
+    "\tpadding     : type == 29\n"
+    "\ttime_extend : type == 30\n"
+    "\ttime_stamp : type == 31\n"
+    "\tdata max type_len  == 28\n");
+
+#define TRACEDAT_COMMON_FORMAT\
+    "format:\n"\
+    "\tfield:unsigned short common_type;\toffset:0;\tsize:2;\tsigned:0;\n"\
+    "\tfield:unsigned char common_flags;\toffset:2;\tsize:1;\tsigned:0;\n"\
+    "\tfield:unsigned char common_preempt_count;\toffset:3;\tsize:1;\tsigned:0;\n"\
+    "\tfield:int common_pid;\toffset:4;\tsize:4;\tsigned:1;\n"\
+    "\n"
+
+static const sstring tracedat_ftrace_formats[] = {
+    ss_static_init(
+    "name: function\n"
+    "ID: 1\n"
+    TRACEDAT_COMMON_FORMAT
+    "\tfield:unsigned long ip;\toffset:8;\tsize:8;\tsigned:0;\n"
+    "\tfield:unsigned long parent_ip;\toffset:16;\tsize:8;\tsigned:0;\n"
+    "\n"
+    "print fmt: \" %ps <-- %ps\", (void *)REC->ip, (void *)REC->parent_ip\n"),
+
+    ss_static_init(
+    "name: funcgraph_exit\n"
+    "ID: 10\n"
+    TRACEDAT_COMMON_FORMAT
+    "\tfield:unsigned long func;\toffset:8;\tsize:8;\tsigned:0;\n"
+    "\tfield:int depth;\toffset:16;\tsize:4;\tsigned:1;\n"
+    "\tfield:unsigned int overrun;\toffset:20;\tsize:4;\tsigned:0;\n"
+    "\tfield:unsigned long long calltime;\toffset:24;\tsize:8;\tsigned:0;\n"
+    "\tfield:unsigned long long rettime;\toffset:32;\tsize:8;\tsigned:0;\n"
+    "\n"
+    "print fmt: \"<-- %ps (%d) (start: %llx  end: %llx) over: %d\", (void *)REC->func, "
+    "REC->depth, REC->calltime, REC->rettime, REC->depth\n"),
+
+    ss_static_init(
+    "name: funcgraph_entry\n"
+    "ID: 11\n"
+    TRACEDAT_COMMON_FORMAT
+    "\tfield:unsigned long func;\toffset:8;\tsize:8;\tsigned:0;\n"
+    "\tfield:int depth;\toffset:16;\tsize:4;\tsigned:1;\n"
+    "\n"
+    "print fmt: \"--> %ps (%d)\", (void *)REC->func, REC->depth\n"),
+};
+#define TRACEDAT_NR_FTRACE_FORMATS  (sizeof(tracedat_ftrace_formats) / sizeof(sstring))
+
+static struct ftrace_printer tracedat_printer;
+static u32 tracedat_cpus;
+
+static void
+tracedat_add_sym(struct tracedat_page * tp, unsigned long ip)
+{
+    u64 offset;
+
+    if (tp->syms && !sstring_is_null(find_elf_sym(ip, &offset, 0)))
+        table_set(tp->syms, pointer_from_u64(ip - offset), pointer_from_u64(ip - offset));
+}
+
+static void
+tracedat_write_event(struct tracedat_page * tp, u64 ts, void * event, u32 len)
+{
+    u32 * p = (u32 *)(tp->data + TRACEDAT_PAGE_HDR_SIZE + tp->len);
+    u64 delta;
+
+    if (tp->len == 0) {
+        /* the page timestamp is the time of its first event */
+        *(u64 *)tp->data = ts;
+        tp->ts = ts;
+    }
+
+    /* entries flushed on a context switch can be slightly out of order */
+    delta = (ts > tp->ts) ? ts - tp->ts : 0;
+    if (delta >> TRACEDAT_TIME_DELTA_BITS) {
+        p[0] = TRACEDAT_TYPE_TIME_EXTEND | ((delta & MASK(TRACEDAT_TIME_DELTA_BITS)) << 5);
+        p[1] = delta >> TRACEDAT_TIME_DELTA_BITS;
+        p += 2;
+        tp->len += 2 * sizeof(u32);
+        delta = 0;
+    }
+    p[0] = (len / sizeof(u32)) | (delta << 5);
+    runtime_memcpy(p + 1, event, len);
+    tp->len += sizeof(u32) + len;
+    if (ts > tp->ts)
+        tp->ts = ts;
+}
+
+static void
+tracedat_write_entry(struct tracedat_page * tp, struct rbuf_entry * entry)
+{
+    if (current_tracer == &tracer_list[FTRACE_FUNCTION_IDX]) {
+        struct rbuf_entry_function * func = &(entry->func);
+        struct tracedat_function ev = {
+            .common = { .type = TRACEDAT_FUNCTION_ID, .pid = func->tid },
+            .ip = func->ip,
+            .parent_ip = func->parent_ip,
+        };
+
+        tracedat_add_sym(tp, func->ip);
+        tracedat_add_sym(tp, func->parent_ip);
+        tracedat_write_event(tp, func->ts, &ev, sizeof(ev));
+    } else if (current_tracer == &tracer_list[FTRACE_FUNCTION_GRAPH_IDX]) {
+        struct rbuf_entry_function_graph * graph = &(entry->graph);
+
+        if (graph->depth == TRACE_GRAPH_SWITCH_DEPTH)
+            return;
+        tracedat_add_sym(tp, graph->ip);
+
+        /* functions without children only have a return entry */
+        if (graph->duration == UNTIMED || !graph->has_child) {
+            struct tracedat_funcgraph_entry ev = {
+                .common = { .type = TRACEDAT_FUNCGRAPH_ENTRY_ID, .pid = graph->tid },
+                .func = graph->ip,
+                .depth = graph->depth,
+            };
+            timestamp ts = graph->ts;
+
+            if (graph->duration != UNTIMED)
+                ts -= graph->duration;
+            tracedat_write_event(tp, nsec_from_timestamp(ts), &ev, sizeof(ev));
+        }
+        if (graph->duration != UNTIMED) {
+            struct tracedat_funcgraph_exit ev = {
+                .common = { .type = TRACEDAT_FUNCGRAPH_EXIT_ID, .pid = graph->tid },
+                .func = graph->ip,
+                .depth = graph->depth,
+                .calltime = nsec_from_timestamp(graph->ts - graph->duration),
+                .rettime = nsec_from_timestamp(graph->ts),
+            };
+
+            tracedat_write_event(tp, ev.rettime, &ev, sizeof(ev));
+        }
+    }
+}
+
+/* fills a page with the events of the entries starting at idx, and returns the index of the first
+ * entry not consumed; the page is empty only if no entry up to end generates an event */
+static unsigned long
+tracedat_fill_page(struct tracedat_page * tp, struct rbuf * rbuf,
+                   unsigned long idx, unsigned long end)
+{
+    zero(tp->data, TRACEDAT_PAGE_SIZE);
+    tp->len = 0;
+    while (idx != end &&
+           TRACEDAT_PAGE_HDR_SIZE + tp->len + TRACEDAT_ENTRY_MAX <= TRACEDAT_PAGE_SIZE) {
+        tracedat_write_entry(tp, &(rbuf->trace_array[idx]));
+        idx = rbuf_next_idx(rbuf, idx);
+    }
+    *(u64 *)(tp->data + sizeof(u64)) = tp->len;
+    return idx;
+}
+
+/* writes a string literal including its terminator */
+#define tracedat_write_string(b, str)   buffer_write(b, str, sizeof(str))
+
+static void
+tracedat_write_file(buffer b, sstring contents)
+{
+    buffer_write_le64(b, contents.len);
+    buffer_write(b, contents.ptr, contents.len);
+}
+
+static sysreturn
+tracedat_write_header(struct ftrace_printer * p)
+{
+    buffer b = printer_buffer(p);
+    struct tracedat_page tp;
+    struct rbuf *rb;
+    u64 len_offset, offset;
+    int i;
+
+    tp.data = allocate(ftrace_heap, TRACEDAT_PAGE_SIZE);
+    if (tp.data == INVALID_ADDRESS)
+        return -ENOMEM;
+    tp.syms = allocate_table(ftrace_heap, identity_key, pointer_equal);
+    if (tp.syms == INVALID_ADDRESS) {
+        deallocate(ftrace_heap, tp.data, TRACEDAT_PAGE_SIZE);
+        return -ENOMEM;
+    }
+
+    /* size the data of each CPU, and collect the functions it references */
+    tracedat_cpus = vector_length(cpu_rbufs);
+    for (i = 0; i < tracedat_cpus; i++) {
+        unsigned long idx;
+
+        rb = vector_get(cpu_rbufs, i);
+        rbuf_lock(rb);
+        idx = rb->read_idx;
+        rb->export_end = __rbuf_read_end(rb);
+        rb->export_pages = 0;
+        while (idx != rb->export_end) {
+            idx = tracedat_fill_page(&tp, rb, idx, rb->export_end);
+            if (tp.len)
+                rb->export_pages++;
+        }
+        rbuf_unlock(rb);
+    }
+    deallocate(ftrace_heap, tp.data, TRACEDAT_PAGE_SIZE);
+
+    /* initial format */
+    buffer_write(b, "\x17\x08\x44tracing", 10);
+    tracedat_write_string(b, "6");
+    buffer_write_byte(b, 0);    /* little endian */
+    buffer_write_byte(b, sizeof(unsigned long));
+    buffer_write_le32(b, TRACEDAT_PAGE_SIZE);
+
+    /* header info */
+    tracedat_write_string(b, "header_page");
+    tracedat_write_file(b, tracedat_header_page);
+    tracedat_write_string(b, "header_event");
+    tracedat_write_file(b, tracedat_header_event);
+
+    /* ftrace event formats, no other event systems */
+    buffer_write_le32(b, TRACEDAT_NR_FTRACE_FORMATS);
+    for (i = 0; i < TRACEDAT_NR_FTRACE_FORMATS; i++)
+        tracedat_write_file(b, tracedat_ftrace_formats[i]);
+    buffer_write_le32(b, 0);
+
+    /* kallsyms, limited to the traced functions */
+    len_offset = buffer_length(b);
+    buffer_write_le32(b, 0);
+    table_foreach(tp.syms, k, v) {
+        (void)v;
+        bprintf(b, "%016lx t %s\n", u64_from_pointer(k), find_elf_sym(u64_from_pointer(k), 0, 0));
+    }
+    *(u32 *)buffer_ref(b, len_offset) = buffer_length(b) - len_offset - sizeof(u32);
+    deallocate_table(tp.syms);
+
+    /* no trace_printk formats or cmdlines */
+    buffer_write_le32(b, 0);
+    buffer_write_le64(b, 0);
+
+    buffer_write_le32(b, tracedat_cpus);
+    tracedat_write_string(b, "options  ");
+    {
+        sstring clock = (current_tracer == &tracer_list[FTRACE_FUNCTION_IDX]) ?
+                        ss("[x86-tsc]\n") : ss("[mono_raw]\n");
+        buffer_write_le16(b, TRACEDAT_OPTION_TRACECLOCK);
+        buffer_write_le32(b, clock.len + 1);
+        buffer_write(b, clock.ptr, clock.len);
+        buffer_write_byte(b, 0);
+    }
+    buffer_write_le16(b, TRACEDAT_OPTION_DONE);
+
+    /* per-CPU data, page aligned after the header */
+    tracedat_write_string(b, "flyrecord");
+    offset = pad(buffer_length(b) + tracedat_cpus * 2 * sizeof(u64), TRACEDAT_PAGE_SIZE);
+    for (i = 0; i < tracedat_cpus; i++) {
+        rb = vector_get(cpu_rbufs, i);
+        buffer_write_le64(b, offset);
+        buffer_write_le64(b, rb->export_pages * TRACEDAT_PAGE_SIZE);
+        offset += rb->export_pages * TRACEDAT_PAGE_SIZE;
+    }
+    len_offset = pad(buffer_length(b), TRACEDAT_PAGE_SIZE) - buffer_length(b);
+    if (!buffer_extend(b, len_offset))
+        return -ENOMEM;
+    zero(buffer_end(b), len_offset);
+    buffer_produce(b, len_offset);
+
+    return 1;   /* data to follow */
+}
+
+static sysreturn
+FTRACE_FN(trace_dat, init)(struct ftrace_printer * p, u64 flags)
+{
+    if (tracedat_is_open || trace_pipe_is_open)
+        return -EBUSY;
+
+    if (printer_init(p, flags | TRACE_FLAG_HEADER | TRACE_FLAG_DESTRUCTIVE | TRACE_FLAG_BINARY))
+        return -ENOMEM;
+
+    tracedat_is_open = true;
+    return 0;
+}
+
+static sysreturn
+FTRACE_FN(trace_dat, deinit)(struct ftrace_printer * p)
+{
+    assert(tracedat_is_open);
+    tracedat_is_open = false;
+    printer_deinit(p);
+    return 0;
+}
+
+static sysreturn
+FTRACE_FN(trace_dat, get)(struct ftrace_printer * p)
+{
+    buffer b = printer_buffer(p);
+    struct tracedat_page tp;
+    struct rbuf *rb;
+    int i;
+
+    if (p->flags & TRACE_FLAG_HEADER)
+        return tracedat_write_header(p);
+
+    tp.syms = 0;
+    for (i = 0; i < tracedat_cpus; i++) {
+        rb = vector_get(cpu_rbufs, i);
+        rbuf_lock(rb);
+        while (rb->export_pages > 0) {
+            unsigned long idx;
+
+            if (printer_length(p) + TRACEDAT_PAGE_SIZE > printer_size(p)) {
+                rbuf_unlock(rb);
+                return 1;   /* more to send */
+            }
+            if (!buffer_extend(b, TRACEDAT_PAGE_SIZE)) {
+                rbuf_unlock(rb);
+                return -ENOMEM;
+            }
+            tp.data = buffer_end(b);
+            idx = tracedat_fill_page(&tp, rb, rb->read_idx, rb->export_end);
+            __rbuf_release_read_entries(rb, idx);
+            buffer_produce(b, TRACEDAT_PAGE_SIZE);
+            rb->export_pages--;
+        }
+
+        /* trailing entries without events */
+        __rbuf_release_read_entries(rb, rb->export_end);
+        rbuf_unlock(rb);
+    }
+
+    return 0;
+}
+
 /*
  * tracing_on callbacks
  */
@@ -1557,6 +1987,10 @@ routine_list[] = {
     FTRACE_ROUTINE(
         "trace_pipe", _INIT(trace_pipe), _DEINIT(trace_pipe), _GET(trace_pipe),
         0, &trace_pipe_printer
+    ),
+    FTRACE_ROUTINE(
+        "trace.dat", _INIT(trace_dat), _DEINIT(trace_dat), _GET(trace_dat),
+        0, &tracedat_printer
     )
 };
 #define FTRACE_NR_ROUTINES (sizeof(routine_list) / sizeof(struct ftrace_routine))
@@ -1590,11 +2024,12 @@ format_usage_buffer(void)
 }
 
 static void
-ftrace_send_http_chunked_response(http_responder handler)
+ftrace_send_http_chunked_response(http_responder handler, boolean binary)
 {
     status s;
 
-    s = send_http_chunked_response(handler, timm("ContentType", "text/html"));
+    s = send_http_chunked_response(handler, timm("ContentType", "%s",
+        binary ? ss("application/octet-stream") : ss("text/html")));
     if (!is_ok(s))
         msg_err("ftrace: failed to send HTTP response\n");
 }
@@ -1654,6 +2089,7 @@ __ftrace_send_http_chunk_internal(struct ftrace_routine * routine, struct ftrace
                                   boolean local_printer, http_responder out)
 {
     sysreturn ret;
+    boolean live = !!(p->flags & TRACE_FLAG_DESTRUCTIVE);
     ret = routine->get_fn(p);
 
     /* no real error handling for http get here */
@@ -1694,7 +2130,8 @@ __ftrace_send_http_chunk_internal(struct ftrace_routine * routine, struct ftrace
         goto send_http_chunk_failed;
 
     /* XXX re-enable tracing --- ideally this would move to a completion handler */
-    global_rbuf_enable();
+    if (!live)
+        global_rbuf_enable();
 
     return false;
 
@@ -1754,8 +2191,10 @@ __ftrace_do_http_method(http_responder out, struct ftrace_routine * routine,
     /* set the max size of the printer to the largest possible */
     printer_set_size(p, TRACE_PRINTER_MAX_SIZE);
 
-    /* XXX disable any more tracing while we're spooling this out ... */
-    global_rbuf_disable();
+    /* XXX disable any more tracing while we're spooling this out ... (destructive reads only
+     * cover the data written before they started, and can run along with tracing) */
+    if (!(p->flags & TRACE_FLAG_DESTRUCTIVE))
+        global_rbuf_disable();
 
     /* get/put */
     if (is_put) {
@@ -1776,7 +2215,7 @@ __ftrace_do_http_method(http_responder out, struct ftrace_routine * routine,
         }
         ftrace_send_http_response(out, printer_buffer(p));
     } else {
-        ftrace_send_http_chunked_response(out);
+        ftrace_send_http_chunked_response(out, !!(p->flags & TRACE_FLAG_BINARY));
         if (__ftrace_send_http_chunk_internal(routine, p, local_printer, out))
         {
             timer_handler t = closure(ftrace_heap, __ftrace_send_http_chunk, routine,
@@ -1879,6 +2318,30 @@ init_http_listener(void)
     return 0;
 }
 
+/* Sets up tracing on a CPU hot-added after initialization; its ring buffer is published last, as
+ * the tracing hooks skip CPUs that do not have one. */
+closure_func_basic(thunk, void, ftrace_cpu_online)
+{
+    cpuinfo ci = current_cpu();
+    if (vector_get(cpu_rbufs, ci->id))
+        return;
+    struct rbuf *rb = allocate_rbuf(ftrace_heap, cpu_rbuf_kb);
+    if (rb == INVALID_ADDRESS) {
+        msg_err("unable to allocate cpu rbuf\n");
+        return;
+    }
+    if (ftrace_cpu_init(ci) != 0) {
+        deallocate(rbuf_heap, rb->trace_array, sizeof(struct rbuf_entry) * rb->size);
+        deallocate(ftrace_heap, rb, sizeof(struct rbuf));
+        return;
+    }
+    if (tracing_on)
+        ci->m.ftrace_disable_cnt = 0;
+    rb->ci = ci;
+    write_barrier();
+    vector_set(cpu_rbufs, ci->id, rb);
+}
+
 int
 ftrace_init(unix_heaps uh, filesystem fs)
 {
@@ -1888,15 +2351,15 @@ ftrace_init(unix_heaps uh, filesystem fs)
     ftrace_heap = heap_locked(&(uh->kh));
     rbuf_heap = (heap)heap_page_backed(&(uh->kh));
 
-    cpu_rbufs = allocate_vector(ftrace_heap, total_processors);
+    cpu_rbufs = allocate_vector(ftrace_heap, present_processors);
     if (cpu_rbufs == INVALID_ADDRESS) {
         msg_err("unable to allocate rbufs vector\n");
         return -1;
     }
-    u64 per_cpu_kb = DEFAULT_TRACE_ARRAY_SIZE_KB / total_processors;
+    cpu_rbuf_kb = DEFAULT_TRACE_ARRAY_SIZE_KB / total_processors;
 
     vector_foreach(cpuinfos, ci) {
-        struct rbuf *rb = allocate_rbuf(ftrace_heap, per_cpu_kb);
+        struct rbuf *rb = allocate_rbuf(ftrace_heap, cpu_rbuf_kb);
         if (rb == INVALID_ADDRESS) {
             msg_err("unable to allocate cpu rbuf\n");
             return -1;
@@ -1916,6 +2379,7 @@ ftrace_init(unix_heaps uh, filesystem fs)
         if (ftrace_cpu_init(ci) != 0)
             return -1;
     }
+    register_percpu_init(init_closure_func(&cpu_online, thunk, ftrace_cpu_online));
     return 0;
 }
 
@@ -1979,7 +2443,8 @@ NOTRACE void
 ftrace_thread_switch(thread out, thread in)
 {
     struct rbuf *rb = vector_get(cpu_rbufs, current_cpu()->id);
-    assert(rb != 0);
+    if (!rb)
+        return;
     if (!rbuf_enabled(rb) ||
         (current_tracer != &tracer_list[FTRACE_FUNCTION_GRAPH_IDX]))
     {
@@ -2042,7 +2507,8 @@ prepare_ftrace_return(unsigned long self, unsigned long * parent,
     int depth;
     cpuinfo ci = current_cpu();
     struct rbuf *rb = vector_get(cpu_rbufs, ci->id);
-    assert(rb != 0);
+    if (!rb)
+        return;
 
     if (!rbuf_enabled(rb) ||
         (ci->graph_idx == FTRACE_THREAD_DISABLE_IDX))
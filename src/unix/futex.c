@@ -1,32 +1,90 @@
 #include <unix_internal.h>
 
+/* Futexes are kept in a per-process hash of buckets, each with its own lock,
+   so that unrelated futex operations do not serialize on the process lock. */
+#define FUTEX_HASH_ORDER        8
+#define FUTEX_HASH_BUCKETS      U64_FROM_BIT(FUTEX_HASH_ORDER)
+
+#define FUTEX_WAITERS           0x80000000
+#define FUTEX_OWNER_DIED        0x40000000
+#define FUTEX_TID_MASK          0x3fffffff
+
+#define FUTEX_BITSET_MATCH_ANY  0xffffffff
+
+struct futex_bucket {
+    struct spinlock lock;
+    struct list futexes;
+};
+
 struct futex {
     heap h;
     blockq bq;
     struct spinlock lock;
+    struct list l;              /* embedding on futex_bucket->futexes */
+    struct list vwaiters;       /* of struct futex_vwaiter */
+    u64 key;
+};
+
+/* A futex_waitv() operation waits on multiple futexes with one waiter queued on each futex; the
+ * first futex woken up records its index, and the thread waits on the blockq of the operation.
+ * Waiters of an operation that has already been woken up are skipped by wakeups, so that no
+ * wakeup is lost to them. */
+struct futex_waitv_op;
+
+struct futex_vwaiter {
+    struct list l;              /* embedding on futex->vwaiters */
+    struct futex *f;
+    struct futex_waitv_op *op;
+};
+
+struct futex_waitv_op {
+    heap h;
+    blockq bq;
+    u32 nr;
+    u32 queued;                 /* number of waiters queued */
+    u32 woken;                  /* index of the first futex woken up, nr if none */
+    struct futex_vwaiter w[];
 };
 
 #define futex_lock(f)   spin_lock(&(f)->lock)
 #define futex_unlock(f) spin_unlock(&(f)->lock)
 
-static u64 futex_key_function(void *x)
+static struct futex_bucket *futex_bucket_from_key(process p, u64 key)
 {
-    return u64_from_pointer(x);
+    /* Fibonacci hashing spreads the (int-aligned) user addresses. */
+    return &p->futices[(key * 0x9e3779b97f4a7c15ull) >> (64 - FUTEX_HASH_ORDER)];
 }
 
-static boolean futex_key_equal(void *a, void *b)
+static struct futex *futex_find_locked(struct futex_bucket *b, u64 key)
 {
-    return a == b;
+    list_foreach(&b->futexes, l) {
+        struct futex *f = struct_from_list(l, struct futex *, l);
+        if (f->key == key)
+            return f;
+    }
+    return 0;
+}
+
+/* Look up an existing futex without allocating; wake paths use this, as
+   there can be no waiters on a futex that was never created. */
+static struct futex *futex_find(process p, u64 key)
+{
+    struct futex_bucket *b = futex_bucket_from_key(p, key);
+    spin_lock(&b->lock);
+    struct futex *f = futex_find_locked(b, key);
+    spin_unlock(&b->lock);
+    return f;
 }
 
 static struct futex * soft_create_futex(process p, u64 key)
 {
     heap h = heap_locked(get_kernel_heaps());
+    struct futex_bucket *b = futex_bucket_from_key(p, key);
     struct futex * f;
 
-    process_lock(p);
+    spin_lock(&b->lock);
 
-    f = table_find(p->futices, pointer_from_u64(key));
+    f = futex_find_locked(b, key);
     if (f)
         goto out;
 
@@ -46,9 +104,11 @@ static struct futex * soft_create_futex(process p, u64 key)
     }
 
     spin_lock_init(&f->lock);
-    table_set(p->futices, pointer_from_u64(key), f);
+    list_init(&f->vwaiters);
+    f->key = key;
+    list_push_back(&b->futexes, &f->l);
   out:
-    process_unlock(p);
+    spin_unlock(&b->lock);
     return f;
 }
 
@@ -61,6 +121,23 @@ static unix_context futex_wake_one(struct futex * f)
     return t;
 }
 
+/* Wakes the first futex_waitv() waiter of a futex whose operation has not been woken up yet;
+ * returns false if there is none. Called with the futex lock held. */
+static boolean futex_wake_vwaiter(struct futex *f)
+{
+    list l;
+    while ((l = list_get_next(&f->vwaiters))) {
+        struct futex_vwaiter *w = struct_from_list(l, struct futex_vwaiter *, l);
+        struct futex_waitv_op *op = w->op;
+        list_delete(l);
+        if (compare_and_swap_32(&op->woken, op->nr, w - op->w)) {
+            blockq_wake_one(op->bq);
+            return true;
+        }
+    }
+    return false;
+}
+
 /*
  * Wake up to 'val' waiters
  * Return the number woken
@@ -71,7 +148,7 @@ static int futex_wake_many(struct futex * f, int val)
 
     for (nr_woken = 0; nr_woken < val; nr_woken++) {
         unix_context w = futex_wake_one(f);
-        if (w == INVALID_ADDRESS)
+        if ((w == INVALID_ADDRESS) && !futex_wake_vwaiter(f))
             break;
     }
 
@@ -80,11 +157,7 @@ static int futex_wake_many(struct futex * f, int val)
 
 boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
 {
-    struct futex * f;
-
-    process_lock(p);
-    f = table_find(p->futices, (void *)uaddr);
-    process_unlock(p);
+    struct futex * f = futex_find(p, u64_from_pointer(uaddr));
     if (!f)
         return false;
 
@@ -94,18 +167,64 @@ boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
     return true;
 }
 
+/*
+ * Attempt to take ownership of the PI futex word at uaddr for thread t.
+ * Must be called with the futex lock held and user memory faults trapped.
+ * If the lock is owned by another thread and set_waiters is true, the
+ * FUTEX_WAITERS bit is set so that the owner will enter the kernel to unlock.
+ *
+ * Return:
+ *  0: lock acquired
+ *  -EAGAIN: lock owned by another thread
+ *  -EDEADLK: lock already owned by t
+ *  -ESRCH: owner does not exist
+ */
+static sysreturn futex_pi_trylock(int *uaddr, thread t, boolean set_waiters, boolean acquire_waiters)
+{
+    u32 *word = (u32 *)uaddr;
+    while (1) {
+        u32 val = *word;
+        u32 owner = val & FUTEX_TID_MASK;
+        if (owner == t->tid)
+            return -EDEADLK;
+        if (owner) {
+            thread o = thread_from_tid(t->p, owner);
+            if (o != INVALID_ADDRESS) {
+                thread_release(o);
+                if (!set_waiters || (val & FUTEX_WAITERS) ||
+                    compare_and_swap_32(word, val, val | FUTEX_WAITERS))
+                    return -EAGAIN;
+                continue;
+            }
+            /* The owner exited without releasing the lock; it may be taken
+               over only if the robust list handling marked it dead. */
+            if (!(val & FUTEX_OWNER_DIED))
+                return -ESRCH;
+        }
+        u32 new = t->tid | (val & (FUTEX_OWNER_DIED | FUTEX_WAITERS));
+        if (acquire_waiters)
+            new |= FUTEX_WAITERS;
+        if (compare_and_swap_32(word, val, new))
+            return 0;
+    }
+}
+
 /*
  * futex_bh is invoked either by the bh processor in response
  * to timeout/signal delivery/etc., or by another thread in sys_futex
  *
+ * Waiters in FUTEX_LOCK_PI are queued with an empty bitset, which no bitset
+ * wakeup can match; on wakeup they retry acquiring the lock and resume
+ * waiting if it was taken in the meantime.
+ *
  * Return:
  *  BLOCKQ_BLOCK_REQUIRED: top half, going to block
  *  -ETIMEDOUT: if we timed out
  *  -EINTR: if we're being nullified
  *  0: thread woken up
  */
-closure_function(3, 1, sysreturn, futex_bh,
-                 struct futex *, f, thread, t, timestamp, timeout,
+closure_function(4, 1, sysreturn, futex_bh,
+                 struct futex *, f, thread, t, timestamp, timeout, u32, bitset,
                  u64 flags)
 {
     thread t = bound(t);
@@ -124,6 +243,22 @@ closure_function(3, 1, sysreturn, futex_bh,
             rv = bound(timeout) ? -EINTR : -ERESTARTSYS;
         else
             rv = -ETIMEDOUT;
+    } else if (!bound(bitset)) {
+        /* Other waiters may remain, so keep FUTEX_WAITERS set on acquisition. */
+        context ctx = get_current_context(current_cpu());
+        futex_lock(f);
+        if (context_set_err(ctx)) {
+            rv = -EFAULT;
+        } else {
+            rv = futex_pi_trylock(pointer_from_u64(f->key), t, true, true);
+            context_clear_err(ctx);
+        }
+        if (rv == -EAGAIN) {
+            rv = blockq_block_required((unix_context)ctx, flags);
+            futex_unlock(f);
+            return rv;
+        }
+        futex_unlock(f);
     } else {
         rv = 0; /* no timer expire + not us --> actual wakeup */
     }
@@ -140,11 +275,31 @@ closure_function(1, 1, void, futex_requeue_handler,
     closure_member(futex_bh, action, f) = bound(dest);
 }
 
+closure_function(1, 1, boolean, futex_bitset_filter,
+                 u32, bitset,
+                 blockq_action action)
+{
+    return (closure_member(futex_bh, action, bitset) & bound(bitset)) != 0;
+}
+
+/* Wake up to val waiters whose wait bitset intersects bitset (futex_waitv() waiters match any
+ * bitset). */
+static int futex_wake_bitset(struct futex *f, int val, u32 bitset)
+{
+    if (bitset == FUTEX_BITSET_MATCH_ANY)
+        return futex_wake_many(f, val);
+    int nr_woken = blockq_wake_matching(f->bq, val, stack_closure(futex_bitset_filter, bitset));
+    while ((nr_woken < val) && futex_wake_vwaiter(f))
+        nr_woken++;
+    return nr_woken;
+}
+
 static timestamp get_timeout_timestamp(int futex_op, u64 val2)
 {
     switch (futex_op) {
     case FUTEX_WAIT:
     case FUTEX_WAIT_BITSET:
+    case FUTEX_LOCK_PI:
         return (val2) 
             ? time_from_timespec((struct timespec *)pointer_from_u64(val2)) 
             : 0;
@@ -155,6 +310,235 @@ static timestamp get_timeout_timestamp(int futex_op, u64 val2)
 
 static boolean futex_verbose;
 
+/* Reads a futex of the given futex2 size; called with user memory faults trapped. */
+static u64 futex_read(void *uaddr, u32 size)
+{
+    switch (size) {
+    case FUTEX2_SIZE_U8:
+        return *(u8 *)uaddr;
+    case FUTEX2_SIZE_U16:
+        return *(u16 *)uaddr;
+    case FUTEX2_SIZE_U32:
+        return *(u32 *)uaddr;
+    default:
+        return *(u64 *)uaddr;
+    }
+}
+
+static sysreturn futex_wait(struct futex *f, void *uaddr, u64 val, u32 size, u32 bitset,
+                            clock_id clkid, timestamp ts, boolean absolute)
+{
+    context ctx = get_current_context(current_cpu());
+    sysreturn rv;
+    futex_lock(f);
+    if (context_set_err(ctx))
+        rv = -EFAULT;
+    else if (futex_read(uaddr, size) != val)
+        rv = -EAGAIN;
+    else
+        rv = blockq_check_timeout(f->bq,
+                                  contextual_closure(futex_bh, f, current, ts, bitset),
+                                  false, clkid, ts, absolute);
+    futex_unlock(f);
+    if (rv != -EFAULT)
+        context_clear_err(ctx);
+    return rv;
+}
+
+static sysreturn futex_requeue(int *uaddr, int val, u64 val2, int *uaddr2,
+                               boolean cmp, int val3)
+{
+    struct futex *f, *new;
+    int woken, requeued;
+    sysreturn rv;
+
+    if (!validate_user_memory(uaddr2, sizeof(int), false))
+        return set_syscall_error(current, EFAULT);
+
+    f = soft_create_futex(current->p, u64_from_pointer(uaddr));
+    if (f == INVALID_ADDRESS)
+        return set_syscall_error(current, ENOMEM);
+    new = INVALID_ADDRESS;
+    if (val2 > 0) {
+        new = soft_create_futex(current->p, u64_from_pointer(uaddr2));
+        if (new == INVALID_ADDRESS)
+            return set_syscall_error(current, ENOMEM);
+    }
+
+    context ctx = get_current_context(current_cpu());
+    if (futex_verbose && !context_set_err(ctx)) {
+        thread_log(current, "futex_%srequeue [%ld %p %d] val: %d val2: %d uaddr2: %p %d val3: %d",
+                   cmp ? ss("cmp_") : sstring_empty(),
+                   current->tid, uaddr, *uaddr, val, val2, uaddr2, *uaddr2, val3);
+        context_clear_err(ctx);
+    }
+
+    futex_lock(f);
+    if (cmp) {
+        if (context_set_err(ctx)) {
+            futex_unlock(f);
+            return -EFAULT;
+        }
+        if (*uaddr != val3) {
+            rv = -EAGAIN;
+            goto out;
+        }
+    }
+
+    woken = futex_wake_many(f, val);
+
+    requeued = 0;
+    if (new != INVALID_ADDRESS && new != f) {
+        requeued = blockq_transfer_waiters(new->bq, f->bq, val2,
+                                           stack_closure(futex_requeue_handler, new));
+
+        /* futex_waitv() waiters are woken up instead (a spurious wakeup for them) */
+        while ((requeued < val2) && futex_wake_vwaiter(f))
+            requeued++;
+        if (futex_verbose)
+            thread_log(current, " awoken: %d, re-queued %d", woken, requeued);
+    }
+    rv = woken + requeued;
+  out:
+    futex_unlock(f);
+    if (cmp)
+        context_clear_err(ctx);
+    return rv;
+}
+
+static sysreturn futex_wake_op(int *uaddr, int val, u64 val2, int *uaddr2, int val3)
+{
+    unsigned int cmparg = val3 & MASK(12);
+    unsigned int oparg = (val3 >> 12) & MASK(12);
+    unsigned int cmp = (val3 >> 24) & MASK(4);
+    unsigned int op = (val3 >> 28) & MASK(4);
+    int oldval, wake1, wake2, c;
+
+    if (!validate_user_memory(uaddr2, sizeof(int), true))
+        return set_syscall_error(current, EFAULT);
+
+    context ctx = get_current_context(current_cpu());
+    if (futex_verbose && !context_set_err(ctx)) {
+        thread_log(current, "futex_wake_op: [%ld %p %d] %p %d %d %d %d",
+            current->tid, uaddr, *uaddr, uaddr2, cmparg, oparg, cmp, op);
+        context_clear_err(ctx);
+    }
+
+    /* The operation on uaddr2 must be applied regardless, but a futex without
+       waiters need not be created. When uaddr2 has no futex, its lock is
+       substituted by the one of the bucket it would hash to. */
+    process p = current->p;
+    struct futex *f = futex_find(p, u64_from_pointer(uaddr));
+    struct futex *f2 = futex_find(p, u64_from_pointer(uaddr2));
+    struct spinlock *l1 = f ? &f->lock : 0;
+    struct spinlock *l2 = f2 ? &f2->lock :
+        &futex_bucket_from_key(p, u64_from_pointer(uaddr2))->lock;
+    if (f == f2)
+        l1 = 0;
+    if (l1)
+        spin_lock_2(l1, l2);
+    else
+        spin_lock(l2);
+
+    boolean fault = false;
+    wake1 = wake2 = 0;
+    if (context_set_err(ctx)) {
+        fault = true;
+        goto wake_op_done;
+    }
+    oldval = *(int *) uaddr2;
+    
+    switch (op) {
+    case FUTEX_OP_SET:   *uaddr2 = oparg; break;
+    case FUTEX_OP_ADD:   *uaddr2 += oparg; break;
+    case FUTEX_OP_OR:    *uaddr2 |= oparg; break;
+    case FUTEX_OP_ANDN:  *uaddr2 &= ~oparg; break;
+    case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
+    }
+    context_clear_err(ctx);
+
+    if (f)
+        wake1 = futex_wake_many(f, val);
+    
+    c = 0;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ: c = (oldval == cmparg) ; break;
+    case FUTEX_OP_CMP_NE: c = (oldval != cmparg); break;
+    case FUTEX_OP_CMP_LT: c = (oldval < cmparg); break;
+    case FUTEX_OP_CMP_LE: c = (oldval <= cmparg); break;
+    case FUTEX_OP_CMP_GT: c = (oldval > cmparg) ; break;
+    case FUTEX_OP_CMP_GE: c = (oldval >= cmparg) ; break;
+    }
+    
+    if (c && f2 && f2 != f)
+        wake2 = futex_wake_many(f2, val2);
+
+  wake_op_done:
+    spin_unlock(l2);
+    if (l1)
+        spin_unlock(l1);
+    return fault ? -EFAULT : wake1 + wake2;
+}
+
+/*
+ * PI futexes follow the Linux user-space protocol: the futex word holds the
+ * TID of the owner, FUTEX_WAITERS is set while waiters exist in the kernel,
+ * and FUTEX_OWNER_DIED is set by robust list handling. Uncontended lock and
+ * unlock operations happen entirely in user space.
+ *
+ * As the scheduler has no notion of thread priorities, no priority boost is
+ * propagated to the owner; waiters acquire the lock in wakeup order.
+ */
+static sysreturn futex_lock_pi(int *uaddr, boolean try, timestamp ts)
+{
+    struct futex *f = soft_create_futex(current->p, u64_from_pointer(uaddr));
+    if (f == INVALID_ADDRESS)
+        return set_syscall_error(current, ENOMEM);
+
+    context ctx = get_current_context(current_cpu());
+    sysreturn rv;
+    futex_lock(f);
+    if (context_set_err(ctx)) {
+        futex_unlock(f);
+        return -EFAULT;
+    }
+    rv = futex_pi_trylock(uaddr, current, !try, false);
+    context_clear_err(ctx);
+    if (rv == -EAGAIN && !try)
+        /* FUTEX_LOCK_PI timeouts are absolute and measured against CLOCK_REALTIME. */
+        rv = blockq_check_timeout(f->bq, contextual_closure(futex_bh, f, current, ts, 0),
+                                  false, CLOCK_ID_REALTIME, ts, true);
+    futex_unlock(f);
+    return rv;
+}
+
+static sysreturn futex_unlock_pi(int *uaddr)
+{
+    u32 *word = (u32 *)uaddr;
+    u32 val;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    do {
+        val = *word;
+        if ((val & FUTEX_TID_MASK) != current->tid) {
+            context_clear_err(ctx);
+            return -EPERM;
+        }
+    } while (!compare_and_swap_32(word, val, 0));
+    context_clear_err(ctx);
+
+    /* A waiter may be between setting FUTEX_WAITERS and being queued, in which
+       case the wake flag of the blockq causes it to retry acquisition. */
+    struct futex *f = futex_find(current->p, u64_from_pointer(uaddr));
+    if (f) {
+        futex_lock(f);
+        blockq_wake_one(f->bq);
+        futex_unlock(f);
+    }
+    return 0;
+}
+
 sysreturn futex(int *uaddr, int futex_op, int val,
                 u64 val2, int *uaddr2, int val3)
 {
@@ -165,10 +549,6 @@ sysreturn futex(int *uaddr, int futex_op, int val,
     if (!validate_user_memory(uaddr, sizeof(int), false))
         return set_syscall_error(current, EFAULT);
 
-    f = soft_create_futex(current->p, u64_from_pointer(uaddr));
-    if (f == INVALID_ADDRESS)
-        return set_syscall_error(current, ENOMEM);
-    
     op = futex_op & 127; // chuck the private bit
     ts = get_timeout_timestamp(op, val2);
     clock_id clkid = (futex_op & FUTEX_CLOCK_REALTIME) ? CLOCK_ID_REALTIME :
@@ -176,177 +556,359 @@ sysreturn futex(int *uaddr, int futex_op, int val,
 
     context ctx = get_current_context(current_cpu());
     switch (op) {
-    case FUTEX_WAIT: {
-        if (futex_verbose)
-            thread_log(current, "futex_wait [%ld %p %d] %d 0x%ld",
-                current->tid, uaddr, *uaddr, val, val2);
-
-        sysreturn rv;
-        futex_lock(f);
-        if (context_set_err(ctx))
-            rv = -EFAULT;
-        else if (*uaddr != val)
-            rv = -EAGAIN;
-        else
-            rv = blockq_check_timeout(f->bq,
-                                      contextual_closure(futex_bh, f, current, ts),
-                                      false, clkid, ts, false);
-        futex_unlock(f);
-        if (rv != -EFAULT)
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET: {
+        u32 bitset = (op == FUTEX_WAIT) ? FUTEX_BITSET_MATCH_ANY : val3;
+        if (!bitset)
+            return -EINVAL;
+        if (futex_verbose && !context_set_err(ctx)) {
+            thread_log(current, "futex_wait%s [%ld %p %d] %d 0x%ld %d",
+                (op == FUTEX_WAIT) ? sstring_empty() : ss("_bitset"),
+                current->tid, uaddr, *uaddr, val, val2, val3);
             context_clear_err(ctx);
-        return rv;
+        }
+
+        f = soft_create_futex(current->p, u64_from_pointer(uaddr));
+        if (f == INVALID_ADDRESS)
+            return set_syscall_error(current, ENOMEM);
+        return futex_wait(f, uaddr, (u32)val, FUTEX2_SIZE_U32, bitset, clkid, ts,
+                          op == FUTEX_WAIT_BITSET);
     }
 
-    case FUTEX_WAKE: {
+    case FUTEX_WAKE:
+    case FUTEX_WAKE_BITSET: {
+        u32 bitset = (op == FUTEX_WAKE) ? FUTEX_BITSET_MATCH_ANY : val3;
+        if (!bitset)
+            return -EINVAL;
         if (futex_verbose && !context_set_err(ctx)) {
-            thread_log(current, "futex_wake [%ld %p %d] %d",
-                current->tid, uaddr, *uaddr, val);
+            thread_log(current, "futex_wake%s [%ld %p %d] %d %d",
+                (op == FUTEX_WAKE) ? sstring_empty() : ss("_bitset"),
+                current->tid, uaddr, *uaddr, val, val3);
             context_clear_err(ctx);
         }
+        f = futex_find(current->p, u64_from_pointer(uaddr));
+        if (!f)
+            return 0;
         futex_lock(f);
-        int nr_woken = futex_wake_many(f, val);
+        int nr_woken = futex_wake_bitset(f, val, bitset);
         futex_unlock(f);
         return nr_woken;
     }
 
-    case FUTEX_CMP_REQUEUE: {
-        int woken, requeued;
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+        return futex_requeue(uaddr, val, val2, uaddr2, op == FUTEX_CMP_REQUEUE, val3);
 
-        if (!validate_user_memory(uaddr2, sizeof(int), false))
-            return set_syscall_error(current, EFAULT);
+    case FUTEX_WAKE_OP:
+        return futex_wake_op(uaddr, val, val2, uaddr2, val3);
 
-        if (futex_verbose && !context_set_err(ctx)) {
-            thread_log(current, "futex_cmp_requeue [%ld %p %d] val: %d val2: %d uaddr2: %p %d val3: %d",
-                       current->tid, uaddr, *uaddr, val, val2, uaddr2, *uaddr2, val3);
-            context_clear_err(ctx);
-        }
+    case FUTEX_LOCK_PI:
+    case FUTEX_TRYLOCK_PI:
+        if (futex_verbose)
+            thread_log(current, "futex_%slock_pi [%ld %p] 0x%ld",
+                       (op == FUTEX_TRYLOCK_PI) ? ss("try") : sstring_empty(),
+                       current->tid, uaddr, val2);
+        return futex_lock_pi(uaddr, op == FUTEX_TRYLOCK_PI, ts);
 
-        sysreturn rv;
-        futex_lock(f);
-        if (context_set_err(ctx)) {
-            rv = -EFAULT;
-            goto cmp_requeue_done;
-        }
-        if (*uaddr != val3) {
-            rv = -EAGAIN;
-            goto cmp_requeue_done;
-        }
+    case FUTEX_UNLOCK_PI:
+        if (futex_verbose)
+            thread_log(current, "futex_unlock_pi [%ld %p]", current->tid, uaddr);
+        return futex_unlock_pi(uaddr);
 
-        woken = futex_wake_many(f, val);
+    case FUTEX_CMP_REQUEUE_PI: rprintf("futex_cmp_requeue_pi not implemented\n"); break;
+    case FUTEX_WAIT_REQUEUE_PI: rprintf("futex_wait_requeue_pi not implemented\n"); break;
+    default: rprintf("futex op %d not implemented\n", op); break;
+    }
 
-        requeued = 0;
-        if (val2 > 0) {
-            struct futex * new = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (new == INVALID_ADDRESS) {
-                rv = -ENOMEM;
-                goto cmp_requeue_done;
-            }
-            requeued = blockq_transfer_waiters(new->bq, f->bq, val2,
-                                               stack_closure(futex_requeue_handler, new));
-            if (futex_verbose)
-                thread_log(current, " awoken: %d, re-queued %d", woken, requeued);
+    return set_syscall_error(current, ENOSYS);
+}
+
+/* futex2: futexes can be 8, 16, 32 or 64 bits wide, and with FUTEX2_NUMA the futex word is
+ * followed by a word of the same size holding a NUMA node number. As futexes are hashed per process
+ * rather than per node, the node only serves as a hint to user space: waiters fill in the node of
+ * their CPU if the node is -1, and invalid node numbers are rejected. */
+
+static u64 futex2_value_mask(u32 size)
+{
+    return (size == FUTEX2_SIZE_U64) ? -1ull : MASK(8 << size);
+}
+
+/* Returns the number of bytes spanned by a futex, or 0 if the flags or alignment are invalid. */
+static bytes futex2_bytes(void *uaddr, u32 flags)
+{
+    if (flags & ~(FUTEX2_SIZE_MASK | FUTEX2_NUMA | FUTEX2_PRIVATE))
+        return 0;
+    u32 size = flags & FUTEX2_SIZE_MASK;
+    if ((flags & FUTEX2_NUMA) && (size == FUTEX2_SIZE_U8))
+        return 0;   /* not enough room for node numbers */
+    bytes len = U64_FROM_BIT(size) << ((flags & FUTEX2_NUMA) ? 1 : 0);
+    return (u64_from_pointer(uaddr) & (len - 1)) ? 0 : len;
+}
+
+/* Called with user memory faults trapped; returns false if the node number is invalid. */
+static boolean futex2_numa_node(void *uaddr, u32 size, boolean wait)
+{
+    void *naddr = uaddr + U64_FROM_BIT(size);
+    u64 node = futex_read(naddr, size);
+    if (node == futex2_value_mask(size)) {
+        if (!wait)
+            return true;
+        node = numa_cpu_node(current_cpu()->id);
+        switch (size) {
+        case FUTEX2_SIZE_U16:
+            *(u16 *)naddr = node;
+            break;
+        case FUTEX2_SIZE_U32:
+            *(u32 *)naddr = node;
+            break;
+        default:
+            *(u64 *)naddr = node;
         }
-        rv = woken + requeued;
-      cmp_requeue_done:
-        futex_unlock(f);
-        if (rv != -EFAULT)
-            context_clear_err(ctx);
-        return rv;
+        return true;
     }
+    return (node < numa_node_count());
+}
 
-    case FUTEX_WAKE_OP: {
-        unsigned int cmparg = val3 & MASK(12);
-        unsigned int oparg = (val3 >> 12) & MASK(12);
-        unsigned int cmp = (val3 >> 24) & MASK(4);
-        unsigned int op = (val3 >> 28) & MASK(4);
-        int oldval, wake1, wake2, c;
+static boolean futex2_timeout(struct timespec *timeout, int clockid, clock_id *clkid,
+                              timestamp *ts)
+{
+    *ts = 0;
+    *clkid = CLOCK_ID_MONOTONIC;
+    if (!timeout)
+        return true;
+    if (clockid == CLOCK_REALTIME)
+        *clkid = CLOCK_ID_REALTIME;
+    else if (clockid != CLOCK_MONOTONIC)
+        return false;
+    *ts = time_from_timespec(timeout);
+    return true;
+}
 
-        if (!validate_user_memory(uaddr2, sizeof(int), true))
-            return set_syscall_error(current, EFAULT);
+/* Checks the value (and node, if any) of a futex to be waited on; returns 0 on success. Called
+ * with user memory faults trapped. */
+static sysreturn futex2_wait_check(void *uaddr, u64 val, u32 flags)
+{
+    u32 size = flags & FUTEX2_SIZE_MASK;
+    if ((flags & FUTEX2_NUMA) && !futex2_numa_node(uaddr, size, true))
+        return -EINVAL;
+    return (futex_read(uaddr, size) == val) ? 0 : -EAGAIN;
+}
 
-        if (futex_verbose && !context_set_err(ctx)) {
-            thread_log(current, "futex_wake_op: [%ld %p %d] %p %d %d %d %d",
-                current->tid, uaddr, *uaddr, uaddr2, cmparg, oparg, cmp, op);
-            context_clear_err(ctx);
-        }
+sysreturn futex2_wake(void *uaddr, u64 mask, int nr, u32 flags)
+{
+    bytes len = futex2_bytes(uaddr, flags);
+    u32 bitset = mask;
+    if (!len || (mask & ~futex2_value_mask(flags & FUTEX2_SIZE_MASK)) || !bitset)
+        return -EINVAL;
+    if (!validate_user_memory(uaddr, len, false))
+        return -EFAULT;
+    if (futex_verbose)
+        thread_log(current, "futex2_wake [%ld %p] mask 0x%lx nr %d flags 0x%x",
+                   current->tid, uaddr, mask, nr, flags);
+    if (flags & FUTEX2_NUMA) {
+        context ctx = get_current_context(current_cpu());
+        if (context_set_err(ctx))
+            return -EFAULT;
+        boolean valid = futex2_numa_node(uaddr, flags & FUTEX2_SIZE_MASK, false);
+        context_clear_err(ctx);
+        if (!valid)
+            return -EINVAL;
+    }
+    struct futex *f = futex_find(current->p, u64_from_pointer(uaddr));
+    if (!f)
+        return 0;
+    futex_lock(f);
+    int nr_woken = futex_wake_bitset(f, nr, bitset);
+    futex_unlock(f);
+    return nr_woken;
+}
 
-        struct futex *f2 = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-        if (f2 == INVALID_ADDRESS)
-            return -ENOMEM;
-        boolean fault = false;
-        spin_lock_2(&f->lock, &f2->lock);
-        if (context_set_err(ctx)) {
-            fault = true;
-            goto wake_op_done;
-        }
-        oldval = *(int *) uaddr2;
-        
-        switch (op) {
-        case FUTEX_OP_SET:   *uaddr2 = oparg; break;
-        case FUTEX_OP_ADD:   *uaddr2 += oparg; break;
-        case FUTEX_OP_OR:    *uaddr2 |= oparg; break;
-        case FUTEX_OP_ANDN:  *uaddr2 &= ~oparg; break;
-        case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
-        }
+sysreturn futex2_wait(void *uaddr, u64 val, u64 mask, u32 flags, struct timespec *timeout,
+                      int clockid)
+{
+    bytes len = futex2_bytes(uaddr, flags);
+    u32 size = flags & FUTEX2_SIZE_MASK;
+    u32 bitset = mask;
+    if (!len || (val & ~futex2_value_mask(size)) || (mask & ~futex2_value_mask(size)) ||
+        !bitset)
+        return -EINVAL;
+    if (!validate_user_memory(uaddr, len, (flags & FUTEX2_NUMA) != 0) ||
+        (timeout && !fault_in_user_memory(timeout, sizeof(*timeout), false)))
+        return -EFAULT;
+    clock_id clkid;
+    timestamp ts;
+    if (!futex2_timeout(timeout, clockid, &clkid, &ts))
+        return -EINVAL;
+    if (futex_verbose)
+        thread_log(current, "futex2_wait [%ld %p] val 0x%lx mask 0x%lx flags 0x%x",
+                   current->tid, uaddr, val, mask, flags);
+    if (flags & FUTEX2_NUMA) {
+        context ctx = get_current_context(current_cpu());
+        if (context_set_err(ctx))
+            return -EFAULT;
+        boolean valid = futex2_numa_node(uaddr, size, true);
         context_clear_err(ctx);
+        if (!valid)
+            return -EINVAL;
+    }
+    struct futex *f = soft_create_futex(current->p, u64_from_pointer(uaddr));
+    if (f == INVALID_ADDRESS)
+        return -ENOMEM;
+    return futex_wait(f, uaddr, val, size, bitset, clkid, ts, true);
+}
 
-        wake1 = futex_wake_many(f, val);
-        
-        c = 0;
-        switch (cmp) {
-        case FUTEX_OP_CMP_EQ: c = (oldval == cmparg) ; break;
-        case FUTEX_OP_CMP_NE: c = (oldval != cmparg); break;
-        case FUTEX_OP_CMP_LT: c = (oldval < cmparg); break;
-        case FUTEX_OP_CMP_LE: c = (oldval <= cmparg); break;
-        case FUTEX_OP_CMP_GT: c = (oldval > cmparg) ; break;
-        case FUTEX_OP_CMP_GE: c = (oldval >= cmparg) ; break;
-        }
-        
-        wake2 = 0;
-        if (c) {
-            wake2 = futex_wake_many(f2, val2);
-        }
+/* Only 32-bit futexes without node number can be requeued (as with FUTEX_CMP_REQUEUE). */
+sysreturn futex2_requeue(struct futex_waitv *waiters, u32 flags, int nr_wake, int nr_requeue)
+{
+    if (flags)
+        return -EINVAL;
+    if (!fault_in_user_memory(waiters, 2 * sizeof(*waiters), false))
+        return -EFAULT;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return -EFAULT;
+    struct futex_waitv w[2];
+    runtime_memcpy(w, waiters, sizeof(w));
+    context_clear_err(ctx);
+    for (int i = 0; i < 2; i++) {
+        if (w[i].__reserved || ((w[i].flags & ~FUTEX2_PRIVATE) != FUTEX2_SIZE_U32) ||
+            !futex2_bytes(pointer_from_u64(w[i].uaddr), w[i].flags))
+            return -EINVAL;
+    }
+    if ((w[0].val > U32_MAX) || (nr_wake < 0) || (nr_requeue < 0))
+        return -EINVAL;
+    int *uaddr = pointer_from_u64(w[0].uaddr);
+    if (!validate_user_memory(uaddr, sizeof(int), false))
+        return -EFAULT;
+    return futex_requeue(uaddr, nr_wake, nr_requeue, pointer_from_u64(w[1].uaddr), true,
+                         w[0].val);
+}
 
-      wake_op_done:
-        futex_unlock(f2);
-        futex_unlock(f);
-        return fault ? -EFAULT : wake1 + wake2;
+/* Removes the waiters of a futex_waitv() operation from their futexes and returns the index of the
+ * futex woken up (nr if none). */
+static u32 futex_waitv_dequeue(struct futex_waitv_op *op)
+{
+    for (u32 i = 0; i < op->queued; i++) {
+        struct futex_vwaiter *w = &op->w[i];
+        futex_lock(w->f);
+        if (list_inserted(&w->l))
+            list_delete(&w->l);
+        futex_unlock(w->f);
     }
+    op->queued = 0;
+    return op->woken;
+}
 
-    case FUTEX_WAIT_BITSET: {
-        if (futex_verbose && !context_set_err(ctx)) {
-            thread_log(current, "futex_wait_bitset [%ld %p %d] %d 0x%ld %d",
-                current->tid, uaddr, *uaddr, val, val2, val3);
-            context_clear_err(ctx);
-        }
+static void futex_waitv_free(struct futex_waitv_op *op)
+{
+    deallocate_blockq(op->bq);
+    deallocate(op->h, op, sizeof(*op) + op->nr * sizeof(op->w[0]));
+}
+
+/* Returns the index of the futex woken up; a wakeup occurring together with a timeout or signal
+ * takes precedence over them, as it must not be lost. */
+closure_function(2, 1, sysreturn, futex_waitv_bh,
+                 struct futex_waitv_op *, op, thread, t,
+                 u64 flags)
+{
+    struct futex_waitv_op *op = bound(op);
+    thread t = bound(t);
+    sysreturn rv;
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+    } else if (flags & BLOCKQ_ACTION_TIMEDOUT) {
+        rv = -ETIMEDOUT;
+    } else if (op->woken < op->nr) {
+        rv = 0;
+    } else if (!(flags & BLOCKQ_ACTION_BLOCKED)) {
+        return BLOCKQ_BLOCK_REQUIRED;
+    } else {
+        /* spurious wakeup */
+        return blockq_block_required((unix_context)get_current_context(current_cpu()), flags);
+    }
+    u32 woken = futex_waitv_dequeue(op);
+    if (woken < op->nr)
+        rv = woken;
+    thread_log(t, "%s: op %p, flags 0x%lx, rv %ld", func_ss, op, flags, rv);
+    futex_waitv_free(op);
+    closure_finish();
+    return syscall_return(t, rv);
+}
 
-        sysreturn rv;
+sysreturn futex_waitv(struct futex_waitv *waiters, u32 nr_futexes, u32 flags,
+                      struct timespec *timeout, int clockid)
+{
+    if (flags || !nr_futexes || (nr_futexes > FUTEX_WAITV_MAX))
+        return -EINVAL;
+    if (!fault_in_user_memory(waiters, nr_futexes * sizeof(*waiters), false) ||
+        (timeout && !fault_in_user_memory(timeout, sizeof(*timeout), false)))
+        return -EFAULT;
+    clock_id clkid;
+    timestamp ts;
+    if (!futex2_timeout(timeout, clockid, &clkid, &ts))
+        return -EINVAL;
+    if (futex_verbose)
+        thread_log(current, "futex_waitv [%ld %p] nr %d", current->tid, waiters, nr_futexes);
+    heap h = heap_locked(get_kernel_heaps());
+    struct futex_waitv_op *op = allocate(h, sizeof(*op) + nr_futexes * sizeof(op->w[0]));
+    if (op == INVALID_ADDRESS)
+        return -ENOMEM;
+    op->bq = allocate_blockq(h, ss("futex_waitv"));
+    if (op->bq == INVALID_ADDRESS) {
+        deallocate(h, op, sizeof(*op) + nr_futexes * sizeof(op->w[0]));
+        return -ENOMEM;
+    }
+    op->h = h;
+    op->nr = op->woken = nr_futexes;
+    op->queued = 0;
+    context ctx = get_current_context(current_cpu());
+    sysreturn rv = 0;
+    for (u32 i = 0; i < nr_futexes; i++) {
+        if (context_set_err(ctx)) {
+            rv = -EFAULT;
+            goto out;
+        }
+        struct futex_waitv w = waiters[i];
+        context_clear_err(ctx);
+        void *uaddr = pointer_from_u64(w.uaddr);
+        bytes len = futex2_bytes(uaddr, w.flags);
+        if (!len || w.__reserved || (w.val & ~futex2_value_mask(w.flags & FUTEX2_SIZE_MASK))) {
+            rv = -EINVAL;
+            goto out;
+        }
+        if (!validate_user_memory(uaddr, len, (w.flags & FUTEX2_NUMA) != 0)) {
+            rv = -EFAULT;
+            goto out;
+        }
+        struct futex *f = soft_create_futex(current->p, w.uaddr);
+        if (f == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            goto out;
+        }
         futex_lock(f);
-        if (context_set_err(ctx))
+        if (context_set_err(ctx)) {
             rv = -EFAULT;
-        else if (*uaddr != val)
-            rv = -EAGAIN;
-        else
-            rv = blockq_check_timeout(f->bq,
-                                      contextual_closure(futex_bh, f, current, ts),
-                                      false, clkid, ts, true);
-        futex_unlock(f);
-        if (rv != -EFAULT)
+        } else {
+            rv = futex2_wait_check(uaddr, w.val, w.flags);
             context_clear_err(ctx);
-        return rv;
-    }
-
-    case FUTEX_REQUEUE: rprintf("futex_requeue not implemented\n"); break;
-    case FUTEX_WAKE_BITSET: rprintf("futex_wake_bitset not implemented\n"); break;
-    case FUTEX_LOCK_PI: rprintf("futex_lock_pi not implemented\n"); break;
-    case FUTEX_TRYLOCK_PI: rprintf("futex_trylock_pi not implemented\n"); break;
-    case FUTEX_UNLOCK_PI: rprintf("futex_unlock_pi not implemented\n"); break;
-    case FUTEX_CMP_REQUEUE_PI: rprintf("futex_cmp_requeue_pi not implemented\n"); break;
-    case FUTEX_WAIT_REQUEUE_PI: rprintf("futex_wait_requeue_pi not implemented\n"); break;
-    default: rprintf("futex op %d not implemented\n", op); break;
+        }
+        if (rv == 0) {
+            struct futex_vwaiter *vw = &op->w[op->queued++];
+            vw->f = f;
+            vw->op = op;
+            list_push_back(&f->vwaiters, &vw->l);
+        }
+        futex_unlock(f);
+        if (rv)
+            goto out;
     }
-
-    return set_syscall_error(current, ENOSYS);
+    return blockq_check_timeout(op->bq, contextual_closure(futex_waitv_bh, op, current),
+                                false, clkid, ts, true);
+  out:
+    if (futex_waitv_dequeue(op) < nr_futexes)
+        rv = op->woken;     /* woken up while queueing the other waiters */
+    futex_waitv_free(op);
+    return rv;
 }
 
 closure_func_basic(set_value_notify, boolean, futex_trace_notify,
@@ -360,15 +922,18 @@ void
 init_futices(process p)
 {
     heap h = heap_locked(&p->uh->kh);
-    p->futices = allocate_table(h, futex_key_function, futex_key_equal);
+    p->futices = allocate(h, FUTEX_HASH_BUCKETS * sizeof(struct futex_bucket));
     if (p->futices == INVALID_ADDRESS)
         halt("failed to allocate futex table\n");
+    for (int i = 0; i < FUTEX_HASH_BUCKETS; i++) {
+        spin_lock_init(&p->futices[i].lock);
+        list_init(&p->futices[i].futexes);
+    }
     register_root_notify(sym(futex_trace), closure_func(h, set_value_notify, futex_trace_notify));
 }
 
 /* robust mutex handling */
 
-#define FUTEX_OWNER_DIED	0x40000000
 #define FUTEX_KEY_ADDR(x, o)    ((int *)((u8 *)(x) + (o)))
 
 typedef struct robust_list {
@@ -21,10 +21,19 @@ typedef struct inotify {
     closure_struct(fdesc_close, close);
     heap h;
     struct list watches;
+    table wd_watches;   /* watch descriptor -> watch */
+    table ino_watches;  /* inode number -> watch */
     int watch_count;
     int next_wd;
     ringbuf event_buf;
     blockq bq;
+    struct {    /* last queued event (used for coalescing) */
+        boolean valid;
+        int wd;
+        u32 mask;
+        u32 cookie;
+        string name;
+    } last;
 } *inotify;
 
 typedef struct inotify_watch {
@@ -172,6 +181,8 @@ closure_func_basic(fdesc_close, sysreturn, inotify_close,
         notify_remove(watch->ns, watch->ne, false);
         deallocate(in->h, watch, sizeof(*watch));
     }
+    deallocate_table(in->wd_watches);
+    deallocate_table(in->ino_watches);
     release_fdesc(&in->f);
     deallocate_blockq(in->bq);
     deallocate_ringbuf(in->event_buf);
@@ -195,6 +206,14 @@ static boolean inotify_queue_event(inotify in, inotify_watch watch, u32 eventmas
     }
     ringbuf b = in->event_buf;
     boolean empty = (ringbuf_length(b) == 0);
+    u32 cookie = evdata ? evdata->cookie : 0;
+    string name = name_len ? evdata->name : 0;
+
+    /* Identical consecutive events are coalesced, as long as the last event is still in the queue.
+     * Event names are symbol strings, thus they can be compared by reference. */
+    if (!empty && in->last.valid && (in->last.wd == watch->wd) && (in->last.mask == eventmask) &&
+        (in->last.cookie == cookie) && (in->last.name == name))
+        return false;
 
     /* Ensure there is always room for an overflow event. */
     if ((ringbuf_space(b) < event_len + sizeof(event)) && (b->length < INOTIFY_BUFLEN_MAX))
@@ -208,18 +227,24 @@ static boolean inotify_queue_event(inotify in, inotify_watch watch, u32 eventmas
             event.len = 0;
             ringbuf_write(b, &event, sizeof(event));
         }
+        in->last.valid = false;
         return false;
     }
 
     event.wd = watch->wd;
     event.mask = eventmask;
-    event.cookie = evdata ? evdata->cookie : 0;
+    event.cookie = cookie;
     event.len = name_len ? (event_len - sizeof(event)) : 0;
     ringbuf_write(b, &event, sizeof(event));
     if (name_len) {
         ringbuf_write(b, ringbuf_ref(evdata->name, 0), name_len);
         ringbuf_memset(b, '\0', event.len - name_len);
     }
+    in->last.valid = true;
+    in->last.wd = watch->wd;
+    in->last.mask = eventmask;
+    in->last.cookie = cookie;
+    in->last.name = name;
     return empty;
 }
 
@@ -228,6 +253,8 @@ static boolean inotify_rm_watch_locked(inotify in, inotify_watch watch, boolean
     boolean notify_readers = inotify_queue_event(in, watch, IN_IGNORED, 0);
     if (delete_from_list)
         list_delete(&watch->l);
+    table_remove(in->wd_watches, pointer_from_u64((u64)watch->wd));
+    table_remove(in->ino_watches, pointer_from_u64(watch->n));
     deallocate(in->h, watch, sizeof(*watch));
     in->watch_count--;
     return notify_readers;
@@ -291,9 +318,15 @@ sysreturn inotify_init1(int flags)
         goto nomem;
     }
     in->bq = allocate_blockq(h, ss("inotify"));
-    if (in->bq == INVALID_ADDRESS) {
-        deallocate_ringbuf(in->event_buf);
-        goto nomem;
+    if (in->bq == INVALID_ADDRESS)
+        goto nomem_buf;
+    in->wd_watches = allocate_table(h, identity_key, pointer_equal);
+    if (in->wd_watches == INVALID_ADDRESS)
+        goto nomem_bq;
+    in->ino_watches = allocate_table(h, identity_key, pointer_equal);
+    if (in->ino_watches == INVALID_ADDRESS) {
+        deallocate_table(in->wd_watches);
+        goto nomem_bq;
     }
     init_fdesc(h, &in->f, FDESC_TYPE_INOTIFY);
     in->f.read = init_closure_func(&in->read, file_io, inotify_read);
@@ -305,12 +338,17 @@ sysreturn inotify_init1(int flags)
     list_init(&in->watches);
     in->watch_count = 0;
     in->next_wd = 0;
+    in->last.valid = false;
     sysreturn fd = allocate_fd(current->p, in);
     if (fd == INVALID_PHYSICAL) {
         apply(in->f.close, 0, io_completion_ignore);
         return -EMFILE;
     }
     return fd;
+  nomem_bq:
+    deallocate_blockq(in->bq);
+  nomem_buf:
+    deallocate_ringbuf(in->event_buf);
   nomem:
     deallocate(h, in, sizeof(struct inotify));
     return -ENOMEM;
@@ -344,19 +382,13 @@ sysreturn inotify_add_watch(int fd, const char *pathname, u32 mask)
         goto out;
     }
     mask |= IN_IGNORED | IN_ISDIR | IN_Q_OVERFLOW | IN_UNMOUNT;
-    inotify_watch watch = 0;
     inode ino = fs->get_inode(fs, n);
     inotify_lock(in);
-    list_foreach(&in->watches, e) {
-        inotify_watch w = struct_from_field(e, inotify_watch, l);
-        if (w->n == ino) {
-            notify_entry_update_eventmask(w->ne,
-                (mask & IN_MASK_ADD) ? (notify_entry_get_eventmask(w->ne) | mask) : mask);
-            watch = w;
-            break;
-        }
-    }
-    if (!watch) {
+    inotify_watch watch = table_find(in->ino_watches, pointer_from_u64(ino));
+    if (watch) {
+        notify_entry_update_eventmask(watch->ne,
+            (mask & IN_MASK_ADD) ? (notify_entry_get_eventmask(watch->ne) | mask) : mask);
+    } else {
         if (in->watch_count >= INOTIFY_WATCH_MAX) {
             rv = -ENOSPC;
             goto unlock;
@@ -366,6 +398,14 @@ sysreturn inotify_add_watch(int fd, const char *pathname, u32 mask)
             rv = -ENOMEM;
             goto unlock;
         }
+        int wd = in->next_wd;
+        if (!table_set_noreplace(in->wd_watches, pointer_from_u64((u64)wd), watch)) {
+            /* watch descriptor values wrapped around and this one is still in use */
+            deallocate(in->h, watch, sizeof(*watch));
+            rv = -ENOSPC;
+            goto unlock;
+        }
+        table_set(in->ino_watches, pointer_from_u64(ino), watch);
         watch->ne = fs_watch(in->h, n, mask,
                              init_closure_func(&watch->eh, event_handler, inotify_event_handler),
                              &watch->ns);
@@ -378,6 +418,8 @@ sysreturn inotify_add_watch(int fd, const char *pathname, u32 mask)
             watch->n = ino;
             list_push_back(&in->watches, &watch->l);
         } else {
+            table_remove(in->wd_watches, pointer_from_u64((u64)wd));
+            table_remove(in->ino_watches, pointer_from_u64(ino));
             deallocate(in->h, watch, sizeof(*watch));
             watch = 0;
             rv = -ENOMEM;
@@ -403,18 +445,14 @@ sysreturn inotify_rm_watch(int fd, int wd)
     rv = -EINVAL;
     boolean notify_readers = false;
     inotify_lock(in);
-    list_foreach(&in->watches, e) {
-        inotify_watch watch = struct_from_field(e, inotify_watch, l);
-        if (watch->wd == wd) {
-            /* Delete the watch from the inotify list before removing the notify entry, otherwise if
-             * an event is triggered the event handler could access a deallocated watch structure.
-             */
-            list_delete(&watch->l);
-            notify_remove(watch->ns, watch->ne, false);
-            notify_readers = inotify_rm_watch_locked(in, watch, false);
-            rv = 0;
-            break;
-        }
+    inotify_watch watch = (wd >= 0) ? table_find(in->wd_watches, pointer_from_u64((u64)wd)) : 0;
+    if (watch) {
+        /* Delete the watch from the inotify list before removing the notify entry, otherwise if an
+         * event is triggered the event handler could access a deallocated watch structure. */
+        list_delete(&watch->l);
+        notify_remove(watch->ns, watch->ne, false);
+        notify_readers = inotify_rm_watch_locked(in, watch, false);
+        rv = 0;
     }
     inotify_unlock(in);
     if (notify_readers)
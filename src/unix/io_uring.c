@@ -1,9 +1,22 @@
+#include <net_system_structs.h>
 #include <unix_internal.h>
+#include <socket.h>
 
+#define IORING_SETUP_SQPOLL     (1 << 1)
+#define IORING_SETUP_SQ_AFF     (1 << 2)
 #define IORING_SETUP_CQSIZE     (1 << 3)
+#define IORING_SETUP_COOP_TASKRUN   (1 << 8)
+#define IORING_SETUP_TASKRUN_FLAG   (1 << 9)
+#define IORING_SETUP_SINGLE_ISSUER  (1 << 12)
+#define IORING_SETUP_DEFER_TASKRUN  (1 << 13)
 
 #define IORING_FEAT_SINGLE_MMAP     (1 << 0)
 #define IORING_FEAT_RW_CUR_POS      (1 << 3)
+#define IORING_FEAT_SQPOLL_NONFIXED (1 << 7)
+
+#define IORING_SQ_NEED_WAKEUP   (1 << 0)
+#define IORING_SQ_CQ_OVERFLOW   (1 << 1)
+#define IORING_SQ_TASKRUN       (1 << 2)
 
 #define IORING_OFF_SQ_RING  0ULL
 #define IORING_OFF_CQ_RING  0x8000000ULL
@@ -11,7 +24,17 @@
 
 #define IORING_TIMEOUT_ABS  (1 << 0)
 
-#define IORING_ENTER_GETEVENTS  (1 << 0)
+#define IORING_POLL_ADD_MULTI   (1 << 0)    /* in sqe->len */
+#define IORING_ACCEPT_MULTISHOT (1 << 0)    /* in sqe->ioprio */
+
+#define IORING_CQE_F_BUFFER     (1 << 0)
+#define IORING_CQE_F_MORE       (1 << 1)
+#define IORING_CQE_F_NOTIF      (1 << 3)
+#define IORING_CQE_BUFFER_SHIFT 16
+
+#define IORING_ENTER_GETEVENTS          (1 << 0)
+#define IORING_ENTER_SQ_WAKEUP          (1 << 1)
+#define IORING_ENTER_REGISTERED_RING    (1 << 4)
 
 #define IO_URING_OP_SUPPORTED   (1 << 0)
 
@@ -19,8 +42,14 @@
 #define IOUR_CQ_ENTRIES_MAX (2 * IOUR_SQ_ENTRIES_MAX)
 #define IOUR_FILES_MAX      0x8000
 
+#define IOUR_SQPOLL_IDLE_DEFAULT    seconds(1)
+#define IOUR_SQPOLL_INTERVAL        microseconds(10)
+
+#define IOUR_BUFS_MAX       0x10000     /* per buffer group */
+
 #define IOSQE_FIXED_FILE    (1 << 0)
 #define IOSQE_ASYNC         (1 << 4)
+#define IOSQE_BUFFER_SELECT (1 << 5)
 
 //#define IOUR_DEBUG
 #ifdef IOUR_DEBUG
@@ -36,8 +65,14 @@ struct io_uring_sqe {
     u8 flags;
     u16 ioprio;
     s32 fd;
-    u64 off;
-    u64 addr;
+    union {
+        u64 off;
+        u64 addr2;
+    };
+    union {
+        u64 addr;
+        u64 splice_off_in;
+    };
     u32 len;
     union {
         u32 rw_flags;
@@ -46,10 +81,19 @@ struct io_uring_sqe {
         u32 sync_range_flags;
         u32 msg_flags;
         u32 timeout_flags;
+        u32 accept_flags;
+        u32 splice_flags;
     };
     u64 user_data;
     union{
-        u16 buf_index;
+        struct {
+            union {
+                u16 buf_index;
+                u16 buf_group;
+            } __attribute__((packed));
+            u16 personality;
+            s32 splice_fd_in;
+        };
         u64 __pad2[3];
     };
 };
@@ -85,6 +129,30 @@ enum iour_enter_opcode {
     IORING_OP_STATX,
     IORING_OP_READ,
     IORING_OP_WRITE,
+    IORING_OP_FADVISE,
+    IORING_OP_MADVISE,
+    IORING_OP_SEND,
+    IORING_OP_RECV,
+    IORING_OP_OPENAT2,
+    IORING_OP_EPOLL_CTL,
+    IORING_OP_SPLICE,
+    IORING_OP_PROVIDE_BUFFERS,
+    IORING_OP_REMOVE_BUFFERS,
+    IORING_OP_TEE,
+    IORING_OP_SHUTDOWN,
+    IORING_OP_RENAMEAT,
+    IORING_OP_UNLINKAT,
+    IORING_OP_MKDIRAT,
+    IORING_OP_SYMLINKAT,
+    IORING_OP_LINKAT,
+    IORING_OP_MSG_RING,
+    IORING_OP_FSETXATTR,
+    IORING_OP_SETXATTR,
+    IORING_OP_FGETXATTR,
+    IORING_OP_GETXATTR,
+    IORING_OP_SOCKET,
+    IORING_OP_URING_CMD,
+    IORING_OP_SEND_ZC,
     IORING_OP_LAST,
 };
 
@@ -98,6 +166,19 @@ enum iour_register_opcode {
     IORING_REGISTER_FILES_UPDATE,
     IORING_REGISTER_EVENTFD_ASYNC,
     IORING_REGISTER_PROBE,
+    IORING_REGISTER_PERSONALITY,
+    IORING_UNREGISTER_PERSONALITY,
+    IORING_REGISTER_RESTRICTIONS,
+    IORING_REGISTER_ENABLE_RINGS,
+    IORING_REGISTER_FILES2,
+    IORING_REGISTER_FILES_UPDATE2,
+    IORING_REGISTER_BUFFERS2,
+    IORING_REGISTER_BUFFERS_UPDATE,
+    IORING_REGISTER_IOWQ_AFF,
+    IORING_UNREGISTER_IOWQ_AFF,
+    IORING_REGISTER_IOWQ_MAX_WORKERS,
+    IORING_REGISTER_RING_FDS,
+    IORING_UNREGISTER_RING_FDS,
 };
 
 struct io_uring_files_update {
@@ -106,6 +187,12 @@ struct io_uring_files_update {
     s32 *fds;
 };
 
+struct io_uring_rsrc_update {
+    u32 offset;
+    u32 resv;
+    u64 data;
+};
+
 struct io_uring_probe_op {
     u8 op;
     u8 resv;
@@ -144,7 +231,7 @@ typedef struct io_uring {
     u64 phys;
     closure_struct(fdesc_mmap, mmap);
     closure_struct(fdesc_close, close);
-    struct iovec *bufs;
+    struct iour_fixed_buf *bufs;
     u32 buf_count;
     fdesc *files;
     u32 file_count;
@@ -152,11 +239,52 @@ typedef struct io_uring {
     u64 sigmask;
     fdesc eventfd;
     boolean eventfd_async;
+
+    /* Completions that cannot be posted to the CQ ring, because it is full or (with
+     * IORING_SETUP_DEFER_TASKRUN) because they are not posted by the issuer thread, are kept in
+     * order in a ring of cq_entries CQEs, allocated with the instance, and are posted when the
+     * issuer enters io_uring_enter() (or, without DEFER_TASKRUN, as soon as there is room); they
+     * are dropped (and counted in the CQ overflow) only if this ring is full too. */
+    struct io_uring_cqe *pending_cqes;
+    u32 pending_head, pending_tail;
+    boolean defer_taskrun;
+    boolean taskrun_flag;
+    thread issuer;      /* IORING_SETUP_SINGLE_ISSUER */
+
+    /* While a submission round is in progress (batch_depth non-zero), waking up the waiter and
+     * signaling the eventfd are deferred to the end of the round, so that they are done once for
+     * all the completions posted in the round. */
+    u32 batch_depth;
+    boolean notify_pending;
+    boolean efd_pending;
     struct list pollers;
     struct list timers;
     u32 cq_timeouts;
     u64 noncancelable_ops;
 
+    /* SQ polling (IORING_SETUP_SQPOLL): while active, the SQ ring is polled from a kernel timer
+     * (optionally on a fixed CPU) and the poller counts as a non-cancelable operation; after
+     * sq_idle without new entries, IORING_SQ_NEED_WAKEUP is set and polling stops until
+     * io_uring_enter() is called with IORING_ENTER_SQ_WAKEUP. */
+    process p;
+    thread sq_thread;
+    boolean sq_poll;
+    boolean sq_active;
+    int sq_cpu;
+    timestamp sq_idle;
+    timestamp sq_last;
+    struct timer sq_timer;
+    closure_struct(timer_handler, sq_timeout);
+    closure_struct(thunk, sq_poll_run);
+
+    /* Buffer groups registered with IORING_OP_PROVIDE_BUFFERS, and multishot operations that
+     * stay armed until they fail or the instance is closed. */
+    struct list buf_groups;
+    struct list multishot_ops;
+
+    /* Set by close(): the SQ poller and multishot operations stop at their next pass. */
+    boolean closed;
+
     /* When true, the io_uring context is being shut down in the background,
      * i.e. no thread is blocked on close() and the context will be deallocated
      * when its last non-cancelable operation is completed. This can happen if
@@ -178,6 +306,7 @@ typedef struct iour_poll {
     notify_entry ne;
     closure_struct(iour_poll_notify, handler);
     u64 events;
+    boolean multishot;
 } *iour_poll;
 
 declare_closure_struct(2, 2, void, iour_timeout,
@@ -192,6 +321,60 @@ typedef struct iour_timer {
     closure_struct(iour_timeout, handler);
 } *iour_timer;
 
+typedef struct iour_buf {
+    struct list l;
+    u64 addr;
+    u32 len;
+    u16 bid;
+    u16 bgid;
+} *iour_buf;
+
+/* Buffer registered with IORING_REGISTER_BUFFERS: at registration, it is faulted in for DMA and
+ * split into physically contiguous segments, so that fixed I/O on O_DIRECT files hands the buffer
+ * memory to the storage driver without faulting in or translating pages for each request. The
+ * segments are rebuilt if the process mappings in the buffer span have changed since (see
+ * process_pin_range()). */
+struct iour_buf_seg {
+    u64 addr;
+    u64 len;
+};
+
+typedef struct iour_fixed_buf {
+    struct iovec iov;
+    u64 gen;            /* pinned memory generation the segments are valid for */
+    struct iour_buf_seg *segs;
+    u32 seg_count;
+} *iour_fixed_buf;
+
+#define IOUR_FIXED_BUF_MAX  (1ull << 30)
+
+typedef struct iour_buf_group {
+    struct list l;
+    struct list bufs;   /* buffers are selected in LIFO order */
+    u16 bgid;
+} *iour_buf_group;
+
+/* Socket operation (send, receive or accept), issued directly to the socket implementation. */
+typedef struct iour_sock_op {
+    struct list l;      /* in multishot_ops */
+    io_uring iour;
+    struct sock *s;
+    context ctx;
+    u64 user_data;
+    u8 opcode;
+    boolean multishot;
+    int flags;
+    iour_buf buf;
+    struct msghdr *msg;
+    struct msghdr hdr;  /* used by IORING_OP_SEND and IORING_OP_RECV */
+    struct iovec iov;
+    struct sockaddr *addr;
+    socklen_t *addrlen;
+    u64 refcount;
+    closure_struct(io_completion, complete);
+    closure_struct(thunk, next);
+} *iour_sock_op;
+
 /* Mmapped region layout:
  * - Region 1
  *   - struct io_rings
@@ -216,6 +399,14 @@ typedef struct iour_timer {
 #define iour_lock(iour)     spin_lock(&(iour)->f.lock)
 #define iour_unlock(iour)   spin_unlock(&(iour)->f.lock)
 
+static void iour_fixed_bufs_dealloc(io_uring iour, iour_fixed_buf bufs, u32 count)
+{
+    for (u32 i = 0; i < count; i++)
+        if (bufs[i].seg_count)
+            deallocate(iour->h, bufs[i].segs, bufs[i].seg_count * sizeof(struct iour_buf_seg));
+    deallocate(iour->h, bufs, count * sizeof(struct iour_fixed_buf));
+}
+
 static void iour_release(io_uring iour)
 {
     iour_debug("completion %p", iour->shutdown_completion);
@@ -226,7 +417,18 @@ static void iour_release(io_uring iour)
         deallocate(iour->h, iour->files, sizeof(fdesc) * iour->file_count);
     }
     if (iour->buf_count)
-        deallocate(iour->h, iour->bufs, sizeof(struct iovec) * iour->buf_count);
+        iour_fixed_bufs_dealloc(iour, iour->bufs, iour->buf_count);
+    deallocate(iour->h, iour->pending_cqes, iour->cq_entries * sizeof(struct io_uring_cqe));
+    if (iour->sq_thread)
+        thread_release(iour->sq_thread);
+    list_foreach(&iour->buf_groups, l) {
+        iour_buf_group g = struct_from_list(l, iour_buf_group, l);
+        list_foreach(&g->bufs, b) {
+            iour_buf buf = struct_from_list(b, iour_buf, l);
+            deallocate(iour->h, buf, sizeof(*buf));
+        }
+        deallocate(iour->h, g, sizeof(*g));
+    }
     u64 alloc_size = IOUR_ALLOC_SIZE(iour);
     release_fdesc(&iour->f);
     deallocate(iour->h, iour->rings, alloc_size);
@@ -236,6 +438,14 @@ static void iour_release(io_uring iour)
         apply(completion, 0);
 }
 
+/* The SQ poller submits from a kernel context, where there is no current thread: operations
+ * that need a thread are done on behalf of the thread that set up the instance. */
+static thread iour_thread(io_uring iour)
+{
+    thread t = current;
+    return t ? t : iour->sq_thread;
+}
+
 static void iour_timer_remove(io_uring iour, iour_timer t)
 {
     if (remove_timer(kernel_timers, &t->t, 0)) {
@@ -328,6 +538,11 @@ closure_func_basic(fdesc_close, sysreturn, iour_close,
     }
 
     iour_lock(iour);
+    iour->closed = true;   /* an active SQ poller stops at its next pass */
+    list_foreach(&iour->multishot_ops, l) {
+        iour_sock_op op = struct_from_list(l, iour_sock_op, l);
+        blockq_wake_one_for_thread(op->s->rxbq, (unix_context)op->ctx, true);
+    }
     if (iour->eventfd) {
         fdesc_put(iour->eventfd);
         iour->eventfd = 0;
@@ -357,6 +572,136 @@ closure_func_basic(fdesc_close, sysreturn, iour_close,
     return 0;
 }
 
+static unsigned int iour_submit_entries(io_uring iour, unsigned int to_submit);
+
+static const u64 iour_efd_val = 1;
+
+/* Called with the instance lock held, which is released on return: wakes up the waiter (if any)
+ * and signals the eventfd for the completions posted, unless a submission round is in progress. */
+static void iour_notify_unlock(io_uring iour)
+{
+    blockq bq = 0;
+    fdesc efd = 0;
+    if (iour->batch_depth) {
+        iour->notify_pending = true;
+    } else {
+        iour->notify_pending = false;
+        bq = iour->bq;
+        if (bq)
+            blockq_reserve(bq);
+        if (iour->efd_pending) {
+            iour->efd_pending = false;
+            efd = iour->eventfd;
+            if (efd)
+                fetch_and_add(&efd->refcnt, 1);
+        }
+    }
+    iour_unlock(iour);
+    if (efd) {
+        apply(efd->write, (void *)&iour_efd_val, sizeof(iour_efd_val), 0,
+              get_current_context(current_cpu()), true, io_completion_ignore);
+        fdesc_put(efd);
+    }
+    if (bq) {
+        blockq_wake_one(bq);
+        blockq_release(bq);
+    }
+}
+
+static void iour_batch_start(io_uring iour)
+{
+    iour_lock(iour);
+    iour->batch_depth++;
+    iour_unlock(iour);
+}
+
+static void iour_batch_end(io_uring iour)
+{
+    iour_lock(iour);
+    if ((--iour->batch_depth == 0) && iour->notify_pending)
+        iour_notify_unlock(iour);
+    else
+        iour_unlock(iour);
+}
+
+/* Drops a non-cancelable operation that does not post a completion; called with the instance lock
+ * held, which is released on return. */
+static void iour_op_done_locked(io_uring iour)
+{
+    if ((fetch_and_add(&iour->noncancelable_ops, -1) == 1) && iour->shutdown) {
+        iour_release(iour);
+        return;
+    }
+    iour_notify_unlock(iour);
+}
+
+/* Called with the instance lock held; the lock is released on return. */
+static void iour_sq_poll_stop_locked(io_uring iour)
+{
+    iour->sq_active = false;
+    iour_op_done_locked(iour);
+}
+
+closure_func_basic(thunk, void, iour_sq_poll_run)
+{
+    io_uring iour = struct_from_field(closure_self(), io_uring, sq_poll_run);
+    unsigned int submitted = iour->closed ? 0 : iour_submit_entries(iour, iour->sq_entries);
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    iour_lock(iour);
+    if (iour->closed) {
+        iour_sq_poll_stop_locked(iour);
+        return;
+    }
+    if (submitted)
+        iour->sq_last = here;
+    if (here - iour->sq_last >= iour->sq_idle) {
+        iour->rings->sq_flags |= IORING_SQ_NEED_WAKEUP;
+        memory_barrier();
+
+        /* Entries queued before the flag became visible would not be followed by a wakeup. */
+        if (iour->rings->sq_head == iour->rings->sq_tail) {
+            iour_debug("SQ poller idle");
+            iour_sq_poll_stop_locked(iour);
+            return;
+        }
+        iour->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+        iour->sq_last = here;
+    }
+    register_timer(kernel_timers, &iour->sq_timer, CLOCK_ID_MONOTONIC_RAW, IOUR_SQPOLL_INTERVAL,
+                   false, 0, (timer_handler)&iour->sq_timeout);
+    iour_unlock(iour);
+}
+
+closure_func_basic(timer_handler, void, iour_sq_timeout,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled)
+        return;
+    io_uring iour = struct_from_field(closure_self(), io_uring, sq_timeout);
+    thunk t = (thunk)&iour->sq_poll_run;
+    int cpu = iour->sq_cpu;
+    if ((cpu >= 0) && (cpu != current_cpu()->id)) {
+        assert(enqueue_irqsafe(cpuinfo_from_id(cpu)->cpu_queue, t));
+        wakeup_cpu(cpu);
+    } else {
+        apply(t);
+    }
+}
+
+/* Called with the instance lock held. */
+static void iour_sq_poll_start_locked(io_uring iour)
+{
+    if (iour->closed)
+        return;
+    iour_debug("starting SQ poller, cpu %d", iour->sq_cpu);
+    iour->rings->sq_flags &= ~IORING_SQ_NEED_WAKEUP;
+    iour->sq_active = true;
+    iour->sq_last = now(CLOCK_ID_MONOTONIC_RAW);
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    register_timer(kernel_timers, &iour->sq_timer, CLOCK_ID_MONOTONIC_RAW, 0, false, 0,
+                   (timer_handler)&iour->sq_timeout);
+}
+
 static void iour_rings_init(io_uring iour)
 {
     io_rings rings = iour->rings;
@@ -378,9 +723,25 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
     iour_debug("entries %d, flags 0x%x, CQ entries %d", entries, params->flags,
                params->cq_entries);
     if ((entries == 0) || (entries > IOUR_SQ_ENTRIES_MAX) ||
-            (params->flags & ~IORING_SETUP_CQSIZE) || params->resv[0] ||
+            (params->flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF |
+                               IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN |
+                               IORING_SETUP_TASKRUN_FLAG | IORING_SETUP_SINGLE_ISSUER |
+                               IORING_SETUP_DEFER_TASKRUN)) || params->resv[0] ||
             params->resv[1] || params->resv[2] || params->resv[3])
         return -EINVAL;
+    if ((params->flags & IORING_SETUP_SQ_AFF) &&
+            (!(params->flags & IORING_SETUP_SQPOLL) ||
+             (params->sq_thread_cpu >= total_processors)))
+        return -EINVAL;
+
+    /* Completions never interrupt user code here, so IORING_SETUP_COOP_TASKRUN is implied; the
+     * task run flag signals deferred completions. */
+    if (((params->flags & IORING_SETUP_TASKRUN_FLAG) &&
+         !(params->flags & (IORING_SETUP_COOP_TASKRUN | IORING_SETUP_DEFER_TASKRUN))) ||
+        ((params->flags & IORING_SETUP_DEFER_TASKRUN) &&
+         (!(params->flags & IORING_SETUP_SINGLE_ISSUER) ||
+          (params->flags & IORING_SETUP_SQPOLL))))
+        return -EINVAL;
     u32 sq_entries, cq_entries;
     sq_entries = U64_FROM_BIT(find_order(entries));
     if (params->flags & IORING_SETUP_CQSIZE) {
@@ -419,16 +780,44 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
     iour_debug("rings %p, SQ array %p, CQEs %p, SQEs %p", iour->rings,
                iour->sq_array, iour->cqes, iour->sqes);
 
+    iour->pending_cqes = allocate(h, cq_entries * sizeof(struct io_uring_cqe));
+    if (iour->pending_cqes == INVALID_ADDRESS) {
+        ret = -ENOMEM;
+        goto err2;
+    }
+    iour->pending_head = iour->pending_tail = 0;
+    iour->defer_taskrun = (params->flags & IORING_SETUP_DEFER_TASKRUN) != 0;
+    iour->taskrun_flag = (params->flags & IORING_SETUP_TASKRUN_FLAG) != 0;
+    iour->issuer = (params->flags & IORING_SETUP_SINGLE_ISSUER) ? current : 0;
+    iour->batch_depth = 0;
+    iour->notify_pending = iour->efd_pending = false;
+
     iour_rings_init(iour);
     iour->buf_count = iour->file_count = 0;
     iour->bq = 0;
     iour->eventfd = 0;
     list_init(&iour->pollers);
     list_init(&iour->timers);
+    list_init(&iour->buf_groups);
+    list_init(&iour->multishot_ops);
     iour->cq_timeouts = 0;
     iour->noncancelable_ops = 0;
     iour->shutdown = false;
     iour->shutdown_completion = 0;
+    iour->p = current->p;
+    iour->sq_thread = 0;
+    iour->sq_poll = (params->flags & IORING_SETUP_SQPOLL) != 0;
+    iour->sq_active = iour->closed = false;
+    if (iour->sq_poll) {
+        /* without an explicit CPU, poll on an isolated CPU (if any) */
+        iour->sq_cpu = (params->flags & IORING_SETUP_SQ_AFF) ? params->sq_thread_cpu :
+                       sched_poll_cpu();
+        iour->sq_idle = params->sq_thread_idle ? milliseconds(params->sq_thread_idle) :
+                        IOUR_SQPOLL_IDLE_DEFAULT;
+        init_timer(&iour->sq_timer);
+        init_closure_func(&iour->sq_timeout, timer_handler, iour_sq_timeout);
+        init_closure_func(&iour->sq_poll_run, thunk, iour_sq_poll_run);
+    }
     init_fdesc(h, &iour->f, FDESC_TYPE_IORING);
     iour->f.mmap = init_closure_func(&iour->mmap, fdesc_mmap, iour_mmap);
     iour->f.close = init_closure_func(&iour->close, fdesc_close, iour_close);
@@ -437,7 +826,8 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
         ret = -EFAULT;
         goto err3;
     }
-    params->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS;
+    params->features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_RW_CUR_POS |
+                       IORING_FEAT_SQPOLL_NONFIXED;
     params->sq_entries = sq_entries;
     params->sq_off.head = offsetof(io_rings, sq_head);
     params->sq_off.tail = offsetof(io_rings, sq_tail);
@@ -462,54 +852,108 @@ sysreturn io_uring_setup(unsigned int entries, struct io_uring_params *params)
         return -EMFILE;
     }
     iour_debug("fd %d", ret);
+    if (iour->sq_poll) {
+        iour->sq_thread = current;
+        thread_reserve(iour->sq_thread);
+        iour_lock(iour);
+        iour_sq_poll_start_locked(iour);
+        iour_unlock(iour);
+    }
     return ret;
 err3:
+    deallocate(h, iour->pending_cqes, cq_entries * sizeof(struct io_uring_cqe));
+err2:
     deallocate(h, iour->rings, alloc_size);
 err1:
     deallocate(h, iour, sizeof(*iour));
     return ret;
 }
 
-simple_closure_function(1, 1, void, iour_efd_complete,
-                        u64, efd_val,
-                        sysreturn rv)
+/* Number of completions posted, including those pending and dropped. */
+static u32 iour_cq_count(io_uring iour)
 {
-    closure_finish();
+    io_rings rings = iour->rings;
+    return rings->cq_tail + (iour->pending_tail - iour->pending_head) + rings->cq_overflow;
+}
+
+static void iour_pending_flags_update(io_uring iour)
+{
+    io_rings rings = iour->rings;
+    u32 flag = iour->defer_taskrun ? (iour->taskrun_flag ? IORING_SQ_TASKRUN : 0) :
+               IORING_SQ_CQ_OVERFLOW;
+    if (iour->pending_head != iour->pending_tail)
+        rings->sq_flags |= flag;
+    else
+        rings->sq_flags &= ~flag;
 }
 
-static void iour_complete_locked(io_uring iour, u64 user_data, s32 res,
+/* Moves pending completions to the CQ ring, as long as there is room; called with the instance
+ * lock held. */
+static void iour_pending_flush_locked(io_uring iour)
+{
+    io_rings rings = iour->rings;
+    if (iour->pending_head == iour->pending_tail)
+        return;
+    u32 head = *(volatile u32 *)&rings->cq_head;
+    while ((iour->pending_head != iour->pending_tail) &&
+           (rings->cq_tail - head < iour->cq_entries)) {
+        iour->cqes[rings->cq_tail & iour->cq_mask] =
+            iour->pending_cqes[iour->pending_head++ & iour->cq_mask];
+        write_barrier();
+        rings->cq_tail++;
+    }
+    iour_debug("flushed pending CQEs, CQ tail %d, pending %d", rings->cq_tail,
+               iour->pending_tail - iour->pending_head);
+    iour_pending_flags_update(iour);
+}
+
+/* With IORING_SETUP_DEFER_TASKRUN, completions are posted to the CQ ring directly only by the
+ * issuer thread (in its syscalls). */
+static boolean iour_can_post(io_uring iour)
+{
+    if (!iour->defer_taskrun)
+        return true;
+    return is_syscall_context(get_current_context(current_cpu())) && (current == iour->issuer);
+}
+
+static void iour_complete_locked(io_uring iour, u64 user_data, s32 res, u32 flags,
                                  boolean async)
 {
     io_rings rings = iour->rings;
-    iour_debug("user_data %ld, res %d, CQ tail %d", user_data, res,
+    iour_debug("user_data %ld, res %d, flags 0x%x, CQ tail %d", user_data, res, flags,
                rings->cq_tail);
-    if (rings->cq_tail < rings->cq_head + iour->cq_entries) {
-        struct io_uring_cqe *cqe = &iour->cqes[rings->cq_tail & iour->cq_mask];
+    boolean can_post = iour_can_post(iour);
+    if (can_post)
+        iour_pending_flush_locked(iour);
+    struct io_uring_cqe *cqe;
+    if (can_post && (iour->pending_head == iour->pending_tail) &&
+        (rings->cq_tail - *(volatile u32 *)&rings->cq_head < iour->cq_entries)) {
+        cqe = &iour->cqes[rings->cq_tail & iour->cq_mask];
         cqe->user_data = user_data;
         cqe->res = res;
-        cqe->flags = 0;
+        cqe->flags = flags;
         write_barrier();
         rings->cq_tail++;
+    } else if (iour->pending_tail - iour->pending_head < iour->cq_entries) {
+        iour_debug("pending");
+        cqe = &iour->pending_cqes[iour->pending_tail++ & iour->cq_mask];
+        cqe->user_data = user_data;
+        cqe->res = res;
+        cqe->flags = flags;
+        iour_pending_flags_update(iour);
     } else {
         iour_debug("overflow");
         rings->cq_overflow++;
     }
-    if (iour->eventfd && (async || !iour->eventfd_async)) {
-        closure_new(iour->h, iour_efd_complete, completion);
-        if (completion != INVALID_ADDRESS) {
-            completion->efd_val = 1;
-            apply(iour->eventfd->write, &completion->efd_val,
-                  sizeof(completion->efd_val), 0, get_current_context(current_cpu()), true,
-                  closure_get(iour_efd_complete, completion));
-        }
-    }
+    if (iour->eventfd && (async || !iour->eventfd_async))
+        iour->efd_pending = true;
 }
 
-static void iour_complete(io_uring iour, u64 user_data, s32 res,
-                          boolean async, boolean noncancelable)
+static void iour_complete_flags(io_uring iour, u64 user_data, s32 res, u32 flags,
+                                boolean async, boolean noncancelable)
 {
     iour_lock(iour);
-    iour_complete_locked(iour, user_data, res, async);
+    iour_complete_locked(iour, user_data, res, flags, async);
     if (noncancelable) {
         if ((fetch_and_add(&iour->noncancelable_ops, -1) == 1) &&
                 iour->shutdown) {
@@ -522,11 +966,11 @@ static void iour_complete(io_uring iour, u64 user_data, s32 res,
 check_timers:
     list_foreach(&iour->timers, l) {
         iour_timer iour_tim = struct_from_list(l, iour_timer, l);
-        if (iour_tim->target == iour->rings->cq_tail + iour->rings->cq_overflow) {
+        if (iour_tim->target == iour_cq_count(iour)) {
             list_delete(l);
             list_push_back(&deleted_timers, l);
             iour->cq_timeouts++;
-            iour_complete_locked(iour, iour_tim->user_data, 0, async);
+            iour_complete_locked(iour, iour_tim->user_data, 0, 0, async);
 
             /* Increment the target of any remaining timers, to compensate the
              * CQ tail increment due to the just completed timeout, then go
@@ -538,41 +982,139 @@ check_timers:
             goto check_timers;
         }
     }
-    blockq bq = iour->bq;
-    if (bq)
-        blockq_reserve(bq);
-    iour_unlock(iour);
+    iour_notify_unlock(iour);
     list_foreach(&deleted_timers, l) {
         iour_timer iour_tim = struct_from_list(l, iour_timer, l);
         iour_timer_remove(iour, iour_tim);
     }
-    if (bq) {
-        blockq_wake_one(bq);
-        blockq_release(bq);
-    }
+}
+
+static void iour_complete(io_uring iour, u64 user_data, s32 res,
+                          boolean async, boolean noncancelable)
+{
+    iour_complete_flags(iour, user_data, res, 0, async, noncancelable);
 }
 
 static void iour_complete_timeout(io_uring iour, u64 user_data)
 {
     iour_lock(iour);
     iour->cq_timeouts++;
-    iour_complete_locked(iour, user_data, -ETIME, true);
-    blockq bq = iour->bq;
-    if (bq)
-        blockq_reserve(bq);
+    iour_complete_locked(iour, user_data, -ETIME, 0, true);
+    iour_notify_unlock(iour);
+}
+
+/* Called with the instance lock held. */
+static iour_buf_group iour_buf_group_find(io_uring iour, u16 bgid)
+{
+    list_foreach(&iour->buf_groups, l) {
+        iour_buf_group g = struct_from_list(l, iour_buf_group, l);
+        if (g->bgid == bgid)
+            return g;
+    }
+    return 0;
+}
+
+static s32 iour_provide_buffers(io_uring iour, u64 addr, u32 len, u32 nbufs, u16 bgid,
+                                u64 bid)
+{
+    iour_debug("addr 0x%lx, len %d, nbufs %d, group %d, bid %d", addr, len, nbufs, bgid, bid);
+    if ((nbufs == 0) || (nbufs > IOUR_BUFS_MAX) || (bid + nbufs > IOUR_BUFS_MAX))
+        return -EINVAL;
+    if (!validate_user_memory(pointer_from_u64(addr), (u64)len * nbufs, true))
+        return -EFAULT;
+    s32 res = 0;
+    iour_lock(iour);
+    iour_buf_group g = iour_buf_group_find(iour, bgid);
+    if (!g) {
+        g = allocate(iour->h, sizeof(*g));
+        if (g == INVALID_ADDRESS) {
+            res = -ENOMEM;
+            goto out;
+        }
+        list_init(&g->bufs);
+        g->bgid = bgid;
+        list_push_back(&iour->buf_groups, &g->l);
+    }
+    for (u32 i = 0; i < nbufs; i++) {
+        iour_buf b = allocate(iour->h, sizeof(*b));
+        if (b == INVALID_ADDRESS) {
+            if (i == 0)
+                res = -ENOMEM;
+            break;
+        }
+        b->addr = addr + (u64)len * i;
+        b->len = len;
+        b->bid = bid + i;
+        b->bgid = bgid;
+        list_push_back(&g->bufs, &b->l);
+    }
+  out:
     iour_unlock(iour);
-    if (bq) {
-        blockq_wake_one(bq);
-        blockq_release(bq);
+    return res;
+}
+
+static s32 iour_remove_buffers(io_uring iour, u32 nbufs, u16 bgid)
+{
+    iour_debug("nbufs %d, group %d", nbufs, bgid);
+    if ((nbufs == 0) || (nbufs > IOUR_BUFS_MAX))
+        return -EINVAL;
+    s32 res = 0;
+    iour_lock(iour);
+    iour_buf_group g = iour_buf_group_find(iour, bgid);
+    if (g) {
+        list l;
+        while ((res < nbufs) && (l = list_get_next(&g->bufs))) {
+            list_delete(l);
+            deallocate(iour->h, struct_from_list(l, iour_buf, l), sizeof(struct iour_buf));
+            res++;
+        }
+    } else {
+        res = -ENOENT;
+    }
+    iour_unlock(iour);
+    return res;
+}
+
+static iour_buf iour_select_buffer(io_uring iour, u16 bgid)
+{
+    iour_buf b = 0;
+    iour_lock(iour);
+    iour_buf_group g = iour_buf_group_find(iour, bgid);
+    if (g && !list_empty(&g->bufs))
+        b = struct_from_list(list_pop_back(&g->bufs), iour_buf, l);
+    iour_unlock(iour);
+    iour_debug("group %d: buffer %p", bgid, b);
+    return b;
+}
+
+/* Returns the CQE flags for a completed operation that used a selected buffer: the buffer is
+ * consumed on success and given back to its group otherwise. */
+static u32 iour_buffer_done(io_uring iour, iour_buf b, sysreturn rv)
+{
+    if (rv < 0) {
+        iour_lock(iour);
+        iour_buf_group g = iour_buf_group_find(iour, b->bgid);
+        if (g)
+            list_push_back(&g->bufs, &b->l);
+        iour_unlock(iour);
+        if (!g)
+            deallocate(iour->h, b, sizeof(*b));
+        return 0;
     }
+    u32 flags = IORING_CQE_F_BUFFER | (b->bid << IORING_CQE_BUFFER_SHIFT);
+    deallocate(iour->h, b, sizeof(*b));
+    return flags;
 }
 
-closure_function(4, 1, void, iour_rw_complete,
-                 io_uring, iour, fdesc, f, u64, user_data, context, proc_ctx,
+closure_function(5, 1, void, iour_rw_complete,
+                 io_uring, iour, fdesc, f, u64, user_data, context, proc_ctx, iour_buf, buf,
                  sysreturn rv)
 {
+    io_uring iour = bound(iour);
+    iour_buf buf = bound(buf);
     fdesc_put(bound(f));
-    iour_complete(bound(iour), bound(user_data), rv, true, true);
+    u32 flags = buf ? iour_buffer_done(iour, buf, rv) : 0;
+    iour_complete_flags(iour, bound(user_data), rv, flags, true, true);
     context_release_refcount(bound(proc_ctx));
     closure_finish();
 }
@@ -581,9 +1123,10 @@ static void iour_iov(io_uring iour, fdesc f, boolean write, struct iovec *iov,
                      u32 len, u64 off, u64 user_data)
 {
     io_completion completion;
-    process_context pc = get_process_context();
+    process_context pc = get_process_context_for(iour->p);
     if (pc != INVALID_ADDRESS) {
-        completion = closure(iour->h, iour_rw_complete, iour, f, user_data, &pc->uc.kc.context);
+        completion = closure(iour->h, iour_rw_complete, iour, f, user_data, &pc->uc.kc.context,
+                             0);
         if (completion == INVALID_ADDRESS)
             context_release_refcount(&pc->uc.kc.context);
     } else {
@@ -598,9 +1141,15 @@ static void iour_iov(io_uring iour, fdesc f, boolean write, struct iovec *iov,
     }
 }
 
+/* If buf is non-zero, it is a selected buffer that replaces addr and len. */
 static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
-                    u64 offset, u64 user_data)
+                    u64 offset, u64 user_data, iour_buf buf)
 {
+    if (buf) {
+        addr = pointer_from_u64(buf->addr);
+        if (!len || (len > buf->len))
+            len = buf->len;
+    }
     iour_debug("%s at %p, len %d, offset %ld", write ? ss("write") : ss("read"), addr,
             len, offset);
     int err = 0;
@@ -613,9 +1162,10 @@ static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
             (!write && !fdesc_is_readable(f))) {
         err = -EBADF;
     } else {
-        pc = get_process_context();
+        pc = get_process_context_for(iour->p);
         if (pc != INVALID_ADDRESS) {
-            completion = closure(iour->h, iour_rw_complete, iour, f, user_data, &pc->uc.kc.context);
+            completion = closure(iour->h, iour_rw_complete, iour, f, user_data, &pc->uc.kc.context,
+                                 buf);
             if (completion == INVALID_ADDRESS)
                 context_release_refcount(&pc->uc.kc.context);
         } else {
@@ -626,6 +1176,8 @@ static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
     }
     if (err) {
         fdesc_put(f);
+        if (buf)
+            iour_buffer_done(iour, buf, err);
         iour_complete(iour, user_data, err, false, false);
     } else {
         fetch_and_add(&iour->noncancelable_ops, 1);
@@ -633,6 +1185,313 @@ static void iour_rw(io_uring iour, fdesc f, boolean write, void *addr, u32 len,
     }
 }
 
+/* Faults in a buffer to be registered and splits it into physically contiguous segments; called in
+ * syscall context. */
+static sysreturn iour_fixed_buf_map(io_uring iour, struct iovec *iov, u64 *gen,
+                                    struct iour_buf_seg **segs, u32 *seg_count)
+{
+    u64 start = u64_from_pointer(iov->iov_base);
+    u64 end = start + iov->iov_len;
+    *seg_count = 0;
+    if (start == end)
+        return 0;
+    *gen = process_pin_range(iour->p, irange(start & ~PAGEMASK, pad(end, PAGESIZE)));
+    if (!fault_in_user_memory_for_dma(iov->iov_base, iov->iov_len))
+        return -EFAULT;
+    u32 count = 0, alloc_count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        physical next_phys = INVALID_PHYSICAL;
+        count = 0;
+        for (u64 a = start; a < end; ) {
+            u64 next = MIN((a & ~PAGEMASK) + PAGESIZE, end);
+            physical phys = physical_from_virtual(pointer_from_u64(a));
+            if ((phys == INVALID_PHYSICAL) || (pass && (phys != next_phys) &&
+                                               (count == alloc_count))) {
+                /* the mappings have changed under us */
+                if (pass)
+                    deallocate(iour->h, *segs, alloc_count * sizeof(struct iour_buf_seg));
+                return -EFAULT;
+            }
+            if (phys != next_phys) {
+                if (pass)
+                    (*segs)[count] = (struct iour_buf_seg){a, 0};
+                count++;
+            }
+            if (pass)
+                (*segs)[count - 1].len += next - a;
+            next_phys = phys + (next - a);
+            a = next;
+        }
+        if (!pass) {
+            *segs = allocate(iour->h, count * sizeof(struct iour_buf_seg));
+            if (*segs == INVALID_ADDRESS)
+                return -ENOMEM;
+            alloc_count = count;
+        }
+    }
+    if (count < alloc_count) {
+        deallocate(iour->h, *segs, alloc_count * sizeof(struct iour_buf_seg));
+        return -EFAULT;
+    }
+    *seg_count = count;
+    return 0;
+}
+
+static sg_list iour_fixed_buf_sg_locked(iour_fixed_buf b, void *addr, u32 len)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return 0;
+    u64 start = u64_from_pointer(addr);
+    u64 end = start + len;
+    u32 lo = 0, hi = b->seg_count;
+    while (lo < hi) {
+        u32 mid = (lo + hi) / 2;
+        if (b->segs[mid].addr + b->segs[mid].len <= start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (struct iour_buf_seg *seg = &b->segs[lo]; start < end; seg++) {
+        u64 seg_end = MIN(seg->addr + seg->len, end);
+        sg_buf sgb = sg_list_tail_add(sg, seg_end - start);
+        if (sgb == INVALID_ADDRESS) {
+            deallocate_sg_list(sg);
+            return 0;
+        }
+        sgb->buf = pointer_from_u64(start);
+        sgb->size = seg_end - start;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+        start = seg_end;
+    }
+    return sg;
+}
+
+/* Returns an sg list with the segments of a registered buffer that span [addr, addr + len), or 0
+ * if the buffer segments are stale and cannot be rebuilt in this context (which requires faulting
+ * in the buffer). */
+static sg_list iour_fixed_buf_sg(io_uring iour, u16 index, void *addr, u32 len)
+{
+    if (len == 0)
+        return 0;
+    for (boolean remapped = false; ; remapped = true) {
+        iour_lock(iour);
+        if (index >= iour->buf_count) {
+            iour_unlock(iour);
+            return 0;
+        }
+        iour_fixed_buf bufs = iour->bufs;
+        iour_fixed_buf b = &bufs[index];
+        if (b->seg_count && (b->gen == *(volatile u64 *)&iour->p->pinned_gen)) {
+            sg_list sg = iour_fixed_buf_sg_locked(b, addr, len);
+            iour_unlock(iour);
+            return sg;
+        }
+        struct iovec iov = b->iov;
+        iour_unlock(iour);
+        if (remapped || !is_syscall_context(get_current_context(current_cpu())))
+            return 0;
+        u64 gen;
+        struct iour_buf_seg *segs;
+        u32 seg_count;
+        if (iour_fixed_buf_map(iour, &iov, &gen, &segs, &seg_count) < 0)
+            return 0;
+        iour_lock(iour);
+        if ((iour->bufs == bufs) && (index < iour->buf_count) &&
+            (b->iov.iov_base == iov.iov_base) && (b->iov.iov_len == iov.iov_len)) {
+            struct iour_buf_seg *old_segs = b->segs;
+            u32 old_count = b->seg_count;
+            b->segs = segs;
+            b->seg_count = seg_count;
+            b->gen = gen;
+            segs = old_segs;
+            seg_count = old_count;
+        }
+        iour_unlock(iour);
+        if (seg_count)
+            deallocate(iour->h, segs, seg_count * sizeof(struct iour_buf_seg));
+    }
+}
+
+/* Issues a fixed I/O request directly on the segments of a registered buffer; returns false if
+ * the request must take the regular path (in which case sg is left to the caller). */
+static boolean iour_rw_direct(io_uring iour, fdesc f, boolean write, sg_list sg, u64 offset,
+                              u64 user_data)
+{
+    if ((fdesc_type(f) != FDESC_TYPE_REGULAR) ||
+        (write ? !fdesc_is_writable(f) : !fdesc_is_readable(f)))
+        return false;
+    iour_debug("direct %s, len %ld, offset %ld", write ? ss("write") : ss("read"), sg->count,
+               offset);
+    process_context pc = get_process_context_for(iour->p);
+    if (pc == INVALID_ADDRESS)
+        return false;
+    io_completion completion = closure(iour->h, iour_rw_complete, iour, f, user_data,
+                                       &pc->uc.kc.context, 0);
+    if (completion == INVALID_ADDRESS) {
+        context_release_refcount(&pc->uc.kc.context);
+        return false;
+    }
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    if (file_direct_io_sg((file)f, sg, offset, write, &pc->uc.kc.context, completion))
+        return true;
+    deallocate_closure(completion);
+    context_release_refcount(&pc->uc.kc.context);
+    iour_lock(iour);
+    iour_op_done_locked(iour);
+    return false;
+}
+
+static void iour_sock_op_issue(iour_sock_op op)
+{
+    struct sock *s = op->s;
+    io_completion completion = (io_completion)&op->complete;
+    switch (op->opcode) {
+    case IORING_OP_ACCEPT:
+        s->accept4(s, op->addr, op->addrlen, op->flags, op->ctx, true, completion);
+        break;
+    case IORING_OP_RECVMSG:
+    case IORING_OP_RECV:
+        s->recvmsg(s, op->msg, op->flags, op->ctx, true, completion);
+        break;
+    default:
+        s->sendmsg(s, op->msg, op->flags, op->ctx, true, completion);
+    }
+}
+
+static void iour_sock_op_put(iour_sock_op op)
+{
+    if (fetch_and_add(&op->refcount, -1) == 1) {
+        socket_release(op->s);
+        context_release_refcount(op->ctx);
+        deallocate(op->iour->h, op, sizeof(*op));
+    }
+}
+
+closure_func_basic(io_completion, void, iour_sock_op_complete,
+                   sysreturn rv)
+{
+    iour_sock_op op = struct_from_field(closure_self(), iour_sock_op, complete);
+    io_uring iour = op->iour;
+    u64 user_data = op->user_data;
+    iour_debug("opcode %d, user_data %ld, rv %ld", op->opcode, user_data, rv);
+    u32 flags = 0;
+    if (op->buf) {
+        flags = iour_buffer_done(iour, op->buf, rv);
+        op->buf = 0;
+    }
+    if (op->multishot) {
+        iour_lock(iour);
+        boolean rearm = (rv >= 0) && !iour->closed;
+        if (!rearm) {
+            list_delete(&op->l);
+            if (iour->closed && (rv == -ERESTARTSYS))
+                rv = -ECANCELED;
+        }
+        iour_unlock(iour);
+        if (rearm) {
+            iour_complete_flags(iour, user_data, rv, IORING_CQE_F_MORE, true, false);
+            async_apply((thunk)&op->next);
+            return;
+        }
+    } else if (op->opcode == IORING_OP_SEND_ZC) {
+        /* The data has been copied out of the user buffer by the time the send completes, so the
+         * buffer notification immediately follows the result. */
+        iour_complete_flags(iour, user_data, rv, IORING_CQE_F_MORE, true, false);
+        rv = 0;
+        flags = IORING_CQE_F_NOTIF;
+    }
+    iour_sock_op_put(op);
+    iour_complete_flags(iour, user_data, rv, flags, true, true);
+}
+
+/* Re-arms a multishot operation. A close() that runs while the operation is being issued would
+ * find it not yet blocked, so the instance is checked again once the operation is issued; the
+ * operation and the instance are kept alive until then. */
+closure_func_basic(thunk, void, iour_sock_op_next)
+{
+    iour_sock_op op = struct_from_field(closure_self(), iour_sock_op, next);
+    io_uring iour = op->iour;
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    fetch_and_add(&op->refcount, 1);
+    iour_sock_op_issue(op);
+    iour_lock(iour);
+    if (iour->closed && list_inserted(&op->l))
+        blockq_wake_one_for_thread(op->s->rxbq, (unix_context)op->ctx, true);
+    iour_sock_op_put(op);
+    iour_op_done_locked(iour);
+}
+
+/* Takes ownership of the socket reference. */
+static void iour_sock_op_submit(io_uring iour, struct sock *s, struct io_uring_sqe *sqe,
+                                struct msghdr *msg, iour_buf buf)
+{
+    s32 err;
+    iour_sock_op op = allocate(iour->h, sizeof(*op));
+    if (op == INVALID_ADDRESS) {
+        err = -ENOMEM;
+        goto error;
+    }
+    process_context pc = get_process_context_for(iour->p);
+    if (pc == INVALID_ADDRESS) {
+        deallocate(iour->h, op, sizeof(*op));
+        err = -ENOMEM;
+        goto error;
+    }
+    op->iour = iour;
+    op->s = s;
+    op->ctx = &pc->uc.kc.context;
+    op->user_data = sqe->user_data;
+    op->opcode = sqe->opcode;
+    op->refcount = 1;
+    op->multishot = false;
+    op->buf = buf;
+    if (sqe->opcode == IORING_OP_ACCEPT) {
+        op->flags = sqe->accept_flags;
+        op->addr = pointer_from_u64(sqe->addr);
+        op->addrlen = pointer_from_u64(sqe->addr2);
+        if (sqe->ioprio & IORING_ACCEPT_MULTISHOT) {
+            op->multishot = true;
+            init_closure_func(&op->next, thunk, iour_sock_op_next);
+        }
+    } else {
+        op->flags = sqe->msg_flags;
+        if (msg) {
+            op->msg = msg;
+        } else {
+            if (buf) {
+                op->iov.iov_base = pointer_from_u64(buf->addr);
+                op->iov.iov_len = (sqe->len && (sqe->len < buf->len)) ? sqe->len : buf->len;
+            } else {
+                op->iov.iov_base = pointer_from_u64(sqe->addr);
+                op->iov.iov_len = sqe->len;
+            }
+            zero(&op->hdr, sizeof(op->hdr));
+            op->hdr.msg_iov = &op->iov;
+            op->hdr.msg_iovlen = 1;
+            op->msg = &op->hdr;
+        }
+    }
+    init_closure_func(&op->complete, io_completion, iour_sock_op_complete);
+    fetch_and_add(&iour->noncancelable_ops, 1);
+    if (op->multishot) {
+        iour_lock(iour);
+        list_push_back(&iour->multishot_ops, &op->l);
+        iour_unlock(iour);
+        thunk next = (thunk)&op->next;
+        apply(next);
+    } else {
+        iour_sock_op_issue(op);
+    }
+    return;
+  error:
+    if (buf)
+        iour_buffer_done(iour, buf, err);
+    socket_release(s);
+    iour_complete(iour, sqe->user_data, err, false, false);
+}
+
 define_closure_function(2, 2, u64, iour_poll_notify,
                         io_uring, iour, iour_poll, p,
                         u64 events, void *arg)
@@ -645,13 +1504,19 @@ define_closure_function(2, 2, u64, iour_poll_notify,
     iour_lock(iour);
     boolean found = list_find(&iour->pollers, &p->l);
     if (found) {
-        list_delete(&p->l);
+        if (!p->multishot)
+            list_delete(&p->l);
     } else {
         p->events = events;
     }
     iour_unlock(iour);
     if (found) {
         iour_debug("user_data %ld, events %ld", p->user_data, events);
+        if (p->multishot) {
+            /* The poller stays armed until it is removed or the instance is closed. */
+            iour_complete_flags(iour, p->user_data, events, IORING_CQE_F_MORE, true, false);
+            return rv;
+        }
         iour_complete(iour, p->user_data, events, true, false);
         rv = NOTIFY_RESULT_RELEASE;
         fdesc_put(p->f);
@@ -660,7 +1525,8 @@ define_closure_function(2, 2, u64, iour_poll_notify,
     return rv;
 }
 
-static void iour_poll_add(io_uring iour, fdesc f, u16 events, u64 user_data)
+static void iour_poll_add(io_uring iour, fdesc f, u16 events, boolean multishot,
+                          u64 user_data)
 {
     s32 err = 0;
     iour_poll p = allocate(iour->h, sizeof(*p));
@@ -671,16 +1537,25 @@ static void iour_poll_add(io_uring iour, fdesc f, u16 events, u64 user_data)
     p->user_data = user_data;
     p->f = f;
     p->events = 0;
+    p->multishot = multishot;
     p->ne = notify_add(f->ns, events | EPOLLERR | EPOLLHUP,
         init_closure(&p->handler, iour_poll_notify, iour, p));
     if (p->ne == INVALID_ADDRESS) {
         err = -ENOMEM;
         deallocate(iour->h, p, sizeof(*p));
+        goto done;
     }
     iour_lock(iour);
     if (!p->events)
         list_push_back(&iour->pollers, &p->l);
-    else {
+    else if (multishot) {
+        /* Poll events have been notified already: report them and keep the poller armed. */
+        u64 events = p->events;
+        list_push_back(&iour->pollers, &p->l);
+        iour_unlock(iour);
+        iour_complete_flags(iour, user_data, events, IORING_CQE_F_MORE, false, false);
+        return;
+    } else {
         /* Poll events have been notified already. */
         iour_unlock(iour);
         iour_complete(iour, p->user_data, p->events, false, false);
@@ -694,10 +1569,12 @@ done:
     if (!err) {
         if (f->events)
             /* Check if poll events are already present. */
-            notify_dispatch_for_thread(f->ns, apply(f->events, current),
-                current);
-    } else
+            notify_dispatch_for_thread(f->ns, apply(f->events, iour_thread(iour)),
+                iour_thread(iour));
+    } else {
+        fdesc_put(f);
         iour_complete(iour, user_data, err, false, false);
+    }
 }
 
 static void iour_poll_remove(io_uring iour, u64 addr, u64 user_data)
@@ -771,7 +1648,7 @@ static void iour_timeout_add(io_uring iour, struct timespec *ts, u32 flags,
      * completion (i.e. a past completion), so that it won't match future
      * completions (until after UINT_MAX operations, at which point the timeout
      * will have elapsed already, hopefully). */
-    iour_tim->target = iour->rings->cq_tail + off;
+    iour_tim->target = iour_cq_count(iour) + off;
     iour_debug("target %ld", iour_tim->target);
 
     /* Timeouts are counted as non-cancelable_operations because the ability to remove a kernel
@@ -811,7 +1688,7 @@ static void iour_timeout_remove(io_uring iour, u64 addr, u64 user_data)
     iour_complete(iour, user_data, res, false, false);
 }
 
-closure_function(3, 1, void, iour_close_complete,
+closure_function(3, 1, void, iour_op_complete,
                  io_uring, iour, u64, user_data, context, proc_ctx,
                  sysreturn rv)
 {
@@ -839,7 +1716,7 @@ static int iour_register_files_update(io_uring iour, int *fds,
             if (fds[i] == -1)
                 f = 0;
             else {
-                f = fdesc_get(current->p, fds[i]);
+                f = fdesc_get(iour->p, fds[i]);
                 if (!f) {
                     iour_debug("invalid fd %d", fds[i]);
                     ret = -EBADF;
@@ -869,7 +1746,9 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
         sqe->user_data);
     fdesc f = 0;
     s32 res;
-    if (sqe->flags & ~(IOSQE_FIXED_FILE | IOSQE_ASYNC)) {
+    if ((sqe->flags & ~(IOSQE_FIXED_FILE | IOSQE_ASYNC | IOSQE_BUFFER_SELECT)) ||
+            ((sqe->flags & IOSQE_BUFFER_SELECT) &&
+             (sqe->opcode != IORING_OP_READ) && (sqe->opcode != IORING_OP_RECV))) {
         /* non-supported flags */
         res = -EINVAL;
         goto complete;
@@ -880,8 +1759,16 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
     case IORING_OP_READ_FIXED:
     case IORING_OP_WRITE_FIXED:
     case IORING_OP_POLL_ADD:
+    case IORING_OP_SENDMSG:
+    case IORING_OP_RECVMSG:
+    case IORING_OP_ACCEPT:
     case IORING_OP_READ:
     case IORING_OP_WRITE:
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+    case IORING_OP_SPLICE:
+    case IORING_OP_TEE:
+    case IORING_OP_SEND_ZC:
         if (sqe->flags & IOSQE_FIXED_FILE) {
             iour_lock(iour);
             int fd = sqe->fd;
@@ -892,7 +1779,7 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
             }
             iour_unlock(iour);
         } else
-            f = fdesc_get(current->p, sqe->fd);
+            f = fdesc_get(iour->p, sqe->fd);
         if (!f) {
             res = -EBADF;
             goto complete;
@@ -932,7 +1819,7 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
             else
                 res = -EFAULT;
         } else {
-            struct iovec *iov = &iour->bufs[buf_index];
+            struct iovec *iov = &iour->bufs[buf_index].iov;
             void *buf = pointer_from_u64(sqe->addr);
             u32 len = sqe->len;
             boolean write = sqe->opcode == IORING_OP_WRITE_FIXED;
@@ -941,19 +1828,27 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
                 res = -EFAULT;
             } else {
                 iour_unlock(iour);
-                iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data);
+                sg_list sg = ((fdesc_type(f) == FDESC_TYPE_REGULAR) &&
+                              (f->flags & O_DIRECT)) ?
+                             iour_fixed_buf_sg(iour, buf_index, buf, len) : 0;
+                if (sg && iour_rw_direct(iour, f, write, sg, sqe->off, sqe->user_data))
+                    return true;
+                if (sg)
+                    deallocate_sg_list(sg);
+                iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data, 0);
                 return true;
             }
         }
         iour_unlock(iour);
         goto complete;
     case IORING_OP_POLL_ADD:
-        if (sqe->ioprio || sqe->off || sqe->addr || sqe->len ||
+        if (sqe->ioprio || sqe->off || sqe->addr || (sqe->len & ~IORING_POLL_ADD_MULTI) ||
                 sqe->buf_index) {
             res = -EINVAL;
             goto complete;
         }
-        iour_poll_add(iour, f, sqe->poll_events, sqe->user_data);
+        iour_poll_add(iour, f, sqe->poll_events, sqe->len & IORING_POLL_ADD_MULTI,
+                      sqe->user_data);
         break;
     case IORING_OP_POLL_REMOVE:
         if (sqe->ioprio || sqe->off || sqe->len || sqe->poll_events ||
@@ -992,17 +1887,17 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
         }
         int fd = sqe->fd;
         if ((sqe->flags & IOSQE_FIXED_FILE) ||
-                !(f = fdesc_get(current->p, fd)) || (f == &iour->f)) {
+                !(f = fdesc_get(iour->p, fd)) || (f == &iour->f)) {
             res = -EBADF;
             goto complete;
         }
         iour_debug("closing fd %d", fd);
-        deallocate_fd(current->p, fd);
-        if (fetch_and_add(&f->refcnt, -2) == 2) {
+        deallocate_fd(iour->p, fd);
+        if (fdesc_put_removed(f, 1)) {
             io_completion completion;
-            process_context pc = get_process_context();
+            process_context pc = get_process_context_for(iour->p);
             if (pc != INVALID_ADDRESS) {
-                completion = closure(iour->h, iour_close_complete, iour, sqe->user_data,
+                completion = closure(iour->h, iour_op_complete, iour, sqe->user_data,
                                      &pc->uc.kc.context);
                 if (completion == INVALID_ADDRESS)
                     context_release_refcount(&pc->uc.kc.context);
@@ -1029,7 +1924,14 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
         goto complete;
     case IORING_OP_READ:
     case IORING_OP_WRITE:
-        if (sqe->buf_index) {
+        if (sqe->flags & IOSQE_BUFFER_SELECT) {
+            iour_buf buf = iour_select_buffer(iour, sqe->buf_group);
+            if (!buf) {
+                res = -ENOBUFS;
+                goto complete;
+            }
+            iour_rw(iour, f, false, 0, sqe->len, sqe->off, sqe->user_data, buf);
+        } else if (sqe->buf_index) {
             res = -EINVAL;
             goto complete;
         } else {
@@ -1041,9 +1943,121 @@ static boolean iour_submit(io_uring iour, struct io_uring_sqe *sqe)
                 res = -EFAULT;
                 goto complete;
             }
-            iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data);
+            iour_rw(iour, f, write, buf, len, sqe->off, sqe->user_data, 0);
         }
         break;
+    case IORING_OP_SENDMSG:
+    case IORING_OP_RECVMSG:
+    case IORING_OP_ACCEPT:
+    case IORING_OP_SEND:
+    case IORING_OP_RECV:
+    case IORING_OP_SEND_ZC: {
+        if (f->type != FDESC_TYPE_SOCKET) {
+            res = -ENOTSOCK;
+            goto complete;
+        }
+        struct sock *s = (struct sock *)f;
+        struct msghdr *msg = 0;
+        iour_buf buf = 0;
+        boolean recv = (sqe->opcode == IORING_OP_RECVMSG) || (sqe->opcode == IORING_OP_RECV);
+        if (sqe->opcode == IORING_OP_ACCEPT) {
+            if (sqe->len || sqe->buf_index || (sqe->ioprio & ~IORING_ACCEPT_MULTISHOT)) {
+                res = -EINVAL;
+                goto complete;
+            }
+            if (!s->accept4) {
+                res = -EOPNOTSUPP;
+                goto complete;
+            }
+            void *addr = pointer_from_u64(sqe->addr);
+            socklen_t *addrlen = pointer_from_u64(sqe->addr2);
+            if (addr && (!validate_user_memory(addrlen, sizeof(*addrlen), true) ||
+                         !validate_user_memory(addr, PAGESIZE, true))) {
+                res = -EFAULT;
+                goto complete;
+            }
+        } else {
+            if (sqe->ioprio || (!(sqe->flags & IOSQE_BUFFER_SELECT) && sqe->buf_index)) {
+                res = -EINVAL;
+                goto complete;
+            }
+            if (recv ? !s->recvmsg : !s->sendmsg) {
+                res = -EOPNOTSUPP;
+                goto complete;
+            }
+            if ((sqe->opcode == IORING_OP_SENDMSG) || (sqe->opcode == IORING_OP_RECVMSG)) {
+                msg = pointer_from_u64(sqe->addr);
+                if (sqe->len != 1) {
+                    res = -EINVAL;
+                    goto complete;
+                }
+                if (!validate_msghdr(msg, recv)) {
+                    res = -EFAULT;
+                    goto complete;
+                }
+            } else if (sqe->flags & IOSQE_BUFFER_SELECT) {
+                buf = iour_select_buffer(iour, sqe->buf_group);
+                if (!buf) {
+                    res = -ENOBUFS;
+                    goto complete;
+                }
+            } else if (!validate_user_memory(pointer_from_u64(sqe->addr), sqe->len, recv)) {
+                res = -EFAULT;
+                goto complete;
+            }
+        }
+        iour_sock_op_submit(iour, s, sqe, msg, buf);
+        return true;
+    }
+    case IORING_OP_SPLICE:
+    case IORING_OP_TEE: {
+        boolean tee = (sqe->opcode == IORING_OP_TEE);
+        if (sqe->ioprio || sqe->buf_index || (tee && (sqe->off || sqe->splice_off_in))) {
+            res = -EINVAL;
+            goto complete;
+        }
+        fdesc in = fdesc_get(iour->p, sqe->splice_fd_in);
+        if (!in) {
+            res = -EBADF;
+            goto complete;
+        }
+        io_completion completion;
+        process_context pc = get_process_context_for(iour->p);
+        if (pc != INVALID_ADDRESS) {
+            completion = closure(iour->h, iour_op_complete, iour, sqe->user_data,
+                                 &pc->uc.kc.context);
+            if (completion == INVALID_ADDRESS)
+                context_release_refcount(&pc->uc.kc.context);
+        } else {
+            completion = INVALID_ADDRESS;
+        }
+        if (completion == INVALID_ADDRESS) {
+            fdesc_put(in);
+            res = -ENOMEM;
+            goto complete;
+        }
+        fetch_and_add(&iour->noncancelable_ops, 1);
+
+        /* an offset of -1 (i.e. infinity) means the current file offset is used */
+        pipe_splice(in, tee ? infinity : sqe->splice_off_in, f, tee ? infinity : sqe->off,
+                    sqe->len, sqe->splice_flags, tee, &pc->uc.kc.context, true, completion);
+        return true;
+    }
+    case IORING_OP_PROVIDE_BUFFERS:
+        if (sqe->ioprio || sqe->rw_flags || sqe->splice_fd_in) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = iour_provide_buffers(iour, sqe->addr, sqe->len, sqe->fd, sqe->buf_group, sqe->off);
+        goto complete;
+    case IORING_OP_REMOVE_BUFFERS:
+        if (sqe->ioprio || sqe->rw_flags || sqe->addr || sqe->len || sqe->off ||
+                sqe->splice_fd_in) {
+            res = -EINVAL;
+            goto complete;
+        }
+        res = iour_remove_buffers(iour, sqe->fd, sqe->buf_group);
+        goto complete;
     default:
         iour_complete(iour, sqe->user_data, -EINVAL, false, false);
         return false;
@@ -1056,6 +2070,64 @@ complete:
     return true;
 }
 
+static boolean iour_opcode_is_rw(u8 opcode)
+{
+    switch (opcode) {
+    case IORING_OP_READV:
+    case IORING_OP_WRITEV:
+    case IORING_OP_READ_FIXED:
+    case IORING_OP_WRITE_FIXED:
+    case IORING_OP_READ:
+    case IORING_OP_WRITE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static unsigned int iour_submit_entries(io_uring iour, unsigned int to_submit)
+{
+    io_rings rings = iour->rings;
+    context ctx = get_current_context(current_cpu());
+    read_barrier();
+    iour_debug("SQ head %d, SQ tail %d", rings->sq_head, rings->sq_tail);
+    unsigned int submitted;
+    iour_batch_start(iour);
+    for (submitted = 0; submitted < to_submit;) {
+        iour_lock(iour);
+        if (rings->sq_head >= rings->sq_tail) {
+            iour_unlock(iour);
+            break;
+        }
+        u32 sqe_index = iour->sq_array[rings->sq_head & iour->sq_mask];
+        rings->sq_head++;
+        iour_unlock(iour);
+        if (sqe_index < iour->sq_entries) {
+            submitted++;
+            struct io_uring_sqe *sqe = &iour->sqes[sqe_index];
+
+            /* storage requests issued while submitting a read or write operation inherit the
+             * I/O priority of the SQE, if set */
+            u16 ioprio = ctx->ioprio;
+            if (sqe->ioprio && iour_opcode_is_rw(sqe->opcode))
+                ctx->ioprio = sqe->ioprio;
+            boolean ok = iour_submit(iour, sqe);
+            ctx->ioprio = ioprio;
+            if (!ok)
+                break;
+        } else {
+            iour_debug("sqe dropped: index %d, entries %d", sqe_index,
+                iour->sq_entries);
+            iour_lock(iour);
+            iour->rings->sq_dropped++;
+            iour_unlock(iour);
+            break;
+        }
+    }
+    iour_batch_end(iour);
+    return submitted;
+}
+
 simple_closure_function(7, 1, sysreturn, iour_getevents_bh,
                         io_uring, iour, sysreturn, submitted, unsigned int, min_complete, unsigned int, timeouts, boolean, sig_set, thread, t, io_completion, completion,
                         u64 flags)
@@ -1072,6 +2144,7 @@ simple_closure_function(7, 1, sysreturn, iour_getevents_bh,
         iour->bq = 0;
         goto out;
     }
+    iour_pending_flush_locked(iour);
     iour_debug("CQ head %d, CQ tail %d",iour->rings->cq_head,
                iour->rings->cq_tail);
     if ((iour->rings->cq_tail - iour->rings->cq_head < bound(min_complete)) &&
@@ -1103,12 +2176,37 @@ sysreturn io_uring_enter(int fd, unsigned int to_submit,
 {
     iour_debug("fd %d, to_submit %d, min_complete %d, flags 0x%x, sig %p", fd,
         to_submit, min_complete, flags, sig);
-    io_uring iour = iour_from_fd(current->p, fd);
+    io_uring iour;
+    if (flags & IORING_ENTER_REGISTERED_RING) {
+        /* fd is an index in the table of registered rings */
+        process p = current->p;
+        if ((fd < 0) || (fd >= IO_URING_RING_FDS_MAX))
+            return -EINVAL;
+        process_lock(p);
+        iour = (io_uring)p->io_uring_rings[fd];
+        if (iour)
+            fetch_and_add(&iour->f.refcnt, 1);
+        process_unlock(p);
+        if (!iour)
+            return -EBADF;
+    } else {
+        iour = iour_from_fd(current->p, fd);
+    }
     sysreturn rv;
-    if (flags & ~IORING_ENTER_GETEVENTS) {
+    if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP |
+                  IORING_ENTER_REGISTERED_RING)) {
         rv = -EINVAL;
         goto out;
     }
+    if (iour->issuer && (current != iour->issuer)) {
+        rv = -EEXIST;
+        goto out;
+    }
+
+    /* post the completions deferred while the CQ ring was full, or completed by other contexts */
+    iour_lock(iour);
+    iour_pending_flush_locked(iour);
+    iour_unlock(iour);
     u64 sigmask;
     if (sig && !get_user_value(sig, &sigmask)) {
         rv = -EFAULT;
@@ -1122,31 +2220,18 @@ sysreturn io_uring_enter(int fd, unsigned int to_submit,
             goto out;
         }
     }
-    io_rings rings = iour->rings;
-    read_barrier();
-    iour_debug("SQ head %d, SQ tail %d", rings->sq_head, rings->sq_tail);
     unsigned int submitted;
-    for (submitted = 0; submitted < to_submit;) {
-        iour_lock(iour);
-        if (rings->sq_head >= rings->sq_tail) {
-            iour_unlock(iour);
-            break;
-        }
-        u32 sqe_index = iour->sq_array[rings->sq_head & iour->sq_mask];
-        rings->sq_head++;
-        iour_unlock(iour);
-        if (sqe_index < iour->sq_entries) {
-            submitted++;
-            if (!iour_submit(iour, &iour->sqes[sqe_index]))
-                break;
-        } else {
-            iour_debug("sqe dropped: index %d, entries %d", sqe_index,
-                iour->sq_entries);
+    if (iour->sq_poll) {
+        /* submission is done by the SQ poller */
+        if (flags & IORING_ENTER_SQ_WAKEUP) {
             iour_lock(iour);
-            iour->rings->sq_dropped++;
+            if (!iour->sq_active)
+                iour_sq_poll_start_locked(iour);
             iour_unlock(iour);
-            break;
         }
+        submitted = to_submit;
+    } else {
+        submitted = iour_submit_entries(iour, to_submit);
     }
     cpuinfo ci = current_cpu();
     syscall_context sc = (syscall_context)get_current_context(ci);
@@ -1186,21 +2271,34 @@ static sysreturn iour_register_buffers(io_uring iour, struct iovec *bufs,
 {
     if ((count == 0) || (count > IOV_MAX))
         return -EINVAL;
-    sysreturn ret;
-    iour_lock(iour);
     if (iour->buf_count)
+        return -EBUSY;
+    iour_fixed_buf fbufs = allocate_zero(iour->h, sizeof(struct iour_fixed_buf) * count);
+    if (fbufs == INVALID_ADDRESS)
+        return -ENOMEM;
+    sysreturn ret = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        iour_fixed_buf b = &fbufs[i];
+        b->iov = bufs[i];
+        if (b->iov.iov_len > IOUR_FIXED_BUF_MAX)
+            ret = -EFAULT;
+        else
+            ret = iour_fixed_buf_map(iour, &b->iov, &b->gen, &b->segs, &b->seg_count);
+        if (ret < 0)
+            goto fail;
+    }
+    iour_lock(iour);
+    if (iour->buf_count) {
         ret = -EBUSY;
-    else {
-        iour->bufs = allocate(iour->h, sizeof(struct iovec) * count);
-        if (iour->bufs == INVALID_ADDRESS) {
-            ret = -ENOMEM;
-        } else {
-            runtime_memcpy(iour->bufs, bufs, sizeof(struct iovec) * count);
-            iour->buf_count = count;
-            ret = 0;
-        }
+    } else {
+        iour->bufs = fbufs;
+        iour->buf_count = count;
     }
     iour_unlock(iour);
+    if (ret == 0)
+        return ret;
+  fail:
+    iour_fixed_bufs_dealloc(iour, fbufs, count);
     return ret;
 }
 
@@ -1211,7 +2309,7 @@ static sysreturn iour_unregister_buffers(io_uring iour)
     if (iour->buf_count == 0)
         ret = -ENXIO;
     else {
-        deallocate(iour->h, iour->bufs, sizeof(struct iovec) * iour->buf_count);
+        iour_fixed_bufs_dealloc(iour, iour->bufs, iour->buf_count);
         iour->buf_count = 0;
         ret = 0;
     }
@@ -1313,6 +2411,15 @@ static sysreturn iour_unregister_eventfd(io_uring iour)
     return ret;
 }
 
+static const u8 iour_supported_ops[] = {
+    IORING_OP_NOP, IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED,
+    IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_SENDMSG, IORING_OP_RECVMSG,
+    IORING_OP_TIMEOUT, IORING_OP_TIMEOUT_REMOVE, IORING_OP_ACCEPT, IORING_OP_CLOSE,
+    IORING_OP_FILES_UPDATE, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND, IORING_OP_RECV,
+    IORING_OP_SPLICE, IORING_OP_PROVIDE_BUFFERS, IORING_OP_REMOVE_BUFFERS, IORING_OP_TEE,
+    IORING_OP_SEND_ZC,
+};
+
 static sysreturn iour_register_probe(struct io_uring_probe *probe,
                                      unsigned int op_count)
 {
@@ -1327,22 +2434,84 @@ static sysreturn iour_register_probe(struct io_uring_probe *probe,
     for (unsigned int i = 0; i < op_count; i++)
         probe->ops[i].op = i;
     probe->ops_len = op_count;
-    probe->ops[IORING_OP_NOP].flags = probe->ops[IORING_OP_READV].flags =
-            probe->ops[IORING_OP_WRITEV].flags =
-            probe->ops[IORING_OP_READ_FIXED].flags =
-            probe->ops[IORING_OP_WRITE_FIXED].flags =
-            probe->ops[IORING_OP_POLL_ADD].flags =
-            probe->ops[IORING_OP_POLL_REMOVE].flags =
-            probe->ops[IORING_OP_TIMEOUT].flags =
-            probe->ops[IORING_OP_TIMEOUT_REMOVE].flags =
-            probe->ops[IORING_OP_CLOSE].flags =
-            probe->ops[IORING_OP_FILES_UPDATE].flags =
-            probe->ops[IORING_OP_READ].flags =
-            probe->ops[IORING_OP_WRITE].flags = IO_URING_OP_SUPPORTED;
+    for (unsigned int i = 0; i < sizeof(iour_supported_ops); i++)
+        if (iour_supported_ops[i] < op_count)
+            probe->ops[iour_supported_ops[i]].flags = IO_URING_OP_SUPPORTED;
     context_clear_err(ctx);
     return 0;
 }
 
+static sysreturn iour_register_ring_fds(struct io_uring_rsrc_update *upd, unsigned int count)
+{
+    if (count > IO_URING_RING_FDS_MAX)
+        return -EINVAL;
+    if (!fault_in_user_memory(upd, sizeof(*upd) * count, true))
+        return -EFAULT;
+    process p = current->p;
+    sysreturn rv = 0;
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        u32 offset = upd[i].offset;
+        if (upd[i].resv || ((offset != -1U) && (offset >= IO_URING_RING_FDS_MAX))) {
+            rv = -EINVAL;
+            break;
+        }
+        fdesc f = fdesc_get(p, upd[i].data);
+        if (!f) {
+            rv = -EBADF;
+            break;
+        }
+        if (f->type != FDESC_TYPE_IORING) {
+            fdesc_put(f);
+            rv = -EOPNOTSUPP;
+            break;
+        }
+        process_lock(p);
+        if (offset == -1U) {
+            for (offset = 0; offset < IO_URING_RING_FDS_MAX; offset++)
+                if (!p->io_uring_rings[offset])
+                    break;
+        }
+        if ((offset < IO_URING_RING_FDS_MAX) && !p->io_uring_rings[offset]) {
+            p->io_uring_rings[offset] = f;
+            upd[i].offset = offset;
+        } else {
+            rv = -EBUSY;
+        }
+        process_unlock(p);
+        if (rv) {
+            fdesc_put(f);
+            break;
+        }
+    }
+    return i ? i : rv;
+}
+
+static sysreturn iour_unregister_ring_fds(struct io_uring_rsrc_update *upd, unsigned int count)
+{
+    if (count > IO_URING_RING_FDS_MAX)
+        return -EINVAL;
+    if (!fault_in_user_memory(upd, sizeof(*upd) * count, false))
+        return -EFAULT;
+    process p = current->p;
+    sysreturn rv = 0;
+    unsigned int i;
+    for (i = 0; i < count; i++) {
+        u32 offset = upd[i].offset;
+        if (upd[i].resv || (offset >= IO_URING_RING_FDS_MAX)) {
+            rv = -EINVAL;
+            break;
+        }
+        process_lock(p);
+        fdesc f = p->io_uring_rings[offset];
+        p->io_uring_rings[offset] = 0;
+        process_unlock(p);
+        if (f)
+            fdesc_put(f);
+    }
+    return i ? i : rv;
+}
+
 sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
                             unsigned int nr_args)
 {
@@ -1411,6 +2580,12 @@ sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
             rv = iour_register_probe(probe, nr_args);
         break;
     }
+    case IORING_REGISTER_RING_FDS:
+        rv = iour_register_ring_fds((struct io_uring_rsrc_update *)arg, nr_args);
+        break;
+    case IORING_UNREGISTER_RING_FDS:
+        rv = iour_unregister_ring_fds((struct io_uring_rsrc_update *)arg, nr_args);
+        break;
     default:
         rv = -EINVAL;
         break;
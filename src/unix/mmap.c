@@ -28,8 +28,34 @@
         }                                                               \
     } while(0)
 
-#define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock)
-#define vmap_unlock(p) spin_unlock_irq(&(p)->vmap_lock, _savedflags)
+/* Holders of the vmap lock bump the vmap sequence count on entry and exit,
+   so that a lockless lookup can detect a concurrent modification. */
+#define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock); \
+    (p)->vmap_seq++;                                                    \
+    write_barrier()
+#define vmap_unlock(p) do {                                             \
+        write_barrier();                                                \
+        (p)->vmap_seq++;                                                \
+        spin_unlock_irq(&(p)->vmap_lock, _savedflags);                  \
+    } while (0)
+
+/* Pages of user memory pinned for DMA (whose translations are cached, e.g. by io_uring for its
+   fixed buffers) are tracked with a conservative span; a change that may unmap or replace pages in
+   the span, or make them read-only, bumps a generation count, which invalidates the cached
+   translations. */
+static inline void vmap_unpin_range_locked(process p, range q)
+{
+    if (range_span(range_intersection(p->pinned, q)))
+        p->pinned_gen++;
+}
+
+/* transparent huge page modes (manifest "transparent_hugepage" option) */
+#define THP_NEVER   0
+#define THP_MADVISE 1
+#define THP_ALWAYS  2
+
+/* do not fault in huge pages when free physical memory is below this amount */
+#define THP_MIN_FREE_MEMORY (32 * MB)
 
 typedef struct vmap_heap {
     struct heap h;  /* must be first */
@@ -37,17 +63,33 @@ typedef struct vmap_heap {
     boolean randomize;
 } *vmap_heap;
 
+/* B+tree nodes of the vmap map are accessed by lockless lookups from the page fault path (see
+   vmap_from_vaddr()), thus are released after an RCU grace period. */
+typedef struct vmap_node_heap {
+    struct heap h;  /* must be first */
+    heap parent;
+} *vmap_node_heap;
+
 static struct {
     heap h;
     heap virtual_backed;
+    heap page_backed;
+    id_heap physical;
+    int thp_mode;
+    int fault_around;   /* in pages; 0 if disabled */
 
     closure_struct(rb_key_compare, pf_compare);
     closure_struct(rbnode_handler, pf_print);
 
     struct list pf_freelist;
+
+    queue zeroed_pages;
+    closure_struct(idle_work_handler, zeroed_pages_fill);
+    closure_struct(mem_cleaner, zeroed_pages_cleaner);
 } mmap_info;
 
-static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr);
+static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr,
+                                    boolean write);
 
 closure_func_basic(rb_key_compare, int, pending_fault_compare,
                    rbnode a, rbnode b)
@@ -110,7 +152,7 @@ static pending_fault new_pending_fault_locked(process p, u64 addr)
     pf->addr = addr;
     pf->bss_start = 0;
     pf->p = p;
-    init_closure_func(&pf->complete, status_handler, pending_fault_complete);
+    pf->completion = init_closure_func(&pf->complete, status_handler, pending_fault_complete);
     assert(rbtree_insert_node(&p->pending_faults, &pf->n));
     return pf;
 }
@@ -125,25 +167,111 @@ static pending_fault find_pending_fault_locked(process p, u64 addr)
     return (pending_fault)n;
 }
 
-/* returns physical address */
-u64 new_zeroed_pages(u64 v, u64 length, pageflags flags, status_handler complete)
+static inline heap anon_page_heap(u32 vmflags)
+{
+    return (vmflags & VMAP_FLAG_PAGE_BACKED) ? mmap_info.page_backed : mmap_info.virtual_backed;
+}
+
+/* memory demand-faulted with zeroed pages */
+static inline boolean vmap_is_anonymous(vmap vm)
+{
+    if (vm->flags & VMAP_FLAG_MMAP)
+        return (vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS;
+    return !(vm->flags & VMAP_FLAG_PROG) &&
+           (vm->flags & (VMAP_FLAG_STACK | VMAP_FLAG_HEAP | VMAP_FLAG_BSS));
+}
+
+/* Pages are zeroed with non-temporal stores, so that filling the pool does not evict the working
+ * set of the idle CPU from the cache; the fill stops when free memory gets scarce. */
+closure_func_basic(idle_work_handler, boolean, zeroed_pages_fill)
+{
+    queue q = mmap_info.zeroed_pages;
+    heap phys = (heap)mmap_info.physical;
+    for (int i = 0; i < ZEROED_PAGE_FILL_BATCH; i++) {
+        if (queue_full(q) || (heap_total(phys) - heap_allocated(phys) < THP_MIN_FREE_MEMORY))
+            return false;
+        void *m = allocate(mmap_info.virtual_backed, PAGESIZE);
+        if (m == INVALID_ADDRESS)
+            return false;
+        zero_nontemporal(m, PAGESIZE);
+        if (!enqueue(q, m)) {
+            deallocate(mmap_info.virtual_backed, m, PAGESIZE);
+            return false;
+        }
+    }
+    return !queue_full(q);
+}
+
+closure_func_basic(mem_cleaner, u64, zeroed_pages_cleaner,
+                   u64 clean_bytes)
+{
+    u64 cleaned = 0;
+    void *m;
+    while ((cleaned < clean_bytes) && ((m = dequeue(mmap_info.zeroed_pages)) != INVALID_ADDRESS)) {
+        deallocate(mmap_info.virtual_backed, m, PAGESIZE);
+        cleaned += PAGESIZE;
+    }
+    return cleaned;
+}
+
+static u64 new_zeroed_pages_from(heap h, u64 v, u64 length, pageflags flags,
+                                 status_handler complete)
 {
     assert((v & MASK(PAGELOG)) == 0);
-    void *m = allocate(mmap_info.virtual_backed, length);
+    void *m = INVALID_ADDRESS;
+    if ((h == mmap_info.virtual_backed) && (length == PAGESIZE))
+        m = dequeue(mmap_info.zeroed_pages);
     if (m == INVALID_ADDRESS) {
-        vmap_debug("%s: cannot get physical page\n", func_ss);
-        return INVALID_PHYSICAL;
+        m = allocate(h, length);
+        if (m == INVALID_ADDRESS) {
+            vmap_debug("%s: cannot get physical page\n", func_ss);
+            return INVALID_PHYSICAL;
+        }
+        zero(m, length);
     }
-    zero(m, length);
     write_barrier();
     u64 p = physical_from_virtual(m);
     u64 mapped_p = map_with_complete(v, p, length, flags, complete);
     if (mapped_p != p)
         /* The mapping must have been done in parallel by another CPU. */
-        deallocate(mmap_info.virtual_backed, m, length);
+        deallocate(h, m, length);
     return mapped_p;
 }
 
+/* returns physical address */
+u64 new_zeroed_pages(u64 v, u64 length, pageflags flags, status_handler complete)
+{
+    return new_zeroed_pages_from(mmap_info.virtual_backed, v, length, flags, complete);
+}
+
+/* Try to back the 2MB-aligned area containing vaddr with a single huge page. Fails if the area
+   is not entirely within the vmap, if physical memory is scarce, or if any page in the area has
+   already been mapped (in which case the area stays mapped with small pages). */
+static boolean new_zeroed_huge_page(vmap vm, u64 vaddr, status_handler complete)
+{
+    u64 v = vaddr & ~PAGEMASK_2M;
+    if (!range_contains(vm->node.r, irangel(v, PAGESIZE_2M)))
+        return false;
+    heap phys = (heap)mmap_info.physical;
+    if (heap_total(phys) - heap_allocated(phys) < THP_MIN_FREE_MEMORY)
+        return false;
+    void *m = allocate(mmap_info.page_backed, PAGESIZE_2M);
+    if (m == INVALID_ADDRESS)
+        return false;
+    u64 p = physical_from_virtual(m);
+    if (p & PAGEMASK_2M)
+        goto fail;
+    zero(m, PAGESIZE_2M);
+    write_barrier();
+    if (!map_if_unmapped(v, p, PAGESIZE_2M, pageflags_from_vmflags(vm->flags)))
+        goto fail;
+    apply(complete, STATUS_OK);
+    return true;
+  fail:
+    deallocate(mmap_info.page_backed, m, PAGESIZE_2M);
+    return false;
+}
+
 static void demand_page_major_fault(pending_fault pf, context ctx)
 {
     spinlock lock = &pf->p->faulting_lock;
@@ -154,8 +282,8 @@ static void demand_page_major_fault(pending_fault pf, context ctx)
     context_pre_suspend(ctx);
 }
 
-closure_function(4, 1, void, mmap_anon_page,
-                 boolean, flush_done, pending_fault, pf, vmap, vm, u64, vaddr,
+closure_function(5, 1, void, mmap_anon_page,
+                 boolean, flush_done, pending_fault, pf, vmap, vm, u64, vaddr, boolean, write,
                  status s)
 {
     if (!bound(flush_done)) {
@@ -168,18 +296,49 @@ closure_function(4, 1, void, mmap_anon_page,
         timm_dealloc(s);
     }
     mm_service(false);
-    s = demand_anonymous_page(bound(pf), 0, bound(vm), bound(vaddr));
+    s = demand_anonymous_page(bound(pf), 0, bound(vm), bound(vaddr), bound(write));
     timm_dealloc(s);
     closure_finish();
 }
 
-static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr)
+/* Read faults on anonymous memory are resolved by mapping the zero page read-only; a private page
+ * is only allocated on the first write (see do_anonymous_cow()). Ranges registered with a
+ * userfaultfd always get private pages, so that write-protection applies to them. */
+static boolean map_zero_page(pending_fault pf, vmap vm, u64 vaddr, status_handler completion)
+{
+    process p = pf->p;
+    u64 page_addr = vaddr & ~PAGEMASK;
+    if ((zero_page_phys == INVALID_PHYSICAL) || (vm->flags & VMAP_FLAG_HUGEPAGE) ||
+        (!list_empty(&p->userfaultfds) &&
+         userfaultfd_registered(p, page_addr,
+                                UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP)))
+        return false;
+    map_with_complete(page_addr, zero_page_phys, PAGESIZE,
+                      pageflags_readonly(pageflags_from_vmflags(vm->flags)), completion);
+    return true;
+}
+
+static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr,
+                                    boolean write)
 {
     status_handler completion = (status_handler)&pf->complete;
-    if (new_zeroed_pages(vaddr & ~MASK(PAGELOG), PAGESIZE, pageflags_from_vmflags(vm->flags),
-                         completion) == INVALID_PHYSICAL) {
+    if (!write && map_zero_page(pf, vm, vaddr, completion)) {
+        count_minor_fault();
+        return STATUS_OK;
+    }
+    if (vm->flags & VMAP_FLAG_HUGEPAGE) {
+        if (new_zeroed_huge_page(vm, vaddr, completion)) {
+            count_minor_fault();
+            count_huge_fault();
+            return STATUS_OK;
+        }
+        count_huge_fault_fallback();
+    }
+    if (new_zeroed_pages_from(anon_page_heap(vm->flags), vaddr & ~MASK(PAGELOG), PAGESIZE,
+                              pageflags_from_vmflags(vm->flags), completion) == INVALID_PHYSICAL) {
         if (ctx) {
-            status_handler sh = closure(mmap_info.h, mmap_anon_page, false, pf, vm, vaddr);
+            status_handler sh = closure(mmap_info.h, mmap_anon_page, false, pf, vm, vaddr,
+                                        write);
             if (sh != INVALID_ADDRESS) {
                 pf_debug("anonymous page major fault, addr %p\n", pf->addr);
                 demand_page_major_fault(pf, ctx);
@@ -194,6 +353,24 @@ static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64
     return STATUS_OK;
 }
 
+/* Maps the pages around a faulting page that are already filled in the page cache, so that
+ * accesses to neighboring pages do not take a fault each. */
+static void filebacked_fault_around(vmap vm, u64 page_addr, pageflags flags)
+{
+    u64 window = mmap_info.fault_around << PAGELOG;
+    if (!window || pageflags_is_writable(flags))
+        return;
+    range r = range_intersection(irangel(page_addr & ~(window - 1), window), vm->node.r);
+    if (vm->flags & VMAP_FLAG_TAIL_BSS)   /* the page containing the bss start must be zeroed */
+        r.end = MIN(r.end, (vm->node.r.start + vm->bss_offset) & ~PAGEMASK);
+    u64 file_end = pad(pagecache_get_node_length(vm->cache_node), PAGESIZE);
+    r.end = MIN(r.end, vm->node.r.start + file_end - MIN(file_end, vm->node_offset));
+    if ((r.end <= r.start) || (range_span(r) <= PAGESIZE))
+        return;
+    pagecache_map_filled_pages(vm->cache_node, vm->node_offset + (r.start - vm->node.r.start),
+                               r.start, range_span(r) >> PAGELOG, flags);
+}
+
 define_closure_function(3, 0, void, pending_fault_demand_file_page,
                         vmap, vm, u64, node_offset, pageflags, flags)
 {
@@ -206,13 +383,15 @@ define_closure_function(3, 0, void, pending_fault_demand_file_page,
              func_ss, pf, node_offset, pf->addr, flags);
     pagecache_map_page(pn, node_offset, pf->addr, flags,
                        (status_handler)&pf->complete);
-    range ra = irange(node_offset + PAGESIZE,
-        vm->node_offset + range_span(vm->node.r));
-    if (range_valid(ra)) {
-        if (range_span(ra) > FILE_READAHEAD_DEFAULT)
-            ra.end = ra.start + FILE_READAHEAD_DEFAULT;
+    filebacked_fault_around(vm, pf->addr, flags);
+    range ra = file_ra_next(&vm->ra, node_offset, PAGESIZE, FILE_READAHEAD_DEFAULT,
+                            FILE_READAHEAD_MAX);
+    if (vm->ra.size == 0)   /* non-sequential fault: read around with a fixed window */
+        ra = irangel(node_offset + PAGESIZE, FILE_READAHEAD_DEFAULT);
+    ra = range_intersection(ra, irange(node_offset + PAGESIZE,
+                                       vm->node_offset + range_span(vm->node.r)));
+    if (range_span(ra) > 0)
         pagecache_node_fetch_pages(pn, ra);
-    }
 }
 
 static status demand_filebacked_page(process p, context ctx, vmap vm, u64 vaddr, pending_fault pf)
@@ -221,9 +400,9 @@ static status demand_filebacked_page(process p, context ctx, vmap vm, u64 vaddr,
     u64 page_addr = vaddr & ~PAGEMASK;
     u64 vmap_offset = page_addr - vm->node.r.start;
     u64 node_offset = vm->node_offset + vmap_offset;
-    boolean shared = (vm->flags & VMAP_FLAG_SHARED) != 0;
-    if (!shared && !(vm->flags & VMAP_FLAG_PROG))
-        flags = pageflags_readonly(flags); /* cow */
+    /* private maps are copied on write, and writes to shared maps are tracked by the page cache */
+    if (!(vm->flags & VMAP_FLAG_PROG))
+        flags = pageflags_readonly(flags);
 
     pf_debug("   node %p (start 0x%lx), offset 0x%lx, vm flags 0x%lx, pageflags 0x%lx\n",
              vm->cache_node, vm->node.r.start, node_offset, vm->flags, flags.w);
@@ -237,12 +416,19 @@ static status demand_filebacked_page(process p, context ctx, vmap vm, u64 vaddr,
         return timm("result", "out of range page");
     }
 
+    if (vm->cache_node == p->exec_record) {
+        u64 pi = node_offset >> PAGELOG;
+        if (pi < p->exec_record_pages->maxbits)
+            bitmap_set_atomic(p->exec_record_pages, pi, 1);
+    }
+
     if ((vm->flags & VMAP_FLAG_TAIL_BSS) &&
         point_in_range(irangel(vmap_offset, PAGESIZE), vm->bss_offset))
         pf->bss_start = vm->bss_offset - vmap_offset;
 
     if (pagecache_map_page_if_filled(vm->cache_node, node_offset, page_addr, flags, completion)) {
         pf_debug("   immediate completion\n");
+        filebacked_fault_around(vm, page_addr, flags);
         count_minor_fault();
         return STATUS_OK;
     }
@@ -285,11 +471,20 @@ status do_demand_page(process p, context ctx, u64 vaddr, vmap vm)
         pf = new_pending_fault_locked(p, page_addr);
         spin_unlock_irq(&p->faulting_lock, flags);
         pf_debug("   new pending_fault %p\n", pf);
+        if (!list_empty(&p->userfaultfds) && vmap_is_anonymous(vm) &&
+            userfaultfd_registered(p, page_addr, UFFDIO_REGISTER_MODE_MISSING)) {
+            /* the page is supplied by the user program */
+            pf_debug("   userfaultfd missing page\n");
+            demand_page_major_fault(pf, ctx);
+            userfaultfd_report(p, pf, is_write_fault(ctx->frame) ? UFFD_PAGEFAULT_FLAG_WRITE : 0,
+                               current ? current->tid : 0);
+            kern_yield();
+        }
         if (vm->flags & VMAP_FLAG_MMAP) {
             int mmap_type = vm->flags & VMAP_MMAP_TYPE_MASK;
             switch (mmap_type) {
             case VMAP_MMAP_TYPE_ANONYMOUS:
-                return demand_anonymous_page(pf, ctx, vm, vaddr);
+                return demand_anonymous_page(pf, ctx, vm, vaddr, is_write_fault(ctx->frame));
             case VMAP_MMAP_TYPE_FILEBACKED:
                 return demand_filebacked_page(p, ctx, vm, vaddr, pf);
             default:
@@ -300,20 +495,174 @@ status do_demand_page(process p, context ctx, u64 vaddr, vmap vm)
             return demand_filebacked_page(p, ctx, vm, vaddr, pf);
         } else {
             pf_debug("   bss / stack / heap page fault\n");
-            return demand_anonymous_page(pf, ctx, vm, vaddr);
+            return demand_anonymous_page(pf, ctx, vm, vaddr, is_write_fault(ctx->frame));
         }
     }
     context_pre_suspend(ctx);
     kern_yield();
 }
 
+/* Copy on write of the zero page: a write to anonymous memory mapped to the zero page replaces it
+   with a private zeroed page. Concurrent faults on the same page wait for the first one to be
+   resolved. */
+boolean do_anonymous_cow(process p, context ctx, u64 vaddr, vmap vm)
+{
+    u64 page_addr = vaddr & ~PAGEMASK;
+    if ((zero_page_phys == INVALID_PHYSICAL) || !vmap_is_anonymous(vm) ||
+        (physical_from_virtual(pointer_from_u64(page_addr)) != zero_page_phys))
+        return false;
+    pf_debug("%s: vaddr 0x%lx, ctx %p\n", func_ss, vaddr, ctx);
+    u64 flags = spin_lock_irq(&p->faulting_lock);
+    pending_fault pf = find_pending_fault_locked(p, page_addr);
+    if (pf) {
+        vector_push(pf->dependents, ctx);
+        spin_unlock_irq(&p->faulting_lock, flags);
+        count_minor_fault();
+        context_pre_suspend(ctx);
+        kern_yield();
+    }
+    pf = new_pending_fault_locked(p, page_addr);
+    spin_unlock_irq(&p->faulting_lock, flags);
+    if (physical_from_virtual(pointer_from_u64(page_addr)) != zero_page_phys) {
+        /* resolved by a fault that completed in the meantime */
+        apply(pf->completion, STATUS_OK);
+        return true;
+    }
+    heap h = anon_page_heap(vm->flags);
+    void *m = allocate(h, PAGESIZE);
+    if (m == INVALID_ADDRESS)
+        halt("cannot get physical page for vaddr 0x%lx, ctx %p; OOM\n", vaddr, ctx);
+    zero(m, PAGESIZE);
+    write_barrier();
+    remap(page_addr, physical_from_virtual(m), PAGESIZE, pageflags_from_vmflags(vm->flags));
+    count_minor_fault();
+    apply(pf->completion, STATUS_OK);
+    return true;
+}
+
+/* A write to a page write-protected through a userfaultfd suspends the faulting context until the
+   user program removes the protection. */
+boolean do_userfault_wp(process p, context ctx, u64 vaddr, vmap vm)
+{
+    if (list_empty(&p->userfaultfds) || !vmap_is_anonymous(vm) ||
+        !userfaultfd_registered(p, vaddr, UFFDIO_REGISTER_MODE_WP))
+        return false;
+    u64 page_addr = vaddr & ~PAGEMASK;
+    pf_debug("%s: vaddr 0x%lx, ctx %p\n", func_ss, vaddr, ctx);
+    u64 flags = spin_lock_irq(&p->faulting_lock);
+    pending_fault pf = find_pending_fault_locked(p, page_addr);
+    boolean report = !pf;
+    if (report)
+        pf = new_pending_fault_locked(p, page_addr);
+    spin_unlock_irq(&p->faulting_lock, flags);
+    demand_page_major_fault(pf, ctx);
+    if (report)
+        userfaultfd_report(p, pf, UFFD_PAGEFAULT_FLAG_WRITE | UFFD_PAGEFAULT_FLAG_WP,
+                           current ? current->tid : 0);
+    kern_yield();
+}
+
+closure_func_basic(range_handler, boolean, vmap_range_gap,
+                   range r)
+{
+    return false;
+}
+
+closure_func_basic(rmnode_handler, boolean, vmap_range_anonymous,
+                   rmnode n)
+{
+    return vmap_is_anonymous((vmap)n);
+}
+
+boolean vmap_range_is_anonymous(process p, range q)
+{
+    vmap_lock(p);
+    int res = rangemap_range_lookup_with_gaps(p->vmaps, q,
+                                              stack_closure_func(rmnode_handler, vmap_range_anonymous),
+                                              stack_closure_func(range_handler, vmap_range_gap));
+    vmap_unlock(p);
+    return res == RM_MATCH;
+}
+
+/* Maps a new anonymous page at vaddr, filled with the contents of the user buffer at src, or
+   zeroed if src is null; used to resolve userfaultfd faults. */
+sysreturn anonymous_page_fill(process p, u64 vaddr, const void *src, boolean readonly)
+{
+    vmap vm = vmap_from_vaddr(p, vaddr);
+    if ((vm == INVALID_ADDRESS) || !vmap_is_anonymous(vm))
+        return -ENOENT;
+    heap h = anon_page_heap(vm->flags);
+    void *m = allocate(h, PAGESIZE);
+    if (m == INVALID_ADDRESS)
+        return -ENOMEM;
+    if (!src) {
+        zero(m, PAGESIZE);
+    } else if (!copy_from_user(src, m, PAGESIZE)) {
+        deallocate(h, m, PAGESIZE);
+        return -EFAULT;
+    }
+    write_barrier();
+    pageflags flags = pageflags_from_vmflags(vm->flags);
+    if (readonly)
+        flags = pageflags_readonly(flags);
+    if (!map_if_unmapped(vaddr, physical_from_virtual(m), PAGESIZE, flags)) {
+        deallocate(h, m, PAGESIZE);
+        return -EEXIST;
+    }
+    return 0;
+}
+
+closure_function(2, 1, boolean, anonymous_write_protect_vmap,
+                 range, q, boolean, wp,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    if (!vmap_is_anonymous(vm))
+        return false;
+    range ri = range_intersection(bound(q), n->r);
+    pageflags flags = pageflags_from_vmflags(vm->flags);
+    if (bound(wp))
+        flags = pageflags_readonly(flags);
+    update_map_flags(ri.start, range_span(ri), flags);
+    return true;
+}
+
+/* Write-protects the mapped pages of anonymous memory in a range, or restores their protection to
+   that of their mapping. */
+sysreturn anonymous_write_protect(process p, range q, boolean wp)
+{
+    vmap_lock(p);
+    int res = rangemap_range_lookup_with_gaps(p->vmaps, q,
+                                              stack_closure(anonymous_write_protect_vmap, q, wp),
+                                              stack_closure_func(range_handler, vmap_range_gap));
+    vmap_unlock(p);
+    return (res == RM_MATCH) ? 0 : -ENOENT;
+}
+
 static inline vmap vmap_from_vaddr_locked(process p, u64 vaddr)
 {
     return (vmap)rangemap_lookup(p->vmaps, vaddr);
 }
 
+/* Lookups from the page fault path don't take the vmap lock unless they race
+   with a modification of the map: vmaps are freed after an RCU grace period,
+   so a lookup within a read section never touches freed memory, and the
+   sequence count tells whether the result is consistent. */
 vmap vmap_from_vaddr(process p, u64 vaddr)
 {
+    rcu_read_lock();
+    u64 seq = *(volatile u64 *)&p->vmap_seq;
+    read_barrier();
+    if (!(seq & 1)) {
+        vmap vm = (vmap)rangemap_lookup_unlocked(p->vmaps, vaddr);
+        read_barrier();
+        if (*(volatile u64 *)&p->vmap_seq == seq) {
+            rcu_read_unlock();
+            return vm;
+        }
+    }
+    rcu_read_unlock();
+
     vmap_lock(p);
     vmap vm = vmap_from_vaddr_locked(p, vaddr);
     vmap_unlock(p);
@@ -436,7 +785,7 @@ static void deallocate_vmap_locked(rangemap rm, vmap vm)
     vmap_debug("%s: vm %p %R\n", func_ss, vm, vm->node.r);
     if (!(vm->flags & VMAP_FLAG_TAIL_BSS) && vm->fd)
         fdesc_put(vm->fd);
-    deallocate(rm->h, vm, sizeof(struct vmap));
+    rcu_deallocate(rm->h, vm, sizeof(struct vmap));
 }
 
 static vmap allocate_vmap_locked(rangemap rm, range q, struct vmap k)
@@ -521,17 +870,19 @@ static inline boolean validate_mmap_range(process p, range q)
     return range_valid(q) && q.start >= p->mmap_min_addr && q.end <= USER_LIMIT;
 }
 
-closure_function(3, 1, boolean, proc_virt_gap_handler,
-                 u64, size, boolean, randomize, u64 *, addr,
+closure_function(4, 1, boolean, proc_virt_gap_handler,
+                 u64, size, int, align_order, boolean, randomize, u64 *, addr,
                  range r)
 {
     u64 size = bound(size);
-    if (range_span(r) <= size)
+    int order = bound(align_order);
+    r.start = pad(r.start, U64_FROM_BIT(order));
+    if (r.start >= r.end || range_span(r) <= size)
         return true;
 
     u64 offset;
     if (bound(randomize))
-        offset = (random_u64() % ((range_span(r) - size) >> PAGELOG)) << PAGELOG;
+        offset = (random_u64() % ((range_span(r) - size) >> order)) << order;
     else
         offset = 0;
     *bound(addr) = r.start + offset;
@@ -539,17 +890,23 @@ closure_function(3, 1, boolean, proc_virt_gap_handler,
 }
 
 /* Does NOT mark the returned address as allocated in the virtual heap. */
-static u64 process_get_virt_range_locked(process p, u64 size, range region)
+static u64 process_get_virt_range_aligned_locked(process p, u64 size, int align_order,
+                                                 range region)
 {
     assert(!(size & PAGEMASK));
     vmap_heap vmh = (vmap_heap)p->virtual;
     u64 addr = INVALID_PHYSICAL;
-    rangemap_range_find_gaps(p->vmaps, region,
-                             stack_closure(proc_virt_gap_handler, size,
-                                           vmh->randomize, &addr));
+    rangemap_range_find_large_gaps(p->vmaps, region, size,
+                                   stack_closure(proc_virt_gap_handler, size, align_order,
+                                                 vmh->randomize, &addr));
     return addr;
 }
 
+static u64 process_get_virt_range_locked(process p, u64 size, range region)
+{
+    return process_get_virt_range_aligned_locked(p, size, PAGELOG, region);
+}
+
 u64 process_get_virt_range(process p, u64 size, range region)
 {
     vmap_lock(p);
@@ -661,7 +1018,9 @@ sysreturn mremap(void *old_address, u64 old_size, u64 new_size, int flags, void
                     rv = -ENOMEM;
                     goto unlock_out;
                 }
-                u64 vnew = process_get_virt_range_locked(p, new_size, PROCESS_VIRTUAL_MMAP_RANGE);
+                u64 vnew = process_get_virt_range_aligned_locked(p, new_size,
+                    (k.flags & VMAP_FLAG_HUGEPAGE) ? PAGELOG_2M : PAGELOG,
+                    PROCESS_VIRTUAL_MMAP_RANGE);
                 if (vnew == (u64)INVALID_ADDRESS) {
                     msg_err("failed to allocate virtual memory, size %ld\n", new_size);
                     rv = -ENOMEM;
@@ -828,8 +1187,8 @@ struct vmap altered_vmap_key(vmap match, u32 flags, u64 offset_delta)
     return k;
 }
 
-void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 newflags,
-                                          vmap match)
+/* set the flags of the part of match intersecting q, splitting match as needed */
+static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 newflags, vmap match)
 {
     vmap_debug("%s: vm %p %R prev flags 0x%x\n", func_ss, match, match->node.r, match->flags);
     if (newflags == match->flags)
@@ -841,9 +1200,6 @@ void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 n
     boolean head = ri.start > rn.start;
     boolean tail = ri.end < rn.end;
 
-    /* protection flags only */
-    newflags = (match->flags & ~(VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC)) | newflags;
-
     if (!head && !tail) {
         /* updating flags may result in adjacent maps with same attributes;
            removing and reinserting the node will take care of merging */
@@ -879,6 +1235,15 @@ void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 n
     }
 }
 
+void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 newflags,
+                                          vmap match)
+{
+    /* protection flags only */
+    vmap_update_flags_intersection(pvmap, q,
+                                   (match->flags & ~(VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC)) |
+                                   newflags, match);
+}
+
 closure_func_basic(range_handler, boolean, vmap_update_protections_gap,
                    range r)
 {
@@ -910,13 +1275,19 @@ static sysreturn vmap_update_protections_locked(heap h, rangemap pvmap, range q,
 
     /* updating protections can lead to merging of nodes, so we cannot traverse */
     range r = q;
+    pageflags flags = pageflags_from_vmflags(newflags);
     while (range_span(r)) {
         vmap vm = (vmap)rangemap_lookup(pvmap, r.start);
         vmap_assert(vm != INVALID_ADDRESS);
+        range ri = irange(r.start, MIN(r.end, vm->node.r.end));
+        boolean shared_file = (vm->flags & VMAP_FLAG_MMAP) && (vm->flags & VMAP_FLAG_SHARED) &&
+            ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED);
         vmap_update_protections_intersection(h, pvmap, q, newflags, vm);
-        r.start = MIN(r.end, vm->node.r.end);
+
+        /* writes to shared file pages must fault, so that the page cache can track them */
+        update_map_flags(ri.start, range_span(ri), shared_file ? pageflags_readonly(flags) : flags);
+        r.start = ri.end;
     }
-    update_map_flags(q.start, range_span(q), pageflags_from_vmflags(newflags));
     vmap_paranoia_locked(pvmap);
     return 0;
 }
@@ -943,12 +1314,201 @@ sysreturn mprotect(void * addr, u64 len, int prot)
 
     process p = current->p;
     vmap_lock(p);
+    if (!(new_vmflags & VMAP_FLAG_WRITABLE))
+        vmap_unpin_range_locked(p, irangel(where, padlen));
     sysreturn result = vmap_update_protections_locked(mmap_info.h, p->vmaps,
                                                       irangel(where, padlen), new_vmflags);
     vmap_unlock(p);
     return result;
 }
 
+u32 thp_vmflags(boolean advised)
+{
+    if ((mmap_info.thp_mode == THP_ALWAYS) || (advised && (mmap_info.thp_mode == THP_MADVISE)))
+        return VMAP_FLAG_HUGEPAGE | VMAP_FLAG_PAGE_BACKED;
+    return 0;
+}
+
+/* On NUMA machines, anonymous pages are allocated individually from the page_backed heap, which
+   places them on the node of the faulting CPU (first touch), instead of being carved from page
+   heap chunks that may belong to any node. */
+u32 numa_vmflags(void)
+{
+    return (numa_node_count() > 1) ? VMAP_FLAG_PAGE_BACKED : 0;
+}
+
+void unmap_and_free_anonymous(u32 vmflags, u64 vaddr, u64 length)
+{
+    unmap_and_free_phys_heap(vaddr, length, anon_page_heap(vmflags));
+}
+
+closure_func_basic(entry_handler, boolean, madvise_unmapped_entry,
+                   int level, u64 vaddr, pteptr entry)
+{
+    pte e = pte_from_pteptr(entry);
+    return !pte_is_present(e) || !pte_is_mapping(level, e);
+}
+
+/* MADV_DONTNEED: the pages are dropped, and read back as zero (anonymous memory) or as the file
+   contents (file-backed memory) at the next access */
+closure_function(1, 1, boolean, madvise_dontneed_vmap,
+                 range, q,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    range ri = range_intersection(bound(q), n->r);
+    if (vmap_is_anonymous(vm))
+        unmap_and_free_anonymous(vm->flags, ri.start, range_span(ri));
+    else if ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED)
+        pagecache_node_unmap_pages(vm->cache_node, ri,
+                                   vm->node_offset + (ri.start - n->r.start));
+    return true;
+}
+
+/* MADV_FREE: the pages of anonymous memory are marked clean, and those not written again are
+   reclaimed (and read back as zero) when memory runs low */
+closure_function(2, 1, boolean, madvise_free_vmap,
+                 range, q, boolean *, oom,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    if (!vmap_is_anonymous(vm))
+        return true;
+    range ri = range_intersection(bound(q), n->r);
+    clean_pages(ri.start, range_span(ri));
+    if (!rangemap_insert_range(current->p->lazyfree, ri))
+        *bound(oom) = true;
+    return true;
+}
+
+closure_function(2, 1, boolean, mmap_lazyfree_vmap,
+                 range, q, u64 *, cleaned,
+                 rmnode n)
+{
+    vmap vm = (vmap)n;
+    if (vmap_is_anonymous(vm)) {
+        range ri = range_intersection(bound(q), n->r);
+        *bound(cleaned) += unmap_clean_and_free_phys_heap(ri.start, range_span(ri),
+                                                          anon_page_heap(vm->flags));
+    }
+    return true;
+}
+
+closure_function(1, 1, u64, mmap_lazyfree_cleaner,
+                 process, p,
+                 u64 clean_bytes)
+{
+    process p = bound(p);
+    u64 cleaned = 0;
+    /* the cleaner may be invoked from an allocation done with the vmap lock held */
+    u64 irqflags = irq_disable_save();
+    if (!spin_try(&p->vmap_lock)) {
+        irq_restore(irqflags);
+        return 0;
+    }
+    rmnode n;
+    while ((cleaned < clean_bytes) &&
+           ((n = rangemap_first_node(p->lazyfree)) != INVALID_ADDRESS)) {
+        /* pages written since MADV_FREE are kept, so the range is done with after one pass */
+        range r = n->r;
+        rangemap_remove_range(p->lazyfree, n);
+        rangemap_range_lookup(p->vmaps, r, stack_closure(mmap_lazyfree_vmap, r, &cleaned));
+    }
+    spin_unlock(&p->vmap_lock);
+    irq_restore(irqflags);
+    vmap_debug("%s: cleaned %ld / %ld bytes\n", func_ss, cleaned, clean_bytes);
+    return cleaned;
+}
+
+static sysreturn madvise_reclaim(process p, range q, int advice)
+{
+    sysreturn rv = 0;
+    boolean oom = false;
+    vmap_lock(p);
+    if (rangemap_range_find_gaps(p->vmaps, q,
+                                 stack_closure_func(range_handler, vmap_update_protections_gap))
+        == RM_ABORT) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    vmap_unpin_range_locked(p, q);
+    /* the pages of all vmaps in the range are invalidated with a single TLB shootdown */
+    page_flush_batch_start();
+    if (advice == MADV_DONTNEED)
+        rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_dontneed_vmap, q));
+    else
+        rangemap_range_lookup(p->vmaps, q, stack_closure(madvise_free_vmap, q, &oom));
+    page_flush_batch_end();
+    if (oom)
+        rv = -ENOMEM;
+  out:
+    vmap_unlock(p);
+    return rv;
+}
+
+static sysreturn madvise(void *addr, u64 len, int advice)
+{
+    thread_log(current, "madvise: addr %p, len 0x%lx, advice %d", addr, len, advice);
+    u64 where = u64_from_pointer(addr);
+    if (where & MASK(PAGELOG))
+        return -EINVAL;
+    switch (advice) {
+    case MADV_DONTNEED:
+    case MADV_FREE:
+    case MADV_HUGEPAGE:
+    case MADV_NOHUGEPAGE:
+        break;
+    default:
+        return 0;   /* other advice is accepted and ignored */
+    }
+    if (len == 0)
+        return 0;
+    range q = irangel(where, pad(len, PAGESIZE));
+    process p = current->p;
+    if ((advice == MADV_DONTNEED) || (advice == MADV_FREE))
+        return madvise_reclaim(p, q, advice);
+    if (mmap_info.thp_mode == THP_NEVER)
+        return 0;
+    sysreturn rv = 0;
+    vmap_lock(p);
+    if (rangemap_range_find_gaps(p->vmaps, q,
+                                 stack_closure_func(range_handler, vmap_update_protections_gap))
+        == RM_ABORT) {
+        rv = -ENOMEM;
+        goto out;
+    }
+
+    /* updating flags can lead to merging of nodes, so we cannot traverse */
+    range r = q;
+    while (range_span(r)) {
+        vmap vm = (vmap)rangemap_lookup(p->vmaps, r.start);
+        vmap_assert(vm != INVALID_ADDRESS);
+        range ri = range_intersection(q, vm->node.r);
+        r.start = MIN(r.end, vm->node.r.end);
+        if ((vm->flags & VMAP_MMAP_TYPE_MASK) != VMAP_MMAP_TYPE_ANONYMOUS)
+            continue;
+        u32 newflags;
+        if (advice == MADV_HUGEPAGE) {
+            /* Pages already faulted in came from the small page cache, and must be returned
+               there; only areas with no mapped pages can switch heaps. */
+            if (!(vm->flags & VMAP_FLAG_PAGE_BACKED) &&
+                !traverse_ptes(ri.start, range_span(ri),
+                               stack_closure_func(entry_handler, madvise_unmapped_entry))) {
+                thread_log(current, "   %R already populated; huge pages not enabled", ri);
+                continue;
+            }
+            newflags = vm->flags | VMAP_FLAG_HUGEPAGE | VMAP_FLAG_PAGE_BACKED;
+        } else {
+            newflags = vm->flags & ~VMAP_FLAG_HUGEPAGE;
+        }
+        vmap_update_flags_intersection(p->vmaps, q, newflags, vm);
+    }
+    vmap_paranoia_locked(p->vmaps);
+  out:
+    vmap_unlock(p);
+    return rv;
+}
+
 /* blow a hole in the process address space intersecting q */
 closure_function(3, 1, boolean, vmap_remove_intersection,
                  rangemap, pvmap, range, q, vmap_handler, unmap,
@@ -1002,7 +1562,7 @@ static void vmap_unmap_page_range(process p, vmap k)
     u64 len = range_span(r);
     switch (type) {
     case VMAP_MMAP_TYPE_ANONYMOUS:
-        unmap_and_free_phys(r.start, len);
+        unmap_and_free_anonymous(k->flags, r.start, len);
         break;
     case VMAP_MMAP_TYPE_FILEBACKED:
         pagecache_node_unmap_pages(k->cache_node, r, k->node_offset);
@@ -1024,9 +1584,13 @@ closure_function(1, 1, boolean, vmap_unmap,
 static void process_remove_range_locked(process p, range q, boolean unmap)
 {
     vmap_debug("%s: q %R\n", func_ss, q);
+    vmap_unpin_range_locked(p, q);
     vmap_handler vh = unmap ? stack_closure(vmap_unmap, p) : 0;
+    /* a range spanning several vmaps is invalidated with a single TLB shootdown */
+    page_flush_batch_start();
     rangemap_range_lookup(p->vmaps, q,
                           (rmnode_handler)stack_closure(vmap_remove_intersection, p->vmaps, q, vh));
+    page_flush_batch_end();
 }
 
 /* don't truncate vmap; just unmap truncated pages */
@@ -1133,7 +1697,7 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
         return -EINVAL;
     }
     if (flags & MAP_HUGETLB)
-        thread_log(current, "   MAP_HUGETLB not implemented; ignoring");
+        thread_log(current, "   MAP_HUGETLB not implemented; treating as a huge page hint");
     if (flags & MAP_SYNC)
         thread_log(current, "   MAP_SYNC not implemented; ignoring");
 
@@ -1190,6 +1754,9 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
     if (flags & MAP_ANONYMOUS) {
         vmap_mmap_type = VMAP_MMAP_TYPE_ANONYMOUS;
         allowed_flags = anon_perms(p);
+        if (len >= PAGESIZE_2M)
+            vmflags |= thp_vmflags((flags & MAP_HUGETLB) != 0);
+        vmflags |= numa_vmflags();
     } else {
         desc = resolve_fd(p, fd); /* must return via out label to release fdesc */
         switch (desc->type) {
@@ -1253,7 +1820,10 @@ static sysreturn mmap(void *addr, u64 length, int prot, int flags, int fd, u64 o
             (flags & MAP_32BIT) ? PROCESS_VIRTUAL_32BIT_RANGE :
 #endif
             PROCESS_VIRTUAL_MMAP_RANGE;
-        u64 vaddr = process_get_virt_range_locked(p, len, alloc_region);
+        /* place areas that may later be backed by huge pages on a huge page boundary */
+        u64 vaddr = process_get_virt_range_aligned_locked(p, len,
+            (vmap_mmap_type == VMAP_MMAP_TYPE_ANONYMOUS && len >= PAGESIZE_2M &&
+             mmap_info.thp_mode != THP_NEVER) ? PAGELOG_2M : PAGELOG, alloc_region);
         if (vaddr == INVALID_PHYSICAL) {
             ret = -ENOMEM;
             thread_log(current, "   failed to get virtual address range");
@@ -1352,6 +1922,16 @@ bytes vmh_total(struct heap *h)
     return PROCESS_VIRTUAL_HEAP_LIMIT;
 }
 
+static u64 vmap_node_alloc(struct heap *h, bytes b)
+{
+    return allocate_u64(((vmap_node_heap)h)->parent, b);
+}
+
+static void vmap_node_dealloc(struct heap *h, u64 a, bytes b)
+{
+    rcu_deallocate(((vmap_node_heap)h)->parent, pointer_from_u64(a), b);
+}
+
 closure_function(2, 1, boolean, check_vmap_permissions,
                  u64, required_flags, u64, disallowed_flags,
                  vmap vm)
@@ -1395,6 +1975,34 @@ boolean fault_in_user_memory(const void *buf, bytes length, boolean writable)
     return fault_in_memory(buf, length);
 }
 
+/* Faults in a user buffer that is about to be written by a device, with write accesses that leave
+ * its contents unchanged, so that copy-on-write and zero pages are replaced by private pages. */
+boolean fault_in_user_memory_for_dma(const void *buf, bytes length)
+{
+    if (!validate_user_memory_permissions(current->p, buf, length, VMAP_FLAG_WRITABLE, 0))
+        return false;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        return false;
+    u64 addr = u64_from_pointer(buf);
+    for (u64 p = addr & ~PAGEMASK; p < addr + length; p += PAGESIZE)
+        fetch_and_add(pointer_from_u64(p), 0);
+    context_clear_err(ctx);
+    return true;
+}
+
+/* Adds q to the pinned span, and returns the current generation: translations of pages in q
+   obtained afterwards remain valid as long as the generation is unchanged. */
+u64 process_pin_range(process p, range q)
+{
+    vmap_lock(p);
+    p->pinned = range_span(p->pinned) ?
+                irange(MIN(p->pinned.start, q.start), MAX(p->pinned.end, q.end)) : q;
+    u64 gen = p->pinned_gen;
+    vmap_unlock(p);
+    return gen;
+}
+
 void mmap_process_init(process p, tuple root)
 {
     kernel_heaps kh = &p->uh->kh;
@@ -1402,13 +2010,47 @@ void mmap_process_init(process p, tuple root)
     boolean aslr = !get(root, sym(noaslr));
     mmap_info.h = h;
     mmap_info.virtual_backed = (heap)kh->pages;
+    mmap_info.page_backed = (heap)kh->page_backed;
+    mmap_info.physical = kh->physical;
+    if (zero_page_phys == INVALID_PHYSICAL) {
+        void *zp = allocate_zero(mmap_info.virtual_backed, PAGESIZE);
+        assert(zp != INVALID_ADDRESS);
+        zero_page_phys = physical_from_virtual(zp);
+    }
+    value thp = get_string(root, sym(transparent_hugepage));
+    if (!thp || !buffer_strcmp(thp, "madvise")) {
+        mmap_info.thp_mode = THP_MADVISE;
+    } else if (!buffer_strcmp(thp, "always")) {
+        mmap_info.thp_mode = THP_ALWAYS;
+    } else {
+        if (buffer_strcmp(thp, "never"))
+            msg_err("invalid transparent_hugepage value \"%b\"; disabling huge pages\n", thp);
+        mmap_info.thp_mode = THP_NEVER;
+    }
+    u64 fault_around;
+    if (!get_u64(root, sym(fault_around_pages), &fault_around))
+        fault_around = FAULT_AROUND_DEFAULT;
+    if (fault_around > 1)
+        mmap_info.fault_around = U64_FROM_BIT(msb(MIN(fault_around, FAULT_AROUND_MAX)));
+    else
+        mmap_info.fault_around = 0;
     spin_lock_init(&p->vmap_lock);
+    p->vmap_seq = 0;
+    p->pinned = irange(0, 0);
+    p->pinned_gen = 0;
     u64 min_addr;
     if (get_u64(root, sym(mmap_min_addr), &min_addr))
         p->mmap_min_addr = min_addr;
     else
         p->mmap_min_addr = PAGESIZE;
-    p->vmaps = allocate_rangemap(h);
+    heap vmaps_heap = mem_account_heap(h, h, ss("vmaps"));
+    assert(vmaps_heap != INVALID_ADDRESS);
+    vmap_node_heap vnh = allocate_zero(h, sizeof(struct vmap_node_heap));
+    assert(vnh != INVALID_ADDRESS);
+    vnh->h.alloc = vmap_node_alloc;
+    vnh->h.dealloc = vmap_node_dealloc;
+    vnh->parent = vmaps_heap;
+    p->vmaps = allocate_rangemap_btree(vmaps_heap, &vnh->h);
     assert(p->vmaps != INVALID_ADDRESS);
     vmap_heap vmh = allocate(h, sizeof(struct vmap_heap));
     assert(vmh != INVALID_ADDRESS);
@@ -1441,11 +2083,24 @@ void mmap_process_init(process p, tuple root)
                                      ivmap(VMAP_FLAG_EXEC, 0, 0, 0, 0)) != INVALID_ADDRESS);
 #endif
 
+    p->lazyfree = allocate_rangemap(h);
+    assert(p->lazyfree != INVALID_ADDRESS);
+    mem_cleaner lazyfree_cleaner = closure(h, mmap_lazyfree_cleaner, p);
+    assert(lazyfree_cleaner != INVALID_ADDRESS);
+    assert(mm_register_mem_cleaner(lazyfree_cleaner, ss("lazyfree"), MM_CLEANER_DATA));
+    list_init(&p->userfaultfds);
     spin_lock_init(&p->faulting_lock);
     init_rbtree(&p->pending_faults,
                 init_closure_func(&mmap_info.pf_compare, rb_key_compare, pending_fault_compare),
                 init_closure_func(&mmap_info.pf_print, rbnode_handler, pending_fault_print));
     list_init(&mmap_info.pf_freelist);
+    mmap_info.zeroed_pages = allocate_queue(h, ZEROED_PAGE_POOL_SIZE);
+    assert(mmap_info.zeroed_pages != INVALID_ADDRESS);
+    assert(mm_register_mem_cleaner(init_closure_func(&mmap_info.zeroed_pages_cleaner, mem_cleaner,
+                                                     zeroed_pages_cleaner),
+                                   ss("zeroed pages"), MM_CLEANER_CACHE));
+    sched_set_idle_work(init_closure_func(&mmap_info.zeroed_pages_fill, idle_work_handler,
+                                          zeroed_pages_fill));
 }
 
 void register_mmap_syscalls(struct syscall *map)
@@ -1456,5 +2111,6 @@ void register_mmap_syscalls(struct syscall *map)
     register_syscall(map, msync, msync, SYSCALL_F_SET_MEM);
     register_syscall(map, munmap, munmap, SYSCALL_F_SET_MEM);
     register_syscall(map, mprotect, mprotect, SYSCALL_F_SET_MEM);
-    register_syscall(map, madvise, syscall_ignore, SYSCALL_F_SET_MEM);
+    register_syscall(map, madvise, madvise, SYSCALL_F_SET_MEM);
+    register_syscall(map, userfaultfd, userfaultfd, SYSCALL_F_SET_DESC);
 }
@@ -281,12 +281,67 @@ enum {
 #define RTM_F_OFFLOAD	   0x4000
 #define RTM_F_TRAP	   0x8000
 
+/* RTM_*NEIGH message payload */
+struct ndmsg {
+    u8 ndm_family;
+    u8 ndm_pad1;
+    u16 ndm_pad2;
+    s32 ndm_ifindex;
+    u16 ndm_state;
+    u8 ndm_flags;
+    u8 ndm_type;
+};
+
+/* ndmsg.ndm_state */
+#define NUD_INCOMPLETE  0x01
+#define NUD_REACHABLE   0x02
+#define NUD_STALE       0x04
+#define NUD_PERMANENT   0x80
+
+/* RTM_*NEIGH attribute types */
+enum {
+    NDA_UNSPEC,
+    NDA_DST,
+    NDA_LLADDR,
+};
+
+#define SOL_NETLINK 270
+
+/* SOL_NETLINK socket options */
+#define NETLINK_ADD_MEMBERSHIP  1
+#define NETLINK_DROP_MEMBERSHIP 2
+
 #define NL_QUEUE_MAX_LEN    64
+#define NL_MSG_MAX_LEN      256
+
+/* Dumps are serialized once and shared by the sockets streaming them, until the network
+ * configuration changes: the lwIP callback bumps the configuration generation, and a dump built at
+ * an older generation is rebuilt on the next request. Messages are stored with zero sequence number
+ * and port ID, which are filled in as each message is copied to the receive queue of a socket. */
+enum {
+    NL_DUMP_LINK,
+    NL_DUMP_ADDR4,
+    NL_DUMP_ADDR6,
+    NL_DUMP_ROUTE,
+    NL_DUMP_CACHED,
+    NL_DUMP_NEIGH = NL_DUMP_CACHED, /* ARP entries change without notice: never cached */
+};
+
+typedef struct nl_dump {
+    struct refcount refcount;
+    u64 gen;
+    struct netif *netif_default;    /* default route interface when built (route dump) */
+    buffer msgs;
+} *nl_dump;
 
 static struct {
+    heap h;
     id_heap pids;
     vector sockets;
     struct spinlock lock;
+    u64 gen;                        /* network configuration generation */
+    nl_dump dumps[NL_DUMP_CACHED];
+    struct spinlock dump_lock;
 } netlink;
 
 typedef struct nlsock {
@@ -294,6 +349,15 @@ typedef struct nlsock {
     int family;
     struct sockaddr_nl addr;
     queue data;
+    boolean overrun;    /* notifications have been dropped */
+
+    /* multipart dump being streamed: messages are copied to the receive queue as it drains */
+    boolean dumping;
+    u32 dump_seq;
+    int dump_count;
+    nl_dump dumps[2];
+    u64 dump_offset;
+
     closure_struct(file_io, read);
     closure_struct(file_io, write);
     closure_struct(fdesc_events, events);
@@ -304,11 +368,11 @@ typedef struct nlsock {
 #define nl_unlock(s)    spin_unlock(&(s)->sock.f.lock)
 
 typedef struct nl_rtm_netif_priv {
-    nlsock s;
-    struct nlmsghdr *hdr;
+    buffer b;
     int if_index;
     struct netif *netif_default;
     boolean found;
+    boolean failed;
 } *nl_rtm_netif_priv;
 
 static void nl_enqueue(nlsock s, void *msg, u64 msg_len)
@@ -323,22 +387,46 @@ static void nl_enqueue(nlsock s, void *msg, u64 msg_len)
     }
 }
 
-static void nl_enqueue_ifinfo(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, struct netif *netif)
+/* Enqueues a copy of a message with the given sequence number and port ID; returns false if the
+ * receive queue is full. */
+static boolean nl_enqueue_copy(nlsock s, struct nlmsghdr *msg, u32 seq, u32 pid)
+{
+    u32 len = msg->nlmsg_len;
+    if ((s->sock.rx_len + len >= so_rcvbuf) || queue_full(s->data))
+        return false;
+    struct nlmsghdr *hdr = allocate(s->sock.h, len);
+    if (hdr == INVALID_ADDRESS)
+        return false;
+    runtime_memcpy(hdr, msg, len);
+    hdr->nlmsg_seq = seq;
+    hdr->nlmsg_pid = pid;
+    nl_enqueue(s, hdr, len);
+    return true;
+}
+
+/* appends to a buffer a zeroed message of the given (aligned) length */
+static struct nlmsghdr *nl_put_msg(buffer b, int len, u16 type, u16 flags)
+{
+    if (!buffer_extend(b, len))
+        return 0;
+    struct nlmsghdr *hdr = buffer_end(b);
+    zero(hdr, len);
+    buffer_produce(b, len);
+    hdr->nlmsg_len = len;
+    hdr->nlmsg_type = type;
+    hdr->nlmsg_flags = flags;
+    return hdr;
+}
+
+static boolean nl_put_ifinfo(buffer b, u16 type, u16 flags, struct netif *netif)
 {
     int resp_len = NLMSG_ALIGN(sizeof(struct nlmsghdr) + sizeof(struct ifinfomsg) +
         RTA_SPACE(sizeof(netif->name) + 2) + RTA_SPACE(sizeof(u32) /* MTU */));
     if (netif->hwaddr_len != 0)
         resp_len += RTA_SPACE(netif->hwaddr_len);
-    struct nlmsghdr *hdr = allocate(s->sock.h, resp_len);
-    if (hdr == INVALID_ADDRESS) {
-        msg_err("failed to allocate message\n");
-        return;
-    }
-    hdr->nlmsg_len = resp_len;
-    hdr->nlmsg_type = type;
-    hdr->nlmsg_flags = flags;
-    hdr->nlmsg_seq = seq;
-    hdr->nlmsg_pid = pid;
+    struct nlmsghdr *hdr = nl_put_msg(b, resp_len, type, flags);
+    if (!hdr)
+        return false;
     struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(hdr);
     ifi->ifi_family = AF_UNSPEC;
     ifi->ifi_type = netif_get_type(netif);
@@ -359,24 +447,17 @@ static void nl_enqueue_ifinfo(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, s
     rta->rta_len = RTA_LENGTH(sizeof(u32));
     rta->rta_type = IFLA_MTU;
     *(u32 *)(RTA_DATA(rta)) = netif->mtu;
-    nl_enqueue(s, hdr, resp_len);
+    return true;
 }
 
-static void nl_enqueue_ifaddr(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, struct netif *netif,
-                              int family, void *addr, int addr_len, int prefix_len)
+static boolean nl_put_ifaddr(buffer b, u16 type, u16 flags, struct netif *netif,
+                             int family, void *addr, int addr_len, int prefix_len)
 {
     int resp_len = NLMSG_ALIGN(sizeof(struct nlmsghdr) + sizeof(struct ifaddrmsg) +
         RTA_SPACE(addr_len) + RTA_SPACE(sizeof(netif->name) + 2));
-    struct nlmsghdr *hdr = allocate(s->sock.h, resp_len);
-    if (hdr == INVALID_ADDRESS) {
-        msg_err("failed to allocate message\n");
-        return;
-    }
-    hdr->nlmsg_len = resp_len;
-    hdr->nlmsg_type = type;
-    hdr->nlmsg_flags = flags;
-    hdr->nlmsg_seq = seq;
-    hdr->nlmsg_pid = pid;
+    struct nlmsghdr *hdr = nl_put_msg(b, resp_len, type, flags);
+    if (!hdr)
+        return false;
     struct ifaddrmsg *ifa = (struct ifaddrmsg *)NLMSG_DATA(hdr);
     ifa->ifa_family = family;
     ifa->ifa_prefixlen = prefix_len;
@@ -391,21 +472,21 @@ static void nl_enqueue_ifaddr(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, s
     rta->rta_len = RTA_LENGTH(sizeof(netif->name) + 2);
     rta->rta_type = IFA_LABEL;
     netif_name_cpy(RTA_DATA(rta), netif);
-    nl_enqueue(s, hdr, resp_len);
+    return true;
 }
 
-static inline void nl_enqueue_ifaddr4(nlsock s, u16 type, u16 flags, u32 seq, u32 pid,
-                                      struct netif *netif, ip4_addr_t addr, ip4_addr_t netmask)
+static inline boolean nl_put_ifaddr4(buffer b, u16 type, u16 flags, struct netif *netif,
+                                     ip4_addr_t addr, ip4_addr_t netmask)
 {
-    nl_enqueue_ifaddr(s, type, flags, seq, pid, netif, AF_INET, &addr, sizeof(ip4_addr_t),
-                      32 - lsb(ntohl(netmask.addr)));
+    return nl_put_ifaddr(b, type, flags, netif, AF_INET, &addr, sizeof(ip4_addr_t),
+                         32 - lsb(ntohl(netmask.addr)));
 }
 
-static inline void nl_enqueue_ifaddr6(nlsock s, u16 type, u16 flags, u32 seq, u32 pid,
-                                      struct netif *netif, ip6_addr_t addr)
+static inline boolean nl_put_ifaddr6(buffer b, u16 type, u16 flags, struct netif *netif,
+                                     ip6_addr_t addr)
 {
-    nl_enqueue_ifaddr(s, type, flags, seq, pid, netif, AF_INET6, &addr.addr, sizeof(addr.addr),
-                      netif_is_loopback(netif) ? 128 : 64);
+    return nl_put_ifaddr(b, type, flags, netif, AF_INET6, &addr.addr, sizeof(addr.addr),
+                         netif_is_loopback(netif) ? 128 : 64);
 }
 
 enum {
@@ -413,8 +494,8 @@ enum {
     RTMSG_TYPE_GW
 };
 
-static void nl_enqueue_rtmsg(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, struct netif *netif,
-                             struct netif *netif_default, int rmtype)
+static boolean nl_put_rtmsg(buffer b, u16 type, u16 flags, struct netif *netif,
+                            struct netif *netif_default, int rmtype)
 {
     int resp_len;
     boolean is_default = netif_default == netif;
@@ -439,16 +520,9 @@ static void nl_enqueue_rtmsg(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, st
                                 RTA_SPACE(4) /* oif */));
         break;
     }
-    struct nlmsghdr *hdr = allocate(s->sock.h, resp_len);
-    if (hdr == INVALID_ADDRESS) {
-        msg_err("failed to allocate message\n");
-        return;
-    }
-    hdr->nlmsg_len = resp_len;
-    hdr->nlmsg_type = type;
-    hdr->nlmsg_flags = flags;
-    hdr->nlmsg_seq = seq;
-    hdr->nlmsg_pid = pid;
+    struct nlmsghdr *hdr = nl_put_msg(b, resp_len, type, flags);
+    if (!hdr)
+        return false;
     struct rtmsg *rtm = (struct rtmsg *)NLMSG_DATA(hdr);
     rtm->rtm_family = AF_INET;
     rtm->rtm_table = RT_TABLE_MAIN;
@@ -498,22 +572,43 @@ static void nl_enqueue_rtmsg(nlsock s, u16 type, u16 flags, u32 seq, u32 pid, st
     rta->rta_len = RTA_LENGTH(4);
     rta->rta_type = RTA_OIF;
     *(u32 *)RTA_DATA(rta) = netif_get_index(netif);
-    nl_enqueue(s, hdr, resp_len);
+    return true;
 }
 
-static void nl_enqueue_done(nlsock s, struct nlmsghdr *req)
+/* the routes of an interface, other than loopback */
+static boolean nl_put_routes(buffer b, u16 type, u16 flags, struct netif *n,
+                             struct netif *n_default)
 {
-    struct nlmsghdr *hdr = allocate(s->sock.h, NLMSG_HDRLEN);
-    if (hdr == INVALID_ADDRESS) {
-        msg_err("failed to allocate message\n");
-        return;
-    }
-    hdr->nlmsg_len = NLMSG_HDRLEN;
-    hdr->nlmsg_type = NLMSG_DONE;
-    hdr->nlmsg_flags = 0;
-    hdr->nlmsg_seq = req->nlmsg_seq;
-    hdr->nlmsg_pid = s->addr.nl_pid;
-    nl_enqueue(s, hdr, NLMSG_HDRLEN);
+    if (netif_is_loopback(n))
+        return true;
+    if (!ip4_addr_cmp(ip_2_ip4(&n->gw), IP4_ADDR_ANY4) &&
+        !nl_put_rtmsg(b, type, flags, n, n_default, RTMSG_TYPE_GW))
+        return false;
+    return nl_put_rtmsg(b, type, flags, n, n_default, RTMSG_TYPE_IF);
+}
+
+static boolean nl_put_neigh(buffer b, struct netif *netif, ip4_addr_t *addr,
+                            struct eth_addr *ethaddr)
+{
+    int resp_len = NLMSG_ALIGN(sizeof(struct nlmsghdr) + sizeof(struct ndmsg) +
+        RTA_SPACE(sizeof(ip4_addr_t)) + RTA_SPACE(ETH_HWADDR_LEN));
+    struct nlmsghdr *hdr = nl_put_msg(b, resp_len, RTM_NEWNEIGH, NLM_F_MULTI);
+    if (!hdr)
+        return false;
+    struct ndmsg *ndm = (struct ndmsg *)NLMSG_DATA(hdr);
+    ndm->ndm_family = AF_INET;
+    ndm->ndm_ifindex = netif_get_index(netif);
+    ndm->ndm_state = NUD_REACHABLE;
+    ndm->ndm_type = RTN_UNICAST;
+    struct rtattr *rta = (void*)ndm + NLMSG_ALIGN(sizeof(*ndm));
+    rta->rta_len = RTA_LENGTH(sizeof(ip4_addr_t));
+    rta->rta_type = NDA_DST;
+    ip4_addr_copy(*(ip4_addr_t *)RTA_DATA(rta), *addr);
+    rta = RTA_NEXT(rta);
+    rta->rta_len = RTA_LENGTH(ETH_HWADDR_LEN);
+    rta->rta_type = NDA_LLADDR;
+    runtime_memcpy(RTA_DATA(rta), ethaddr->addr, ETH_HWADDR_LEN);
+    return true;
 }
 
 static void nl_enqueue_error(nlsock s, struct nlmsghdr *msg, int errno)
@@ -535,21 +630,39 @@ static void nl_enqueue_error(nlsock s, struct nlmsghdr *msg, int errno)
     nl_enqueue(s, hdr, errmsg_len);
 }
 
+/* enqueues a copy of each message in a buffer to the sockets subscribed to a multicast group */
+static void nl_notify(u32 group, buffer b)
+{
+    spin_lock(&netlink.lock);
+    nlsock s;
+    vector_foreach(netlink.sockets, s) {
+        if (!(s->addr.nl_groups & group))
+            continue;
+        nl_lock(s);
+        for (bytes offset = 0; offset < buffer_length(b);) {
+            struct nlmsghdr *msg = buffer_ref(b, offset);
+            if (!nl_enqueue_copy(s, msg, 0, NL_PID_KERNEL))
+                s->overrun = true;  /* reported by the next read */
+            offset += msg->nlmsg_len;
+        }
+        nl_unlock(s);
+    }
+    spin_unlock(&netlink.lock);
+}
+
 static boolean nl_rtm_getlink(struct netif *n, void *priv)
 {
     nl_rtm_netif_priv data = priv;
-    nlsock s = data->s;
-    nl_enqueue_ifinfo(s, RTM_NEWLINK, NLM_F_MULTI, data->hdr->nlmsg_seq, s->addr.nl_pid, n);
-    return false;
+    if (!nl_put_ifinfo(data->b, RTM_NEWLINK, NLM_F_MULTI, n))
+        data->failed = true;
+    return data->failed;
 }
 
 static boolean nl_rtm_getlink_single(struct netif *n, void *priv)
 {
     nl_rtm_netif_priv data = priv;
     if (netif_get_index(n) == data->if_index) {
-        nlsock s = data->s;
-        nl_enqueue_ifinfo(s, RTM_NEWLINK, 0, data->hdr->nlmsg_seq, s->addr.nl_pid, n);
-        data->found = true;
+        data->found = nl_put_ifinfo(data->b, RTM_NEWLINK, 0, n);
         return true;
     }
     return false;
@@ -558,41 +671,193 @@ static boolean nl_rtm_getlink_single(struct netif *n, void *priv)
 static boolean nl_rtm_getaddr(struct netif *n, void *priv)
 {
     nl_rtm_netif_priv data = priv;
-    nlsock s = data->s;
-    nl_enqueue_ifaddr4(s, RTM_NEWADDR, NLM_F_MULTI, data->hdr->nlmsg_seq, s->addr.nl_pid, n,
-                       *netif_ip4_addr(n), *netif_ip4_netmask(n));
-    return false;
+    if (!nl_put_ifaddr4(data->b, RTM_NEWADDR, NLM_F_MULTI, n, *netif_ip4_addr(n),
+                        *netif_ip4_netmask(n)))
+        data->failed = true;
+    return data->failed;
 }
 
 static boolean nl_rtm_getaddr6(struct netif *n, void *priv)
 {
     nl_rtm_netif_priv data = priv;
-    nlsock s = data->s;
     for (int i = 0; i < LWIP_IPV6_NUM_ADDRESSES; i++) {
-        if (!ip6_addr_isinvalid(netif_ip6_addr_state(n, i))) {
-            nl_enqueue_ifaddr6(s, RTM_NEWADDR, NLM_F_MULTI, data->hdr->nlmsg_seq, s->addr.nl_pid, n,
-                               *netif_ip6_addr(n, i));
+        if (!ip6_addr_isinvalid(netif_ip6_addr_state(n, i)) &&
+            !nl_put_ifaddr6(data->b, RTM_NEWADDR, NLM_F_MULTI, n, *netif_ip6_addr(n, i))) {
+            data->failed = true;
+            break;
         }
     }
-    return false;
+    return data->failed;
 }
 
 static boolean nl_rtm_getroute(struct netif *n, void *priv)
 {
-    /* No loopback reporting for main table. */
-    if (n->name[0] == 'l' && n->name[1] == 'o')
-        return false;
-
     nl_rtm_netif_priv data = priv;
-    nlsock s = data->s;
-    struct nlmsghdr *hdr = data->hdr;
-    struct netif *n_default = data->netif_default;
-    if (!ip4_addr_cmp(ip_2_ip4(&n->gw), IP4_ADDR_ANY4))
-        nl_enqueue_rtmsg(s, RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, s->addr.nl_pid, n, n_default,
-                         RTMSG_TYPE_GW);
-    nl_enqueue_rtmsg(s, RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, s->addr.nl_pid, n, n_default,
-                     RTMSG_TYPE_IF);
-    return false;
+    if (!nl_put_routes(data->b, RTM_NEWROUTE, NLM_F_MULTI, n, data->netif_default))
+        data->failed = true;
+    return data->failed;
+}
+
+static boolean nl_rtm_getneigh(nl_rtm_netif_priv data)
+{
+    for (size_t i = 0; i < ARP_TABLE_SIZE; i++) {
+        ip4_addr_t *addr;
+        struct netif *netif;
+        struct eth_addr *ethaddr;
+        if (etharp_get_entry(i, &addr, &netif, &ethaddr) &&
+            !nl_put_neigh(data->b, netif, addr, ethaddr))
+            return false;
+    }
+    return true;
+}
+
+static nl_dump nl_dump_build(int type, struct netif *netif_default)
+{
+    u64 gen = netlink.gen;
+    read_barrier();
+    nl_dump d = allocate(netlink.h, sizeof(*d));
+    if (d == INVALID_ADDRESS)
+        return 0;
+    d->msgs = allocate_buffer(netlink.h, PAGESIZE);
+    if (d->msgs == INVALID_ADDRESS)
+        goto err;
+    struct nl_rtm_netif_priv priv = {
+        .b = d->msgs,
+        .netif_default = netif_default,
+        .failed = false,
+    };
+    switch (type) {
+    case NL_DUMP_LINK:
+        netif_iterate(nl_rtm_getlink, &priv);
+        break;
+    case NL_DUMP_ADDR4:
+        netif_iterate(nl_rtm_getaddr, &priv);
+        break;
+    case NL_DUMP_ADDR6:
+        netif_iterate(nl_rtm_getaddr6, &priv);
+        break;
+    case NL_DUMP_ROUTE:
+        netif_iterate(nl_rtm_getroute, &priv);
+        break;
+    case NL_DUMP_NEIGH:
+        priv.failed = !nl_rtm_getneigh(&priv);
+        break;
+    }
+    if (priv.failed) {
+        deallocate_buffer(d->msgs);
+        goto err;
+    }
+    init_refcount(&d->refcount, 1, 0);
+    d->gen = gen;
+    d->netif_default = netif_default;
+    nl_debug("built dump type %d, gen %ld, length %ld", type, gen, buffer_length(d->msgs));
+    return d;
+  err:
+    deallocate(netlink.h, d, sizeof(*d));
+    return 0;
+}
+
+static void nl_dump_release(nl_dump d)
+{
+    if (refcount_release(&d->refcount)) {
+        deallocate_buffer(d->msgs);
+        deallocate(netlink.h, d, sizeof(*d));
+    }
+}
+
+/* returns a reference to an up-to-date dump, or 0 on allocation failure */
+static nl_dump nl_dump_get(int type)
+{
+    if (type >= NL_DUMP_CACHED)
+        return nl_dump_build(type, 0);
+    struct netif *netif_default = (type == NL_DUMP_ROUTE) ? netif_get_default() : 0;
+    spin_lock(&netlink.dump_lock);
+    nl_dump d = netlink.dumps[type];
+    if (!d || (d->gen != netlink.gen) || (d->netif_default != netif_default)) {
+        d = nl_dump_build(type, netif_default);
+        if (d) {
+            if (netlink.dumps[type])
+                nl_dump_release(netlink.dumps[type]);
+            netlink.dumps[type] = d;
+        }
+    }
+    if (d)
+        refcount_reserve(&d->refcount);
+    spin_unlock(&netlink.dump_lock);
+    if (netif_default)
+        netif_unref(netif_default);
+    return d;
+}
+
+/* Copies the messages of the dump being streamed to the receive queue, while it has room; called
+ * with the socket locked. */
+static void nl_dump_continue(nlsock s)
+{
+    while (s->dumping) {
+        if (s->dump_count) {
+            nl_dump d = s->dumps[0];
+            if (s->dump_offset < buffer_length(d->msgs)) {
+                struct nlmsghdr *msg = buffer_ref(d->msgs, s->dump_offset);
+                if (!nl_enqueue_copy(s, msg, s->dump_seq, s->addr.nl_pid))
+                    return;
+                s->dump_offset += msg->nlmsg_len;
+                continue;
+            }
+            nl_dump_release(d);
+            s->dumps[0] = s->dumps[1];
+            s->dump_count--;
+            s->dump_offset = 0;
+            continue;
+        }
+        struct {
+            struct nlmsghdr hdr;
+            s32 error;
+        } done = {
+            .hdr = {
+                .nlmsg_len = NLMSG_HDRLEN + sizeof(s32),
+                .nlmsg_type = NLMSG_DONE,
+                .nlmsg_flags = NLM_F_MULTI,
+            },
+            .error = 0,
+        };
+        if (!nl_enqueue_copy(s, &done.hdr, s->dump_seq, s->addr.nl_pid))
+            return;
+        s->dumping = false;
+    }
+}
+
+static void nl_dump_stop(nlsock s)
+{
+    while (s->dump_count > 0)
+        nl_dump_release(s->dumps[--s->dump_count]);
+    s->dumping = false;
+}
+
+/* starts streaming one or two dumps as a multipart message; returns an errno value */
+static int nl_dump_start(nlsock s, struct nlmsghdr *hdr, int type, int next_type)
+{
+    if (s->dumping)
+        return EBUSY;
+    s->dump_count = 0;
+    if (type >= 0) {
+        nl_dump d = nl_dump_get(type);
+        if (!d)
+            return ENOMEM;
+        s->dumps[s->dump_count++] = d;
+    }
+    if (next_type >= 0) {
+        nl_dump d = nl_dump_get(next_type);
+        if (!d) {
+            nl_dump_stop(s);
+            return ENOMEM;
+        }
+        s->dumps[s->dump_count++] = d;
+    }
+    s->dump_seq = hdr->nlmsg_seq;
+    s->dump_offset = 0;
+    s->dumping = true;
+    nl_dump_continue(s);
+    return 0;
 }
 
 static void nl_route_req(nlsock s, struct nlmsghdr *hdr)
@@ -606,12 +871,7 @@ static void nl_route_req(nlsock s, struct nlmsghdr *hdr)
             break;
         }
         if (hdr->nlmsg_flags & NLM_F_DUMP) {
-            struct nl_rtm_netif_priv priv = {
-                .s = s,
-                .hdr = hdr,
-            };
-            netif_iterate(nl_rtm_getlink, &priv);
-            nl_enqueue_done(s, hdr);
+            errno = nl_dump_start(s, hdr, NL_DUMP_LINK, -1);
         } else {    /* Return a single entry. */
             struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(hdr);
             if ((hdr->nlmsg_len < NLMSG_HDRLEN + sizeof(*ifi)) || (ifi->ifi_index == 0)) {
@@ -619,14 +879,15 @@ static void nl_route_req(nlsock s, struct nlmsghdr *hdr)
                 break;
             }
             struct nl_rtm_netif_priv priv = {
-                .s = s,
-                .hdr = hdr,
+                .b = little_stack_buffer(NL_MSG_MAX_LEN),
                 .if_index = ifi->ifi_index,
                 .found = false,
             };
             netif_iterate(nl_rtm_getlink_single, &priv);
             if (!priv.found)
                 errno = EINVAL;
+            else if (!nl_enqueue_copy(s, buffer_ref(priv.b, 0), hdr->nlmsg_seq, s->addr.nl_pid))
+                errno = ENOBUFS;
         }
         break;
     }
@@ -636,21 +897,9 @@ static void nl_route_req(nlsock s, struct nlmsghdr *hdr)
             break;
         if (hdr->nlmsg_flags & NLM_F_DUMP) {
             u8 af = msg->rtgen_family;
-            if (af == AF_INET || af == AF_UNSPEC) {   /* retrieve IPv4 addresses */
-                struct nl_rtm_netif_priv priv = {
-                    .s = s,
-                    .hdr = hdr,
-                };
-                netif_iterate(nl_rtm_getaddr, &priv);
-            }
-            if (af == AF_INET6 || af == AF_UNSPEC) {  /* IPv6 */
-                struct nl_rtm_netif_priv priv = {
-                    .s = s,
-                    .hdr = hdr,
-                };
-                netif_iterate(nl_rtm_getaddr6, &priv);
-            }
-            nl_enqueue_done(s, hdr);
+            errno = nl_dump_start(s, hdr,
+                                  (af == AF_INET || af == AF_UNSPEC) ? NL_DUMP_ADDR4 : -1,
+                                  (af == AF_INET6 || af == AF_UNSPEC) ? NL_DUMP_ADDR6 : -1);
         } else {
             errno = EOPNOTSUPP;
         }
@@ -665,17 +914,23 @@ static void nl_route_req(nlsock s, struct nlmsghdr *hdr)
         u8 af = msg->rtgen_family;
         if (hdr->nlmsg_flags & NLM_F_DUMP) {
             /* Presently only reporting IPv4 routes on the "main" table. */
-            if (af != AF_INET6) {
-                struct nl_rtm_netif_priv priv = {
-                    .s = s,
-                    .hdr = hdr,
-                    .netif_default = netif_get_default(),
-                };
-                netif_iterate(nl_rtm_getroute, &priv);
-                if (priv.netif_default)
-                    netif_unref(priv.netif_default);
-            }
-            nl_enqueue_done(s, hdr);
+            errno = nl_dump_start(s, hdr, (af != AF_INET6) ? NL_DUMP_ROUTE : -1, -1);
+        } else {
+            errno = EOPNOTSUPP;
+        }
+        break;
+    }
+    case RTM_GETNEIGH: {
+        struct rtgenmsg *msg = (struct rtgenmsg *)NLMSG_DATA(hdr);
+        if (hdr->nlmsg_len < NLMSG_HDRLEN + sizeof(*msg)) {
+            errno = EINVAL;
+            break;
+        }
+        u8 af = msg->rtgen_family;
+        if (hdr->nlmsg_flags & NLM_F_DUMP) {
+            /* IPv4 (ARP) entries only */
+            errno = nl_dump_start(s, hdr, (af == AF_INET || af == AF_UNSPEC) ? NL_DUMP_NEIGH : -1,
+                                  -1);
         } else {
             errno = EOPNOTSUPP;
         }
@@ -767,6 +1022,11 @@ closure_function(8, 1, sysreturn, nl_read_bh,
     }
     context ctx = get_current_context(current_cpu());
     nl_lock(s);
+    if (s->overrun) {
+        s->overrun = false;
+        rv = -ENOBUFS;
+        goto unlock;
+    }
     struct nlmsghdr *hdr = dequeue(s->data);
     if (hdr == INVALID_ADDRESS) {
         if (s->sock.f.flags & SOCK_NONBLOCK) {
@@ -841,6 +1101,7 @@ closure_function(8, 1, sysreturn, nl_read_bh,
             rv = hdr->nlmsg_len;
         s->sock.rx_len -= hdr->nlmsg_len;
         deallocate(s->sock.h, hdr, hdr->nlmsg_len);
+        nl_dump_continue(s);
         hdr = queue_peek(s->data);
         if (hdr == INVALID_ADDRESS) { /* no more data available to read */
             fdesc_notify_events(&s->sock.f);
@@ -897,6 +1158,7 @@ closure_func_basic(fdesc_close, sysreturn, nl_close,
     nlsock s = struct_from_closure(nlsock, close);
     nl_debug("close, pid %d", s->addr.nl_pid);
     socket_flush_q(&s->sock);
+    nl_dump_stop(s);
     struct nlmsghdr *hdr = dequeue(s->data);
     while (hdr != INVALID_ADDRESS) {
         deallocate(s->sock.h, hdr, hdr->nlmsg_len);
@@ -1011,8 +1273,8 @@ static sysreturn nl_recvfrom(struct sock *sock, void *buf, u64 len, int flags,
     return blockq_check(s->sock.rxbq, ba, false);
 }
 
-static sysreturn nl_sendmsg(struct sock *sock, const struct msghdr *msg, int flags, boolean in_bh,
-                            io_completion completion)
+static sysreturn nl_sendmsg(struct sock *sock, const struct msghdr *msg, int flags, context ctx,
+                            boolean in_bh, io_completion completion)
 {
     nl_debug("sendmsg: iovlen %ld, flags 0x%x", msg->msg_iovlen, flags);
     nlsock s = (nlsock)sock;
@@ -1034,61 +1296,116 @@ static sysreturn nl_sendmsg(struct sock *sock, const struct msghdr *msg, int fla
     return io_complete(completion, rv);
 }
 
-static sysreturn nl_recvmsg(struct sock *sock, struct msghdr *msg, int flags, boolean in_bh,
-                            io_completion completion)
+static sysreturn nl_recvmsg(struct sock *sock, struct msghdr *msg, int flags, context ctx,
+                            boolean in_bh, io_completion completion)
 {
     nl_debug("recvmsg: iovlen %ld, flags 0x%x", msg->msg_iovlen, flags);
     nlsock s = (nlsock)sock;
-    blockq_action ba = contextual_closure(nl_read_bh, s, 0, 0, msg, flags,
-                                          msg->msg_name, &msg->msg_namelen, completion);
+    blockq_action ba = closure_from_context(ctx, nl_read_bh, s, 0, 0, msg, flags,
+                                            msg->msg_name, &msg->msg_namelen, completion);
     if (ba == INVALID_ADDRESS)
         return io_complete(completion, -ENOMEM);
     return blockq_check(s->sock.rxbq, ba, in_bh);
 }
 
+static sysreturn nl_setsockopt(struct sock *sock, int level, int optname, void *optval,
+                               socklen_t optlen)
+{
+    nlsock s = (nlsock)sock;
+    sysreturn rv;
+    u32 group;
+    switch (level) {
+    case SOL_SOCKET:
+        switch (optname) {
+        case SO_SNDBUF:
+        case SO_RCVBUF:
+            rv = 0; /* the receive queue is bounded by so_rcvbuf */
+            break;
+        default:
+            rv = -EOPNOTSUPP;
+        }
+        break;
+    case SOL_NETLINK:
+        switch (optname) {
+        case NETLINK_ADD_MEMBERSHIP:
+        case NETLINK_DROP_MEMBERSHIP:
+            rv = sockopt_copy_from_user(optval, optlen, &group, sizeof(group));
+            if (rv)
+                break;
+            if ((group == 0) || (group > 32)) {
+                rv = -EINVAL;
+                break;
+            }
+            nl_debug("%s group %d", (optname == NETLINK_ADD_MEMBERSHIP) ? ss("add") : ss("drop"),
+                     group);
+            spin_lock(&netlink.lock);
+            nl_lock(s);
+            if (optname == NETLINK_ADD_MEMBERSHIP)
+                s->addr.nl_groups |= U32_FROM_BIT(group - 1);
+            else
+                s->addr.nl_groups &= ~U32_FROM_BIT(group - 1);
+            nl_unlock(s);
+            spin_unlock(&netlink.lock);
+            break;
+        default:
+            rv = -ENOPROTOOPT;
+        }
+        break;
+    default:
+        rv = -EOPNOTSUPP;
+    }
+    socket_release(sock);
+    return rv;
+}
+
 static void nl_lwip_ext_callback(struct netif* netif, netif_nsc_reason_t reason,
                                const netif_ext_callback_args_t* args)
 {
     nl_debug("lwIP callback, reason 0x%x", reason);
-    nlsock s;
-    if (reason & (LWIP_NSC_NETIF_ADDED | LWIP_NSC_NETIF_REMOVED | LWIP_NSC_LINK_CHANGED)) {
-        spin_lock(&netlink.lock);
-        vector_foreach(netlink.sockets, s) {
-            if (s->addr.nl_groups & RTMGRP_LINK) {
-                nl_lock(s);
-                nl_enqueue_ifinfo(s, (reason == LWIP_NSC_NETIF_REMOVED) ? RTM_DELLINK : RTM_NEWLINK,
-                        0, 0, NL_PID_KERNEL, netif);
-                nl_unlock(s);
-            }
-        }
-        spin_unlock(&netlink.lock);
+    fetch_and_add(&netlink.gen, 1);
+    buffer b = little_stack_buffer(NL_MSG_MAX_LEN * 2);
+    if (reason & (LWIP_NSC_NETIF_ADDED | LWIP_NSC_NETIF_REMOVED | LWIP_NSC_LINK_CHANGED |
+                  LWIP_NSC_STATUS_CHANGED)) {
+        if (nl_put_ifinfo(b, (reason == LWIP_NSC_NETIF_REMOVED) ? RTM_DELLINK : RTM_NEWLINK, 0,
+                          netif))
+            nl_notify(RTMGRP_LINK, b);
+        buffer_clear(b);
     }
     if (reason & LWIP_NSC_IPV4_SETTINGS_CHANGED) {
-        spin_lock(&netlink.lock);
-        vector_foreach(netlink.sockets, s) {
-            if (s->addr.nl_groups & RTMGRP_IPV4_IFADDR) {
-                if ((reason & LWIP_NSC_IPV4_ADDRESS_CHANGED) &&
-                        !ip4_addr_isany(ip_2_ip4(args->ipv4_changed.old_address))) {
-                    nl_lock(s);
-                    nl_enqueue_ifaddr4(s, RTM_DELADDR, 0, 0, NL_PID_KERNEL, netif,
-                        args->ipv4_changed.old_address->u_addr.ip4,
-                        (reason & LWIP_NSC_IPV4_NETMASK_CHANGED) ?
-                                *ip_2_ip4(args->ipv4_changed.old_netmask) :
-                                *ip_2_ip4(&netif->netmask));
-                    nl_unlock(s);
-                }
-                if (!ip4_addr_isany(netif_ip4_addr(netif))) {
-                    nl_lock(s);
-                    nl_enqueue_ifaddr4(s, RTM_NEWADDR, 0, 0, NL_PID_KERNEL, netif,
-                        *netif_ip4_addr(netif), *netif_ip4_netmask(netif));
-                    nl_unlock(s);
-                }
-            }
-        }
-        spin_unlock(&netlink.lock);
+        if ((reason & LWIP_NSC_IPV4_ADDRESS_CHANGED) &&
+            !ip4_addr_isany(ip_2_ip4(args->ipv4_changed.old_address)))
+            nl_put_ifaddr4(b, RTM_DELADDR, 0, netif, args->ipv4_changed.old_address->u_addr.ip4,
+                           (reason & LWIP_NSC_IPV4_NETMASK_CHANGED) ?
+                           *ip_2_ip4(args->ipv4_changed.old_netmask) : *ip_2_ip4(&netif->netmask));
+        if (!ip4_addr_isany(netif_ip4_addr(netif)))
+            nl_put_ifaddr4(b, RTM_NEWADDR, 0, netif, *netif_ip4_addr(netif),
+                           *netif_ip4_netmask(netif));
+        nl_notify(RTMGRP_IPV4_IFADDR, b);
+        buffer_clear(b);
+        if (!ip4_addr_isany(netif_ip4_addr(netif)) &&
+            nl_put_routes(b, RTM_NEWROUTE, 0, netif, netif_default))
+            nl_notify(RTMGRP_IPV4_ROUTE, b);
+        buffer_clear(b);
+    }
+    if (reason & LWIP_NSC_IPV6_ADDR_STATE_CHANGED) {
+        s8 i = args->ipv6_addr_state_changed.addr_index;
+        boolean valid = !ip6_addr_isinvalid(netif_ip6_addr_state(netif, i));
+        if ((valid != !ip6_addr_isinvalid(args->ipv6_addr_state_changed.old_state)) &&
+            nl_put_ifaddr6(b, valid ? RTM_NEWADDR : RTM_DELADDR, 0, netif,
+                           *ip_2_ip6(args->ipv6_addr_state_changed.address)))
+            nl_notify(RTMGRP_IPV6_IFADDR, b);
     }
 }
 
+/* Called on changes of interface settings that are not notified by lwIP. */
+void netlink_link_changed(struct netif *netif)
+{
+    fetch_and_add(&netlink.gen, 1);
+    buffer b = little_stack_buffer(NL_MSG_MAX_LEN);
+    if (nl_put_ifinfo(b, RTM_NEWLINK, 0, netif))
+        nl_notify(RTMGRP_LINK, b);
+}
+
 sysreturn netlink_open(int type, int family)
 {
     nl_debug("open: type %d, family %d", type, family);
@@ -1118,12 +1435,16 @@ sysreturn netlink_open(int type, int family)
     spin_unlock(&netlink.lock);
     s->family = family;
     zero(&s->addr, sizeof(s->addr));
+    s->overrun = false;
+    s->dumping = false;
+    s->dump_count = 0;
     s->sock.f.read = init_closure_func(&s->read, file_io, nl_read);
     s->sock.f.write = init_closure_func(&s->write, file_io, nl_write);
     s->sock.f.events = init_closure_func(&s->events, fdesc_events, nl_events);
     s->sock.f.close = init_closure_func(&s->close, fdesc_close, nl_close);
     s->sock.bind = nl_bind;
     s->sock.getsockname = nl_getsockname;
+    s->sock.setsockopt = nl_setsockopt;
     s->sock.sendto = nl_sendto;
     s->sock.recvfrom = nl_recvfrom;
     s->sock.sendmsg = nl_sendmsg;
@@ -1144,11 +1465,13 @@ sysreturn netlink_open(int type, int family)
 void netlink_init(void)
 {
     heap h = heap_locked(&get_unix_heaps()->kh);
+    netlink.h = h;
     netlink.pids = create_id_heap(h, h, 1, U32_MAX, 1, false);
     assert(netlink.pids != INVALID_ADDRESS);
     netlink.sockets = allocate_vector(h, 8);
     assert(netlink.sockets != INVALID_ADDRESS);
     spin_lock_init(&netlink.lock);
+    spin_lock_init(&netlink.dump_lock);
     BSS_RO_AFTER_INIT NETIF_DECLARE_EXT_CALLBACK(netif_callback);
     netif_add_ext_callback(&netif_callback, nl_lwip_ext_callback);
 }
@@ -0,0 +1,714 @@
+/* perf_event_open(2): per-thread hardware and software counters
+ *
+ * Each event is bound to a thread and is assigned a dedicated PMU counter, which is programmed
+ * while the thread (or its syscall context) runs on a CPU and saved when it is paused; counters are
+ * not multiplexed, so the number of hardware events of a thread is limited by the number of PMU
+ * counters. Sampling events write PERF_RECORD_SAMPLE records to a ring buffer mapped by the user
+ * program, from the PMU overflow interrupt.
+ */
+
+#include <unix_internal.h>
+#include <pmu.h>
+
+//#define PERF_DEBUG
+#ifdef PERF_DEBUG
+#define perf_debug(x, ...) do {tprintf(sym(perf), 0, ss("%s: " x "\n"), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define perf_debug(x, ...)
+#endif
+
+#define PERF_TYPE_HARDWARE  0
+#define PERF_TYPE_SOFTWARE  1
+#define PERF_TYPE_RAW       4
+
+#define PERF_COUNT_SW_CPU_CLOCK     0
+#define PERF_COUNT_SW_TASK_CLOCK    1
+
+#define PERF_ATTR_SIZE_VER0 64
+
+#define PERF_ATTR_FLAG_DISABLED         U64_FROM_BIT(0)
+#define PERF_ATTR_FLAG_EXCLUDE_USER     U64_FROM_BIT(4)
+#define PERF_ATTR_FLAG_EXCLUDE_KERNEL   U64_FROM_BIT(5)
+#define PERF_ATTR_FLAG_FREQ             U64_FROM_BIT(10)
+#define PERF_ATTR_FLAG_WATERMARK        U64_FROM_BIT(14)
+
+#define PERF_SAMPLE_IP          U64_FROM_BIT(0)
+#define PERF_SAMPLE_TID         U64_FROM_BIT(1)
+#define PERF_SAMPLE_TIME        U64_FROM_BIT(2)
+#define PERF_SAMPLE_ID          U64_FROM_BIT(6)
+#define PERF_SAMPLE_CPU         U64_FROM_BIT(7)
+#define PERF_SAMPLE_PERIOD      U64_FROM_BIT(8)
+#define PERF_SAMPLE_IDENTIFIER  U64_FROM_BIT(16)
+
+#define PERF_SAMPLE_SUPPORTED   (PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME |          \
+                                 PERF_SAMPLE_ID | PERF_SAMPLE_CPU | PERF_SAMPLE_PERIOD |        \
+                                 PERF_SAMPLE_IDENTIFIER)
+
+#define PERF_FORMAT_TOTAL_TIME_ENABLED  U64_FROM_BIT(0)
+#define PERF_FORMAT_TOTAL_TIME_RUNNING  U64_FROM_BIT(1)
+#define PERF_FORMAT_ID                  U64_FROM_BIT(2)
+
+#define PERF_FLAG_FD_NO_GROUP   U64_FROM_BIT(0)
+#define PERF_FLAG_FD_CLOEXEC    U64_FROM_BIT(3)
+
+#define PERF_EVENT_IOC_ENABLE   0x2400
+#define PERF_EVENT_IOC_DISABLE  0x2401
+#define PERF_EVENT_IOC_RESET    0x2403
+#define PERF_EVENT_IOC_PERIOD   0x40082404
+#define PERF_EVENT_IOC_ID       0x80082407
+
+#define PERF_RECORD_LOST    2
+#define PERF_RECORD_SAMPLE  9
+
+#define PERF_RECORD_MISC_KERNEL 1
+#define PERF_RECORD_MISC_USER   2
+
+#define PERF_CAP_BIT0_IS_DEPRECATED U64_FROM_BIT(1)
+
+/* sign-extended 32-bit counter writes limit the sampling period on some PMUs */
+#define PERF_SAMPLE_PERIOD_MAX  MASK(31)
+
+struct perf_event_attr {
+    u32 type;
+    u32 size;
+    u64 config;
+    u64 sample_period;
+    u64 sample_type;
+    u64 read_format;
+    u64 flags;
+    u32 wakeup_events;
+    u32 bp_type;
+    u64 config1;
+};
+
+struct perf_event_header {
+    u32 type;
+    u16 misc;
+    u16 size;
+};
+
+struct perf_event_mmap_page {
+    u32 version;
+    u32 compat_version;
+    u32 lock;
+    u32 index;
+    s64 offset;
+    u64 time_enabled;
+    u64 time_running;
+    u64 capabilities;
+    u16 pmc_width;
+    u16 time_shift;
+    u32 time_mult;
+    u64 time_offset;
+    u64 time_zero;
+    u32 size;
+    u32 reserved_1;
+    u64 time_cycles;
+    u64 time_mask;
+    u8 reserved[116 * 8];
+    u64 data_head;
+    u64 data_tail;
+    u64 data_offset;
+    u64 data_size;
+};
+
+typedef struct perf_event {
+    struct fdesc f; /* must be first */
+    heap h;
+    thread t;
+    struct list l;      /* in thread perf_events */
+    u64 id;
+    u32 type;
+    u64 hw_event;
+    u64 pmu_flags;
+    int counter;        /* -1 for software events */
+    u64 read_format;
+    u64 sample_type;
+    u64 sample_period;
+    u32 wakeup_events;
+    boolean watermark;
+    boolean enabled;
+    int cpu;            /* CPU the event is running on, or -1 */
+    u64 count;
+    u64 load_value;     /* counter value when the event was loaded */
+    timestamp run_start;
+    timestamp time_running;
+
+    /* sample ring, allocated on mmap */
+    struct perf_event_mmap_page *ring;
+    u64 ring_size;
+    u64 data_size;
+    u64 lost;
+    u32 samples_since_wakeup;
+    u64 wakeup_head;
+    boolean wakeup_pending;
+    boolean closed;
+
+    closure_struct(file_io, read);
+    closure_struct(fdesc_events, events);
+    closure_struct(fdesc_ioctl, ioctl);
+    closure_struct(fdesc_mmap, mmap);
+    closure_struct(fdesc_close, close);
+    closure_struct(thunk, wakeup);
+} *perf_event;
+
+static struct {
+    heap h;
+    boolean pmu;
+    u64 next_id;
+    thread *loaded;     /* per-CPU thread with loaded events */
+    closure_struct(thunk, overflow);
+} perf;
+
+static inline u64 perf_lock(thread t)
+{
+    return spin_lock_irq(&t->perf_lock);
+}
+
+static inline void perf_unlock(thread t, u64 flags)
+{
+    spin_unlock_irq(&t->perf_lock, flags);
+}
+
+static void perf_event_start(perf_event ev, cpuinfo ci)
+{
+    ev->cpu = ci->id;
+    ev->run_start = now(CLOCK_ID_MONOTONIC_RAW);
+    if (ev->counter >= 0) {
+        pmu_counter_start(ev->counter, ev->hw_event, ev->pmu_flags, ev->load_value);
+        ev->t->perf_running |= U64_FROM_BIT(ev->counter);
+    }
+}
+
+static u64 perf_event_counter_delta(perf_event ev)
+{
+    return (pmu_counter_read(ev->counter) - ev->load_value) & pmu_counter_mask();
+}
+
+/* must be called on the CPU the event is running on */
+static void perf_event_stop(perf_event ev)
+{
+    timestamp elapsed = now(CLOCK_ID_MONOTONIC_RAW) - ev->run_start;
+    ev->time_running += elapsed;
+    if (ev->counter >= 0) {
+        u64 v = pmu_counter_stop(ev->counter);
+        ev->count += (v - ev->load_value) & pmu_counter_mask();
+        ev->load_value = v;
+        ev->t->perf_running &= ~U64_FROM_BIT(ev->counter);
+    } else {
+        ev->count += nsec_from_timestamp(elapsed);
+    }
+    ev->cpu = -1;
+}
+
+static u64 perf_event_value(perf_event ev, timestamp *running)
+{
+    u64 count = ev->count;
+    timestamp t = ev->time_running;
+    if (ev->cpu >= 0) {
+        timestamp elapsed = now(CLOCK_ID_MONOTONIC_RAW) - ev->run_start;
+        t += elapsed;
+        if (ev->counter < 0)
+            count += nsec_from_timestamp(elapsed);
+        else if (ev->cpu == current_cpu()->id)
+            count += perf_event_counter_delta(ev);
+    }
+    if (running)
+        *running = t;
+    return count;
+}
+
+static void perf_event_update_userpage(perf_event ev)
+{
+    struct perf_event_mmap_page *pg = ev->ring;
+    if (!pg)
+        return;
+    timestamp running;
+    perf_event_value(ev, &running);
+    pg->lock++;
+    write_barrier();
+    pg->time_enabled = pg->time_running = nsec_from_timestamp(running);
+    write_barrier();
+    pg->lock++;
+}
+
+/* Starts the enabled events of a thread on the current CPU. */
+void perf_event_load(thread t)
+{
+    cpuinfo ci = current_cpu();
+    u64 flags = perf_lock(t);
+    list_foreach(&t->perf_events, l) {
+        perf_event ev = struct_from_field(l, perf_event, l);
+        if (ev->enabled && (ev->cpu < 0))
+            perf_event_start(ev, ci);
+    }
+    t->perf_cpu = ci->id;
+    perf.loaded[ci->id] = t;
+    perf_unlock(t, flags);
+}
+
+/* Saves the events of a thread running on the current CPU, and stops any counters left running
+ * by events that have since been closed. */
+void perf_event_unload(thread t)
+{
+    cpuinfo ci = current_cpu();
+    u64 flags = perf_lock(t);
+    list_foreach(&t->perf_events, l) {
+        perf_event ev = struct_from_field(l, perf_event, l);
+        if (ev->cpu == ci->id) {
+            perf_event_stop(ev);
+            perf_event_update_userpage(ev);
+        }
+    }
+    bitmap_word_foreach_set(t->perf_running, bit, i, 0)
+        pmu_counter_stop(i);
+    t->perf_running = 0;
+    t->perf_cpu = -1;
+    perf.loaded[ci->id] = 0;
+    perf_unlock(t, flags);
+}
+
+static void perf_ring_write(perf_event ev, u64 head, void *data, u64 len)
+{
+    u8 *base = (u8 *)ev->ring + PAGESIZE;
+    u64 off = head & (ev->data_size - 1);
+    u64 first = MIN(len, ev->data_size - off);
+    runtime_memcpy(base + off, data, first);
+    if (first < len)
+        runtime_memcpy(base, data + first, len - first);
+}
+
+static boolean perf_ring_output(perf_event ev, void *rec, u64 len)
+{
+    struct perf_event_mmap_page *pg = ev->ring;
+    u64 head = pg->data_head;
+    u64 tail = pg->data_tail;
+    read_barrier();
+    if (ev->data_size - (head - tail) < len)
+        return false;
+    perf_ring_write(ev, head, rec, len);
+    write_barrier();
+    pg->data_head = head + len;
+    return true;
+}
+
+closure_func_basic(thunk, void, perf_event_wakeup)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, wakeup);
+    thread t = ev->t;
+    u64 flags = perf_lock(t);
+    ev->wakeup_pending = false;
+    boolean closed = ev->closed;
+    perf_unlock(t, flags);
+    if (closed) {
+        thread_release(t);
+        deallocate(ev->h, ev, sizeof(*ev));
+        return;
+    }
+    fdesc_notify_events(&ev->f);
+}
+
+static void perf_event_sample(perf_event ev, cpuinfo ci, context ctx)
+{
+    if (!ev->ring || !ev->data_size) {
+        ev->lost++;
+        return;
+    }
+    if (ev->lost) {
+        struct {
+            struct perf_event_header hdr;
+            u64 id;
+            u64 lost;
+        } lost_rec = {
+            .hdr = {.type = PERF_RECORD_LOST, .misc = 0, .size = sizeof(lost_rec)},
+            .id = ev->id,
+            .lost = ev->lost,
+        };
+        if (!perf_ring_output(ev, &lost_rec, sizeof(lost_rec))) {
+            ev->lost++;
+            return;
+        }
+        ev->lost = 0;
+    }
+    u64 rec[16];
+    struct perf_event_header *hdr = (struct perf_event_header *)rec;
+    int n = 1;
+    u64 st = ev->sample_type;
+    thread t = ev->t;
+    if (st & PERF_SAMPLE_IDENTIFIER)
+        rec[n++] = ev->id;
+    if (st & PERF_SAMPLE_IP)
+        rec[n++] = frame_fault_pc(ctx->frame);
+    if (st & PERF_SAMPLE_TID)
+        rec[n++] = ((u64)t->tid << 32) | t->p->pid;
+    if (st & PERF_SAMPLE_TIME)
+        rec[n++] = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC));
+    if (st & PERF_SAMPLE_ID)
+        rec[n++] = ev->id;
+    if (st & PERF_SAMPLE_CPU)
+        rec[n++] = ci->id;
+    if (st & PERF_SAMPLE_PERIOD)
+        rec[n++] = ev->sample_period;
+    hdr->type = PERF_RECORD_SAMPLE;
+    hdr->misc = (ctx->type == CONTEXT_TYPE_THREAD) ? PERF_RECORD_MISC_USER :
+                                                     PERF_RECORD_MISC_KERNEL;
+    hdr->size = n * sizeof(u64);
+    if (!perf_ring_output(ev, rec, hdr->size)) {
+        ev->lost++;
+        return;
+    }
+    boolean wakeup;
+    if (ev->watermark) {
+        wakeup = (ev->ring->data_head - ev->wakeup_head >= ev->wakeup_events);
+    } else {
+        wakeup = (++ev->samples_since_wakeup >= ev->wakeup_events);
+    }
+    if (wakeup && !ev->wakeup_pending) {
+        ev->samples_since_wakeup = 0;
+        ev->wakeup_head = ev->ring->data_head;
+        ev->wakeup_pending = true;
+        async_apply_bh((thunk)&ev->wakeup);
+    }
+}
+
+/* PMU overflow interrupt: the interrupted context belongs to the thread whose events are loaded */
+closure_func_basic(thunk, void, perf_event_overflow)
+{
+    u64 status = pmu_overflow_status();
+    cpuinfo ci = current_cpu();
+    thread t = perf.loaded[ci->id];
+    if (!status || !t)
+        return;
+    context ctx = get_current_context(ci);
+    u64 mask = pmu_counter_mask();
+    u64 flags = perf_lock(t);
+    list_foreach(&t->perf_events, l) {
+        perf_event ev = struct_from_field(l, perf_event, l);
+        if ((ev->cpu != ci->id) || (ev->counter < 0) || !ev->sample_period ||
+            !(status & U64_FROM_BIT(ev->counter)))
+            continue;
+        u64 v = pmu_counter_stop(ev->counter);
+        ev->count += (v - ev->load_value) & mask;
+        perf_event_sample(ev, ci, ctx);
+        ev->load_value = -ev->sample_period & mask;
+        pmu_counter_start(ev->counter, ev->hw_event, ev->pmu_flags, ev->load_value);
+    }
+    perf_unlock(t, flags);
+}
+
+closure_func_basic(file_io, sysreturn, perf_event_read,
+                   void *buf, u64 length, u64 offset, context ctx, boolean bh,
+                   io_completion completion)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, read);
+    u64 values[4];
+    int n = 0;
+    timestamp running;
+    u64 flags = perf_lock(ev->t);
+    values[n++] = perf_event_value(ev, &running);
+    perf_unlock(ev->t, flags);
+    if (ev->read_format & PERF_FORMAT_TOTAL_TIME_ENABLED)
+        values[n++] = nsec_from_timestamp(running);
+    if (ev->read_format & PERF_FORMAT_TOTAL_TIME_RUNNING)
+        values[n++] = nsec_from_timestamp(running);
+    if (ev->read_format & PERF_FORMAT_ID)
+        values[n++] = ev->id;
+    sysreturn rv = n * sizeof(u64);
+    if (length < rv)
+        rv = -ENOSPC;
+    else if (!copy_to_user(buf, values, rv))
+        rv = -EFAULT;
+    return io_complete(completion, rv);
+}
+
+closure_func_basic(fdesc_events, u32, perf_event_events,
+                   thread t)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, events);
+    struct perf_event_mmap_page *pg = ev->ring;
+    if (pg && (pg->data_head != pg->data_tail))
+        return EPOLLIN;
+    return 0;
+}
+
+static void perf_event_enable(perf_event ev, boolean enable)
+{
+    thread t = ev->t;
+    cpuinfo ci = current_cpu();
+    u64 flags = perf_lock(t);
+    ev->enabled = enable;
+    if (!enable && (ev->cpu == ci->id)) {
+        perf_event_stop(ev);
+        perf_event_update_userpage(ev);
+    } else if (enable && (ev->cpu < 0) && (t->perf_cpu == ci->id)) {
+        perf_event_start(ev, ci);
+    }
+    perf_unlock(t, flags);
+    if (enable && (t == current) && (t->perf_cpu < 0))
+        perf_event_load(t);
+}
+
+static void perf_event_reset(perf_event ev)
+{
+    u64 flags = perf_lock(ev->t);
+    ev->count = 0;
+    if (ev->cpu == current_cpu()->id) {
+        if (ev->counter >= 0)
+            ev->count = -perf_event_counter_delta(ev);
+        else
+            ev->count = -nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - ev->run_start);
+    }
+    perf_unlock(ev->t, flags);
+}
+
+closure_func_basic(fdesc_ioctl, sysreturn, perf_event_ioctl,
+                   unsigned long request, vlist ap)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, ioctl);
+    switch (request) {
+    case PERF_EVENT_IOC_ENABLE:
+        perf_event_enable(ev, true);
+        return 0;
+    case PERF_EVENT_IOC_DISABLE:
+        perf_event_enable(ev, false);
+        return 0;
+    case PERF_EVENT_IOC_RESET:
+        perf_event_reset(ev);
+        return 0;
+    case PERF_EVENT_IOC_PERIOD: {
+        u64 period;
+        if (!get_user_value(varg(ap, u64 *), &period))
+            return -EFAULT;
+        if (!ev->sample_period || !period || (period > PERF_SAMPLE_PERIOD_MAX))
+            return -EINVAL;
+        ev->sample_period = period;     /* takes effect at the next overflow */
+        return 0;
+    }
+    case PERF_EVENT_IOC_ID:
+        if (!set_user_value(varg(ap, u64 *), ev->id))
+            return -EFAULT;
+        return 0;
+    default:
+        return ioctl_generic(&ev->f, request, ap);
+    }
+}
+
+/* The mapping consists of the control page followed by 2^n data pages. */
+closure_func_basic(fdesc_mmap, sysreturn, perf_event_mmap,
+                   vmap vm, u64 offset)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, mmap);
+    u64 len = range_span(vm->node.r);
+    u64 data_size = len - PAGESIZE;
+    if ((offset != 0) || (len < PAGESIZE) || (data_size & (data_size - 1)))
+        return -EINVAL;
+    if (vm->flags & VMAP_FLAG_EXEC)
+        return -EACCES;
+    thread t = ev->t;
+    heap rh = (heap)heap_linear_backed(get_kernel_heaps());
+    struct perf_event_mmap_page *pg = 0;
+    if (!ev->ring) {
+        pg = allocate_zero(rh, len);
+        if (pg == INVALID_ADDRESS)
+            return -ENOMEM;
+        pg->capabilities = PERF_CAP_BIT0_IS_DEPRECATED;
+        pg->pmc_width = (ev->counter >= 0) ? msb(pmu_counter_mask()) + 1 : 0;
+        pg->size = sizeof(*pg);
+        pg->data_offset = PAGESIZE;
+        pg->data_size = data_size;
+    }
+    u64 flags = perf_lock(t);
+    if (!ev->ring && pg) {
+        ev->data_size = data_size;
+        ev->ring_size = len;
+        if (ev->watermark && (!ev->wakeup_events || ev->wakeup_events > data_size))
+            ev->wakeup_events = data_size / 2;
+        ev->ring = pg;
+        pg = 0;
+        perf_event_update_userpage(ev);
+    }
+    if (len != ev->ring_size) {
+        perf_unlock(t, flags);
+        return -EINVAL;
+    }
+    perf_unlock(t, flags);
+    if (pg)     /* lost a race with a concurrent mmap */
+        deallocate(rh, pg, len);
+    u64 virt = vm->node.r.start;
+    remap(virt, physical_from_virtual(ev->ring), len, pageflags_from_vmflags(vm->flags));
+    vm->allowed_flags |= VMAP_FLAG_WRITABLE | VMAP_FLAG_READABLE;
+    return virt;
+}
+
+closure_func_basic(fdesc_close, sysreturn, perf_event_close,
+                   context ctx, io_completion completion)
+{
+    perf_event ev = struct_from_field(closure_self(), perf_event, close);
+    perf_debug("event %ld", ev->id);
+    thread t = ev->t;
+    u64 flags = perf_lock(t);
+    if (ev->cpu == current_cpu()->id)
+        perf_event_stop(ev);
+    list_delete(&ev->l);
+    if (ev->counter >= 0)
+        t->perf_counters &= ~U64_FROM_BIT(ev->counter);
+    struct perf_event_mmap_page *ring = ev->ring;
+    ev->ring = 0;
+    boolean pending = ev->wakeup_pending;
+    ev->closed = true;
+    perf_unlock(t, flags);
+    if (ring)
+        deallocate((heap)heap_linear_backed(get_kernel_heaps()), ring, ev->ring_size);
+    release_fdesc(&ev->f);
+    if (!pending) {
+        /* otherwise, the pending wakeup frees the event */
+        thread_release(t);
+        deallocate(ev->h, ev, sizeof(*ev));
+    }
+    return io_complete(completion, 0);
+}
+
+static sysreturn perf_event_attr_parse(perf_event ev, struct perf_event_attr *attr)
+{
+    switch (attr->type) {
+    case PERF_TYPE_HARDWARE:
+        if (!perf.pmu || !pmu_hw_event(attr->config, &ev->hw_event))
+            return -ENOENT;
+        break;
+    case PERF_TYPE_RAW:
+        if (!perf.pmu || !pmu_raw_event(attr->config, &ev->hw_event))
+            return -ENOENT;
+        break;
+    case PERF_TYPE_SOFTWARE:
+        if ((attr->config != PERF_COUNT_SW_CPU_CLOCK) && (attr->config != PERF_COUNT_SW_TASK_CLOCK))
+            return -ENOENT;
+        break;
+    default:
+        return -ENOENT;
+    }
+    if (attr->read_format & ~(PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING |
+                              PERF_FORMAT_ID))
+        return -EINVAL;
+    if (attr->sample_period) {
+        if (attr->flags & PERF_ATTR_FLAG_FREQ)
+            return -EINVAL;
+        if ((attr->type == PERF_TYPE_SOFTWARE) || !pmu_sampling_supported())
+            return -EOPNOTSUPP;
+        if ((attr->sample_period > PERF_SAMPLE_PERIOD_MAX) ||
+            (attr->sample_type & ~PERF_SAMPLE_SUPPORTED))
+            return -EINVAL;
+    }
+    ev->type = attr->type;
+    ev->read_format = attr->read_format;
+    ev->sample_period = attr->sample_period;
+    ev->sample_type = attr->sample_type;
+    ev->watermark = !!(attr->flags & PERF_ATTR_FLAG_WATERMARK);
+    ev->wakeup_events = ev->watermark ? attr->wakeup_events : MAX(attr->wakeup_events, 1);
+    ev->enabled = !(attr->flags & PERF_ATTR_FLAG_DISABLED);
+    ev->pmu_flags = 0;
+    if (!(attr->flags & PERF_ATTR_FLAG_EXCLUDE_USER))
+        ev->pmu_flags |= PMU_COUNT_USER;
+    if (!(attr->flags & PERF_ATTR_FLAG_EXCLUDE_KERNEL))
+        ev->pmu_flags |= PMU_COUNT_KERNEL;
+    if (ev->sample_period) {
+        ev->pmu_flags |= PMU_COUNT_INTERRUPT;
+        ev->load_value = -ev->sample_period & pmu_counter_mask();
+    } else {
+        ev->load_value = 0;
+    }
+    return 0;
+}
+
+static sysreturn perf_event_open(struct perf_event_attr *uattr, int pid, int cpu, int group_fd,
+                          unsigned long flags)
+{
+    perf_debug("pid %d, cpu %d, group_fd %d, flags 0x%lx", pid, cpu, group_fd, flags);
+    u32 size;
+    if (!get_user_value(&uattr->size, &size))
+        return -EFAULT;
+    if (size == 0)
+        size = PERF_ATTR_SIZE_VER0;
+    if (size < PERF_ATTR_SIZE_VER0)
+        return -E2BIG;
+    struct perf_event_attr attr;
+    if (!copy_from_user(uattr, &attr, sizeof(attr)))
+        return -EFAULT;
+    if (flags & ~(PERF_FLAG_FD_NO_GROUP | PERF_FLAG_FD_CLOEXEC))
+        return -EINVAL;
+    if ((cpu != -1) || (group_fd != -1) || (pid < 0))
+        return -EINVAL;
+
+    thread t;
+    if (pid == 0) {
+        t = current;
+        thread_reserve(t);
+    } else {
+        t = thread_from_tid(current->p, pid);
+        if (t == INVALID_ADDRESS)
+            return -ESRCH;
+    }
+    heap h = perf.h;
+    sysreturn rv;
+    perf_event ev = allocate_zero(h, sizeof(*ev));
+    if (ev == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out_release;
+    }
+    rv = perf_event_attr_parse(ev, &attr);
+    if (rv)
+        goto out_dealloc;
+    ev->h = h;
+    ev->t = t;
+    ev->cpu = -1;
+    ev->counter = -1;
+    ev->id = fetch_and_add(&perf.next_id, 1);
+    init_fdesc(h, &ev->f, FDESC_TYPE_PERF_EVENT);
+    ev->f.flags = O_RDONLY;
+    ev->f.read = init_closure_func(&ev->read, file_io, perf_event_read);
+    ev->f.events = init_closure_func(&ev->events, fdesc_events, perf_event_events);
+    ev->f.ioctl = init_closure_func(&ev->ioctl, fdesc_ioctl, perf_event_ioctl);
+    ev->f.mmap = init_closure_func(&ev->mmap, fdesc_mmap, perf_event_mmap);
+    ev->f.close = init_closure_func(&ev->close, fdesc_close, perf_event_close);
+    init_closure_func(&ev->wakeup, thunk, perf_event_wakeup);
+
+    u64 lflags = perf_lock(t);
+    if (ev->type != PERF_TYPE_SOFTWARE) {
+        u64 free = ~t->perf_counters & MASK(pmu_counter_count());
+        if (!free) {
+            perf_unlock(t, lflags);
+            release_fdesc(&ev->f);
+            rv = -ENOSPC;
+            goto out_dealloc;
+        }
+        ev->counter = lsb(free);
+        t->perf_counters |= U64_FROM_BIT(ev->counter);
+    }
+    list_push_back(&t->perf_events, &ev->l);
+    perf_unlock(t, lflags);
+
+    u64 fd = allocate_fd(current->p, ev);
+    if (fd == INVALID_PHYSICAL) {
+        apply(ev->f.close, 0, io_completion_ignore);
+        return -EMFILE;
+    }
+    perf_debug("event %ld: fd %ld, tid %d, counter %d", ev->id, fd, t->tid, ev->counter);
+    if (ev->enabled && (t == current))
+        perf_event_load(t);
+    return fd;
+  out_dealloc:
+    deallocate(h, ev, sizeof(*ev));
+  out_release:
+    thread_release(t);
+    return rv;
+}
+
+void register_perf_event_syscalls(struct syscall *map)
+{
+    kernel_heaps kh = get_kernel_heaps();
+    perf.h = heap_locked(kh);
+    perf.loaded = allocate_zero(heap_general(kh), present_processors * sizeof(thread));
+    assert(perf.loaded != INVALID_ADDRESS);
+    perf.pmu = init_pmu(kh, init_closure_func(&perf.overflow, thunk, perf_event_overflow));
+    perf.next_id = 1;
+    register_syscall(map, perf_event_open, perf_event_open, SYSCALL_F_SET_DESC);
+}
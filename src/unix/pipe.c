@@ -7,7 +7,6 @@
 #define pipe_debug(x, ...)
 #endif
 
-#define INITIAL_PIPE_DATA_SIZE  100
 #define PIPE_MIN_CAPACITY       PAGESIZE
 #define DEFAULT_PIPE_MAX_SIZE   (16 * PAGESIZE) /* see pipe(7) */
 #define PIPE_READ               0
@@ -33,7 +32,9 @@ struct pipe {
     heap h;
     u64 ref_cnt;
     u64 max_size;
-    buffer data;
+    ringbuf data;
+    boolean filling;    /* splice into the pipe in progress at the ring tail */
+    boolean draining;   /* splice out of the pipe in progress at the ring head */
     struct spinlock lock;
 };
 
@@ -49,6 +50,18 @@ boolean pipe_init(unix_heaps uh)
     return (uh->pipe_cache == INVALID_ADDRESS ? false : true);
 }
 
+/* Makes room in the ring for up to n more bytes without growing it past the pipe capacity, nor
+   moving its contents while they are being spliced out; returns the number of bytes that can be
+   written. */
+static u64 pipe_reserve(pipe p, u64 n)
+{
+    ringbuf b = p->data;
+    if ((ringbuf_space(b) < n) && !p->draining)
+        ringbuf_set_capacity(b, MIN(p->max_size,
+                                    U64_FROM_BIT(find_order(ringbuf_length(b) + n))));
+    return MIN(n, ringbuf_space(b));
+}
+
 static inline void pipe_notify_reader(pipe_file pf, int events)
 {
     pipe_file read_pf = &pf->pipe->files[PIPE_READ];
@@ -88,7 +101,7 @@ static void pipe_release(pipe p)
     if (!p->ref_cnt || (fetch_and_add(&p->ref_cnt, -1) == 1)) {
         pipe_debug("%s(%p): deallocating pipe\n", func_ss, p);
         if (p->data != INVALID_ADDRESS)
-            deallocate_buffer(p->data);
+            deallocate_ringbuf(p->data);
 
         unix_cache_free(get_unix_heaps(), pipe, p);
     }
@@ -102,7 +115,7 @@ static inline void pipe_dealloc_end(pipe p, pipe_file pf)
         pipe_debug("%s(%p): writer notified\n", func_ss, p);
     }
     if (&p->files[PIPE_WRITE] == pf) {
-        pipe_notify_reader(pf, (buffer_length(p->data) ? EPOLLIN : 0) | EPOLLHUP);
+        pipe_notify_reader(pf, (ringbuf_length(p->data) ? EPOLLIN : 0) | EPOLLHUP);
         pipe_debug("%s(%p): reader notified\n", func_ss, p);
     }
     pipe_file_release(pf);
@@ -131,10 +144,11 @@ closure_function(4, 1, sysreturn, pipe_read_bh,
 
     context ctx = get_current_context(current_cpu());
     pipe_lock(pf->pipe);
-    buffer b = pf->pipe->data;
-    rv = MIN(buffer_length(b), bound(length));
+    ringbuf b = pf->pipe->data;
+    /* data at the ring head is reserved while being spliced out */
+    rv = pf->pipe->draining ? 0 : MIN(ringbuf_length(b), bound(length));
     if (rv == 0) {
-        if (pf->pipe->files[PIPE_WRITE].fd == -1)
+        if (!pf->pipe->draining && (pf->pipe->files[PIPE_WRITE].fd == -1))
             goto unlock;
         if (pf->f.flags & O_NONBLOCK) {
             rv = -EAGAIN;
@@ -148,13 +162,10 @@ closure_function(4, 1, sysreturn, pipe_read_bh,
         rv = -EFAULT;
         goto unlock;
     }
-    buffer_read(b, bound(dest), rv);
+    ringbuf_read(b, bound(dest), rv);
     context_clear_err(ctx);
 
-    // If we have consumed all of the buffer, reset it. This might prevent future writes to allocte new buffer
-    // in buffer_write/buffer_extend. Can improve things until a proper circular buffer is available
-    if (buffer_length(b) == 0) {
-        buffer_clear(b);
+    if (ringbuf_length(b) == 0) {
         pipe_unlock(pf->pipe);
         notify_dispatch(pf->f.ns, 0); /* for edge trigger */
         goto notify_writer;
@@ -196,12 +207,14 @@ closure_function(4, 1, sysreturn, pipe_write_bh,
 
     u64 length = bound(length);
     pipe p = pf->pipe;
-    buffer b = p->data;
+    ringbuf b = p->data;
     context ctx = get_current_context(current_cpu());
     pipe_lock(p);
-    u64 avail = p->max_size - buffer_length(b);
+    /* while spliced into, the ring tail is reserved */
+    u64 avail = p->filling ? 0 : p->max_size - ringbuf_length(b);
+    u64 real_length = avail ? pipe_reserve(p, MIN(length, avail)) : 0;
 
-    if (avail == 0) {
+    if (real_length == 0) {
         if (pf->pipe->files[PIPE_READ].fd == -1) {
             rv = -EPIPE;
             goto unlock;
@@ -214,9 +227,8 @@ closure_function(4, 1, sysreturn, pipe_write_bh,
         return blockq_block_required((unix_context)ctx, flags);
     }
 
-    u64 real_length = MIN(length, avail);
     if (!context_set_err(ctx)) {
-        assert(buffer_write(b, bound(dest), real_length));
+        ringbuf_write(b, bound(dest), real_length);
         context_clear_err(ctx);
         rv = real_length;
     } else {
@@ -251,7 +263,7 @@ closure_func_basic(fdesc_events, u32, pipe_read_events,
     pipe_file pf = struct_from_closure(pipe_file, events);
     assert(pf->f.read);
     pipe_lock(pf->pipe);
-    u32 events = buffer_length(pf->pipe->data) ? EPOLLIN : 0;
+    u32 events = ringbuf_length(pf->pipe->data) ? EPOLLIN : 0;
     if (pf->pipe->files[PIPE_WRITE].fd == -1)
         events |= EPOLLHUP;
     pipe_unlock(pf->pipe);
@@ -264,7 +276,7 @@ closure_func_basic(fdesc_events, u32, pipe_write_events,
     pipe_file pf = struct_from_closure(pipe_file, events);
     assert(pf->f.write);
     pipe_lock(pf->pipe);
-    u32 events = buffer_length(pf->pipe->data) < pf->pipe->max_size ? EPOLLOUT : 0;
+    u32 events = ringbuf_length(pf->pipe->data) < pf->pipe->max_size ? EPOLLOUT : 0;
     if (pf->pipe->files[PIPE_READ].fd == -1)
         events |= EPOLLHUP;
     pipe_unlock(pf->pipe);
@@ -303,8 +315,10 @@ int do_pipe2(int fds[2], int flags)
 
     pipe->ref_cnt = 0;
     pipe->max_size = DEFAULT_PIPE_MAX_SIZE;
+    pipe->filling = pipe->draining = false;
 
-    pipe->data = allocate_buffer(pipe->h, INITIAL_PIPE_DATA_SIZE);
+    /* the ring grows on demand up to max_size and is not shrunk when drained */
+    pipe->data = allocate_ringbuf(pipe->h, PIPE_MIN_CAPACITY);
     if (pipe->data == INVALID_ADDRESS) {
         msg_err("failed to allocate pipe's data buffer\n");
         goto err;
@@ -352,7 +366,8 @@ int do_pipe2(int fds[2], int flags)
             msg_err("failed to allocate blockq\n");
             apply(writer->f.close, 0, io_completion_ignore);
             deallocate_fd(pipe->proc, fds[PIPE_READ]);
-            fdesc_put(&pipe->files[PIPE_READ].f);
+            if (fdesc_put_removed(&pipe->files[PIPE_READ].f, 0))
+                apply(pipe->files[PIPE_READ].f.close, 0, io_completion_ignore);
             return -ENOMEM;
         }
         writer->fd = fds[PIPE_WRITE] = allocate_fd(pipe->proc, writer);
@@ -360,7 +375,8 @@ int do_pipe2(int fds[2], int flags)
             msg_err("failed to allocate fd\n");
             apply(writer->f.close, 0, io_completion_ignore);
             deallocate_fd(pipe->proc, fds[PIPE_READ]);
-            fdesc_put(&pipe->files[PIPE_READ].f);
+            if (fdesc_put_removed(&pipe->files[PIPE_READ].f, 0))
+                apply(pipe->files[PIPE_READ].f.close, 0, io_completion_ignore);
             return -EMFILE;
         }
     }
@@ -378,13 +394,18 @@ int pipe_set_capacity(fdesc f, int capacity)
     pipe p = pf->pipe;
     if (capacity < PIPE_MIN_CAPACITY)
         capacity = PIPE_MIN_CAPACITY;
+
+    /* ring capacity is a power of 2 */
+    u64 size = U64_FROM_BIT(find_order(capacity));
     int rv;
     pipe_lock(p);
-    if (capacity < buffer_length(p->data)) {
+    if ((size < ringbuf_length(p->data)) || p->filling || p->draining) {
         rv = -EBUSY;
     } else {
-        p->max_size = buffer_set_capacity(p->data, (bytes)capacity);
-        rv = (int)p->max_size;
+        if (p->data->length > size)
+            ringbuf_set_capacity(p->data, size);
+        p->max_size = size;
+        rv = (int)size;
     }
     pipe_unlock(p);
     return rv;
@@ -395,3 +416,370 @@ int pipe_get_capacity(fdesc f)
     pipe_file pf = (pipe_file)f;
     return (int)pf->pipe->max_size;
 }
+
+/* splice / tee
+
+   Data moves with a single copy, between the pipe ring and the other file (or the ring of the
+   other pipe). While I/O on the other file runs directly on ring memory, the ring region involved
+   is reserved (see 'filling' and 'draining'): the ring is not resized, and competing readers or
+   writers of the same pipe end wait for the reservation to be lifted. */
+
+#define pipe_splice_nonblock(pf, sflags) \
+    (((pf)->f.flags & O_NONBLOCK) || ((sflags) & SPLICE_F_NONBLOCK))
+
+closure_function(3, 1, void, pipe_splice_io_complete,
+                 pipe_file, pf, boolean, to_pipe, io_completion, completion,
+                 sysreturn rv)
+{
+    pipe_file pf = bound(pf);
+    pipe p = pf->pipe;
+    pipe_lock(p);
+    if (bound(to_pipe)) {
+        if (rv > 0)
+            ringbuf_produce(p->data, rv);
+        p->filling = false;
+    } else {
+        if (rv > 0)
+            ringbuf_consume(p->data, rv);
+        p->draining = false;
+    }
+    u32 events = ringbuf_length(p->data) ? EPOLLIN : 0;
+    pipe_unlock(p);
+    pipe_notify_reader(pf, events);
+    pipe_notify_writer(pf, EPOLLOUT);
+    apply(bound(completion), rv);
+    closure_finish();
+}
+
+closure_function(8, 1, sysreturn, pipe_splice_bh,
+                 pipe_file, pf, fdesc, f, u64, offset, u64, len, unsigned int, flags, boolean, to_pipe, boolean, bh, io_completion, completion,
+                 u64 bqflags)
+{
+    pipe_file pf = bound(pf);
+    pipe p = pf->pipe;
+    boolean to_pipe = bound(to_pipe);
+    sysreturn rv;
+
+    if (bqflags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+
+    context ctx = get_current_context(current_cpu());
+    pipe_lock(p);
+    ringbuf b = p->data;
+    void *ring_ptr = 0;
+    u64 n;
+    if (to_pipe) {
+        if (p->files[PIPE_READ].fd == -1) {
+            rv = -EPIPE;
+            goto unlock;
+        }
+        n = p->filling ? 0 : MIN(bound(len), p->max_size - ringbuf_length(b));
+        if (n > 0) {
+            n = pipe_reserve(p, n);
+            ring_ptr = b->contents + (b->end & (b->length - 1));
+        }
+    } else {
+        n = p->draining ? 0 : MIN(bound(len), ringbuf_length(b));
+        if ((n == 0) && !p->draining && (p->files[PIPE_WRITE].fd == -1)) {
+            rv = 0;
+            goto unlock;
+        }
+        ring_ptr = b->contents + (b->start & (b->length - 1));
+    }
+    if (n > 0)
+        n = MIN(n, b->contents + b->length - ring_ptr);   /* up to the ring wrap point */
+    if (n == 0) {
+        if (pipe_splice_nonblock(pf, bound(flags))) {
+            rv = -EAGAIN;
+            goto unlock;
+        }
+        pipe_unlock(p);
+        return blockq_block_required((unix_context)ctx, bqflags);
+    }
+    io_completion c = closure(p->h, pipe_splice_io_complete, pf, to_pipe, bound(completion));
+    if (c == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto unlock;
+    }
+    if (to_pipe)
+        p->filling = true;
+    else
+        p->draining = true;
+    pipe_unlock(p);
+    fdesc f = bound(f);
+    u64 offset = bound(offset);
+    boolean bh = bound(bh);
+    closure_finish();
+    if (to_pipe)
+        apply(f->read, ring_ptr, n, offset, ctx, true, c);
+    else
+        apply(f->write, ring_ptr, n, offset, ctx, true, c);
+    return ((bqflags & BLOCKQ_ACTION_BLOCKED) || bh) ? 0 :
+           thread_maybe_sleep_uninterruptible(current);
+  unlock:
+    pipe_unlock(p);
+  out:
+    apply(bound(completion), rv);
+    closure_finish();
+    return rv;
+}
+
+static void pipe_pair_lock(pipe a, pipe b)
+{
+    if (a < b) {
+        pipe_lock(a);
+        pipe_lock(b);
+    } else {
+        pipe_lock(b);
+        pipe_lock(a);
+    }
+}
+
+/* Pipe to pipe transfer: copies data from the head of the source ring to the tail of the
+   destination ring, and consumes it from the source unless this is a tee. */
+closure_function(6, 1, sysreturn, pipe_transfer_bh,
+                 pipe_file, in, pipe_file, out, u64, len, unsigned int, flags, boolean, consume, io_completion, completion,
+                 u64 bqflags)
+{
+    pipe_file in = bound(in), out = bound(out);
+    pipe src = in->pipe, dst = out->pipe;
+    sysreturn rv;
+
+    if (bqflags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+
+    context ctx = get_current_context(current_cpu());
+    pipe_pair_lock(src, dst);
+    ringbuf sb = src->data, db = dst->data;
+    if (dst->files[PIPE_READ].fd == -1) {
+        rv = -EPIPE;
+        goto unlock;
+    }
+    u64 n = src->draining ? 0 : MIN(bound(len), ringbuf_length(sb));
+    if ((n == 0) && !src->draining && (src->files[PIPE_WRITE].fd == -1)) {
+        rv = 0;
+        goto unlock;
+    }
+    if (n > 0) {
+        n = dst->filling ? 0 : MIN(n, dst->max_size - ringbuf_length(db));
+        if (n > 0)
+            n = pipe_reserve(dst, n);
+    }
+    if (n == 0) {
+        if (pipe_splice_nonblock(in, bound(flags)) || pipe_splice_nonblock(out, bound(flags))) {
+            rv = -EAGAIN;
+            goto unlock;
+        }
+        pipe_unlock(src);
+        pipe_unlock(dst);
+        return blockq_block_required((unix_context)ctx, bqflags);
+    }
+    void *head = sb->contents + (sb->start & (sb->length - 1));
+    u64 first = MIN(n, sb->contents + sb->length - head);
+    ringbuf_write(db, head, first);
+    if (first < n)
+        ringbuf_write(db, sb->contents, n - first);
+    if (bound(consume))
+        ringbuf_consume(sb, n);
+    rv = n;
+  unlock:
+    pipe_unlock(src);
+    pipe_unlock(dst);
+    if (rv > 0) {
+        pipe_notify_reader(out, EPOLLIN);
+        if (bound(consume))
+            pipe_notify_writer(in, EPOLLOUT);
+    }
+  out:
+    apply(bound(completion), rv);
+    closure_finish();
+    return rv;
+}
+
+/* Wakes a pipe to pipe transfer waiting on one pipe when the other pipe changes state. */
+closure_function(1, 2, u64, pipe_transfer_wake,
+                 blockq, bq,
+                 u64 events, void *arg)
+{
+    if (events == NOTIFY_EVENTS_RELEASE)
+        closure_finish();
+    else if (events)
+        blockq_wake_one(bound(bq));
+    return 0;
+}
+
+closure_function(5, 1, void, splice_complete,
+                 fdesc, in, fdesc, out, notify_set, ns, notify_entry, wake, io_completion, completion,
+                 sysreturn rv)
+{
+    if (bound(wake))
+        notify_remove(bound(ns), bound(wake), true);
+    fdesc_put(bound(in));
+    fdesc_put(bound(out));
+    apply(bound(completion), rv);
+    closure_finish();
+}
+
+/* Moves (or, for tee, copies) up to len bytes between two file descriptors, at least one of which
+   is a pipe. An offset of infinity on the non-pipe side means the file offset is used. The caller's
+   references to in and out are released on completion. */
+sysreturn pipe_splice(fdesc in, u64 off_in, fdesc out, u64 off_out, u64 len, unsigned int flags,
+                      boolean tee, context ctx, boolean bh, io_completion completion)
+{
+    sysreturn rv;
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (!fdesc_is_readable(in) || !fdesc_is_writable(out)) {
+        rv = -EBADF;
+        goto out;
+    }
+    boolean in_pipe = (in->type == FDESC_TYPE_PIPE);
+    boolean out_pipe = (out->type == FDESC_TYPE_PIPE);
+    if ((!in_pipe && !out_pipe) || (tee && !(in_pipe && out_pipe))) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if ((in_pipe && (off_in != infinity)) || (out_pipe && (off_out != infinity))) {
+        rv = -ESPIPE;
+        goto out;
+    }
+    if (in_pipe && out_pipe && (((pipe_file)in)->pipe == ((pipe_file)out)->pipe)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (len == 0) {
+        rv = 0;
+        goto out;
+    }
+    u64 offset = in_pipe ? off_out : off_in;
+    if ((offset != infinity) && ((s64)offset < 0)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (!(in_pipe ? out->write : in->read)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    pipe_file pf = (pipe_file)(in_pipe ? in : out);
+    heap h = pf->pipe->h;
+    notify_set ns = 0;
+    notify_entry wake = 0;
+    if (in_pipe && out_pipe) {
+        /* Wait on the input pipe; state changes of the output pipe (space made available, reader
+           closed) are forwarded to the same queue so that a waiter is never left on a pipe that
+           is no longer the reason for blocking. */
+        event_handler eh = closure(h, pipe_transfer_wake, pf->bq);
+        if (eh == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            goto out;
+        }
+        ns = out->ns;
+        wake = notify_add(ns, EPOLLOUT | EPOLLERR | EPOLLHUP, eh);
+        if (wake == INVALID_ADDRESS) {
+            deallocate_closure(eh);
+            rv = -ENOMEM;
+            goto out;
+        }
+    }
+    io_completion c = closure(h, splice_complete, in, out, ns, wake, completion);
+    if (c == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out_wake;
+    }
+    blockq_action ba;
+    if (in_pipe && out_pipe)
+        ba = closure_from_context(ctx, pipe_transfer_bh, (pipe_file)in, (pipe_file)out, len, flags,
+                                  !tee, c);
+    else if (in_pipe)
+        ba = closure_from_context(ctx, pipe_splice_bh, pf, out, offset, len, flags, false, bh, c);
+    else
+        ba = closure_from_context(ctx, pipe_splice_bh, pf, in, offset, len, flags, true, bh, c);
+    if (ba == INVALID_ADDRESS) {
+        deallocate_closure(c);
+        rv = -ENOMEM;
+        goto out_wake;
+    }
+    return blockq_check(pf->bq, ba, bh);
+  out_wake:
+    if (wake)
+        notify_remove(ns, wake, true);
+  out:
+    fdesc_put(in);
+    fdesc_put(out);
+    return io_complete(completion, rv);
+}
+
+closure_function(1, 1, void, splice_syscall_complete,
+                 s64 *, offp,
+                 sysreturn rv)
+{
+    if ((rv > 0) && bound(offp)) {
+        /* advance the offset of the file on the non-pipe side */
+        context ctx = get_current_context(current_cpu());
+        if (!context_set_err(ctx)) {
+            *bound(offp) += rv;
+            context_clear_err(ctx);
+        }
+    }
+    apply(syscall_io_complete, rv);
+    closure_finish();
+}
+
+static sysreturn do_splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len,
+                           unsigned int flags, boolean tee)
+{
+    fdesc in = resolve_fd(current->p, fd_in);
+    fdesc out = fdesc_get(current->p, fd_out);
+    if (!out) {
+        fdesc_put(in);
+        return -EBADF;
+    }
+    sysreturn rv;
+    fdesc f[2] = {in, out};
+    s64 *offp[2] = {off_in, off_out};
+    u64 offsets[2] = {infinity, infinity};
+    for (int i = 0; i < 2; i++) {
+        if (!offp[i])
+            continue;
+        if (f[i]->type == FDESC_TYPE_PIPE) {
+            rv = -ESPIPE;
+            goto out;
+        }
+        if (!get_user_value(offp[i], &offsets[i])) {
+            rv = -EFAULT;
+            goto out;
+        }
+        if ((s64)offsets[i] < 0) {
+            rv = -EINVAL;
+            goto out;
+        }
+    }
+    io_completion completion = closure(heap_locked(get_kernel_heaps()), splice_syscall_complete,
+                                       off_in ? off_in : off_out);
+    if (completion == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    return pipe_splice(in, offsets[0], out, offsets[1], len, flags, tee,
+                       get_current_context(current_cpu()), false, completion);
+  out:
+    fdesc_put(in);
+    fdesc_put(out);
+    return rv;
+}
+
+sysreturn splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len, unsigned int flags)
+{
+    return do_splice(fd_in, off_in, fd_out, off_out, len, flags, false);
+}
+
+sysreturn tee(int fd_in, int fd_out, u64 len, unsigned int flags)
+{
+    return do_splice(fd_in, 0, fd_out, 0, len, flags, true);
+}
@@ -24,6 +24,9 @@ typedef struct epollfd {
     boolean registered;
     boolean zombie; /* freed or masked by oneshot */
     notify_entry notify_handle;
+    struct list ready_l;    /* in a ready list shard, when ready is set */
+    boolean ready;
+    u32 ready_events;       /* pending edge-triggered events */
 } *epollfd;
 
 typedef struct epoll_blocked *epoll_blocked;
@@ -56,6 +59,15 @@ struct epoll_blocked {
     struct list blocked_list;
 };
 
+/* A shard of the epoll ready list: epollfds with pending events are queued on the shard of the
+   CPU that received the notification, and epoll_wait() collects them from all shards. Shards are
+   protected by their own lock, so that notifications don't contend with each other or with waiters
+   on the fd set. */
+typedef struct epoll_ready {
+    struct spinlock lock;
+    struct list head;
+} *epoll_ready;
+
 /* we call it an epoll, but these structs are used for select and poll too */
 struct epoll {
     struct fdesc f;             /* must be first */
@@ -70,12 +82,19 @@ struct epoll {
     vector events;              /* epollfds indexed by fd */
     int nfds;
     bitmap fds;                 /* fds being watched / epollfd registered */
+    epoll_ready ready;          /* ready list shards (epoll instances only) */
+    u64 ready_shards;
+    closure_struct(fdesc_ioctl, ioctl);
+    struct epoll_params busy_poll;  /* EPIOCSPARAMS */
+    struct net_napi *napi;      /* rx queue of the last network notification */
 };
 
 closure_func_basic(thunk, void, epoll_free)
 {
     epoll e = struct_from_closure(epoll, free);
     epoll_debug("e %p\n", e);
+    if (e->ready)
+        deallocate(e->h, e->ready, sizeof(struct epoll_ready) * e->ready_shards);
     deallocate_bitmap(e->fds);
     deallocate_vector(e->events);
     deallocate(epoll_heap, e, sizeof(*e));
@@ -125,6 +144,7 @@ static void reset_epollfd(epollfd efd, u32 eventmask, u64 data)
     efd->lastevents = 0;
     efd->zombie = false;
     efd->data = data;
+    efd->ready_events = 0;
 }
 
 static epollfd alloc_epollfd(epoll e, int fd, u32 eventmask, u64 data)
@@ -174,10 +194,61 @@ static void release_epollfd(epollfd efd)
 }
 
 static inline void poll_notify(epollfd efd, epoll_blocked w, u64 events);
-static inline boolean epoll_wait_notify(epollfd efd, epoll_blocked w, u64 report);
 static inline void select_notify(epollfd efd, epoll_blocked w, u64 report);
 static inline u32 report_from_notify_events(epollfd efd, u64 notify_events);
 
+/* Queues an epollfd on the ready list, and returns true if it was not queued already. Called with
+   efd->lock held. */
+static boolean epollfd_set_ready(epollfd efd, u32 report)
+{
+    efd->ready_events |= report;
+
+    /* now that these events are pending, update last */
+    efd->lastevents |= report;
+    if (efd->ready)
+        return false;
+    epoll e = efd->e;
+    epoll_ready r = &e->ready[current_cpu()->id % e->ready_shards];
+    efd->ready = true;
+    refcount_reserve(&efd->refcount);   /* ready list */
+    spin_lock(&r->lock);
+    list_push_back(&r->head, &efd->ready_l);
+    spin_unlock(&r->lock);
+    return true;
+}
+
+static boolean epoll_ready_pending(epoll e)
+{
+    for (u64 i = 0; i < e->ready_shards; i++)
+        if (!list_empty(&e->ready[i].head))
+            return true;
+    return false;
+}
+
+/* Wakes up a single waiter (optionally restricted to thread t), and moves it to the back of the
+   waiter list so that subsequent wakeups are spread among waiters. Returns false if there are no
+   matching waiters. */
+static boolean epoll_wake_waiter(epoll e, thread t)
+{
+    epoll_blocked w = 0;
+    spin_lock(&e->blocked_lock);
+    list_foreach(&e->blocked_head, l) {
+        epoll_blocked elem = struct_from_list(l, epoll_blocked, blocked_list);
+        if (!t || (elem->t == t)) {
+            w = elem;
+            list_delete(l);
+            list_push_back(&e->blocked_head, l);
+            break;
+        }
+    }
+    if (w) {
+        epoll_debug("   waking waiter %p (tid %d)\n", w, w->t->tid);
+        blockq_wake_one(w->t->thread_bq);
+    }
+    spin_unlock(&e->blocked_lock);
+    return (w != 0);
+}
+
 closure_function(1, 2, u64, wait_notify,
                  epollfd, efd,
                  u64 notify_events, void *t)
@@ -201,13 +272,24 @@ closure_function(1, 2, u64, wait_notify,
     }
 
     u32 events = (u32)notify_events;
-    if (efd->e->epoll_type == EPOLL_TYPE_EPOLL)
-        events = report_from_notify_events(efd, events);
     u64 rv = 0;
+    if (efd->e->epoll_type == EPOLL_TYPE_EPOLL) {
+        /* Only one waiter is woken up per ready transition; with EPOLLEXCLUSIVE, a wakeup also
+           consumes the notification, so that other epoll instances are not woken up. */
+        events = report_from_notify_events(efd, events);
+        epoll_debug("efd->fd %d, events 0x%x\n", efd->fd, events);
+        struct net_napi *napi = current_cpu()->net_rx_napi;
+        if (napi)
+            efd->e->napi = napi;
+        if (events && (epollfd_set_ready(efd, events) || t) && epoll_wake_waiter(efd->e, t) &&
+            (efd->eventmask & EPOLLEXCLUSIVE))
+            rv = NOTIFY_RESULT_CONSUMED;
+        spin_unlock(&efd->lock);
+        return rv;
+    }
     epoll_blocked w;
     spin_lock(&efd->e->blocked_lock);
     list l = list_get_next(&efd->e->blocked_head);
-  notify_blocked:
     w = l ? struct_from_list(l, epoll_blocked, blocked_list) : 0;
     epoll_debug("efd->fd %d, events 0x%x, blocked %p, zombie %d\n",
                 efd->fd, events, w, efd->zombie);
@@ -222,15 +304,6 @@ closure_function(1, 2, u64, wait_notify,
     case EPOLL_TYPE_POLL:
         poll_notify(efd, w, events);
         break;
-    case EPOLL_TYPE_EPOLL:
-        if (epoll_wait_notify(efd, w, events))
-            rv |= NOTIFY_RESULT_CONSUMED;
-        if (!(rv & NOTIFY_RESULT_CONSUMED) || !(efd->eventmask & EPOLLEXCLUSIVE)) {
-            l = l->next;
-            if (l != &efd->e->blocked_head)
-                goto notify_blocked;
-        }
-        break;
     case EPOLL_TYPE_SELECT:
         select_notify(efd, w, events);
         break;
@@ -278,10 +351,33 @@ static void epoll_release_epollfds(epoll e)
     spin_wunlock(&e->fds_lock);
 }
 
+/* Drops the ready list references; no notifications can be received after the epollfds have been
+   released. */
+static void epoll_drain_ready(epoll e)
+{
+    for (u64 i = 0; i < e->ready_shards; i++) {
+        epoll_ready r = &e->ready[i];
+        spin_lock(&r->lock);
+        list l;
+        while ((l = list_get_next(&r->head))) {
+            list_delete(l);
+            spin_unlock(&r->lock);
+            epollfd efd = struct_from_list(l, epollfd, ready_l);
+            spin_lock(&efd->lock);
+            efd->ready = false;
+            spin_unlock(&efd->lock);
+            refcount_release(&efd->refcount);
+            spin_lock(&r->lock);
+        }
+        spin_unlock(&r->lock);
+    }
+}
+
 void epoll_finish(epoll e)
 {
     epoll_debug("e %p\n", e);
     epoll_release_epollfds(e);
+    epoll_drain_ready(e);
     refcount_release(&e->refcount);
 }
 
@@ -294,14 +390,51 @@ closure_func_basic(fdesc_close, sysreturn, epoll_close,
     return io_complete(completion, 0);
 }
 
+closure_func_basic(fdesc_ioctl, sysreturn, epoll_ioctl,
+                   unsigned long request, vlist ap)
+{
+    epoll e = struct_from_closure(epoll, ioctl);
+    switch (request) {
+    case EPIOCSPARAMS: {
+        struct epoll_params *uparams = varg(ap, struct epoll_params *);
+        struct epoll_params params;
+        if (!copy_from_user(uparams, &params, sizeof(params)))
+            return -EFAULT;
+        if (params.__pad || (params.prefer_busy_poll > 1) ||
+            (params.busy_poll_usecs > S32_MAX))
+            return -EINVAL;
+        e->busy_poll = params;
+        return 0;
+    }
+    case EPIOCGPARAMS:
+        if (!copy_to_user(varg(ap, struct epoll_params *), &e->busy_poll, sizeof(e->busy_poll)))
+            return -EFAULT;
+        return 0;
+    default:
+        return ioctl_generic(&e->f, request, ap);
+    }
+}
+
 sysreturn epoll_create(int flags)
 {
     epoll_debug("flags 0x%x\n", flags);
     epoll e = epoll_alloc_internal(EPOLL_TYPE_EPOLL);
     if (e == INVALID_ADDRESS)
         return -ENOMEM;
+    e->ready = allocate(e->h, sizeof(struct epoll_ready) * total_processors);
+    if (e->ready == INVALID_ADDRESS) {
+        e->ready = 0;
+        refcount_release(&e->refcount);
+        return -ENOMEM;
+    }
+    e->ready_shards = total_processors;
+    for (u64 i = 0; i < e->ready_shards; i++) {
+        spin_lock_init(&e->ready[i].lock);
+        list_init(&e->ready[i].head);
+    }
     init_fdesc(e->h, &e->f, FDESC_TYPE_EPOLL);
     e->f.close = init_closure_func(&e->close, fdesc_close, epoll_close);
+    e->f.ioctl = init_closure_func(&e->ioctl, fdesc_ioctl, epoll_ioctl);
     u64 fd = allocate_fd(current->p, e);
     if (fd == INVALID_PHYSICAL) {
         apply(e->f.close, 0, io_completion_ignore);
@@ -326,11 +459,17 @@ static void epoll_blocked_release(epoll_blocked w, u64 bq_flags)
 {
     epoll_debug("w %p\n", w);
 
-    spin_lock(&w->e->blocked_lock);
+    epoll e = w->e;
+    spin_lock(&e->blocked_lock);
     assert(!list_empty(&w->blocked_list));
     list_delete(&w->blocked_list);
-    spin_unlock(&w->e->blocked_lock);
+    spin_unlock(&e->blocked_lock);
     list_init(&w->blocked_list);
+
+    /* Events left in the ready list (e.g. level-triggered events, or events beyond maxevents) are
+       passed on to another waiter. */
+    if (e->ready && epoll_ready_pending(e))
+        epoll_wake_waiter(e, 0);
     refcount_release(&w->refcount);
 }
 
@@ -354,56 +493,80 @@ static inline u32 report_from_notify_events(epollfd efd, u64 notify_events)
     return edge_detect ? ~efd->lastevents & events : events;
 }
 
-static inline boolean epoll_wait_notify(epollfd efd, epoll_blocked w, u64 report)
+/* Collects pending events from the ready list into the user buffer of a waiter, and returns the
+   number of events collected. Level-triggered epollfds that still have events are queued again, so
+   that they are reported by subsequent calls. Called from the waiter's syscall context. */
+static int epoll_collect_ready(epoll e, epoll_blocked w)
 {
-    if (report == 0)
-        return false;
-
-    spin_lock(&w->lock);
-    if (!w->user_events || (w->user_events->length - w->user_events->end) <= 0) {
-        spin_unlock(&w->lock);
-        epoll_debug("   user_events null or full\n");
-        return false;
-    }
+    buffer b = w->user_events;
+    int count = 0;
+    int max = (b->length - b->end) / sizeof(struct epoll_event);
+    struct list requeue;
+    list_init(&requeue);
     context ctx = get_current_context(current_cpu());
-    if (is_kernel_context(ctx)) {
-        /* Borrow the thread's fault handler prior to touching user memory. */
-        use_fault_handler(w->t->context.fault_handler);
-    }
-    if (context_set_err(ctx)) {
-        w->retval = -EFAULT;
-        goto out;
+    u64 start = current_cpu()->id;
+    for (u64 i = 0; (i < e->ready_shards) && (count < max); i++) {
+        epoll_ready r = &e->ready[(start + i) % e->ready_shards];
+        if (list_empty(&r->head))
+            continue;
+        spin_lock(&r->lock);
+        list l;
+        while ((count < max) && (l = list_get_next(&r->head))) {
+            list_delete(l);
+            spin_unlock(&r->lock);
+            epollfd efd = struct_from_list(l, epollfd, ready_l);
+            u32 events;
+            u64 data;
+            boolean keep = false;
+            spin_lock(&efd->lock);
+            if (efd->zombie || !efd->registered) {
+                events = 0;
+            } else if (efd->eventmask & EPOLLET) {
+                events = efd->ready_events;
+            } else {
+                events = apply(efd->f->events, w->t) & (efd->eventmask | POLL_EXCEPTIONS);
+                keep = (events != 0);
+            }
+            efd->ready_events = 0;
+            data = efd->data;
+            if (events && (efd->eventmask & EPOLLONESHOT)) {
+                efd->zombie = true;
+                keep = false;
+            }
+            if (keep)
+                list_push_back(&requeue, &efd->ready_l);
+            else
+                efd->ready = false;
+            spin_unlock(&efd->lock);
+            if (!keep)
+                refcount_release(&efd->refcount);   /* ready list */
+            if (events) {
+                if (!context_set_err(ctx)) {
+                    struct epoll_event *ev = buffer_ref(b, b->end);
+                    ev->data = data;
+                    ev->events = events;
+                    context_clear_err(ctx);
+                    b->end += sizeof(struct epoll_event);
+                    count++;
+                    epoll_debug("   epoll_event %p, data 0x%lx, events 0x%x\n", ev, data, events);
+                } else {
+                    w->retval = -EFAULT;
+                }
+            }
+            spin_lock(&r->lock);
+        }
+        spin_unlock(&r->lock);
     }
-    struct epoll_event *e, *end;
-    e = buffer_ref(w->user_events, 0);
-    end = buffer_ref(w->user_events, w->user_events->end);
-    while (e < end) {
-        if (e->data == efd->data) {
-            /* Use the union of reported events so that edge triggers aren't missed. */
-            e->events |= report;
-            goto reported;
+    if (!list_empty(&requeue)) {
+        epoll_ready r = &e->ready[start % e->ready_shards];
+        spin_lock(&r->lock);
+        list_foreach(&requeue, l) {
+            list_delete(l);
+            list_push_back(&r->head, l);
         }
-        e++;
+        spin_unlock(&r->lock);
     }
-    e->data = efd->data;
-    e->events = report;
-    w->user_events->end += sizeof(struct epoll_event);
-  reported:
-    epoll_debug("   epoll_event %p, data 0x%lx, events 0x%x\n", e, e->data, e->events);
-    context_clear_err(ctx);
-  out:
-    if (is_kernel_context(ctx))
-        clear_fault_handler();
-    spin_unlock(&w->lock);
-    
-    /* XXX check this */
-    if (efd->eventmask & EPOLLONESHOT)
-        efd->zombie = true;
-
-    /* now that we've reported these events, update last */
-    efd->lastevents |= report;
-    blockq_wake_one(w->t->thread_bq);
-    return true;
+    return count;
 }
 
 static epoll_blocked alloc_epoll_blocked(epoll e)
@@ -438,9 +601,6 @@ static void check_fdesc(epollfd efd, epoll_blocked w)
     case EPOLL_TYPE_POLL:
         poll_notify(efd, w, events);
         break;
-    case EPOLL_TYPE_EPOLL:
-        epoll_wait_notify(efd, w, report_from_notify_events(efd, events));
-        break;
     case EPOLL_TYPE_SELECT:
         select_notify(efd, w, events);
         break;
@@ -461,7 +621,7 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     epoll_blocked w = bound(w);
     timestamp timeout = bound(timeout);
     spin_lock(&w->lock);
-    int eventcount = user_event_count(w);
+    int eventcount = epoll_collect_ready(w->e, w);
 
     epoll_debug("w %p on tid %d, timeout %ld, flags 0x%lx, event count %d\n",
                 w, t->tid, timeout, flags, eventcount);
@@ -483,6 +643,10 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     spin_unlock(&w->lock);
 
     epoll_debug("  continue blocking\n");
+    epoll e = w->e;
+    struct net_napi *napi = e->napi;
+    if (e->busy_poll.busy_poll_usecs && napi)
+        net_busy_poll(napi, e->busy_poll.busy_poll_usecs);
     return blockq_block_required(&bound(t)->syscall->uc, flags);
   out_wakeup:
     unwrap_buffer(w->e->h, w->user_events);
@@ -522,24 +686,7 @@ sysreturn epoll_wait(int epfd,
     w->user_events->end = 0;
     spin_unlock(&w->lock);
 
-    spin_rlock(&e->fds_lock);
-    bitmap_foreach_set(e->fds, fd) {
-        epollfd efd = vector_get(e->events, fd);
-        assert(efd);
-        assert(efd->fd == fd);
-
-        if (efd->zombie)
-            continue;
-
-        /* event transitions may in some cases need to be polled for
-           (e.g. due to change in lwIP internal state), so request a check */
-        spin_lock(&efd->lock);
-        if (efd->registered)
-            check_fdesc(efd, w);
-        spin_unlock(&efd->lock);
-    }
-    spin_runlock(&e->fds_lock);
-
+    /* Only the ready list is looked at (by epoll_wait_bh), not the whole set of registered fds. */
     timestamp ts = (timeout > 0) ? milliseconds(timeout) : 0;
     return blockq_check_timeout(w->t->thread_bq,
                                 contextual_closure(epoll_wait_bh, w, current,
@@ -556,20 +703,27 @@ static epollfd epollfd_from_fd(epoll e, int fd)
     return efd;
 }
 
+/* Called with efd->lock held. */
 static void epollfd_update(epollfd efd)
 {
     /* It may seem excessive to perform a check for all
        waiters. However, thanks to thread-specific fd events (thanks
        in turn to signalfd), we could have independent events for
        multiple threads that require waking - even on the same fd. */
-
-    spin_lock(&efd->e->blocked_lock);
-    list_foreach(&efd->e->blocked_head, l) {
+    epoll e = efd->e;
+    fdesc f = efd->f;
+    u32 mask = efd->eventmask | POLL_EXCEPTIONS;
+    u32 events = apply(f->events, current) & mask;
+    spin_lock(&e->blocked_lock);
+    list_foreach(&e->blocked_head, l) {
         epoll_blocked w = struct_from_list(l, epoll_blocked, blocked_list);
         epoll_debug("   posting check for blocked waiter (tid %d)\n", w->t->tid);
-        check_fdesc(efd, w);
+        events |= apply(f->events, w->t) & mask;
     }
-    spin_unlock(&efd->e->blocked_lock);
+    spin_unlock(&e->blocked_lock);
+    events = report_from_notify_events(efd, events);
+    if (events && epollfd_set_ready(efd, events))
+        epoll_wake_waiter(e, 0);
 }
 
 static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
@@ -595,10 +749,9 @@ static sysreturn epoll_add_fd(epoll e, int fd, u32 events, u64 data)
     } else {
         reset_epollfd(efd, events, data);
     }
-    register_epollfd(efd);
-
     /* apply check(s) for any current waiters */
-    epollfd_update(efd);
+    if (register_epollfd(efd))
+        epollfd_update(efd);
     spin_unlock(&efd->lock);
     return 0;
 }
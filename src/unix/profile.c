@@ -0,0 +1,317 @@
+/* Sampling CPU profiler
+ *
+ * While profiling is enabled, a periodic timer sends an IPI to all CPUs, and each CPU records the
+ * call chain of the code it interrupted: the kernel stack, unwound via frame pointers from the
+ * interrupted frame, followed by the user stack of the current thread (if any; user programs must be
+ * built with frame pointers to get more than the sampled instruction). Samples are stored in per-CPU
+ * buffers allocated when the profiler is initialized, so that the sampling interrupt handler never
+ * allocates memory; when a buffer is full, further samples on that CPU are counted as dropped.
+ *
+ * Samples are retrieved over HTTP in the text format produced by `perf script`, which flame graph
+ * tools accept as is:
+ *   curl http://<address>:9091/profile/start
+ *   curl http://<address>:9091/profile/samples > out.perf
+ *   stackcollapse-perf.pl out.perf | flamegraph.pl > profile.svg
+ */
+
+#include <unix_internal.h>
+#include <http.h>
+#include <symtab.h>
+
+#define PROFILE_PORT            9091
+#define PROFILE_URI             "profile"
+#define PROFILE_FREQ_DEFAULT    97      /* Hz; not a round number, to avoid lockstep with timers */
+#define PROFILE_FREQ_MAX        10000
+#define PROFILE_SAMPLES_PER_CPU 4096
+#define PROFILE_MAX_DEPTH       32
+#define PROFILE_HTTP_CHUNK_MAXSIZE  (64*KB)
+
+typedef struct profile_sample {
+    timestamp ts;
+    int tid;                    /* 0 for kernel contexts */
+    u8 kernel_depth;
+    u8 user_depth;
+    char comm[16];
+    u64 pcs[PROFILE_MAX_DEPTH]; /* kernel frames followed by user frames, innermost first */
+} *profile_sample;
+
+typedef struct profile_cpu {
+    profile_sample samples;
+    u64 count;
+    u64 dropped;
+} *profile_cpu;
+
+static struct {
+    heap h;
+    boolean enabled;
+    u64 freq;
+    u64 ipi_vector;
+    profile_cpu cpus;
+    struct timer timer;
+    closure_struct(timer_handler, timer_func);
+    closure_struct(thunk, sample_func);
+    http_listener hl;
+} profile;
+
+/* Unwinds a stack via frame pointers; frames outside of the stack address space (kernel or user) of
+ * the sampled code stop the unwinding, as do frames that do not move toward the stack base. */
+static int profile_unwind(u64 *pcs, int max, u64 pc, u64 *fp, boolean user)
+{
+    int depth = 0;
+    if (max == 0)
+        return 0;
+    pcs[depth++] = pc;
+    while (depth < max) {
+        if ((u64_from_pointer(fp) & (sizeof(u64) - 1)) || (is_kernel_memory(fp) == user) ||
+            !validate_frame_ptr(fp))
+            break;
+        u64 *nfp;
+        u64 *rap = get_frame_ra_ptr(fp, &nfp);
+        if (!rap || (*rap == 0))
+            break;
+        pcs[depth++] = *rap;
+        if (nfp <= fp)
+            break;
+        fp = nfp;
+    }
+    return depth;
+}
+
+closure_func_basic(thunk, void, profile_sample_handler)
+{
+    if (!profile.enabled)
+        return;
+    cpuinfo ci = current_cpu();
+    profile_cpu pc = &profile.cpus[ci->id];
+    if (pc->count == PROFILE_SAMPLES_PER_CPU) {
+        pc->dropped++;
+        return;
+    }
+    profile_sample s = &pc->samples[pc->count];
+    context ctx = get_current_context(ci);
+    context_frame f = ctx->frame;
+    thread t = 0;
+    context_frame uf = 0;
+    s->kernel_depth = 0;
+    switch (ctx->type) {
+    case CONTEXT_TYPE_THREAD:
+        t = (thread)ctx;
+        uf = f;
+        break;
+    case CONTEXT_TYPE_SYSCALL:
+        t = ((syscall_context)ctx)->t;
+        uf = t->context.frame;
+        /* fall through */
+    default:
+        s->kernel_depth = profile_unwind(s->pcs, PROFILE_MAX_DEPTH, frame_fault_pc(f),
+                                         pointer_from_u64(f[FRAME_RBP]), false);
+    }
+    if (t) {
+        s->tid = t->tid;
+        runtime_memcpy(s->comm, t->name, sizeof(s->comm));
+        s->comm[sizeof(s->comm) - 1] = '\0';
+        s->user_depth = profile_unwind(s->pcs + s->kernel_depth,
+                                       PROFILE_MAX_DEPTH - s->kernel_depth, frame_fault_pc(uf),
+                                       pointer_from_u64(uf[FRAME_RBP]), true);
+    } else {
+        s->tid = 0;
+        runtime_memcpy(s->comm, "kernel", sizeof("kernel"));
+        s->user_depth = 0;
+    }
+    s->ts = now(CLOCK_ID_MONOTONIC);
+    write_barrier();
+    pc->count++;
+}
+
+closure_func_basic(timer_handler, void, profile_timer_func,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns == timer_disabled || !profile.enabled)
+        return;
+    send_ipi(TARGET_EXCLUSIVE_BROADCAST, profile.ipi_vector);
+    /* the local CPU records the timer handler itself, accounting for the profiler overhead */
+    send_ipi(current_cpu()->id, profile.ipi_vector);
+}
+
+static void profile_start(void)
+{
+    if (profile.enabled)
+        return;
+    profile.enabled = true;
+    timestamp period = nanoseconds(BILLION / profile.freq);
+    register_timer(kernel_timers, &profile.timer, CLOCK_ID_MONOTONIC, period, false, period,
+                   (timer_handler)&profile.timer_func);
+}
+
+static void profile_stop(void)
+{
+    if (!profile.enabled)
+        return;
+    profile.enabled = false;
+    remove_timer(kernel_timers, &profile.timer, 0);
+}
+
+static void profile_reset(void)
+{
+    profile_stop();
+    for (u64 i = 0; i < total_processors; i++) {
+        profile.cpus[i].count = 0;
+        profile.cpus[i].dropped = 0;
+    }
+}
+
+/* User frames are resolved from the program and interpreter symbols, which are in the symbol table
+ * if ingest_program_symbols is set in the manifest. */
+static void profile_print_frame(buffer b, u64 pc, boolean user)
+{
+    sstring module = user ? ss("[user]") : ss("[kernel.kallsyms]");
+    u64 offset;
+    sstring name = find_elf_sym(pc, &offset, 0);
+    if (sstring_is_null(name))
+        bprintf(b, "\t%16lx [unknown] (%s)\n", pc, module);
+    else
+        bprintf(b, "\t%16lx %s+0x%lx (%s)\n", pc, name, offset, module);
+}
+
+static void profile_print_sample(buffer b, int cpu, profile_sample s)
+{
+    u64 usec = usec_from_timestamp(s->ts);
+    bprintf(b, "%s %d [%03d] %ld.%06ld: 1 cpu-clock:\n", sstring_from_cstring(s->comm, sizeof(s->comm)),
+            s->tid, cpu, usec / MILLION, usec % MILLION);
+    for (int i = 0; i < s->kernel_depth; i++)
+        profile_print_frame(b, s->pcs[i], false);
+    for (int i = 0; i < s->user_depth; i++)
+        profile_print_frame(b, s->pcs[s->kernel_depth + i], true);
+    bprintf(b, "\n");
+}
+
+#define catch_err(s) do {if (!is_ok(s)) msg_err("profile: failed to send HTTP response: %v\n", (s));} while(0)
+
+static void profile_send_http_response(http_responder handler, buffer b)
+{
+    catch_err(send_http_response(handler, timm("ContentType", "text/plain"), b));
+}
+
+static void profile_send_http_error(http_responder handler, sstring status, sstring msg)
+{
+    buffer b = aprintf(profile.h, "<html><head><title>%s %s</title></head>"
+                       "<body><h1>%s</h1></body></html>\r\n", status, msg, msg);
+    catch_err(send_http_response(handler, timm("status", "%s %s", status, msg), b));
+}
+
+/* Sampling is suspended while samples are being sent, so that the per-CPU buffers are stable. */
+static void profile_send_samples(http_responder out)
+{
+    boolean enabled = profile.enabled;
+    profile_stop();
+    catch_err(send_http_chunked_response(out, timm("ContentType", "text/plain")));
+    buffer b = 0;
+    u64 dropped = 0;
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        profile_cpu pc = &profile.cpus[cpu];
+        u64 count = pc->count;
+        read_barrier();
+        dropped += pc->dropped;
+        for (u64 i = 0; i < count; i++) {
+            if (!b) {
+                b = allocate_buffer(profile.h, PROFILE_HTTP_CHUNK_MAXSIZE);
+                assert(b != INVALID_ADDRESS);
+            }
+            profile_print_sample(b, cpu, &pc->samples[i]);
+            if (buffer_length(b) > PROFILE_HTTP_CHUNK_MAXSIZE - 4*KB) {
+                send_http_chunk(out, b);
+                b = 0;
+            }
+        }
+    }
+    if (b)
+        send_http_chunk(out, b);
+    if (dropped)
+        msg_warn("profile: %ld samples dropped\n", dropped);
+    send_http_chunk(out, 0);
+    if (enabled)
+        profile_start();
+}
+
+closure_func_basic(http_request_handler, void, profile_http_request,
+                   http_method method, http_responder handler, value val)
+{
+    string relative_uri = get_string(val, sym(relative_uri));
+    if (!relative_uri) {
+        profile_send_http_error(handler, ss("500"), ss("Internal Server Error"));
+        return;
+    }
+    if (method != HTTP_REQUEST_METHOD_GET) {
+        profile_send_http_error(handler, ss("501"), ss("Not Implemented"));
+        return;
+    }
+    if (!buffer_strcmp(relative_uri, "samples")) {
+        profile_send_samples(handler);
+    } else if (!buffer_strcmp(relative_uri, "start")) {
+        profile_start();
+        profile_send_http_response(handler, aprintf(profile.h, "profiling started at %ld Hz\n",
+                                                    profile.freq));
+    } else if (!buffer_strcmp(relative_uri, "stop")) {
+        profile_stop();
+        profile_send_http_response(handler, aprintf(profile.h, "profiling stopped\n"));
+    } else if (!buffer_strcmp(relative_uri, "reset")) {
+        profile_reset();
+        profile_send_http_response(handler, aprintf(profile.h, "profiling stopped, samples cleared\n"));
+    } else {
+        profile_send_http_error(handler, ss("404"), ss("Not Found"));
+    }
+}
+
+static void profile_init_http_listener(void)
+{
+    profile.hl = allocate_http_listener(profile.h, PROFILE_PORT);
+    if (profile.hl == INVALID_ADDRESS) {
+        msg_err("could not allocate profile HTTP listener\n");
+        return;
+    }
+    http_register_uri_handler(profile.hl, ss(PROFILE_URI),
+                              closure_func(profile.h, http_request_handler, profile_http_request));
+    status s = listen_port(profile.h, PROFILE_PORT, connection_handler_from_http_listener(profile.hl));
+    if (!is_ok(s)) {
+        msg_err("listen_port(port=%d) failed for profile HTTP listener\n", PROFILE_PORT);
+        deallocate_http_listener(profile.h, profile.hl);
+        return;
+    }
+    rprintf("started profile http listener on port %d\n", PROFILE_PORT);
+}
+
+/* The sampling frequency can be set with "profile:(frequency:<Hz>)" in the manifest root, and
+ * "profile:(start:t)" enables sampling from boot. */
+void profile_init(kernel_heaps kh, tuple root)
+{
+    profile.h = heap_locked(kh);
+    profile.freq = PROFILE_FREQ_DEFAULT;
+    tuple config = get_tuple(root, sym(profile));
+    if (config) {
+        u64 freq;
+        if (get_u64(config, sym(frequency), &freq)) {
+            if ((freq > 0) && (freq <= PROFILE_FREQ_MAX))
+                profile.freq = freq;
+            else
+                msg_err("profile: invalid frequency %ld\n", freq);
+        }
+    }
+    profile.cpus = allocate_zero(profile.h, present_processors * sizeof(struct profile_cpu));
+    assert(profile.cpus != INVALID_ADDRESS);
+    heap backed = (heap)heap_page_backed(kh);
+    for (u64 i = 0; i < present_processors; i++) {
+        profile.cpus[i].samples = allocate(backed,
+                                           PROFILE_SAMPLES_PER_CPU * sizeof(struct profile_sample));
+        assert(profile.cpus[i].samples != INVALID_ADDRESS);
+    }
+    init_timer(&profile.timer);
+    init_closure_func(&profile.timer_func, timer_handler, profile_timer_func);
+    profile.ipi_vector = allocate_ipi_interrupt();
+    assert(profile.ipi_vector != INVALID_PHYSICAL);
+    register_interrupt(profile.ipi_vector,
+                       init_closure_func(&profile.sample_func, thunk, profile_sample_handler),
+                       ss("profile ipi"));
+    profile_init_http_listener();
+    if (config && get(config, sym(start)))
+        profile_start();
+}
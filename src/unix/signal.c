@@ -527,14 +527,6 @@ sysreturn rt_sigsuspend(const u64 * mask, u64 sigsetsize)
     return blockq_check(t->thread_bq, ba, false);
 }
 
-static boolean thread_is_on_altsigstack(thread t)
-{
-    return t->signal_stack != 0 &&
-        point_in_range(irangel(u64_from_pointer(t->signal_stack),
-                               t->signal_stack_length),
-                       thread_frame(t)[SYSCALL_FRAME_SP]);
-}
-
 sysreturn sigaltstack(const stack_t *ss, stack_t *oss)
 {
     thread t = current;
@@ -1092,19 +1084,18 @@ static void default_signal_action(thread t, queued_signal qs)
     halt_with_code(VM_EXIT_SIGNAL(signum), ss("%s\n"), fate);
 }
 
-boolean dispatch_signals(thread t)
+/* undo the temporary mask of rt_sigsuspend */
+static inline void restore_saved_signal_mask(thread t)
 {
-    /* dequeue (and thus reset) a pending signal */
-    queued_signal qs = dequeue_signal(t, get_signal_mask(t));
-
     if (t->saved_signal_mask != -1ull) {
         set_signal_mask(t, t->saved_signal_mask);
         t->saved_signal_mask = -1ull;
     }
+}
 
-    if (qs == INVALID_ADDRESS)
-        return false;
-
+/* returns true if a handler frame has been set up for the signal */
+static boolean dispatch_signal(thread t, queued_signal qs)
+{
     /* act on signal disposition */
     struct siginfo *si = &qs->si;
     int signum = si->si_signo;
@@ -1159,6 +1150,29 @@ boolean dispatch_signals(thread t)
     return true;
 }
 
+/* Delivers all signals pending for the thread and not masked: the handler frames of successive
+   signals are stacked on one another, each handler returning to the previous one, so that a burst
+   of signals is handled on a single return to user mode. */
+boolean dispatch_signals(thread t)
+{
+    /* Lockless check of the pending bitmaps: a signal that is queued concurrently also makes the
+       sender interrupt or wake the thread, and is dispatched on its next return to user mode. */
+    if (!(get_all_pending_signals(t) & ~get_signal_mask(t)) && (t->saved_signal_mask == -1ull))
+        return false;
+
+    boolean dispatched = false;
+    queued_signal qs;
+
+    /* dequeue (and thus reset) pending signals */
+    while ((qs = dequeue_signal(t, get_signal_mask(t))) != INVALID_ADDRESS) {
+        restore_saved_signal_mask(t);
+        if (dispatch_signal(t, qs))
+            dispatched = true;
+    }
+    restore_saved_signal_mask(t);
+    return dispatched;
+}
+
 void register_signal_syscalls(struct syscall *map)
 {
 #ifdef __x86_64__
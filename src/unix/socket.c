@@ -32,6 +32,15 @@ typedef struct unixsock {
     closure_struct(event_handler, event_handler);
     closure_struct(thunk, free);
     struct refcount refcount;
+
+    /* Buffer of a reader blocked on an empty stream socket, into which writers copy data directly
+     * instead of queueing it. */
+    struct {
+        void *owner;    /* blockq action of the reader */
+        void *buf;
+        u64 len;
+        u64 filled;
+    } rx_direct;
 } *unixsock;
 
 #define unixsock_lock(s)    spin_lock(&(s)->sock.f.lock)
@@ -187,15 +196,24 @@ closure_function(7, 1, sysreturn, unixsock_read_bh,
 
     sharedbuf shb;
     sysreturn rv;
+    boolean disconnected;
+    boolean was_full = false;
+    boolean read_done = false;
+    boolean offered = false;
+    context ctx = get_current_context(current_cpu());
 
     unixsock_lock(s);
-    boolean disconnected = unixsock_is_conn_oriented(s) && !(s->peer && s->peer->data);
-    boolean read_done = false;
+  retry:
+    disconnected = unixsock_is_conn_oriented(s) && !(s->peer && s->peer->data);
+    if ((s->rx_direct.owner == closure_self()) && s->rx_direct.filled) {
+        rv = s->rx_direct.filled;
+        goto out;
+    }
     if ((flags & BLOCKQ_ACTION_NULLIFY) && !disconnected) {
         rv = -ERESTARTSYS;
         goto out;
     }
-    context ctx = get_current_context(current_cpu());
+    was_full = (s->sock.rx_len >= so_rcvbuf) || queue_full(s->data);
     shb = queue_peek(s->data);
     if (shb == INVALID_ADDRESS) {
         if (disconnected) {
@@ -205,6 +223,25 @@ closure_function(7, 1, sysreturn, unixsock_read_bh,
             rv = -EAGAIN;
             goto out;
         }
+
+        /* Offer the buffer to writers before blocking. It is faulted in beforehand (and thus only
+         * on the first invocation, from the syscall), so that a fault in a writer copying to it
+         * can only come from the source buffer. */
+        if (dest && (s->sock.type == SOCK_STREAM) && !s->rx_direct.owner &&
+            !(flags & BLOCKQ_ACTION_BLOCKED) && !offered) {
+            u64 len = MIN(length, so_rcvbuf);
+            unixsock_unlock(s);
+            boolean faulted_in = fault_in_user_memory(dest, len, true);
+            unixsock_lock(s);
+            if (faulted_in && !s->rx_direct.owner) {
+                s->rx_direct.owner = closure_self();
+                s->rx_direct.buf = dest;
+                s->rx_direct.len = len;
+                s->rx_direct.filled = 0;
+            }
+            offered = true;
+            goto retry;
+        }
         unixsock_unlock(s);
         return blockq_block_required((unix_context)ctx, flags);
     }
@@ -256,8 +293,12 @@ closure_function(7, 1, sysreturn, unixsock_read_bh,
     context_clear_err(ctx);
     read_done = true;
 out:
+    if (s->rx_direct.owner == closure_self())
+        s->rx_direct.owner = 0;
     unixsock_unlock(s);
-    if (read_done)
+
+    /* writers are blocked (or see the socket as not writable) only if it was full */
+    if (read_done && was_full)
         unixsock_notify_writer(s);
     apply(bound(completion), rv);
     closure_finish();
@@ -292,6 +333,47 @@ static sysreturn unixsock_write_check(unixsock s, u64 len)
     return 1;   /* any value > 0 will do */
 }
 
+/* Copies data to the buffer of a blocked reader of a stream socket, if no data is queued ahead of
+ * it. Called with the destination socket locked and the context error handler set. */
+static u64 unixsock_write_direct(void **src, sg_list sg, u64 length, unixsock dest)
+{
+    if (!dest->rx_direct.owner || !queue_empty(dest->data))
+        return 0;
+    u64 xfer = MIN(length, dest->rx_direct.len - dest->rx_direct.filled);
+    void *target = dest->rx_direct.buf + dest->rx_direct.filled;
+    if (*src) {
+        runtime_memcpy(target, *src, xfer);
+        *src += xfer;
+    } else {
+        u64 len = sg_copy_to_buf(target, sg, xfer);
+        assert(len == xfer);
+    }
+    dest->rx_direct.filled += xfer;
+    return xfer;
+}
+
+/* Appends data to the last queued buffer of a stream socket, so that small writes do not take a
+ * queue slot each. Called with the destination socket locked and the context error handler set. */
+static u64 unixsock_write_coalesce(void **src, sg_list sg, u64 length, unixsock dest)
+{
+    u64 qlen = queue_length(dest->data);
+    if (qlen == 0)
+        return 0;
+    sharedbuf shb = queue_peek_at(dest->data, qlen - 1);
+    buffer b = shb->b;
+    u64 xfer = MIN(MIN(length, b->length - b->end), so_rcvbuf - dest->sock.rx_len);
+    if (*src) {
+        runtime_memcpy(buffer_end(b), *src, xfer);
+        *src += xfer;
+    } else {
+        u64 len = sg_copy_to_buf(buffer_end(b), sg, xfer);
+        assert(len == xfer);
+    }
+    buffer_produce(b, xfer);
+    dest->sock.rx_len += xfer;
+    return xfer;
+}
+
 static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
                                    unixsock dest, unixsock from)
 {
@@ -301,11 +383,31 @@ static sysreturn unixsock_write_to(void *src, sg_list sg, u64 length,
 
     context ctx = get_current_context(current_cpu());
     sysreturn rv = 0;
+    boolean stream = (from->sock.type == SOCK_STREAM);
+    if (stream) {
+        if (context_set_err(ctx))
+            return -EFAULT;
+        rv = unixsock_write_direct(&src, sg, length, dest);
+        context_clear_err(ctx);
+        length -= rv;
+        if (length == 0)
+            return rv;
+        if (context_set_err(ctx))
+            return rv ? rv : -EFAULT;
+        u64 xfer = unixsock_write_coalesce(&src, sg, length, dest);
+        context_clear_err(ctx);
+        rv += xfer;
+        length -= xfer;
+        if ((length == 0) || (dest->sock.rx_len >= so_rcvbuf) || queue_full(dest->data))
+            return rv;
+    }
     do {
         u64 xfer = MIN(UNIXSOCK_BUF_MAX_SIZE, length);
-        if (from->sock.type == SOCK_STREAM)
+        if (stream)
             xfer = MIN(xfer, so_rcvbuf - dest->sock.rx_len);
-        sharedbuf shb = sharedbuf_allocate(dest->sock.h, xfer);
+
+        /* stream buffers are allocated in full so that subsequent writes can be appended */
+        sharedbuf shb = sharedbuf_allocate(dest->sock.h, stream ? UNIXSOCK_BUF_MAX_SIZE : xfer);
         if (shb == INVALID_ADDRESS) {
             if (rv == 0) {
                 rv = -ENOMEM;
@@ -683,12 +785,12 @@ out:
 }
 
 closure_function(5, 1, sysreturn, accept_bh,
-                 unixsock, s, thread, t, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+                 unixsock, s, struct sockaddr *, addr, socklen_t *, addrlen, int, flags, io_completion, completion,
                  u64 bqflags)
 {
     unixsock s = bound(s);
-    thread t = bound(t);
     struct sockaddr *addr = bound(addr);
+    context ctx = context_from_closure(closure_self());
     sysreturn rv;
 
     if (bqflags & BLOCKQ_ACTION_NULLIFY) {
@@ -704,10 +806,10 @@ closure_function(5, 1, sysreturn, accept_bh,
             rv = -EAGAIN;
             goto out;
         }
-        return blockq_block_required(&t->syscall->uc, bqflags);
+        return blockq_block_required((unix_context)ctx, bqflags);
     }
 
-    child->sock.fd = allocate_fd(current->p, child);
+    child->sock.fd = allocate_fd(unix_context_process(ctx), child);
     if (child->sock.fd == INVALID_PHYSICAL) {
         apply(child->sock.f.close, 0, io_completion_ignore);
         rv = -ENFILE;
@@ -720,7 +822,6 @@ closure_function(5, 1, sysreturn, accept_bh,
     child->sock.f.flags |= bound(flags);
     rv = child->sock.fd;
     if (addr) {
-        context ctx = get_current_context(current_cpu());
         if (context_set_err(ctx)) {
             rv = -EFAULT;
             goto out;
@@ -730,14 +831,13 @@ closure_function(5, 1, sysreturn, accept_bh,
     }
     unixsock_notify_writer(s);
 out:
-    socket_release(&s->sock);
-    syscall_return(t, rv);
+    apply(bound(completion), rv);
     closure_finish();
     return rv;
 }
 
 static sysreturn unixsock_accept4(struct sock *sock, struct sockaddr *addr,
-        socklen_t *addrlen, int flags)
+        socklen_t *addrlen, int flags, context ctx, boolean in_bh, io_completion completion)
 {
     unixsock s = (unixsock) sock;
     sysreturn rv;
@@ -749,12 +849,14 @@ static sysreturn unixsock_accept4(struct sock *sock, struct sockaddr *addr,
         rv = -EINVAL;
         goto out;
     }
-    blockq_action ba = contextual_closure(accept_bh, s, current, addr, addrlen,
-            flags);
-    return blockq_check(sock->rxbq, ba, false);
+    blockq_action ba = closure_from_context(ctx, accept_bh, s, addr, addrlen, flags, completion);
+    if (ba == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    return blockq_check(sock->rxbq, ba, in_bh);
 out:
-    socket_release(sock);
-    return rv;
+    return io_complete(completion, rv);
 }
 
 static sysreturn unixsock_getsockname(struct sock *sock, struct sockaddr *addr, socklen_t *addrlen)
@@ -886,7 +988,7 @@ closure_function(2, 1, void, sendmsg_complete,
 }
 
 sysreturn unixsock_sendmsg(struct sock *sock, const struct msghdr *msg,
-                           int flags, boolean in_bh, io_completion completion)
+                           int flags, context ctx, boolean in_bh, io_completion completion)
 {
     sg_list sg = allocate_sg_list();
     sysreturn rv;
@@ -899,7 +1001,6 @@ sysreturn unixsock_sendmsg(struct sock *sock, const struct msghdr *msg,
     io_completion complete = closure(sock->h, sendmsg_complete, sg, completion);
     if (complete == INVALID_ADDRESS)
         goto err_dealloc_sg;
-    context ctx = get_current_context(current_cpu());
     return apply(sock->f.sg_write, sg, sg->count, 0, ctx, in_bh, complete);
   err_dealloc_sg:
     deallocate_sg_list(sg);
@@ -920,8 +1021,8 @@ closure_function(4, 1, void, recvmsg_complete,
     closure_finish();
 }
 
-sysreturn unixsock_recvmsg(struct sock *sock, struct msghdr *msg, int flags, boolean in_bh,
-                           io_completion completion)
+sysreturn unixsock_recvmsg(struct sock *sock, struct msghdr *msg, int flags, context ctx,
+                           boolean in_bh, io_completion completion)
 {
     sg_list sg = allocate_sg_list();
     sysreturn rv;
@@ -933,9 +1034,9 @@ sysreturn unixsock_recvmsg(struct sock *sock, struct msghdr *msg, int flags, boo
                                      msg->msg_iov, msg->msg_iovlen, completion);
     if (complete == INVALID_ADDRESS)
         goto err_dealloc_sg;
-    blockq_action ba = contextual_closure(unixsock_read_bh, (unixsock)sock,
-                                          0, sg, iov_total_len(msg->msg_iov, msg->msg_iovlen),
-                                          complete, msg->msg_name, &msg->msg_namelen);
+    blockq_action ba = closure_from_context(ctx, unixsock_read_bh, (unixsock)sock,
+                                            0, sg, iov_total_len(msg->msg_iov, msg->msg_iovlen),
+                                            complete, msg->msg_name, &msg->msg_namelen);
     if (ba == INVALID_ADDRESS) {
         deallocate_closure(complete);
         goto err_dealloc_sg;
@@ -988,6 +1089,7 @@ static unixsock unixsock_alloc(heap h, int type, u32 flags, boolean alloc_fd)
     s->conn_q = 0;
     s->peer = 0;
     s->notify_handle = INVALID_ADDRESS;
+    s->rx_direct.owner = 0;
     init_closure_func(&s->free, thunk, unixsock_free);
     init_refcount(&s->refcount, 1, (thunk)&s->free);
     if (alloc_fd) {
@@ -44,6 +44,17 @@ struct mmsghdr {
     unsigned int msg_len;
 };
 
+struct cmsghdr {
+    u64 cmsg_len;
+    int cmsg_level;
+    int cmsg_type;
+};
+
+#define CMSG_ALIGN(len) pad(len, sizeof(u64))
+#define CMSG_DATA(cmsg) ((u8 *)(cmsg) + CMSG_ALIGN(sizeof(struct cmsghdr)))
+#define CMSG_SPACE(len) (CMSG_ALIGN(sizeof(struct cmsghdr)) + CMSG_ALIGN(len))
+#define CMSG_LEN(len)   (CMSG_ALIGN(sizeof(struct cmsghdr)) + (len))
+
 #define IFNAMSIZ    16
 
 struct ifmap {
@@ -88,7 +99,7 @@ struct sock {
     sysreturn (*connect)(struct sock *sock, struct sockaddr *addr,
             socklen_t addrlen);
     sysreturn (*accept4)(struct sock *sock, struct sockaddr *addr,
-            socklen_t *addrlen, int flags);
+            socklen_t *addrlen, int flags, context ctx, boolean in_bh, io_completion completion);
     sysreturn (*getsockname)(struct sock *sock, struct sockaddr *addr, socklen_t *addrlen);
     sysreturn (*getsockopt)(struct sock *sock, int level,
                             int optname, void *optval, socklen_t *optlen);
@@ -99,9 +110,9 @@ struct sock {
     sysreturn (*recvfrom)(struct sock *sock, void *buf, u64 len, int flags,
              struct sockaddr *dest_addr, socklen_t *addrlen);
     sysreturn (*sendmsg)(struct sock *sock, const struct msghdr *msg,
-                         int flags, boolean in_bh, io_completion completion);
-    sysreturn (*recvmsg)(struct sock *sock, struct msghdr *msg, int flags, boolean in_bh,
-                         io_completion completion);
+                         int flags, context ctx, boolean in_bh, io_completion completion);
+    sysreturn (*recvmsg)(struct sock *sock, struct msghdr *msg, int flags, context ctx,
+                         boolean in_bh, io_completion completion);
     sysreturn (*shutdown)(struct sock *sock, int how);
 };
 
@@ -200,8 +211,14 @@ sysreturn unixsock_open(int type, int protocol);
 
 void netlink_init(void);
 sysreturn netlink_open(int type, int family);
+struct netif;
+void netlink_link_changed(struct netif *netif);
 
 void vsock_init(void);
 sysreturn vsock_open(int type, int family);
 
+/* Address families implemented outside of the kernel core (e.g. in klibs) */
+closure_type(socket_family_open, sysreturn, int type, int protocol);
+boolean socket_family_register(int domain, socket_family_open open);
+
 extern int so_rcvbuf;
@@ -58,6 +58,19 @@ static sysreturn meminfo_read(file f, void *dest, u64 length, u64 offset)
     return buffer_read_at(b, offset, dest, length);
 }
 
+static sysreturn vmstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(256);
+    bprintf(b, "pgfault %ld\n"
+               "pgmajfault %ld\n"
+               "thp_fault_alloc %ld\n"
+               "thp_fault_fallback %ld\n"
+               "closure_alloc %ld\n",
+            mm_stats.minor_faults + mm_stats.major_faults, mm_stats.major_faults,
+            mm_stats.huge_faults, mm_stats.huge_fault_fallbacks, closure_alloc_count());
+    return buffer_read_at(b, offset, dest, length);
+}
+
 typedef struct mounts_notify_data *mounts_notify_data;
 
 struct mounts_notify_data {
@@ -207,14 +220,83 @@ static u32 cpu_online_events(file f)
     return (EPOLLIN | EPOLLOUT);
 }
 
+/* Linux schedstat formats: per-CPU lines report cross-CPU wakeups (and how many of them moved the
+ * woken task to the waker CPU), the time spent running and the time tasks waited in the run
+ * queue, in nanoseconds, and per-task files report on-CPU time, run queue wait time and number of
+ * timeslices. */
+static sysreturn schedstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    heap h = heap_locked(get_kernel_heaps());
+    buffer b = allocate_buffer(h, 64 * (total_processors + 1));
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
+    bprintf(b, "version 15\ntimestamp %ld\n", nsec_from_timestamp(here) / 1000000);
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        sched_cpu_stats stats = &cpuinfo_from_id(cpu)->sched_stats;
+        timestamp idle_start = stats->idle_start;
+        timestamp idle = stats->idle_time +
+            (idle_start && (here > idle_start) ? here - idle_start : 0);
+        bprintf(b, "cpu%ld 0 0 %ld 0 %ld %ld %ld %ld %ld\n", cpu, stats->runs,
+                stats->wakeups, stats->wake_local,
+                nsec_from_timestamp(here > idle ? here - idle : 0),
+                nsec_from_timestamp(stats->wait_time), stats->runs);
+    }
+    context ctx = get_current_context(current_cpu());
+    if (!context_set_err(ctx))
+        length = buffer_read_at(b, offset, dest, length);
+    else
+        length = -EFAULT;
+    deallocate_buffer(b);
+    return length;
+}
+
+closure_function(2, 1, boolean, proc_schedstat_handler,
+                 timestamp *, wait_time, u64 *, runs,
+                 rbnode n)
+{
+    thread t = struct_from_field(n, thread, n);
+    *bound(wait_time) += t->task.wait_time;
+    *bound(runs) += t->task.runs;
+    return true;
+}
+
+static sysreturn proc_schedstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    process p = current->p;
+    timestamp wait_time = 0;
+    u64 runs = 0;
+    spin_lock(&p->threads_lock);
+    rbtree_traverse(p->threads, RB_INORDER, stack_closure(proc_schedstat_handler,
+                                                          &wait_time, &runs));
+    spin_unlock(&p->threads_lock);
+    buffer b = little_stack_buffer(64);
+    bprintf(b, "%ld %ld %ld\n", nsec_from_timestamp(proc_cputime(p)),
+            nsec_from_timestamp(wait_time), runs);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn thread_schedstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    thread t = current;
+    buffer b = little_stack_buffer(64);
+    bprintf(b, "%ld %ld %ld\n", nsec_from_timestamp(thread_cputime(t)),
+            nsec_from_timestamp(t->task.wait_time), t->task.runs);
+    return buffer_read_at(b, offset, dest, length);
+}
+
 static const special_file special_files[] = {
     { ss_static_init("/dev/urandom"), .read = urandom_read, .write = 0, .events = urandom_events },
     { ss_static_init("/dev/null"), .read = null_read, .write = null_write, .events = null_events },
     { ss_static_init("/proc/meminfo"), .read = meminfo_read},
+    { ss_static_init("/proc/vmstat"), .read = vmstat_read},
     { ss_static_init("/proc/mounts"), .open = mounts_open, .close = mounts_close,
       .read = mounts_read, .events = mounts_events,
       .alloc_size = sizeof(struct mounts_notify_data)},
     { ss_static_init("/proc/self/maps"), .read = maps_read, .events = maps_events, },
+    { ss_static_init("/proc/schedstat"), .read = schedstat_read},
+    { ss_static_init("/proc/self/schedstat"), .read = proc_schedstat_read},
+    { ss_static_init("/proc/thread-self/schedstat"), .read = thread_schedstat_read},
     { ss_static_init("/sys/devices/system/cpu/online"), .read = cpu_online_read,
       .write = null_write, .events = cpu_online_events },
     FTRACE_SPECIAL_FILES
@@ -13,6 +13,30 @@ static buffer hostname;
 
 static struct syscall_stat stats[SYS_MAX];
 BSS_RO_AFTER_INIT boolean do_syscall_stats;
+
+/* Always-on per-CPU latency statistics: bucket 0 counts calls completing in less than
+ * 2^SYSCALL_LAT_MIN_ORDER nanoseconds, each following bucket doubles the range, and the last
+ * bucket counts all slower calls. */
+#define SYSCALL_LAT_BUCKETS     24
+#define SYSCALL_LAT_MIN_ORDER   10
+
+typedef struct syscall_lat {
+    u64 calls;
+    u64 errors;
+    u64 nsecs;
+    u32 hist[SYSCALL_LAT_BUCKETS];
+} *syscall_lat;
+
+DEFINE_TRACEPOINT(syscall_enter, "tid:u64 call:u64 arg0:x64");
+DEFINE_TRACEPOINT(syscall_exit, "tid:u64 call:u64 ret:s64 nsecs:u64");
+
+BSS_RO_AFTER_INIT static syscall_lat syscall_lats;     /* SYS_MAX entries per CPU */
+static struct {
+    heap h;
+    table syms;             /* syscall name symbol -> number + 1 */
+    tuple *values;          /* per-syscall management tuples, allocated on access */
+    struct spinlock lock;
+} syscall_lat_mgmt;
 BSS_RO_AFTER_INIT static boolean do_missing_files;
 BSS_RO_AFTER_INIT static vector missing_files;
 
@@ -165,6 +189,9 @@ closure_function(2, 1, void, iov_write_complete,
     closure_finish();
 }
 
+static boolean file_direct_io(file f, struct iovec *iov, int iovcnt, u64 offset_arg, boolean write,
+                              context ctx, io_completion completion);
+
 void iov_op(fdesc f, boolean write, struct iovec *iov, int iovcnt, u64 offset,
             context ctx, boolean blocking, io_completion completion)
 {
@@ -182,6 +209,10 @@ void iov_op(fdesc f, boolean write, struct iovec *iov, int iovcnt, u64 offset,
         goto out;
     }
 
+    if ((fdesc_type(f) == FDESC_TYPE_REGULAR) &&
+        file_direct_io((file)f, iov, iovcnt, offset, write, ctx, completion))
+        return;
+
     heap h = heap_locked(get_kernel_heaps());
     if (write ? (f->sg_write != 0) : (f->sg_read != 0)) {
         sg_list sg = allocate_sg_list();
@@ -358,6 +389,21 @@ sysreturn pwritev(int fd, struct iovec *iov, int iovcnt, s64 offset)
     return iov_internal(fd, true, iov, iovcnt, offset);
 }
 
+/* With byte-ring pipes, the user pages are copied into (or out of) the pipe buffer rather than
+   being mapped into it; the direction of the transfer follows the pipe end. */
+sysreturn vmsplice(int fd, struct iovec *iov, u64 nr_segs, unsigned int flags)
+{
+    if (flags & ~(SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE | SPLICE_F_GIFT))
+        return -EINVAL;
+    fdesc f = resolve_fd(current->p, fd);
+    int type = f->type;
+    boolean write = fdesc_is_writable(f);
+    fdesc_put(f);
+    if (type != FDESC_TYPE_PIPE)
+        return -EBADF;
+    return iov_internal(fd, write, iov, nr_segs, infinity);
+}
+
 closure_function(9, 1, void, sendfile_bh,
                  fdesc, in, fdesc, out, long *, offset, sg_list, sg, sg_buf, cur_buf, bytes, count, bytes, readlen, bytes, written, boolean, bh,
                  sysreturn rv)
@@ -441,6 +487,60 @@ out_complete:
     closure_finish();
 }
 
+/* Used when the output file takes scatter-gather writes (e.g. sockets): the buffers filled by the
+   read, which reference page cache pages, are passed as they are to the output, which may send
+   them without copying. */
+closure_function(6, 1, void, sendfile_sg_bh,
+                 fdesc, in, fdesc, out, long *, offset, sg_list, sg, bytes, readlen, boolean, bh,
+                 sysreturn rv)
+{
+    thread t = current;
+    thread_log(t, "%s: readlen %ld, bh %d, rv %ld", func_ss, bound(readlen), bound(bh), rv);
+    context ctx = get_current_context(current_cpu());
+    if (!bound(bh)) {
+        /* read complete (rv == bytes read) */
+        if (rv <= 0)
+            goto out_complete;
+        bound(bh) = true;
+        bound(readlen) = rv;
+        if (bound(offset)) {
+            if (!context_set_err(ctx)) {
+                *bound(offset) += rv;
+                context_clear_err(ctx);
+            } else {
+                rv = -EFAULT;
+                goto out_complete;
+            }
+        }
+        thread_log(t, "   read %ld bytes, writing", rv);
+        apply(bound(out)->sg_write, bound(sg), rv, infinity, ctx, true,
+              (io_completion)closure_self());
+        return;
+    }
+
+    /* write complete: move the input offset back past any data not written */
+    s64 unsent = bound(readlen) - MAX(rv, 0);
+    if (unsent > 0) {
+        if (bound(offset)) {
+            if (!context_set_err(ctx)) {
+                *bound(offset) -= unsent;
+                context_clear_err(ctx);
+            }
+        } else if (bound(in)->type == FDESC_TYPE_REGULAR) {
+            file f_in = (file)bound(in);
+            f_in->offset -= unsent;
+        }
+        thread_log(t, "   rewound %ld bytes", unsent);
+    }
+out_complete:
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    fdesc_put(bound(in));
+    fdesc_put(bound(out));
+    syscall_return(t, rv);
+    closure_finish();
+}
+
 /* Should be determined more intelligently based on available
    buffering on output side, modulated by link capacity
    (e.g. bandwidth delay product). Right now assuming the common mode
@@ -485,8 +585,15 @@ static sysreturn sendfile(int out_fd, int in_fd, long *offset, bytes count)
     }
 
     u64 n = MIN(count, SENDFILE_READ_MAX);
-    io_completion read_complete = closure(heap_locked(get_kernel_heaps()), sendfile_bh, infile, outfile,
-                                          offset, sg, 0, n, 0, 0, false);
+    heap h = heap_locked(get_kernel_heaps());
+    io_completion read_complete = outfile->sg_write ?
+        (io_completion)closure(h, sendfile_sg_bh, infile, outfile, offset, sg, 0, false) :
+        (io_completion)closure(h, sendfile_bh, infile, outfile, offset, sg, 0, n, 0, 0, false);
+    if (read_complete == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        rv = -ENOMEM;
+        goto out;
+    }
     context ctx = get_current_context(current_cpu());
     apply(infile->sg_read, sg, n, read_offset, ctx, false, read_complete);
     return get_syscall_return(current);
@@ -520,6 +627,470 @@ static void begin_file_read(file f, u64 length)
     }
 }
 
+static sysreturn file_write_check(file f, u64 offset, u64 len)
+{
+    fsfile fsf = f->fsf;
+    if (!fsf)
+        return -EBADF;
+    if (len == 0)
+        return 0;
+    filesystem fs = f->fs;
+    if (fs->get_seals) {
+        u64 seals;
+        if (fs->get_seals(fs, fsf, &seals) == FS_STATUS_OK) {
+            if ((seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) ||
+                ((seals & F_SEAL_GROW) && (offset + len > fsfile_get_length(fsf))))
+                return -EPERM;
+        }
+    }
+    return 0;
+}
+
+static void begin_file_write(file f, u64 len)
+{
+    if (len > 0) {
+        tuple md = filesystem_get_meta(f->fs, f->n);
+        if (md) {
+            filesystem_update_mtime(f->fs, md);
+            fs_notify_event(md, IN_MODIFY);
+            filesystem_put_meta(f->fs, md);
+        }
+    }
+}
+
+/* Files are copied by copy_file_range() in chunks: the page cache buffers filled by each read of
+   the input file are passed to a write to the output file. */
+#define FILE_COPY_CHUNK (1 * MB)
+
+typedef struct file_copy {
+    thread t;
+    file in, out;
+    long *off_in, *off_out;
+    u64 in_offset, out_offset;
+    u64 remaining;
+    u64 copied;
+    u64 readlen;
+    sg_list sg;
+    closure_struct(io_completion, io_complete);
+    closure_struct(fs_status_handler, cloned);
+} *file_copy;
+
+static void file_copy_finish(file_copy fc, sysreturn rv)
+{
+    thread t = fc->t;
+    thread_log(t, "%s: copied %ld, rv %ld", func_ss, fc->copied, rv);
+    if (fc->copied) {
+        rv = fc->copied;
+        context ctx = get_current_context(current_cpu());
+        if (fc->off_in || fc->off_out) {
+            if (!context_set_err(ctx)) {
+                if (fc->off_in)
+                    *fc->off_in = fc->in_offset;
+                if (fc->off_out)
+                    *fc->off_out = fc->out_offset;
+                context_clear_err(ctx);
+            } else {
+                rv = -EFAULT;
+            }
+        }
+        if (!fc->off_in)
+            fc->in->offset = fc->in_offset;
+        if (!fc->off_out)
+            fc->out->offset = fc->out_offset;
+    }
+    sg_list_release(fc->sg);
+    deallocate_sg_list(fc->sg);
+    fdesc_put(&fc->in->f);
+    fdesc_put(&fc->out->f);
+    deallocate(heap_locked(get_kernel_heaps()), fc, sizeof(*fc));
+    syscall_return(t, rv);
+}
+
+closure_func_basic(io_completion, void, file_copy_io_complete,
+                   sysreturn rv)
+{
+    file_copy fc = struct_from_field(closure_self(), file_copy, io_complete);
+    thread_log(fc->t, "%s: readlen %ld, rv %ld", func_ss, fc->readlen, rv);
+    context ctx = get_current_context(current_cpu());
+    if (!fc->readlen) {
+        /* read complete */
+        if (rv <= 0)
+            goto done;
+        fc->readlen = rv;
+        apply(fc->out->f.sg_write, fc->sg, rv, fc->out_offset, ctx, true,
+              (io_completion)&fc->io_complete);
+        return;
+    }
+
+    /* write complete */
+    sg_list_release(fc->sg);
+    if (rv <= 0)
+        goto done;
+    fc->copied += rv;
+    fc->in_offset += rv;
+    fc->out_offset += rv;
+    fc->remaining -= rv;
+    if ((rv < fc->readlen) || !fc->remaining)
+        goto done;
+    fc->readlen = 0;
+    apply(fc->in->f.sg_read, fc->sg, MIN(fc->remaining, FILE_COPY_CHUNK), fc->in_offset, ctx, true,
+          (io_completion)&fc->io_complete);
+    return;
+  done:
+    file_copy_finish(fc, rv);
+}
+
+closure_func_basic(fs_status_handler, void, file_copy_cloned,
+                   fsfile fsf, fs_status fss)
+{
+    file_copy fc = struct_from_field(closure_self(), file_copy, cloned);
+    if (fss == FS_STATUS_OK) {
+        fc->copied = fc->remaining;
+        fc->in_offset += fc->remaining;
+        fc->out_offset += fc->remaining;
+    }
+    file_copy_finish(fc, sysreturn_from_fs_status(fss));
+}
+
+/* The range is cloned (sharing storage between the two files) if the filesystem supports it,
+   otherwise its data is copied through the page cache. */
+static sysreturn copy_file_range(int fd_in, long *off_in, int fd_out, long *off_out, u64 len,
+                                 unsigned int flags)
+{
+    thread_log(current, "%s: in %d, off_in %p, out %d, off_out %p, len %ld, flags 0x%x",
+               func_ss, fd_in, off_in, fd_out, off_out, len, flags);
+    if (flags)
+        return -EINVAL;
+    u64 in_offset, out_offset;
+    if ((off_in && !get_user_value(off_in, &in_offset)) ||
+        (off_out && !get_user_value(off_out, &out_offset)))
+        return -EFAULT;
+    fdesc in = resolve_fd(current->p, fd_in);
+    fdesc out = fdesc_get(current->p, fd_out);
+    if (!out) {
+        fdesc_put(in);
+        return -EBADF;
+    }
+    sysreturn rv;
+    if (!fdesc_is_readable(in) || !fdesc_is_writable(out) || (out->flags & O_APPEND)) {
+        rv = -EBADF;
+        goto out;
+    }
+    if ((in->type == FDESC_TYPE_DIRECTORY) || (out->type == FDESC_TYPE_DIRECTORY)) {
+        rv = -EISDIR;
+        goto out;
+    }
+    if ((in->type != FDESC_TYPE_REGULAR) || (out->type != FDESC_TYPE_REGULAR)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    file fin = (file)in;
+    file fout = (file)out;
+    if (off_in) {
+        if ((s64)in_offset < 0) {
+            rv = -EINVAL;
+            goto out;
+        }
+    } else {
+        in_offset = fin->offset;
+    }
+    if (off_out) {
+        if ((s64)out_offset < 0) {
+            rv = -EINVAL;
+            goto out;
+        }
+    } else {
+        out_offset = fout->offset;
+    }
+    u64 in_length = fsfile_get_length(fin->fsf);
+    len = (in_offset < in_length) ? MIN(len, in_length - in_offset) : 0;
+    if ((fin->fsf == fout->fsf) &&
+        range_span(range_intersection(irangel(in_offset, len), irangel(out_offset, len)))) {
+        rv = -EINVAL;
+        goto out;
+    }
+    rv = file_write_check(fout, out_offset, len);
+    if ((rv < 0) || (len == 0))
+        goto out;
+
+    heap h = heap_locked(get_kernel_heaps());
+    file_copy fc = allocate(h, sizeof(*fc));
+    if (fc == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    fc->sg = allocate_sg_list();
+    if (fc->sg == INVALID_ADDRESS) {
+        deallocate(h, fc, sizeof(*fc));
+        rv = -ENOMEM;
+        goto out;
+    }
+    fc->t = current;
+    fc->in = fin;
+    fc->out = fout;
+    fc->off_in = off_in;
+    fc->off_out = off_out;
+    fc->in_offset = in_offset;
+    fc->out_offset = out_offset;
+    fc->remaining = len;
+    fc->copied = 0;
+    fc->readlen = 0;
+    init_closure_func(&fc->io_complete, io_completion, file_copy_io_complete);
+    fs_status fss = filesystem_clone(fin->fsf, in_offset, fout->fsf, out_offset, len,
+                                     init_closure_func(&fc->cloned, fs_status_handler,
+                                                       file_copy_cloned));
+    thread_log(current, "   clone: %s", string_from_fs_status(fss));
+    if (fss == FS_STATUS_OK) {
+        begin_file_write(fout, len);
+        return thread_maybe_sleep_uninterruptible(current);
+    }
+    context ctx = get_current_context(current_cpu());
+    apply(in->sg_read, fc->sg, MIN(len, FILE_COPY_CHUNK), in_offset, ctx, false,
+          (io_completion)&fc->io_complete);
+    return get_syscall_return(current);
+  out:
+    fdesc_put(in);
+    fdesc_put(out);
+    return rv;
+}
+
+closure_function(2, 2, void, file_clone_complete,
+                 thread, t, fdesc, src,
+                 fsfile fsf, fs_status fss)
+{
+    thread_log(bound(t), "%s: %s", func_ss, string_from_fs_status(fss));
+    fdesc_put(bound(src));
+    syscall_return(bound(t), sysreturn_from_fs_status(fss));
+    closure_finish();
+}
+
+/* FICLONE and FICLONERANGE ioctls: a zero source length extends the range to the end of the
+   source file. */
+static sysreturn file_clone(file dest, int src_fd, u64 src_offset, u64 src_length,
+                            u64 dest_offset)
+{
+    thread_log(current, "%s: src %d, offset %ld, length %ld, dest offset %ld", func_ss, src_fd,
+               src_offset, src_length, dest_offset);
+    fdesc src = resolve_fd(current->p, src_fd);
+    sysreturn rv;
+    if (!fdesc_is_readable(src) || !fdesc_is_writable(&dest->f) || (dest->f.flags & O_APPEND)) {
+        rv = -EBADF;
+        goto out;
+    }
+    if ((src->type != FDESC_TYPE_REGULAR) || (dest->f.type != FDESC_TYPE_REGULAR)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    file fsrc = (file)src;
+    u64 length = fsfile_get_length(fsrc->fsf);
+    if ((src_offset > length) || (src_length > length - src_offset)) {
+        rv = -EINVAL;
+        goto out;
+    }
+    if (src_length == 0)
+        src_length = length - src_offset;
+    rv = file_write_check(dest, dest_offset, src_length);
+    if (rv < 0)
+        goto out;
+    fs_status_handler completion = closure(heap_locked(get_kernel_heaps()), file_clone_complete,
+                                           current, src);
+    if (completion == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    fs_status fss = filesystem_clone(fsrc->fsf, src_offset, dest->fsf, dest_offset, src_length,
+                                     completion);
+    if (fss != FS_STATUS_OK) {
+        deallocate_closure(completion);
+        rv = sysreturn_from_fs_status(fss);
+        goto out;
+    }
+    begin_file_write(dest, src_length);
+    return thread_maybe_sleep_uninterruptible(current);
+  out:
+    fdesc_put(src);
+    return rv;
+}
+
+closure_function(7, 1, void, file_direct_io_complete,
+                 file, f, sg_list, sg, u64, count, boolean, is_file_offset, boolean, write, io_completion, completion, boolean, flush,
+                 status s)
+{
+    file f = bound(f);
+    if (!bound(flush)) {
+        deallocate_sg_list(bound(sg));
+        if (is_ok(s) && bound(write) && (f->f.flags & O_DSYNC)) {
+            bound(flush) = true;
+            fsfile_flush(f->fsf, !(f->f.flags & _O_SYNC), (status_handler)closure_self());
+            return;
+        }
+    }
+    thread_log(current, "%s: f %p, count %ld, status %v", func_ss, f, bound(count), s);
+    sysreturn rv;
+    if (is_ok(s)) {
+        if (bound(is_file_offset)) /* vs specified offset (pread/pwrite) */
+            f->offset += bound(count);
+        rv = bound(count);
+    } else {
+        rv = sysreturn_from_fs_status_value(s);
+        timm_dealloc(s);
+    }
+    apply(bound(completion), rv);
+    closure_finish();
+}
+
+/* Checks a direct I/O request for length (block-aligned) bytes at offset: returns false if it must
+ * take the cached path, otherwise sets *count to the number of bytes transferred and *length to
+ * the number of bytes requested from storage (reads are extended to the end of the block
+ * containing the end of the file), or *rv to an error. */
+static boolean file_direct_io_range(file f, u64 offset, boolean write, u64 *length, u64 *count,
+                                    sysreturn *rv)
+{
+    u64 block_mask = fs_blocksize(f->fs) - 1;
+    if ((*length == 0) || (offset & block_mask))
+        return false;
+    *rv = 0;
+    *count = *length;
+    if (write) {
+        *rv = file_write_check(f, offset, *length);
+    } else if (check_file_read(f, offset, rv)) {
+        u64 file_length = fsfile_get_length(f->fsf);
+        if (offset >= file_length)
+            return false;
+        *count = MIN(*length, file_length - offset);
+        *length = (*count + block_mask) & ~block_mask;
+    }
+    return true;
+}
+
+/* Issues a direct I/O request on a list of physically contiguous user buffers, which is
+ * deallocated on completion; returns false if the request must take the cached path. */
+static boolean file_direct_io_submit(file f, sg_list sg, u64 offset, boolean is_file_offset,
+                                     u64 length, u64 count, boolean write, context ctx,
+                                     io_completion completion)
+{
+    status_handler sh = closure_from_context(ctx, file_direct_io_complete, f, sg, count,
+                                             is_file_offset, write, completion, false);
+    if (sh == INVALID_ADDRESS)
+        return false;
+    if (!pagecache_node_direct_io(fsfile_get_cachenode(f->fsf), sg, irangel(offset, length),
+                                  write, sh)) {
+        deallocate_closure(sh);
+        return false;
+    }
+    if (write)
+        begin_file_write(f, count);
+    else
+        begin_file_read(f, count);
+    return true;
+}
+
+/* O_DIRECT: requests whose user buffers, offset and length are aligned to the filesystem block
+ * size are transferred between the user buffers and storage without going through the page cache.
+ * Returns false if the request must take the cached path instead, which is also the case if it
+ * conflicts with pages in the cache or is not issued from a syscall (e.g. by an SQ polling
+ * io_uring), as the user buffers are faulted in beforehand. */
+static boolean file_direct_io(file f, struct iovec *iov, int iovcnt, u64 offset_arg, boolean write,
+                              context ctx, io_completion completion)
+{
+    if (!(f->f.flags & O_DIRECT) || !f->fsf ||
+        !is_syscall_context(get_current_context(current_cpu())))
+        return false;
+    u64 block_mask = fs_blocksize(f->fs) - 1;
+    boolean is_file_offset = offset_arg == infinity;
+    u64 offset = is_file_offset ? f->offset : offset_arg;
+    u64 length = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if ((u64_from_pointer(iov[i].iov_base) | iov[i].iov_len) & block_mask)
+            return false;
+        length += iov[i].iov_len;
+    }
+    sysreturn rv;
+    u64 count;
+    if (!file_direct_io_range(f, offset, write, &length, &count, &rv))
+        return false;
+    if (rv < 0) {
+        io_complete(completion, rv);
+        return true;
+    }
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return false;
+
+    /* storage drivers require each buffer to be physically contiguous */
+    for (u64 remain = length; remain > 0; iov++) {
+        u64 iov_len = MIN(iov->iov_len, remain);
+        if (!(write ? fault_in_user_memory(iov->iov_base, iov_len, false) :
+              fault_in_user_memory_for_dma(iov->iov_base, iov_len))) {
+            deallocate_sg_list(sg);
+            io_complete(completion, -EFAULT);
+            return true;
+        }
+        for (u64 done = 0; done < iov_len; ) {
+            void *p = iov->iov_base + done;
+            u64 len = MIN(iov_len - done, PAGESIZE - (u64_from_pointer(p) & PAGEMASK));
+            sg_buf sgb = sg_list_tail_add(sg, len);
+            if (sgb == INVALID_ADDRESS)
+                goto fail;
+            sgb->buf = p;
+            sgb->size = len;
+            sgb->offset = 0;
+            sgb->refcount = 0;
+            done += len;
+        }
+        remain -= iov_len;
+    }
+    if (file_direct_io_submit(f, sg, offset, is_file_offset, length, count, write, ctx,
+                              completion))
+        return true;
+  fail:
+    deallocate_sg_list(sg);
+    return false;
+}
+
+/* O_DIRECT request on user buffers that are known to be resident, writable and physically
+ * contiguous (e.g. io_uring fixed buffers), which therefore can be issued from any context. On
+ * success, the sg list (whose buffers hold no references) is consumed; returns false if the
+ * request must take the regular path, in which case the sg list is left untouched. */
+boolean file_direct_io_sg(file f, sg_list sg, u64 offset_arg, boolean write, context ctx,
+                          io_completion completion)
+{
+    if (!(f->f.flags & O_DIRECT) || !f->fsf)
+        return false;
+    u64 block_mask = fs_blocksize(f->fs) - 1;
+    boolean is_file_offset = offset_arg == infinity;
+    u64 offset = is_file_offset ? f->offset : offset_arg;
+    sg_list_foreach(sg, sgb) {
+        if ((u64_from_pointer(sgb->buf + sgb->offset) | sg_buf_len(sgb)) & block_mask)
+            return false;
+    }
+    u64 length = sg->count;
+    sysreturn rv;
+    u64 count;
+    if (!file_direct_io_range(f, offset, write, &length, &count, &rv))
+        return false;
+    if (rv < 0) {
+        deallocate_sg_list(sg);
+        io_complete(completion, rv);
+        return true;
+    }
+    if (length < sg->count) {
+        /* drop the buffers beyond the end of the last block read */
+        u64 total = 0;
+        sg_list_foreach(sg, sgb) {
+            if (total + sg_buf_len(sgb) >= length) {
+                sgb->size = sgb->offset + (length - total);
+                sg->b->end = sg->b->start + ((void *)(sgb + 1) - buffer_ref(sg->b, 0));
+                break;
+            }
+            total += sg_buf_len(sgb);
+        }
+        sg->count = length;
+    }
+    return file_direct_io_submit(f, sg, offset, is_file_offset, length, count, write, ctx,
+                                 completion);
+}
+
 closure_function(6, 1, void, file_read_complete,
                  sg_list, sg, void *, dest, u64, limit, file, f, boolean, is_file_offset, io_completion, completion,
                  status s)
@@ -571,6 +1142,8 @@ closure_func_basic(file_io, sysreturn, file_read,
     sysreturn rv;
     if (!check_file_read(f, offset, &rv))
         return io_complete(completion, rv);
+    if (file_direct_io(f, &(struct iovec){dest, length}, 1, offset_arg, false, ctx, completion))
+        goto out;
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         thread_log(t, "   unable to allocate sg list");
@@ -585,6 +1158,7 @@ closure_func_basic(file_io, sysreturn, file_read,
     begin_file_read(f, length);
     apply(f->fs_read, sg, irangel(offset, length), sh);
     file_readahead(f, offset, length);
+  out:
     /* possible direct return in top half */
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
 }
@@ -632,37 +1206,6 @@ closure_func_basic(sg_file_io, sysreturn, file_sg_read,
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
 }
 
-static sysreturn file_write_check(file f, u64 offset, u64 len)
-{
-    fsfile fsf = f->fsf;
-    if (!fsf)
-        return -EBADF;
-    if (len == 0)
-        return 0;
-    filesystem fs = f->fs;
-    if (fs->get_seals) {
-        u64 seals;
-        if (fs->get_seals(fs, fsf, &seals) == FS_STATUS_OK) {
-            if ((seals & (F_SEAL_WRITE | F_SEAL_FUTURE_WRITE)) ||
-                ((seals & F_SEAL_GROW) && (offset + len > fsfile_get_length(fsf))))
-                return -EPERM;
-        }
-    }
-    return 0;
-}
-
-static void begin_file_write(file f, u64 len)
-{
-    if (len > 0) {
-        tuple md = filesystem_get_meta(f->fs, f->n);
-        if (md) {
-            filesystem_update_mtime(f->fs, md);
-            fs_notify_event(md, IN_MODIFY);
-            filesystem_put_meta(f->fs, md);
-        }
-    }
-}
-
 static void file_write_complete_internal(file f, u64 len,
                                          boolean is_file_offset,
                                          io_completion completion, status s)
@@ -714,6 +1257,8 @@ closure_func_basic(file_io, sysreturn, file_write,
     sysreturn rv = file_write_check(f, offset, length);
     if (rv < 0)
         return io_complete(completion, rv);
+    if (file_direct_io(f, &(struct iovec){src, length}, 1, offset_arg, true, ctx, completion))
+        goto out;
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         thread_log(t, "   unable to allocate sg list");
@@ -735,6 +1280,7 @@ closure_func_basic(file_io, sysreturn, file_write,
         goto no_mem;
     begin_file_write(f, length);
     apply(f->fs_write, sg, irangel(offset, length), sh);
+  out:
     /* possible direct return in top half */
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
   no_mem:
@@ -802,6 +1348,8 @@ closure_func_basic(fdesc_close, sysreturn, file_close,
     fsfile fsf = f->fsf;
     if (fsf)
         fsfile_release(fsf);
+    if (f->dirents)
+        deallocate_vector(f->dirents);
     file_release(f);
     return io_complete(completion, 0);
 }
@@ -869,12 +1417,14 @@ int unix_file_new(filesystem fs, tuple md, int type, int flags, fsfile fsf)
         f->fs_write = fsfile_get_writer(fsf);
         assert(f->fs_write);
         f->fadv = POSIX_FADV_NORMAL;
+        f->ra = (struct file_ra){};
         length = fsfile_get_length(fsf);
     } else {
         length = 0;
     }
     f->n = fs->get_inode(fs, md);
     f->offset = (flags & O_APPEND) ? length : 0;
+    f->dirents = 0;
 
     if (type == FDESC_TYPE_SPECIAL) {
         int spec_ret = spec_open(f, md);
@@ -1066,10 +1616,8 @@ sysreturn dup2(int oldfd, int newfd)
     if (newfd != oldfd) {
         fdesc newf = fdesc_get(p, newfd);
         if (newf) {
-            process_lock(p);
-            assert(vector_set(p->files, newfd, f));
-            process_unlock(p);
-            if (fetch_and_add(&newf->refcnt, -2) == 2) {
+            replace_fd(p, newfd, f);
+            if (fdesc_put_removed(newf, 1)) {
                 if (newf->close)
                     apply(newf->close, get_current_context(current_cpu()), io_completion_ignore);
             }
@@ -1158,10 +1706,8 @@ sysreturn creat(const char *pathname, int mode)
 static inline boolean fill_random(void *buf, u64 buflen)
 {
     context ctx = get_current_context(current_cpu());
-    if (context_set_err(ctx)) {
-        random_buffer_aborted();
+    if (context_set_err(ctx))
         return false;
-    }
     random_buffer(alloca_wrap_buffer(buf, buflen));
     context_clear_err(ctx);
     return true;
@@ -1187,7 +1733,7 @@ sysreturn getrandom(void *buf, u64 buflen, unsigned int flags)
     if (!buflen)
         return set_syscall_error(current, EINVAL);
 
-    if (flags & ~(GRND_NONBLOCK | GRND_RANDOM))
+    if (flags & ~(GRND_NONBLOCK | GRND_RANDOM | GRND_INSECURE))
         return set_syscall_error(current, EINVAL);
 
     u64 n = MIN(GETRANDOM_MAX_BUFLEN, buflen);
@@ -1204,63 +1750,63 @@ sysreturn getrandom(void *buf, u64 buflen, unsigned int flags)
     return buflen;
 }
 
-static int try_write_dirent(void *dirp, boolean dirent64, string p,
-        int *read_sofar, int *written_sofar, u64 *f_offset,
-        unsigned int *count, filesystem fs, tuple n)
-{
-    int len = buffer_length(p);
-    *read_sofar += len;
-    if (*read_sofar > *f_offset) {
-        int reclen = dirent64 ? (offsetof(struct linux_dirent64 *, d_name) + len + 1) :
-                     (offsetof(struct linux_dirent *, d_name) + len + 2);
-        reclen = pad(reclen, 8);    /* so that all dirent structures have natural alignment */
-        // include this element in the getdents output
-        if (reclen > *count) {
-            // can't include, there's no space
-            *read_sofar -= len;
-            return -1;
-        } else {
-            // include the entry in the buffer
-            if (dirent64) {
-                struct linux_dirent64 *dp = dirp;
-                dp->d_ino = fs->get_inode(fs, n);
-                dp->d_reclen = reclen;
-                runtime_memcpy(dp->d_name, buffer_ref(p, 0), len);
-                dp->d_name[len] = '\0';
-                dp->d_off = reclen + *written_sofar;
-                dp->d_type = dt_from_tuple(n);
-            } else {
-                struct linux_dirent *dp = dirp;
-                dp->d_ino = fs->get_inode(fs, n);
-                dp->d_reclen = reclen;
-                runtime_memcpy(dp->d_name, buffer_ref(p, 0), len);
-                zero(dp->d_name + len, reclen - (((void *)dp->d_name) - dirp) - len - 1);
-                dp->d_off = reclen + *written_sofar;
-                ((char *)dirp)[reclen - 1] = dt_from_tuple(n);
-            }
-
-            // advance dirp
-            *written_sofar += reclen;
-            *count -= reclen;
-            return reclen;
-        }
+/* Writes a directory entry to a user buffer; returns the record length, or 0 if the entry does not
+ * fit in the buffer. */
+static int write_dirent(void *dirp, boolean dirent64, unsigned int count, string name, u64 ino,
+                        int type, u64 next_offset)
+{
+    int len = buffer_length(name);
+    int reclen = dirent64 ? (offsetof(struct linux_dirent64 *, d_name) + len + 1) :
+                 (offsetof(struct linux_dirent *, d_name) + len + 2);
+    reclen = pad(reclen, 8);    /* so that all dirent structures have natural alignment */
+    if (reclen > count)
+        return 0;
+    if (dirent64) {
+        struct linux_dirent64 *dp = dirp;
+        dp->d_ino = ino;
+        dp->d_reclen = reclen;
+        runtime_memcpy(dp->d_name, buffer_ref(name, 0), len);
+        dp->d_name[len] = '\0';
+        dp->d_off = next_offset;
+        dp->d_type = type;
+    } else {
+        struct linux_dirent *dp = dirp;
+        dp->d_ino = ino;
+        dp->d_reclen = reclen;
+        runtime_memcpy(dp->d_name, buffer_ref(name, 0), len);
+        zero(dp->d_name + len, reclen - (((void *)dp->d_name) - dirp) - len - 1);
+        dp->d_off = next_offset;
+        ((char *)dirp)[reclen - 1] = type;
     }
-    return 0;
+    return reclen;
 }
 
-closure_function(8, 2, boolean, getdents_each,
-                 file, f, void **, dirp, boolean, dirent64, int *, read_sofar, int *, written_sofar, unsigned int *, count, int *, r, filesystem, fs,
+closure_function(1, 2, boolean, getdents_snapshot_each,
+                 vector, dirents,
                  value k, value v)
 {
     assert(is_symbol(k));
-    string p = symbol_string(k);
-    *bound(r) = try_write_dirent(*bound(dirp), bound(dirent64), p,
-                                 bound(read_sofar), bound(written_sofar), &bound(f)->offset, bound(count),
-                                 bound(fs), v);
-    if (*bound(r) < 0)
-        return false;
+    vector_push(bound(dirents), k);
+    return true;
+}
 
-    *bound(dirp) = *bound(dirp) + *bound(r);
+/* The directory entry names are collected when a directory stream is (re)started, so that the file
+ * offset can be used as a stable cursor in the list of entries: each getdents call resumes from
+ * where the previous one stopped, instead of rescanning the directory from the start. */
+static boolean getdents_snapshot(file f, tuple md, tuple c)
+{
+    if (f->dirents) {
+        vector_clear(f->dirents);
+    } else {
+        f->dirents = allocate_vector(heap_locked(get_kernel_heaps()), 16);
+        if (f->dirents == INVALID_ADDRESS) {
+            f->dirents = 0;
+            return false;
+        }
+    }
+    vector_push(f->dirents, sym_this("."));
+    vector_push(f->dirents, sym_this(".."));
+    iterate(c, stack_closure(getdents_snapshot_each, f->dirents));
     return true;
 }
 
@@ -1273,27 +1819,43 @@ static sysreturn getdents_internal(int fd, void *dirp, unsigned int count, boole
         rv = -EFAULT;
         goto out;
     }
-    md = filesystem_get_meta(f->fs, f->n);
+    filesystem fs = f->fs;
+    md = filesystem_get_meta(fs, f->n);
     tuple c;
     if (!md || !(c = children(md))) {
         rv = -ENOTDIR;
         goto out;
     }
-
-    int r = 0;
-    int read_sofar = 0, written_sofar = 0;
-    binding_handler h = stack_closure(getdents_each, f, &dirp, dirent64,
-                                      &read_sofar, &written_sofar, &count, &r, f->fs);
-    symbol parent_sym = sym_this("..");
-    if (apply(h, sym_this("."), md) && apply(h, parent_sym, get_tuple(md, parent_sym)))
-        iterate(c, h);
+    if ((!f->dirents || (f->offset == 0)) && !getdents_snapshot(f, md, c)) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    u64 index;
+    unsigned int written = 0;
+    for (index = f->offset; index < vector_length(f->dirents); index++) {
+        symbol s = vector_get(f->dirents, index);
+        tuple n;
+        if (index == 0)
+            n = md;
+        else if (index == 1)
+            n = get_tuple(md, s);
+        else
+            n = get_tuple(c, s);
+        if (!n) /* entry removed since the directory stream was started */
+            continue;
+        int reclen = write_dirent(dirp + written, dirent64, count - written, symbol_string(s),
+                                  fs->get_inode(fs, n), dt_from_tuple(n), index + 1);
+        if (!reclen)
+            break;
+        written += reclen;
+    }
     fs_notify_event(md, IN_ACCESS);
-    filesystem_update_relatime(f->fs, md);
-    f->offset = read_sofar;
-    if (r < 0 && written_sofar == 0)
+    filesystem_update_relatime(fs, md);
+    f->offset = index;
+    if ((written == 0) && (index < vector_length(f->dirents)))
         rv = -EINVAL;
     else
-        rv = written_sofar;
+        rv = written;
   out:
     if (md)
         filesystem_put_meta(f->fs, md);
@@ -1617,18 +2179,11 @@ static void fill_stat(int type, filesystem fs, fsfile f, tuple n, struct stat *s
     }
 }
 
-static sysreturn fstat(int fd, struct stat *s)
+static void fdesc_fill_stat(fdesc f, struct stat *s)
 {
-    thread_log(current, "fd %d, stat %p", fd, s);
-    fdesc f = resolve_fd(current->p, fd);
     filesystem fs;
     tuple n;
     fsfile fsf = 0;
-    sysreturn rv = 0;
-    if (!fault_in_user_memory(s, sizeof(struct stat), true)) {
-        rv = -EFAULT;
-        goto out;
-    }
     switch (f->type) {
     case FDESC_TYPE_REGULAR:
         fsf = ((file)f)->fsf;
@@ -1647,24 +2202,33 @@ static sysreturn fstat(int fd, struct stat *s)
     fill_stat(f->type, fs, fsf, n, s);
     if (n)
         filesystem_put_meta(fs, n);
+}
+
+static sysreturn fstat(int fd, struct stat *s)
+{
+    thread_log(current, "fd %d, stat %p", fd, s);
+    fdesc f = resolve_fd(current->p, fd);
+    sysreturn rv = 0;
+    if (!fault_in_user_memory(s, sizeof(struct stat), true)) {
+        rv = -EFAULT;
+        goto out;
+    }
+    fdesc_fill_stat(f, s);
     thread_log(current, "st_ino %lx, st_mode 0x%x, st_size %lx", s->st_ino, s->st_mode, s->st_size);
   out:
     fdesc_put(f);
     return rv;
 }
 
-static sysreturn stat_internal(filesystem fs, inode cwd, sstring name, boolean follow,
-        struct stat *buf)
+/* If get_size is false, the file size and allocated blocks are not retrieved, which avoids opening
+ * the file (an expensive operation on remote filesystems). */
+static sysreturn node_fill_stat(filesystem fs, inode cwd, sstring name, boolean follow,
+                                boolean get_size, struct stat *buf)
 {
     tuple n;
-    fsfile fsf;
-
-    if (!fault_in_user_memory(buf, sizeof(struct stat), true))
-        return -EFAULT;
-
-    thread_log(current, "stat: cwd 0x%lx, \"%s\", %sfollow, buf %p", cwd, name,
-               follow ? sstring_empty() : ss("no "), buf);
-    fs_status fss = filesystem_get_node(&fs, cwd, name, !follow, false, false, false, &n, &fsf);
+    fsfile fsf = 0;
+    fs_status fss = filesystem_get_node(&fs, cwd, name, !follow, false, false, false, &n,
+                                        get_size ? &fsf : 0);
     if (fss != FS_STATUS_OK)
         return sysreturn_from_fs_status(fss);
 
@@ -1672,11 +2236,24 @@ static sysreturn stat_internal(filesystem fs, inode cwd, sstring name, boolean f
     filesystem_put_node(fs, n);
     if (fsf)
         fsfile_release(fsf);
-    thread_log(current, "st_ino %lx, st_mode 0x%x, st_size %lx",
-               buf->st_ino, buf->st_mode, buf->st_size);
     return 0;
 }
 
+static sysreturn stat_internal(filesystem fs, inode cwd, sstring name, boolean follow,
+        struct stat *buf)
+{
+    if (!fault_in_user_memory(buf, sizeof(struct stat), true))
+        return -EFAULT;
+
+    thread_log(current, "stat: cwd 0x%lx, \"%s\", %sfollow, buf %p", cwd, name,
+               follow ? sstring_empty() : ss("no "), buf);
+    sysreturn rv = node_fill_stat(fs, cwd, name, follow, true, buf);
+    if (rv == 0)
+        thread_log(current, "st_ino %lx, st_mode 0x%x, st_size %lx",
+                   buf->st_ino, buf->st_mode, buf->st_size);
+    return rv;
+}
+
 #ifdef __x86_64__
 
 static sysreturn stat_cwd(const char *name, boolean follow, struct stat *buf)
@@ -1718,6 +2295,59 @@ static sysreturn newfstatat(int dfd, const char *name, struct stat *s, int flags
     return rv;
 }
 
+static sysreturn statx(int dirfd, const char *pathname, int flags, unsigned int mask,
+                       struct statx *buf)
+{
+    thread_log(current, "%s: dirfd %d, pathname %p, flags 0x%x, mask 0x%x, buf %p", func_ss,
+               dirfd, pathname, flags, mask, buf);
+    if ((flags & ~(AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_EMPTY_PATH | AT_STATX_SYNC_TYPE)) ||
+        ((flags & AT_STATX_SYNC_TYPE) == AT_STATX_SYNC_TYPE) || (mask & STATX__RESERVED))
+        return -EINVAL;
+    if (!fault_in_user_memory(buf, sizeof(struct statx), true))
+        return -EFAULT;
+    sstring name_ss;
+    if (!fault_in_user_string(pathname, &name_ss))
+        return -EFAULT;
+
+    /* Size and block count are the only attributes that may need the file to be opened; all the
+     * other attributes are retrieved from the (cached) file metadata. */
+    boolean get_size = (mask & (STATX_SIZE | STATX_BLOCKS)) != 0;
+    struct stat s;
+    sysreturn rv;
+    if ((flags & AT_EMPTY_PATH) && sstring_is_empty(name_ss)) {
+        fdesc f = resolve_fd(current->p, dirfd);
+        fdesc_fill_stat(f, &s);
+        fdesc_put(f);
+        get_size = true;
+    } else {
+        filesystem fs;
+        inode cwd = resolve_dir(fs, dirfd, pathname, name_ss);
+        rv = node_fill_stat(fs, cwd, name_ss, !(flags & AT_SYMLINK_NOFOLLOW), get_size, &s);
+        filesystem_release(fs);
+        if (rv)
+            return rv;
+    }
+    zero(buf, sizeof(struct statx));
+    buf->stx_mask = STATX_BASIC_STATS;
+    if (!get_size)
+        buf->stx_mask &= ~(STATX_SIZE | STATX_BLOCKS);
+    buf->stx_blksize = s.st_blksize;
+    buf->stx_nlink = 1;
+    buf->stx_mode = s.st_mode;
+    buf->stx_ino = s.st_ino;
+    buf->stx_size = s.st_size;
+    buf->stx_blocks = s.st_blocks;
+    buf->stx_atime.tv_sec = s.st_atime;
+    buf->stx_atime.tv_nsec = s.st_atime_nsec;
+    buf->stx_ctime.tv_sec = buf->stx_mtime.tv_sec = s.st_mtime;
+    buf->stx_ctime.tv_nsec = buf->stx_mtime.tv_nsec = s.st_mtime_nsec;
+    buf->stx_rdev_major = MAJOR(s.st_rdev);
+    buf->stx_rdev_minor = MINOR(s.st_rdev);
+    thread_log(current, "  stx_ino %lx, stx_mode 0x%x, stx_size %lx", buf->stx_ino,
+               buf->stx_mode, buf->stx_size);
+    return 0;
+}
+
 sysreturn lseek(int fd, s64 offset, int whence)
 {
     thread_log(current, "%s: fd %d offset %ld whence %s",
@@ -1937,7 +2567,7 @@ static sysreturn brk(void *addr)
             !adjust_process_heap(p, irange(p->heap_base, new_end)))
             goto out;
         write_barrier();
-        unmap_and_free_phys(new_end, old_end - new_end);
+        unmap_and_free_anonymous(p->heap_map->flags, new_end, old_end - new_end);
     } else if (new_end > old_end) {
         u64 alloc = new_end - old_end;
         if (!validate_user_memory(pointer_from_u64(old_end), alloc, true) ||
@@ -2114,7 +2744,7 @@ sysreturn close(int fd)
     fdesc f = resolve_fd(current->p, fd);
     deallocate_fd(current->p, fd);
 
-    if (fetch_and_add(&f->refcnt, -2) == 2) {
+    if (fdesc_put_removed(f, 1)) {
         if (f->close)
             return apply(f->close, get_current_context(current_cpu()), syscall_io_complete);
         msg_err("no close handler for fd %d\n", fd);
@@ -2232,6 +2862,18 @@ sysreturn ioctl_generic(fdesc f, unsigned long request, vlist ap)
     case FIONCLEX:
     case FIOCLEX:
         return 0;
+    case FICLONE:
+        if (f->type != FDESC_TYPE_REGULAR)
+            return -EINVAL;
+        return file_clone((file)f, varg(ap, int), 0, 0, 0);
+    case FICLONERANGE: {
+        if (f->type != FDESC_TYPE_REGULAR)
+            return -EINVAL;
+        struct file_clone_range fcr;
+        if (!copy_from_user(varg(ap, struct file_clone_range *), &fcr, sizeof(fcr)))
+            return -EFAULT;
+        return file_clone((file)f, fcr.src_fd, fcr.src_offset, fcr.src_length, fcr.dest_offset);
+    }
     default:
         return -ENOSYS;
     }
@@ -2331,14 +2973,27 @@ sysreturn sched_setaffinity(int pid, u64 cpusetsize, u64 *mask)
 {
     if (!fault_in_user_memory(mask, cpusetsize, false))
         return set_syscall_error(current, EFAULT);
+    u64 ncpus = MIN(total_processors, 64 * (cpusetsize / sizeof(u64)));
+    u64 first_cpu;
+    for (first_cpu = 0; first_cpu < ncpus; first_cpu++)
+        if (mask[first_cpu / 64] & U64_FROM_BIT(first_cpu % 64))
+            break;
+    if (first_cpu == ncpus)
+        return set_syscall_error(current, EINVAL);
     thread t;
     if (!(t = lookup_thread(pid)))
             return set_syscall_error(current, EINVAL);
-    u64 cpus = pad(MIN(total_processors, 64 * (cpusetsize / sizeof(u64))), 64);
+    u64 cpus = pad(ncpus, 64);
     thread_lock(t);
     runtime_memcpy(bitmap_base(t->affinity), mask, cpus / 8);
-    if (cpus < total_processors)
-        bitmap_range_check_and_set(t->affinity, cpus, total_processors - cpus, false, false);
+    if (cpus < present_processors)
+        bitmap_range_check_and_set(t->affinity, cpus, present_processors - cpus, false, false);
+
+    /* If the thread is not on an allowed CPU, move it (this is the only way for a thread to go to
+     * an isolated CPU, as load balancing does not move threads to and from isolated CPUs). */
+    cpuinfo ci = struct_from_field(t->scheduling_queue, cpuinfo, thread_queue);
+    if (!bitmap_get(t->affinity, ci->id))
+        t->scheduling_queue = &cpuinfo_from_id(first_cpu)->thread_queue;
     thread_unlock(t);
     thread_release(t);
     return 0;
@@ -2361,6 +3016,328 @@ sysreturn sched_getaffinity(int pid, u64 cpusetsize, u64 *mask)
     return cpusetsize;
 }
 
+static boolean sched_policy_valid(int policy, int prio)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return (prio >= 1) && (prio <= SCHED_RT_PRIO_MAX);
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        return (prio == 0);
+    default:
+        return false;
+    }
+}
+
+/* Real-time policies (SCHED_FIFO, SCHED_RR) place a thread in the real-time scheduling class;
+ * the other policies are served by the fair class, where SCHED_BATCH is equivalent to
+ * SCHED_OTHER. */
+sysreturn sched_setscheduler(int pid, int policy, struct sched_param *param)
+{
+    struct sched_param p;
+    if (pid < 0)
+        return -EINVAL;
+    if (!param)
+        return -EINVAL;
+    if (!copy_from_user(param, &p, sizeof(p)))
+        return -EFAULT;
+    policy &= ~SCHED_RESET_ON_FORK;
+    if (!sched_policy_valid(policy, p.sched_priority))
+        return -EINVAL;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    thread_lock(t);
+    thread_set_sched(t, policy, p.sched_priority, t->task.nice, t->task.slice);
+    thread_unlock(t);
+    thread_release(t);
+    return 0;
+}
+
+sysreturn sched_getscheduler(int pid)
+{
+    if (pid < 0)
+        return -EINVAL;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    sysreturn rv = t->sched_policy;
+    thread_release(t);
+    return rv;
+}
+
+sysreturn sched_setparam(int pid, struct sched_param *param)
+{
+    struct sched_param p;
+    if ((pid < 0) || !param)
+        return -EINVAL;
+    if (!copy_from_user(param, &p, sizeof(p)))
+        return -EFAULT;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    sysreturn rv = 0;
+    thread_lock(t);
+    if (sched_policy_valid(t->sched_policy, p.sched_priority))
+        thread_set_sched(t, t->sched_policy, p.sched_priority, t->task.nice, t->task.slice);
+    else
+        rv = -EINVAL;
+    thread_unlock(t);
+    thread_release(t);
+    return rv;
+}
+
+sysreturn sched_getparam(int pid, struct sched_param *param)
+{
+    if ((pid < 0) || !param)
+        return -EINVAL;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    struct sched_param p = {
+        .sched_priority = t->task.rt_prio,
+    };
+    thread_release(t);
+    if (!copy_to_user(param, &p, sizeof(p)))
+        return -EFAULT;
+    return 0;
+}
+
+sysreturn sched_get_priority_max(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return SCHED_RT_PRIO_MAX;
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+sysreturn sched_get_priority_min(int policy)
+{
+    switch (policy) {
+    case SCHED_FIFO:
+    case SCHED_RR:
+        return 1;
+    case SCHED_OTHER:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+sysreturn sched_rr_get_interval(int pid, struct timespec *tp)
+{
+    if (pid < 0)
+        return -EINVAL;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    struct timespec ts;
+    timespec_from_time(&ts, sched_task_quantum(&t->task));
+    thread_release(t);
+    if (!copy_to_user(tp, &ts, sizeof(ts)))
+        return -EFAULT;
+    return 0;
+}
+
+/* The sched_runtime attribute of fair threads is the requested time slice: threads with shorter
+ * slices are scheduled with lower latency, with the same share of CPU time. */
+sysreturn sched_setattr(int pid, struct sched_attr *uattr, unsigned int flags)
+{
+    struct sched_attr attr;
+    u32 size;
+    if ((pid < 0) || !uattr || flags)
+        return -EINVAL;
+    if (!copy_from_user(&uattr->size, &size, sizeof(size)))
+        return -EFAULT;
+    if (!size)
+        size = SCHED_ATTR_SIZE_VER0;
+    if (size < SCHED_ATTR_SIZE_VER0)
+        return -E2BIG;
+    zero(&attr, sizeof(attr));
+    if (!copy_from_user(uattr, &attr, MIN(size, sizeof(attr))))
+        return -EFAULT;
+    if ((attr.sched_flags & ~SCHED_FLAG_RESET_ON_FORK) ||
+        !sched_policy_valid(attr.sched_policy, attr.sched_priority))
+        return -EINVAL;
+    timestamp slice = 0;
+    if ((attr.sched_policy != SCHED_FIFO) && (attr.sched_policy != SCHED_RR) &&
+        attr.sched_runtime) {
+        slice = nanoseconds(attr.sched_runtime);
+        slice = MAX(MIN(slice, microseconds(SCHED_SLICE_MAX_US)),
+                    microseconds(SCHED_SLICE_MIN_US));
+    }
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    thread_lock(t);
+    thread_set_sched(t, attr.sched_policy, attr.sched_priority, attr.sched_nice, slice);
+    thread_unlock(t);
+    thread_release(t);
+    return 0;
+}
+
+sysreturn sched_getattr(int pid, struct sched_attr *uattr, unsigned int size, unsigned int flags)
+{
+    if ((pid < 0) || !uattr || (size < SCHED_ATTR_SIZE_VER0) || flags)
+        return -EINVAL;
+    thread t = lookup_thread(pid);
+    if (!t)
+        return -ESRCH;
+    struct sched_attr attr = {
+        .size = sizeof(attr),
+        .sched_policy = t->sched_policy,
+        .sched_nice = t->task.nice,
+        .sched_priority = t->task.rt_prio,
+        .sched_runtime = (t->task.sched_class == SCHED_CLASS_FAIR) ?
+            nsec_from_timestamp(sched_task_quantum(&t->task)) : 0,
+    };
+    thread_release(t);
+    if (!copy_to_user(uattr, &attr, MIN(size, sizeof(attr))))
+        return -EFAULT;
+    return 0;
+}
+
+closure_function(1, 1, boolean, setpriority_handler,
+                 int, nice,
+                 rbnode n)
+{
+    thread t = struct_from_field(n, thread, n);
+    thread_set_sched(t, t->sched_policy, t->task.rt_prio, bound(nice), t->task.slice);
+    return true;
+}
+
+/* The nice value of a thread sets its weight in the fair scheduling class; the process group and
+ * user targets refer to all threads of the process. */
+sysreturn setpriority(int which, int who, int prio)
+{
+    int nice = MAX(MIN(prio, 19), -20);
+    switch (which) {
+    case PRIO_PROCESS: {
+        thread t = lookup_thread(who);
+        if (!t)
+            return -ESRCH;
+        thread_lock(t);
+        thread_set_sched(t, t->sched_policy, t->task.rt_prio, nice, t->task.slice);
+        thread_unlock(t);
+        thread_release(t);
+        break;
+    }
+    case PRIO_PGRP:
+    case PRIO_USER: {
+        process p = current->p;
+        spin_lock(&p->threads_lock);
+        rbtree_traverse(p->threads, RB_INORDER, stack_closure(setpriority_handler, nice));
+        spin_unlock(&p->threads_lock);
+        break;
+    }
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/* As the raw syscall, returns 20 minus the nice value. */
+sysreturn getpriority(int which, int who)
+{
+    switch (which) {
+    case PRIO_PROCESS: {
+        thread t = lookup_thread(who);
+        if (!t)
+            return -ESRCH;
+        sysreturn rv = 20 - t->task.nice;
+        thread_release(t);
+        return rv;
+    }
+    case PRIO_PGRP:
+    case PRIO_USER:
+        return 20 - current->task.nice;
+    default:
+        return -EINVAL;
+    }
+}
+
+closure_function(1, 1, boolean, ioprio_set_handler,
+                 u16, ioprio,
+                 rbnode n)
+{
+    thread t = struct_from_field(n, thread, n);
+    t->context.ioprio = bound(ioprio);
+    return true;
+}
+
+/* The I/O priority of a thread is applied to the storage requests submitted by its syscalls; the
+ * process group and user targets refer to all threads of the process. */
+sysreturn ioprio_set(int which, int who, int ioprio)
+{
+    int level = IOPRIO_PRIO_DATA(ioprio);
+    switch (IOPRIO_PRIO_CLASS(ioprio)) {
+    case IOPRIO_CLASS_NONE:
+        if (level)
+            return -EINVAL;
+        break;
+    case IOPRIO_CLASS_RT:
+    case IOPRIO_CLASS_BE:
+        if (level >= IOPRIO_NR_LEVELS)
+            return -EINVAL;
+        break;
+    case IOPRIO_CLASS_IDLE:
+        break;
+    default:
+        return -EINVAL;
+    }
+    switch (which) {
+    case IOPRIO_WHO_PROCESS: {
+        thread t = lookup_thread(who);
+        if (!t)
+            return -ESRCH;
+        t->context.ioprio = ioprio;
+        thread_release(t);
+        break;
+    }
+    case IOPRIO_WHO_PGRP:
+    case IOPRIO_WHO_USER: {
+        process p = current->p;
+        spin_lock(&p->threads_lock);
+        rbtree_traverse(p->threads, RB_INORDER, stack_closure(ioprio_set_handler, ioprio));
+        spin_unlock(&p->threads_lock);
+        break;
+    }
+    default:
+        return -EINVAL;
+    }
+    return 0;
+}
+
+sysreturn ioprio_get(int which, int who)
+{
+    switch (which) {
+    case IOPRIO_WHO_PROCESS: {
+        thread t = lookup_thread(who);
+        if (!t)
+            return -ESRCH;
+        sysreturn rv = t->context.ioprio;
+        thread_release(t);
+        return rv;
+    }
+    case IOPRIO_WHO_PGRP:
+    case IOPRIO_WHO_USER:
+        return current->context.ioprio;
+    default:
+        return -EINVAL;
+    }
+}
+
 sysreturn capget(cap_user_header_t hdrp, cap_user_data_t datap)
 {
     if (datap) {
@@ -2472,11 +3449,16 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, fadvise64, fadvise64, SYSCALL_F_SET_DESC);
     register_syscall(map, fstat, fstat, SYSCALL_F_SET_DESC);
     register_syscall(map, newfstatat, newfstatat, SYSCALL_F_SET_FILE|SYSCALL_F_SET_DESC);
+    register_syscall(map, statx, statx, SYSCALL_F_SET_FILE|SYSCALL_F_SET_DESC);
     register_syscall(map, readv, readv, SYSCALL_F_SET_DESC);
     register_syscall(map, writev, writev, SYSCALL_F_SET_DESC);
     register_syscall(map, preadv, preadv, SYSCALL_F_SET_DESC);
     register_syscall(map, pwritev, pwritev, SYSCALL_F_SET_DESC);
     register_syscall(map, sendfile, sendfile, SYSCALL_F_SET_DESC|SYSCALL_F_SET_NET);
+    register_syscall(map, copy_file_range, copy_file_range, SYSCALL_F_SET_DESC);
+    register_syscall(map, splice, splice, SYSCALL_F_SET_DESC);
+    register_syscall(map, tee, tee, SYSCALL_F_SET_DESC);
+    register_syscall(map, vmsplice, vmsplice, SYSCALL_F_SET_DESC);
     register_syscall(map, truncate, truncate, SYSCALL_F_SET_FILE);
     register_syscall(map, ftruncate, ftruncate, SYSCALL_F_SET_DESC);
     register_syscall(map, fdatasync, fdatasync, SYSCALL_F_SET_DESC);
@@ -2505,7 +3487,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, setrlimit, setrlimit, 0);
     register_syscall(map, prlimit64, prlimit64, 0);
     register_syscall(map, getrusage, getrusage, 0);
-    register_syscall(map, getpid, getpid, 0);
+    register_syscall(map, getpid, getpid, SYSCALL_F_LEAF);
     register_syscall(map, exit_group, exit_group, SYSCALL_F_SET_PROC);
     register_syscall(map, exit, (sysreturn (*)())exit, SYSCALL_F_SET_PROC);
     register_syscall(map, getdents64, getdents64, SYSCALL_F_SET_DESC);
@@ -2518,8 +3500,21 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, fchdir, fchdir, SYSCALL_F_SET_DESC);
     register_syscall(map, sched_getaffinity, sched_getaffinity, 0);
     register_syscall(map, sched_setaffinity, sched_setaffinity, 0);
-    register_syscall(map, getuid, syscall_ignore, 0);
-    register_syscall(map, geteuid, syscall_ignore, 0);
+    register_syscall(map, sched_setscheduler, sched_setscheduler, 0);
+    register_syscall(map, sched_getscheduler, sched_getscheduler, 0);
+    register_syscall(map, sched_setparam, sched_setparam, 0);
+    register_syscall(map, sched_getparam, sched_getparam, 0);
+    register_syscall(map, sched_get_priority_max, sched_get_priority_max, SYSCALL_F_LEAF);
+    register_syscall(map, sched_get_priority_min, sched_get_priority_min, SYSCALL_F_LEAF);
+    register_syscall(map, sched_rr_get_interval, sched_rr_get_interval, 0);
+    register_syscall(map, sched_setattr, sched_setattr, 0);
+    register_syscall(map, sched_getattr, sched_getattr, 0);
+    register_syscall(map, setpriority, setpriority, 0);
+    register_syscall(map, getpriority, getpriority, 0);
+    register_syscall(map, ioprio_set, ioprio_set, 0);
+    register_syscall(map, ioprio_get, ioprio_get, 0);
+    register_syscall(map, getuid, syscall_ignore, SYSCALL_F_LEAF);
+    register_syscall(map, geteuid, syscall_ignore, SYSCALL_F_LEAF);
     register_syscall(map, setgroups, syscall_ignore, 0);
     register_syscall(map, setuid, syscall_ignore, 0);
     register_syscall(map, setgid, syscall_ignore, 0);
@@ -2527,7 +3522,7 @@ void register_file_syscalls(struct syscall *map)
     register_syscall(map, capset, syscall_ignore, 0);
     register_syscall(map, prctl, prctl, 0);
     register_syscall(map, sysinfo, sysinfo, 0);
-    register_syscall(map, umask, umask, 0);
+    register_syscall(map, umask, umask, SYSCALL_F_LEAF);
     register_syscall(map, statfs, statfs, SYSCALL_F_SET_FILE);
     register_syscall(map, fstatfs, fstatfs, SYSCALL_F_SET_DESC);
     register_syscall(map, io_uring_setup, io_uring_setup, SYSCALL_F_SET_DESC);
@@ -2563,6 +3558,125 @@ void count_syscall(thread t, sysreturn rv)
     fetch_and_add(&ss->usecs, us);
 }
 
+void syscall_latency_record(thread t, sysreturn rv)
+{
+    int call = t->syscall_lat_call;
+    t->syscall_lat_call = -1;
+    u64 ns = nsec_from_timestamp(now(CLOCK_ID_MONOTONIC_RAW) - t->syscall_lat_start);
+    int bucket = (ns >> SYSCALL_LAT_MIN_ORDER) ? msb(ns) + 1 - SYSCALL_LAT_MIN_ORDER : 0;
+    trace(syscall_exit, t->tid, call, rv, ns);
+    u64 flags = irq_disable_save();
+    syscall_lat sl = &syscall_lats[current_cpu()->id * SYS_MAX + call];
+    sl->calls++;
+    if (rv < 0 && rv >= -255)
+        sl->errors++;
+    sl->nsecs += ns;
+    sl->hist[MIN(bucket, SYSCALL_LAT_BUCKETS - 1)]++;
+    irq_restore(flags);
+}
+
+static void syscall_latency_sum(int call, syscall_lat sum)
+{
+    zero(sum, sizeof(*sum));
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        syscall_lat sl = &syscall_lats[cpu * SYS_MAX + call];
+        sum->calls += sl->calls;
+        sum->errors += sl->errors;
+        sum->nsecs += sl->nsecs;
+        for (int i = 0; i < SYSCALL_LAT_BUCKETS; i++)
+            sum->hist[i] += sl->hist[i];
+    }
+}
+
+/* returns the management tuple of a syscall, updated with the current statistics */
+static tuple syscall_latency_value(int call)
+{
+    struct syscall_lat sum;
+    syscall_latency_sum(call, &sum);
+    spin_lock(&syscall_lat_mgmt.lock);
+    tuple t = syscall_lat_mgmt.values[call];
+    if (!t) {
+        t = allocate_tuple();
+        assert(t != INVALID_ADDRESS);
+        set(t, sym(latency), allocate_tuple());
+        syscall_lat_mgmt.values[call] = t;
+    }
+    set(t, sym(calls), value_from_u64(sum.calls));
+    set(t, sym(errors), value_from_u64(sum.errors));
+    set(t, sym(nsecs), value_from_u64(sum.nsecs));
+    tuple hist = get_tuple(t, sym(latency));
+    for (int i = 0; i < SYSCALL_LAT_BUCKETS; i++) {
+        if (sum.hist[i])
+            set(hist, intern_u64(i ? U64_FROM_BIT(SYSCALL_LAT_MIN_ORDER + i - 1) : 0),
+                value_from_u64(sum.hist[i]));
+    }
+    spin_unlock(&syscall_lat_mgmt.lock);
+    return t;
+}
+
+closure_func_basic(tuple_get, value, syscall_stats_get,
+                   value a)
+{
+    if (!is_symbol(a))
+        return 0;
+    u64 n = u64_from_pointer(table_find(syscall_lat_mgmt.syms, a));
+    return n ? syscall_latency_value(n - 1) : 0;
+}
+
+closure_func_basic(tuple_set, void, syscall_stats_set,
+                   value a, value v)
+{
+    /* read-only */
+}
+
+closure_func_basic(tuple_iterate, boolean, syscall_stats_iterate,
+                   binding_handler h)
+{
+    for (int call = 0; call < SYS_MAX; call++) {
+        if (sstring_is_null(linux_syscalls[call].name))
+            continue;
+        boolean called = false;
+        for (u64 cpu = 0; cpu < total_processors; cpu++) {
+            if (syscall_lats[cpu * SYS_MAX + call].calls) {
+                called = true;
+                break;
+            }
+        }
+        if (called && !apply(h, sym_sstring(linux_syscalls[call].name),
+                             syscall_latency_value(call)))
+            return false;
+    }
+    return true;
+}
+
+static void init_syscall_latency(heap h)
+{
+    syscall_lats = allocate_zero(h, present_processors * SYS_MAX * sizeof(struct syscall_lat));
+    assert(syscall_lats != INVALID_ADDRESS);
+    syscall_lat_mgmt.h = h;
+    spin_lock_init(&syscall_lat_mgmt.lock);
+}
+
+/* Exposes the statistics of called syscalls, keyed by syscall name, in the management tree */
+void syscall_latency_management(tuple root)
+{
+    heap h = syscall_lat_mgmt.h;
+    syscall_lat_mgmt.values = allocate_zero(h, SYS_MAX * sizeof(tuple));
+    assert(syscall_lat_mgmt.values != INVALID_ADDRESS);
+    syscall_lat_mgmt.syms = allocate_table(h, identity_key, pointer_equal);
+    assert(syscall_lat_mgmt.syms != INVALID_ADDRESS);
+    for (int call = 0; call < SYS_MAX; call++) {
+        if (!sstring_is_null(linux_syscalls[call].name))
+            table_set(syscall_lat_mgmt.syms, sym_sstring(linux_syscalls[call].name),
+                      pointer_from_u64((u64)call + 1));
+    }
+    tuple ft = allocate_function_tuple(closure_func(h, tuple_get, syscall_stats_get),
+                                       closure_func(h, tuple_set, syscall_stats_set),
+                                       closure_func(h, tuple_iterate, syscall_stats_iterate));
+    assert(ft != INVALID_ADDRESS);
+    set(root, sym(syscall_stats), ft);
+}
+
 static boolean debugsyscalls;
 
 static void syscall_context_pause(context ctx)
@@ -2571,6 +3685,8 @@ static void syscall_context_pause(context ctx)
     syscall_accumulate_stime(sc);
     if (sc->call >= 0)
         count_syscall_save(sc->t);
+    if (sc->t)
+        perf_event_thread_pause(sc->t);
     context_release_refcount(ctx);
 }
 
@@ -2582,6 +3698,8 @@ static void syscall_context_resume(context ctx)
     sc->start_time = here == 0 ? 1 : here;
     if (sc->call >= 0)
         count_syscall_resume(sc->t);
+    if (sc->t)
+        perf_event_thread_resume(sc->t);
     context_reserve_refcount(ctx);
 }
 
@@ -2606,6 +3724,30 @@ syscall_context allocate_syscall_context(cpuinfo ci)
     return sc;
 }
 
+static boolean syscall_leaf_allowed(thread t)
+{
+    return !do_syscall_stats && !debugsyscalls && !t->p->trap &&
+           !(shutting_down & SHUTDOWN_ONGOING) &&
+           !((sigstate_get_pending(&t->signals) | sigstate_get_pending(&t->p->signals)) &
+             ~t->signal_mask) && (t->saved_signal_mask == -1ull);
+}
+
+/* Leaf syscalls run directly on the syscall context stack, with interrupts disabled, and return to
+ * the user thread without any context switch or pass through the scheduler. */
+static void __attribute__((noreturn)) syscall_leaf(cpuinfo ci, syscall_context sc, thread t,
+                                                   u64 call, u64 arg0)
+{
+    context_frame f = thread_frame(t);
+    sc->t = t;  /* so that the handler can refer to the current thread */
+    sysreturn (*h)(u64, u64, u64, u64, u64, u64) = t->p->syscalls[call].handler;
+    set_syscall_return(t, h(arg0, f[SYSCALL_FRAME_ARG1], f[SYSCALL_FRAME_ARG2],
+                            f[SYSCALL_FRAME_ARG3], f[SYSCALL_FRAME_ARG4], f[SYSCALL_FRAME_ARG5]));
+    set_current_context(ci, &t->context);
+    ci->state = cpu_user;
+    thread_release(t);  /* frame save reference */
+    frame_return(f);
+}
+
 void syscall_handler(thread t)
 {
     /* The syscall_context stored in ci was set as current on syscall entry in
@@ -2623,10 +3765,15 @@ void syscall_handler(thread t)
     set_syscall_return(t, -ENOSYS);
 
     syscall_context sc = (syscall_context)get_current_context(ci);
+    if ((call < sizeof(_linux_syscalls) / sizeof(_linux_syscalls[0])) &&
+        (t->p->syscalls[call].flags & SYSCALL_F_LEAF) && syscall_leaf_allowed(t))
+        syscall_leaf(ci, sc, t, call, arg0);
+
     context ctx = &sc->uc.kc.context;
     assert(is_syscall_context(ctx));
     sc->t = t;
     ctx->fault_handler = t->context.fault_handler;
+    ctx->ioprio = t->context.ioprio;
     sc->start_time = 0;
     sc->call = call;
     assert(ctx->refcount.c == 1);
@@ -2644,6 +3791,9 @@ void syscall_handler(thread t)
     }
 
     /* In the future, interrupt enable can go here. */
+    t->syscall_lat_call = call;
+    t->syscall_lat_start = now(CLOCK_ID_MONOTONIC_RAW);
+    trace(syscall_enter, t->tid, call, arg0);
     if (do_syscall_stats) {
         assert(t->last_syscall == -1);
         t->last_syscall = call;
@@ -2667,6 +3817,7 @@ void syscall_handler(thread t)
         assert(ctx->refcount.c > 1);
         context_release_refcount(ctx);
         set_syscall_return(t, rv);
+        count_syscall_latency(t, rv);
         if (do_syscall_stats)
             count_syscall(t, rv);
         if (debugsyscalls)
@@ -2677,6 +3828,7 @@ void syscall_handler(thread t)
         else
             thread_log(t, "nosyscall %d", call);
     }
+    count_syscall_latency(t, -ENOSYS);
     if (do_syscall_stats)
         count_syscall(t, 0);
   out:
@@ -2827,6 +3979,7 @@ void init_syscalls(process p)
         filesystem_read_entire(fs, hostname_t, h,
                                closure_func(h, buffer_handler, hostname_done), ignore_status);
     tuple root = p->process_root;
+    init_syscall_latency(h);
     do_syscall_stats = get(root, sym(syscall_summary)) != 0;
     if (do_syscall_stats) {
         shutdown_handler print_syscall_stats = closure_func(h, shutdown_handler,
@@ -2861,6 +4014,7 @@ void *swap_syscall_handler(struct syscall *m, int n, sysreturn (*f)())
 {
     sysreturn (*ret)() = m[n].handler;
     m[n].handler = f;
+    m[n].flags &= ~SYSCALL_F_LEAF;  /* the new handler may block */
     return ret;
 }
 
@@ -78,6 +78,7 @@ typedef struct iovec {
 #define EMLINK          31              /* Too many links */
 #define EPIPE           32              /* Broken pipe */
 #define ERANGE          34              /* Math result not representable */
+#define EDEADLK         35              /* Resource deadlock avoided */
 #define ENAMETOOLONG    36              /* File name too long */
 
 #define ENOSYS          38              /* Invalid system call number */
@@ -87,6 +88,7 @@ typedef struct iovec {
 
 #define ENODATA         61		/* No data available */
 #define ETIME           62		/* Timer expired */
+#define EBADMSG         74		/* Not a data message */
 #define EOVERFLOW       75		/* Value too large for defined data type */
 #define EBADFD          77		/* File descriptor in bad state */
 #define EDESTADDRREQ    89		/* Destination address required */
@@ -139,6 +141,12 @@ typedef struct iovec {
 #define F_ADD_SEALS     (F_LINUX_SPECIFIC_BASE + 9)
 #define F_GET_SEALS     (F_LINUX_SPECIFIC_BASE + 10)
 
+/* flags for splice(), tee() and vmsplice() */
+#define SPLICE_F_MOVE       0x01
+#define SPLICE_F_NONBLOCK   0x02
+#define SPLICE_F_MORE       0x04
+#define SPLICE_F_GIFT       0x08
+
 /* Values for 'mode' argument of access/faccessat syscalls */
 #define F_OK    0x0
 #define X_OK    0x1
@@ -174,6 +182,54 @@ struct flock {
 #define FIONBIO         0x5421
 #define FIONCLEX        0x5450
 #define FIOCLEX         0x5451
+#define FICLONE         0x40049409
+#define FICLONERANGE    0x4020940d
+
+struct file_clone_range {
+    s64 src_fd;
+    u64 src_offset;
+    u64 src_length;
+    u64 dest_offset;
+};
+
+/* ioprio_set(2) targets */
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_WHO_PGRP     2
+#define IOPRIO_WHO_USER     3
+
+#define IOPRIO_NR_LEVELS    8
+
+/* scheduling policies */
+#define SCHED_OTHER     0
+#define SCHED_FIFO      1
+#define SCHED_RR        2
+#define SCHED_BATCH     3
+#define SCHED_IDLE      5
+#define SCHED_RESET_ON_FORK 0x40000000
+
+#define SCHED_FLAG_RESET_ON_FORK    0x01
+
+struct sched_param {
+    int sched_priority;
+};
+
+struct sched_attr {
+    u32 size;
+    u32 sched_policy;
+    u64 sched_flags;
+    s32 sched_nice;
+    u32 sched_priority;
+    u64 sched_runtime;
+    u64 sched_deadline;
+    u64 sched_period;
+};
+
+#define SCHED_ATTR_SIZE_VER0    48
+
+/* setpriority(2) targets */
+#define PRIO_PROCESS    0
+#define PRIO_PGRP       1
+#define PRIO_USER       2
 
 #define AT_NULL         0               /* End of vector */
 #define AT_IGNORE       1               /* Entry should be ignored */
@@ -202,6 +258,10 @@ struct flock {
 #define AT_SYMLINK_FOLLOW   0x400       /* Follow symbolic links.  */
 #define AT_NO_AUTOMOUNT     0x800       /* Suppress terminal automount traversal */
 #define AT_EMPTY_PATH       0x1000      /* Allow empty relative pathname */
+#define AT_STATX_SYNC_TYPE  0x6000      /* Type of synchronisation required from statx() */
+#define AT_STATX_SYNC_AS_STAT   0x0000  /* Do whatever stat() does */
+#define AT_STATX_FORCE_SYNC     0x2000  /* Force the attributes to be sync'd with the server */
+#define AT_STATX_DONT_SYNC      0x4000  /* Don't sync attributes with the server */
 
 #define MAP_SHARED          0x01
 #define MAP_PRIVATE         0x02
@@ -239,6 +299,21 @@ struct flock {
 #define MS_INVALIDATE 2
 #define MS_SYNC       4
 
+/* madvise */
+#define MADV_DONTNEED   4
+#define MADV_FREE       8
+#define MADV_HUGEPAGE   14
+#define MADV_NOHUGEPAGE 15
+
+/* userfaultfd */
+#define UFFD_USER_MODE_ONLY 1
+
+#define UFFDIO_REGISTER_MODE_MISSING    U64_FROM_BIT(0)
+#define UFFDIO_REGISTER_MODE_WP         U64_FROM_BIT(1)
+
+#define UFFD_PAGEFAULT_FLAG_WRITE   U64_FROM_BIT(0)
+#define UFFD_PAGEFAULT_FLAG_WP      U64_FROM_BIT(1)
+
 typedef int clockid_t;
 
 #define CLOCK_REALTIME              0
@@ -312,6 +387,25 @@ struct utimbuf {
 
 #define FUTEX_CLOCK_REALTIME    (1 << 8)
 
+/* futex2 flags */
+#define FUTEX2_SIZE_U8          0x00
+#define FUTEX2_SIZE_U16         0x01
+#define FUTEX2_SIZE_U32         0x02
+#define FUTEX2_SIZE_U64         0x03
+#define FUTEX2_NUMA             0x04
+#define FUTEX2_PRIVATE          128
+
+#define FUTEX2_SIZE_MASK        0x03
+
+#define FUTEX_WAITV_MAX         128
+
+struct futex_waitv {
+    u64 val;
+    u64 uaddr;
+    u32 flags;
+    u32 __reserved;
+};
+
 #define  FUTEX_OP_SET        0  /* uaddr2 = oparg; */
 #define  FUTEX_OP_ADD        1  /* uaddr2 += oparg; */
 #define  FUTEX_OP_OR         2  /* uaddr2 |= oparg; */
@@ -746,6 +840,16 @@ struct clone_args {
 #define EPOLLONESHOT	(1u << 30)
 #define EPOLLET		(1u << 31)
 
+struct epoll_params {
+    u32 busy_poll_usecs;
+    u16 busy_poll_budget;
+    u8 prefer_busy_poll;
+    u8 __pad;
+};
+
+#define EPIOCSPARAMS    0x40088a01
+#define EPIOCGPARAMS    0x80088a02
+
 typedef struct aux {u64 tag; u64 val;} *aux;
 
 struct statfs {
@@ -765,6 +869,53 @@ struct statfs {
     long f_spare[4];
 };
 
+#define STATX_TYPE          0x00000001U
+#define STATX_MODE          0x00000002U
+#define STATX_NLINK         0x00000004U
+#define STATX_UID           0x00000008U
+#define STATX_GID           0x00000010U
+#define STATX_ATIME         0x00000020U
+#define STATX_MTIME         0x00000040U
+#define STATX_CTIME         0x00000080U
+#define STATX_INO           0x00000100U
+#define STATX_SIZE          0x00000200U
+#define STATX_BLOCKS        0x00000400U
+#define STATX_BASIC_STATS   0x000007ffU
+#define STATX__RESERVED     0x80000000U
+
+struct statx_timestamp {
+    s64 tv_sec;
+    u32 tv_nsec;
+    s32 __reserved;
+};
+
+struct statx {
+    u32 stx_mask;
+    u32 stx_blksize;
+    u64 stx_attributes;
+    u32 stx_nlink;
+    u32 stx_uid;
+    u32 stx_gid;
+    u16 stx_mode;
+    u16 __spare0;
+    u64 stx_ino;
+    u64 stx_size;
+    u64 stx_blocks;
+    u64 stx_attributes_mask;
+    struct statx_timestamp stx_atime;
+    struct statx_timestamp stx_btime;
+    struct statx_timestamp stx_ctime;
+    struct statx_timestamp stx_mtime;
+    u32 stx_rdev_major;
+    u32 stx_rdev_minor;
+    u32 stx_dev_major;
+    u32 stx_dev_minor;
+    u64 stx_mnt_id;
+    u32 stx_dio_mem_align;
+    u32 stx_dio_offset_align;
+    u64 __spare3[12];
+};
+
 typedef u32 uid_t;
 typedef u32 gid_t;
 
@@ -836,7 +987,9 @@ struct io_uring_params {
 #define IPPROTO_IP      0
 #define SOL_SOCKET      1
 #define SOL_TCP         6
+#define SOL_UDP         17
 #define IPPROTO_IPV6    41
+#define SOL_TLS         282
 
 /* set/getsockopt optnames */
 #define SO_DEBUG        1
@@ -854,10 +1007,13 @@ struct io_uring_params {
 #define SO_ACCEPTCONN   30
 #define SO_PROTOCOL     38
 #define SO_DOMAIN       39
+#define SO_BUSY_POLL    46
+#define SO_ZEROCOPY     60
 
 #define IP_TOS              1
 #define IP_TTL              2
 #define IP_OPTIONS          4
+#define IP_RECVERR          11
 #define IP_MINTTL           21
 #define IP_MULTICAST_IF     32
 #define IP_MULTICAST_TTL    33
@@ -869,6 +1025,7 @@ struct io_uring_params {
 #define IPV6_MULTICAST_IF   17
 #define IPV6_MULTICAST_HOPS 18
 #define IPV6_MULTICAST_LOOP 19
+#define IPV6_RECVERR        25
 #define IPV6_V6ONLY     26
 #define IPV6_RECVPKTINFO    49
 #define IPV6_RECVHOPLIMIT   51
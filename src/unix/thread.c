@@ -4,6 +4,8 @@
 
 BSS_RO_AFTER_INIT thread dummy_thread;
 
+DEFINE_TRACEPOINT(sched_thread_run, "tid:u64 pc:x64");
+
 sysreturn gettid()
 {
     return current->tid;
@@ -75,6 +77,9 @@ static sysreturn clone_internal(struct clone_args_internal *args)
 
      clone_frame_pstate(f, thread_frame(current));
      thread_clone_sigmask(t, current);
+     t->context.ioprio = current->context.ioprio;
+     thread_set_sched(t, current->sched_policy, current->task.rt_prio, current->task.nice,
+                      current->task.slice);
 
      set_syscall_return(t, 0);
      f[SYSCALL_FRAME_SP] = (u64)stack + stack_size;
@@ -153,6 +158,10 @@ sysreturn clone3(struct clone_args *args, bytes size)
 void register_thread_syscalls(struct syscall *map)
 {
     register_syscall(map, futex, futex, 0);
+    register_syscall(map, futex_waitv, futex_waitv, 0);
+    register_syscall(map, futex_wake, futex2_wake, 0);
+    register_syscall(map, futex_wait, futex2_wait, 0);
+    register_syscall(map, futex_requeue, futex2_requeue, 0);
     register_syscall(map, set_robust_list, set_robust_list, 0);
     register_syscall(map, get_robust_list, get_robust_list, 0);
     register_syscall(map, clone, clone, SYSCALL_F_SET_PROC);
@@ -161,7 +170,7 @@ void register_thread_syscalls(struct syscall *map)
     register_syscall(map, arch_prctl, arch_prctl, 0);
 #endif
     register_syscall(map, set_tid_address, set_tid_address, 0);
-    register_syscall(map, gettid, gettid, 0);
+    register_syscall(map, gettid, gettid, SYSCALL_F_LEAF);
 }
 
 void thread_log_internal(thread t, sstring desc, ...)
@@ -219,7 +228,14 @@ static void thread_cputime_update(thread t)
     if (t->start_time != 0) {
         timestamp diff = now(CLOCK_ID_MONOTONIC_RAW) - t->start_time;
         t->utime += diff;
-        t->task.runtime = diff;
+
+        /* time stolen by the hypervisor is not charged to the scheduler runtime */
+        if (pv_steal_clock) {
+            timestamp steal = pv_steal_clock(current_cpu()->id) - t->start_steal;
+            t->task.runtime += (steal < diff) ? diff - steal : 0;
+        } else {
+            t->task.runtime += diff;
+        }
         t->start_time = 0;
         cputime_update(t, diff, true);
     }
@@ -232,6 +248,7 @@ static void thread_pause(context ctx)
     thread t = (thread)ctx;
     context_frame f = thread_frame(t);
     thread_cputime_update(t);
+    perf_event_thread_pause(t);
     thread_frame_save_fpsimd(f);
     thread_frame_save_tls(f);
 }
@@ -242,11 +259,14 @@ static void thread_resume(context ctx)
     assert(t->start_time == 0); // XXX tmp debug
     timestamp here = now(CLOCK_ID_MONOTONIC_RAW);
     t->start_time = here == 0 ? 1 : here;
+    if (pv_steal_clock)
+        t->start_steal = pv_steal_clock(current_cpu()->id);
     if (do_syscall_stats && t->last_syscall == SYS_sched_yield)
         count_syscall(t, 0);
     context_frame f = thread_frame(t);
     thread_frame_restore_tls(f);
     thread_frame_restore_fpsimd(f);
+    perf_event_thread_resume(t);
     frame_enable_interrupts(f);
 }
 
@@ -254,7 +274,13 @@ static void thread_schedule_return(context ctx)
 {
     thread t = (thread)ctx;
     thread_cputime_update(t);   /* so that it is scheduled based on how much CPU time it used */
-    sched_enqueue(t->scheduling_queue, &t->task);
+    cpuinfo ci = current_cpu();
+    if ((ci->switch_target == &t->task) && !ci->switch_to) {
+        ci->switch_target = 0;
+        ci->switch_to = &t->task;
+        return;
+    }
+    sched_wakeup(t->scheduling_queue, t->affinity, &t->task);
 }
 
 closure_func_basic(thunk, void, thread_return)
@@ -282,9 +308,11 @@ closure_func_basic(thunk, void, thread_return)
 
     context_frame f = t->context.frame;
     assert(f[FRAME_FULL]);
+    trace(sched_thread_run, t->tid, f[SYSCALL_FRAME_PC]);
     thread_trace(t, TRACE_THREAD_RUN, "run thread, cpu %d, frame %p, pc 0x%lx, sp 0x%lx, rv 0x%lx",
                  current_cpu()->id, f, f[SYSCALL_FRAME_PC], f[SYSCALL_FRAME_SP], f[SYSCALL_FRAME_RETVAL1]);
     clear_fault_handler();
+    rcu_quiescent(ci);
     context_switch(&t->context);
     thread_release(t);
     frame_return(thread_frame(t));
@@ -320,6 +348,7 @@ void thread_yield(void)
     thread_log(current, "yield %d, RIP=0x%lx", current->tid, thread_frame(current)[SYSCALL_FRAME_PC]);
     current->syscall = 0;
     set_syscall_return(current, 0);
+    count_syscall_latency(current, 0);
     syscall_finish(false);
 }
 
@@ -396,6 +425,7 @@ timerqueue thread_get_cpu_timer_queue(thread t)
 closure_func_basic(thunk, void, free_thread)
 {
     thread t = struct_from_closure(thread, free);
+    destruct_context(&t->context);
     if (t->cpu_timers)
         deallocate_timerqueue(t->cpu_timers);
     deallocate_bitmap(t->affinity);
@@ -407,6 +437,33 @@ closure_func_basic(thunk, void, free_thread)
     /* TODO: Intentionally leaking tracelog_attrs; no accounting for attrs lifetime... */
 }
 
+/* Weight of fair threads with the SCHED_IDLE policy, which get a minimal share of the CPU when
+ * competing with other fair threads. */
+#define SCHED_IDLE_WEIGHT   3
+
+/* Sets the scheduling policy and parameters of a thread; they take effect the next time the
+ * thread is scheduled. */
+void thread_set_sched(thread t, int policy, int rt_prio, int nice, timestamp slice)
+{
+    sched_task task = &t->task;
+    t->sched_policy = policy;
+    sched_task_set_nice(task, nice);
+    switch (policy) {
+    case SCHED_FIFO:
+        sched_task_set_class(task, SCHED_CLASS_FIFO, rt_prio);
+        break;
+    case SCHED_RR:
+        sched_task_set_class(task, SCHED_CLASS_RR, rt_prio);
+        break;
+    case SCHED_IDLE:
+        task->weight = SCHED_IDLE_WEIGHT;
+        /* fall through */
+    default:
+        sched_task_set_class(task, SCHED_CLASS_FAIR, 0);
+    }
+    task->slice = slice;
+}
+
 thread create_thread(process p, u64 tid)
 {
     heap h = heap_locked((kernel_heaps)p->uh);
@@ -419,8 +476,8 @@ thread create_thread(process p, u64 tid)
     t->context.resume = thread_resume;
     t->context.schedule_return = thread_schedule_return;
     t->context.pre_suspend = 0;
-    t->task.t = init_closure_func(&t->thread_return, thunk, thread_return);
-    t->task.runtime = 0;
+    sched_task_init(&t->task, init_closure_func(&t->thread_return, thunk, thread_return));
+    t->sched_policy = SCHED_OTHER;
 
     t->thread_bq = allocate_blockq(h, ss("thread"));
     if (t->thread_bq == INVALID_ADDRESS)
@@ -431,6 +488,7 @@ thread create_thread(process p, u64 tid)
     runtime_memcpy(&t->uh, p->uh, sizeof(*p->uh));
     init_refcount(&t->context.refcount, 1, init_closure_func(&t->free, thunk, free_thread));
     t->select_epoll = 0;
+    zero(t->fd_cache, sizeof(t->fd_cache));
     init_rbnode(&t->n);
     t->clear_tid = 0;
     t->name[0] = '\0';
@@ -452,10 +510,15 @@ thread create_thread(process p, u64 tid)
 
     t->signal_stack = 0;
     t->signal_stack_length = 0;
-    t->affinity = allocate_bitmap(h, h, total_processors);
+    t->affinity = allocate_bitmap(h, h, present_processors);
     if (t->affinity == INVALID_ADDRESS)
         goto fail_affinity;
-    bitmap_range_check_and_set(t->affinity, 0, total_processors, false, true);
+    bitmap_range_check_and_set(t->affinity, 0, present_processors, false, true);
+    if (isolated_cpu_mask) {
+        /* threads run on isolated CPUs only if explicitly placed there */
+        bitmap_foreach_set(isolated_cpu_mask, cpu)
+            bitmap_set(t->affinity, cpu, 0);
+    }
     t->syscall_complete = false;
     init_sigstate(&t->signals);
     t->signal_mask = 0;
@@ -464,10 +527,15 @@ thread create_thread(process p, u64 tid)
     t->utime = t->stime = 0;
     t->start_time = 0;
     t->last_syscall = -1;
+    t->syscall_lat_call = -1;
     t->cpu_timers = 0;
 
     list_init(&t->l_faultwait);
     spin_lock_init(&t->lock);
+    list_init(&t->perf_events);
+    t->perf_counters = t->perf_running = 0;
+    t->perf_cpu = -1;
+    spin_lock_init(&t->perf_lock);
 
     /* install gdb fault handler if gdb is inited */
     gdb_check_fault_handler(t);
@@ -13,6 +13,10 @@
 #define timer_debug(x, ...)
 #endif
 
+/* Relative timerfd expirations may be up to 1/2^TIMERFD_SLACK_ORDER of their period late, which
+   lets long timers be kept on the per-CPU timer wheels rather than in the ordered queue. */
+#define TIMERFD_SLACK_ORDER 6
+
 enum unix_timer_type {
     UNIX_TIMER_TYPE_TIMERFD = 1,
     UNIX_TIMER_TYPE_POSIX,      /* POSIX.1b (timer_create) */
@@ -218,6 +222,8 @@ sysreturn timerfd_settime(int fd, int flags,
                 ut->cid, tinit, absolute, interval);
     if (interval != 0)
         ut->interval = true;
+    timer_set_slack(&ut->t, absolute ? 0 :
+                    (interval ? MIN(tinit, interval) : tinit) >> TIMERFD_SLACK_ORDER);
     reserve_unix_timer(ut);
     register_timer(kernel_timers, &ut->t, ut->cid, tinit, absolute, interval,
                    init_closure_func(&ut->info.timerfd.timer_expire, timer_handler,
@@ -243,51 +249,54 @@ sysreturn timerfd_gettime(int fd, struct itimerspec *curr_value)
     return rv;
 }
 
-closure_function(4, 1, sysreturn, timerfd_read_bh,
-                 unix_timer, ut, void *, dest, u64, length, io_completion, completion,
-                 u64 flags)
+/* Returns false if the read must block. */
+static boolean timerfd_read_try(unix_timer ut, void *dest, sysreturn *rv)
 {
-    unix_timer ut = bound(ut);
-    boolean blocked = (flags & BLOCKQ_ACTION_BLOCKED) != 0;
-    sysreturn rv = sizeof(u64);
-
-    timer_debug("ut %p, dest %p, length %ld, flags 0x%lx\n",
-                ut, bound(dest), bound(length), flags);
-
-    if (flags & BLOCKQ_ACTION_NULLIFY) {
-        assert(blocked);
-        rv = -ERESTARTSYS;
-        goto out;
-    }
-
     spin_lock(&ut->lock);
-
     if (ut->info.timerfd.canceled) {
         ut->info.timerfd.canceled = false;
-        rv = -ECANCELED;
+        *rv = -ECANCELED;
         goto out;
     }
-
-    context ctx = get_current_context(current_cpu());
     u64 overruns = ut->overruns;
     if (overruns == 0) {
-        if (!blocked && (ut->f.flags & TFD_NONBLOCK)) {
-            rv = -EAGAIN;
-            goto out;
+        if (!(ut->f.flags & TFD_NONBLOCK)) {
+            spin_unlock(&ut->lock);
+            return false;
         }
-        timer_debug("   -> block\n");
-        spin_unlock(&ut->lock);
-        return blockq_block_required((unix_context)ctx, flags);
+        *rv = -EAGAIN;
+        goto out;
     }
+    context ctx = get_current_context(current_cpu());
     if (!context_set_err(ctx)) {
-        *(u64*)bound(dest) = overruns;
+        *(u64*)dest = overruns;
         context_clear_err(ctx);
         ut->overruns = 0;
+        *rv = sizeof(u64);
     } else {
-        rv = -EFAULT;
+        *rv = -EFAULT;
     }
   out:
     spin_unlock(&ut->lock);
+    return true;
+}
+
+closure_function(3, 1, sysreturn, timerfd_read_bh,
+                 unix_timer, ut, void *, dest, io_completion, completion,
+                 u64 flags)
+{
+    unix_timer ut = bound(ut);
+    sysreturn rv;
+
+    timer_debug("ut %p, dest %p, flags 0x%lx\n", ut, bound(dest), flags);
+
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        assert(flags & BLOCKQ_ACTION_BLOCKED);
+        rv = -ERESTARTSYS;
+    } else if (!timerfd_read_try(ut, bound(dest), &rv)) {
+        timer_debug("   -> block\n");
+        return blockq_block_required((unix_context)get_current_context(current_cpu()), flags);
+    }
     timer_debug("   -> returning %ld\n", rv);
     apply(bound(completion), rv);
     closure_finish();
@@ -302,7 +311,12 @@ closure_func_basic(file_io, sysreturn, timerfd_read,
     unix_timer ut = struct_from_closure(unix_timer, info.timerfd.read);
     timer_debug("ut %p, dest %p, length %ld, ctx %p, bh %d, completion %p\n",
                 ut, dest, length, ctx, bh, completion);
-    blockq_action ba = closure_from_context(ctx, timerfd_read_bh, ut, dest, length, completion);
+
+    /* expirations already pending are read without going through the blockq */
+    sysreturn rv;
+    if (timerfd_read_try(ut, dest, &rv))
+        return io_complete(completion, rv);
+    blockq_action ba = closure_from_context(ctx, timerfd_read_bh, ut, dest, completion);
     return blockq_check(ut->info.timerfd.bq, ba, bh);
 }
 
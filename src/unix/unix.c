@@ -27,6 +27,53 @@ unix_heaps get_unix_heaps()
     return u_heap;
 }
 
+#define FDTABLE_INITIAL_CHUNKS  16
+
+static fdtable allocate_fdtable(heap h, u64 nchunks)
+{
+    fdtable t = allocate(h, sizeof(struct fdtable) + nchunks * sizeof(fdesc *));
+    if (t == INVALID_ADDRESS)
+        return t;
+    t->nchunks = nchunks;
+    zero(t->chunks, nchunks * sizeof(fdesc *));
+    return t;
+}
+
+/* Called with the process lock held. Readers may be looking up the table
+   concurrently, so a new directory or chunk is fully initialized before it
+   is published, and so is a descriptor before it is stored. */
+static boolean fdtable_set_locked(process p, u64 fd, fdesc f)
+{
+    heap h = heap_locked((kernel_heaps)p->uh);
+    fdtable t = p->files;
+    u64 c = fd >> FDTABLE_CHUNK_ORDER;
+    if (c >= t->nchunks) {
+        if (!f)
+            return true;
+        fdtable new = allocate_fdtable(h, MAX(t->nchunks * 2, c + 1));
+        if (new == INVALID_ADDRESS)
+            return false;
+        runtime_memcpy(new->chunks, t->chunks, t->nchunks * sizeof(fdesc *));
+        write_barrier();
+        p->files = new;
+        rcu_deallocate(h, t, sizeof(struct fdtable) + t->nchunks * sizeof(fdesc *));
+        t = new;
+    }
+    fdesc *chunk = t->chunks[c];
+    if (!chunk) {
+        if (!f)
+            return true;
+        chunk = allocate_zero(h, FDTABLE_CHUNK_SIZE * sizeof(fdesc));
+        if (chunk == INVALID_ADDRESS)
+            return false;
+        write_barrier();
+        t->chunks[c] = chunk;
+    }
+    write_barrier();
+    chunk[fd & MASK(FDTABLE_CHUNK_ORDER)] = f;
+    return true;
+}
+
 u64 allocate_fd(process p, void *f)
 {
     process_lock(p);
@@ -35,7 +82,7 @@ u64 allocate_fd(process p, void *f)
         msg_err("fail; maxed out\n");
         goto out;
     }
-    if (!vector_set(p->files, fd, f)) {
+    if (!fdtable_set_locked(p, fd, f)) {
         deallocate_u64((heap)p->fdallocator, fd, 1);
         fd = INVALID_PHYSICAL;
     }
@@ -52,7 +99,7 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
         msg_err("failed\n");
     }
     else {
-        if (!vector_set(p->files, fd, f)) {
+        if (!fdtable_set_locked(p, fd, f)) {
             deallocate_u64((heap)p->fdallocator, fd, 1);
             fd = INVALID_PHYSICAL;
         }
@@ -64,11 +111,42 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
 void deallocate_fd(process p, int fd)
 {
     process_lock(p);
-    assert(vector_set(p->files, fd, 0));
+    assert(fdtable_set_locked(p, fd, 0));
+    write_barrier();
+    p->fd_gen++;
     deallocate_u64((heap)p->fdallocator, fd, 1);
     process_unlock(p);
 }
 
+void replace_fd(process p, int fd, fdesc f)
+{
+    process_lock(p);
+    assert(fdtable_set_locked(p, fd, f));
+    write_barrier();
+    p->fd_gen++;
+    process_unlock(p);
+}
+
+closure_func_basic(thunk, void, fdesc_rcu_put)
+{
+    fdesc_put(struct_from_closure(fdesc, rcu_put));
+}
+
+boolean fdesc_put_removed(fdesc f, u64 refs)
+{
+    /* Lookups that found f before its removal may still take references
+       until a grace period has elapsed. If references are left besides the
+       table's, the latter is dropped after a grace period and the last
+       holder closes the descriptor; otherwise, wait for the grace period
+       here so that the caller can complete the close synchronously. */
+    if (fetch_and_add(&f->refcnt, -refs) - refs > 1) {
+        call_rcu((thunk)&f->rcu_put);
+        return false;
+    }
+    synchronize_rcu();
+    return fetch_and_add(&f->refcnt, -1) == 1;
+}
+
 closure_func_basic(io_completion, void, fdesc_io_complete,
                    sysreturn rv)
 {
@@ -80,6 +158,7 @@ void init_fdesc(heap h, fdesc f, int type)
 {
     zero(f, sizeof(*f));
     init_closure_func(&f->io_complete, io_completion, fdesc_io_complete);
+    init_closure_func(&f->rcu_put, thunk, fdesc_rcu_put);
     f->refcnt = 1;
     f->type = type;
     f->ns = allocate_notify_set(h);
@@ -220,14 +299,23 @@ sstring string_from_mmap_type(int type)
         (vm->flags & VMAP_FLAG_WRITABLE) ? ss("writable ") : sstring_empty(),   \
         (vm->flags & VMAP_FLAG_EXEC) ? ss("executable ") : sstring_empty()
 
-static boolean handle_protection_fault(context ctx, u64 vaddr, vmap vm)
+static boolean handle_protection_fault(process p, context ctx, u64 vaddr, vmap vm)
 {
     /* vmap found, with protection violation set --> send prot violation */
     u64 flags = VMAP_FLAG_MMAP | VMAP_FLAG_WRITABLE;
     if (is_write_fault(ctx->frame) && (vm->flags & flags) == flags &&
         (vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_FILEBACKED) {
-        /* copy on write */
         u64 vaddr_aligned = vaddr & ~MASK(PAGELOG);
+        if (vm->flags & VMAP_FLAG_SHARED) {
+            /* first write to a shared page since the last dirty scan */
+            pf_debug("write to shared map: vaddr 0x%lx, node %p\n", vaddr, vm->cache_node);
+            if (!pagecache_node_shared_write_fault(vm->cache_node, vaddr_aligned,
+                                                   pageflags_from_vmflags(vm->flags)))
+                halt("cannot track write to shared map at vaddr 0x%lx, ctx %p; OOM\n", vaddr, ctx);
+            return true;
+        }
+
+        /* copy on write */
         u64 node_offset = vm->node_offset + (vaddr_aligned - vm->node.r.start);
         pf_debug("copy-on-write for private map: vaddr 0x%lx, node %p, node_offset 0x%lx\n",
                  vaddr, vm->cache_node, node_offset);
@@ -237,6 +325,16 @@ static boolean handle_protection_fault(context ctx, u64 vaddr, vmap vm)
         return true;
     }
 
+    /* first write to anonymous memory mapped to the zero page */
+    if (is_write_fault(ctx->frame) && (vm->flags & VMAP_FLAG_WRITABLE) &&
+        do_anonymous_cow(p, ctx, vaddr, vm))
+        return true;
+
+    /* write to anonymous memory write-protected through a userfaultfd */
+    if (is_write_fault(ctx->frame) && (vm->flags & VMAP_FLAG_WRITABLE) &&
+        do_userfault_wp(p, ctx, vaddr, vm))
+        return true;
+
     if (is_thread_context(ctx)) {
         pf_debug(format_protection_violation(vaddr, ctx, vm));
         deliver_fault_signal(SIGSEGV, (thread)ctx, vaddr, SEGV_ACCERR);
@@ -322,7 +420,7 @@ closure_func_basic(fault_handler, context, unix_fault_handler,
         }
 
         if (is_protection_fault(ctx->frame)) {
-            if (handle_protection_fault(ctx, vaddr, vm)) {
+            if (handle_protection_fault(p, ctx, vaddr, vm)) {
                 if (!is_thread_context(ctx))
                     return ctx;   /* direct return */
                 schedule_thread(t);
@@ -488,6 +586,12 @@ process_context get_process_context(void)
     thread t = current;
     if (!t)
         return INVALID_ADDRESS;
+    return get_process_context_for(t->p);
+}
+
+/* for use from kernel contexts, where there is no current thread */
+process_context get_process_context_for(process p)
+{
     cpuinfo ci = current_cpu();
     process_context pc = dequeue_single(ci->free_process_contexts);
     if (pc != INVALID_ADDRESS) {
@@ -499,7 +603,7 @@ process_context get_process_context(void)
         return pc;
     init_unix_context(&pc->uc, CONTEXT_TYPE_PROCESS, PROCESS_CONTEXT_SIZE,
                       ci->free_process_contexts);
-    pc->p = t->p;
+    pc->p = p;
     context c = &pc->uc.kc.context;
     c->pause = process_context_pause;
     c->resume = process_context_resume;
@@ -539,8 +643,9 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     p->cwd = fs->get_inode(fs, filesystem_getroot(fs));
     p->process_root = root;
     p->fdallocator = create_id_heap(locked, locked, 0, infinity, 1, false);
-    p->files = allocate_vector(locked, 64);
-    zero(p->files, sizeof(p->files));
+    p->files = allocate_fdtable(locked, FDTABLE_INITIAL_CHUNKS);
+    assert(p->files != INVALID_ADDRESS);
+    p->fd_gen = 0;
     create_stdfiles(uh, p);
     init_threads(p);
     init_closure_func(&p->fault_handler, fault_handler, unix_fault_handler);
@@ -558,6 +663,9 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     assert(p->cpu_timers != INVALID_ADDRESS);
     p->aio_ids = create_id_heap(locked, locked, 0, S32_MAX, 1, false);
     p->aio = allocate_vector(locked, 8);
+    zero(p->io_uring_rings, sizeof(p->io_uring_rings));
+    p->exec_record = 0;
+    p->exec_record_pages = 0;
     p->trace = 0;
     p->trap = 0;
     if ((u64)p->pid - 1 < MAX_PROCESSES)
@@ -641,6 +749,13 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
 	goto alloc_fail;
 #ifdef LOCK_STATS
     lockstats_init(kh);
+#endif
+    lockprof_init(kh, root);
+#ifdef CONFIG_PROFILE
+    profile_init(kh, root);
+#endif
+#ifdef CONFIG_BLOCKPROF
+    blockprof_init(kh, root);
 #endif
 #ifdef NET
     if (!netsyscall_init(uh, root))
@@ -675,8 +790,11 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
     register_clock_syscalls(linux_syscalls);
     register_timer_syscalls(linux_syscalls);
     register_other_syscalls(linux_syscalls);
+    register_perf_event_syscalls(linux_syscalls);
     configure_syscalls(kernel_process);
+    syscall_latency_management(root);
 
+    coredump_set_compression(get(root, sym(coredump_compress)) != 0);
     tuple coredumplimit = get(root, sym(coredumplimit));
     if (coredumplimit && is_string(coredumplimit)) {
         buffer b = alloca_wrap((buffer)coredumplimit);
@@ -693,7 +811,8 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
         coredump_set_limit(size);
     }
     assert(mm_register_mem_cleaner(init_closure_func(&uh->mem_cleaner, mem_cleaner,
-                                                     unix_mem_cleaner)));
+                                                     unix_mem_cleaner),
+                                   ss("unix"), MM_CLEANER_CACHE));
 out:
     return kernel_process;
   alloc_fail:
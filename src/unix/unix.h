@@ -16,6 +16,7 @@ void dump_mem_stats(buffer b);
 
 void coredump_set_limit(u64 s);
 u64 coredump_get_limit(void);
+void coredump_set_compression(boolean compress);
 
 timestamp proc_utime(process p);
 timestamp proc_stime(process p);
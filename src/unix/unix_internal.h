@@ -18,6 +18,8 @@
 #define VMAP_FLAG_PROG     0x1000
 #define VMAP_FLAG_BSS      0x2000
 #define VMAP_FLAG_TAIL_BSS 0x4000
+#define VMAP_FLAG_HUGEPAGE 0x8000  /* anonymous faults may map huge pages */
+#define VMAP_FLAG_PAGE_BACKED 0x10000  /* anonymous memory comes from the page_backed heap */
 
 #define VMAP_MMAP_TYPE_MASK       0x0f00
 #define VMAP_MMAP_TYPE_ANONYMOUS  0x0100
@@ -44,6 +46,8 @@
 #define PROCESS_STACK_SIZE          (2 * MB)
 #define PROCESS_STACK_PREALLOC_SIZE PAGESIZE
 
+#define THREAD_FD_CACHE_SIZE        4   /* power of 2 */
+
 /* restrict the area in which ELF segments can be placed */
 #define PROCESS_ELF_LOAD_END        (3ull * GB) /* 3gb hard upper limit */
 
@@ -65,11 +69,18 @@ typedef s64 sysreturn;
 // fix config/build, remove this include to take off network
 #include <net.h>
 boolean netsyscall_init(unix_heaps uh, tuple cfg);
+#ifdef CONFIG_PROFILE
+void profile_init(kernel_heaps kh, tuple root);
+#endif
+#ifdef CONFIG_BLOCKPROF
+void blockprof_init(kernel_heaps kh, tuple root);
+#endif
 
 typedef struct process *process;
 typedef struct thread *thread;
 
 thread create_thread(process, u64 tid);
+void thread_set_sched(thread t, int policy, int rt_prio, int nice, timestamp slice);
 void exit_thread(thread);
 
 // Taken from the manual pages
@@ -154,6 +165,7 @@ typedef struct unix_heaps {
 closure_type(io_completion, void, sysreturn rv);
 closure_type(blockq_action, sysreturn, u64 flags);
 closure_type(blockq_action_handler, void, blockq_action action);
+closure_type(blockq_action_filter, boolean, blockq_action action);
 
 struct blockq;
 typedef struct blockq * blockq;
@@ -161,6 +173,18 @@ typedef struct blockq * blockq;
 declare_closure_struct(1, 2, void, blockq_thread_timeout,
                        blockq, bq,
                        u64 expiry, u64 overruns);
+
+#ifdef CONFIG_BLOCKPROF
+#define BLOCKPROF_MAX_DEPTH 16
+
+/* blocking profiler state of a waiting context (see blockprof.c) */
+struct blockprof_wait {
+    timestamp start;            /* 0 if the wait is not profiled */
+    u64 depth;
+    u64 pcs[BLOCKPROF_MAX_DEPTH];
+};
+#endif
+
 typedef struct unix_context {
     struct kernel_context kc;
     blockq blocked_on;  /* blockq context is waiting on, INVALID_ADDRESS for uninterruptible */
@@ -171,6 +195,9 @@ typedef struct unix_context {
     closure_struct(blockq_thread_timeout, bq_timeout_func);
     blockq_action bq_action;    /* action to check for wake, timeout or abort */
     struct list bq_l;           /* embedding on blockq->waiters_head */
+#ifdef CONFIG_BLOCKPROF
+    struct blockprof_wait bq_prof;
+#endif
     struct spinlock lock;
 } *unix_context;
 
@@ -183,6 +210,7 @@ typedef struct process_context {
 } *process_context;
 
 process_context get_process_context(void);
+process_context get_process_context_for(process p);
 
 typedef struct syscall_context {
     struct unix_context uc;
@@ -240,6 +268,13 @@ void blockq_flush(blockq bq);
 sysreturn blockq_check_timeout(blockq bq, blockq_action a, boolean in_bh,
                                clock_id id, timestamp timeout, boolean absolute);
 int blockq_transfer_waiters(blockq dest, blockq src, int n, blockq_action_handler handler);
+int blockq_wake_matching(blockq bq, int n, blockq_action_filter filter);
+
+#ifdef CONFIG_BLOCKPROF
+void blockprof_block(unix_context t);
+void blockprof_rewait(unix_context t);
+void blockprof_wake(blockq bq, unix_context t, u64 bq_flags);
+#endif
 
 static inline sysreturn blockq_check(blockq bq, blockq_action a, boolean in_bh)
 {
@@ -273,6 +308,7 @@ typedef struct pending_fault {
     struct list l_free;
     closure_struct(pending_fault_demand_file_page, demand_file_page);
     closure_struct(status_handler, complete);
+    status_handler completion;  /* typed reference to complete */
 } *pending_fault;
 
 /* XXX probably should bite bullet and allocate these... */
@@ -286,6 +322,7 @@ typedef struct thread {
     char name[16]; /* thread name */
     syscall_context syscall;
     struct sched_task task;
+    int sched_policy;
     sched_queue scheduling_queue;
     process p;
 
@@ -301,6 +338,15 @@ typedef struct thread {
     closure_struct(thunk, thread_return);
 
     epoll select_epoll;
+
+    /* recently resolved descriptors, valid while the process fd_gen matches;
+       entries do not hold a reference */
+    struct fd_cache_entry {
+        int fd;
+        struct fdesc *f;
+        u64 gen;
+    } fd_cache[THREAD_FD_CACHE_SIZE];
+
     int *clear_tid;
     int tid;
     struct rbnode n;
@@ -316,8 +362,11 @@ typedef struct thread {
 
     timestamp utime, stime;
     timestamp start_time;
+    timestamp start_steal;
     int last_syscall;
     timestamp syscall_enter_ts;
+    int syscall_lat_call;
+    timestamp syscall_lat_start;
     u64 syscall_time;
     closure_struct(clock_now, now);
     timerqueue cpu_timers;
@@ -334,6 +383,13 @@ typedef struct thread {
     struct list l_faultwait;
     struct spinlock lock;   /* generic lock for struct members without a specific lock */
 
+    /* perf events, with PMU counters loaded while the thread or its syscall context runs */
+    struct list perf_events;
+    u64 perf_counters;      /* counters assigned to events */
+    u64 perf_running;       /* counters programmed on perf_cpu */
+    int perf_cpu;
+    struct spinlock perf_lock;
+
 #ifdef CONFIG_TRACELOG
     tuple tracelog_attrs;
 #endif
@@ -372,6 +428,8 @@ closure_type(fdesc_et_handler, u64, u64 events, u64 lastevents);
 #define FDESC_TYPE_SYMLINK     11
 #define FDESC_TYPE_IORING      12
 #define FDESC_TYPE_INOTIFY     13
+#define FDESC_TYPE_PERF_EVENT  14
+#define FDESC_TYPE_USERFAULTFD 15
 
 typedef struct fdesc {
     file_io read, write;
@@ -382,6 +440,7 @@ typedef struct fdesc {
     fdesc_close close;
     fdesc_et_handler edge_trigger_handler;
     closure_struct(io_completion, io_complete);
+    closure_struct(thunk, rcu_put);
 
     u64 refcnt;
     int type;
@@ -393,6 +452,28 @@ typedef struct fdesc {
 #define IOV_MAX 1024
 
 #define FILE_READAHEAD_DEFAULT  (128 * KB)
+#define FILE_READAHEAD_MAX      (2 * MB)
+
+/* number of pages, in an aligned window around a file-backed page fault, that are mapped on a
+ * fault if already present in the page cache */
+#define FAULT_AROUND_DEFAULT    16
+#define FAULT_AROUND_MAX        PAGECACHE_MAP_BATCH_MAX
+
+/* pool of pre-zeroed pages for anonymous memory faults, refilled by idle CPUs a batch at a time */
+#define ZEROED_PAGE_POOL_SIZE   512
+#define ZEROED_PAGE_FILL_BATCH  8
+
+/* Sequential stream state for adaptive read-ahead. When an access reaches the
+ * async marker, the next window is issued and the window size doubles up to
+ * the maximum; non-sequential accesses reset the stream. */
+typedef struct file_ra {
+    u64 start;          /* start of the current read-ahead window */
+    u64 size;           /* size of the current read-ahead window */
+    u64 async;          /* offset that triggers the next window */
+    u64 prev;           /* end of the previous access */
+} *file_ra;
+
+range file_ra_next(file_ra ra, u64 offset, u64 len, u64 init_size, u64 max_size);
 
 struct file {
     struct fdesc f;             /* must be first */
@@ -402,9 +483,11 @@ struct file {
         sg_io fs_read;
         sg_io fs_write;
         int fadv;           /* posix_fadvise advice */
+        struct file_ra ra;  /* read-ahead stream state */
     };
     inode n;                /* filesystem inode number */
     u64 offset;
+    vector dirents;         /* directory entry names, indexed by offset (for getdents) */
     closure_struct(file_io, read);
     closure_struct(file_io, write);
     closure_struct(sg_file_io, sg_read);
@@ -430,6 +513,7 @@ typedef struct vmap {
         fdesc fd;
         u64 bss_offset;
     };
+    struct file_ra ra;  /* read-ahead stream state for file-backed faults */
 } *vmap;
 
 #define ivmap(__f, __af, __o, __c, __fd) (struct vmap) {    \
@@ -469,6 +553,9 @@ static inline sysreturn blockq_block_required(unix_context t, u64 bq_flags)
 
 vmap allocate_vmap(process p, range r, struct vmap q);
 boolean adjust_process_heap(process p, range new);
+u32 thp_vmflags(boolean advised);
+u32 numa_vmflags(void);
+void unmap_and_free_anonymous(u32 vmflags, u64 vaddr, u64 length);
 
 u64 process_get_virt_range(process p, u64 size, range region);
 void *process_map_physical(process p, u64 phys_addr, u64 size, u64 vmflags);
@@ -477,6 +564,8 @@ typedef struct file *file;
 
 struct syscall;
 
+#define IO_URING_RING_FDS_MAX   16
+
 typedef struct process {
     unix_heaps        uh;       /* non-thread-specific */
     int               pid;
@@ -489,15 +578,20 @@ typedef struct process {
     filesystem        cwd_fs;
     tuple             process_root;
     inode             cwd;
-    table             futices;
+    struct futex_bucket *futices;
     closure_struct(fault_handler, fault_handler);
     rbtree            threads;
     struct spinlock   threads_lock;
     struct syscall   *syscalls;
-    vector            files;
+    struct fdtable   *files;    /* writers hold the process lock */
+    u64               fd_gen;   /* bumped when a descriptor is removed */
     u64               mmap_min_addr;
     struct spinlock   vmap_lock;
+    u64               vmap_seq; /* odd while vmaps is being modified */
     rangemap          vmaps;    /* process mappings */
+    rangemap          lazyfree; /* MADV_FREE ranges, reclaimed under memory pressure */
+    range             pinned;   /* span of memory translated for DMA (io_uring fixed buffers) */
+    u64               pinned_gen;   /* bumped when pages in the pinned span may change */
     vmap              stack_map;
     vmap              heap_map;
     struct aux        saved_aux[NAUX];
@@ -505,6 +599,7 @@ typedef struct process {
     char             *saved_args_end;
     struct rbtree     pending_faults; /* pending_faults in progress */
     struct spinlock   faulting_lock;
+    struct list       userfaultfds; /* protected by faulting_lock */
     struct sigstate   signals;
     struct sigaction  sigactions[NSIG];
     notify_set        signalfds;
@@ -516,6 +611,9 @@ typedef struct process {
     timerqueue        cpu_timers;
     id_heap           aio_ids;
     vector            aio;
+    fdesc             io_uring_rings[IO_URING_RING_FDS_MAX];  /* IORING_REGISTER_RING_FDS */
+    pagecache_node    exec_record;  /* program file whose page faults are recorded (exec_prefault) */
+    bitmap            exec_record_pages;    /* recorded program file pages */
     u8                trace;
     boolean           trap;         /* do not run threads when set */
     struct spinlock   lock; /* generic lock for struct members without a specific lock */
@@ -557,6 +655,19 @@ static inline thread _current(sstring caller) {
 #define current ((thread)get_current_thread())
 #endif
 
+/* process on behalf of which a syscall, thread or process context runs */
+static inline process unix_context_process(context ctx)
+{
+    switch (ctx->type) {
+    case CONTEXT_TYPE_SYSCALL:
+        return ((syscall_context)ctx)->t->p;
+    case CONTEXT_TYPE_THREAD:
+        return ((thread)ctx)->p;
+    default:
+        return ((process_context)ctx)->p;
+    }
+}
+
 void init_thread_fault_handler(thread t);
 
 static inline boolean proc_is_exec_protected(process p)
@@ -664,16 +775,77 @@ static inline int fdesc_type(fdesc f)
     return f->type;
 }
 
+/* The descriptor table is a directory of fixed-size chunks: chunks never
+   move once allocated, and only the directory is replaced when the table
+   grows, the old one being freed after an RCU grace period. The reference
+   held by the table to a removed descriptor is released only after a grace
+   period as well (see fdesc_put_removed()), so that a reader which found a
+   descriptor in the table can safely take a reference to it. */
+#define FDTABLE_CHUNK_ORDER     6
+#define FDTABLE_CHUNK_SIZE      U64_FROM_BIT(FDTABLE_CHUNK_ORDER)
+
+typedef struct fdtable {
+    u64 nchunks;
+    fdesc *chunks[];
+} *fdtable;
+
+/* Called within an RCU read section. */
+static inline fdesc fdtable_lookup(process p, u64 fd)
+{
+    fdtable t = *(fdtable volatile *)&p->files;
+    u64 c = fd >> FDTABLE_CHUNK_ORDER;
+    if (c >= t->nchunks)
+        return 0;
+    fdesc *chunk = *(fdesc * volatile *)&t->chunks[c];
+    return chunk ? *(fdesc volatile *)&chunk[fd & MASK(FDTABLE_CHUNK_ORDER)] : 0;
+}
+
 static inline fdesc fdesc_get(process p, int fd)
 {
-    process_lock(p);
-    fdesc f = vector_get(p->files, fd);
+    if (fd < 0)
+        return 0;
+    rcu_read_lock();
+    fdesc f = fdtable_lookup(p, fd);
     if (f)
         fetch_and_add(&f->refcnt, 1);
-    process_unlock(p);
+    rcu_read_unlock();
     return f;
 }
 
+/* As fdesc_get(), for a descriptor of the process of the current thread,
+   first looking into the per-thread cache of recently used descriptors. */
+static inline fdesc thread_fdesc_get(thread t, int fd)
+{
+    if (fd < 0)
+        return 0;
+    process p = t->p;
+    struct fd_cache_entry *e = &t->fd_cache[fd & (THREAD_FD_CACHE_SIZE - 1)];
+    rcu_read_lock();
+    u64 gen = *(volatile u64 *)&p->fd_gen;
+    read_barrier();     /* pairs with the write barrier before fd_gen updates */
+    fdesc f;
+    if (e->f && e->fd == fd && e->gen == gen) {
+        f = e->f;
+    } else {
+        f = fdtable_lookup(p, fd);
+        if (f) {
+            e->fd = fd;
+            e->f = f;
+            e->gen = gen;
+        }
+    }
+    if (f)
+        fetch_and_add(&f->refcnt, 1);
+    rcu_read_unlock();
+    return f;
+}
+
+/* Release the reference held by the descriptor table to f, which has been
+   removed from the table, along with refs references held by the caller.
+   Returns true if these were the last references, in which case the caller
+   must close f. */
+boolean fdesc_put_removed(fdesc f, u64 refs);
+
 static inline void fdesc_notify_events(fdesc f)
 {
     u32 events = apply(f->events, 0);
@@ -685,8 +857,13 @@ u64 allocate_fd(process p, void *f);
 /* Allocate a file descriptor greater than or equal to min. */
 u64 allocate_fd_gte(process p, u64 min, void *f);
 
+/* The caller then releases the table reference with fdesc_put_removed(). */
 void deallocate_fd(process p, int fd);
 
+/* Install f in place of an open descriptor, whose table reference the caller
+   then releases with fdesc_put_removed(). */
+void replace_fd(process p, int fd, fdesc f);
+
 void init_vdso(process p);
 
 boolean copy_from_user(const void *uaddr, void *kaddr, u64 len);
@@ -700,6 +877,8 @@ boolean validate_user_memory_permissions(process p, const void *buf, bytes lengt
 
 boolean fault_in_memory(const void *buf, bytes length);
 boolean fault_in_user_memory(const void *buf, bytes length, boolean writable);
+boolean fault_in_user_memory_for_dma(const void *buf, bytes length);
+u64 process_pin_range(process p, range q);
 
 void mmap_process_init(process p, tuple root);
 
@@ -778,9 +957,10 @@ static inline u64 normalize_signal_mask(u64 mask)
     return mask & ~(mask_from_sig(SIGKILL) | mask_from_sig(SIGSTOP));
 }
 
+/* may be called without holding ss_lock */
 static inline u64 sigstate_get_pending(sigstate ss)
 {
-    return ss->pending;
+    return *(volatile u64 *)&ss->pending;
 }
 
 static inline boolean sigstate_is_pending(sigstate ss, int sig)
@@ -793,6 +973,14 @@ static inline sigaction sigaction_from_sig(thread t, int signum)
     return &t->p->sigactions[signum - 1];
 }
 
+static inline boolean thread_is_on_altsigstack(thread t)
+{
+    return t->signal_stack != 0 &&
+        point_in_range(irangel(u64_from_pointer(t->signal_stack),
+                               t->signal_stack_length),
+                       thread_frame(t)[SYSCALL_FRAME_SP]);
+}
+
 boolean dispatch_signals(thread t);
 void deliver_signal_to_thread(thread t, struct siginfo *);
 void deliver_signal_to_process(process p, struct siginfo *);
@@ -813,6 +1001,7 @@ void *swap_syscall_handler(struct syscall *m, int n, sysreturn (*f)());
 #define register_syscall(m, n, f, fl) _register_syscall(m, SYS_##n, f, ss(#n), fl)
 
 #define SYSCALL_F_NOTRACE   0x1
+#define SYSCALL_F_LEAF      0x2 /* never blocks, does not access user memory */
 #define SYSCALL_F_SET_FILE  (1<<8)
 #define SYSCALL_F_SET_DESC  (1<<9)
 #define SYSCALL_F_SET_MEM   (1<<10)
@@ -840,14 +1029,39 @@ static inline void count_syscall_resume(thread t)
         t->syscall_enter_ts = now(CLOCK_ID_MONOTONIC_RAW);
 }
 
+void syscall_latency_record(thread t, sysreturn rv);
+void syscall_latency_management(tuple root);
+
+static inline void count_syscall_latency(thread t, sysreturn rv)
+{
+    if (t->syscall_lat_call >= 0)
+        syscall_latency_record(t, rv);
+}
+
 static inline void count_syscall_noreturn(thread t)
 {
+    t->syscall_lat_call = -1;
     if (!do_syscall_stats)
         return;
     t->syscall_time = 0;
     t->last_syscall = -1;
 }
 
+void perf_event_load(thread t);
+void perf_event_unload(thread t);
+
+static inline void perf_event_thread_resume(thread t)
+{
+    if (!list_empty(&t->perf_events))
+        perf_event_load(t);
+}
+
+static inline void perf_event_thread_pause(thread t)
+{
+    if (t->perf_cpu >= 0)
+        perf_event_unload(t);
+}
+
 void register_file_syscalls(struct syscall *);
 void register_net_syscalls(struct syscall *);
 void register_signal_syscalls(struct syscall *);
@@ -857,6 +1071,7 @@ void register_poll_syscalls(struct syscall *);
 void register_clock_syscalls(struct syscall *);
 void register_timer_syscalls(struct syscall *);
 void register_other_syscalls(struct syscall *);
+void register_perf_event_syscalls(struct syscall *);
 
 /* Call this routine if RTC offset should ever shift... */
 void notify_unix_timers_of_rtc_change(void);
@@ -870,6 +1085,11 @@ boolean unix_timers_init(unix_heaps uh);
 extern sysreturn syscall_ignore();
 u64 new_zeroed_pages(u64 v, u64 length, pageflags flags, status_handler complete);
 status do_demand_page(process p, context ctx, u64 vaddr, vmap vm);
+boolean do_anonymous_cow(process p, context ctx, u64 vaddr, vmap vm);
+boolean do_userfault_wp(process p, context ctx, u64 vaddr, vmap vm);
+boolean vmap_range_is_anonymous(process p, range q);
+sysreturn anonymous_page_fill(process p, u64 vaddr, const void *src, boolean readonly);
+sysreturn anonymous_write_protect(process p, range q, boolean wp);
 void demand_page_done(context ctx, u64 vaddr, status s);
 vmap vmap_from_vaddr(process p, u64 vaddr);
 void vmap_iterator(process p, vmap_handler vmh);
@@ -944,6 +1164,7 @@ static inline sysreturn syscall_return(thread t, sysreturn val)
     thread_lock(t);
     set_syscall_return(t, val);
     t->syscall_complete = true;
+    count_syscall_latency(t, val);
     if (do_syscall_stats)
         count_syscall(t, val);
     if (t->syscall && t->syscall->uc.blocked_on)
@@ -952,6 +1173,23 @@ static inline sysreturn syscall_return(thread t, sysreturn val)
     return val;
 }
 
+/* Makes a thread runnable (completing its pending syscall, if any) so that it runs next on the
+ * current CPU without going through the thread queue; to be used when the current thread is about
+ * to sleep, to switch directly from one thread to another. If the thread is not made runnable by
+ * this call (e.g. because its syscall has not suspended yet), it is scheduled as usual later. */
+static inline void thread_switch_to(thread t)
+{
+    u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
+    ci->switch_target = &t->task;
+    if (t->syscall)
+        syscall_return(t, get_syscall_return(t));
+    else
+        schedule_thread(t);
+    ci->switch_target = 0;
+    irq_restore(flags);
+}
+
 static inline void syscall_accumulate_stime(syscall_context sc)
 {
     assert(sc->start_time != 0);
@@ -985,6 +1223,8 @@ boolean clockid_get(process p, clockid_t id, boolean timer, clock_id *res, threa
 
 void iov_op(fdesc f, boolean write, struct iovec *iov, int iovcnt, u64 offset,
             context ctx, boolean blocking, io_completion completion);
+boolean file_direct_io_sg(file f, sg_list sg, u64 offset_arg, boolean write, context ctx,
+                          io_completion completion);
 
 static inline u64 iov_total_len(struct iovec *iov, int iovcnt)
 {
@@ -994,13 +1234,19 @@ static inline u64 iov_total_len(struct iovec *iov, int iovcnt)
     return len;
 }
 
-#define resolve_fd(__p, __fd) ({void *f ; if (!(f = fdesc_get(__p, __fd))) return set_syscall_error(current, EBADF); f;})
+#define resolve_fd(__p, __fd) ({void *f ; if (!(f = ((__p) == current->p ? thread_fdesc_get(current, __fd) : fdesc_get(__p, __fd)))) return set_syscall_error(current, EBADF); f;})
 
 void init_syscalls(process p);
 void init_threads(process p);
 void init_futices(process p);
 
 sysreturn futex(int *uaddr, int futex_op, int val, u64 val2, int *uaddr2, int val3);
+sysreturn futex_waitv(struct futex_waitv *waiters, u32 nr_futexes, u32 flags,
+                      struct timespec *timeout, int clockid);
+sysreturn futex2_wake(void *uaddr, u64 mask, int nr, u32 flags);
+sysreturn futex2_wait(void *uaddr, u64 val, u64 mask, u32 flags, struct timespec *timeout,
+                      int clockid);
+sysreturn futex2_requeue(struct futex_waitv *waiters, u32 flags, int nr_wake, int nr_requeue);
 sysreturn get_robust_list(int pid, void *head, u64 *len);
 sysreturn set_robust_list(void *head, u64 len);
 void wake_robust_list(process p, void *head);
@@ -1027,6 +1273,10 @@ sysreturn io_uring_register(int fd, unsigned int opcode, void *arg,
 int do_pipe2(int fds[2], int flags);
 int pipe_set_capacity(fdesc f, int capacity);
 int pipe_get_capacity(fdesc f);
+sysreturn splice(int fd_in, s64 *off_in, int fd_out, s64 *off_out, u64 len, unsigned int flags);
+sysreturn tee(int fd_in, int fd_out, u64 len, unsigned int flags);
+sysreturn pipe_splice(fdesc in, u64 off_in, fdesc out, u64 off_out, u64 len, unsigned int flags,
+                      boolean tee, context ctx, boolean bh, io_completion completion);
 
 sysreturn socketpair(int domain, int type, int protocol, int sv[2]);
 
@@ -1042,6 +1292,10 @@ sysreturn inotify_rm_watch(int fd, int wd);
 
 int do_eventfd2(unsigned int count, int flags);
 
+sysreturn userfaultfd(int flags);
+boolean userfaultfd_registered(process p, u64 vaddr, u64 mode);
+void userfaultfd_report(process p, pending_fault pf, u64 flags, u32 tid);
+
 typedef struct special_file_wrapper {
     struct file f;
     u64 alloc_size;
@@ -1067,6 +1321,7 @@ void fpreg_copy_out(void *b, thread t);
 /* getrandom(2) flags */
 #define GRND_NONBLOCK               1
 #define GRND_RANDOM                 2
+#define GRND_INSECURE               4
 
 #define SIGNAL_STACK_SIZE 8192
 
@@ -0,0 +1,662 @@
+/* userfaultfd(2): user-space handling of page faults
+ *
+ * Ranges of anonymous memory are registered with a userfaultfd in MISSING mode, where faults on
+ * pages that are not mapped are reported to the user program, and/or in WP mode, where writes to
+ * pages write-protected with UFFDIO_WRITEPROTECT are reported. A faulting context waits on the
+ * pending fault of its page, like in a major fault, until the fault is resolved with UFFDIO_COPY,
+ * UFFDIO_ZEROPAGE, UFFDIO_WRITEPROTECT or UFFDIO_WAKE, after which the faulting access is retried.
+ */
+
+#include <unix_internal.h>
+
+//#define UFFD_DEBUG
+#ifdef UFFD_DEBUG
+#define uffd_debug(x, ...) do {tprintf(sym(uffd), 0, ss("%s: " x "\n"), func_ss, ##__VA_ARGS__);} while(0)
+#else
+#define uffd_debug(x, ...)
+#endif
+
+#define UFFD_API    0xAA
+
+#define UFFD_FEATURE_PAGEFAULT_FLAG_WP  U64_FROM_BIT(0)
+#define UFFD_FEATURE_THREAD_ID          U64_FROM_BIT(8)
+#define UFFD_FEATURES_SUPPORTED (UFFD_FEATURE_PAGEFAULT_FLAG_WP | UFFD_FEATURE_THREAD_ID)
+
+#define UFFD_EVENT_PAGEFAULT    0x12
+
+#define _UFFDIO_REGISTER        0x00
+#define _UFFDIO_UNREGISTER      0x01
+#define _UFFDIO_WAKE            0x02
+#define _UFFDIO_COPY            0x03
+#define _UFFDIO_ZEROPAGE        0x04
+#define _UFFDIO_WRITEPROTECT    0x06
+#define _UFFDIO_API             0x3F
+
+#define UFFDIO_API          0xC018AA3F
+#define UFFDIO_REGISTER     0xC020AA00
+#define UFFDIO_UNREGISTER   0x8010AA01
+#define UFFDIO_WAKE         0x8010AA02
+#define UFFDIO_COPY         0xC028AA03
+#define UFFDIO_ZEROPAGE     0xC020AA04
+#define UFFDIO_WRITEPROTECT 0xC018AA06
+
+#define UFFD_API_IOCTLS     (U64_FROM_BIT(_UFFDIO_REGISTER) | U64_FROM_BIT(_UFFDIO_UNREGISTER) | \
+                             U64_FROM_BIT(_UFFDIO_API))
+#define UFFD_RANGE_IOCTLS   (U64_FROM_BIT(_UFFDIO_WAKE) | U64_FROM_BIT(_UFFDIO_COPY) |  \
+                             U64_FROM_BIT(_UFFDIO_ZEROPAGE))
+
+#define UFFDIO_COPY_MODE_DONTWAKE           U64_FROM_BIT(0)
+#define UFFDIO_COPY_MODE_WP                 U64_FROM_BIT(1)
+#define UFFDIO_ZEROPAGE_MODE_DONTWAKE       U64_FROM_BIT(0)
+#define UFFDIO_WRITEPROTECT_MODE_WP         U64_FROM_BIT(0)
+#define UFFDIO_WRITEPROTECT_MODE_DONTWAKE   U64_FROM_BIT(1)
+
+struct uffdio_api {
+    u64 api;
+    u64 features;
+    u64 ioctls;
+};
+
+struct uffdio_range {
+    u64 start;
+    u64 len;
+};
+
+struct uffdio_register {
+    struct uffdio_range range;
+    u64 mode;
+    u64 ioctls;
+};
+
+struct uffdio_copy {
+    u64 dst;
+    u64 src;
+    u64 len;
+    u64 mode;
+    s64 copy;
+};
+
+struct uffdio_zeropage {
+    struct uffdio_range range;
+    u64 mode;
+    s64 zeropage;
+};
+
+struct uffdio_writeprotect {
+    struct uffdio_range range;
+    u64 mode;
+};
+
+struct uffd_msg {
+    u8 event;
+    u8 reserved1;
+    u16 reserved2;
+    u32 reserved3;
+    union {
+        struct {
+            u64 flags;
+            u64 address;
+            union {
+                u32 ptid;
+            } feat;
+        } pagefault;
+        struct {
+            u64 reserved1;
+            u64 reserved2;
+            u64 reserved3;
+        } reserved;
+    } arg;
+} __attribute__((packed));
+
+/* messages returned by a single read */
+#define UFFD_READ_MAX   16
+
+typedef struct uffd_region {
+    struct rmnode n;    /* must be first */
+    u64 mode;
+} *uffd_region;
+
+typedef struct uffd_fault {
+    struct list l;
+    pending_fault pf;
+    u64 flags;
+    u32 tid;
+    boolean reported;   /* read by the user program */
+} *uffd_fault;
+
+struct uffd {
+    struct fdesc f;     /* must be first */
+    heap h;
+    process p;
+    boolean api;        /* UFFDIO_API done */
+    u64 features;
+    rangemap regions;   /* uffd_region */
+    struct list faults; /* uffd_fault */
+    struct list l;      /* in process userfaultfds */
+    blockq read_bq;
+    boolean notify_pending;
+    boolean closed;
+    closure_struct(thunk, notify);
+    closure_struct(file_io, read);
+    closure_struct(fdesc_events, events);
+    closure_struct(fdesc_ioctl, ioctl);
+    closure_struct(fdesc_close, close);
+};
+
+#define uffd_lock(uffd)     spin_lock(&(uffd)->f.lock)
+#define uffd_unlock(uffd)   spin_unlock(&(uffd)->f.lock)
+
+/* Called with the process faulting lock held. */
+static struct uffd *userfaultfd_lookup(process p, u64 vaddr, u64 mode)
+{
+    list_foreach(&p->userfaultfds, e) {
+        struct uffd *uffd = struct_from_list(e, struct uffd *, l);
+        uffd_lock(uffd);
+        uffd_region r = (uffd_region)rangemap_lookup(uffd->regions, vaddr);
+        boolean match = (r != INVALID_ADDRESS) && (r->mode & mode);
+        uffd_unlock(uffd);
+        if (match)
+            return uffd;
+    }
+    return 0;
+}
+
+boolean userfaultfd_registered(process p, u64 vaddr, u64 mode)
+{
+    u64 irqflags = spin_lock_irq(&p->faulting_lock);
+    boolean registered = (userfaultfd_lookup(p, vaddr, mode) != 0);
+    spin_unlock_irq(&p->faulting_lock, irqflags);
+    return registered;
+}
+
+/* Queues a fault to be read by the user program; the faulting context must already be a dependent
+   of the pending fault. */
+void userfaultfd_report(process p, pending_fault pf, u64 flags, u32 tid)
+{
+    u64 mode = (flags & UFFD_PAGEFAULT_FLAG_WP) ? UFFDIO_REGISTER_MODE_WP :
+                                                  UFFDIO_REGISTER_MODE_MISSING;
+    uffd_debug("addr 0x%lx, flags 0x%lx, tid %d", pf->addr, flags, tid);
+    boolean notify = false;
+    status s = STATUS_OK;
+    u64 irqflags = spin_lock_irq(&p->faulting_lock);
+    struct uffd *uffd = userfaultfd_lookup(p, pf->addr, mode);
+    if (uffd) {
+        uffd_fault uf = allocate(uffd->h, sizeof(*uf));
+        if (uf != INVALID_ADDRESS) {
+            uf->pf = pf;
+            uf->flags = flags;
+            uf->tid = tid;
+            uf->reported = false;
+            uffd_lock(uffd);
+            list_push_back(&uffd->faults, &uf->l);
+            if (!uffd->notify_pending) {
+                uffd->notify_pending = true;
+                notify = true;
+            }
+            uffd_unlock(uffd);
+        } else {
+            s = timm_oom;
+        }
+    }
+    spin_unlock_irq(&p->faulting_lock, irqflags);
+    if (notify)
+        async_apply((thunk)&uffd->notify);
+    else if (!uffd || !is_ok(s))
+        /* unregistered in the meantime: let the access be retried */
+        async_apply_status_handler(pf->completion, s);
+}
+
+closure_function(1, 1, boolean, userfaultfd_region_free,
+                 heap, h,
+                 rmnode n)
+{
+    deallocate(bound(h), n, sizeof(struct uffd_region));
+    return true;
+}
+
+static void userfaultfd_free(struct uffd *uffd)
+{
+    deallocate_rangemap(uffd->regions, stack_closure(userfaultfd_region_free, uffd->h));
+    deallocate_blockq(uffd->read_bq);
+    release_fdesc(&uffd->f);
+    deallocate(uffd->h, uffd, sizeof(*uffd));
+}
+
+closure_func_basic(thunk, void, userfaultfd_notify)
+{
+    struct uffd *uffd = struct_from_field(closure_self(), struct uffd *, notify);
+    if (!uffd->closed) {
+        blockq_wake_one(uffd->read_bq);
+        fdesc_notify_events(&uffd->f);
+    }
+    uffd_lock(uffd);
+    uffd->notify_pending = false;
+    boolean closed = uffd->closed;
+    uffd_unlock(uffd);
+    if (closed)
+        userfaultfd_free(uffd);
+}
+
+/* Resumes the contexts waiting on faults in a range. */
+static void userfaultfd_wake(struct uffd *uffd, range q)
+{
+    struct list l;
+    list_init(&l);
+    uffd_lock(uffd);
+    list_foreach(&uffd->faults, e) {
+        uffd_fault uf = struct_from_list(e, uffd_fault, l);
+        if (point_in_range(q, uf->pf->addr)) {
+            list_delete(e);
+            list_push_back(&l, e);
+        }
+    }
+    uffd_unlock(uffd);
+    list_foreach(&l, e) {
+        uffd_fault uf = struct_from_list(e, uffd_fault, l);
+        uffd_debug("addr 0x%lx", uf->pf->addr);
+        list_delete(e);
+        apply(uf->pf->completion, STATUS_OK);
+        deallocate(uffd->h, uf, sizeof(*uf));
+    }
+}
+
+closure_function(4, 1, sysreturn, userfaultfd_read_bh,
+                 struct uffd *, uffd, void *, buf, u64, length, io_completion, completion,
+                 u64 flags)
+{
+    struct uffd *uffd = bound(uffd);
+    sysreturn rv;
+    if (flags & BLOCKQ_ACTION_NULLIFY) {
+        rv = -ERESTARTSYS;
+        goto out;
+    }
+    struct uffd_msg msgs[UFFD_READ_MAX];
+    int max = MIN(bound(length) / sizeof(struct uffd_msg), UFFD_READ_MAX);
+    int n = 0;
+    uffd_lock(uffd);
+    list_foreach(&uffd->faults, e) {
+        uffd_fault uf = struct_from_list(e, uffd_fault, l);
+        if (uf->reported)
+            continue;
+        struct uffd_msg *msg = &msgs[n];
+        zero(msg, sizeof(*msg));
+        msg->event = UFFD_EVENT_PAGEFAULT;
+        msg->arg.pagefault.flags = uf->flags;
+        msg->arg.pagefault.address = uf->pf->addr;
+        if (uffd->features & UFFD_FEATURE_THREAD_ID)
+            msg->arg.pagefault.feat.ptid = uf->tid;
+        uf->reported = true;
+        if (++n == max)
+            break;
+    }
+    uffd_unlock(uffd);
+    if (n == 0) {
+        if (uffd->f.flags & O_NONBLOCK) {
+            rv = -EAGAIN;
+            goto out;
+        }
+        return blockq_block_required((unix_context)get_current_context(current_cpu()), flags);
+    }
+    rv = n * sizeof(struct uffd_msg);
+    if (!copy_to_user(bound(buf), msgs, rv))
+        rv = -EFAULT;
+  out:
+    apply(bound(completion), rv);
+    closure_finish();
+    return rv;
+}
+
+closure_func_basic(file_io, sysreturn, userfaultfd_read,
+                   void *buf, u64 length, u64 offset, context ctx, boolean bh,
+                   io_completion completion)
+{
+    struct uffd *uffd = struct_from_field(closure_self(), struct uffd *, read);
+    if (!uffd->api)
+        return io_complete(completion, -EINVAL);
+    if (length < sizeof(struct uffd_msg))
+        return io_complete(completion, -EINVAL);
+    blockq_action ba = closure_from_context(ctx, userfaultfd_read_bh, uffd, buf, length,
+                                            completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, -ENOMEM);
+    return blockq_check(uffd->read_bq, ba, bh);
+}
+
+closure_func_basic(fdesc_events, u32, userfaultfd_events,
+                   thread t)
+{
+    struct uffd *uffd = struct_from_field(closure_self(), struct uffd *, events);
+    u32 events = 0;
+    uffd_lock(uffd);
+    list_foreach(&uffd->faults, e) {
+        if (!struct_from_list(e, uffd_fault, l)->reported) {
+            events = EPOLLIN;
+            break;
+        }
+    }
+    uffd_unlock(uffd);
+    return events;
+}
+
+static boolean userfaultfd_range_valid(struct uffdio_range *ur, range *q)
+{
+    if ((ur->start & PAGEMASK) || (ur->len & PAGEMASK) || !ur->len ||
+        (ur->start + ur->len < ur->start) || (ur->start + ur->len > USER_LIMIT))
+        return false;
+    *q = irangel(ur->start, ur->len);
+    return true;
+}
+
+/* Returns whether a range is entirely registered, with any of the given modes. */
+static boolean userfaultfd_range_registered(struct uffd *uffd, range q, u64 mode)
+{
+    boolean registered = true;
+    uffd_lock(uffd);
+    u64 next = q.start;
+    while (next < q.end) {
+        uffd_region r = (uffd_region)rangemap_lookup(uffd->regions, next);
+        if ((r == INVALID_ADDRESS) || !(r->mode & mode)) {
+            registered = false;
+            break;
+        }
+        next = r->n.r.end;
+    }
+    uffd_unlock(uffd);
+    return registered;
+}
+
+/* Called with the userfaultfd lock held. Returns the union of the modes of the removed regions. */
+static u64 userfaultfd_remove_regions(struct uffd *uffd, range q, boolean *oom)
+{
+    rangemap rm = uffd->regions;
+    u64 mode = 0;
+    rmnode n;
+    while (((n = rangemap_lookup_at_or_next(rm, q.start)) != INVALID_ADDRESS) &&
+           (n->r.start < q.end)) {
+        range r = n->r;
+        mode |= ((uffd_region)n)->mode;
+        if (r.start < q.start) {
+            if (r.end > q.end) {
+                uffd_region tail = allocate(uffd->h, sizeof(*tail));
+                if (tail == INVALID_ADDRESS) {
+                    *oom = true;
+                    break;
+                }
+                rmnode_init(&tail->n, irange(q.end, r.end));
+                tail->mode = ((uffd_region)n)->mode;
+                rangemap_reinsert(rm, n, irange(r.start, q.start));
+                rangemap_insert(rm, &tail->n);
+                break;
+            }
+            rangemap_reinsert(rm, n, irange(r.start, q.start));
+        } else if (r.end > q.end) {
+            rangemap_reinsert(rm, n, irange(q.end, r.end));
+            break;
+        } else {
+            rangemap_remove_node(rm, n);
+            deallocate(uffd->h, n, sizeof(struct uffd_region));
+        }
+    }
+    return mode;
+}
+
+static sysreturn userfaultfd_register(struct uffd *uffd, struct uffdio_register *ureg)
+{
+    struct uffdio_register reg;
+    if (!copy_from_user(ureg, &reg, sizeof(reg)))
+        return -EFAULT;
+    range q;
+    if (!userfaultfd_range_valid(&reg.range, &q) || !reg.mode ||
+        (reg.mode & ~(UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP)))
+        return -EINVAL;
+    if (!vmap_range_is_anonymous(uffd->p, q))
+        return -EINVAL;
+    uffd_region r = allocate(uffd->h, sizeof(*r));
+    if (r == INVALID_ADDRESS)
+        return -ENOMEM;
+    rmnode_init(&r->n, q);
+    r->mode = reg.mode;
+    boolean oom = false;
+    uffd_lock(uffd);
+    userfaultfd_remove_regions(uffd, q, &oom);
+    if (!oom)
+        rangemap_insert(uffd->regions, &r->n);
+    uffd_unlock(uffd);
+    if (oom) {
+        deallocate(uffd->h, r, sizeof(*r));
+        return -ENOMEM;
+    }
+    uffd_debug("%R, mode 0x%lx", q, reg.mode);
+    u64 ioctls = UFFD_RANGE_IOCTLS;
+    if (reg.mode & UFFDIO_REGISTER_MODE_WP)
+        ioctls |= U64_FROM_BIT(_UFFDIO_WRITEPROTECT);
+    if (!set_user_value(&ureg->ioctls, ioctls))
+        return -EFAULT;
+    return 0;
+}
+
+static sysreturn userfaultfd_unregister(struct uffd *uffd, struct uffdio_range *urange)
+{
+    struct uffdio_range ur;
+    range q;
+    if (!copy_from_user(urange, &ur, sizeof(ur)))
+        return -EFAULT;
+    if (!userfaultfd_range_valid(&ur, &q))
+        return -EINVAL;
+    boolean oom = false;
+    uffd_lock(uffd);
+    u64 mode = userfaultfd_remove_regions(uffd, q, &oom);
+    uffd_unlock(uffd);
+    if (oom)
+        return -ENOMEM;
+    uffd_debug("%R", q);
+    if (mode & UFFDIO_REGISTER_MODE_WP)
+        anonymous_write_protect(uffd->p, q, false);
+    userfaultfd_wake(uffd, q);
+    return 0;
+}
+
+/* Resolves missing page faults by mapping pages filled from src, or zeroed if src is null. */
+static s64 userfaultfd_fill(struct uffd *uffd, range q, u64 src, boolean wp, boolean wake)
+{
+    if (!userfaultfd_range_registered(uffd, q, UFFDIO_REGISTER_MODE_MISSING))
+        return -ENOENT;
+    s64 filled = 0;
+    sysreturn rv = 0;
+    for (u64 v = q.start; v < q.end; v += PAGESIZE) {
+        rv = anonymous_page_fill(uffd->p, v, src ? pointer_from_u64(src + (v - q.start)) : 0, wp);
+        if (rv)
+            break;
+        filled += PAGESIZE;
+    }
+    if (wake && filled)
+        userfaultfd_wake(uffd, irangel(q.start, filled));
+    return filled ? filled : rv;
+}
+
+static sysreturn userfaultfd_copy(struct uffd *uffd, struct uffdio_copy *ucopy)
+{
+    struct uffdio_copy c;
+    if (!copy_from_user(ucopy, &c, sizeof(c)))
+        return -EFAULT;
+    struct uffdio_range ur = {.start = c.dst, .len = c.len};
+    range q;
+    if (!userfaultfd_range_valid(&ur, &q) || (c.src & PAGEMASK) ||
+        (c.mode & ~(UFFDIO_COPY_MODE_DONTWAKE | UFFDIO_COPY_MODE_WP)))
+        return -EINVAL;
+    s64 copied = userfaultfd_fill(uffd, q, c.src, !!(c.mode & UFFDIO_COPY_MODE_WP),
+                                  !(c.mode & UFFDIO_COPY_MODE_DONTWAKE));
+    if (!set_user_value(&ucopy->copy, copied))
+        return -EFAULT;
+    if (copied < 0)
+        return copied;
+    return (copied == c.len) ? 0 : -EAGAIN;
+}
+
+static sysreturn userfaultfd_zeropage(struct uffd *uffd, struct uffdio_zeropage *uzero)
+{
+    struct uffdio_zeropage z;
+    if (!copy_from_user(uzero, &z, sizeof(z)))
+        return -EFAULT;
+    range q;
+    if (!userfaultfd_range_valid(&z.range, &q) || (z.mode & ~UFFDIO_ZEROPAGE_MODE_DONTWAKE))
+        return -EINVAL;
+    s64 zeroed = userfaultfd_fill(uffd, q, 0, false, !(z.mode & UFFDIO_ZEROPAGE_MODE_DONTWAKE));
+    if (!set_user_value(&uzero->zeropage, zeroed))
+        return -EFAULT;
+    if (zeroed < 0)
+        return zeroed;
+    return (zeroed == z.range.len) ? 0 : -EAGAIN;
+}
+
+static sysreturn userfaultfd_writeprotect(struct uffd *uffd, struct uffdio_writeprotect *uwp)
+{
+    struct uffdio_writeprotect wp;
+    if (!copy_from_user(uwp, &wp, sizeof(wp)))
+        return -EFAULT;
+    range q;
+    if (!userfaultfd_range_valid(&wp.range, &q) ||
+        (wp.mode & ~(UFFDIO_WRITEPROTECT_MODE_WP | UFFDIO_WRITEPROTECT_MODE_DONTWAKE)) ||
+        ((wp.mode & UFFDIO_WRITEPROTECT_MODE_WP) && (wp.mode & UFFDIO_WRITEPROTECT_MODE_DONTWAKE)))
+        return -EINVAL;
+    if (!userfaultfd_range_registered(uffd, q, UFFDIO_REGISTER_MODE_WP))
+        return -ENOENT;
+    boolean protect = !!(wp.mode & UFFDIO_WRITEPROTECT_MODE_WP);
+    sysreturn rv = anonymous_write_protect(uffd->p, q, protect);
+    if (!rv && !protect && !(wp.mode & UFFDIO_WRITEPROTECT_MODE_DONTWAKE))
+        userfaultfd_wake(uffd, q);
+    return rv;
+}
+
+static sysreturn userfaultfd_api(struct uffd *uffd, struct uffdio_api *uapi)
+{
+    struct uffdio_api api;
+    if (!copy_from_user(uapi, &api, sizeof(api)))
+        return -EFAULT;
+    if (uffd->api || (api.api != UFFD_API) || (api.features & ~UFFD_FEATURES_SUPPORTED))
+        return -EINVAL;
+    uffd->features = api.features;
+    uffd->api = true;
+    api.features = UFFD_FEATURES_SUPPORTED;
+    api.ioctls = UFFD_API_IOCTLS;
+    if (!copy_to_user(uapi, &api, sizeof(api)))
+        return -EFAULT;
+    return 0;
+}
+
+closure_func_basic(fdesc_ioctl, sysreturn, userfaultfd_ioctl,
+                   unsigned long request, vlist ap)
+{
+    struct uffd *uffd = struct_from_field(closure_self(), struct uffd *, ioctl);
+    if (request == UFFDIO_API)
+        return userfaultfd_api(uffd, varg(ap, struct uffdio_api *));
+    switch (request) {
+    case UFFDIO_REGISTER:
+    case UFFDIO_UNREGISTER:
+    case UFFDIO_WAKE:
+    case UFFDIO_COPY:
+    case UFFDIO_ZEROPAGE:
+    case UFFDIO_WRITEPROTECT:
+        if (!uffd->api)
+            return -EINVAL;
+        break;
+    default:
+        return ioctl_generic(&uffd->f, request, ap);
+    }
+    switch (request) {
+    case UFFDIO_REGISTER:
+        return userfaultfd_register(uffd, varg(ap, struct uffdio_register *));
+    case UFFDIO_UNREGISTER:
+        return userfaultfd_unregister(uffd, varg(ap, struct uffdio_range *));
+    case UFFDIO_WAKE: {
+        struct uffdio_range ur;
+        range q;
+        if (!copy_from_user(varg(ap, struct uffdio_range *), &ur, sizeof(ur)))
+            return -EFAULT;
+        if (!userfaultfd_range_valid(&ur, &q))
+            return -EINVAL;
+        userfaultfd_wake(uffd, q);
+        return 0;
+    }
+    case UFFDIO_COPY:
+        return userfaultfd_copy(uffd, varg(ap, struct uffdio_copy *));
+    case UFFDIO_ZEROPAGE:
+        return userfaultfd_zeropage(uffd, varg(ap, struct uffdio_zeropage *));
+    default:
+        return userfaultfd_writeprotect(uffd, varg(ap, struct uffdio_writeprotect *));
+    }
+}
+
+closure_function(1, 1, boolean, userfaultfd_region_release,
+                 struct uffd *, uffd,
+                 rmnode n)
+{
+    struct uffd *uffd = bound(uffd);
+    if (((uffd_region)n)->mode & UFFDIO_REGISTER_MODE_WP)
+        anonymous_write_protect(uffd->p, n->r, false);
+    return true;
+}
+
+closure_func_basic(fdesc_close, sysreturn, userfaultfd_close,
+                   context ctx, io_completion completion)
+{
+    struct uffd *uffd = struct_from_field(closure_self(), struct uffd *, close);
+    process p = uffd->p;
+    u64 irqflags = spin_lock_irq(&p->faulting_lock);
+    list_delete(&uffd->l);
+    spin_unlock_irq(&p->faulting_lock, irqflags);
+
+    /* no more faults can be queued: release the write-protected pages and the waiting contexts */
+    rangemap_range_lookup(uffd->regions, irange(0, USER_LIMIT),
+                          stack_closure(userfaultfd_region_release, uffd));
+    userfaultfd_wake(uffd, irange(0, USER_LIMIT));
+    uffd_lock(uffd);
+    uffd->closed = true;
+    boolean pending = uffd->notify_pending;
+    uffd_unlock(uffd);
+    if (!pending)   /* otherwise, the pending notification frees the userfaultfd */
+        userfaultfd_free(uffd);
+    return io_complete(completion, 0);
+}
+
+sysreturn userfaultfd(int flags)
+{
+    if (flags & ~(O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY))
+        return -EINVAL;
+    process p = current->p;
+    heap h = heap_locked(&p->uh->kh);
+    struct uffd *uffd = allocate_zero(h, sizeof(*uffd));
+    if (uffd == INVALID_ADDRESS)
+        return -ENOMEM;
+    uffd->regions = allocate_rangemap(h);
+    if (uffd->regions == INVALID_ADDRESS)
+        goto err_regions;
+    uffd->read_bq = allocate_blockq(h, ss("userfaultfd"));
+    if (uffd->read_bq == INVALID_ADDRESS)
+        goto err_bq;
+    init_fdesc(h, &uffd->f, FDESC_TYPE_USERFAULTFD);
+    uffd->f.flags = O_RDONLY | (flags & O_NONBLOCK);
+    uffd->f.read = init_closure_func(&uffd->read, file_io, userfaultfd_read);
+    uffd->f.events = init_closure_func(&uffd->events, fdesc_events, userfaultfd_events);
+    uffd->f.ioctl = init_closure_func(&uffd->ioctl, fdesc_ioctl, userfaultfd_ioctl);
+    uffd->f.close = init_closure_func(&uffd->close, fdesc_close, userfaultfd_close);
+    init_closure_func(&uffd->notify, thunk, userfaultfd_notify);
+    uffd->h = h;
+    uffd->p = p;
+    list_init(&uffd->faults);
+    u64 irqflags = spin_lock_irq(&p->faulting_lock);
+    list_push_back(&p->userfaultfds, &uffd->l);
+    spin_unlock_irq(&p->faulting_lock, irqflags);
+    u64 fd = allocate_fd(p, uffd);
+    if (fd == INVALID_PHYSICAL) {
+        apply(uffd->f.close, 0, io_completion_ignore);
+        return -EMFILE;
+    }
+    uffd_debug("fd %ld, flags 0x%x", fd, flags);
+    return fd;
+  err_bq:
+    deallocate_rangemap(uffd->regions, stack_closure(userfaultfd_region_free, h));
+  err_regions:
+    deallocate(h, uffd, sizeof(*uffd));
+    return -ENOMEM;
+}
@@ -26,6 +26,7 @@ typedef struct vsock {
     struct sock sock;
     closure_struct(file_io, read);
     closure_struct(file_io, write);
+    closure_struct(sg_file_io, sg_write);
     closure_struct(fdesc_events, events);
     closure_struct(fdesc_close, close);
     enum {
@@ -256,8 +257,8 @@ closure_func_basic(file_io, sysreturn, vsock_read,
     return blockq_check(s->sock.rxbq, ba, bh);
 }
 
-closure_function(4, 1, sysreturn, vsock_write_bh,
-                 vsock, s, void *, src, u64, length, io_completion, completion,
+closure_function(5, 1, sysreturn, vsock_write_bh,
+                 vsock, s, void *, src, sg_list, sg, u64, length, io_completion, completion,
                  u64 bqflags)
 {
     vsock s = bound(s);
@@ -307,11 +308,21 @@ closure_function(4, 1, sysreturn, vsock_write_bh,
         rv = -EFAULT;
         goto unlock_out;
     }
-    runtime_memcpy(txbuf, src, length);
+    if (src) {
+        runtime_memcpy(txbuf, src, length);
+    } else {
+        u64 len = sg_copy_to_buf(txbuf, bound(sg), length);
+        assert(len == length);
+    }
     context_clear_err(ctx);
     vsock_unlock(s);
     vsock_conn_lock(conn);
-    rv = virtio_sock_tx(conn, txbuf) ? length : -ENOMEM;
+    if (virtio_sock_tx(conn, txbuf)) {
+        rv = length;
+    } else {
+        virtio_sock_free_txbuf(vsock_priv.transport, txbuf);
+        rv = -ENOMEM;
+    }
     vsock_conn_unlock(conn);
     goto out;
 unlock_out:
@@ -330,7 +341,20 @@ closure_func_basic(file_io, sysreturn, vsock_write,
     if (length == 0)
         return io_complete(completion, 0);
     vsock s = struct_from_field(closure_self(), vsock, write);
-    blockq_action ba = closure_from_context(ctx, vsock_write_bh, s, src, length, completion);
+    blockq_action ba = closure_from_context(ctx, vsock_write_bh, s, src, 0, length, completion);
+    return blockq_check(s->sock.txbq, ba, bh);
+}
+
+/* Vectored writes are gathered into a single packet. */
+closure_func_basic(sg_file_io, sysreturn, vsock_sg_write,
+                   sg_list sg, u64 length, u64 offset, context ctx, boolean bh, io_completion completion)
+{
+    if (length == 0)
+        return io_complete(completion, 0);
+    vsock s = struct_from_field(closure_self(), vsock, sg_write);
+    blockq_action ba = closure_from_context(ctx, vsock_write_bh, s, 0, sg, length, completion);
+    if (ba == INVALID_ADDRESS)
+        return io_complete(completion, -ENOMEM);
     return blockq_check(s->sock.txbq, ba, bh);
 }
 
@@ -562,14 +586,13 @@ static sysreturn vsock_connect(struct sock *sock, struct sockaddr *addr, socklen
     return rv;
 }
 
-closure_function(4, 1, sysreturn, vsock_accept_bh,
-                 vsock, s, struct sockaddr *, addr, socklen_t *, addrlen, int, flags,
+closure_function(5, 1, sysreturn, vsock_accept_bh,
+                 vsock, s, struct sockaddr *, addr, socklen_t *, addrlen, int, flags, io_completion, completion,
                  u64 bqflags)
 {
     vsock s = bound(s);
     sysreturn rv;
     context ctx = context_from_closure(closure_self());
-    thread t = ((syscall_context)ctx)->t;
     if (bqflags & BLOCKQ_ACTION_NULLIFY) {
         rv = -ERESTARTSYS;
         goto out;
@@ -585,9 +608,9 @@ closure_function(4, 1, sysreturn, vsock_accept_bh,
             rv = -EAGAIN;
             goto out;
         }
-        return blockq_block_required(&((syscall_context)ctx)->uc, bqflags);
+        return blockq_block_required((unix_context)ctx, bqflags);
     }
-    child->sock.fd = allocate_fd(t->p, child);
+    child->sock.fd = allocate_fd(unix_context_process(ctx), child);
     if (child->sock.fd == INVALID_PHYSICAL) {
         apply(child->sock.f.close, 0, io_completion_ignore);
         rv = -ENFILE;
@@ -618,14 +641,13 @@ closure_function(4, 1, sysreturn, vsock_accept_bh,
     if (empty)
         fdesc_notify_events(&s->sock.f);    /* reset EPOLLIN event */
   out:
+    apply(bound(completion), rv);
     closure_finish();
-    socket_release(&s->sock);
-    syscall_return(t, rv);
     return rv;
 }
 
 static sysreturn vsock_accept4(struct sock *sock, struct sockaddr *addr, socklen_t *addrlen,
-                               int flags)
+                               int flags, context ctx, boolean in_bh, io_completion completion)
 {
     vsock s = (vsock)sock;
     sysreturn rv;
@@ -633,15 +655,15 @@ static sysreturn vsock_accept4(struct sock *sock, struct sockaddr *addr, socklen
         rv = -EINVAL;
         goto out;
     }
-    blockq_action ba = contextual_closure(vsock_accept_bh, s, addr, addrlen, flags);
+    blockq_action ba = closure_from_context(ctx, vsock_accept_bh, s, addr, addrlen, flags,
+                                            completion);
     if (ba == INVALID_ADDRESS) {
         rv = -ENOMEM;
         goto out;
     }
-    return blockq_check(sock->rxbq, ba, false);
+    return blockq_check(sock->rxbq, ba, in_bh);
 out:
-    socket_release(sock);
-    return rv;
+    return io_complete(completion, rv);
 }
 
 static sysreturn vsock_sendto(struct sock *sock, void *buf, u64 len, int flags,
@@ -739,6 +761,7 @@ static sysreturn vsock_alloc(heap h, int type, int flags, boolean alloc_fd, vsoc
         goto err_socket;
     s->sock.f.read = init_closure_func(&s->read, file_io, vsock_read);
     s->sock.f.write = init_closure_func(&s->write, file_io, vsock_write);
+    s->sock.f.sg_write = init_closure_func(&s->sg_write, sg_file_io, vsock_sg_write);
     s->sock.f.events = init_closure_func(&s->events, fdesc_events, vsock_events);
     s->sock.f.close = init_closure_func(&s->close, fdesc_close, vsock_close);
     s->sock.bind = vsock_bind;
@@ -887,8 +910,10 @@ vsock_connection vsock_get_conn(struct vsock_conn_id *conn_id)
 vsock_connection vsock_rx(struct vsock_conn_id *conn_id, void *data, u64 len)
 {
     vsock_connection conn = vsock_get_connection(conn_id);
-    if (!conn)
+    if (!conn) {
+        virtio_sock_free_rxbuf(vsock_priv.transport, data);
         return conn;
+    }
     vsock_conn_lock(conn);
     vsock s = conn->vsock;
     if (s) {
@@ -916,6 +941,8 @@ vsock_connection vsock_rx(struct vsock_conn_id *conn_id, void *data, u64 len)
         blockq_wake_one(s->sock.rxbq);
         if (notify)
             notify_dispatch(s->sock.f.ns, vsock_events_internal(s));
+    } else {
+        virtio_sock_free_rxbuf(vsock_priv.transport, data);
     }
     return conn;
 }
@@ -461,7 +461,15 @@ closure_func_basic(buffer_handler, status, connection_output,
     conn_handler ch = struct_from_field(closure_self(), conn_handler, out);
     descriptor c = ch->f;
     if (b)  {
-        igr(write(c, b->contents, buffer_length(b)));
+        if (buffer_is_chain(b)) {
+            sg_list sg = buffer_chain_sg(b);
+            if (sg != INVALID_ADDRESS) {
+                sg_list_foreach(sg, sgb)
+                    igr(write(c, sgb->buf + sgb->offset, sg_buf_len(sgb)));
+            }
+        } else {
+            igr(write(c, b->contents, buffer_length(b)));
+        }
         deallocate_buffer(b);
     } else {
         shutdown(c, SHUT_RDWR); /* trigger execution of input handler, which will clean up things */
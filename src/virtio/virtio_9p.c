@@ -696,7 +696,19 @@ closure_function(4, 1, void, v9p_read_complete,
     closure_finish();
 }
 
-void v9p_read(void *priv, u32 fid, u64 offset, u32 count, void *dest, status_handler complete)
+/* Adds to a message the buffers holding the first count bytes of an sg list (without consuming
+ * them), so that data is transferred directly to/from the sg buffers. */
+static void v9p_push_sg(virtio_9p v9p, vqmsg m, sg_list sg, u32 count, boolean write)
+{
+    for (u64 i = 0; count > 0; i++) {
+        sg_buf sgb = sg_list_peek_at(sg, i);
+        u32 len = MIN(sg_buf_len(sgb), count);
+        vqmsg_push(v9p->vq, m, physical_from_virtual(sgb->buf + sgb->offset), len, write);
+        count -= len;
+    }
+}
+
+void v9p_read(void *priv, u32 fid, u64 offset, u32 count, sg_list dest, status_handler complete)
 {
     v9p_debug("read fid %d, offset %ld, count %d, complete %F\n", fid, offset, count, complete);
     virtio_9p v9p = priv;
@@ -724,7 +736,7 @@ void v9p_read(void *priv, u32 fid, u64 offset, u32 count, void *dest, status_han
     }
     vqmsg_push(v9p->vq, m, phys, sizeof(xaction->req), false);
     vqmsg_push(v9p->vq, m, phys + sizeof(xaction->req), sizeof(xaction->resp), true);
-    vqmsg_push(v9p->vq, m, physical_from_virtual(dest), count, true);
+    v9p_push_sg(v9p, m, dest, count, true);
     vqmsg_commit(v9p->vq, m, finish);
     return;
   dealloc_req:
@@ -759,7 +771,7 @@ closure_function(4, 1, void, v9p_write_complete,
     closure_finish();
 }
 
-void v9p_write(void *priv, u32 fid, u64 offset, u32 count, void *src, status_handler complete)
+void v9p_write(void *priv, u32 fid, u64 offset, u32 count, sg_list src, status_handler complete)
 {
     v9p_debug("write fid %d, offset %ld, count %d, complete %F\n", fid, offset, count, complete);
     virtio_9p v9p = priv;
@@ -787,7 +799,7 @@ void v9p_write(void *priv, u32 fid, u64 offset, u32 count, void *src, status_han
         goto dealloc_req;
     }
     vqmsg_push(v9p->vq, m, phys, sizeof(*req), false);
-    vqmsg_push(v9p->vq, m, physical_from_virtual(src), count, false);
+    v9p_push_sg(v9p, m, src, count, false);
     vqmsg_push(v9p->vq, m, phys + sizeof(*req), sizeof(*resp), true);
     vqmsg_commit(v9p->vq, m, finish);
     return;
@@ -20,5 +20,5 @@ fs_status v9p_attach(void *priv, u32 root_fid, u64 *root_qid);
 fs_status v9p_walk(void *priv, u32 fid, u32 newfid, string wname, struct p9_qid *qid);
 fs_status v9p_clunk(void *priv, u32 fid);
 
-void v9p_read(void *priv, u32 fid, u64 offset, u32 count, void *dest, status_handler complete);
-void v9p_write(void *priv, u32 fid, u64 offset, u32 count, void *src, status_handler complete);
+void v9p_read(void *priv, u32 fid, u64 offset, u32 count, sg_list dest, status_handler complete);
+void v9p_write(void *priv, u32 fid, u64 offset, u32 count, sg_list src, status_handler complete);
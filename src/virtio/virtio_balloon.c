@@ -21,6 +21,10 @@
 #endif
 
 #define VIRTIO_BALLOON_RETRY_INTERVAL_SEC 5
+#define VIRTIO_BALLOON_REPORT_INTERVAL_SEC 2
+
+/* maximum number of chunks sent to the device in a free page report */
+#define VIRTIO_BALLOON_REPORT_CHUNKS 16
 
 /* Virtio interface is always 4K pages. */
 #define VIRTIO_BALLOON_PAGE_ORDER PAGELOG
@@ -34,6 +38,12 @@
 #define VIRTIO_BALLOON_F_MUST_TELL_HOST 1
 #define VIRTIO_BALLOON_F_STATS_VQ       2
 #define VIRTIO_BALLOON_F_DEFLATE_ON_OOM 4
+#define VIRTIO_BALLOON_F_FREE_PAGE_HINT 8
+#define VIRTIO_BALLOON_F_PAGE_POISON    16  /* not negotiated: freed memory is not poisoned */
+#define VIRTIO_BALLOON_F_REPORTING      32
+
+#define VIRTIO_BALLOON_CMD_ID_STOP  0
+#define VIRTIO_BALLOON_CMD_ID_DONE  1
 
 struct virtio_balloon_stat {
 #define VIRTIO_BALLOON_S_SWAP_IN      0
@@ -61,6 +71,8 @@ struct virtio_balloon {
     virtqueue inflateq;
     virtqueue deflateq;
     virtqueue statsq;
+    virtqueue free_page_vq;
+    virtqueue reporting_vq;
     struct timer retry_timer;
     closure_struct(timer_handler, timer_task);
     struct virtio_balloon_stat *stats;
@@ -69,6 +81,24 @@ struct virtio_balloon {
     u32 actual_pages;
     struct list in_balloon;
     struct list free;
+
+    /* Free memory chunks (of VIRTIO_BALLOON_ALLOC_SIZE bytes) taken from the physical heap and
+     * either hinted or reported to the device; they are given back to the physical heap when
+     * the kernel needs memory. */
+    struct spinlock lock;
+    vector hinted;
+    vector reported;
+    u32 hint_cmd_id;
+    u32 *cmd_id_active;
+    u64 cmd_id_active_phys;
+    u32 *cmd_id_stop;
+    u64 cmd_id_stop_phys;
+    closure_struct(vqfinish, hint_complete);
+    u64 report[VIRTIO_BALLOON_REPORT_CHUNKS];
+    int report_count;
+    struct timer report_timer;
+    closure_struct(timer_handler, report_task);
+    closure_struct(vqfinish, report_complete);
 } virtio_balloon;
 
 typedef struct balloon_page {
@@ -81,10 +111,14 @@ struct virtio_balloon_config {
     /* explicitly little endian */
     u32 num_pages;
     u32 actual;
+    u32 free_page_hint_cmd_id;
+    u32 poison_val;
 } __attribute__((packed));
 
 #define VIRTIO_BALLOON_R_NUM_PAGES (offsetof(struct virtio_balloon_config *, num_pages))
 #define VIRTIO_BALLOON_R_ACTUAL    (offsetof(struct virtio_balloon_config *, actual))
+#define VIRTIO_BALLOON_R_FREE_PAGE_HINT_CMD_ID  \
+    (offsetof(struct virtio_balloon_config *, free_page_hint_cmd_id))
 
 static inline boolean balloon_must_tell_host(void)
 {
@@ -96,6 +130,16 @@ static inline boolean balloon_has_stats_vq(void)
     return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_STATS_VQ) != 0;
 }
 
+static inline boolean balloon_has_free_page_hint(void)
+{
+    return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_FREE_PAGE_HINT) != 0;
+}
+
+static inline boolean balloon_has_reporting(void)
+{
+    return (virtio_balloon.dev->features & VIRTIO_BALLOON_F_REPORTING) != 0;
+}
+
 static u64 phys_base_from_balloon_page(balloon_page bp)
 {
     return bp->addrs[0] << VIRTIO_BALLOON_PAGE_ORDER;
@@ -136,6 +180,44 @@ static balloon_page allocate_balloon_page(void)
     return bp;
 }
 
+/* Takes a chunk from the hinted or reported chunks */
+static u64 virtio_balloon_get_chunk(vector chunks)
+{
+    spin_lock(&virtio_balloon.lock);
+    void *chunk = chunks ? vector_pop(chunks) : 0;
+    spin_unlock(&virtio_balloon.lock);
+    return chunk ? u64_from_pointer(chunk) : INVALID_PHYSICAL;
+}
+
+static void virtio_balloon_put_chunk(vector chunks, u64 phys)
+{
+    spin_lock(&virtio_balloon.lock);
+    vector_push(chunks, pointer_from_u64(phys));
+    spin_unlock(&virtio_balloon.lock);
+}
+
+/* Returns up to n chunks from the given vector to the physical heap */
+static u64 virtio_balloon_release_chunks(vector chunks, u64 n)
+{
+    u64 released = 0;
+    while (released < n) {
+        u64 phys = virtio_balloon_get_chunk(chunks);
+        if (phys == INVALID_PHYSICAL)
+            break;
+        deallocate_u64((heap)virtio_balloon.physical, phys, VIRTIO_BALLOON_ALLOC_SIZE);
+        released++;
+    }
+    return released;
+}
+
+/* Allocates a chunk from the physical heap if free memory does not go below the given amount */
+static u64 virtio_balloon_alloc_chunk(u64 min_free)
+{
+    if (heap_free((heap)virtio_balloon.physical) < min_free + VIRTIO_BALLOON_ALLOC_SIZE)
+        return INVALID_PHYSICAL;
+    return allocate_u64((heap)virtio_balloon.physical, VIRTIO_BALLOON_ALLOC_SIZE);
+}
+
 static u64 virtio_balloon_inflate(u64 n_balloon_pages)
 {
     virtqueue vq = virtio_balloon.inflateq;
@@ -143,10 +225,14 @@ static u64 virtio_balloon_inflate(u64 n_balloon_pages)
 
     u64 inflated = 0;
     while (inflated < n_balloon_pages) {
-        if (heap_free((heap)virtio_balloon.physical) <
-            (BALLOON_MEMORY_MINIMUM + VIRTIO_BALLOON_ALLOC_SIZE))
-            break;
-        u64 phys = allocate_u64((heap)virtio_balloon.physical, VIRTIO_BALLOON_ALLOC_SIZE);
+        /* chunks already reported to the device are the cheapest to give away */
+        u64 phys = virtio_balloon_get_chunk(virtio_balloon.reported);
+        if (phys == INVALID_PHYSICAL) {
+            if (heap_free((heap)virtio_balloon.physical) <
+                (BALLOON_MEMORY_MINIMUM + VIRTIO_BALLOON_ALLOC_SIZE))
+                break;
+            phys = allocate_u64((heap)virtio_balloon.physical, VIRTIO_BALLOON_ALLOC_SIZE);
+        }
         if (phys == INVALID_PHYSICAL) {
             /* We shouldn't get down to the minimum. This ought to be an error
                or assertion failure, however we can't completely account for
@@ -220,6 +306,97 @@ static u64 virtio_balloon_deflate(u64 n_balloon_pages)
     return deflated;
 }
 
+closure_func_basic(vqfinish, void, virtio_balloon_hint_complete,
+                   u64 len)
+{
+    /* hinted chunks are kept until the device is done with the hinting request */
+}
+
+static void virtio_balloon_hint_push(u64 phys, u32 len, boolean write)
+{
+    virtqueue vq = virtio_balloon.free_page_vq;
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(vq, m, phys, len, write);
+    vqmsg_commit(vq, m, (vqfinish)&virtio_balloon.hint_complete);
+}
+
+/* Hints the free memory which is not needed by the kernel to the device (e.g. so that the
+ * hypervisor can skip free pages when migrating the VM). */
+static void virtio_balloon_hint(u32 cmd_id)
+{
+    *virtio_balloon.cmd_id_active = htole32(cmd_id);
+    virtio_balloon_hint_push(virtio_balloon.cmd_id_active_phys, sizeof(u32), false);
+    u64 min_free = mm_watermark_high();
+    u64 hinted = 0;
+    u64 phys;
+    while ((phys = virtio_balloon_alloc_chunk(min_free)) != INVALID_PHYSICAL) {
+        virtio_balloon_put_chunk(virtio_balloon.hinted, phys);
+        virtio_balloon_hint_push(phys, VIRTIO_BALLOON_ALLOC_SIZE, true);
+        hinted++;
+    }
+    virtio_balloon_hint_push(virtio_balloon.cmd_id_stop_phys, sizeof(u32), false);
+    virtio_balloon_debug("%s: cmd_id %d, hinted %ld MB\n", func_ss, cmd_id,
+                         hinted << (VIRTIO_BALLOON_ALLOC_ORDER - 20));
+}
+
+static void virtio_balloon_hint_update(void)
+{
+    u32 cmd_id = le32toh(vtdev_cfg_read_4(virtio_balloon.dev,
+                                          VIRTIO_BALLOON_R_FREE_PAGE_HINT_CMD_ID));
+    if (cmd_id == virtio_balloon.hint_cmd_id)
+        return;
+    virtio_balloon.hint_cmd_id = cmd_id;
+    switch (cmd_id) {
+    case VIRTIO_BALLOON_CMD_ID_STOP:
+        break;
+    case VIRTIO_BALLOON_CMD_ID_DONE:
+        virtio_balloon_release_chunks(virtio_balloon.hinted, -1ull);
+        break;
+    default:
+        virtio_balloon_hint(cmd_id);
+    }
+}
+
+closure_func_basic(vqfinish, void, virtio_balloon_report_complete,
+                   u64 len)
+{
+    virtio_balloon_verbose("%s: %d chunks reported\n", func_ss, virtio_balloon.report_count);
+    for (int i = 0; i < virtio_balloon.report_count; i++)
+        virtio_balloon_put_chunk(virtio_balloon.reported, virtio_balloon.report[i]);
+    virtio_balloon.report_count = 0;
+}
+
+/* Reports free memory in excess of what the kernel needs to the device, so that the hypervisor
+ * can reclaim the host memory backing it without the need of an explicit balloon target.
+ * Reported chunks stay out of the physical heap until memory is needed: this keeps them from
+ * being reported again, and lets the reclaim code return them with no cost other than the host
+ * faulting in the memory again. */
+closure_func_basic(timer_handler, void, virtio_balloon_report_task,
+                   u64 expiry, u64 overruns)
+{
+    if ((overruns == timer_disabled) || virtio_balloon.report_count)
+        return;
+    u64 min_free = 2 * mm_watermark_high();
+    int n;
+    for (n = 0; n < VIRTIO_BALLOON_REPORT_CHUNKS; n++) {
+        u64 phys = virtio_balloon_alloc_chunk(min_free);
+        if (phys == INVALID_PHYSICAL)
+            break;
+        virtio_balloon.report[n] = phys;
+    }
+    if (n == 0)
+        return;
+    virtio_balloon_verbose("%s: reporting %d chunks\n", func_ss, n);
+    virtqueue vq = virtio_balloon.reporting_vq;
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    for (int i = 0; i < n; i++)
+        vqmsg_push(vq, m, virtio_balloon.report[i], VIRTIO_BALLOON_ALLOC_SIZE, true);
+    virtio_balloon.report_count = n;
+    vqmsg_commit(vq, m, (vqfinish)&virtio_balloon.report_complete);
+}
+
 void virtio_balloon_update(void)
 {
     remove_timer(kernel_timers, &virtio_balloon.retry_timer, 0);
@@ -259,6 +436,8 @@ closure_function(1, 0, void, virtio_balloon_config_change,
 {
     virtio_balloon_debug("%s\n", func_ss);
     virtio_balloon_update();
+    if (balloon_has_free_page_hint())
+        virtio_balloon_hint_update();
 }
 
 closure_func_basic(mem_cleaner, u64, virtio_balloon_deflater,
@@ -274,6 +453,30 @@ closure_func_basic(mem_cleaner, u64, virtio_balloon_deflater,
     return deflated << VIRTIO_BALLOON_ALLOC_ORDER;
 }
 
+closure_func_basic(mem_cleaner, u64, virtio_balloon_free_page_cleaner,
+                   u64 clean_bytes)
+{
+    u64 n = (clean_bytes + MASK(VIRTIO_BALLOON_ALLOC_ORDER)) >> VIRTIO_BALLOON_ALLOC_ORDER;
+    u64 released = virtio_balloon_release_chunks(virtio_balloon.hinted, n);
+    released += virtio_balloon_release_chunks(virtio_balloon.reported, n - released);
+    virtio_balloon_debug("%s: released %ld MB\n", func_ss,
+                         released << (VIRTIO_BALLOON_ALLOC_ORDER - 20));
+    return released << VIRTIO_BALLOON_ALLOC_ORDER;
+}
+
+/* free memory, including hinted and reported chunks */
+static u64 virtio_balloon_free_memory(void)
+{
+    u64 chunks = 0;
+    spin_lock(&virtio_balloon.lock);
+    if (virtio_balloon.hinted)
+        chunks += vector_length(virtio_balloon.hinted);
+    if (virtio_balloon.reported)
+        chunks += vector_length(virtio_balloon.reported) + virtio_balloon.report_count;
+    spin_unlock(&virtio_balloon.lock);
+    return heap_free((heap)virtio_balloon.physical) + (chunks << VIRTIO_BALLOON_ALLOC_ORDER);
+}
+
 static inline void write_stat(u16 tag, u64 val)
 {
     virtio_balloon_debug("   tag %d, val 0x%lx\n", tag, val);
@@ -306,9 +509,10 @@ closure_func_basic(vqfinish, void, virtio_balloon_enqueue_stats,
     write_stat(VIRTIO_BALLOON_S_SWAP_OUT, 0);
     write_stat(VIRTIO_BALLOON_S_MAJFLT, mm_stats.major_faults);
     write_stat(VIRTIO_BALLOON_S_MINFLT, mm_stats.minor_faults);
-    write_stat(VIRTIO_BALLOON_S_MEMFREE, heap_free((heap)virtio_balloon.physical));
+    u64 free = virtio_balloon_free_memory();
+    write_stat(VIRTIO_BALLOON_S_MEMFREE, free);
     write_stat(VIRTIO_BALLOON_S_MEMTOT, heap_total((heap)virtio_balloon.physical));
-    write_stat(VIRTIO_BALLOON_S_AVAIL, heap_free((heap)virtio_balloon.physical));
+    write_stat(VIRTIO_BALLOON_S_AVAIL, free);
     write_stat(VIRTIO_BALLOON_S_CACHES, pagecache_get_occupancy());
     write_stat(VIRTIO_BALLOON_S_HTLB_PGALLOC, 0);
     write_stat(VIRTIO_BALLOON_S_HTLB_PGFAIL, 0);
@@ -358,6 +562,8 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, id_heap p
     list_init(&virtio_balloon.free);
     init_timer(&virtio_balloon.retry_timer);
     init_closure_func(&virtio_balloon.timer_task, timer_handler, virtio_balloon_timer_task);
+    spin_lock_init(&virtio_balloon.lock);
+    init_timer(&virtio_balloon.report_timer);
 
     thunk t = closure(general, virtio_balloon_config_change, v);
     assert(t != INVALID_ADDRESS);
@@ -380,14 +586,55 @@ static boolean virtio_balloon_attach(heap general, backed_heap backed, id_heap p
     } else {
         virtio_balloon.statsq = 0;
     }
+
+    /* optional virtqueues are numbered consecutively after the ones which are present */
+    int vq_index = balloon_has_stats_vq() ? 3 : 2;
+    if (balloon_has_free_page_hint()) {
+        virtio_balloon.hinted = allocate_vector(general, 64);
+        assert(virtio_balloon.hinted != INVALID_ADDRESS);
+        virtio_balloon.cmd_id_active = alloc_map(backed, 2 * sizeof(u32),
+                                                 &virtio_balloon.cmd_id_active_phys);
+        assert(virtio_balloon.cmd_id_active != INVALID_ADDRESS);
+        virtio_balloon.cmd_id_stop = virtio_balloon.cmd_id_active + 1;
+        virtio_balloon.cmd_id_stop_phys = virtio_balloon.cmd_id_active_phys + sizeof(u32);
+        *virtio_balloon.cmd_id_stop = htole32(VIRTIO_BALLOON_CMD_ID_STOP);
+        virtio_balloon.hint_cmd_id = VIRTIO_BALLOON_CMD_ID_STOP;
+        init_closure_func(&virtio_balloon.hint_complete, vqfinish, virtio_balloon_hint_complete);
+        s = virtio_alloc_virtqueue(v, ss("virtio balloon free_page_vq"), vq_index++,
+                                   &virtio_balloon.free_page_vq);
+        if (!is_ok(s))
+            goto fail;
+    }
+    if (balloon_has_reporting()) {
+        virtio_balloon.reported = allocate_vector(general, 64);
+        assert(virtio_balloon.reported != INVALID_ADDRESS);
+        init_closure_func(&virtio_balloon.report_complete, vqfinish,
+                          virtio_balloon_report_complete);
+        s = virtio_alloc_virtqueue(v, ss("virtio balloon reporting_vq"), vq_index++,
+                                   &virtio_balloon.reporting_vq);
+        if (!is_ok(s))
+            goto fail;
+    }
     virtio_balloon_debug("   virtqueues allocated, setting driver status OK\n");
     vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
     update_actual_pages(0);
     virtio_balloon_update();
     mem_cleaner bd = closure_func(general, mem_cleaner, virtio_balloon_deflater);
     assert(bd != INVALID_ADDRESS);
-    if (!mm_register_mem_cleaner(bd))
+    if (!mm_register_mem_cleaner(bd, ss("virtio_balloon"), MM_CLEANER_EXTERNAL))
         deallocate_closure(bd);
+    if (balloon_has_free_page_hint() || balloon_has_reporting()) {
+        mem_cleaner fc = closure_func(general, mem_cleaner, virtio_balloon_free_page_cleaner);
+        assert(fc != INVALID_ADDRESS);
+        if (!mm_register_mem_cleaner(fc, ss("virtio_balloon_free_pages"), MM_CLEANER_CACHE))
+            deallocate_closure(fc);
+    }
+    if (balloon_has_reporting()) {
+        timestamp t = seconds(VIRTIO_BALLOON_REPORT_INTERVAL_SEC);
+        register_timer(kernel_timers, &virtio_balloon.report_timer, CLOCK_ID_MONOTONIC, t, false,
+                       t, init_closure_func(&virtio_balloon.report_task, timer_handler,
+                                            virtio_balloon_report_task));
+    }
     if (balloon_has_stats_vq())
         virtio_balloon_init_statsq();
     return true;
@@ -407,7 +654,9 @@ closure_function(3, 1, boolean, vtpci_balloon_probe,
     virtio_balloon_debug("   attaching\n", __func__);
     vtdev v = (vtdev)attach_vtpci(bound(general), bound(backed), d,
                                   (VIRTIO_BALLOON_F_STATS_VQ |
-                                   VIRTIO_BALLOON_F_MUST_TELL_HOST));
+                                   VIRTIO_BALLOON_F_MUST_TELL_HOST |
+                                   VIRTIO_BALLOON_F_FREE_PAGE_HINT |
+                                   VIRTIO_BALLOON_F_REPORTING));
     return virtio_balloon_attach(bound(general), bound(backed), bound(physical), v);
 }
 
@@ -0,0 +1,137 @@
+#include <kernel.h>
+#include <drivers/console.h>
+
+#include "virtio_internal.h"
+#include "virtio_mmio.h"
+#include "virtio_pci.h"
+
+/* Output-only driver for the first port of a virtio console device: unlike an emulated UART, which
+ * takes a VM exit for each character, a write is handed to the host as a single buffer. */
+
+//#define VIRTIO_CONSOLE_DEBUG
+#ifdef VIRTIO_CONSOLE_DEBUG
+#define virtio_console_debug(x, ...) do {tprintf(sym(virtio_console), 0, ss(x "\n"), ##__VA_ARGS__);} while(0)
+#else
+#define virtio_console_debug(x, ...)
+#endif
+
+#define VIRTIO_CONSOLE_DRIVER_FEATURES  0
+
+/* virtqueues of port 0 (the multiport feature is not negotiated) */
+#define VIRTIO_CONSOLE_RXQ  0
+#define VIRTIO_CONSOLE_TXQ  1
+
+typedef struct virtio_console {
+    struct console_driver driver;
+    heap general;
+    backed_heap backed;
+    vtdev dev;
+    virtqueue rxq, txq;
+} *virtio_console;
+
+typedef struct virtio_console_txbuf {
+    virtio_console vc;
+    bytes len;
+    closure_struct(vqfinish, complete);
+    u8 data[0];
+} *virtio_console_txbuf;
+
+closure_func_basic(vqfinish, void, virtio_console_tx_complete,
+                   u64 len)
+{
+    virtio_console_txbuf txbuf = struct_from_field(closure_self(), virtio_console_txbuf, complete);
+    deallocate((heap)txbuf->vc->backed, txbuf, sizeof(*txbuf) + txbuf->len);
+}
+
+static void virtio_console_write(void *d, const char *s, bytes count)
+{
+    virtio_console vc = d;
+    if (count == 0)
+        return;
+    u64 phys;
+    virtio_console_txbuf txbuf = alloc_map(vc->backed, sizeof(*txbuf) + count, &phys);
+    if (txbuf == INVALID_ADDRESS)
+        return;
+    txbuf->vc = vc;
+    txbuf->len = count;
+    runtime_memcpy(txbuf->data, s, count);
+    virtqueue vq = vc->txq;
+    vqmsg m = allocate_vqmsg(vq);
+    if (m == INVALID_ADDRESS) {
+        dealloc_unmap(vc->backed, txbuf, phys, sizeof(*txbuf) + count);
+        return;
+    }
+    vqmsg_push(vq, m, phys + offsetof(virtio_console_txbuf, data), count, false);
+    vqmsg_commit(vq, m, init_closure_func(&txbuf->complete, vqfinish, virtio_console_tx_complete));
+}
+
+static boolean virtio_console_dev_attach(heap general, backed_heap backed, vtdev dev)
+{
+    virtio_console_debug("dev_features 0x%lx, features 0x%lx", dev->dev_features, dev->features);
+    virtio_console vc = allocate_zero(general, sizeof(*vc));
+    if (vc == INVALID_ADDRESS)
+        return false;
+
+    /* The receive virtqueue is initialized even if not used, because a device may expect all
+     * virtqueues of a port to be ready. */
+    status s = virtio_alloc_virtqueue(dev, ss("virtio console rx"), VIRTIO_CONSOLE_RXQ, &vc->rxq);
+    if (!is_ok(s)) {
+        msg_err("failed to allocate rx virtqueue: %v\n", s);
+        timm_dealloc(s);
+        goto err;
+    }
+    s = virtio_alloc_virtqueue(dev, ss("virtio console tx"), VIRTIO_CONSOLE_TXQ, &vc->txq);
+    if (!is_ok(s)) {
+        msg_err("failed to allocate tx virtqueue: %v\n", s);
+        timm_dealloc(s);
+        goto err;
+    }
+
+    /* completed transmit buffers are reclaimed on subsequent writes */
+    virtqueue_set_polling(vc->txq, true);
+    vc->general = general;
+    vc->backed = backed;
+    vc->dev = dev;
+    vc->driver.write = virtio_console_write;
+    vc->driver.name = ss("virtio");
+    vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
+    attach_console_driver(&vc->driver);
+    return true;
+  err:
+    deallocate(general, vc, sizeof(*vc));
+    return false;
+}
+
+closure_function(2, 1, boolean, vtpci_console_probe,
+                 heap, general, backed_heap, backed,
+                 pci_dev d)
+{
+    if (!vtpci_probe(d, VIRTIO_ID_CONSOLE))
+        return false;
+    heap general = bound(general);
+    backed_heap backed = bound(backed);
+    vtdev v = (vtdev)attach_vtpci(general, backed, d, VIRTIO_CONSOLE_DRIVER_FEATURES);
+    return virtio_console_dev_attach(general, backed, v);
+}
+
+closure_function(2, 1, void, vtmmio_console_probe,
+                 heap, general, backed_heap, backed,
+                 vtmmio d)
+{
+    if (vtmmio_get_u32(d, VTMMIO_OFFSET_DEVID) != VIRTIO_ID_CONSOLE)
+        return;
+    heap general = bound(general);
+    backed_heap backed = bound(backed);
+    if (attach_vtmmio(general, backed, d, VIRTIO_CONSOLE_DRIVER_FEATURES))
+        virtio_console_dev_attach(general, backed, &d->virtio_dev);
+}
+
+void init_virtio_console(kernel_heaps kh)
+{
+    heap h = heap_locked(kh);
+    backed_heap backed = heap_linear_backed(kh);
+    pci_probe probe = closure(h, vtpci_console_probe, h, backed);
+    assert(probe != INVALID_ADDRESS);
+    register_pci_driver(probe, 0);
+    vtmmio_probe_devs(stack_closure(vtmmio_console_probe, h, backed));
+}
@@ -0,0 +1,289 @@
+#include <kernel.h>
+#include <pagecache.h>
+#include <fs.h>
+#include <fuse.h>
+#include <storage.h>
+
+#include "virtio_internal.h"
+#include "virtio_pci.h"
+
+//#define VTFS_DEBUG
+#ifdef VTFS_DEBUG
+#define vtfs_debug(x, ...) do {tprintf(sym(vtfs), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define vtfs_debug(x, ...)
+#endif
+
+#define VIRTIO_FS_SHMCAP_ID_CACHE   0   /* shared memory region used as DAX window */
+
+#define VIRTIO_FS_TAG_LEN   36
+
+struct virtio_fs_config {
+    u8 tag[VIRTIO_FS_TAG_LEN];
+    u32 num_request_queues;
+} __attribute__((packed));
+
+#define VIRTIO_FS_R_TAG         (offsetof(struct virtio_fs_config *, tag))
+#define VIRTIO_FS_R_NUM_QUEUES  (offsetof(struct virtio_fs_config *, num_request_queues))
+
+typedef struct virtio_fs {
+    heap general;
+    backed_heap backed;
+    vtdev dev;
+    closure_struct(fs_init_handler, fs_init);
+    virtqueue hiprio_vq;
+    virtqueue *vq_map;  /* request queue used by each CPU */
+    void *dax_window;
+    u64 dax_size;
+} *virtio_fs;
+
+#define vtfs_vq(vtfs)   ((vtfs)->vq_map[current_cpu()->id])
+
+closure_function(2, 1, void, vtfs_req_complete,
+                 context, ctx, u32 *, ret_len,
+                 u64 len)
+{
+    *bound(ret_len) = len;
+    context_schedule_return(bound(ctx));
+    closure_finish();
+}
+
+closure_function(1, 1, void, vtfs_async_complete,
+                 status_handler, complete,
+                 u64 len)
+{
+    vtfs_debug("async request complete, len %ld\n", len);
+    apply(bound(complete), STATUS_OK);
+    closure_finish();
+}
+
+/* Adds to a message the buffers holding the first count bytes of an sg list (without consuming
+ * them), so that data is transferred directly to/from the sg buffers. */
+static void vtfs_push_sg(virtqueue vq, vqmsg m, sg_list sg, u32 count, boolean write)
+{
+    for (u64 i = 0; count > 0; i++) {
+        sg_buf sgb = sg_list_peek_at(sg, i);
+        u32 len = MIN(sg_buf_len(sgb), count);
+        vqmsg_push(vq, m, physical_from_virtual(sgb->buf + sgb->offset), len, write);
+        count -= len;
+    }
+}
+
+void *vtfs_get_iobuf(void *priv, u64 size)
+{
+    virtio_fs vtfs = priv;
+    return allocate((heap)vtfs->backed, size);
+}
+
+void vtfs_put_iobuf(void *priv, void *buf, u64 size)
+{
+    virtio_fs vtfs = priv;
+    deallocate((heap)vtfs->backed, buf, size);
+}
+
+/* Sends a request and waits for the reply; returns the reply length (0 on failure). The request and
+ * reply buffers must have been obtained via vtfs_get_iobuf(). */
+u32 vtfs_request(void *priv, void *in, u32 in_len, void *out, u32 out_len)
+{
+    virtio_fs vtfs = priv;
+    context ctx = get_current_context(current_cpu());
+    u32 ret_len;
+    vqfinish finish = closure(vtfs->general, vtfs_req_complete, ctx, &ret_len);
+    if (finish == INVALID_ADDRESS)
+        return 0;
+    virtqueue vq = vtfs_vq(vtfs);
+    vqmsg m = allocate_vqmsg(vq);
+    if (m == INVALID_ADDRESS) {
+        deallocate_closure(finish);
+        return 0;
+    }
+    vqmsg_push(vq, m, physical_from_virtual(in), in_len, false);
+    vqmsg_push(vq, m, physical_from_virtual(out), out_len, true);
+    context_pre_suspend(ctx);
+    vqmsg_commit(vq, m, finish);
+    context_suspend();
+    return ret_len;
+}
+
+/* Sends a request whose data payload (if sg_len is non-zero) is read from (sg_write false) or
+ * written to (sg_write true) the buffers of an sg list; the completion is invoked when the reply
+ * has been received. */
+void vtfs_request_async(void *priv, void *in, u32 in_len, void *out, u32 out_len,
+                        sg_list sg, u32 sg_len, boolean sg_write, status_handler complete)
+{
+    vtfs_debug("async request, in_len %d, out_len %d, sg_len %d (%s)\n", in_len, out_len, sg_len,
+               sg_write ? ss("write") : ss("read"));
+    virtio_fs vtfs = priv;
+    status s;
+    vqfinish finish = closure(vtfs->general, vtfs_async_complete, complete);
+    if (finish == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate vqfinish");
+        goto error;
+    }
+    virtqueue vq = vtfs_vq(vtfs);
+    vqmsg m = allocate_vqmsg(vq);
+    if (m == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate vqmsg");
+        deallocate_closure(finish);
+        goto error;
+    }
+    vqmsg_push(vq, m, physical_from_virtual(in), in_len, false);
+    if (sg_len && !sg_write)
+        vtfs_push_sg(vq, m, sg, sg_len, false);
+    if (out_len)
+        vqmsg_push(vq, m, physical_from_virtual(out), out_len, true);
+    if (sg_len && sg_write)
+        vtfs_push_sg(vq, m, sg, sg_len, true);
+    vqmsg_commit(vq, m, finish);
+    return;
+  error:
+    s = timm_append(s, "fsstatus", "%d", FS_STATUS_NOMEM);
+    apply(complete, s);
+}
+
+/* Sends a request that does not have a reply (e.g. FORGET) via the high priority queue. */
+void vtfs_request_hiprio(void *priv, void *in, u32 in_len, status_handler complete)
+{
+    virtio_fs vtfs = priv;
+    status s;
+    vqfinish finish = closure(vtfs->general, vtfs_async_complete, complete);
+    if (finish == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate vqfinish");
+        goto error;
+    }
+    vqmsg m = allocate_vqmsg(vtfs->hiprio_vq);
+    if (m == INVALID_ADDRESS) {
+        s = timm("result", "failed to allocate vqmsg");
+        deallocate_closure(finish);
+        goto error;
+    }
+    vqmsg_push(vtfs->hiprio_vq, m, physical_from_virtual(in), in_len, false);
+    vqmsg_commit(vtfs->hiprio_vq, m, finish);
+    return;
+  error:
+    apply(complete, s);
+}
+
+/* Returns the address of the DAX window (if any), where file contents can be mapped via
+ * FUSE_SETUPMAPPING requests. */
+void *vtfs_get_dax_window(void *priv, u64 *size)
+{
+    virtio_fs vtfs = priv;
+    *size = vtfs->dax_size;
+    return vtfs->dax_window;
+}
+
+closure_func_basic(fs_init_handler, void, vtfs_fs_init,
+                   boolean readonly, filesystem_complete complete)
+{
+    vtfs_debug("%s read-%s (%F)\n", func_ss, readonly ? ss("only") : ss("write"), complete);
+    virtio_fs vtfs = struct_from_field(closure_self(), virtio_fs, fs_init);
+    fuse_create_fs(vtfs->general, vtfs, readonly, complete);
+}
+
+static boolean vtfs_alloc_vqs(virtio_fs vtfs)
+{
+    vtdev dev = vtfs->dev;
+    status s = virtio_alloc_virtqueue(dev, ss("virtio fs hiprio"), 0, &vtfs->hiprio_vq);
+    if (!is_ok(s))
+        goto error;
+    u64 num_queues = vtdev_cfg_read_4(dev, VIRTIO_FS_R_NUM_QUEUES);
+    num_queues = MAX(MIN(num_queues, total_processors), 1);
+    vtfs_debug("  using %ld request queues\n", num_queues);
+    vtfs->vq_map = allocate(vtfs->general, present_processors * sizeof(vtfs->vq_map[0]));
+    if (vtfs->vq_map == INVALID_ADDRESS)
+        return false;
+    u64 cpus_per_vq = total_processors / num_queues;
+    u64 excess_cpus = total_processors - cpus_per_vq * num_queues;
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u64 i = 0; i < num_queues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_vq + 1) : cpus_per_vq;
+        virtqueue vq;
+        s = virtio_alloc_vq_aff(dev, ss("virtio fs request"), 1 + i,
+                                irangel(first_cpu, num_cpus), &vq);
+        if (!is_ok(s)) {
+            deallocate(vtfs->general, vtfs->vq_map, present_processors * sizeof(vtfs->vq_map[0]));
+            goto error;
+        }
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            vtfs->vq_map[j] = vq;
+    }
+    for (u64 j = total_processors; j < present_processors; j++)
+        vtfs->vq_map[j] = vtfs->vq_map[j % total_processors];
+    return true;
+  error:
+    msg_err("failed to allocate virtqueue: %v\n", s);
+    timm_dealloc(s);
+    return false;
+}
+
+static void vtfs_map_dax_window(virtio_fs vtfs)
+{
+    range r;
+    vtfs->dax_window = 0;
+    vtfs->dax_size = 0;
+    if ((vtfs->dev->transport != VTIO_TRANSPORT_PCI) ||
+        !vtpci_get_shm((vtpci)vtfs->dev, VIRTIO_FS_SHMCAP_ID_CACHE, &r) || !range_span(r))
+        return;
+    u64 size = range_span(r);
+    void *window = allocate((heap)heap_virtual_huge(get_kernel_heaps()), size);
+    if (window == INVALID_ADDRESS) {
+        msg_err("failed to allocate DAX window\n");
+        return;
+    }
+    /* the window contents are host page cache memory: map it as normal (cacheable) memory */
+    map(u64_from_pointer(window), r.start, size, pageflags_writable(pageflags_memory()));
+    vtfs_debug("  DAX window %R mapped at %p\n", r, window);
+    vtfs->dax_window = window;
+    vtfs->dax_size = size;
+}
+
+static boolean vtfs_dev_attach(heap general, backed_heap backed, vtdev dev)
+{
+    vtfs_debug("dev_features 0x%lx, features 0x%lx\n", dev->dev_features, dev->features);
+    virtio_fs vtfs = allocate(general, sizeof(*vtfs));
+    if (vtfs == INVALID_ADDRESS)
+        return false;
+    vtfs->general = general;
+    vtfs->backed = backed;
+    vtfs->dev = dev;
+    char label[VOLUME_LABEL_MAX_LEN];
+    int tag_len = MIN(VIRTIO_FS_TAG_LEN, VOLUME_LABEL_MAX_LEN - 1);
+    vtdev_cfg_read_mem(dev, VIRTIO_FS_R_TAG, label, tag_len);
+    label[tag_len] = '\0';
+    vtfs_debug("  tag %s\n", sstring_from_cstring(label, VOLUME_LABEL_MAX_LEN));
+    if (!vtfs_alloc_vqs(vtfs))
+        goto err;
+    vtfs_map_dax_window(vtfs);
+    u8 uuid[UUID_LEN];
+    zero(uuid, sizeof(uuid));
+    if (!volume_add(uuid, label, vtfs,
+                    init_closure_func(&vtfs->fs_init, fs_init_handler, vtfs_fs_init), -1)) {
+        msg_err("failed to add volume\n");
+        goto err;
+    }
+    vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
+    return true;
+  err:
+    deallocate(general, vtfs, sizeof(*vtfs));
+    return false;
+}
+
+closure_function(2, 1, boolean, vtpci_fs_probe,
+                 heap, general, backed_heap, backed,
+                 pci_dev d)
+{
+    if (!vtpci_probe(d, VIRTIO_ID_FS))
+        return false;
+    vtdev v = (vtdev)attach_vtpci(bound(general), bound(backed), d, 0);
+    return vtfs_dev_attach(bound(general), bound(backed), v);
+}
+
+void init_virtio_fs(kernel_heaps kh)
+{
+    heap h = heap_locked(kh);
+    pci_probe probe = closure(h, vtpci_fs_probe, h, heap_linear_backed(kh));
+    assert(probe != INVALID_ADDRESS);
+    register_pci_driver(probe, 0);
+}
@@ -0,0 +1,9 @@
+void *vtfs_get_iobuf(void *priv, u64 size);
+void vtfs_put_iobuf(void *priv, void *buf, u64 size);
+
+u32 vtfs_request(void *priv, void *in, u32 in_len, void *out, u32 out_len);
+void vtfs_request_async(void *priv, void *in, u32 in_len, void *out, u32 out_len,
+                        sg_list sg, u32 sg_len, boolean sg_write, status_handler complete);
+void vtfs_request_hiprio(void *priv, void *in, u32 in_len, status_handler complete);
+
+void *vtfs_get_dax_window(void *priv, u64 *size);
@@ -14,6 +14,8 @@
 #define VIRTIO_ID_INPUT         18
 #define VIRTIO_ID_VSOCK         19
 #define VIRTIO_ID_CRYPTO        20
+#define VIRTIO_ID_MEM           24
+#define VIRTIO_ID_FS            26
 
 typedef struct virtqueue *virtqueue;
 
@@ -59,6 +61,9 @@ closure_type(vqfinish, void, u64 len);
 /* Modern device */
 #define VIRTIO_F_VERSION_1 U64_FROM_BIT(32)
 
+/* Packed virtqueue layout (modern devices only) */
+#define VIRTIO_F_RING_PACKED U64_FROM_BIT(34)
+
 closure_type(vtdev_notify, void, u16 queue_index, bytes notify_offset);
 
 typedef struct vtdev {
@@ -127,6 +132,10 @@ physical virtqueue_used_paddr(struct virtqueue *vq);
 u16 virtqueue_entries(virtqueue vq);
 u16 virtqueue_free_entries(virtqueue vq);
 void virtqueue_set_polling(virtqueue vq, boolean enable);
+void virtqueue_set_budget(virtqueue vq, u16 budget);
+void virtqueue_set_delayed_events(virtqueue vq, boolean enable);
+void virtqueue_set_io_poll(virtqueue vq, boolean enable);
+void virtqueue_poll_used(virtqueue vq);
 
 typedef struct vqmsg *vqmsg;
 
@@ -0,0 +1,339 @@
+#include <kernel.h>
+
+#include "virtio_internal.h"
+#include "virtio_pci.h"
+
+//#define VIRTIO_MEM_DEBUG
+#ifdef VIRTIO_MEM_DEBUG
+#define virtio_mem_debug(x, ...) do {tprintf(sym(vtmem), 0, ss(x), ##__VA_ARGS__);} while(0)
+#else
+#define virtio_mem_debug(x, ...)
+#endif
+
+#define VIRTIO_MEM_F_ACPI_PXM                   U64_FROM_BIT(0)
+#define VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE     U64_FROM_BIT(1)
+
+#define VIRTIO_MEM_REQ_PLUG         0
+#define VIRTIO_MEM_REQ_UNPLUG       1
+#define VIRTIO_MEM_REQ_UNPLUG_ALL   2
+
+#define VIRTIO_MEM_RESP_ACK     0
+#define VIRTIO_MEM_RESP_NACK    1
+#define VIRTIO_MEM_RESP_BUSY    2
+#define VIRTIO_MEM_RESP_ERROR   3
+
+/* Memory is plugged and unplugged in units of (at least) 128 MB, which keeps the number of device
+ * requests low and allows units to be brought online and offline in the physical heap as a
+ * whole. */
+#define VIRTIO_MEM_UNIT_ORDER   27
+
+#define VIRTIO_MEM_RETRY_INTERVAL_SEC   5
+
+struct virtio_mem_config {
+    /* explicitly little endian */
+    u64 block_size;
+    u16 node_id;
+    u8 padding[6];
+    u64 addr;
+    u64 region_size;
+    u64 usable_region_size;
+    u64 plugged_size;
+    u64 requested_size;
+} __attribute__((packed));
+
+#define VIRTIO_MEM_R_BLOCK_SIZE     (offsetof(struct virtio_mem_config *, block_size))
+#define VIRTIO_MEM_R_ADDR           (offsetof(struct virtio_mem_config *, addr))
+#define VIRTIO_MEM_R_REGION_SIZE    (offsetof(struct virtio_mem_config *, region_size))
+#define VIRTIO_MEM_R_USABLE_SIZE    (offsetof(struct virtio_mem_config *, usable_region_size))
+#define VIRTIO_MEM_R_PLUGGED_SIZE   (offsetof(struct virtio_mem_config *, plugged_size))
+#define VIRTIO_MEM_R_REQUESTED_SIZE (offsetof(struct virtio_mem_config *, requested_size))
+
+struct virtio_mem_req {
+    u16 type;
+    u16 padding[3];
+    u64 addr;
+    u16 nb_blocks;
+    u16 padding_1[3];
+} __attribute__((packed));
+
+struct virtio_mem_resp {
+    u16 type;
+    u16 padding[3];
+    u16 state;
+} __attribute__((packed));
+
+typedef struct virtio_mem_msg {
+    struct virtio_mem_req req;
+    struct virtio_mem_resp resp;
+} *virtio_mem_msg;
+
+static struct virtio_mem {
+    heap general;
+    id_heap physical;
+    vtdev dev;
+    virtqueue vq;
+    u64 block_size;
+    u64 unit_size;
+    range region;       /* device-managed memory added (offline) to the physical heap */
+    u64 units;
+    bitmap plugged;     /* plugged units */
+    u64 plugged_size;
+    boolean unplug_all;
+    virtio_mem_msg msg;
+    u64 msg_phys;
+    boolean req_pending;
+    u64 req_unit;
+    struct spinlock lock;
+    struct timer retry_timer;
+    closure_struct(timer_handler, retry_task);
+    closure_struct(thunk, config_change);
+    closure_struct(vqfinish, req_complete);
+} virtio_mem;
+
+static u64 virtio_mem_cfg_read_8(u64 offset)
+{
+    u64 low = le32toh(vtdev_cfg_read_4(virtio_mem.dev, offset));
+    u64 high = le32toh(vtdev_cfg_read_4(virtio_mem.dev, offset + sizeof(u32)));
+    return low | (high << 32);
+}
+
+static u64 virtio_mem_unit_addr(u64 unit)
+{
+    return virtio_mem.region.start + unit * virtio_mem.unit_size;
+}
+
+static void virtio_mem_request(u16 type, u64 unit)
+{
+    virtio_mem_debug("%s: type %d, unit %ld\n", func_ss, type, unit);
+    virtqueue vq = virtio_mem.vq;
+    struct virtio_mem_req *req = &virtio_mem.msg->req;
+    zero(req, sizeof(*req));
+    req->type = htole16(type);
+    if (type != VIRTIO_MEM_REQ_UNPLUG_ALL) {
+        req->addr = htole64(virtio_mem_unit_addr(unit));
+        req->nb_blocks = htole16(virtio_mem.unit_size / virtio_mem.block_size);
+    }
+    vqmsg m = allocate_vqmsg(vq);
+    assert(m != INVALID_ADDRESS);
+    vqmsg_push(vq, m, virtio_mem.msg_phys, sizeof(*req), false);
+    vqmsg_push(vq, m, virtio_mem.msg_phys + offsetof(virtio_mem_msg, resp),
+               sizeof(struct virtio_mem_resp), true);
+    virtio_mem.req_pending = true;
+    virtio_mem.req_unit = unit;
+    vqmsg_commit(vq, m, (vqfinish)&virtio_mem.req_complete);
+}
+
+static void virtio_mem_retry(void)
+{
+    remove_timer(kernel_timers, &virtio_mem.retry_timer, 0);
+    register_timer(kernel_timers, &virtio_mem.retry_timer, CLOCK_ID_MONOTONIC,
+                   seconds(VIRTIO_MEM_RETRY_INTERVAL_SEC), false, 0,
+                   (timer_handler)&virtio_mem.retry_task);
+}
+
+/* Takes a plugged unit out of the physical heap so that it can be unplugged, starting from the
+ * highest address; returns false if no unit is entirely free. */
+static boolean virtio_mem_offline_unit(u64 *unit)
+{
+    u64 unit_size = virtio_mem.unit_size;
+    for (s64 i = virtio_mem.units - 1; i >= 0; i--) {
+        if (!bitmap_get(virtio_mem.plugged, i))
+            continue;
+        if (heap_free((heap)virtio_mem.physical) < mm_watermark_high() + unit_size)
+            break;
+        if (id_heap_set_online(virtio_mem.physical, virtio_mem_unit_addr(i), unit_size, false)) {
+            *unit = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Issues the next request needed to bring the plugged memory to the size requested by the device;
+ * returns false if unplugging needs memory to be reclaimed first. Must be called with the lock
+ * held. */
+static boolean virtio_mem_update_locked(void)
+{
+    if (virtio_mem.req_pending)
+        return true;
+    u64 requested = virtio_mem_cfg_read_8(VIRTIO_MEM_R_REQUESTED_SIZE);
+    u64 usable = virtio_mem_cfg_read_8(VIRTIO_MEM_R_USABLE_SIZE);
+    u64 unit_size = virtio_mem.unit_size;
+    virtio_mem_debug("%s: requested %ld MB, plugged %ld MB\n", func_ss, requested >> 20,
+                     virtio_mem.plugged_size >> 20);
+    if (virtio_mem.unplug_all) {
+        virtio_mem_request(VIRTIO_MEM_REQ_UNPLUG_ALL, 0);
+    } else if (virtio_mem.plugged_size < requested) {
+        u64 usable_units = MIN(usable / unit_size, virtio_mem.units);
+        for (u64 i = 0; i < usable_units; i++) {
+            if (!bitmap_get(virtio_mem.plugged, i)) {
+                virtio_mem_request(VIRTIO_MEM_REQ_PLUG, i);
+                break;
+            }
+        }
+    } else if (virtio_mem.plugged_size >= requested + unit_size) {
+        u64 unit;
+        if (!virtio_mem_offline_unit(&unit))
+            return false;
+        virtio_mem_request(VIRTIO_MEM_REQ_UNPLUG, unit);
+    }
+    return true;
+}
+
+static void virtio_mem_update(void)
+{
+    spin_lock(&virtio_mem.lock);
+    boolean done = virtio_mem_update_locked();
+    spin_unlock(&virtio_mem.lock);
+    if (!done) {
+        /* Reclaim memory so that a unit can be unplugged the next time, which happens
+         * asynchronously because units in use cannot be taken offline right away. */
+        u64 reclaimed = mm_reclaim_memory(virtio_mem.unit_size);
+        virtio_mem_debug("   reclaimed %ld MB for unplug\n", reclaimed >> 20);
+        (void)reclaimed;
+        virtio_mem_retry();
+    }
+}
+
+closure_func_basic(vqfinish, void, virtio_mem_req_complete,
+                   u64 len)
+{
+    u16 req_type = le16toh(virtio_mem.msg->req.type);
+    u16 resp_type = le16toh(virtio_mem.msg->resp.type);
+    u64 unit = virtio_mem.req_unit;
+    u64 unit_size = virtio_mem.unit_size;
+    virtio_mem_debug("%s: request type %d, response %d\n", func_ss, req_type, resp_type);
+    spin_lock(&virtio_mem.lock);
+    virtio_mem.req_pending = false;
+    boolean ack = (resp_type == VIRTIO_MEM_RESP_ACK);
+    switch (req_type) {
+    case VIRTIO_MEM_REQ_PLUG:
+        if (ack) {
+            assert(id_heap_set_online(virtio_mem.physical, virtio_mem_unit_addr(unit), unit_size,
+                                      true));
+            bitmap_set(virtio_mem.plugged, unit, 1);
+            virtio_mem.plugged_size += unit_size;
+        }
+        break;
+    case VIRTIO_MEM_REQ_UNPLUG:
+        if (ack) {
+            bitmap_set(virtio_mem.plugged, unit, 0);
+            virtio_mem.plugged_size -= unit_size;
+        } else {
+            assert(id_heap_set_online(virtio_mem.physical, virtio_mem_unit_addr(unit), unit_size,
+                                      true));
+        }
+        break;
+    case VIRTIO_MEM_REQ_UNPLUG_ALL:
+        if (ack)
+            virtio_mem.unplug_all = false;
+        break;
+    }
+    spin_unlock(&virtio_mem.lock);
+    if (ack) {
+        virtio_mem_update();
+    } else {
+        if (resp_type == VIRTIO_MEM_RESP_ERROR)
+            msg_err("request type %d failed\n", req_type);
+        virtio_mem_retry();
+    }
+}
+
+closure_func_basic(timer_handler, void, virtio_mem_retry_task,
+                   u64 expiry, u64 overruns)
+{
+    if (overruns != timer_disabled)
+        virtio_mem_update();
+}
+
+closure_func_basic(thunk, void, virtio_mem_config_change)
+{
+    virtio_mem_debug("%s\n", func_ss);
+    virtio_mem_update();
+}
+
+static boolean virtio_mem_attach(heap general, backed_heap backed, id_heap physical, vtdev v)
+{
+    virtio_mem_debug("   dev_features 0x%lx, features 0x%lx\n", v->dev_features, v->features);
+    if (virtio_mem.dev) {
+        msg_err("multiple devices not supported\n");
+        return false;
+    }
+    virtio_mem.general = general;
+    virtio_mem.physical = physical;
+    virtio_mem.dev = v;
+    u64 block_size = virtio_mem_cfg_read_8(VIRTIO_MEM_R_BLOCK_SIZE);
+    u64 unit_size = MAX(block_size, U64_FROM_BIT(VIRTIO_MEM_UNIT_ORDER));
+    u64 addr = virtio_mem_cfg_read_8(VIRTIO_MEM_R_ADDR);
+    u64 units = virtio_mem_cfg_read_8(VIRTIO_MEM_R_REGION_SIZE) / unit_size;
+    virtio_mem_debug("   block size 0x%lx, region at 0x%lx, %ld units\n", block_size, addr, units);
+    if ((block_size < PAGESIZE) || (unit_size / block_size > U16_MAX) || (addr & (unit_size - 1)) ||
+        (units == 0)) {
+        msg_err("unsupported device configuration (block size 0x%lx, address 0x%lx)\n",
+                block_size, addr);
+        goto fail;
+    }
+    virtio_mem.block_size = block_size;
+    virtio_mem.unit_size = unit_size;
+    virtio_mem.region = irangel(addr, units * unit_size);
+    virtio_mem.units = units;
+    virtio_mem.plugged = allocate_bitmap(general, general, units);
+    if (virtio_mem.plugged == INVALID_ADDRESS)
+        goto fail;
+    virtio_mem.plugged_size = 0;
+
+    /* memory plugged before the driver was initialized (e.g. before a reboot) is not known to the
+     * physical heap: unplug it before plugging what is requested */
+    virtio_mem.unplug_all = (virtio_mem_cfg_read_8(VIRTIO_MEM_R_PLUGGED_SIZE) != 0);
+    virtio_mem.msg = alloc_map(backed, sizeof(struct virtio_mem_msg), &virtio_mem.msg_phys);
+    if (virtio_mem.msg == INVALID_ADDRESS)
+        goto fail_dealloc_bitmap;
+    virtio_mem.req_pending = false;
+    spin_lock_init(&virtio_mem.lock);
+    init_timer(&virtio_mem.retry_timer);
+    init_closure_func(&virtio_mem.retry_task, timer_handler, virtio_mem_retry_task);
+    init_closure_func(&virtio_mem.req_complete, vqfinish, virtio_mem_req_complete);
+    status s = virtio_register_config_change_handler(v,
+        init_closure_func(&virtio_mem.config_change, thunk, virtio_mem_config_change));
+    if (!is_ok(s))
+        goto fail_status;
+    s = virtio_alloc_virtqueue(v, ss("virtio mem guest-request"), 0, &virtio_mem.vq);
+    if (!is_ok(s))
+        goto fail_status;
+    if (!kernel_add_hotplug_memory(virtio_mem.region)) {
+        msg_err("failed to add memory region %R\n", virtio_mem.region);
+        goto fail_dealloc_msg;
+    }
+    vtdev_set_status(v, VIRTIO_CONFIG_STATUS_DRIVER_OK);
+    virtio_mem_update();
+    return true;
+  fail_status:
+    msg_err("failed to attach: %v\n", s);
+    timm_dealloc(s);
+  fail_dealloc_msg:
+    dealloc_unmap(backed, virtio_mem.msg, virtio_mem.msg_phys, sizeof(struct virtio_mem_msg));
+  fail_dealloc_bitmap:
+    deallocate_bitmap(virtio_mem.plugged);
+  fail:
+    virtio_mem.dev = 0;
+    return false;
+}
+
+closure_function(3, 1, boolean, vtpci_mem_probe,
+                 heap, general, backed_heap, backed, id_heap, physical,
+                 pci_dev d)
+{
+    if (!vtpci_probe(d, VIRTIO_ID_MEM))
+        return false;
+    vtdev v = (vtdev)attach_vtpci(bound(general), bound(backed), d,
+                                  VIRTIO_MEM_F_UNPLUGGED_INACCESSIBLE);
+    return virtio_mem_attach(bound(general), bound(backed), bound(physical), v);
+}
+
+void init_virtio_mem(kernel_heaps kh)
+{
+    heap h = heap_locked(kh);
+    pci_probe probe = closure(h, vtpci_mem_probe, h, heap_linear_backed(kh), heap_physical(kh));
+    assert(probe != INVALID_ADDRESS);
+    register_pci_driver(probe, 0);
+}
@@ -56,15 +56,32 @@
 #endif // defined(VIRTIO_NET_DEBUG)
 
 #define VIRTIO_NET_DRV_FEATURES \
-    (VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC | VIRTIO_NET_F_GUEST_TSO4 |         \
+    (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC |               \
+     VIRTIO_NET_F_GUEST_TSO4 |                                                      \
      VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_GUEST_ECN | VIRTIO_NET_F_GUEST_UFO |    \
      VIRTIO_NET_F_MRG_RXBUF | VIRTIO_F_ANY_LAYOUT | VIRTIO_F_RING_EVENT_IDX |       \
-     VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ)
+     VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ | VIRTIO_NET_F_RSS | VIRTIO_F_RING_PACKED)
+
+#define VNET_RSS_HASH_TYPES                                                 \
+    (VIRTIO_NET_RSS_HASH_TYPE_IPv4 | VIRTIO_NET_RSS_HASH_TYPE_TCPv4 |           \
+     VIRTIO_NET_RSS_HASH_TYPE_UDPv4 | VIRTIO_NET_RSS_HASH_TYPE_IPv6 |           \
+     VIRTIO_NET_RSS_HASH_TYPE_TCPv6 | VIRTIO_NET_RSS_HASH_TYPE_UDPv6)
+#define VNET_RSS_KEY_LEN    40
+#define VNET_RSS_INDIR_LEN  128
 
 typedef struct vnet_rx {
     virtqueue q;
     u32 seqno;
     struct virtio_net_hdr_mrg_rxbuf *hdr;
+    struct net_gro gro;
+    struct net_napi napi;
+    closure_struct(thunk, poll);
+
+    /* Released buffers that could not be re-posted to the ring, recycled by post_receive() without
+     * going through the rxbuffers cache. The pool grows by one buffer each time the ring has to be
+     * refilled from the cache, and is shrunk by the memory cleaner. */
+    queue pool;
+    u32 pool_limit;
 } *vnet_rx;
 
 typedef struct vnet {
@@ -76,11 +93,10 @@ typedef struct vnet {
     closure_struct(mem_cleaner, mem_cleaner);
     bytes net_header_len;
     int rxbuflen;
+    u16 rx_queues;
     virtqueue *txq_map;
     vnet_rx rx;
     struct virtqueue *ctl;
-    u64 empty_phys;
-    void *empty; // just a mac..fix, from pre-heap days
 } *vnet;
 
 typedef struct vnet_cmd {
@@ -97,34 +113,115 @@ typedef struct xpbuf
     vnet vn;
     vnet_rx rx;
     closure_struct(vqfinish, input);
+    u64 phys;                   /* physical address of the buffer, resolved once at allocation */
     u32 seqno;
 } __attribute__((aligned(8))) *xpbuf;
 
 
-closure_function(1, 1, void, tx_complete,
-                 struct pbuf *, p,
-                 u64 len)
+/* Per-packet transmit state, allocated from physically contiguous memory
+   so that the device can read the header in place. */
+typedef struct vnet_tx {
+    struct virtio_net_hdr_mrg_rxbuf hdr;
+    vnet vn;
+    struct pbuf *p;
+    closure_struct(vqfinish, complete);
+} *vnet_tx;
+
+#define VNET_TCP_CSUM_OFFSET    16
+
+closure_func_basic(vqfinish, void, vnet_tx_complete,
+                   u64 len)
 {
-    pbuf_free(bound(p));
-    closure_finish();
+    vnet_tx tx = struct_from_closure(vnet_tx, complete);
+    pbuf_free(tx->p);
+    deallocate((heap)tx->vn->txhandlers, tx, sizeof(*tx));
+}
+
+static inline u64 vnet_csum_add(u64 sum, u16 *w, int n)
+{
+    for (int i = 0; i < n; i++)
+        sum += w[i];
+    return sum;
 }
 
+/* Set up checksum offload for an outgoing TCP segment, whose checksum is not
+   generated by lwIP when the device has VIRTIO_NET_F_CSUM (see
+   virtioif_init()): the device checksums the packet from csum_start to its
+   end and stores the result at csum_start + csum_offset, which must be
+   seeded with the pseudo-header sum. */
+static void vnet_tx_csum(struct pbuf *p, struct virtio_net_hdr *hdr)
+{
+    u16 buf[(SIZEOF_ETH_HDR + SIZEOF_VLAN_HDR + IP6_HLEN) / sizeof(u16)];
+    u8 *h = (u8 *)buf;
+    u16 len = pbuf_copy_partial(p, buf, sizeof(buf), 0);
+    u16 off = SIZEOF_ETH_HDR;
+    if (len < off)
+        return;
+    u16 type = lwip_ntohs(buf[6]);
+    if (type == ETHTYPE_VLAN) {
+        if (len < off + SIZEOF_VLAN_HDR)
+            return;
+        type = lwip_ntohs(buf[(off + 2) / sizeof(u16)]);
+        off += SIZEOF_VLAN_HDR;
+    }
+    u8 *iph = h + off;
+    u16 *iphw = (u16 *)iph;
+    u64 sum;
+    u16 l4len;
+    if (type == ETHTYPE_IP) {
+        if (len < off + IP_HLEN)
+            return;
+        u16 hlen = (iph[0] & 0xf) * 4;
+        /* lwIP doesn't fragment TCP segments, but check anyway */
+        if (hlen < IP_HLEN || iph[9] != IP_PROTO_TCP || (iph[6] & 0x3f) || iph[7])
+            return;
+        l4len = lwip_ntohs(iphw[1]) - hlen;
+        sum = vnet_csum_add(0, iphw + 6, 4);    /* source and destination */
+        off += hlen;
+    } else if (type == ETHTYPE_IPV6) {
+        if (len < off + IP6_HLEN || iph[6] != IP6_NEXTH_TCP)
+            return;
+        l4len = lwip_ntohs(iphw[2]);
+        sum = vnet_csum_add(0, iphw + 4, 16);   /* source and destination */
+        off += IP6_HLEN;
+    } else {
+        return;
+    }
+    sum += lwip_htons(IP_PROTO_TCP) + lwip_htons(l4len);
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    u16 csum = sum;
+    if (pbuf_take_at(p, &csum, sizeof(csum), off + VNET_TCP_CSUM_OFFSET) != ERR_OK)
+        return;
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = off;
+    hdr->csum_offset = VNET_TCP_CSUM_OFFSET;
+}
 
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
     vnet vn = netif->state;
 
+    vnet_tx tx = allocate((heap)vn->txhandlers, sizeof(*tx));
+    if (tx == INVALID_ADDRESS)
+        return ERR_MEM;
+    zero(&tx->hdr, sizeof(tx->hdr));
+    if (vn->dev->features & VIRTIO_NET_F_CSUM)
+        vnet_tx_csum(p, &tx->hdr.hdr);
+    tx->vn = vn;
+    tx->p = p;
+
     virtqueue txq = vn->txq_map[current_cpu()->id];
     vqmsg m = allocate_vqmsg(txq);
     assert(m != INVALID_ADDRESS);
-    vqmsg_push(txq, m, vn->empty_phys, vn->net_header_len, false);
+    vqmsg_push(txq, m, physical_from_virtual(&tx->hdr), vn->net_header_len, false);
 
     pbuf_ref(p);
 
     for (struct pbuf * q = p; q != NULL; q = q->next)
         vqmsg_push(txq, m, physical_from_virtual(q->payload), q->len, false);
 
-    vqmsg_commit(txq, m, closure((heap)vn->txhandlers, tx_complete, p));
+    vqmsg_commit(txq, m, init_closure_func(&tx->complete, vqfinish, vnet_tx_complete));
     
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -149,7 +246,7 @@ static vqmsg vnet_rxq_push(vnet vn, xpbuf x, int *desc_count)
         return m;
     int rxbuflen = vn->rxbuflen;
     pbuf_alloced_custom(PBUF_RAW, rxbuflen, PBUF_REF, &x->p, x + 1, rxbuflen);
-    u64 phys = physical_from_virtual(x + 1);
+    u64 phys = x->phys;
     if (vtdev_is_modern(vn->dev) || (vn->dev->features & VIRTIO_F_ANY_LAYOUT)) {
         vqmsg_push(rxq, m, phys, rxbuflen, true);
         *desc_count = 1;
@@ -175,11 +272,20 @@ static void receive_buffer_release(struct pbuf *p)
             return;
         }
     }
+    vnet_rx rx = x->rx;
+    if ((queue_length(rx->pool) < rx->pool_limit) && enqueue(rx->pool, x))
+        return;
     deallocate((heap)vn->rxbuffers, x, vn->rxbuflen + sizeof(struct xpbuf));
 }
 
 static int post_receive(vnet vn, vnet_rx rx);
 
+closure_func_basic(thunk, void, vnet_rx_poll)
+{
+    vnet_rx rx = struct_from_field(closure_self(), vnet_rx, poll);
+    virtqueue_poll_used(rx->q);
+}
+
 closure_func_basic(vqfinish, void, vnet_input,
                    u64 len)
 {
@@ -274,7 +380,7 @@ closure_func_basic(vqfinish, void, vnet_input,
         }
     }
     if (!err)
-        err = (vn->ndev.n.input(&x->p.pbuf, &vn->ndev.n) != ERR_OK);
+        net_gro_receive(&rx->gro, &x->p.pbuf);
   out:
     if (err)
         receive_buffer_release(&x->p.pbuf);
@@ -291,12 +397,20 @@ static int post_receive(vnet vn, vnet_rx rx)
     int new_entries = 0;
     int rxbuflen = vn->rxbuflen;
     while (new_entries < free_entries) {
-        xpbuf x = allocate((heap)vn->rxbuffers, sizeof(struct xpbuf) + rxbuflen);
-        if (x == INVALID_ADDRESS)
-            break;
-        x->vn = vn;
-        x->rx = rx;
-        x->p.custom_free_function = receive_buffer_release;
+        xpbuf x = dequeue(rx->pool);
+        if (x == INVALID_ADDRESS) {
+            x = allocate((heap)vn->rxbuffers, sizeof(struct xpbuf) + rxbuflen);
+            if (x == INVALID_ADDRESS)
+                break;
+            x->vn = vn;
+            x->rx = rx;
+            x->p.custom_free_function = receive_buffer_release;
+            x->phys = physical_from_virtual(x + 1);
+
+            /* racing with the memory cleaner is harmless: the limit is only a hint */
+            if (rx->pool_limit < 2 * virtqueue_entries(rxq))
+                rx->pool_limit++;
+        }
         int desc_count;
         vqmsg m = vnet_rxq_push(vn, x, &desc_count);
         if (m == INVALID_ADDRESS)
@@ -314,8 +428,23 @@ closure_func_basic(mem_cleaner, u64, vnet_mem_cleaner,
                    u64 clean_bytes)
 {
     vnet vn = struct_from_field(closure_self(), vnet, mem_cleaner);
-    return cache_drain(vn->rxbuffers, clean_bytes,
-                       NET_RX_BUFFERS_RETAIN * (sizeof(struct xpbuf) + vn->rxbuflen));
+    bytes alloc_size = sizeof(struct xpbuf) + vn->rxbuflen;
+    u64 cleaned = 0;
+    for (u16 i = 0; i < vn->rx_queues; i++) {
+        vnet_rx rx = vn->rx + i;
+        rx->pool_limit /= 2;
+        while ((cleaned < clean_bytes) && (queue_length(rx->pool) > rx->pool_limit)) {
+            xpbuf x = dequeue(rx->pool);
+            if (x == INVALID_ADDRESS)
+                break;
+            deallocate((heap)vn->rxbuffers, x, alloc_size);
+            cleaned += alloc_size;
+        }
+    }
+    if (cleaned < clean_bytes)
+        cleaned += cache_drain(vn->rxbuffers, clean_bytes - cleaned,
+                               NET_RX_BUFFERS_RETAIN * alloc_size);
+    return cleaned;
 }
 
 closure_func_basic(vqfinish, void, vnet_cmd_finish,
@@ -375,6 +504,90 @@ closure_function(2, 1, void, vnet_cmd_mq_complete,
     closure_finish();
 }
 
+static boolean vnet_set_mq(vnet vn, u16 vq_pairs)
+{
+    struct virtio_net_ctrl_mq ctrl_mq = {
+        .virtqueue_pairs = vq_pairs,
+    };
+    status_handler complete = closure((heap)vn->dev->contiguous, vnet_cmd_mq_complete, vn,
+                                      ctrl_mq);
+    if (complete == INVALID_ADDRESS)
+        return false;
+    if (!vnet_ctrl_cmd(vn, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
+                       &closure_member(vnet_cmd_mq_complete, complete, ctrl_mq),
+                       sizeof(ctrl_mq), complete)) {
+        deallocate_closure(complete);
+        return false;
+    }
+    return true;
+}
+
+closure_function(4, 1, void, vnet_cmd_rss_complete,
+                 vnet, vn, struct virtio_net_rss_config *, cfg, bytes, cfg_len, u16, vq_pairs,
+                 status s)
+{
+    vnet vn = bound(vn);
+    deallocate((heap)vn->dev->contiguous, bound(cfg), bound(cfg_len));
+    if (s == STATUS_OK) {
+        netif_set_link_up(&vn->ndev.n);
+    } else {
+        /* the device still accepts the plain multiqueue command */
+        msg_warn("RSS configuration failed (%v), using default steering\n", s);
+        timm_dealloc(s);
+        if (!vnet_set_mq(vn, bound(vq_pairs)))
+            msg_err("failed to set vq pairs\n");
+    }
+    closure_finish();
+}
+
+/* Spread receive flows over all rx queues by programming the device RSS
+   indirection table; each rx queue interrupt is affine to the CPUs mapped to
+   the corresponding tx queue, so a flow is processed on the CPU group that
+   transmits on it. */
+static boolean vnet_set_rss(vnet vn, u16 vq_pairs)
+{
+    vtdev dev = vn->dev;
+    u32 hash_types = vtdev_cfg_read_4(dev, VIRTIO_NET_R_HASH_TYPES) & VNET_RSS_HASH_TYPES;
+    u16 indir_len = vtdev_cfg_read_2(dev, VIRTIO_NET_R_RSS_MAX_INDIR_LEN);
+    u8 key_len = vtdev_cfg_read_1(dev, VIRTIO_NET_R_RSS_MAX_KEY_SIZE);
+    virtio_net_debug("%s: hash types 0x%x, max indirection len %d, max key size %d\n", func_ss,
+                     hash_types, indir_len, key_len);
+    if (!hash_types || !indir_len || !key_len)
+        return false;
+    indir_len = MIN(U64_FROM_BIT(msb(indir_len)), VNET_RSS_INDIR_LEN);
+    key_len = MIN(key_len, VNET_RSS_KEY_LEN);
+    bytes cfg_len = sizeof(struct virtio_net_rss_config) + indir_len * sizeof(u16) +
+                    sizeof(struct virtio_net_rss_key) + key_len;
+    heap h = (heap)dev->contiguous;
+    struct virtio_net_rss_config *cfg = allocate(h, cfg_len);
+    if (cfg == INVALID_ADDRESS)
+        return false;
+    cfg->hash_types = hash_types;
+    cfg->indirection_table_mask = indir_len - 1;
+    cfg->unclassified_queue = 0;
+    for (u16 i = 0; i < indir_len; i++)
+        cfg->indirection_table[i] = i % vq_pairs;
+    struct virtio_net_rss_key *key = (struct virtio_net_rss_key *)&cfg->indirection_table[indir_len];
+    key->max_tx_vq = vq_pairs;
+    key->hash_key_length = key_len;
+    for (u8 i = 0; i < key_len; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(key->hash_key_data + i, &r, MIN(sizeof(r), key_len - i));
+    }
+    status_handler complete = closure(h, vnet_cmd_rss_complete, vn, cfg, cfg_len, vq_pairs);
+    if (complete == INVALID_ADDRESS)
+        goto err;
+    if (!vnet_ctrl_cmd(vn, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_RSS_CONFIG, cfg, cfg_len,
+                       complete)) {
+        deallocate_closure(complete);
+        goto err;
+    }
+    return true;
+  err:
+    deallocate(h, cfg, cfg_len);
+    return false;
+}
+
 static err_t virtioif_init(struct netif *netif)
 {
     vnet vn = netif->state;
@@ -401,6 +614,10 @@ static err_t virtioif_init(struct netif *netif)
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_UP;
+
+    /* TCP checksums are computed by the device (see vnet_tx_csum()) */
+    if (vn->dev->features & VIRTIO_NET_F_CSUM)
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
     return ERR_OK;
 }
 
@@ -439,10 +656,11 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     if (rx == INVALID_ADDRESS)
         goto err;
     vn->rx = rx;
-    vn->txq_map = allocate(h, total_processors * sizeof(vn->txq_map[0]));
+    vn->txq_map = allocate(h, present_processors * sizeof(vn->txq_map[0]));
     if (vn->txq_map == INVALID_ADDRESS)
         goto err1;
     int rxq_entries = 0, txq_entries = 0;
+    u16 pools = 0;
     range cpu_affinity;
     u64 first_cpu = 0, num_cpus = 0;
     for (u64 i = 0; i < vq_pairs; i++) {
@@ -460,6 +678,9 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
         rx[i].q = vq;
         rx[i].seqno = 0;
         rx[i].hdr = 0;
+        net_gro_init(&rx[i].gro, &vn->ndev.n, true);
+        net_napi_init(&rx[i].napi, &rx[i].gro,
+                      init_closure_func(&rx[i].poll, thunk, vnet_rx_poll));
         rxq_entries += virtqueue_entries(vq);
         vq_index++;
         s = virtio_alloc_vq_aff(dev, ss("virtio net tx"), vq_index, cpu_affinity, &vq);
@@ -469,10 +690,13 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
             goto err2;
         }
         virtqueue_set_polling(vq, true);
+        virtqueue_set_delayed_events(vq, true);
         for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
             vn->txq_map[j] = vq;
         txq_entries += virtqueue_entries(vq);
     }
+    for (u64 j = total_processors; j < present_processors; j++)
+        vn->txq_map[j] = vn->txq_map[j % total_processors];
     if (vq_pairs > 1) {
         status s = virtio_alloc_virtqueue(dev, ss("virtio net ctrl"), 2 * max_vq_pairs, &vn->ctl);
         if (!is_ok(s)) {
@@ -485,47 +709,54 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
                      rxq_entries, txq_entries);
     bytes rx_allocsize = vn->rxbuflen + sizeof(struct xpbuf);
     bytes rxbuffers_pagesize = find_page_size(rx_allocsize, rxq_entries);
-    bytes tx_handler_size = sizeof(closure_struct_type(tx_complete));
+    bytes tx_handler_size = sizeof(struct vnet_tx);
     bytes tx_handler_pagesize = find_page_size(tx_handler_size, txq_entries);
     virtio_net_debug("%s: net_header_len %d, rx_allocsize %d, rxbuffers_pagesize %d "
                      "tx_handler_size %d tx_handler_pagesize %d\n", func_ss, vn->net_header_len,
                      rx_allocsize, rxbuffers_pagesize, tx_handler_size, tx_handler_pagesize);
-    vn->rxbuffers = allocate_objcache(h, contiguous, rx_allocsize, rxbuffers_pagesize, true);
+    for (pools = 0; pools < vq_pairs; pools++) {
+        rx[pools].pool = allocate_queue(h, 2 * virtqueue_entries(rx[pools].q));
+        if (rx[pools].pool == INVALID_ADDRESS)
+            goto err_pools;
+        rx[pools].pool_limit = 0;
+    }
+    vn->rx_queues = vq_pairs;
+    heap buffers = mem_account_heap(h, contiguous, ss("net_buffers"));
+    if (buffers == INVALID_ADDRESS)
+        goto err_pools;
+    vn->rxbuffers = allocate_objcache(h, buffers, rx_allocsize, rxbuffers_pagesize, true);
     if (vn->rxbuffers == INVALID_ADDRESS)
-        goto err2;
-    vn->txhandlers = allocate_objcache(h, contiguous, tx_handler_size, tx_handler_pagesize, true);
-    if (vn->txhandlers == INVALID_ADDRESS)
         goto err3;
+    vn->txhandlers = allocate_objcache(h, buffers, tx_handler_size, tx_handler_pagesize, true);
+    if (vn->txhandlers == INVALID_ADDRESS)
+        goto err4;
     for (u16 i = 0; i < vq_pairs; i++)
         if (post_receive(vn, vn->rx + i) == 0) {
             msg_err("failed to fill rx queues (%d)\n", rxq_entries);
-            goto err4;
+            goto err5;
         }
     if (vq_pairs > 1) {
-        struct virtio_net_ctrl_mq ctrl_mq = {
-            .virtqueue_pairs = vq_pairs,
-        };
-        status_handler complete = closure(contiguous, vnet_cmd_mq_complete, vn, ctrl_mq);
-        if (complete == INVALID_ADDRESS)
-            goto err4;
-        if (!vnet_ctrl_cmd(vn, VIRTIO_NET_CTRL_MQ, VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET,
-                             &closure_member(vnet_cmd_mq_complete, complete, ctrl_mq),
-                             sizeof(ctrl_mq), complete)) {
-            deallocate_closure(complete);
-            goto err4;
-        }
+        if (!((dev->features & VIRTIO_NET_F_RSS) && vnet_set_rss(vn, vq_pairs)) &&
+            !vnet_set_mq(vn, vq_pairs))
+            goto err5;
     } else {
         netif_set_link_up(&vn->ndev.n);
     }
     vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
-    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner));
+    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner),
+                            ss("virtio_net"), MM_CLEANER_CACHE);
     return true;
+  err5:
+    destroy_heap((heap)vn->txhandlers);
   err4:
-      destroy_heap((heap)vn->txhandlers);
-  err3:
     destroy_heap((heap)vn->rxbuffers);
+  err3:
+    destroy_heap(buffers);
+  err_pools:
+    while (pools > 0)
+        deallocate_queue(rx[--pools].pool);
   err2:
-    deallocate(h, vn->txq_map, total_processors * sizeof(vn->txq_map[0]));
+    deallocate(h, vn->txq_map, present_processors * sizeof(vn->txq_map[0]));
   err1:
     deallocate(h, rx, vq_pairs * sizeof(*rx));
   err:
@@ -540,7 +771,6 @@ static void virtio_net_attach(vtdev dev)
     //    VIRTIO_NET_F_GUEST_UFO | VIRTIO_NET_F_CTRL_VLAN | VIRTIO_NET_F_MQ;
 
     heap h = dev->general;
-    backed_heap contiguous = dev->contiguous;
     vnet vn = allocate(h, sizeof(struct vnet));
     assert(vn != INVALID_ADDRESS);
     init_closure_func(&vn->ndev.setup, netif_dev_setup, virtio_net_setup);
@@ -559,10 +789,6 @@ static void virtio_net_attach(vtdev dev)
         vn->rxbuflen = U16_MAX & ~0x7;  /* lwIP maximum packet length is U16_MAX */
 
     vn->dev = dev;
-    vn->empty = alloc_map(contiguous, contiguous->h.pagesize, &vn->empty_phys);
-    assert(vn->empty != INVALID_ADDRESS);
-    for (int i = 0; i < vn->net_header_len; i++)
-        ((u8 *)vn->empty)[i] = 0;
     netif_add(&vn->ndev.n,
               0, 0, 0, 
               vn,
@@ -55,6 +55,8 @@
 #define VIRTIO_NET_F_GUEST_ANNOUNCE 0x200000 /* Announce device on network */
 #define VIRTIO_NET_F_MQ		0x400000 /* Device supports RFS */
 #define VIRTIO_NET_F_CTRL_MAC_ADDR 0x800000 /* Set MAC address */
+#define VIRTIO_NET_F_HASH_REPORT U64_FROM_BIT(57) /* Device can report per-packet hash */
+#define VIRTIO_NET_F_RSS	U64_FROM_BIT(60) /* Device supports RSS steering */
 
 #define VIRTIO_NET_S_LINK_UP	1	/* Link is up */
 
@@ -70,9 +72,20 @@ struct virtio_net_config {
 	 * Legal values are between 1 and 0x8000.
 	 */
 	u16	max_virtqueue_pairs;
+	u16	mtu;
+	u32	speed;
+	u8	duplex;
+	/* RSS parameters (if VIRTIO_NET_F_RSS or VIRTIO_NET_F_HASH_REPORT) */
+	u8	rss_max_key_size;
+	u16	rss_max_indirection_table_length;
+	u32	supported_hash_types;
 } __attribute__((packed));
 
 #define VIRTIO_NET_R_MAX_VQ     (offsetof(struct virtio_net_config *, max_virtqueue_pairs))
+#define VIRTIO_NET_R_RSS_MAX_KEY_SIZE   (offsetof(struct virtio_net_config *, rss_max_key_size))
+#define VIRTIO_NET_R_RSS_MAX_INDIR_LEN  \
+    (offsetof(struct virtio_net_config *, rss_max_indirection_table_length))
+#define VIRTIO_NET_R_HASH_TYPES (offsetof(struct virtio_net_config *, supported_hash_types))
 
 /*
  * This is the first element of the scatter-gather list.  If you don't
@@ -205,4 +218,38 @@ struct virtio_net_ctrl_mq {
 #define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MIN		1
 #define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_MAX		0x8000
 
+/*
+ * Receive Side Scaling
+ *
+ * With VIRTIO_NET_F_RSS, the command VIRTIO_NET_CTRL_MQ_RSS_CONFIG sets the
+ * hash types, the hash key and the indirection table used by the device to
+ * select a receive virtqueue for each incoming packet, and also sets the
+ * number of transmit queues in use. The indirection table length must be a
+ * power of 2, and each of its entries is a 0-based receive queue index.
+ * The command payload is a virtio_net_rss_config structure, followed by the
+ * indirection table and by a virtio_net_rss_key structure.
+ */
+struct virtio_net_rss_config {
+    u32 hash_types;
+    u16 indirection_table_mask;
+    u16 unclassified_queue;
+    u16 indirection_table[];
+} __attribute__((packed));
+
+struct virtio_net_rss_key {
+    u16 max_tx_vq;
+    u8 hash_key_length;
+    u8 hash_key_data[];
+} __attribute__((packed));
+
+#define VIRTIO_NET_CTRL_MQ_RSS_CONFIG		1
+#define VIRTIO_NET_CTRL_MQ_HASH_CONFIG		2
+
+#define VIRTIO_NET_RSS_HASH_TYPE_IPv4	(1 << 0)
+#define VIRTIO_NET_RSS_HASH_TYPE_TCPv4	(1 << 1)
+#define VIRTIO_NET_RSS_HASH_TYPE_UDPv4	(1 << 2)
+#define VIRTIO_NET_RSS_HASH_TYPE_IPv6	(1 << 3)
+#define VIRTIO_NET_RSS_HASH_TYPE_TCPv6	(1 << 4)
+#define VIRTIO_NET_RSS_HASH_TYPE_UDPv6	(1 << 5)
+
 #endif /* _VIRTIO_NET_H */
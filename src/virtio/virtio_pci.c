@@ -64,6 +64,7 @@
 #define VIRTIO_PCI_CAP_ISR_CFG       3 /* ISR Status */
 #define VIRTIO_PCI_CAP_DEVICE_CFG    4 /* Device specific configuration */
 #define VIRTIO_PCI_CAP_PCI_CFG       5 /* PCI configuration access */
+#define VIRTIO_PCI_CAP_SHARED_MEMORY_CFG 8 /* Shared memory region */
 
 /* This is the PCI capability header: */
 struct vtpci_cap {
@@ -82,6 +83,19 @@ struct vtpci_cap {
 #define VTPCI_CAP_R_BAR              (offsetof(struct vtpci_cap *, bar))
 #define VTPCI_CAP_R_OFFSET           (offsetof(struct vtpci_cap *, offset))
 #define VTPCI_CAP_R_LENGTH           (offsetof(struct vtpci_cap *, length))
+#define VTPCI_CAP_R_ID               (offsetof(struct vtpci_cap *, padding))
+
+/*
+ * Modern device capability with 64-bit offset and length (for shared memory regions)
+ */
+struct vtpci_cap64 {
+    struct vtpci_cap cap;
+    u32 offset_hi;
+    u32 length_hi;
+} __attribute__((packed));
+
+#define VTPCI_CAP64_R_OFFSET_HI      (offsetof(struct vtpci_cap64 *, offset_hi))
+#define VTPCI_CAP64_R_LENGTH_HI      (offsetof(struct vtpci_cap64 *, length_hi))
 
 /*
  * Modern device notify capability
@@ -372,6 +386,35 @@ static u32 vtpci_modern_find_cap(vtpci dev, u8 cfg_type, struct pci_bar *b)
     return 0;
 }
 
+/* Returns the physical address range of a device shared memory region. */
+boolean vtpci_get_shm(vtpci dev, u8 id, range *r)
+{
+    if (!vtpci_is_modern(dev))
+        return false;
+    for (u32 cp = pci_find_cap(dev->dev, PCIY_VENDOR); cp != 0; cp = pci_find_next_cap(dev->dev, PCIY_VENDOR, cp)) {
+        if ((pci_cfgread(dev->dev, cp + VTPCI_CAP_R_TYPE, 1) != VIRTIO_PCI_CAP_SHARED_MEMORY_CFG) ||
+            (pci_cfgread(dev->dev, cp + VTPCI_CAP_R_ID, 1) != id))
+            continue;
+        u8 bar = pci_cfgread(dev->dev, cp + VTPCI_CAP_R_BAR, 1);
+        u64 offset = pci_cfgread(dev->dev, cp + VTPCI_CAP_R_OFFSET, 4) |
+                ((u64)pci_cfgread(dev->dev, cp + VTPCI_CAP64_R_OFFSET_HI, 4) << 32);
+        u64 length = pci_cfgread(dev->dev, cp + VTPCI_CAP_R_LENGTH, 4) |
+                ((u64)pci_cfgread(dev->dev, cp + VTPCI_CAP64_R_LENGTH_HI, 4) << 32);
+        pci_platform_init_bar(dev->dev, bar);
+        u32 base = pci_cfgread(dev->dev, PCIR_BAR(bar), 4);
+        if ((base & PCI_BAR_B_TYPE_MASK) != PCI_BAR_MEMORY)
+            return false;
+        u64 addr = base & ~PCI_BAR_B_MEMORY_MASK;
+        if (base & PCI_BAR_F_64BIT)
+            addr |= (u64)pci_cfgread(dev->dev, PCIR_BAR(bar + 1), 4) << 32;
+        virtio_pci_debug("%s: id %d, bar %d, addr 0x%lx, offset 0x%lx, length 0x%lx\n", func_ss,
+                         id, bar, addr, offset, length);
+        *r = irangel(addr + offset, length);
+        return true;
+    }
+    return false;
+}
+
 static void vtpci_modern_alloc_resources(vtpci dev)
 {
     dev->regs[VTPCI_REG_DEVICE_STATUS] = VTPCI_R_DEVICE_STATUS;
@@ -95,6 +95,7 @@ status vtpci_alloc_virtqueue(vtpci dev, sstring name, int idx, range cpu_affinit
 status vtpci_register_config_change_handler(vtpci dev, thunk handler);
 void vtpci_set_status(vtpci dev, u8 status);
 boolean vtpci_is_modern(vtpci dev);
+boolean vtpci_get_shm(vtpci dev, u8 id, range *r);
 
 /* VirtIO PCI vendor/device ID. */
 #define VIRTIO_PCI_VENDORID	0x1AF4
@@ -112,7 +112,7 @@ struct virtio_scsi {
     struct virtqueue *eventq;
     struct virtio_scsi_event *events;
 
-    struct virtqueue *requestq;
+    struct virtqueue **requestq_map;    /* per-CPU request queue */
 
     u32 seg_max;
     u16 max_target;
@@ -124,6 +124,9 @@ struct virtio_scsi {
 };
 
 typedef struct virtio_scsi *virtio_scsi;
+
+#define virtio_scsi_requestq(s) ((s)->requestq_map[current_cpu()->id])
+
 typedef struct virtio_scsi_disk *virtio_scsi_disk;
 
 struct virtio_scsi_disk {
@@ -134,6 +137,7 @@ struct virtio_scsi_disk {
     u32 max_xfer_len;
     u64 capacity;
     u64 block_size;
+    boolean unmap;      /* logical block provisioning */
 };
 
 static void virtio_scsi_report_luns(virtio_scsi s, storage_attach a, u16 target);
@@ -255,12 +259,13 @@ static void virtio_scsi_enqueue_request(virtio_scsi s, virtio_scsi_request r,
 {
     vqfinish f = closure(s->v->virtio_dev.general, virtio_scsi_request_complete,
         c, s, r, r_phys);
-    virtqueue vq = s->requestq;
+    virtqueue vq = virtio_scsi_requestq(s);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
 
     vqmsg_push(vq, m, r_phys + offsetof(virtio_scsi_request, req), sizeof(r->req), false);
-    if (r->req.cdb[0] == SCSI_CMD_WRITE_16) {
+    u8 cmd = r->req.cdb[0];
+    if ((cmd == SCSI_CMD_WRITE_16) || (cmd == SCSI_CMD_UNMAP)) {
         if (length > 0)
             vqmsg_push(vq, m, physical_from_virtual(buf), length, false);   // dataout
         vqmsg_push(vq, m, r_phys + offsetof(virtio_scsi_request, resp), sizeof(r->resp),
@@ -339,7 +344,7 @@ static void virtio_scsi_io_sg(virtio_scsi_disk d, boolean write, sg_list sg, ran
     struct scsi_cdb_readwrite_16 *cdb;
     u32 desc_blocks, req_blocks;
     heap h = s->v->virtio_dev.general;
-    virtqueue vq = s->requestq;
+    virtqueue vq = virtio_scsi_requestq(s);
     vqmsg msg;
     u32 desc_count;
     merge m = 0;
@@ -408,6 +413,37 @@ static void virtio_scsi_flush(virtio_scsi_disk d, status_handler sh)
                                 closure(s->v->virtio_dev.general, virtio_scsi_io_done, sh));
 }
 
+static void virtio_scsi_unmap(virtio_scsi_disk d, range blocks, status_handler sh)
+{
+    virtio_scsi_debug("%s: blocks %R, sh %F\n", func_ss, blocks, sh);
+    virtio_scsi s = d->scsi;
+    heap h = s->v->virtio_dev.general;
+    merge m = 0;
+    while (range_span(blocks)) {
+        u32 nblocks = MIN(range_span(blocks), U32_MAX);
+        u64 r_phys;
+        virtio_scsi_request r = virtio_scsi_alloc_request(s, d->target, d->lun, SCSI_CMD_UNMAP,
+                                                          &r_phys);
+        struct scsi_cdb_unmap *cdb = (struct scsi_cdb_unmap *)r->req.cdb;
+        cdb->length = htobe16(r->alloc_len);
+        struct scsi_unmap_param *param = (struct scsi_unmap_param *)r->data;
+        zero(param, sizeof(*param));
+        param->length = htobe16(sizeof(*param) - sizeof(param->length));
+        param->desc_length = htobe16(sizeof(param->desc));
+        param->desc.addr = htobe64(blocks.start);
+        param->desc.length = htobe32(nblocks);
+        blocks.start += nblocks;
+        if (!m && range_span(blocks)) {
+            m = allocate_merge(h, sh);
+            sh = apply_merge(m);
+        }
+        virtio_scsi_enqueue_request(s, r, r_phys, r->data, r->alloc_len,
+                                    closure(h, virtio_scsi_io_done, m ? apply_merge(m) : sh));
+    }
+    if (m)
+        apply(sh, STATUS_OK);
+}
+
 closure_func_basic(storage_req_handler, void, virtio_scsi_req_handler,
                    storage_req req)
 {
@@ -428,6 +464,14 @@ closure_func_basic(storage_req_handler, void, virtio_scsi_req_handler,
     case STORAGE_OP_WRITE:
         virtio_scsi_io(d, SCSI_CMD_WRITE_16, req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_DISCARD:
+        if (d->unmap) {
+            virtio_scsi_unmap(d, req->blocks, req->completion);
+            break;
+        }
+        /* no break */
+    default:
+        storage_req_unsupported(req);
     }
 }
 
@@ -481,11 +525,12 @@ closure_function(5, 2, void, virtio_scsi_read_capacity_done,
     d->max_xfer_len = bound(max_xfer_len);
     d->block_size = be32toh(res->length);
     d->capacity = sectors * d->block_size;
+    d->unmap = (be16toh(res->lalba_lbp) & SRC16_LBPME_A) != 0;
     d->target = target;
     d->lun = lun;
     d->scsi = s;
-    virtio_scsi_debug("%s: target %d, lun %d, block size 0x%lx, capacity 0x%lx\n",
-                      func_ss, target, lun, d->block_size, d->capacity);
+    virtio_scsi_debug("%s: target %d, lun %d, block size 0x%lx, capacity 0x%lx, unmap %d\n",
+                      func_ss, target, lun, d->block_size, d->capacity, d->unmap);
 
     async_apply(closure(s->v->virtio_dev.general, virtio_scsi_init_done,
                         d, bound(attach_id), bound(a)));
@@ -668,12 +713,10 @@ static void virtio_scsi_attach(heap general, storage_attach a, backed_heap page_
 {
     virtio_scsi s = allocate(general, sizeof(struct virtio_scsi));
     assert(s != INVALID_ADDRESS);
-    s->v = attach_vtpci(general, page_allocator, _dev, VIRTIO_SCSI_F_HOTPLUG);
+    s->v = attach_vtpci(general, page_allocator, _dev,
+                        VIRTIO_SCSI_F_HOTPLUG | VIRTIO_F_RING_PACKED);
 
 #ifdef VIRTIO_SCSI_DEBUG
-    u32 num_queues = pci_bar_read_4(&s->v->device_config, VIRTIO_SCSI_R_NUM_QUEUES);
-    virtio_scsi_debug("num queues %d\n", num_queues);
-
     u32 max_sectors = pci_bar_read_4(&s->v->device_config, VIRTIO_SCSI_R_MAX_SECTORS);
     virtio_scsi_debug("max sectors %d\n", max_sectors);
 
@@ -706,8 +749,30 @@ static void virtio_scsi_attach(heap general, storage_attach a, backed_heap page_
     assert(st == STATUS_OK);
     st = vtpci_alloc_virtqueue(s->v, ss("virtio scsi event"), 1, cpu_affinity, &s->eventq);
     assert(st == STATUS_OK);
-    st = vtpci_alloc_virtqueue(s->v, ss("virtio scsi request"), 2, cpu_affinity, &s->requestq);
-    assert(st == STATUS_OK);
+
+    /* request queues are spread over the CPUs, so that each CPU submits to its own queue */
+    u32 num_queues = pci_bar_read_4(&s->v->device_config, VIRTIO_SCSI_R_NUM_QUEUES);
+    num_queues = MAX(MIN(num_queues, total_processors), 1);
+    virtio_scsi_debug("num queues %d\n", num_queues);
+    s->requestq_map = allocate(general, present_processors * sizeof(s->requestq_map[0]));
+    assert(s->requestq_map != INVALID_ADDRESS);
+    u64 cpus_per_vq = total_processors / num_queues;
+    u64 excess_cpus = total_processors - cpus_per_vq * num_queues;
+    boolean io_poll = storage_io_poll_enabled(ss("virtio_scsi"));
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u32 i = 0; i < num_queues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_vq + 1) : cpus_per_vq;
+        virtqueue vq;
+        st = vtpci_alloc_virtqueue(s->v, ss("virtio scsi request"), 2 + i,
+                                   irangel(first_cpu, num_cpus), &vq);
+        assert(st == STATUS_OK);
+        virtqueue_set_io_poll(vq, io_poll);
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            s->requestq_map[j] = vq;
+    }
+    for (u64 j = total_processors; j < present_processors; j++)
+        s->requestq_map[j] = s->requestq_map[j % total_processors];
 
     // On reset, the device MUST set sense_size to 96 and cdb_size to 32
     pci_bar_write_4(&s->v->device_config, VIRTIO_SCSI_R_SENSE_SIZE, VIRTIO_SCSI_SENSE_SIZE);
@@ -48,13 +48,22 @@ struct virtio_vsock_hdr {
 #define virtio_sock_debug(x, ...)
 #endif
 
-#define VIRTIO_SOCK_DRIVER_FEATURES VIRTIO_VSOCK_F_STREAM
+#define VIRTIO_SOCK_DRIVER_FEATURES (VIRTIO_VSOCK_F_STREAM | VIRTIO_F_RING_PACKED)
 
 /* 2 descriptors per packet (one for the header and one for the optional payload) are needed because
  * AWS Firecracker does not support inserting a received data packet into a single descriptor. */
 #define VIRTIO_SOCK_RX_PACKET_DESCS 2
 
-#define VIRTIO_SOCK_RXBUF_SIZE  (4 * KB)
+/* Receive buffers span multiple pages so that the host can transfer large packets, which keeps
+ * the per-packet overhead low on streams; packets with a small payload are copied to a buffer of
+ * their size, so that they do not tie up a large buffer while queued in a socket. */
+#define VIRTIO_SOCK_RXBUF_SIZE  (64 * KB)
+#define VIRTIO_SOCK_RX_BUFS_MAX 32
+#define VIRTIO_SOCK_RX_COPY_MAX (1 * KB)
+
+/* Credit updates are sent when at least this fraction of the receive buffer space has been
+ * consumed since the peer was last informed (each transmitted packet also carries the credit). */
+#define VIRTIO_SOCK_CREDIT_UPDATE_DIV   2
 
 typedef struct virtio_sock {
     heap general;
@@ -62,6 +71,7 @@ typedef struct virtio_sock {
     vtdev dev;
     virtqueue rxq, txq, eventq;
     u32 rx_seqno;
+    u32 rx_bufs;
     u32 guest_cid;
 } *virtio_sock;
 
@@ -71,6 +81,7 @@ typedef struct virtio_sock_connection {
     u16 type;
     u32 buf_alloc;
     u32 fwd_cnt;
+    u32 last_fwd_cnt;   /* value last sent to the peer */
     u32 tx_cnt;
     u32 peer_buf_alloc;
     u32 peer_fwd_cnt;
@@ -80,6 +91,7 @@ typedef struct virtio_sock_connection {
 typedef struct virtio_sock_rxbuf {
     virtio_sock vs;
     u32 seqno;
+    u32 size;
     closure_struct(vqfinish, complete);
     u8 data[0];
 } *virtio_sock_rxbuf;
@@ -126,9 +138,10 @@ static boolean virtio_sock_dev_attach(heap general, backed_heap backed, vtdev de
     vs->general = general;
     vs->backed = backed;
     vs->dev = dev;
+    vs->rx_seqno = 0;
+    vs->rx_bufs = 0;
     if (!virtio_sock_rxq_submit(vs))
         goto err;
-    vs->rx_seqno = 0;
     vtdev_set_status(dev, VIRTIO_CONFIG_STATUS_DRIVER_OK);
     vsock_set_transport(vs);
     return true;
@@ -211,7 +224,7 @@ static boolean virtio_sock_tx_hdr(virtio_sock vs, virtio_sock_connection conn, u
     hdr->op = op;
     hdr->flags = flags;
     hdr->buf_alloc = conn->buf_alloc;
-    hdr->fwd_cnt = conn->fwd_cnt;
+    hdr->fwd_cnt = conn->last_fwd_cnt = conn->fwd_cnt;
     virtio_sock_debug("tx op %d, fwd_cnt %d", op, hdr->fwd_cnt);
     virtqueue vq = vs->txq;
     vqmsg m = allocate_vqmsg(vq);
@@ -321,10 +334,22 @@ closure_func_basic(vqfinish, void, virtio_sock_rx_complete,
             virtio_sock_tx_hdr(vs, conn, VIRTIO_VSOCK_OP_RST, 0);
         break;
     }
-    case VIRTIO_VSOCK_OP_RW:
-        conn = (virtio_sock_connection)vsock_rx(&conn_id, hdr + 1, hdr->len);
-        free_buf = false;
+    case VIRTIO_VSOCK_OP_RW: {
+        void *data = hdr + 1;
+        if (hdr->len <= VIRTIO_SOCK_RX_COPY_MAX) {
+            u32 size = offsetof(virtio_sock_rxbuf, data) + sizeof(*hdr) + hdr->len;
+            virtio_sock_rxbuf copy = allocate((heap)vs->backed, size);
+            if (copy != INVALID_ADDRESS) {
+                copy->vs = vs;
+                copy->size = size;
+                runtime_memcpy(copy->data, hdr, sizeof(*hdr) + hdr->len);
+                data = copy->data + sizeof(*hdr);
+            }
+        }
+        conn = (virtio_sock_connection)vsock_rx(&conn_id, data, hdr->len);
+        free_buf = (data != hdr + 1);
         break;
+    }
     case VIRTIO_VSOCK_OP_CREDIT_UPDATE:
         conn = (virtio_sock_connection)vsock_get_conn(&conn_id);
         break;
@@ -341,8 +366,9 @@ closure_func_basic(vqfinish, void, virtio_sock_rx_complete,
     }
   out:
     vs->rx_seqno++;
+    fetch_and_add_32(&vs->rx_bufs, -1);
     if (free_buf)
-        deallocate((heap)vs->backed, rxbuf, VIRTIO_SOCK_RXBUF_SIZE);
+        deallocate((heap)vs->backed, rxbuf, rxbuf->size);
     virtio_sock_rxq_submit(vs);
 }
 
@@ -353,7 +379,7 @@ static boolean virtio_sock_rxq_submit(virtio_sock vs)
     virtio_sock_debug("rxq submit: %d free entries", free_entries);
     int new_entries = 0;
     u64 phys;
-    while (new_entries < free_entries) {
+    while ((new_entries < free_entries) && (vs->rx_bufs < VIRTIO_SOCK_RX_BUFS_MAX)) {
         virtio_sock_rxbuf rxbuf = alloc_map(vs->backed, VIRTIO_SOCK_RXBUF_SIZE, &phys);
         if (rxbuf == INVALID_ADDRESS)
             break;
@@ -367,13 +393,15 @@ static boolean virtio_sock_rxq_submit(virtio_sock vs)
         data_offset += sizeof(struct virtio_vsock_hdr);
         vqmsg_push(vq, m, phys + data_offset, VIRTIO_SOCK_RXBUF_SIZE - data_offset, true);
         rxbuf->vs = vs;
+        rxbuf->size = VIRTIO_SOCK_RXBUF_SIZE;
         new_entries += VIRTIO_SOCK_RX_PACKET_DESCS;
+        fetch_and_add_32(&vs->rx_bufs, 1);
         vqmsg_commit_seqno(vq, m,
                            init_closure_func(&rxbuf->complete, vqfinish, virtio_sock_rx_complete),
                            &rxbuf->seqno, new_entries >= free_entries);
     }
     if (new_entries == 0)
-        return false;
+        return (vs->rx_bufs > 0);
     if (new_entries < free_entries)
         virtqueue_kick(vq);
     return true;
@@ -391,7 +419,7 @@ vsock_connection virtio_sock_conn_new(void *priv, u32 local_port, u32 peer_cid,
     c->vs = vs;
     c->type = VIRTIO_VSOCK_TYPE_STREAM;
     c->buf_alloc = buf_size;
-    c->fwd_cnt = c->tx_cnt = 0;
+    c->fwd_cnt = c->last_fwd_cnt = c->tx_cnt = 0;
     return &c->vsock_conn;
 }
 
@@ -427,7 +455,7 @@ void virtio_sock_free_txbuf(void *priv, void *buf)
     virtio_sock vs = priv;
     struct virtio_vsock_hdr *hdr = buf - sizeof(*hdr);
     virtio_sock_txbuf txbuf = (void *)hdr - offsetof(virtio_sock_txbuf, data);
-    deallocate((heap)vs->backed, txbuf, sizeof(*txbuf) + hdr->len);
+    deallocate((heap)vs->backed, txbuf, sizeof(*txbuf) + sizeof(*hdr) + hdr->len);
 }
 
 void virtio_sock_free_rxbuf(void *priv, void *buf)
@@ -435,7 +463,7 @@ void virtio_sock_free_rxbuf(void *priv, void *buf)
     virtio_sock vs = priv;
     virtio_sock_rxbuf rxbuf = buf - sizeof(struct virtio_vsock_hdr) -
                               offsetof(virtio_sock_rxbuf, data);
-    deallocate((heap)vs->backed, rxbuf, VIRTIO_SOCK_RXBUF_SIZE);
+    deallocate((heap)vs->backed, rxbuf, rxbuf->size);
 }
 
 u64 virtio_sock_get_buf_space(vsock_connection conn)
@@ -458,7 +486,7 @@ boolean virtio_sock_tx(vsock_connection conn, void *data)
     hdr->op = VIRTIO_VSOCK_OP_RW;
     hdr->flags = 0;
     hdr->buf_alloc = c->buf_alloc;
-    hdr->fwd_cnt = c->fwd_cnt;
+    hdr->fwd_cnt = c->last_fwd_cnt = c->fwd_cnt;
     virtio_sock_debug("tx data, fwd_cnt %d", hdr->fwd_cnt);
     virtqueue vq = vs->txq;
     vqmsg m = allocate_vqmsg(vq);
@@ -481,7 +509,8 @@ void virtio_sock_recved(vsock_connection conn, u64 length)
     virtio_sock_debug("recved %ld", length);
     virtio_sock_connection c = (virtio_sock_connection)conn;
     c->fwd_cnt += length;
-    virtio_sock_tx_hdr(c->vs, c, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
+    if (c->fwd_cnt - c->last_fwd_cnt >= c->buf_alloc / VIRTIO_SOCK_CREDIT_UPDATE_DIV)
+        virtio_sock_tx_hdr(c->vs, c, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
 }
 
 boolean virtio_sock_shutdown(vsock_connection conn, int flags)
@@ -42,7 +42,8 @@ struct virtio_blk_config {
        u32 opt_io_size;
     } topology;
     u8 writeback;
-    u8 unused0[3];
+    u8 unused0;
+    u16 num_queues;
     u32 max_discard_sectors;
     u32 max_discard_seg;
     u32 discard_sector_alignment;
@@ -60,6 +61,9 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_F_FLUSH      U64_FROM_BIT(9)
 #define VIRTIO_BLK_F_TOPOLOGY   U64_FROM_BIT(10)
 #define VIRTIO_BLK_F_CONFIG_WCE U64_FROM_BIT(11)
+#define VIRTIO_BLK_F_MQ         U64_FROM_BIT(12)
+#define VIRTIO_BLK_F_DISCARD    U64_FROM_BIT(13)
+#define VIRTIO_BLK_F_WRITE_ZEROES   U64_FROM_BIT(14)
 
 #define VIRTIO_BLK_R_CAPACITY_LOW                (offsetof(struct virtio_blk_config *, capacity))
 #define VIRTIO_BLK_R_CAPACITY_HIGH               (offsetof(struct virtio_blk_config *, capacity) + 4)
@@ -74,6 +78,7 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_R_TOPOLOGY_MIN_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, min_io_size))
 #define VIRTIO_BLK_R_TOPOLOGY_OPT_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, opt_io_size))
 #define VIRTIO_BLK_R_WRITEBACK                   (offsetof(struct virtio_blk_config *, writeback))
+#define VIRTIO_BLK_R_NUM_QUEUES                  (offsetof(struct virtio_blk_config *, num_queues))
 #define VIRTIO_BLK_R_MAX_DISCARD_SECTORS         (offsetof(struct virtio_blk_config *, max_discard_sectors))
 #define VIRTIO_BLK_R_MAX_DISCARD_SEG             (offsetof(struct virtio_blk_config *, max_discard_seg))
 #define VIRTIO_BLK_R_DISCARD_SECTOR_ALIGNMENT    (offsetof(struct virtio_blk_config *, discard_sector_alignment))
@@ -87,23 +92,48 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_T_IN         0
 #define VIRTIO_BLK_T_OUT        1
 #define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_T_DISCARD    11
+#define VIRTIO_BLK_T_WRITE_ZEROES   13
 
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
 
+/* segment of a discard or write zeroes request */
+struct virtio_blk_dwz_seg {
+    u64 sector;
+    u32 num_sectors;
+    u32 flags;
+} __attribute__((packed));
+
+#define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP  U32_FROM_BIT(0)
+
+/* maximum number of segments per request, so that a request fits in a page */
+#define VIRTIO_BLK_DWZ_SEG_MAX  \
+    ((PAGESIZE - VIRTIO_BLK_REQ_HEADER_SIZE - VIRTIO_BLK_REQ_STATUS_SIZE) /   \
+     sizeof(struct virtio_blk_dwz_seg))
+
 #define VIRTIO_BLK_DRIVER_FEATURES  \
-    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH)
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH | \
+     VIRTIO_BLK_F_MQ | VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES | VIRTIO_F_RING_PACKED)
 
 typedef struct storage {
     vtdev v;
     closure_struct(storage_req_handler, req_handler);
-    struct virtqueue *command;
+    struct virtqueue **vq_map;  /* per-CPU request queue */
     u64 capacity;
     u64 block_size;
     u32 seg_max;
+    u32 max_discard_sectors;
+    u32 max_discard_seg;
+    u32 discard_alignment;      /* in sectors */
+    u32 max_write_zeroes_sectors;
+    u32 max_write_zeroes_seg;
+    boolean write_zeroes_unmap;
 } *storage;
 
+#define storage_vq(st)  ((st)->vq_map[current_cpu()->id])
+
 static virtio_blk_req allocate_virtio_blk_req(storage st, u32 type, u64 sector, u64 *phys)
 {
     virtio_blk_req req = alloc_map(st->v->contiguous, sizeof(struct virtio_blk_req), phys);
@@ -155,7 +185,7 @@ static inline void storage_rw_internal(storage st, boolean write, void * buf,
         apply(sh, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -186,7 +216,7 @@ static void virtio_storage_io_sg(storage st, boolean write, sg_list sg, range bl
     virtio_blk_req req = 0;
     u64 req_phys;
     heap h = st->v->general;
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg msg;
     u32 desc_count;
     merge m = 0;
@@ -235,7 +265,7 @@ static void storage_flush(storage st, status_handler s)
         apply(s, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -245,6 +275,96 @@ static void storage_flush(storage st, status_handler s)
     vqmsg_commit(vq, m, c);
 }
 
+closure_function(5, 1, void, dwz_complete,
+                 storage, s, status_handler, f, void *, req, u64, phys, u64, size,
+                 u64 len)
+{
+    void *req = bound(req);
+    u64 size = bound(size);
+    u8 req_status = *(u8 *)(req + size - VIRTIO_BLK_REQ_STATUS_SIZE);
+    status st = 0;
+    if (req_status)
+        st = timm("result", "%d", req_status);
+    async_apply_status_handler(bound(f), st);
+    dealloc_unmap(bound(s)->v->contiguous, req, bound(phys),
+                  pad(size, bound(s)->v->contiguous->h.pagesize));
+    closure_finish();
+}
+
+/* Discard and write zeroes requests carry a list of segments (instead of a data buffer) between the
+ * request header and the status byte; a block range is split into as many segments and requests as
+ * the device limits require. */
+static void virtio_storage_dwz(storage st, u32 type, range blocks, status_handler sh)
+{
+    virtio_blk_debug("%s: type %d, blocks %R\n", func_ss, type, blocks);
+    u32 max_sectors, max_seg, flags;
+    if (type == VIRTIO_BLK_T_DISCARD) {
+        max_sectors = st->max_discard_sectors;
+        max_seg = st->max_discard_seg;
+        flags = 0;
+
+        /* discarding is advisory: leave out the unaligned head and tail of the range */
+        u32 align = st->discard_alignment;
+        if (align > 1) {
+            blocks.start = ((blocks.start + align - 1) / align) * align;
+            blocks.end = (blocks.end / align) * align;
+        }
+    } else {
+        max_sectors = st->max_write_zeroes_sectors;
+        max_seg = st->max_write_zeroes_seg;
+        flags = st->write_zeroes_unmap ? VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP : 0;
+    }
+    if (blocks.start >= blocks.end) {
+        async_apply_status_handler(sh, STATUS_OK);
+        return;
+    }
+    heap h = st->v->general;
+    backed_heap contiguous = st->v->contiguous;
+    virtqueue vq = storage_vq(st);
+    merge m = 0;
+    while (range_span(blocks)) {
+        u64 seg_count = (range_span(blocks) + max_sectors - 1) / max_sectors;
+        u32 nseg = MIN(seg_count, max_seg);
+        u64 seg_size = nseg * sizeof(struct virtio_blk_dwz_seg);
+        u64 size = VIRTIO_BLK_REQ_HEADER_SIZE + seg_size + VIRTIO_BLK_REQ_STATUS_SIZE;
+        u64 req_phys;
+        virtio_blk_req req = alloc_map(contiguous, size, &req_phys);
+        if (req == INVALID_ADDRESS) {
+            if (!m) {
+                apply(sh, timm_oom);
+                return;
+            }
+            apply(apply_merge(m), timm_oom);
+            break;
+        }
+        req->type = type;
+        req->reserved = 0;
+        req->sector = 0;
+        struct virtio_blk_dwz_seg *seg = (void *)req + VIRTIO_BLK_REQ_HEADER_SIZE;
+        for (u32 i = 0; i < nseg; i++) {
+            u32 num_sectors = MIN(range_span(blocks), max_sectors);
+            seg[i].sector = blocks.start;
+            seg[i].num_sectors = num_sectors;
+            seg[i].flags = flags;
+            blocks.start += num_sectors;
+        }
+        vqmsg msg = allocate_vqmsg(vq);
+        assert(msg != INVALID_ADDRESS);
+        vqmsg_push(vq, msg, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE + seg_size, false);
+        vqmsg_push(vq, msg, req_phys + VIRTIO_BLK_REQ_HEADER_SIZE + seg_size,
+                   VIRTIO_BLK_REQ_STATUS_SIZE, true);
+        if (!m && range_span(blocks)) {
+            m = allocate_merge(h, sh);
+            sh = apply_merge(m);
+        }
+        vqfinish c = closure(h, dwz_complete, st, m ? apply_merge(m) : sh, req, req_phys, size);
+        assert(c != INVALID_ADDRESS);
+        vqmsg_commit(vq, msg, c);
+    }
+    if (m)
+        apply(sh, STATUS_OK);
+}
+
 closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
                    storage_req req)
 {
@@ -268,6 +388,20 @@ closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
     case STORAGE_OP_WRITE:
         storage_rw_internal(st, true, req->data, req->blocks, req->completion);
         break;
+    case STORAGE_OP_DISCARD:
+        if (st->v->features & VIRTIO_BLK_F_DISCARD)
+            virtio_storage_dwz(st, VIRTIO_BLK_T_DISCARD, req->blocks, req->completion);
+        else
+            storage_req_unsupported(req);
+        break;
+    case STORAGE_OP_WRITE_ZEROES:
+        if (st->v->features & VIRTIO_BLK_F_WRITE_ZEROES)
+            virtio_storage_dwz(st, VIRTIO_BLK_T_WRITE_ZEROES, req->blocks, req->completion);
+        else
+            storage_req_unsupported(req);
+        break;
+    default:
+        storage_req_unsupported(req);
     }
 }
 
@@ -282,10 +416,56 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
     s->capacity = (vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_LOW) |
 		   ((u64) vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_HIGH) << 32)) * s->block_size;
     virtio_blk_debug("%s: capacity 0x%lx, block size 0x%x\n", func_ss, s->capacity, s->block_size);
-    virtio_alloc_virtqueue(v, ss("virtio blk"), 0, &s->command);
+    u64 num_queues = (v->features & VIRTIO_BLK_F_MQ) ?
+            vtdev_cfg_read_2(v, VIRTIO_BLK_R_NUM_QUEUES) : 1;
+    num_queues = MAX(MIN(num_queues, total_processors), 1);
+    virtio_blk_debug("%s: using %ld queues\n", func_ss, num_queues);
+    s->vq_map = allocate(general, present_processors * sizeof(s->vq_map[0]));
+    assert(s->vq_map != INVALID_ADDRESS);
+    u64 cpus_per_vq = total_processors / num_queues;
+    u64 excess_cpus = total_processors - cpus_per_vq * num_queues;
+    boolean io_poll = storage_io_poll_enabled(ss("virtio_blk"));
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u64 i = 0; i < num_queues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_vq + 1) : cpus_per_vq;
+        virtqueue vq;
+        status st = virtio_alloc_vq_aff(v, ss("virtio blk"), i, irangel(first_cpu, num_cpus), &vq);
+        if (!is_ok(st)) {
+            msg_err("failed to allocate vq: %v\n", st);
+            timm_dealloc(st);
+            deallocate(general, s->vq_map, present_processors * sizeof(s->vq_map[0]));
+            deallocate(general, s, sizeof(struct storage));
+            return;
+        }
+        virtqueue_set_io_poll(vq, io_poll);
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            s->vq_map[j] = vq;
+    }
+    /* hot-added CPUs share the queues of the CPUs online at attach time */
+    for (u64 j = total_processors; j < present_processors; j++)
+        s->vq_map[j] = s->vq_map[j % total_processors];
 
     s->seg_max = (v->features & VIRTIO_BLK_F_SEG_MAX) ?
             vtdev_cfg_read_4(v, VIRTIO_BLK_R_SEG_MAX) : 1;
+    if (v->features & VIRTIO_BLK_F_DISCARD) {
+        s->max_discard_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_DISCARD_SECTORS) ? : U32_MAX;
+        s->max_discard_seg = MIN(MAX(vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_DISCARD_SEG), 1),
+                                 VIRTIO_BLK_DWZ_SEG_MAX);
+        s->discard_alignment = vtdev_cfg_read_4(v, VIRTIO_BLK_R_DISCARD_SECTOR_ALIGNMENT);
+        virtio_blk_debug("%s: discard max sectors %d, max seg %d, alignment %d\n", func_ss,
+                         s->max_discard_sectors, s->max_discard_seg, s->discard_alignment);
+    }
+    if (v->features & VIRTIO_BLK_F_WRITE_ZEROES) {
+        s->max_write_zeroes_sectors = vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_WRITE_ZEROS_SECTORS) ? :
+                                      U32_MAX;
+        s->max_write_zeroes_seg = MIN(MAX(vtdev_cfg_read_4(v, VIRTIO_BLK_R_MAX_WRITE_ZEROS_SEG), 1),
+                                      VIRTIO_BLK_DWZ_SEG_MAX);
+        s->write_zeroes_unmap = vtdev_cfg_read_1(v, VIRTIO_BLK_R_WRITE_ZEROS_MAY_UNMAP) != 0;
+        virtio_blk_debug("%s: write zeroes max sectors %d, max seg %d, unmap %d\n", func_ss,
+                         s->max_write_zeroes_sectors, s->max_write_zeroes_seg,
+                         s->write_zeroes_unmap);
+    }
     if (v->features & VIRTIO_BLK_F_FLUSH) {
         if (v->features & VIRTIO_BLK_F_CONFIG_WCE)
             vtdev_cfg_write_1(v, VIRTIO_BLK_R_WRITEBACK, 1 /* writeback */);
@@ -27,6 +27,7 @@
  */
 
 #include <kernel.h>
+#include <storage.h>
 #include "virtio_internal.h"
 
 //#define VIRTQUEUE_DEBUG
@@ -48,6 +49,20 @@
 #define VRING_DESC_F_WRITE      2
 #define VRING_DESC_F_INDIRECT   4
 
+/* packed ring descriptor flags */
+#define VRING_PACKED_DESC_F_AVAIL   U64_FROM_BIT(7)
+#define VRING_PACKED_DESC_F_USED    U64_FROM_BIT(15)
+
+/* packed ring event suppression flags */
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 1
+#define VRING_PACKED_EVENT_FLAG_DESC    2
+
+#define VRING_PACKED_EVENT_WRAP_SHIFT   15
+
+/* Maximum number of used buffers processed in a single pass of the queue service routine. */
+#define VQ_POLL_BUDGET          64
+
 /* shared with vqmsg with next unused */
 struct vring_desc {
     u64 busaddr;                /* phys for now */
@@ -75,6 +90,18 @@ struct vring_used {
     struct vring_used_elem ring[0];
 } __attribute__((packed));
 
+struct vring_packed_desc {
+    u64 busaddr;
+    u32 len;
+    u16 id;
+    u16 flags;
+} __attribute__((packed));
+
+struct vring_packed_desc_event {
+    u16 off_wrap;
+    u16 flags;
+} __attribute__((packed));
+
 typedef struct vqmsg {
     struct list l;              /* vq->msg_queue when queued, or chained for bh process */
     union {
@@ -97,8 +124,28 @@ typedef struct virtqueue {
     volatile struct vring_used *used;    
     u16 *avail_event;
     u16 *used_event;
+
+    /* packed ring layout (VIRTIO_F_RING_PACKED): buffer ids are distinct from descriptor indexes,
+     * and desc_idx is the head of the buffer id free list */
+    boolean packed;
+    boolean avail_wrap;
+    boolean used_wrap;
+    u16 next_avail_idx;
+    volatile struct vring_packed_desc *packed_desc;
+    volatile struct vring_packed_desc_event *driver_event;
+    volatile struct vring_packed_desc_event *device_event;
+    u16 *next_id;
+
     boolean polling;
     boolean events_enabled;
+    boolean delayed_events;     /* with event index, interrupt after most pending buffers are used */
+    boolean service_scheduled;  /* atomic */
+    boolean service_deferred;   /* service queued on the runqueue instead of the bhqueue */
+    u16 budget;
+    closure_struct(thunk, service);
+    boolean io_poll;            /* submitters spin for completions (hybrid polling) */
+    u64 completions;            /* number of used buffers processed */
+    struct io_poll poll;
     u64 free_cnt;               /* atomic */
     u16 desc_idx;               /* head of descriptor free list */
     u16 last_used_idx;          /* irq only */
@@ -154,11 +201,56 @@ void vqmsg_push(virtqueue vq, vqmsg m, u64 phys_addr, u32 len, boolean write)
 }
 
 static void virtqueue_fill(virtqueue vq);
+static boolean vq_poll(virtqueue vq, u64 budget);
+
+static boolean vq_packed_desc_used(virtqueue vq)
+{
+    u16 flags = vq->packed_desc[vq->last_used_idx].flags;
+    boolean avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    boolean used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    return (avail == used) && (used == vq->used_wrap);
+}
+
+static boolean vq_used_pending(virtqueue vq)
+{
+    if (vq->packed)
+        return vq_packed_desc_used(vq);
+    return (vq->last_used_idx != vq->used->idx);
+}
+
+/* Processes the buffers used by the device without waiting for the queue interrupt (e.g. when
+ * busy polling); as with the queue service, completions are applied asynchronously. */
+void virtqueue_poll_used(virtqueue vq)
+{
+    if (vq_used_pending(vq)) {
+        u64 irqflags = spin_lock_irq(&vq->lock);
+        vq_poll(vq, vq->entries);
+        virtqueue_fill(vq);
+        spin_unlock_irq(&vq->lock, irqflags);
+    }
+}
 
 /* If seqno is non-null, the value it points to is set to a sequence number whose value is
  * initialized (when the virtqueue is created) to zero and incremented by one each time this
  * function is called with a nun-null seqno. This allows callers to determine e.g. the order in
  * which messages are received from a remote peer. */
+/* Spin on the used ring until a buffer is used or the polling window expires; buffers that are
+ * not processed here are handled by the queue interrupt. */
+static void virtqueue_io_poll(virtqueue vq, u64 completions)
+{
+    timestamp start = io_poll_start(&vq->poll);
+    timestamp deadline = start + vq->poll.window;
+    boolean completed;
+    do {
+        virtqueue_poll_used(vq);
+        completed = (*(volatile u64 *)&vq->completions != completions);
+        if (completed)
+            break;
+        kern_pause();
+    } while (now(CLOCK_ID_MONOTONIC_RAW) < deadline);
+    io_poll_end(&vq->poll, start, completed);
+}
+
 void vqmsg_commit_seqno(virtqueue vq, vqmsg m, vqfinish completion, u32 *seqno, boolean kick)
 {
     m->completion = completion;
@@ -170,7 +262,10 @@ void vqmsg_commit_seqno(virtqueue vq, vqmsg m, vqfinish completion, u32 *seqno,
     list_push_back(&vq->msg_queue, &m->l);
     if (kick)
         virtqueue_fill(vq);
+    u64 completions = vq->completions;
     spin_unlock_irq(&vq->lock, irqflags);
+    if (kick && vq->io_poll && !in_interrupt())
+        virtqueue_io_poll(vq, completions);
 }
 
 void virtqueue_kick(virtqueue vq)
@@ -181,12 +276,58 @@ void virtqueue_kick(virtqueue vq)
     spin_unlock_irq(lock, irqflags);
 }
 
-static void vq_poll(virtqueue vq)
+/* called with lock held */
+static void vq_msg_used(virtqueue vq, u16 id, u32 len)
+{
+    vqmsg m = vq->msgs[id];
+    fetch_and_add(&vq->free_cnt, m->count);
+    m->len = len;
+    vq->msgs[id] = 0;
+    virtqueue_debug("add msg %p\n", m);
+
+    async_apply_1(m->completion, (void*)m->len);
+    vq->completions++;
+    list_insert_after(&vq->free_msgs, &m->l);
+}
+
+static boolean vq_poll_packed(virtqueue vq, u64 budget)
+{
+    while (vq_packed_desc_used(vq)) {
+        if (budget-- == 0)
+            return true;
+
+        /* read the descriptor contents only after its flags show it as used */
+        read_barrier();
+        volatile struct vring_packed_desc *d = vq->packed_desc + vq->last_used_idx;
+        u16 id = d->id;
+        u32 len = d->len;
+        virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+                                func_ss, vq->name, vq->last_used_idx, id, len);
+        vqmsg m = vq->msgs[id];
+        assert(m);
+        vq->last_used_idx += m->count;
+        if (vq->last_used_idx >= vq->entries) {
+            vq->last_used_idx -= vq->entries;
+            vq->used_wrap = !vq->used_wrap;
+        }
+        vq->next_id[id] = vq->desc_idx;
+        vq->desc_idx = id;
+        vq_msg_used(vq, id, len);
+    }
+    return false;
+}
+
+/* Processes up to budget used buffers; returns true if more used buffers are pending. */
+static boolean vq_poll(virtqueue vq, u64 budget)
 {
     // ensure we see up-to-date used->idx (updated by host)
     memory_barrier();
-    
+
+    if (vq->packed)
+        return vq_poll_packed(vq, budget);
     while (vq->last_used_idx != vq->used->idx) {
+        if (budget-- == 0)
+            return true;
         volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
         virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
                                 func_ss, vq->name, vq->last_used_idx, uep->id, uep->len);
@@ -205,40 +346,66 @@ static void vq_poll(virtqueue vq)
         vq->desc_idx = head;
 
         vq->last_used_idx++;
-        fetch_and_add(&vq->free_cnt, m->count);
-        m->len = uep->len;
-        vq->msgs[head] = 0;
-        virtqueue_debug("add msg %p\n", m);
-
-        async_apply_1(m->completion, (void*)m->len);
-
-        /* TODO should probably observe a limit / drain method here */
-        list_insert_after(&vq->free_msgs, &m->l);
+        vq_msg_used(vq, head, uep->len);
     }
+    return false;
 }
 
-closure_function(1, 0, void, vq_interrupt,
-                 virtqueue, vq)
+static void vq_enable_events(virtqueue vq);
+static void vq_disable_events(virtqueue vq);
+
+/* Queue service routine, run with queue interrupts disabled: used buffers are processed in batches
+ * of at most vq->budget, and as long as the device keeps using buffers the routine re-queues itself
+ * instead of re-enabling interrupts. Each re-queue alternates between the bhqueue and the runqueue,
+ * so that the services of other queues and the scheduler run between two batches. */
+closure_func_basic(thunk, void, vq_service)
 {
-    virtqueue vq = bound(vq);
+    virtqueue vq = struct_from_field(closure_self(), virtqueue, service);
     virtqueue_debug_verbose("%s: ENTRY: vq %s: entries %d, last_used_idx %d, used->idx %d, desc_idx %d\n",
                             func_ss, vq->name, vq->entries,
                             vq->last_used_idx, vq->used->idx, vq->desc_idx);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    boolean pending = vq_poll(vq, vq->budget);
+    if (!pending) {
+        vq->service_scheduled = false;
+        if (!vq->polling) {
+            vq_enable_events(vq);
 
-    spin_lock(&vq->lock);
-  poll:
-    vq_poll(vq);
-    if (!vq->polling && (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) &&
-        (vq->last_used_idx != *vq->used_event)) {
-        *vq->used_event = vq->last_used_idx;
-        /* Poll again, to cover cases where a new buffer has been used after the previous poll but
-         * before updating used_event. */
-        goto poll;
+            /* Cover cases where a new buffer has been used after the previous poll but before
+             * enabling events. */
+            memory_barrier();
+            if (vq_used_pending(vq) &&
+                compare_and_swap_boolean(&vq->service_scheduled, false, true)) {
+                vq_disable_events(vq);
+                pending = true;
+            }
+        }
     }
     virtqueue_fill(vq);
-    virtqueue_debug("%s: EXIT: vq %s: last_used_idx %d, desc_idx %d\n",
-                    func_ss, vq->name, vq->last_used_idx, vq->desc_idx);
+    virtqueue_debug("%s: EXIT: vq %s: last_used_idx %d, desc_idx %d, pending %d\n",
+                    func_ss, vq->name, vq->last_used_idx, vq->desc_idx, pending);
+    spin_unlock_irq(&vq->lock, irqflags);
+    if (pending) {
+        vq->service_deferred = !vq->service_deferred;
+        if (vq->service_deferred)
+            async_apply((thunk)&vq->service);
+        else
+            async_apply_bh((thunk)&vq->service);
+    }
+}
+
+closure_function(1, 0, void, vq_interrupt,
+                 virtqueue, vq)
+{
+    virtqueue vq = bound(vq);
+    if (!compare_and_swap_boolean(&vq->service_scheduled, false, true))
+        return;
+    spin_lock(&vq->lock);
+    if (!vq->polling)
+        vq_disable_events(vq);
     spin_unlock(&vq->lock);
+    vq->service_deferred = false;
+    async_apply_bh((thunk)&vq->service);
 }
 
 status virtqueue_alloc(vtdev dev,
@@ -250,13 +417,24 @@ status virtqueue_alloc(vtdev dev,
                        virtqueue *vqp,
                        thunk *t)
 {
+    boolean packed = (dev->features & VIRTIO_F_RING_PACKED) != 0;
     u64 vq_alloc_size = sizeof(struct virtqueue) + size * sizeof(vqmsg);
+    if (packed)
+        vq_alloc_size += size * sizeof(u16);    /* next_id */
     virtqueue vq = allocate_zero(dev->general, vq_alloc_size);
-    bytes avail_offset = size * sizeof(struct vring_desc);
-    bytes used_offset = pad(avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size +
-                            sizeof(u16) /* used_event */, align);
-    bytes alloc = used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size +
-                                    sizeof(u16) /* avail_event */, align);
+    bytes avail_offset, used_offset, alloc;
+    if (packed) {
+        /* descriptor ring, followed by the driver and device event suppression structures */
+        avail_offset = size * sizeof(struct vring_packed_desc);
+        used_offset = avail_offset + sizeof(struct vring_packed_desc_event);
+        alloc = used_offset + sizeof(struct vring_packed_desc_event);
+    } else {
+        avail_offset = size * sizeof(struct vring_desc);
+        used_offset = pad(avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size +
+                          sizeof(u16) /* used_event */, align);
+        alloc = used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size +
+                                  sizeof(u16) /* avail_event */, align);
+    }
     
     if (vq == INVALID_ADDRESS) 
         return timm("status", "cannot allocate virtqueue");
@@ -281,16 +459,34 @@ status virtqueue_alloc(vtdev dev,
     vq->desc = (struct vring_desc *) vq->ring_mem;
     vq->avail = (struct vring_avail *) (vq->ring_mem + avail_offset);
     vq->used = (struct vring_used *) (vq->ring_mem + used_offset);
-    virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p\n",
-                    func_ss, vq, vq->desc, vq->avail, vq->used);
-    vq->avail_event = (void *)(vq->used + 1) + sizeof(vq->used->ring[0]) * size;
-    vq->used_event = (void *)(vq->avail + 1) + sizeof(vq->avail->ring[0]) * size;
+    virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p%s\n",
+                    func_ss, vq, vq->desc, vq->avail, vq->used,
+                    packed ? ss(" (packed)") : sstring_empty());
     vq->events_enabled = true;
+    vq->budget = VQ_POLL_BUDGET;
+    init_closure_func(&vq->service, thunk, vq_service);
+
+    if (packed) {
+        vq->packed = true;
+        vq->packed_desc = vq->ring_mem;
+        vq->driver_event = vq->ring_mem + avail_offset;
+        vq->device_event = vq->ring_mem + used_offset;
+        vq->avail_wrap = vq->used_wrap = true;
+        vq->next_id = (u16 *)(vq->msgs + size);
+
+        // initialize buffer id free list
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->next_id[i] = i + 1;
+        vq->next_id[vq->entries - 1] = VQ_RING_DESC_CHAIN_END;
+    } else {
+        vq->avail_event = (void *)(vq->used + 1) + sizeof(vq->used->ring[0]) * size;
+        vq->used_event = (void *)(vq->avail + 1) + sizeof(vq->avail->ring[0]) * size;
 
-    // initialize descriptor chains
-    for (int i = 0; i < vq->entries - 1; i++)
-        vq->desc[i].next = i + 1;
-    vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+        // initialize descriptor chains
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->desc[i].next = i + 1;
+        vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+    }
 
     *t = closure(dev->general, vq_interrupt, vq);
     *vqp = vq;
@@ -322,18 +518,55 @@ u16 virtqueue_free_entries(virtqueue vq)
     return vq->free_cnt;
 }
 
+static void vq_enable_events_packed(virtqueue vq)
+{
+    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) {
+        u32 off = vq->last_used_idx;
+        boolean wrap = vq->used_wrap;
+        if (vq->delayed_events) {
+            u32 pending = vq->next_avail_idx - vq->last_used_idx;
+            if (vq->avail_wrap != vq->used_wrap)
+                pending += vq->entries;
+            off += pending * 3 / 4;
+            if (off >= vq->entries) {
+                off -= vq->entries;
+                wrap = !wrap;
+            }
+        }
+        vq->driver_event->off_wrap = off | (wrap << VRING_PACKED_EVENT_WRAP_SHIFT);
+
+        /* the event offset must be visible before the flags that enable it */
+        write_barrier();
+        vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+    } else {
+        vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+}
+
 static void vq_enable_events(virtqueue vq)
 {
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
-        *vq->used_event = vq->last_used_idx;
-    else
+    if (vq->packed) {
+        vq_enable_events_packed(vq);
+    } else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) {
+        u16 used_event = vq->last_used_idx;
+
+        /* Coalesce interrupts by requesting one only when 3/4 of the pending buffers have been
+         * used: pending buffers are guaranteed to be used without further action by the driver
+         * only on some queues (e.g. transmit queues), thus this is enabled per queue. */
+        if (vq->delayed_events)
+            used_event += (u16)(vq->avail->idx - vq->last_used_idx) * 3 / 4;
+        *vq->used_event = used_event;
+    } else {
         vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+    }
     vq->events_enabled = true;
 }
 
 static void vq_disable_events(virtqueue vq)
 {
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
+    if (vq->packed)
+        vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
         /* set an arbitrary value, we will still receive an interrupt every 64K messages */
         *vq->used_event = (u16)-1;
     else
@@ -350,13 +583,42 @@ void virtqueue_set_polling(virtqueue vq, boolean enable)
     vq->polling = enable;
 }
 
+void virtqueue_set_budget(virtqueue vq, u16 budget)
+{
+    vq->budget = budget ? budget : VQ_POLL_BUDGET;
+}
+
+void virtqueue_set_delayed_events(virtqueue vq, boolean enable)
+{
+    vq->delayed_events = enable;
+}
+
+void virtqueue_set_io_poll(virtqueue vq, boolean enable)
+{
+    if (enable)
+        io_poll_init(&vq->poll);
+    vq->io_poll = enable;
+}
+
 static int virtqueue_notify(virtqueue vq, u16 added)
 {
     // ensure used->flags update is visible to us
     // and updated avail->idx is visible to host
     memory_barrier();
     int should_notify;
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
+    if (vq->packed) {
+        u16 flags = vq->device_event->flags;
+        if (flags == VRING_PACKED_EVENT_FLAG_DESC) {
+            u16 off_wrap = vq->device_event->off_wrap;
+            u16 event_idx = off_wrap & MASK(VRING_PACKED_EVENT_WRAP_SHIFT);
+            if ((off_wrap >> VRING_PACKED_EVENT_WRAP_SHIFT) != vq->avail_wrap)
+                event_idx -= vq->entries;
+            u16 new_idx = vq->next_avail_idx;
+            should_notify = ((u16)(new_idx - event_idx - 1) < added);
+        } else {
+            should_notify = (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+        }
+    } else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
         should_notify = ((vq->avail->idx - *vq->avail_event - 1) < added) || (added == vq->entries);
     else
         should_notify = ((vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0);
@@ -365,6 +627,74 @@ static int virtqueue_notify(virtqueue vq, u16 added)
     return should_notify;
 }
 
+static void vq_add_split(virtqueue vq, vqmsg m)
+{
+    u16 head = vq->desc_idx;
+    vq->msgs[head] = m;
+
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        volatile struct vring_desc *d = vq->desc + vq->desc_idx;
+        d->busaddr = src->busaddr;
+        d->len = src->len;
+        d->flags = src->flags;
+        if (i < m->count - 1)
+            d->flags |= VRING_DESC_F_NEXT;
+        vq->desc_idx = d->next;
+
+        virtqueue_debug_verbose("      - desc_idx %d, vring_desc %p, busaddr 0x%lx, "
+                                "len 0x%x, flags 0x%x, next %d\n", vq->desc_idx, d, d->busaddr,
+                                d->len, d->flags, d->next);
+    }
+
+    u16 avail_idx = vq->avail->idx & (vq->entries - 1);
+    vq->avail->ring[avail_idx] = head;
+    virtqueue_debug_verbose("      avail->ring[%d] = %d\n", avail_idx, head);
+    fetch_and_add(&vq->free_cnt, -m->count);
+
+    // ensure desc and avail ring updates above are visible before updating avail->idx
+    write_barrier();
+    vq->avail->idx++;
+}
+
+static void vq_add_packed(virtqueue vq, vqmsg m)
+{
+    u16 id = vq->desc_idx;
+    vq->desc_idx = vq->next_id[id];
+    vq->msgs[id] = m;
+
+    u16 head = vq->next_avail_idx;
+    u16 head_flags = 0;
+    u16 idx = head;
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        volatile struct vring_packed_desc *d = vq->packed_desc + idx;
+        d->busaddr = src->busaddr;
+        d->len = src->len;
+        d->id = id;
+        u16 flags = src->flags | (vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL :
+                                  VRING_PACKED_DESC_F_USED);
+        if (i < m->count - 1)
+            flags |= VRING_DESC_F_NEXT;
+
+        /* the head descriptor is made available last, after the whole chain is written */
+        if (i == 0)
+            head_flags = flags;
+        else
+            d->flags = flags;
+        virtqueue_debug_verbose("      - idx %d, id %d, busaddr 0x%lx, len 0x%x, flags 0x%x\n",
+                                idx, id, d->busaddr, d->len, flags);
+        if (++idx == vq->entries) {
+            idx = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
+    vq->next_avail_idx = idx;
+    fetch_and_add(&vq->free_cnt, -m->count);
+    write_barrier();
+    vq->packed_desc[head].flags = head_flags;
+}
+
 /* called with lock held */
 static void virtqueue_fill(virtqueue vq)
 {
@@ -375,7 +705,7 @@ static void virtqueue_fill(virtqueue vq)
     u16 added = 0;
   begin:
     if (vq->polling)
-        vq_poll(vq);
+        vq_poll(vq, vq->entries);
     while (n && n != &vq->msg_queue) {
         vqmsg m = struct_from_list(n, vqmsg, l);
         virtqueue_debug_verbose("   vqmsg %p, count %d\n", m, m->count);
@@ -387,34 +717,14 @@ static void virtqueue_fill(virtqueue vq)
         assert(vq->free_cnt <= vq->entries);
 
         assert(m->completion);
-        u16 head = vq->desc_idx;
-        vq->msgs[head] = m;
-
-        for (int i = 0; i < m->count; i++) {
-            struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
-            volatile struct vring_desc *d = vq->desc + vq->desc_idx;
-            d->busaddr = src->busaddr;
-            d->len = src->len;
-            d->flags = src->flags;
-            if (i < m->count - 1)
-                d->flags |= VRING_DESC_F_NEXT;
-            vq->desc_idx = d->next;
-
-            virtqueue_debug_verbose("      - desc_idx %d, vring_desc %p, busaddr 0x%lx, "
-                                    "len 0x%x, flags 0x%x, next %d\n", vq->desc_idx, d, d->busaddr,
-                                    d->len, d->flags, d->next);
+        if (vq->packed) {
+            vq_add_packed(vq, m);
+            added += m->count;
+        } else {
+            vq_add_split(vq, m);
+            added++;
         }
 
-        u16 avail_idx = vq->avail->idx & (vq->entries - 1);
-        vq->avail->ring[avail_idx] = head;
-        virtqueue_debug_verbose("      avail->ring[%d] = %d\n", avail_idx, head);
-        fetch_and_add(&vq->free_cnt, -m->count);
-        added++;
-
-        // ensure desc and avail ring updates above are visible before updating avail->idx
-        write_barrier();
-        vq->avail->idx++;
-
         list nn = list_get_next(n);
         list_delete(n);
         n = nn;
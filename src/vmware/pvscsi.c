@@ -12,7 +12,6 @@
 # define pvscsi_debug(...) do { } while(0)
 #endif // defined(PVSCSI_DEBUG)
 
-#define PVSCSI_DEFAULT_NUM_PAGES_REQ_RING 8
 #define PVSCSI_CDB_SIZE 16
 #define PVSCSI_SENSE_SIZE 256
 #define PVSCSI_RETRY_LIMIT  3
@@ -54,6 +53,7 @@ typedef struct pvscsi {
 
     u32 max_targets;
     u32 adapter_queue_size;
+    boolean use_req_call_threshold;
 
     struct list hcb_queue;
     struct spinlock queue_lock;
@@ -116,6 +116,12 @@ static struct pvscsi_hcb *pvscsi_hcb_alloc(pvscsi dev, u16 target, u16 lun, u8 c
 }
 
 static boolean pvscsi_action_io(pvscsi dev, struct pvscsi_hcb *hcb);
+static void pvscsi_kick_io(pvscsi dev, boolean rw);
+
+static inline boolean pvscsi_cmd_is_rw(u8 cdb0)
+{
+    return (cdb0 == SCSI_CMD_READ_16 || cdb0 == SCSI_CMD_WRITE_16);
+}
 
 static void pvscsi_action_io_queued(pvscsi dev, struct pvscsi_hcb *hcb, u16 target, u16 lun,
                                     void *buf, u64 length)
@@ -138,9 +144,10 @@ static void pvscsi_action_io_queued(pvscsi dev, struct pvscsi_hcb *hcb, u16 targ
         return;
     }
 
-    if (!pvscsi_action_io(dev, hcb)) {
+    if (pvscsi_action_io(dev, hcb))
+        pvscsi_kick_io(dev, pvscsi_cmd_is_rw(hcb->cdb[0]));
+    else
         list_push_back(&dev->hcb_queue, &hcb->links);
-    }
     spin_unlock(&dev->queue_lock);
 }
 
@@ -418,6 +425,21 @@ closure_function(1, 0, void, intx_handler,
     pvscsi_process_cmp_ring(dev);
 }
 
+/* With the request call threshold feature, the device keeps processing the request ring while
+ * requests are outstanding, and read/write requests need a kick only when the number of pending
+ * requests reaches the threshold set by the device. */
+static boolean pvscsi_setup_req_call(pvscsi dev)
+{
+    pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_COMMAND, PVSCSI_CMD_SETUP_REQCALLTHRESHOLD);
+    if (pvscsi_reg_read(dev, PVSCSI_REG_OFFSET_COMMAND_STATUS) == -1)
+        return false;
+    struct pvscsi_cmd_desc_setup_req_call cmd;
+    zero(&cmd, sizeof(cmd));
+    cmd.enable = 1;
+    pvscsi_write_cmd(dev, PVSCSI_CMD_SETUP_REQCALLTHRESHOLD, &cmd, sizeof(cmd));
+    return pvscsi_reg_read(dev, PVSCSI_REG_OFFSET_COMMAND_STATUS) != 0;
+}
+
 static void *pvscsi_ring_alloc(heap h, int num_pages, void *ppn_list)
 {
     // allocate ring memory
@@ -458,6 +480,8 @@ closure_function(1, 0, void, pvscsi_rx_service_bh, pvscsi, dev)
         }
     }
 
+    /* the device is kicked once for all the requests submitted from the queue */
+    boolean submitted = false, rw = true;
     spin_lock(&dev->queue_lock);
     list_foreach(&dev->hcb_queue, i) {
         assert(i);
@@ -465,7 +489,11 @@ closure_function(1, 0, void, pvscsi_rx_service_bh, pvscsi, dev)
         if (!pvscsi_action_io(dev, hcb))
             break;
         list_delete(i);
+        submitted = true;
+        rw = rw && pvscsi_cmd_is_rw(hcb->cdb[0]);
     }
+    if (submitted)
+        pvscsi_kick_io(dev, rw);
     spin_unlock(&dev->queue_lock);
 }
 
@@ -515,12 +543,15 @@ static void pvscsi_attach(heap general, storage_attach a, heap page_allocator, p
     assert(pad(dev->contiguous->pagesize, PAGESIZE) == dev->contiguous->pagesize);
     struct pvscsi_cmd_desc_setup_rings cmd;
     zero((void *)&cmd, sizeof(cmd));
-    cmd.req_ring_num_pages = PVSCSI_DEFAULT_NUM_PAGES_REQ_RING;
-    cmd.cmp_ring_num_pages = cmd.req_ring_num_pages;
+    cmd.req_ring_num_pages = PVSCSI_MAX_NUM_PAGES_REQ_RING;
+    cmd.cmp_ring_num_pages = PVSCSI_MAX_NUM_PAGES_CMP_RING;
     dev->rings_state = pvscsi_ring_alloc(dev->contiguous, 1, cmd.rings_state_ppns);
     dev->req_ring = pvscsi_ring_alloc(dev->contiguous, cmd.req_ring_num_pages, cmd.req_ring_ppns);
     dev->cmp_ring = pvscsi_ring_alloc(dev->contiguous, cmd.cmp_ring_num_pages, cmd.cmp_ring_ppns);
     pvscsi_write_cmd(dev, PVSCSI_CMD_SETUP_RINGS, &cmd, sizeof(cmd));
+    dev->use_req_call_threshold = pvscsi_setup_req_call(dev);
+    pvscsi_debug("%s: request call threshold %s\n", func_ss,
+                 dev->use_req_call_threshold ? ss("enabled") : ss("disabled"));
 
 #ifdef PVSCSI_DEBUG
     volatile struct pvscsi_rings_state *s = dev->rings_state;
@@ -534,7 +565,8 @@ static void pvscsi_attach(heap general, storage_attach a, heap page_allocator, p
     // setup hcb cache
     dev->hcb_objcache = allocate_objcache(dev->general, page_allocator,
                                           sizeof(struct pvscsi_hcb), PAGESIZE_2M, true);
-    mm_register_mem_cleaner(init_closure_func(&dev->mem_cleaner, mem_cleaner, pvscsi_mem_cleaner));
+    mm_register_mem_cleaner(init_closure_func(&dev->mem_cleaner, mem_cleaner, pvscsi_mem_cleaner),
+                            ss("pvscsi"), MM_CLEANER_CACHE);
 
     dev->adapter_queue_size = cmd.req_ring_num_pages * PAGESIZE / sizeof(struct pvscsi_ring_req_desc);
     dev->adapter_queue_size = MIN(dev->adapter_queue_size, PVSCSI_MAX_REQ_QUEUE_DEPTH);
@@ -587,10 +619,13 @@ closure_function(3, 1, boolean, pvscsi_probe,
     return true;
 }
 
-static void pvscsi_kick_io(pvscsi dev, u8 cdb0)
+static void pvscsi_kick_io(pvscsi dev, boolean rw)
 {
-    if (cdb0 == SCSI_CMD_READ_16 || cdb0 == SCSI_CMD_WRITE_16) {
-        pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_RW_IO, 0);
+    if (rw) {
+        struct pvscsi_rings_state *s = dev->rings_state;
+        if (!dev->use_req_call_threshold ||
+            s->req_prod_idx - s->req_cons_idx >= s->req_call_threshold)
+            pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_RW_IO, 0);
     } else {
         pvscsi_reg_write(dev, PVSCSI_REG_OFFSET_KICK_NON_RW_IO, 0);
     }
@@ -607,8 +642,6 @@ static void pvscsi_execute_ccb(pvscsi dev, struct pvscsi_hcb *hcb)
 
     memory_barrier();
     s->req_prod_idx++;
-    pvscsi_kick_io(dev, cdb0);
-    pvscsi_debug("%s: kicked\n", func_ss);
 }
 
 static inline u64 pvscsi_hcb_to_context(pvscsi dev, struct pvscsi_hcb *hcb)
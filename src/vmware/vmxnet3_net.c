@@ -9,6 +9,7 @@
 #include "lwip/ethip6.h"
 #include "lwip/etharp.h"
 #include "lwip/dhcp.h"
+#include "lwip/inet_chksum.h"
 #include <pci.h>
 #include "netif/ethernet.h"
 #include "vmware.h"
@@ -21,15 +22,26 @@
 # define vmxnet3_net_debug(...) do { } while (0)
 #endif // defined(VMXNET3_NET_DEBUG)
 
+#define VMXNET3_RSS_HASH_TYPES                                  \
+    (UPT1_RSS_HASH_TYPE_IPV4 | UPT1_RSS_HASH_TYPE_TCP_IPV4 |    \
+     UPT1_RSS_HASH_TYPE_IPV6 | UPT1_RSS_HASH_TYPE_TCP_IPV6)
+
+typedef struct vmxnet3_rx {
+    vmxnet3 vn;
+    struct vmxnet3_rxqueue *rxq;
+    closure_struct(thunk, intr_handler);
+    closure_struct(thunk, service);     /* for bhqueue processing */
+    queue servicequeue;
+} *vmxnet3_rx;
+
 typedef struct vmxnet3 {
     struct netif_dev ndev;
     vmxnet3_pci dev;
     caching_heap rxbuffers;
     int rxbuflen;
     closure_struct(mem_cleaner, mem_cleaner);
-    thunk rx_intr_handler;
-    thunk rx_service;           /* for bhqueue processing */
-    queue rx_servicequeue;
+    struct vmxnet3_txqueue **txq_map;   /* indexed by CPU */
+    vmxnet3_rx rx;
 } *vmxnet3;
 
 typedef struct xpbuf
@@ -39,12 +51,16 @@ typedef struct xpbuf
     struct list l;
 } *xpbuf;
 
-static void vmxnet3_interrupts_enable(vmxnet3_pci dev)
+static void vmxnet3_rx_intr_enable(vmxnet3_pci dev, struct vmxnet3_rxqueue *rxq)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 0);
 }
 
+static void vmxnet3_rx_intr_disable(vmxnet3_pci dev, struct vmxnet3_rxqueue *rxq)
+{
+    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
+}
+
 boolean vmxnet3_probe(pci_dev d)
 {
     if (pci_get_vendor(d) != VMXNET3_VMWARE_VENDOR_ID)
@@ -99,21 +115,30 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
 
     vmx_ds->vmxnet3_revision = VMXNET3_REVISION;
     vmx_ds->upt_version = VMXNET3_UPT_VERSION;
-    vmx_ds->upt_features = 0;
+    /* LRO requires Rx checksum offload (see vmxnet3_rx_csum()) */
+    vmx_ds->upt_features = UPT1_F_CSUM | UPT1_F_LRO;
     vmx_ds->driver_data = physical_from_virtual(dev);
     assert(vmx_ds->driver_data != INVALID_PHYSICAL);
     vmx_ds->driver_data_len = sizeof(struct vmxnet3);
     // queue_shared & queue_shared_len are in
     // vmxnet3_queues_shared_alloc()
-    vmx_ds->mtu = VMXNET3_RX_MAXSEGSIZE - sizeof(struct eth_hdr);
+    vmx_ds->mtu = VMXNET3_MTU;
     vmx_ds->nrxsg_max = VMXNET3_MAX_RX_SEGS;
-    vmx_ds->ntxqueue = VMXNET3_DEF_TX_QUEUES;
-    vmx_ds->nrxqueue = VMXNET3_DEF_RX_QUEUES;
+    vmx_ds->ntxqueue = dev->nqueues;
+    vmx_ds->nrxqueue = dev->nqueues;
 
+    /* interrupt 0 is shared by events and Tx queues, followed by one for each Rx queue */
     vmx_ds->automask = 0;
-    vmx_ds->nintr = 2;
+    vmx_ds->nintr = 1 + dev->nqueues;
     vmx_ds->evintr = 0;
 
+    if (dev->vmx_rss) {
+        vmx_ds->upt_features |= UPT1_F_RSS;
+        vmx_ds->rss.version = VMXNET3_RSS_VERSION;
+        vmx_ds->rss.paddr = physical_from_virtual(dev->vmx_rss);
+        vmx_ds->rss.len = sizeof(*dev->vmx_rss);
+    }
+
     vmx_ds->rxmode = VMXNET3_RXMODE_UCAST | VMXNET3_RXMODE_MCAST | VMXNET3_RXMODE_BCAST |
         VMXNET3_RXMODE_ALLMULTI;
 
@@ -130,29 +155,29 @@ void init_vmxnet3_driver_shared(vmxnet3_pci dev)
 
 static void vmxnet3_interrupts_disable(vmxnet3_pci dev)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
-    struct vmxnet3_txqueue *txq = dev->vmx_txq[0];
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(rxq->vxrxq_intr_idx), 1);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(txq->vxtxq_intr_idx), 1);
+    for (int i = 0; i < dev->nqueues; i++)
+        vmxnet3_rx_intr_disable(dev, dev->vmx_rxq[i]);
+    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_IMASK(dev->vmx_txq[0]->vxtxq_intr_idx), 1);
 }
 
-static void kick_pending(vmxnet3_pci dev)
+static void kick_pending(vmxnet3_pci dev, struct vmxnet3_txqueue *vmx_txq)
 {
-    struct vmxnet3_txqueue* vmx_txq = dev->vmx_txq[0];
     if (vmx_txq->vxtxq_ts->npending) {
         vmx_txq->vxtxq_ts->npending = 0;
-        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(0), vmx_txq->vxtxq_cmd_ring.vxtxr_head);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_TXH(vmx_txq->vxtxq_id),
+                        vmx_txq->vxtxq_cmd_ring.vxtxr_head);
     }
 }
 
 static err_t low_level_output(struct netif *netif, struct pbuf *p)
 {
     vmxnet3 vn = netif->state;
+    struct vmxnet3_txqueue *txq = vn->txq_map[current_cpu()->id];
 
-    err_t e = vmxnet3_isc_txd_encap(vn->dev, p);
+    err_t e = vmxnet3_isc_txd_encap(txq, p);
     if (e != ERR_OK)
         return e;
-    kick_pending(vn->dev)
+    kick_pending(vn->dev, txq);
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -212,22 +237,24 @@ static err_t vmxif_init(struct netif *netif)
         __func__,
         netif->hwaddr[0], netif->hwaddr[1], netif->hwaddr[2],
         netif->hwaddr[3], netif->hwaddr[4], netif->hwaddr[5]);
-    netif->mtu = vn->dev->vmx_ds->mtu;
+    netif->mtu = VMXNET3_MTU;
 
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
-    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_LINK_UP | NETIF_FLAG_UP;
+    /* the link is brought up when the device queues are set up (see vmxnet3_setup()) */
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_UP;
 
+    /* TCP checksums of received packets are verified by the device (see vmxnet3_rx_csum()) */
+    NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_CHECK_TCP);
     return ERR_OK;
 }
 
-static void process_interrupt(vmxnet3 vn);
+static void process_interrupt(vmxnet3_rx rx);
 
-closure_function(1, 0, void, rx_interrupt,
-                 vmxnet3, vn)
+closure_func_basic(thunk, void, rx_interrupt)
 {
-    vmxnet3 vn = bound(vn);
-    process_interrupt(vn);
+    vmxnet3_rx rx = struct_from_field(closure_self(), vmxnet3_rx, intr_handler);
+    process_interrupt(rx);
 }
 
 static void receive_buffer_release(struct pbuf *p)
@@ -236,12 +263,12 @@ static void receive_buffer_release(struct pbuf *p)
     deallocate((heap)x->vn->rxbuffers, x, x->vn->rxbuflen + sizeof(struct xpbuf));
 }
 
-closure_function(1, 0, void, vmxnet3_rx_service_bh,
-                 vmxnet3, vn)
+closure_func_basic(thunk, void, vmxnet3_rx_service_bh)
 {
-    vmxnet3 vn = bound(vn);
+    vmxnet3_rx rx = struct_from_field(closure_self(), vmxnet3_rx, service);
+    vmxnet3 vn = rx->vn;
     list l;
-    while ((l = (list)dequeue(vn->rx_servicequeue)) != INVALID_ADDRESS) {
+    while ((l = (list)dequeue(rx->servicequeue)) != INVALID_ADDRESS) {
         struct list q;
         assert(l);
         assert(l->prev);
@@ -260,7 +287,7 @@ closure_function(1, 0, void, vmxnet3_rx_service_bh,
     }
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid);
+void vmxnet3_newbuf(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, int rid);
 
 closure_func_basic(mem_cleaner, u64, vmxnet3_mem_cleaner,
                    u64 clean_bytes)
@@ -324,7 +351,7 @@ static void test_shared(vmxnet3 vn)
         assert(rxr->vxrxr_desc_skips == 0);
         assert(rxr->vxrxr_refill_start == 0);
         for(int j = 0; j<rxr->vxrxr_ndesc; ++j) {
-            assert(rxr->vxrxr_rxd[j].addr == physical_from_virtual(dev->rx_pbuf[i][j]->payload));
+            assert(rxr->vxrxr_rxd[j].addr == physical_from_virtual(dev->vmx_rxq[0]->vxrxq_pbuf[i][j]->payload));
             assert(rxr->vxrxr_rxd[j].btype == (i == 0 ? VMXNET3_BTYPE_HEAD : VMXNET3_BTYPE_BODY));
             assert(rxr->vxrxr_rxd[j].dtype == 0);
             assert(rxr->vxrxr_rxd[j].len == vn->rxbuflen);
@@ -345,6 +372,112 @@ static void test_shared(vmxnet3 vn)
 #endif
 }
 
+static void vmxnet3_rss_alloc(vmxnet3_pci dev)
+{
+    struct vmxnet3_rss_shared *rss = allocate_zero(dev->contiguous, sizeof(*rss));
+    assert(rss != INVALID_ADDRESS);
+    rss->hash_type = VMXNET3_RSS_HASH_TYPES;
+    rss->hash_func = UPT1_RSS_HASH_FUNC_TOEPLITZ;
+    rss->hash_key_size = UPT1_RSS_MAX_KEY_SIZE;
+    rss->ind_table_size = UPT1_RSS_MAX_IND_TABLE_SIZE;
+    for (int i = 0; i < UPT1_RSS_MAX_KEY_SIZE; i += sizeof(u64)) {
+        u64 r = random_u64();
+        runtime_memcpy(rss->hash_key + i, &r, MIN(sizeof(r), UPT1_RSS_MAX_KEY_SIZE - i));
+    }
+    for (int i = 0; i < UPT1_RSS_MAX_IND_TABLE_SIZE; i++)
+        rss->ind_table[i] = i % dev->nqueues;
+    dev->vmx_rss = rss;
+}
+
+/* As in virtio-net, queue pairs are assigned to groups of CPUs: each CPU transmits on the Tx queue
+   of its group, and the interrupt of the Rx queue of the pair is affine to the same group, so that
+   flows steered to an Rx queue by RSS are processed on the CPUs that transmit on them. */
+closure_func_basic(netif_dev_setup, boolean, vmxnet3_setup,
+                   tuple config)
+{
+    vmxnet3 vn = struct_from_closure(vmxnet3, ndev.setup);
+    vmxnet3_pci dev = vn->dev;
+    heap h = dev->general;
+    u64 nqueues;
+    if (!config || !get_u64(config, sym_this("io-queues"), &nqueues) || (nqueues == 0))
+        nqueues = VMXNET3_MAX_QUEUE_PAIRS;
+    nqueues = MIN(MIN(nqueues, VMXNET3_MAX_QUEUE_PAIRS), total_processors);
+
+    /* one interrupt for each Rx queue, plus one for events */
+    if (dev->msix_count < 2) {
+        msg_err("insufficient MSI-X vectors (%d)\n", dev->msix_count);
+        return false;
+    }
+    nqueues = MIN(nqueues, dev->msix_count - 1);
+    dev->nqueues = nqueues;
+    vmxnet3_net_debug("%s: using %ld queue pairs\n", func_ss, nqueues);
+
+    vmxnet3_tx_queues_alloc(dev);
+    vmxnet3_rx_queues_alloc(dev);
+
+    vmxnet3_queues_shared_alloc(dev);
+    vmxnet3_set_interrupt_idx(dev);
+
+    vn->rx = allocate(h, nqueues * sizeof(*vn->rx));
+    assert(vn->rx != INVALID_ADDRESS);
+    vn->txq_map = allocate(h, total_processors * sizeof(vn->txq_map[0]));
+    assert(vn->txq_map != INVALID_ADDRESS);
+    u64 cpus_per_q = total_processors / nqueues;
+    u64 excess_cpus = total_processors - cpus_per_q * nqueues;
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u64 i = 0; i < nqueues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_q + 1) : cpus_per_q;
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            vn->txq_map[j] = dev->vmx_txq[i];
+
+        vmxnet3_rx rx = &vn->rx[i];
+        rx->vn = vn;
+        rx->rxq = dev->vmx_rxq[i];
+        rx->servicequeue = allocate_queue(h, VMXNET3_RX_SERVICEQUEUE_DEPTH);
+        assert(rx->servicequeue != INVALID_ADDRESS);
+        init_closure_func(&rx->service, thunk, vmxnet3_rx_service_bh);
+        if (pci_setup_msix_aff(dev->dev, rx->rxq->vxrxq_intr_idx,
+                               init_closure_func(&rx->intr_handler, thunk, rx_interrupt),
+                               ss("vmxnet3 rx"), irangel(first_cpu, num_cpus)) ==
+            INVALID_PHYSICAL) {
+            msg_err("failed to set up interrupt for rx queue %ld\n", i);
+            return false;
+        }
+        // interrupts are not used for tx
+
+        for (int r = 0; r < VMXNET3_RXRINGS_PERQ; r++) {
+            for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
+                vmxnet3_newbuf(vn, rx->rxq, r);
+        }
+    }
+    if (nqueues > 1)
+        vmxnet3_rss_alloc(dev);
+
+    vmxnet3_init_shared_data(dev);
+
+    /* Check device versions */
+    vmxnet3_check_version(dev);
+
+    vmxnet3_interrupts_disable(dev);
+
+    /* enable device */
+    init_vmxnet3_driver_shared(dev);
+    test_shared(vn);
+    u32 status = vmxnet3_read_cmd(dev, VMXNET3_CMD_ENABLE);
+    if (status != 0) {
+        msg_err("failed to enable device (status 0x%x)\n", status);
+        return false;
+    }
+    for (int i = 0; i < nqueues; i++) {
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(i), 0);
+        pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(i), 0);
+        vmxnet3_rx_intr_enable(dev, dev->vmx_rxq[i]);
+    }
+    netif_set_link_up(&vn->ndev.n);
+    return true;
+}
+
 static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
 {
     struct vmxnet3_pci *dev = allocate(general, sizeof(struct vmxnet3_pci));
@@ -357,10 +490,12 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
 
     pci_set_bus_master(dev->dev);
     pci_enable_io_and_memory(d);
-    pci_enable_msix(dev->dev);
+    dev->msix_count = pci_enable_msix(dev->dev);
 
     dev->general = general;
     dev->contiguous = page_allocator;
+    dev->nqueues = 0;
+    dev->vmx_rss = 0;
 
     vmxnet3_write_cmd(dev, VMXNET3_CMD_DISABLE);
     vmxnet3_write_cmd(dev, VMXNET3_CMD_RESET);
@@ -368,56 +503,27 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
     vmxnet3 vn = allocate(dev->general, sizeof(struct vmxnet3));
     assert(vn != INVALID_ADDRESS);
     vn->dev = dev;
+    vn->txq_map = 0;
+    vn->rx = 0;
     netif_dev_init(&vn->ndev);
+    init_closure_func(&vn->ndev.setup, netif_dev_setup, vmxnet3_setup);
 
     vn->rxbuflen = VMXNET3_RX_MAXSEGSIZE;
     vn->rxbuffers = allocate_objcache(dev->general, page_allocator,
                                       vn->rxbuflen + sizeof(struct xpbuf), PAGESIZE_2M, true);
     assert(vn->rxbuffers != INVALID_ADDRESS);
-    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vmxnet3_mem_cleaner));
+    mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vmxnet3_mem_cleaner),
+                            ss("vmxnet3"), MM_CLEANER_CACHE);
 
     dev->vmx_ds = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_driver_shared));
     assert(dev->vmx_ds != INVALID_ADDRESS);
 
-    vn->rx_servicequeue = allocate_queue(dev->general, VMXNET3_RX_SERVICEQUEUE_DEPTH);
-    assert(vn->rx_servicequeue != INVALID_ADDRESS);
-    vn->rx_service = closure(dev->general, vmxnet3_rx_service_bh, vn);
-
-    vn->rx_intr_handler = closure(dev->general, rx_interrupt, vn);
-    assert(pci_setup_msix(dev->dev, 1, vn->rx_intr_handler, ss("vmxnet3 rx")) != INVALID_PHYSICAL);
-    // interrupts are not used for tx
-
-    vmxnet3_tx_queues_alloc(dev);
-    vmxnet3_rx_queues_alloc(dev);
-
-    vmxnet3_queues_shared_alloc(dev);
-
-    for (int i = 0; i < VMXNET3_RXRINGS_PERQ; i++) {
-        for (int idx = 0; idx < VMXNET3_MAX_RX_NDESC; idx++)
-            vmxnet3_newbuf(vn, i);
-    }
-
-    vmxnet3_init_shared_data(dev);
-
-    /* Check device versions */
-    vmxnet3_check_version(dev);
-
-    vmxnet3_set_interrupt_idx(dev);
-
-    vmxnet3_interrupts_disable(dev);
-
-    /* enable device */
-    init_vmxnet3_driver_shared(dev);
-    test_shared(vn);
-    vmxnet3_read_cmd(dev, VMXNET3_CMD_ENABLE);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), 0);
-    pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), 0);
+    /* queues are allocated and the device is enabled in vmxnet3_setup() */
     netif_add(&vn->ndev.n,
               0, 0, 0,
               vn,
               vmxif_init,
               ethernet_input);
-    vmxnet3_interrupts_enable(dev);
 }
 
 closure_function(2, 1, boolean, vmxnet3_net_probe,
@@ -439,9 +545,8 @@ void init_vmxnet3_network(kernel_heaps kh)
     register_pci_driver(closure(h, vmxnet3_net_probe, h, (heap)heap_linear_backed(kh)), 0);
 }
 
-static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
+static void vmxnet3_discard(struct vmxnet3_rxqueue *rxq, int rid, int idx)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
     struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
     rxd->gen = rxr->vxrxr_gen;
@@ -451,10 +556,8 @@ static void vmxnet3_discard(vmxnet3_pci dev, int rid, int idx)
     }
 }
 
-void vmxnet3_newbuf(vmxnet3 vdev, int rid)
+void vmxnet3_newbuf(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, int rid)
 {
-    vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
 
     int idx = rxr->vxrxr_refill_start;
@@ -472,7 +575,7 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
                         x+1,
                         vdev->rxbuflen);
 
-    dev->rx_pbuf[rid][idx] = (struct pbuf*)x;
+    rxq->vxrxq_pbuf[rid][idx] = (struct pbuf*)x;
 
     rxd->addr = physical_from_virtual(x+1);
     assert(rxd->addr != INVALID_PHYSICAL);
@@ -487,10 +590,75 @@ void vmxnet3_newbuf(vmxnet3 vdev, int rid)
     }
 }
 
-void vmxnet3_receive(vmxnet3 vdev, struct list *l)
+/* Verifies in software the TCP checksum of a received packet; only IPv4 and IPv6 packets without
+   extension headers are parsed, as these are the packets that carry TCP segments not recognized by
+   the device. TCP segments in IP fragments are rejected, since their checksum can only be verified
+   after reassembly. */
+static boolean vmxnet3_rx_tcp_csum_sw(struct pbuf *p)
+{
+    struct eth_hdr *ethhdr = p->payload;
+    if (p->len < SIZEOF_ETH_HDR)
+        return true;
+    u16 hlen, tcplen, sum;
+    if (ethhdr->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr *iph = p->payload + SIZEOF_ETH_HDR;
+        if ((p->len < SIZEOF_ETH_HDR + IP_HLEN) || (IPH_PROTO(iph) != IP_PROTO_TCP))
+            return true;
+        if (IPH_OFFSET(iph) & PP_HTONS(IP_OFFMASK | IP_MF))
+            return false;
+        hlen = IPH_HL_BYTES(iph);
+        u16 len = lwip_ntohs(IPH_LEN(iph));
+        /* malformed packets are dropped by lwIP */
+        if ((hlen < IP_HLEN) || (len < hlen) || (SIZEOF_ETH_HDR + len > p->tot_len) ||
+            (p->len < SIZEOF_ETH_HDR + hlen))
+            return true;
+        ip4_addr_t src, dest;
+        ip4_addr_copy(src, iph->src);
+        ip4_addr_copy(dest, iph->dest);
+        tcplen = len - hlen;
+        hlen += SIZEOF_ETH_HDR;
+        pbuf_remove_header(p, hlen);
+        sum = ip4_chksum_pseudo_partial(p, IP_PROTO_TCP, tcplen, tcplen, &src, &dest);
+    } else if (ethhdr->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr *ip6h = p->payload + SIZEOF_ETH_HDR;
+        if (p->len < SIZEOF_ETH_HDR + IP6_HLEN)
+            return true;
+        if (IP6H_NEXTH(ip6h) == IP6_NEXTH_FRAGMENT) {
+            struct ip6_frag_hdr *frag = (struct ip6_frag_hdr *)(ip6h + 1);
+            return ((p->len < SIZEOF_ETH_HDR + IP6_HLEN + IP6_FRAG_HLEN) ||
+                    (frag->_nexth != IP6_NEXTH_TCP));
+        }
+        if (IP6H_NEXTH(ip6h) != IP6_NEXTH_TCP)
+            return true;
+        tcplen = IP6H_PLEN(ip6h);
+        if (SIZEOF_ETH_HDR + IP6_HLEN + tcplen > p->tot_len)
+            return true;
+        ip6_addr_t src, dest;
+        ip6_addr_copy_from_packed(src, ip6h->src);
+        ip6_addr_copy_from_packed(dest, ip6h->dest);
+        hlen = SIZEOF_ETH_HDR + IP6_HLEN;
+        pbuf_remove_header(p, hlen);
+        sum = ip6_chksum_pseudo_partial(p, IP6_NEXTH_TCP, tcplen, tcplen, &src, &dest);
+    } else {
+        return true;
+    }
+    pbuf_add_header(p, hlen);
+    return (sum == 0);
+}
+
+/* The TCP checksums of aggregated (LRO) packets are not valid on the wire, so lwIP does not check
+   TCP checksums on this interface: packets are accepted if the device verified their checksum, or
+   otherwise checked in software. */
+static boolean vmxnet3_rx_csum(struct pbuf *p, struct vmxnet3_rxcompdesc *rxcd)
+{
+    if (!rxcd->no_csum && rxcd->tcp && rxcd->csum_ok)
+        return true;
+    return vmxnet3_rx_tcp_csum_sw(p);
+}
+
+void vmxnet3_receive(vmxnet3 vdev, struct vmxnet3_rxqueue *rxq, struct list *l)
 {
     vmxnet3_pci dev = vdev->dev;
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_comp_ring *rxc = &rxq->vxrxq_comp_ring;
 
     for(;;) {
@@ -500,19 +668,20 @@ void vmxnet3_receive(vmxnet3 vdev, struct list *l)
             break;
         read_barrier();
 
-        assert(rxcd->qid < VMXNET3_RXRINGS_PERQ);
-
         if (++rxc->vxcr_next == rxc->vxcr_ndesc) {
             rxc->vxcr_next = 0;
             rxc->vxcr_gen ^= 1;
         }
 
-        u32 rid = rxcd->qid;
+        /* the qid of a completion identifies the command ring: ring 0 of Rx queue q has qid q,
+           ring 1 has qid q + the number of Rx queues */
+        u32 rid = (rxcd->qid == rxq->vxrxq_id) ? 0 : 1;
+        assert(rxcd->qid == rxq->vxrxq_id + rid * dev->nqueues);
         u32 idx = rxcd->rxd_idx;
         u32 length = rxcd->len;
         struct vmxnet3_rxring *rxr = &rxq->vxrxq_cmd_ring[rid];
         struct vmxnet3_rxdesc *rxd = &rxr->vxrxr_rxd[idx];
-        struct pbuf *m = dev->rx_pbuf[rid][idx];
+        struct pbuf *m = rxq->vxrxq_pbuf[rid][idx];
 
         assert(m != NULL);
 
@@ -525,78 +694,84 @@ void vmxnet3_receive(vmxnet3 vdev, struct list *l)
         }
 
         if (rxcd->eop && rxcd->error) {
-            vmxnet3_discard(dev, rid, idx);
+            vmxnet3_discard(rxq, rid, idx);
             goto next;
         }
 
         /* Check and handle SOP/EOP state errors */
-        if (rxcd->sop && dev->currpkt_head) {
-            receive_buffer_release(dev->currpkt_head);
-            dev->currpkt_head = dev->currpkt_tail =  NULL;
-        } else if (!rxcd->sop && !dev->currpkt_head) {
-            vmxnet3_discard(dev, rid, idx);
+        if (rxcd->sop && rxq->vxrxq_currpkt_head) {
+            receive_buffer_release(rxq->vxrxq_currpkt_head);
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail =  NULL;
+        } else if (!rxcd->sop && !rxq->vxrxq_currpkt_head) {
+            vmxnet3_discard(rxq, rid, idx);
             goto next;
         }
 
        if (rxcd->sop) {
             assert(rxd->btype == VMXNET3_BTYPE_HEAD);
             assert((idx % 1) == 0);
-            assert(dev->currpkt_head == NULL);
+            assert(rxq->vxrxq_currpkt_head == NULL);
 
             if (length == 0) {
-                vmxnet3_discard(dev, rid, idx);
+                vmxnet3_discard(rxq, rid, idx);
                 goto next;
             }
 
             m->tot_len = length;
             m->len = length;
 
-            dev->currpkt_head = dev->currpkt_tail = m;
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail = m;
         } else {
             assert(rxd->btype == VMXNET3_BTYPE_BODY);
-            assert(dev->currpkt_head != NULL);
+            assert(rxq->vxrxq_currpkt_head != NULL);
 
             m->len = length;
-            dev->currpkt_head->tot_len += length;
-            dev->currpkt_tail->next = m;
-            dev->currpkt_tail = m;
+            rxq->vxrxq_currpkt_head->tot_len += length;
+            rxq->vxrxq_currpkt_tail->next = m;
+            rxq->vxrxq_currpkt_tail = m;
         }
 
         if (rxcd->eop) {
-            list_insert_before(l, &((struct xpbuf*)dev->currpkt_head)->l);
-            dev->currpkt_head = dev->currpkt_tail = NULL;
+            struct pbuf *p = rxq->vxrxq_currpkt_head;
+            if (vmxnet3_rx_csum(p, rxcd))
+                list_insert_before(l, &((struct xpbuf*)p)->l);
+            else
+                pbuf_free(p);
+            rxq->vxrxq_currpkt_head = rxq->vxrxq_currpkt_tail = NULL;
         }
-        vmxnet3_newbuf(vdev, rid);
+        vmxnet3_newbuf(vdev, rxq, rid);
 
 next:
         if (rxq->vxrxq_rs->update_rxhead) {
             idx = (idx + 1) % rxr->vxrxr_ndesc;
 
             if (rid == 0)
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH1(rxq->vxrxq_id), idx);
             else
-                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(0), idx);
+                pci_bar_write_4(&dev->bar0, VMXNET3_BAR0_RXH2(rxq->vxrxq_id), idx);
         }
     }
 
 }
 
-static void process_interrupt(vmxnet3 vn)
+static void process_interrupt(vmxnet3_rx rx)
 {
+    vmxnet3 vn = rx->vn;
     vmxnet3_pci dev = vn->dev;
+    struct vmxnet3_rxqueue *rxq = rx->rxq;
     struct list q;
     list_init(&q);
 
-    vmxnet3_interrupts_disable(dev);
-    while (vmxnet3_rxq_available(dev)) {
-        vmxnet3_receive(vn, &q);
+    vmxnet3_rx_intr_disable(dev, rxq);
+    while (vmxnet3_rxq_available(rxq)) {
+        vmxnet3_receive(vn, rxq, &q);
     }
-    vmxnet3_interrupts_enable(dev);
+    vmxnet3_rx_intr_enable(dev, rxq);
     list l = list_get_next(&q);
     if (l) {
         /* trick: remove (local) head and queue first element */
         list_delete(&q);
-        assert(enqueue(vn->rx_servicequeue, l));
-        async_apply_bh(vn->rx_service);
+        assert(enqueue(rx->servicequeue, l));
+        async_apply_bh((thunk)&rx->service);
     }
 }
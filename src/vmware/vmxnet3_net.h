@@ -79,19 +79,20 @@ typedef struct vmxnet3_pci {
 
     struct vmxnet3_driver_shared* vmx_ds;
     void *vmxnet3_mcast_table_mem;
-    struct vmxnet3_txqueue *vmx_txq[VMXNET3_DEF_TX_QUEUES];
-    struct vmxnet3_rxqueue *vmx_rxq[VMXNET3_DEF_RX_QUEUES];
+    int msix_count;
+    int nqueues;    /* Tx/Rx queue pairs */
+    struct vmxnet3_txqueue *vmx_txq[VMXNET3_MAX_QUEUE_PAIRS];
+    struct vmxnet3_rxqueue *vmx_rxq[VMXNET3_MAX_QUEUE_PAIRS];
     void *queues_shared_mem;
+    struct vmxnet3_rss_shared *vmx_rss;
     struct vmxnet3_txdesc *tx_desc_mem;
-    struct pbuf *tx_pbuf[VMXNET3_MAX_TX_NDESC];
     struct vmxnet3_txcompdesc *tx_compdesc_mem;
     struct vmxnet3_rxdesc *rx_desc_mem;
-    struct pbuf *rx_pbuf[VMXNET3_RXRINGS_PERQ][VMXNET3_MAX_RX_NDESC];
     struct vmxnet3_rxcompdesc *rx_compdesc_mem;
-    struct pbuf *currpkt_head, *currpkt_tail;
 } *vmxnet3_pci;
 
 #define VMXNET3_RX_MAXSEGSIZE		((1 << 13) - sizeof(struct xpbuf))
+#define VMXNET3_MTU			(VMXNET3_RX_MAXSEGSIZE - sizeof(struct eth_hdr))
 
 /*
  * Predetermined size of the multicast MACs filter table. If the
@@ -96,7 +96,7 @@ void init_vmxnet3_rx_queue(vmxnet3_pci vp, struct vmxnet3_rxqueue *rxq)
 
 void vmxnet3_tx_queues_alloc(vmxnet3_pci dev)
 {
-    for (int i = 0; i < VMXNET3_DEF_TX_QUEUES; ++i) {
+    for (int i = 0; i < dev->nqueues; ++i) {
         dev->vmx_txq[i] = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_txqueue));
         assert(dev->vmx_txq[i] != INVALID_ADDRESS);
         vmxnet3_init_txq(dev, i);
@@ -104,37 +104,35 @@ void vmxnet3_tx_queues_alloc(vmxnet3_pci dev)
     }
 
     // allocate tx descriptors memory
-    u64 tx_desc_size = sizeof(struct vmxnet3_txdesc) * VMXNET3_MAX_TX_NDESC * VMXNET3_DEF_TX_QUEUES;
+    u64 tx_desc_size = sizeof(struct vmxnet3_txdesc) * VMXNET3_MAX_TX_NDESC * dev->nqueues;
     dev->tx_desc_mem = allocate_zero(dev->contiguous, tx_desc_size);
     assert(dev->tx_desc_mem != INVALID_ADDRESS);
     // alignment
     assert((u64)dev->tx_desc_mem == pad((u64)dev->tx_desc_mem, VMXNET_ALIGN_QUEUES_DESC));
 
-    u64 tx_compdesc_size = sizeof(struct vmxnet3_txcompdesc) * VMXNET3_MAX_TX_NDESC * VMXNET3_DEF_TX_QUEUES;
+    u64 tx_compdesc_size = sizeof(struct vmxnet3_txcompdesc) * VMXNET3_MAX_TX_NDESC * dev->nqueues;
     dev->tx_compdesc_mem = allocate_zero(dev->contiguous, tx_compdesc_size);
     assert(dev->tx_compdesc_mem != INVALID_ADDRESS);
     // alignment
     assert((u64)dev->tx_compdesc_mem == pad((u64)dev->tx_compdesc_mem, VMXNET_ALIGN_QUEUES_DESC));
-
-    memset(&dev->tx_pbuf, 0, sizeof(dev->tx_pbuf));
 }
 
 void vmxnet3_rx_queues_alloc(vmxnet3_pci dev)
 {
-    for (int i = 0; i < VMXNET3_DEF_RX_QUEUES; ++i) {
+    for (int i = 0; i < dev->nqueues; ++i) {
         dev->vmx_rxq[i] = allocate_zero(dev->contiguous, sizeof(struct vmxnet3_rxqueue));
         assert(dev->vmx_rxq[i] != INVALID_ADDRESS);
         vmxnet3_init_rxq(dev, i);
         init_vmxnet3_rx_queue(dev, dev->vmx_rxq[i]);
     }
     // allocate rx descriptors memory
-    u64 rx_desc_size = sizeof(struct vmxnet3_rxdesc) * VMXNET3_MAX_RX_NDESC * VMXNET3_RXRINGS_PERQ * VMXNET3_DEF_RX_QUEUES;
+    u64 rx_desc_size = sizeof(struct vmxnet3_rxdesc) * VMXNET3_MAX_RX_NDESC * VMXNET3_RXRINGS_PERQ * dev->nqueues;
     dev->rx_desc_mem = allocate_zero(dev->contiguous, rx_desc_size);
     assert(dev->rx_desc_mem != INVALID_ADDRESS);
     // alignment
     assert((u64)dev->rx_desc_mem == pad((u64)dev->rx_desc_mem, VMXNET_ALIGN_QUEUES_DESC));
 
-    u64 rx_compdesc_size = sizeof(struct vmxnet3_rxcompdesc) * VMXNET3_MAX_RX_NCOMPDESC * VMXNET3_DEF_RX_QUEUES;
+    u64 rx_compdesc_size = sizeof(struct vmxnet3_rxcompdesc) * VMXNET3_MAX_RX_NCOMPDESC * dev->nqueues;
     dev->rx_compdesc_mem = allocate_zero(dev->contiguous, rx_compdesc_size);
     assert(dev->rx_compdesc_mem != INVALID_ADDRESS);
     // alignment
@@ -148,8 +146,8 @@ void vmxnet3_queues_shared_alloc(vmxnet3_pci dev)
      * as vmxnet3_driver_shared contains only a single address member
      * for the shared queue data area.
      */
-    u64 size = VMXNET3_DEF_TX_QUEUES * sizeof(struct vmxnet3_txq_shared) +
-        VMXNET3_DEF_RX_QUEUES * sizeof(struct vmxnet3_rxq_shared);
+    u64 size = dev->nqueues * (sizeof(struct vmxnet3_txq_shared) +
+                               sizeof(struct vmxnet3_rxq_shared));
     dev->queues_shared_mem = allocate_zero(dev->contiguous, size);
     assert(dev->queues_shared_mem != INVALID_ADDRESS);
     // alignment
@@ -162,12 +160,12 @@ void vmxnet3_queues_shared_alloc(vmxnet3_pci dev)
     vmx_ds->queue_shared_len = size;
 
     caddr_t addr = (caddr_t)dev->queues_shared_mem;
-    for (int i = 0; i < VMXNET3_DEF_TX_QUEUES; ++i) {
+    for (int i = 0; i < dev->nqueues; ++i) {
         dev->vmx_txq[i]->vxtxq_ts = (struct vmxnet3_txq_shared *) addr;
         addr += sizeof(struct vmxnet3_txq_shared);
     }
 
-    for (int i = 0; i < VMXNET3_DEF_RX_QUEUES; ++i) {
+    for (int i = 0; i < dev->nqueues; ++i) {
         dev->vmx_rxq[i]->vxrxq_rs = (struct vmxnet3_rxq_shared *) addr;
         addr += sizeof(struct vmxnet3_rxq_shared);
     }
@@ -175,7 +173,7 @@ void vmxnet3_queues_shared_alloc(vmxnet3_pci dev)
     struct vmxnet3_txcompdesc* aligned_txcompdesc_mem = (struct vmxnet3_txcompdesc*)dev->tx_compdesc_mem;
     struct vmxnet3_txdesc* aligned_txdesc_mem = (struct vmxnet3_txdesc*)dev->tx_desc_mem;
     /* Record descriptor ring vaddrs and paddrs */
-    for (int q = 0; q < VMXNET3_DEF_TX_QUEUES; q++) {
+    for (int q = 0; q < dev->nqueues; q++) {
 
         struct vmxnet3_txqueue *txq = dev->vmx_txq[q];
         struct vmxnet3_comp_ring *txc = &txq->vxtxq_comp_ring;
@@ -195,7 +193,7 @@ void vmxnet3_queues_shared_alloc(vmxnet3_pci dev)
     struct vmxnet3_rxcompdesc* aligned_rxcompdesc_mem = (struct vmxnet3_rxcompdesc*)dev->rx_compdesc_mem;
     struct vmxnet3_rxdesc* aligned_rxdesc_mem = (struct vmxnet3_rxdesc*)dev->rx_desc_mem;
     /* Record descriptor ring vaddrs and paddrs */
-    for (int q = 0; q < VMXNET3_DEF_RX_QUEUES; q++) {
+    for (int q = 0; q < dev->nqueues; q++) {
         struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[q];
         struct vmxnet3_comp_ring *rxc = &rxq->vxrxq_comp_ring;
 
@@ -219,7 +217,7 @@ void vmxnet3_queues_shared_alloc(vmxnet3_pci dev)
 void vmxnet3_init_shared_data(vmxnet3_pci dev)
 {
     /* Tx queues */
-    for (int i = 0; i < VMXNET3_DEF_TX_QUEUES; i++) {
+    for (int i = 0; i < dev->nqueues; i++) {
         struct vmxnet3_txqueue *txq = dev->vmx_txq[i];
         struct vmxnet3_txq_shared *txs = txq->vxtxq_ts;
 
@@ -233,7 +231,7 @@ void vmxnet3_init_shared_data(vmxnet3_pci dev)
     }
 
     /* Rx queues */
-    for (int i = 0; i < VMXNET3_DEF_RX_QUEUES; i++) {
+    for (int i = 0; i < dev->nqueues; i++) {
         struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[i];
         struct vmxnet3_rxq_shared *rxs = rxq->vxrxq_rs;
 
@@ -252,9 +250,8 @@ void vmxnet3_init_shared_data(vmxnet3_pci dev)
 
 /* called with lwIP lock held */
 int
-vmxnet3_isc_txd_encap(vmxnet3_pci dev, struct pbuf *p)
+vmxnet3_isc_txd_encap(struct vmxnet3_txqueue *txq, struct pbuf *p)
 {
-    struct vmxnet3_txqueue *txq = dev->vmx_txq[0];
     struct vmxnet3_txring *txr = &txq->vxtxq_cmd_ring;
 
     //TODO: max segments?
@@ -263,14 +260,14 @@ vmxnet3_isc_txd_encap(vmxnet3_pci dev, struct pbuf *p)
         nsegs += 1;
 
     if (txr->vxtxr_avail < nsegs + 1) {
-        vmxnet3_isc_txd_credits_update(dev);
+        vmxnet3_isc_txd_credits_update(txq);
         if (txr->vxtxr_avail < nsegs + 1) {
             return ERR_BUF;
         }
     }
 
     unsigned pidx = txr->vxtxr_head;
-    dev->tx_pbuf[txr->vxtxr_head] = p;
+    txq->vxtxq_pbuf[txr->vxtxr_head] = p;
     pbuf_ref(p);
 
     assert(nsegs <= VMXNET3_TX_MAXSEGS);
@@ -346,9 +343,8 @@ vmxnet3_isc_txd_encap(vmxnet3_pci dev, struct pbuf *p)
 
 /* called with lwIP lock held */
 void
-vmxnet3_isc_txd_credits_update(vmxnet3_pci dev)
+vmxnet3_isc_txd_credits_update(struct vmxnet3_txqueue *txq)
 {
-    struct vmxnet3_txqueue *txq = dev->vmx_txq[0];
     struct vmxnet3_comp_ring *txc = &txq->vxtxq_comp_ring;
     struct vmxnet3_txring *txr = &txq->vxtxq_cmd_ring;
 
@@ -364,9 +360,9 @@ vmxnet3_isc_txd_credits_update(vmxnet3_pci dev)
             txc->vxcr_gen ^= 1;
         }
 
-        struct pbuf* p = dev->tx_pbuf[txcd->eop_idx];
+        struct pbuf* p = txq->vxtxq_pbuf[txcd->eop_idx];
         if (p != NULL) {
-            dev->tx_pbuf[txcd->eop_idx] = NULL;
+            txq->vxtxq_pbuf[txcd->eop_idx] = NULL;
             pbuf_free(p);
         }
 
@@ -386,14 +382,14 @@ vmxnet3_set_interrupt_idx(vmxnet3_pci dev)
 {
     // must be less than nintr
     int intr_idx = 1;
-    for (int i = 0; i < VMXNET3_DEF_RX_QUEUES; i++, intr_idx++) {
+    for (int i = 0; i < dev->nqueues; i++, intr_idx++) {
         struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[i];
         struct vmxnet3_rxq_shared *rxs = rxq->vxrxq_rs;
         rxq->vxrxq_intr_idx = intr_idx;
         rxs->intr_idx = rxq->vxrxq_intr_idx;
     }
 
-    for (int i = 0; i < VMXNET3_DEF_TX_QUEUES; i++, intr_idx++) {
+    for (int i = 0; i < dev->nqueues; i++, intr_idx++) {
         struct vmxnet3_txqueue *txq = dev->vmx_txq[i];
         struct vmxnet3_txq_shared *txs = txq->vxtxq_ts;
         // Must be 0; must be less than nintr;
@@ -403,9 +399,8 @@ vmxnet3_set_interrupt_idx(vmxnet3_pci dev)
 }
 
 boolean
-vmxnet3_rxq_available(vmxnet3_pci dev)
+vmxnet3_rxq_available(struct vmxnet3_rxqueue *rxq)
 {
-    struct vmxnet3_rxqueue *rxq = dev->vmx_rxq[0];
     struct vmxnet3_comp_ring *rxc = &rxq->vxrxq_comp_ring;
     struct vmxnet3_rxcompdesc *rxcd = &rxc->vxcr_u.rxcd[rxc->vxcr_next];
 
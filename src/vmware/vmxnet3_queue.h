@@ -155,6 +155,30 @@ struct UPT1_RxStats {
 #define UPT1_F_VLAN	0x0004		/* VLAN tag stripping */
 #define UPT1_F_LRO	0x0008		/* Large receive offloading */
 
+/* RSS configuration, referenced by the rss field of the driver shared area */
+#define UPT1_RSS_HASH_TYPE_NONE		0x00
+#define UPT1_RSS_HASH_TYPE_IPV4		0x01
+#define UPT1_RSS_HASH_TYPE_TCP_IPV4	0x02
+#define UPT1_RSS_HASH_TYPE_IPV6		0x04
+#define UPT1_RSS_HASH_TYPE_TCP_IPV6	0x08
+
+#define UPT1_RSS_HASH_FUNC_NONE		0x00
+#define UPT1_RSS_HASH_FUNC_TOEPLITZ	0x01
+
+#define UPT1_RSS_MAX_KEY_SIZE		40
+#define UPT1_RSS_MAX_IND_TABLE_SIZE	128
+
+#define VMXNET3_RSS_VERSION	1
+
+struct vmxnet3_rss_shared {
+    u16 hash_type;
+    u16 hash_func;
+    u16 hash_key_size;
+    u16 ind_table_size;
+    u8 hash_key[UPT1_RSS_MAX_KEY_SIZE];
+    u8 ind_table[UPT1_RSS_MAX_IND_TABLE_SIZE];
+} __attribute__((packed));
+
 struct vmxnet3_txdesc {
     u64 addr;
 
@@ -340,6 +364,7 @@ struct vmxnet3_txqueue {
     struct vmxnet3_comp_ring vxtxq_comp_ring;
     struct vmxnet3_txq_shared *vxtxq_ts;
     char vxtxq_name[16];
+    struct pbuf *vxtxq_pbuf[VMXNET3_MAX_TX_NDESC];
 };
 
 struct vmxnet3_rxqueue {
@@ -350,13 +375,15 @@ struct vmxnet3_rxqueue {
     struct vmxnet3_comp_ring vxrxq_comp_ring;
     struct vmxnet3_rxq_shared *vxrxq_rs;
     char vxrxq_name[16];
+    struct pbuf *vxrxq_pbuf[VMXNET3_RXRINGS_PERQ][VMXNET3_MAX_RX_NDESC];
+    struct pbuf *vxrxq_currpkt_head, *vxrxq_currpkt_tail;
 };
 
 /*
- * The number of Rx/Tx queues this driver prefers.
+ * Tx and Rx queues are used in pairs, up to one pair per CPU; the number of
+ * pairs is chosen at setup time (see vmxnet3_setup()).
  */
-#define VMXNET3_DEF_RX_QUEUES   1 /* 8 on FreeBSD */
-#define VMXNET3_DEF_TX_QUEUES   1 /* 8 on FreeBSD */
+#define VMXNET3_MAX_QUEUE_PAIRS VMXNET3_MAX_TX_QUEUES
 
 //aligment
 #define VMXNET_ALIGN_MULTICAST 32
@@ -373,10 +400,10 @@ void vmxnet3_rx_queues_alloc(vmxnet3_pci vp);
 void vmxnet3_queues_shared_alloc(vmxnet3_pci vp);
 void vmxnet3_init_shared_data(vmxnet3_pci vp);
 
-int vmxnet3_isc_txd_encap(vmxnet3_pci vp, struct pbuf *p);
-void vmxnet3_isc_txd_credits_update(vmxnet3_pci vp);
+int vmxnet3_isc_txd_encap(struct vmxnet3_txqueue *txq, struct pbuf *p);
+void vmxnet3_isc_txd_credits_update(struct vmxnet3_txqueue *txq);
 
 void vmxnet3_set_interrupt_idx(vmxnet3_pci vp);
-boolean vmxnet3_rxq_available(vmxnet3_pci vp);
+boolean vmxnet3_rxq_available(struct vmxnet3_rxqueue *rxq);
 
 #endif /* _VMXNET3_QUEUE_H */
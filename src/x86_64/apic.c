@@ -28,15 +28,22 @@ BSS_RO_AFTER_INIT static heap apic_heap;
 BSS_RO_AFTER_INIT static u64 ioapic_membase;
 BSS_RO_AFTER_INIT apic_iface apic_if;
 BSS_RO_AFTER_INIT buffer apic_id_map;
+BSS_RO_AFTER_INIT boolean apic_pv_eoi;
+BSS_RO_AFTER_INIT boolean (*apic_pv_ipi)(u64 *bitmap, u32 min, u32 icr);
 
 static inline void apic_write(int reg, u32 val)
 {
-    apic_if->write(apic_if, reg, val);
+    indirect_call_2(apic_if->write, x2apic_write, xapic_write, apic_if, reg, val);
 }
 
 static inline u32 apic_read(int reg)
 {
-    return apic_if->read(apic_if, reg);
+    return indirect_call_2(apic_if->read, x2apic_read, xapic_read, apic_if, reg);
+}
+
+static inline void apic_send_ipi(u32 target, u64 flags, u8 vector)
+{
+    indirect_call_2(apic_if->ipi, x2apic_ipi, xapic_ipi, apic_if, target, flags, vector);
 }
 
 static inline u32 apicid_from_cpuid(u32 idx)
@@ -46,19 +53,74 @@ static inline u32 apicid_from_cpuid(u32 idx)
     return *(u32 *)buffer_ref(apic_id_map, idx * sizeof(u32));
 }
 
+/* Destinations of a paravirtual IPI: APIC IDs within APIC_PV_IPI_CLUSTER of the lowest one are
+ * gathered in a single hypercall. */
+typedef struct apic_pv_ipi_batch {
+    u64 bitmap[APIC_PV_IPI_CLUSTER / 64];
+    u32 min;
+    boolean pending;
+} *apic_pv_ipi_batch;
+
+static void apic_pv_ipi_flush(apic_pv_ipi_batch b, u64 flags, u8 vector)
+{
+    if (!b->pending)
+        return;
+    b->pending = false;
+    if (apic_pv_ipi(b->bitmap, b->min, flags | ICR_TYPE_FIXED | vector))
+        return;
+    for (int i = 0; i < APIC_PV_IPI_CLUSTER; i++) {
+        if (b->bitmap[i / 64] & U64_FROM_BIT(i % 64))
+            apic_send_ipi(b->min + i, flags, vector);
+    }
+}
+
+static void apic_pv_ipi_add(apic_pv_ipi_batch b, u32 apicid, u64 flags, u8 vector)
+{
+    if (b->pending && ((apicid < b->min) || (apicid - b->min >= APIC_PV_IPI_CLUSTER)))
+        apic_pv_ipi_flush(b, flags, vector);
+    if (!b->pending) {
+        zero(b->bitmap, sizeof(b->bitmap));
+        b->min = apicid;
+        b->pending = true;
+    }
+    u32 offset = apicid - b->min;
+    b->bitmap[offset / 64] |= U64_FROM_BIT(offset % 64);
+}
+
+/* Sends an IPI to the CPUs (other than the current one) set in cpus, or to all of them if cpus is
+ * null. */
+static void apic_ipi_cpus(u64 *cpus, u64 flags, u8 vector)
+{
+    u32 self = current_cpu()->id;
+    boolean pv = apic_pv_ipi && (flags == ICR_ASSERT);
+    struct apic_pv_ipi_batch b;
+    b.pending = false;
+    for (int i = 0; i < total_processors; i++) {
+        if ((i == self) || (cpus && !(cpus[i / 64] & U64_FROM_BIT(i % 64))))
+            continue;
+        if (pv)
+            apic_pv_ipi_add(&b, apicid_from_cpuid(i), flags, vector);
+        else
+            apic_send_ipi(apicid_from_cpuid(i), flags, vector);
+    }
+    if (pv)
+        apic_pv_ipi_flush(&b, flags, vector);
+}
+
+void apic_ipi_mask(u64 *cpus, u64 flags, u8 vector)
+{
+    apic_ipi_cpus(cpus, flags, vector);
+}
+
 void apic_ipi(u64 target, u64 flags, u8 vector)
 {
     /* Do not use native "all but self" destination as it is very slow
      * and may target processors not available */
     if (target == TARGET_EXCLUSIVE_BROADCAST) {
-        for (int i = 0; i < total_processors; i++) {
-            if (current_cpu()->id == i)
-                continue;
-            apic_if->ipi(apic_if, apicid_from_cpuid(i), flags, vector);
-        }
+        apic_ipi_cpus(0, flags, vector);
         return;
     }
-    apic_if->ipi(apic_if, apicid_from_cpuid(target), flags, vector);
+    apic_send_ipi(apicid_from_cpuid(target), flags, vector);
 }
 
 static inline void apic_set(int reg, u32 v)
@@ -86,6 +148,15 @@ static void calibrate_lapic_timer(void)
 
 void lapic_eoi(void)
 {
+    if (apic_pv_eoi) {
+        /* set by the hypervisor when the interrupt being serviced needs no EOI write; it is only
+         * updated while this CPU is not running, so no atomic operation is needed */
+        volatile u64 *pv_eoi = &current_cpu()->m.kvm_pv_eoi;
+        if (*pv_eoi & 1) {
+            *pv_eoi = 0;
+            return;
+        }
+    }
     write_barrier();
     apic_write(APIC_EOI, 0);
     write_barrier();
@@ -243,17 +314,43 @@ void ioapic_register_int(unsigned int gsi, thunk h, sstring name, range cpu_affi
         ioapic_set_int(gsi, v, irq_get_target_cpu(cpu_affinity));
 }
 
-int cpuid_from_apicid(u32 aid)
+/* returns -1 if no present processor has the given APIC ID */
+int lookup_cpuid_from_apicid(u32 aid)
 {
     for (int i = 0; i < present_processors; i++) {
         if (aid == apicid_from_cpuid(i))
             return i;
     }
-    assert(0);
+    return -1;
 }
 
-closure_function(1, 2, void, apic_madt_handler,
-                 kernel_heaps, kh,
+int cpuid_from_apicid(u32 aid)
+{
+    int cpu = lookup_cpuid_from_apicid(aid);
+    assert(cpu >= 0);
+    return cpu;
+}
+
+/* Assigns the next CPU number to a hot-added processor, so that online CPUs keep contiguous
+ * numbers: the processor swaps its number with the offline processor that has the next number.
+ * Returns the previous number of the processor, or -1 if the APIC ID does not belong to an offline
+ * present processor. */
+int apic_hotplug_cpuid(u32 aid)
+{
+    int cpu = total_processors;
+    int prev = lookup_cpuid_from_apicid(aid);
+    if (!apic_id_map || (prev < cpu))
+        return -1;
+    u32 *ids = buffer_ref(apic_id_map, 0);
+    ids[prev] = ids[cpu];
+    ids[cpu] = aid;
+    return prev;
+}
+
+/* Enabled processors are recorded in a first pass and hotpluggable (not enabled) ones in a second
+ * pass, so that the CPUs started at boot have the lowest numbers. */
+closure_function(2, 2, void, apic_madt_handler,
+                 kernel_heaps, kh, boolean, hotplug,
                  u8 type, void *p)
 {
     u32 apic_id;
@@ -262,8 +359,7 @@ closure_function(1, 2, void, apic_madt_handler,
     case ACPI_MADT_LAPIC:
         apic_debug("found xAPIC LAPIC entry\n");
         acpi_lapic l = p;
-        /* XXX should eventually deal with online capable */
-        if (!(l->flags & MADT_LAPIC_ENABLED))
+        if (((l->flags & MADT_LAPIC_ENABLED) != 0) == bound(hotplug))
             break;
         apic_id = l->id;
         assert(buffer_write(apic_id_map, &apic_id, sizeof(apic_id)));
@@ -277,8 +373,7 @@ closure_function(1, 2, void, apic_madt_handler,
     case ACPI_MADT_LAPICx2:
         apic_debug("found x2APIC LAPIC entry\n");
         acpi_lapic_x2 lx2 = p;
-        /* XXX should eventually deal with online capable */
-        if (!(lx2->flags & MADT_LAPIC_ENABLED))
+        if (((lx2->flags & MADT_LAPIC_ENABLED) != 0) == bound(hotplug))
             break;
         apic_id = lx2->id;
         assert(buffer_write(apic_id_map, &apic_id, sizeof(apic_id)));
@@ -290,7 +385,7 @@ closure_function(1, 2, void, apic_madt_handler,
     case ACPI_MADT_IOAPIC:
         apic_debug("found IOAPIC entry\n");
         acpi_ioapic io = p;
-        if (ioapic_membase)
+        if (bound(hotplug) || ioapic_membase)
             break;
         apic_debug("ioapic membase set to %lx\n", io->addr);
         ioapic_membase = (u64)io->addr;
@@ -304,7 +399,9 @@ void init_apic(kernel_heaps kh)
     apic_id_map = allocate_buffer(apic_heap, 8);
     assert(apic_id_map != INVALID_ADDRESS);
     apic_debug("walking MADT table...\n");
-    if (!acpi_walk_madt(stack_closure(apic_madt_handler, kh))) {
+    if (acpi_walk_madt(stack_closure(apic_madt_handler, kh, false))) {
+        acpi_walk_madt(stack_closure(apic_madt_handler, kh, true));
+    } else {
         deallocate_buffer(apic_id_map);
         apic_id_map = 0;
         apic_debug("MADT not found, detecting apic interface...\n");
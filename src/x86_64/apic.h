@@ -62,9 +62,21 @@ void init_apic(kernel_heaps kh);
 void lapic_set_tsc_deadline_mode(u32 v);
 boolean init_lapic_timer(clock_timer *ct, thunk *per_cpu_init);
 void apic_ipi(u64 target, u64 flags, u8 vector);
+void apic_ipi_mask(u64 *cpus, u64 flags, u8 vector);
+
+/* Paravirtual interrupt operations, set up by hypervisor detection:
+ * with apic_pv_eoi, lapic_eoi() skips the EOI write if the hypervisor has set bit 0 of the
+ * kvm_pv_eoi word of the current CPU; apic_pv_ipi sends a fixed IPI (as described by icr) to the
+ * APICs whose IDs are at the offsets from min set in the 128-bit bitmap, and returns false on
+ * failure. */
+extern boolean apic_pv_eoi;
+extern boolean (*apic_pv_ipi)(u64 *bitmap, u32 min, u32 icr);
+#define APIC_PV_IPI_CLUSTER 128
 void apic_per_cpu_init(void);
 void apic_enable(void);
+int lookup_cpuid_from_apicid(u32 aid);
 int cpuid_from_apicid(u32 aid);
+int apic_hotplug_cpuid(u32 aid);
 
 void ioapic_set_int(unsigned int gsi, u64 v, u32 target_cpu);
 boolean ioapic_int_is_free(unsigned int gsi);
@@ -72,8 +84,18 @@ void ioapic_register_int(unsigned int gsi, thunk h, sstring name, range cpu_affi
 
 extern apic_iface apic_if;
 
+/* APIC methods, called directly by the APIC access functions (see indirect_call()) */
+u32 x2apic_get_id(apic_iface i);
+void x2apic_write(apic_iface i, int reg, u64 val);
+u64 x2apic_read(apic_iface i, int reg);
+void x2apic_ipi(apic_iface i, u32 target, u64 flags, u8 vector);
+u32 xapic_get_id(apic_iface i);
+void xapic_write(apic_iface i, int reg, u64 val);
+u64 xapic_read(apic_iface i, int reg);
+void xapic_ipi(apic_iface i, u32 target, u64 flags, u8 vector);
+
 static inline u32 apic_id(void)
 {
     assert(apic_if);
-    return apic_if->get_id(apic_if);
+    return indirect_call_2(apic_if->get_id, x2apic_get_id, xapic_get_id, apic_if);
 }
@@ -9,14 +9,17 @@
 
 BSS_RO_AFTER_INIT clock_now platform_monotonic_now;
 BSS_RO_AFTER_INIT clock_timer platform_timer;
+BSS_RO_AFTER_INIT timestamp platform_timer_max;
 
 void init_clock(void)
 {
-    /* detect rdtscp */
+    /* detect rdtscp and rdpid */
     u32 regs[4];
     cpuid(0x80000001, 0, regs);
     __vdso_dat->clock_src = VDSO_CLOCK_SYSCALL;
     __vdso_dat->machine.platform_has_rdtscp = (regs[3] & U64_FROM_BIT(27)) != 0;
+    cpuid(0x7, 0, regs);
+    __vdso_dat->machine.platform_has_rdpid = (regs[2] & U64_FROM_BIT(22)) != 0;
 }
 
 /* error refers to the time (expressed in TSC cycles) it takes to read the PIT counter value. */
@@ -69,6 +72,7 @@ boolean init_tsc_timer(kernel_heaps kh)
 {
     u64 tsc_scaling = tsc_calibrate();
     if (tsc_scaling) {
+        __vdso_dat->machine.tsc_scaling = tsc_scaling;
         register_platform_clock_now(closure(heap_general(kh), tsc_now, tsc_scaling),
                                     VDSO_CLOCK_TSC_STABLE, 0);
         thunk percpu_init;
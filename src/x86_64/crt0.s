@@ -44,8 +44,26 @@ extern  init_service
 
 extern use_xsave
 
+;; Only thread contexts have an extended (FPU/vector) state area, as the kernel does not use these
+;; registers. The address of the area whose contents match the registers of this CPU is kept at
+;; gs:40, and the cpuinfo of the CPU where an area was last saved or restored is recorded in the
+;; frame (FRAME_XSTATE_CPU, cleared when the area is modified by the kernel), so that returning to a
+;; thread whose state is still live on this CPU skips the restore. use_xsave is 2 when XSAVEOPT is
+;; available, whose modified and init optimizations skip the components unchanged since the last
+;; XRSTOR from the same area or in their initial configuration.
+
 %macro load_extended_registers 1
         mov rcx, [%1+FRAME_EXTENDED*8]
+        test rcx, rcx
+        jz %%out
+        mov rax, [gs:0]
+        cmp rcx, [gs:40]
+        jne %%load
+        cmp rax, [%1+FRAME_XSTATE_CPU*8]
+        je %%out
+%%load:
+        mov [gs:40], rcx
+        mov [%1+FRAME_XSTATE_CPU*8], rax
         mov al, [use_xsave]
         test al, al
         jnz %%xs
@@ -60,26 +78,28 @@ extern use_xsave
 
 %macro save_extended_registers 1
         mov rcx, [%1+FRAME_EXTENDED*8]
+        test rcx, rcx
+        jz %%out
         mov al, [use_xsave]
         test al, al
         jnz %%xs
-        fxsave [rcx]  ; we wouldn't have to do this if we could guarantee no other user thread ran before us
-        jmp %%out
+        fxsave [rcx]
+        jmp %%saved
 %%xs:
+        cmp al, 2
         mov edx, 0xffffffff
         mov eax, edx
+        jne %%xsave
+        xsaveopt [rcx]
+        jmp %%saved
+%%xsave:
         xsave [rcx]
+%%saved:
+        mov [gs:40], rcx
+        mov rax, [gs:0]
+        mov [%1+FRAME_XSTATE_CPU*8], rax
 %%out:
 %endmacro
-
-        
-      
-;;;  helper so userspace can save a frame without
-;;; 
-global xsave        
-xsave:
-        save_extended_registers rdi
-        ret
         
 ;; stack frame upon entry:
 ;;
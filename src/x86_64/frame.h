@@ -41,7 +41,8 @@
 #define FRAME_FULL       28
 #define FRAME_SAVED_RAX  29
 #define FRAME_EXTENDED   30
-#define FRAME_SIZE       31
+#define FRAME_XSTATE_CPU 31
+#define FRAME_SIZE       32
 
 #define ERR_FRAME_RBX   0
 #define ERR_FRAME_RBP   1
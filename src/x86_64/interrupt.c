@@ -4,6 +4,9 @@
 #include <apic.h>
 #include <symtab.h>
 #include <drivers/acpi.h>
+#ifdef CONFIG_KPROBES
+#include <kprobe.h>
+#endif
 
 //#define INT_DEBUG
 #ifdef INT_DEBUG
@@ -387,6 +390,11 @@ void init_interrupts(kernel_heaps kh)
     for (int i = INTERRUPT_VECTOR_START; i < n_interrupt_vectors; i++)
         write_idt(i, vector_base + i * interrupt_vector_size, IST_INTERRUPT);
 
+#ifdef CONFIG_KPROBES
+    /* kernel probe breakpoints are handled before the generic exception path */
+    write_idt(3, u64_from_pointer(kprobe_bp_entry), IST_EXCEPTION);
+#endif
+
     u8 idt_desc[10] = {0};
     *(u16*)idt_desc = 2 * sizeof(u64) * n_interrupt_vectors - 1;
     *(u64*)(idt_desc + sizeof(u16)) = u64_from_pointer(idt);
@@ -18,6 +18,9 @@
 #define USER_CODE_SEG_DESC  (SEG_DESC_L | SEG_DESC_P | (3 << SEG_DESC_DPL_SHIFT) | SEG_DESC_S | SEG_DESC_CODE | SEG_DESC_RW)
 #define USER_DATA_SEG_DESC  (SEG_DESC_S | (3 << SEG_DESC_DPL_SHIFT) | SEG_DESC_P | SEG_DESC_RW)
 
+BSS_RO_AFTER_INIT static heap xstate_cache;
+BSS_RO_AFTER_INIT static bytes xstate_area_size;
+
 #ifdef SPIN_LOCK_DEBUG_NOSMP
 u64 get_program_counter(void)
 {
@@ -31,6 +34,11 @@ void send_ipi(u64 cpu, u8 vector)
     apic_ipi(cpu, ICR_ASSERT, vector);
 }
 
+void send_ipi_mask(u64 *cpus, u8 vector)
+{
+    apic_ipi_mask(cpus, ICR_ASSERT, vector);
+}
+
 void interrupt_exit(void)
 {
     lapic_eoi();
@@ -61,6 +69,44 @@ void clone_frame_pstate(context_frame dest, context_frame src)
 {
     runtime_memcpy(dest, src, sizeof(u64) * (FRAME_N_PSTATE + 1));
     runtime_memcpy(frame_extended(dest), frame_extended(src), extended_frame_size);
+    frame_extended_modified(dest);
+}
+
+/* legacy region of the XSAVE area */
+#define XSTATE_FCW          0
+#define XSTATE_MXCSR        24
+#define XSTATE_ST_REGS      32
+#define XSTATE_XMM_REGS     160
+#define XSTATE_XMM_END      416
+#define XSTATE_BV           512
+#define XSTATE_HDR_SIZE     64
+
+#define XSTATE_X87          U64_FROM_BIT(0)
+#define XSTATE_SSE          U64_FROM_BIT(1)
+
+#define FCW_INIT            0x037f
+#define MXCSR_INIT          0x1f80
+
+void xstate_copy_out(void *dest, void *area, bytes len)
+{
+    runtime_memcpy(dest, area, len);
+    if (use_xsave != XSAVE_MODE_XSAVEOPT)
+        return;
+    u64 bv = *(u64 *)(area + XSTATE_BV);
+    if (!(bv & XSTATE_X87) && (len >= XSTATE_XMM_REGS)) {
+        zero(dest, XSTATE_MXCSR);
+        *(u16 *)(dest + XSTATE_FCW) = FCW_INIT;
+        zero(dest + XSTATE_ST_REGS, XSTATE_XMM_REGS - XSTATE_ST_REGS);
+    }
+    if (!(bv & XSTATE_SSE) && (len >= XSTATE_XMM_END))
+        zero(dest + XSTATE_XMM_REGS, XSTATE_XMM_END - XSTATE_XMM_REGS);
+}
+
+bytes xstate_used_size(void *area)
+{
+    if (!use_xsave || (*(u64 *)(area + XSTATE_BV) & ~(XSTATE_X87 | XSTATE_SSE)))
+        return extended_frame_size;
+    return XSTATE_BV + XSTATE_HDR_SIZE;
 }
 
 static void seg_desc_set(seg_desc_t *d, u32 base, u16 limit, u16 flags)
@@ -77,7 +123,16 @@ static void seg_desc_set(seg_desc_t *d, u32 base, u16 limit, u16 flags)
 
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
 {
+    if (ci->id == 0) {
+        /* XSAVE areas must be 64-byte aligned */
+        kernel_heaps kh = get_kernel_heaps();
+        xstate_area_size = pad(extended_frame_size, 64);
+        xstate_cache = (heap)allocate_objcache(heap_locked(kh), (heap)heap_page_backed(kh),
+                                               xstate_area_size, PAGESIZE, true);
+        assert(xstate_cache != INVALID_ADDRESS);
+    }
     ci->m.self = &ci->m;
+    ci->m.xstate_live = 0;
     kernel_context kc = allocate_kernel_context(ci);
     assert(kc != INVALID_ADDRESS);
 
@@ -109,18 +164,31 @@ void init_cpuinfo_machine(cpuinfo ci, heap backed)
 }
 
 #ifdef KERNEL
+/* Only thread contexts have an extended state area: the kernel is built without FPU and vector
+ * instructions, so these registers keep user state across kernel execution. */
 void init_context_machine(context c)
 {
-    void *e = allocate_zero((heap)heap_page_backed(get_kernel_heaps()), extended_frame_size);
-    assert(e != INVALID_ADDRESS);
+    if (c->type != CONTEXT_TYPE_THREAD)
+        return;
+    void *e = thread_extended_frame_get();
+    if (e == INVALID_ADDRESS) {
+        e = allocate(xstate_cache, xstate_area_size);
+        assert(e != INVALID_ADDRESS);
+    }
+
+    /* initial FPU configuration; all components in XSTATE_BV are cleared */
+    zero(e, xstate_area_size);
+    *(u16 *)(e + XSTATE_FCW) = FCW_INIT;
+    *(u32 *)(e + XSTATE_MXCSR) = MXCSR_INIT;
     c->frame[FRAME_EXTENDED] = u64_from_pointer(e);
-    xsave(c->frame);
 }
 
 void destruct_context(context c)
 {
     if (c->frame[FRAME_EXTENDED]) {
-        deallocate_u64((heap)heap_page_backed(get_kernel_heaps()), c->frame[FRAME_EXTENDED], extended_frame_size);
+        if ((c->type != CONTEXT_TYPE_THREAD) ||
+            !thread_extended_frame_put(pointer_from_u64(c->frame[FRAME_EXTENDED])))
+            deallocate_u64(xstate_cache, c->frame[FRAME_EXTENDED], xstate_area_size);
         c->frame[FRAME_EXTENDED] = 0;
     }
 }
@@ -152,6 +152,16 @@ static inline void wait_for_interrupt(void)
     asm volatile("sti; hlt" ::: "memory");
 }
 
+/* Zeroes memory with non-temporal stores, bypassing the cache; address and length must be
+ * 32-byte aligned. */
+static inline void zero_nontemporal(void *p, bytes len)
+{
+    for (u64 *w = p, *end = p + len; w < end; w += 4)
+        asm volatile("movnti %1, (%0); movnti %1, 8(%0); movnti %1, 16(%0); movnti %1, 24(%0)" ::
+                     "r"(w), "r"(0ull) : "memory");
+    asm volatile("sfence" ::: "memory");
+}
+
 void triple_fault(void) __attribute__((noreturn));
 void start_cpu(int index);
 void allocate_apboot(heap stackheap, void (*ap_entry)());
@@ -300,8 +310,11 @@ struct cpuinfo_machine {
     /* One temporary for syscall enter to use so that we don't need to touch the user stack. +32 */
     u64 tmp;
 
+    /* Extended state area whose contents are live in the registers of this CPU. +40 */
+    void *xstate_live;
+
 #ifdef CONFIG_FTRACE
-    /* Used by mcount to determine if to enter ftrace code. +40 */
+    /* Used by mcount to determine if to enter ftrace code. +48 */
     u64 ftrace_disable_cnt;
 #endif
 
@@ -332,6 +345,17 @@ struct cpuinfo_machine {
     /* Monotonic clock timestamp when the lapic timer is supposed to fire; used to re-arm the timer
      * when it fires too early (based on what the monotonic clock source says). */
     timestamp lapic_timer_expiry;
+
+    /* Areas shared with a KVM hypervisor: steal time (including the preempted state of this
+     * virtual CPU), and the paravirtual EOI flag, set when an interrupt needs no EOI write. */
+    struct kvm_steal_time {
+        u64 steal;
+        u32 version;
+        u32 flags;
+        u8 preempted;
+        u8 pad[47];
+    } __attribute__((aligned(64))) kvm_steal_time;
+    volatile u64 kvm_pv_eoi;
 };
 
 typedef struct cpuinfo *cpuinfo;
@@ -345,6 +369,10 @@ static inline cpuinfo current_cpu(void)
 
 extern u64 extended_frame_size;
 
+#define XSAVE_MODE_XSAVE    1
+#define XSAVE_MODE_XSAVEOPT 2
+extern u8 use_xsave;
+
 static inline boolean frame_is_full(context_frame f)
 {
     return f[FRAME_FULL];
@@ -365,7 +393,35 @@ static inline void frame_disable_interrupts(context_frame f)
     f[FRAME_EFLAGS] &= ~U64_FROM_BIT(EFLAG_INTERRUPT);
 }
 
-extern void xsave(context_frame f);
+/* to be called after modifying the saved extended state of a context, so that it is restored */
+static inline void frame_extended_modified(context_frame f)
+{
+    f[FRAME_XSTATE_CPU] = 0;
+}
+
+/* Brackets the use of vector registers by kernel code. Kernel contexts have no extended state
+ * area, so interrupts are disabled; the registers may hold the state of a user thread, which has
+ * been saved on kernel entry and is marked as no longer live so that it is restored on return. */
+static inline u64 kernel_simd_begin(void)
+{
+    u64 flags = irq_disable_save();
+    asm volatile("movq $0, %%gs:40" ::: "memory");   /* cpuinfo_machine.xstate_live */
+    return flags;
+}
+
+static inline void kernel_simd_end(u64 flags)
+{
+    irq_restore(flags);
+}
+
+/* Copies out a saved extended state, filling in the legacy area of x87 and SSE state in their
+ * initial configuration (not written by the init optimization of XSAVEOPT). */
+void xstate_copy_out(void *dest, void *area, bytes len);
+
+/* Returns the length of the leading portion of a saved extended state that must be copied to
+ * preserve it: components beyond SSE that are in their initial configuration (cleared in
+ * XSTATE_BV) are initialized by XRSTOR regardless of the contents of their save area. */
+bytes xstate_used_size(void *area);
 extern void clone_frame_pstate(context_frame dest, context_frame src);
 
 static inline boolean is_protection_fault(context_frame f)
@@ -560,6 +616,16 @@ static inline void return_offset(u64 offset) {
     rv;\
 })
 
+#define do_syscall3(sysnr, rdi, rsi, rdx) ({\
+    sysreturn rv;\
+    asm("syscall"\
+        : "=a" (rv)\
+        : "0" (sysnr), "D" (rdi), "S"(rsi), "d"(rdx)\
+        : "memory"\
+    );\
+    rv;\
+})
+
 /* clocksource */
 
 static inline boolean platform_has_precise_clocksource(void)
@@ -0,0 +1,73 @@
+;; Breakpoint exception entry for kernel probes (see src/kernel/kprobe.c)
+
+default rel
+
+extern interrupt_entry
+extern kprobe_handle_bp
+
+;; Breakpoints in user mode take the generic exception path. In kernel mode, the exception frame is
+;; moved from the exception stack to the interrupted stack (below its red zone), so that breakpoints
+;; hit by the handler itself can use the exception stack again; the registers are saved on top of
+;; the frame as a struct kprobe_regs, which the handler can modify to resume execution elsewhere.
+global kprobe_bp_entry
+kprobe_bp_entry:
+        test qword [rsp + 8], 0x03      ; CS
+        jz .kernel
+        push qword 3
+        jmp interrupt_entry
+.kernel:
+        push rax
+        push rbx
+        mov rbx, rsp                    ; rbx, rax, rip, cs, rflags, rsp, ss
+        mov rsp, [rbx + 40]
+        sub rsp, 128
+        and rsp, ~15
+        push qword [rbx + 48]           ; ss
+        push qword [rbx + 40]           ; rsp
+        push qword [rbx + 32]           ; rflags
+        push qword [rbx + 24]           ; cs
+        push qword [rbx + 16]           ; rip
+        push qword [rbx + 8]            ; rax
+        push qword [rbx]                ; rbx
+        push rcx
+        push rdx
+        push rsi
+        push rdi
+        push rbp
+        push r8
+        push r9
+        push r10
+        push r11
+        push r12
+        push r13
+        push r14
+        push r15
+        mov rdi, rsp
+        cld
+        call kprobe_handle_bp
+        test al, al
+        pop r15
+        pop r14
+        pop r13
+        pop r12
+        pop r11
+        pop r10
+        pop r9
+        pop r8
+        pop rbp
+        pop rdi
+        pop rsi
+        pop rdx
+        pop rcx
+        pop rbx
+        pop rax
+        jz .not_handled
+        iretq
+.not_handled:
+        push qword 3
+        jmp interrupt_entry
+
+;; hooked function returns land here
+global kprobe_ret_trampoline
+kprobe_ret_trampoline:
+        int3
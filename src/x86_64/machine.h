@@ -238,4 +238,31 @@ static inline __attribute__((always_inline)) void kern_pause(void)
 
 struct arch_vdso_dat {
     u8 platform_has_rdtscp;
+    u8 platform_has_rdpid;
+    u64 tsc_scaling;    /* for VDSO_CLOCK_TSC_STABLE */
 };
+
+#ifdef KERNEL
+/* Minimum length at which memcpy / memset switch to REP MOVSB / STOSB; zero
+   if the processor does not advertise enhanced (ERMS) or fast short (FSRM)
+   string operations. Set from CPUID during CPU feature initialization. */
+extern u64 memops_rep_min;
+
+#define ARCH_MEMCPY_FAST
+static inline __attribute__((always_inline)) u8 arch_memcpy_fast(void *dst, const void *src, u64 len)
+{
+    if (!memops_rep_min || len < memops_rep_min)
+        return 0;
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(len) : : "memory");
+    return 1;
+}
+
+#define ARCH_MEMSET_FAST
+static inline __attribute__((always_inline)) u8 arch_memset_fast(void *dst, u8 b, u64 len)
+{
+    if (!memops_rep_min || len < memops_rep_min)
+        return 0;
+    asm volatile("rep stosb" : "+D"(dst), "+c"(len) : "a"(b) : "memory");
+    return 1;
+}
+#endif
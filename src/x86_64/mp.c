@@ -29,12 +29,23 @@ static void (*start_callback)();
 
 /* CPUID level 7 (EBX) */
 #define CPUID_SMEP  (1<<7)
+#define CPUID_ERMS  (1<<9)
 
 /* CPUID level 7 (ECX) */
 #define CPUID_UMIP  (1<<2)
 
+/* CPUID level 7 (EDX) */
+#define CPUID_FSRM  (1<<4)
+
+/* REP MOVSB / STOSB startup cost is only amortized beyond these lengths */
+#define MEMOPS_REP_MIN_ERMS 512
+#define MEMOPS_REP_MIN_FSRM 64
+
 #define XCR0_SSE (1<<1)
 #define XCR0_AVX (1<<2)
+#define CPUID_XSAVEOPT  (1<<0)
+
+/* 0: FXSAVE, XSAVE_MODE_XSAVE or XSAVE_MODE_XSAVEOPT (tested in crt0.s) */
 u8 use_xsave;
 u64 extended_frame_size = 512;
 
@@ -45,7 +56,7 @@ void init_cpu_features()
 
     cpuid(1, 0, v);
     if (v[2] & CPUID_XSAVE)
-        use_xsave = 1;
+        use_xsave = XSAVE_MODE_XSAVE;
     boolean avx = (v[2] & CPUID_AVX) != 0;
     mov_from_cr("cr4", cr);
     cr |= CR4_PGE | CR4_OSFXSR | CR4_OSXMMEXCPT;
@@ -58,6 +69,10 @@ void init_cpu_features()
         cr |= CR4_SMEP;
     if (v[2] & CPUID_UMIP)
         cr |= CR4_UMIP;
+    if (v[3] & CPUID_FSRM)
+        memops_rep_min = MEMOPS_REP_MIN_FSRM;
+    else if (v[1] & CPUID_ERMS)
+        memops_rep_min = MEMOPS_REP_MIN_ERMS;
     mov_to_cr("cr4", cr);
     mov_from_cr("cr0", cr);
     cr |= C0_MP | C0_WP;
@@ -71,6 +86,9 @@ void init_cpu_features()
         xsetbv(0, v[0], v[1]);
         cpuid(0xd, 0, v);
         extended_frame_size = v[1];
+        cpuid(0xd, 1, v);
+        if (v[0] & CPUID_XSAVEOPT)
+            use_xsave = XSAVE_MODE_XSAVEOPT;
     }
 }
 
@@ -79,7 +97,8 @@ void cpu_init(int cpu)
     u64 addr = u64_from_pointer(cpuinfo_from_id(cpu));
     write_msr(KERNEL_GS_MSR, 0); /* clear user GS */
     write_msr(GS_MSR, addr);
-    if (VVAR_REF(vdso_dat).machine.platform_has_rdtscp)
+    if (VVAR_REF(vdso_dat).machine.platform_has_rdtscp ||
+        VVAR_REF(vdso_dat).machine.platform_has_rdpid)
         write_msr(TSC_AUX_MSR, cpu);    /* used by vdso_getcpu() */
     init_syscall_handler();
 }
@@ -91,8 +110,10 @@ static void __attribute__((noinline)) ap_new_stack()
     u64 id = apic_id();
     mp_debug_u64(id);
     int cid = cpuid_from_apicid(id);
-    fetch_and_add(&total_processors, 1);
     cpu_init(cid);
+    page_invalidate_cpu_online();
+    fetch_and_add(&total_processors, 1);
+    flush_tlb_global();
 
     mp_debug(", enable apic");
     apic_enable();
@@ -10,7 +10,7 @@ void invalidate(u64 page)
     asm volatile("invlpg (%0)" :: "r" ((word)page) : "memory");
 }
 
-/* assumes page table is consistent when called */
+/* assumes page table is consistent when called; a full flush preserves global entries */
 void flush_tlb(boolean full_flush)
 {
     if (full_flush) {
@@ -20,6 +20,19 @@ void flush_tlb(boolean full_flush)
     }
 }
 
+/* toggling CR4.PGE flushes all entries, including global ones */
+void flush_tlb_global(void)
+{
+    u64 cr4;
+    mov_from_cr("cr4", cr4);
+    if (cr4 & CR4_PGE) {
+        mov_to_cr("cr4", cr4 & ~CR4_PGE);
+        mov_to_cr("cr4", cr4);
+    } else {
+        flush_tlb(true);
+    }
+}
+
 #ifdef BOOT
 void page_invalidate(flush_entry f, u64 address)
 {
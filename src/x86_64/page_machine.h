@@ -2,6 +2,7 @@
 
 #define PAGE_NO_EXEC       U64_FROM_BIT(63)
 #define PAGE_NO_PS         0x0200 /* AVL[0] */
+#define PAGE_GLOBAL        0x0100
 #define PAGE_PS            0x0080
 #define PAGE_DIRTY         0x0040
 #define PAGE_ACCESSED      0x0020
@@ -90,6 +91,12 @@ static inline pageflags pageflags_no_minpage(pageflags flags)
     return (pageflags){.w = flags.w & ~PAGE_NO_PS};
 }
 
+/* kernel mappings that are not flushed by a non-global full TLB flush */
+static inline pageflags pageflags_global(pageflags flags)
+{
+    return (pageflags){.w = flags.w | PAGE_GLOBAL};
+}
+
 /* no-exec, read-only */
 static inline pageflags pageflags_default_user(void)
 {
@@ -156,7 +163,8 @@ static inline pageflags pageflags_from_pte(pte pte)
 
 static inline u64 page_pte(u64 phys, u64 flags)
 {
-    return phys | (flags & ~PAGE_NO_PS) | PAGE_PRESENT;
+    /* flags may come from a block mapping; bit 7 is PAT, not PS, in a page table entry */
+    return phys | (flags & ~(PAGE_NO_PS | PAGE_PS)) | PAGE_PRESENT;
 }
 
 static inline u64 block_pte(u64 phys, u64 flags)
@@ -0,0 +1,215 @@
+/* x86 performance monitoring: Intel architectural PMU (version 2 or later) and AMD PerfMonV2 */
+
+#include <kernel.h>
+#include <apic.h>
+#include <pmu.h>
+
+//#define PMU_DEBUG
+#ifdef PMU_DEBUG
+#define pmu_debug(x, ...) do {rprintf("PMU: " x, ##__VA_ARGS__);} while(0)
+#else
+#define pmu_debug(x, ...)
+#endif
+
+#define CPUID_FN_ARCH_PMU       0x0a
+#define CPUID_FN_AMD_PMU        0x80000022
+
+/* Intel */
+#define IA32_PMC0                   0xc1
+#define IA32_PERFEVTSEL0            0x186
+#define IA32_PERF_GLOBAL_STATUS     0x38e
+#define IA32_PERF_GLOBAL_CTRL       0x38f
+#define IA32_PERF_GLOBAL_OVF_CTRL   0x390
+
+/* AMD */
+#define AMD_PERF_CTL0               0xc0010200
+#define AMD_PERF_CTR0               0xc0010201
+#define AMD_PERF_GLOBAL_STATUS      0xc0000300
+#define AMD_PERF_GLOBAL_CTL         0xc0000301
+#define AMD_PERF_GLOBAL_STATUS_CLR  0xc0000302
+#define AMD_COUNTER_WIDTH           48
+
+#define PERFEVTSEL_USR      U64_FROM_BIT(16)
+#define PERFEVTSEL_OS       U64_FROM_BIT(17)
+#define PERFEVTSEL_PC       U64_FROM_BIT(19)
+#define PERFEVTSEL_INT      U64_FROM_BIT(20)
+#define PERFEVTSEL_ANY      U64_FROM_BIT(21)
+#define PERFEVTSEL_EN       U64_FROM_BIT(22)
+
+#define PERFEVTSEL_CTRL_BITS    (PERFEVTSEL_USR | PERFEVTSEL_OS | PERFEVTSEL_PC | PERFEVTSEL_INT | \
+                                 PERFEVTSEL_ANY | PERFEVTSEL_EN)
+
+/* Intel architectural events, in the order of the CPUID availability bit vector */
+static const struct {
+    u8 generic;
+    u16 event;
+} intel_arch_events[] = {
+    {PMU_EVENT_CPU_CYCLES, 0x003c},
+    {PMU_EVENT_INSTRUCTIONS, 0x00c0},
+    {PMU_EVENT_BUS_CYCLES, 0x013c},
+    {PMU_EVENT_CACHE_REFERENCES, 0x4f2e},
+    {PMU_EVENT_CACHE_MISSES, 0x412e},
+    {PMU_EVENT_BRANCH_INSTRUCTIONS, 0x00c4},
+    {PMU_EVENT_BRANCH_MISSES, 0x00c5},
+};
+
+static const struct {
+    u8 generic;
+    u16 event;
+} amd_events[] = {
+    {PMU_EVENT_CPU_CYCLES, 0x0076},
+    {PMU_EVENT_INSTRUCTIONS, 0x00c0},
+    {PMU_EVENT_CACHE_REFERENCES, 0xff60},
+    {PMU_EVENT_CACHE_MISSES, 0x0964},
+    {PMU_EVENT_BRANCH_INSTRUCTIONS, 0x00c2},
+    {PMU_EVENT_BRANCH_MISSES, 0x00c3},
+};
+
+BSS_RO_AFTER_INIT static struct {
+    int counters;
+    u64 mask;
+    boolean amd;
+    u32 evtsel_base, ctr_base, msr_stride;
+    u32 global_ctrl, global_status, global_status_clr;
+    u32 intel_events;       /* bitmap of available architectural events */
+    u64 vector;
+    thunk overflow_handler;
+} pmu;
+
+closure_func_basic(thunk, void, pmu_interrupt)
+{
+    apply(pmu.overflow_handler);
+
+    /* the LVT entry is masked when the interrupt is delivered */
+    apic_if->write(apic_if, APIC_LVT_PERF, pmu.vector);
+}
+
+boolean init_pmu(kernel_heaps kh, thunk overflow_handler)
+{
+    u32 v[4];
+    cpuid(0, 0, v);
+    boolean amd = (v[1] == 0x68747541);     /* "Auth"enticAMD */
+    if (amd) {
+        if (cpuid_highest_fn(true) < CPUID_FN_AMD_PMU)
+            return false;
+        cpuid(CPUID_FN_AMD_PMU, 0, v);
+        if (!(v[0] & 1))    /* PerfMonV2 */
+            return false;
+        pmu.counters = v[1] & 0xf;
+        pmu.mask = MASK(AMD_COUNTER_WIDTH);
+        pmu.evtsel_base = AMD_PERF_CTL0;
+        pmu.ctr_base = AMD_PERF_CTR0;
+        pmu.msr_stride = 2;
+        pmu.global_ctrl = AMD_PERF_GLOBAL_CTL;
+        pmu.global_status = AMD_PERF_GLOBAL_STATUS;
+        pmu.global_status_clr = AMD_PERF_GLOBAL_STATUS_CLR;
+    } else {
+        if (v[0] < CPUID_FN_ARCH_PMU)
+            return false;
+        cpuid(CPUID_FN_ARCH_PMU, 0, v);
+        u8 version = v[0] & 0xff;
+        if (version < 2)
+            return false;
+        pmu.counters = (v[0] >> 8) & 0xff;
+        pmu.mask = MASK((v[0] >> 16) & 0xff);
+        int event_count = MIN((v[0] >> 24) & 0xff, _countof(intel_arch_events));
+        pmu.intel_events = ~v[1] & MASK(event_count);
+        pmu.evtsel_base = IA32_PERFEVTSEL0;
+        pmu.ctr_base = IA32_PMC0;
+        pmu.msr_stride = 1;
+        pmu.global_ctrl = IA32_PERF_GLOBAL_CTRL;
+        pmu.global_status = IA32_PERF_GLOBAL_STATUS;
+        pmu.global_status_clr = IA32_PERF_GLOBAL_OVF_CTRL;
+    }
+    pmu.amd = amd;
+    pmu.counters = MIN(pmu.counters, 64);
+    if (pmu.counters == 0)
+        return false;
+    pmu.overflow_handler = overflow_handler;
+    pmu.vector = allocate_interrupt();
+    register_interrupt(pmu.vector, closure_func(heap_general(kh), thunk, pmu_interrupt),
+                       ss("pmu"));
+    pmu_debug("%s PMU, %d counters, mask 0x%lx, events 0x%x\n", amd ? ss("AMD") : ss("Intel"),
+              pmu.counters, pmu.mask, pmu.intel_events);
+    return true;
+}
+
+int pmu_counter_count(void)
+{
+    return pmu.counters;
+}
+
+u64 pmu_counter_mask(void)
+{
+    return pmu.mask;
+}
+
+boolean pmu_sampling_supported(void)
+{
+    return (pmu.counters > 0);
+}
+
+boolean pmu_hw_event(u64 id, u64 *event)
+{
+    if (pmu.amd) {
+        for (int i = 0; i < _countof(amd_events); i++)
+            if (amd_events[i].generic == id) {
+                *event = amd_events[i].event;
+                return true;
+            }
+    } else {
+        for (int i = 0; i < _countof(intel_arch_events); i++)
+            if ((intel_arch_events[i].generic == id) && (pmu.intel_events & U64_FROM_BIT(i))) {
+                *event = intel_arch_events[i].event;
+                return true;
+            }
+    }
+    return false;
+}
+
+/* Raw configs have the PERFEVTSEL layout; the control bits are managed by the kernel. */
+boolean pmu_raw_event(u64 config, u64 *event)
+{
+    if (config & PERFEVTSEL_CTRL_BITS)
+        return false;
+    if (!pmu.amd && (config >> 32))
+        return false;
+    *event = config;
+    return true;
+}
+
+void pmu_counter_start(int idx, u64 event, u64 flags, u64 value)
+{
+    u64 evtsel = event | PERFEVTSEL_EN;
+    if (flags & PMU_COUNT_USER)
+        evtsel |= PERFEVTSEL_USR;
+    if (flags & PMU_COUNT_KERNEL)
+        evtsel |= PERFEVTSEL_OS;
+    if (flags & PMU_COUNT_INTERRUPT) {
+        evtsel |= PERFEVTSEL_INT;
+        apic_if->write(apic_if, APIC_LVT_PERF, pmu.vector);
+    }
+    write_msr(pmu.evtsel_base + idx * pmu.msr_stride, 0);
+    write_msr(pmu.ctr_base + idx * pmu.msr_stride, value & pmu.mask);
+    write_msr(pmu.global_ctrl, MASK(pmu.counters));
+    write_msr(pmu.evtsel_base + idx * pmu.msr_stride, evtsel);
+}
+
+u64 pmu_counter_stop(int idx)
+{
+    write_msr(pmu.evtsel_base + idx * pmu.msr_stride, 0);
+    return read_msr(pmu.ctr_base + idx * pmu.msr_stride) & pmu.mask;
+}
+
+u64 pmu_counter_read(int idx)
+{
+    return read_msr(pmu.ctr_base + idx * pmu.msr_stride) & pmu.mask;
+}
+
+u64 pmu_overflow_status(void)
+{
+    u64 status = read_msr(pmu.global_status) & MASK(pmu.counters);
+    if (status)
+        write_msr(pmu.global_status_clr, status);
+    return status;
+}
@@ -110,7 +110,8 @@ static u64 setup_ucontext_fpstate(void **fpstate, thread t, u64 rsp)
 {
     rsp -= pad(extended_frame_size, 16);
     *fpstate = pointer_from_u64(rsp);
-    runtime_memcpy(*fpstate, frame_extended(t->context.frame), extended_frame_size);
+    void *area = frame_extended(t->context.frame);
+    xstate_copy_out(*fpstate, area, xstate_used_size(area));
     return rsp;
 }
 
@@ -123,7 +124,8 @@ boolean setup_sigframe(thread t, int signum, struct siginfo *si)
     context_frame f = thread_frame(t);
     u64 rsp;
 
-    if ((sa->sa_flags & SA_ONSTACK) && t->signal_stack)
+    /* nested handlers (e.g. of signals dispatched together) stay below the frame on the alt stack */
+    if ((sa->sa_flags & SA_ONSTACK) && t->signal_stack && !thread_is_on_altsigstack(t))
         rsp = u64_from_pointer(t->signal_stack + t->signal_stack_length);
     else
         rsp = f[FRAME_RSP];
@@ -198,8 +200,11 @@ void restore_ucontext(struct ucontext * uctx, thread t)
     else
         f[FRAME_CS] &= ~1;
     t->signal_mask = normalize_signal_mask(mcontext->oldmask);
-    if (mcontext->fpstate)
-        runtime_memcpy(frame_extended(t->context.frame), mcontext->fpstate, extended_frame_size);
+    if (mcontext->fpstate) {
+        runtime_memcpy(frame_extended(t->context.frame), mcontext->fpstate,
+                       xstate_used_size(mcontext->fpstate));
+        frame_extended_modified(t->context.frame);
+    }
 }
 
 void reg_copy_out(struct core_regs *r, thread t)
@@ -242,8 +247,7 @@ u64 fpreg_size(void)
 
 void fpreg_copy_out(void *b, thread t)
 {
-    runtime_memcpy(b, pointer_from_u64(t->context.frame[FRAME_EXTENDED]),
-        fpreg_size());
+    xstate_copy_out(b, frame_extended(t->context.frame), fpreg_size());
 }
 
 void register_other_syscalls(struct syscall *map)
@@ -271,8 +275,8 @@ void register_other_syscalls(struct syscall *map)
     register_syscall(map, lchown, syscall_ignore, 0);
     init_syscall(map, ptrace, 0);
     init_syscall(map, syslog, 0);
-    register_syscall(map, getgid, syscall_ignore, 0);
-    register_syscall(map, getegid, syscall_ignore, 0);
+    register_syscall(map, getgid, syscall_ignore, SYSCALL_F_LEAF);
+    register_syscall(map, getegid, syscall_ignore, SYSCALL_F_LEAF);
     init_syscall(map, setpgid, 0);
     init_syscall(map, getppid, 0);
     init_syscall(map, getpgrp, 0);
@@ -371,8 +375,6 @@ void register_other_syscalls(struct syscall *map)
     init_syscall(map, add_key, 0);
     init_syscall(map, request_key, 0);
     init_syscall(map, keyctl, 0);
-    init_syscall(map, ioprio_set, 0);
-    init_syscall(map, ioprio_get, 0);
     init_syscall(map, migrate_pages, 0);
     init_syscall(map, mknodat, 0);
     register_syscall(map, fchownat, syscall_ignore, 0);
@@ -406,7 +408,6 @@ void register_other_syscalls(struct syscall *map)
     init_syscall(map, userfaultfd, 0);
     init_syscall(map, membarrier, 0);
     register_syscall(map, mlock2, syscall_ignore, 0);
-    init_syscall(map, copy_file_range, 0);
     init_syscall(map, preadv2, 0);
     init_syscall(map, pwritev2, 0);
     init_syscall(map, pkey_mprotect, 0);
@@ -330,9 +330,14 @@
 #define SYS_pkey_mprotect			329
 #define SYS_pkey_alloc				330
 #define SYS_pkey_free				331
+#define SYS_statx				332
 #define SYS_io_uring_setup			425
 #define SYS_io_uring_enter			426
 #define SYS_io_uring_register			427
 #define SYS_clone3				435
+#define SYS_futex_waitv				449
+#define SYS_futex_wake				454
+#define SYS_futex_wait				455
+#define SYS_futex_requeue			456
 
-#define SYS_MAX 451
+#define SYS_MAX 457
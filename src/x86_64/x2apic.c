@@ -19,14 +19,14 @@ static void inline check_reg(int reg)
     assert(reg != APIC_ICR + 1);
 }
 
-static void x2apic_write(apic_iface i, int reg, u64 val)
+void x2apic_write(apic_iface i, int reg, u64 val)
 {
     x2apic_debug("write to reg 0x%x, val 0x%x\n", reg, val);
     check_reg(reg);
     asm volatile("wrmsr" :: "a" (val), "c" (reg), "d" (val >> 32) : "memory");
 }
 
-static u64 x2apic_read(apic_iface i, int reg)
+u64 x2apic_read(apic_iface i, int reg)
 {
     x2apic_debug("read from reg 0x%x\n", reg);
     check_reg(reg);
@@ -37,13 +37,13 @@ static u64 x2apic_read(apic_iface i, int reg)
     return d;
 }
 
-static u32 x2apic_get_id(apic_iface i)
+u32 x2apic_get_id(apic_iface i)
 {
     return x2apic_read(i, APIC_APICID) & 0xffffffff;
 }
 
 #define XAPIC_READ_TIMEOUT_ITERS 512 /* arbitrary */
-static void x2apic_ipi(apic_iface i, u32 target, u64 flags, u8 vector)
+void x2apic_ipi(apic_iface i, u32 target, u64 flags, u8 vector)
 {
     u64 w;
     u64 icr = (flags & ~0xff) | vector;
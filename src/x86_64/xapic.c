@@ -24,14 +24,14 @@ static u64 xapic_from_x2apic_reg(int reg)
     return (reg & 0xff) << 4;
 }
 
-static void xapic_write(apic_iface i, int reg, u64 val)
+void xapic_write(apic_iface i, int reg, u64 val)
 {
     xapic_debug("write to reg 0x%x, val 0x%x\n", reg, val);
     assert((val & ~MASK(32)) == 0); /* 32 bit only on xapic */
     *(volatile u32 *)(xapic_vbase + xapic_from_x2apic_reg(reg)) = (u32)val;
 }
 
-static u64 xapic_read(apic_iface i, int reg)
+u64 xapic_read(apic_iface i, int reg)
 {
     xapic_debug("read from reg 0x%x\n", reg);
     u32 d = *(volatile u32 *)(xapic_vbase + xapic_from_x2apic_reg(reg));
@@ -39,13 +39,13 @@ static u64 xapic_read(apic_iface i, int reg)
     return d;
 }
 
-static u32 xapic_get_id(apic_iface i)
+u32 xapic_get_id(apic_iface i)
 {
     return xapic_read(i, APIC_APICID) >> 24;
 }
 
 #define XAPIC_READ_TIMEOUT_ITERS 512 /* arbitrary */
-static void xapic_ipi(apic_iface i, u32 target, u64 flags, u8 vector)
+void xapic_ipi(apic_iface i, u32 target, u64 flags, u8 vector)
 {
     u64 w;
     u64 icr = (flags & ~0xff) | vector;
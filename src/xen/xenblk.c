@@ -16,6 +16,16 @@
           sizeof(((struct blkif_sring *)0)->ring[0])))
 #define XENBLK_SECTORS_PER_PAGE (PAGESIZE / SECTOR_SIZE)
 
+/* The request ring spans up to 2^XENBLK_RING_PAGE_ORDER_MAX pages, if the backend supports
+ * multi-page rings. */
+#define XENBLK_RING_PAGE_ORDER_MAX  2
+#define XENBLK_RING_PAGES_MAX       U64_FROM_BIT(XENBLK_RING_PAGE_ORDER_MAX)
+
+/* With persistent grants (if supported by the backend), data is copied to and from a pool of pages
+ * that stay granted to the backend, so that the backend can keep them mapped instead of mapping
+ * and unmapping the pages of each request. */
+#define XENBLK_PGRANTS_MAX(xbd) (RING_SIZE(&(xbd)->ring) * BLKIF_MAX_SEGMENTS_PER_REQUEST)
+
 //#define XENBLK_DEBUG
 #ifdef XENBLK_DEBUG
 #define xenblk_debug(x, ...) do {rprintf("XBLK: " x "\n", ##__VA_ARGS__);} while(0)
@@ -37,7 +47,11 @@ struct xenblk_dev {
     tuple meta;
     u64 capacity;
     blkif_front_ring_t ring;
-    grant_ref_t ring_gntref;
+    u8 ring_page_order;
+    grant_ref_t ring_gntrefs[XENBLK_RING_PAGES_MAX];
+    boolean persistent;
+    u64 pgrant_count;
+    struct list pgrants;    /* xenblk_pgrant */
     evtchn_port_t evtchn;
     closure_struct(xenblk_io, read);
     closure_struct(xenblk_io, write);
@@ -63,12 +77,23 @@ typedef struct xenblk_req {
     status s;
 } *xenblk_req;
 
+typedef struct xenblk_pgrant {
+    struct list l;
+    void *buf;
+    grant_ref_t gref;
+} *xenblk_pgrant;
+
 typedef struct xenblk_ring_req {
     struct list l;
     u64 id;
     xenblk_req req;
     u8 segments;
     grant_ref_t grefs[BLKIF_MAX_SEGMENTS_PER_REQUEST];
+    struct {
+        xenblk_pgrant pg;
+        void *buf;      /* destination of read data */
+        u32 len;
+    } pseg[BLKIF_MAX_SEGMENTS_PER_REQUEST];    /* with persistent grants */
 } *xenblk_ring_req;
 
 static xenblk_req xenblk_get_req(xenblk_dev xbd)
@@ -109,11 +134,69 @@ static xenblk_ring_req xenblk_get_rreq(xenblk_dev xbd)
     return req;
 }
 
+/* Called with mutex locked */
+static xenblk_pgrant xenblk_get_pgrant(xenblk_dev xbd)
+{
+    list l = list_get_next(&xbd->pgrants);
+    if (l) {
+        list_delete(l);
+        return struct_from_list(l, xenblk_pgrant, l);
+    }
+    if (xbd->pgrant_count >= XENBLK_PGRANTS_MAX(xbd))
+        return 0;
+    xenblk_pgrant pg = allocate(xbd->h, sizeof(*pg));
+    if (pg == INVALID_ADDRESS)
+        return 0;
+    pg->buf = allocate(xbd->contiguous, PAGESIZE);
+    if (pg->buf == INVALID_ADDRESS)
+        goto dealloc_pg;
+    pg->gref = xen_grant_page_access(xbd->dev.backend_id, physical_from_virtual(pg->buf), false);
+    if (!pg->gref)
+        goto dealloc_buf;
+    xbd->pgrant_count++;
+    return pg;
+  dealloc_buf:
+    deallocate(xbd->contiguous, pg->buf, PAGESIZE);
+  dealloc_pg:
+    deallocate(xbd->h, pg, sizeof(*pg));
+    return 0;
+}
+
+/* Called with mutex locked; the pool is used LIFO, so that the most recently used grants (likely
+ * still mapped by the backend) are reused first. */
+static void xenblk_put_pgrant(xenblk_dev xbd, xenblk_pgrant pg)
+{
+    list_insert_after(&xbd->pgrants, &pg->l);
+}
+
+/* Called with the mutex locked. Fills a segment with up to a page of data copied from the request
+ * buffer to a persistently granted page; returns false if no page is available. */
+static boolean xenblk_fill_pseg(xenblk_dev xbd, xenblk_req xbreq, xenblk_ring_req rreq,
+                                struct blkif_request_segment *seg, u8 index)
+{
+    xenblk_pgrant pg = xenblk_get_pgrant(xbd);
+    if (!pg)
+        return false;
+    u64 sectors = MIN(range_span(xbreq->remain), XENBLK_SECTORS_PER_PAGE);
+    u32 len = sectors * SECTOR_SIZE;
+    if (xbreq->operation == BLKIF_OP_WRITE)
+        runtime_memcpy(pg->buf, xbreq->buf, len);
+    rreq->pseg[index].pg = pg;
+    rreq->pseg[index].buf = xbreq->buf;
+    rreq->pseg[index].len = len;
+    seg->gref = pg->gref;
+    seg->first_sect = 0;
+    seg->last_sect = sectors - 1;
+    xbreq->remain.start += sectors;
+    xbreq->buf += len;
+    return true;
+}
+
 /* Called with the mutex locked. */
 static void xenblk_service_pending(xenblk_dev xbd)
 {
     RING_IDX prod = xbd->ring.req_prod_pvt;
-    RING_IDX prod_end = xbd->ring.rsp_cons + XENBLK_RING_SIZE;
+    RING_IDX prod_end = xbd->ring.rsp_cons + RING_SIZE(&xbd->ring);
     xenblk_debug("%s: prod %d, prod_end %d", func_ss, prod, prod_end);
     while (prod < prod_end) {
         blkif_request_t *req = RING_GET_REQUEST(&xbd->ring, prod);
@@ -144,6 +227,15 @@ static void xenblk_service_pending(xenblk_dev xbd)
                 break;
             }
             struct blkif_request_segment *seg = &req->seg[req->nr_segments];
+            if (xbd->persistent) {
+                if (!xenblk_fill_pseg(xbd, xbreq, rreq, seg, req->nr_segments)) {
+                    out_of_grants = true;
+                    break;
+                }
+                xenblk_debug("  persistent segment %d [%d, %d]", req->nr_segments,
+                             seg->first_sect, seg->last_sect);
+                continue;
+            }
             u64 phys = physical_from_virtual(xbreq->buf);
             assert(phys != INVALID_PHYSICAL);
             seg->gref = xen_grant_page_access(xbd->dev.backend_id, phys,
@@ -167,6 +259,8 @@ static void xenblk_service_pending(xenblk_dev xbd)
             rreq->segments = req->nr_segments;
             xbreq->pending++;
             prod++;
+        } else {
+            list_insert_before(list_begin(&xbd->free_rreqs), &rreq->l);
         }
         if (out_of_grants)
             break;
@@ -192,10 +286,19 @@ static void xenblk_service_ring(xenblk_dev xbd)
             blkif_response_t *resp = RING_GET_RESPONSE(&xbd->ring, cons);
             xenblk_ring_req rreq = vector_get(xbd->rreqs, resp->id);
             assert(rreq);
-            for (u8 segment = 0; segment < rreq->segments; segment++)
-                xen_revoke_page_access(rreq->grefs[segment]);
-            list_insert_before(list_begin(&xbd->free_rreqs), &rreq->l);
             xenblk_req req = rreq->req;
+            if (xbd->persistent) {
+                for (u8 segment = 0; segment < rreq->segments; segment++) {
+                    xenblk_pgrant pg = rreq->pseg[segment].pg;
+                    if ((req->operation == BLKIF_OP_READ) && (resp->status == BLKIF_RSP_OKAY))
+                        runtime_memcpy(rreq->pseg[segment].buf, pg->buf, rreq->pseg[segment].len);
+                    xenblk_put_pgrant(xbd, pg);
+                }
+            } else {
+                for (u8 segment = 0; segment < rreq->segments; segment++)
+                    xen_revoke_page_access(rreq->grefs[segment]);
+            }
+            list_insert_before(list_begin(&xbd->free_rreqs), &rreq->l);
             if ((resp->status != BLKIF_RSP_OKAY) && (req->s == STATUS_OK)) {
                 req->s = timm("result", "xenblk error %d", resp->status);
             }
@@ -263,6 +366,13 @@ closure_func_basic(thunk, void, xenblk_bh_service)
     spin_unlock(&xbd->lock);
 }
 
+static void xenblk_ring_free(xenblk_dev xbd, int granted_pages)
+{
+    for (int i = 0; i < granted_pages; i++)
+        xen_revoke_page_access(xbd->ring_gntrefs[i]);
+    deallocate(xbd->contiguous, xbd->ring.sring, PAGESIZE << xbd->ring_page_order);
+}
+
 static void xenblk_remove(xenblk_dev xbd)
 {
     xenblk_debug("removing device %p", xbd);
@@ -276,8 +386,15 @@ static void xenblk_remove(xenblk_dev xbd)
     xen_driver_unbind(xbd->meta);
     xenbus_set_state(0, xbd->dev.frontend, XenbusStateClosed);
     xen_close_evtchn(xbd->evtchn);
-    xen_revoke_page_access(xbd->ring_gntref);
-    deallocate(xbd->contiguous, xbd->ring.sring, PAGESIZE);
+    xenblk_ring_free(xbd, 1 << xbd->ring_page_order);
+    list l;
+    while ((l = list_get_next(&xbd->pgrants))) {
+        list_delete(l);
+        xenblk_pgrant pg = struct_from_list(l, xenblk_pgrant, l);
+        xen_revoke_page_access(pg->gref);
+        deallocate(xbd->contiguous, pg->buf, PAGESIZE);
+        deallocate(xbd->h, pg, sizeof(*pg));
+    }
     deallocate_vector(xbd->rreqs);
     deallocate(xbd->h, xbd, sizeof(*xbd));
 }
@@ -330,6 +447,13 @@ closure_func_basic(thunk, void, xenblk_watch_service)
             goto remove;
         }
         xbd->capacity = sector_size * sectors;
+        u64 persistent;
+        s = xenstore_read_u64(0, xd->backend, ss("feature-persistent"), &persistent);
+        if (is_ok(s))
+            xbd->persistent = (persistent != 0);
+        else
+            timm_dealloc(s);
+        xenblk_debug("persistent grants %s", xbd->persistent ? ss("enabled") : ss("disabled"));
         s = xenbus_set_state(0, xd->frontend, XenbusStateConnected);
         if (!is_ok(s)) {
             msg_err("cannot set frontend state to connected: %v\n", s);
@@ -405,8 +529,26 @@ static status xenblk_inform_backend(xenblk_dev xbd)
     s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%s"), ss(XEN_IO_PROTO_ABI_NATIVE));
     if (!is_ok(s))
         goto abort;
-    node = ss("ring-ref");
-    s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%d"), xbd->ring_gntref);
+    if (xbd->ring_page_order == 0) {
+        node = ss("ring-ref");
+        s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%d"), xbd->ring_gntrefs[0]);
+        if (!is_ok(s))
+            goto abort;
+    } else {
+        node = ss("ring-page-order");
+        s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%d"), xbd->ring_page_order);
+        if (!is_ok(s))
+            goto abort;
+        for (int i = 0; i < (1 << xbd->ring_page_order); i++) {
+            char ring_ref[16];
+            node = isstring(ring_ref, rsnprintf(ring_ref, sizeof(ring_ref), "ring-ref%d", i));
+            s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%d"), xbd->ring_gntrefs[i]);
+            if (!is_ok(s))
+                goto abort;
+        }
+    }
+    node = ss("feature-persistent");
+    s = xenstore_sync_printf(tx_id, xd->frontend, node, ss("%d"), 1);
     if (!is_ok(s))
         goto abort;
     node = ss("event-channel");
@@ -437,18 +579,31 @@ static status xenblk_inform_backend(xenblk_dev xbd)
 static status xenblk_enable(xenblk_dev xbd)
 {
     xen_dev xd = &xbd->dev;
-    blkif_sring_t *ring = allocate_zero(xbd->contiguous, PAGESIZE);
+    u64 max_order;
+    status s = xenstore_read_u64(0, xd->backend, ss("max-ring-page-order"), &max_order);
+    if (is_ok(s)) {
+        xbd->ring_page_order = MIN(max_order, XENBLK_RING_PAGE_ORDER_MAX);
+    } else {
+        timm_dealloc(s);
+        xbd->ring_page_order = 0;
+    }
+    bytes ring_size = PAGESIZE << xbd->ring_page_order;
+    blkif_sring_t *ring = allocate_zero(xbd->contiguous, ring_size);
     if (ring == INVALID_ADDRESS)
         return timm("result", "cannot allocate ring");
     SHARED_RING_INIT(ring);
-    FRONT_RING_INIT(&xbd->ring, ring, PAGESIZE);
-    status s;
-    xbd->ring_gntref = xen_grant_page_access(xd->backend_id,
-        physical_from_virtual(ring), false);
-    if (xbd->ring_gntref == 0) {
-        s = timm("result", "failed to obtain grant reference for ring");
-        goto out_dealloc;
+    FRONT_RING_INIT(&xbd->ring, ring, ring_size);
+    int granted_pages;
+    for (granted_pages = 0; granted_pages < (1 << xbd->ring_page_order); granted_pages++) {
+        grant_ref_t gref = xen_grant_page_access(xd->backend_id,
+            physical_from_virtual((void *)ring + granted_pages * PAGESIZE), false);
+        if (gref == 0) {
+            s = timm("result", "failed to obtain grant reference for ring");
+            goto out_revoke;
+        }
+        xbd->ring_gntrefs[granted_pages] = gref;
     }
+    xenblk_debug("ring page order %d, %d entries", xbd->ring_page_order, RING_SIZE(&xbd->ring));
     s = xen_allocate_evtchn(xd->backend_id, &xbd->evtchn);
     if (!is_ok(s))
         goto out_revoke;
@@ -474,9 +629,7 @@ static status xenblk_enable(xenblk_dev xbd)
   out_evtchn:
     xen_close_evtchn(xbd->evtchn);
   out_revoke:
-    xen_revoke_page_access(xbd->ring_gntref);
-  out_dealloc:
-    deallocate(xbd->contiguous, ring, PAGESIZE);
+    xenblk_ring_free(xbd, granted_pages);
     return s;
 }
 
@@ -510,6 +663,9 @@ closure_function(2, 3, boolean, xenblk_probe,
     list_init(&xbd->done);
     list_init(&xbd->free);
     list_init(&xbd->free_rreqs);
+    list_init(&xbd->pgrants);
+    xbd->persistent = false;
+    xbd->pgrant_count = 0;
     spin_lock_init(&xbd->lock);
     xbd->sa = bound(sa);
     xbd->meta = meta;
@@ -59,6 +59,9 @@ typedef struct xennet_tx_buf {
     u16 npages;
     u16 nextpage;
     buffer pages;               /* array of xennet_txpages */
+    void *copybuf;              /* persistently granted page for small frames */
+    u64 copybuf_paddr;
+    grant_ref_t copybuf_gntref;
 } *xennet_tx_buf;
 
 typedef struct xennet_tx_page {
@@ -92,6 +95,7 @@ struct xennet_dev {
 
     thunk rx_service;           /* for runqueue processing */
     queue rx_servicequeue;
+    struct net_gro rx_gro;
 
     struct spinlock tx_fill_lock;
     vector txbufs;
@@ -241,6 +245,20 @@ static xennet_tx_buf xennet_get_txbuf(xennet_dev xd)
     txb->nextpage = 0;
     txb->pages = allocate_buffer(xd->h, sizeof(struct xennet_tx_page) * 4);
 
+    /* Frames that fit in a page are copied to a page that stays granted to the backend for the
+       lifetime of the buffer, instead of granting and revoking access to the pbuf pages. */
+    txb->copybuf = allocate(xd->contiguous, PAGESIZE);
+    if (txb->copybuf != INVALID_ADDRESS) {
+        txb->copybuf_paddr = physical_from_virtual(txb->copybuf);
+        txb->copybuf_gntref = xen_grant_page_access(xd->dev.backend_id, txb->copybuf_paddr, true);
+        if (!txb->copybuf_gntref) {
+            deallocate(xd->contiguous, txb->copybuf, PAGESIZE);
+            txb->copybuf = 0;
+        }
+    } else {
+        txb->copybuf = 0;
+    }
+
     flags = spin_lock_irq(&xd->tx_fill_lock);
     txb->idx = vector_length(xd->txbufs);
     vector_push(xd->txbufs, txb);
@@ -307,11 +325,13 @@ closure_function(1, 0, void, xennet_tx_service_bh,
         list_foreach(&q, i) {
             xennet_tx_buf txb = struct_from_list(i, xennet_tx_buf, l);
             list_delete(i);
-            for (int j = 0; j < xennet_get_n_tx_pages(txb); j++) {
-                xennet_tx_page txp = xennet_get_tx_page(txb, j);
-                xen_revoke_page_access(txp->gntref);
+            if (txb->p) {
+                for (int j = 0; j < xennet_get_n_tx_pages(txb); j++) {
+                    xennet_tx_page txp = xennet_get_tx_page(txb, j);
+                    xen_revoke_page_access(txp->gntref);
+                }
+                pbuf_free(txb->p);
             }
-            pbuf_free(txb->p);
             xennet_return_txbuf(xd, txb);
         }
     }
@@ -407,6 +427,19 @@ static void xennet_tx_buf_add_pages(xennet_dev xd, xennet_tx_buf txb, struct pbu
         txp->end = true;
 }
 
+static void xennet_tx_buf_copy(xennet_tx_buf txb, struct pbuf *p)
+{
+    pbuf_copy_partial(p, txb->copybuf, p->tot_len, 0);
+    extend_total(txb->pages, sizeof(struct xennet_tx_page));
+    xennet_tx_page txp = xennet_get_tx_page(txb, 0);
+    txp->paddr = txb->copybuf_paddr;
+    txp->gntref = txb->copybuf_gntref;
+    txp->offset = 0;
+    txp->len = p->tot_len;
+    txp->end = true;
+    txb->npages = 1;
+}
+
 /* enqueue tx buffer for subsequent ring processing */
 static err_t xennet_linkoutput(struct netif *netif, struct pbuf *p)
 {
@@ -416,9 +449,13 @@ static err_t xennet_linkoutput(struct netif *netif, struct pbuf *p)
     xennet_tx_buf txb = xennet_get_txbuf(xd);
     if (txb == INVALID_ADDRESS)
         return ERR_MEM;
-    pbuf_ref(p);
-    txb->p = p;
-    xennet_tx_buf_add_pages(xd, txb, p);
+    if (txb->copybuf && (p->tot_len <= PAGESIZE)) {
+        xennet_tx_buf_copy(txb, p);
+    } else {
+        pbuf_ref(p);
+        txb->p = p;
+        xennet_tx_buf_add_pages(xd, txb, p);
+    }
 
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
@@ -632,14 +669,10 @@ closure_function(1, 0, void, xennet_rx_service_bh,
             assert(i);
             xennet_rx_buf rxb = struct_from_list(i, xennet_rx_buf, l);
             list_delete(i);
-            struct netif *n = &xd->ndev.n;
-            err_enum_t err = n->input((struct pbuf *)&rxb->p, n);
-            if (err != ERR_OK) {
-                msg_err("xennet: rx drop by stack, err %d\n", err);
-                xennet_return_rxbuf((struct pbuf *)&rxb->p);
-            }
+            net_gro_receive(&xd->rx_gro, (struct pbuf *)&rxb->p);
         }
     }
+    net_gro_flush(&xd->rx_gro);
     xennet_debug("%s exit", func_ss);
 }
 
@@ -797,6 +830,7 @@ static status xennet_attach(kernel_heaps kh, int id, buffer frontend, tuple meta
     xd->rx_servicequeue = allocate_queue(h, XENNET_RX_SERVICEQUEUE_DEPTH);
     assert(xd->rx_servicequeue != INVALID_ADDRESS);
     xd->rx_service = closure(h, xennet_rx_service_bh, xd);
+    net_gro_init(&xd->rx_gro, &xd->ndev.n, false);
 
     spin_lock_init(&xd->rx_fill_lock);
     spin_lock_init(&xd->tx_fill_lock);
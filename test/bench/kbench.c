@@ -0,0 +1,26 @@
+#include <time.h>
+#include <runtime.h>
+
+#include "../test_utils.h"
+#include "kbench.h"
+
+/* Host-side runtime microbenchmarks; see kbench.h. Usage: kbench */
+
+static u64 kbench_nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static void kbench_report(sstring name, u64 ops, u64 nsecs)
+{
+    rprintf(KBENCH_REPORT_FORMAT, name, ops, nsecs);
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+    kbench_run_common(h);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/* Runtime microbenchmarks, shared by the host-side kbench program (test/bench/kbench.c) and the
+ * in-kernel bench klib (klib/test/bench.c).
+ *
+ * The including file defines kbench_nsecs(), returning a monotonic time in nanoseconds, and
+ * kbench_report(), which prints the result of a benchmark. Results are reported one benchmark per
+ * line:
+ *   kbench {"name":"<name>","ops":<ops>,"nsecs":<nsecs>}
+ * with an additional "allocs":<count> field for benchmarks that count kernel closure allocations,
+ * which tools/kbench-compare.py compares across runs.
+ */
+
+#define KBENCH_REPORT_FORMAT    "kbench {\"name\":\"%s\",\"ops\":%ld,\"nsecs\":%ld}\n"
+
+static u64 kbench_nsecs(void);
+static void kbench_report(sstring name, u64 ops, u64 nsecs);
+
+#define KBENCH_ALLOC_BATCH      64
+#define KBENCH_ALLOC_SIZE       64
+#define KBENCH_ALLOC_OPS        (1 << 20)
+#define KBENCH_TABLE_ENTRIES    4096
+#define KBENCH_TABLE_OPS        (1 << 22)
+#define KBENCH_RBTREE_NODES     4096
+#define KBENCH_RBTREE_ROUNDS    64
+#define KBENCH_TIMERS           1024
+#define KBENCH_TIMER_ROUNDS     256
+#define KBENCH_SG_BUFS          16
+#define KBENCH_SG_OPS           (1 << 14)
+#define KBENCH_CLOSURE_OPS      (1 << 24)
+
+/* multiplication by an odd constant is a bijection, which yields distinct, scattered keys */
+#define kbench_key(i)   ((u64)(i) * 0x9e3779b97f4a7c15ull)
+
+static void kbench_alloc(heap h, sstring name)
+{
+    void *p[KBENCH_ALLOC_BATCH];
+    u64 t0 = kbench_nsecs();
+    for (int n = 0; n < KBENCH_ALLOC_OPS / KBENCH_ALLOC_BATCH; n++) {
+        for (int i = 0; i < KBENCH_ALLOC_BATCH; i++) {
+            p[i] = allocate(h, KBENCH_ALLOC_SIZE);
+            assert(p[i] != INVALID_ADDRESS);
+        }
+        for (int i = 0; i < KBENCH_ALLOC_BATCH; i++)
+            deallocate(h, p[i], KBENCH_ALLOC_SIZE);
+    }
+    kbench_report(name, KBENCH_ALLOC_OPS, kbench_nsecs() - t0);
+}
+
+static void kbench_table_lookup(heap h)
+{
+    table t = allocate_table(h, identity_key, pointer_equal);
+    assert(t != INVALID_ADDRESS);
+    for (u64 i = 1; i <= KBENCH_TABLE_ENTRIES; i++)
+        table_set(t, pointer_from_u64(kbench_key(i)), pointer_from_u64(i));
+    u64 found = 0;
+    u64 t0 = kbench_nsecs();
+    for (u64 i = 0; i < KBENCH_TABLE_OPS; i++) {
+        if (table_find(t, pointer_from_u64(kbench_key((i % KBENCH_TABLE_ENTRIES) + 1))))
+            found++;
+    }
+    kbench_report(ss("table_lookup"), KBENCH_TABLE_OPS, kbench_nsecs() - t0);
+    assert(found == KBENCH_TABLE_OPS);
+    deallocate_table(t);
+}
+
+typedef struct kbench_rbnode {
+    struct rbnode node;
+    u64 key;
+} *kbench_rbnode;
+
+closure_func_basic(rb_key_compare, int, kbench_rb_compare,
+                   rbnode a, rbnode b)
+{
+    u64 ka = ((kbench_rbnode)a)->key, kb = ((kbench_rbnode)b)->key;
+    return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+static void kbench_rbtree_insert(heap h)
+{
+    kbench_rbnode nodes = allocate(h, KBENCH_RBTREE_NODES * sizeof(struct kbench_rbnode));
+    assert(nodes != INVALID_ADDRESS);
+    for (int i = 0; i < KBENCH_RBTREE_NODES; i++)
+        nodes[i].key = kbench_key(i);
+    struct rbtree t;
+    init_rbtree(&t, stack_closure_func(rb_key_compare, kbench_rb_compare), 0);
+    u64 elapsed = 0;
+    for (int r = 0; r < KBENCH_RBTREE_ROUNDS; r++) {
+        for (int i = 0; i < KBENCH_RBTREE_NODES; i++)
+            init_rbnode(&nodes[i].node);
+        u64 t0 = kbench_nsecs();
+        for (int i = 0; i < KBENCH_RBTREE_NODES; i++)
+            assert(rbtree_insert_node(&t, &nodes[i].node));
+        elapsed += kbench_nsecs() - t0;
+        for (int i = 0; i < KBENCH_RBTREE_NODES; i++)
+            rbtree_remove_node(&t, &nodes[i].node);
+    }
+    kbench_report(ss("rbtree_insert"), KBENCH_RBTREE_NODES * KBENCH_RBTREE_ROUNDS, elapsed);
+    deallocate(h, nodes, KBENCH_RBTREE_NODES * sizeof(struct kbench_rbnode));
+}
+
+closure_func_basic(clock_now, timestamp, kbench_clock_now)
+{
+    return 0;
+}
+
+closure_func_basic(timer_handler, void, kbench_timer_handler,
+                   u64 expiry, u64 overruns)
+{
+}
+
+/* register and remove timers with scattered expiries in a timer queue */
+static void kbench_timer(heap h)
+{
+    timerqueue tq = allocate_timerqueue(h, stack_closure_func(clock_now, kbench_clock_now),
+                                        ss("kbench"));
+    assert(tq != INVALID_ADDRESS);
+    struct timer *timers = allocate(h, KBENCH_TIMERS * sizeof(struct timer));
+    assert(timers != INVALID_ADDRESS);
+    timer_handler th = stack_closure_func(timer_handler, kbench_timer_handler);
+    u64 t0 = kbench_nsecs();
+    for (int r = 0; r < KBENCH_TIMER_ROUNDS; r++) {
+        for (int i = 0; i < KBENCH_TIMERS; i++) {
+            init_timer(&timers[i]);
+            register_timer(tq, &timers[i], CLOCK_ID_MONOTONIC,
+                           microseconds(1 + kbench_key(i) % MILLION), false, 0, th);
+        }
+        for (int i = 0; i < KBENCH_TIMERS; i++)
+            assert(remove_timer(tq, &timers[i], 0));
+    }
+    kbench_report(ss("timer_insert_remove"), KBENCH_TIMERS * KBENCH_TIMER_ROUNDS,
+                  kbench_nsecs() - t0);
+    deallocate(h, timers, KBENCH_TIMERS * sizeof(struct timer));
+    deallocate_timerqueue(tq);
+}
+
+/* gather KBENCH_SG_BUFS pages into a contiguous buffer */
+static void kbench_sg_copy(heap h)
+{
+    u64 len = KBENCH_SG_BUFS * PAGESIZE;
+    void *src = allocate(h, len);
+    assert(src != INVALID_ADDRESS);
+    void *dest = allocate(h, len);
+    assert(dest != INVALID_ADDRESS);
+    runtime_memset(src, 0xa5, len);
+    sg_list sg = allocate_sg_list();
+    assert(sg != INVALID_ADDRESS);
+    u64 t0 = kbench_nsecs();
+    for (int n = 0; n < KBENCH_SG_OPS; n++) {
+        for (int i = 0; i < KBENCH_SG_BUFS; i++) {
+            sg_buf sgb = sg_list_tail_add(sg, PAGESIZE);
+            assert(sgb != INVALID_ADDRESS);
+            sgb->buf = src + i * PAGESIZE;
+            sgb->size = PAGESIZE;
+            sgb->offset = 0;
+            sgb->refcount = 0;
+        }
+        assert(sg_copy_to_buf(dest, sg, len) == len);
+    }
+    kbench_report(ss("sg_copy_64k"), KBENCH_SG_OPS, kbench_nsecs() - t0);
+    deallocate_sg_list(sg);
+    deallocate(h, dest, len);
+    deallocate(h, src, len);
+}
+
+closure_function(1, 0, void, kbench_closure,
+                 u64 *, count)
+{
+    (*bound(count))++;
+}
+
+static void kbench_closure_apply(heap h)
+{
+    u64 count = 0;
+    thunk t = closure(h, kbench_closure, &count);
+    assert(t != INVALID_ADDRESS);
+    /* keep the call indirect */
+    thunk * volatile tp = &t;
+    u64 t0 = kbench_nsecs();
+    for (u64 i = 0; i < KBENCH_CLOSURE_OPS; i++)
+        apply(*tp);
+    kbench_report(ss("closure_apply"), KBENCH_CLOSURE_OPS, kbench_nsecs() - t0);
+    assert(count == KBENCH_CLOSURE_OPS);
+    deallocate_closure(t);
+}
+
+/* benchmarks common to the host and kernel runtimes */
+static void kbench_run_common(heap h)
+{
+    kbench_alloc(h, ss("alloc_64"));
+    kbench_table_lookup(h);
+    kbench_rbtree_insert(h);
+    kbench_timer(h);
+    kbench_sg_copy(h);
+    kbench_closure_apply(h);
+}
@@ -5,3 +5,11 @@ import "testing"
 func TestE2E(t *testing.T) {
 	RunE2ETests(t)
 }
+
+func TestNetBench(t *testing.T) {
+	RunNetBench(t)
+}
+
+func TestMemBench(t *testing.T) {
+	RunMemBench(t)
+}
@@ -0,0 +1,210 @@
+package e2e
+
+import (
+	"encoding/json"
+	"fmt"
+	"io"
+	"os"
+	"os/exec"
+	"runtime"
+	"strconv"
+	"strings"
+	"testing"
+	"time"
+)
+
+// Memory benchmark: runs the node_alloc, python_alloc and ruby_alloc apps in benchmark mode
+// (MEMBENCH set in their environment) with a range of vCPU counts. Each app grows its heap by a
+// given amount, maps, touches and unmaps large buffers, and times garbage collections over a
+// large object graph; it reports fault counts (from /proc/vmstat), memory in use (from
+// /proc/meminfo) and latencies on a line starting with "MEMBENCH". Results are emitted as a
+// JSON document.
+//
+// Environment variables:
+//   MEMBENCH         must be set to run the benchmark
+//   MEMBENCH_APPS    comma-separated apps (default node_alloc,python_alloc,ruby_alloc)
+//   MEMBENCH_VCPUS   comma-separated vCPU counts (default 1,2,4, limited to the host CPU count)
+//   MEMBENCH_MB      heap growth in MB (default 256)
+//   MEMBENCH_OUTPUT  output file (default: standard output)
+
+const membenchConfig = "membench-config.json"
+
+var membenchPackages = map[string]string{
+	"node_alloc":   "eyberg/node:20.5.0",
+	"python_alloc": "eyberg/python:3.10.6",
+	"ruby_alloc":   "eyberg/ruby:3.1.2",
+}
+
+type membenchHeapGrow struct {
+	MB           int     `json:"mb"`
+	Ms           float64 `json:"ms"`
+	Faults       uint64  `json:"faults"`
+	FaultsPerSec float64 `json:"faults_per_sec"`
+	HugeFaults   uint64  `json:"huge_faults"`
+}
+
+type membenchMmap struct {
+	Count  int             `json:"count"`
+	SizeKB int             `json:"size_kb"`
+	Map    netbenchLatency `json:"map"`
+	Unmap  netbenchLatency `json:"unmap"`
+}
+
+type membenchGC struct {
+	Count   int             `json:"count"`
+	Pause   netbenchLatency `json:"pause"`
+	TotalMs float64         `json:"total_ms"`
+}
+
+type membenchRSS struct {
+	BaselineKB uint64 `json:"baseline_kb"`
+	PeakKB     uint64 `json:"peak_kb"`
+}
+
+type membenchResult struct {
+	App      string           `json:"app"`
+	VCPUs    int              `json:"vcpus"`
+	Seconds  float64          `json:"seconds"`
+	HeapGrow membenchHeapGrow `json:"heap_grow"`
+	Mmap     membenchMmap     `json:"mmap"`
+	GC       membenchGC       `json:"gc"`
+	RSS      membenchRSS      `json:"rss"`
+}
+
+type membenchReport struct {
+	Commit   string           `json:"commit"`
+	Date     string           `json:"date"`
+	HostCPUs int              `json:"host_cpus"`
+	HeapMB   int              `json:"heap_mb"`
+	Results  []membenchResult `json:"results"`
+}
+
+// Writes the benchmark configuration of the app in the current directory, derived from its
+// functional test configuration.
+func membenchWriteConfig(mb int) error {
+	data, err := os.ReadFile("config.json")
+	if err != nil {
+		return err
+	}
+	var config map[string]interface{}
+	if err = json.Unmarshal(data, &config); err != nil {
+		return err
+	}
+	env, _ := config["ENV"].(map[string]interface{})
+	if env == nil {
+		env = make(map[string]interface{})
+	}
+	env["MEMBENCH"] = "1"
+	env["MEMBENCH_MB"] = strconv.Itoa(mb)
+	config["ENV"] = env
+	if m, ok := config["ManifestPassthrough"].(map[string]interface{}); ok {
+		delete(m, "expected_exit_code")
+	}
+	if data, err = json.MarshalIndent(config, "", "  "); err != nil {
+		return err
+	}
+	return os.WriteFile(membenchConfig, data, 0644)
+}
+
+func membenchRun(t *testing.T, app string, vcpus int, mb int) membenchResult {
+	dir, err := os.Getwd()
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer os.Chdir(dir)
+	if err = os.Chdir(dir + "/" + app); err != nil {
+		t.Fatal(err)
+	}
+	if err = membenchWriteConfig(mb); err != nil {
+		t.Fatal(err)
+	}
+	defer os.Remove(membenchConfig)
+	start := time.Now()
+	cmd := fmt.Sprintf("ops pkg load %s -c %s --smp %d", membenchPackages[app], membenchConfig, vcpus)
+	p, buffer, ctx, _, err := AsyncCmdStart(cmd, 10*time.Minute)
+	if err != nil {
+		t.Fatal(err)
+	}
+	_, err = p.Process.Wait()
+	if err == nil {
+		err = ctx.Err()
+	}
+	if err != nil {
+		t.Logf("Output: %v", buffer.String())
+		t.Fatal(err)
+	}
+	r := membenchResult{App: app, VCPUs: vcpus, Seconds: time.Since(start).Seconds()}
+	for _, line := range strings.Split(buffer.String(), "\n") {
+		i := strings.Index(line, "MEMBENCH ")
+		if i < 0 {
+			continue
+		}
+		if err = json.Unmarshal([]byte(strings.TrimSpace(line[i+len("MEMBENCH "):])), &r); err != nil {
+			t.Logf("Output: %v", buffer.String())
+			t.Fatal(err)
+		}
+		return r
+	}
+	t.Logf("Output: %v", buffer.String())
+	t.Fatal("no benchmark results in output")
+	return r
+}
+
+// RunMemBench runs the memory benchmark
+func RunMemBench(t *testing.T) {
+	if os.Getenv("MEMBENCH") == "" {
+		t.Skip("MEMBENCH not set")
+	}
+	apps := []string{"node_alloc", "python_alloc", "ruby_alloc"}
+	if s := os.Getenv("MEMBENCH_APPS"); s != "" {
+		apps = strings.Split(s, ",")
+		for _, app := range apps {
+			if membenchPackages[app] == "" {
+				t.Fatalf("unknown app %q", app)
+			}
+		}
+	}
+	var vcpus []int
+	for _, v := range netbenchEnvList(t, "MEMBENCH_VCPUS", []int{1, 2, 4}) {
+		if v <= runtime.NumCPU() {
+			vcpus = append(vcpus, v)
+		}
+	}
+	mb := netbenchEnvList(t, "MEMBENCH_MB", []int{256})[0]
+	report := membenchReport{
+		Date:     time.Now().UTC().Format(time.RFC3339),
+		HostCPUs: runtime.NumCPU(),
+		HeapMB:   mb,
+	}
+	if out, err := exec.Command("git", "rev-parse", "HEAD").Output(); err == nil {
+		report.Commit = strings.TrimSpace(string(out))
+	}
+
+	for _, app := range apps {
+		for _, v := range vcpus {
+			t.Run(fmt.Sprintf("%s_vcpus_%d", app, v), func(t *testing.T) {
+				r := membenchRun(t, app, v, mb)
+				t.Logf("heap grow %d MB: %.1f ms, %.0f faults/s; mmap p50 %.1f us, munmap p50 %.1f us; "+
+					"gc pause p50 %.1f us; peak %d kB", r.HeapGrow.MB, r.HeapGrow.Ms,
+					r.HeapGrow.FaultsPerSec, r.Mmap.Map.P50, r.Mmap.Unmap.P50, r.GC.Pause.P50,
+					r.RSS.PeakKB)
+				report.Results = append(report.Results, r)
+			})
+		}
+	}
+
+	var w io.Writer = os.Stdout
+	if path := os.Getenv("MEMBENCH_OUTPUT"); path != "" {
+		f, err := os.Create(path)
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer f.Close()
+		w = f
+	}
+	enc := json.NewEncoder(w)
+	enc.SetIndent("", "  ")
+	if err := enc.Encode(report); err != nil {
+		t.Fatal(err)
+	}
+}
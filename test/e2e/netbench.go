@@ -0,0 +1,364 @@
+package e2e
+
+import (
+	"bufio"
+	"encoding/json"
+	"fmt"
+	"io"
+	"net"
+	"os"
+	"os/exec"
+	"runtime"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"testing"
+	"time"
+)
+
+// Network benchmark: boots the netbench runtime test (test/runtime/netbench.c) on a bridged
+// multiqueue tap interface with a range of vCPU counts, and for each vCPU count runs HTTP
+// request/response, TCP bulk receive and transmit, and UDP ping-pong load across a range of
+// connection counts. Results are emitted as a JSON document.
+//
+// The host must have a multiqueue tap interface on the guest network, e.g.:
+//   ip tuntap add tap0 mode tap multi_queue
+//   ip addr add 10.3.3.1/24 dev tap0
+//   ip link set tap0 up
+//
+// Environment variables:
+//   NETBENCH           must be set to run the benchmark
+//   NETBENCH_ADDR      guest address (default 10.3.3.2, as configured in netbench.manifest)
+//   NETBENCH_VCPUS     comma-separated vCPU counts (default 1,2,4, limited to the host CPU count)
+//   NETBENCH_CONNS     comma-separated connection counts (default 1,4,16,64)
+//   NETBENCH_DURATION  duration of each measurement (default 10s)
+//   NETBENCH_OUTPUT    output file (default: standard output)
+
+const (
+	netbenchHTTPPort   = 8080
+	netbenchSinkPort   = 5201
+	netbenchSourcePort = 5202
+	netbenchUDPPort    = 5309
+	netbenchBufSize    = 64 * 1024
+	netbenchUDPSize    = 64
+)
+
+var netbenchRequest = []byte("GET / HTTP/1.1\r\nHost: netbench\r\n\r\n")
+
+type netbenchLatency struct {
+	P50 float64 `json:"p50_us"`
+	P99 float64 `json:"p99_us"`
+	Max float64 `json:"max_us"`
+}
+
+type netbenchResult struct {
+	Test        string           `json:"test"`
+	VCPUs       int              `json:"vcpus"`
+	Connections int              `json:"connections"`
+	Seconds     float64          `json:"seconds"`
+	Ops         uint64           `json:"ops,omitempty"`
+	OpsPerSec   float64          `json:"ops_per_sec,omitempty"`
+	Bytes       uint64           `json:"bytes,omitempty"`
+	Gbps        float64          `json:"gbps,omitempty"`
+	Errors      uint64           `json:"errors"`
+	Latency     *netbenchLatency `json:"latency,omitempty"`
+}
+
+type netbenchReport struct {
+	Commit   string           `json:"commit"`
+	Date     string           `json:"date"`
+	HostCPUs int              `json:"host_cpus"`
+	Duration float64          `json:"duration_seconds"`
+	Results  []netbenchResult `json:"results"`
+}
+
+func netbenchEnvList(t *testing.T, name string, def []int) []int {
+	s := os.Getenv(name)
+	if s == "" {
+		return def
+	}
+	var l []int
+	for _, f := range strings.Split(s, ",") {
+		v, err := strconv.Atoi(strings.TrimSpace(f))
+		if err != nil || v <= 0 {
+			t.Fatalf("invalid %s value %q", name, f)
+		}
+		l = append(l, v)
+	}
+	return l
+}
+
+// Collects latency samples of each connection, merged when the measurement completes.
+type netbenchSamples struct {
+	sync.Mutex
+	all []time.Duration
+}
+
+func (s *netbenchSamples) add(l []time.Duration) {
+	s.Lock()
+	s.all = append(s.all, l...)
+	s.Unlock()
+}
+
+func (s *netbenchSamples) latency() *netbenchLatency {
+	if len(s.all) == 0 {
+		return nil
+	}
+	sort.Slice(s.all, func(i, j int) bool { return s.all[i] < s.all[j] })
+	us := func(d time.Duration) float64 { return float64(d.Nanoseconds()) / 1000 }
+	return &netbenchLatency{
+		P50: us(s.all[len(s.all)/2]),
+		P99: us(s.all[len(s.all)*99/100]),
+		Max: us(s.all[len(s.all)-1]),
+	}
+}
+
+// Runs conns instances of f in parallel until the deadline; f returns the number of operations
+// and bytes it completed.
+func netbenchRun(conns int, d time.Duration,
+	f func(deadline time.Time) (ops uint64, bytes uint64, err error)) (ops, bytes, errs uint64, secs float64) {
+	var wg sync.WaitGroup
+	start := time.Now()
+	deadline := start.Add(d)
+	for i := 0; i < conns; i++ {
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			o, b, err := f(deadline)
+			atomic.AddUint64(&ops, o)
+			atomic.AddUint64(&bytes, b)
+			if err != nil {
+				atomic.AddUint64(&errs, 1)
+			}
+		}()
+	}
+	wg.Wait()
+	secs = time.Since(start).Seconds()
+	return
+}
+
+// Keep-alive HTTP requests, one outstanding request per connection.
+func netbenchHTTP(addr string, conns int, d time.Duration) netbenchResult {
+	var samples netbenchSamples
+	ops, _, errs, secs := netbenchRun(conns, d, func(deadline time.Time) (uint64, uint64, error) {
+		c, err := net.DialTimeout("tcp", fmt.Sprintf("%s:%d", addr, netbenchHTTPPort), 5*time.Second)
+		if err != nil {
+			return 0, 0, err
+		}
+		defer c.Close()
+		c.SetDeadline(deadline.Add(5 * time.Second))
+		r := bufio.NewReader(c)
+		var ops uint64
+		var lat []time.Duration
+		for time.Now().Before(deadline) {
+			t0 := time.Now()
+			if _, err = c.Write(netbenchRequest); err != nil {
+				break
+			}
+			if err = netbenchReadResponse(r); err != nil {
+				break
+			}
+			lat = append(lat, time.Since(t0))
+			ops++
+		}
+		samples.add(lat)
+		return ops, 0, err
+	})
+	return netbenchResult{Test: "http", Connections: conns, Seconds: secs, Ops: ops,
+		OpsPerSec: float64(ops) / secs, Errors: errs, Latency: samples.latency()}
+}
+
+func netbenchReadResponse(r *bufio.Reader) error {
+	length := -1
+	for {
+		line, err := r.ReadString('\n')
+		if err != nil {
+			return err
+		}
+		line = strings.TrimRight(line, "\r\n")
+		if line == "" {
+			break
+		}
+		if strings.HasPrefix(strings.ToLower(line), "content-length:") {
+			length, err = strconv.Atoi(strings.TrimSpace(line[len("content-length:"):]))
+			if err != nil {
+				return err
+			}
+		}
+	}
+	if length < 0 {
+		return fmt.Errorf("response without content length")
+	}
+	_, err := r.Discard(length)
+	return err
+}
+
+// Bulk TCP transfer; rx measures data received by the guest, tx data sent by the guest.
+func netbenchTCP(addr string, rx bool, conns int, d time.Duration) netbenchResult {
+	port, test := netbenchSourcePort, "tcp_tx"
+	if rx {
+		port, test = netbenchSinkPort, "tcp_rx"
+	}
+	_, bytes, errs, secs := netbenchRun(conns, d, func(deadline time.Time) (uint64, uint64, error) {
+		c, err := net.DialTimeout("tcp", fmt.Sprintf("%s:%d", addr, port), 5*time.Second)
+		if err != nil {
+			return 0, 0, err
+		}
+		defer c.Close()
+		c.SetDeadline(deadline)
+		buf := make([]byte, netbenchBufSize)
+		var total uint64
+		for {
+			var n int
+			if rx {
+				n, err = c.Write(buf)
+			} else {
+				n, err = c.Read(buf)
+			}
+			total += uint64(n)
+			if err != nil {
+				break
+			}
+		}
+		if ne, ok := err.(net.Error); ok && ne.Timeout() {
+			err = nil
+		}
+		return 0, total, err
+	})
+	return netbenchResult{Test: test, Connections: conns, Seconds: secs, Bytes: bytes,
+		Gbps: float64(bytes) * 8 / secs / 1e9, Errors: errs}
+}
+
+// UDP ping-pong, one outstanding datagram per socket; lost datagrams are counted as errors.
+func netbenchUDP(addr string, conns int, d time.Duration) netbenchResult {
+	var samples netbenchSamples
+	var lost uint64
+	ops, _, errs, secs := netbenchRun(conns, d, func(deadline time.Time) (uint64, uint64, error) {
+		c, err := net.Dial("udp", fmt.Sprintf("%s:%d", addr, netbenchUDPPort))
+		if err != nil {
+			return 0, 0, err
+		}
+		defer c.Close()
+		req := make([]byte, netbenchUDPSize)
+		resp := make([]byte, netbenchUDPSize)
+		var ops uint64
+		var lat []time.Duration
+		for time.Now().Before(deadline) {
+			t0 := time.Now()
+			if _, err = c.Write(req); err != nil {
+				break
+			}
+			c.SetReadDeadline(t0.Add(100 * time.Millisecond))
+			if _, err = c.Read(resp); err != nil {
+				if ne, ok := err.(net.Error); ok && ne.Timeout() {
+					atomic.AddUint64(&lost, 1)
+					err = nil
+					continue
+				}
+				break
+			}
+			lat = append(lat, time.Since(t0))
+			ops++
+		}
+		samples.add(lat)
+		return ops, 0, err
+	})
+	return netbenchResult{Test: "udp_pingpong", Connections: conns, Seconds: secs, Ops: ops,
+		OpsPerSec: float64(ops) / secs, Errors: errs + lost, Latency: samples.latency()}
+}
+
+func netbenchWaitReady(addr string, timeout time.Duration) error {
+	deadline := time.Now().Add(timeout)
+	for time.Now().Before(deadline) {
+		c, err := net.DialTimeout("tcp", fmt.Sprintf("%s:%d", addr, netbenchHTTPPort), time.Second)
+		if err == nil {
+			c.Close()
+			return nil
+		}
+		time.Sleep(500 * time.Millisecond)
+	}
+	return fmt.Errorf("netbench server at %s not reachable", addr)
+}
+
+// RunNetBench runs the network benchmark
+func RunNetBench(t *testing.T) {
+	if os.Getenv("NETBENCH") == "" {
+		t.Skip("NETBENCH not set")
+	}
+	addr := os.Getenv("NETBENCH_ADDR")
+	if addr == "" {
+		addr = "10.3.3.2"
+	}
+	var vcpus []int
+	for _, v := range netbenchEnvList(t, "NETBENCH_VCPUS", []int{1, 2, 4}) {
+		if v <= runtime.NumCPU() {
+			vcpus = append(vcpus, v)
+		}
+	}
+	conns := netbenchEnvList(t, "NETBENCH_CONNS", []int{1, 4, 16, 64})
+	duration := 10 * time.Second
+	if s := os.Getenv("NETBENCH_DURATION"); s != "" {
+		var err error
+		if duration, err = time.ParseDuration(s); err != nil {
+			t.Fatal(err)
+		}
+	}
+	report := netbenchReport{
+		Date:     time.Now().UTC().Format(time.RFC3339),
+		HostCPUs: runtime.NumCPU(),
+		Duration: duration.Seconds(),
+	}
+	if out, err := exec.Command("git", "rev-parse", "HEAD").Output(); err == nil {
+		report.Commit = strings.TrimSpace(string(out))
+	}
+
+	// build once, so that the image build does not count against the boot timeout
+	if out, err := exec.Command("make", "-C", "../..", "image", "TARGET=netbench").CombinedOutput(); err != nil {
+		t.Logf("Output: %s", out)
+		t.Fatal(err)
+	}
+	for _, v := range vcpus {
+		t.Run(fmt.Sprintf("vcpus_%d", v), func(t *testing.T) {
+			cmd := fmt.Sprintf("make -C ../.. run-bridge TARGET=netbench SMP=%d NET_QUEUES=%d", v, v)
+			p, buffer, _, _, err := AsyncCmdStart(cmd, time.Duration(len(conns)*4+2)*(duration+time.Minute))
+			if err != nil {
+				t.Fatal(err)
+			}
+			defer p.Cancel()
+			if err = netbenchWaitReady(addr, 2*time.Minute); err != nil {
+				t.Logf("Output: %v", buffer)
+				t.Fatal(err)
+			}
+			for _, c := range conns {
+				for _, r := range []netbenchResult{
+					netbenchHTTP(addr, c, duration),
+					netbenchTCP(addr, true, c, duration),
+					netbenchTCP(addr, false, c, duration),
+					netbenchUDP(addr, c, duration),
+				} {
+					r.VCPUs = v
+					t.Logf("%s: %d connections: %.0f ops/s, %.3f Gb/s, %d errors", r.Test,
+						c, r.OpsPerSec, r.Gbps, r.Errors)
+					report.Results = append(report.Results, r)
+				}
+			}
+		})
+	}
+
+	var w io.Writer = os.Stdout
+	if path := os.Getenv("NETBENCH_OUTPUT"); path != "" {
+		f, err := os.Create(path)
+		if err != nil {
+			t.Fatal(err)
+		}
+		defer f.Close()
+		w = f
+	}
+	enc := json.NewEncoder(w)
+	enc.SetIndent("", "  ")
+	if err := enc.Encode(report); err != nil {
+		t.Fatal(err)
+	}
+}
@@ -1,7 +1,119 @@
-let array = [];
-let start = Date.now();
-var i = setInterval(function() {
-        if (Date.now() - start > 10000)
-                clearInterval(i);
-        array.push(new Array(1000000).join("x"));
-}, 1000);
+const fs = require('fs');
+const v8 = require('v8');
+const vm = require('vm');
+
+const PAGE_SIZE = 4096;
+const MB = 1024 * 1024;
+
+function alloc() {
+        let array = [];
+        let start = Date.now();
+        var i = setInterval(function() {
+                if (Date.now() - start > 10000)
+                        clearInterval(i);
+                array.push(new Array(1000000).join("x"));
+        }, 1000);
+}
+
+// Memory benchmark (run by membench.go with MEMBENCH set): reports fault counts from
+// /proc/vmstat and memory in use from /proc/meminfo, as the kernel has no per-process RSS.
+// Large array buffers are allocated with mmap by the C library and unmapped when collected, so
+// the unmap latency includes a full collection.
+function readKV(path) {
+        let kv = {};
+        for (const line of fs.readFileSync(path, 'utf8').split('\n')) {
+                const fields = line.replace(':', ' ').split(/\s+/);
+                if (fields.length >= 2)
+                        kv[fields[0]] = parseInt(fields[1]);
+        }
+        return kv;
+}
+
+function usedKB() {
+        const m = readKV('/proc/meminfo');
+        return m.MemTotal - m.MemFree;
+}
+
+function now() {
+        return Number(process.hrtime.bigint()) / 1e9;
+}
+
+function latency(samples) {
+        samples.sort((a, b) => a - b);
+        const us = (s) => Math.round(s * 1e9) / 1e3;
+        return {p50_us: us(samples[Math.floor(samples.length / 2)]),
+                p99_us: us(samples[Math.floor(samples.length * 99 / 100)]),
+                max_us: us(samples[samples.length - 1])};
+}
+
+function touch(buf) {
+        const a = new Uint8Array(buf);
+        for (let i = 0; i < a.length; i += PAGE_SIZE)
+                a[i] = 1;
+}
+
+function benchHeapGrow(mb, rss) {
+        const v0 = readKV('/proc/vmstat');
+        const t0 = now();
+        let chunks = [];
+        for (let i = 0; i < mb; i++) {
+                chunks.push(new ArrayBuffer(MB));
+                touch(chunks[i]);
+        }
+        const secs = now() - t0;
+        const v1 = readKV('/proc/vmstat');
+        rss.peak_kb = Math.max(rss.peak_kb, usedKB());
+        const faults = v1.pgfault - v0.pgfault;
+        return [chunks, {mb: mb, ms: Math.round(secs * 1e6) / 1e3, faults: faults,
+                         faults_per_sec: Math.round(faults / secs),
+                         huge_faults: v1.thp_fault_alloc - v0.thp_fault_alloc}];
+}
+
+function benchMmap(count, size, gc) {
+        let mapS = [], unmapS = [];
+        for (let i = 0; i < count; i++) {
+                let t0 = now();
+                let b = new ArrayBuffer(size);
+                touch(b);
+                const t1 = now();
+                b = null;
+                gc();
+                mapS.push(t1 - t0);
+                unmapS.push(now() - t1);
+        }
+        return {count: count, size_kb: size / 1024, map: latency(mapS), unmap: latency(unmapS)};
+}
+
+function benchGC(objects, count, gc) {
+        let graph = [];
+        for (let i = 0; i < objects; i++)
+                graph.push([i, String(i)]);
+        let pauses = [];
+        for (let i = 0; i < count; i++) {
+                const t0 = now();
+                gc();
+                pauses.push(now() - t0);
+        }
+        graph = null;
+        const total = pauses.reduce((a, b) => a + b, 0);
+        return {count: count, pause: latency(pauses), total_ms: Math.round(total * 1e6) / 1e3};
+}
+
+function membench() {
+        v8.setFlagsFromString('--expose-gc');
+        const gc = vm.runInNewContext('gc');
+        const mb = parseInt(process.env.MEMBENCH_MB || '256');
+        let rss = {baseline_kb: usedKB()};
+        rss.peak_kb = rss.baseline_kb;
+        let [chunks, grow] = benchHeapGrow(mb, rss);
+        chunks = null;
+        const result = {heap_grow: grow, mmap: benchMmap(256, 4 * MB, gc),
+                        gc: benchGC(1000000, 16, gc), rss: rss};
+        rss.peak_kb = Math.max(rss.peak_kb, usedKB());
+        console.log('MEMBENCH ' + JSON.stringify(result));
+}
+
+if (process.env.MEMBENCH)
+        membench();
+else
+        alloc();
@@ -1,3 +1,12 @@
+import gc
+import json
+import mmap
+import os
+import time
+
+PAGE_SIZE = 4096
+MB = 1024 * 1024
+
 def allocate_memory():
     try:
         memory_list = []
@@ -6,5 +15,82 @@ def allocate_memory():
     except MemoryError:
         exit(0)
 
+# Memory benchmark (run by membench.go with MEMBENCH set): reports fault counts from
+# /proc/vmstat and memory in use from /proc/meminfo, as the kernel has no per-process RSS.
+def read_kv(path):
+    kv = {}
+    with open(path) as f:
+        for line in f:
+            fields = line.replace(":", " ").split()
+            if len(fields) >= 2:
+                kv[fields[0]] = int(fields[1])
+    return kv
+
+def used_kb():
+    m = read_kv("/proc/meminfo")
+    return m["MemTotal"] - m["MemFree"]
+
+def latency(samples):
+    samples = sorted(samples)
+    us = lambda s: round(s * 1e6, 3)
+    return {"p50_us": us(samples[len(samples) // 2]),
+            "p99_us": us(samples[len(samples) * 99 // 100]),
+            "max_us": us(samples[-1])}
+
+def bench_heap_grow(mb, rss):
+    v0 = read_kv("/proc/vmstat")
+    t0 = time.monotonic()
+    chunks = [bytearray(MB) for _ in range(mb)]
+    for c in chunks:
+        for i in range(0, MB, PAGE_SIZE):
+            c[i] = 1
+    secs = time.monotonic() - t0
+    v1 = read_kv("/proc/vmstat")
+    rss["peak_kb"] = max(rss["peak_kb"], used_kb())
+    faults = v1["pgfault"] - v0["pgfault"]
+    return chunks, {"mb": mb, "ms": round(secs * 1000, 3), "faults": faults,
+                    "faults_per_sec": round(faults / secs), "huge_faults":
+                    v1["thp_fault_alloc"] - v0["thp_fault_alloc"]}
+
+def bench_mmap(count, size):
+    map_s, unmap_s = [], []
+    for _ in range(count):
+        t0 = time.monotonic()
+        m = mmap.mmap(-1, size)
+        for i in range(0, size, PAGE_SIZE):
+            m[i] = 1
+        t1 = time.monotonic()
+        m.close()
+        t2 = time.monotonic()
+        map_s.append(t1 - t0)
+        unmap_s.append(t2 - t1)
+    return {"count": count, "size_kb": size // 1024, "map": latency(map_s),
+            "unmap": latency(unmap_s)}
+
+def bench_gc(objects, count):
+    graph = [[i, str(i)] for i in range(objects)]
+    pauses = []
+    for _ in range(count):
+        t0 = time.monotonic()
+        gc.collect()
+        pauses.append(time.monotonic() - t0)
+    del graph
+    return {"count": count, "pause": latency(pauses),
+            "total_ms": round(sum(pauses) * 1000, 3)}
+
+def membench():
+    mb = int(os.environ.get("MEMBENCH_MB", "256"))
+    rss = {"baseline_kb": used_kb()}
+    rss["peak_kb"] = rss["baseline_kb"]
+    chunks, grow = bench_heap_grow(mb, rss)
+    del chunks
+    result = {"heap_grow": grow, "mmap": bench_mmap(256, 4 * MB),
+              "gc": bench_gc(1000000, 16), "rss": rss}
+    rss["peak_kb"] = max(rss["peak_kb"], used_kb())
+    print("MEMBENCH " + json.dumps(result), flush=True)
+
 if __name__ == "__main__":
-    allocate_memory()
+    if os.environ.get("MEMBENCH"):
+        membench()
+    else:
+        allocate_memory()
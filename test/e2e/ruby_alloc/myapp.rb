@@ -1,3 +1,94 @@
+require 'json'
+
+MB = 1024 * 1024
+
+# Memory benchmark (run by membench.go with MEMBENCH set): reports fault counts from
+# /proc/vmstat and memory in use from /proc/meminfo, as the kernel has no per-process RSS.
+# Large strings are allocated with mmap by the C library and unmapped when collected, so the
+# unmap latency includes a full collection.
+def read_kv(path)
+  kv = {}
+  File.foreach(path) do |line|
+    fields = line.tr(':', ' ').split
+    kv[fields[0]] = fields[1].to_i if fields.length >= 2
+  end
+  kv
+end
+
+def used_kb
+  m = read_kv('/proc/meminfo')
+  m['MemTotal'] - m['MemFree']
+end
+
+def now
+  Process.clock_gettime(Process::CLOCK_MONOTONIC)
+end
+
+def latency(samples)
+  samples = samples.sort
+  us = ->(s) { (s * 1e6).round(3) }
+  { p50_us: us.(samples[samples.length / 2]),
+    p99_us: us.(samples[samples.length * 99 / 100]),
+    max_us: us.(samples[-1]) }
+end
+
+def bench_heap_grow(mb, rss)
+  v0 = read_kv('/proc/vmstat')
+  t0 = now
+  chunks = Array.new(mb) { "\x01".b * MB }
+  secs = now - t0
+  v1 = read_kv('/proc/vmstat')
+  rss[:peak_kb] = [rss[:peak_kb], used_kb].max
+  faults = v1['pgfault'] - v0['pgfault']
+  [chunks, { mb: mb, ms: (secs * 1000).round(3), faults: faults,
+             faults_per_sec: (faults / secs).round,
+             huge_faults: v1['thp_fault_alloc'] - v0['thp_fault_alloc'] }]
+end
+
+def bench_mmap(count, size)
+  map_s = []
+  unmap_s = []
+  count.times do
+    t0 = now
+    s = "\x01".b * size
+    t1 = now
+    s = nil
+    GC.start
+    map_s << t1 - t0
+    unmap_s << now - t1
+  end
+  { count: count, size_kb: size / 1024, map: latency(map_s), unmap: latency(unmap_s) }
+end
+
+def bench_gc(objects, count)
+  graph = Array.new(objects) { |i| [i, i.to_s] }
+  pauses = Array.new(count) do
+    t0 = now
+    GC.start
+    now - t0
+  end
+  graph = nil
+  { count: count, pause: latency(pauses), total_ms: (pauses.sum * 1000).round(3) }
+end
+
+def membench
+  mb = (ENV['MEMBENCH_MB'] || '256').to_i
+  rss = { baseline_kb: used_kb }
+  rss[:peak_kb] = rss[:baseline_kb]
+  chunks, grow = bench_heap_grow(mb, rss)
+  chunks = nil
+  result = { heap_grow: grow, mmap: bench_mmap(256, 4 * MB),
+             gc: bench_gc(1000000, 16), rss: rss }
+  rss[:peak_kb] = [rss[:peak_kb], used_kb].max
+  puts 'MEMBENCH ' + JSON.generate(result)
+  $stdout.flush
+end
+
+if ENV['MEMBENCH']
+  membench
+  exit
+end
+
 begin
   array = []
   start = Time.now
@@ -28,6 +28,8 @@
 
 #define IORING_SETUP_CQSIZE     (1 << 3)
 
+#define IORING_SQ_CQ_OVERFLOW   (1 << 1)
+
 #define IO_URING_OP_SUPPORTED   (1 << 0)
 
 #define IORING_OFF_SQ_RING  0ULL
@@ -546,13 +548,25 @@ static void iour_test_basic(void)
 
     test_assert(iour_submit(&iour, 1, 0) == 0); /* no SQEs available */
 
-    /* CQ overflow */
+    /* CQ overflow: completions that do not fit in the CQ ring are kept pending (up to the CQ
+     * ring size), and dropped afterwards */
     for (int i = 0; i <= iour.params.cq_entries; i++) {
         iour_setup_nop(&iour, 0);
         test_assert(iour_submit(&iour, 1, 1) == 1);
     }
+    test_assert(*(uint32_t *)(iour.rings + iour.params.sq_off.flags) & IORING_SQ_CQ_OVERFLOW);
+    test_assert(*(uint32_t *)(iour.rings + iour.params.cq_off.overflow) == 0);
+    for (int i = 1; i <= iour.params.cq_entries; i++) {
+        iour_setup_nop(&iour, 0);
+        test_assert(iour_submit(&iour, 1, 1) == 1);
+    }
     test_assert(*(uint32_t *)(iour.rings + iour.params.cq_off.overflow) == 1);
 
+    /* pending completions are posted as CQ ring entries are consumed */
+    test_assert(iour_get_cqe(&iour) != NULL);
+    test_assert(iour_submit(&iour, 0, 0) == 0);
+    test_assert(*iour.cq_tail - *iour.cq_head == iour.params.cq_entries);
+
     test_assert(iour_exit(&iour) == 0);
     test_assert(iour_init(&iour, 1) == 0);
     test_assert(iour.fd > 0);
@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+/* Kernel microbenchmarks measured from user space, reported in the format of
+   test/bench/kbench.h. The runtime benchmarks run in-kernel from the bench klib
+   loaded by kbench.manifest. Syscall benchmarks also report the number of
+   closures the kernel allocated from a heap while they ran. */
+
+#define SYSCALL_OPS     (1 << 20)
+#define SWITCH_OPS      (1 << 16)
+#define FILE_READ_OPS   (1 << 18)
+#define FILE_READ_SIZE  4096
+#define UDP_OPS         (1 << 16)
+
+static uint64_t nsecs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* heap-allocated kernel closures, from /proc/vmstat */
+static uint64_t closure_allocs(void)
+{
+    FILE *f = fopen("/proc/vmstat", "r");
+    if (!f)
+        test_perror("open /proc/vmstat");
+    char line[64];
+    uint64_t allocs = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "closure_alloc %lu", &allocs) == 1)
+            break;
+    }
+    fclose(f);
+    return allocs;
+}
+
+static void report(const char *name, uint64_t ops, uint64_t nsecs, uint64_t allocs)
+{
+    printf("kbench {\"name\":\"%s\",\"ops\":%lu,\"nsecs\":%lu,\"allocs\":%lu}\n", name, ops,
+           nsecs, allocs);
+}
+
+static void bench_syscall(void)
+{
+    uint64_t a0 = closure_allocs();
+    uint64_t t0 = nsecs();
+    for (int i = 0; i < SYSCALL_OPS; i++)
+        syscall(SYS_getppid);
+    uint64_t elapsed = nsecs() - t0;
+    report("syscall_roundtrip", SYSCALL_OPS, elapsed, closure_allocs() - a0);
+
+    /* getpid is served by the leaf syscall fast path */
+    a0 = closure_allocs();
+    t0 = nsecs();
+    for (int i = 0; i < SYSCALL_OPS; i++)
+        syscall(SYS_getpid);
+    elapsed = nsecs() - t0;
+    report("syscall_leaf_roundtrip", SYSCALL_OPS, elapsed, closure_allocs() - a0);
+}
+
+/* reads of a page-cached file */
+static void bench_file_read(void)
+{
+    static char buf[FILE_READ_SIZE];
+    int fd = open("/kbench_file", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        test_perror("open");
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+        test_perror("write");
+    uint64_t a0 = closure_allocs();
+    uint64_t t0 = nsecs();
+    for (int i = 0; i < FILE_READ_OPS; i++) {
+        if (pread(fd, buf, sizeof(buf), 0) != sizeof(buf))
+            test_perror("pread");
+    }
+    uint64_t elapsed = nsecs() - t0;
+    report("file_pread_4k", FILE_READ_OPS, elapsed, closure_allocs() - a0);
+    close(fd);
+    unlink("/kbench_file");
+}
+
+/* a datagram sent to and received from a loopback socket: two syscalls per operation */
+static void bench_udp_loopback(void)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        test_perror("socket");
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addrlen = sizeof(addr);
+    if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0)
+        test_perror("bind");
+    if (getsockname(fd, (struct sockaddr *)&addr, &addrlen) < 0)
+        test_perror("getsockname");
+    char c = 0;
+    uint64_t a0 = closure_allocs();
+    uint64_t t0 = nsecs();
+    for (int i = 0; i < UDP_OPS; i++) {
+        if (sendto(fd, &c, 1, 0, (struct sockaddr *)&addr, addrlen) != 1)
+            test_perror("sendto");
+        if (recv(fd, &c, 1, 0) != 1)
+            test_perror("recv");
+    }
+    uint64_t elapsed = nsecs() - t0;
+    report("udp_loopback", UDP_OPS, elapsed, closure_allocs() - a0);
+    close(fd);
+}
+
+static int ping[2], pong[2];
+
+static void *switch_child(void *arg)
+{
+    char c;
+    for (int i = 0; i < SWITCH_OPS; i++) {
+        if (read(ping[0], &c, 1) != 1)
+            test_perror("child read");
+        if (write(pong[1], &c, 1) != 1)
+            test_perror("child write");
+    }
+    return NULL;
+}
+
+/* two threads pinned to the same CPU alternately block on a pipe: each round trip is two
+   context switches */
+static void bench_context_switch(void)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(0, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+        test_perror("sched_setaffinity");
+    if (pipe(ping) < 0 || pipe(pong) < 0)
+        test_perror("pipe");
+    pthread_t child;
+    if (pthread_create(&child, NULL, switch_child, NULL))
+        test_error("pthread_create");
+    char c = 0;
+    uint64_t a0 = closure_allocs();
+    uint64_t t0 = nsecs();
+    for (int i = 0; i < SWITCH_OPS; i++) {
+        if (write(ping[1], &c, 1) != 1)
+            test_perror("write");
+        if (read(pong[0], &c, 1) != 1)
+            test_perror("read");
+    }
+    uint64_t elapsed = nsecs() - t0;
+    uint64_t allocs = closure_allocs() - a0;
+    if (pthread_join(child, NULL))
+        test_error("pthread_join");
+    report("context_switch", 2 * SWITCH_OPS, elapsed, allocs);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, NULL);
+    bench_syscall();
+    bench_file_read();
+    bench_udp_loopback();
+    bench_context_switch();
+    return EXIT_SUCCESS;
+}
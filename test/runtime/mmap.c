@@ -12,9 +12,12 @@
 #include <errno.h>
 #include <pthread.h>
 
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <linux/userfaultfd.h>
 
 /* for sha */
 #include <runtime.h>
@@ -1422,6 +1425,120 @@ static void filebacked_sigbus_test(void)
     }
 }
 
+static void madvise_test(void)
+{
+    printf("** starting madvise test\n");
+    unsigned char *p = mmap(0, PAGESIZE * 4, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap");
+    memset(p, 0xa5, PAGESIZE * 4);
+    if (madvise(p + PAGESIZE, PAGESIZE * 2, MADV_DONTNEED) < 0)
+        test_perror("madvise(MADV_DONTNEED)");
+    test_assert(p[0] == 0xa5 && p[PAGESIZE * 3] == 0xa5);
+    for (int i = PAGESIZE; i < PAGESIZE * 3; i++) {
+        if (p[i] != 0)
+            test_error("page not zeroed after MADV_DONTNEED at offset %d", i);
+    }
+
+    /* pages written after MADV_FREE must keep their contents */
+    memset(p, 0x5a, PAGESIZE * 4);
+    if (madvise(p, PAGESIZE * 4, MADV_FREE) < 0)
+        test_perror("madvise(MADV_FREE)");
+    p[0] = 0x3c;
+    test_assert(p[0] == 0x3c);
+    for (int i = PAGESIZE * 3; i < PAGESIZE * 4; i++) {
+        if ((p[i] != 0x5a) && (p[i] != 0))
+            test_error("unexpected contents after MADV_FREE at offset %d", i);
+    }
+    munmap(p, PAGESIZE * 4);
+}
+
+/* pages read before being written are shared copies of the zero page until written */
+static void anon_read_then_write_test(void)
+{
+    printf("** starting anonymous read-then-write test\n");
+    unsigned char *p = mmap(0, PAGESIZE * 4, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap");
+    for (int i = 0; i < PAGESIZE * 4; i++) {
+        if (p[i] != 0)
+            test_error("anonymous page not zeroed at offset %d", i);
+    }
+    p[PAGESIZE] = 0x11;
+    test_assert(p[PAGESIZE] == 0x11);
+    test_assert((p[0] == 0) && (p[PAGESIZE * 2] == 0));
+
+    /* a page read before write access is granted must still get a private copy */
+    if (mprotect(p + PAGESIZE * 2, PAGESIZE * 2, PROT_READ) < 0)
+        test_perror("mprotect(PROT_READ)");
+    test_assert(p[PAGESIZE * 3] == 0);
+    if (mprotect(p + PAGESIZE * 2, PAGESIZE * 2, PROT_READ | PROT_WRITE) < 0)
+        test_perror("mprotect(PROT_READ | PROT_WRITE)");
+    p[PAGESIZE * 3] = 0x22;
+    test_assert((p[PAGESIZE * 3] == 0x22) && (p[0] == 0) && (p[PAGESIZE * 2] == 0));
+    if (madvise(p, PAGESIZE * 4, MADV_DONTNEED) < 0)
+        test_perror("madvise(MADV_DONTNEED)");
+    test_assert((p[PAGESIZE] == 0) && (p[PAGESIZE * 3] == 0));
+    munmap(p, PAGESIZE * 4);
+}
+
+static void *uffd_fault_thread(void *arg)
+{
+    volatile unsigned long *p = arg;
+    return (void *)p[1];
+}
+
+static void userfaultfd_test(void)
+{
+    printf("** starting userfaultfd test\n");
+    int uffd = syscall(SYS_userfaultfd, O_CLOEXEC);
+    if (uffd < 0)
+        test_perror("userfaultfd");
+    struct uffdio_api api = {.api = UFFD_API, .features = 0};
+    if (ioctl(uffd, UFFDIO_API, &api) < 0)
+        test_perror("UFFDIO_API");
+    unsigned long *p = mmap(0, PAGESIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap");
+    struct uffdio_register reg = {
+        .range = {.start = (unsigned long)p, .len = PAGESIZE},
+        .mode = UFFDIO_REGISTER_MODE_MISSING,
+    };
+    if (ioctl(uffd, UFFDIO_REGISTER, &reg) < 0)
+        test_perror("UFFDIO_REGISTER");
+    test_assert(reg.ioctls & (1ull << _UFFDIO_COPY));
+
+    pthread_t thread;
+    if (pthread_create(&thread, 0, uffd_fault_thread, p) != 0)
+        test_error("pthread_create");
+    struct uffd_msg msg;
+    if (read(uffd, &msg, sizeof(msg)) != sizeof(msg))
+        test_perror("read userfaultfd");
+    test_assert(msg.event == UFFD_EVENT_PAGEFAULT);
+    test_assert(msg.arg.pagefault.address == (unsigned long)p);
+
+    unsigned long *src = malloc(PAGESIZE * 2);
+    src = (unsigned long *)(((unsigned long)src + PAGESIZE - 1) & ~(PAGESIZE - 1ul));
+    src[1] = 0x1234;
+    struct uffdio_copy copy = {
+        .dst = (unsigned long)p,
+        .src = (unsigned long)src,
+        .len = PAGESIZE,
+    };
+    if (ioctl(uffd, UFFDIO_COPY, &copy) < 0)
+        test_perror("UFFDIO_COPY");
+    test_assert(copy.copy == PAGESIZE);
+    void *val;
+    if (pthread_join(thread, &val) != 0)
+        test_error("pthread_join");
+    test_assert((unsigned long)val == 0x1234);
+    close(uffd);
+    munmap(p, PAGESIZE);
+}
+
 int main(int argc, char * argv[])
 {
     /*
@@ -1449,6 +1566,9 @@ int main(int argc, char * argv[])
     multithread_filebacked_test(h, MT_N_THREADS);
     filebacked_sigbus_test();
     check_fault_in_user_memory();
+    madvise_test();
+    anon_read_then_write_test();
+    userfaultfd_test();
 
     printf("\n**** all tests passed ****\n");
 
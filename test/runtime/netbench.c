@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "../test_utils.h"
+
+/* Network benchmark server, driven by the netbench harness in test/e2e. Each worker thread
+   (one per CPU) owns an epoll instance and an SO_REUSEPORT listener of each TCP service:
+     8080   HTTP/1.1 keep-alive server answering every request with a short fixed response
+     5201   TCP sink: received data is discarded
+     5202   TCP source: data is sent until the peer closes the connection
+     5309   UDP echo
+   Usage: netbench [workers] */
+
+#define HTTP_PORT       8080
+#define SINK_PORT       5201
+#define SOURCE_PORT     5202
+#define UDP_PORT        5309
+#define MAX_WORKERS     64
+#define MAX_EVENTS      64
+#define BUF_SIZE        (64 * 1024)
+
+enum conn_type {
+    CONN_LISTEN_HTTP,
+    CONN_LISTEN_SINK,
+    CONN_LISTEN_SOURCE,
+    CONN_HTTP,
+    CONN_SINK,
+    CONN_SOURCE,
+    CONN_UDP,
+};
+
+struct conn {
+    int fd;
+    enum conn_type type;
+    int req_len;        /* HTTP: bytes of incomplete request headers */
+};
+
+static const char http_response[] =
+    "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 13\r\n\r\nHello, world!";
+
+static int make_socket(int type, int port)
+{
+    int fd = socket(AF_INET, type | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        test_perror("socket");
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+        test_perror("setsockopt");
+    struct sockaddr_in sin = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+        test_perror("bind port %d", port);
+    if ((type == SOCK_STREAM) && (listen(fd, 1024) < 0))
+        test_perror("listen");
+    return fd;
+}
+
+static void add_conn(int epfd, int fd, enum conn_type type, unsigned int events)
+{
+    struct conn *c = malloc(sizeof(*c));
+    if (!c)
+        test_error("out of memory");
+    c->fd = fd;
+    c->type = type;
+    c->req_len = 0;
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        test_perror("epoll_ctl");
+}
+
+static void close_conn(int epfd, struct conn *c)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c);
+}
+
+static void accept_conns(int epfd, struct conn *l)
+{
+    while (1) {
+        int fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if ((errno != EAGAIN) && (errno != EINTR))
+                perror("accept4");
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        switch (l->type) {
+        case CONN_LISTEN_HTTP:
+            add_conn(epfd, fd, CONN_HTTP, EPOLLIN);
+            break;
+        case CONN_LISTEN_SINK:
+            add_conn(epfd, fd, CONN_SINK, EPOLLIN);
+            break;
+        default:
+            add_conn(epfd, fd, CONN_SOURCE, EPOLLIN | EPOLLOUT);
+            break;
+        }
+    }
+}
+
+/* Counts complete requests (terminated by an empty line) in the received data; requests have no
+   body. Returns false if the connection is to be closed. */
+static int serve_http(struct conn *c, char *buf)
+{
+    while (1) {
+        ssize_t n = read(c->fd, buf, BUF_SIZE);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+            return (errno == EAGAIN);
+        int requests = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            /* track the "\r\n\r\n" terminator across reads */
+            char ch = buf[i];
+            if ((ch == '\r' && (c->req_len & 1) == 0) || (ch == '\n' && (c->req_len & 1)))
+                c->req_len++;
+            else
+                c->req_len = 0;
+            if (c->req_len == 4) {
+                requests++;
+                c->req_len = 0;
+            }
+        }
+        while (requests-- > 0) {
+            if (write(c->fd, http_response, sizeof(http_response) - 1) < 0)
+                return 0;
+        }
+    }
+}
+
+static int serve_sink(struct conn *c, char *buf)
+{
+    while (1) {
+        ssize_t n = read(c->fd, buf, BUF_SIZE);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+            return (errno == EAGAIN);
+    }
+}
+
+static int serve_source(struct conn *c, char *buf, unsigned int events)
+{
+    if (events & EPOLLIN) {
+        ssize_t n = read(c->fd, buf, BUF_SIZE);
+        if ((n == 0) || ((n < 0) && (errno != EAGAIN)))
+            return 0;
+    }
+    while (1) {
+        ssize_t n = write(c->fd, buf, BUF_SIZE);
+        if (n < 0)
+            return (errno == EAGAIN);
+    }
+}
+
+static void serve_udp(struct conn *c, char *buf)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len;
+    while (1) {
+        sin_len = sizeof(sin);
+        ssize_t n = recvfrom(c->fd, buf, BUF_SIZE, 0, (struct sockaddr *)&sin, &sin_len);
+        if (n < 0)
+            return;
+        sendto(c->fd, buf, n, 0, (struct sockaddr *)&sin, sin_len);
+    }
+}
+
+static void *worker(void *arg)
+{
+    char *buf = malloc(BUF_SIZE);
+    if (!buf)
+        test_error("out of memory");
+    memset(buf, 0x5a, BUF_SIZE);
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        test_perror("epoll_create1");
+    add_conn(epfd, make_socket(SOCK_STREAM, HTTP_PORT), CONN_LISTEN_HTTP, EPOLLIN);
+    add_conn(epfd, make_socket(SOCK_STREAM, SINK_PORT), CONN_LISTEN_SINK, EPOLLIN);
+    add_conn(epfd, make_socket(SOCK_STREAM, SOURCE_PORT), CONN_LISTEN_SOURCE, EPOLLIN);
+    add_conn(epfd, make_socket(SOCK_DGRAM, UDP_PORT), CONN_UDP, EPOLLIN);
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            test_perror("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            struct conn *c = events[i].data.ptr;
+            int keep = 1;
+            switch (c->type) {
+            case CONN_LISTEN_HTTP:
+            case CONN_LISTEN_SINK:
+            case CONN_LISTEN_SOURCE:
+                accept_conns(epfd, c);
+                break;
+            case CONN_HTTP:
+                keep = serve_http(c, buf);
+                break;
+            case CONN_SINK:
+                keep = serve_sink(c, buf);
+                break;
+            case CONN_SOURCE:
+                keep = serve_source(c, buf, events[i].events);
+                break;
+            case CONN_UDP:
+                serve_udp(c, buf);
+                break;
+            }
+            if (!keep || (events[i].events & (EPOLLERR | EPOLLHUP)))
+                close_conn(epfd, c);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1 || workers > MAX_WORKERS)
+        test_error("worker count must be between 1 and %d", MAX_WORKERS);
+    setbuf(stdout, NULL);
+    pthread_t threads[MAX_WORKERS];
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&threads[i], NULL, worker, NULL))
+            test_error("pthread_create");
+    }
+    printf("netbench: %d workers ready\n", workers);
+    for (int i = 0; i < workers; i++)
+        pthread_join(threads[i], NULL);
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <net/if.h>
 #include <poll.h>
 #include <pthread.h>
@@ -19,11 +20,18 @@
 
 #define NETSOCK_TEST_BASIC_PORT 1233
 #define NETSOCK_TEST_FAULT_PORT 1237
+#define NETSOCK_TEST_REUSEPORT_PORT 1238
+#define NETSOCK_TEST_UDP_SEG_PORT   1239
+
+#define NETSOCK_TEST_REUSEPORT_CONNS    8
 
 #define NETSOCK_TEST_FIO_COUNT  8
 
 #define NETSOCK_TEST_PEEK_COUNT 8
 
+#define NETSOCK_TEST_UDP_SEG_SIZE   100
+#define NETSOCK_TEST_UDP_SEG_LEN    350
+
 static inline void timespec_sub(struct timespec *a, struct timespec *b, struct timespec *r)
 {
     r->tv_sec = a->tv_sec - b->tv_sec;
@@ -687,6 +695,152 @@ static void netsock_test_msg(int sock_type)
         test_assert(close(listen_fd) == 0);
 }
 
+static void netsock_test_udp_segment(void)
+{
+    int tx_fd, rx_fd;
+    struct sockaddr_in addr;
+    int val;
+    socklen_t len;
+    struct iovec iov[4];
+    struct mmsghdr mmsg[4];
+    struct msghdr msg;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    char tx_buf[NETSOCK_TEST_UDP_SEG_LEN], rx_buf[4][NETSOCK_TEST_UDP_SEG_LEN];
+    int segs = (NETSOCK_TEST_UDP_SEG_LEN + NETSOCK_TEST_UDP_SEG_SIZE - 1) /
+               NETSOCK_TEST_UDP_SEG_SIZE;
+
+    tx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(tx_fd > 0);
+    rx_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(rx_fd > 0);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_UDP_SEG_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    test_assert(bind(rx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    test_assert(connect(tx_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    for (int i = 0; i < sizeof(tx_buf); i++)
+        tx_buf[i] = i;
+
+    /* UDP_SEGMENT: a send buffer is split into datagrams of the segment size */
+    val = NETSOCK_TEST_UDP_SEG_SIZE;
+    test_assert(setsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)) == 0);
+    val = 0;
+    len = sizeof(val);
+    test_assert(getsockopt(tx_fd, SOL_UDP, UDP_SEGMENT, &val, &len) == 0);
+    test_assert((len == sizeof(val)) && (val == NETSOCK_TEST_UDP_SEG_SIZE));
+    test_assert(send(tx_fd, tx_buf, sizeof(tx_buf), 0) == sizeof(tx_buf));
+    memset(mmsg, 0, sizeof(mmsg));
+    for (int i = 0; i < segs; i++) {
+        iov[i].iov_base = rx_buf[i];
+        iov[i].iov_len = sizeof(rx_buf[i]);
+        mmsg[i].msg_hdr.msg_iov = &iov[i];
+        mmsg[i].msg_hdr.msg_iovlen = 1;
+    }
+    test_assert(recvmmsg(rx_fd, mmsg, segs, 0, NULL) == segs);
+    for (int i = 0; i < segs; i++) {
+        int seg_len = MIN(sizeof(tx_buf) - i * NETSOCK_TEST_UDP_SEG_SIZE,
+                          NETSOCK_TEST_UDP_SEG_SIZE);
+        test_assert(mmsg[i].msg_len == seg_len);
+        test_assert(!memcmp(rx_buf[i], tx_buf + i * NETSOCK_TEST_UDP_SEG_SIZE, seg_len));
+    }
+
+    /* UDP_GRO: the datagrams are coalesced into one message */
+    val = 1;
+    test_assert(setsockopt(rx_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0);
+    test_assert(send(tx_fd, tx_buf, sizeof(tx_buf), 0) == sizeof(tx_buf));
+    usleep(1000 * 50);  /* wait for all datagrams to be queued */
+    memset(&msg, 0, sizeof(msg));
+    iov[0].iov_base = rx_buf[0];
+    iov[0].iov_len = sizeof(rx_buf[0]);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &control;
+    msg.msg_controllen = sizeof(control);
+    test_assert(recvmsg(rx_fd, &msg, 0) == sizeof(tx_buf));
+    test_assert(!memcmp(rx_buf[0], tx_buf, sizeof(tx_buf)));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    test_assert(cmsg && (cmsg->cmsg_level == SOL_UDP) && (cmsg->cmsg_type == UDP_GRO));
+    test_assert(*(int *)CMSG_DATA(cmsg) == NETSOCK_TEST_UDP_SEG_SIZE);
+
+    test_assert((close(tx_fd) == 0) && (close(rx_fd) == 0));
+}
+
+/* Accepts a connection on any of the listening sockets. */
+static void netsock_test_reuseport_accept(int *fds, int count)
+{
+    struct pollfd pfd[count];
+    int conn_fd;
+
+    for (int i = 0; i < count; i++) {
+        pfd[i].fd = fds[i];
+        pfd[i].events = POLLIN;
+    }
+    while (1) {
+        test_assert(poll(pfd, count, -1) > 0);
+        for (int i = 0; i < count; i++) {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+            conn_fd = accept(fds[i], NULL, NULL);
+            if (conn_fd > 0) {
+                test_assert(close(conn_fd) == 0);
+                return;
+            }
+            test_assert(errno == EAGAIN);
+        }
+    }
+}
+
+static void netsock_test_reuseport(void)
+{
+    int fds[2], fd, tx_fd[NETSOCK_TEST_REUSEPORT_CONNS];
+    struct sockaddr_in addr;
+    int val;
+    socklen_t len = sizeof(val);
+
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NETSOCK_TEST_REUSEPORT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (int i = 0; i < 2; i++) {
+        fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        test_assert(fds[i] > 0);
+        netsock_toggle_and_check_sockopt(fds[i], SOL_SOCKET, SO_REUSEPORT, 1);
+        test_assert(bind(fds[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    }
+    for (int i = 0; i < 2; i++)
+        test_assert(listen(fds[i], NETSOCK_TEST_REUSEPORT_CONNS) == 0);
+
+    /* the port is not available to sockets without SO_REUSEPORT */
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    test_assert(fd > 0);
+    test_assert(getsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, &len) == 0 && val == 0);
+    test_assert((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) && (errno == EADDRINUSE));
+    test_assert(close(fd) == 0);
+
+    for (int i = 0; i < NETSOCK_TEST_REUSEPORT_CONNS; i++) {
+        tx_fd[i] = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(tx_fd[i] > 0);
+        test_assert(connect(tx_fd[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    }
+    for (int i = 0; i < NETSOCK_TEST_REUSEPORT_CONNS; i++)
+        netsock_test_reuseport_accept(fds, 2);
+
+    /* the remaining member keeps accepting connections after the other one is closed */
+    test_assert(close(fds[0]) == 0);
+    for (int i = 0; i < NETSOCK_TEST_REUSEPORT_CONNS; i++) {
+        test_assert(close(tx_fd[i]) == 0);
+        tx_fd[i] = socket(AF_INET, SOCK_STREAM, 0);
+        test_assert(tx_fd[i] > 0);
+        test_assert(connect(tx_fd[i], (struct sockaddr *)&addr, sizeof(addr)) == 0);
+        netsock_test_reuseport_accept(fds + 1, 1);
+        test_assert(close(tx_fd[i]) == 0);
+    }
+    test_assert(close(fds[1]) == 0);
+}
+
 static void *netsock_test_fault_udp_thread(void *arg)
 {
     int fd;
@@ -855,6 +1009,8 @@ int main(int argc, char **argv)
     netsock_test_netconf();
     netsock_test_msg(SOCK_STREAM);
     netsock_test_msg(SOCK_DGRAM);
+    netsock_test_udp_segment();
+    netsock_test_reuseport();
     netsock_test_fault();
     printf("Network socket tests OK\n");
     return EXIT_SUCCESS;
@@ -301,7 +301,10 @@ static int umcg_perftest(void)
         umcg_ctxsw_assert_worker_event(worker_id, UMCG_WE_WAIT);
         umcg_test_check_done(&start);
     }
-    printf("Results: %lld cycles (%g cycles/sec)\n", cycles, cycles/ (double)umcg_test_duration);
+
+    /* each cycle comprises two context switches (server to worker and worker to server) */
+    printf("Results: %lld cycles (%g cycles/sec, %g ns/switch)\n", cycles,
+           cycles / (double)umcg_test_duration, umcg_test_duration * 1e9 / (2 * cycles));
     umcg_ctxsw_assert_worker_event(worker_id, UMCG_WE_EXIT);
     pthread_join(worker, NULL);
     return 0;
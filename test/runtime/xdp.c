@@ -0,0 +1,217 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_tun.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#define XDP_TUN_ADDR    0x0a0b0c0d
+
+#define XDP_FRAME_SIZE  2048
+#define XDP_FRAMES      16
+#define XDP_RING_SIZE   8
+
+#define XDP_PKT_LEN 64
+
+struct xdp_ring {
+    volatile u32 *producer;
+    volatile u32 *consumer;
+    volatile u32 *flags;
+    void *desc;
+};
+
+static int xdp_tun_setup(char *ifname)
+{
+    int tun_fd = open("/dev/net/tun", O_RDWR);
+    test_assert(tun_fd > 0);
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, "xdp%d");
+    ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+    test_assert(ioctl(tun_fd, TUNSETIFF, &ifr) == 0);
+    int sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    test_assert(sock_fd > 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(XDP_TUN_ADDR);
+    memcpy(&ifr.ifr_addr, &addr, sizeof(addr));
+    test_assert(ioctl(sock_fd, SIOCSIFADDR, &ifr) == 0);
+    addr.sin_addr.s_addr = htonl(0xffffff00);
+    memcpy(&ifr.ifr_addr, &addr, sizeof(addr));
+    test_assert(ioctl(sock_fd, SIOCSIFNETMASK, &ifr) == 0);
+    test_assert(ioctl(sock_fd, SIOCGIFFLAGS, &ifr) == 0);
+    ifr.ifr_flags |= IFF_UP;
+    test_assert(ioctl(sock_fd, SIOCSIFFLAGS, &ifr) == 0);
+    test_assert(close(sock_fd) == 0);
+    strcpy(ifname, ifr.ifr_name);
+    return tun_fd;
+}
+
+static void xdp_ring_map(int fd, struct xdp_ring *r, struct xdp_ring_offset *off, off_t pgoff,
+                         size_t entry_size)
+{
+    void *map = mmap(NULL, off->desc + XDP_RING_SIZE * entry_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, pgoff);
+    test_assert(map != MAP_FAILED);
+    r->producer = map + off->producer;
+    r->consumer = map + off->consumer;
+    r->flags = map + off->flags;
+    r->desc = map + off->desc;
+}
+
+/* IPv4 packet from the tun peer, with the packet index in the payload */
+static void xdp_make_pkt(u8 *pkt, int index)
+{
+    struct iphdr *iph = (struct iphdr *)pkt;
+    memset(pkt, 0, XDP_PKT_LEN);
+    iph->version = 4;
+    iph->ihl = 5;
+    iph->tot_len = htons(XDP_PKT_LEN);
+    iph->ttl = 64;
+    iph->protocol = IPPROTO_UDP;
+    iph->saddr = htonl(XDP_TUN_ADDR + 1);
+    iph->daddr = htonl(XDP_TUN_ADDR);
+    for (int i = sizeof(*iph); i < XDP_PKT_LEN; i++)
+        pkt[i] = index + i;
+}
+
+static void xdp_test_basic(void)
+{
+    char ifname[IFNAMSIZ];
+    int tun_fd = xdp_tun_setup(ifname);
+    unsigned int ifindex = if_nametoindex(ifname);
+    test_assert(ifindex > 0);
+
+    test_assert((socket(AF_XDP, SOCK_DGRAM, 0) == -1) && (errno == ESOCKTNOSUPPORT));
+    int fd = socket(AF_XDP, SOCK_RAW, 0);
+    test_assert(fd >= 0);
+    struct sockaddr_xdp sxdp;
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+
+    /* binding requires a UMEM and its rings */
+    test_assert((bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == -1) && (errno == EINVAL));
+
+    u8 *umem = mmap(NULL, XDP_FRAMES * XDP_FRAME_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    test_assert(umem != MAP_FAILED);
+    struct xdp_umem_reg mr;
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = (u64)umem;
+    mr.len = XDP_FRAMES * XDP_FRAME_SIZE;
+    mr.chunk_size = XDP_FRAME_SIZE - 1;
+    test_assert((setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1) &&
+                (errno == EINVAL));
+    mr.chunk_size = XDP_FRAME_SIZE;
+    test_assert(setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == 0);
+    test_assert((setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1) &&
+                (errno == EBUSY));
+
+    int entries = XDP_RING_SIZE - 1;
+    test_assert((setsockopt(fd, SOL_XDP, XDP_RX_RING, &entries, sizeof(entries)) == -1) &&
+                (errno == EINVAL));
+    entries = XDP_RING_SIZE;
+    test_assert(setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &entries, sizeof(entries)) == 0);
+    test_assert(setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &entries,
+                           sizeof(entries)) == 0);
+    test_assert(setsockopt(fd, SOL_XDP, XDP_RX_RING, &entries, sizeof(entries)) == 0);
+    test_assert(setsockopt(fd, SOL_XDP, XDP_TX_RING, &entries, sizeof(entries)) == 0);
+    test_assert((setsockopt(fd, SOL_XDP, XDP_TX_RING, &entries, sizeof(entries)) == -1) &&
+                (errno == EINVAL));
+
+    struct xdp_mmap_offsets off;
+    socklen_t optlen = sizeof(off);
+    test_assert(getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == 0);
+    test_assert(optlen == sizeof(off));
+    struct xdp_ring fill, comp, rx, tx;
+    xdp_ring_map(fd, &fill, &off.fr, XDP_UMEM_PGOFF_FILL_RING, sizeof(u64));
+    xdp_ring_map(fd, &comp, &off.cr, XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(u64));
+    xdp_ring_map(fd, &rx, &off.rx, XDP_PGOFF_RX_RING, sizeof(struct xdp_desc));
+    xdp_ring_map(fd, &tx, &off.tx, XDP_PGOFF_TX_RING, sizeof(struct xdp_desc));
+
+    sxdp.sxdp_flags = XDP_ZEROCOPY;
+    test_assert((bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == -1) && (errno == EOPNOTSUPP));
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    test_assert(bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == 0);
+    test_assert((bind(fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) == -1) && (errno == EINVAL));
+    test_assert(*tx.flags & XDP_RING_NEED_WAKEUP);
+
+    /* receive: packets written to the tun interface land in the frames posted to the fill ring */
+    u8 pkt[XDP_PKT_LEN];
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    test_assert(poll(&pfd, 1, 0) == 0);
+    for (int i = 0; i < XDP_RING_SIZE / 2; i++)
+        ((u64 *)fill.desc)[i] = i * XDP_FRAME_SIZE;
+    __atomic_store_n(fill.producer, XDP_RING_SIZE / 2, __ATOMIC_RELEASE);
+    for (int i = 0; i < 2; i++) {
+        xdp_make_pkt(pkt, i);
+        test_assert(write(tun_fd, pkt, sizeof(pkt)) == sizeof(pkt));
+    }
+    test_assert((poll(&pfd, 1, -1) == 1) && (pfd.revents & POLLIN));
+    test_assert(__atomic_load_n(rx.producer, __ATOMIC_ACQUIRE) == 2);
+    test_assert(*fill.consumer == 2);
+    for (int i = 0; i < 2; i++) {
+        struct xdp_desc *desc = (struct xdp_desc *)rx.desc + i;
+        test_assert((desc->addr == i * XDP_FRAME_SIZE) && (desc->len == XDP_PKT_LEN));
+        xdp_make_pkt(pkt, i);
+        test_assert(memcmp(umem + desc->addr, pkt, XDP_PKT_LEN) == 0);
+    }
+    __atomic_store_n(rx.consumer, 2, __ATOMIC_RELEASE);
+    test_assert(poll(&pfd, 1, 0) == 0);
+
+    /* transmit: frames queued to the tx ring are read from the tun interface */
+    u64 tx_addr = (XDP_FRAMES - 1) * XDP_FRAME_SIZE;
+    xdp_make_pkt(umem + tx_addr, 0xa5);
+    struct xdp_desc *desc = tx.desc;
+    desc->addr = tx_addr;
+    desc->len = XDP_PKT_LEN;
+    desc[1].addr = mr.len;  /* out of bounds */
+    desc[1].len = XDP_PKT_LEN;
+    __atomic_store_n(tx.producer, 2, __ATOMIC_RELEASE);
+    test_assert(sendto(fd, NULL, 0, MSG_DONTWAIT, NULL, 0) == 0);
+    test_assert(*tx.consumer == 2);
+    test_assert(read(tun_fd, pkt, sizeof(pkt)) == XDP_PKT_LEN);
+    test_assert(memcmp(umem + tx_addr, pkt, XDP_PKT_LEN) == 0);
+    test_assert(__atomic_load_n(comp.producer, __ATOMIC_ACQUIRE) == 1);
+    test_assert(((u64 *)comp.desc)[0] == tx_addr);
+
+    struct xdp_statistics stats;
+    optlen = sizeof(stats);
+    test_assert(getsockopt(fd, SOL_XDP, XDP_STATISTICS, &stats, &optlen) == 0);
+    test_assert((stats.tx_invalid_descs == 1) && (stats.rx_dropped == 0));
+
+    test_assert(close(fd) == 0);
+
+    /* once unbound, the interface delivers packets to the network stack again */
+    test_assert(write(tun_fd, pkt, sizeof(pkt)) == sizeof(pkt));
+    test_assert(close(tun_fd) == 0);
+    munmap(umem, XDP_FRAMES * XDP_FRAME_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    xdp_test_basic();
+    printf("XDP test OK\n");
+    return EXIT_SUCCESS;
+}
@@ -228,6 +228,77 @@ boolean test_range_get_first(bitmap b) {
     return true;
 }
 
+/**
+ *  Tests allocations, deallocations and searches in a bitmap with a summary,
+ *  checking the results against a bitmap without a summary.
+ */
+boolean test_summary(heap h) {
+    u64 nbits = 4 * BITMAP_SUMMARY_MIN_BITS;
+    bitmap b = allocate_bitmap(h, h, nbits);
+    bitmap ref = allocate_bitmap(h, h, nbits);
+    if (!bitmap_enable_summary(b)) {
+        msg_err("!!! failed to enable bitmap summary\n");
+        return false;
+    }
+    boolean result = false;
+    /* fill most of the bitmap, so that allocations have to skip full words */
+    for (u64 i = 0; i < nbits - 3 * 64; i++) {
+        if (bitmap_alloc(b, 1) != bitmap_alloc(ref, 1)) {
+            msg_err("!!! single-bit allocation mismatch at %ld\n", i);
+            goto out;
+        }
+    }
+    for (int i = 0; i < 1000; i++) {
+        u64 bit = rand() % (nbits - 3 * 64);
+        if (bitmap_get(ref, bit)) {
+            bitmap_dealloc(b, bit, 1);
+            bitmap_dealloc(ref, bit, 1);
+        }
+        u64 size = 1ull << (rand() % 8);
+        u64 a = bitmap_alloc(b, size);
+        if (a != bitmap_alloc(ref, size)) {
+            msg_err("!!! allocation mismatch for size %ld\n", size);
+            goto out;
+        }
+        if ((a != INVALID_PHYSICAL) && (rand() & 1)) {
+            bitmap_dealloc(b, a, size);
+            bitmap_dealloc(ref, a, size);
+        }
+    }
+    /* multi-word allocations */
+    u64 first = bitmap_alloc(b, 128);
+    if (first != bitmap_alloc(ref, 128)) {
+        msg_err("!!! multi-word allocation mismatch\n");
+        goto out;
+    }
+    /* searches for set bits across empty words */
+    bitmap_range_check_and_set(b, 0, nbits, false, false);
+    bitmap_range_check_and_set(ref, 0, nbits, false, false);
+    for (int i = 0; i < 100; i++) {
+        u64 bit = rand() % nbits;
+        bitmap_set(b, bit, 1);
+        bitmap_set(ref, bit, 1);
+        u64 start = rand() % nbits;
+        u64 len = rand() % (nbits - start);
+        if (bitmap_range_get_first(b, start, len) != bitmap_range_get_first(ref, start, len)) {
+            msg_err("!!! range_get_first mismatch (start %ld, nbits %ld)\n", start, len);
+            goto out;
+        }
+    }
+    bitmap c = bitmap_clone(b);
+    if (bitmap_range_get_first(c, 0, nbits) != bitmap_range_get_first(ref, 0, nbits)) {
+        msg_err("!!! range_get_first mismatch in cloned bitmap\n");
+        deallocate_bitmap(c);
+        goto out;
+    }
+    deallocate_bitmap(c);
+    result = true;
+  out:
+    deallocate_bitmap(b);
+    deallocate_bitmap(ref);
+    return result;
+}
+
 boolean basic_test()
 {
     heap h = init_process_runtime();
@@ -259,6 +330,8 @@ boolean basic_test()
 
     if(!test_range_get_first(b)) return false;
 
+    if (!test_summary(h)) return false;
+
     // deallocate bitmap
     deallocate_bitmap(b);
     return true;
@@ -350,6 +350,27 @@ boolean ringbuf_tests(heap h)
     ringbuf_read(b, &v3, sizeof(v3));
     test_assert((v3[0] == 0x11) && (v3[1] == 0x11) && (v3[2] == 0x33));
 
+    /* Staged data is not visible until published, and wraps around the end of the ring. */
+    test_assert(ringbuf_set_capacity(b, 8) == 8);
+    test_assert(ringbuf_length_sync(b) == 0);
+    ringbuf_stage(b, 0, &v3, sizeof(v3));
+    test_assert(ringbuf_length_sync(b) == 0);
+    ringbuf_publish(b, sizeof(v3));
+    test_assert((ringbuf_length_sync(b) == sizeof(v3)) && (ringbuf_space_sync(b) == 8 - sizeof(v3)));
+    for (int i = 0; i < 10; i++) {
+        v4 = i;
+        ringbuf_stage(b, 0, &v4, sizeof(v4));
+        test_assert(ringbuf_peek(b, &v3, sizeof(v3)) == true);
+        ringbuf_release(b, sizeof(v3));
+        ringbuf_publish(b, sizeof(v4));
+        test_assert(ringbuf_peek(b, &v4, sizeof(v4)) == true && (v4 == i));
+        ringbuf_stage(b, 0, &v3, sizeof(v3));
+        ringbuf_publish(b, sizeof(v3));
+        ringbuf_release(b, sizeof(v4));
+    }
+    test_assert(ringbuf_length_sync(b) == sizeof(v3));
+    test_assert((v3[0] == 0x11) && (v3[1] == 0x11) && (v3[2] == 0x33));
+
     failure = false;
 
 fail:
@@ -357,6 +378,48 @@ fail:
     return failure;
 }
 
+boolean chain_tests(heap h)
+{
+    boolean failure = true;
+    u8 data[3 * BUFFER_CHAIN_FRAG_SIZE];
+    for (int i = 0; i < sizeof(data); i++)
+        data[i] = i * 7;
+    buffer_chain c = allocate_buffer_chain(h);
+    test_assert(c != INVALID_ADDRESS);
+    buffer cb = buffer_chain_buffer(c);
+    test_assert(buffer_is_chain(cb));
+    test_assert(buffer_length(cb) == 0);
+
+    /* writes spanning fragments, an appended buffer, then more writes */
+    test_assert(buffer_chain_write(c, data, 100));
+    test_assert(buffer_chain_write(c, data + 100, BUFFER_CHAIN_FRAG_SIZE));
+    buffer b = allocate_buffer(h, BUFFER_CHAIN_FRAG_SIZE);
+    buffer_write(b, data + 100 + BUFFER_CHAIN_FRAG_SIZE, BUFFER_CHAIN_FRAG_SIZE);
+    test_assert(buffer_chain_push(c, b));
+    test_assert(!buffer_is_chain(b));
+    test_assert(buffer_chain_push(c, allocate_buffer(h, 1)));  /* empty */
+    u64 written = 100 + 2 * BUFFER_CHAIN_FRAG_SIZE;
+    test_assert(buffer_chain_write(c, data + written, sizeof(data) - written));
+    test_assert(buffer_length(cb) == sizeof(data));
+
+    sg_list sg = buffer_chain_sg(cb);
+    test_assert(sg != INVALID_ADDRESS);
+    test_assert(sg_list_length(sg) == 4);
+    test_assert(sg_buf_len(sg_list_peek_at(sg, 2)) == BUFFER_CHAIN_FRAG_SIZE);
+    test_assert(sg_list_peek_at(sg, 2)->buf == buffer_ref(b, 0));
+
+    /* consume part of the fragments, release the rest with the chain */
+    u8 out[BUFFER_CHAIN_FRAG_SIZE + 200];
+    test_assert(sg_copy_to_buf(out, sg, sizeof(out)) == sizeof(out));
+    test_assert(!runtime_memcmp(out, data, sizeof(out)));
+    test_assert(sg_list_length(sg) == 2);
+    failure = false;
+  fail:
+    if (c != INVALID_ADDRESS)
+        deallocate_buffer(buffer_chain_buffer(c));
+    return failure;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -367,6 +430,7 @@ int main(int argc, char **argv)
     failure |= concat_tests(h);
     failure |= vbprintf_tests(h);
     failure |= ringbuf_tests(h);
+    failure |= chain_tests(h);
 
     if (failure) {
         msg_err("Test failed\n");
@@ -40,6 +40,13 @@ closure_function(1, 2, void, test1,
 closure_type(test0_type, u64, u64 r);
 closure_type(test1_type, void, void *self, boolean terminate);
 
+closure_function(1, 1, u64, test2,
+                 u64, l,
+                 u64 r)
+{
+    return bound(l) + r;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -60,5 +67,12 @@ int main(int argc, char **argv)
         test_error("leak after deallocate_closure(): prev %lld, now %lld",
                 heap_occupancy, heap_allocated(h));
     }
+
+    /* apply_func() with matching and non-matching closure functions */
+    test0_type s = stack_closure(test2, 1);
+    if (apply_func(s, test2, 2) != 3)
+        test_error("apply_func() return value mismatch (direct call)");
+    if (apply_func(s, test0, 2) != 3)
+        test_error("apply_func() return value mismatch (indirect call)");
     return EXIT_SUCCESS;
 }
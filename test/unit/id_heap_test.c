@@ -381,6 +381,71 @@ static boolean alloc_align_test(heap h)
     return true;
 }
 
+static boolean set_online_test(heap h)
+{
+    const u64 base = 0x100000;
+    const u64 length = 64 * PAGESIZE;
+    const u64 offline_base = base + 16 * PAGESIZE;
+    const u64 offline_length = 32 * PAGESIZE;
+    id_heap id = create_id_heap(h, h, base, length, PAGESIZE, false);
+    if (id == INVALID_ADDRESS) {
+        msg_err("cannot create heap\n");
+        return false;
+    }
+    if (!id_heap_set_online(id, offline_base, offline_length, false)) {
+        msg_err("failed to take free area offline\n");
+        return false;
+    }
+    if ((heap_total((heap)id) != length - offline_length) || (heap_allocated((heap)id) != 0)) {
+        msg_err("unexpected total %ld / allocated %ld with offline area\n",
+                heap_total((heap)id), heap_allocated((heap)id));
+        return false;
+    }
+
+    /* offline ids must not be allocated */
+    u64 res;
+    for (u64 i = 0; i < (length - offline_length) / PAGESIZE; i++) {
+        res = allocate_u64((heap)id, PAGESIZE);
+        if ((res == INVALID_PHYSICAL) ||
+            ((res >= offline_base) && (res < offline_base + offline_length))) {
+            msg_err("unexpected allocation 0x%lx\n", res);
+            return false;
+        }
+    }
+    if ((res = allocate_u64((heap)id, PAGESIZE)) != INVALID_PHYSICAL) {
+        msg_err("should have exhausted online ids, got 0x%lx\n", res);
+        return false;
+    }
+
+    /* an area with allocated ids cannot be taken offline */
+    if (id_heap_set_online(id, base, 2 * PAGESIZE, false)) {
+        msg_err("allocated area should not be taken offline\n");
+        return false;
+    }
+    if (!id_heap_set_online(id, offline_base, offline_length, true)) {
+        msg_err("failed to bring area online\n");
+        return false;
+    }
+    if (!id_heap_add_offline_range(id, base + length, length) ||
+        (heap_total((heap)id) != length)) {
+        msg_err("failed to add offline range\n");
+        return false;
+    }
+    if ((heap_total((heap)id) != length) ||
+        (heap_allocated((heap)id) != length - offline_length)) {
+        msg_err("unexpected total %ld / allocated %ld after bringing area online\n",
+                heap_total((heap)id), heap_allocated((heap)id));
+        return false;
+    }
+    res = id_heap_alloc_subrange(id, PAGESIZE, offline_base, offline_base + offline_length);
+    if (res != offline_base) {
+        msg_err("online area allocation returned 0x%lx\n", res);
+        return false;
+    }
+    destroy_heap((heap)id);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -406,6 +471,9 @@ int main(int argc, char **argv)
     if (!alloc_align_test(h))
         goto fail;
 
+    if (!set_online_test(h))
+        goto fail;
+
     msg_debug("test passed\n");
     exit(EXIT_SUCCESS);
   fail:
@@ -0,0 +1,93 @@
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+#define LZ4_BUF_SIZE    (64 * KB)
+
+static u8 src[LZ4_BUF_SIZE], comp[LZ4_BUF_SIZE + LZ4_BUF_SIZE / 64], dst[LZ4_BUF_SIZE];
+
+static u64 test_roundtrip(u64 len)
+{
+    u64 clen = lz4_compress(src, len, comp, sizeof(comp));
+    test_assert(clen > 0);
+    test_assert(lz4_decompress(comp, clen, dst, len) == len);
+    test_assert(runtime_memcmp(src, dst, len) == 0);
+
+    /* partial decode */
+    if (len > 1) {
+        runtime_memset(dst, 0, len);
+        test_assert(lz4_decompress(comp, clen, dst, len / 2) == len / 2);
+        test_assert(runtime_memcmp(src, dst, len / 2) == 0);
+        test_assert(dst[len / 2] == 0);
+    }
+    return clen;
+}
+
+static void test_compressible(void)
+{
+    for (int i = 0; i < LZ4_BUF_SIZE; i++)
+        src[i] = "compressible data "[i % 18];
+    test_assert(test_roundtrip(LZ4_BUF_SIZE) < LZ4_BUF_SIZE / 64);
+
+    /* runs, including matches overlapping their own output */
+    runtime_memset(src, 0xa5, LZ4_BUF_SIZE);
+    test_assert(test_roundtrip(LZ4_BUF_SIZE) < LZ4_BUF_SIZE / 64);
+
+    /* short inputs are stored as literals */
+    for (u64 len = 1; len <= 16; len++)
+        test_roundtrip(len);
+
+    /* caller-supplied hash table */
+    static u32 table[LZ4_COMPRESS_TABLE_SIZE / sizeof(u32)];
+    static u8 comp_table[sizeof(comp)];
+    for (int i = 0; i < LZ4_BUF_SIZE; i++)
+        src[i] = i / 100;
+    u64 clen = lz4_compress(src, LZ4_BUF_SIZE, comp, sizeof(comp));
+    test_assert(lz4_compress_table(src, LZ4_BUF_SIZE, comp_table, sizeof(comp_table), table) ==
+                clen);
+    test_assert(runtime_memcmp(comp, comp_table, clen) == 0);
+}
+
+static void test_incompressible(void)
+{
+    for (int i = 0; i < LZ4_BUF_SIZE; i += sizeof(u64))
+        *(u64 *)(src + i) = random_u64();
+    test_assert(test_roundtrip(LZ4_BUF_SIZE) > LZ4_BUF_SIZE);
+
+    /* output that doesn't fit is rejected */
+    test_assert(lz4_compress(src, LZ4_BUF_SIZE, comp, LZ4_BUF_SIZE - 1) == 0);
+
+    /* mixed contents */
+    for (int i = 0; i < LZ4_BUF_SIZE / 2; i++)
+        src[i] = i / 100;
+    test_assert(test_roundtrip(LZ4_BUF_SIZE) < LZ4_BUF_SIZE);
+}
+
+static void test_malformed(void)
+{
+    for (int i = 0; i < LZ4_BUF_SIZE; i++)
+        src[i] = i % 7;
+    u64 clen = lz4_compress(src, LZ4_BUF_SIZE, comp, sizeof(comp));
+    test_assert(clen > 0);
+
+    /* truncated input */
+    for (u64 len = 1; len < clen; len++)
+        test_assert(lz4_decompress(comp, len, dst, LZ4_BUF_SIZE) < LZ4_BUF_SIZE);
+
+    /* match offset pointing before the start of the output */
+    u8 bad[] = { 0x10, 'a', 0x02, 0x00 };
+    test_assert(lz4_decompress(bad, sizeof(bad), dst, LZ4_BUF_SIZE) == -1);
+
+    /* literal length past the end of the input */
+    u8 bad_len[] = { 0xf0, 0x10, 'a' };
+    test_assert(lz4_decompress(bad_len, sizeof(bad_len), dst, LZ4_BUF_SIZE) == -1);
+}
+
+int main(int argc, char *argv[])
+{
+    init_process_runtime();
+    test_compressible();
+    test_incompressible();
+    test_malformed();
+    return 0;
+}
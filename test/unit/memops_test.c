@@ -4,6 +4,9 @@
 
 #define MEM_BUF_SIZE    512
 
+#define BENCH_BUF_SIZE  (64 * KB)
+#define BENCH_TOTAL     (256 * MB)
+
 static void test_memcpy(long *buf1, long *buf2, unsigned long buf_size)
 {
     for (long i = 0; i < buf_size; i++) {
@@ -100,17 +103,72 @@ static void test_memcmp(long *buf, unsigned long buf_size)
             sizeof(long)) != 0);
     test_assert(runtime_memcmp(buf, buf + 1, sizeof(long)) != 0);
     test_assert(runtime_memcmp(buf, buf, buf_size * sizeof(long)) == 0);
+
+    /* result sign must follow the first differing byte */
+    u8 *a = (u8 *)buf;
+    u8 *b = (u8 *)(buf + buf_size / 2);
+    bytes len = (buf_size / 2 - 1) * sizeof(long);
+    for (long i = 0; i < sizeof(long); i++) {
+        for (bytes diff = 0; diff < len - i; diff += 13) {
+            runtime_memset(a, 0x5a, len);
+            runtime_memset(b, 0x5a, len);
+            a[diff] = 0x5b;
+            test_assert(runtime_memcmp(a, b + i, len - i) > 0);
+            test_assert(runtime_memcmp(b + i, a, len - i) < 0);
+            a[diff] = 0x59;
+            test_assert(runtime_memcmp(a, b + i, len - i) < 0);
+            test_assert(runtime_memcmp(b + i, a, len - i) > 0);
+        }
+    }
+}
+
+static void bench_report(sstring op, bytes size, timestamp t)
+{
+    u64 usec = usec_from_timestamp(t);
+    rprintf("%s %8ld bytes: %6ld MB/s\n", op, size,
+            usec ? (BENCH_TOTAL / MB) * 1000000 / usec : 0);
+}
+
+/* Throughput of memcpy / memset / memcmp across copy sizes; not part of the
+   default test run, invoke as "memops_test bench". */
+static void memops_bench(heap h)
+{
+    u8 *src = allocate(h, BENCH_BUF_SIZE);
+    u8 *dst = allocate(h, BENCH_BUF_SIZE);
+    test_assert(src != INVALID_ADDRESS && dst != INVALID_ADDRESS);
+    runtime_memset(src, 0xa5, BENCH_BUF_SIZE);
+    runtime_memset(dst, 0xa5, BENCH_BUF_SIZE);
+    for (bytes size = 64; size <= BENCH_BUF_SIZE; size <<= 2) {
+        u64 iterations = BENCH_TOTAL / size;
+        timestamp start = now(CLOCK_ID_MONOTONIC);
+        for (u64 i = 0; i < iterations; i++)
+            runtime_memcpy(dst, src, size);
+        bench_report(ss("memcpy"), size, now(CLOCK_ID_MONOTONIC) - start);
+        start = now(CLOCK_ID_MONOTONIC);
+        for (u64 i = 0; i < iterations; i++)
+            runtime_memset(dst, i, size);
+        bench_report(ss("memset"), size, now(CLOCK_ID_MONOTONIC) - start);
+        runtime_memset(dst, 0xa5, size);
+        start = now(CLOCK_ID_MONOTONIC);
+        for (u64 i = 0; i < iterations; i++)
+            test_assert(runtime_memcmp(dst, src, size) == 0);
+        bench_report(ss("memcmp"), size, now(CLOCK_ID_MONOTONIC) - start);
+    }
+    deallocate(h, src, BENCH_BUF_SIZE);
+    deallocate(h, dst, BENCH_BUF_SIZE);
 }
 
 int main(int argc, char *argv[])
 {
     long buf1[MEM_BUF_SIZE], buf2[MEM_BUF_SIZE];
 
-    init_process_runtime();
+    heap h = init_process_runtime();
     test_memcpy(buf1, buf2, MEM_BUF_SIZE);
     test_memcpy(buf2, buf1, MEM_BUF_SIZE);
     test_memcpy_overlap(buf1, MEM_BUF_SIZE);
     test_memset(buf1, MEM_BUF_SIZE);
     test_memcmp(buf1, MEM_BUF_SIZE);
+    if (argc > 1 && !runtime_strcmp(sstring_from_cstring(argv[1], 8), ss("bench")))
+        memops_bench(h);
     return 0;
 }
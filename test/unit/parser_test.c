@@ -768,6 +768,119 @@ JSON_PARSE_TEST(json_nested_test, "{\"a\":{\"b\":{\"c\":{\"d\":{\"e\":{\"f\":{\"
     return true;
 }
 
+JSON_PARSE_TEST(json_numbervalue_exp_test, "{\"a\":-1.5e+3,\"b\":2E-2,\"c\":\"d\"}")
+{
+    test_no_errors();
+    test_assert((root != NULL) && (tuple_count(root) == 1));
+    string s = get_string(root, sym_this("c"));
+    test_assert(s != NULL);
+    test_strings_equal(s, "d");
+
+    destruct_value(root, true);
+    return true;
+}
+
+JSON_PARSE_TEST(json_invalid_exp_test, "{\"a\":1e}")
+{
+    test_assert(errors_count > 0);
+    return true;
+}
+
+JSON_PARSE_TEST(json_escape_test, "{\"a\\\"b\":\"c\\\\d\\n\\u0041\\u00e9\\ud83d\\ude00\"}")
+{
+    test_no_errors();
+    test_assert((root != NULL) && (tuple_count(root) == 1));
+    string s = get_string(root, sym_this("a\"b"));
+    test_assert(s != NULL);
+    test_strings_equal(s, "c\\d\nA\xc3\xa9\xf0\x9f\x98\x80");
+
+    destruct_value(root, true);
+    return true;
+}
+
+JSON_PARSE_TEST(json_invalid_escape_test, "{\"a\":\"\\u00g0\"}")
+{
+    test_assert(errors_count > 0);
+    return true;
+}
+
+/* feeds a document in chunks of all sizes through the buffer interface of the JSON parser */
+boolean json_parser_feed_test(heap h)
+{
+    sstring doc = ss("{\"key\":\"a fairly long string value that spans several words\","
+                     "\"n\":[1,2,{\"x\":\"y\"}],\"obj\":{\"k\\u00e9y\":\"v\"}}");
+    for (int chunk = 1; chunk <= doc.len; chunk++) {
+        root = NULL;
+        errors_count = 0;
+        parser p = json_p;
+        for (int offset = 0; offset < doc.len; offset += chunk)
+            p = json_parser_feed(p, alloca_wrap_buffer(doc.ptr + offset,
+                                                       MIN(chunk, doc.len - offset)));
+        apply(p, CHARACTER_INVALID);
+        test_no_errors();
+        test_assert((root != NULL) && (tuple_count(root) == 2));
+        string s = get_string(root, sym_this("key"));
+        test_assert(s != NULL);
+        test_strings_equal(s, "a fairly long string value that spans several words");
+        tuple t = get_tuple(root, sym_this("obj"));
+        test_assert(t != NULL);
+        s = get_string(t, sym_this("k\xc3\xa9y"));
+        test_assert(s != NULL);
+        test_strings_equal(s, "v");
+        destruct_value(root, true);
+    }
+    return false;
+}
+
+static const enum json_event json_stream_expected[] = {
+    JSON_EVENT_OBJ_START, JSON_EVENT_KEY, JSON_EVENT_ARRAY_START, JSON_EVENT_NUMBER,
+    JSON_EVENT_TRUE, JSON_EVENT_FALSE, JSON_EVENT_NULL, JSON_EVENT_STRING, JSON_EVENT_ARRAY_END,
+    JSON_EVENT_KEY, JSON_EVENT_OBJ_START, JSON_EVENT_OBJ_END, JSON_EVENT_OBJ_END,
+};
+
+static int json_stream_events;
+
+closure_function(0, 2, boolean, json_stream_test_handler,
+                 enum json_event ev, buffer data)
+{
+    if ((json_stream_events >= sizeof(json_stream_expected) / sizeof(json_stream_expected[0])) ||
+        (ev != json_stream_expected[json_stream_events]))
+        return false;
+    switch (json_stream_events++) {
+    case 1:
+        return (buffer_strcmp(data, "a") == 0);
+    case 3:
+        return (buffer_strcmp(data, "-12.5e3") == 0);
+    case 7:
+        return (buffer_strcmp(data, "s") == 0);
+    }
+    return true;
+}
+
+boolean json_stream_test(heap h)
+{
+    json_stream js = allocate_json_stream(h, stack_closure(json_stream_test_handler));
+    test_assert(js != INVALID_ADDRESS);
+    json_stream_events = 0;
+    test_assert(json_stream_feed(js, alloca_wrap_sstring(ss("{\"a\": [-12.5e3, true, fal"))));
+    test_assert(json_stream_feed(js, alloca_wrap_sstring(ss("se, null, \"s\"], \"b\": {}}"))));
+    test_assert(json_stream_end(js));
+    test_assert(json_stream_events == sizeof(json_stream_expected) / sizeof(json_stream_expected[0]));
+
+    /* a handler returning false stops the parser */
+    json_stream_reset(js);
+    json_stream_events = 0;
+    test_assert(!json_stream_feed(js, alloca_wrap_sstring(ss("{\"b\":"))));
+    test_assert(json_stream_error(js) != 0);
+
+    json_stream_reset(js);
+    json_stream_events = 0;
+    test_assert(!json_stream_feed(js, alloca_wrap_sstring(ss("{\"a\" 1}"))));
+    test_assert(json_stream_error(js) != 0);
+    deallocate_json_stream(h, js);
+    return false;
+}
+
 void init (heap h)
 {
     tuple_p = value_parser(h, closure(h, finish, h), closure(h, perr, h));
@@ -848,6 +961,12 @@ test_func TESTS[] = {
     json_empty_array_test,
     json_array_test,
     json_nested_test,
+    json_numbervalue_exp_test,
+    json_invalid_exp_test,
+    json_escape_test,
+    json_invalid_escape_test,
+    json_parser_feed_test,
+    json_stream_test,
 
     NULL
 };
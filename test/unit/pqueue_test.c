@@ -41,10 +41,10 @@ closure_function(1, 1, boolean, walk_test_handler,
     return v != (void *)500;
 }
 
-boolean basic_test(heap h)
+boolean basic_test(heap h, u8 order)
 {
     char * msg = "";
-    pqueue q = allocate_pqueue(h, basic_sort);
+    pqueue q = allocate_pqueue_dary(h, basic_sort, order);
 
     /* Single entry */
     pqueue_insert(q, (void *)500);
@@ -233,15 +233,15 @@ boolean basic_test(heap h)
     return true;
   fail:
     deallocate_pqueue(q);
-    printf("pqueue basic test failed: %s\n", msg);
+    printf("pqueue basic test (order %d) failed: %s\n", order, msg);
     return false;
 }
 
 /* TODO more thorough would be to track insertions in a list or some
    other structure and parity check */
-boolean random_test(heap h, int n, int passes)
+boolean random_test(heap h, u8 order, int n, int passes)
 {
-    pqueue q = allocate_pqueue(h, basic_sort);
+    pqueue q = allocate_pqueue_dary(h, basic_sort, order);
     char * msg = "";
     int remain = 0;
 
@@ -271,7 +271,7 @@ boolean random_test(heap h, int n, int passes)
     }
     return true;
   fail:
-    printf("random_test fail; %s\n", msg);
+    printf("random_test (order %d) fail; %s\n", order, msg);
     deallocate_pqueue(q);
     return false;
 }
@@ -281,7 +281,7 @@ static boolean reorder_sort(void *a, void *b)
     return (((struct pqueue_test_elem *)a)->val < ((struct pqueue_test_elem *)b)->val);
 }
 
-static boolean remove_test(heap h, int passes)
+static boolean remove_test(heap h, u8 order, int passes)
 {
     const int max_elems = 512;
     struct pqueue_test_elem elems[max_elems];
@@ -289,7 +289,7 @@ static boolean remove_test(heap h, int passes)
     int val;
     char *err_msg = NULL;
 
-    pqueue q = allocate_pqueue(h, reorder_sort);
+    pqueue q = allocate_pqueue_dary(h, reorder_sort, order);
     for (int pass = 0; pass < passes; pass++) {
         num_elems = (rand() % max_elems) + 1;
         for (int i = 0; i < num_elems; i++) {
@@ -323,11 +323,11 @@ static boolean remove_test(heap h, int passes)
     deallocate_pqueue(q);
     if (!err_msg)
         return true;
-    printf("remove test failed: %s\n", err_msg);
+    printf("remove test (order %d) failed: %s\n", order, err_msg);
     return false;
 }
 
-static boolean reorder_test(heap h, int passes)
+static boolean reorder_test(heap h, u8 order, int passes)
 {
     const int max_elems = 512;
     struct pqueue_test_elem elems[max_elems];
@@ -335,7 +335,7 @@ static boolean reorder_test(heap h, int passes)
     int val;
     char *err_msg = NULL;
 
-    pqueue q = allocate_pqueue(h, reorder_sort);
+    pqueue q = allocate_pqueue_dary(h, reorder_sort, order);
     for (int pass = 0; pass < passes; pass++) {
         num_elems = (rand() % max_elems) + 1;
         for (int i = 0; i < num_elems; i++)
@@ -362,25 +362,67 @@ static boolean reorder_test(heap h, int passes)
     deallocate_pqueue(q);
     if (!err_msg)
         return true;
-    printf("reorder test failed: %s\n", err_msg);
+    printf("reorder test (order %d) failed: %s\n", order, err_msg);
     return false;
 }
 
+#define BENCH_MIN_ELEMS     (1ull << 10)
+#define BENCH_MAX_ELEMS     (1ull << 20)
+
+/* Insertion of random elements followed by popping of all elements (as done by a timer queue where
+   all timers expire), and interleaved pop/insert on a queue of constant size (as done by a run queue
+   or by a timer queue with periodic timers), for binary and wider heaps; not part of the default
+   test run, invoke as "pqueue_test bench". */
+static void pqueue_bench(heap h)
+{
+    u64 *vals = malloc(BENCH_MAX_ELEMS * sizeof(u64));
+    assert(vals);
+    for (u64 i = 0; i < BENCH_MAX_ELEMS; i++)
+        vals[i] = random_u64() | 1;
+    for (u64 n = BENCH_MIN_ELEMS; n <= BENCH_MAX_ELEMS; n <<= 2) {
+        for (u8 order = 1; order <= 3; order++) {
+            pqueue q = allocate_pqueue_dary(h, basic_sort, order);
+            timestamp start = now(CLOCK_ID_MONOTONIC);
+            for (u64 i = 0; i < n; i++)
+                pqueue_insert(q, (void *)vals[i]);
+            timestamp insert = now(CLOCK_ID_MONOTONIC) - start;
+            start = now(CLOCK_ID_MONOTONIC);
+            for (u64 i = 0; i < n; i++)
+                pqueue_insert(q, (void *)(u64_from_pointer(pqueue_pop(q)) - vals[i]));
+            timestamp churn = now(CLOCK_ID_MONOTONIC) - start;
+            start = now(CLOCK_ID_MONOTONIC);
+            for (u64 i = 0; i < n; i++)
+                pqueue_pop(q);
+            timestamp pop = now(CLOCK_ID_MONOTONIC) - start;
+            rprintf("%2d-ary %8ld elements: insert %6ld ns, pop/insert %6ld ns, pop %6ld ns\n",
+                    1 << order, n, nsec_from_timestamp(insert) / n,
+                    nsec_from_timestamp(churn) / n, nsec_from_timestamp(pop) / n);
+            deallocate_pqueue(q);
+        }
+    }
+    free(vals);
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
 
-    if (!basic_test(h))
-	goto fail;
+    for (u8 order = 1; order <= PQUEUE_ORDER_MAX; order++) {
+        if (!basic_test(h, order))
+            goto fail;
 
-    if (!random_test(h, 100, 1000))
-        goto fail;
+        if (!random_test(h, order, 100, 1000))
+            goto fail;
 
-    if (!remove_test(h, 100))
-        goto fail;
+        if (!remove_test(h, order, 100))
+            goto fail;
 
-    if (!reorder_test(h, 1000))
-        goto fail;
+        if (!reorder_test(h, order, 1000))
+            goto fail;
+    }
+
+    if (argc > 1 && !runtime_strcmp(sstring_from_cstring(argv[1], 8), ss("bench")))
+        pqueue_bench(h);
 
     msg_debug("pqueue test passed\n");
     exit(EXIT_SUCCESS);
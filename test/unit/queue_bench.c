@@ -0,0 +1,152 @@
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+/* Contention benchmark for queue and mpmc_queue: each thread alternates
+   between enqueueing and dequeueing a batch of items for a fixed number of
+   operations, and the aggregate throughput is reported. Usage:
+   queue_bench [max_threads] */
+
+#define QUEUE_ORDER         (10)
+#define QUEUE_SIZE          (1ull << QUEUE_ORDER)
+#define BENCH_OPS           (1ull << 20)
+#define BENCH_BATCH         32
+#define BENCH_MAX_THREADS   64
+
+static heap test_heap;
+static volatile boolean start;
+
+typedef struct bench_ops {
+    const char *name;
+    void *(*create)(heap h, u64 size);
+    void (*destroy)(void *q);
+    boolean (*put)(void *q, void *p);
+    void *(*get)(void *q);
+} *bench_ops;
+
+static void *bench_queue_allocate(heap h, u64 size)
+{
+    return allocate_queue(h, size);
+}
+
+static void bench_queue_deallocate(void *q)
+{
+    deallocate_queue(q);
+}
+
+static boolean bench_queue_enqueue(void *q, void *p)
+{
+    return enqueue(q, p);
+}
+
+static void *bench_queue_dequeue(void *q)
+{
+    return dequeue(q);
+}
+
+static void *bench_mpmc_allocate(heap h, u64 size)
+{
+    return allocate_mpmc_queue(h, size);
+}
+
+static void bench_mpmc_deallocate(void *q)
+{
+    deallocate_mpmc_queue(q);
+}
+
+static boolean bench_mpmc_enqueue(void *q, void *p)
+{
+    return mpmc_enqueue(q, p);
+}
+
+static void *bench_mpmc_dequeue(void *q)
+{
+    return mpmc_dequeue(q);
+}
+
+static struct bench_ops bench_types[] = {
+    {"queue", bench_queue_allocate, bench_queue_deallocate, bench_queue_enqueue, bench_queue_dequeue},
+    {"mpmc_queue", bench_mpmc_allocate, bench_mpmc_deallocate, bench_mpmc_enqueue, bench_mpmc_dequeue},
+};
+
+struct bench_arg {
+    bench_ops ops;
+    void *q;
+    u64 nops;
+};
+
+static void *bench_child(void *arg)
+{
+    struct bench_arg *ba = arg;
+    u64 done = 0;
+    while (!start)
+        sched_yield();
+    while (done < ba->nops) {
+        int n;
+        for (n = 0; n < BENCH_BATCH; n++) {
+            if (!ba->ops->put(ba->q, (void *)(done + n + 1)))
+                break;
+        }
+        for (int i = 0; i < n; i++) {
+            while (ba->ops->get(ba->q) == INVALID_ADDRESS)
+                sched_yield();
+        }
+        done += n ? n : 1;
+    }
+    return (void *)EXIT_SUCCESS;
+}
+
+static u64 nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static void bench_run(bench_ops ops, int nthreads)
+{
+    pthread_t threads[BENCH_MAX_THREADS];
+    struct bench_arg arg;
+    arg.ops = ops;
+    arg.q = ops->create(test_heap, QUEUE_SIZE);
+    test_assert(arg.q != INVALID_ADDRESS);
+    arg.nops = BENCH_OPS / nthreads;
+    start = false;
+    write_barrier();
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, bench_child, &arg))
+            test_error("pthread_create");
+    }
+    u64 t0 = nsec_now();
+    start = true;
+    for (int i = 0; i < nthreads; i++) {
+        void *retval;
+        if (pthread_join(threads[i], &retval))
+            test_error("pthread_join");
+        test_assert(retval == (void *)EXIT_SUCCESS);
+    }
+    u64 elapsed = nsec_now() - t0;
+    u64 total = arg.nops * nthreads * 2;
+    printf("%-12s threads %3d: %6lld ns/op, %8lld kops/s\n", ops->name, nthreads,
+           elapsed / total, total * MILLION / elapsed);
+    ops->destroy(arg.q);
+}
+
+int main(int argc, char **argv)
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) :
+        MIN(sysconf(_SC_NPROCESSORS_ONLN), BENCH_MAX_THREADS);
+    if (max_threads < 1 || max_threads > BENCH_MAX_THREADS)
+        test_error("thread count must be between 1 and %d", BENCH_MAX_THREADS);
+    setbuf(stdout, NULL);
+    test_heap = init_process_runtime();
+    for (int nthreads = 1; nthreads <= max_threads; nthreads <<= 1) {
+        for (int i = 0; i < sizeof(bench_types) / sizeof(bench_types[0]); i++)
+            bench_run(&bench_types[i], nthreads);
+    }
+    return EXIT_SUCCESS;
+}
@@ -241,6 +241,178 @@ static void basic_test(boolean multi)
     deallocate_queue(q);
 }
 
+static void batch_test(void)
+{
+    queuetest_debug("");
+    queue q = allocate_queue(test_heap, QUEUE_SIZE);
+    test_assert(q != INVALID_ADDRESS);
+    void **buf = allocate(test_heap, QUEUE_SIZE * sizeof(u64));
+    test_assert(dequeue_batch(q, buf, QUEUE_SIZE) == 0);
+
+    /* offset the ring so that batches wrap */
+    for (u64 i = 0; i < QUEUE_SIZE / 2 + 3; i++) {
+        test_assert(enqueue(q, (void *)i));
+        test_assert(dequeue(q) == (void *)i);
+    }
+    u64 next_in = 0, next_out = 0;
+    for (int pass = 0; pass < BASIC_TEST_RANDOM_PASSES; pass++) {
+        u64 n_enqueue = random() % (QUEUE_SIZE - queue_length(q) + 1);
+        for (u64 i = 0; i < n_enqueue; i++)
+            test_assert(enqueue(q, (void *)next_in++));
+        u32 n = dequeue_batch(q, buf, random() % QUEUE_SIZE + 1);
+        test_assert(n <= next_in - next_out);
+        for (u32 i = 0; i < n; i++)
+            test_assert(buf[i] == (void *)next_out++);
+    }
+    while (next_out < next_in) {
+        u32 n = dequeue_batch(q, buf, QUEUE_SIZE);
+        test_assert(n > 0);
+        for (u32 i = 0; i < n; i++)
+            test_assert(buf[i] == (void *)next_out++);
+    }
+    test_assert(queue_empty(q));
+    deallocate(test_heap, buf, QUEUE_SIZE * sizeof(u64));
+    deallocate_queue(q);
+}
+
+static void mpmc_basic_test(void)
+{
+    queuetest_debug("");
+    mpmc_queue q = allocate_mpmc_queue(test_heap, QUEUE_SIZE);
+    test_assert(q != INVALID_ADDRESS);
+    test_assert(mpmc_queue_empty(q));
+    for (int pass = 0; pass < 3; pass++) {
+        for (u64 i = 0; i < QUEUE_SIZE; i++)
+            test_assert(mpmc_enqueue(q, (void *)i));
+        test_assert(mpmc_queue_length(q) == QUEUE_SIZE);
+
+        /* enqueue should fail here */
+        test_assert(!mpmc_enqueue(q, 0));
+        for (u64 i = 0; i < QUEUE_SIZE; i++)
+            test_assert(mpmc_dequeue(q) == (void *)i);
+        test_assert(mpmc_dequeue(q) == INVALID_ADDRESS);
+        test_assert(mpmc_queue_empty(q));
+    }
+    deallocate_mpmc_queue(q);
+}
+
+static void * mpmc_test_child(void *arg)
+{
+    mpmc_queue q = (mpmc_queue)arg;
+
+    do {
+        if (!drain_and_exit) {
+            int n_enqueue = random() % MAX_CONSECUTIVE_OPS;
+            for (int i = 0; i < n_enqueue; i++) {
+                u64 n = find_free();
+                if (n == INVALID)
+                    break;
+                if (!mpmc_enqueue(q, (void *)n)) {
+                    release(n);
+                    break;
+                }
+                fetch_and_add((u64*)&total_queued, 1);
+            }
+        }
+
+        int n_dequeue = random() % MAX_CONSECUTIVE_OPS;
+        for (int i = 0; i < n_dequeue; i++) {
+            u64 n = (u64)mpmc_dequeue(q);
+            if (n == INVALID) {
+                if (drain_and_exit)
+                    return (void *)EXIT_SUCCESS;
+                break;
+            }
+            test_assert(n < RESULTS_VEC_SIZE);
+            release(n);
+            fetch_and_add((u64*)&total_dequeued, 1);
+        }
+    } while(1);
+}
+
+static void mpmc_thread_test(void)
+{
+    pthread_t threads[N_THREADS];
+    mpmc_queue q = allocate_mpmc_queue(test_heap, QUEUE_SIZE);
+    test_assert(q != INVALID_ADDRESS);
+
+    vec_count = RESULTS_VEC_SIZE;
+    zero(results, RESULTS_VEC_SIZE * sizeof(u64));
+    total_queued = total_dequeued = 0;
+    drain_and_exit = false;
+    write_barrier();
+    for (int i = 0; i < N_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, mpmc_test_child, q))
+            test_error("pthread_create");
+    }
+
+    usleep(THREAD_TEST_DURATION_US);
+    drain_and_exit = true;
+
+    for (int i = 0; i < N_THREADS; i++) {
+        void * retval;
+        if (pthread_join(threads[i], &retval))
+            test_error("pthread_join");
+        if (retval != (void *)EXIT_SUCCESS)
+            test_error("child %d failed", i);
+    }
+    test_assert(vec_count == RESULTS_VEC_SIZE);
+    test_assert(total_queued == total_dequeued);
+    test_assert(mpmc_queue_empty(q));
+    deallocate_mpmc_queue(q);
+}
+
+#define SPSC_TEST_ITEMS (QUEUE_SIZE * 1024)
+#define SPSC_BATCH      16
+
+static void * spsc_test_producer(void *arg)
+{
+    spsc_queue q = (spsc_queue)arg;
+    void *buf[SPSC_BATCH];
+    u64 next = 0;
+    while (next < SPSC_TEST_ITEMS) {
+        u32 n = random() % SPSC_BATCH + 1;
+        for (u32 i = 0; i < n; i++)
+            buf[i] = (void *)(next + i);
+        next += spsc_enqueue_batch(q, buf, n);
+    }
+    return (void *)EXIT_SUCCESS;
+}
+
+static void spsc_test(void)
+{
+    queuetest_debug("");
+    pthread_t producer;
+    spsc_queue q = allocate_spsc_queue(test_heap, QUEUE_SIZE);
+    test_assert(q != INVALID_ADDRESS);
+
+    /* single-threaded fill and drain */
+    for (u64 i = 0; i < QUEUE_SIZE; i++)
+        test_assert(spsc_enqueue(q, (void *)i));
+    test_assert(!spsc_enqueue(q, 0));
+    test_assert(spsc_queue_length(q) == QUEUE_SIZE);
+    for (u64 i = 0; i < QUEUE_SIZE; i++)
+        test_assert(spsc_dequeue(q) == (void *)i);
+    test_assert(spsc_dequeue(q) == INVALID_ADDRESS);
+
+    /* ordering across threads with batches of varying size */
+    if (pthread_create(&producer, NULL, spsc_test_producer, q))
+        test_error("pthread_create");
+    void *buf[SPSC_BATCH];
+    u64 next = 0;
+    while (next < SPSC_TEST_ITEMS) {
+        u32 n = spsc_dequeue_batch(q, buf, random() % SPSC_BATCH + 1);
+        for (u32 i = 0; i < n; i++)
+            test_assert(buf[i] == (void *)next++);
+    }
+    void *retval;
+    if (pthread_join(producer, &retval))
+        test_error("pthread_join");
+    test_assert(retval == (void *)EXIT_SUCCESS);
+    test_assert(spsc_queue_length(q) == 0);
+    deallocate_spsc_queue(q);
+}
+
 int main(int argc, char **argv)
 {
     setbuf(stdout, NULL);
@@ -249,6 +421,10 @@ int main(int argc, char **argv)
     basic_test(true);
     thread_test();
     n_test();
+    batch_test();
+    mpmc_basic_test();
+    mpmc_thread_test();
+    spsc_test();
     queuetest_debug("queue test passed\n");
     return EXIT_SUCCESS;
 }
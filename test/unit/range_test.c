@@ -126,6 +126,15 @@ boolean basic_test(heap h)
         goto fail;
     }
 
+    /* unlocked lookups */
+    if (rangemap_lookup_unlocked(rm, 19) != &tn1->node ||
+        rangemap_lookup_unlocked(rm, 20) != &tn3->node ||
+        rangemap_lookup_unlocked(rm, 9) != INVALID_ADDRESS ||
+        rangemap_lookup_unlocked(rm, 30) != INVALID_ADDRESS) {
+        msg = "lookup unlocked";
+        goto fail;
+    }
+
     /* range lookup */
     rmnode_handler rh = stack_closure_func(rmnode_handler, basic_test_validate);
     rangemap_range_lookup(rm, irange(0, 26), rh);
@@ -201,9 +210,9 @@ closure_function(1, 1, boolean, rangemap_merge_destructor,
     return true;
 }
 
-static boolean rangemap_merge_test(heap h)
+static boolean rangemap_merge_test(heap h, boolean btree)
 {
-    rangemap rm = allocate_rangemap(h);
+    rangemap rm = btree ? allocate_rangemap_btree(h, 0) : allocate_rangemap(h);
     if (rm == INVALID_ADDRESS) {
         msg_err("failed to allocate rangemap\n");
         return false;
@@ -241,6 +250,188 @@ static boolean rangemap_merge_test(heap h)
     return true;
 }
 
+#define BTREE_TEST_NODES    2048
+#define BTREE_TEST_SPACING  8
+
+static void range_test_shuffle(test_node *nodes, int count)
+{
+    for (int i = count - 1; i > 0; i--) {
+        int j = random_u64() % (i + 1);
+        test_node tmp = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = tmp;
+    }
+}
+
+static boolean rmnode_range_equal(rmnode a, rmnode b)
+{
+    if ((a == INVALID_ADDRESS) || (b == INVALID_ADDRESS))
+        return a == b;
+    return range_equal(a->r, b->r);
+}
+
+#define BTREE_TEST_GAPS     128
+
+closure_function(3, 1, boolean, rangemap_gap_collect,
+                 range *, gaps, int *, count, u64, min_span,
+                 range r)
+{
+    if (range_span(r) > bound(min_span)) {
+        test_assert(*bound(count) < BTREE_TEST_GAPS);
+        bound(gaps)[(*bound(count))++] = r;
+    }
+    return true;
+}
+
+/* compares the gaps larger than min_span found by a linear search and by a large gap search */
+static void rangemap_gaps_verify(rangemap rb, rangemap bt, range q, u64 min_span)
+{
+    range gaps[BTREE_TEST_GAPS], rb_gaps[BTREE_TEST_GAPS], bt_gaps[BTREE_TEST_GAPS];
+    int count = 0, rb_count = 0, bt_count = 0;
+    rangemap_range_find_gaps(rb, q, stack_closure(rangemap_gap_collect, gaps, &count, min_span));
+    rangemap_range_find_large_gaps(rb, q, min_span,
+                                   stack_closure(rangemap_gap_collect, rb_gaps, &rb_count, 0));
+    rangemap_range_find_large_gaps(bt, q, min_span,
+                                   stack_closure(rangemap_gap_collect, bt_gaps, &bt_count, 0));
+    test_assert((rb_count == count) && (bt_count == count));
+    for (int i = 0; i < count; i++)
+        test_assert(range_equal(rb_gaps[i], gaps[i]) && range_equal(bt_gaps[i], gaps[i]));
+}
+
+/* compares a B+tree map with a red-black tree map holding the same ranges */
+static void rangemap_btree_verify(rangemap rb, rangemap bt)
+{
+    test_assert(rangemap_count(rb) == rangemap_count(bt));
+    rmnode n = rangemap_first_node(bt);
+    rangemap_foreach(rb, rn) {
+        test_assert(rmnode_range_equal(rn, n));
+        test_assert(rmnode_range_equal(rangemap_prev_node(rb, rn), rangemap_prev_node(bt, n)));
+        n = rangemap_next_node(bt, n);
+    }
+    test_assert(n == INVALID_ADDRESS);
+    for (u64 point = 0; point < (BTREE_TEST_NODES + 2) * BTREE_TEST_SPACING; point++) {
+        test_assert(rmnode_range_equal(rangemap_lookup(rb, point), rangemap_lookup(bt, point)));
+        test_assert(rmnode_range_equal(rangemap_lookup(rb, point),
+                                       rangemap_lookup_unlocked(bt, point)));
+        test_assert(rmnode_range_equal(rangemap_lookup_at_or_next(rb, point),
+                                       rangemap_lookup_at_or_next(bt, point)));
+        test_assert(rmnode_range_equal(rangemap_lookup_max_lte(rb, point),
+                                       rangemap_lookup_max_lte(bt, point)));
+    }
+    for (int i = 0; i < 64; i++) {
+        u64 start = random_u64() % ((BTREE_TEST_NODES + 2) * BTREE_TEST_SPACING);
+        range q = irangel(start, random_u64() % (64 * BTREE_TEST_SPACING));
+        test_assert(rangemap_range_intersects(rb, q) == rangemap_range_intersects(bt, q));
+        struct rangemap_iter it;
+        rmnode n = rangemap_iter_start(bt, &it, q.start);
+        rangemap_foreach_of_range(rb, rn, &(struct rmnode){.r = q}) {
+            test_assert(rmnode_range_equal(rn, n));
+            n = rangemap_iter_next(&it);
+        }
+        rangemap_gaps_verify(rb, bt, q, random_u64() % BTREE_TEST_SPACING);
+    }
+}
+
+closure_func_basic(rmnode_handler, boolean, rangemap_btree_keep_node,
+                   rmnode n)
+{
+    return true;
+}
+
+static test_node *rangemap_btree_nodes(heap h)
+{
+    test_node *nodes = allocate(h, BTREE_TEST_NODES * sizeof(test_node));
+    test_assert(nodes != INVALID_ADDRESS);
+    for (int i = 0; i < BTREE_TEST_NODES; i++)
+        nodes[i] = allocate_test_node(h, irangel(BTREE_TEST_SPACING * (i + 1),
+                                                 1 + i % (BTREE_TEST_SPACING - 1)), i);
+    range_test_shuffle(nodes, BTREE_TEST_NODES);
+    return nodes;
+}
+
+static boolean rangemap_btree_test(heap h)
+{
+    rangemap rb = allocate_rangemap(h);
+    rangemap bt = allocate_rangemap_btree(h, 0);
+    test_assert((rb != INVALID_ADDRESS) && (bt != INVALID_ADDRESS));
+    test_node *rb_nodes = rangemap_btree_nodes(h);
+    test_node *bt_nodes = allocate(h, BTREE_TEST_NODES * sizeof(test_node));
+    test_assert(bt_nodes != INVALID_ADDRESS);
+    for (int i = 0; i < BTREE_TEST_NODES; i++)
+        bt_nodes[i] = allocate_test_node(h, rb_nodes[i]->node.r, rb_nodes[i]->val);
+
+    /* random insertions and removals */
+    for (int i = 0; i < BTREE_TEST_NODES; i++) {
+        test_assert(rangemap_insert(rb, &rb_nodes[i]->node));
+        test_assert(rangemap_insert(bt, &bt_nodes[i]->node));
+    }
+    rangemap_btree_verify(rb, bt);
+    struct test_node overlap;
+    rmnode_init(&overlap.node, irangel(rb_nodes[0]->node.r.start, 1));
+    test_assert(!rangemap_insert(bt, &overlap.node));
+    for (int i = 0; i < BTREE_TEST_NODES; i += 2) {
+        rangemap_remove_node(rb, &rb_nodes[i]->node);
+        rangemap_remove_node(bt, &bt_nodes[i]->node);
+    }
+    rangemap_btree_verify(rb, bt);
+    for (int i = 0; i < BTREE_TEST_NODES; i += 2) {
+        test_assert(rangemap_insert(rb, &rb_nodes[i]->node));
+        test_assert(rangemap_insert(bt, &bt_nodes[i]->node));
+    }
+    rangemap_btree_verify(rb, bt);
+
+    /* removal of the current node while iterating */
+    struct rangemap_iter it;
+    rmnode next;
+    int count = 0;
+    for (rmnode n = rangemap_iter_start(bt, &it, 0); n != INVALID_ADDRESS; n = next) {
+        next = rangemap_iter_next(&it);
+        if (count++ & 1) {
+            rangemap_remove_node(bt, n);
+            rangemap_remove_node(rb, rangemap_lookup(rb, n->r.start));
+        }
+    }
+    test_assert(count == BTREE_TEST_NODES);
+    rangemap_btree_verify(rb, bt);
+    rmnode_handler keep = stack_closure_func(rmnode_handler, rangemap_btree_keep_node);
+    destruct_rangemap(rb, keep);
+    destruct_rangemap(bt, keep);
+    test_assert((rangemap_count(bt) == 0) && (rangemap_first_node(bt) == INVALID_ADDRESS));
+
+    /* bulk insertion, into an empty map and into a non-empty map */
+    for (int i = 0; i < BTREE_TEST_NODES; i++) {
+        while (rb_nodes[i]->val != i) {
+            test_node tmp = rb_nodes[rb_nodes[i]->val];
+            rb_nodes[rb_nodes[i]->val] = rb_nodes[i];
+            rb_nodes[i] = tmp;
+        }
+    }
+    for (int count = 1; count <= BTREE_TEST_NODES; count = count * 3 + 1) {
+        range_test_shuffle(bt_nodes, count);
+        test_assert(rangemap_insert_bulk(bt, (rmnode *)bt_nodes, count));
+        for (int i = 0; i < count; i++)
+            test_assert(rangemap_insert(rb, &rb_nodes[bt_nodes[i]->val]->node));
+        rangemap_btree_verify(rb, bt);
+        if (count < BTREE_TEST_NODES) {
+            test_assert(!rangemap_insert_bulk(bt, (rmnode *)bt_nodes, 1));
+            test_assert(rangemap_count(bt) == count);
+        }
+        destruct_rangemap(rb, keep);
+        destruct_rangemap(bt, keep);
+    }
+    test_assert(rangemap_insert_bulk(bt, (rmnode *)bt_nodes, BTREE_TEST_NODES / 2));
+    test_assert(rangemap_insert_bulk(bt, (rmnode *)bt_nodes + BTREE_TEST_NODES / 2,
+                                     BTREE_TEST_NODES / 2));
+    test_assert(rangemap_count(bt) == BTREE_TEST_NODES);
+    deallocate_rangemap(bt, stack_closure(dealloc_test_node, h));
+    deallocate_rangemap(rb, keep);
+    for (int i = 0; i < BTREE_TEST_NODES; i++)
+        deallocate(h, rb_nodes[i], sizeof(struct test_node));
+    deallocate(h, rb_nodes, BTREE_TEST_NODES * sizeof(test_node));
+    deallocate(h, bt_nodes, BTREE_TEST_NODES * sizeof(test_node));
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -251,7 +442,10 @@ int main(int argc, char **argv)
     if (!range_diff_test())
         goto fail;
 
-    if (!rangemap_merge_test(h))
+    if (!rangemap_merge_test(h, false) || !rangemap_merge_test(h, true))
+        goto fail;
+
+    if (!rangemap_btree_test(h))
         goto fail;
 
     msg_debug("range test passed\n");
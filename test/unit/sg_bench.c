@@ -0,0 +1,131 @@
+#include <time.h>
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+/* Single-threaded benchmark of scatter-gather list operations: allocation and release of
+   sg_lists, copies between sg_lists and linear buffers, and moves of buffers between sg_lists,
+   for fragments of various sizes. Usage:
+   sg_bench [iterations] */
+
+#define BENCH_ITERATIONS    (1ull << 14)
+#define BENCH_FRAGS         64
+#define BENCH_MIN_FRAG      (1ull << 9)
+#define BENCH_MAX_FRAG      (1ull << 16)
+
+static heap test_heap;
+
+static u64 nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+static void bench_fill(sg_list sg, void *frags, u64 frag_size)
+{
+    for (int i = 0; i < BENCH_FRAGS; i++) {
+        sg_buf sgb = sg_list_tail_add(sg, frag_size);
+        test_assert(sgb != INVALID_ADDRESS);
+        sgb->buf = frags + i * frag_size;
+        sgb->size = frag_size;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+    }
+}
+
+static void bench_alloc(u64 iterations)
+{
+    sg_list sgs[BENCH_FRAGS];
+    u64 t0 = nsec_now();
+    for (u64 i = 0; i < iterations; i++) {
+        for (int j = 0; j < BENCH_FRAGS; j++) {
+            sgs[j] = allocate_sg_list();
+            test_assert(sgs[j] != INVALID_ADDRESS);
+        }
+        for (int j = 0; j < BENCH_FRAGS; j++)
+            deallocate_sg_list(sgs[j]);
+    }
+    u64 t1 = nsec_now();
+    printf("allocate/deallocate sg_list: %lld ns/op\n", (t1 - t0) / (iterations * BENCH_FRAGS));
+}
+
+static void bench_copy(u64 iterations, u64 frag_size)
+{
+    u64 total = BENCH_FRAGS * frag_size;
+    void *frags = allocate(test_heap, total);
+    void *target = allocate(test_heap, total);
+    test_assert((frags != INVALID_ADDRESS) && (target != INVALID_ADDRESS));
+    runtime_memset(frags, 0xa5, total);
+    sg_list sg = allocate_sg_list();
+    test_assert(sg != INVALID_ADDRESS);
+    u64 t_to = 0, t_from = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        bench_fill(sg, frags, frag_size);
+        u64 t0 = nsec_now();
+        test_assert(sg_copy_to_buf(target, sg, total) == total);
+        u64 t1 = nsec_now();
+        bench_fill(sg, frags, frag_size);
+        u64 t2 = nsec_now();
+        test_assert(sg_copy_from_buf(target, sg, total) == total);
+        u64 t3 = nsec_now();
+        t_to += t1 - t0;
+        t_from += t3 - t2;
+    }
+    test_assert(runtime_memcmp(frags, target, total) == 0);
+    printf("copy %6lld byte fragments: to buffer %5lld MB/s, from buffer %5lld MB/s\n", frag_size,
+           (iterations * total * THOUSAND) / MAX(t_to, 1), (iterations * total * THOUSAND) / MAX(t_from, 1));
+    deallocate_sg_list(sg);
+    deallocate(test_heap, frags, total);
+    deallocate(test_heap, target, total);
+}
+
+static void bench_move(u64 iterations, u64 frag_size)
+{
+    u64 total = BENCH_FRAGS * frag_size;
+    void *frags = allocate(test_heap, total);
+    test_assert(frags != INVALID_ADDRESS);
+    sg_list src = allocate_sg_list();
+    sg_list dest = allocate_sg_list();
+    test_assert((src != INVALID_ADDRESS) && (dest != INVALID_ADDRESS));
+    u64 t_whole = 0, t_split = 0;
+    for (u64 i = 0; i < iterations; i++) {
+        bench_fill(src, frags, frag_size);
+        u64 t0 = nsec_now();
+        test_assert(sg_move(dest, src, total) == total);
+        u64 t1 = nsec_now();
+        test_assert(sg_list_length(dest) == BENCH_FRAGS);
+        sg_list_release(dest);
+
+        /* move in chunks that straddle fragment boundaries */
+        bench_fill(src, frags, frag_size);
+        u64 chunk = frag_size + frag_size / 2;
+        u64 t2 = nsec_now();
+        for (u64 moved = 0; moved < total; moved += chunk)
+            test_assert(sg_move(dest, src, chunk) == MIN(chunk, total - moved));
+        u64 t3 = nsec_now();
+        sg_list_release(dest);
+        t_whole += t1 - t0;
+        t_split += t3 - t2;
+    }
+    printf("move %6lld byte fragments: whole %4lld ns/frag, split %4lld ns/frag\n", frag_size,
+           t_whole / (iterations * BENCH_FRAGS), t_split / (iterations * BENCH_FRAGS));
+    deallocate_sg_list(src);
+    deallocate_sg_list(dest);
+    deallocate(test_heap, frags, total);
+}
+
+int main(int argc, char **argv)
+{
+    u64 iterations = argc > 1 ? atoll(argv[1]) : BENCH_ITERATIONS;
+    if (iterations == 0)
+        test_error("iteration count must be positive");
+    setbuf(stdout, NULL);
+    test_heap = init_process_runtime();
+    bench_alloc(iterations);
+    for (u64 frag_size = BENCH_MIN_FRAG; frag_size <= BENCH_MAX_FRAG; frag_size <<= 2)
+        bench_copy(MAX(iterations * BENCH_MIN_FRAG / frag_size, 1), frag_size);
+    for (u64 frag_size = BENCH_MIN_FRAG; frag_size <= BENCH_MAX_FRAG; frag_size <<= 2)
+        bench_move(iterations, frag_size);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+#define BENCH_BUF_SIZE  (64 * KB)
+#define BENCH_TOTAL     (256 * MB)
+
+static struct {
+    const char *msg;
+    const char *digest;
+} sha256_vectors[] = {
+    {"",
+     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"abc",
+     "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+    {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+     "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+    {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+     "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+};
+
+static u8 hex_nibble(char c)
+{
+    return (c >= 'a') ? c - 'a' + 10 : c - '0';
+}
+
+static void check_digest(heap h, buffer msg, const char *expected)
+{
+    buffer d = allocate_buffer(h, 32);
+    test_assert(d != INVALID_ADDRESS);
+    sha256(d, msg);
+    test_assert(buffer_length(d) == 32);
+    u8 *digest = buffer_ref(d, 0);
+    for (int i = 0; i < 32; i++) {
+        if (digest[i] != ((hex_nibble(expected[2 * i]) << 4) | hex_nibble(expected[2 * i + 1])))
+            test_error("digest mismatch at byte %d (expected %s)", i, expected);
+    }
+    deallocate_buffer(d);
+}
+
+static void test_vectors(heap h)
+{
+    for (int i = 0; i < sizeof(sha256_vectors) / sizeof(sha256_vectors[0]); i++) {
+        const char *msg = sha256_vectors[i].msg;
+        check_digest(h, alloca_wrap_sstring(sstring_from_cstring(msg, KB)), sha256_vectors[i].digest);
+    }
+}
+
+/* one million repetitions of 'a', hashed from buffers at all word offsets */
+static void test_long(heap h)
+{
+    bytes len = MILLION;
+    u8 *p = allocate(h, len + 8);
+    test_assert(p != INVALID_ADDRESS);
+    runtime_memset(p, 'a', len + 8);
+    for (int offset = 0; offset < 8; offset++)
+        check_digest(h, alloca_wrap_buffer(p + offset, len),
+                     "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    deallocate(h, p, len + 8);
+}
+
+/* Messages differing only in length must hash differently, and the same message hashed from
+   different alignments must give the same digest (exercises the partial block handling). */
+static void test_lengths(heap h)
+{
+    u8 *p = allocate(h, 2 * KB);
+    test_assert(p != INVALID_ADDRESS);
+    for (int i = 0; i < 2 * KB; i++)
+        p[i] = i * 7 + 3;
+    buffer prev = allocate_buffer(h, 32);
+    buffer d = allocate_buffer(h, 32);
+    buffer d2 = allocate_buffer(h, 32);
+    test_assert(prev != INVALID_ADDRESS && d != INVALID_ADDRESS && d2 != INVALID_ADDRESS);
+    for (bytes len = 0; len < KB; len++) {
+        buffer_clear(d);
+        sha256(d, alloca_wrap_buffer(p, len));
+        if (len > 0)
+            test_assert(runtime_memcmp(buffer_ref(d, 0), buffer_ref(prev, 0), 32) != 0);
+        runtime_memcpy(p + KB + 1, p, len);
+        buffer_clear(d2);
+        sha256(d2, alloca_wrap_buffer(p + KB + 1, len));
+        test_assert(runtime_memcmp(buffer_ref(d, 0), buffer_ref(d2, 0), 32) == 0);
+        buffer_clear(prev);
+        buffer_write(prev, buffer_ref(d, 0), 32);
+    }
+    deallocate_buffer(prev);
+    deallocate_buffer(d);
+    deallocate_buffer(d2);
+    deallocate(h, p, 2 * KB);
+}
+
+/* Throughput across message sizes; not part of the default test run, invoke as
+   "sha256_test bench". */
+static void sha256_bench(heap h)
+{
+    u8 *src = allocate(h, BENCH_BUF_SIZE);
+    buffer d = allocate_buffer(h, 32);
+    test_assert(src != INVALID_ADDRESS && d != INVALID_ADDRESS);
+    runtime_memset(src, 0xa5, BENCH_BUF_SIZE);
+    for (bytes size = 64; size <= BENCH_BUF_SIZE; size <<= 2) {
+        u64 iterations = BENCH_TOTAL / size;
+        buffer b = alloca_wrap_buffer(src, size);
+        timestamp start = now(CLOCK_ID_MONOTONIC);
+        for (u64 i = 0; i < iterations; i++) {
+            buffer_clear(d);
+            sha256(d, b);
+        }
+        u64 usec = usec_from_timestamp(now(CLOCK_ID_MONOTONIC) - start);
+        rprintf("sha256 %8ld bytes: %6ld MB/s\n", size,
+                usec ? (BENCH_TOTAL / MB) * 1000000 / usec : 0);
+    }
+    deallocate_buffer(d);
+    deallocate(h, src, BENCH_BUF_SIZE);
+}
+
+int main(int argc, char *argv[])
+{
+    heap h = init_process_runtime();
+    test_vectors(h);
+    test_long(h);
+    test_lengths(h);
+    if (argc > 1 && !runtime_strcmp(sstring_from_cstring(argv[1], 8), ss("bench")))
+        sha256_bench(h);
+    return 0;
+}
@@ -0,0 +1,328 @@
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+static inline key silly_key(void *a)
+{
+    return 0;
+}
+
+static inline key less_silly_key(void *a)
+{
+    return ((u64)a & 0x8);
+}
+
+static inline boolean anything_equals(void *a, void* b)
+{
+    return true;
+}
+
+static boolean basic_table_tests(heap h, u64 (*key_function)(void *x), u64 n_elem)
+{
+    u64 heap_occupancy = heap_allocated(h);
+    swisstable t = allocate_swisstable(h, key_function, pointer_equal);
+    u64 count;
+    u64 val;
+
+    swisstable_validate(t, ss("basic_table_tests: alloc"));
+
+    if (swisstable_elements(t) != 0) {
+        msg_err("swisstable_elements() not zero on empty table\n");
+        return false;
+    }
+
+    swisstable_foreach(t, n, v) {
+        (void) n;
+        (void) v;
+        msg_err("swisstable_foreach() on empty table\n");
+        return false;
+    }
+
+    for (count = 0; count < n_elem; count++) {
+        swisstable_set(t, (void *)count, (void *)(count + 1));
+    }
+
+    swisstable_validate(t, ss("basic_table_tests: after fill"));
+
+    /* This should not add anything to the table. */
+    swisstable_set(t, (void *)count, 0);
+
+    swisstable_validate(t, ss("basic_table_tests: after null set"));
+
+    count = 0;
+    swisstable_foreach(t, n, v) {
+        if ((u64)v != (u64)n + 1) {
+            msg_err("swisstable_foreach() invalid value %d for name %d, "
+                    "should be %d\n", (u64)v, (u64)n, (u64)n + 1);
+            return false;
+        }
+        count++;
+    }
+
+    if (count != n_elem) {
+        msg_err("swisstable_foreach() invalid iteration count %d\n", count);
+        return false;
+    }
+
+    for (count = 0; count < n_elem; count++) {
+        u64 v = (u64)swisstable_find(t, (void *)count);
+
+        if (!v) {
+            msg_err("element %d not found\n", count);
+            return false;
+        }
+        if (v != count + 1) {
+            msg_err("element %d invalid value %d, should be %d\n", count, v,
+                    count + 1);
+            return false;
+        }
+    }
+
+    if (swisstable_find(t, (void *)count)) {
+        msg_err("found unexpected element %d\n", count);
+        return false;
+    }
+
+    if (swisstable_set_noreplace(t, pointer_from_u64(n_elem / 2), pointer_from_u64(1))) {
+        msg_err("could replace element %ld\n", n_elem / 2);
+        return false;
+    }
+
+    /* Remove one element from the table. */
+    swisstable_set(t, 0, 0);
+    if (swisstable_find(t, 0)) {
+        msg_err("found unexpected element 0\n");
+        return false;
+    }
+
+    swisstable_validate(t, ss("basic_table_tests: after remove one"));
+
+    count = swisstable_elements(t);
+    if (count != n_elem - 1) {
+        msg_err("invalid swisstable_elements() %d, should be %d\n", count,
+                n_elem - 1);
+        return false;
+    }
+
+    val = u64_from_pointer(swisstable_remove(t, (pointer_from_u64(1))));
+    if (val != 2) {
+        msg_err("invalid element %ld removed, should be 2\n", val);
+        return false;
+    }
+    swisstable_validate(t, ss("basic_table_tests: after swisstable_remove()"));
+    count = swisstable_elements(t);
+    if (count != n_elem - 2) {
+        msg_err("invalid swisstable_elements() %ld after swisstable_remove(), should be %ld\n",
+                count, n_elem - 2);
+        return false;
+    }
+
+    /* Remove the rest: first forward (skimming off top of each bucket) */
+    for (count = 2; count < (n_elem / 2); count++)
+        swisstable_set(t, (void *)count, 0);
+
+    swisstable_validate(t, ss("basic_table_tests: after remove forward"));
+
+    /* ... and then backward (descend to bottom of each bucket) */
+    for (count = n_elem - 1; count >= (n_elem / 2); count--)
+        swisstable_set(t, (void *)count, 0);
+
+    swisstable_validate(t, ss("basic_table_tests: after remove backward"));
+
+    count = swisstable_elements(t);
+    if (count != 0) {
+        msg_err("invalid swisstable_elements() %d, should be 0\n");
+        return false;
+    }
+
+    if (!swisstable_set_noreplace(t, pointer_from_u64(0), pointer_from_u64(n_elem))) {
+        msg_err("could not set element at 0\n");
+        return false;
+    }
+    val = u64_from_pointer(swisstable_find(t, pointer_from_u64(0)));
+    if (val != n_elem) {
+        msg_err("unexpected element %ld at 0 after swisstable_set_noreplace()\n", val);
+        return false;
+    }
+
+    deallocate_swisstable(t);
+    if (heap_allocated(h) != heap_occupancy) {
+        msg_err("leak: heap_allocated(h) %ld, originally %ld\n", heap_allocated(h), heap_occupancy);
+        return false;
+    }
+    return true;
+}
+
+static boolean one_elem_table_tests(heap h, u64 n_elem)
+{
+    u64 heap_occupancy = heap_allocated(h);
+    swisstable t = allocate_swisstable(h, silly_key, anything_equals);
+    u64 count;
+
+    swisstable_validate(t, ss("one_elem_table_tests: after alloc"));
+
+    for (count = 0; count < n_elem; count++) {
+        swisstable_set(t, (void *)count, (void *)(count + 1));
+    }
+
+    swisstable_validate(t, ss("one_elem_table_tests: after fill"));
+
+    count = 0;
+    swisstable_foreach(t, n, v) {
+        if (n != 0) {
+            msg_err("swisstable_foreach() invalid name %d\n", (u64)n);
+            return false;
+        }
+        if ((u64)v != n_elem) {
+            msg_err("swisstable_foreach() invalid value %d for name %d, "
+                    "should be %d\n", (u64)v, (u64)n, n_elem);
+            return false;
+        }
+        count++;
+    }
+
+    if (count != 1) {
+        msg_err("swisstable_foreach() invalid iteration count %d\n", count);
+        return false;
+    }
+
+    count = swisstable_elements(t);
+    if (count != 1) {
+        msg_err("invalid swisstable_elements() %d, should be 1\n", count);
+        return false;
+    }
+
+    for (count = 0; count < n_elem; count++) {
+        u64 v = (u64)swisstable_find(t, (void *)count);
+
+        if (!v) {
+            msg_err("element %d not found\n", count);
+            return false;
+        }
+        if (v != n_elem) {
+            msg_err("element %d invalid value %d, should be %d\n", count, v,
+                    n_elem);
+            return false;
+        }
+    }
+
+    if (!swisstable_find(t, (void *)count)) {
+        msg_err("element %d not found\n", count);
+        return false;
+    }
+
+    swisstable_clear(t);
+    if (swisstable_find(t, (void *)count)) {
+        msg_err("element found after swisstable_clear()\n");
+        return false;
+    }
+    count = swisstable_elements(t);
+    if (count != 0) {
+        msg_err("invalid swisstable_elements() %d after swisstable_clear()\n", count);
+        return false;
+    }
+
+    deallocate_swisstable(t);
+    if (heap_allocated(h) != heap_occupancy) {
+        msg_err("leak: heap_allocated(h) %ld, originally %ld\n", heap_allocated(h), heap_occupancy);
+        return false;
+    }
+    return true;
+}
+
+/* Repeatedly remove and re-insert elements, so that deleted slots accumulate and the table is
+ * rehashed (without growing) while still holding all live elements. */
+static boolean churn_table_tests(heap h, u64 (*key_function)(void *x), u64 n_elem)
+{
+    u64 heap_occupancy = heap_allocated(h);
+    swisstable t = allocate_swisstable(h, key_function, pointer_equal);
+    u64 count;
+
+    for (count = 0; count < n_elem / 4; count++)
+        swisstable_set(t, pointer_from_u64(count), pointer_from_u64(count + 1));
+    for (u64 base = 0; base < n_elem; base += n_elem / 4) {
+        for (count = base; count < base + n_elem / 8; count++) {
+            if (u64_from_pointer(swisstable_remove(t, pointer_from_u64(count))) != count + 1) {
+                msg_err("element %ld not removed\n", count);
+                return false;
+            }
+            swisstable_set(t, pointer_from_u64(count + n_elem / 4),
+                           pointer_from_u64(count + n_elem / 4 + 1));
+        }
+        for (; count < base + n_elem / 4; count++) {
+            swisstable_remove(t, pointer_from_u64(count));
+            swisstable_set(t, pointer_from_u64(count + n_elem / 4),
+                           pointer_from_u64(count + n_elem / 4 + 1));
+        }
+        swisstable_validate(t, ss("churn_table_tests: after churn"));
+        if (swisstable_elements(t) != n_elem / 4) {
+            msg_err("invalid swisstable_elements() %ld, should be %ld\n",
+                    swisstable_elements(t), n_elem / 4);
+            return false;
+        }
+        if (swisstable_find(t, pointer_from_u64(base))) {
+            msg_err("found removed element %ld\n", base);
+            return false;
+        }
+        count = base + n_elem / 4;
+        if (u64_from_pointer(swisstable_find(t, pointer_from_u64(count))) != count + 1) {
+            msg_err("element %ld not found\n", count);
+            return false;
+        }
+    }
+
+    /* remove elements while iterating */
+    count = 0;
+    swisstable_foreach(t, n, v) {
+        (void)v;
+        swisstable_remove(t, n);
+        count++;
+    }
+    if (count != n_elem / 4 || swisstable_elements(t) != 0) {
+        msg_err("invalid state after removal while iterating: count %ld, elements %ld\n",
+                count, swisstable_elements(t));
+        return false;
+    }
+    swisstable_validate(t, ss("churn_table_tests: after remove all"));
+
+    deallocate_swisstable(t);
+    if (heap_allocated(h) != heap_occupancy) {
+        msg_err("leak: heap_allocated(h) %ld, originally %ld\n", heap_allocated(h), heap_occupancy);
+        return false;
+    }
+    return true;
+}
+
+#define BASIC_ELEM_COUNT  512
+#define STRESS_ELEM_COUNT (1ull << 20)
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+
+    if (!basic_table_tests(h, identity_key, BASIC_ELEM_COUNT)) {
+        test_error("identity key swisstable test");
+    }
+
+    if (!basic_table_tests(h, silly_key, BASIC_ELEM_COUNT)) {
+        test_error("silly key swisstable test");
+    }
+
+    if (!basic_table_tests(h, less_silly_key, BASIC_ELEM_COUNT)) {
+        test_error("less silly key swisstable test");
+    }
+
+    if (!one_elem_table_tests(h, BASIC_ELEM_COUNT)) {
+        test_error("one-element swisstable test");
+    }
+
+    if (!basic_table_tests(h, identity_key, STRESS_ELEM_COUNT)) {
+        test_error("stress swisstable test");
+    }
+
+    if (!churn_table_tests(h, identity_key, STRESS_ELEM_COUNT)) {
+        test_error("churn swisstable test");
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,127 @@
+#include <time.h>
+#include <runtime.h>
+
+#include "../test_utils.h"
+
+/* Single-threaded comparison of table and swisstable on the workloads of table_test and
+   swisstable_test: fill the table with a given number of elements, look up every element, look up
+   as many missing elements, then remove every element. Usage:
+   table_bench [max_elements] */
+
+#define BENCH_MIN_ELEMS     (1ull << 8)
+#define BENCH_MAX_ELEMS     (1ull << 22)
+
+static heap test_heap;
+
+typedef struct bench_ops {
+    const char *name;
+    void *(*create)(heap h);
+    void (*destroy)(void *t);
+    void (*set)(void *t, void *c, void *v);
+    void *(*find)(void *t, void *c);
+    void *(*remove)(void *t, void *c);
+} *bench_ops;
+
+static void *bench_table_allocate(heap h)
+{
+    return allocate_table(h, identity_key, pointer_equal);
+}
+
+static void bench_table_deallocate(void *t)
+{
+    deallocate_table(t);
+}
+
+static void bench_table_set(void *t, void *c, void *v)
+{
+    table_set(t, c, v);
+}
+
+static void *bench_table_find(void *t, void *c)
+{
+    return table_find(t, c);
+}
+
+static void *bench_table_remove(void *t, void *c)
+{
+    return table_remove(t, c);
+}
+
+static void *bench_swisstable_allocate(heap h)
+{
+    return allocate_swisstable(h, identity_key, pointer_equal);
+}
+
+static void bench_swisstable_deallocate(void *t)
+{
+    deallocate_swisstable(t);
+}
+
+static void bench_swisstable_set(void *t, void *c, void *v)
+{
+    swisstable_set(t, c, v);
+}
+
+static void *bench_swisstable_find(void *t, void *c)
+{
+    return swisstable_find(t, c);
+}
+
+static void *bench_swisstable_remove(void *t, void *c)
+{
+    return swisstable_remove(t, c);
+}
+
+static struct bench_ops bench_types[] = {
+    {"table", bench_table_allocate, bench_table_deallocate, bench_table_set, bench_table_find,
+     bench_table_remove},
+    {"swisstable", bench_swisstable_allocate, bench_swisstable_deallocate, bench_swisstable_set,
+     bench_swisstable_find, bench_swisstable_remove},
+};
+
+static u64 nsec_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+/* keys are spread out like heap pointers, which are typical table keys */
+#define bench_key(i)    pointer_from_u64(((i) + 1) << 4)
+
+static void bench_run(bench_ops ops, u64 n_elem)
+{
+    void *t = ops->create(test_heap);
+    test_assert(t != INVALID_ADDRESS);
+    u64 t0 = nsec_now();
+    for (u64 i = 0; i < n_elem; i++)
+        ops->set(t, bench_key(i), pointer_from_u64(i + 1));
+    u64 t1 = nsec_now();
+    for (u64 i = 0; i < n_elem; i++)
+        test_assert(ops->find(t, bench_key(i)) == pointer_from_u64(i + 1));
+    u64 t2 = nsec_now();
+    for (u64 i = n_elem; i < 2 * n_elem; i++)
+        test_assert(ops->find(t, bench_key(i)) == 0);
+    u64 t3 = nsec_now();
+    for (u64 i = 0; i < n_elem; i++)
+        test_assert(ops->remove(t, bench_key(i)) == pointer_from_u64(i + 1));
+    u64 t4 = nsec_now();
+    printf("%-10s %8lld elements: insert %4lld, find hit %4lld, find miss %4lld, remove %4lld ns/op\n",
+           ops->name, n_elem, (t1 - t0) / n_elem, (t2 - t1) / n_elem, (t3 - t2) / n_elem,
+           (t4 - t3) / n_elem);
+    ops->destroy(t);
+}
+
+int main(int argc, char **argv)
+{
+    u64 max_elems = argc > 1 ? atoll(argv[1]) : BENCH_MAX_ELEMS;
+    if (max_elems < BENCH_MIN_ELEMS)
+        test_error("element count must be at least %lld", BENCH_MIN_ELEMS);
+    setbuf(stdout, NULL);
+    test_heap = init_process_runtime();
+    for (u64 n_elem = BENCH_MIN_ELEMS; n_elem <= max_elems; n_elem <<= 2) {
+        for (int i = 0; i < sizeof(bench_types) / sizeof(bench_types[0]); i++)
+            bench_run(&bench_types[i], n_elem);
+    }
+    return EXIT_SUCCESS;
+}
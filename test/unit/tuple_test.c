@@ -358,6 +358,92 @@ fail:
     return failure;
 }
 
+closure_function(2, 2, boolean, remove_each,
+                 tuple, t, int *, count,
+                 value a, value v)
+{
+    set(bound(t), a, 0);
+    (*bound(count))++;
+    return true;
+}
+
+boolean promotion_test(heap h)
+{
+    boolean failure = true;
+    tuple t = allocate_tuple();
+    int n_attrs = TUPLE_INLINE_MAX * 4;
+
+    /* fill past the inline array capacity, checking all attributes along the way */
+    for (int i = 0; i < n_attrs; i++) {
+        set(t, intern_u64(i), value_from_u64(i + 1));
+        test_assert(tuple_count(t) == i + 1);
+        for (int j = 0; j <= i; j++) {
+            u64 x;
+            test_assert(get_u64(t, intern_u64(j), &x) && (x == j + 1));
+        }
+        test_assert(!get(t, intern_u64(i + 1)));
+    }
+
+    /* clone a promoted tuple */
+    tuple c = clone_tuple(t);
+    test_assert(tuple_count(c) == n_attrs);
+    test_assert(get(c, intern_u64(n_attrs - 1)) != 0);
+    destruct_value(c, true);
+
+    /* remove attributes from a tuple held in the inline array */
+    tuple s = allocate_tuple();
+    for (int i = 0; i < TUPLE_INLINE_MAX; i++)
+        set(s, intern_u64(i), value_from_u64(i + 1));
+    set(s, intern_u64(TUPLE_INLINE_MAX / 2), 0);
+    test_assert(tuple_count(s) == TUPLE_INLINE_MAX - 1);
+    test_assert(!get(s, intern_u64(TUPLE_INLINE_MAX / 2)));
+    set(s, intern_u64(TUPLE_INLINE_MAX / 2), value_from_u64(1));
+    set(s, intern_u64(0), value_from_u64(2));
+    test_assert(tuple_count(s) == TUPLE_INLINE_MAX);
+    u64 x;
+    test_assert(get_u64(s, intern_u64(0), &x) && (x == 2));
+    test_assert(tuple_get_symbol(s, get(s, intern_u64(TUPLE_INLINE_MAX - 1))) ==
+                intern_u64(TUPLE_INLINE_MAX - 1));
+
+    /* remove each attribute while iterating */
+    int count = 0;
+    iterate(s, stack_closure(remove_each, s, &count));
+    test_assert((count == TUPLE_INLINE_MAX) && (tuple_count(s) == 0));
+    destruct_value(s, true);
+
+    failure = false;
+fail:
+    destruct_value(t, true);
+    return failure;
+}
+
+boolean symbol_test(heap h)
+{
+    boolean failure = true;
+    int n_syms = 4 * KB;   /* enough to grow the symbol table */
+
+    symbol a = sym_const(symbol_test);
+    test_assert(a != 0);
+    test_assert(sym(symbol_test) == a);
+    test_assert(!buffer_strcmp(symbol_string(a), "symbol_test"));
+    for (int i = 0; i < n_syms; i++) {
+        symbol s = intern_u64(i);
+        test_assert(s == intern_u64(i));
+        test_assert(s != a);
+    }
+    for (int i = 0; i < n_syms; i++) {
+        buffer b = little_stack_buffer(20);
+        print_number(b, i, 10, 0, false);
+        test_assert(!buffer_compare_with_sstring(symbol_string(intern_u64(i)),
+                                                 isstring(buffer_ref(b, 0), buffer_length(b))));
+    }
+    test_assert(sym_this("symbol_test") == a);
+
+    failure = false;
+fail:
+    return failure;
+}
+
 int main(int argc, char **argv)
 {
     heap h = init_process_runtime();
@@ -369,6 +455,8 @@ int main(int argc, char **argv)
     failure |= encode_decode_reference_test(h);
     failure |= encode_decode_self_reference_test(h);
     failure |= encode_decode_lengthy_test(h);
+    failure |= promotion_test(h);
+    failure |= symbol_test(h);
 
     if (failure) {
         msg_err("Test failed\n");
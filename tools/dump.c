@@ -4,7 +4,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <pagecache.h>
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <limits.h>
 #include <log.h>
+#include <pthread.h>
 
 #define DUMP_OPT_TREE  (1U << 0)
 
@@ -22,41 +23,40 @@
 #define TERM_COLOR_WHITE    97
 #define TERM_COLOR_DEFAULT  0
 
-closure_function(2, 1, void, bread,
-                 descriptor, d, u64, fs_offset,
-                 storage_req req)
+#define DUMP_JOBS_MAX   256
+
+/* the filesystem image is mapped in memory, so that storage reads are plain copies */
+static struct {
+    u8 *base;                   /* start of the filesystem */
+    u64 length;                 /* bytes mapped from base */
+} image;
+
+/* regular files to be extracted by the worker threads */
+typedef struct extract_file {
+    tuple md;
+    fsfile f;
+    char *path;
+    boolean direct;             /* extracted by a worker thread */
+} *extract_file;
+
+static struct {
+    int jobs;
+    vector files;
+    u64 next;                   /* index of the next file to be extracted */
+} extract;
+
+closure_func_basic(storage_req_handler, void, bread,
+                   storage_req req)
 {
     if (req->op != STORAGE_OP_READSG)
         halt("%s: invalid storage op %d\n", func_ss, req->op);
-    sg_list sg = req->data;
-    u64 offset = bound(fs_offset) + (req->blocks.start << SECTOR_OFFSET);
+    u64 offset = req->blocks.start << SECTOR_OFFSET;
     u64 total = range_span(req->blocks) << SECTOR_OFFSET;
-    struct iovec iov[IOV_MAX];
-    int iov_count;
-    ssize_t xfer;
-    lseek(bound(d), offset, SEEK_SET);
-    while (total > 0) {
-        iov_count = 0;
-        xfer = 0;
-        sg_list_foreach(sg, sgb) {
-            iov[iov_count].iov_base = sgb->buf + sgb->offset;
-            iov[iov_count].iov_len = MIN(sg_buf_len(sgb), total - xfer);
-            xfer += iov[iov_count].iov_len;
-            if ((++iov_count == IOV_MAX) || (xfer == total))
-                break;
-        }
-        xfer = readv(bound(d), iov, iov_count);
-        if (xfer < 0 && errno != EINTR) {
-            apply(req->completion, timm("result", "read error %s", errno_sstring()));
-            return;
-        }
-        if (xfer == 0) {
-            apply(req->completion, timm("result", "end of file"));
-            return;
-        }
-        sg_consume(sg, xfer);
-        total -= xfer;
+    if (offset + total > image.length) {
+        apply(req->completion, timm("result", "end of file"));
+        return;
     }
+    sg_copy_from_buf(image.base + offset, req->data, total);
     apply(req->completion, STATUS_OK);
 }
 
@@ -83,6 +83,94 @@ closure_function(1, 1, status, write_file,
     return STATUS_OK;
 }
 
+/* Writes the data of the file blocks stored at storage_block directly from the image; holes are
+ * left unwritten (the file is extended to its length at the end). */
+closure_function(2, 2, boolean, extract_run,
+                 int, fd, u64, length,
+                 range blocks, u64 storage_block)
+{
+    if (storage_block == INVALID_PHYSICAL)
+        return true;
+    u64 offset = blocks.start << SECTOR_OFFSET;
+    u64 len = MIN(range_span(blocks) << SECTOR_OFFSET, bound(length) - offset);
+    u64 src_offset = storage_block << SECTOR_OFFSET;
+    if (src_offset + len > image.length) {
+        fprintf(stderr, "file extent beyond end of image\n");
+        exit(EXIT_FAILURE);
+    }
+    u8 *src = image.base + src_offset;
+    madvise((void *)((u64)src & ~MASK(PAGELOG)), len + ((u64)src & MASK(PAGELOG)), MADV_WILLNEED);
+    while (len > 0) {
+        ssize_t xfer = pwrite(bound(fd), src, len, offset);
+        if (xfer < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("file write");
+            exit(EXIT_FAILURE);
+        }
+        src += xfer;
+        offset += xfer;
+        len -= xfer;
+    }
+    return true;
+}
+
+/* Returns false if the file data cannot be copied directly from the image (compressed extents). */
+static boolean extract_file_direct(extract_file ef)
+{
+    int fd = open(ef->path, O_CREAT|O_WRONLY|O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "couldn't create file %s: %s\n", ef->path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    u64 length = fsfile_get_length(ef->f);
+    range blocks = irange(0, (length + SECTOR_SIZE - 1) >> SECTOR_OFFSET);
+    boolean success = tfsfile_map_blocks(ef->f, blocks, stack_closure(extract_run, fd, length));
+    if (success && (ftruncate(fd, length) < 0)) {
+        perror("file truncate");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    return success;
+}
+
+/* The filesystem is not modified while files are being extracted, and all files have been loaded
+ * beforehand: worker threads only look up extent maps. */
+static void *extract_worker(void *arg)
+{
+    u64 count = vector_length(extract.files);
+    u64 i;
+    while ((i = fetch_and_add(&extract.next, 1)) < count) {
+        extract_file ef = vector_get(extract.files, i);
+        ef->direct = extract_file_direct(ef);
+    }
+    return 0;
+}
+
+static void extract_files(filesystem fs, heap h)
+{
+    pthread_t threads[DUMP_JOBS_MAX];
+    int jobs = MIN(extract.jobs, vector_length(extract.files));
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], 0, extract_worker, 0)) {
+            fprintf(stderr, "failed to create thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int i = 0; i < jobs; i++)
+        pthread_join(threads[i], 0);
+    extract_file ef;
+    vector_foreach(extract.files, ef) {
+        if (!ef->direct) {
+            buffer path = alloca_wrap_buffer(ef->path, strlen(ef->path));
+            filesystem_read_entire(fs, ef->md, h, closure(h, write_file, path), (void *)ignore);
+        }
+        free(ef->path);
+        deallocate(h, ef, sizeof(*ef));
+    }
+    deallocate_vector(extract.files);
+}
+
 void readdir(filesystem fs, heap h, tuple w, buffer path);
 
 closure_function(3, 2, boolean, readdir_each_child,
@@ -108,8 +196,21 @@ void readdir(filesystem fs, heap h, tuple w, buffer path)
         iterate(t, stack_closure(readdir_each_child, fs, h, path));
     } else {
         t = get_tuple(w, sym(extents));
-        if (t)
+        if (!t)
+            return;
+        fsfile f = extract.jobs ? fsfile_from_node(fs, w) : 0;
+        if (f) {
+            extract_file ef = allocate(h, sizeof(*ef));
+            assert(ef != INVALID_ADDRESS);
+            ef->md = w;
+            ef->f = f;
+            ef->path = strndup(buffer_ref(path, 0), buffer_length(path));
+            assert(ef->path);
+            ef->direct = false;
+            vector_push(extract.files, ef);
+        } else {
             filesystem_read_entire(fs, w, h, closure(h, write_file, path), (void *)ignore);
+        }
     }
 }
 
@@ -179,8 +280,13 @@ closure_function(3, 2, void, fsc,
     deallocate_buffer(rb);
 
     buffer b = bound(b);
-    if (b)
+    if (b) {
+        if (extract.jobs)
+            extract.files = allocate_vector(h, 64);
         readdir(fs, h, root, b);
+        if (extract.jobs)
+            extract_files(fs, h);
+    }
 
     if (options & DUMP_OPT_TREE)
         dump_fsentry(0, sym_this("/"), root);
@@ -258,6 +364,7 @@ static void usage(const char *prog)
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -d <target dir>\tCopy filesystem contents from "
             "<fs image> into <target dir>\n");
+    fprintf(stderr, "  -j <jobs>\t\tWith -d, copy files using <jobs> threads\n");
     fprintf(stderr, "  -t\t\t\tDisplay filesystem from <fs image> as a tree\n");
     fprintf(stderr, "  -l\t\t\tDisplay contents of crash log\n");
     exit(EXIT_FAILURE);
@@ -270,11 +377,18 @@ int main(int argc, char **argv)
     unsigned int options = 0;
     boolean print_klog = false;
 
-    while ((c = getopt(argc, argv, "d:tl")) != EOF) {
+    while ((c = getopt(argc, argv, "d:j:tl")) != EOF) {
         switch (c) {
         case 'd':
             target_dir = alloca_wrap_buffer(optarg, strlen(optarg));
             break;
+        case 'j':
+            extract.jobs = atoi(optarg);
+            if ((extract.jobs < 1) || (extract.jobs > DUMP_JOBS_MAX)) {
+                fprintf(stderr, "number of jobs must be between 1 and %d\n", DUMP_JOBS_MAX);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 't':
             options |= DUMP_OPT_TREE;
             break;
@@ -297,12 +411,30 @@ int main(int argc, char **argv)
     if (print_klog)
         dump_klog(fd);
 
+    u64 fs_offset = get_fs_offset(fd, PARTITION_ROOTFS, false);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size <= fs_offset) {
+        fprintf(stderr, "no filesystem found in %s\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    u8 *base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    image.base = base + fs_offset;
+    image.length = st.st_size - fs_offset;
+
     heap h = init_process_runtime();
     init_pagecache(h, h, PAGESIZE);
     create_filesystem(h,
                       SECTOR_SIZE,
                       infinity,
-                      closure(h, bread, fd, get_fs_offset(fd, PARTITION_ROOTFS, false)),
+                      closure_func(h, storage_req_handler, bread),
                       true, sstring_null(), /* read only, no label */
                       closure(h, fsc, h, target_dir, options));
     return EXIT_SUCCESS;
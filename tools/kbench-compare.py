@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+
+# Compare two kbench result logs (the "kbench {...}" lines printed by the host-side
+# test/bench/kbench program, the in-kernel bench klib and test/runtime/kbench) and
+# report the change in time per operation for each benchmark, along with kernel
+# closure allocations per operation where reported. Exits with status 1 if any
+# benchmark regressed by more than the threshold.
+#
+# usage: kbench-compare.py [-t <percent>] <baseline log> <new log>
+
+import argparse
+import json
+import sys
+
+def parse(path):
+    results = {}
+    allocs = {}
+    with open(path, errors='replace') as f:
+        for line in f:
+            i = line.find('kbench {')
+            if i < 0:
+                continue
+            try:
+                r = json.loads(line[i + len('kbench '):])
+            except ValueError:
+                continue
+            results[r['name']] = r['nsecs'] / r['ops']
+            if 'allocs' in r:
+                allocs[r['name']] = r['allocs'] / r['ops']
+    return results, allocs
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-t', '--threshold', type=float, default=10.0,
+                        help='regression threshold in percent (default 10)')
+    parser.add_argument('baseline')
+    parser.add_argument('new')
+    args = parser.parse_args()
+
+    base, base_allocs = parse(args.baseline)
+    new, new_allocs = parse(args.new)
+    regressed = False
+    print('%-24s %12s %12s %8s' % ('benchmark', 'base ns/op', 'new ns/op', 'change'))
+    for name in sorted(set(base) | set(new)):
+        if name not in base or name not in new:
+            print('%-24s %12s %12s' % (name, '%.2f' % base[name] if name in base else '-',
+                                       '%.2f' % new[name] if name in new else '-'))
+            continue
+        change = (new[name] - base[name]) * 100 / base[name] if base[name] else 0
+        flag = ''
+        if change > args.threshold:
+            flag = ' REGRESSION'
+            regressed = True
+        print('%-24s %12.2f %12.2f %+7.1f%%%s' % (name, base[name], new[name], change, flag))
+        if name in base_allocs and name in new_allocs:
+            print('%-24s %12.2f %12.2f' % ('  allocs/op', base_allocs[name], new_allocs[name]))
+    sys.exit(1 if regressed else 0)
+
+if __name__ == '__main__':
+    main()
@@ -11,9 +11,11 @@
 #include <pagecache.h>
 #include <storage.h>
 #include <tfs.h>
+#include <elf64.h>
 #include <dirent.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <region.h>
 
@@ -32,6 +34,12 @@
  * 32-bit File Allocation Table. */
 #define UEFI_PART_SIZE  (33 * MB)
 
+/* File contents are read (and hashed, if deduplicating, and compressed, if requested) by a pool of
+ * threads, in batches of up to MKFS_BATCH_SIZE bytes, ahead of being written to the filesystem. */
+#define MKFS_READ_THREADS_MAX   16
+#define MKFS_BATCH_SIZE         (256 * MB)
+#define MKFS_DIGEST_SIZE        32
+
 /* Volume Boot Record */
 static u8 uefi_part_blob1[] = {
     0xEB, 0x58, 0x90, 0x6D, 0x6B, 0x66, 0x73, 0x2E, 0x66, 0x61, 0x74, 0x00, 0x02, 0x01, 0x20, 0x00,
@@ -200,36 +208,117 @@ buffer lookup_file(heap h, const char *target_root, buffer name, struct stat *st
     return target_name;
 }
 
-// its nice that we can append a file to any existing buffer, but harsh we have to grow the buffer
-void read_file(heap h, const char *target_root, buffer dest, buffer name)
+typedef struct mkfs_file {
+    tuple md;
+    char *path;
+    u64 size;
+    void *data;             /* padded to a whole number of sectors */
+    int err;
+    u8 digest[MKFS_DIGEST_SIZE];
+    boolean compress;
+    void *cdata;            /* compressed data, one COMPRESSED_EXTENT_SIZE slot per chunk */
+    u64 *clen;              /* compressed length of each chunk (0: stored uncompressed) */
+} *mkfs_file;
+
+typedef struct mkfs_batch {
+    struct mkfs_file *files;
+    int count;
+    int next;
+    boolean hash;
+} *mkfs_batch;
+
+/* contents already written to the filesystem, for deduplication */
+typedef struct mkfs_digest {
+    u8 digest[MKFS_DIGEST_SIZE];
+    u64 size;
+    tuple md;
+} *mkfs_digest;
+
+/* Compress each chunk of a file that shrinks by at least one sector. */
+static void compress_file_contents(mkfs_file mf)
 {
-    // mode bit metadata
-    struct stat st;
-    buffer target_name = lookup_file(h, target_root, name, &st);
-    if (target_name != NULL) {
-        //printf("%s -> %s\n", cstring(name), cstring(target_name));
-        name = target_name;
+    u64 nchunks = (mf->size + COMPRESSED_EXTENT_SIZE - 1) / COMPRESSED_EXTENT_SIZE;
+    mf->cdata = malloc(nchunks * COMPRESSED_EXTENT_SIZE);
+    mf->clen = malloc(nchunks * sizeof(u64));
+    if (!mf->cdata || !mf->clen) {
+        mf->err = ENOMEM;
+        return;
     }
+    for (u64 i = 0; i < nchunks; i++) {
+        u64 offset = i * COMPRESSED_EXTENT_SIZE;
+        u64 len = pad(MIN(COMPRESSED_EXTENT_SIZE, mf->size - offset), SECTOR_SIZE);
+        void *dest = mf->cdata + offset;
+        u64 clen = lz4_compress(mf->data + offset, len, dest, len - SECTOR_SIZE);
+        if (clen)
+            zero(dest + clen, pad(clen, SECTOR_SIZE) - clen);
+        mf->clen[i] = clen;
+    }
+}
 
-    buffer tmpbuf = little_stack_buffer(NAME_MAX + 1);
-    int fd = open(cstring(name, tmpbuf), O_RDONLY);
-    if (fd < 0) halt("couldn't open file %b: %s\n", name, errno_sstring());
-    u64 size = st.st_size;
-    buffer_extend(dest, pad(st.st_size, SECTOR_SIZE));
+/* Called from reader threads: only libc and the (heap-less) hash and compression functions can be
+ * used here. */
+static void read_file_contents(mkfs_file mf, boolean hash)
+{
+    int fd = open(mf->path, O_RDONLY);
+    if (fd < 0) {
+        mf->err = errno;
+        return;
+    }
+    u64 padded_size = pad(mf->size, SECTOR_SIZE);
+    mf->data = malloc(padded_size);
+    if (!mf->data) {
+        mf->err = ENOMEM;
+        close(fd);
+        return;
+    }
+    zero(mf->data + mf->size, padded_size - mf->size);
     u64 total = 0;
-    while (total < size) {
-        int rv = read(fd, buffer_ref(dest, total), size - total);
-        if (rv < 0 && errno != EINTR) {
-            close(fd);
-            halt("read: %b: %s\n", name, errno_sstring());
+    while (total < mf->size) {
+        ssize_t rv = read(fd, mf->data + total, mf->size - total);
+        if (rv < 0) {
+            if (errno == EINTR)
+                continue;
+            mf->err = errno;
+            break;
+        }
+        if (rv == 0) {
+            mf->err = EIO;  /* file truncated since stat */
+            break;
         }
         total += rv;
     }
-    dest->end += size;
     close(fd);
+    if (!mf->err && hash) {
+        buffer digest = little_stack_buffer(MKFS_DIGEST_SIZE);
+        sha256(digest, alloca_wrap_buffer(mf->data, mf->size));
+        runtime_memcpy(mf->digest, buffer_ref(digest, 0), MKFS_DIGEST_SIZE);
+    }
+    if (!mf->err && mf->compress && mf->size)
+        compress_file_contents(mf);
+}
 
-    if (target_name != NULL)
-        deallocate_buffer(target_name);
+static void *mkfs_read_worker(void *arg)
+{
+    mkfs_batch b = arg;
+    int i;
+    while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->count)
+        read_file_contents(&b->files[i], b->hash);
+    return 0;
+}
+
+static void read_batch(mkfs_batch b)
+{
+    long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    nthreads = MAX(1, MIN(MIN(nthreads, MKFS_READ_THREADS_MAX), b->count));
+    pthread_t threads[nthreads];
+    b->next = 0;
+    for (int i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[i], 0, mkfs_read_worker, b))
+            halt("couldn't create reader thread: %s\n", errno_sstring());
+    }
+    mkfs_read_worker(b);
+    for (int i = 1; i < nthreads; i++)
+        pthread_join(threads[i], 0);
 }
 
 heap malloc_allocator();
@@ -298,17 +387,43 @@ closure_func_basic(status_handler, void, err,
     rprintf("reported error\n");
 }
 
-static buffer get_file_contents(heap h, const char *target_root, value v)
+/* Resolves the host file backing the contents of a file; returns false if there is none. The
+ * contents tuple can override the image-wide compression setting with a compress attribute. */
+static boolean get_file_path(heap h, const char *target_root, value v, boolean compress,
+                             mkfs_file mf)
 {
-    value path = table_find((table)v, sym(host));
-    if (path) {
-        // seems like it wouldn't be to hard to arrange
-        // for this to avoid the staging copy
-        buffer dest = allocate_buffer(h, 1024);
-        read_file(h, target_root, dest, path);
-        return dest;
-    }
-    return 0;
+    buffer name = get(v, sym(host));
+    if (!name)
+        return false;
+    struct stat st;
+    buffer target_name = lookup_file(h, target_root, name, &st);
+    if (target_name != NULL)
+        name = target_name;
+    buffer tmpbuf = little_stack_buffer(PATH_MAX + 1);
+    mf->path = strdup(cstring(name, tmpbuf));
+    if (!mf->path)
+        halt("couldn't allocate file path\n");
+    mf->size = st.st_size;
+    mf->data = 0;
+    mf->err = 0;
+    value c = get(v, sym(compress));
+    mf->compress = c ? (is_string(c) && !buffer_strcmp(c, "t")) : compress;
+    mf->cdata = 0;
+    mf->clen = 0;
+    if (target_name != NULL)
+        deallocate_buffer(target_name);
+    return true;
+}
+
+static key mkfs_digest_key(void *k)
+{
+    return *(u64 *)((mkfs_digest)k)->digest;
+}
+
+static boolean mkfs_digest_equals(void *a, void *b)
+{
+    mkfs_digest da = a, db = b;
+    return (da->size == db->size) && !runtime_memcmp(da->digest, db->digest, MKFS_DIGEST_SIZE);
 }
 
 static value translate(heap h, vector worklist,
@@ -344,6 +459,7 @@ static value translate(heap h, vector worklist,
 extern heap init_process_runtime();
 
 static io_status_handler mkfs_write_status;
+static status_handler mkfs_extent_status;
 closure_func_basic(io_status_handler, void, mkfs_write_handler,
                    status s, bytes length)
 {
@@ -353,8 +469,114 @@ closure_func_basic(io_status_handler, void, mkfs_write_handler,
     }
 }
 
-closure_function(4, 2, void, fsc,
-                 heap, h, descriptor, out, tuple, root, const char *, target_root,
+typedef struct mkfs_dup {
+    tuple md;
+    mkfs_digest orig;
+} *mkfs_dup;
+
+closure_func_basic(status_handler, void, mkfs_extent_write_handler,
+                   status s)
+{
+    if (!is_ok(s)) {
+        rprintf("extent write failed with %v\n", s);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Storage writes complete synchronously here, so the file data can be freed on return. */
+static void write_compressed_file(tfs fs, mkfs_file mf)
+{
+    tfsfile f = allocate_fsfile(fs, mf->md);
+    u64 chunk_blocks = COMPRESSED_EXTENT_SIZE / SECTOR_SIZE;
+    for (u64 i = 0, offset = 0; offset < mf->size; i++, offset += COMPRESSED_EXTENT_SIZE) {
+        range blocks = irangel(i * chunk_blocks,
+                               pad(MIN(COMPRESSED_EXTENT_SIZE, mf->size - offset),
+                                   SECTOR_SIZE) / SECTOR_SIZE);
+        u64 clen = mf->clen[i];
+        fs_status fss = filesystem_write_extent(f, blocks,
+                                                (clen ? mf->cdata : mf->data) + offset, clen,
+                                                mkfs_extent_status);
+        if (fss != FS_STATUS_OK)
+            halt("couldn't write file %s: %s\n", sstring_from_cstring(mf->path, PATH_MAX),
+                 string_from_fs_status(fss));
+    }
+    fsfile_set_length((fsfile)f, mf->size);
+    filesystem_write_eav(fs, mf->md, sym(filelength), value_from_u64(mf->size), false);
+}
+
+static void write_file_contents(heap h, tfs fs, mkfs_file mf, table digests, vector duplicates)
+{
+    if (mf->err) {
+        errno = mf->err;
+        halt("couldn't read file %s: %s\n", sstring_from_cstring(mf->path, PATH_MAX), errno_sstring());
+    }
+    if (mf->size == 0) {
+        /* make an empty file */
+        filesystem_write_eav(fs, mf->md, sym(extents), allocate_tuple(), false);
+        filesystem_write_eav(fs, mf->md, sym(filelength), value_from_u64(0), false);
+        goto out;
+    }
+    if (digests) {
+        struct mkfs_digest k;
+        runtime_memcpy(k.digest, mf->digest, MKFS_DIGEST_SIZE);
+        k.size = mf->size;
+        mkfs_digest orig = table_find(digests, &k);
+        if (orig) {
+            mkfs_dup dup = allocate(h, sizeof(*dup));
+            assert(dup != INVALID_ADDRESS);
+            dup->md = mf->md;
+            dup->orig = orig;
+            vector_push(duplicates, dup);
+            goto out;
+        }
+        mkfs_digest d = allocate(h, sizeof(*d));
+        assert(d != INVALID_ADDRESS);
+        runtime_memcpy(d, &k, sizeof(k));
+        d->md = mf->md;
+        table_set(digests, d, d);
+    }
+    if (mf->compress) {
+        write_compressed_file(fs, mf);
+        goto out;
+    }
+    fsfile fsf = (fsfile)allocate_fsfile(fs, mf->md);
+    filesystem_write_linear(fsf, mf->data, irangel(0, mf->size), ignore_io_status);
+  out:
+    free(mf->data);
+    free(mf->cdata);
+    free(mf->clen);
+    free(mf->path);
+}
+
+closure_function(2, 2, boolean, link_duplicate_extent,
+                 tfs, fs, tuple, extents,
+                 value off, value e)
+{
+    tfs fs = bound(fs);
+    symbol shared = sym(shared);
+    if (!get(e, shared)) {
+        filesystem_write_eav(fs, e, shared, null_value, false);
+        set(e, shared, null_value);
+    }
+    set(bound(extents), off, clone_tuple(e));
+    return true;
+}
+
+/* Point a file at the extents of an identical file, marking them as shared. */
+static void link_duplicate(tfs fs, mkfs_dup dup)
+{
+    tuple orig_extents = get_tuple(dup->orig->md, sym(extents));
+    assert(orig_extents);
+    tuple extents = allocate_tuple();
+    iterate(orig_extents, stack_closure(link_duplicate_extent, fs, extents));
+    filesystem_write_eav(fs, dup->md, sym(extents), extents, false);
+    set(dup->md, sym(extents), extents);
+    filesystem_write_eav(fs, dup->md, sym(filelength), value_from_u64(dup->orig->size), false);
+}
+
+closure_function(6, 2, void, fsc,
+                 heap, h, descriptor, out, tuple, root, const char *, target_root, boolean, readonly,
+                 boolean, compress,
                  filesystem fs, status s)
 {
     tuple root = bound(root);
@@ -379,30 +601,353 @@ closure_function(4, 2, void, fsc,
 
     tfs tfs = (struct tfs *)fs;
     filesystem_write_tuple(tfs, md);
+    struct mkfs_file *files = malloc(sizeof(struct mkfs_file) * (vector_length(worklist) + 1));
+    assert(files);
+    int nfiles = 0;
     vector i;
-    buffer off = 0;
     vector_foreach(worklist, i) {
-        tuple f = vector_get(i, 0);
-        buffer contents = get_file_contents(h, bound(target_root), vector_get(i, 1));
-        if (contents) {
-            if (buffer_length(contents) > 0) {
-                fsfile fsf = (fsfile)allocate_fsfile(tfs, f);
-                filesystem_write_linear(fsf, buffer_ref(contents, 0), irangel(0, buffer_length(contents)),
-                                        ignore_io_status);
-                deallocate_buffer(contents);
-            } else {
-                if (!off)
-                    off = value_from_u64(0);
-                /* make an empty file */
-                filesystem_write_eav(tfs, f, sym(extents), allocate_tuple(), false);
-                filesystem_write_eav(tfs, f, sym(filelength), off, false);
-            }
+        mkfs_file mf = &files[nfiles];
+        if (get_file_path(h, bound(target_root), vector_get(i, 1), bound(compress), mf)) {
+            /* compressed extents cannot be written to */
+            if (mf->compress && !bound(readonly))
+                halt("file %s: compression requires readonly_rootfs\n",
+                     sstring_from_cstring(mf->path, PATH_MAX));
+            mf->md = vector_get(i, 0);
+            nfiles++;
         }
     }
+    table digests = bound(readonly) ? allocate_table(h, mkfs_digest_key, mkfs_digest_equals) : 0;
+    vector duplicates = allocate_vector(h, 8);
+    for (int start = 0, end; start < nfiles; start = end) {
+        u64 batch_size = 0;
+        end = start;
+        do {
+            batch_size += files[end++].size;
+        } while ((end < nfiles) && (batch_size + files[end].size <= MKFS_BATCH_SIZE));
+        struct mkfs_batch batch = {
+            .files = &files[start],
+            .count = end - start,
+            .hash = (digests != 0),
+        };
+        read_batch(&batch);
+        for (int n = start; n < end; n++)
+            write_file_contents(h, tfs, &files[n], digests, duplicates);
+    }
+    free(files);
     filesystem_flush(fs, ignore_status);
+    if (vector_length(duplicates) > 0) {
+        /* Extents are allocated on writeback (which completes synchronously here), so duplicates
+         * can only be linked after the originals have been flushed. */
+        rprintf("%d duplicate files\n", vector_length(duplicates));
+        mkfs_dup dup;
+        vector_foreach(duplicates, dup)
+            link_duplicate(tfs, dup);
+        filesystem_flush(fs, ignore_status);
+    }
     closure_finish();
 }
 
+/* Dynamic loader cache
+ *
+ * With "loader_cache:t" in the manifest, the shared libraries needed by the program are resolved
+ * against the image contents, following the DT_NEEDED entries of the program and (recursively) of
+ * each library found. The image paths of the libraries are then stored in the root tuple as the
+ * "loader_cache" vector, in breadth-first order, so that the kernel can read them into its page
+ * cache when the program is started, instead of waiting for the dynamic loader to open and map
+ * them one by one. */
+#define LOADER_CACHE_SYMLINK_MAX    16
+#define LOADER_CACHE_PATH_DEPTH     64
+
+/* Looks up an absolute path in the image, following symbolic links; the resolved path is stored
+ * in "resolved" (of size PATH_MAX). */
+static tuple image_lookup(tuple root, const char *path, char *resolved, int links)
+{
+    tuple dirs[LOADER_CACHE_PATH_DEPTH];
+    int lens[LOADER_CACHE_PATH_DEPTH];
+    int depth = 0;
+    tuple n = root;
+    int len = 0;
+    resolved[0] = '\0';
+    while (*path) {
+        while (*path == '/')
+            path++;
+        const char *end = strchrnul(path, '/');
+        int clen = end - path;
+        if ((clen == 0) || ((clen == 1) && (path[0] == '.'))) {
+            path = end;
+            continue;
+        }
+        if ((clen == 2) && (path[0] == '.') && (path[1] == '.')) {
+            if (depth > 0) {
+                depth--;
+                n = dirs[depth];
+                len = lens[depth];
+                resolved[len] = '\0';
+            }
+            path = end;
+            continue;
+        }
+        tuple c = children(n);
+        if (!c || (depth == LOADER_CACHE_PATH_DEPTH) || (len + 1 + clen >= PATH_MAX))
+            return 0;
+        tuple child = get_tuple(c, intern(alloca_wrap_buffer(path, clen)));
+        if (!child)
+            return 0;
+        buffer target = get_string(child, sym(linktarget));
+        if (target) {
+            if (links == LOADER_CACHE_SYMLINK_MAX)
+                return 0;
+            /* restart the lookup from the link target followed by the rest of the path */
+            char p[PATH_MAX];
+            int plen = (*(char *)buffer_ref(target, 0) == '/') ? 0 : len;
+            if (plen + 1 + buffer_length(target) + strlen(end) >= PATH_MAX)
+                return 0;
+            runtime_memcpy(p, resolved, plen);
+            p[plen++] = '/';
+            runtime_memcpy(p + plen, buffer_ref(target, 0), buffer_length(target));
+            plen += buffer_length(target);
+            strcpy(p + plen, end);
+            return image_lookup(root, p, resolved, links + 1);
+        }
+        dirs[depth] = n;
+        lens[depth++] = len;
+        resolved[len++] = '/';
+        runtime_memcpy(resolved + len, path, clen);
+        len += clen;
+        resolved[len] = '\0';
+        n = child;
+        path = end;
+    }
+    return n;
+}
+
+static void loader_cache_add_dirs(heap h, vector dirs, const char *list, const char *origin)
+{
+    while (*list) {
+        const char *end = strchrnul(list, ':');
+        int len = end - list;
+        if (len > 0) {
+            buffer b = allocate_buffer(h, len + 1);
+            assert(b != INVALID_ADDRESS);
+            if ((len >= 7) && !runtime_memcmp(list, "$ORIGIN", 7)) {
+                buffer_write(b, origin, strlen(origin));
+                buffer_write(b, list + 7, len - 7);
+            } else {
+                buffer_write(b, list, len);
+            }
+            vector_push(dirs, b);
+        }
+        list = *end ? end + 1 : end;
+    }
+}
+
+static void *elf_vaddr_to_offset(Elf64_Ehdr *e, u64 size, u64 vaddr)
+{
+    foreach_phdr(e, p) {
+        if ((p->p_type == PT_LOAD) && (vaddr >= p->p_vaddr) &&
+            (vaddr < p->p_vaddr + p->p_filesz) && (p->p_offset + p->p_filesz <= size))
+            return (void *)e + p->p_offset + (vaddr - p->p_vaddr);
+    }
+    return 0;
+}
+
+/* Reads the names of the libraries needed by an ELF file, and its library search path; returns
+ * the ELF machine type, or 0 if the file is not a 64-bit ELF file. */
+static u16 loader_cache_parse_elf(heap h, const char *host_path, const char *origin,
+                                  vector needed, vector dirs)
+{
+    int fd = open(host_path, O_RDONLY);
+    if (fd < 0)
+        halt("loader_cache: couldn't open %s: %s\n", host_path, errno_sstring());
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        halt("loader_cache: couldn't stat %s: %s\n", host_path, errno_sstring());
+    u64 size = st.st_size;
+    u16 machine = 0;
+    if (size < sizeof(Elf64_Ehdr))
+        goto out;
+    Elf64_Ehdr *e = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (e == MAP_FAILED)
+        halt("loader_cache: couldn't map %s: %s\n", host_path, errno_sstring());
+    if ((e->e_ident[EI_MAG0] != ELFMAG0) || (e->e_ident[EI_MAG1] != ELFMAG1) ||
+        (e->e_ident[EI_MAG2] != ELFMAG2) || (e->e_ident[EI_MAG3] != ELFMAG3) ||
+        (e->e_ident[EI_CLASS] != ELFCLASS64) ||
+        (e->e_phoff + e->e_phnum * e->e_phentsize > size))
+        goto unmap;
+    machine = e->e_machine;
+    Elf64_Dyn *dyn = 0;
+    int ndyn = 0;
+    foreach_phdr(e, p) {
+        if ((p->p_type == PT_DYNAMIC) && (p->p_offset + p->p_filesz <= size)) {
+            dyn = (void *)e + p->p_offset;
+            ndyn = p->p_filesz / sizeof(Elf64_Dyn);
+        }
+    }
+    const char *strtab = 0;
+    for (int i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_STRTAB)
+            strtab = elf_vaddr_to_offset(e, size, dyn[i].d_un.d_ptr);
+    }
+    if (!strtab)
+        goto unmap;
+    boolean runpath = false;
+    for (int i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        if (dyn[i].d_tag == DT_RUNPATH)
+            runpath = true;
+    }
+    for (int i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++) {
+        const char *s = strtab + dyn[i].d_un.d_val;
+        switch (dyn[i].d_tag) {
+        case DT_NEEDED:
+            vector_push(needed, strdup(s));
+            break;
+        case DT_RPATH:
+            /* ignored by the dynamic loader if DT_RUNPATH is present */
+            if (!runpath)
+                loader_cache_add_dirs(h, dirs, s, origin);
+            break;
+        case DT_RUNPATH:
+            loader_cache_add_dirs(h, dirs, s, origin);
+            break;
+        }
+    }
+  unmap:
+    munmap(e, size);
+  out:
+    close(fd);
+    return machine;
+}
+
+static sstring loader_cache_triplet(u16 machine)
+{
+    switch (machine) {
+    case EM_X86_64:
+        return ss("x86_64-linux-gnu");
+    case EM_AARCH64:
+        return ss("aarch64-linux-gnu");
+    case EM_RISCV:
+        return ss("riscv64-linux-gnu");
+    }
+    return sstring_empty();
+}
+
+static buffer loader_cache_path(heap h, const char *path)
+{
+    string s = allocate_string(strlen(path));
+    assert(s != INVALID_ADDRESS);
+    buffer_write(s, path, strlen(path));
+    return s;
+}
+
+/* Resolves a library name against the search path; returns the image path of the library, or
+ * null if not found. */
+static buffer loader_cache_find(heap h, tuple root, vector dirs, u16 machine, const char *name)
+{
+    char path[PATH_MAX], resolved[PATH_MAX];
+    if (strchr(name, '/'))
+        return image_lookup(root, name, resolved, 0) ? loader_cache_path(h, resolved) : 0;
+    buffer dir;
+    vector_foreach(dirs, dir) {
+        snprintf(path, sizeof(path), "%.*s/%s", (int)buffer_length(dir), (char *)buffer_ref(dir, 0),
+                 name);
+        tuple n = image_lookup(root, path, resolved, 0);
+        if (n && get_tuple(n, sym(contents)))
+            return loader_cache_path(h, resolved);
+    }
+
+    /* default search path */
+    sstring triplet = loader_cache_triplet(machine);
+    const char *defaults[] = { "/lib64", "/usr/lib64", "/lib", "/usr/lib" };
+    for (int i = -2; i < (int)(sizeof(defaults) / sizeof(defaults[0])); i++) {
+        if (i < 0) {
+            if (sstring_is_empty(triplet))
+                continue;
+            snprintf(path, sizeof(path), "%s/%.*s/%s", (i == -2) ? "/lib" : "/usr/lib",
+                     (int)triplet.len, triplet.ptr, name);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", defaults[i], name);
+        }
+        tuple n = image_lookup(root, path, resolved, 0);
+        if (n && get_tuple(n, sym(contents)))
+            return loader_cache_path(h, resolved);
+    }
+    return 0;
+}
+
+/* Parses the library at an image path and queues the image paths of its needed libraries;
+ * returns the ELF machine type. */
+static u16 loader_cache_scan(heap h, const char *target_root, tuple root, buffer image_path,
+                             vector env_dirs, vector queue)
+{
+    char resolved[PATH_MAX];
+    tuple n = image_lookup(root, buffer_to_cstring(image_path), resolved, 0);
+    tuple contents = n ? get_tuple(n, sym(contents)) : 0;
+    buffer host = contents ? get_string(contents, sym(host)) : 0;
+    if (!host)
+        return 0;
+    struct stat st;
+    buffer target_name = lookup_file(h, target_root, host, &st);
+    char *origin = strdup(resolved);
+    assert(origin);
+    *strrchr(origin, '/') = '\0';
+    vector needed = allocate_vector(h, 8);
+    vector dirs = allocate_vector(h, 8);
+    buffer dir;
+    vector_foreach(env_dirs, dir)
+        vector_push(dirs, dir);
+    u16 machine = loader_cache_parse_elf(h, buffer_to_cstring(target_name ? target_name : host),
+                                         origin, needed, dirs);
+    char *name;
+    vector_foreach(needed, name) {
+        buffer lib = loader_cache_find(h, root, dirs, machine, name);
+        if (lib)
+            vector_push(queue, lib);
+        else
+            rprintf("loader_cache: library %s (needed by %b) not found in image\n",
+                    sstring_from_cstring(name, PATH_MAX), image_path);
+        free(name);
+    }
+    deallocate_vector(needed);
+    deallocate_vector(dirs);
+    free(origin);
+    if (target_name)
+        deallocate_buffer(target_name);
+    return machine;
+}
+
+static value loader_cache(heap h, const char *target_root, tuple root)
+{
+    buffer program = get_string(root, sym(program));
+    if (!program)
+        halt("loader_cache: program not specified\n");
+    vector env_dirs = allocate_vector(h, 4);
+    tuple env = get_tuple(root, sym(environment));
+    buffer ld_path = env ? get_string(env, sym(LD_LIBRARY_PATH)) : 0;
+    if (ld_path)
+        loader_cache_add_dirs(h, env_dirs, buffer_to_cstring(ld_path), "");
+    vector queue = allocate_vector(h, 16);
+    vector_push(queue, program);
+    vector libs = allocate_tagged_vector(16);
+    assert(libs != INVALID_ADDRESS);
+    for (int i = 0; i < vector_length(queue); i++) {
+        buffer path = vector_get(queue, i);
+        boolean dup = false;
+        for (int j = 0; j < i; j++) {
+            if (buffer_compare(path, vector_get(queue, j))) {
+                dup = true;
+                break;
+            }
+        }
+        if (dup)
+            continue;
+        loader_cache_scan(h, target_root, root, path, env_dirs, queue);
+        if (i > 0)
+            vector_push(libs, path);
+    }
+    rprintf("loader_cache: %d libraries\n", vector_length(libs));
+    return libs;
+}
+
 static void write_blob_padded(descriptor out, u8 *blob, size_t len, boolean with_trailer)
 {
     assert(write(out, blob, len) == len);
@@ -623,6 +1168,7 @@ int main(int argc, char **argv)
     long long img_size = 0;
     long long coredumplimit = 0;
     boolean empty_fs = false;
+    boolean compress = false;
     const char *uefi_loader = NULL;
     heap h = init_process_runtime();
     cmdline_tuples = allocate_vector(h, 4);
@@ -733,6 +1279,7 @@ int main(int argc, char **argv)
 
     init_pagecache(h, h, PAGESIZE);
     mkfs_write_status = closure_func(h, io_status_handler, mkfs_write_handler);
+    mkfs_extent_status = closure_func(h, status_handler, mkfs_extent_write_handler);
 
     if (root && !empty_fs) {
         /* apply commandline tuples to root */
@@ -755,6 +1302,20 @@ int main(int argc, char **argv)
             deallocate_buffer((buffer)v);
         }
 
+        /* image-wide default for file compression (see get_file_path()) */
+        v = get(root, sym(compress));
+        if (v) {
+            set(root, sym(compress), 0); /* consume it, kernel doesn't need it */
+            compress = is_string(v) && !buffer_strcmp(v, "t");
+            deallocate_value(v);
+        }
+
+        v = get(root, sym(loader_cache));
+        if (v && is_string(v) && !buffer_strcmp(v, "t")) {
+            set(root, sym(loader_cache), loader_cache(h, target_root, root));
+            deallocate_value(v);
+        }
+
         v = get(root, sym(coredumplimit));
         if (v) {
             char *cdl = buffer_to_cstring((buffer)v);
@@ -791,8 +1352,11 @@ int main(int argc, char **argv)
             }
         }
         if (boot) {
+            /* The boot FS is never written to at run time, so its files (kernel and klibs) can be
+             * compressed too; the boot loaders decompress the kernel as its extents are read. */
             create_filesystem(h, SECTOR_SIZE, BOOTFS_SIZE, closure(h, bwrite, out, offset), false,
-                              sstring_empty(), closure(h, fsc, h, out, boot, target_root));
+                              sstring_empty(), closure(h, fsc, h, out, boot, target_root, true,
+                                                       compress));
             offset += BOOTFS_SIZE;
 
             /* Remove tuple from root, so it doesn't end up in the root FS. */
@@ -808,7 +1372,8 @@ int main(int argc, char **argv)
                       closure(h, bwrite, out, offset),
                       false,
                       label,
-                      closure(h, fsc, h, out, root, target_root));
+                      closure(h, fsc, h, out, root, target_root,
+                              root && get(root, sym(readonly_rootfs)), compress));
 
     off_t current_size = lseek(out, 0, SEEK_END);
     if (current_size < 0) {
@@ -21,10 +21,13 @@
 #include <string.h>
 #include <pthread.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 
 #define FUSE_USE_VERSION 26
 #define _FILE_OFFSET_BITS 64
-#include <fuse.h>
+#include <fuse/fuse.h>  /* not src/fs/fuse.h */
 
 //#define TFS_FUSE_DEBUG
 #ifdef TFS_FUSE_DEBUG
@@ -35,8 +38,20 @@
 
 #define FLUSH_TIMEOUT 5
 
+#define READAHEAD_SIZE  (1 * MB)
+
 static int dfd;
 static heap h;
+static boolean readonly;
+
+/* The filesystem image is mapped in memory, so that storage reads are plain copies (writes go
+ * through the image file descriptor, whose data is shared with the mapping). On a read-only mount,
+ * file reads copy data directly from the mapping under the read lock, so that they can be served
+ * in parallel by the FUSE threads. */
+static struct {
+    u8 *base;                   /* start of the filesystem */
+    u64 length;                 /* bytes mapped from base */
+} image;
 
 static filesystem rootfs;
 static tuple cwd;
@@ -144,6 +159,8 @@ int rv_from_fs_status(fs_status s)
         return -ELOOP;
     case FS_STATUS_NAMETOOLONG:
         return -ENAMETOOLONG;
+    case FS_STATUS_READONLY:
+        return -EROFS;
     default:
         return 0;
     }
@@ -205,18 +222,23 @@ closure_function(2, 1, void, req_handle,
     u64 total;
     struct iovec iov[IOV_MAX];
     int iov_count;
-    boolean write;
     ssize_t xfer;
 
     tfs_fuse_debug("storage request %d, blocks %R\n", req->op, req->blocks);
     switch (req->op) {
     case STORAGE_OP_READSG:
+        offset = req->blocks.start << SECTOR_OFFSET;
+        total = range_span(req->blocks) << SECTOR_OFFSET;
+        if (offset + total > image.length) {
+            apply(req->completion, timm("result", "end of file"));
+            return;
+        }
+        sg_copy_from_buf(image.base + offset, req->data, total);
+        break;
     case STORAGE_OP_WRITESG:
-        write = (req->op == STORAGE_OP_WRITESG);
         sg = req->data;
         offset = bound(fs_offset) + (req->blocks.start << SECTOR_OFFSET);
         total = range_span(req->blocks) << SECTOR_OFFSET;
-        lseek(bound(d), offset, SEEK_SET);
         while (total > 0) {
             iov_count = 0;
             xfer = 0;
@@ -227,24 +249,13 @@ closure_function(2, 1, void, req_handle,
                 if ((++iov_count == IOV_MAX) || (xfer == total))
                     break;
             }
-            if (write) {
-                xfer = writev(bound(d), iov, iov_count);
-                if (xfer < 0 && errno != EINTR) {
-                    apply(req->completion,
-                          timm("result", "write error %s", errno_sstring()));
-                    return;
-                }
-            } else {
-                xfer = readv(bound(d), iov, iov_count);
-                if (xfer < 0 && errno != EINTR) {
-                    apply(req->completion,
-                          timm("result", "read error %s", errno_sstring()));
-                    return;
-                }
-                if (xfer == 0) {
-                    apply(req->completion, timm("result", "end of file"));
-                    return;
-                }
+            xfer = pwritev(bound(d), iov, iov_count, offset);
+            if (xfer < 0) {
+                if (errno == EINTR)
+                    continue;
+                apply(req->completion,
+                      timm("result", "write error %s", errno_sstring()));
+                return;
             }
             sg_consume(sg, xfer);
             offset += xfer;
@@ -377,6 +388,51 @@ closure_func_basic(file_io, int, file_read,
     return rv;
 }
 
+/* Advises the kernel to read the image area following the data just copied, which is likely to be
+ * read next if the file is read sequentially. */
+static void image_readahead(u64 offset)
+{
+    if (offset >= image.length)
+        return;
+    u8 *p = image.base + offset;
+    u64 misalign = u64_from_pointer(p) & MASK(PAGELOG);
+    madvise(p - misalign, MIN(READAHEAD_SIZE, image.length - offset) + misalign, MADV_WILLNEED);
+}
+
+closure_function(3, 2, boolean, file_read_direct_run,
+                 void *, dest, u64, offset, u64, length,
+                 range blocks, u64 storage_block)
+{
+    range r = range_lshift(blocks, SECTOR_OFFSET);
+    range q = range_intersection(r, irangel(bound(offset), bound(length)));
+    void *dest = bound(dest) + (q.start - bound(offset));
+    if (storage_block == INVALID_PHYSICAL) {
+        zero(dest, range_span(q));
+        return true;
+    }
+    u64 src = (storage_block << SECTOR_OFFSET) + (q.start - r.start);
+    if (src + range_span(q) > image.length)
+        return false;
+    runtime_memcpy(dest, image.base + src, range_span(q));
+    if (q.end == bound(offset) + bound(length))
+        image_readahead(src + range_span(q));
+    return true;
+}
+
+/* Called with the read lock held on a read-only filesystem; returns -EAGAIN if the data cannot be
+ * copied directly from the image (e.g. compressed extents). */
+static int file_read_direct(file f, void *dest, u64 length, u64 offset)
+{
+    if (offset >= f->length)
+        return 0;
+    length = MIN(length, f->length - offset);
+    range blocks = range_rshift_pad(irangel(offset, length), SECTOR_OFFSET);
+    if (!tfsfile_map_blocks(f->fsf, blocks,
+                            stack_closure(file_read_direct_run, dest, offset, length)))
+        return -EAGAIN;
+    return length;
+}
+
 closure_function(5, 1, void, file_write_complete,
                  file, f, sg_list, sg, u64, length, boolean, is_file_offset, int *, rv,
                  status s)
@@ -562,6 +618,15 @@ static int tfs_read(const char *path, char *buf, size_t size, off_t off, struct
 {
     tfs_fuse_debug("%s: path %s\n", __func__, path);
     int rv;
+    if (readonly) {
+        pthread_rwlock_rdlock(&rwlock);
+        file f = resolve_fd_noret(fi->fh);
+        rv = (f && (f->f.type == FDESC_TYPE_REGULAR)) ? file_read_direct(f, buf, size, off) :
+                                                        -EAGAIN;
+        pthread_rwlock_unlock(&rwlock);
+        if (rv != -EAGAIN)
+            return rv;
+    }
     pthread_rwlock_wrlock(&rwlock);
     int fd = fi->fh;
     fdesc f = resolve_fd(fd);
@@ -580,6 +645,8 @@ out:
 static int tfs_write(const char *path, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
 {
     tfs_fuse_debug("%s: path %s\n", __func__, path);
+    if (readonly)
+        return -EROFS;
     pthread_rwlock_wrlock(&rwlock);
     int fd = fi->fh;
     fdesc f = resolve_fd(fd);
@@ -839,6 +906,8 @@ static inline timestamp time_from_timespec(const struct timespec *t)
 
 static int tfs_utimens(const char *filename, const struct timespec tv[2])
 {
+    if (readonly)
+        return -EROFS;
     timestamp atime =
         tv ? time_from_timespec(&tv[0]) : now(CLOCK_ID_REALTIME);
     timestamp mtime =
@@ -908,6 +977,7 @@ void usage(const char *prog)
     fprintf(stderr, "  -f\t\t\tStay in foreground\n");
     fprintf(stderr, "  -d\t\t\tFuse debug messages\n");
     fprintf(stderr, "  -b\t\t\tMount boot partition\n");
+    fprintf(stderr, "  -r\t\t\tMount read-only\n");
     exit(EXIT_FAILURE);
 }
 
@@ -916,15 +986,19 @@ int main(int argc, char **argv)
     int partition = PARTITION_ROOTFS;
     if (argc < 3)
         usage(argv[0]);
-    /* if -b is passed, remove it from the args for fuse */
+    /* if -b or -r are passed, remove them from the args for fuse */
     for (int i = 1; i < argc - 2; i++) {
-        if (strcmp(argv[i], "-b") != 0)
+        if (strcmp(argv[i], "-b") == 0)
+            partition = PARTITION_BOOTFS;
+        else if (strcmp(argv[i], "-r") == 0)
+            readonly = true;
+        else
             continue;
-        partition = PARTITION_BOOTFS;
-        memmove(&argv[i], &argv[i+1], (argc - i+1) * sizeof(char *));
+        memmove(&argv[i], &argv[i+1], (argc - i) * sizeof(char *));
         argc--;
+        i--;
     }
-    int fd = open(argv[argc - 1], O_RDWR);
+    int fd = open(argv[argc - 1], readonly ? O_RDONLY : O_RDWR);
     if (fd < 0) {
         fprintf(stderr, "couldn't open fs image file %s: %s\n", argv[argc - 1],
             strerror(errno));
@@ -934,13 +1008,31 @@ int main(int argc, char **argv)
     --argc;
     h = init_process_runtime();
     init_pagecache(h, h, PAGESIZE);
-    u64 length;
+    u64 length = 0;
     u64 offset = get_fs_offset(fd, partition, false, &length);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        exit(EXIT_FAILURE);
+    }
+    if (st.st_size <= offset) {
+        fprintf(stderr, "no filesystem found in %s\n", argv[argc]);
+        exit(EXIT_FAILURE);
+    }
+    if (!length)
+        length = st.st_size - offset;
+    u8 *base = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        exit(EXIT_FAILURE);
+    }
+    image.base = base + offset;
+    image.length = MIN(length, st.st_size - offset);
     create_filesystem(h,
                       SECTOR_SIZE,
                       length,
                       closure(h, req_handle, fd, offset),
-                      0, sstring_null(),
+                      readonly, sstring_null(),
                       closure_func(h, filesystem_complete, fsc));
     fdallocator = create_id_heap(h, h, 0, infinity, 1, false);
     files = allocate_vector(h, 64);
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+# Decode the binary tracepoint stream served by the kernel at
+# http://<host>:9090/tracelog/binary, merging the per-CPU records by time.
+#
+# usage: decode-tracelog.py <file>   (or read from stdin)
+
+import struct
+import sys
+
+MAGIC = 0x5054534e
+VERSION = 1
+
+def read(f, fmt):
+    size = struct.calcsize(fmt)
+    data = f.read(size)
+    if len(data) < size:
+        raise EOFError
+    return struct.unpack(fmt, data)
+
+def parse_fields(spec):
+    fields = []
+    for f in spec.split():
+        name, _, ftype = f.partition(':')
+        fields.append((name, ftype or "u64"))
+    return fields
+
+def format_arg(value, ftype):
+    if ftype == "s64":
+        return str(value - (1 << 64) if value & (1 << 63) else value)
+    if ftype == "x64":
+        return hex(value)
+    return str(value)
+
+def decode(f):
+    magic, version, ncpus, ntp, _ = read(f, '<IHHII')
+    if magic != MAGIC:
+        sys.exit('bad magic 0x%x' % magic)
+    if version != VERSION:
+        sys.exit('unsupported stream version %d' % version)
+    tracepoints = {}
+    for _ in range(ntp):
+        id, name_len, fields_len, _ = read(f, '<HHHH')
+        strings = f.read((name_len + fields_len + 7) & ~7)
+        name = strings[:name_len].decode()
+        fields = strings[name_len:name_len + fields_len].decode()
+        tracepoints[id] = (name, parse_fields(fields))
+
+    events = []
+    while True:
+        try:
+            cpu, _, lost, nwords = read(f, '<IIQQ')
+        except EOFError:
+            break
+        if lost:
+            print('cpu %d: %d records lost' % (cpu, lost), file=sys.stderr)
+        words = read(f, '<%dQ' % nwords)
+        i = 0
+        while i < nwords:
+            t = words[i]
+            id = words[i + 1] & 0xffff
+            nargs = (words[i + 1] >> 16) & 0xffff
+            events.append((t, cpu, id, words[i + 2:i + 2 + nargs]))
+            i += 2 + nargs
+
+    # timestamps are 32.32 fixed-point seconds
+    events.sort(key=lambda e: e[0])
+    for t, cpu, id, args in events:
+        name, fields = tracepoints.get(id, ('tracepoint_%d' % id, []))
+        out = []
+        for n, a in enumerate(args):
+            fname, ftype = fields[n] if n < len(fields) else ('arg%d' % n, 'x64')
+            out.append('%s=%s' % (fname, format_arg(a, ftype)))
+        print('%d.%09d %3d %s %s' % (t >> 32, ((t & 0xffffffff) * 1000000000) >> 32,
+                                     cpu, name, ' '.join(out)))
+
+if __name__ == '__main__':
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], 'rb') as f:
+            decode(f)
+    else:
+        decode(sys.stdin.buffer)